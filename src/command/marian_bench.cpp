@@ -0,0 +1,332 @@
+#include "marian.h"
+#include "common/config_parser.h"
+#include "common/file_stream.h"
+#include "common/perf_counters.h"
+#include "common/timer.h"
+#include "common/utils.h"
+#include "translator/beam_search.h"
+#include "translator/request_capture.h"
+#include "translator/translator.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Decoding benchmark: loads the model once for every combination of --bench-gemm-types, --bench-threads and
+// --bench-beam-sizes and decodes batches of all combinations of --bench-batch-sizes and --bench-lengths, either of
+// synthetic sentences or of the lines of --bench-input. Writes one JSON object per combination with the latency
+// percentiles of the batches, the tokens per second and the memory, e.g.
+//   ./marian-bench -m model.npz -v vocab.spm vocab.spm --cpu-threads 1 --bench-gemm-types float32 packed8 \
+//       --bench-batch-sizes 1 16 --bench-lengths 16 64 --bench-output bench.jsonl
+// With --bench-counters on the CPU, the objects also have the hardware counters of the timed batches, see
+// PerfCounters, e.g. to tell whether a GEMM type is compute-bound or memory-bound.
+// With --bench-replay, the requests captured by --capture-slow-ms are decoded again instead, batch by batch as they
+// were formed, with one JSON object per request. Combined with --profile-nodes, this shows where a slow request spent
+// its time; batches that are fast when replayed alone were slow because of contention with other requests.
+
+namespace {
+using namespace marian;
+
+// Peak resident memory of the process in bytes, 0 where it is not available
+size_t peakResidentMemory() {
+#ifndef _WIN32
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss; // bytes
+#else
+    return (size_t)usage.ru_maxrss * 1024; // kilobytes
+#endif
+#endif
+  return 0;
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double>& sorted, double p) {
+  if(sorted.empty())
+    return 0.;
+  size_t rank = (size_t)std::ceil(p / 100. * sorted.size());
+  return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return percentile(values, 50);
+}
+
+std::string quote(const std::string& s) {
+  std::string quoted = "\"";
+  for(char c : s) {
+    if(c == '"' || c == '\\')
+      quoted.push_back('\\');
+    quoted.push_back(c);
+  }
+  return quoted + "\"";
+}
+
+// batchSize sentences of length - 1 arbitrary words from the vocabulary, the end-of-sentence is added when decoding
+std::vector<Words> syntheticSentences(Ptr<Vocab> vocab, size_t batchSize, size_t length) {
+  std::vector<Words> sentences(batchSize);
+  size_t k = 0;
+  for(auto& words : sentences) {
+    while(words.size() + 1 < length) {
+      auto word = Word::fromWordIndex((k++ * 7919 + 3) % vocab->size());
+      if(word != vocab->getEosId() && word != vocab->getUnkId())
+        words.push_back(word);
+    }
+  }
+  return sentences;
+}
+
+// The next batchSize lines of the encoded input, starting over at its end
+std::vector<Words> realSentences(const std::vector<Words>& lines, size_t batchSize, size_t& next) {
+  std::vector<Words> sentences;
+  for(size_t i = 0; i < batchSize; ++i)
+    sentences.push_back(lines[next++ % lines.size()]);
+  return sentences;
+}
+
+// Options of a captured request that form exactly its batch of size sentences again
+std::string replayOverrides(const std::string& overrides, size_t size) {
+  YAML::Node node = YAML::Load(overrides);
+  if(!node.IsMap())
+    node = YAML::Node(YAML::NodeType::Map);
+  node["mini-batch"] = size;
+  node["mini-batch-words"] = 0;
+  node["maxi-batch"] = 1;
+  node["maxi-batch-sort"] = "none";
+  YAML::Emitter out;
+  out << node;
+  return out.c_str();
+}
+
+// Decodes the requests of --bench-replay again, --bench-warmup + --bench-batches times each
+void replay(Ptr<Options> options, std::ostream& out) {
+  auto requests = RequestCapture::read(options->get<std::string>("bench-replay"));
+  LOG(info, "[bench] Replaying {} captured requests", requests.size());
+  auto service = New<TranslateService<BeamSearch>>(options->with("warmup-batch-sizes", std::vector<size_t>(),
+                                                                 "translation-cache", (size_t)0,
+                                                                 "capture-slow-ms", (size_t)0));
+  auto shortlist = options->get<std::vector<std::string>>("shortlist", {});
+  size_t numBatches = std::max<size_t>(1, options->get<size_t>("bench-batches"));
+  size_t numWarmup = options->get<size_t>("bench-warmup");
+
+  for(size_t r = 0; r < requests.size(); ++r) {
+    const auto& request = requests[r];
+    if(request.shortlist != shortlist)
+      LOG(warn, "[bench] Request {} was captured with --shortlist {}, but is replayed with {}",
+          r, utils::join(request.shortlist, " "), utils::join(shortlist, " "));
+    auto lines = utils::split(request.input, "\n", /*keepEmpty=*/true);
+
+    std::vector<std::vector<double>> seconds(request.batches.size()); // [batch][run]
+    for(size_t i = 0; i < numWarmup + numBatches; ++i) {
+      for(size_t b = 0; b < request.batches.size(); ++b) {
+        const auto& batch = request.batches[b];
+        auto overrides = replayOverrides(request.overrides, batch.sentences.size());
+        timer::Timer timer;
+        if(!request.input.empty()) {
+          std::vector<std::string> batchLines;
+          for(auto id : batch.sentences)
+            batchLines.push_back(lines[id]);
+          service->translateLines(utils::join(batchLines, "\n"), overrides);
+        } else {
+          std::vector<std::vector<Words>> inputs;
+          for(const auto& stream : request.ids) {
+            inputs.emplace_back();
+            for(auto id : batch.sentences)
+              inputs.back().push_back(stream[id]);
+          }
+          service->translateIds(inputs, overrides);
+        }
+        if(i >= numWarmup)
+          seconds[b].push_back(timer.elapsed());
+      }
+    }
+
+    auto list = [](const std::vector<double>& values) {
+      std::vector<std::string> strings;
+      for(auto value : values)
+        strings.push_back(std::to_string(value));
+      return "[" + utils::join(strings, ", ") + "]";
+    };
+    std::vector<double> captured, replayed;
+    size_t words = 0;
+    for(size_t b = 0; b < request.batches.size(); ++b) {
+      captured.push_back(request.batches[b].seconds);
+      replayed.push_back(median(seconds[b]));
+      words += request.batches[b].words;
+    }
+    out << "{\"request\": " << r
+        << ", \"batches\": " << request.batches.size()
+        << ", \"src_words\": " << words
+        << ", \"captured_seconds\": " << request.seconds
+        << ", \"replay_seconds\": " << std::accumulate(replayed.begin(), replayed.end(), 0.)
+        << ", \"captured_batch_seconds\": " << list(captured)
+        << ", \"replay_batch_seconds\": " << list(replayed)
+        << "}" << std::endl;
+  }
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  using namespace marian;
+
+  ConfigParser parser(cli::mode::translation);
+  const std::string group = "Benchmark options";
+  parser.addOption<std::vector<size_t>>("--bench-batch-sizes", group,
+      "Batch sizes of the benchmark in sentences", std::vector<size_t>({1, 8, 32}));
+  parser.addOption<std::vector<size_t>>("--bench-beam-sizes", group,
+      "Beam sizes of the benchmark, empty for --beam-size", std::vector<size_t>());
+  parser.addOption<std::vector<size_t>>("--bench-lengths", group,
+      "Lengths of the synthetic source sentences in tokens including the end of sentence",
+      std::vector<size_t>({16, 64}));
+  parser.addOption<std::string>("--bench-input", group,
+      "Decode the lines of this file instead of synthetic sentences, --bench-lengths is ignored then", "");
+  parser.addOption<std::vector<std::string>>("--bench-gemm-types", group,
+      "GEMM types of the benchmark on the CPU, see --gemm-type, empty for --gemm-type", std::vector<std::string>());
+  parser.addOption<std::vector<size_t>>("--bench-threads", group,
+      "Values of --cpu-intra-op-threads of the benchmark on the CPU, empty for --cpu-intra-op-threads",
+      std::vector<size_t>());
+  parser.addOption<size_t>("--bench-batches", group,
+      "Number of timed batches per combination", 20);
+  parser.addOption<size_t>("--bench-warmup", group,
+      "Number of batches per combination that are decoded before the timed ones", 2);
+  parser.addOption<std::string>("--bench-output", group,
+      "Write one JSON object per combination to this file", "stdout");
+  parser.addOption<bool>("--bench-counters", group,
+      "Add the instructions per cycle, last-level cache misses and estimated memory bandwidth of the decoding threads "
+      "from the hardware counters of the CPU, Linux only", false);
+  parser.addOption<std::string>("--bench-replay", group,
+      "Decode the requests of this file of --capture-slow-ms again, batch by batch, instead of the combinations", "");
+  auto options = parser.parseOptions(argc, argv, /*validate=*/true);
+
+  if(!options->get<std::string>("bench-replay").empty()) {
+    auto outPath = options->get<std::string>("bench-output");
+    UPtr<std::ostream> out(outPath == "stdout" ? new std::ostream(std::cout.rdbuf()) : new io::OutputFileStream(outPath));
+    replay(options, *out);
+    return 0;
+  }
+
+  auto vocabPaths = options->get<std::vector<std::string>>("vocabs");
+  auto maxVocabs = options->get<std::vector<int>>("dim-vocabs");
+  std::vector<Ptr<Vocab>> srcVocabs;
+  for(size_t i = 0; i + 1 < vocabPaths.size(); ++i) {
+    srcVocabs.push_back(New<Vocab>(options, i));
+    srcVocabs.back()->load(vocabPaths[i], maxVocabs[i]);
+  }
+
+  std::vector<Words> inputLines;
+  auto inputPath = options->get<std::string>("bench-input");
+  if(!inputPath.empty()) {
+    ABORT_IF(srcVocabs.size() != 1, "--bench-input requires a model with a single source");
+    io::InputFileStream in(inputPath);
+    std::string line;
+    while(io::getline(in, line))
+      inputLines.push_back(srcVocabs[0]->encode(line, /*addEOS=*/false, /*inference=*/true));
+    ABORT_IF(inputLines.empty(), "--bench-input {} is empty", inputPath);
+  }
+
+  auto gemmTypes = options->get<std::vector<std::string>>("bench-gemm-types");
+  auto threads = options->get<std::vector<size_t>>("bench-threads");
+  bool onCpu = Config::getDevices(options).front().type == DeviceType::cpu;
+  if(!onCpu && (!gemmTypes.empty() || !threads.empty()))
+    LOG(warn, "[bench] --bench-gemm-types and --bench-threads only apply on the CPU and are ignored");
+  if(!onCpu || gemmTypes.empty())
+    gemmTypes = {options->get<std::string>("gemm-type")};
+  if(!onCpu || threads.empty())
+    threads = {options->get<size_t>("cpu-intra-op-threads", 1)};
+
+  auto beamSizes = options->get<std::vector<size_t>>("bench-beam-sizes");
+  if(beamSizes.empty())
+    beamSizes = {options->get<size_t>("beam-size")};
+  auto lengths = inputLines.empty() ? options->get<std::vector<size_t>>("bench-lengths") : std::vector<size_t>({0});
+  auto batchSizes = options->get<std::vector<size_t>>("bench-batch-sizes");
+  ABORT_IF(batchSizes.empty(), "--bench-batch-sizes must not be empty");
+  size_t numBatches = std::max<size_t>(1, options->get<size_t>("bench-batches"));
+  size_t numWarmup = options->get<size_t>("bench-warmup");
+  bool withCounters = onCpu && options->get<bool>("bench-counters");
+
+  auto outPath = options->get<std::string>("bench-output");
+  UPtr<std::ostream> out(outPath == "stdout" ? new std::ostream(std::cout.rdbuf()) : new io::OutputFileStream(outPath));
+
+  for(const auto& gemmType : gemmTypes) {
+    for(auto numThreads : threads) {
+      for(auto beamSize : beamSizes) {
+        // on-line packing and quantization of a float32 model needs --optimize, packed models ignore it. Every
+        // call of translateIds() below is a single batch, without options to override that would be parsed.
+        auto serviceOptions = options->with("gemm-type", gemmType,
+                                            "optimize", options->get<bool>("optimize") || gemmType != "float32",
+                                            "cpu-intra-op-threads", numThreads,
+                                            "beam-size", beamSize,
+                                            "mini-batch", (int)*std::max_element(batchSizes.begin(), batchSizes.end()),
+                                            "mini-batch-words", 0,
+                                            "maxi-batch", 1,
+                                            "maxi-batch-sort", std::string("none"),
+                                            "warmup-batch-sizes", std::vector<size_t>());
+        // opened before the service, so that its worker threads inherit the counters
+        UPtr<PerfCounters> counters(withCounters ? new PerfCounters(/*inheritThreads=*/true) : nullptr);
+        timer::Timer loadTimer;
+        auto service = New<TranslateService<BeamSearch>>(serviceOptions);
+        double loadSeconds = loadTimer.elapsed();
+
+        for(auto batchSize : batchSizes) {
+          for(auto length : lengths) {
+            size_t next = 0;
+            std::vector<double> seconds;
+            size_t srcTokens = 0, trgTokens = 0;
+            PerfCounters::Values counts;
+            for(size_t i = 0; i < numWarmup + numBatches; ++i) {
+              std::vector<std::vector<Words>> inputs;
+              for(auto vocab : srcVocabs)
+                inputs.push_back(inputLines.empty() ? syntheticSentences(vocab, batchSize, length)
+                                                    : realSentences(inputLines, batchSize, next));
+
+              auto countsBefore = counters ? counters->read() : PerfCounters::Values();
+              timer::Timer timer;
+              auto outputs = service->translateIds(inputs);
+              if(i < numWarmup)
+                continue;
+              seconds.push_back(timer.elapsed());
+              if(counters)
+                counts += counters->read() - countsBefore;
+              for(const auto& words : inputs.front())
+                srcTokens += words.size() + 1; // with the end of sentence
+              for(const auto& output : outputs)
+                trgTokens += output.words.size() + 1;
+            }
+
+            double total = std::accumulate(seconds.begin(), seconds.end(), 0.);
+            std::sort(seconds.begin(), seconds.end());
+            *out << "{\"gemm_type\": " << quote(gemmType)
+                 << ", \"threads\": " << numThreads
+                 << ", \"beam_size\": " << beamSize
+                 << ", \"batch_size\": " << batchSize
+                 << ", \"length\": " << (inputLines.empty() ? std::to_string(length) : quote("input"))
+                 << ", \"batches\": " << seconds.size()
+                 << ", \"load_seconds\": " << loadSeconds
+                 << ", \"latency_mean\": " << total / seconds.size()
+                 << ", \"latency_p50\": " << percentile(seconds, 50)
+                 << ", \"latency_p90\": " << percentile(seconds, 90)
+                 << ", \"latency_p99\": " << percentile(seconds, 99)
+                 << ", \"src_tokens_per_second\": " << srcTokens / total
+                 << ", \"trg_tokens_per_second\": " << trgTokens / total
+                 << ", \"sentences_per_second\": " << batchSize * seconds.size() / total
+                 << ", \"workspace_bytes\": " << service->workspaceHighWater()
+                 << ", \"peak_rss_bytes\": " << peakResidentMemory();
+            if(counters && counters->available())
+              *out << ", \"instructions_per_cycle\": " << counts.ipc()
+                   << ", \"llc_misses\": " << counts.cacheMisses
+                   << ", \"llc_miss_rate\": " << counts.cacheMissRate()
+                   << ", \"est_memory_gb_per_second\": " << counts.bytesFromMemory() / total * 1e-9;
+            *out << "}" << std::endl;
+          }
+        }
+      }
+    }
+  }
+
+  return 0;
+}
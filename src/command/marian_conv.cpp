@@ -1,9 +1,12 @@
 #include "marian.h"
 #include "common/cli_wrapper.h"
+#include "common/binary.h"
+#include "common/sparsity.h"
 #include "tensors/cpu/expression_graph_packable.h"
 #include "onnx/expression_graph_onnx_exporter.h"
 #include "layers/lsh.h"
 #include "data/shortlist.h"
+#include "training/sharded_checkpoint.h"
 #include <sstream>
 
 int main(int argc, char** argv) {
@@ -16,7 +19,7 @@ int main(int argc, char** argv) {
     auto cli = New<cli::CLIWrapper>(
         config,
         "Convert a model in the .npz format and normal memory layout to a mmap-able binary model which could be in normal memory layout or packed memory layout\n"
-        "or convert a text lexical shortlist to a binary shortlist with {--shortlist,-s} option",
+        "or convert a text lexical shortlist (or a binary shortlist in the old unaligned layout) to a mmap-able binary shortlist with {--shortlist,-s} option",
         "Allowed options",
         "Examples:\n"
         "  ./marian-conv -f model.npz -t model.bin --gemm-type packed16");
@@ -24,20 +27,51 @@ int main(int argc, char** argv) {
     cli->add<std::string>("--to,-t", "Output model", "model.bin");
     cli->add<std::string>("--export-as", "Kind of conversion: marian-bin or onnx-{encode,decoder-step,decoder-init,decoder-stop}", "marian-bin");
     cli->add<std::string>("--gemm-type,-g", "GEMM Type to be used: float32, packed16, packed8avx2, packed8avx512, "
-                          "intgemm8, intgemm8ssse3, intgemm8avx2, intgemm8avx512, intgemm16, intgemm16sse2, intgemm16avx2, intgemm16avx512",
+                          "intgemm8, intgemm8ssse3, intgemm8avx2, intgemm8avx512, intgemm16, intgemm16sse2, intgemm16avx2, intgemm16avx512, intgemm8amx, intgemm8ruy, bfloat16, int8gpu",
                           "float32");
+    cli->add<std::vector<std::string>>("--gemm-variants",
+                                       "Further GEMM types to pack the matrices for in the same model, e.g. intgemm8avx2 "
+                                       "intgemm8ssse3 after --gemm-type intgemm8avx512vnni. Loading uses the first of "
+                                       "--gemm-type and these that the CPU supports");
+    cli->add<float>("--quantize-range",
+                    "Range for the per-channel quantization of --gemm-type int8gpu in multiples of the standard deviation "
+                    "of each channel, 0.0 means min/max quantization",
+                    0.f);
+    cli->add<std::string>("--prune-pattern",
+                          "Prune the weight matrices apart from embeddings and output layer by magnitude to the N:M or "
+                          "N:MxW sparsity pattern for --sparse-gemm, e.g. 2:4x16. Pruning during training with "
+                          "--prune-pattern loses less quality");
+    cli->add<size_t>("--threads",
+                     "Number of threads that convert the matrices of the model in parallel, 0 uses all cores",
+                     0);
     cli->add<std::vector<std::string>>("--add-lsh",
                                        "Encode output matrix and optional rotation matrix into model file. "
                                        "arg1: number of bits in LSH encoding, arg2: name of output weights matrix")->implicit_val("1024 Wemb");
     cli->add<std::vector<std::string>>("--vocabs,-V", "Vocabulary file, required for ONNX export");
-    cli->add<std::vector<std::string>>("--shortlist,-s", "Shortlist conversion: filePath firstNum bestNum threshold");
+    cli->add<bool>("--onnx-shortlist",
+                   "Export the ONNX decoder steps with the output layer restricted to the target words of an additional "
+                   "input shortlist_indices");
+    cli->add<std::vector<std::string>>("--shortlist,-s", "Shortlist conversion: filePath firstNum bestNum threshold, or filePath of a binary shortlist");
     cli->add<std::string>("--dump-shortlist,-d", "Binary shortlist dump path","lex.bin");
+    cli->add<int>("--binary-version",
+                  "Version of the *.bin file to write: 1, or 2 with a directory for looking up items by name, "
+                  "checksums and optionally compressed items",
+                  BINARY_FILE_VERSION);
+    cli->add<int>("--compress",
+                  "Compress the items of at least 64KB of a version 2 *.bin file with zstd at this level, if that makes "
+                  "them smaller. Compressed items are decompressed when loading instead of being memory-mapped",
+                  0);
+    cli->add<bool>("--consolidate-checkpoint",
+                   "Merge the parts of the sharded training checkpoint of model --from into --to, "
+                   "e.g. model.npz.optimizer.npz");
     cli->parse(argc, argv);
     options->merge(config);
   }
 
   // shortlist conversion:
   // ./marian-conv --shortlist lex.esen.s2t 100 100 0 --dump-shortlist lex.esen.bin --vocabs vocab.esen.spm vocab.esen.spm
+  // binary shortlists written by older versions are converted to the page-aligned layout with
+  // ./marian-conv --shortlist lex.esen.old.bin --dump-shortlist lex.esen.bin --vocabs vocab.esen.spm vocab.esen.spm
   if(options->hasAndNotEmpty("shortlist")){
     auto vocabPaths = options->get<std::vector<std::string>>("vocabs");
     auto dumpPath = options->get<std::string>("dump-shortlist");
@@ -56,6 +90,17 @@ int main(int argc, char** argv) {
 
   auto modelFrom = options->get<std::string>("from");
   auto modelTo = options->get<std::string>("to");
+  io::binary::setSaveFormat(options->get<int>("binary-version"), options->get<int>("compress"));
+
+  // sharded checkpoint consolidation:
+  // ./marian-conv --consolidate-checkpoint -f model.npz -t model.npz.optimizer.npz
+  if(options->get<bool>("consolidate-checkpoint")) {
+    ShardedCheckpoint checkpoint;
+    ABORT_IF(!checkpoint.load(modelFrom), "No sharded checkpoint found: {}", ShardedCheckpoint::manifestFileName(modelFrom));
+    LOG(info, "Consolidating {} parts of the checkpoint of {} into {}", checkpoint.parts, modelFrom, modelTo);
+    io::saveItems(modelTo, checkpoint.consolidate(modelFrom));
+    return 0;
+  }
 
   auto exportAs = options->get<std::string>("export-as");
   auto vocabPaths = options->get<std::vector<std::string>>("vocabs");// , std::vector<std::string>());
@@ -73,6 +118,10 @@ int main(int argc, char** argv) {
   // We accept any type here and will later croak during packAndSave if the type cannot be used for conversion
   Type saveGemmType = typeFromString(options->get<std::string>("gemm-type", "float32"));
 
+  std::vector<Type> gemmVariants;
+  for(auto variant : options->get<std::vector<std::string>>("gemm-variants", {}))
+    gemmVariants.push_back(typeFromString(variant));
+
   LOG(info, "Outputting {}, precision: {}", modelTo, saveGemmType);
 
 
@@ -92,7 +141,7 @@ int main(int argc, char** argv) {
       // Add dummy parameters for the LSH before the model gets actually initialized.
       // This create the parameters with useless values in the tensors, but it gives us the memory we need.
       toBeLSHed = {
-        {lshOutputWeights, "lsh_output_codes", "lsh_output_rotation", lshNBits}
+        {lshOutputWeights, lsh::CODES_NAME, lsh::ROTATION_NAME, lshNBits}
       };
 
       graph->setReloaded(false);
@@ -110,18 +159,41 @@ int main(int argc, char** argv) {
         lsh::overwriteDummyParameters(graph, /*paramInfo=*/p);
     }
 
+    SparsityPattern prunePattern(options->get<std::string>("prune-pattern", ""));
+    if(!prunePattern.empty()) {
+      size_t numPruned = 0;
+      for(auto p : *graph->params()) {
+        if(!prunePattern.appliesTo(p->name(), p->shape()))
+          continue;
+        ABORT_IF(p->value_type() != Type::float32, "Pruning parameter {} of type {} is not supported", p->name(), p->value_type());
+        std::vector<float> values;
+        p->val()->get(values);
+        prunePattern.prune(values.data(), p->shape()[0], p->shape()[1]);
+        p->val()->set(values);
+        numPruned++;
+      }
+      LOG(info, "Pruned {} weight matrices to the {} sparsity pattern", numPruned, prunePattern.toString());
+    }
+
     // added a flag if the weights needs to be packed or not
-    graph->packAndSave(modelTo, configStr.str(), /* --gemm-type */ saveGemmType, Type::float32);
+    graph->packAndSave(modelTo, configStr.str(), /* --gemm-type */ saveGemmType, Type::float32,
+                       /* --quantize-range */ options->get<float>("quantize-range"),
+                       /* --threads */ options->get<size_t>("threads"),
+                       /* --gemm-variants */ gemmVariants);
   }
   else if (exportAs == "onnx-encode") {
 #ifdef USE_ONNX
     auto graph = New<ExpressionGraphONNXExporter>();
     graph->setDevice(CPU0);
-    graph->load(modelFrom);
+    graph->load(modelFile);
     graph->forward();  // run the initializers
     auto modelOptions = New<Options>(config)->with("vocabs", vocabPaths, "inference", true);
 
-    graph->exportToONNX(modelTo, modelOptions, vocabPaths);
+    // an 8-bit --gemm-type exports the weights of the affine layers in int8
+    ABORT_IF(saveGemmType != Type::float32 && sizeOf(saveGemmType) != 1,
+             "ONNX export supports --gemm-type float32 or an 8-bit type, not {}", saveGemmType);
+    graph->exportToONNX(modelTo, modelOptions, vocabPaths, options->get<bool>("onnx-shortlist"),
+                        /*int8=*/sizeOf(saveGemmType) == 1, options->get<float>("quantize-range"));
 #else
     ABORT("--export-as onnx-encode requires Marian to be built with USE_ONNX=ON");
 #endif // USE_ONNX
@@ -1,5 +1,6 @@
 #include "marian.h"
 #include "translator/beam_search.h"
+#include "translator/speculative_search.h"
 #include "translator/translator.h"
 #include "common/timer.h"
 #ifdef _WIN32
@@ -9,7 +10,11 @@
 int main(int argc, char** argv) {
   using namespace marian;
   auto options = parseOptions(argc, argv, cli::mode::translation);
-  auto task = New<Translate<BeamSearch>>(options);
+  Ptr<ModelTask> task;
+  if(options->get<size_t>("speculative-decoding", 0) > 0)
+    task = New<Translate<SpeculativeSearch>>(options);
+  else
+    task = New<Translate<BeamSearch>>(options);
 
   timer::Timer timer;
   task->run();
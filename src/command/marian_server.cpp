@@ -1,13 +1,150 @@
 #include "marian.h"
+#include "common/metrics.h"
+#include "common/signal_handling.h"
 #include "translator/beam_search.h"
+#include "translator/request_aggregator.h"
 #include "translator/translator.h"
 #include "common/timer.h"
+#include "common/tracing.h"
 #include "common/utils.h"
 
 #include "3rd_party/simple-websocket-server/server_ws.hpp"
 
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
 typedef SimpleWeb::SocketServer<SimpleWeb::WS> WSServer;
 
+namespace {
+using marian::Words;
+using marian::Word;
+
+// Binary frames of /translate/ids consist of unsigned 32-bit integers in host byte order: for every
+// sentence the number of word ids followed by the word ids themselves. Responses use the same format.
+bool decodeIds(const std::string& frame, size_t vocabSize, std::vector<Words>& sentences, std::string& error) {
+  if(frame.size() % sizeof(uint32_t) != 0) {
+    error = "frame size is not a multiple of 4 bytes";
+    return false;
+  }
+  std::vector<uint32_t> values(frame.size() / sizeof(uint32_t));
+  std::memcpy(values.data(), frame.data(), frame.size());
+  for(size_t i = 0; i < values.size();) {
+    size_t length = values[i++];
+    if(length > values.size() - i) {
+      error = "sentence length exceeds the frame";
+      return false;
+    }
+    Words words;
+    for(size_t j = 0; j < length; ++j, ++i) {
+      if(values[i] >= vocabSize) {
+        error = "word id " + std::to_string(values[i]) + " is out of vocabulary";
+        return false;
+      }
+      words.push_back(Word::fromWordIndex(values[i]));
+    }
+    sentences.push_back(words);
+  }
+  return true;
+}
+
+template <class Translation>
+std::string encodeIds(const std::vector<Translation>& translations) {
+  std::vector<uint32_t> values;
+  for(const auto& translation : translations) {
+    values.push_back((uint32_t)translation.words.size());
+    for(auto word : translation.words)
+      values.push_back((uint32_t)word.toWordIndex());
+  }
+  return std::string((const char*)values.data(), values.size() * sizeof(uint32_t));
+}
+
+// Logs the translation time of each request, or with --log-requests-ms at most once per interval the number of
+// requests since the previous message with their mean and maximum time, so that busy servers do not spend their
+// worker threads on logging.
+class RequestLog {
+  std::chrono::milliseconds interval_;
+  std::mutex mutex_;
+  std::chrono::steady_clock::time_point since_{std::chrono::steady_clock::now()};
+  size_t requests_{0};
+  double totalSeconds_{0};
+  double maxSeconds_{0};
+
+public:
+  RequestLog(size_t intervalMs) : interval_(intervalMs) {}
+
+  template <class... Args>
+  void record(double seconds, Args&&... args) {
+    if(interval_.count() == 0) {
+      LOG(info, std::forward<Args>(args)...);
+      return;
+    }
+    size_t requests;
+    double totalSeconds, maxSeconds, elapsed;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_++;
+      totalSeconds_ += seconds;
+      maxSeconds_ = std::max(maxSeconds_, seconds);
+      auto now = std::chrono::steady_clock::now();
+      if(now - since_ < interval_)
+        return;
+      requests = requests_;
+      totalSeconds = totalSeconds_;
+      maxSeconds = maxSeconds_;
+      elapsed = std::chrono::duration<double>(now - since_).count();
+      since_ = now;
+      requests_ = 0;
+      totalSeconds_ = maxSeconds_ = 0;
+    }
+    LOG(info, "Translated {} requests in {:.1f}s, taking {:.5f}s on average and {:.5f}s at most",
+        requests, elapsed, totalSeconds / requests, maxSeconds);
+  }
+};
+
+// Answers plain HTTP requests for /metrics with the Prometheus text format, one connection at a time.
+// Runs until the process exits.
+void serveMetrics(unsigned short port, const marian::metrics::Registry& registry) {
+  namespace asio = boost::asio;
+  asio::io_context io;
+  asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port));
+  LOG(info, "Metrics are available at http://localhost:{}/metrics", port);
+  for(;;) {
+    asio::ip::tcp::socket socket(io);
+    boost::system::error_code ec;
+    acceptor.accept(socket, ec);
+    if(ec)
+      continue;
+
+    asio::streambuf request;
+    asio::read_until(socket, request, "\r\n\r\n", ec);
+    if(ec)
+      continue;
+    std::istream requestStream(&request);
+    std::string method, path;
+    requestStream >> method >> path;
+
+    std::string status = "200 OK", body;
+    if(method != "GET")
+      status = "405 Method Not Allowed";
+    else if(path != "/metrics" && path != "/metrics/")
+      status = "404 Not Found";
+    else
+      body = registry.render();
+
+    std::string response = "HTTP/1.1 " + status + "\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n\r\n" + body;
+    asio::write(socket, asio::buffer(response), ec);
+  }
+}
+}  // namespace
+
 int main(int argc, char **argv) {
   using namespace marian;
 
@@ -15,31 +152,167 @@ int main(int argc, char **argv) {
   auto options = parseOptions(argc, argv, cli::mode::server, true);
   auto task = New<TranslateService<BeamSearch>>(options);
   auto quiet = options->get<bool>("quiet-translation");
+  auto stream = options->get<bool>("stream", false);
+  auto requestTimeout = std::chrono::milliseconds(options->get<size_t>("request-timeout-ms", 0));
+  auto requestLog = std::make_shared<RequestLog>(options->get<size_t>("log-requests-ms", 0));
+
+  // With --metrics-port statistics of the server and the decoder are collected
+  auto metricsPort = options->get<size_t>("metrics-port", 0);
+  auto registry = New<metrics::Registry>();
+  if(metricsPort > 0)
+    task->registerMetrics(*registry);
+
+  // per endpoint: latency from arrival to the complete response, number of requests and timed out requests
+  struct EndpointMetrics {
+    Ptr<metrics::Histogram> latency;
+    Ptr<metrics::Counter> requests, expired;
+  };
+  auto endpointMetrics = [&registry, metricsPort](const std::string& endpoint) {
+    EndpointMetrics endpointMetrics;
+    if(metricsPort > 0) {
+      auto labels = "endpoint=\"" + endpoint + "\"";
+      endpointMetrics.latency = registry->histogram("marian_request_latency_seconds",
+                                                    "Time from the arrival of a request until its response is sent",
+                                                    metrics::latencyBounds(), labels);
+      endpointMetrics.requests = registry->counter("marian_requests_total", "Number of received requests", labels);
+      endpointMetrics.expired = registry->counter("marian_requests_expired_total",
+                                                  "Number of requests dropped after --request-timeout-ms", labels);
+    }
+    return endpointMetrics;
+  };
+
+  // With --batch-wait-ms requests from all connections are translated together
+  Ptr<RequestAggregator> aggregator;
+  if(options->get<size_t>("batch-wait-ms", 0) > 0) {
+    auto maxWords = options->get<size_t>("batch-max-words", 0);
+    Ptr<metrics::Histogram> aggregateFill;
+    if(metricsPort > 0 && maxWords > 0)
+      aggregateFill = registry->histogram("marian_aggregated_batch_fill_ratio",
+                                          "Source words of requests translated together relative to --batch-max-words",
+                                          {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.0});
+    auto translate = [task, maxWords, aggregateFill](const std::string& input,
+                                                     RequestAggregator::LineCallback onLine,
+                                                     RequestAggregator::Clock::time_point deadline) {
+      if(aggregateFill) {
+        size_t words = 0;
+        for(const auto& line : utils::split(input, "\n", /*keepEmpty=*/true))
+          words += utils::split(line, " ").size() + 1; // counted like RequestAggregator::submit()
+        aggregateFill->observe((double)words / maxWords);
+      }
+      return task->translateLines(input, /*yamlOverridesStr=*/"", onLine, deadline);
+    };
+    aggregator = New<RequestAggregator>(translate, options->get<size_t>("batch-wait-ms"), maxWords);
+    if(metricsPort > 0) {
+      registry->gauge("marian_queue_requests", "Requests waiting for the next batch",
+                      [aggregator]() { return (double)aggregator->pendingRequests(); });
+      registry->gauge("marian_queue_words", "Source words waiting for the next batch",
+                      [aggregator]() { return (double)aggregator->pendingWords(); });
+    }
+  }
 
   // Initialize web server
   WSServer server;
   server.config.port = (short)options->get<size_t>("port", 8080);
 
   auto &translate = server.endpoint["^/translate/?$"];
+  auto &translateBulk = server.endpoint["^/translate/bulk/?$"];
+  auto &translateIds = server.endpoint["^/translate/ids/?$"];
+
+  auto onSent = [](const SimpleWeb::error_code &ec) {
+    if(ec)
+      LOG(error, "Error sending message: ({}) {}", ec.value(), ec.message());
+  };
+
+  // Interactive traffic goes to /translate, document-sized jobs to /translate/bulk. With --batch-wait-ms
+  // interactive requests are batched first, and requests that have not started within
+  // --request-timeout-ms are dropped.
+  auto onMessage = [&task, &aggregator, quiet, stream, requestTimeout, requestLog, onSent](int priority,
+                                                                                          EndpointMetrics metrics) {
+    return [&task, &aggregator, quiet, stream, requestTimeout, requestLog, onSent, priority, metrics](
+               Ptr<WSServer::Connection> connection, Ptr<WSServer::InMessage> message) {
+      if(metrics.requests)
+        metrics.requests->inc();
+
+      // Get input text
+      auto inputText = message->string();
 
-  translate.on_message = [&task, quiet](Ptr<WSServer::Connection> connection,
-                                        Ptr<WSServer::InMessage> message) {
-    // Get input text
-    auto inputText = message->string();
+      // With --stream every sentence is sent back as soon as it is finished
+      TranslateService<BeamSearch>::TranslationCallback callback;
+      if(stream)
+        callback = [connection, onSent](size_t lineNo, const std::string& translation) {
+          auto lineStream = std::make_shared<WSServer::OutMessage>();
+          *lineStream << lineNo << "\t" << translation << std::endl;
+          connection->send(lineStream, onSent);
+        };
+
+      // Send translation back
+      auto timer = New<timer::Timer>();
+      auto sendTranslation = [connection, onSent, quiet, requestLog, timer, metrics](const std::string& outputText) {
+        tracing::Span span("send");
+        auto sendStream = std::make_shared<WSServer::OutMessage>();
+        *sendStream << outputText << std::endl;
+        if(metrics.latency)
+          metrics.latency->observe(timer->elapsed());
+        if(!quiet)
+          requestLog->record(timer->elapsed(), "Translation took: {:.5f}s", timer->elapsed());
+        connection->send(sendStream, onSent);
+      };
+
+      // Translate
+      if(aggregator) {
+        auto deadline = requestTimeout.count() > 0 ? RequestAggregator::Clock::now() + requestTimeout
+                                                   : RequestAggregator::Clock::time_point::max();
+        auto sendTimeout = [connection, onSent, metrics]() {
+          if(metrics.expired)
+            metrics.expired->inc();
+          auto sendStream = std::make_shared<WSServer::OutMessage>();
+          *sendStream << "Error: request timed out" << std::endl;
+          connection->send(sendStream, onSent);
+        };
+        aggregator->submit(inputText, sendTranslation, callback, priority, deadline, sendTimeout); // returns immediately
+      } else {
+        // the trace of a sampled request includes sending its translation, see --trace-sample-rate
+        auto trace = task->getTracer() ? task->getTracer()->startTrace("request") : nullptr;
+        if(trace) {
+          trace->setAttribute("priority", priority);
+          trace->setAttribute("input_bytes", inputText.size());
+        }
+        tracing::Scope scope(trace);
+        sendTranslation(task->run(inputText, /*yamlOverridesStr=*/"", callback));
+      }
+    };
+  };
+  translate.on_message = onMessage(/*priority=*/1, endpointMetrics("translate"));
+  translateBulk.on_message = onMessage(/*priority=*/0, endpointMetrics("bulk"));
+
+  // Pre-tokenized input and output as word ids in binary frames, see decodeIds()
+  auto idsMetrics = endpointMetrics("ids");
+  translateIds.on_message = [&task, quiet, requestLog, onSent, idsMetrics](Ptr<WSServer::Connection> connection,
+                                                                           Ptr<WSServer::InMessage> message) {
+    if(idsMetrics.requests)
+      idsMetrics.requests->inc();
     auto sendStream = std::make_shared<WSServer::OutMessage>();
+    const auto& srcVocabs = task->getSrcVocabs();
 
-    // Translate
-    timer::Timer timer;
-    auto outputText = task->run(inputText);
-    *sendStream << outputText << std::endl;
-    if(!quiet)
-      LOG(info, "Translation took: {:.5f}s", timer.elapsed());
-
-    // Send translation back
-    connection->send(sendStream, [](const SimpleWeb::error_code &ec) {
-      if(ec)
-        LOG(error, "Error sending message: ({}) {}", ec.value(), ec.message());
-    });
+    std::vector<Words> sentences;
+    std::string error;
+    if(srcVocabs.size() != 1) {
+      error = "only single-source models are supported";
+    } else if(decodeIds(message->string(), srcVocabs.front()->size(), sentences, error)) {
+      timer::Timer timer;
+      *sendStream << encodeIds(task->translateIds({sentences}));
+      if(idsMetrics.latency)
+        idsMetrics.latency->observe(timer.elapsed());
+      if(!quiet)
+        requestLog->record(timer.elapsed(), "Translation of {} pre-tokenized sentences took: {:.5f}s",
+                           sentences.size(), timer.elapsed());
+      connection->send(sendStream, onSent, /*fin_rsv_opcode=*/130); // binary frame
+      return;
+    }
+
+    LOG(warn, "Rejected binary request: {}", error);
+    *sendStream << "Error: " << error;
+    connection->send(sendStream, onSent); // text frame
   };
 
   // Error Codes for error code meanings
@@ -48,6 +321,27 @@ int main(int argc, char **argv) {
                           const SimpleWeb::error_code &ec) {
     LOG(error, "Connection error: ({}) {}", ec.value(), ec.message());
   };
+  translateBulk.on_error = translate.on_error;
+  translateIds.on_error = translate.on_error;
+
+  // Metrics are served on their own port by a plain HTTP server, the web socket server only speaks web sockets
+  if(metricsPort > 0)
+    std::thread([metricsPort, registry]() { serveMetrics((unsigned short)metricsPort, *registry); }).detach();
+
+#ifdef SIGHUP
+  // On SIGHUP the models are loaded again from --models into new graphs, which take over from the current ones as
+  // soon as they are warmed up
+  signal(SIGHUP, setSignalFlag);
+  std::thread([task]() {
+    for(;;) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      if(getSignalFlag(SIGHUP)) {
+        clearSignalFlag(SIGHUP);
+        task->reload();
+      }
+    }
+  }).detach();
+#endif
 
   // Start server thread
   std::thread serverThread([&server]() {
@@ -3,6 +3,7 @@
 
 #include "common/signal_handling.h"
 #include "training/graph_group_async.h"
+#include "training/graph_group_pipeline.h"
 #include "training/graph_group_singleton.h"
 #include "training/graph_group_sync.h"
 #include "training/training.h"
@@ -18,7 +19,11 @@ int main(int argc, char** argv) {
   // If given, then this implementation is used for all combinations of (single, multiple) MPI
   // processes x (single, multiple) GPUs per MPI process.  This variant is presently up-to-date and
   // best supported.
-  if(options->get<bool>("sync-sgd")) { // @TODO: make default
+  if(options->get<bool>("pipeline-parallel")) {
+    LOG(info, "[training] Using pipeline-parallel training");
+    New<Train<PipelineGraphGroup>>(options)->run();
+  }
+  else if(options->get<bool>("sync-sgd")) { // @TODO: make default
     LOG(info, "Using synchronous SGD");
     New<Train<SyncGraphGroup>>(options)->run();
   }
@@ -18,12 +18,25 @@ int main(int argc, char** argv) {
         "Allowed options",
         "Examples:\n"
         "  ./marian-vocab < text.src > vocab.yml\n"
-        "  cat text.src text.trg | ./marian-vocab > vocab.yml");
+        "  cat text.src text.trg | ./marian-vocab > vocab.yml\n"
+        "  ./marian-vocab --compile vocab.yml vocab.bvoc");
     cli->add<size_t>("--max-size,-m", "Generate only UINT most common vocabulary items", 0);
+    cli->add<std::vector<std::string>>("--compile",
+        "Compile the vocabulary file arg1 into the memory-mappable vocabulary arg2, which should end in .bvoc "
+        "to be recognized, instead of creating a vocabulary");
     cli->parse(argc, argv);
     options->merge(config);
   }
 
+  auto compile = options->get<std::vector<std::string>>("compile", {});
+  if(!compile.empty()) {
+    ABORT_IF(compile.size() != 2, "--compile expects a vocabulary and the file to write it to");
+    LOG(info, "Compiling vocabulary...");
+    Vocab::compile(compile[0], compile[1]);
+    LOG(info, "Finished");
+    return 0;
+  }
+
   LOG(info, "Creating vocabulary...");
 
   auto vocab = New<Vocab>(options, 0);
@@ -3,9 +3,21 @@
 #include "common/file_stream.h"
 #include "common/io_item.h"
 #include "common/types.h"
+#include "common/utils.h"
 #include "tensors/cpu/integer_common.h"
 
+#include "3rd_party/mio/mio.hpp"
+#include "3rd_party/threadpool.h"
+#include "3rd_party/zlib/zlib.h"
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 namespace marian {
 namespace io {
@@ -19,6 +31,32 @@ struct Header {
   uint64_t dataLength;
 };
 
+// Version 2: the file begins with the version, the number of items and the size of the hash table, followed by
+// an Entry for each item, the hash table, the names, the shapes and the 256-byte aligned data of the items:
+//   uint64 version | uint64 numItems | uint64 tableSize | Entry entries[numItems] | uint64 table[tableSize] | ...
+// The table is indexed by the FNV-1a hash of a name modulo tableSize with linear probing, and holds the index of
+// the item with that name plus one, or 0 for an empty slot.
+struct Entry {
+  uint64_t nameOffset;   // from the beginning of the file, as all offsets
+  uint64_t nameLength;   // with the terminating 0
+  uint64_t type;
+  uint64_t shapeOffset;
+  uint64_t shapeLength;
+  uint64_t dataOffset;   // aligned to 256 bytes
+  uint64_t dataLength;   // of the item data with padding
+  uint64_t storedLength; // in the file, differs from dataLength if compressed
+  uint64_t compression;
+  uint64_t checksum;     // CRC32 of the stored bytes
+};
+
+enum : uint64_t { COMPRESSION_NONE = 0, COMPRESSION_ZSTD = 1 };
+
+const size_t MIN_COMPRESSED_BYTES = 64 * 1024;
+
+// of the files that saveItems() writes, see setSaveFormat()
+int saveVersion = BINARY_FILE_VERSION;
+int saveCompressionLevel = 0;
+
 // cast current void pointer to T pointer and move forward by num elements
 template <typename T>
 const T* get(const void*& current, uint64_t num = 1) {
@@ -27,7 +65,248 @@ const T* get(const void*& current, uint64_t num = 1) {
   return ptr;
 }
 
+uint64_t hashName(const char* name) {
+  uint64_t hash = 14695981039346656037ull;
+  for(; *name; ++name)
+    hash = (hash ^ (unsigned char)*name) * 1099511628211ull;
+  return hash;
+}
+
+uint64_t checksum(const char* data, size_t size) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  for(size_t done = 0; done < size;) {
+    uInt len = (uInt)std::min<size_t>(size - done, (size_t)1 << 30);
+    crc = crc32(crc, (const Bytef*)data + done, len);
+    done += len;
+  }
+  return crc;
+}
+
+// sets the data of item, in place if the item is mapped
+void setItemData(io::Item& item, const char* ptr, uint64_t len) {
+  // For intgemm AVX512 and AVX512VNNI have the same arangement, but the VNNI algorithm is faster.
+  // Change the type to the fastest one supported.
+  if (item.type == Type::intgemm8avx512) {
+    item.type = cpu::integer::getIntgemmType(Type::intgemm8);
+  }
+  if(item.mapped) { // memory-mapped, hence only set pointer
+    if(item.type == Type::intgemm8 || item.type == Type::intgemm16)
+      throw MarianRuntimeException("mmap format not supported for hardware non-specific intgemm matrices", getCallStack(/*skipLevels=*/0));
+    item.ptr = ptr;
+  } else { // reading into item data
+    item.bytes.resize(len);
+    // Intgemm8/16 matrices in binary model are just quantized, however they also need to be reordered
+    // Reordering depends on the architecture (SSE/AVX2/AVX512) so we read in the quantized matrices and
+    // then reorder them before adding them as a parameter in the graph.
+    if (matchType<intgemm8>(item.type)) {
+      item.type = cpu::integer::getIntgemmType(Type::intgemm8);
+      cpu::integer::prepareAndTransposeB<Type::intgemm8>(item, ptr);
+    } else if (matchType<intgemm16>(item.type)) {
+      item.type = cpu::integer::getIntgemmType(Type::intgemm16);
+      cpu::integer::prepareAndTransposeB<Type::intgemm16>(item, ptr);
+    } else {
+      std::copy(ptr, ptr + len, item.bytes.begin());
+    }
+  }
+}
+
+// loads the item of entry from a version 2 file that starts at start. Compressed items are never mapped, and the
+// checksums of mapped items are not verified, as that would read all of them at once.
+void loadItem(const char* start, const Entry& entry, io::Item& item, bool mapped) {
+  item.name = start + entry.nameOffset;
+  item.type = (Type)entry.type;
+  const int* shape = (const int*)(start + entry.shapeOffset);
+  item.shape.resize(entry.shapeLength);
+  std::copy(shape, shape + entry.shapeLength, item.shape.begin());
+
+  const char* stored = start + entry.dataOffset;
+  bool compressed = entry.compression != COMPRESSION_NONE;
+  ABORT_IF((!mapped || compressed) && checksum(stored, entry.storedLength) != entry.checksum,
+           "Checksum mismatch in item {} of binary model, the file is corrupt", item.name);
+
+  item.mapped = mapped && !compressed;
+  if(!compressed) {
+    setItemData(item, stored, entry.dataLength);
+    return;
+  }
+
+  ABORT_IF(entry.compression != COMPRESSION_ZSTD, "Unknown compression {} of item {}", entry.compression, item.name);
+#ifdef USE_ZSTD
+  std::vector<char> data(entry.dataLength);
+  size_t ret = ZSTD_decompress(data.data(), data.size(), stored, entry.storedLength);
+  ABORT_IF(ZSTD_isError(ret), "Error decompressing item {}: {}", item.name, ZSTD_getErrorName(ret));
+  ABORT_IF(ret != data.size(), "Item {} decompresses to {} bytes, expected {}", item.name, ret, data.size());
+  setItemData(item, data.data(), data.size());
+#else
+  ABORT("Item {} of the binary model is zstd-compressed, but marian was compiled without zstd", item.name);
+#endif
+}
+
+const Entry* findItem(const void* current, const std::string& varName) {
+  const char* start = (const char*)current;
+  get<uint64_t>(current); // version
+  uint64_t numItems = *get<uint64_t>(current);
+  uint64_t tableSize = *get<uint64_t>(current);
+  const Entry* entries = get<Entry>(current, numItems);
+  const uint64_t* table = get<uint64_t>(current, tableSize);
+
+  for(uint64_t slot = hashName(varName.c_str()) % tableSize; table[slot] != 0; slot = (slot + 1) % tableSize) {
+    const Entry& entry = entries[table[slot] - 1];
+    if(varName == start + entry.nameOffset)
+      return &entry;
+  }
+  return nullptr;
+}
+
+void loadItemsVersion2(const void* current, std::vector<io::Item>& items, bool mapped) {
+  const char* start = (const char*)current;
+  get<uint64_t>(current); // version
+  uint64_t numItems = *get<uint64_t>(current);
+  get<uint64_t>(current); // size of the hash table
+  const Entry* entries = get<Entry>(current, numItems);
+
+  items.resize(numItems);
+  for(size_t i = 0; i < numItems; ++i)
+    loadItem(start, entries[i], items[i], mapped);
+}
+
+void saveItemsVersion2(const std::string& fileName, const std::vector<io::Item>& items) {
+  uint64_t numItems = items.size();
+  uint64_t tableSize = std::max<uint64_t>(1, 2 * numItems); // at most half full
+
+  // compressed in parallel, the others are written as they are
+  std::vector<std::vector<char>> compressed(numItems);
+  if(saveCompressionLevel > 0) {
+#ifdef USE_ZSTD
+    ThreadPool pool(std::max<size_t>(1, std::thread::hardware_concurrency()));
+    std::vector<std::future<void>> done;
+    for(size_t i = 0; i < numItems; ++i) {
+      size_t size = items[i].mapped ? items[i].size() : items[i].bytes.size();
+      if(size < MIN_COMPRESSED_BYTES)
+        continue;
+      done.emplace_back(pool.enqueue([&, i, size]() {
+        auto& out = compressed[i];
+        out.resize(ZSTD_compressBound(size));
+        size_t ret = ZSTD_compress(out.data(), out.size(), items[i].data(), size, saveCompressionLevel);
+        ABORT_IF(ZSTD_isError(ret), "Error compressing item {}: {}", items[i].name, ZSTD_getErrorName(ret));
+        out.resize(ret < size ? ret : 0); // stored raw unless it gets smaller
+        out.shrink_to_fit();
+      }));
+    }
+    for(auto& f : done)
+      f.get();
+#endif
+  }
+
+  std::vector<Entry> entries(numItems);
+  uint64_t pos = 3 * sizeof(uint64_t) + numItems * sizeof(Entry) + tableSize * sizeof(uint64_t);
+  for(size_t i = 0; i < numItems; ++i) {
+    entries[i].nameOffset = pos;
+    entries[i].nameLength = items[i].name.size() + 1;
+    pos += entries[i].nameLength;
+  }
+  for(size_t i = 0; i < numItems; ++i) {
+    entries[i].shapeOffset = pos;
+    entries[i].shapeLength = items[i].shape.size();
+    pos += entries[i].shapeLength * sizeof(int);
+  }
+  for(size_t i = 0; i < numItems; ++i) {
+    auto& entry = entries[i];
+    entry.type = (uint64_t)items[i].type;
+    entry.dataLength = items[i].mapped ? items[i].size() : items[i].bytes.size();
+    entry.compression = compressed[i].empty() ? COMPRESSION_NONE : COMPRESSION_ZSTD;
+    entry.storedLength = compressed[i].empty() ? entry.dataLength : compressed[i].size();
+    entry.checksum = checksum(compressed[i].empty() ? items[i].data() : compressed[i].data(), entry.storedLength);
+    pos = (pos + 255) / 256 * 256;
+    entry.dataOffset = pos;
+    pos += entry.storedLength;
+  }
+
+  std::vector<uint64_t> table(tableSize, 0);
+  for(size_t i = 0; i < numItems; ++i) {
+    uint64_t slot = hashName(items[i].name.c_str()) % tableSize;
+    while(table[slot] != 0)
+      slot = (slot + 1) % tableSize;
+    table[slot] = i + 1;
+  }
+
+  io::OutputFileStream out(fileName);
+  uint64_t version = BINARY_FILE_VERSION_DIRECTORY;
+  pos = out.write(&version);
+  pos += out.write(&numItems);
+  pos += out.write(&tableSize);
+  pos += out.write(entries.data(), entries.size());
+  pos += out.write(table.data(), table.size());
+  for(const auto& item : items)
+    pos += out.write(item.name.data(), item.name.size() + 1);
+  for(const auto& item : items)
+    pos += out.write(item.shape.data(), item.shape.size());
+
+  for(size_t i = 0; i < numItems; ++i) {
+    const char padding = 0;
+    while(pos < entries[i].dataOffset)
+      pos += out.write(&padding);
+    pos += out.write(compressed[i].empty() ? items[i].data() : compressed[i].data(), entries[i].storedLength);
+  }
+}
+
+uint64_t fileVersion(const void* current) {
+  return *(const uint64_t*)current;
+}
+
+const std::string VARIANT_PREFIX = "variant:";
+
+std::string variantName(Type variant, const std::string& name) {
+  return VARIANT_PREFIX + fmt::format("{}", variant) + ":" + name;
+}
+
+void selectVariant(std::vector<io::Item>& items) {
+  auto list = std::find_if(items.begin(), items.end(), [](const io::Item& item) { return item.name == VARIANTS_NAME; });
+  if(list == items.end())
+    return;
+
+  auto variants = utils::split(std::string(list->data()), " ");
+  ABORT_IF(variants.empty(), "The model lists no GEMM variants");
+  size_t chosen = 0;
+  while(chosen < variants.size() && !cpu::integer::isSupported(typeFromString(variants[chosen])))
+    chosen++;
+  if(chosen == variants.size()) {
+    LOG(warn, "[memory] This CPU supports none of the GEMM variants {} of the model", list->data());
+    chosen = 0; // fails with an explanation once it is used
+  }
+  LOG(info, "[memory] Using the {} variant of the GEMM weights", variants[chosen]);
+
+  std::string prefix = VARIANT_PREFIX + variants[chosen] + ":";
+  std::unordered_map<std::string, size_t> replacements;
+  std::vector<bool> isVariant(items.size());
+  for(size_t i = 0; i < items.size(); ++i) {
+    isVariant[i] = utils::beginsWith(items[i].name, VARIANT_PREFIX);
+    if(chosen > 0 && utils::beginsWith(items[i].name, prefix))
+      replacements[items[i].name.substr(prefix.size())] = i;
+  }
+
+  std::vector<io::Item> selected;
+  for(size_t i = 0; i < items.size(); ++i) {
+    if(isVariant[i]) // before any of them is moved
+      continue;
+    auto it = replacements.find(items[i].name);
+    if(it != replacements.end()) {
+      selected.push_back(std::move(items[it->second]));
+      selected.back().name = items[i].name;
+    } else {
+      selected.push_back(std::move(items[i]));
+    }
+  }
+  items.swap(selected);
+}
+
 void loadItems(const void* current, std::vector<io::Item>& items, bool mapped) {
+  if(fileVersion(current) == BINARY_FILE_VERSION_DIRECTORY) {
+    loadItemsVersion2(current, items, mapped);
+    selectVariant(items);
+    return;
+  }
+
   uint64_t binaryFileVersion = *get<uint64_t>(current);
   ABORT_IF(binaryFileVersion != BINARY_FILE_VERSION,
            "Binary file versions do not match: {} (file) != {} (expected)",
@@ -57,34 +336,9 @@ void loadItems(const void* current, std::vector<io::Item>& items, bool mapped) {
   uint64_t offset = *get<uint64_t>(current);
   get<char>(current, offset);
 
-  for(int i = 0; i < numHeaders; ++i) {
-    // For intgemm AVX512 and AVX512VNNI have the same arangement, but the VNNI algorithm is faster.
-    // Change the type to the fastest one supported.
-    if (items[i].type == Type::intgemm8avx512) {
-      items[i].type = cpu::integer::getIntgemmType(Type::intgemm8);
-    }
-    if(items[i].mapped) { // memory-mapped, hence only set pointer
-      if(items[i].type == Type::intgemm8 || items[i].type == Type::intgemm16)
-        throw MarianRuntimeException("mmap format not supported for hardware non-specific intgemm matrices", getCallStack(/*skipLevels=*/0));
-      items[i].ptr = get<char>(current, headers[i].dataLength);
-    } else { // reading into item data
-      uint64_t len = headers[i].dataLength;
-      items[i].bytes.resize(len);
-      const char* ptr = get<char>(current, len);
-      // Intgemm8/16 matrices in binary model are just quantized, however they also need to be reordered
-      // Reordering depends on the architecture (SSE/AVX2/AVX512) so we read in the quantized matrices and
-      // then reorder them before adding them as a parameter in the graph.
-      if (matchType<intgemm8>(items[i].type)) {
-        items[i].type = cpu::integer::getIntgemmType(Type::intgemm8);
-        cpu::integer::prepareAndTransposeB<Type::intgemm8>(items[i], ptr);
-      } else if (matchType<intgemm16>(items[i].type)) {
-        items[i].type = cpu::integer::getIntgemmType(Type::intgemm16);
-        cpu::integer::prepareAndTransposeB<Type::intgemm16>(items[i], ptr);
-      } else {
-        std::copy(ptr, ptr + len, items[i].bytes.begin());
-      }
-    }
-  }
+  for(int i = 0; i < numHeaders; ++i)
+    setItemData(items[i], get<char>(current, headers[i].dataLength), headers[i].dataLength);
+  selectVariant(items);
 }
 
 void loadItems(const std::string& fileName, std::vector<io::Item>& items) {
@@ -108,6 +362,13 @@ void loadItems(const std::string& fileName, std::vector<io::Item>& items) {
 }
 
 io::Item getItem(const void* current, const std::string& varName) {
+  if(fileVersion(current) == BINARY_FILE_VERSION_DIRECTORY) { // looked up without reading the other items
+    io::Item item;
+    if(const Entry* entry = findItem(current, varName))
+      loadItem((const char*)current, *entry, item, /*mapped=*/true);
+    return item;
+  }
+
   std::vector<io::Item> items;
   loadItems(current, items, /*mapped=*/true);
 
@@ -119,6 +380,14 @@ io::Item getItem(const void* current, const std::string& varName) {
 }
 
 io::Item getItem(const std::string& fileName, const std::string& varName) {
+  mio::mmap_source mmap(fileName);
+  if(mmap.size() >= sizeof(uint64_t) && fileVersion(mmap.data()) == BINARY_FILE_VERSION_DIRECTORY) {
+    io::Item item;
+    if(const Entry* entry = findItem(mmap.data(), varName))
+      loadItem(mmap.data(), *entry, item, /*mapped=*/false);
+    return item;
+  }
+
   std::vector<io::Item> items;
   loadItems(fileName, items);
 
@@ -129,8 +398,25 @@ io::Item getItem(const std::string& fileName, const std::string& varName) {
   return io::Item();
 }
 
+void setSaveFormat(int version, int compressionLevel) {
+  ABORT_IF(version != BINARY_FILE_VERSION && version != BINARY_FILE_VERSION_DIRECTORY,
+           "Binary model files have version {} or {}, not {}", BINARY_FILE_VERSION, BINARY_FILE_VERSION_DIRECTORY, version);
+  ABORT_IF(compressionLevel > 0 && version == BINARY_FILE_VERSION,
+           "Compressed items require binary model files of version {}", BINARY_FILE_VERSION_DIRECTORY);
+#ifndef USE_ZSTD
+  ABORT_IF(compressionLevel > 0, "Compressing binary models requires marian to be compiled with zstd");
+#endif
+  saveVersion = version;
+  saveCompressionLevel = compressionLevel;
+}
+
 void saveItems(const std::string& fileName,
                const std::vector<io::Item>& items) {
+  if(saveVersion == BINARY_FILE_VERSION_DIRECTORY) {
+    saveItemsVersion2(fileName, items);
+    return;
+  }
+
   io::OutputFileStream out(fileName);
   uint64_t pos = 0;
 
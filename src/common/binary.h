@@ -8,6 +8,9 @@
 namespace marian {
 
 const static int BINARY_FILE_VERSION = 1;
+// Version 2 adds a directory of the items with a hash table of their names, a CRC32 checksum of each item and
+// zstd-compressed items, see saveItems(). Both versions are read, version 1 is written unless setSaveFormat() says.
+const static int BINARY_FILE_VERSION_DIRECTORY = 2;
 
 namespace io {
 namespace binary {
@@ -22,6 +25,21 @@ io::Item getItem(const std::string& fileName, const std::string& vName);
 
 void saveItems(const std::string& fileName, const std::vector<io::Item>& items);
 
+// A model can carry the GEMM weights packed for several CPUs, see marian-conv --gemm-variants. The item VARIANTS_NAME
+// lists their types separated by spaces, the first one is stored under the names of the parameters, each further
+// one under variantName(type, name) for the parameters that it packs differently.
+const std::string VARIANTS_NAME = "special:gemm-variants";
+std::string variantName(Type variant, const std::string& name);
+
+// Keeps the first variant of the list that this CPU supports under the names of the parameters, and drops the items
+// of the others. Memory-mapped items of the dropped variants are never read. Called by loadItems().
+void selectVariant(std::vector<io::Item>& items);
+
+// Sets the version of the files that saveItems() writes in this process and, for version 2, the zstd level that
+// items of at least 64KB are compressed with if that makes them smaller, 0 stores them raw. Compressed items cannot
+// be memory-mapped and are decompressed when loading instead. See marian-conv --binary-version and --compress.
+void setSaveFormat(int version, int compressionLevel = 0);
+
 }  // namespace binary
 }  // namespace io
 }  // namespace marian
@@ -0,0 +1,268 @@
+#include "common/compressed_stream.h"
+#include "common/filesystem.h"
+#include "common/logging.h"
+#include "common/utils.h"
+
+#include "3rd_party/threadpool.h"
+#include "3rd_party/zlib/zlib.h"
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <thread>
+
+namespace marian {
+namespace io {
+
+namespace {
+
+// shared by all streams, each keeps up to BLOCKS_AHEAD of its blocks in flight
+size_t numDecompressionThreads() {
+  return std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), 8));
+}
+
+ThreadPool& decompressionPool() {
+  static ThreadPool pool(numDecompressionThreads());
+  return pool;
+}
+
+const size_t BLOCKS_AHEAD = 4 * numDecompressionThreads();
+
+uint16_t readLE16(const unsigned char* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t readLE32(const unsigned char* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// BGZF: every block is a gzip member whose extra field has the subfield BC with the block size - 1
+bool isBgzf(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  unsigned char header[18];
+  if(!file.read((char*)header, sizeof(header)))
+    return false;
+  return header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4) != 0 && readLE16(header + 10) >= 6
+         && header[12] == 'B' && header[13] == 'C' && readLE16(header + 14) == 2;
+}
+
+bool readBgzfBlock(std::streambuf* source, std::vector<char>& block) {
+  const size_t HEADER = 12; // up to and including the length of the extra field
+  block.resize(HEADER);
+  std::streamsize got = source->sgetn(block.data(), HEADER);
+  if(got == 0)
+    return false;
+  auto bytes = (const unsigned char*)block.data();
+  ABORT_IF(got != (std::streamsize)HEADER || bytes[0] != 31 || bytes[1] != 139 || (bytes[3] & 4) == 0,
+           "Corrupt BGZF block header");
+
+  size_t extraEnd = HEADER + readLE16(bytes + 10);
+  block.resize(extraEnd);
+  ABORT_IF(source->sgetn(block.data() + HEADER, extraEnd - HEADER) != (std::streamsize)(extraEnd - HEADER),
+           "Truncated BGZF block");
+  bytes = (const unsigned char*)block.data();
+
+  size_t blockSize = 0;
+  for(size_t i = HEADER; i + 4 <= extraEnd; i += 4 + readLE16(bytes + i + 2)) {
+    if(bytes[i] == 'B' && bytes[i + 1] == 'C' && readLE16(bytes + i + 2) == 2 && i + 6 <= extraEnd) {
+      blockSize = readLE16(bytes + i + 4) + 1;
+      break;
+    }
+  }
+  ABORT_IF(blockSize < extraEnd + 8, "BGZF block without a valid block size");
+
+  block.resize(blockSize);
+  ABORT_IF(source->sgetn(block.data() + extraEnd, blockSize - extraEnd) != (std::streamsize)(blockSize - extraEnd),
+           "Truncated BGZF block");
+  return true;
+}
+
+std::vector<char> inflateBgzfBlock(const std::vector<char>& block) {
+  // the gzip trailer ends with the uncompressed size, the empty block marks the end of the file
+  size_t size = readLE32((const unsigned char*)block.data() + block.size() - 4);
+  std::vector<char> out(size);
+  if(size == 0)
+    return out;
+
+  z_stream strm = {};
+  ABORT_IF(inflateInit2(&strm, 15 + 16) != Z_OK, "Could not initialize zlib");
+  strm.next_in = (Bytef*)block.data();
+  strm.avail_in = (uInt)block.size();
+  strm.next_out = (Bytef*)out.data();
+  strm.avail_out = (uInt)out.size();
+  int ret = inflate(&strm, Z_FINISH);
+  size_t decompressed = strm.total_out;
+  inflateEnd(&strm);
+  ABORT_IF(ret != Z_STREAM_END || decompressed != size, "Corrupt BGZF block");
+  return out;
+}
+
+#ifdef USE_ZSTD
+// returns the compressed sizes of the frames of a zstd file in the seekable format, nothing otherwise
+std::vector<size_t> seekableZstdFrames(const std::string& path) {
+  const uint32_t SKIPPABLE_MAGIC = 0x184D2A5E;
+  const uint32_t SEEKABLE_MAGIC = 0x8F92EAB1;
+  const size_t FOOTER = 9; // number of frames, descriptor, magic number
+
+  std::vector<size_t> frames;
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  std::streamoff fileSize = file.tellg();
+  if(!file || fileSize < (std::streamoff)(8 + FOOTER))
+    return frames;
+
+  unsigned char footer[FOOTER];
+  file.seekg(fileSize - FOOTER);
+  if(!file.read((char*)footer, FOOTER) || readLE32(footer + 5) != SEEKABLE_MAGIC)
+    return frames;
+  size_t numFrames = readLE32(footer);
+  size_t entrySize = (footer[4] & 0x80) ? 12 : 8; // with or without checksums
+  std::streamoff tableSize = 8 + numFrames * entrySize + FOOTER;
+  if(tableSize > fileSize)
+    return frames;
+
+  unsigned char skippable[8];
+  std::vector<unsigned char> entries(numFrames * entrySize);
+  file.seekg(fileSize - tableSize);
+  if(!file.read((char*)skippable, sizeof(skippable)) || readLE32(skippable) != SKIPPABLE_MAGIC
+     || readLE32(skippable + 4) != tableSize - 8 || !file.read((char*)entries.data(), entries.size()))
+    return frames;
+
+  std::streamoff compressed = 0;
+  for(size_t i = 0; i < numFrames; ++i) {
+    frames.push_back(readLE32(entries.data() + i * entrySize));
+    compressed += frames.back();
+  }
+  if(compressed + tableSize != fileSize) {
+    LOG(warn, "[data] The seek table of {} does not match its size, decompressing it on one thread", path);
+    frames.clear();
+  }
+  return frames;
+}
+
+std::vector<char> decompressZstdFrame(const std::vector<char>& block) {
+  auto size = ZSTD_getFrameContentSize(block.data(), block.size());
+  if(size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR) {
+    std::vector<char> out(size);
+    size_t ret = ZSTD_decompress(out.data(), out.size(), block.data(), block.size());
+    ABORT_IF(ZSTD_isError(ret), "Error decompressing zstd frame: {}", ZSTD_getErrorName(ret));
+    ABORT_IF(ret != size, "Corrupt zstd frame");
+    return out;
+  }
+
+  // without the size in the frame header
+  ZSTD_DStream* stream = ZSTD_createDStream();
+  ZSTD_initDStream(stream);
+  ZSTD_inBuffer input = {block.data(), block.size(), 0};
+  std::vector<char> out;
+  size_t ret;
+  bool truncated = false;
+  do {
+    size_t pos = out.size();
+    out.resize(pos + ZSTD_DStreamOutSize());
+    ZSTD_outBuffer output = {out.data() + pos, ZSTD_DStreamOutSize(), 0};
+    ret = ZSTD_decompressStream(stream, &output, &input);
+    out.resize(pos + output.pos);
+    truncated = !ZSTD_isError(ret) && ret != 0 && input.pos == input.size && output.pos < output.size;
+  } while(!ZSTD_isError(ret) && ret != 0 && !truncated);
+  ZSTD_freeDStream(stream);
+  ABORT_IF(ZSTD_isError(ret), "Error decompressing zstd frame: {}", ZSTD_getErrorName(ret));
+  ABORT_IF(truncated, "Truncated zstd frame");
+  return out;
+}
+#endif
+
+}  // namespace
+
+std::unique_ptr<std::streambuf> BlockDecompressBuf::open(const std::string& path, std::streambuf* source) {
+  if(filesystem::is_fifo(path)) // the format cannot be detected without consuming the pipe
+    return nullptr;
+
+  if(utils::endsWith(path, ".gz") && isBgzf(path))
+    return std::unique_ptr<std::streambuf>(new BlockDecompressBuf(source, readBgzfBlock, inflateBgzfBlock));
+#ifdef USE_ZSTD
+  if(utils::endsWith(path, ".zst")) {
+    auto frames = seekableZstdFrames(path);
+    if(!frames.empty()) {
+      size_t next = 0;
+      auto readFrame = [frames, next](std::streambuf* source, std::vector<char>& block) mutable {
+        if(next == frames.size()) // what follows is the seek table
+          return false;
+        block.resize(frames[next++]);
+        ABORT_IF(source->sgetn(block.data(), block.size()) != (std::streamsize)block.size(), "Truncated zstd frame");
+        return true;
+      };
+      return std::unique_ptr<std::streambuf>(new BlockDecompressBuf(source, readFrame, decompressZstdFrame));
+    }
+  }
+#endif
+  return nullptr;
+}
+
+BlockDecompressBuf::BlockDecompressBuf(std::streambuf* source, ReadBlockFunc readBlock, DecompressFunc decompress)
+    : source_(source), readBlock_(readBlock), decompress_(decompress) {
+  setg(nullptr, nullptr, nullptr);
+}
+
+// reads the next blocks on this thread and lets the pool decompress them
+void BlockDecompressBuf::readAhead() {
+  while(!sourceEnded_ && blocks_.size() < BLOCKS_AHEAD) {
+    std::vector<char> block;
+    if(!readBlock_(source_, block)) {
+      sourceEnded_ = true;
+      break;
+    }
+    auto decompress = decompress_;
+    blocks_.push_back(decompressionPool().enqueue(
+        [decompress, block = std::move(block)]() { return decompress(block); }));
+  }
+}
+
+BlockDecompressBuf::int_type BlockDecompressBuf::underflow() {
+  while(gptr() == egptr()) { // blocks may decompress to nothing
+    readAhead();
+    if(blocks_.empty())
+      return traits_type::eof();
+    current_ = blocks_.front().get();
+    blocks_.pop_front();
+    setg(current_.data(), current_.data(), current_.data() + current_.size());
+  }
+  return traits_type::to_int_type(*gptr());
+}
+
+#ifdef USE_ZSTD
+ZstdStreamBuf::ZstdStreamBuf(std::streambuf* source)
+    : source_(source), stream_(ZSTD_createDStream()), in_(ZSTD_DStreamInSize()), out_(ZSTD_DStreamOutSize()) {
+  ZSTD_initDStream((ZSTD_DStream*)stream_);
+  setg(out_.data(), out_.data(), out_.data());
+}
+
+ZstdStreamBuf::~ZstdStreamBuf() {
+  ZSTD_freeDStream((ZSTD_DStream*)stream_);
+}
+
+ZstdStreamBuf::int_type ZstdStreamBuf::underflow() {
+  while(gptr() == egptr()) {
+    if(inPos_ == inSize_) {
+      inSize_ = (size_t)source_->sgetn(in_.data(), in_.size());
+      inPos_ = 0;
+      if(inSize_ == 0)
+        return traits_type::eof();
+    }
+    // continues with the next frame, if the file has several, and skips skippable frames
+    ZSTD_inBuffer input = {in_.data(), inSize_, inPos_};
+    ZSTD_outBuffer output = {out_.data(), out_.size(), 0};
+    size_t ret = ZSTD_decompressStream((ZSTD_DStream*)stream_, &output, &input);
+    ABORT_IF(ZSTD_isError(ret), "Error decompressing zstd file: {}", ZSTD_getErrorName(ret));
+    inPos_ = input.pos;
+    setg(out_.data(), out_.data(), out_.data() + output.pos);
+  }
+  return traits_type::to_int_type(*gptr());
+}
+#endif
+
+}  // namespace io
+}  // namespace marian
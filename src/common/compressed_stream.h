@@ -0,0 +1,69 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace marian {
+namespace io {
+
+/**
+ * A streambuf that decompresses a file of independently compressed blocks on a shared thread pool, several blocks
+ * ahead of the reader, so that reading a compressed corpus is not limited by a single decompressing thread. The file
+ * is read from source, which stays owned by the caller. Two formats consist of such blocks:
+ *  - gzip files written by bgzip (BGZF), whose blocks of up to 64KB each carry their compressed size,
+ *  - zstd files in the seekable format, e.g. from `zstd --seekable` or t2sz, whose frame sizes are in a seek table
+ *    at the end of the file.
+ */
+class BlockDecompressBuf : public std::streambuf {
+public:
+  // returns a streambuf that decompresses source if the file at path is BGZF or seekable zstd, otherwise nullptr
+  static std::unique_ptr<std::streambuf> open(const std::string& path, std::streambuf* source);
+
+  // reads the next compressed block from source into block, returns false at the end of the blocks
+  typedef std::function<bool(std::streambuf* source, std::vector<char>& block)> ReadBlockFunc;
+  typedef std::function<std::vector<char>(const std::vector<char>& block)> DecompressFunc;
+
+  BlockDecompressBuf(std::streambuf* source, ReadBlockFunc readBlock, DecompressFunc decompress);
+
+protected:
+  int_type underflow() override;
+
+private:
+  void readAhead();
+
+  std::streambuf* source_;
+  ReadBlockFunc readBlock_;
+  DecompressFunc decompress_;
+  bool sourceEnded_{false};
+
+  std::deque<std::future<std::vector<char>>> blocks_; // blocks being decompressed, in order
+  std::vector<char> current_;                         // the decompressed block that is being read
+};
+
+#ifdef USE_ZSTD
+// A streambuf that decompresses a zstd file that is not in the seekable format, on the reading thread
+class ZstdStreamBuf : public std::streambuf {
+public:
+  explicit ZstdStreamBuf(std::streambuf* source);
+  ~ZstdStreamBuf();
+
+protected:
+  int_type underflow() override;
+
+private:
+  std::streambuf* source_;
+  void* stream_; // ZSTD_DStream, not declared here to keep zstd.h out of this header
+  std::vector<char> in_;
+  size_t inPos_{0};
+  size_t inSize_{0};
+  std::vector<char> out_;
+};
+#endif
+
+}  // namespace io
+}  // namespace marian
@@ -1,6 +1,7 @@
 #include "common/config.h"
 #include "common/config_parser.h"
 #include "common/file_stream.h"
+#include "common/filesystem.h"
 #include "common/logging.h"
 #include "common/options.h"
 #include "common/regex.h"
@@ -8,8 +9,11 @@
 #include "common/version.h"
 
 #include <algorithm>
+#include <map>
+#include <mutex>
 #include <set>
 #include <string>
+#include <tuple>
 
 namespace marian {
 
@@ -279,15 +283,68 @@ Ptr<Options> parseOptions(int argc, char** argv, cli::mode mode, bool validate)
   return cp.parseOptions(argc, argv, validate);
 }
 
+// the model files that parsing reads the model configuration from, with their sizes and modification times
+typedef std::vector<std::tuple<std::string, size_t, time_t>> ModelStamps;
+
+static ModelStamps modelStamps(Ptr<Options> options, cli::mode mode) {
+  std::vector<std::string> paths;
+  if(mode == cli::mode::translation || mode == cli::mode::server)
+    paths = options->get<std::vector<std::string>>("models", {});
+  else
+    paths.push_back(options->get<std::string>("model", ""));
+
+  ModelStamps stamps;
+  for(const auto& path : paths) {
+    bool exists = !path.empty() && filesystem::exists(path);
+    stamps.emplace_back(path, exists ? filesystem::fileSize(path) : 0, exists ? filesystem::lastWriteTime(path) : 0);
+  }
+  return stamps;
+}
+
 Ptr<Options> parseOptions(const std::string& args, cli::mode mode, bool validate) {
   std::vector<std::string> vArgs = utils::split(args, " ");
 
+  // Embedded use creates translators and the like from the same arguments again and again, e.g. one per tenant. Their
+  // options are parsed once and cloned afterwards, as long as the model files are unchanged. Training, which may reload
+  // its configuration, and arguments that read config files or the environment are parsed every time.
+  bool cacheable = mode != cli::mode::training;
+  for(const auto& arg : vArgs)
+    if(arg == "-c" || arg.rfind("--config", 0) == 0 || arg.rfind("--interpolate-env-vars", 0) == 0)
+      cacheable = false;
+
+  typedef std::tuple<int, bool, std::string> Key;
+  static std::map<Key, std::pair<Ptr<Options>, ModelStamps>> parsed;
+  static std::mutex mutex;
+  const size_t maxParsed = 64;
+  Key key((int)mode, validate, args);
+
+  if(cacheable) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = parsed.find(key);
+    if(it != parsed.end() && modelStamps(it->second.first, mode) == it->second.second) {
+      auto options = it->second.first->clone();
+      // what parsing sets besides the options
+      auto seed = options->get<size_t>("seed", 0);
+      Config::seed = seed == 0 ? (size_t)time(0) : seed;
+      LOG(debug, "[config] Reusing the options parsed from the same arguments before");
+      return options;
+    }
+  }
+
   std::string dummy("marian");
   std::vector<char*> cArgs = { &dummy[0] };
   for(auto& arg : vArgs)
     cArgs.push_back(&arg[0]);
 
-  return parseOptions((int)cArgs.size(), cArgs.data(), mode, validate);
+  auto options = parseOptions((int)cArgs.size(), cArgs.data(), mode, validate);
+
+  if(cacheable) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(parsed.size() >= maxParsed)
+      parsed.clear();
+    parsed[key] = std::make_pair(options->clone(), modelStamps(options, mode));
+  }
+  return options;
 }
 
 std::ostream& operator<<(std::ostream& out, const Config& config) {
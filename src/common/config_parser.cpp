@@ -45,6 +45,8 @@ const std::set<std::string> PATHS = {
   "data-weighting",
   "log",
   "sqlite",           // except: 'temporary', handled in the processPaths function
+  "binary-corpus",
+  "train-mixture",
   "shortlist",        // except: only the first element in the sequence is a path, handled in the
                       //  processPaths function
 };
@@ -124,11 +126,38 @@ void ConfigParser::addOptionsGeneral(cli::CLIWrapper& cli) {
   cli.add<int>("--workspace,-w",
     "Preallocate arg MB of work space. Negative `--workspace -N` value allocates workspace as total available GPU memory minus N megabytes.",
     defaultWorkspace);
+  cli.add<std::string>("--memory-profile",
+    "Write a Chrome trace (chrome://tracing) of the node memory of each graph to arg, with the device inserted before "
+    "the extension, e.g. memory.gpu0.json");
+  cli.add<size_t>("--memory-profile-passes",
+    "Number of forward passes, with their backward passes in training, that --memory-profile records. In translation "
+    "every decoder step is a forward pass",
+    2);
+  cli.add<size_t>("--profile-nodes",
+    "Time every node of the first arg forward passes, with their backward passes in training, and log the operators "
+    "that take the most time. Set MARIAN_PROFILE_SYNC=1 to synchronize GPUs around every node. 0 disables it",
+    0);
+  cli.add<size_t>("--profile-nodes-top",
+    "Number of operators in the table of --profile-nodes",
+    20);
+  cli.add<std::string>("--profile-nodes-trace",
+    "Also write every node call of --profile-nodes as a Chrome trace to arg, with the device inserted before the "
+    "extension");
+  cli.add<bool>("--profile-nodes-counters",
+    "Add the instructions per cycle, last-level cache misses and estimated memory bandwidth of every operator from "
+    "the hardware counters to the table of --profile-nodes on the CPU. Linux only, see perf_event_paranoid");
+  cli.add<bool>("--allocator-size-classes",
+    "Round workspace allocations up to size classes and reuse freed blocks of the same class instead of the "
+    "best-fitting gap. Avoids fragmentation from inputs of varying sizes for at most 25% more memory per tensor");
   cli.add<std::string>("--log",
     "Log training process information to file given by arg");
   cli.add<std::string>("--log-level",
     "Set verbosity level of logging: trace, debug, info, warn, err(or), critical, off",
     "info");
+  cli.add<size_t>("--log-async",
+    "Queue up to arg log messages and write them on a background thread that flushes the log files every second, "
+    "instead of writing and flushing on the calling thread. 0 = off",
+    0);
   cli.add<std::string>("--log-time-zone",
     "Set time zone for the date shown on logging");
   cli.add<bool>("--quiet",
@@ -165,6 +194,29 @@ void ConfigParser::addOptionsServer(cli::CLIWrapper& cli) {
   cli.add<size_t>("--port,-p",
       "Port number for web socket server",
       8080);
+  cli.add<bool>("--stream",
+      "Send every sentence as its own message '<line number>\\t<translation>' as soon as it is translated, "
+      "before the message with the complete translation");
+  cli.add<size_t>("--batch-wait-ms",
+      "Collect requests from all connections for up to arg milliseconds and translate them together. "
+      "0 translates every request on its own",
+      0);
+  cli.add<size_t>("--batch-max-words",
+      "Translate the collected requests as soon as they contain arg source words, 0 means no limit. "
+      "Only used with --batch-wait-ms",
+      0);
+  cli.add<size_t>("--request-timeout-ms",
+      "Drop requests that have not been translated within arg milliseconds after their arrival, 0 means never. "
+      "Only used with --batch-wait-ms, which also schedules requests to /translate before those to /translate/bulk",
+      0);
+  cli.add<size_t>("--log-requests-ms",
+      "Log the translation times of requests at most once per arg milliseconds, as the number of requests and "
+      "their mean and maximum time since the last such message. 0 logs every request",
+      0);
+  cli.add<size_t>("--metrics-port",
+      "Serve request latencies, queue depth, batch fill ratios, word counts, workspace size and cache hit "
+      "counts in the Prometheus text format at http://<host>:arg/metrics. 0 disables metrics",
+      0);
   cli.switchGroup(previous_group);
   // clang-format on
 }
@@ -190,6 +242,10 @@ void ConfigParser::addOptionsModel(cli::CLIWrapper& cli) {
   if(mode_ == cli::mode::translation) {
     cli.add<bool>("--model-mmap",
       "Use memory-mapping when loading model (CPU only)");
+    cli.add<bool>("--model-mmap-lazy",
+      "Read the parameters of a memory-mapped *.bin model from disk only when they are used and without read-ahead, "
+      "e.g. for the embeddings of languages that are rarely translated. The kernel evicts them again when memory "
+      "runs short. Parameters that are converted to another type or uploaded to a GPU are still read at start-up");
   }
 #endif
   cli.add<bool>("--ignore-model-config",
@@ -276,6 +332,10 @@ void ConfigParser::addOptionsModel(cli::CLIWrapper& cli) {
   cli.add<int>("--transformer-heads",
       "Number of heads in multi-head attention (transformer)",
       8);
+  cli.add<int>("--transformer-heads-kv",
+      "Number of key and value heads for grouped-query attention, each shared by --transformer-heads / arg query heads, "
+      "1 for multi-query attention. 0 means --transformer-heads. Only for --type transformer-new",
+      0);
   cli.add<bool>("--transformer-no-projection",
       "Omit linear projection after multi-head attention (transformer)");
   cli.add<bool>("--transformer-rnn-projection",
@@ -297,6 +357,21 @@ void ConfigParser::addOptionsModel(cli::CLIWrapper& cli) {
   cli.add<std::string>("--transformer-ffn-activation",
       "Activation between filters: swish or relu (transformer)",
       "swish");
+  cli.add<int>("--transformer-moe-experts",
+      "Replace the position-wise feed-forward networks with sparse mixtures of arg experts, each of the size of "
+      "--transformer-dim-ffn (transformer-new). Disabled with 0",
+      0);
+  cli.add<int>("--transformer-moe-top-k",
+      "Number of experts of --transformer-moe-experts that process each word",
+      2);
+  cli.add<float>("--transformer-moe-capacity-factor",
+      "Each expert processes at most arg times its even share of the words of a batch, further words skip it",
+      1.25f);
+  cli.add<float>("--transformer-moe-balance-weight",
+      "Weight of the auxiliary loss that balances the words over the experts of --transformer-moe-experts",
+      0.01f);
+  cli.add<bool>("--transformer-packed-ffn",
+      "Run the position-wise feed-forward networks on the unmasked words of a batch only, without padding (transformer)");
   cli.add<int>("--transformer-dim-aan",
       "Size of position-wise feed-forward network in AAN (transformer)",
       2048);
@@ -309,8 +384,12 @@ void ConfigParser::addOptionsModel(cli::CLIWrapper& cli) {
   cli.add<bool>("--transformer-aan-nogate",
       "Omit gate in AAN (transformer)");
   cli.add<std::string>("--transformer-decoder-autoreg",
-      "Type of autoregressive layer in transformer decoder: self-attention, average-attention (transformer)",
+      "Type of autoregressive layer in transformer decoder: self-attention, average-attention (transformer), "
+      "rnn (transformer-new)",
       "self-attention");
+  cli.add<bool>("--transformer-encoder-causal",
+      "Let every source position attend only to itself and the positions before it in transformer encoder "
+      "self-attention, so that the encodings of a prefix do not depend on the words after it");
   cli.add<std::vector<size_t>>("--transformer-tied-layers",
       "List of tied decoder layers (transformer)");
   cli.add<std::string>("--transformer-guided-alignment-layer",
@@ -362,6 +441,13 @@ void ConfigParser::addOptionsModel(cli::CLIWrapper& cli) {
       "Don't use any bias vectors in linear layers");
   cli.add<bool>("--transformer-no-affine",
       "Don't use any scale or bias vectors in layer norm");
+  cli.add<int>("--lora-rank",
+      "Add low-rank adapters (LoRA) of this rank to the linear layers of --type transformer-new and train only them, "
+      "e.g. to fine-tune a --pretrained-model. 0 disables them",
+      0);
+  cli.add<float>("--lora-alpha",
+      "Scale the output of the low-rank adapters by arg / --lora-rank",
+      16.f);
 
   cli.add<std::string>("--bert-mask-symbol", "Masking symbol for BERT masked-LM training", "[MASK]");
   cli.add<std::string>("--bert-sep-symbol", "Sentence separator symbol for BERT next sentence prediction training", "[SEP]");
@@ -386,7 +472,6 @@ void ConfigParser::addOptionsModel(cli::CLIWrapper& cli) {
   cli.add<bool>("--comet-prepend-zero", "Add a start symbol to batch entries");
   cli.add<bool>("--comet-use-separator", "Add a sentence separator to batch entries when joining source, target and mt", false);
 
-#ifdef CUDNN
   cli.add<int>("--char-stride",
       "Width of max-pooling layer after convolution layer in char-s2s model",
       5);
@@ -399,7 +484,6 @@ void ConfigParser::addOptionsModel(cli::CLIWrapper& cli) {
   cli.add<std::vector<int>>("--char-conv-filters-widths",
       "Convolution window widths in char-s2s model",
       {1, 2, 3, 4, 5, 6, 7, 8});
-#endif
 
   if(mode_ == cli::mode::training) {
     // TODO: add ->range(0,1);
@@ -437,6 +521,17 @@ void ConfigParser::addOptionsTraining(cli::CLIWrapper& cli) {
       "Setting --overwrite-checkpoint=false also saves full checkpoints checkpoints with optimizer parameters, etc. "
       "Uses (a lot) more disk space.",
       true);
+  cli.add<bool>("--async-checkpoints",
+      "Write model files and checkpoints in the background, training continues once they have been copied to host "
+      "memory. The final model is written before training exits");
+  cli.add<bool>("--sharded-checkpoints",
+      "Each process writes the optimizer state of its devices to model.npz.optimizer.part<k>.npz instead of gathering "
+      "it into model.npz.optimizer.npz, listed in model.npz.optimizer.manifest.yml. The parts are re-sharded "
+      "if training continues with a different number of processes, marian-conv --consolidate-checkpoint "
+      "merges them into a regular checkpoint");
+  cli.add<bool>("--elastic-restart",
+      "When training continues from a checkpoint written with a different number of devices, e.g. after nodes of "
+      "a preemptible pool were lost or added, scale --optimizer-delay to keep the effective batch size");
   cli.add<bool>("--no-reload",
       "Do not load existing model specified in --model arg");
   cli.add<bool>("--no-optimizer-reload",
@@ -480,6 +575,10 @@ void ConfigParser::addOptionsTraining(cli::CLIWrapper& cli) {
   cli.add<bool>("--disp-label-counts",
       "Display label counts when logging loss progress",
       true);
+  cli.add<bool>("--disp-timing",
+      "Display the share of the time since the last display spent waiting for data, building graphs, in the forward "
+      "and backward passes, the gradient communication, the optimizer and validation. Synchronizes the devices after "
+      "each phase, which slows training down a little (synchronous SGD only)");
 //   cli.add<int>("--disp-label-index",
 //       "Display label counts based on i-th input stream (-1 is last)", -1);
   cli.add<std::string/*SchedulerPeriod*/>("--save-freq",
@@ -502,6 +601,9 @@ void ConfigParser::addOptionsTraining(cli::CLIWrapper& cli) {
       "Shortcut for backwards compatiblity, equivalent to --shuffle none (deprecated)");
   cli.add<bool>("--no-restore-corpus",
       "Skip restoring corpus state after training is restarted");
+  cli.add<bool>("--shard-data",
+      "With several MPI processes, each one reads, shuffles and batches only every N-th sentence of the training data "
+      "instead of all of it. The main process collects the statistics of --mini-batch-fit for all of them");
   cli.add<std::string>("--tempdir,-T",
       "Directory for temporary (shuffled) files and database",
       "/tmp");
@@ -511,13 +613,51 @@ void ConfigParser::addOptionsTraining(cli::CLIWrapper& cli) {
     ->implicit_val("temporary");
   cli.add<bool>("--sqlite-drop",
       "Drop existing tables in sqlite3 database");
+  cli.add<std::string>("--binary-corpus",
+      "Read the training corpus as word ids from a memory-mapped binary file at this path. It is created from "
+      "--train-sets and --vocabs if it does not exist, later runs reuse it without reading and encoding the text. Unlike --sqlite it needs neither a database nor "
+      "random() queries to shuffle");
+  cli.add<size_t>("--binary-corpus-readahead",
+      "Request the pages of this many shuffled sentences of --binary-corpus ahead of reading them, 0 leaves reading "
+      "to the page faults",
+      4096);
+  cli.add<std::vector<std::string>>("--train-mixture",
+      "Paths to further training corpora that are mixed with --train-sets, as many files for each as --train-sets, "
+      "e.g. source2 target2 source3 target3. Each corpus is read in a loop from its own position and every sentence "
+      "is drawn from one of them at random. An epoch ends when each was read to its end at least once");
+  cli.add<std::vector<float>>("--mixture-weights",
+      "Sampling weights of --train-sets and each corpus of --train-mixture, equal by default");
+  cli.add<std::vector<float>>("--mixture-temperature",
+      "Draw from corpus i with probability proportional to weight_i^(1/arg). With two values, the temperature moves "
+      "linearly from the first to the second over --mixture-temperature-sentences sentences",
+      {1.f});
+  cli.add<size_t>("--mixture-temperature-sentences",
+      "Number of drawn sentences over which --mixture-temperature moves from its first to its second value");
+  cli.add<bool>("--benchmark",
+      "Measure the training speed on batches of random word ids instead of --train-sets, with the vocabularies of "
+      "--vocabs if they exist or of the sizes of --dim-vocabs. Neither loads, validates nor saves the model, ends "
+      "after one epoch unless --after is given and reports the words per second, the time per update of each phase "
+      "and the memory of each device. Requires --sync-sgd");
+  cli.add<std::vector<float>>("--benchmark-lengths",
+      "Mean and standard deviation of the normally distributed lengths of the sentences of --benchmark in tokens, "
+      "one pair for all streams or a pair for each",
+      {25.f, 10.f});
+  cli.add<size_t>("--benchmark-sentences",
+      "Number of sentences of an epoch of --benchmark",
+      1000000);
+  cli.add<size_t>("--benchmark-warmup",
+      "Number of updates of --benchmark that are not measured",
+      10);
+  cli.add<bool>("--train-feed",
+      "Read the training sentences as word ids of --vocabs from the data given to Trainer.train() of pymarian instead "
+      "of --train-sets");
 
   addSuboptionsDevices(cli);
   addSuboptionsBatching(cli);
 
   // optimizer options
   cli.add<std::string>("--optimizer,-o",
-     "Optimization algorithm: sgd, adagrad, adam",
+     "Optimization algorithm: sgd, adagrad, adam, adam8bit, adafactor",
      "adam");
   cli.add<std::vector<float>>("--optimizer-params",
      "Parameters for optimization algorithm, e.g. betas for Adam. "
@@ -526,9 +666,26 @@ void ConfigParser::addOptionsTraining(cli::CLIWrapper& cli) {
      "SGD update delay (#batches between updates). 1 = no delay. "
      "Can be fractional, e.g. 0.1 to use only 10% of each batch",
      1.f);
+  cli.add<size_t>("--optimizer-delay-words",
+     "Synchronous SGD: accumulate the gradients of batches until they have at least this many target labels, "
+     "then update. Batches are read as with --optimizer-delay 1, with --mini-batch-fit what fits into the devices. "
+     "0 = off",
+     0);
+  cli.add<bool>("--fused-optimizer",
+     "Update the parameters, optimizer state and exponential smoothing in one pass per update (Adam only)");
 
   cli.add<bool>("--sync-sgd",
      "Use synchronous SGD instead of asynchronous for multi-gpu training");
+  cli.add<size_t>("--async-staleness",
+     "Asynchronous SGD: a device waits before fetching parameters if it pushed more than this many updates "
+     "beyond the slowest busy device. 0 = no bound",
+     0);
+  cli.add<bool>("--pipeline-parallel",
+     "Train an encoder-decoder model on two devices, the encoders on the first and the decoder on the second, "
+     "with the micro-batches of --pipeline-micro-batches in a pipeline");
+  cli.add<size_t>("--pipeline-micro-batches",
+     "Split each batch of --pipeline-parallel into arg micro-batches",
+     4);
 
   // learning rate options
   cli.add<float>("--learn-rate,-l",
@@ -570,6 +727,18 @@ void ConfigParser::addOptionsTraining(cli::CLIWrapper& cli) {
 
   cli.add<double>("--label-smoothing",
      "Epsilon for label smoothing (0 to disable)");
+  cli.add<int>("--chunked-output-loss",
+     "Compute the output layer and cross-entropy of a batch in blocks of arg rows, holding only their logits "
+     "(0 to disable). Trades a second output GEMM in the backward pass for the memory of the full logits",
+     0);
+  cli.add<size_t>("--sampled-softmax",
+     "Train the output layer on a sampled softmax over arg candidates per batch: its target words and words drawn "
+     "log-uniformly by vocabulary id, whose logits are corrected by their sampling probability (0 to disable)",
+     0);
+  cli.add<std::string/*SchedulingParameter*/>("--sampled-softmax-until",
+     "Train on the full softmax from arg on to fine-tune the output layer at the end of training: "
+     "updates (u), target labels (t) or epochs (e). 0 to sample until the end",
+     "0");
   cli.add<double>("--factor-weight",
      "Weight for loss function for factors (factored vocab only) (1 to disable)", 1.0f);
   cli.add<float>("--clip-norm",
@@ -579,6 +748,11 @@ void ConfigParser::addOptionsTraining(cli::CLIWrapper& cli) {
      "Maintain smoothed version of parameters for validation and saving with smoothing factor. 0 to disable. "
       "Auto-adjusted to --mini-batch-words-ref if given.",
      0.f)->implicit_val("1e-4");
+  cli.add<size_t>("--exponential-smoothing-freq",
+     "Update the smoothed parameters only every arg updates, by as much as the decays of the arg updates together",
+     1);
+  cli.add<bool>("--exponential-smoothing-async",
+     "Update the smoothed parameters on a background thread while the next batch is computed (CPU devices only)");
   cli.add<std::string/*SchedulerPeriod*/>("--exponential-smoothing-replace-freq",
       "When exponential-smoothing is enabled replace master parameters with smoothed parameters once every n steps (possible units u=updates, t=target labels, e=epochs)",
       "0");
@@ -695,6 +869,15 @@ void ConfigParser::addOptionsValidation(cli::CLIWrapper& cli) {
       "Reset stalled validation metrics when the training is restarted");
   cli.add<bool>("--valid-reset-all",
       "Reset all validation metrics when the training is restarted");
+  cli.add<bool>("--valid-async",
+      "Validate a copy of the (smoothed) parameters in the background while training continues and report the "
+      "results when they are ready. The final validation still runs on the training graphs");
+  cli.add<std::string>("--valid-async-device",
+      "Device of the background validation with --valid-async: cpu or the id of a GPU, empty for the first "
+      "training device");
+  cli.add<size_t>("--valid-async-workspace",
+      "Preallocate arg MB of work space for the background validation with --valid-async",
+      512);
   cli.add<size_t>("--early-stopping",
       "Stop if the first validation metric does not improve for arg consecutive validation steps",
       10);
@@ -772,6 +955,11 @@ void ConfigParser::addOptionsTranslation(cli::CLIWrapper& cli) {
   cli.add<std::string>("--output,-o",
       "Path to output file, stdout by default",
       "stdout");
+  cli.add<bool>("--output-unordered",
+      "Print translations as soon as they are finished, prefixed with the line number and a tab unless --n-best");
+  cli.add<size_t>("--output-reorder-window",
+      "Stop reading batches while this many translations wait for an earlier one to be printed, 0 for no limit",
+      0);
   cli.add<std::vector<std::string>>("--vocabs,-v",
       "Paths to vocabulary files have to correspond to --input");
   // decoding options
@@ -786,12 +974,25 @@ void ConfigParser::addOptionsTranslation(cli::CLIWrapper& cli) {
       3);
   cli.add<float>("--word-penalty",
       "Subtract (arg * translation length) from translation score");
+  cli.add<float>("--beam-prune-relative",
+      "Drop the hypotheses of a beam whose probability is less than arg times the one of its best hypothesis, "
+      "which narrows the beam of the sentence for the remaining steps. Disabled with 0",
+      0.f);
+  cli.add<float>("--beam-prune-absolute",
+      "Drop the hypotheses of a beam whose path score is more than arg below the one of its best hypothesis. "
+      "Disabled with 0",
+      0.f);
+  cli.add<bool>("--beam-prune-finished",
+      "Drop the unfinished hypotheses of a sentence whose path score is below the one of its best finished "
+      "hypothesis, which they cannot outscore without --normalize or --word-penalty");
   cli.add<bool>("--allow-unk",
       "Allow unknown words to appear in output");
   cli.add<bool>("--allow-special",
       "Allow special symbols to appear in output, e.g. for SentencePiece with byte-fallback do not suppress the newline symbol");
   cli.add<bool>("--n-best",
       "Generate n-best list");
+  cli.add<std::string>("--n-best-binary",
+      "Also write the n-best lists to this file in a binary format for rerankers, see BinaryNBestWriter");
   cli.add<std::string>("--alignment",
      "Return word alignment. Possible values: 0.0-1.0, hard, soft")
     ->implicit_val("1");
@@ -800,11 +1001,43 @@ void ConfigParser::addOptionsTranslation(cli::CLIWrapper& cli) {
      "Use either as `./marian-decoder --force-decode --input source.txt prefixes.txt [...]` where inputs and prefixes align on line-level or as "
      "`paste source.txt prefixes.txt | ./marian-decoder --force-decode --tsv --tsv-fields 2 [...]` when reading from stdin."
   );
+  cli.add<std::string>("--terminology",
+     "File with a tab-separated source and target phrase per line. If a source phrase occurs in a sentence, its translation "
+     "is constrained to contain the target phrase, with at most 64 terms per sentence");
   cli.add<bool>("--word-scores",
       "Print word-level scores. One score per subword unit, not normalized even if --normalize");
   cli.add<std::string/*SchedulerPeriod*/>("--stat-freq",
     "Display speed information every arg mini-batches. Disabled by default with 0, set to value larger than 0 to activate",
     "0");
+  cli.add<size_t>("--in-flight-batches",
+    "Number of batches decoded concurrently per device. Each slot keeps its own graph and workspace, so that "
+    "new batches can start while earlier ones are still finishing their longest sentences",
+    1);
+  cli.add<size_t>("--translation-cache",
+    "Keep translations in an LRU cache of up to arg MB and serve repeated input sentences from it "
+    "without decoding them again. Disabled with 0",
+    0);
+  cli.add<std::vector<size_t>>("--warmup-batch-sizes",
+    "Translate synthetic batches of these sizes on every graph when a translation service starts, so that the "
+    "first requests do not pay for graph construction, workspace growth and GEMM tuning. Disabled if empty");
+  cli.add<std::vector<size_t>>("--warmup-lengths",
+    "Source lengths of the synthetic batches of --warmup-batch-sizes",
+    {16});
+  cli.add<float>("--trace-sample-rate",
+    "Trace this fraction of the requests to a translation service or marian-server through tokenization, batching, "
+    "the encoder, the decoder steps and the output, see --trace-output. Disabled with 0",
+    0.f);
+  cli.add<std::string>("--trace-output",
+    "Append the traces of --trace-sample-rate as OpenTelemetry OTLP/JSON lines to this file, "
+    "e.g. for the otlpjsonfile receiver of the OpenTelemetry Collector",
+    "stderr");
+  cli.add<size_t>("--capture-slow-ms",
+    "Append requests to a translation service or marian-server that take at least this many milliseconds, with their "
+    "batches, options and shortlist, to --capture-output, see marian-bench --bench-replay. Disabled with 0",
+    0);
+  cli.add<std::string>("--capture-output",
+    "Replay file of --capture-slow-ms",
+    "slow-requests.yml");
 #ifdef USE_SENTENCEPIECE
   cli.add<bool>("--no-spm-decode",
       "Keep the output segmented into SentencePiece subwords");
@@ -828,25 +1061,79 @@ void ConfigParser::addOptionsTranslation(cli::CLIWrapper& cli) {
 
   cli.add<std::vector<std::string>>("--shortlist",
      "Use softmax shortlist: path first best prune");
+  cli.add<bool>("--shortlist-per-sentence",
+     "Select the lexical shortlist of --shortlist for every sentence instead of one union per batch. "
+     "The output layer multiplies each sentence with its own candidates in a batched GEMM");
+  cli.add<size_t>("--shortlist-sticky",
+     "Keep the lexical shortlist candidates of a decoding thread for arg batches after they were last selected, "
+     "so the shortlist stays stable across the batches of a document. Disabled with 0",
+     0);
+  cli.add<bool>("--shortlist-compact-embeddings",
+     "Look up the decoder input embeddings of a batch-level --shortlist in a compact copy of the short-listed rows, "
+     "gathered once per batch and shared with the output layer if the embeddings are tied");
   cli.add<std::vector<float>>("--weights",
       "Scorer weights");
+  cli.add<std::vector<std::string>>("--lora-adapters",
+      "Models trained with --lora-rank on the model of --models, whose adapters are loaded side by side onto it. A "
+      "source line that starts with <lora:N> is translated with adapter N of the list (0-based), the other lines with "
+      "the model alone. Batches mix the lines of all adapters, which share the weights of the model");
+  cli.add<bool>("--parallel-ensemble",
+      "Run every model of an ensemble after the first on a graph and a thread of its own, which build and forward "
+      "their decoding steps concurrently with the first one. Applies to CPU devices, where every member uses "
+      "--cpu-intra-op-threads threads of its own, and to beam search");
+  cli.add<size_t>("--speculative-decoding",
+      "Greedy speculative decoding: the last model given with --models drafts arg tokens per step, which the "
+      "remaining models verify in a single step. Output equals greedy decoding with the remaining models. "
+      "Disabled with 0",
+      0);
+  cli.add<std::vector<size_t>>("--early-exit-layers",
+      "Transformer decoder layers (from 1) after which a decoding step ends early if the output layer applied there "
+      "is confident about every hypothesis, see --early-exit-threshold. The layers above only add their keys and "
+      "values for the step");
+  cli.add<float>("--early-exit-threshold",
+      "Minimum difference between the probabilities of the best and the second best word of every hypothesis of a "
+      "step to end it at one of --early-exit-layers. Disabled with 0",
+      0.f);
   cli.add<std::vector<std::string>>("--output-sampling",
      "Noise output layer with gumbel noise. Implicit default is 'full 1.0' for sampling from full distribution"
      " with softmax temperature 1.0. Also accepts 'topk num temp' (e.g. topk 100 0.1) for top-100 sampling with"
      " temperature 0.1")
      ->implicit_val("full 1.0");
+  cli.add<size_t>("--num-samples",
+     "Sample this many translations of every source sentence with --output-sampling and --beam-size 1 and print them "
+     "as an --n-best list. The encoder runs once per sentence, its output is shared by the samples",
+     1);
   cli.add<std::vector<int>>("--output-approx-knn",
-     "Use approximate knn search in output layer (currently only in transformer)")
+     "Use approximate knn search in output layer (currently only in transformer): k and number of bits. "
+     "The number of bits may be omitted if the model contains an LSH index, see marian-conv --add-lsh")
      ->implicit_val("100 1024");
+  cli.add<int>("--transformer-tiled-attention",
+     "Compute transformer attention over at least arg keys in tiles with an online softmax, which never "
+     "materializes the attention matrix, e.g. for document-level inputs. Disabled with 0",
+     0);
+  cli.add<bool>("--transformer-encoder-prefix-cache",
+     "Reuse the encoder keys, values and outputs of the source words that a single-sentence batch shares "
+     "as a prefix with the previous one of its thread, e.g. the preceding sentences of document-level inputs. "
+     "Requires a model trained with --transformer-encoder-causal");
+  cli.add<bool>("--rnn-cudnn",
+     "Run the first bidirectional layer of s2s and amun encoders with GRU cells as one cuDNN bidirectional GRU on "
+     "GPUs. Requires compilation with -DUSE_CUDNN=on");
 
   // parameters for on-line quantization
   cli.add<bool>("--optimize",
       "Optimize the graph on-the-fly", false);
   cli.add<std::string>("--gemm-type,-g",
-     "GEMM Type to be used for on-line quantization/packing: float32, packed16, packed8", "float32");
+     "GEMM Type to be used for on-line quantization/packing: float32, packed16, packed8, or auto for float32 with "
+     "the split of every GEMM shape over --cpu-intra-op-threads tuned at runtime, see --autotune-cache", "float32");
   cli.add<float>("--quantize-range",
      "Range for the on-line quantiziation of weight matrix in multiple of this range and standard deviation, 0.0 means min/max quantization",
      0.f);
+  cli.add<std::string>("--sparse-gemm",
+     "Multiply with the float32 weight matrices of a model pruned to the N:MxW pattern arg of --prune-pattern, "
+     "e.g. 2:4x16, by a CPU kernel that reads only the non-zero weights");
+  cli.add<std::string>("--autotune-cache",
+     "Keep the tuned decisions of --gemm-type auto in this file, keyed by the CPU and the models, so that later runs "
+     "do not tune the same GEMM shapes again");
 
 #if 0 // @TODO: Ask Hany if there are any decoding-time options
   // add ULR settings
@@ -887,6 +1174,11 @@ void ConfigParser::addOptionsScoring(cli::CLIWrapper& cli) {
      ->implicit_val("1"),
   cli.add<bool>("--word-scores",
       "Print word-level scores. One score per subword unit, not normalized even if --normalize");
+  cli.add<bool>("--output-unordered",
+      "Print scores as soon as they are computed, prefixed with the line number and a tab unless --n-best");
+  cli.add<size_t>("--output-reorder-window",
+      "Stop reading batches while this many scores wait for an earlier one to be printed, 0 for no limit",
+      0);
 
   addSuboptionsInputLength(cli);
   addSuboptionsTSV(cli);
@@ -932,7 +1224,26 @@ void ConfigParser::addOptionsEmbedding(cli::CLIWrapper& cli) {
   cli.add<bool>("--compute-similarity",
       "Expect two inputs and compute cosine similarity instead of outputting embedding vector");
   cli.add<bool>("--binary",
-      "Output vectors as binary floats");
+      "Output vectors as binary floats, same as --output-format fp32");
+  cli.add<std::string>("--output-format",
+      "Format of the output vectors: text, fp32 or fp16 (raw little-endian floats) or npy (float32 numpy array, "
+      "requires an output file)",
+      "text");
+  cli.add<bool>("--output-unordered",
+      "Write vectors as soon as they are computed and their sentence ids to the sidecar file <output>.ids "
+      "(<name>.ids.npy for <name>.npy), instead of in input order");
+  cli.add<size_t>("--output-shards",
+      "Write sentence i to the unordered shard i % N, the files <output> with .0, .1, ... before the extension",
+      1);
+  cli.add<std::string>("--search-targets",
+      "Embed the sentences of this file and print the --search-k nearest of them for every input sentence as "
+      "'source id<tab>target id<tab>cosine<tab>margin' instead of the vectors");
+  cli.add<int>("--search-k",
+      "Number of neighbours for --search-targets, also used for the margin",
+      4);
+  cli.add<std::string>("--search-index",
+      "Index for --search-targets: exact (all cosines on the device) or lsh (hamming distance of the sign bits on the CPU)",
+      "exact");
 
   addSuboptionsInputLength(cli);
   addSuboptionsTSV(cli);
@@ -988,6 +1299,9 @@ void ConfigParser::addOptionsEvaluating(cli::CLIWrapper& cli) {
       "Report average of all sentence-level values. By default the average is appended as the last line. "
       "Alternatively, we can provide `--average only` which supresses other values.",
       "skip")->implicit_val("append");
+  cli.add<size_t>("--mbr",
+      "Minimum Bayes risk decoding with a COMET model: the input has N candidate translations per source on "
+      "consecutive lines as source<tab>candidate, prints the candidate with the highest mean score against all others");
 
   addSuboptionsInputLength(cli);
   addSuboptionsTSV(cli);
@@ -1000,6 +1314,15 @@ void ConfigParser::addOptionsEvaluating(cli::CLIWrapper& cli) {
       "Mixed precision for inference, set parameter type in expression graph. Supported values: float32, float16",
       {"float32"});
 
+  // parameters for on-line quantization
+  cli.add<bool>("--optimize",
+      "Optimize the graph on-the-fly", false);
+  cli.add<std::string>("--gemm-type,-g",
+     "GEMM Type to be used for on-line quantization/packing: float32, packed16, packed8", "float32");
+  cli.add<float>("--quantize-range",
+     "Range for the on-line quantiziation of weight matrix in multiple of this range and standard deviation, 0.0 means min/max quantization",
+     0.f);
+
   cli.add<std::string>("--like",
       "Set good defaults for supported metric types: comet-qe, comet, bleurt");
 
@@ -1069,6 +1392,24 @@ void ConfigParser::addSuboptionsDevices(cli::CLIWrapper& cli) {
       "When using NCCL and MPI for multi-process training use 'global' (default, less memory usage) "
       "or 'local' (more memory usage but faster) sharding",
       {"global"});
+    cli.add<std::string>("--all-reduce",
+      "How NCCL reduces gradients in multi-process training with global sharding: 'flat' (default) all-reduces over "
+      "all GPUs at once, 'hierarchical' reduce-scatters within each process, all-reduces the chunks across processes "
+      "and all-gathers them back, so that only one chunk per GPU crosses between nodes",
+      "flat");
+    cli.add<size_t>("--gradient-bucket-mb",
+      "With NCCL, global sharding and flat --all-reduce, reduce the gradients of the last sub-batch in buckets of "
+      "about this many MB as soon as the backward pass computed them, overlapping communication and computation. "
+      "0 reduces all gradients after the backward pass",
+      0);
+    cli.add<std::string>("--gradient-compression",
+      "With NCCL, global sharding and flat --all-reduce, compress the gradients that are summed over GPUs, keeping "
+      "what is lost for the next update: 'fp16' sums them in half precision, 'powersgd' sums a low-rank "
+      "approximation of each matrix, see --gradient-compression-rank. 'none' (default) sums them exactly",
+      "none");
+    cli.add<size_t>("--gradient-compression-rank",
+      "Rank of the approximations of --gradient-compression powersgd",
+      4);
     cli.add<std::string/*SchedulerPeriod*/>("--sync-freq",
       "When sharding is local sync all shards across processes once every n steps (possible units u=updates, t=target labels, e=epochs)",
       "200u");
@@ -1083,6 +1424,62 @@ void ConfigParser::addSuboptionsDevices(cli::CLIWrapper& cli) {
   cli.add<size_t>("--cpu-threads",
       "Use CPU-based computation with this many independent threads, 0 means GPU-based computation",
       1);
+#endif
+  cli.add<size_t>("--cpu-intra-op-threads",
+      "Split large kernels (GEMMs, softmax, layer normalization and transposes) of each CPU graph of "
+      "--cpu-threads across this many threads, for lower latency per batch at the cost of throughput",
+      1);
+  if(mode_ == cli::mode::translation) {
+    cli.add<size_t>("--memory-plans",
+      "Plan the memory of up to this many different forward passes ahead of time from their first run, so that "
+      "repeated passes, e.g. decoder steps of the same batch shape, skip the workspace allocator. 0 disables plans",
+      0);
+    cli.add<bool>("--fuse-elementwise",
+      "Fuse chains of elementwise operations, e.g. relu(x * mask + b), into single operations before each forward "
+      "pass");
+    cli.add<bool>("--simplify-graph",
+      "Remove operations that do not change their input, e.g. transposes of axes of size 1, from the graph before "
+      "each forward pass");
+    cli.add<bool>("--shared-cpu-parameters",
+      "Let the graphs of --cpu-threads share one read-only copy of the model parameters and of the packed or "
+      "quantized weights computed from them instead of holding a copy each");
+    cli.add<bool>("--cpu-numa",
+      "Spread the graphs of --cpu-threads evenly over the NUMA nodes and bind the threads that build and run each "
+      "graph to the CPUs of its node, so that its workspace and parameters are in the memory of the node (Linux)");
+    cli.add<bool>("--cpu-numa-replicate",
+      "With --cpu-numa, give the graphs of each NUMA node their own copy of the model weights in the memory of the "
+      "node, instead of sharing the memory-mapped model or one copy of --shared-cpu-parameters between all nodes");
+    cli.add<size_t>("--frozen-graphs",
+      "Keep the transformer encoder graphs of up to this many different batch shapes and only re-bind their words "
+      "and masks for later batches of the same shape instead of building them again. 0 builds every batch",
+      0);
+  }
+#ifdef CUDA_FOUND
+  if(mode_ == cli::mode::translation) {
+    cli.add<size_t>("--cuda-graphs",
+      "Capture the GPU kernels of repeated decoder steps into up to this many CUDA graphs and replay them, "
+      "0 launches every kernel separately",
+      0);
+  }
+  if(mode_ == cli::mode::training || mode_ == cli::mode::translation) {
+    cli.add<size_t>("--fp8",
+      "Run the GEMMs of affine layers in FP8 on GPUs with FP8 tensor cores (compute capability 8.9 and higher), "
+      "with per-tensor scales from the largest absolute values over an amax history of arg steps. "
+      "Weights, gradients and optimizer state keep the types of --precision, 0 disables FP8",
+      0)
+    ->implicit_val("16");
+    cli.add<size_t>("--staged-loading",
+      "Upload the parameters of a loaded model to the GPU in the order of the model file through two page-locked "
+      "staging buffers of arg MB each, reading the next piece of the file while the previous one is copied. "
+      "0 copies each parameter synchronously when it is first used",
+      64);
+  }
+  if(mode_ == cli::mode::training) {
+    cli.add<size_t>("--pinned-uploads",
+      "Upload the indices, masks and weights of each batch to the GPU through two page-locked staging buffers "
+      "of arg MB each, without waiting for the kernels of the previous batch. 0 copies them synchronously",
+      8);
+  }
 #endif
   // clang-format on
 }
@@ -1103,6 +1500,18 @@ void ConfigParser::addSuboptionsBatching(cli::CLIWrapper& cli) {
                defaultMiniBatch);
   cli.add<int>("--mini-batch-words",
       "Set mini-batch size based on words instead of sentences");
+  cli.add<size_t>("--mini-batch-tokens",
+      "Set mini-batch size so that the batch size times the summed lengths of the longest sentences of all streams, "
+      "i.e. the tokens including padding, stays within arg. 0 = off",
+      0);
+
+  if(mode_ == cli::mode::embedding || mode_ == cli::mode::evaluating) {
+    cli.add<bool>("--mini-batch-fit",
+      "Determine mini-batch size automatically based on sentence-length to fit reserved memory in the forward pass");
+    cli.add<size_t>("--mini-batch-fit-step",
+      "Step size for mini-batch-fit statistics",
+      10);
+  }
 
   if(mode_ == cli::mode::training) {
     cli.add<bool>("--mini-batch-fit",
@@ -1110,20 +1519,40 @@ void ConfigParser::addSuboptionsBatching(cli::CLIWrapper& cli) {
     cli.add<size_t>("--mini-batch-fit-step",
       "Step size for mini-batch-fit statistics",
       10);
+    cli.add<bool>("--mini-batch-fit-cache",
+      "Save the mini-batch-fit statistics to model.batch-stats.yml and reuse them when training restarts with the same "
+      "options on the same kind of device. Disable with --mini-batch-fit-cache=false",
+      true);
     cli.add<bool>("--gradient-checkpointing",
       "Enable gradient-checkpointing to minimize memory usage");
+    cli.add<std::string>("--gradient-checkpointing-policy",
+      "Nodes that gradient checkpointing keeps: manual (layer outputs) or products (layer outputs and the outputs of "
+      "all matrix products, recomputing only the cheap operations in between)",
+      "manual");
+    cli.add<size_t>("--gradient-checkpointing-every",
+      "Keep only every arg-th layer output as a checkpoint with --gradient-checkpointing",
+      1);
+    cli.add<bool>("--activation-offloading",
+      "Offload the outputs of transformer layers to host memory between the forward and backward pass instead of "
+      "keeping them on the device. Cannot be combined with --gradient-checkpointing");
   }
 
   cli.add<int>("--maxi-batch",
       "Number of batches to preload for length-based sorting",
       defaultMaxiBatch);
   cli.add<std::string>("--maxi-batch-sort",
-      "Sorting strategy for maxi-batch: none, src, trg (not available for decoder)",
+      "Sorting strategy for maxi-batch: none, src, trg (not available for decoder), "
+      "trg-predicted (decoder only: output length predicted from already finished translations)",
       defaultMaxiBatchSort);
 
   if(mode_ == cli::mode::training) {
     cli.add<bool>("--shuffle-in-ram",
         "Keep shuffled corpus in RAM, do not write to temp file");
+    cli.add<size_t>("--shuffle-buffer",
+        "Shuffle uncompressed training files in chunks instead of reading them into RAM: chunks are read in random "
+        "order, several at a time, into a buffer of this many sentences, from which sentences are drawn at random. "
+        "0 = off",
+        0);
 
 #if DETERMINISTIC
     cli.add<size_t>("--data-threads",
@@ -1132,6 +1561,16 @@ void ConfigParser::addSuboptionsBatching(cli::CLIWrapper& cli) {
     cli.add<size_t>("--data-threads",
         "Number of concurrent threads to use during data reading and processing", 8);
 #endif
+    cli.add<size_t>("--data-prefetch",
+        "Number of maxi-batches that are read and split into batches ahead of training", 2);
+    cli.add<size_t>("--length-buckets",
+        "Split the target lengths up to --max-length into this many buckets and form batches within a bucket. "
+        "The sentences that do not fill a batch of their bucket wait for the next maxi-batch. 0 = off",
+        0);
+    cli.add<float>("--length-bucket-temperature",
+        "With --length-buckets, the next batch comes from a bucket drawn with probability proportional to its "
+        "number of batches to the power of 1/T: 1 = as --shuffle batches, larger values approach uniform buckets",
+        1.f);
 
     // @TODO: Consider making the next two options options of the vocab instead, to make it more local in scope.
     cli.add<size_t>("--all-caps-every",
@@ -1160,6 +1599,11 @@ void ConfigParser::addSuboptionsBatching(cli::CLIWrapper& cli) {
         "Number of concurrent threads to use during data reading and processing", 8);
 #endif
   }
+#ifdef USE_SENTENCEPIECE
+  cli.add<size_t>("--sentencepiece-cache",
+      "Cache the SentencePiece pieces of up to arg recently used words and encode lines word by word. Only for "
+      "models that split on whitespace, which is the default, and not with --sentencepiece-alphas sampling");
+#endif
   // clang-format on
 }
 
@@ -1225,6 +1669,18 @@ void ConfigParser::addSuboptionsQuantization(cli::CLIWrapper& cli) {
      "Uses log-based quantization");
   cli.add<bool>("--quantize-biases",
      "Apply quantization to biases");
+  // structured pruning
+  cli.add<std::string>("--prune-pattern",
+     "Prune the weight matrices apart from embeddings and output layer to N:M sparsity, keeping the N largest of every "
+     "M consecutive rows, e.g. 2:4, or N:MxW to keep the same rows for W columns at a time, e.g. 2:4x16 for "
+     "--sparse-gemm. Requires --sync-sgd");
+  cli.add<size_t>("--prune-after",
+     "Start pruning after arg updates, e.g. to fine-tune a trained model with the pruned weights",
+     0);
+  cli.add<size_t>("--prune-freq",
+     "Recompute the pruned weights every arg updates from their magnitudes after the update, so that pruned weights "
+     "can grow back. With 0, the weights pruned first stay pruned",
+     0);
   // clang-format on
 }
 
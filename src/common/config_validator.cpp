@@ -69,7 +69,10 @@ void ConfigValidator::validateOptionsTranslation() const {
 #ifdef COMPILE_CPU
   ABORT_IF(get<bool>("model-mmap") && get<size_t>("cpu-threads") == 0,
            "Model MMAP is CPU-only, please use --cpu-threads");
+  ABORT_IF(get<bool>("cpu-numa") && get<size_t>("cpu-threads") == 0,
+           "--cpu-numa is CPU-only, please use --cpu-threads");
 #endif
+  ABORT_IF(get<bool>("cpu-numa-replicate") && !get<bool>("cpu-numa"), "--cpu-numa-replicate requires --cpu-numa");
 
   for(const auto& modelFile : models) {
     filesystem::Path modelPath(modelFile);
@@ -83,6 +86,42 @@ void ConfigValidator::validateOptionsTranslation() const {
     filesystem::Path vocabPath(vocabFile);
     ABORT_IF(!filesystem::exists(vocabPath), "Vocabulary file does not exist: " + vocabFile);
   }
+
+  if(get<size_t>("num-samples") > 1) {
+    ABORT_IF(!has("output-sampling") || get<std::vector<std::string>>("output-sampling").empty(),
+             "--num-samples requires --output-sampling");
+    ABORT_IF(get<size_t>("beam-size") != 1, "--num-samples requires --beam-size 1, every sample is a greedy path");
+    ABORT_IF(!get<bool>("n-best"), "--num-samples requires --n-best to print the samples");
+    ABORT_IF(get<bool>("force-decode") || !get<std::string>("alignment").empty(),
+             "--num-samples does not support --force-decode or --alignment");
+  }
+
+  ABORT_IF(get<bool>("parallel-ensemble") && get<size_t>("speculative-decoding") > 0,
+           "--parallel-ensemble does not support --speculative-decoding");
+
+  auto adapters = get<std::vector<std::string>>("lora-adapters");
+  ABORT_IF(!adapters.empty() && models.size() != 1, "--lora-adapters are loaded onto a single model of --models");
+  for(const auto& adapterFile : adapters)
+    ABORT_IF(!filesystem::exists(filesystem::Path(adapterFile)), "Adapter file does not exist: " + adapterFile);
+
+  ABORT_IF(!get<std::string>("n-best-binary").empty() && !get<bool>("n-best"),
+           "--n-best-binary requires --n-best");
+
+  ABORT_IF(get<float>("beam-prune-relative") < 0.f || get<float>("beam-prune-relative") >= 1.f,
+           "--beam-prune-relative must be in [0, 1)");
+  ABORT_IF(get<float>("beam-prune-absolute") < 0.f, "--beam-prune-absolute must not be negative");
+
+  if(!get<std::string>("terminology").empty()) {
+    ABORT_IF(!filesystem::exists(filesystem::Path(get<std::string>("terminology"))),
+             "Terminology file does not exist: " + get<std::string>("terminology"));
+    ABORT_IF(get<bool>("force-decode"), "--terminology does not support --force-decode");
+    // the banks keep hypotheses with more constraint words over better scoring ones
+    ABORT_IF(get<float>("beam-prune-relative") > 0.f || get<float>("beam-prune-absolute") > 0.f
+             || get<bool>("beam-prune-finished"),
+             "--terminology does not support beam pruning");
+    ABORT_IF(has("shortlist") && !get<std::vector<std::string>>("shortlist").empty(),
+             "--terminology does not support --shortlist");
+  }
 }
 
 void ConfigValidator::validateOptionsParallelData() const {
@@ -90,6 +129,19 @@ void ConfigValidator::validateOptionsParallelData() const {
   if(dumpConfigOnly_)
     return;
 
+  // synthetic data for measuring the training speed
+  if(has("benchmark") && get<bool>("benchmark")) {
+    ABORT_IF(!get<bool>("sync-sgd"), "--benchmark requires --sync-sgd");
+    return;
+  }
+
+  // word ids handed over by the caller
+  if(has("train-feed") && get<bool>("train-feed")) {
+    ABORT_IF(!get<bool>("sync-sgd"), "--train-feed requires --sync-sgd");
+    ABORT_IF(get<std::vector<std::string>>("vocabs").empty(), "--train-feed requires --vocabs");
+    return;
+  }
+
   auto trainSets = get<std::vector<std::string>>("train-sets");
   ABORT_IF(trainSets.empty(), "No train sets given in config file or on command line");
 
@@ -139,6 +191,10 @@ void ConfigValidator::validateOptionsTraining() const {
   ABORT_IF(!modelDir.empty() && !filesystem::isDirectory(modelDir),
            "Model directory does not exist");
 
+  ABORT_IF(get<int>("lora-rank") < 0, "--lora-rank must not be negative");
+  ABORT_IF(get<int>("lora-rank") > 0 && get<std::string>("type") != "transformer-new",
+           "--lora-rank requires --type transformer-new");
+
   std::string errorMsg = "There should be as many validation files as training files";
   if(get<bool>("tsv"))
     errorMsg += ". If the training set is in the TSV format, validation sets have to also be a single TSV file";
@@ -177,6 +233,37 @@ void ConfigValidator::validateOptionsTraining() const {
            "ULR requires query and keys vectors specified with --ulr-query-vectors and "
            "--ulr-keys-vectors option");
 
+  // the chunked logits can only be read by the cross-entropy
+  ABORT_IF(get<int>("chunked-output-loss") < 0, "--chunked-output-loss must not be negative");
+  ABORT_IF(get<int>("chunked-output-loss") > 0 && get<bool>("unlikelihood-loss"),
+           "--chunked-output-loss does not support --unlikelihood-loss");
+
+  if(get<size_t>("sampled-softmax") > 0) {
+    auto vocabs = get<std::vector<std::string>>("vocabs");
+    ABORT_IF(!vocabs.empty() && utils::endsWith(vocabs.back(), ".fsv"),
+             "--sampled-softmax does not support factored vocabularies");
+  }
+
+  if(get<bool>("pipeline-parallel")) {
+    ABORT_IF(get<size_t>("pipeline-micro-batches") == 0, "--pipeline-micro-batches must be at least 1");
+    // the stages own disjoint parameters, the decoder does not see the weights of the encoders
+    ABORT_IF(get<bool>("tied-embeddings-src") || get<bool>("tied-embeddings-all"),
+             "--pipeline-parallel does not support embeddings tied between encoder and decoder");
+    ABORT_IF(has("valid-sets") && !get<std::vector<std::string>>("valid-sets").empty(),
+             "--pipeline-parallel does not support --valid-sets");
+    ABORT_IF(get<bool>("mini-batch-fit"), "--pipeline-parallel does not support --mini-batch-fit");
+    ABORT_IF(get<size_t>("quantize-bits") > 0, "--pipeline-parallel does not support --quantize-bits");
+  }
+
+  ABORT_IF(get<size_t>("length-buckets") > 0 && get<float>("length-bucket-temperature") <= 0.f,
+           "--length-bucket-temperature must be positive");
+
+  if(get<size_t>("optimizer-delay-words") > 0) {
+    ABORT_IF(!get<bool>("sync-sgd"), "--optimizer-delay-words requires --sync-sgd");
+    ABORT_IF(get<float>("optimizer-delay") != 1.f, "--optimizer-delay-words replaces --optimizer-delay");
+    ABORT_IF(get<bool>("pipeline-parallel"), "--pipeline-parallel does not support --optimizer-delay-words");
+  }
+
   // validate model quantization
   size_t bits = get<size_t>("quantize-bits");
   ABORT_IF(bits > 32, "Invalid quantization bits. Must be from 0 to 32 bits");
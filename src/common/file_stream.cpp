@@ -1,4 +1,5 @@
 #include "common/file_stream.h"
+#include "common/compressed_stream.h"
 #include "common/utils.h"
 
 #include <streambuf>
@@ -43,10 +44,21 @@ InputFileStream::InputFileStream(const std::string &file)
   ABORT_IF(!ret, "Error opening file ({}): {}", errno, file_.string());
   ABORT_IF(ret != streamBuf1_.get(), "Return value is not equal to streambuf pointer, that is weird");
 
-  // insert .gz decompression
-  if(marian::utils::endsWith(file, ".gz")) {
+  // insert .gz or .zst decompression, on several threads if the file consists of independent blocks
+  bool gz = marian::utils::endsWith(file, ".gz");
+  bool zst = marian::utils::endsWith(file, ".zst");
+  if(gz || zst) {
     streamBuf2_ = std::move(streamBuf1_);
-    streamBuf1_.reset(new zstr::istreambuf(streamBuf2_.get()));
+    if(!pipe_)
+      streamBuf1_ = BlockDecompressBuf::open(file_.string(), streamBuf2_.get());
+    if(!streamBuf1_ && gz)
+      streamBuf1_.reset(new zstr::istreambuf(streamBuf2_.get()));
+#ifdef USE_ZSTD
+    if(!streamBuf1_ && zst)
+      streamBuf1_.reset(new ZstdStreamBuf(streamBuf2_.get()));
+#else
+    ABORT_IF(!streamBuf1_, "Reading {} needs a build with zstd, see -DUSE_ZSTD", file);
+#endif
   }
 
   // initialize the underlying istream
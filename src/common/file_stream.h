@@ -51,7 +51,7 @@ public:
 protected:
   marian::filesystem::Path file_;
   std::unique_ptr<std::streambuf> streamBuf1_;  // main streambuf
-  std::unique_ptr<std::streambuf> streamBuf2_;  // in case of a .gz file
+  std::unique_ptr<std::streambuf> streamBuf2_;  // in case of a .gz or .zst file
   FILE* pipe_{};                                // in case of pipe syntax
   std::vector<char> readBuf_;
 };
@@ -105,6 +105,10 @@ namespace filesystem {
     return p.getImpl().size();
   }
 
+  static inline time_t lastWriteTime(const Path& p) {
+    return p.getImpl().mtime();
+  }
+
   static inline bool isDirectory(const Path& p) {
     return p.getImpl().is_directory();
   }
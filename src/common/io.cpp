@@ -10,6 +10,17 @@
 
 #include "training/communicator.h"
 
+#include "3rd_party/threadpool.h"
+
+#include <cstring>
+#include <map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 namespace marian {
 namespace io {
 
@@ -32,6 +43,27 @@ ModelWeights::FileType ModelWeights::getFileType(const std::string& fileName) {
     ABORT("Unknown file format for file {}", fileName);
 }
 
+Ptr<ModelWeights> ModelWeights::shared(const std::string& fileName, MmapMode mmapMode) {
+  static std::mutex registryMutex;
+  static std::map<std::pair<std::string, MmapMode>, std::weak_ptr<ModelWeights>> registry;
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  auto& entry = registry[{fileName, mmapMode}];
+  auto weights = entry.lock();
+  if(weights) {
+    LOG(info, "Sharing already opened model {}", fileName);
+  } else {
+    weights = New<ModelWeights>(fileName, mmapMode);
+    entry = weights;
+  }
+
+  // forget about models that are not used anymore
+  for(auto it = registry.begin(); it != registry.end();)
+    it = it->second.expired() ? registry.erase(it) : std::next(it);
+
+  return weights;
+}
+
 std::vector<Item>& ModelWeights::items() {
   load();
   return items_;
@@ -187,7 +219,37 @@ void ModelWeights::load() {
   loaded_ = true;
 }
 
-void ModelWeights::loadAndSync(Ptr<IMPIWrapper> mpi) {
+void ModelWeights::adviseRandomAccess() {
+  load();
+#ifndef _WIN32
+  if(mmap_ && mmap_->is_mapped() && madvise((void*)mmap_->data(), mmap_->mapped_length(), MADV_RANDOM) != 0)
+    LOG(warn, "[memory] Could not advise random access to memory-mapped model {}", fileName_);
+#endif
+}
+
+Ptr<ModelWeights> ModelWeights::replicate(Ptr<ModelWeights> weights) {
+  weights->load();
+  ABORT_IF(weights->fileType_ != FileType::isNpz && weights->fileType_ != FileType::isBin,
+           "Only the weights of model files can be replicated");
+  if(!weights->mmap_) {
+    auto replica = New<ModelWeights>(weights->fileName_, weights->mmapMode_, weights->locking_);
+    replica->load();
+    return replica;
+  }
+
+  // the binary format aligns the items to 256 bytes within the file
+  const size_t alignment = 256;
+  size_t bytes = weights->mmap_->size();
+  auto replica = New<ModelWeights>((const void*)nullptr, MmapMode::RequiredMmap, weights->locking_);
+  replica->fileName_ = weights->fileName_;
+  replica->replica_.resize(bytes + alignment); // writes the pages on the node of the calling thread
+  char* aligned = replica->replica_.data() + (alignment - (uintptr_t)replica->replica_.data() % alignment) % alignment;
+  std::memcpy(aligned, weights->mmap_->data(), bytes);
+  replica->ptr_ = aligned;
+  return replica;
+}
+
+void ModelWeights::loadAndSync(Ptr<IMPIWrapper> mpi, bool mapShared) {
   ABORT_IF(!mpi, "MPI wrapper is null");
   ABORT_IF(mmapMode_ != MmapMode::DontMmap, "Mmapping not allowed");
 
@@ -197,7 +259,7 @@ void ModelWeights::loadAndSync(Ptr<IMPIWrapper> mpi) {
   mpi->bCast(fileName_);
   mpi->bCast(&fileType_, 1, mpi->getDataType((size_t*)&fileType_));
   mpi->bCast(&loaded_,   1, mpi->getDataType(&loaded_));
-  mpi->bCast(items_);
+  mpi->bCastNodeShared(items_, mapShared);
 }
 
 // @TODO: make cnpy and our wrapper talk to each other in terms of types
@@ -245,7 +307,15 @@ void addMetaToItems(const std::string& meta,
   items.push_back(item);
 }
 
+// the AsyncSaver of the innermost AsyncSaver::Scope on this thread
+static thread_local AsyncSaver* asyncSaver = nullptr;
+
 void saveItems(const std::string& fileName, const std::vector<Item>& items) {
+  if(asyncSaver) {
+    asyncSaver->save(fileName, items);
+    return;
+  }
+
   if(isNpz(fileName)) {
     saveItemsNpz(fileName, items);
   } else if(isBin(fileName)) {
@@ -255,5 +325,60 @@ void saveItems(const std::string& fileName, const std::vector<Item>& items) {
   }
 }
 
+// so that a checkpoint that has been reported as written survives a crash of the machine
+static void syncFile(const std::string& fileName) {
+#ifndef _WIN32
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if(fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+#else
+  fileName;
+#endif
+}
+
+AsyncSaver::AsyncSaver() : writer_(new ThreadPool(1)) {}
+
+AsyncSaver::~AsyncSaver() {
+  try {
+    wait();
+  } catch(const std::exception& e) {
+    LOG(error, "Writing a checkpoint in the background failed: {}", e.what());
+  }
+}
+
+void AsyncSaver::save(const std::string& fileName, std::vector<Item> items) {
+  pending_.push_back(writer_->enqueue([fileName, items = std::move(items)]() {
+    saveItems(fileName, items); // there is no scope on the writer thread
+    syncFile(fileName);
+    LOG(info, "[training] Finished writing {} in the background", fileName);
+  }));
+}
+
+void AsyncSaver::wait() {
+  std::vector<std::future<void>> pending;
+  pending.swap(pending_);
+  std::exception_ptr error;
+  for(auto& written : pending) {
+    try {
+      written.get();
+    } catch(...) {
+      if(!error)
+        error = std::current_exception();
+    }
+  }
+  if(error)
+    std::rethrow_exception(error);
+}
+
+AsyncSaver::Scope::Scope(AsyncSaver& saver) : previous_(asyncSaver) {
+  asyncSaver = &saver;
+}
+
+AsyncSaver::Scope::~Scope() {
+  asyncSaver = previous_;
+}
+
 }  // namespace io
 }  // namespace marian
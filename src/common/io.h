@@ -9,6 +9,8 @@
 #include "common/definitions.h"
 #include "common/io_item.h"
 
+#include <future>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -23,6 +25,7 @@
 namespace marian {
 
 struct IMPIWrapper;
+class ThreadPool;
 
 namespace io {
 
@@ -46,6 +49,7 @@ private:
 
   std::vector<Item> items_;
   std::unique_ptr<mio::mmap_source> mmap_;
+  std::vector<char> replica_; // the memory of a replica of a memory-mapped model, see replicate()
 
   mutable std::mutex mutex_;
   bool locking_{true}; // if true, the mutex will be locked when accessing the data, see scopedLockGuard()
@@ -76,6 +80,12 @@ public:
   ModelWeights(const ModelWeights&&) = delete;
   ModelWeights(const ModelWeights&) = delete;
 
+  // Returns the ModelWeights of fileName from a process-wide registry, so that several translators
+  // in the same process load or memory-map a model file only once. The weights are released when the
+  // last user lets go of them. Memory-mapped *.bin models on the CPU then also share the parameter
+  // memory of all graphs, as the graphs point into the mapping.
+  static Ptr<ModelWeights> shared(const std::string& fileName, MmapMode mmapMode = MmapMode::OpportunisticMmap);
+
   std::vector<Item>& items();
   const std::vector<Item>& items() const;
 
@@ -92,7 +102,18 @@ public:
   // goes out of scope. So we have an optional scoped lock guard.
   std::unique_ptr<std::lock_guard<std::mutex>> scopedLockGuard() const;
 
-  void loadAndSync(Ptr<IMPIWrapper> mpi);
+  // Loads the model on the main process and broadcasts it to the others, once per host, see
+  // IMPIWrapper::bCastNodeShared(). With mapShared, the processes of a host share one copy of the items.
+  void loadAndSync(Ptr<IMPIWrapper> mpi, bool mapShared = false);
+
+  // Tells the kernel that a memory-mapped model is read at random, see --model-mmap-lazy. The parameters that CPU
+  // graphs use in place are then only read from disk page by page when nodes touch them, without reading ahead, and
+  // as clean file pages they are evicted again under memory pressure. Does nothing for models that are not mapped.
+  void adviseRandomAccess();
+
+  // A copy of the weights in memory that the calling thread writes first, hence on its NUMA node, see --cpu-numa.
+  // CPU graphs use a copy of memory-mapped weights in place like the mapping, other weights are loaded again.
+  static Ptr<ModelWeights> replicate(Ptr<ModelWeights> weights);
 };
 
 // for saving we keep the old interface since there is no intelligence going on here and it is useful
@@ -103,6 +124,34 @@ void addMetaToItems(const std::string& meta,
 
 void saveItems(const std::string& fileName, const std::vector<Item>& items);
 
+/**
+ * Writes the files of saveItems() on a background thread, for the checkpoints of training, see GraphGroup::save().
+ * While a Scope of the saver exists, saveItems() on the thread that created the scope hands its items, which are
+ * already a copy in host memory, over to the writer and returns. The writer serializes them and flushes the file to
+ * disk. wait() blocks until all files handed over have been written and rethrows the first error in writing them.
+ */
+class AsyncSaver {
+public:
+  AsyncSaver();
+  ~AsyncSaver(); // waits
+
+  void save(const std::string& fileName, std::vector<Item> items);
+  void wait();
+
+  class Scope {
+  public:
+    Scope(AsyncSaver& saver);
+    ~Scope();
+
+  private:
+    AsyncSaver* previous_;
+  };
+
+private:
+  std::unique_ptr<ThreadPool> writer_;
+  std::vector<std::future<void>> pending_;
+};
+
 /**
  * Creates a flat io::Item from a given std::vector so that it can be saved in a npz file
  * or Marian's native binary format with the given name.
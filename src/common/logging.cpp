@@ -2,8 +2,11 @@
 #include "common/config.h"
 #include "common/utils.h"
 
+#include "spdlog/async_logger.h"
 #include "spdlog/sinks/null_sink.h"
 #include "3rd_party/ExceptionWithCallStack.h"
+#include <map>
+#include <mutex>
 #include <time.h>
 #include <stdlib.h>
 #ifdef __unix__
@@ -22,10 +25,19 @@ namespace marian {
   void setThrowExceptionOnAbort(bool doThrowExceptionOnAbort) { throwExceptionOnAbort = doThrowExceptionOnAbort; };
 }
 
+// the sinks and patterns of the asynchronous loggers, for synchronizeLoggers()
+struct AsyncLogger {
+  std::vector<spdlog::sink_ptr> sinks;
+  std::string pattern;
+};
+static std::mutex asyncLoggersMutex;
+static std::map<std::string, AsyncLogger> asyncLoggers;
+
 std::shared_ptr<spdlog::logger> createStderrLogger(const std::string& name,
                                                    const std::string& pattern,
                                                    const std::vector<std::string>& files,
-                                                   bool quiet) {
+                                                   bool quiet,
+                                                   size_t asyncQueueSize) {
   auto logger = spdlog::get(name);
   if(!logger) {
     std::vector<spdlog::sink_ptr> sinks;
@@ -39,12 +51,26 @@ std::shared_ptr<spdlog::logger> createStderrLogger(const std::string& name,
   int rank = marian::utils::getMPIRankEnv(); // this function looks up OMPI_COMM_WORLD_RANK env variable
   if(rank == 0) {
     for(auto&& file : files) {
-      auto file_sink = std::make_shared<spdlog::sinks::simple_file_sink_st>(file, true);
+      // the background thread of an asynchronous logger flushes the files itself
+      auto file_sink = std::make_shared<spdlog::sinks::simple_file_sink_st>(file, /*force_flush=*/asyncQueueSize == 0);
       sinks.push_back(file_sink);
     }
   }
 
-    logger = std::make_shared<spdlog::logger>(name, begin(sinks), end(sinks));
+    if(asyncQueueSize > 0) {
+      // messages are formatted and written by one background thread, which flushes every second. Callers block
+      // while the queue is full.
+      size_t queueSize = 1;
+      while(queueSize < asyncQueueSize) // spdlog requires a power of two
+        queueSize *= 2;
+      logger = std::make_shared<spdlog::async_logger>(name, begin(sinks), end(sinks), queueSize,
+                                                      spdlog::async_overflow_policy::block_retry,
+                                                      /*worker_warmup_cb=*/nullptr, std::chrono::seconds(1));
+      std::lock_guard<std::mutex> lock(asyncLoggersMutex);
+      asyncLoggers[name] = {sinks, pattern};
+    } else {
+      logger = std::make_shared<spdlog::logger>(name, begin(sinks), end(sinks));
+    }
 
     spdlog::register_logger(logger);
     logger->set_pattern(pattern);
@@ -94,8 +120,9 @@ void createLoggers(const marian::Config* config) {
   }
 
   bool quiet = config && config->get<bool>("quiet");
-  Logger general{createStderrLogger("general", "[%Y-%m-%d %T] %v", generalLogs, quiet)};
-  Logger valid{createStderrLogger("valid", "[%Y-%m-%d %T] [valid] %v", validLogs, quiet)};
+  size_t asyncQueueSize = config && config->has("log-async") ? config->get<size_t>("log-async") : 0;
+  Logger general{createStderrLogger("general", "[%Y-%m-%d %T] %v", generalLogs, quiet, asyncQueueSize)};
+  Logger valid{createStderrLogger("valid", "[%Y-%m-%d %T] [valid] %v", validLogs, quiet, asyncQueueSize)};
 
   if(config && config->has("log-level")) {
     std::string loglevel = config->get<std::string>("log-level");
@@ -159,6 +186,22 @@ void switchToMultinodeLogging(std::string nodeIdStr) {
 
 
 namespace marian {
+  void synchronizeLoggers() {
+    std::lock_guard<std::mutex> lock(asyncLoggersMutex);
+    for(const auto& entry : asyncLoggers) {
+      Logger async = spdlog::get(entry.first);
+      if(!async)
+        continue;
+      auto logger = std::make_shared<spdlog::logger>(entry.first, begin(entry.second.sinks), end(entry.second.sinks));
+      logger->set_pattern(entry.second.pattern);
+      logger->set_level(async->level());
+      spdlog::drop(entry.first);
+      spdlog::register_logger(logger);
+      async.reset(); // the last reference waits for the background thread to write the queue before it terminates
+    }
+    asyncLoggers.clear();
+  }
+
   std::string noinline getCallStack(size_t skipLevels) {
     return ::Microsoft::MSR::CNTK::DebugUtil::GetCallStack(skipLevels + 2, /*makeFunctionNamesStandOut=*/true);
   }
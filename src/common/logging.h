@@ -11,6 +11,10 @@ namespace marian {
   void logCallStack(size_t skipLevels);
   std::string getCallStack(size_t skipLevels);
 
+  // Replaces the asynchronous loggers of --log-async by synchronous loggers with the same sinks, after their
+  // background threads wrote the queued messages
+  void synchronizeLoggers();
+
   // Marian gives a basic exception guarantee. If you catch a
   // MarianRuntimeError you must assume that the object can be
   // safely destructed, but cannot be used otherwise.
@@ -95,10 +99,14 @@ namespace marian {
  * Prints critical error message and causes abnormal program termination by
  * calling std::abort().
  *
+ * Asynchronous loggers (--log-async) are first replaced by synchronous ones, see marian::synchronizeLoggers(), so
+ * that the message and the messages queued before it are written before the program terminates.
+ *
  * @param ... Message text and variables
  */
 #define ABORT(...)                                                               \
   do {                                                                           \
+    marian::synchronizeLoggers();                                                \
     auto logger = spdlog::get("general");                                        \
     if(logger == nullptr)                                                        \
       logger = createStderrLogger("general", "[%Y-%m-%d %T] Error: %v");         \
@@ -110,6 +118,7 @@ namespace marian {
     logger->set_pattern("%v");                                                   \
     auto callStack = marian::getCallStack(/*skipLevels=*/0);                     \
     checkedLog("general", "critical", callStack);                                \
+    logger->flush(); /* std::abort() does not flush the files of --log-async */  \
     if(marian::getThrowExceptionOnAbort())                                       \
       throw marian::MarianRuntimeException(fmt::format(__VA_ARGS__), callStack); \
     else                                                                         \
@@ -143,7 +152,8 @@ typedef std::shared_ptr<spdlog::logger> Logger;
 Logger createStderrLogger(const std::string&,
                           const std::string&,
                           const std::vector<std::string>& = {},
-                          bool quiet = false);
+                          bool quiet = false,
+                          size_t asyncQueueSize = 0);
 
 namespace marian {
 class Config;
@@ -0,0 +1,122 @@
+#include "common/metrics.h"
+
+#include "common/logging.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace marian {
+namespace metrics {
+
+void Counter::inc(double value) {
+  double current = value_.load();
+  while(!value_.compare_exchange_weak(current, current + value)) {}
+}
+
+Histogram::Histogram(const std::vector<double>& bounds) : bounds_(bounds), counts_(bounds.size() + 1, 0) {
+  ABORT_IF(!std::is_sorted(bounds_.begin(), bounds_.end()), "Histogram bounds need to be sorted");
+}
+
+void Histogram::observe(double value) {
+  size_t bucket = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin(); // value <= bound
+  std::lock_guard<std::mutex> lock(mutex_);
+  counts_[bucket]++;
+  sum_ += value;
+}
+
+std::vector<size_t> Histogram::buckets() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<size_t> cumulative(counts_.size());
+  size_t total = 0;
+  for(size_t i = 0; i < counts_.size(); ++i)
+    cumulative[i] = total += counts_[i];
+  return cumulative;
+}
+
+double Histogram::sum() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sum_;
+}
+
+size_t Histogram::count() const {
+  return buckets().back();
+}
+
+std::vector<double> latencyBounds() {
+  return {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+}
+
+Registry::Family& Registry::family(const std::string& name, const std::string& help, const std::string& type) {
+  auto& family = families_[name];
+  ABORT_IF(!family.type.empty() && family.type != type,
+           "Metric {} has been registered as {} already", name, family.type);
+  family.help = help;
+  family.type = type;
+  return family;
+}
+
+Ptr<Counter> Registry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto counter = New<Counter>();
+  family(name, help, "counter").values.emplace_back(labels, [counter]() { return counter->value(); });
+  return counter;
+}
+
+void Registry::counterFn(const std::string& name, const std::string& help, ValueFn value, const std::string& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  family(name, help, "counter").values.emplace_back(labels, value);
+}
+
+Ptr<Histogram> Registry::histogram(const std::string& name,
+                                   const std::string& help,
+                                   const std::vector<double>& bounds,
+                                   const std::string& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto histogram = New<Histogram>(bounds);
+  family(name, help, "histogram").histograms.emplace_back(labels, histogram);
+  return histogram;
+}
+
+void Registry::gauge(const std::string& name, const std::string& help, ValueFn value, const std::string& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  family(name, help, "gauge").values.emplace_back(labels, value);
+}
+
+std::string Registry::render() const {
+  // joins the labels of a metric with an additional label, e.g. for the bucket bounds of histograms
+  auto withLabels = [](const std::string& labels, const std::string& extra = "") {
+    std::string all = labels.empty() ? extra : (extra.empty() ? labels : labels + "," + extra);
+    return all.empty() ? all : "{" + all + "}";
+  };
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream out;
+  out.precision(10);
+  for(const auto& entry : families_) {
+    const auto& name = entry.first;
+    const auto& family = entry.second;
+    out << "# HELP " << name << " " << family.help << "\n";
+    out << "# TYPE " << name << " " << family.type << "\n";
+    for(const auto& value : family.values)
+      out << name << withLabels(value.first) << " " << value.second() << "\n";
+    for(const auto& histogram : family.histograms) {
+      const auto& bounds = histogram.second->bounds();
+      auto buckets = histogram.second->buckets();
+      for(size_t i = 0; i < buckets.size(); ++i) {
+        std::ostringstream le;
+        le.precision(10);
+        if(i < bounds.size())
+          le << bounds[i];
+        else
+          le << "+Inf";
+        out << name << "_bucket" << withLabels(histogram.first, "le=\"" + le.str() + "\"") << " " << buckets[i] << "\n";
+      }
+      out << name << "_sum" << withLabels(histogram.first) << " " << histogram.second->sum() << "\n";
+      out << name << "_count" << withLabels(histogram.first) << " " << buckets.back() << "\n";
+    }
+  }
+  return out.str();
+}
+
+}  // namespace metrics
+}  // namespace marian
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common/definitions.h"
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace marian {
+namespace metrics {
+
+// Monotonically increasing value, e.g. the number of translated sentences
+class Counter {
+public:
+  void inc(double value = 1.0);
+  double value() const { return value_; }
+
+private:
+  std::atomic<double> value_{0.0};
+};
+
+// Distribution of observed values over fixed upper bucket bounds, e.g. request latencies
+class Histogram {
+public:
+  Histogram(const std::vector<double>& bounds);
+  void observe(double value);
+
+  // cumulative counts per bound, the last entry counts all observations (+Inf)
+  std::vector<size_t> buckets() const;
+  const std::vector<double>& bounds() const { return bounds_; }
+  double sum() const;
+  size_t count() const;
+
+private:
+  const std::vector<double> bounds_; // sorted
+  mutable std::mutex mutex_;
+  std::vector<size_t> counts_;       // non-cumulative, [bounds_.size() + 1]
+  double sum_{0.0};
+};
+
+// Bucket bounds for latencies in seconds, from 1ms to 60s
+std::vector<double> latencyBounds();
+
+/**
+ * Collection of named metrics that is rendered in the Prometheus text exposition format, see
+ * https://prometheus.io/docs/instrumenting/exposition_formats/. Metrics of the same name form a
+ * family and are told apart by their labels, e.g. `endpoint="bulk"`. Gauges, and counters that
+ * are maintained elsewhere, are callbacks that are evaluated while rendering, hence they need to
+ * stay valid for the lifetime of the registry.
+ * Registering is thread-safe, but is meant to happen at startup.
+ */
+class Registry {
+public:
+  typedef std::function<double()> ValueFn;
+
+  Ptr<Counter> counter(const std::string& name, const std::string& help, const std::string& labels = "");
+  void counterFn(const std::string& name, const std::string& help, ValueFn value, const std::string& labels = "");
+  Ptr<Histogram> histogram(const std::string& name,
+                           const std::string& help,
+                           const std::vector<double>& bounds,
+                           const std::string& labels = "");
+  void gauge(const std::string& name, const std::string& help, ValueFn value, const std::string& labels = "");
+
+  std::string render() const;
+
+private:
+  struct Family {
+    std::string help;
+    std::string type;
+    std::vector<std::pair<std::string, ValueFn>> values; // counters and gauges
+    std::vector<std::pair<std::string, Ptr<Histogram>>> histograms;
+  };
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_; // rendered in alphabetical order
+
+  Family& family(const std::string& name, const std::string& help, const std::string& type);
+};
+
+}  // namespace metrics
+}  // namespace marian
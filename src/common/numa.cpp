@@ -0,0 +1,77 @@
+#include "common/numa.h"
+#include "common/logging.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace marian {
+
+#ifdef __linux__
+// the numbers of a list like "0-15,32-47" of /sys/devices/system, empty if the file cannot be read
+static std::vector<int> readList(const std::string& fileName) {
+  std::vector<int> numbers;
+  std::ifstream file(fileName);
+  std::string range;
+  while(std::getline(file, range, ',')) {
+    int first, last;
+    char dash;
+    std::istringstream in(range);
+    if(!(in >> first))
+      continue;
+    if(!(in >> dash >> last) || dash != '-')
+      last = first;
+    for(int i = first; i <= last; ++i)
+      numbers.push_back(i);
+  }
+  return numbers;
+}
+#endif
+
+NumaNodes::NumaNodes() {
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  bool knowsAllowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+  for(int node : readList("/sys/devices/system/node/online")) {
+    std::vector<int> cpus;
+    for(int cpu : readList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))
+      if(cpu < CPU_SETSIZE && (!knowsAllowed || CPU_ISSET(cpu, &allowed)))
+        cpus.push_back(cpu);
+    if(!cpus.empty()) // nodes of memory only, or outside of the CPUs of the process (taskset, cgroups)
+      cpus_.push_back(cpus);
+  }
+#endif
+  if(cpus_.empty()) {
+    LOG_ONCE(warn, "NUMA nodes are only available on Linux with /sys/devices/system/node, using one node");
+    cpus_.push_back({});
+  }
+}
+
+bool NumaNodes::bind(size_t node) const {
+#ifdef __linux__
+  if(cpus_[node].empty())
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for(int cpu : cpus_[node])
+    CPU_SET(cpu, &set);
+  if(sched_setaffinity(0, sizeof(set), &set) != 0) { // 0 is the calling thread
+    LOG_ONCE(warn, "Cannot bind threads to the CPUs of NUMA node {}: {}", node, std::strerror(errno));
+    return false;
+  }
+  return true;
+#else
+  (void)node;
+  return false;
+#endif
+}
+
+}  // namespace marian
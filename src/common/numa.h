@@ -0,0 +1,35 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace marian {
+
+/**
+ * The NUMA nodes of the machine and the CPUs of each that the process may run on, from /sys/devices/system/node on
+ * Linux, see --cpu-numa. Elsewhere, or if sysfs lists no nodes, all CPUs are one node and bind() does nothing.
+ *
+ * Binding a thread to the CPUs of a node also places the memory it allocates on that node: Linux allocates a page on
+ * the node of the CPU that first writes it, so the workspace and the parameters of a graph that bound threads create
+ * and run are node-local without libnuma or explicit memory policies. Threads inherit the binding of the thread that
+ * creates them, e.g. the intra-op threads of a graph.
+ */
+class NumaNodes {
+public:
+  NumaNodes();
+
+  size_t size() const { return cpus_.size(); }
+  const std::vector<int>& cpus(size_t node) const { return cpus_[node]; }
+
+  // the node of worker i of n, the workers fill the nodes one after the other in blocks of equal size
+  size_t nodeOf(size_t worker, size_t workers) const { return worker * size() / std::max<size_t>(workers, 1); }
+
+  // Binds the calling thread to the CPUs of the node, false if the system does not allow it
+  bool bind(size_t node) const;
+
+private:
+  std::vector<std::vector<int>> cpus_;  // [node] the CPUs of the node the process may run on
+};
+
+}  // namespace marian
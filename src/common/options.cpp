@@ -11,10 +11,11 @@ T Get<T>::apply(const Options* opt, const char* const key) {
 #if FASTOPT
   opt->lazyRebuild();
   ABORT_IF(!opt->has(key), "Required option '{}' has not been set", key);
-  return opt->fastOptions_[key].as<T>();
+  return opt->state_->fastOptions[key].as<T>();
 #else
   ABORT_IF(!opt->has(key), "Required option '{}' has not been set", key);
-  return opt->options_[key].as<T>();
+  const YAML::Node& options = opt->state_->options;
+  return options[key].as<T>();
 #endif
 }
 
@@ -24,10 +25,11 @@ T Get<T>::apply(const Options* opt, const char* const key, const T& defaultValue
 #if FASTOPT
   opt->lazyRebuild();
   if(opt->has(key))
-    return opt->fastOptions_[key].as<T>();
+    return opt->state_->fastOptions[key].as<T>();
 #else
+  const YAML::Node& options = opt->state_->options;
   if(opt->has(key))
-    return opt->options_[key].as<T>();
+    return options[key].as<T>();
 #endif
   else
     return defaultValue;
@@ -55,7 +57,8 @@ template struct Get<std::vector<std::string>>;
 template <>
 std::vector<YAML::Node> Get<std::vector<YAML::Node>>::apply(const Options* opt, const char* const key) {
   ABORT_IF(!opt->has(key), "Required option '{}' has not been set", key);
-  auto vec = opt->options_[key].as<std::vector<YAML::Node>>();
+  const YAML::Node& options = opt->state_->options; // const, lookups must not change a shared tree
+  auto vec = options[key].as<std::vector<YAML::Node>>();
   for(auto& node : vec)  {
     if(node.IsScalar())
       node = YAML::Load(node.as<std::string>());
@@ -76,7 +79,8 @@ template struct Get<std::vector<YAML::Node>>;
 template <>
 YAML::Node Get<YAML::Node>::apply(const Options* opt, const char* const key) {
   ABORT_IF(!opt->has(key), "Required option '{}' has not been set", key);
-  YAML::Node node = opt->options_[key];
+  const YAML::Node& options = opt->state_->options;
+  YAML::Node node = options[key];
   if(node.IsScalar())
     node = YAML::Load(node.as<std::string>());
   return node;
@@ -92,63 +96,65 @@ YAML::Node Get<YAML::Node>::apply(const Options* opt, const char* const key, con
 template struct Get<YAML::Node>;
 }
 
-Options::Options()
-#if FASTOPT
-  : fastOptions_(options_)
-#endif
-{}
+Options::Options() : state_(New<State>(YAML::Node())) {}
+
+Options::Options(const Options& other) {
+  *this = other;
+}
 
-Options::Options(const Options& other)
+Options& Options::operator=(const Options& other) {
 #if FASTOPT
-  : options_(YAML::Clone(other.options_)),
-    fastOptions_(options_) {}
-#else
-  : options_(YAML::Clone(other.options_)) {}
+  other.lazyRebuild(); // before sharing, so that no clone ever rebuilds the shared lookup
 #endif
+  state_ = other.state_;
+  return *this;
+}
 
 Ptr<Options> Options::clone() const {
-  return New<Options>(*this); // fastOptions_ get set in constructor above
+  return New<Options>(*this); // shares state_ until either side changes
 }
 
 YAML::Node Options::cloneToYamlNode() const {
-  return YAML::Clone(options_); // Do not give access to internal YAML object
+  return YAML::Clone(state_->options); // Do not give access to internal YAML object
 }
 
 void Options::parse(const std::string& yaml) {
   auto node = YAML::Load(yaml);
+  auto& options = detach().options;
   for(auto it : node)
-    options_[it.first.as<std::string>()] = YAML::Clone(it.second);
+    options[it.first.as<std::string>()] = YAML::Clone(it.second);
 #if FASTOPT
   setLazyRebuild();
 #endif
 }
 
 void Options::merge(const YAML::Node& node, bool overwrite) {
+  auto& options = detach().options;
   for(auto it : node)
-    if(overwrite || !options_[it.first.as<std::string>()])
-      options_[it.first.as<std::string>()] = YAML::Clone(it.second);
+    if(overwrite || !options[it.first.as<std::string>()])
+      options[it.first.as<std::string>()] = YAML::Clone(it.second);
 #if FASTOPT
   setLazyRebuild();
 #endif
 }
 
 void Options::merge(Ptr<Options> options) {
-  merge(options->options_);
+  merge(options->state_->options);
 }
 
 std::string Options::asYamlString() {
   std::stringstream ss;
-  ss << options_;
+  ss << state_->options;
   return ss.str();
 }
 
 bool Options::hasAndNotEmpty(const char* const key) const {
 #if FASTOPT
   lazyRebuild();
-  if(!fastOptions_.has(key)) {
+  if(!state_->fastOptions.has(key)) {
     return false;
   } else {
-    auto& node = fastOptions_[key];
+    auto& node = state_->fastOptions[key];
     if(node.isSequence())
       return node.size() != 0;
     else if(node.isScalar()) // numerical values count as non-empty
@@ -157,10 +163,11 @@ bool Options::hasAndNotEmpty(const char* const key) const {
       ABORT("Wrong node type");
   }
 #else
-  if(!options_[key]) {
+  const YAML::Node& options = state_->options;
+  if(!options[key]) {
     return false;
   } else {
-    auto& node = options_[key];
+    auto node = options[key];
     if(node.IsSequence())
       return node.size() != 0;
     else if(node.IsScalar()) // numerical values count as non-empty
@@ -178,9 +185,10 @@ bool Options::hasAndNotEmpty(const std::string& key) const {
 bool Options::has(const char* const key) const {
 #if FASTOPT
   lazyRebuild();
-  return fastOptions_.has(key);
+  return state_->fastOptions.has(key);
 #else
-  return options_[key];
+  const YAML::Node& options = state_->options;
+  return options[key];
 #endif
 }
 
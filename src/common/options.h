@@ -44,27 +44,47 @@ namespace options_helpers {
 /**
  * Container for options stored as key-value pairs. Keys are unique strings.
  * This is not thread-safe and locking is the responsibility of the caller.
+ *
+ * Clones share the options and their fast lookup until the clone or the original changes them (copy-on-write), so
+ * cloning, e.g. by with() for every layer or translator, does not copy the YAML tree or rebuild the lookup. Clones
+ * may be used from different threads.
  */
 class Options {
 protected:
-  YAML::Node options_;  // YAML options use for parsing, modification and printing
-  
+  struct State {
+    YAML::Node options; // YAML options use for parsing, modification and printing
 #if FASTOPT
-  // Only to be modified in lazyRebuild and setLazyRebuild
-  mutable FastOpt fastOptions_; // FastOpt used for fast lookup, lazily rebuilt from YYAML whenever required
-  mutable bool lazyRebuildPending_{false}; // flag if need to lazily rebuild
+    // Only to be modified in lazyRebuild and setLazyRebuild
+    FastOpt fastOptions; // FastOpt used for fast lookup, lazily rebuilt from YYAML whenever required
+    bool lazyRebuildPending{false}; // flag if need to lazily rebuild
 
+    State(const YAML::Node& node) : options(node), fastOptions(node) {}
+#else
+    State(const YAML::Node& node) : options(node) {}
+#endif
+  };
+  // shared with clones, which rebuild the lookup before sharing it, so a shared state never changes
+  Ptr<State> state_;
+
+  // the state to change, copied first if clones share it
+  State& detach() {
+    if(state_.use_count() > 1)
+      state_ = New<State>(YAML::Clone(state_->options));
+    return *state_;
+  }
+
+#if FASTOPT
   // set flag that a rebuild is required
   void setLazyRebuild() const {
-    lazyRebuildPending_ = true;
+    state_->lazyRebuildPending = true;
   }
 
   // check if rebuild is required, rebuild, unset flag.
   void lazyRebuild() const {
-    if(lazyRebuildPending_) {
-      FastOpt temp(options_);
-      fastOptions_.swap(temp);
-      lazyRebuildPending_ = false;
+    if(state_->lazyRebuildPending) {
+      FastOpt temp(state_->options);
+      state_->fastOptions.swap(temp);
+      state_->lazyRebuildPending = false;
     }
   }
 #endif
@@ -72,8 +92,9 @@ protected:
 public:
   Options();
 
-  // This creates a proper clone
+  // This creates a proper clone, which shares the options until one of both changes
   Options(const Options& other);
+  Options& operator=(const Options& other);
  
   // constructor with one or more key-value pairs
   // New<Options>("var1", val1, "var2", val2, ...)
@@ -124,7 +145,7 @@ public:
   /**
    * @brief Splice options from a YAML node
    *
-   * By default, only options with keys that do not already exist in options_ are extracted from
+   * By default, only options with keys that do not already exist in the options are extracted from
    * node. These options are cloned if overwrite is true.
    *
    * @param node a YAML node to transfer the options from
@@ -137,7 +158,7 @@ public:
 
   template <typename T>
   void set(const std::string& key, T value) {
-    options_[key] = value;
+    detach().options[key] = value;
 #if FASTOPT
     setLazyRebuild();
 #endif
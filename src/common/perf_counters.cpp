@@ -0,0 +1,65 @@
+#include "common/perf_counters.h"
+#include "common/logging.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace marian {
+
+PerfCounters::PerfCounters(bool inheritThreads) {
+  for(int i = 0; i < numCounters; ++i)
+    fds_[i] = -1;
+#ifdef __linux__
+  const uint64_t configs[numCounters] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                         PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES};
+  for(int i = 0; i < numCounters; ++i) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.exclude_kernel = 1; // allowed up to perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    attr.inherit = inheritThreads ? 1 : 0;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds_[i] = (int)syscall(__NR_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1, /*group_fd=*/-1, /*flags=*/0);
+    if(fds_[i] < 0) {
+      LOG_ONCE(warn, "Hardware performance counters are not available: {}", std::strerror(errno));
+      return;
+    }
+  }
+  available_ = true;
+#else
+  LOG_ONCE(warn, "Hardware performance counters are only available on Linux");
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  for(int i = 0; i < numCounters; ++i)
+    if(fds_[i] >= 0)
+      close(fds_[i]);
+#endif
+}
+
+PerfCounters::Values PerfCounters::read() const {
+  uint64_t counts[numCounters] = {0};
+#ifdef __linux__
+  if(available_) {
+    for(int i = 0; i < numCounters; ++i) {
+      uint64_t value[3]; // count, time enabled, time running
+      if(::read(fds_[i], value, sizeof(value)) != (ssize_t)sizeof(value))
+        continue;
+      counts[i] = value[2] > 0 && value[2] < value[1] ? (uint64_t)((double)value[0] * value[1] / value[2]) : value[0];
+    }
+  }
+#endif
+  return {counts[0], counts[1], counts[2], counts[3]};
+}
+
+}  // namespace marian
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+namespace marian {
+
+/**
+ * Hardware performance counters of the CPU via perf_event_open(2) on Linux: cycles, instructions and the references
+ * to and misses of the last-level cache, counted in user space. They tell whether a kernel is compute-bound (high
+ * instructions per cycle) or memory-bound (many cache misses, low IPC). The bytes read from memory are estimated as
+ * one cache line of 64 bytes per miss, which ignores prefetches and writebacks.
+ *
+ * The counters count the thread that creates them and, with inheritThreads, the threads it creates afterwards, e.g.
+ * a thread pool, but not threads that already exist. They are unavailable on other systems, without a PMU, e.g. in
+ * many VMs, or if /proc/sys/kernel/perf_event_paranoid is above 2, and then read zeros.
+ */
+class PerfCounters {
+public:
+  struct Values {
+    uint64_t cycles{0};
+    uint64_t instructions{0};
+    uint64_t cacheReferences{0};
+    uint64_t cacheMisses{0};
+
+    Values operator-(const Values& other) const {
+      return {cycles - other.cycles, instructions - other.instructions,
+              cacheReferences - other.cacheReferences, cacheMisses - other.cacheMisses};
+    }
+    Values& operator+=(const Values& other) {
+      cycles += other.cycles;
+      instructions += other.instructions;
+      cacheReferences += other.cacheReferences;
+      cacheMisses += other.cacheMisses;
+      return *this;
+    }
+
+    double ipc() const { return cycles > 0 ? (double)instructions / cycles : 0.; }
+    double cacheMissRate() const { return cacheReferences > 0 ? (double)cacheMisses / cacheReferences : 0.; }
+    double bytesFromMemory() const { return 64. * cacheMisses; }
+  };
+
+  PerfCounters(bool inheritThreads = false);
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  bool available() const { return available_; }
+
+  // Counts since creation, scaled up if the kernel multiplexed the counters
+  Values read() const;
+
+private:
+  static const int numCounters = 4;
+  int fds_[numCounters];
+  bool available_{false};
+};
+
+}  // namespace marian
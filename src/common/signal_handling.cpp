@@ -46,6 +46,12 @@ bool getSignalFlag(const int sig) {
   return (sigflags_ & (1<<sig)) != 0;
 }
 
+void clearSignalFlag(const int sig) {
+  ABORT_IF(sig > maxSignalForSetSignalFlag,
+           "Signal out of range (must be < {}, is {}).", maxSignalForSetSignalFlag, sig);
+  sigflags_ &= ~(1<<sig);
+}
+
 void requestSaveAndExit(int sig) {
   setSignalFlag(sig);         // keep track of triggering signal
   saveAndExit_ = 1; // set flag to exit gracefully
@@ -14,7 +14,8 @@
 //   https://wiki.sei.cmu.edu/confluence/display/c/SIG31-C.+Do+not+access+shared+objects+in+signal+handlers
 //
 // The exact behavior of 'graceful exit' depends on the application; for training, it means 'save model and exit',
-// for a server (not implemented yet): 'block new requests but serve pending requests and then exit'.
+// for a server (not implemented yet): 'block new requests but serve pending requests and then exit'. marian-server
+// reloads its models on SIGHUP, see TranslateService::reload().
 //
 // Graceful exit for training is useful for training on clusters with time limits on jobs. Slurm, for example, can be
 // set up to send a custom signal at a set time before the end of the time slot, giving Marian time to save its current
@@ -36,4 +37,7 @@ void setSignalFlag(int sig);  // custom handler (set flag) for sig
 /// Check if a setSignalFlag was triggered for this signal
 bool getSignalFlag(int sig);
 
+/// Reset the flag of this signal, e.g. after handling a signal that can be sent repeatedly
+void clearSignalFlag(int sig);
+
 } // End of namespace marian
@@ -0,0 +1,95 @@
+#include "common/sparsity.h"
+#include "common/logging.h"
+#include "common/utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace marian {
+
+SparsityPattern::SparsityPattern(const std::string& pattern) {
+  if(pattern.empty())
+    return;
+
+  auto colon = pattern.find(':');
+  ABORT_IF(colon == std::string::npos, "Sparsity pattern '{}' is not of the form N:M or N:MxW", pattern);
+  auto x = pattern.find('x', colon);
+  try {
+    keep  = std::stoi(pattern.substr(0, colon));
+    group = std::stoi(pattern.substr(colon + 1, x == std::string::npos ? std::string::npos : x - colon - 1));
+    width = x == std::string::npos ? 1 : std::stoi(pattern.substr(x + 1));
+  } catch(const std::logic_error&) {
+    ABORT("Sparsity pattern '{}' is not of the form N:M or N:MxW", pattern);
+  }
+  ABORT_IF(keep < 1 || keep >= group || width < 1,
+           "Sparsity pattern '{}' must keep between 1 and M - 1 of M rows for at least one column",
+           pattern);
+}
+
+std::string SparsityPattern::toString() const {
+  if(empty())
+    return "";
+  return std::to_string(keep) + ":" + std::to_string(group) + (width > 1 ? "x" + std::to_string(width) : "");
+}
+
+bool SparsityPattern::appliesTo(const std::string& name, const Shape& shape) const {
+  if(empty() || shape.size() != 2)
+    return false;
+  if(name.find("Wemb") != std::string::npos || name.find("ff_logit_out") != std::string::npos
+     || utils::endsWith(name, "_Wt"))
+    return false;
+  return shape[0] >= group && shape[0] % group == 0 && shape[1] % width == 0;
+}
+
+void SparsityPattern::mask(const float* data, int rows, int cols, float* mask) const {
+  ABORT_IF(rows % group != 0 || cols % width != 0,
+           "A [{}, {}] matrix does not have the {} sparsity pattern", rows, cols, toString());
+
+  std::vector<float> magnitudes(group);
+  std::vector<int> order(group);
+  for(int j0 = 0; j0 < cols; j0 += width) {
+    for(int g = 0; g < rows; g += group) {
+      for(int r = 0; r < group; ++r) {
+        magnitudes[r] = 0.f;
+        for(int j = j0; j < j0 + width; ++j)
+          magnitudes[r] += std::abs(data[(size_t)(g + r) * cols + j]);
+      }
+      // stable, so that ties keep the first rows
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return magnitudes[a] > magnitudes[b]; });
+      for(int i = 0; i < group; ++i) {
+        float kept = i < keep ? 1.f : 0.f;
+        for(int j = j0; j < j0 + width; ++j)
+          mask[(size_t)(g + order[i]) * cols + j] = kept;
+      }
+    }
+  }
+}
+
+void SparsityPattern::prune(float* data, int rows, int cols) const {
+  std::vector<float> kept((size_t)rows * cols);
+  mask(data, rows, cols, kept.data());
+  for(size_t i = 0; i < kept.size(); ++i)
+    data[i] *= kept[i];
+}
+
+bool SparsityPattern::matches(const float* data, int rows, int cols) const {
+  if(rows % group != 0 || cols % width != 0)
+    return false;
+  for(int j0 = 0; j0 < cols; j0 += width) {
+    for(int g = 0; g < rows; g += group) {
+      int nonZero = 0;
+      for(int r = g; r < g + group; ++r)
+        if(std::any_of(data + (size_t)r * cols + j0, data + (size_t)r * cols + j0 + width, [](float w) { return w != 0.f; }))
+          ++nonZero;
+      if(nonZero > keep)
+        return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace marian
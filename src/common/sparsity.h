@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common/shape.h"
+
+#include <string>
+
+namespace marian {
+
+/**
+ * N:M structured sparsity of weight matrices, see --prune-pattern and --sparse-gemm. Of every group of M consecutive
+ * rows, i.e. input dimensions, of a [rows, cols] weight matrix, N rows are kept for each block of width adjacent
+ * columns and the other weights of the group are zero. 2:4 is the pattern of the sparse tensor cores of Ampere GPUs;
+ * 2:4x16 keeps the same 2 of every 4 rows for 16 columns at a time, so that the CPU kernel of --sparse-gemm multiplies
+ * with contiguous vectors of the kept weights and reads half of the matrix.
+ */
+struct SparsityPattern {
+  int keep{0};  // N
+  int group{0}; // M
+  int width{1}; // columns that share the kept rows of a group
+
+  SparsityPattern() {}
+  // parses "N:M" or "N:MxW", the empty string is no pattern
+  explicit SparsityPattern(const std::string& pattern);
+
+  bool empty() const { return group == 0; }
+  std::string toString() const;
+
+  // whether the parameter name of this shape has the pattern: the weight matrices of a model apart from embeddings
+  // and output layers, whose rows are a multiple of the group and columns a multiple of the width
+  bool appliesTo(const std::string& name, const Shape& shape) const;
+
+  // sets mask[i] to 1 for the weights of the row-major [rows, cols] matrix data that are kept, those of the largest
+  // magnitude in each group, and to 0 for the others
+  void mask(const float* data, int rows, int cols, float* mask) const;
+  // sets the weights to zero that mask() does not keep
+  void prune(float* data, int rows, int cols) const;
+  // whether the matrix has at most N non-zero rows in each group and column block
+  bool matches(const float* data, int rows, int cols) const;
+};
+
+}  // namespace marian
@@ -0,0 +1,217 @@
+#include "common/tracing.h"
+
+#include "common/file_stream.h"
+#include "common/logging.h"
+
+#include <cstdio>
+#include <random>
+#include <sstream>
+
+namespace marian {
+namespace tracing {
+
+namespace {
+
+std::mt19937_64& randomEngine() {
+  thread_local std::mt19937_64 engine(std::random_device{}());
+  return engine;
+}
+
+uint64_t randomId() {
+  uint64_t id;
+  do {
+    id = randomEngine()();
+  } while(id == 0); // all-zero ids are invalid in OpenTelemetry
+  return id;
+}
+
+std::string hex(uint64_t value) {
+  char buffer[17];
+  std::snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)value);
+  return buffer;
+}
+
+std::string quote(const std::string& s) {
+  std::string quoted = "\"";
+  for(char c : s) {
+    if(c == '"' || c == '\\') {
+      quoted.push_back('\\');
+      quoted.push_back(c);
+    } else if((unsigned char)c < 0x20) {
+      char buffer[7];
+      std::snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned)c);
+      quoted += buffer;
+    } else {
+      quoted.push_back(c);
+    }
+  }
+  return quoted + "\"";
+}
+
+std::string nanos(Clock::time_point t) {
+  // a string, as OTLP/JSON encodes 64-bit integers
+  return quote(std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count()));
+}
+
+}  // namespace
+
+std::string attributeValue(const std::string& value) {
+  return "{\"stringValue\":" + quote(value) + "}";
+}
+
+std::string attributeValue(const char* value) {
+  return attributeValue(std::string(value));
+}
+
+std::string attributeValue(double value) {
+  std::ostringstream out;
+  out << "{\"doubleValue\":" << value << "}";
+  return out.str();
+}
+
+std::string attributeValue(bool value) {
+  return std::string("{\"boolValue\":") + (value ? "true" : "false") + "}";
+}
+
+Trace::Trace(Ptr<Tracer> tracer, const std::string& name)
+    : tracer_(tracer), traceIdHigh_(randomId()), traceIdLow_(randomId()) {
+  root_.id = newSpanId();
+  root_.name = name;
+  root_.start = Clock::now();
+}
+
+Trace::~Trace() {
+  root_.end = Clock::now();
+  try {
+    tracer_->write(*this);
+  } catch(const std::exception& e) {
+    LOG(warn, "[tracing] Could not write trace: {}", e.what());
+  }
+}
+
+uint64_t Trace::newSpanId() {
+  return randomId(); // the random engine is per thread
+}
+
+void Trace::add(SpanData span) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  spans_.push_back(std::move(span));
+}
+
+std::string Trace::toJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string traceId = quote(hex(traceIdHigh_) + hex(traceIdLow_));
+
+  std::ostringstream out;
+  out << "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":"
+      << attributeValue(tracer_->serviceName()) << "}]},\"scopeSpans\":[{\"scope\":{\"name\":\"marian\"},\"spans\":[";
+  auto writeSpan = [&](const SpanData& span, bool first) {
+    out << (first ? "" : ",") << "{\"traceId\":" << traceId << ",\"spanId\":" << quote(hex(span.id));
+    if(span.parent != 0)
+      out << ",\"parentSpanId\":" << quote(hex(span.parent));
+    out << ",\"name\":" << quote(span.name) << ",\"kind\":1" // SPAN_KIND_INTERNAL
+        << ",\"startTimeUnixNano\":" << nanos(span.start) << ",\"endTimeUnixNano\":" << nanos(span.end)
+        << ",\"attributes\":[";
+    for(size_t i = 0; i < span.attributes.size(); ++i)
+      out << (i == 0 ? "" : ",") << "{\"key\":" << quote(span.attributes[i].first)
+          << ",\"value\":" << span.attributes[i].second << "}";
+    out << "]}";
+  };
+  writeSpan(root_, true);
+  for(const auto& span : spans_)
+    writeSpan(span, false);
+  out << "]}]}]}";
+  return out.str();
+}
+
+Tracer::Tracer(double sampleRate, const std::string& path, const std::string& serviceName)
+    : sampleRate_(sampleRate), serviceName_(serviceName) {
+  ABORT_IF(sampleRate < 0 || sampleRate > 1, "--trace-sample-rate needs to be in [0, 1], not {}", sampleRate);
+  if(path == "stderr")
+    out_.reset(new std::ostream(std::cerr.rdbuf()));
+  else
+    out_.reset(new io::OutputFileStream(path));
+}
+
+Ptr<Trace> Tracer::startTrace(const std::string& name) {
+  if(sampleRate_ <= 0)
+    return nullptr;
+  if(sampleRate_ < 1 && std::uniform_real_distribution<double>(0, 1)(randomEngine()) >= sampleRate_)
+    return nullptr;
+  return New<Trace>(shared_from_this(), name);
+}
+
+void Tracer::write(const Trace& trace) {
+  auto json = trace.toJson();
+  std::lock_guard<std::mutex> lock(mutex_);
+  *out_ << json << std::endl;
+}
+
+Context& current() {
+  thread_local Context context;
+  return context;
+}
+
+Span::Span(const char* name) {
+  auto& context = current();
+  if(!context.trace)
+    return;
+  trace_ = context.trace;
+  data_.id = trace_->newSpanId();
+  data_.parent = context.parent;
+  data_.name = name;
+  data_.start = Clock::now();
+  context.parent = data_.id;
+}
+
+Span::~Span() {
+  if(!trace_)
+    return;
+  data_.end = Clock::now();
+  current().parent = data_.parent;
+  trace_->add(std::move(data_));
+}
+
+void record(const char* name, Clock::time_point start, Clock::time_point end) {
+  const auto& context = current();
+  if(!context.trace)
+    return;
+  SpanData span;
+  span.id = context.trace->newSpanId();
+  span.parent = context.parent;
+  span.name = name;
+  span.start = start;
+  span.end = end;
+  context.trace->add(std::move(span));
+}
+
+RepeatedSpan::RepeatedSpan(const char* name) {
+  const auto& context = current();
+  if(!context.trace)
+    return;
+  trace_ = context.trace;
+  data_.id = trace_->newSpanId();
+  data_.parent = context.parent;
+  data_.name = name;
+}
+
+RepeatedSpan::~RepeatedSpan() {
+  if(!trace_ || count_ == 0)
+    return;
+  data_.attributes.emplace_back("count", attributeValue(count_));
+  data_.attributes.emplace_back("busy_ms", attributeValue(std::chrono::duration<double, std::milli>(busy_).count()));
+  trace_->add(std::move(data_));
+}
+
+void RepeatedSpan::add(Clock::time_point start, Clock::time_point end) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(count_ == 0 || start < data_.start)
+    data_.start = start;
+  if(count_ == 0 || end > data_.end)
+    data_.end = end;
+  ++count_;
+  busy_ += end - start;
+}
+
+}  // namespace tracing
+}  // namespace marian
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "common/definitions.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace marian {
+namespace tracing {
+
+/**
+ * Sampled latency tracing of requests, see --trace-sample-rate. A sampled request gets a Trace whose spans are timed
+ * intervals of its processing, e.g. tokenization, the encoder or the decoder steps of a batch. Finished traces are
+ * written in the OTLP/JSON format of OpenTelemetry, one line of resourceSpans per trace, which the OpenTelemetry
+ * Collector reads with its otlpjsonfile receiver.
+ *
+ * Spans find their trace and parent span in the thread-local Context, which Scope sets. Without a trace, e.g. for
+ * requests that were not sampled, Span and RepeatedSpan only check that the context is empty.
+ */
+
+typedef std::chrono::system_clock Clock;
+
+struct SpanData {
+  uint64_t id{0};
+  uint64_t parent{0}; // 0 for the root span
+  std::string name;
+  Clock::time_point start;
+  Clock::time_point end;
+  std::vector<std::pair<std::string, std::string>> attributes; // key and OTLP/JSON AnyValue
+};
+
+// OTLP/JSON AnyValue of an attribute value
+std::string attributeValue(const std::string& value);
+std::string attributeValue(const char* value);
+std::string attributeValue(double value);
+inline std::string attributeValue(float value) { return attributeValue((double)value); }
+std::string attributeValue(bool value);
+template <typename T>
+std::string attributeValue(T value) { // integers
+  return "{\"intValue\":\"" + std::to_string(value) + "\"}";
+}
+
+class Tracer;
+
+// The spans of one request. It is written to its Tracer when the last reference to it goes away.
+class Trace {
+public:
+  Trace(Ptr<Tracer> tracer, const std::string& name);
+  ~Trace();
+
+  uint64_t root() const { return root_.id; }
+  uint64_t newSpanId();
+  void add(SpanData span);
+
+  template <typename T>
+  void setAttribute(const std::string& key, T value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    root_.attributes.emplace_back(key, attributeValue(value));
+  }
+
+  std::string toJson() const;
+
+private:
+  Ptr<Tracer> tracer_;
+  uint64_t traceIdHigh_, traceIdLow_;
+  SpanData root_;
+  mutable std::mutex mutex_;
+  std::vector<SpanData> spans_;
+};
+
+// Samples requests and writes their traces, see --trace-sample-rate and --trace-output
+class Tracer : public std::enable_shared_from_this<Tracer> {
+public:
+  Tracer(double sampleRate, const std::string& path, const std::string& serviceName = "marian");
+
+  // A new trace with a root span of this name, or nullptr if the request is not sampled
+  Ptr<Trace> startTrace(const std::string& name);
+
+  void write(const Trace& trace);
+
+  const std::string& serviceName() const { return serviceName_; }
+
+private:
+  double sampleRate_;
+  std::string serviceName_;
+  std::mutex mutex_;
+  UPtr<std::ostream> out_;
+};
+
+// The trace and span that spans started on this thread belong to
+struct Context {
+  Ptr<Trace> trace;
+  uint64_t parent{0};
+};
+
+Context& current();
+
+// Whether this thread works for a sampled request
+inline bool active() { return current().trace != nullptr; }
+
+// Sets the context of this thread for the lifetime of the scope, e.g. for the tasks of a request on worker threads
+class Scope {
+public:
+  Scope(const Context& context) : previous_(current()) { current() = context; }
+  // new spans are children of the root span of trace, keeps the current context if trace is nullptr
+  Scope(Ptr<Trace> trace) : Scope(trace ? Context{trace, trace->root()} : current()) {}
+  ~Scope() { current() = previous_; }
+
+private:
+  Context previous_;
+};
+
+// Times the lifetime of the span, spans started during it are its children
+class Span {
+public:
+  Span(const char* name);
+  ~Span();
+
+  template <typename T>
+  void set(const char* key, T value) {
+    if(trace_)
+      data_.attributes.emplace_back(key, attributeValue(value));
+  }
+
+private:
+  Ptr<Trace> trace_;
+  SpanData data_;
+};
+
+// Adds a span that has already ended to the current context, e.g. the time a batch waited for a worker
+void record(const char* name, Clock::time_point start, Clock::time_point end);
+
+/**
+ * Repeated intervals, e.g. the steps of the decoder, as a single span from the start of the first to the end of the
+ * last one, with their number and summed duration as the attributes count and busy_ms. It belongs to the context at
+ * its construction and is added when it is destroyed. Intervals may be timed on several threads at once.
+ */
+class RepeatedSpan {
+public:
+  RepeatedSpan(const char* name);
+  ~RepeatedSpan();
+
+  // Times one interval for its lifetime
+  class Interval {
+  public:
+    Interval(RepeatedSpan& span) : span_(span.trace_ ? &span : nullptr) {
+      if(span_)
+        start_ = Clock::now();
+    }
+    ~Interval() {
+      if(span_)
+        span_->add(start_, Clock::now());
+    }
+    Interval(const Interval&) = delete;
+    Interval& operator=(const Interval&) = delete;
+
+  private:
+    RepeatedSpan* span_;
+    Clock::time_point start_;
+  };
+
+  Interval time() { return Interval(*this); }
+
+private:
+  void add(Clock::time_point start, Clock::time_point end);
+
+  Ptr<Trace> trace_;
+  SpanData data_;
+  std::mutex mutex_;
+  size_t count_{0};
+  Clock::duration busy_{0};
+};
+
+}  // namespace tracing
+}  // namespace marian
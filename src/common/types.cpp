@@ -1,5 +1,6 @@
 #include "common/types.h"
 #include "tensors/cpu/fbgemm/packed_gemm.h"
+#include "tensors/cpu/amx_int8.h"
 
 namespace marian {
 
@@ -29,7 +30,13 @@ size_t requiredBytes(const Shape& shape, Type type) {
   }
 #endif  // USE_FBGEMM 
 
-  if (isIntgemm(type)) {
+  if (type == Type::intgemm8amx) {
+    /* Packed by oneMKL, the quantization multiplier is stored at the back as for the other intgemm types */
+    return cpu::amx::packedBytes(shape);
+  } else if (type == Type::int8gpu) {
+    /* The int8 matrix is followed by one float32 unquantization multiplier per column, see gpu::int8gemm */
+    return shape.elements() * sizeOf(type) + shape[-1] * sizeOf(Type::float32);
+  } else if (isIntgemm(type)) {
     /* Intgemm tensors have an extra float at the back that stores the quantization multiplier */
     return shape.elements() * sizeOf(type) + sizeOf(Type::float32);
   } else {
@@ -170,6 +170,14 @@ struct intgemm8ssse3       { int8_t x;  };
 struct intgemm8avx2        { int8_t x;  };
 struct intgemm8avx512      { int8_t x;  };
 struct intgemm8avx512vnni  { int8_t x;  };
+struct intgemm8amx         { int8_t x;  };
+struct intgemm8ruy         { int8_t x;  };
+
+// memory holder for bfloat16 weight matrices, the upper 16 bits of a float32. Only used as the B matrix of CPU GEMMs.
+struct bfloat16 { uint16_t x; };
+
+// memory holder for int8 weight matrices with per-channel scales, only used as the B matrix of GPU GEMMs.
+struct int8gpu { int8_t x; };
 
 
 #ifndef __CUDACC__ // vectorized types not available from .cu files
@@ -280,9 +288,13 @@ enum class TypeClass : size_t { // size_type has 8 bytes, so we can have 16 fiel
 
   packed_type   = 0x00800, // special packed (CPU cache friendly) type class, used in FBGEMM. Annoyingly we need to keep 0x800 for back-compat, would be nicer to align with intgemm
   intgemm_type  = 0x10000, // intgemm quantized architecture agnostic models
+  bfloat16_type = 0x20000, // bfloat16 weights for CPU GEMMs, deliberately not a float_type so they are not converted during loading
+  amx_type      = 0x40000, // processor-specific layout for AMX tiles, packed by oneMKL, currently used for Intgemm-style int8 GEMMs only
+  ruy_type      = 0x80000, // plain row-major int8 matrices multiplied by ruy, which packs them at runtime, mostly for ARM CPUs
+  gpu_int8_type = 0x100000, // int8 matrices with per-channel scales for the int8 tensor cores of GPUs, see gpu::int8gemm
 
   size_mask     = 0x000FF, // maximum allowed size is 256 bytes right now; if more are required, extend the size field
-  class_mask    = 0xFFF00, // three fields for different type classes, if more classes are added we need to increase the number of fields here
+  class_mask    = 0xFFFF00, // four fields for different type classes, if more classes are added we need to increase the number of fields here
 };
 
 constexpr inline size_t operator+(TypeClass typeClass, size_t val) {
@@ -321,10 +333,16 @@ enum class Type : size_t {
   intgemm8avx2        = TypeClass::intgemm_type + 1u + TypeClass::avx2_type,           ///< Int8 quantized and packed (avx2) matrices for intgemm
   intgemm8avx512      = TypeClass::intgemm_type + 1u + TypeClass::avx512_type,         ///< Int8 quantized and packed (avx512) matrices for intgemm
   intgemm8avx512vnni  = TypeClass::intgemm_type + 1u + TypeClass::avx512_type + 4096u, ///< Int8 quantized and packed (avx512) matrices for intgemm. VNNI algorithm
+  intgemm8amx         = TypeClass::intgemm_type + 1u + TypeClass::amx_type,            ///< Int8 quantized matrices packed by oneMKL for AMX tiles, multiplied by oneMKL instead of intgemm
+  intgemm8ruy         = TypeClass::intgemm_type + 1u + TypeClass::ruy_type,            ///< Int8 quantized row-major matrices, multiplied by ruy instead of intgemm (ARM64 NEON)
 
   intgemm16sse2       = TypeClass::intgemm_type + 2u + TypeClass::sse2_type,           ///< Int16 quantized and packed (sse2) matrices for intgemm
   intgemm16avx2       = TypeClass::intgemm_type + 2u + TypeClass::avx2_type,           ///< Int16 quantized and packed (avx2) matrices for intgemm
   intgemm16avx512     = TypeClass::intgemm_type + 2u + TypeClass::avx512_type,         ///< Int16 quantized and packed (avx512) matrices for intgemm
+
+  bfloat16            = TypeClass::bfloat16_type + 2u,                                 ///< bfloat16 matrices in the normal float32 memory layout, for CPU GEMMs with float32 accumulation
+
+  int8gpu             = TypeClass::gpu_int8_type + 1u,                                 ///< Int8 matrices quantized per output channel and stored transposed, for cuBLASLt GEMMs with int32 accumulation
 };
 
 static inline size_t operator&(TypeClass typeClass, Type type) {
@@ -375,10 +393,26 @@ static inline bool isAvx512(Type type) {
   return (TypeClass::avx512_type & type) != 0;
 }
 
+static inline bool isAmx(Type type) {
+  return (TypeClass::amx_type & type) != 0;
+}
+
+static inline bool isRuy(Type type) {
+  return (TypeClass::ruy_type & type) != 0;
+}
+
 static inline bool isIntgemm(Type type) {
   return (TypeClass::intgemm_type & type) != 0;
 }
 
+static inline bool isBFloat16(Type type) {
+  return (TypeClass::bfloat16_type & type) != 0;
+}
+
+static inline bool isGpuInt8(Type type) {
+  return (TypeClass::gpu_int8_type & type) != 0;
+}
+
 size_t requiredBytes(const Shape& shape, Type type); // towards Frank's vision of joint Shape/Type
 
 template <typename T>
@@ -409,11 +443,16 @@ template <> inline bool matchType<intgemm8ssse3>(Type type)        { return type
 template <> inline bool matchType<intgemm8avx2>(Type type)         { return type == Type::intgemm8avx2;        }
 template <> inline bool matchType<intgemm8avx512>(Type type)       { return type == Type::intgemm8avx512;      }
 template <> inline bool matchType<intgemm8avx512vnni>(Type type)   { return type == Type::intgemm8avx512vnni;  }
+template <> inline bool matchType<intgemm8amx>(Type type)          { return type == Type::intgemm8amx;         }
+template <> inline bool matchType<intgemm8ruy>(Type type)          { return type == Type::intgemm8ruy;         }
 
 template <> inline bool matchType<intgemm16>(Type type)            { return type == Type::intgemm16;           }
 template <> inline bool matchType<intgemm16sse2>(Type type)        { return type == Type::intgemm16sse2;       }
 template <> inline bool matchType<intgemm16avx2>(Type type)        { return type == Type::intgemm16avx2;       }
 template <> inline bool matchType<intgemm16avx512>(Type type)      { return type == Type::intgemm16avx512;     }
+
+template <> inline bool matchType<bfloat16>(Type type)             { return type == Type::bfloat16;            }
+template <> inline bool matchType<int8gpu>(Type type)              { return type == Type::int8gpu;             }
 // clang-format on
 
 static inline std::ostream& operator<<(std::ostream& out, Type type) {
@@ -441,10 +480,15 @@ static inline std::ostream& operator<<(std::ostream& out, Type type) {
     case Type::intgemm8avx2        : out << "intgemm8avx2"; break;
     case Type::intgemm8avx512      : out << "intgemm8avx512"; break;
     case Type::intgemm8avx512vnni  : out << "intgemm8avx512vnni"; break;
+    case Type::intgemm8amx         : out << "intgemm8amx"; break;
+    case Type::intgemm8ruy         : out << "intgemm8ruy"; break;
     case Type::intgemm16           : out << "intgemm16"; break;
     case Type::intgemm16sse2       : out << "intgemm16sse2"; break;
     case Type::intgemm16avx2       : out << "intgemm16avx2"; break;
     case Type::intgemm16avx512     : out << "intgemm16avx512"; break;
+
+    case Type::bfloat16            : out << "bfloat16"; break;
+    case Type::int8gpu             : out << "int8gpu"; break;
   }
   return out;
 }
@@ -476,10 +520,15 @@ template <> inline std::string request<intgemm8ssse3>()       { return "intgemm8
 template <> inline std::string request<intgemm8avx2>()        { return "intgemm8avx2";    }
 template <> inline std::string request<intgemm8avx512>()      { return "intgemm8avx512";  }
 template <> inline std::string request<intgemm8avx512vnni>()  { return "intgemm8avx512vnni";  }
+template <> inline std::string request<intgemm8amx>()         { return "intgemm8amx";     }
+template <> inline std::string request<intgemm8ruy>()         { return "intgemm8ruy";     }
 template <> inline std::string request<intgemm16>()           { return "intgemm16";       }
 template <> inline std::string request<intgemm16sse2>()       { return "intgemm16sse2";   }
 template <> inline std::string request<intgemm16avx2>()       { return "intgemm16avx2";   }
 template <> inline std::string request<intgemm16avx512>()     { return "intgemm16avx512"; }
+
+template <> inline std::string request<bfloat16>()            { return "bfloat16";        }
+template <> inline std::string request<int8gpu>()             { return "int8gpu";         }
 // clang-format on
 
 static Type inline typeFromString(const std::string& str) {
@@ -525,6 +574,10 @@ static Type inline typeFromString(const std::string& str) {
     return Type::intgemm8avx512;
   if(str == "intgemm8avx512vnni")
     return Type::intgemm8avx512vnni;
+  if(str == "intgemm8amx")
+    return Type::intgemm8amx;
+  if(str == "intgemm8ruy")
+    return Type::intgemm8ruy;
 
   if(str == "intgemm16")
     return Type::intgemm16;
@@ -535,6 +588,12 @@ static Type inline typeFromString(const std::string& str) {
   if(str == "intgemm16avx512")
     return Type::intgemm16avx512;
 
+  if(str == "bfloat16")
+    return Type::bfloat16;
+
+  if(str == "int8gpu")
+    return Type::int8gpu;
+
   ABORT("Unknown type {}", str);
 }
 
@@ -564,11 +623,16 @@ template <> inline Type typeId<intgemm8ssse3>()       { return Type::intgemm8sss
 template <> inline Type typeId<intgemm8avx2>()        { return Type::intgemm8avx2;        }
 template <> inline Type typeId<intgemm8avx512>()      { return Type::intgemm8avx512;      }
 template <> inline Type typeId<intgemm8avx512vnni>()  { return Type::intgemm8avx512vnni;  }
+template <> inline Type typeId<intgemm8amx>()         { return Type::intgemm8amx;         }
+template <> inline Type typeId<intgemm8ruy>()         { return Type::intgemm8ruy;         }
 template <> inline Type typeId<intgemm16>()           { return Type::intgemm16;           }
 template <> inline Type typeId<intgemm16sse2>()       { return Type::intgemm16sse2;       }
 template <> inline Type typeId<intgemm16avx2>()       { return Type::intgemm16avx2;       }
 template <> inline Type typeId<intgemm16avx512>()     { return Type::intgemm16avx512;     }
 
+template <> inline Type typeId<bfloat16>()            { return Type::bfloat16;            }
+template <> inline Type typeId<int8gpu>()             { return Type::int8gpu;             }
+
 
 // Abort if given C++ does not correspond to runtime type
 template <typename T>
@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <array>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -408,6 +409,24 @@ std::string findReplace(const std::string& in, const std::string& what, const st
   return res;
 }
 
+std::string jsonEscape(const std::string& s) {
+  std::stringstream ss;
+  for(char c : s) {
+    switch(c) {
+      case '"': ss << "\\\""; break;
+      case '\\': ss << "\\\\"; break;
+      case '\n': ss << "\\n"; break;
+      case '\t': ss << "\\t"; break;
+      default:
+        if((unsigned char)c < 0x20)
+          ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+        else
+          ss << c;
+    }
+  }
+  return ss.str();
+}
+
 double parseDouble(std::string s) {
   double res;
   char c;  // dummy char -- if we succeed to parse this, then there were extraneous characters after the number
@@ -64,6 +64,9 @@ bool isContinuousScript(char32_t c);
 
 std::string findReplace(const std::string& in, const std::string& what, const std::string& withWhat, bool all = false);
 
+// escapes s for a JSON string literal, without the quotes
+std::string jsonEscape(const std::string& s);
+
 double parseDouble(std::string s);
 double parseNumber(std::string s);
 
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "data/batch_stats.h"
+#include "data/corpus_base.h"
+#include "graph/expression_graph.h"
+
+#include <cmath>
+
+namespace marian {
+namespace data {
+
+/**
+ * Statistics of --mini-batch-fit for inference: for sentence lengths in steps of --mini-batch-fit-step up to
+ * --max-length, the largest batch whose forward pass fits into the workspace of graph without reallocating it.
+ * This is GraphGroup::collectStats() without the backward pass, model only needs build(graph, batch).
+ */
+template <class Model>
+Ptr<BatchStats> collectInferenceStats(Ptr<ExpressionGraph> graph,
+                                      Ptr<Model> model,
+                                      const std::vector<Ptr<Vocab>>& vocabs,
+                                      Ptr<Options> options) {
+  // this runs with fake values, we do not care for overflow/underflow
+  bool throwNan = graph->getThrowNaN();
+  graph->setThrowNaN(false);
+
+  auto stats = New<BatchStats>();
+  size_t step = options->get<size_t>("mini-batch-fit-step", 10);
+  size_t maxLength = options->get<size_t>("max-length");
+
+  // class labels are a single token
+  std::vector<size_t> localMaxes(vocabs.size(), maxLength);
+  auto inputTypes = options->get<std::vector<std::string>>("input-types", {});
+  for(size_t i = 0; i < inputTypes.size() && i < localMaxes.size(); ++i)
+    if(inputTypes[i] == "class")
+      localMaxes[i] = 1;
+
+  auto fits = [&](const std::vector<size_t>& lengths, size_t batchSize) {
+    auto batch = CorpusBatch::fakeBatch(lengths, vocabs, batchSize, options);
+    try {
+      model->build(graph, batch);
+      bool fit = graph->fitsForward();
+      if(fit)
+        stats->add(batch);
+      return fit;
+    } catch(const ShapeSizeException& e) {
+      LOG(debug, "Exception for batch size {}: {}", batchSize, e.what());
+      return false;
+    }
+  };
+
+  auto lengthsFor = [&](size_t length) {
+    std::vector<size_t> lengths(localMaxes.size());
+    for(size_t j = 0; j < lengths.size(); ++j)
+      lengths[j] = std::min(length, localMaxes[j]);
+    return lengths;
+  };
+
+  // upper bound of the batch size for the shortest sentences
+  size_t maxBatch = 512;
+  while(fits(lengthsFor(step), maxBatch))
+    maxBatch *= 2;
+
+  // binary search for each length, the batches only get smaller for longer sentences
+  size_t maxLengthRounded = (size_t)(std::ceil(maxLength / (float)step) * step);
+  for(size_t i = step; i <= maxLengthRounded; i += step) {
+    auto lengths = lengthsFor(i);
+    size_t start = 1;
+    size_t end = maxBatch;
+    while(end >= start) {
+      size_t current = (start + end) / 2;
+      bool fit = fits(lengths, current);
+      LOG(debug, "[batching] length: {} - size: {} - fits: {}", lengths[0], current, fit);
+      if(fit)
+        start = current + 1;
+      else
+        end = current - 1;
+    }
+    if(start == 1) {
+      LOG(warn, "[batching] Sentences of length {} do not fit into the workspace, increase --workspace", i);
+      break;
+    }
+    maxBatch = start;
+  }
+
+  graph->setThrowNaN(throwNan);
+  return stats;
+}
+
+}  // namespace data
+}  // namespace marian
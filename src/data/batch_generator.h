@@ -9,11 +9,14 @@
 #include "data/iterator_facade.h"
 #include "3rd_party/threadpool.h"
 
+#include <algorithm>
+#include <cmath>
 #include <condition_variable>
 #include <deque>
 #include <functional>
 #include <mutex>
-#include <queue>
+#include <numeric>
+#include <random>
 
 namespace marian {
 namespace data {
@@ -75,6 +78,12 @@ protected:
   bool shuffleData_{false};    // determine if full data should be shuffled before reading and batching.
   bool shuffleBatches_{false}; // determine if batches should be shuffled after batching.
 
+  // optional sort key for --maxi-batch-sort trg-predicted, e.g. a predicted output length
+  std::function<float(const Sample&)> sortKey_;
+
+  // optional filter for samples that are handled elsewhere and must not go into any batch, e.g. cached translations
+  std::function<bool(const Sample&)> skip_;
+
 private:
   Ptr<BatchStats> stats_;
   
@@ -82,55 +91,26 @@ private:
 
   // state of fetching
   std::deque<BatchPtr> bufferedBatches_; // current swath of batches that next() reads from
+  Samples carriedSamples_;               // --length-buckets: the sentences that did not fill a batch of their bucket
 
   // state of reading
   typename DataSet::iterator current_;
   bool newlyPrepared_{ true }; // prepare() was just called: we need to reset current_  --@TODO: can we just reset it directly?
 
-  // variables for multi-threaded pre-fetching
-  mutable UPtr<ThreadPool> threadPool_; // (we only use one thread, but keep it around)
-  std::future<std::deque<BatchPtr>> futureBufferedBatches_; // next swath of batches is returned via this
-
-  // this runs on a bg thread; sequencing is handled by caller, but locking is done in here
-  std::deque<BatchPtr> fetchBatches() {
-    timer::Timer total;
-
-    typedef typename Sample::value_type Item;
-    auto itemCmp = [](const Item& sa, const Item& sb) { return sa.size() < sb.size(); }; // sort by element length, not content
-
-    auto cmpSrc = [itemCmp](const Sample& a, const Sample& b) {
-      return std::lexicographical_compare(
-          a.begin(), a.end(), b.begin(), b.end(), itemCmp);
-    };
-
-    auto cmpTrg = [itemCmp](const Sample& a, const Sample& b) {
-      return std::lexicographical_compare(
-          a.rbegin(), a.rend(), b.rbegin(), b.rend(), itemCmp);
-    };
-
-    auto cmpNone = [](const Sample& a, const Sample& b) { return a.getId() < b.getId(); }; // sort in order of original ids = original data order unless shuffling
-
-    typedef std::function<bool(const Sample&, const Sample&)> cmp_type;
-    typedef std::priority_queue<Sample, Samples, cmp_type> sample_queue;
+  // variables for multi-threaded pre-fetching, a pipeline of two stages with one thread each: readerPool_ reads the
+  // sentences of a maxi-batch, threadPool_ sorts them and assembles the batches. Up to prefetchDepth_ swaths of
+  // batches are in flight, so that a slow swath does not stall the consumer.
+  mutable UPtr<ThreadPool> threadPool_;
+  mutable UPtr<ThreadPool> readerPool_;
+  size_t prefetchDepth_{1};
+  std::deque<std::future<std::deque<BatchPtr>>> futureBufferedBatches_; // next swaths of batches, in order
 
-    std::unique_ptr<sample_queue> maxiBatch; // priority queue, shortest first
-
-    if(options_->has("maxi-batch-sort")) {
-      if(options_->get<std::string>("maxi-batch-sort") == "src")
-        maxiBatch.reset(new sample_queue(cmpSrc));
-      else if(options_->get<std::string>("maxi-batch-sort") == "none")
-        maxiBatch.reset(new sample_queue(cmpNone));
-      else
-        maxiBatch.reset(new sample_queue(cmpTrg));
-    } else {
-      maxiBatch.reset(new sample_queue(cmpNone));
-    }
-
-    size_t maxBatchSize = options_->get<int>("mini-batch");
-    size_t maxSize = maxBatchSize * options_->get<int>("maxi-batch");
+  // first stage: reads the sentences of the next maxi-batch. The corpus pre-processes them on its own threads
+  // with --data-threads, which runs while they are read.
+  Samples readMaxiBatch() {
+    size_t maxSize = options_->get<int>("mini-batch") * options_->get<int>("maxi-batch");
 
     // consume data from corpus into maxi-batch (single sentences)
-    // sorted into specified order (due to queue)
     if(newlyPrepared_) {
       current_ = data_->begin();
       newlyPrepared_ = false;
@@ -138,51 +118,100 @@ private:
       if(current_ != data_->end())
         ++current_;
     }
-    
+
     Samples maxiBatchTemp;
     while(current_ != data_->end() && maxiBatchTemp.size() < maxSize) { // loop over data
       if (saveAndExitRequested()) // stop generating batches
-        return std::deque<BatchPtr>();
-      
-      maxiBatchTemp.push_back(*current_);
-  
+        return Samples();
+
+      if(!skip_ || !skip_(*current_))
+        maxiBatchTemp.push_back(*current_);
+
       // do not consume more than required for the maxi batch as this causes
       // that line-by-line translation is delayed by one sentence
       bool last = maxiBatchTemp.size() == maxSize;
       if(!last)
         ++current_; // this actually reads the next line and pre-processes it
     }
-    size_t numSentencesRead = maxiBatchTemp.size();
+    return maxiBatchTemp;
+  }
+
+  // Sorts the samples of a maxi-batch by --maxi-batch-sort, the longest first, as fetchBatches() takes them. The
+  // lengths are small integers, so src and trg are sorted by a stable counting sort per stream, from the least to the
+  // most significant one, which is linear in the number of samples. none sorts by id, from the last one read.
+  Samples sortMaxiBatch(Samples samples) const {
+    samples.erase(std::remove_if(samples.begin(), samples.end(), [](const Sample& s) { return s.empty(); }),
+                  samples.end());
+    if(samples.empty())
+      return samples;
+
+    auto sortBy = options_->has("maxi-batch-sort") ? options_->get<std::string>("maxi-batch-sort") : "none";
+    if(sortBy == "none") {
+      std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) { return a.getId() > b.getId(); });
+      return samples;
+    }
+    if(sortBy == "trg-predicted") {
+      ABORT_IF(!sortKey_, "--maxi-batch-sort trg-predicted is only available for decoding");
+      std::vector<std::pair<float, size_t>> keys; // key, index into samples
+      keys.reserve(samples.size());
+      for(size_t i = 0; i < samples.size(); ++i)
+        keys.emplace_back(sortKey_(samples[i]), i);
+      std::sort(keys.begin(), keys.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) {
+        return a.first > b.first;
+      });
+      Samples sorted;
+      sorted.reserve(samples.size());
+      for(const auto& key : keys)
+        sorted.push_back(std::move(samples[key.second]));
+      return sorted;
+    }
 
-    size_t sets = 0;
-    for(auto&& s : maxiBatchTemp) {
-      if(!s.empty()) {
-        sets = s.size();
-        maxiBatch->push(s);
+    // src compares the lengths of the streams from the first one, trg from the last one
+    size_t sets = samples.front().size();
+    Samples sorted(samples.size());
+    std::vector<size_t> starts; // [bucket] position of the next sample in sorted, buckets are by descending length
+    for(size_t k = 0; k < sets; ++k) {
+      size_t stream = sortBy == "src" ? sets - 1 - k : k;
+      size_t maxLength = 0;
+      for(const auto& s : samples)
+        maxLength = std::max(maxLength, s[stream].size());
+
+      starts.assign(maxLength + 2, 0);
+      for(const auto& s : samples)
+        starts[maxLength - s[stream].size() + 1]++;
+      for(size_t b = 1; b < starts.size(); ++b)
+        starts[b] += starts[b - 1];
+      for(auto& s : samples) {
+        size_t bucket = maxLength - s[stream].size();
+        sorted[starts[bucket]++] = std::move(s);
       }
+      samples.swap(sorted);
     }
+    return samples;
+  }
+
+  // Splits sorted samples into batches of the configured size, in order, and returns the samples that did not fill
+  // a batch in rest. Returns false if the process is asked to save and exit.
+  bool formBatches(const Samples& maxiBatch, std::deque<BatchPtr>& tempBatches, Samples& rest) {
+    size_t maxBatchSize = options_->get<int>("mini-batch");
+    size_t sets = maxiBatch.empty() ? 0 : maxiBatch.front().size();
 
     // construct the actual batches and place them in the queue
     Samples batchVector;
     size_t currentWords = 0;
     std::vector<size_t> lengths(sets, 0); // records maximum length observed within current batch
 
-    std::deque<BatchPtr> tempBatches;
-
-    // process all loaded sentences in order of increasing length
-    // @TODO: we could just use a vector and do a sort() here; would make the cost more explicit
+    // process all loaded sentences in sorted order
     const size_t mbWords = options_->get<size_t>("mini-batch-words", 0);
+    const size_t mbTokens = options_->get<size_t>("mini-batch-tokens", 0);
     const bool useDynamicBatching = options_->has("mini-batch-fit");
-    BatchStats::const_iterator cachedStatsIter;
-    if (stats_)
-      cachedStatsIter = stats_->begin();
+    BatchStats::const_iterator cachedStatsIter; // set by the first sentence of each batch
 
-    while(!maxiBatch->empty()) { // while there are sentences in the queue
+    for(size_t next = 0; next < maxiBatch.size();) {
       if (saveAndExitRequested()) // stop generating batches
-        return std::deque<BatchPtr>();
+        return false;
       // push item onto batch
-      batchVector.push_back(maxiBatch->top());
-      maxiBatch->pop(); // fetch next-shortest
+      batchVector.push_back(maxiBatch[next++]);
 
       // have we reached sufficient amount of data to form a batch?
       bool makeBatch;
@@ -191,13 +220,29 @@ private:
           if(batchVector.back()[i].size() > lengths[i])
             lengths[i] = batchVector.back()[i].size(); // record max lengths so far
 
+        // no entry before the lower bound of the lengths of the first sentence can fit the batch
+        if(batchVector.size() == 1)
+          cachedStatsIter = stats_->lower_bound(lengths);
         maxBatchSize = stats_->findBatchSize(lengths, cachedStatsIter);
 
         makeBatch = batchVector.size() >= maxBatchSize;
         // if last added sentence caused a bump then we likely have bad padding, so rather move it into the next batch
         if(batchVector.size() > maxBatchSize) {
-          maxiBatch->push(batchVector.back());
           batchVector.pop_back();
+          next--;
+        }
+      }
+      else if(mbTokens > 0) { // batch size based on the padded tokens of all streams
+        for(size_t i = 0; i < sets; ++i)
+          if(batchVector.back()[i].size() > lengths[i])
+            lengths[i] = batchVector.back()[i].size();
+        size_t paddedTokens = batchVector.size() * std::accumulate(lengths.begin(), lengths.end(), (size_t)0);
+
+        makeBatch = paddedTokens >= mbTokens;
+        // a sentence that does not fit the budget with the others starts the next batch, unless it is alone
+        if(paddedTokens > mbTokens && batchVector.size() > 1) {
+          batchVector.pop_back();
+          next--;
         }
       }
       else if(mbWords > 0) {
@@ -215,21 +260,93 @@ private:
         batchVector.clear();
         currentWords = 0;
         lengths.assign(sets, 0);
-        if (stats_)
-          cachedStatsIter = stats_->begin();
       }
     }
+    rest = std::move(batchVector);
+    return true;
+  }
 
-    // turn rest into batch
-    // @BUGBUG: This can create a very small batch, which with ce-mean-words can artificially
-    // inflate the contribution of the sames in the batch, causing instability.
-    // I think a good alternative would be to carry over the left-over sentences into the next round.
-    if(!batchVector.empty())
-      tempBatches.push_back(data_->toBatch(batchVector));
+  // --length-buckets: splits the sorted maxi-batch by target length into buckets of equal width up to --max-length
+  // and forms the batches of each bucket, so that no batch mixes lengths of different buckets. The sentences that do
+  // not fill a batch of their bucket are carried over to the next maxi-batch, unless this is the end of the epoch or
+  // no batch could be formed at all. The next batch comes from a bucket drawn with probability proportional to the
+  // number of its remaining batches to the power of 1/--length-bucket-temperature.
+  bool formBucketedBatches(const Samples& maxiBatch, size_t numBuckets, bool flush, std::deque<BatchPtr>& tempBatches) {
+    size_t maxLength = std::max(options_->get<size_t>("max-length", 0), (size_t)1);
+    std::vector<Samples> buckets(numBuckets);
+    for(const auto& s : maxiBatch) {
+      size_t length = std::max(s[s.size() - 1].size(), (size_t)1);
+      buckets[std::min((length - 1) * numBuckets / maxLength, numBuckets - 1)].push_back(s);
+    }
 
-    // Shuffle the batches
-    if(shuffleBatches_) {
-      std::shuffle(tempBatches.begin(), tempBatches.end(), eng_);
+    std::vector<std::deque<BatchPtr>> bucketBatches(numBuckets);
+    std::vector<Samples> rests(numBuckets);
+    bool anyBatch = false;
+    for(size_t b = 0; b < numBuckets; ++b) {
+      if(!formBatches(buckets[b], bucketBatches[b], rests[b]))
+        return false;
+      anyBatch = anyBatch || !bucketBatches[b].empty();
+    }
+    for(size_t b = 0; b < numBuckets; ++b) {
+      if(rests[b].empty())
+        continue;
+      if(flush || !anyBatch)
+        bucketBatches[b].push_back(data_->toBatch(rests[b]));
+      else
+        std::move(rests[b].begin(), rests[b].end(), std::back_inserter(carriedSamples_));
+      if(shuffleBatches_)
+        std::shuffle(bucketBatches[b].begin(), bucketBatches[b].end(), eng_);
+    }
+
+    double exponent = 1. / options_->get<float>("length-bucket-temperature", 1.f);
+    std::vector<double> weights(numBuckets);
+    for(;;) {
+      for(size_t b = 0; b < numBuckets; ++b)
+        weights[b] = bucketBatches[b].empty() ? 0. : std::pow((double)bucketBatches[b].size(), exponent);
+      if(std::all_of(weights.begin(), weights.end(), [](double w) { return w == 0.; }))
+        break;
+      size_t b = std::discrete_distribution<size_t>(weights.begin(), weights.end())(eng_);
+      tempBatches.push_back(bucketBatches[b].front());
+      bucketBatches[b].pop_front();
+    }
+    return true;
+  }
+
+  // second stage: sorts the maxi-batch into the specified order and splits it into batches.
+  // This runs on a bg thread; sequencing is handled by caller, but locking is done in here
+  std::deque<BatchPtr> fetchBatches(Samples maxiBatchTemp) {
+    timer::Timer total;
+
+    size_t numSentencesRead = maxiBatchTemp.size();
+    size_t numBuckets = options_->get<size_t>("length-buckets", 0);
+    bool endOfEpoch = maxiBatchTemp.empty();
+    if(numBuckets > 0) {
+      std::move(carriedSamples_.begin(), carriedSamples_.end(), std::back_inserter(maxiBatchTemp));
+      carriedSamples_.clear();
+    }
+
+    Samples maxiBatch = sortMaxiBatch(std::move(maxiBatchTemp));
+    std::deque<BatchPtr> tempBatches;
+
+    if(numBuckets > 0) {
+      if(!formBucketedBatches(maxiBatch, numBuckets, endOfEpoch, tempBatches))
+        return std::deque<BatchPtr>();
+    } else {
+      Samples rest;
+      if(!formBatches(maxiBatch, tempBatches, rest))
+        return std::deque<BatchPtr>();
+
+      // turn rest into batch
+      // @BUGBUG: This can create a very small batch, which with ce-mean-words can artificially
+      // inflate the contribution of the sames in the batch, causing instability.
+      // --length-buckets carries over the left-over sentences into the next round instead.
+      if(!rest.empty())
+        tempBatches.push_back(data_->toBatch(rest));
+
+      // Shuffle the batches
+      if(shuffleBatches_) {
+        std::shuffle(tempBatches.begin(), tempBatches.end(), eng_);
+      }
     }
     double totalSent{}, totalLabels{};
     for (auto& b : tempBatches) {
@@ -245,14 +362,21 @@ private:
     return tempBatches;
   }
 
-  // this starts fillBatches() as a background operation
+  // this starts reading and fetchBatches() as background operations, until prefetchDepth_ swaths are in flight
   void fetchBatchesAsync() {
-    ABORT_IF(futureBufferedBatches_.valid(), "Attempted to restart futureBufferedBatches_ while still running");
     ABORT_IF(!runAsync_, "Trying to run fetchBatchesAsync() but runAsync_ is false??");
-    ABORT_IF(!threadPool_, "Trying to run fetchBatchesAsync() without initialized threadPool_??");
-    futureBufferedBatches_ = threadPool_->enqueue([this]() {
-      return fetchBatches();
-    });
+    ABORT_IF(!threadPool_ || !readerPool_, "Trying to run fetchBatchesAsync() without initialized threadPool_??");
+    while(futureBufferedBatches_.size() < prefetchDepth_) {
+      auto samples = New<std::future<Samples>>(readerPool_->enqueue([this]() { return readMaxiBatch(); }));
+      futureBufferedBatches_.push_back(threadPool_->enqueue([this, samples]() { return fetchBatches(samples->get()); }));
+    }
+  }
+
+  // waits for the swaths in flight, e.g. the empty ones read after the end of the epoch
+  void discardFetchedBatches() {
+    for(auto& future : futureBufferedBatches_)
+      future.wait();
+    futureBufferedBatches_.clear();
   }
 
   BatchPtr next() {
@@ -260,18 +384,20 @@ private:
       if(runAsync_) { // by default we will run in asynchronous mode
         // out of data: need to get next batch from background thread
         // We only get here if the future has been scheduled to run; it must be valid.
-        ABORT_IF(!futureBufferedBatches_.valid(), "Attempted to wait for futureBufferedBatches_ when none pending.\n"
+        ABORT_IF(futureBufferedBatches_.empty(), "Attempted to wait for futureBufferedBatches_ when none pending.\n"
             "This error often occurs when Marian tries to restore the training data iterator, but the corpus has been changed or replaced.\n"
             "If you have changed the training corpus, add --no-restore-corpus to the training command and run it again.");
-        bufferedBatches_ = std::move(futureBufferedBatches_.get());
+        bufferedBatches_ = std::move(futureBufferedBatches_.front().get());
+        futureBufferedBatches_.pop_front();
         // if bg thread returns an empty swath, we hit the end of the epoch
         if (bufferedBatches_.empty() || saveAndExitRequested()) {
+          discardFetchedBatches();
           return nullptr;
         }
         // and kick off the next bg operation
         fetchBatchesAsync();
       } else { // don't spawn any threads, i.e. batch fetching is blocking.
-        bufferedBatches_ = fetchBatches();
+        bufferedBatches_ = fetchBatches(readMaxiBatch());
         // if bufferedBatches is empty we hit the end of the epoch
         if (bufferedBatches_.empty() || saveAndExitRequested()) {
           return nullptr;
@@ -291,15 +417,16 @@ public:
                  Ptr<BatchStats> stats = nullptr,
                  bool runAsync = true)
       : data_(data), options_(options), stats_(stats), 
-        runAsync_(runAsync), threadPool_(runAsync ? new ThreadPool(1) : nullptr) {
+        runAsync_(runAsync), threadPool_(runAsync ? new ThreadPool(1) : nullptr),
+        readerPool_(runAsync ? new ThreadPool(1) : nullptr),
+        prefetchDepth_(std::max(options_->get<size_t>("data-prefetch", 1), (size_t)1)) {
     auto shuffle = options_->get<std::string>("shuffle", "none");
     shuffleData_ = shuffle == "data";
     shuffleBatches_ = shuffleData_ || shuffle == "batches";
   }
 
   ~BatchGenerator() {
-    if (futureBufferedBatches_.valid()) // bg thread holds a reference to 'this',
-      futureBufferedBatches_.get();     // so must wait for it to complete
+    discardFetchedBatches(); // bg threads hold a reference to 'this', so must wait for them to complete
   }
 
   iterator begin() {
@@ -310,8 +437,16 @@ public:
     return iterator(this, nullptr);
   }
 
+  // Set the key used by --maxi-batch-sort trg-predicted, must be called before prepare()
+  void setSortKey(std::function<float(const Sample&)> sortKey) { sortKey_ = sortKey; }
+
+  // Drop every sample for which skip returns true, must be called before prepare()
+  void setSkipFilter(std::function<bool(const Sample&)> skip) { skip_ = skip; }
+
   // @TODO: get rid of this function, begin() or constructor should figure this out
   void prepare() {
+    ABORT_IF(!futureBufferedBatches_.empty(), "Attempted to restart futureBufferedBatches_ while still running");
+    carriedSamples_.clear();
     if(shuffleData_)
       data_->shuffle();
     else
@@ -369,7 +504,7 @@ public:
 
   void actAfterEpoch(TrainingState& state) override {
     state.seedBatch = getRNGState();
-    state.seedCorpus = data_->getRNGState();
+    data_->saveState(state);
   }
 };
 }  // namespace data
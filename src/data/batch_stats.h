@@ -3,9 +3,13 @@
 #include <deque>
 #include <queue>
 
+#include "common/file_stream.h"
+#include "common/filesystem.h"
 #include "data/corpus.h"
 #include "data/vocab.h"
 
+#include "3rd_party/yaml-cpp/yaml.h"
+
 namespace marian {
 namespace data {
 
@@ -99,6 +103,25 @@ public:
     //dump();
   }
 
+  // writes the statistics with the key of what they were collected for to a file, see --mini-batch-fit-cache
+  void save(const std::string& fileName, const std::string& key) const {
+    YAML::Node config;
+    config["key"] = key;
+    config["stats"] = flatten();
+    io::OutputFileStream(fileName) << config;
+  }
+
+  // reads statistics that save() wrote with the same key, or returns nullptr
+  static Ptr<BatchStats> load(const std::string& fileName, const std::string& key) {
+    if(!filesystem::exists(fileName))
+      return nullptr;
+    YAML::Node config = YAML::Load(io::InputFileStream(fileName).readToString());
+    if(!config["key"] || config["key"].as<std::string>() != key || !config["stats"])
+      return nullptr;
+    auto stats = New<BatchStats>(config["stats"].as<std::vector<size_t>>());
+    return stats->map_.empty() ? nullptr : stats;
+  }
+
   void dump() { // (for debugging)
     for (const auto& entry : map_) {
       for (auto streamLen : entry.first)
@@ -16,7 +16,8 @@ Corpus::Corpus(Ptr<Options> options, bool translate /*= false*/, size_t seed /*=
     : CorpusBase(options, translate, seed),
       shuffleInRAM_(options_->get<bool>("shuffle-in-ram", false)),
       allCapsEvery_(options_->get<size_t>("all-caps-every", 0)),
-      titleCaseEvery_(options_->get<size_t>("english-title-case-every", 0)) {
+      titleCaseEvery_(options_->get<size_t>("english-title-case-every", 0)),
+      shuffleBuffer_(options_->get<size_t>("shuffle-buffer", 0)) {
 
   auto numThreads = options_->get<size_t>("data-threads", 1);
   if(numThreads > 1)
@@ -31,7 +32,8 @@ Corpus::Corpus(std::vector<std::string> paths,
     : CorpusBase(paths, vocabs, options, seed),
       shuffleInRAM_(options_->get<bool>("shuffle-in-ram", false)),
       allCapsEvery_(options_->get<size_t>("all-caps-every", 0)),
-      titleCaseEvery_(options_->get<size_t>("english-title-case-every", 0)) {
+      titleCaseEvery_(options_->get<size_t>("english-title-case-every", 0)),
+      shuffleBuffer_(options_->get<size_t>("shuffle-buffer", 0)) {
   
   auto numThreads = options_->get<size_t>("data-threads", 1);
   if(numThreads > 1)
@@ -71,26 +73,32 @@ SentenceTuple Corpus::next() {
     // get index of the current sentence
     size_t curId = pos_; // note: at end, pos_  == total size
     // if corpus has been shuffled, ids_ contains sentence indexes
-    if(pos_ < ids_.size())
+    bool shuffled = pos_ < ids_.size();
+    if(shuffled)
       curId = ids_[pos_];
     pos_++;
 
     size_t eofsHit = 0;
-    for(size_t i = 0; i < numStreams; ++i) { // looping of all streams
-      // fetch line, from cached copy in RAM or actual file
-      if (!corpusInRAM_.empty()) {
-        if (curId < corpusInRAM_[i].size())
-          fields[i] = corpusInRAM_[i][curId];
-        else {
-          eofsHit++;
-          continue;
+    if(bufferedShuffle_) {
+      if(!nextFromShuffleBuffer(curId, fields))
+        eofsHit = numStreams;
+    } else {
+      for(size_t i = 0; i < numStreams; ++i) { // looping of all streams
+        // fetch line, from cached copy in RAM or actual file
+        if (!corpusInRAM_.empty()) {
+          if (curId < corpusInRAM_[i].size())
+            fields[i] = corpusInRAM_[i][curId];
+          else {
+            eofsHit++;
+            continue;
+          }
         }
-      }
-      else {
-        bool gotLine = io::getline(*files_[i], fields[i]).good();
-        if(!gotLine) {
-          eofsHit++;
-          continue;
+        else {
+          bool gotLine = io::getline(*files_[i], fields[i]).good();
+          if(!gotLine) {
+            eofsHit++;
+            continue;
+          }
         }
       }
     }
@@ -100,6 +108,13 @@ SentenceTuple Corpus::next() {
 
     ABORT_IF(eofsHit != 0, "not all input files have the same number of lines");
 
+    if(numShards_ > 1) {
+      if(shuffled) // the shuffled data holds only the lines of this shard
+        curId = shardIds_[curId];
+      else if(!bufferedShuffle_ && !inShard(curId)) // the chunks of a buffered shuffle are those of this shard
+        continue;
+    }
+
     auto makeSentenceTuple = [this](size_t curId, std::vector<std::string> fields) {
       if(tsv_) {
         // with tsv inputs data, there is only one input stream, hence we only have one field 
@@ -133,6 +148,8 @@ SentenceTuple Corpus::next() {
             permutedIndex = inputPermutation_[i];
 
           size_t vocabId = permutedIndex - shift;
+          if(vocabId == 0 && numAdapters_ > 0)
+            tup.setAdapter(takeAdapterTag(fields[permutedIndex], numAdapters_));
           bool altered;
           preprocessLine(fields[permutedIndex], vocabId, curId, /*out=*/altered);
           if(altered)
@@ -172,7 +189,10 @@ SentenceTuple Corpus::next() {
 // Call either reset() or shuffle().
 // @TODO: merge with reset() below to clarify mutual exclusiveness with reset()
 void Corpus::shuffle() {
-  shuffleData(paths_);
+  if(shuffleBuffer_ > 0 && canShuffleInChunks())
+    shuffleChunks();
+  else
+    shuffleData(paths_);
 }
 
 // reset to regular, non-shuffled reading
@@ -182,6 +202,9 @@ void Corpus::shuffle() {
 void Corpus::reset() {
   corpusInRAM_.clear();
   ids_.clear();
+  bufferedShuffle_ = false;
+  ways_.clear();
+  buffer_.clear();
   if (pos_ == 0) // no data read yet
     return;
   pos_ = 0;
@@ -208,6 +231,15 @@ void Corpus::restore(Ptr<TrainingState> ts) {
   setRNGState(ts->seedCorpus);
 }
 
+void Corpus::skipLines(size_t lines) {
+  ABORT_IF(!ids_.empty() || !corpusInRAM_.empty() || bufferedShuffle_,
+           "Lines can only be skipped while reading the training files in order");
+  std::string line;
+  for(size_t n = 0; n < lines; ++n, ++pos_)
+    for(auto& file : files_)
+      ABORT_IF(!io::getline(*file, line), "Cannot skip {} lines, the training files have only {}", lines, n);
+}
+
 void Corpus::shuffleData(const std::vector<std::string>& paths) {
   LOG(info, "[data] Shuffling data");
 
@@ -231,20 +263,24 @@ void Corpus::shuffleData(const std::vector<std::string>& paths) {
       files_[i] = std::move(strm);
     }
 
-    // read entire corpus into RAM
+    // read entire corpus into RAM, or the lines of this shard
     std::string lineBuf;
-    for (;;) {
+    shardIds_.clear();
+    for (size_t lineId = 0;; ++lineId) {
+      bool keep = inShard(lineId);
       size_t eofsHit = 0;
       for(size_t i = 0; i < numStreams; ++i) {
         bool gotLine = io::getline(*files_[i], lineBuf).good();
-        if (gotLine)
+        if (gotLine && keep)
           corpus[i].push_back(lineBuf);
-        else
+        else if (!gotLine)
           eofsHit++;
       }
       if (eofsHit == numStreams)
         break;
       ABORT_IF(eofsHit != 0, "Not all input files have the same number of lines");
+      if (keep && numShards_ > 1)
+        shardIds_.push_back(lineId);
     }
     files_.clear();
     numSentences = corpus[0].size();
@@ -285,6 +321,103 @@ void Corpus::shuffleData(const std::vector<std::string>& paths) {
   pos_ = 0;
 }
 
+bool Corpus::canShuffleInChunks() const {
+  for(const auto& path : paths_) {
+    if(path == "stdin" || path == "-" || filesystem::is_fifo(path) || utils::endsWith(path, ".gz")) {
+      LOG_ONCE(warn, "[data] --shuffle-buffer needs uncompressed training files, shuffling {} in RAM instead", path);
+      return false;
+    }
+  }
+  return true;
+}
+
+// One pass over the files to find the byte offsets of the chunks, once for all epochs
+void Corpus::indexChunks() {
+  chunkLines_ = std::max(shuffleBuffer_ / SHUFFLE_WAYS, (size_t)1);
+  LOG(info, "[data] Indexing chunks of {} lines for shuffling", utils::withCommas(chunkLines_));
+
+  chunkOffsets_.assign(paths_.size(), {});
+  for(size_t i = 0; i < paths_.size(); ++i) {
+    std::ifstream file(paths_[i], std::ios::binary);
+    ABORT_IF(!file, "Could not open {}", paths_[i]);
+    std::string line;
+    size_t lines = 0;
+    for(std::streamoff offset = file.tellg(); io::getline(file, line); offset = file.tellg()) {
+      if(lines % chunkLines_ == 0)
+        chunkOffsets_[i].push_back(offset);
+      lines++;
+    }
+    ABORT_IF(i > 0 && lines != numLines_, "Not all input files have the same number of lines");
+    numLines_ = lines;
+  }
+  LOG(info, "[data] Done indexing {} sentences in {} chunks", utils::withCommas(numLines_), chunkOffsets_[0].size());
+}
+
+// Shuffles the order of the chunks, the sentences are mixed by the buffer while they are read
+void Corpus::shuffleChunks() {
+  if(chunkOffsets_.empty())
+    indexChunks();
+
+  chunkOrder_.clear();
+  for(size_t chunk = 0; chunk < chunkOffsets_[0].size(); ++chunk)
+    if(inShard(chunk))
+      chunkOrder_.push_back(chunk);
+  LOG(info, "[data] Shuffling {} chunks, mixing their sentences in a buffer of {}",
+      chunkOrder_.size(), utils::withCommas(shuffleBuffer_));
+  std::shuffle(chunkOrder_.begin(), chunkOrder_.end(), eng_);
+  bufferEng_.seed((std::mt19937::result_type)eng_());
+
+  nextChunk_ = 0;
+  ways_.clear();
+  buffer_.clear();
+  corpusInRAM_.clear();
+  ids_.clear();
+  bufferedShuffle_ = true;
+  pos_ = 0;
+}
+
+// Reads the next line of a random one of the open chunks into the buffer, returns false at the end of the data
+bool Corpus::readChunkLine() {
+  while(ways_.size() < SHUFFLE_WAYS && nextChunk_ < chunkOrder_.size()) {
+    size_t chunk = chunkOrder_[nextChunk_++];
+    ShuffleWay way;
+    way.nextId = chunk * chunkLines_;
+    way.linesLeft = std::min(chunkLines_, numLines_ - way.nextId);
+    for(size_t i = 0; i < paths_.size(); ++i) {
+      way.files.emplace_back(new std::ifstream(paths_[i], std::ios::binary));
+      way.files.back()->seekg(chunkOffsets_[i][chunk]);
+    }
+    ways_.push_back(std::move(way));
+  }
+  if(ways_.empty())
+    return false;
+
+  size_t w = std::uniform_int_distribution<size_t>(0, ways_.size() - 1)(bufferEng_);
+  auto& way = ways_[w];
+  std::vector<std::string> fields(way.files.size());
+  for(size_t i = 0; i < way.files.size(); ++i)
+    ABORT_IF(!io::getline(*way.files[i], fields[i]), "{} changed since it was indexed for shuffling", paths_[i]);
+  buffer_.emplace_back(way.nextId++, std::move(fields));
+
+  if(--way.linesLeft == 0)
+    ways_.erase(ways_.begin() + w);
+  return true;
+}
+
+bool Corpus::nextFromShuffleBuffer(size_t& curId, std::vector<std::string>& fields) {
+  while(buffer_.size() < shuffleBuffer_ && readChunkLine())
+    ;
+  if(buffer_.empty())
+    return false;
+
+  size_t k = std::uniform_int_distribution<size_t>(0, buffer_.size() - 1)(bufferEng_);
+  std::swap(buffer_[k], buffer_.back());
+  curId = buffer_.back().first;
+  fields = std::move(buffer_.back().second);
+  buffer_.pop_back();
+  return true;
+}
+
 CorpusBase::batch_ptr Corpus::toBatch(const std::vector<Sample>& batchVector) {
   size_t batchSize = batchVector.size();
 
@@ -329,6 +462,12 @@ CorpusBase::batch_ptr Corpus::toBatch(const std::vector<Sample>& batchVector) {
     addAlignmentsToBatch(batch, batchVector);
   if(weightFileIdx_ > -1 && options_->hasAndNotEmpty("data-weighting"))
     addWeightsToBatch(batch, batchVector);
+  if(numAdapters_ > 0) {
+    std::vector<int> adapters;
+    for(auto& ex : batchVector)
+      adapters.push_back(ex.getAdapter());
+    batch->setAdapters(adapters);
+  }
 
   return batch;
 }
@@ -21,6 +21,7 @@ class Corpus : public CorpusBase {
 private:
   std::vector<UPtr<io::TemporaryFile>> tempFiles_;
   std::vector<size_t> ids_;
+  std::vector<size_t> shardIds_; // line numbers of the sentences that shuffleData() kept for this shard
   
   UPtr<ThreadPool> threadPool_; // thread pool for parallelized data reading
 
@@ -30,6 +31,31 @@ private:
 
   void shuffleData(const std::vector<std::string>& paths);
 
+  // for shuffle-buffer: the files are read in shuffled chunks of consecutive lines, SHUFFLE_WAYS of them at a time,
+  // into a buffer from which next() draws at random
+  static const size_t SHUFFLE_WAYS = 16;
+  struct ShuffleWay {
+    std::vector<UPtr<std::ifstream>> files; // [stream] positioned at the next line of the chunk
+    size_t nextId;                          // line number of the next line
+    size_t linesLeft;
+  };
+  size_t shuffleBuffer_{0};
+  bool bufferedShuffle_{false};
+  size_t numLines_{0};
+  size_t chunkLines_{1};
+  std::vector<std::vector<std::streamoff>> chunkOffsets_; // [stream][chunk] byte offset of the first line of each chunk
+  std::vector<size_t> chunkOrder_;
+  size_t nextChunk_{0};
+  std::vector<ShuffleWay> ways_;
+  std::vector<std::pair<size_t, std::vector<std::string>>> buffer_; // line number and lines of each stream
+  std::mt19937 bufferEng_; // seeded by shuffle() from eng_, so the draws during the epoch do not change eng_
+
+  bool canShuffleInChunks() const;
+  void indexChunks();
+  void shuffleChunks();
+  bool readChunkLine();
+  bool nextFromShuffleBuffer(size_t& curId, std::vector<std::string>& fields);
+
   // for pre-processing
   size_t allCapsEvery_{0};   // if set, convert every N-th input sentence (after randomization) to all-caps (source and target)
   size_t titleCaseEvery_{0}; // ditto for title case (source only)
@@ -70,6 +96,11 @@ public:
   std::vector<Ptr<Vocab>>& getVocabs() override { return vocabs_; }
 
   batch_ptr toBatch(const std::vector<Sample>& batchVector) override;
+
+  // while the files are read in order, as after reset(): the number of lines read, and skipping lines without
+  // processing them, e.g. to continue a corpus of --train-mixture where it was left
+  size_t linesRead() const { return pos_; }
+  void skipLines(size_t lines);
 };
 }  // namespace data
 }  // namespace marian
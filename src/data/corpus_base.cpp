@@ -29,6 +29,22 @@ void SentenceTupleImpl::setWeights(const std::vector<float>& weights) {
   weights_ = weights;
 }
 
+int takeAdapterTag(std::string& line, size_t numAdapters) {
+  const std::string prefix = "<lora:";
+  if(line.compare(0, prefix.size(), prefix) != 0)
+    return -1;
+  auto end = line.find('>', prefix.size());
+  ABORT_IF(end == std::string::npos, "Unterminated adapter tag in line: {}", line);
+  std::string adapter = line.substr(prefix.size(), end - prefix.size());
+  ABORT_IF(adapter.empty() || adapter.find_first_not_of("0123456789") != std::string::npos,
+           "Adapter tag <lora:{}> does not name the index of one of --lora-adapters", adapter);
+  size_t index = std::stoul(adapter);
+  ABORT_IF(index >= numAdapters, "Adapter tag <lora:{}> but there are only {} --lora-adapters", index, numAdapters);
+  auto begin = line.find_first_not_of(' ', end + 1);
+  line.erase(0, begin == std::string::npos ? line.size() : begin);
+  return (int)index;
+}
+
 CorpusIterator::CorpusIterator() : pos_(-1) {}
 
 CorpusIterator::CorpusIterator(CorpusBase* corpus)
@@ -63,7 +79,8 @@ CorpusBase::CorpusBase(const std::vector<std::string>& paths,
       joinFields_(options_->get<bool>("input-join-fields", false)),
       insertSeparator_(options_->get<bool>("comet-use-separator", false)),
       tsv_(options_->get<bool>("tsv", false)),
-      tsvNumInputFields_(getNumberOfTSVInputFields(options)) {
+      tsvNumInputFields_(getNumberOfTSVInputFields(options)),
+      numAdapters_(options_->get<std::vector<std::string>>("lora-adapters", {}).size()) {
   // TODO: support passing only one vocab file if we have fully-tied embeddings
   if(tsv_) {
     ABORT_IF(tsvNumInputFields_ != vocabs_.size(),
@@ -91,7 +108,8 @@ CorpusBase::CorpusBase(Ptr<Options> options, bool translate, size_t seed)
       joinFields_(options_->get<bool>("input-join-fields", false)),
       insertSeparator_(options_->get<bool>("comet-use-separator", false)),
       tsv_(options_->get<bool>("tsv", false)),
-      tsvNumInputFields_(getNumberOfTSVInputFields(options)) {
+      tsvNumInputFields_(getNumberOfTSVInputFields(options)),
+      numAdapters_(options_->get<std::vector<std::string>>("lora-adapters", {}).size()) {
   bool training = !translate;
 
   if(training)
@@ -12,6 +12,7 @@
 #include "data/vocab.h"
 
 #include <future>
+#include <map>
 
 namespace marian {
 namespace data {
@@ -31,6 +32,7 @@ private:
   std::vector<float> weights_;  // [stream index]
   WordAlignment alignment_;
   bool altered_ = false;
+  int adapter_{-1};             // low-rank adapter of the sentence, see --lora-adapters, -1 for none
 
 public:
   typedef Words value_type;
@@ -141,6 +143,9 @@ public:
 
   const WordAlignment& getAlignment() const { return alignment_; }
   void setAlignment(const WordAlignment& alignment) { alignment_ = alignment; }
+
+  int getAdapter() const { return adapter_; }
+  void setAdapter(int adapter) { adapter_ = adapter; }
 };
 
 class SentenceTuple {
@@ -227,8 +232,17 @@ public:
   const std::vector<float>& getWeights() const { return get().getWeights(); }
 
   const WordAlignment& getAlignment() const { return get().getAlignment(); }
+
+  int getAdapter() const { return get().getAdapter(); }
 };
 
+/**
+ * @brief Removes a leading <lora:N> tag, see --lora-adapters, from a source line.
+ *
+ * @return the adapter N, or -1 if the line has no tag. Aborts if N is not less than numAdapters.
+ */
+int takeAdapterTag(std::string& line, size_t numAdapters);
+
 /**
  * @brief Batch of sentences represented as word indices with masking.
  */
@@ -299,6 +313,67 @@ public:
    */
   size_t batchWords() const { return words_; }
 
+  /**
+   * @brief Positions of the unmasked words in a batch-major [size, width] layout, i.e. batchIdx * width + wordPos,
+   * sentence after sentence. This is the packed representation of the batch without padding.
+   *
+   * @param offsets If given, receives the cumulative sentence lengths: the words of sentence b are
+   * at offsets[b] to offsets[b + 1] - 1 of the result, offsets has size + 1 entries.
+   */
+  std::vector<IndexType> packedPositions(std::vector<size_t>* offsets = nullptr) const {
+    std::vector<IndexType> positions;
+    positions.reserve(size_ * width_);
+    if(offsets)
+      offsets->assign(1, 0);
+    for(size_t b = 0; b < size_; ++b) {
+      for(size_t s = 0; s < width_; ++s)
+        if(mask_[locate(/*batchIdx=*/b, /*wordPos=*/s)] != 0)
+          positions.push_back((IndexType)(b * width_ + s));
+      if(offsets)
+        offsets->push_back(positions.size());
+    }
+    return positions;
+  }
+
+  /**
+   * @brief A new sub-batch with the sentences at the given batch indices, in that order.
+   */
+  Ptr<SubBatch> select(const std::vector<size_t>& rows) const {
+    auto selected = New<SubBatch>(rows.size(), width_, vocab_);
+    size_t words = 0;
+    for(size_t b = 0; b < rows.size(); ++b) {
+      for(size_t s = 0; s < width_; ++s) {
+        selected->data()[selected->locate(b, s)] = indices_[locate(rows[b], s)];
+        selected->mask()[selected->locate(b, s)] = mask_[locate(rows[b], s)];
+        words += mask_[locate(rows[b], s)] != 0;
+      }
+    }
+    selected->setWords(words);
+    return selected;
+  }
+
+  /**
+   * @brief The distinct sentences of the batch: receives the batch index of the first occurrence of every
+   * distinct sentence and, for every sentence, the position of its first occurrence in that list.
+   *
+   * @return true if any sentence occurs more than once
+   */
+  bool distinct(std::vector<size_t>& firstRows, std::vector<IndexType>& rowOf) const {
+    std::map<std::vector<WordIndex>, IndexType> seen;
+    firstRows.clear();
+    rowOf.clear();
+    for(size_t b = 0; b < size_; ++b) {
+      std::vector<WordIndex> sentence;
+      for(size_t s = 0; s < width_ && mask_[locate(b, s)] != 0; ++s)
+        sentence.push_back(indices_[locate(b, s)].toWordIndex());
+      auto it = seen.emplace(std::move(sentence), (IndexType)firstRows.size()).first;
+      if(it->second == firstRows.size())
+        firstRows.push_back(b);
+      rowOf.push_back(it->second);
+    }
+    return firstRows.size() < size_;
+  }
+
   /**
    * @brief Splits the stream into sub-batches of equal size (except for last).
    *
@@ -362,6 +437,7 @@ protected:
   std::vector<Ptr<SubBatch>> subBatches_;
   std::vector<WordAlignment> guidedAlignment_; // [max source len, batch size, max target len] flattened
   std::vector<float> dataWeights_;
+  std::vector<int> adapters_; // [batch size] low-rank adapter of each sentence, see --lora-adapters
 
 public:
   CorpusBatch(const std::vector<Ptr<SubBatch>>& subBatches)
@@ -569,6 +645,15 @@ public:
       }
     }
 
+    if(!adapters_.empty()) {
+      pos = 0;
+      for(auto split : splits) {
+        auto cb = std::static_pointer_cast<CorpusBatch>(split);
+        cb->setAdapters(std::vector<int>(adapters_.begin() + pos, adapters_.begin() + pos + cb->size()));
+        pos += cb->size();
+      }
+    }
+
     return splits;
   }
 
@@ -582,6 +667,10 @@ public:
     dataWeights_ = weights;
   }
 
+  // empty unless --lora-adapters are given
+  const std::vector<int>& getAdapters() const { return adapters_; }
+  void setAdapters(const std::vector<int>& adapters) { adapters_ = adapters; }
+
   /**
    * @brief Prints the batch in a readable form on stderr for debugging.
    */
@@ -640,6 +729,15 @@ public:
   virtual ~CorpusBase() {}
   virtual std::vector<Ptr<Vocab>>& getVocabs() = 0;
 
+  // stores what restore() needs to continue after the current epoch, see CorpusBatchGenerator::actAfterEpoch()
+  virtual void saveState(TrainingState& state) { state.seedCorpus = getRNGState(); }
+
+  // restricts reading to the sentences with line number % numShards == shard, see --shard-data. Call before prepare().
+  virtual void setShard(size_t shard, size_t numShards) {
+    shard_ = shard;
+    numShards_ = numShards;
+  }
+
 protected:
   std::vector<UPtr<std::istream>> files_;
   std::vector<Ptr<Vocab>> vocabs_;
@@ -653,6 +751,10 @@ protected:
 
   size_t pos_{0};
 
+  size_t shard_{0};
+  size_t numShards_{1};
+  bool inShard(size_t lineId) const { return lineId % numShards_ == shard_; }
+
   size_t maxLength_{0};
   bool maxLengthCrop_{false};
   bool rightLeft_{false};
@@ -684,6 +786,11 @@ protected:
    */
   int alignFileIdx_{-1};
 
+  /**
+   * @brief Number of --lora-adapters that the source lines can select with a leading tag, see takeAdapterTag().
+   */
+  size_t numAdapters_{0};
+
   /**
    * @brief Determine if EOS symbol should be added to input
    */
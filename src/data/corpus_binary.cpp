@@ -0,0 +1,241 @@
+#include "data/corpus_binary.h"
+
+#include "common/filesystem.h"
+#include "common/utils.h"
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace marian {
+namespace data {
+
+static_assert(sizeof(Word) == sizeof(WordIndex), "The binary corpus stores words as their indices");
+
+CorpusBinary::CorpusBinary(Ptr<Options> options, bool translate /*= false*/, size_t seed /*= Config:seed*/)
+    : CorpusBase(options, translate, seed),
+      readAhead_(options_->get<size_t>("binary-corpus-readahead", 0)) {
+  ABORT_IF(alignFileIdx_ > -1 || weightFileIdx_ > -1,
+           "--binary-corpus does not support guided alignment or data weighting");
+  ABORT_IF(tsv_, "--binary-corpus does not support TSV input");
+
+  auto path = options_->get<std::string>("binary-corpus");
+  if(filesystem::exists(path))
+    LOG(info, "[data] Reusing binary corpus {}", path);
+  else
+    create(path);
+  map(path);
+}
+
+void CorpusBinary::create(const std::string& fileName) {
+  LOG(info, "[data] Creating binary corpus {}", fileName);
+
+  // written under a temporary name and renamed once complete, so that neither an interrupted run nor another process
+  // that creates the same corpus leaves a partial file behind
+  std::string tempName = fileName + ".tmp" + std::to_string(std::random_device()());
+  std::string indexName = tempName + ".index";
+  std::ofstream out(tempName, std::ios::binary);
+  std::ofstream indexOut(indexName, std::ios::binary);
+  ABORT_IF(!out || !indexOut, "Could not create binary corpus {}", tempName);
+
+  Header header = {MAGIC_NUMBER, VERSION, files_.size(), 0, 0};
+  out.write((const char*)&header, sizeof(header));
+  for(const auto& vocab : vocabs_) {
+    uint64_t vocabSize = vocab->size();
+    out.write((const char*)&vocabSize, sizeof(vocabSize));
+  }
+  ABORT_IF(vocabs_.size() != header.streams, "Binary corpus needs one vocabulary per training file");
+
+  uint64_t offset = 0; // in words
+  size_t report = 1000000;
+  std::string line;
+  for(;;) {
+    SentenceTupleImpl tup(header.sentences);
+    size_t eofsHit = 0;
+    for(size_t i = 0; i < files_.size(); ++i) {
+      if(!io::getline(*files_[i], line))
+        eofsHit++;
+      else if(eofsHit == 0)
+        addWordsToSentenceTuple(line, i, tup);
+    }
+    if(eofsHit == files_.size())
+      break;
+    ABORT_IF(eofsHit != 0, "Not all input files have the same number of lines");
+
+    for(size_t i = 0; i < tup.size(); ++i) {
+      indexOut.write((const char*)&offset, sizeof(offset));
+      out.write((const char*)tup[i].data(), tup[i].size() * sizeof(Word));
+      offset += tup[i].size();
+    }
+
+    if(++header.sentences == report) {
+      LOG(info, "[data] Encoded {} sentences", utils::withCommas(header.sentences));
+      report *= 2;
+    }
+  }
+  indexOut.write((const char*)&offset, sizeof(offset));
+  indexOut.close();
+
+  // the index starts at a multiple of 8 bytes
+  const char padding[sizeof(uint64_t)] = {0};
+  out.write(padding, (sizeof(uint64_t) - (size_t)out.tellp() % sizeof(uint64_t)) % sizeof(uint64_t));
+  header.indexOffset = (uint64_t)out.tellp();
+  {
+    std::ifstream indexIn(indexName, std::ios::binary);
+    out << indexIn.rdbuf();
+  }
+  std::remove(indexName.c_str());
+
+  out.seekp(0);
+  out.write((const char*)&header, sizeof(header));
+  out.close();
+  ABORT_IF(!out, "Could not write binary corpus {}", tempName);
+  ABORT_IF(std::rename(tempName.c_str(), fileName.c_str()) != 0, "Could not rename {} to {}", tempName, fileName);
+
+  LOG(info, "[data] Done encoding {} sentences into {}", utils::withCommas(header.sentences), fileName);
+}
+
+void CorpusBinary::map(const std::string& fileName) {
+  mmap_ = mio::mmap_source(fileName);
+  ABORT_IF(mmap_.size() < sizeof(Header), "{} is not a binary corpus", fileName);
+
+  const Header* header = (const Header*)mmap_.data();
+  ABORT_IF(header->magic != MAGIC_NUMBER, "{} is not a binary corpus", fileName);
+  ABORT_IF(header->version != VERSION, "Binary corpus {} has version {}, expected {}", fileName, header->version, VERSION);
+  streams_ = header->streams;
+  sentences_ = header->sentences;
+
+  const uint64_t* vocabSizes = (const uint64_t*)(header + 1);
+  ABORT_IF(streams_ != vocabs_.size(),
+           "Binary corpus {} has {} streams, but there are {} vocabularies", fileName, streams_, vocabs_.size());
+  for(size_t i = 0; i < streams_; ++i)
+    ABORT_IF(vocabSizes[i] != vocabs_[i]->size(),
+             "Binary corpus {} was created with a vocabulary of {} entries for stream {}, not {}. Delete it to create it "
+             "anew", fileName, vocabSizes[i], i, vocabs_[i]->size());
+
+  words_ = (const Word*)(vocabSizes + streams_);
+  index_ = (const uint64_t*)(mmap_.data() + header->indexOffset);
+  ABORT_IF(header->indexOffset + (sentences_ * streams_ + 1) * sizeof(uint64_t) != mmap_.size(),
+           "Binary corpus {} is truncated", fileName);
+
+  LOG(info, "[data] Mapped binary corpus {} with {} sentences", fileName, utils::withCommas(sentences_));
+}
+
+void CorpusBinary::readAhead(size_t end) {
+#ifndef _WIN32
+  static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  end = std::min(end, ids_.size());
+  for(; readAheadPos_ < end; ++readAheadPos_) {
+    const uint64_t* offsets = index_ + ids_[readAheadPos_] * streams_;
+    size_t first = (const char*)(words_ + offsets[0]) - mmap_.data();
+    size_t last = (const char*)(words_ + offsets[streams_]) - mmap_.data();
+    if(last == first)
+      continue;
+    first -= first % pageSize; // the mapping starts at a page boundary
+    madvise((void*)(mmap_.data() + first), last - first, MADV_WILLNEED);
+  }
+#else
+  readAheadPos_ = end;
+#endif
+}
+
+SentenceTuple CorpusBinary::next() {
+  size_t end = ids_.empty() ? sentences_ : ids_.size();
+  // requested in steps of half the window, so that the pages have time to arrive before they are read
+  if(readAhead_ > 0 && !ids_.empty() && readAheadPos_ < pos_ + readAhead_ / 2)
+    readAhead(pos_ + readAhead_);
+  while(pos_ < end) {
+    // if the corpus has been shuffled, ids_ contains the sentence indexes of this shard
+    size_t curId = ids_.empty() ? pos_ : ids_[pos_];
+    pos_++;
+    if(ids_.empty() && !inShard(curId))
+      continue;
+
+    SentenceTupleImpl tup(curId);
+    const uint64_t* offsets = index_ + curId * streams_;
+    for(size_t i = 0; i < streams_; ++i)
+      tup.pushBack(Words(words_ + offsets[i], words_ + offsets[i + 1]));
+
+    // check if all streams are valid, that is, non-empty and no longer than maximum allowed length
+    if(std::all_of(tup.begin(), tup.end(), [=](const Words& words) {
+         return words.size() > 0 && words.size() <= maxLength_;
+       }))
+      return SentenceTuple(tup);
+  }
+  return SentenceTuple();
+}
+
+void CorpusBinary::shuffle() {
+  LOG(info, "[data] Shuffling binary corpus");
+  ids_.clear();
+  for(size_t id = shard_; id < sentences_; id += numShards_)
+    ids_.push_back(id);
+  std::shuffle(ids_.begin(), ids_.end(), eng_);
+  pos_ = 0;
+  readAheadPos_ = 0;
+#ifndef _WIN32
+  if(readAhead_ > 0)
+    madvise((void*)mmap_.data(), mmap_.size(), MADV_RANDOM);
+#endif
+}
+
+void CorpusBinary::reset() {
+  ids_.clear();
+  pos_ = 0;
+  readAheadPos_ = 0;
+#ifndef _WIN32
+  if(readAhead_ > 0)
+    madvise((void*)mmap_.data(), mmap_.size(), MADV_NORMAL);
+#endif
+}
+
+void CorpusBinary::restore(Ptr<TrainingState> ts) {
+  setRNGState(ts->seedCorpus);
+}
+
+CorpusBase::batch_ptr CorpusBinary::toBatch(const std::vector<Sample>& batchVector) {
+  size_t batchSize = batchVector.size();
+
+  std::vector<size_t> sentenceIds;
+  std::vector<int> maxDims;
+  for(auto& ex : batchVector) {
+    if(maxDims.size() < ex.size())
+      maxDims.resize(ex.size(), 0);
+    for(size_t i = 0; i < ex.size(); ++i) {
+      if(ex[i].size() > (size_t)maxDims[i])
+        maxDims[i] = (int)ex[i].size();
+    }
+    sentenceIds.push_back(ex.getId());
+  }
+
+  std::vector<Ptr<SubBatch>> subBatches;
+  for(size_t j = 0; j < maxDims.size(); ++j)
+    subBatches.emplace_back(New<SubBatch>(batchSize, maxDims[j], vocabs_[j]));
+
+  std::vector<size_t> words(maxDims.size(), 0);
+  for(size_t b = 0; b < batchSize; ++b) {
+    for(size_t j = 0; j < maxDims.size(); ++j) {
+      auto subBatch = subBatches[j];
+      for(size_t s = 0; s < batchVector[b][j].size(); ++s) {
+        subBatch->data()[subBatch->locate(/*batchIdx=*/b, /*wordPos=*/s)] = batchVector[b][j][s];
+        subBatch->mask()[subBatch->locate(/*batchIdx=*/b, /*wordPos=*/s)] = 1.f;
+        words[j]++;
+      }
+    }
+  }
+
+  for(size_t j = 0; j < maxDims.size(); ++j)
+    subBatches[j]->setWords(words[j]);
+
+  auto batch = batch_ptr(new batch_type(subBatches));
+  batch->setSentenceIds(sentenceIds);
+  return batch;
+}
+
+}  // namespace data
+}  // namespace marian
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/options.h"
+#include "data/alignment.h"
+#include "data/batch.h"
+#include "data/corpus_base.h"
+#include "data/vocab.h"
+
+#include "mio/mio.hpp"
+
+#include <string>
+#include <vector>
+
+namespace marian {
+namespace data {
+
+/**
+ * Training corpus that is stored as word ids in a memory-mapped binary file, see --binary-corpus. Like a persistent
+ * --sqlite database, the file is created from --train-sets and --vocabs on the first run and reused afterwards, so
+ * later epochs and runs neither read text nor encode it with the vocabularies.
+ *
+ * The file consists of a header, the vocabulary size of each stream, the word ids of all sentences and an index
+ * with the offset of each sentence of each stream into the word ids:
+ *   Header | uint64 vocabSizes[streams] | Word words[] | (padding to 8 bytes) | uint64 index[sentences * streams + 1]
+ * The sentences of stream i of sentence s are words[index[s * streams + i], index[s * streams + i + 1]).
+ *
+ * The word ids are those of the vocabularies and options at creation, rebuild the file if they change. Guided
+ * alignments, data weighting and TSV input are not supported.
+ *
+ * After shuffling, the sentences are read in random order. The kernel's sequential readahead is turned off for the
+ * mapping then, and the pages of the next --binary-corpus-readahead sentences are requested ahead of reading them, so
+ * that a corpus larger than memory is read from disk in parallel instead of one page fault at a time.
+ */
+class CorpusBinary : public CorpusBase {
+public:
+  CorpusBinary(Ptr<Options> options, bool translate = false, size_t seed = Config::seed);
+
+  Sample next() override;
+
+  void shuffle() override;
+
+  void reset() override;
+
+  void restore(Ptr<TrainingState>) override;
+
+  iterator begin() override { return iterator(this); }
+
+  iterator end() override { return iterator(); }
+
+  std::vector<Ptr<Vocab>>& getVocabs() override { return vocabs_; }
+
+  batch_ptr toBatch(const std::vector<Sample>& batchVector) override;
+
+private:
+  struct Header {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t streams;
+    uint64_t sentences;
+    uint64_t indexOffset; // in bytes from the beginning of the file
+  };
+
+  static const uint64_t MAGIC_NUMBER = 0x5350524f434e524dull; // "MRNCORPS"
+  static const uint64_t VERSION = 1;
+
+  // encodes the text of the training files and writes the binary corpus to fileName
+  void create(const std::string& fileName);
+  void map(const std::string& fileName);
+  // asks the kernel to read the pages of the shuffled sentences up to ids_[end] in the background
+  void readAhead(size_t end);
+
+  mio::mmap_source mmap_;
+  size_t streams_{0};
+  size_t sentences_{0};
+  const Word* words_{nullptr};
+  const uint64_t* index_{nullptr};
+
+  std::vector<size_t> ids_; // shuffled order of the sentences, if shuffled
+  size_t readAhead_{0};     // number of shuffled sentences whose pages are requested ahead
+  size_t readAheadPos_{0};  // position in ids_ up to which they have been requested
+};
+
+}  // namespace data
+}  // namespace marian
@@ -0,0 +1,120 @@
+#include "data/corpus_feed.h"
+
+#include "common/filesystem.h"
+#include "common/utils.h"
+
+#include <algorithm>
+
+namespace marian {
+namespace data {
+
+CorpusFeed::CorpusFeed(Ptr<SentenceFeed> feed, Ptr<Options> options, size_t seed /*= Config:seed*/)
+    : CorpusBase(/*paths=*/{}, /*vocabs=*/{}, options, seed), feed_(feed) {
+  ABORT_IF(options_->get("guided-alignment", std::string("none")) != "none" || options_->hasAndNotEmpty("data-weighting"),
+           "--train-feed does not support guided alignment or data weighting");
+
+  auto vocabPaths = options_->get<std::vector<std::string>>("vocabs");
+  auto maxVocabs = options_->get<std::vector<int>>("dim-vocabs");
+  ABORT_IF(vocabPaths.empty(), "--train-feed needs --vocabs");
+  maxVocabs.resize(vocabPaths.size(), 0);
+
+  std::vector<int> vocabDims(vocabPaths.size());
+  for(size_t i = 0; i < vocabPaths.size(); ++i) {
+    ABORT_IF(!filesystem::exists(vocabPaths[i]), "--train-feed needs existing vocabularies, {} does not exist", vocabPaths[i]);
+    auto vocab = New<Vocab>(options_, i);
+    vocabDims[i] = (int)vocab->load(vocabPaths[i], maxVocabs[i]);
+    vocabs_.push_back(vocab);
+  }
+  options_->set("dim-vocabs", vocabDims);
+  addEOS_.resize(vocabs_.size(), true);
+
+  std::vector<size_t> sizes(vocabDims.begin(), vocabDims.end());
+  LOG(info, "[data] Reading the training sentences from the feed with vocabulary sizes {}", utils::join(sizes, ", "));
+}
+
+SentenceTuple CorpusFeed::next() {
+  while(feed_->next(streams_)) {
+    size_t curId = pos_++;
+    if(!inShard(curId))
+      continue;
+
+    ABORT_IF(streams_.size() != vocabs_.size(),
+             "Sentence {} of the feed has {} streams, but there are {} vocabularies", curId, streams_.size(), vocabs_.size());
+
+    SentenceTupleImpl tup(curId);
+    bool fits = true;
+    for(size_t i = 0; i < streams_.size(); ++i) {
+      auto& words = streams_[i];
+      for(auto word : words)
+        ABORT_IF(word.toWordIndex() >= vocabs_[i]->size(),
+                 "Word id {} in stream {} of sentence {} of the feed is not in the vocabulary of size {}",
+                 word.toWordIndex(), i, curId, vocabs_[i]->size());
+      if(addEOS_[i] && (words.empty() || words.back() != vocabs_[i]->getEosId()))
+        words.push_back(vocabs_[i]->getEosId());
+
+      if(words.size() > maxLength_) {
+        if(maxLengthCrop_) {
+          words.resize(maxLength_);
+          if(addEOS_[i])
+            words.back() = vocabs_[i]->getEosId();
+        } else {
+          fits = false;
+        }
+      }
+      fits = fits && !words.empty();
+      tup.pushBack(words);
+    }
+    if(fits)
+      return SentenceTuple(tup);
+  }
+  // an exhausted iterator instead of a container would give an empty epoch after the first one, forever
+  ABORT_IF(pos_ == 0, "The training data of --train-feed has no sentences in this epoch");
+  return SentenceTuple();
+}
+
+void CorpusFeed::reset() {
+  feed_->restart();
+  pos_ = 0;
+}
+
+void CorpusFeed::restore(Ptr<TrainingState> ts) {
+  setRNGState(ts->seedCorpus);
+}
+
+CorpusBase::batch_ptr CorpusFeed::toBatch(const std::vector<Sample>& batchVector) {
+  size_t batchSize = batchVector.size();
+
+  std::vector<size_t> sentenceIds;
+  std::vector<int> maxDims(vocabs_.size(), 0);
+  for(auto& ex : batchVector) {
+    for(size_t i = 0; i < ex.size(); ++i)
+      maxDims[i] = std::max(maxDims[i], (int)ex[i].size());
+    sentenceIds.push_back(ex.getId());
+  }
+
+  std::vector<Ptr<SubBatch>> subBatches;
+  for(size_t j = 0; j < maxDims.size(); ++j)
+    subBatches.emplace_back(New<SubBatch>(batchSize, maxDims[j], vocabs_[j]));
+
+  std::vector<size_t> words(maxDims.size(), 0);
+  for(size_t b = 0; b < batchSize; ++b) {
+    for(size_t j = 0; j < maxDims.size(); ++j) {
+      auto subBatch = subBatches[j];
+      for(size_t s = 0; s < batchVector[b][j].size(); ++s) {
+        subBatch->data()[subBatch->locate(/*batchIdx=*/b, /*wordPos=*/s)] = batchVector[b][j][s];
+        subBatch->mask()[subBatch->locate(/*batchIdx=*/b, /*wordPos=*/s)] = 1.f;
+        words[j]++;
+      }
+    }
+  }
+
+  for(size_t j = 0; j < maxDims.size(); ++j)
+    subBatches[j]->setWords(words[j]);
+
+  auto batch = batch_ptr(new batch_type(subBatches));
+  batch->setSentenceIds(sentenceIds);
+  return batch;
+}
+
+}  // namespace data
+}  // namespace marian
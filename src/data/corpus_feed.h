@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/options.h"
+#include "data/alignment.h"
+#include "data/batch.h"
+#include "data/corpus_base.h"
+#include "data/vocab.h"
+
+#include <vector>
+
+namespace marian {
+namespace data {
+
+/**
+ * Source of the sentence tuples of CorpusFeed, one vector of word ids per stream, e.g. the iterable given to the
+ * Trainer.train() of pymarian. next() is called from the thread that fills the batches, while the model trains on the
+ * previous ones.
+ */
+class SentenceFeed {
+public:
+  virtual ~SentenceFeed() {}
+  // starts an epoch, the sentences of the previous one are not read any further
+  virtual void restart() = 0;
+  // sets streams to the word ids of the next sentence tuple, returns false at the end of the epoch
+  virtual bool next(std::vector<Words>& streams) = 0;
+};
+
+/**
+ * Training corpus of the sentence tuples of a SentenceFeed, see --train-feed. The word ids have to be those of the
+ * vocabularies of --vocabs, the end of sentence is appended where it is missing. The order of the sentences is that
+ * of the feed, which shuffles them if they should be shuffled. Restoring the training skips the batches of the
+ * interrupted epoch as they are read again from the start of the feed, use --no-restore-corpus if the feed does not
+ * repeat its sentences.
+ */
+class CorpusFeed : public CorpusBase {
+public:
+  CorpusFeed(Ptr<SentenceFeed> feed, Ptr<Options> options, size_t seed = Config::seed);
+
+  Sample next() override;
+
+  void shuffle() override { reset(); }
+
+  void reset() override;
+
+  void restore(Ptr<TrainingState>) override;
+
+  iterator begin() override { return iterator(this); }
+
+  iterator end() override { return iterator(); }
+
+  std::vector<Ptr<Vocab>>& getVocabs() override { return vocabs_; }
+
+  batch_ptr toBatch(const std::vector<Sample>& batchVector) override;
+
+private:
+  Ptr<SentenceFeed> feed_;
+  std::vector<Words> streams_;
+};
+
+}  // namespace data
+}  // namespace marian
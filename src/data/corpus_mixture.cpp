@@ -0,0 +1,124 @@
+#include "data/corpus_mixture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace marian {
+namespace data {
+
+CorpusMixture::CorpusMixture(Ptr<Options> options, bool translate /*= false*/, size_t seed /*= Config:seed*/)
+    : CorpusBase(options, translate, seed),
+      weights_(options_->get<std::vector<float>>("mixture-weights", {})),
+      temperatureSentences_(options_->get<size_t>("mixture-temperature-sentences", 0)) {
+  ABORT_IF(alignFileIdx_ > -1 || weightFileIdx_ > -1,
+           "--train-mixture does not support guided alignment or data weighting");
+
+  auto trainSets = options_->get<std::vector<std::string>>("train-sets");
+  auto mixture = options_->get<std::vector<std::string>>("train-mixture");
+  size_t streams = trainSets.size();
+  ABORT_IF(mixture.size() % streams != 0,
+           "--train-mixture needs {} files for each corpus, as many as --train-sets", streams);
+
+  sources_.push_back(New<Corpus>(trainSets, vocabs_, options_, seed));
+  for(auto it = mixture.begin(); it != mixture.end(); it += streams)
+    sources_.push_back(New<Corpus>(std::vector<std::string>(it, it + streams), vocabs_, options_, seed));
+  ended_.resize(sources_.size(), false);
+
+  if(weights_.empty())
+    weights_.resize(sources_.size(), 1.f);
+  ABORT_IF(weights_.size() != sources_.size(),
+           "--mixture-weights needs a weight for --train-sets and each corpus of --train-mixture, {} in total",
+           sources_.size());
+  for(auto weight : weights_)
+    ABORT_IF(weight <= 0.f, "--mixture-weights must be positive, not {}", weight);
+
+  auto temperatures = options_->get<std::vector<float>>("mixture-temperature", {1.f});
+  ABORT_IF(temperatures.empty() || temperatures.size() > 2, "--mixture-temperature expects a start and an end value");
+  startTemperature_ = temperatures.front();
+  endTemperature_ = temperatures.back();
+  ABORT_IF(startTemperature_ <= 0.f || endTemperature_ <= 0.f, "--mixture-temperature must be positive");
+
+  LOG(info, "[data] Mixing {} training corpora", sources_.size());
+}
+
+std::vector<float> CorpusMixture::probabilities() const {
+  float temperature = endTemperature_;
+  if(drawn_ < temperatureSentences_)
+    temperature = startTemperature_ + (endTemperature_ - startTemperature_) * drawn_ / temperatureSentences_;
+
+  std::vector<float> probs;
+  for(auto weight : weights_)
+    probs.push_back(std::pow(weight, 1.f / temperature));
+  return probs;
+}
+
+SentenceTuple CorpusMixture::next() {
+  auto probs = probabilities();
+  float sum = 0.f;
+  for(auto prob : probs)
+    sum += prob;
+
+  for(;;) {
+    // unnormalized, the draw is scaled instead
+    float draw = std::uniform_real_distribution<float>(0.f, sum)(eng_);
+    size_t i = 0;
+    while(i + 1 < probs.size() && draw >= probs[i]) {
+      draw -= probs[i];
+      i++;
+    }
+
+    auto tup = sources_[i]->next();
+    if(tup.valid()) {
+      drawn_++;
+      return tup;
+    }
+
+    // corpus i reached its end, it starts over and the epoch ends once all of them did
+    sources_[i]->reset();
+    ended_[i] = true;
+    if(std::all_of(ended_.begin(), ended_.end(), [](bool ended) { return ended; }))
+      return SentenceTuple();
+  }
+}
+
+void CorpusMixture::reset() {
+  ended_.assign(sources_.size(), false);
+}
+
+void CorpusMixture::setShard(size_t shard, size_t numShards) {
+  CorpusBase::setShard(shard, numShards);
+  for(auto& source : sources_)
+    source->setShard(shard, numShards);
+}
+
+void CorpusMixture::saveState(TrainingState& state) {
+  CorpusBase::saveState(state);
+  state.corpusPositions = {drawn_};
+  for(const auto& source : sources_)
+    state.corpusPositions.push_back(source->linesRead());
+}
+
+void CorpusMixture::restore(Ptr<TrainingState> ts) {
+  setRNGState(ts->seedCorpus);
+
+  const auto& positions = ts->corpusPositions;
+  if(positions.empty()) {
+    LOG(warn, "[data] The training state has no positions of the --train-mixture corpora, reading them from the start");
+    return;
+  }
+  ABORT_IF(positions.size() != sources_.size() + 1,
+           "The training state has the positions of {} training corpora, but there are {}",
+           positions.size() - 1,
+           sources_.size());
+
+  drawn_ = positions[0];
+  for(size_t i = 0; i < sources_.size(); ++i) {
+    sources_[i]->reset();
+    sources_[i]->skipLines(positions[i + 1]);
+  }
+  LOG(info, "[data] Continuing the {} training corpora after {} drawn sentences", sources_.size(), drawn_);
+}
+
+}  // namespace data
+}  // namespace marian
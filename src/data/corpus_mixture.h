@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/options.h"
+#include "data/corpus.h"
+#include "data/corpus_base.h"
+
+#include <vector>
+
+namespace marian {
+namespace data {
+
+/**
+ * Training corpus that mixes --train-sets with the further corpora of --train-mixture, see there. Each corpus is read
+ * in order from its own position and starts over when it reaches its end. Every sentence is drawn from corpus i with
+ * probability proportional to w_i^(1/T), where w_i is its --mixture-weights and the temperature T moves linearly from
+ * the first to the second value of --mixture-temperature over --mixture-temperature-sentences sentences.
+ *
+ * An epoch ends once each corpus has been read to its end at least once, after that reading continues where every
+ * corpus was, without rewinding or shuffling them. The number of sentences drawn and the positions are stored in
+ * TrainingState::corpusPositions to continue exactly there.
+ */
+class CorpusMixture : public CorpusBase {
+public:
+  CorpusMixture(Ptr<Options> options, bool translate = false, size_t seed = Config::seed);
+
+  Sample next() override;
+
+  // the corpora are streamed in order, shuffling is left to the batch generator
+  void shuffle() override { reset(); }
+
+  void reset() override;
+
+  void restore(Ptr<TrainingState>) override;
+
+  void saveState(TrainingState& state) override;
+
+  void setShard(size_t shard, size_t numShards) override;
+
+  iterator begin() override { return iterator(this); }
+
+  iterator end() override { return iterator(); }
+
+  std::vector<Ptr<Vocab>>& getVocabs() override { return vocabs_; }
+
+  batch_ptr toBatch(const std::vector<Sample>& batchVector) override { return sources_[0]->toBatch(batchVector); }
+
+private:
+  std::vector<Ptr<Corpus>> sources_;
+  std::vector<float> weights_;
+  float startTemperature_{1.f};
+  float endTemperature_{1.f};
+  size_t temperatureSentences_{0};
+
+  size_t drawn_{0};          // sentences drawn over all epochs, for the temperature schedule
+  std::vector<bool> ended_;  // corpora that reached their end during this epoch
+
+  std::vector<float> probabilities() const;
+};
+
+}  // namespace data
+}  // namespace marian
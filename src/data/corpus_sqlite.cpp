@@ -133,21 +133,27 @@ SentenceTuple CorpusSQLite::next() {
   return SentenceTuple();
 }
 
+std::string CorpusSQLite::shardCondition() const {
+  if(numShards_ == 1)
+    return "";
+  return " where _id % " + std::to_string(numShards_) + " = " + std::to_string(shard_);
+}
+
 void CorpusSQLite::shuffle() {
   LOG(info, "[sqlite] Selecting shuffled data");
   select_.reset(new SQLite::Statement(
-      *db_, "select * from lines order by random_seed(" + std::to_string(seed_) + ");"));
+      *db_, "select * from lines" + shardCondition() + " order by random_seed(" + std::to_string(seed_) + ");"));
 }
 
 void CorpusSQLite::reset() {
   select_.reset(
-      new SQLite::Statement(*db_, "select * from lines order by _id;"));
+      new SQLite::Statement(*db_, "select * from lines" + shardCondition() + " order by _id;"));
 }
 
 void CorpusSQLite::restore(Ptr<TrainingState> ts) {
   for(size_t i = 0; i < ts->epochs - 1; ++i) {
     select_.reset(new SQLite::Statement(
-        *db_, "select _id from lines order by random_seed(" + std::to_string(seed_) + ");"));
+        *db_, "select _id from lines" + shardCondition() + " order by random_seed(" + std::to_string(seed_) + ");"));
     select_->executeStep();
     reset();
   }
@@ -39,6 +39,7 @@ private:
   UPtr<SQLite::Statement> select_;
 
   void fillSQLite();
+  std::string shardCondition() const; // the lines of this shard, see setShard()
 
   size_t seed_;
 
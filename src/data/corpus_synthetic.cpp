@@ -0,0 +1,120 @@
+#include "data/corpus_synthetic.h"
+
+#include "common/filesystem.h"
+#include "common/utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace marian {
+namespace data {
+
+CorpusSynthetic::CorpusSynthetic(Ptr<Options> options, size_t seed /*= Config:seed*/)
+    : CorpusBase(/*paths=*/{}, /*vocabs=*/{}, options, seed),
+      sentences_(options_->get<size_t>("benchmark-sentences")) {
+  ABORT_IF(options_->get("guided-alignment", std::string("none")) != "none" || options_->hasAndNotEmpty("data-weighting"),
+           "--benchmark does not support guided alignment or data weighting");
+
+  auto vocabPaths = options_->get<std::vector<std::string>>("vocabs");
+  auto maxVocabs = options_->get<std::vector<int>>("dim-vocabs");
+  size_t numStreams = vocabPaths.empty() ? maxVocabs.size() : vocabPaths.size();
+  ABORT_IF(numStreams == 0, "--benchmark needs --vocabs or --dim-vocabs");
+  maxVocabs.resize(numStreams, 0);
+
+  std::vector<int> vocabDims(numStreams);
+  for(size_t i = 0; i < numStreams; ++i) {
+    auto vocab = New<Vocab>(options_, i);
+    if(!vocabPaths.empty()) {
+      ABORT_IF(!filesystem::exists(vocabPaths[i]), "--benchmark needs existing vocabularies, {} does not exist", vocabPaths[i]);
+      vocabDims[i] = (int)vocab->load(vocabPaths[i], maxVocabs[i]);
+    } else {
+      ABORT_IF(maxVocabs[i] == 0, "--benchmark without --vocabs needs --dim-vocabs for each stream");
+      vocab->createFake();
+      vocabDims[i] = maxVocabs[i];
+    }
+    ABORT_IF(vocabDims[i] <= 2, "Vocabulary {} of --benchmark has only {} entries", i, vocabDims[i]);
+    dimVocabs_.push_back((size_t)vocabDims[i]);
+    vocabs_.push_back(vocab);
+  }
+  options_->set("dim-vocabs", vocabDims);
+  addEOS_.resize(numStreams, true);
+
+  auto lengths = options_->get<std::vector<float>>("benchmark-lengths");
+  ABORT_IF(lengths.size() != 2 && lengths.size() != 2 * numStreams,
+           "--benchmark-lengths needs a mean and a standard deviation, or a pair of them for each of the {} streams",
+           numStreams);
+  for(size_t i = 0; i < numStreams; ++i) {
+    size_t j = lengths.size() == 2 ? 0 : 2 * i;
+    lengths_.emplace_back(lengths[j], lengths[j + 1]);
+  }
+
+  LOG(info, "[data] Generating {} synthetic sentences per epoch with vocabulary sizes {}",
+      utils::withCommas(sentences_), utils::join(dimVocabs_, ", "));
+}
+
+SentenceTuple CorpusSynthetic::next() {
+  while(pos_ < sentences_) {
+    size_t curId = pos_++;
+    if(!inShard(curId))
+      continue;
+
+    SentenceTupleImpl tup(curId);
+    for(size_t i = 0; i < vocabs_.size(); ++i) {
+      float drawn = std::round(lengths_[i](eng_));
+      size_t length = (size_t)std::min(std::max(drawn, 1.f), (float)maxLength_);
+      Words words;
+      words.reserve(length);
+      while(words.size() + 1 < length) {
+        auto word = Word::fromWordIndex(eng_() % dimVocabs_[i]);
+        if(word != vocabs_[i]->getEosId() && word != vocabs_[i]->getUnkId())
+          words.push_back(word);
+      }
+      words.push_back(vocabs_[i]->getEosId());
+      tup.pushBack(words);
+    }
+    return SentenceTuple(tup);
+  }
+  return SentenceTuple();
+}
+
+void CorpusSynthetic::restore(Ptr<TrainingState> ts) {
+  setRNGState(ts->seedCorpus);
+}
+
+CorpusBase::batch_ptr CorpusSynthetic::toBatch(const std::vector<Sample>& batchVector) {
+  size_t batchSize = batchVector.size();
+
+  std::vector<size_t> sentenceIds;
+  std::vector<int> maxDims(vocabs_.size(), 0);
+  for(auto& ex : batchVector) {
+    for(size_t i = 0; i < ex.size(); ++i)
+      maxDims[i] = std::max(maxDims[i], (int)ex[i].size());
+    sentenceIds.push_back(ex.getId());
+  }
+
+  std::vector<Ptr<SubBatch>> subBatches;
+  for(size_t j = 0; j < maxDims.size(); ++j)
+    subBatches.emplace_back(New<SubBatch>(batchSize, maxDims[j], vocabs_[j]));
+
+  std::vector<size_t> words(maxDims.size(), 0);
+  for(size_t b = 0; b < batchSize; ++b) {
+    for(size_t j = 0; j < maxDims.size(); ++j) {
+      auto subBatch = subBatches[j];
+      for(size_t s = 0; s < batchVector[b][j].size(); ++s) {
+        subBatch->data()[subBatch->locate(/*batchIdx=*/b, /*wordPos=*/s)] = batchVector[b][j][s];
+        subBatch->mask()[subBatch->locate(/*batchIdx=*/b, /*wordPos=*/s)] = 1.f;
+        words[j]++;
+      }
+    }
+  }
+
+  for(size_t j = 0; j < maxDims.size(); ++j)
+    subBatches[j]->setWords(words[j]);
+
+  auto batch = batch_ptr(new batch_type(subBatches));
+  batch->setSentenceIds(sentenceIds);
+  return batch;
+}
+
+}  // namespace data
+}  // namespace marian
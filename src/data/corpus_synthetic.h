@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/options.h"
+#include "data/alignment.h"
+#include "data/batch.h"
+#include "data/corpus_base.h"
+#include "data/vocab.h"
+
+#include <random>
+#include <vector>
+
+namespace marian {
+namespace data {
+
+/**
+ * Training corpus of random word ids for measuring the training speed without reading data, see --benchmark. Every
+ * epoch has --benchmark-sentences sentence tuples whose lengths are drawn from the normal distributions of
+ * --benchmark-lengths for each stream, cut off to between 1 and --max-length tokens including the end of sentence.
+ *
+ * The vocabularies are loaded from --vocabs if they exist. Otherwise there are as many streams as --dim-vocabs, and
+ * the words are drawn from that many ids without a vocabulary behind them.
+ */
+class CorpusSynthetic : public CorpusBase {
+public:
+  CorpusSynthetic(Ptr<Options> options, size_t seed = Config::seed);
+
+  Sample next() override;
+
+  void shuffle() override { pos_ = 0; }
+
+  void reset() override { pos_ = 0; }
+
+  void restore(Ptr<TrainingState>) override;
+
+  iterator begin() override { return iterator(this); }
+
+  iterator end() override { return iterator(); }
+
+  std::vector<Ptr<Vocab>>& getVocabs() override { return vocabs_; }
+
+  batch_ptr toBatch(const std::vector<Sample>& batchVector) override;
+
+private:
+  size_t sentences_{0};
+  std::vector<size_t> dimVocabs_;
+  std::vector<std::normal_distribution<float>> lengths_; // [stream]
+};
+
+}  // namespace data
+}  // namespace marian
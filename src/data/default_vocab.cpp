@@ -6,15 +6,31 @@
 #include "common/utils.h"
 #include "common/filesystem.h"
 
+#include "3rd_party/phf/phf.h"
+#include "3rd_party/threadpool.h"
+#include "mio/mio.hpp"
+
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
 namespace marian {
 
+namespace {
+// FNV-1a of a word, its key in the perfect hash of a compiled vocabulary
+uint64_t hashWord(const std::string& word) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for(unsigned char c : word)
+    hash = (hash ^ c) * 0x100000001b3ull;
+  return hash;
+}
+}  // namespace
+
 class DefaultVocab : public IVocab {
 protected:
   typedef std::map<std::string, Word> Str2Id;
@@ -26,11 +42,39 @@ protected:
   Word eosId_ = Word::NONE;
   Word unkId_ = Word::NONE;
 
-  std::vector<std::string> suffixes_ = { ".yml", ".yaml", ".json" };
+  std::vector<std::string> suffixes_ = { ".yml", ".yaml", ".json", ".bvoc" };
 
   // Contains control characters added to vocab, possibly due to byte-fallback
   std::vector<Word> controlChars_;
 
+  // A compiled vocabulary (*.bvoc), see compile(), is memory-mapped and neither parsed nor inserted into str2id_, so
+  // that it loads immediately and its pages are shared by all processes that use it:
+  //   Header | uint64 offsets[size + 1] | uint32 g[r] | uint32 slots[m] | char strings[]
+  // The word with id i is strings[offsets[i], offsets[i + 1]). g is the displacement map of a perfect hash of the
+  // FNV-1a hashes of the words into [0, m), and slots[hash] is the id of the word with that hash, if it is one.
+  struct CompiledHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t size;
+    uint64_t eosId;
+    uint64_t unkId;
+    // the parameters of the perfect hash, see struct phf in 3rd_party/phf/phf.h
+    uint64_t seed;
+    uint64_t r;
+    uint64_t m;
+    uint64_t dMax;
+    uint64_t gOp;
+    uint64_t nodiv;
+  };
+
+  static const uint64_t COMPILED_MAGIC = 0x4241434f564e524dull; // "MRNVOCAB"
+  static const uint64_t COMPILED_VERSION = 1;
+
+  bool compiled_{false};
+  mio::mmap_source mmap_;
+  mutable phf phf_; // points into mmap_
+  const uint32_t* slots_{nullptr};
+
   class VocabFreqOrderer {
   private:
     const std::unordered_map<std::string, size_t>& counter_;
@@ -53,6 +97,10 @@ public:
   virtual const std::vector<std::string>& suffixes() const override { return suffixes_; }
 
   virtual Word operator[](const std::string& word) const override {
+    if(compiled_) {
+      WordIndex id = slots_[PHF::hash<uint64_t>(&phf_, hashWord(word))];
+      return id < id2str_.size() && id2str_[id] == word ? Word::fromWordIndex(id) : unkId_;
+    }
     auto it = str2id_.find(word);
     if(it != str2id_.end())
       return it->second;
@@ -70,6 +118,18 @@ public:
     return utils::join(tokens, " ");
   }
 
+  void decodeAppend(const Word* begin, const Word* end, std::string& out, bool ignoreEOS) const override {
+    bool first = true;
+    for(auto word = begin; word != end; ++word) {
+      if(ignoreEOS && *word == eosId_)
+        continue;
+      if(!first)
+        out += ' ';
+      out += (*this)[*word];
+      first = false;
+    }
+  }
+
   std::string surfaceForm(const Words& sentence) const override {
     return decode(sentence, /*ignoreEOS=*/true);
   }
@@ -100,6 +160,9 @@ public:
   }
 
   size_t load(const std::string& vocabPath, size_t maxSize) override {
+    if(utils::endsWith(vocabPath, ".bvoc"))
+      return loadCompiled(vocabPath, maxSize);
+
     bool isJson = regex::regex_search(vocabPath, regex::regex("\\.(json|yaml|yml)$"));
     LOG(info,
         "[data] Loading vocabulary from {} file {}",
@@ -160,6 +223,10 @@ public:
                       const std::vector<std::string>& trainPaths,
                       size_t maxSize = 0) override {
 
+    ABORT_IF(utils::endsWith(vocabPath, ".bvoc"),
+             "Compiled vocabulary {} does not exist, compile it from a vocabulary with marian-vocab --compile",
+             vocabPath);
+
     LOG(info, "[data] Creating vocabulary {} from {}",
               vocabPath,
               utils::join(trainPaths, ", "));
@@ -179,14 +246,114 @@ public:
               path.string());
     }
 
-    std::unordered_map<std::string, size_t> counter;
+    CountShards shards(COUNT_SHARDS);
     for(const auto& trainPath : trainPaths)
-      addCounts(counter, trainPath);
+      addCounts(shards, trainPath);
+
+    std::unordered_map<std::string, size_t> counter;
+    for(auto& shard : shards)
+      counter.insert(shard.counts.begin(), shard.counts.end()); // the shards hold disjoint words
     create(vocabPath, counter, maxSize);
   }
 
+  // Writes this vocabulary as a compiled vocabulary to compiledPath, see CompiledHeader
+  void compile(const std::string& compiledPath) const {
+    ABORT_IF(compiled_, "The vocabulary is already compiled");
+    std::vector<uint64_t> keys;
+    std::vector<WordIndex> ids;
+    for(const auto& pair : str2id_) {
+      keys.push_back(hashWord(pair.first));
+      ids.push_back(pair.second.toWordIndex());
+    }
+    ABORT_IF(std::unordered_set<uint64_t>(keys.begin(), keys.end()).size() != keys.size(),
+             "Two words of the vocabulary have the same hash, it cannot be compiled");
+
+    phf hash;
+    int error = PHF::init<uint64_t, true>(&hash, keys.data(), keys.size(),
+      /* bucket size */ 4,
+      /* loading factor */ 90,
+      /* seed */ 123456);
+    ABORT_IF(error != 0, "PHF error {}", error);
+
+    std::vector<uint32_t> slots(hash.m, Word::NONE.toWordIndex());
+    for(size_t i = 0; i < keys.size(); ++i)
+      slots[PHF::hash<uint64_t>(&hash, keys[i])] = ids[i];
+
+    std::vector<uint64_t> offsets = {0};
+    for(const auto& str : id2str_)
+      offsets.push_back(offsets.back() + str.size());
+
+    CompiledHeader header = {COMPILED_MAGIC, COMPILED_VERSION, id2str_.size(), eosId_.toWordIndex(),
+                             unkId_.toWordIndex(), hash.seed, hash.r, hash.m, hash.d_max, (uint64_t)hash.g_op,
+                             hash.nodiv};
+
+    io::OutputFileStream out(compiledPath);
+    out.write(&header);
+    out.write(offsets.data(), offsets.size());
+    out.write(hash.g, hash.r);
+    out.write(slots.data(), slots.size());
+    for(const auto& str : id2str_)
+      out.write(str.data(), str.size());
+    PHF::destroy(&hash);
+
+    LOG(info, "[data] Compiled vocabulary with {} entries to {}", id2str_.size(), compiledPath);
+  }
+
 private:
 
+  size_t loadCompiled(const std::string& vocabPath, size_t maxSize) {
+    LOG(info, "[data] Mapping compiled vocabulary from {}", vocabPath);
+    ABORT_IF(!filesystem::exists(vocabPath), "Compiled vocabulary file {} does not exist", vocabPath);
+
+    mmap_ = mio::mmap_source(vocabPath);
+    const char* end = mmap_.data() + mmap_.size();
+    auto header = (const CompiledHeader*)mmap_.data();
+    ABORT_IF(mmap_.size() < sizeof(CompiledHeader) || header->magic != COMPILED_MAGIC,
+             "{} is not a compiled vocabulary",
+             vocabPath);
+    ABORT_IF(header->version != COMPILED_VERSION,
+             "Compiled vocabulary {} has version {}, expected {}",
+             vocabPath,
+             header->version,
+             COMPILED_VERSION);
+
+    auto offsets = (const uint64_t*)(header + 1);
+    auto g = (const uint32_t*)(offsets + header->size + 1);
+    slots_ = g + header->r;
+    auto strings = (const char*)(slots_ + header->m);
+    ABORT_IF(strings > end || offsets[header->size] > (uint64_t)(end - strings),
+             "Compiled vocabulary {} is truncated",
+             vocabPath);
+
+    phf_ = phf();
+    phf_.nodiv = header->nodiv != 0;
+    phf_.seed = (phf_seed_t)header->seed;
+    phf_.r = header->r;
+    phf_.m = header->m;
+    phf_.g = const_cast<uint32_t*>(g); // only read
+    phf_.d_max = header->dMax;
+    phf_.g_op = (decltype(phf_.g_op))header->gOp;
+    phf_.g_jmp = nullptr;
+    // phf caches its dispatch in the struct on the first lookup, do it now so that lookups from several threads only read
+    PHF::hash<uint64_t>(&phf_, 0);
+
+    // the words themselves are needed as std::string for operator[](Word)
+    size_t size = maxSize ? std::min<size_t>(maxSize, header->size) : header->size;
+    id2str_.clear();
+    id2str_.reserve(size);
+    for(size_t i = 0; i < size; ++i)
+      id2str_.emplace_back(strings + offsets[i], offsets[i + 1] - offsets[i]);
+    ABORT_IF(id2str_.empty(), "Empty vocabulary: {}", vocabPath);
+
+    eosId_ = Word::fromWordIndex(header->eosId);
+    unkId_ = Word::fromWordIndex(header->unkId);
+    compiled_ = true;
+
+    populateControlChars();
+
+    return std::max(id2str_.size(), maxSize);
+  }
+
   // Creates the first 32 control characters as done in byte-fallback and checks if they exist in the vocab.
   // This makes sure that we do not waste computational effort on suppression if they don't actually appear.
   void populateControlChars() {
@@ -232,24 +399,64 @@ private:
     unkId_ = getRequiredWordId(DEFAULT_UNK_STR, NEMATUS_UNK_STR, Word::DEFAULT_UNK_ID);
   }
 
-  void addCounts(std::unordered_map<std::string, size_t>& counter,
-                 const std::string& trainPath) {
+  // word counts split by the hash of the word into shards that are locked separately
+  struct CountShard {
+    std::mutex mutex;
+    std::unordered_map<std::string, size_t> counts;
+  };
+  typedef std::vector<CountShard> CountShards;
+  static const size_t COUNT_SHARDS = 64;
+  static const size_t COUNT_BLOCK_LINES = 65536;
+
+  static void countLines(const std::vector<std::string>& lines, CountShards& shards) {
+    std::unordered_map<std::string, size_t> counter;
+    for(const auto& line : lines)
+      for(const std::string& tok : utils::split(line, " "))
+        counter[tok]++;
+
+    std::vector<std::vector<const std::pair<const std::string, size_t>*>> byShard(shards.size());
+    std::hash<std::string> hash;
+    for(const auto& count : counter)
+      byShard[hash(count.first) % shards.size()].push_back(&count);
+    for(size_t i = 0; i < shards.size(); ++i) {
+      if(byShard[i].empty())
+        continue;
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      for(auto count : byShard[i])
+        shards[i].counts[count->first] += count->second;
+    }
+  }
+
+  // Reads the lines on this thread and counts them in blocks on the other cores, each block into its own map that is
+  // then added to the shards
+  void addCounts(CountShards& shards, const std::string& trainPath) {
     std::unique_ptr<std::istream> trainStrm(
       trainPath == "stdin" ? new std::istream(std::cin.rdbuf())
                            : new io::InputFileStream(trainPath)
     );
 
+    size_t numThreads = std::min<size_t>(std::thread::hardware_concurrency(), 16);
+    std::unique_ptr<ThreadPool> threadPool;
+    if(numThreads > 1 && !marian::getThrowExceptionOnAbort()) // no threads when Marian is used as a library
+      threadPool.reset(new ThreadPool(numThreads - 1, /*bound=*/2 * numThreads)); // the reader is busy, too
+
+    auto lines = New<std::vector<std::string>>();
     std::string line;
+    auto count = [&]() {
+      if(threadPool)
+        threadPool->enqueue([lines, &shards]() { countLines(*lines, shards); });
+      else
+        countLines(*lines, shards);
+      lines = New<std::vector<std::string>>();
+    };
     while(getline(*trainStrm, line)) {
-      auto toks = utils::split(line, " ");
-      for(const std::string& tok : toks) {
-        auto iter = counter.find(tok);
-        if(iter == counter.end())
-          counter[tok] = 1;
-        else
-          iter->second++;
-      }
+      lines->push_back(line);
+      if(lines->size() == COUNT_BLOCK_LINES)
+        count();
     }
+    if(!lines->empty())
+      count();
+    // the pool waits for the last blocks when it goes out of scope
   }
 
   virtual void create(const std::string& vocabPath,
@@ -356,4 +563,10 @@ Ptr<IVocab> createClassVocab() {
   return New<ClassVocab>();
 }
 
+void compileDefaultVocab(const std::string& vocabPath, const std::string& compiledPath) {
+  DefaultVocab vocab;
+  vocab.load(vocabPath, 0);
+  vocab.compile(compiledPath);
+}
+
 }
@@ -196,6 +196,14 @@ namespace marian {
       numTotalFactors, factorVocabSize(), vocab_.size()/*numValid()*/, utils::withCommas(virtualVocabSize()));
   //vocab_.dumpToFile(modelPath + "_examples");
 
+  // the same information as float masks per factor group, which are used to normalize the lemma scores when decoding
+  lemmaFactorGroupMasks_.assign(groupRanges_.size(), std::vector<float>(lemmaHasFactorGroup_.size(), 0.f));
+  for (size_t lemma = 0; lemma < lemmaHasFactorGroup_.size(); lemma++) {
+    const auto& lemmaFlags = lemmaHasFactorGroup_[lemma];
+    for (size_t g = 0; g < lemmaFlags.size(); g++)
+      lemmaFactorGroupMasks_[g][lemma] = lemmaFlags[g] ? 1.f : 0.f;
+  }
+
   // enumerate all valid combinations of factors for each lemma and add them to vocab_
   // Having vocab_ makes life easier, although it is not strictly needed. Typical expanded valid vocabs
   // are on the order of 200k entries. If we ever go much larger, we'd want to elimimate vocab_
@@ -350,6 +358,19 @@ Word FactoredVocab::lemma2Word(size_t factor0Index) const {
   return factors2word(factorIndices);
 }
 
+// return a vector of 1 or 0 indicating for each lemma whether it has factor group g
+// If 'indices' (units of group 0, e.g. a shortlist) are given, then return the masks for the indices; otherwise for all lemmas
+std::vector<float> FactoredVocab::getLemmaFactorGroupMasks(size_t g, const std::vector<WordIndex>& indices) const {
+  const auto& masks = lemmaFactorGroupMasks_[g];
+  if (indices.empty())
+    return masks;
+  std::vector<float> res;
+  res.reserve(indices.size());
+  for (auto index : indices)
+    res.push_back(masks[index - groupRanges_[0].first]);
+  return res;
+}
+
 // replace a factor that is FACTOR_NOT_SPECIFIED by a specified one
 // This is used in beam search, where factors are searched one after another.
 Word FactoredVocab::expandFactoredWord(Word word, size_t groupIndex, size_t factorIndex) const {
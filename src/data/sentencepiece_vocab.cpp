@@ -11,8 +11,12 @@
 #include "common/filesystem.h"
 #include "common/regex.h"
 
-#include <sstream>
+#include <atomic>
+#include <list>
+#include <mutex>
 #include <random>
+#include <sstream>
+#include <unordered_map>
 
 namespace marian {
 
@@ -45,6 +49,70 @@ private:
   // Contains control characters added to vocab due to byte-fallback
   std::vector<Word> controlChars_;
 
+  // LRU cache of the pieces of single words, see --sentencepiece-cache. Lines are encoded concurrently with
+  // --data-threads, so it is split into shards that are locked separately.
+  struct CacheShard {
+    std::mutex mutex;
+    std::list<std::pair<std::string, std::vector<int>>> entries; // most recently used first
+    std::unordered_map<std::string, std::list<std::pair<std::string, std::vector<int>>>::iterator> index;
+  };
+  static const size_t CACHE_SHARDS = 16;
+  static const size_t CACHE_CHECKS = 100; // lines that are also encoded as a whole, to verify the cache for the model
+  size_t cacheSize_{0};                   // per shard
+  mutable std::unique_ptr<CacheShard[]> cache_;
+  mutable std::atomic<bool> useCache_{false};
+  mutable std::atomic<size_t> cacheChecks_{0};
+
+  void appendCachedPieces(const std::string& word, std::vector<int>& spmIds) const {
+    auto& shard = cache_[std::hash<std::string>()(word) % CACHE_SHARDS];
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto found = shard.index.find(word);
+      if(found != shard.index.end()) {
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+        spmIds.insert(spmIds.end(), found->second->second.begin(), found->second->second.end());
+        return;
+      }
+    }
+
+    std::vector<int> pieces;
+    spm_->Encode(word, &pieces);
+    spmIds.insert(spmIds.end(), pieces.begin(), pieces.end());
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if(shard.index.count(word) == 0) { // another thread may have added it meanwhile
+      shard.entries.emplace_front(word, std::move(pieces));
+      shard.index[word] = shard.entries.begin();
+      if(shard.index.size() > cacheSize_) {
+        shard.index.erase(shard.entries.back().first);
+        shard.entries.pop_back();
+      }
+    }
+  }
+
+  // Encodes the words between spaces separately, which gives the same pieces as the whole line if the model splits on
+  // whitespace. The first lines are compared to the encoding of the whole line, and the cache is disabled if they differ.
+  void encodeWithCache(const std::string& line, std::vector<int>& spmIds) const {
+    for(size_t pos = 0; pos < line.size();) {
+      size_t end = line.find(' ', pos);
+      if(end == std::string::npos)
+        end = line.size();
+      if(end > pos)
+        appendCachedPieces(line.substr(pos, end - pos), spmIds);
+      pos = end + 1;
+    }
+
+    if(cacheChecks_++ < CACHE_CHECKS) {
+      std::vector<int> wholeLine;
+      spm_->Encode(line, &wholeLine);
+      if(wholeLine != spmIds) {
+        LOG(warn, "[data] SentencePiece model does not encode words independently, disabling --sentencepiece-cache");
+        useCache_ = false;
+        spmIds = wholeLine;
+      }
+    }
+  }
+
   // Creates the first 32 control characters as done in byte-fallback and checks if they exist in the vocab.
   // This makes sure that we do not waste computational effort on suppression if they don't actually appear.
   void populateControlChars() {
@@ -97,7 +165,7 @@ private:
     std::shuffle(sample.begin(), sample.end(), generator_);
 
     for(const auto& line : sample)
-        temp << line << std::endl;
+        temp << line << "\n"; // flushed once before training
 
     LOG(info, "[SentencePiece] Selected {} lines", sample.size());
     return sample.size();
@@ -115,7 +183,7 @@ private:
       io::InputFileStream in(trainPath);
       while(getline(in, line)) {
         if(line.size() > 0 && line.size() < maxBytes) {
-          temp << line << std::endl;
+          temp << line << "\n"; // flushed once before training
           seenLines++;
         }
       }
@@ -132,6 +200,12 @@ public:
         generator_((uint32_t)Config::seed),
         keepEncoded_(options->get<bool>("no-spm-decode", false)),
         noEncode_(options->get<bool>("no-spm-encode", false)) {
+    size_t cacheSize = options_->get<size_t>("sentencepiece-cache", 0);
+    if(cacheSize > 0 && !noEncode_) {
+      cacheSize_ = std::max(cacheSize / CACHE_SHARDS, (size_t)1);
+      cache_.reset(new CacheShard[CACHE_SHARDS]);
+      useCache_ = true;
+    }
     if(options_->has("sentencepiece-alphas")) {
       auto alphas = options_->get<std::vector<float>>("sentencepiece-alphas");
       if(alphas.size() <= batchIndex)
@@ -182,6 +256,8 @@ public:
       seenLines = dumpAll(temp, trainPaths, maxBytes);
     else
       seenLines = reservoirSamplingAll(temp, trainPaths, maxLines, maxBytes);
+    temp.flush(); // the trainer reads the file while it is still open
+    ABORT_IF(temp.fail(), "Error writing to temporary file {}", tempFileName);
 
     // Compose the SentencePiece training command from filenames and parameters0
     std::stringstream command;
@@ -234,7 +310,9 @@ public:
       }
     } else {
       std::vector<int> spmIds;
-      if(inference || alpha_ == 0)
+      if((inference || alpha_ == 0) && useCache_)
+        encodeWithCache(line, spmIds);
+      else if(inference || alpha_ == 0)
         spm_->Encode(line, &spmIds);
       else
         spm_->SampleEncode(line, -1, alpha_, &spmIds);
@@ -269,6 +347,30 @@ public:
     return line;
   }
 
+  void decodeAppend(const Word* begin, const Word* end, std::string& out, bool ignoreEOS) const override {
+    if(keepEncoded_) {
+      bool first = true;
+      for(auto id = begin; id != end; ++id) {
+        if(ignoreEOS && *id == getEosId())
+          continue;
+        if(!first)
+          out += ' ';
+        out += (*this)[*id];
+        first = false;
+      }
+    } else {
+      // the ids and the decoded line keep their capacity across sentences of the same thread
+      thread_local std::vector<int> spmSentence;
+      thread_local std::string line;
+      spmSentence.clear();
+      for(auto id = begin; id != end; ++id)
+        if(!ignoreEOS || *id != getEosId())
+          spmSentence.push_back(id->toWordIndex());
+      spm_->Decode(spmSentence, &line);
+      out += line;
+    }
+  }
+
   std::string surfaceForm(const Words& sentence) const override {
     // with SentencePiece, decoded form and surface form are identical
     return decode(sentence, /*ignoreEOS=*/true);
@@ -2,7 +2,10 @@
 #include "microsoft/shortlist/utils/ParameterTree.h"
 #include "marian.h"
 #include "layers/lsh.h"
+#include "data/factored_vocab.h"
 
+#include <bitset>
+#include <numeric>
 #include <queue>
 
 namespace marian {
@@ -36,7 +39,7 @@ WordIndex Shortlist::tryForwardMap(WordIndex wIdx, int /*batchIdx*/) const {
   }
 }
 
-void Shortlist::filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt) {
+void Shortlist::filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt, bool cacheTensors) {
   if (initialized_) {
     return;
   }
@@ -49,10 +52,25 @@ void Shortlist::filter(Expr input, Expr weights, bool isLegacyUntransposedW, Exp
   Shape kShape({k});
   indicesExpr_ = lambda({input, weights}, kShape, Type::uint32, forward);
 
-  createCachedTensors(weights, isLegacyUntransposedW, b, lemmaEt);
+  if(cacheTensors)
+    createCachedTensors(weights, isLegacyUntransposedW, b, lemmaEt);
   initialized_ = true;
 }
 
+Expr Shortlist::getCompactEmbeddings(Expr E) {
+  if(isDynamic() || !indicesExpr_)
+    return nullptr;
+  if(cachedShortWt_ && cachedWeights_ == E)
+    return reshape(cachedShortWt_, {cachedShortWt_->shape()[-2], cachedShortWt_->shape()[-1]});
+  if(!cachedCompactEmb_)
+    cachedCompactEmb_ = index_select(E, 0, indicesExpr_);
+  return cachedCompactEmb_;
+}
+
+Tensor Shortlist::getIndicesTensor() const {
+  return indicesExpr_ ? indicesExpr_->val() : nullptr;
+}
+
 Expr Shortlist::getIndicesExpr() const {
   int k = indicesExpr_->shape()[0];
   Expr out = reshape(indicesExpr_, {1, 1, k});
@@ -66,6 +84,7 @@ void Shortlist::createCachedTensors(Expr weights,
   ABORT_IF(isLegacyUntransposedW, "Legacy untranspose W not yet tested");
   cachedShortWt_ = index_select(weights, isLegacyUntransposedW ? -1 : 0, indicesExpr_);
   cachedShortWt_ = reshape(cachedShortWt_, {1, 1, cachedShortWt_->shape()[0], cachedShortWt_->shape()[1]});
+  cachedWeights_ = weights;
 
   if (b) {
     cachedShortb_ = index_select(b, -1, indicesExpr_);
@@ -80,16 +99,78 @@ void Shortlist::createCachedTensors(Expr weights,
 
 ///////////////////////////////////////////////////////////////////////////////////
 
+SampledShortlistGenerator::SampledShortlistGenerator(Ptr<Options> options, size_t trgIdx, size_t trgVocabSize)
+    : trgIdx_(trgIdx),
+      total_(options->get<size_t>("sampled-softmax")),
+      trgVocabSize_(trgVocabSize),
+      until_(SchedulingParameter::parse(options->get<std::string>("sampled-softmax-until", "0"))),
+      gen_((unsigned int)Config::seed) {}
+
+Ptr<Shortlist> SampledShortlistGenerator::generate(Ptr<data::CorpusBatch> batch) const {
+  if(!sampling_)
+    return nullptr;
+
+  const Words& targets = (*batch)[trgIdx_]->data();
+  std::vector<bool> selected(trgVocabSize_, false), isTarget(trgVocabSize_, false);
+  std::vector<WordIndex> indices;
+  for(auto word : targets) {
+    auto w = word.toWordIndex();
+    if(!selected[w]) {
+      selected[w] = isTarget[w] = true;
+      indices.push_back(w);
+    }
+  }
+
+  // log-uniform P(w) = log((w + 2) / (w + 1)) / log(V + 1), drawn as floor((V + 1)^u) - 1 for u in [0, 1). The
+  // draws are bounded for candidate sets close to the vocabulary size, which would wait for the rarest words.
+  double logRange = std::log((double)trgVocabSize_ + 1);
+  std::uniform_real_distribution<double> uniform(0., 1.);
+  size_t total = std::min(total_, trgVocabSize_);
+  size_t draws = 0;
+  for(; indices.size() < total && draws < 64 * total; ++draws) {
+    auto w = (WordIndex)std::min(std::floor(std::exp(uniform(gen_) * logRange)) - 1., (double)trgVocabSize_ - 1);
+    if(!selected[w]) {
+      selected[w] = true;
+      indices.push_back(w);
+    }
+  }
+  std::sort(indices.begin(), indices.end());
+
+  // a sampled word is selected with probability 1 - (1 - P(w))^draws, the targets always are
+  std::vector<float> logCorrections(indices.size(), 0.f);
+  for(size_t i = 0; i < indices.size(); ++i) {
+    if(isTarget[indices[i]])
+      continue;
+    double p = std::log1p(1. / (indices[i] + 1.)) / logRange;
+    logCorrections[i] = (float)-std::log(-std::expm1(draws * std::log1p(-p)));
+  }
+
+  Words mapped;
+  mapped.reserve(targets.size());
+  for(auto word : targets) {
+    auto pos = std::lower_bound(indices.begin(), indices.end(), word.toWordIndex()) - indices.begin();
+    mapped.push_back(Word::fromWordIndex(pos));
+  }
+
+  return New<SampledShortlist>(indices, mapped, logCorrections);
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+
 LSHShortlist::LSHShortlist(int k, int nbits, size_t lemmaSize, bool abortIfDynamic)
 : Shortlist(std::vector<WordIndex>()),
   k_(k), nbits_(nbits), lemmaSize_(lemmaSize), abortIfDynamic_(abortIfDynamic) {
 }
 
 WordIndex LSHShortlist::reverseMap(int beamIdx, int batchIdx, int idx) const {
+  if(!hostIndicesValid_) { // beam search maps its n-best lists with getIndicesTensor() instead
+    indicesExpr_->val()->get(hostIndices_);
+    hostIndicesValid_ = true;
+  }
   int currBatchSize = indicesExpr_->shape()[1];
   idx = (k_ * currBatchSize * beamIdx) + (k_ * batchIdx) + idx;
-  assert(idx < indices_.size());
-  return indices_[idx];
+  assert(idx < hostIndices_.size());
+  return hostIndices_[idx];
 }
 
 Expr LSHShortlist::getIndicesExpr() const {
@@ -105,7 +186,7 @@ void LSHShortlist::setForcedIndices(Expr forcedIndices) {
   }
 }
 
-void LSHShortlist::filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt) {
+void LSHShortlist::filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt, bool cacheTensors) {
   auto topk = lsh::search(input, weights, k_, nbits_, (int)lemmaSize_, abortIfDynamic_); // [beam, batch, k]
   indicesExpr_ = callback(topk,
                           [this](Expr node) {
@@ -128,14 +209,15 @@ void LSHShortlist::filter(Expr input, Expr weights, bool isLegacyUntransposedW,
                               // we will correctly overwrite the indices used for reverse mapping in the next call back
                               setForcedIndices(nullptr);
                             }
-                            node->val()->get(indices_); // set the value of the field indices_ whenever the graph traverses this node
+                            hostIndicesValid_ = false; // new indices whenever the graph traverses this node
                           });
 
-  createCachedTensors(weights, isLegacyUntransposedW, b, lemmaEt);
+  if(cacheTensors)
+    createCachedTensors(weights, isLegacyUntransposedW, b, lemmaEt);
 }
 
 WordIndex LSHShortlist::tryForwardMap(WordIndex wIdx, int batchIdx) const {
-  if(!indicesExpr_ || indices_.empty())
+  if(!indicesExpr_ || !indicesExpr_->val()) // not computed yet
     return npos;
 
   int dimBatch = indicesExpr_->shape()[-2];
@@ -197,6 +279,128 @@ Ptr<Shortlist> LSHShortlistGenerator::generate(Ptr<data::CorpusBatch> batch) con
   return New<LSHShortlist>(k_, nbits_, lemmaSize_, abortIfDynamic_);
 }
 
+///////////////////////////////////////////////////////////////////////////////////
+
+SentenceShortlist::SentenceShortlist(const std::vector<std::vector<WordIndex>>& rows, WordIndex commonPrefix)
+  : Shortlist(std::vector<WordIndex>()), rows_(rows), activeRows_(rows.size()), commonPrefix_(commonPrefix) {
+  std::iota(activeRows_.begin(), activeRows_.end(), 0);
+}
+
+WordIndex SentenceShortlist::reverseMap(int /*beamIdx*/, int batchIdx, int idx) const {
+  return rows_[activeRows_[batchIdx]][idx];
+}
+
+WordIndex SentenceShortlist::tryForwardMap(WordIndex wIdx, int batchIdx) const {
+  if(wIdx < commonPrefix_)
+    return wIdx;
+  const auto& row = rows_[activeRows_[batchIdx]];
+  auto first = std::lower_bound(row.begin(), row.end(), wIdx);
+  if(first != row.end() && *first == wIdx)
+    return (WordIndex)std::distance(row.begin(), first);
+  return npos;
+}
+
+void SentenceShortlist::select(const std::vector<IndexType>& batchIndices) {
+  if(batchIndices.size() == activeRows_.size()) // nothing has been dropped, the order never changes
+    return;
+  std::vector<IndexType> activeRows;
+  for(auto batchIdx : batchIndices)
+    activeRows.push_back(activeRows_[batchIdx]);
+  activeRows_ = activeRows;
+  changed_ = true;
+}
+
+void SentenceShortlist::filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt, bool cacheTensors) {
+  if(!changed_) // same rows as in the previous step
+    return;
+
+  int dimBatch = (int)activeRows_.size();
+  int k = (int)rows_.front().size();
+  std::vector<WordIndex> indices;
+  indices.reserve(dimBatch * k);
+  for(auto row : activeRows_)
+    indices.insert(indices.end(), rows_[row].begin(), rows_[row].end());
+
+  auto forward = [indices](Expr out, const std::vector<Expr>& ) {
+    out->val()->set(indices);
+  };
+  indicesExpr_ = lambda({input, weights}, Shape({1, dimBatch, k}), Type::uint32, forward);
+
+  if(cacheTensors)
+    createCachedTensors(weights, isLegacyUntransposedW, b, lemmaEt);
+  changed_ = false;
+}
+
+void SentenceShortlist::createCachedTensors(Expr weights,
+                                            bool isLegacyUntransposedW,
+                                            Expr b,
+                                            Expr lemmaEt) {
+  ABORT_IF(isLegacyUntransposedW, "Legacy untranspose W not yet tested");
+  ABORT_IF(lemmaEt, "Per-sentence shortlists do not support factored vocabularies");
+  int dimBatch = indicesExpr_->shape()[1];
+  int k = indicesExpr_->shape()[-1];
+  Expr indicesExprFlatten = reshape(indicesExpr_, {indicesExpr_->shape().elements()});
+
+  cachedShortWt_ = index_select(weights, 0, indicesExprFlatten);
+  cachedShortWt_ = reshape(cachedShortWt_, {1, dimBatch, k, cachedShortWt_->shape()[1]});
+
+  if(b) {
+    cachedShortb_ = index_select(b, -1, indicesExprFlatten);
+    cachedShortb_ = reshape(cachedShortb_, {1, dimBatch, 1, k}); // broadcasts over the beam
+  }
+}
+
+Ptr<Shortlist> createSentenceShortlist(Ptr<SubBatch> srcBatch,
+                                       Ptr<const Vocab> trgVocab,
+                                       Ptr<const Options> options,
+                                       size_t firstNum,
+                                       bool shared,
+                                       const uint64_t* offsets,
+                                       size_t numOffsets,
+                                       const WordIndex* lists) {
+  ABORT_IF(trgVocab->tryAs<FactoredVocab>(), "Per-sentence shortlists do not support factored vocabularies");
+  size_t trgVocabSize = trgVocab->size();
+  size_t dimBatch = srcBatch->batchSize();
+  size_t width = srcBatch->batchWidth();
+
+  std::vector<WordIndex> suppressed = trgVocab->suppressedIndices(!options->get<bool>("allow-unk", false),
+                                                                  !options->get<bool>("allow-special", false));
+  auto isSuppressed = [&](WordIndex i) {
+    return i >= firstNum && std::find(suppressed.begin(), suppressed.end(), i) != suppressed.end();
+  };
+
+  std::vector<std::vector<WordIndex>> rows(dimBatch);
+  size_t k = 0;
+  Words words;
+  for(size_t b = 0; b < dimBatch; ++b) {
+    words.clear();
+    for(size_t t = 0; t < width; ++t) // time-major, includes padding which is </s>
+      words.push_back(srcBatch->data()[t * dimBatch + b]);
+    rows[b] = selectShortlistIndices(words, trgVocabSize, firstNum, shared, offsets, numOffsets, lists);
+    rows[b].erase(std::remove_if(rows[b].begin(), rows[b].end(), isSuppressed), rows[b].end());
+    k = std::max(k, rows[b].size());
+  }
+  k = (k + 7) / 8 * 8; // multiple-of-eight for intgemm
+
+  // pad all rows to k with the most frequent words that are not selected yet
+  for(auto& row : rows) {
+    std::vector<WordIndex> padding;
+    auto it = row.begin();
+    for(WordIndex i = (WordIndex)firstNum; i < trgVocabSize && row.size() + padding.size() < k; ++i) {
+      while(it != row.end() && *it < i)
+        ++it;
+      if((it == row.end() || *it != i) && !isSuppressed(i))
+        padding.push_back(i);
+    }
+    row.insert(row.end(), padding.begin(), padding.end());
+    std::sort(row.begin(), row.end());
+    while(row.size() < k) // tiny vocabularies only
+      row.push_back(row.back());
+  }
+
+  return New<SentenceShortlist>(rows, (WordIndex)std::min(firstNum, trgVocabSize));
+}
+
 //////////////////////////////////////////////////////////////////////////////////////
 QuicksandShortlistGenerator::QuicksandShortlistGenerator(Ptr<Options> options,
                                                          Ptr<const Vocab> srcVocab,
@@ -335,21 +539,72 @@ Ptr<ShortlistGenerator> createShortlistGenerator(Ptr<Options> options,
     std::vector<std::string> vals = options->get<std::vector<std::string>>("shortlist");
     ABORT_IF(vals.empty(), "No path to shortlist given");
     std::string fname = vals[0];
+
+    Ptr<ShortlistGenerator> generator;
     if(isBinaryShortlist(fname)){
-        return New<BinaryShortlistGenerator>(options, srcVocab, trgVocab, srcIdx, trgIdx, shared);
+        generator = New<BinaryShortlistGenerator>(options, srcVocab, trgVocab, srcIdx, trgIdx, shared);
     } else if(filesystem::Path(fname).extension().string() == ".bin") {
-      return New<QuicksandShortlistGenerator>(options, srcVocab, trgVocab, srcIdx, trgIdx, shared);
+      generator = New<QuicksandShortlistGenerator>(options, srcVocab, trgVocab, srcIdx, trgIdx, shared);
     } else {
-      return New<LexicalShortlistGenerator>(options, srcVocab, trgVocab, srcIdx, trgIdx, shared);
+      generator = New<LexicalShortlistGenerator>(options, srcVocab, trgVocab, srcIdx, trgIdx, shared);
     }
+
+    size_t maxAge = options->get<size_t>("shortlist-sticky", 0);
+    if(maxAge > 0) {
+      ABORT_IF(options->get<bool>("shortlist-per-sentence", false),
+               "--shortlist-sticky cannot be combined with --shortlist-per-sentence");
+      LOG(info, "[data] Keeping shortlist candidates for {} batches", maxAge);
+      generator = New<StickyShortlistGenerator>(generator, trgVocab->size(), maxAge);
+    }
+    return generator;
   }
 }
 
+Ptr<Shortlist> StickyShortlistGenerator::generate(Ptr<data::CorpusBatch> batch) const {
+  auto shortlist = generator_->generate(batch);
+  ABORT_IF(shortlist->isDynamic(), "Sticky shortlists need one shortlist per batch");
+
+  Stream* stream;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stream = &streams_[std::this_thread::get_id()]; // references stay valid when the map grows
+  }
+  if(stream->lastSelected.empty())
+    stream->lastSelected.resize(trgVocabSize_, 0);
+  size_t batchNum = ++stream->numBatches;
+
+  const auto& selected = shortlist->indices();
+  for(auto word : selected)
+    stream->lastSelected[word] = batchNum;
+
+  // candidates of this batch and the recently selected ones of the previous batch, padding is not carried over
+  std::vector<WordIndex> merged;
+  std::set_union(stream->indices.begin(), stream->indices.end(), selected.begin(), selected.end(),
+                 std::back_inserter(merged));
+  std::vector<WordIndex> indices;
+  indices.reserve(merged.size());
+  for(auto word : merged)
+    if(stream->lastSelected[word] > 0 && batchNum - stream->lastSelected[word] < maxAge_)
+      indices.push_back(word);
+
+  // pad to a multiple of eight with the most frequent words that are missing, see selectShortlistIndices()
+  std::vector<WordIndex> padding;
+  for(WordIndex word = 0; word < trgVocabSize_ && (indices.size() + padding.size()) % 8 != 0; ++word)
+    if(!std::binary_search(indices.begin(), indices.end(), word))
+      padding.push_back(word);
+  size_t numUnpadded = indices.size();
+  indices.insert(indices.end(), padding.begin(), padding.end());
+  std::inplace_merge(indices.begin(), indices.begin() + numUnpadded, indices.end());
+
+  stream->indices = indices;
+  return New<Shortlist>(indices);
+}
+
 bool isBinaryShortlist(const std::string& fileName){
   uint64_t magic;
   io::InputFileStream in(fileName);
   in.read((char*)(&magic), sizeof(magic));
-  return in && (magic == BINARY_SHORTLIST_MAGIC);
+  return in && (magic == BINARY_SHORTLIST_MAGIC || magic == BINARY_SHORTLIST_MAGIC_V2);
 }
 
 void BinaryShortlistGenerator::contentCheck() {
@@ -374,15 +629,30 @@ void BinaryShortlistGenerator::load(const void* ptr_void, size_t blobSize, bool
    * header
    * wordToOffset array
    * shortLists array
+   * with HeaderV2 the arrays start at the offsets given in the header, see HeaderV2
    */
   ABORT_IF(blobSize < sizeof(Header), "Shortlist length {} too short to have a header", blobSize);
 
   const char *ptr = static_cast<const char*>(ptr_void);
   const Header &header = *reinterpret_cast<const Header*>(ptr);
-  ptr += sizeof(Header);
-  ABORT_IF(header.magic != BINARY_SHORTLIST_MAGIC, "Incorrect magic in binary shortlist");
-
-  uint64_t expectedSize = sizeof(Header) + header.wordToOffsetSize * sizeof(uint64_t) + header.shortListsSize * sizeof(WordIndex);
+  ABORT_IF(header.magic != BINARY_SHORTLIST_MAGIC && header.magic != BINARY_SHORTLIST_MAGIC_V2,
+           "Incorrect magic in binary shortlist");
+
+  uint64_t wordToOffsetBegin = sizeof(Header);
+  uint64_t shortListsBegin = sizeof(Header) + header.wordToOffsetSize * sizeof(uint64_t);
+  uint64_t expectedSize = shortListsBegin + header.shortListsSize * sizeof(WordIndex);
+  if(header.magic == BINARY_SHORTLIST_MAGIC_V2) {
+    ABORT_IF(blobSize < sizeof(HeaderV2), "Shortlist length {} too short to have a header", blobSize);
+    const HeaderV2 &headerV2 = *reinterpret_cast<const HeaderV2*>(ptr);
+    wordToOffsetBegin = headerV2.wordToOffsetBegin;
+    shortListsBegin = headerV2.shortListsBegin;
+    ABORT_IF(wordToOffsetBegin < sizeof(HeaderV2) || wordToOffsetBegin % sizeof(uint64_t) != 0
+             || shortListsBegin < wordToOffsetBegin + header.wordToOffsetSize * sizeof(uint64_t)
+             || shortListsBegin % sizeof(WordIndex) != 0,
+             "Shortlist header contains invalid array offsets");
+    expectedSize = shortListsBegin + header.shortListsSize * sizeof(WordIndex);
+    expectedSize = (expectedSize + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t); // padded
+  }
   ABORT_IF(expectedSize != blobSize, "Shortlist header claims file size should be {} but file is {}", expectedSize, blobSize);
 
   if (check) {
@@ -397,11 +667,8 @@ void BinaryShortlistGenerator::load(const void* ptr_void, size_t blobSize, bool
   wordToOffsetSize_ = header.wordToOffsetSize;
   shortListsSize_ = header.shortListsSize;
 
-  // Offsets right after header.
-  wordToOffset_ = reinterpret_cast<const uint64_t*>(ptr);
-  ptr += wordToOffsetSize_ * sizeof(uint64_t);
-
-  shortLists_ = reinterpret_cast<const WordIndex*>(ptr);
+  wordToOffset_ = reinterpret_cast<const uint64_t*>(ptr + wordToOffsetBegin);
+  shortLists_ = reinterpret_cast<const WordIndex*>(ptr + shortListsBegin);
 
   // Verify offsets and vocab ids are within bounds if requested by user.
   if(check)
@@ -462,62 +729,74 @@ BinaryShortlistGenerator::BinaryShortlistGenerator(const void *ptr_void,
   load(ptr_void, blobSize, check);
 }
 
-Ptr<Shortlist> BinaryShortlistGenerator::generate(Ptr<data::CorpusBatch> batch) const {
-  auto srcBatch = (*batch)[srcIdx_];
-  size_t srcVocabSize = srcVocab_->size();
-  size_t trgVocabSize = trgVocab_->size();
-
-  // Since V=trgVocab_->size() is not large, anchor the time and space complexity to O(V).
-  // Attempt to squeeze the truth tables into CPU cache
-  std::vector<bool> srcTruthTable(srcVocabSize, 0);  // holds selected source words
-  std::vector<bool> trgTruthTable(trgVocabSize, 0);  // holds selected target words
+std::vector<WordIndex> selectShortlistIndices(const Words& srcWords,
+                                              size_t trgVocabSize,
+                                              size_t firstNum,
+                                              bool shared,
+                                              const uint64_t* offsets,
+                                              size_t numOffsets,
+                                              const WordIndex* lists) {
+  // Since V=trgVocabSize is not large, anchor the time and space complexity to O(V) with one bit
+  // per word. All passes over the bitsets work on 64 words at a time.
+  thread_local std::vector<uint64_t> trgBits; // selected target words
+  thread_local std::vector<uint64_t> srcBits; // source words whose targets have been added already
+  const size_t numSrcWords = numOffsets > 0 ? numOffsets - 1 : 0;
+  trgBits.assign((trgVocabSize + 63) / 64, 0); // keeps the capacity of previous batches
+  srcBits.assign((numSrcWords + 63) / 64, 0);
+
+  auto test = [](const std::vector<uint64_t>& bits, size_t i) { return (bits[i / 64] >> (i % 64)) & 1; };
+  auto set = [](std::vector<uint64_t>& bits, size_t i) { bits[i / 64] |= (uint64_t)1 << (i % 64); };
 
   // add firstNum most frequent words
-  for(WordIndex i = 0; i < firstNum_ && i < trgVocabSize; ++i)
-    trgTruthTable[i] = 1;
+  size_t first = std::min(firstNum, trgVocabSize);
+  std::fill(trgBits.begin(), trgBits.begin() + first / 64, ~(uint64_t)0);
+  for(size_t i = first / 64 * 64; i < first; ++i)
+    set(trgBits, i);
 
-  // collect unique words from source
-  // add aligned target words: mark trgTruthTable[word] to 1
-  for(auto word : srcBatch->data()) {
+  // add the aligned target words of every distinct source word
+  for(auto word : srcWords) {
     WordIndex srcIndex = word.toWordIndex();
-    if(shared_)
-      trgTruthTable[srcIndex] = 1;
-    // If srcIndex has not been encountered, add the corresponding target words
-    if (!srcTruthTable[srcIndex]) {
-      for (uint64_t j = wordToOffset_[srcIndex]; j < wordToOffset_[srcIndex+1]; j++)
-        trgTruthTable[shortLists_[j]] = 1;
-      srcTruthTable[srcIndex] = 1;
-    }
+    if(shared && srcIndex < trgVocabSize)
+      set(trgBits, srcIndex);
+    if(srcIndex >= numSrcWords || test(srcBits, srcIndex)) // unknown to the lexicon or seen already
+      continue;
+    set(srcBits, srcIndex);
+    for(uint64_t j = offsets[srcIndex]; j < offsets[srcIndex + 1]; ++j)
+      set(trgBits, lists[j]);
   }
 
-  // Due to the 'multiple-of-eight' issue, the following O(N) patch is inserted
-  size_t trgTruthTableOnes = 0;   // counter for no. of selected target words
-  for (size_t i = 0; i < trgVocabSize; i++) {
-    if(trgTruthTable[i])
-      trgTruthTableOnes++;
-  }
+  size_t numSelected = 0;
+  for(auto bits : trgBits)
+    numSelected += std::bitset<64>(bits).count();
 
   // Ensure that the generated vocabulary items from a shortlist are a multiple-of-eight
   // This is necessary until intgemm supports non-multiple-of-eight matrices.
-  for (size_t i = firstNum_; i < trgVocabSize && trgTruthTableOnes%8!=0; i++){
-    if (!trgTruthTable[i]){
-      trgTruthTable[i] = 1;
-      trgTruthTableOnes++;
+  for(size_t i = firstNum; i < trgVocabSize && numSelected % 8 != 0; ++i) {
+    if(!test(trgBits, i)) {
+      set(trgBits, i);
+      numSelected++;
     }
   }
 
-  // turn selected indices into vector and sort (Bucket sort: O(V))
+  // selected indices in increasing order, skipping over empty 64-word blocks
   std::vector<WordIndex> indices;
-  for (WordIndex i = 0; i < trgVocabSize; i++) {
-    if(trgTruthTable[i])
-      indices.push_back(i);
-  }
+  indices.reserve(numSelected);
+  for(size_t block = 0; block < trgBits.size(); ++block)
+    for(uint64_t bits = trgBits[block]; bits != 0; bits &= bits - 1) // clear the lowest set bit
+      indices.push_back((WordIndex)(block * 64 + std::bitset<64>((bits & (~bits + 1)) - 1).count()));
+  return indices;
+}
 
-  return New<Shortlist>(indices);
+Ptr<Shortlist> BinaryShortlistGenerator::generate(Ptr<data::CorpusBatch> batch) const {
+  auto srcBatch = (*batch)[srcIdx_];
+  if(options_ && options_->get<bool>("shortlist-per-sentence", false)) // no options when constructed from a buffer
+    return createSentenceShortlist(srcBatch, trgVocab_, options_, firstNum_, shared_,
+                                   wordToOffset_, wordToOffsetSize_, shortLists_);
+  return New<Shortlist>(selectShortlistIndices(srcBatch->data(), trgVocab_->size(), firstNum_, shared_,
+                                               wordToOffset_, wordToOffsetSize_, shortLists_));
 }
 
 void BinaryShortlistGenerator::dump(const std::string& fileName) const {
-  ABORT_IF(mmapMem_.is_open(),"No need to dump again");
   LOG(info, "[data] Saving binary shortlist dump to {}", fileName);
   saveBlobToFile(fileName);
 }
@@ -594,9 +873,35 @@ void BinaryShortlistGenerator::import(const std::string& filename, double thresh
   shortLists_ = shortLists;
 }
 
+std::vector<char> BinaryShortlistGenerator::serialize() const {
+  auto align = [](uint64_t bytes) {
+    return (bytes + BINARY_SHORTLIST_ALIGNMENT - 1) / BINARY_SHORTLIST_ALIGNMENT * BINARY_SHORTLIST_ALIGNMENT;
+  };
+  uint64_t wordToOffsetBegin = align(sizeof(HeaderV2));
+  uint64_t shortListsBegin = align(wordToOffsetBegin + wordToOffsetSize_ * sizeof(uint64_t));
+  uint64_t size = shortListsBegin + shortListsSize_ * sizeof(WordIndex);
+  std::vector<char> blob((size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t), 0); // zero padding
+
+  HeaderV2* pHeader = (HeaderV2*)blob.data();
+  pHeader->magic = BINARY_SHORTLIST_MAGIC_V2;
+  pHeader->firstNum = firstNum_;
+  pHeader->bestNum = bestNum_;
+  pHeader->wordToOffsetSize = wordToOffsetSize_;
+  pHeader->shortListsSize = shortListsSize_;
+  pHeader->wordToOffsetBegin = wordToOffsetBegin;
+  pHeader->shortListsBegin = shortListsBegin;
+  std::copy(wordToOffset_, wordToOffset_ + wordToOffsetSize_, (uint64_t*)(blob.data() + wordToOffsetBegin));
+  std::copy(shortLists_, shortLists_ + shortListsSize_, (WordIndex*)(blob.data() + shortListsBegin));
+  pHeader->checksum = (uint64_t)util::hashMem<uint64_t>((uint64_t *)blob.data()+2,
+                                                        blob.size()/sizeof(uint64_t)-2);
+  return blob;
+}
+
 void BinaryShortlistGenerator::saveBlobToFile(const std::string& fileName) const {
+  // imported text shortlists and loaded binary shortlists of either layout are written as HeaderV2
+  auto blob = serialize();
   io::OutputFileStream outTop(fileName);
-  outTop.write(blob_.data(), blob_.size());
+  outTop.write(blob.data(), blob.size());
 }
 
 }  // namespace data
@@ -5,9 +5,13 @@
 #include "common/file_stream.h"
 #include "data/corpus_base.h"
 #include "data/types.h"
+#include "training/training_state.h"
 #include "mio/mio.hpp"
 
+#include <atomic>
+#include <mutex>
 #include <random>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -31,6 +35,8 @@ protected:
   Expr cachedShortWt_;  // short-listed version, cached (cleared by clear())
   Expr cachedShortb_;   // these match the current value of shortlist_
   Expr cachedShortLemmaEt_;
+  Expr cachedWeights_;    // the output weights cachedShortWt_ was gathered from
+  Expr cachedCompactEmb_; // short-listed rows of an embedding matrix other than cachedWeights_
   bool initialized_; // used by batch-level shortlist. Only initialize with 1st call then skip all subsequent calls for same batch
 
   void createCachedTensors(Expr weights,
@@ -47,11 +53,24 @@ public:
   virtual WordIndex reverseMap(int beamIdx, int batchIdx, int idx) const;
   virtual WordIndex tryForwardMap(WordIndex wIdx, int batchIdx=0) const;
 
-  virtual void filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt);
+  // selects the indices for the next step, and gathers the short-listed weights unless cacheTensors is false,
+  // e.g. if the output layer reads the selected rows directly, see logsoftmax_shortlist()
+  virtual void filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt, bool cacheTensors = true);
   virtual Expr getIndicesExpr() const;
   virtual Expr getCachedShortWt() const { return cachedShortWt_; }
   virtual Expr getCachedShortb() const { return cachedShortb_; }
   virtual Expr getCachedShortLemmaEt() const { return cachedShortLemmaEt_; }
+  // [k, dim] rows of the embedding matrix E for the short-listed words, gathered once per batch, so that the decoder
+  // input embeddings are looked up by tryForwardMap() in this compact copy. If the output layer is tied to E, these
+  // are its short-listed weights. Returns nullptr before filter() and for dynamic shortlists
+  virtual Expr getCompactEmbeddings(Expr E);
+  const std::vector<WordIndex>& indices() const { return indices_; } // not up to date on the host if isDynamic()
+  // the indices of the current step where the graph has computed them, [beam or 1, batch or 1, k] elements,
+  // so that n-best lists can be mapped back to words without copying the indices to the host
+  virtual Tensor getIndicesTensor() const;
+
+  // called with the entries of the previous step's batch [batchIdx] that are decoded in the next step
+  virtual void select(const std::vector<IndexType>& /*batchIndices*/) {}
 };
 
 class ShortlistGenerator {
@@ -76,6 +95,8 @@ private:
   int nbits_; // length of hash
   size_t lemmaSize_; // vocab size
   bool abortIfDynamic_; // if true disallow dynamic allocation for encoded weights and rotation matrix (only allow use of pre-allocated parameters)
+  mutable std::vector<WordIndex> hostIndices_; // [beam, batch, k] indices of the last step, only copied to the host by reverseMap() on demand
+  mutable bool hostIndicesValid_{false};
 
   static Ptr<faiss::IndexLSH> index_; // LSH index to store all possible candidates
   static std::mutex mutex_;
@@ -92,7 +113,7 @@ public:
   virtual bool isDynamic() const override { return true; }
   virtual WordIndex reverseMap(int beamIdx, int batchIdx, int idx) const override;
 
-  virtual void filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt) override;
+  virtual void filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt, bool cacheTensors = true) override;
   virtual Expr getIndicesExpr() const override;
   virtual void setForcedIndices(Expr forcedIndices);
 
@@ -112,82 +133,105 @@ public:
 };
 
 ///////////////////////////////////////////////////////////////////////////////////
-
-// Intended for use during training in the future, currently disabled
-#if 0
-class SampledShortlistGenerator : public ShortlistGenerator {
+// Lexical shortlist with its own candidates for every sentence of the batch, see --shortlist-per-sentence.
+// Each row is padded to the same length k, the output layer then gathers [batch, k] rows of the output
+// matrix and multiplies them with a batched GEMM, so that the cost per sentence stays flat as the batch
+// grows. The firstNum most frequent words are at the same positions 0..firstNum-1 in all rows.
+class SentenceShortlist : public Shortlist {
 private:
-  Ptr<Options> options_;
-  size_t maxVocab_{50000};
+  std::vector<std::vector<WordIndex>> rows_; // [origBatchIdx] -> sorted word indices, all of length k
+  std::vector<IndexType> activeRows_;        // [current batchIdx] -> origBatchIdx
+  WordIndex commonPrefix_;                   // words below are at the same position in all rows
+  bool changed_{true};
 
-  size_t total_{10000};
-  size_t firstNum_{1000};
+  void createCachedTensors(Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt);
 
-  size_t srcIdx_;
-  size_t trgIdx_;
-  bool shared_{false};
+public:
+  SentenceShortlist(const std::vector<std::vector<WordIndex>>& rows, WordIndex commonPrefix);
 
-  // static thread_local std::random_device rd_;
-  static thread_local std::unique_ptr<std::mt19937> gen_;
+  virtual bool isDynamic() const override { return true; }
+  virtual WordIndex reverseMap(int beamIdx, int batchIdx, int idx) const override;
+  // rows may differ beyond the common prefix, other words are only found in the row of batchIdx
+  virtual WordIndex tryForwardMap(WordIndex wIdx, int batchIdx=0) const override;
 
-public:
-  SampledShortlistGenerator(Ptr<Options> options,
-                            size_t srcIdx = 0,
-                            size_t trgIdx = 1,
-                            bool shared = false)
-      : options_(options),
-        srcIdx_(srcIdx),
-        trgIdx_(trgIdx),
-        shared_(shared)
-        { }
+  virtual void filter(Expr input, Expr weights, bool isLegacyUntransposedW, Expr b, Expr lemmaEt, bool cacheTensors = true) override;
+  virtual Expr getIndicesExpr() const override { return indicesExpr_; } // [1, batch, k]
+  virtual void select(const std::vector<IndexType>& batchIndices) override;
+};
 
-  virtual Ptr<Shortlist> generate(Ptr<data::CorpusBatch> batch) const override {
-    auto srcBatch = (*batch)[srcIdx_];
-    auto trgBatch = (*batch)[trgIdx_];
-
-    // add firstNum most frequent words
-    std::unordered_set<WordIndex> indexSet;
-    for(WordIndex i = 0; i < firstNum_ && i < maxVocab_; ++i)
-      indexSet.insert(i);
-
-    // add all words from ground truth
-    for(auto i : trgBatch->data())
-      indexSet.insert(i.toWordIndex());
-
-    // add all words from source
-    if(shared_)
-      for(auto i : srcBatch->data())
-        indexSet.insert(i.toWordIndex());
-
-    std::uniform_int_distribution<> dis((int)firstNum_, (int)maxVocab_);
-    if (gen_ == NULL)
-      gen_.reset(new std::mt19937(std::random_device{}()));
-    while(indexSet.size() < total_ && indexSet.size() < maxVocab_)
-      indexSet.insert(dis(*gen_));
-
-    // turn into vector and sort (selected indices)
-    std::vector<WordIndex> idx(indexSet.begin(), indexSet.end());
-    std::sort(idx.begin(), idx.end());
-
-    // assign new shifted position
-    std::unordered_map<WordIndex, WordIndex> pos;
-    std::vector<WordIndex> reverseMap;
-
-    for(WordIndex i = 0; i < idx.size(); ++i) {
-      pos[idx[i]] = i;
-      reverseMap.push_back(idx[i]);
-    }
+///////////////////////////////////////////////////////////////////////////////////
 
-    Words mapped;
-    for(auto i : trgBatch->data()) {
-      // mapped postions for cross-entropy
-      mapped.push_back(Word::fromWordIndex(pos[i.toWordIndex()]));
-    }
+// Candidates of a sampled softmax in training, shared by all target positions of a batch. The target words of the
+// batch are given as positions in the candidates, and the logits of every candidate are corrected by the log of the
+// probability that it is among them.
+class SampledShortlist : public Shortlist {
+private:
+  Words mappedIndices_;               // [target position] -> position of the target word in indices_
+  std::vector<float> logCorrections_; // [k] -log(probability that the candidate was selected)
+
+public:
+  SampledShortlist(const std::vector<WordIndex>& indices,
+                   const Words& mappedIndices,
+                   const std::vector<float>& logCorrections)
+      : Shortlist(indices), mappedIndices_(mappedIndices), logCorrections_(logCorrections) {}
+
+  const Words& mappedIndices() const { return mappedIndices_; }
+  const std::vector<float>& logCorrections() const { return logCorrections_; }
+};
 
-    return New<Shortlist>(idx, mapped, reverseMap);
+// Sampled softmax for training, see --sampled-softmax. The candidates of a batch are all its target words, which are
+// always selected, and words drawn from a log-uniform distribution over the vocabulary ids until there are total
+// of them, which assumes a vocabulary sorted by frequency. Once --sampled-softmax-until is reached, generate()
+// returns nullptr and the remaining updates fine-tune the output layer on the full softmax.
+class SampledShortlistGenerator : public ShortlistGenerator, public TrainingObserver {
+private:
+  size_t trgIdx_;
+  size_t total_;
+  size_t trgVocabSize_;
+  SchedulingParameter until_;
+  std::atomic<bool> sampling_{true};
+
+  mutable std::mt19937 gen_; // generate() is only called by the training thread of one device
+
+  void update(TrainingState& state) {
+    bool sampling = !until_ || state.getProgressIn(until_.unit) < until_.n;
+    if(sampling_ && !sampling)
+      LOG(info, "[training] Reached --sampled-softmax-until {}, training on the full softmax", std::string(until_));
+    sampling_ = sampling;
   }
+
+public:
+  SampledShortlistGenerator(Ptr<Options> options, size_t trgIdx, size_t trgVocabSize);
+
+  virtual Ptr<Shortlist> generate(Ptr<data::CorpusBatch> batch) const override;
+
+  void init(TrainingState& state) override { update(state); }
+  void actAfterBatches(TrainingState& state) override { update(state); }
+  void actAfterLoaded(TrainingState& state) override { update(state); }
 };
-#endif
+
+// Sorted union of the firstNum most frequent target words, of the source words themselves if shared,
+// and of the target word lists [lists[offsets[w]], lists[offsets[w + 1]]) of all source words w,
+// padded with the next most frequent words to a multiple of eight. The selection is done with
+// bitsets over the vocabularies that are reused across batches by every thread.
+std::vector<WordIndex> selectShortlistIndices(const Words& srcWords,
+                                              size_t trgVocabSize,
+                                              size_t firstNum,
+                                              bool shared,
+                                              const uint64_t* offsets,
+                                              size_t numOffsets,
+                                              const WordIndex* lists);
+
+// A SentenceShortlist with the selectShortlistIndices() of every sentence of srcBatch. Suppressed
+// target words are only kept among the firstNum most frequent words, where their positions agree.
+Ptr<Shortlist> createSentenceShortlist(Ptr<SubBatch> srcBatch,
+                                       Ptr<const Vocab> trgVocab,
+                                       Ptr<const Options> options,
+                                       size_t firstNum,
+                                       bool shared,
+                                       const uint64_t* offsets,
+                                       size_t numOffsets,
+                                       const WordIndex* lists);
 
 class LexicalShortlistGenerator : public ShortlistGenerator {
 private:
@@ -201,7 +245,12 @@ private:
   size_t firstNum_{100};
   size_t bestNum_{100};
 
-  std::vector<std::unordered_map<WordIndex, float>> data_; // [WordIndex src] -> [WordIndex tgt] -> P_trans(tgt|src) --@TODO: rename data_ accordingly
+  std::vector<std::unordered_map<WordIndex, float>> data_; // [WordIndex src] -> [WordIndex tgt] -> P_trans(tgt|src), only used while loading
+
+  // pruned shortlists in the same layout as BinaryShortlistGenerator:
+  // [&shortLists_[wordToOffset_[word]], &shortLists_[wordToOffset_[word+1]]) are the sorted target words of word
+  std::vector<uint64_t> wordToOffset_;
+  std::vector<WordIndex> shortLists_;
 
   void load(const std::string& fname) {
     io::InputFileStream in(fname);
@@ -241,6 +290,21 @@ private:
     }
   }
 
+  // flatten the pruned dictionary into sorted per-word arrays, see selectShortlistIndices()
+  void index() {
+    wordToOffset_.assign(1, 0);
+    shortLists_.clear();
+    for(auto& probs : data_) {
+      size_t begin = shortLists_.size();
+      for(auto& it : probs)
+        shortLists_.push_back(it.first);
+      std::sort(shortLists_.begin() + begin, shortLists_.end());
+      wordToOffset_.push_back(shortLists_.size());
+    }
+    data_.clear();
+    data_.shrink_to_fit();
+  }
+
 public:
   LexicalShortlistGenerator(Ptr<Options> options,
                             Ptr<const Vocab> srcVocab,
@@ -272,6 +336,7 @@ public:
     // @TODO: Load and prune in one go.
     load(fname);
     prune(threshold);
+    index();
 
     if(!dumpPath.empty())
       dump(dumpPath);
@@ -286,9 +351,9 @@ public:
 
     // Dump translation pairs from dictionary
     io::OutputFileStream outDic(prefix + ".dic");
-    for(WordIndex srcId = 0; srcId < data_.size(); srcId++) {
-      for(auto& it : data_[srcId]) {
-        auto trgId = it.first;
+    for(WordIndex srcId = 0; srcId + 1 < wordToOffset_.size(); srcId++) {
+      for(uint64_t j = wordToOffset_[srcId]; j < wordToOffset_[srcId + 1]; j++) {
+        auto trgId = shortLists_[j];
         outDic << (*srcVocab_)[Word::fromWordIndex(srcId)] << "\t" << (*trgVocab_)[Word::fromWordIndex(trgId)] << std::endl;
       }
     }
@@ -296,42 +361,11 @@ public:
 
   virtual Ptr<Shortlist> generate(Ptr<data::CorpusBatch> batch) const override {
     auto srcBatch = (*batch)[srcIdx_];
-
-    // add firstNum most frequent words
-    std::unordered_set<WordIndex> indexSet;
-    for(WordIndex i = 0; i < firstNum_ && i < trgVocab_->size(); ++i)
-      indexSet.insert(i);
-
-    // add all words from ground truth
-    // for(auto i : trgBatch->data())
-    //  indexSet.insert(i.toWordIndex());
-
-    // collect unique words form source
-    std::unordered_set<WordIndex> srcSet;
-    for(auto i : srcBatch->data())
-      srcSet.insert(i.toWordIndex());
-
-    // add aligned target words
-    for(auto i : srcSet) {
-      if(shared_)
-        indexSet.insert(i);
-      for(auto& it : data_[i])
-        indexSet.insert(it.first);
-    }
-    // Ensure that the generated vocabulary items from a shortlist are a multiple-of-eight
-    // This is necessary until intgemm supports non-multiple-of-eight matrices.
-    // TODO better solution here? This could potentially be slow.
-    WordIndex i = static_cast<WordIndex>(firstNum_);
-    while (indexSet.size() % 8 != 0) {
-      indexSet.insert(i);
-      i++;
-    }
-
-    // turn into vector and sort (selected indices)
-    std::vector<WordIndex> indices(indexSet.begin(), indexSet.end());
-    std::sort(indices.begin(), indices.end());
-
-    return New<Shortlist>(indices);
+    if(options_->get<bool>("shortlist-per-sentence", false))
+      return createSentenceShortlist(srcBatch, trgVocab_, options_, firstNum_, shared_,
+                                     wordToOffset_.data(), wordToOffset_.size(), shortLists_.data());
+    return New<Shortlist>(selectShortlistIndices(srcBatch->data(), trgVocab_->size(), firstNum_, shared_,
+                                                 wordToOffset_.data(), wordToOffset_.size(), shortLists_.data()));
   }
 };
 
@@ -350,6 +384,34 @@ public:
   }
 };
 
+// Decorator for document translation, where consecutive sentences share most of their target candidates.
+// The shortlist of a batch is the union of the candidates of the wrapped generator with those that it has
+// selected within the last maxAge batches of the same stream, i.e. decoding thread. Hence the selected
+// indices mostly stay the same across the batches of a document and only grow with the candidates of new
+// source words, until unused ones age out. See --shortlist-sticky.
+class StickyShortlistGenerator : public ShortlistGenerator {
+private:
+  Ptr<const ShortlistGenerator> generator_;
+  size_t trgVocabSize_;
+  size_t maxAge_;
+
+  struct Stream {
+    size_t numBatches{0};
+    std::vector<size_t> lastSelected; // [target word] -> number of the last batch that selected the word, 0 if none
+    std::vector<WordIndex> indices;   // sorted shortlist of the previous batch
+  };
+  mutable std::mutex mutex_;
+  mutable std::unordered_map<std::thread::id, Stream> streams_; // only the owning thread uses a Stream
+
+public:
+  StickyShortlistGenerator(Ptr<const ShortlistGenerator> generator, size_t trgVocabSize, size_t maxAge)
+      : generator_(generator), trgVocabSize_(trgVocabSize), maxAge_(maxAge) {}
+
+  virtual Ptr<Shortlist> generate(Ptr<data::CorpusBatch> batch) const override;
+
+  virtual void dump(const std::string& prefix) const override { generator_->dump(prefix); }
+};
+
 /*
 Legacy binary shortlist for Microsoft-internal use.
 */
@@ -400,6 +462,9 @@ Ptr<ShortlistGenerator> createShortlistGenerator(Ptr<Options> options,
 // Magic signature for binary shortlist:
 // ASCII and Unicode text files never start with the following 64 bits
 const uint64_t BINARY_SHORTLIST_MAGIC = 0xF11A48D5013417F5;
+// Magic signature of the page-aligned layout, see BinaryShortlistGenerator::HeaderV2
+const uint64_t BINARY_SHORTLIST_MAGIC_V2 = 0xF11A48D5013417F6;
+const uint64_t BINARY_SHORTLIST_ALIGNMENT = 4096;
 
 bool isBinaryShortlist(const std::string& fileName);
 
@@ -434,6 +499,20 @@ private:
     uint64_t shortListsSize; // Length of shortLists_ array.
   };
 
+  // Layout written by dump(). Both arrays start at multiples of BINARY_SHORTLIST_ALIGNMENT bytes from
+  // the beginning of the file, which is page-aligned when mapped. They are used in place without any
+  // parsing, and the pages of a file are shared by all processes that map it.
+  struct HeaderV2 {
+    uint64_t magic; // BINARY_SHORTLIST_MAGIC_V2
+    uint64_t checksum; // util::hashMem<uint64_t, uint64_t> from &firstNum to end of file, which is padded to 8 bytes.
+    uint64_t firstNum;
+    uint64_t bestNum;
+    uint64_t wordToOffsetSize;
+    uint64_t shortListsSize;
+    uint64_t wordToOffsetBegin; // Byte offset of wordToOffset_ from the beginning of the file.
+    uint64_t shortListsBegin;   // Byte offset of shortLists_ from the beginning of the file.
+  };
+
   void contentCheck();
   // load shortlist from buffer
   void load(const void* ptr_void, size_t blobSize, bool check = true);
@@ -443,6 +522,8 @@ private:
   void import(const std::string& filename, double threshold);
   // save blob to file (called by dump)
   void saveBlobToFile(const std::string& filename) const;
+  // the current shortlists in the HeaderV2 layout
+  std::vector<char> serialize() const;
 
 public:
   BinaryShortlistGenerator(Ptr<Options> options,
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "data/types.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace marian {
+namespace data {
+
+// Predicts the output length of a source sentence for length-aware batching during decoding
+// (--maxi-batch-sort trg-predicted). Every source token keeps a running mean of the target/source
+// length ratio of the finished translations it occurred in. The prediction is the source length
+// times the mean of these per-token ratios, unseen tokens use the global ratio. Since the model is
+// learned on the fly the very first maxi-batch is effectively sorted by source length.
+class TargetLengthPredictor {
+private:
+  mutable std::mutex mutex_;
+  std::unordered_map<WordIndex, std::pair<float, size_t>> tokenRatios_; // token -> (mean ratio, count)
+  float globalRatio_{1.f};
+  size_t numSentences_{0};
+
+public:
+  // record the length of a finished translation of source
+  void update(const Words& source, size_t targetLength) {
+    if(source.empty())
+      return;
+    float ratio = (float)targetLength / (float)source.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    numSentences_++;
+    globalRatio_ += (ratio - globalRatio_) / numSentences_;
+    for(const auto& word : source) {
+      auto& stats = tokenRatios_[word.toWordIndex()];
+      stats.second++;
+      stats.first += (ratio - stats.first) / stats.second;
+    }
+  }
+
+  float predict(const Words& source) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(numSentences_ == 0 || source.empty())
+      return (float)source.size();
+
+    float sumRatios = 0.f;
+    for(const auto& word : source) {
+      auto it = tokenRatios_.find(word.toWordIndex());
+      sumRatios += it != tokenRatios_.end() ? it->second.first : globalRatio_;
+    }
+    return sumRatios; // == source.size() * mean ratio
+  }
+};
+
+}  // namespace data
+}  // namespace marian
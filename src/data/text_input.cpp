@@ -1,5 +1,6 @@
 #include "data/text_input.h"
 #include "common/utils.h"
+#include "3rd_party/threadpool.h"
 
 namespace marian {
 namespace data {
@@ -36,12 +37,74 @@ TextInput::TextInput(std::vector<std::string> inputs,
       rightLeft_(options_->get<bool>("right-left")),
       prependZero_(options_->get<bool>("comet-prepend-zero", false)),
       joinFields_(options_->get<bool>("input-join-fields", false)),
-      insertSeparator_(options_->get<bool>("comet-use-separator", false))
+      insertSeparator_(options_->get<bool>("comet-use-separator", false)),
+      numAdapters_(options_->get<std::vector<std::string>>("lora-adapters", {}).size())
  {
   // Note: inputs are automatically stored in the inherited variable named paths_, but these are
   // texts not paths!
   for(const auto& text : paths_)
     files_.emplace_back(new std::istringstream(text));
+
+  size_t numThreads = options_->get<size_t>("data-threads", 1);
+  if(numThreads > 1)
+    encodeAll(numThreads);
+}
+
+// Encodes all lines up front on several threads, so that larger inputs, e.g. of a server request, are not tokenized
+// one line after another by the reader. next() then takes the sentences from encoded_.
+void TextInput::encodeAll(size_t numThreads) {
+  const size_t LINES_PER_TASK = 64;
+
+  std::vector<std::vector<std::string>> lines(files_.size());
+  size_t numLines = std::numeric_limits<size_t>::max();
+  for(size_t i = 0; i < files_.size(); ++i) {
+    std::string line;
+    while(io::getline(*files_[i], line))
+      lines[i].push_back(line);
+    numLines = std::min(numLines, lines[i].size()); // reading stops at the end of the shortest input
+  }
+  if(files_.empty() || numLines <= LINES_PER_TASK) { // not worth the threads, encoded while read instead
+    for(size_t i = 0; i < files_.size(); ++i)
+      files_[i].reset(new std::istringstream(paths_[i]));
+    return;
+  }
+
+  auto interval = tokenization_.time();
+  if(numAdapters_ > 0)
+    for(size_t l = 0; l < numLines; ++l)
+      adapters_.push_back(takeAdapterTag(lines[0][l], numAdapters_));
+  encoded_.assign(files_.size(), std::vector<Words>(numLines));
+  size_t numTasks = files_.size() * ((numLines + LINES_PER_TASK - 1) / LINES_PER_TASK);
+  ThreadPool pool(std::min(numThreads, numTasks));
+  std::vector<std::future<void>> tasks;
+  for(size_t i = 0; i < files_.size(); ++i) {
+    for(size_t begin = 0; begin < numLines; begin += LINES_PER_TASK) {
+      tasks.push_back(pool.enqueue([this, &lines, i, begin, numLines]() {
+        for(size_t l = begin; l < std::min(begin + LINES_PER_TASK, numLines); ++l)
+          encoded_[i][l] = vocabs_[i]->encode(lines[i][l], /*addEOS =*/true, inference_);
+      }));
+    }
+  }
+  for(auto& task : tasks)
+    task.get();
+}
+
+TextInput::TextInput(std::vector<std::vector<Words>> encoded,
+                     std::vector<Ptr<Vocab>> vocabs,
+                     Ptr<Options> options)
+    : DatasetBase(options),
+      encoded_(std::move(encoded)),
+      vocabs_(vocabs),
+      maxLength_(options_->get<size_t>("max-length")),
+      maxLengthCrop_(options_->get<bool>("max-length-crop")),
+      rightLeft_(options_->get<bool>("right-left")),
+      prependZero_(options_->get<bool>("comet-prepend-zero", false)),
+      joinFields_(options_->get<bool>("input-join-fields", false)),
+      insertSeparator_(options_->get<bool>("comet-use-separator", false)),
+      numAdapters_(options_->get<std::vector<std::string>>("lora-adapters", {}).size())
+ {
+  for(const auto& stream : encoded_)
+    ABORT_IF(stream.size() != encoded_.front().size(), "All input streams need the same number of sentences");
 }
 
 // TextInput is mainly used for inference in the server mode, not for training, so skipping too long
@@ -49,6 +112,21 @@ TextInput::TextInput(std::vector<std::string> inputs,
 SentenceTuple TextInput::next() {
   // get index of the current sentence
   size_t curId = pos_++;
+  if(!encoded_.empty()) {
+    if(curId >= encoded_.front().size())
+      return SentenceTupleImpl(); // end of input
+    std::vector<Words> row;
+    for(size_t i = 0; i < encoded_.size(); ++i) {
+      row.push_back(encoded_[i][curId]);
+      auto eos = vocabs_[i]->getEosId();
+      if(row.back().empty() || row.back().back() != eos)
+        row.back().push_back(eos);
+    }
+    auto tup = encode(row, curId);
+    if(!adapters_.empty())
+      tup.get().setAdapter(adapters_[curId]);
+    return tup;
+  }
   // read next row, i.e. vector<string> from files
   // if any file is empty, we are done
   std::vector<std::string> row;
@@ -60,7 +138,11 @@ SentenceTuple TextInput::next() {
       return SentenceTupleImpl(); // return an empty tuple if above test does not pass();
     }
   }
-  return encode(row, curId);
+  auto interval = tokenization_.time();
+  int adapter = numAdapters_ > 0 ? takeAdapterTag(row[0], numAdapters_) : -1;
+  auto tup = encode(row, curId);
+  tup.get().setAdapter(adapter);
+  return tup;
 }
 
 }  // namespace data
@@ -2,6 +2,7 @@
 
 #include "data/iterator_facade.h"
 #include "data/corpus.h"
+#include "common/tracing.h"
 
 namespace marian {
 namespace data {
@@ -29,6 +30,7 @@ private:
 class TextInput : public DatasetBase<SentenceTuple, TextIterator, CorpusBatch> {
 protected:
   std::vector<UPtr<std::istringstream>> files_;
+  std::vector<std::vector<Words>> encoded_; // [stream][sentence] pre-tokenized input, used instead of files_ if not empty
   std::vector<Ptr<Vocab>> vocabs_;
 
   size_t pos_{0};
@@ -43,8 +45,18 @@ protected:
                                 // the already present </s> separator will demark the fields (mostly used for BLEURT and COMET-KIWI)
   bool insertSeparator_{false}; // when joining fields with joinFields_, additionally use this separator (mostly used for COMET-KIWI)
 
+  size_t numAdapters_{0};       // number of --lora-adapters that the lines of the first input can select, see takeAdapterTag()
+  std::vector<int> adapters_;   // [sentence] adapter of each sentence of encoded_ if numAdapters_ > 0
+
+  tracing::RepeatedSpan tokenization_{"tokenization"}; // of a sampled request, see --trace-sample-rate
+
+  void encodeAll(size_t numThreads);
+
 public:
   TextInput(std::vector<std::string> inputs, std::vector<Ptr<Vocab>> vocabs, Ptr<Options> options);
+  // Input given as vocabulary ids [stream][sentence], which skips text parsing and vocabulary encoding.
+  // A missing </s> is added to every sentence.
+  TextInput(std::vector<std::vector<Words>> encoded, std::vector<Ptr<Vocab>> vocabs, Ptr<Options> options);
   virtual ~TextInput() {}
 
   SentenceTuple next() override;
@@ -95,6 +107,13 @@ public:
     auto batch = batch_ptr(new batch_type(subBatches));
     batch->setSentenceIds(sentenceIds);
 
+    if(numAdapters_ > 0) {
+      std::vector<int> adapters;
+      for(auto& ex : batchVector)
+        adapters.push_back(ex.getAdapter());
+      batch->setAdapters(adapters);
+    }
+
     return batch;
   }
 
@@ -102,7 +121,17 @@ public:
 
   SentenceTuple encode(std::vector<std::string>& fields, size_t id) {
     ABORT_IF(fields.size() != vocabs_.size(), "Number of fields does not match number of vocabs");
-    
+
+    std::vector<Words> fieldWords;
+    for(size_t i = 0; i < fields.size(); ++i)
+      fieldWords.push_back(vocabs_[i]->encode(fields[i], /*addEOS =*/true, inference_));
+    return encode(fieldWords, id);
+  }
+
+  // same as above for fields that have already been mapped to vocabulary ids
+  SentenceTuple encode(std::vector<Words>& fields, size_t id) {
+    ABORT_IF(fields.size() != vocabs_.size(), "Number of fields does not match number of vocabs");
+
     // fill up the sentence tuple with source and/or target sentences
     SentenceTupleImpl tup(id);
 
@@ -115,9 +144,7 @@ public:
       if(inputPermutation_.size() > 0)
         permutedBatchIndex = inputPermutation_[batchIndex];
 
-      std::string& field = fields[permutedBatchIndex];
-
-      Words words = vocabs_[permutedBatchIndex]->encode(field, /*addEOS =*/true, inference_);
+      Words words = fields[permutedBatchIndex];
       ABORT_IF(words.empty(), "Empty input sequences are presently untested");
 
       // This handles adding starts symbols for COMET (<s>) and BERT/BLEURT ([CLS])
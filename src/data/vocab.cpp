@@ -86,6 +86,10 @@ void Vocab::create(const std::string& vocabPath,
   create(vocabPath, std::vector<std::string>({trainPath}), maxSize);
 }
 
+void Vocab::compile(const std::string& vocabPath, const std::string& compiledPath) {
+  compileDefaultVocab(vocabPath, compiledPath);
+}
+
 void Vocab::createFake() {
   if(!vImpl_)
     vImpl_ = createDefaultVocab(); // DefaultVocab is OK here
@@ -119,6 +123,10 @@ std::string Vocab::decode(const Words& sentence,
   return vImpl_->decode(sentence, ignoreEOS);
 }
 
+void Vocab::decodeAppend(const Word* begin, const Word* end, std::string& out, bool ignoreEOS) const {
+  vImpl_->decodeAppend(begin, end, out, ignoreEOS);
+}
+
 // convert sequence of token its to surface form (incl. removng spaces, applying factors)
 // for in-process BLEU validation
 std::string Vocab::surfaceForm(const Words& sentence) const {
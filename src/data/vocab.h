@@ -39,6 +39,10 @@ public:
               const std::string& trainPath,
               size_t maxSize);
 
+  // writes the YAML, JSON or text vocabulary vocabPath as a compiled vocabulary (*.bvoc) to compiledPath, which is
+  // memory-mapped when it is loaded instead of being parsed
+  static void compile(const std::string& vocabPath, const std::string& compiledPath);
+
   // string token to token id
   Word operator[](const std::string& word) const;
 
@@ -54,6 +58,9 @@ public:
   std::string decode(const Words& sentence,
                      bool ignoreEOS = true) const;
 
+  // append the decoded form of [begin, end) to out, see IVocab::decodeAppend()
+  void decodeAppend(const Word* begin, const Word* end, std::string& out, bool ignoreEOS = true) const;
+
   // convert sequence of token its to surface form (incl. removng spaces, applying factors)
   // for in-process BLEU validation
   std::string surfaceForm(const Words& sentence) const;
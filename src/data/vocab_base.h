@@ -34,6 +34,12 @@ public:
 
   virtual std::string decode(const Words& sentence,
                              bool ignoreEos = true) const = 0;
+
+  // Same as decode() for [begin, end), appended to out. Implementations avoid temporary strings, so that one buffer
+  // can be reused for the output of many sentences
+  virtual void decodeAppend(const Word* begin, const Word* end, std::string& out, bool ignoreEos = true) const {
+    out += decode(Words(begin, end), ignoreEos);
+  }
   virtual std::string surfaceForm(const Words& sentence) const = 0;
 
   virtual const std::string& operator[](Word id) const = 0;
@@ -67,6 +73,7 @@ public:
 class Options;
 Ptr<IVocab> createDefaultVocab();
 Ptr<IVocab> createClassVocab();
+void compileDefaultVocab(const std::string& vocabPath, const std::string& compiledPath);
 Ptr<IVocab> createSentencePieceVocab(const std::string& vocabPath, Ptr<Options>, size_t batchIndex);
 Ptr<IVocab> createFactoredVocab(const std::string& vocabPath);
 
@@ -4,12 +4,15 @@
 
 #include "common/config.h"
 #include "common/options.h"
+#include "data/batch_fit.h"
 #include "data/batch_generator.h"
 #include "data/corpus.h"
 #include "data/corpus_nbest.h"
 #include "models/costs.h"
 #include "models/model_task.h"
+#include "embedder/embedding_search.h"
 #include "embedder/vector_collector.h"
+#include "training/communicator.h"
 #include "training/scheduler.h"
 #include "training/validator.h"
 
@@ -52,6 +55,8 @@ private:
   std::vector<Ptr<ExpressionGraph>> graphs_;
   std::vector<Ptr<Model>> models_;
   Ptr<io::ModelWeights> modelFile_;
+  Ptr<BatchStats> stats_; // of --mini-batch-fit, collected on the first graph before the first batch
+  Ptr<IMPIWrapper> mpi_;  // every MPI process embeds every numMPIProcesses()-th batch
 
 public:
   Embed(Ptr<Options> options) : options_(options) {
@@ -76,7 +81,8 @@ public:
     corpus_ = New<Corpus>(options_);
     corpus_->prepare();
 
-    auto devices = Config::getDevices(options_);
+    mpi_ = initMPI(/*multiThreaded=*/false);
+    auto devices = Config::getDevices(options_, mpi_->myMPIRank(), mpi_->numMPIProcesses());
 
     for(auto device : devices) {
       auto graph = New<ExpressionGraph>(true);
@@ -103,20 +109,91 @@ public:
     }
   }
 
+  ~Embed() { finalizeMPI(std::move(mpi_)); }
+
   void run() override {
     LOG(info, "Embedding");
     timer::Timer timer;
 
-    auto batchGenerator = New<BatchGenerator<CorpusBase>>(corpus_, options_);
-    batchGenerator->prepare();
+    if(options_->hasAndNotEmpty("search-targets")) {
+      ABORT_IF(mpi_->numMPIProcesses() > 1, "--search-targets cannot be used with several MPI processes");
+      search();
+    } else {
+      // only the main process writes the output, the vectors of the others are gathered into it
+      Ptr<VectorCollector> output = mpi_->isMainProcess() ? VectorCollector::Create(options_) : nullptr;
+      Ptr<GatheringVectorCollector> gathering;
+      if(mpi_->numMPIProcesses() > 1)
+        output = gathering = New<GatheringVectorCollector>(mpi_, output);
+      embed(corpus_, [output](Ptr<ExpressionGraph> /*graph*/, Ptr<CorpusBatch> batch, std::vector<float>&& sentVectors, int embSize) {
+        // collect embedding vector per sentence.
+        // if we compute similarities this is only one similarity per sentence pair.
+        for(size_t i = 0; i < batch->size(); ++i) {
+            auto beg = i * embSize;
+            auto end = (i + 1) * embSize;
+            std::vector<float> sentVector(sentVectors.begin() + beg, sentVectors.begin() + end);
+            output->Write((long)batch->getSentenceIds()[i],
+                          sentVector);
+        }
+      });
+      if(gathering)
+        gathering->gather();
+    }
+    LOG(info, "Total time: {:.5f}s wall", timer.elapsed());
+  }
+
+  // Embeds the --search-targets and then searches the neighbours of the embedded input sentences among them,
+  // see EmbeddingSearch. Neither side is written out as vectors.
+  void search() {
+    ABORT_IF(options_->get<bool>("compute-similarity"), "--search-targets cannot be used with --compute-similarity");
+    auto searcher = New<EmbeddingSearch>(options_);
+
+    auto targetOptions = options_->with("train-sets", std::vector<std::string>({options_->get<std::string>("search-targets")}));
+    Ptr<CorpusBase> targetCorpus = New<Corpus>(targetOptions);
+    targetCorpus->prepare();
+
+    std::mutex mutex;
+    std::vector<float> targets;
+    int dimEmb = 0;
+    embed(targetCorpus, [&](Ptr<ExpressionGraph> /*graph*/, Ptr<CorpusBatch> batch, std::vector<float>&& sentVectors, int embSize) {
+      std::lock_guard<std::mutex> lock(mutex);
+      dimEmb = embSize;
+      for(size_t i = 0; i < batch->size(); ++i) {
+        size_t id = batch->getSentenceIds()[i];
+        if(targets.size() < (id + 1) * embSize)
+          targets.resize((id + 1) * embSize);
+        std::copy(sentVectors.begin() + i * embSize, sentVectors.begin() + (i + 1) * embSize, targets.begin() + id * embSize);
+      }
+    });
+    searcher->setTargets(std::move(targets), dimEmb);
 
-    auto output = New<VectorCollector>(options_->get<std::string>("output"), options_->get<bool>("binary"));
+    embed(corpus_, [searcher](Ptr<ExpressionGraph> graph, Ptr<CorpusBatch> batch, std::vector<float>&& sentVectors, int /*embSize*/) {
+      searcher->search(graph, batch->getSentenceIds(), std::move(sentVectors));
+    });
 
-    size_t batchId = 0;
+    auto outFile = options_->get<std::string>("output");
+    UPtr<std::ostream> out(outFile == "stdout" ? new std::ostream(std::cout.rdbuf()) : new io::OutputFileStream(outFile));
+    searcher->write(*out, options_->get<size_t>("width", VectorCollector::DEFAULT_WIDTH));
+  }
+
+  // Embeds all sentences of the corpus and hands the [batch size, embSize] vectors of each batch to consume,
+  // which is called from the thread of the graph that computed them
+  void embed(Ptr<CorpusBase> corpus,
+             const std::function<void(Ptr<ExpressionGraph>, Ptr<CorpusBatch>, std::vector<float>&&, int)>& consume) {
+    if(options_->get<bool>("mini-batch-fit", false) && !stats_) {
+      LOG(info, "[batching] Collecting statistics for batch fitting");
+      stats_ = collectInferenceStats(graphs_[0], models_[0], corpus->getVocabs(), options_);
+    }
+    auto batchGenerator = New<BatchGenerator<CorpusBase>>(corpus, options_, stats_);
+    batchGenerator->prepare();
+
+    size_t batchId = 0, batchNo = 0;
     {
       ThreadPool pool(graphs_.size(), graphs_.size());
 
       for(auto batch : *batchGenerator) {
+        if(batchNo++ % mpi_->numMPIProcesses() != mpi_->myMPIRank())
+          continue; // embedded by another MPI process
+
         auto task = [=](size_t id) {
           thread_local Ptr<ExpressionGraph> graph;
           thread_local Ptr<Model> builder;
@@ -143,22 +220,12 @@ public:
             ABORT("Unknown embedding type {}", embeddings->value_type());
           }
 
-          // collect embedding vector per sentence.
-          // if we compute similarities this is only one similarity per sentence pair.
-          for(size_t i = 0; i < batch->size(); ++i) {
-              auto embSize = embeddings->shape()[-1];
-              auto beg = i * embSize;
-              auto end = (i + 1) * embSize;
-              std::vector<float> sentVector(sentVectors.begin() + beg, sentVectors.begin() + end);
-              output->Write((long)batch->getSentenceIds()[i],
-                            sentVector);
-          }
+          consume(graph, batch, std::move(sentVectors), embeddings->shape()[-1]);
         };
 
         pool.enqueue(task, batchId++);
       }
     }
-    LOG(info, "Total time: {:.5f}s wall", timer.elapsed());
   }
 
 };
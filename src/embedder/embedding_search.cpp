@@ -0,0 +1,163 @@
+#include "embedder/embedding_search.h"
+
+#include "3rd_party/faiss/utils/hamming.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+
+namespace marian {
+
+static void normalize(std::vector<float>& vectors, int dimEmb) {
+  for(size_t i = 0; i < vectors.size(); i += dimEmb) {
+    float norm = 0.f;
+    for(int j = 0; j < dimEmb; ++j)
+      norm += vectors[i + j] * vectors[i + j];
+    norm = std::sqrt(norm) + 1e-12f;
+    for(int j = 0; j < dimEmb; ++j)
+      vectors[i + j] /= norm;
+  }
+}
+
+void EmbeddingSearch::setTargets(std::vector<float>&& targets, int dimEmb) {
+  dimEmb_ = dimEmb;
+  numTargets_ = targets.size() / dimEmb;
+  ABORT_IF(numTargets_ == 0, "No target sentences to search in");
+
+  targets_ = std::move(targets);
+  normalize(targets_, dimEmb_);
+  backward_.resize(numTargets_);
+
+  if(!exact_) {
+    codes_.resize(numTargets_ * ((dimEmb_ + 7) / 8));
+    faiss::fvecs2bitvecs(targets_.data(), codes_.data(), (size_t)dimEmb_, numTargets_);
+  }
+  LOG(info, "[search] Searching {} target sentences with the {} index", numTargets_, exact_ ? "exact" : "lsh");
+}
+
+void EmbeddingSearch::addBackward(IndexType target, float cosine) {
+  auto& heap = backward_[target];
+  if(heap.size() < (size_t)k_) {
+    heap.push_back(cosine);
+    std::push_heap(heap.begin(), heap.end(), std::greater<float>());
+  } else if(cosine > heap.front()) {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<float>());
+    heap.back() = cosine;
+    std::push_heap(heap.begin(), heap.end(), std::greater<float>());
+  }
+}
+
+// The cosines of all targets are computed as one product on the device, the targets are a fixed parameter of the
+// graph, so they are only copied to the device for the first batch.
+void EmbeddingSearch::searchExact(Ptr<ExpressionGraph> graph,
+                                  const std::vector<float>& sources,
+                                  std::vector<std::vector<Neighbour>>& neighbours,
+                                  std::vector<std::vector<float>>& backward) {
+  int numSources = (int)neighbours.size();
+  int dimK = std::min(k_, (int)numTargets_);
+  int dimKBackward = std::min(k_, numSources);
+
+  graph->clear();
+  auto trg = graph->get("EmbeddingSearch->targets", Type::float32);
+  if(!trg)
+    trg = graph->param("EmbeddingSearch->targets", {(int)numTargets_, dimEmb_}, inits::fromVector(targets_),
+                       Type::float32, /*fixed=*/true);
+  auto src = graph->constant({numSources, dimEmb_}, inits::fromVector(sources), Type::float32);
+
+  auto cosines = dot(src, trg, /*transA=*/false, /*transB=*/true); // [sources, targets]
+  auto best = topk(cosines, dimK, /*axis=*/-1);
+  auto bestBackward = get<0>(topk(transpose(cosines), dimKBackward, /*axis=*/-1));
+  graph->forward();
+
+  std::vector<float> values, valuesBackward;
+  std::vector<IndexType> indices;
+  get<0>(best)->val()->get(values);
+  get<1>(best)->val()->get(indices);
+  bestBackward->val()->get(valuesBackward);
+
+  for(int i = 0; i < numSources; ++i)
+    for(int j = 0; j < dimK; ++j)
+      neighbours[i].push_back({indices[i * dimK + j], values[i * dimK + j]});
+
+  backward.resize(numTargets_);
+  for(size_t t = 0; t < numTargets_; ++t)
+    backward[t].assign(valuesBackward.begin() + t * dimKBackward, valuesBackward.begin() + (t + 1) * dimKBackward);
+}
+
+void EmbeddingSearch::searchLsh(const std::vector<float>& sources, std::vector<std::vector<Neighbour>>& neighbours) {
+  size_t numSources = neighbours.size();
+  size_t bytesPerVector = (dimEmb_ + 7) / 8;
+  size_t dimK = std::min((size_t)k_, numTargets_);
+
+  std::vector<uint8_t> codes(numSources * bytesPerVector);
+  faiss::fvecs2bitvecs(sources.data(), codes.data(), (size_t)dimEmb_, numSources);
+
+  std::vector<int> distances(numSources * dimK);
+  std::vector<int64_t> ids(numSources * dimK);
+  faiss::int_maxheap_array_t res = {numSources, dimK, ids.data(), distances.data()};
+  faiss::hammings_knn_hc(&res, codes.data(), codes_.data(), numTargets_, bytesPerVector, /*ordered=*/0);
+
+  for(size_t i = 0; i < numSources; ++i) {
+    for(size_t j = 0; j < dimK; ++j) {
+      size_t t = (size_t)ids[i * dimK + j];
+      float cosine = std::inner_product(sources.begin() + i * dimEmb_, sources.begin() + (i + 1) * dimEmb_,
+                                        targets_.begin() + t * dimEmb_, 0.f);
+      neighbours[i].push_back({(IndexType)t, cosine});
+    }
+    std::sort(neighbours[i].begin(), neighbours[i].end(),
+              [](const Neighbour& a, const Neighbour& b) { return a.cosine > b.cosine; });
+  }
+}
+
+void EmbeddingSearch::search(Ptr<ExpressionGraph> graph,
+                             const std::vector<size_t>& sourceIds,
+                             std::vector<float>&& sources) {
+  ABORT_IF(sources.size() != sourceIds.size() * dimEmb_,
+           "Source embeddings of size {} do not match the target embeddings of size {}",
+           sources.size() / std::max<size_t>(sourceIds.size(), 1), dimEmb_);
+  normalize(sources, dimEmb_);
+
+  std::vector<std::vector<Neighbour>> neighbours(sourceIds.size());
+  std::vector<std::vector<float>> backward; // the k best cosines of each target in this batch, exact only
+  if(exact_)
+    searchExact(graph, sources, neighbours, backward);
+  else
+    searchLsh(sources, neighbours);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for(size_t i = 0; i < sourceIds.size(); ++i) {
+    if(!exact_)
+      for(const auto& n : neighbours[i])
+        addBackward(n.target, n.cosine);
+    neighbours_[sourceIds[i]] = std::move(neighbours[i]);
+  }
+  for(size_t t = 0; t < backward.size(); ++t)
+    for(float cosine : backward[t])
+      addBackward((IndexType)t, cosine);
+}
+
+void EmbeddingSearch::write(std::ostream& out, size_t width) const {
+  auto mean = [](const std::vector<float>& values) {
+    float sum = 0.f;
+    for(float v : values)
+      sum += v;
+    return values.empty() ? 0.f : sum / values.size();
+  };
+
+  out << std::fixed << std::setprecision(width);
+  for(const auto& [source, neighbours] : neighbours_) {
+    std::vector<float> cosines;
+    for(const auto& n : neighbours)
+      cosines.push_back(n.cosine);
+    float forward = mean(cosines);
+
+    for(const auto& n : neighbours) {
+      float margin = n.cosine / ((forward + mean(backward_[n.target])) / 2.f);
+      out << source << "\t" << n.target << "\t" << n.cosine << "\t" << margin << "\n";
+    }
+  }
+  out.flush();
+}
+
+}  // namespace marian
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "marian.h"
+
+#include <map>
+#include <mutex>
+
+namespace marian {
+
+/*
+ * k-nearest-neighbour search of source sentence embeddings among target sentence embeddings for bitext mining,
+ * scored with the ratio margin of Artetxe and Schwenk (2019):
+ *   margin(x, y) = cos(x, y) / ((mean of the k best cos(x, .) + mean of the k best cos(., y)) / 2)
+ *
+ * With --search-index exact every batch of sources is multiplied with all targets on the device of the batch,
+ * with lsh the sign bits of the embeddings are compared with the faiss hamming search on the CPU and the k
+ * nearest codes are rescored by their cosine. The backward means of the margin are over all sources for exact
+ * and over the found pairs for lsh. Only the pairs are kept and printed sorted by source at the end.
+ */
+class EmbeddingSearch {
+private:
+  struct Neighbour {
+    IndexType target;
+    float cosine;
+  };
+
+  int k_;
+  bool exact_;
+
+  int dimEmb_{0};
+  size_t numTargets_{0};
+  std::vector<float> targets_; // [numTargets, dimEmb] unit vectors
+  std::vector<uint8_t> codes_; // sign bits of the targets for lsh
+
+  std::mutex mutex_;
+  std::map<size_t, std::vector<Neighbour>> neighbours_; // of each source, best first
+  std::vector<std::vector<float>> backward_;            // min-heaps of the k best cosines of each target
+
+  void searchExact(Ptr<ExpressionGraph> graph,
+                   const std::vector<float>& sources,
+                   std::vector<std::vector<Neighbour>>& neighbours,
+                   std::vector<std::vector<float>>& backward);
+  void searchLsh(const std::vector<float>& sources, std::vector<std::vector<Neighbour>>& neighbours);
+  void addBackward(IndexType target, float cosine);
+
+public:
+  EmbeddingSearch(Ptr<Options> options)
+    : k_(options->get<int>("search-k", 4)),
+      exact_(options->get<std::string>("search-index", "exact") == "exact") {
+    auto index = options->get<std::string>("search-index", "exact");
+    ABORT_IF(index != "exact" && index != "lsh", "Unknown --search-index {}, expected exact or lsh", index);
+    ABORT_IF(k_ < 1, "--search-k has to be at least 1");
+  }
+
+  // The [numTargets, dimEmb] embeddings of the targets in input order
+  void setTargets(std::vector<float>&& targets, int dimEmb);
+
+  // Finds the neighbours of a batch of [sourceIds.size(), dimEmb] source embeddings, thread-safe
+  void search(Ptr<ExpressionGraph> graph, const std::vector<size_t>& sourceIds, std::vector<float>&& sources);
+
+  // Prints k lines "source id \t target id \t cosine \t margin" for every source
+  void write(std::ostream& out, size_t width) const;
+};
+
+}  // namespace marian
@@ -2,27 +2,62 @@
 
 #include "common/logging.h"
 #include "common/utils.h"
+#include "training/communicator.h"
 
 #include <iostream>
 #include <iomanip>
 
+#include "common/types.h"
+
 namespace marian {
 
+static const size_t NPY_HEADER_SIZE = 128;
+
+// Opens stdout or a file, the npy format has to rewrite its header and hence needs a plain file
+static UPtr<std::ostream> openOutput(const std::string& outFile, VectorCollector::Format format) {
+  if(format == VectorCollector::Format::npy)
+    ABORT_IF(outFile == "stdout" || filesystem::Path(outFile).extension() == filesystem::Path(".gz"),
+             "The npy output format requires an uncompressed output file, not {}", outFile);
+  if(outFile == "stdout")
+    return UPtr<std::ostream>(new std::ostream(std::cout.rdbuf()));
+  return UPtr<std::ostream>(new io::OutputFileStream(outFile));
+}
+
+VectorCollector::Format VectorCollector::formatFromString(const std::string& format) {
+  if(format == "text")
+    return Format::text;
+  else if(format == "fp32")
+    return Format::fp32;
+  else if(format == "fp16")
+    return Format::fp16;
+  else if(format == "npy")
+    return Format::npy;
+  ABORT("Unknown output format {}, expected text, fp32, fp16 or npy", format);
+}
+
 // This class manages multi-threaded writing of embedded vectors to stdout or an output file.
 // It will either output string versions of float vectors or binary equal length versions depending
-// on its binary_ flag.
+// on its format_.
 VectorCollector::VectorCollector(bool binary, size_t width)
   : nextId_(0),
-    binary_(binary),
+    format_(binary ? Format::fp32 : Format::text),
     width_{width} {}
 
 VectorCollector::VectorCollector(std::string outFile, bool binary, size_t width)
+  : VectorCollector(outFile, binary ? Format::fp32 : Format::text, width) {}
+
+VectorCollector::VectorCollector(std::string outFile, Format format, size_t width)
   : nextId_(0),
-    outStrm_(new std::ostream(std::cout.rdbuf())),
-    binary_(binary),
+    outStrm_(openOutput(outFile, format)),
+    format_(format),
     width_(width) {
-  if (outFile != "stdout")
-    outStrm_.reset(new io::OutputFileStream(outFile));
+  if(format_ == Format::npy)
+    WriteNpyHeader(*outStrm_, "<f4", 0, 0);
+}
+
+VectorCollector::~VectorCollector() {
+  if(format_ == Format::npy && outStrm_)
+    RewriteNpyHeader(*outStrm_, "<f4", numVectors_, dimVector_);
 }
 
 void VectorCollector::Write(long id, const std::vector<float>& vec) {
@@ -62,8 +97,17 @@ void VectorCollector::Write(long id, const std::vector<float>& vec) {
 }
 
 void VectorCollector::WriteVector(const std::vector<float>& vec) {
-  if(binary_) {
+  if(format_ == Format::fp32 || format_ == Format::npy) {
+    if(format_ == Format::npy) {
+      ABORT_IF(numVectors_ > 0 && vec.size() != dimVector_,
+               "The npy output format requires vectors of equal size, got {} and {}", dimVector_, vec.size());
+      dimVector_ = vec.size();
+      numVectors_++;
+    }
     outStrm_->write((char*)vec.data(), vec.size() * sizeof(float));
+  } else if(format_ == Format::fp16) {
+    std::vector<float16> vec16(vec.begin(), vec.end());
+    outStrm_->write((char*)vec16.data(), vec16.size() * sizeof(float16));
   } else {
     *outStrm_ << std::fixed << std::setprecision(width_);
     for(auto v : vec)
@@ -72,6 +116,28 @@ void VectorCollector::WriteVector(const std::vector<float>& vec) {
   }
 }
 
+void VectorCollector::WriteNpyHeader(std::ostream& out, const std::string& descr, size_t rows, size_t cols) {
+  std::string shape = cols > 0 ? fmt::format("({}, {})", rows, cols) : fmt::format("({},)", rows);
+  std::string dict = fmt::format("{{'descr': '{}', 'fortran_order': False, 'shape': {}, }}", descr, shape);
+  dict.resize(NPY_HEADER_SIZE - 10 - 1, ' '); // magic string, version and header length take 10 bytes
+  dict += '\n';
+
+  uint16_t dictSize = (uint16_t)dict.size();
+  out.write("\x93NUMPY\x01\x00", 8);
+  out.write((const char*)&dictSize, sizeof(dictSize)); // little-endian like the data
+  out.write(dict.data(), dict.size());
+}
+
+void VectorCollector::RewriteNpyHeader(std::ostream& out, const std::string& descr, size_t rows, size_t cols) {
+  out.flush();
+  auto end = out.tellp();
+  out.seekp(0);
+  WriteNpyHeader(out, descr, rows, cols);
+  out.seekp(end);
+  out.flush();
+  ABORT_IF(out.fail(), "Could not rewrite the npy header of the output file");
+}
+
 void AveragingVectorCollector::WriteVector(const std::vector<float>& vec) {
   if(!onlyLast_)
     VectorCollector::WriteVector(vec);
@@ -91,14 +157,119 @@ void AveragingVectorCollector::WriteAverage() {
   VectorCollector::WriteVector(avg);
 }
 
+UnorderedVectorCollector::UnorderedVectorCollector(std::string outFile, Format format, size_t width)
+  : VectorCollector(outFile, format, width) {
+  ABORT_IF(outFile == "stdout", "Unordered output requires an output file for the sentence ids next to it");
+  // <outFile>.ids, but keep the extension of npy files so that numpy.load() finds them
+  auto path = filesystem::Path(outFile);
+  std::string idsFile = format == Format::npy && path.extension() == filesystem::Path(".npy")
+                          ? outFile.substr(0, outFile.size() - 4) + ".ids.npy"
+                          : outFile + ".ids";
+  idsStrm_.reset(new io::OutputFileStream(idsFile));
+  if(format_ == Format::npy)
+    WriteNpyHeader(*idsStrm_, "<i8", 0, 0);
+}
+
+UnorderedVectorCollector::~UnorderedVectorCollector() {
+  if(format_ == Format::npy)
+    RewriteNpyHeader(*idsStrm_, "<i8", numIds_, 0);
+}
+
+void UnorderedVectorCollector::Write(long id, const std::vector<float>& vec) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  WriteVector(vec);
+  if(format_ == Format::text) {
+    *idsStrm_ << id << std::endl;
+  } else {
+    uint64_t id64 = (uint64_t)id;
+    idsStrm_->write((const char*)&id64, sizeof(id64));
+  }
+  numIds_++;
+}
+
+ShardedVectorCollector::ShardedVectorCollector(std::string outFile, Format format, size_t numShards, size_t width)
+  : VectorCollector(/*binary=*/false, width) {
+  ABORT_IF(outFile == "stdout", "Sharded output requires an output file");
+  std::string extension = filesystem::Path(outFile).extension().string();
+  std::string stem = outFile.substr(0, outFile.size() - extension.size());
+  for(size_t i = 0; i < numShards; ++i)
+    shards_.push_back(New<UnorderedVectorCollector>(stem + "." + std::to_string(i) + extension, format, width));
+}
+
+void ShardedVectorCollector::Write(long id, const std::vector<float>& vec) {
+  shards_[(size_t)id % shards_.size()]->Write(id, vec);
+}
+
+GatheringVectorCollector::GatheringVectorCollector(Ptr<IMPIWrapper> mpi, Ptr<VectorCollector> collector)
+  : VectorCollector(/*binary=*/false), mpi_(mpi), collector_(collector) {
+  ABORT_IF(mpi_->isMainProcess() && !collector_, "The main MPI process needs a collector to gather the vectors into");
+}
+
+void GatheringVectorCollector::Write(long id, const std::vector<float>& vec) {
+  if(mpi_->isMainProcess()) {
+    collector_->Write(id, vec);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ABORT_IF(!ids_.empty() && vec.size() != dimVectors_,
+           "Vectors of dimensions {} and {} cannot be gathered together", dimVectors_, vec.size());
+  dimVectors_ = vec.size();
+  ids_.push_back((size_t)id);
+  vectors_.insert(vectors_.end(), vec.begin(), vec.end());
+}
+
+void GatheringVectorCollector::gather() {
+  const int tagSizes = 0, tagIds = 1, tagVectors = 2;
+  if(!mpi_->isMainProcess()) {
+    size_t sizes[2] = {ids_.size(), dimVectors_};
+    mpi_->sSend(sizes, 2, IMPIWrapper::getDataType(sizes), 0, tagSizes);
+    if(!ids_.empty()) {
+      mpi_->sSend(ids_.data(), ids_.size(), IMPIWrapper::getDataType(ids_.data()), 0, tagIds);
+      mpi_->sSend(vectors_.data(), vectors_.size(), IMPIWrapper::getDataType(vectors_.data()), 0, tagVectors);
+    }
+    ids_.clear();
+    vectors_.clear();
+    return;
+  }
+
+  for(size_t rank = 1; rank < mpi_->numMPIProcesses(); ++rank) {
+    size_t sizes[2];
+    mpi_->recv(sizes, 2, IMPIWrapper::getDataType(sizes), rank, tagSizes);
+    std::vector<size_t> ids(sizes[0]);
+    std::vector<float> vectors(sizes[0] * sizes[1]);
+    if(!ids.empty()) {
+      mpi_->recv(ids.data(), ids.size(), IMPIWrapper::getDataType(ids.data()), rank, tagIds);
+      mpi_->recv(vectors.data(), vectors.size(), IMPIWrapper::getDataType(vectors.data()), rank, tagVectors);
+    }
+    for(size_t i = 0; i < ids.size(); ++i)
+      collector_->Write((long)ids[i],
+                        std::vector<float>(vectors.begin() + i * sizes[1], vectors.begin() + (i + 1) * sizes[1]));
+  }
+}
+
 Ptr<VectorCollector> VectorCollector::Create(Ptr<Options> options) {
   std::string average = options->get<std::string>("average", "skip");
   std::string output  = options->get<std::string>("output");
   size_t width        = options->get<size_t>("width", VectorCollector::DEFAULT_WIDTH);
+  size_t shards       = options->get<size_t>("output-shards", 1);
+  bool unordered      = options->get<bool>("output-unordered", false);
+
+  // --binary is the older name of --output-format fp32
+  Format format = formatFromString(options->get<std::string>("output-format", "text"));
+  if(options->get<bool>("binary", false))
+    format = Format::fp32;
 
   Ptr<VectorCollector> collector;
-  if(average == "skip")
-    collector = New<VectorCollector>(output, /*binary=*/false, width);
+  if(average != "skip")
+    ABORT_IF(shards > 1 || unordered || format != Format::text,
+             "Averaging is only available with ordered text output");
+
+  if(shards > 1)
+    collector = New<ShardedVectorCollector>(output, format, shards, width);
+  else if(unordered)
+    collector = New<UnorderedVectorCollector>(output, format, width);
+  else if(average == "skip")
+    collector = New<VectorCollector>(output, format, width);
   else if(average == "append")
     collector = New<AveragingVectorCollector>(output, /*binary=*/false, width, /*onlyLast=*/false);
   else if(average == "only")
@@ -9,16 +9,23 @@
 
 namespace marian {
 
+class IMPIWrapper;
+
 // This class manages multi-threaded writing of embedded vectors to stdout or an output file.
 // It will either output string versions of float vectors or binary equal length versions depending
-// on its binary flag. If binary=false, width can be used to set the number of decimal places.
+// on its format. For text, width can be used to set the number of decimal places.
 class VectorCollector {
 public:
   static const size_t DEFAULT_WIDTH;
 
+  // text: one line per vector, fp32/fp16: raw little-endian floats, npy: a [vectors, dim] float32 numpy array
+  enum class Format { text, fp32, fp16, npy };
+  static Format formatFromString(const std::string& format);
+
   VectorCollector(bool binary=false, size_t width=DEFAULT_WIDTH);
   VectorCollector(std::string outFile, bool binary=false, size_t width=DEFAULT_WIDTH);
-  virtual ~VectorCollector() {}
+  VectorCollector(std::string outFile, Format format, size_t width=DEFAULT_WIDTH);
+  virtual ~VectorCollector();
   
   virtual void Write(long id, const std::vector<float>& vec);
 
@@ -27,15 +34,69 @@ public:
 protected:
   long nextId_{0};
   UPtr<std::ostream> outStrm_;
-  bool binary_; // output binary floating point vectors if set
+  Format format_{Format::text};
   size_t width_{DEFAULT_WIDTH};
 
+  size_t numVectors_{0}; // for the npy header
+  size_t dimVector_{0};
+
   std::mutex mutex_;
 
   typedef std::map<long, std::vector<float>> Outputs;
   Outputs outputs_;
 
   virtual void WriteVector(const std::vector<float>& vec);
+
+  // A fixed-size header, so that it can be rewritten with the final shape once all vectors are written
+  static void WriteNpyHeader(std::ostream& out, const std::string& descr, size_t rows, size_t cols);
+  static void RewriteNpyHeader(std::ostream& out, const std::string& descr, size_t rows, size_t cols);
+};
+
+// Writes every vector as soon as it arrives instead of in the order of the sentence ids, which are written to
+// the sidecar file <outFile>.ids in the same format (one per line for text, uint64 for fp32/fp16, int64 npy array
+// for npy). Reading both files recovers the order, writing never waits for earlier sentences.
+class UnorderedVectorCollector : public VectorCollector {
+private:
+  UPtr<std::ostream> idsStrm_;
+  size_t numIds_{0};
+
+public:
+  UnorderedVectorCollector(std::string outFile, Format format, size_t width=DEFAULT_WIDTH);
+  virtual ~UnorderedVectorCollector();
+
+  virtual void Write(long id, const std::vector<float>& vec) override;
+};
+
+// Writes sentence i to the unordered shard i % numShards, <outFile> with .0, .1, ... inserted before the extension,
+// so that threads rarely write to the same file at the same time.
+class ShardedVectorCollector : public VectorCollector {
+private:
+  std::vector<Ptr<UnorderedVectorCollector>> shards_;
+
+public:
+  ShardedVectorCollector(std::string outFile, Format format, size_t numShards, size_t width=DEFAULT_WIDTH);
+
+  virtual void Write(long id, const std::vector<float>& vec) override;
+};
+
+// Runs with several MPI processes hand their vectors to the collector of the main process: the main process writes
+// its own vectors to it right away, the others keep theirs until gather() sends them to the main process, where they
+// are written in the order of their sentence ids like all others.
+class GatheringVectorCollector : public VectorCollector {
+private:
+  Ptr<IMPIWrapper> mpi_;
+  Ptr<VectorCollector> collector_; // only on the main process
+  std::vector<size_t> ids_;
+  std::vector<float> vectors_;
+  size_t dimVectors_{0};
+
+public:
+  GatheringVectorCollector(Ptr<IMPIWrapper> mpi, Ptr<VectorCollector> collector);
+
+  virtual void Write(long id, const std::vector<float>& vec) override;
+
+  // Collective, to be called by all processes after they have written all of their vectors
+  void gather();
 };
 
 // Add a running summation of vector elements and outputs the average vector on destruction.
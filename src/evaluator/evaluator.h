@@ -4,14 +4,18 @@
 
 #include "common/config.h"
 #include "common/options.h"
+#include "data/batch_fit.h"
 #include "data/batch_generator.h"
 #include "data/corpus.h"
 #include "data/corpus_nbest.h"
 #include "models/costs.h"
+#include "models/comet_qe.h"
 #include "models/model_task.h"
 #include "embedder/vector_collector.h"
+#include "training/communicator.h"
 #include "training/scheduler.h"
 #include "training/validator.h"
+#include "translator/output_collector.h"
 
 namespace marian {
 
@@ -38,6 +42,30 @@ public:
     ABORT_IF(!evaluator, "Could not cast to EncoderPooler");
     return evaluator->apply(graph, batch, /*clearGraph=*/true)[0];
   }
+
+  // Sentence embeddings of the sources in the first and the candidates in the second stream of the batch
+  std::tuple<Expr, Expr> embed(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch) {
+    auto evaluator = std::dynamic_pointer_cast<EncoderPooler>(model_);
+    ABORT_IF(!evaluator, "Could not cast to EncoderPooler");
+    evaluator->clear(graph);
+
+    auto& encoders = evaluator->getEncoders();
+    ABORT_IF(encoders.size() < 2, "MBR decoding requires a model with a source and a translation encoder");
+    auto src = encoders[0]->build(graph, batch)->getContext();
+    auto mt  = encoders[1]->build(graph, batch)->getContext();
+    return std::make_tuple(src, mt);
+  }
+
+  // Expected utilities of the candidates from their embeddings, see CometMetricPooler::mbrUtilities()
+  Expr mbrUtilities(Ptr<ExpressionGraph> graph, Expr src, Expr mt, int numCandidates) {
+    auto evaluator = std::dynamic_pointer_cast<EncoderPooler>(model_);
+    ABORT_IF(!evaluator, "Could not cast to EncoderPooler");
+    evaluator->clear(graph);
+
+    auto pooler = std::dynamic_pointer_cast<models::CometMetricPooler>(evaluator->getPoolers()[0]);
+    ABORT_IF(!pooler, "MBR decoding is only implemented for COMET models");
+    return pooler->mbrUtilities(graph, src, mt, numCandidates);
+  }
 };
 
 /*
@@ -46,11 +74,36 @@ public:
 template <class Model>
 class Evaluate : public ModelTask {
 private:
+  // handle copying from fp32 or fp16 values correctly.
+  static std::vector<float> getValues(Expr values) {
+    std::vector<float> out;
+    if(values->value_type() == Type::float32) {
+      values->val()->get(out);
+    } else if (values->value_type() == Type::float16) {
+      std::vector<float16> out16;
+      values->val()->get(out16);
+      out.reserve(out16.size());
+      for(auto& v: out16)
+        out.push_back(v);
+    } else {
+      ABORT("Unknown value type {}", values->value_type());
+    }
+    return out;
+  }
+
+  static Words sentenceWords(Ptr<SubBatch> subBatch, size_t row) {
+    Words words;
+    for(size_t j = 0; j < subBatch->batchWidth() && subBatch->mask()[subBatch->locate(row, j)] != 0; ++j)
+      words.push_back(subBatch->data()[subBatch->locate(row, j)]);
+    return words;
+  }
+
   Ptr<Options> options_;
 
   std::vector<Ptr<ExpressionGraph>> graphs_;
   std::vector<Ptr<Model>> models_;
   Ptr<io::ModelWeights> modelWeights_;
+  Ptr<IMPIWrapper> mpi_; // every MPI process evaluates every numMPIProcesses()-th batch
 
 public:
   Evaluate(Ptr<Options> options) : options_(options) {
@@ -62,9 +115,19 @@ public:
       Corpus initializer is the one that sets the number of embeddings into options_ object.
       However, we do not need to use corpus object here, so we just create a dummy corpus object.
     */
+    // with --mbr the input is a source and a candidate per line whatever the --like preset says
+    if(options_->get<size_t>("mbr", 0) > 0) {
+      options_ = options_->with("tsv-fields", 2,
+                                "input-types", std::vector<std::string>({"sequence", "sequence"}));
+      auto vocabs = options_->get<std::vector<std::string>>("vocabs", {});
+      if(vocabs.size() > 2)
+        options_ = options_->with("vocabs", std::vector<std::string>(vocabs.begin(), vocabs.begin() + 2));
+    }
+
     Ptr<CorpusBase> corpus = New<Corpus>(options_);
 
-    auto devices = Config::getDevices(options_);
+    mpi_ = initMPI(/*multiThreaded=*/false);
+    auto devices = Config::getDevices(options_, mpi_->myMPIRank(), mpi_->numMPIProcesses());
 
     auto modelPath = options_->get<std::string>("model");
     LOG(info, "Loading model from {}", modelPath);
@@ -82,6 +145,13 @@ public:
             auto precison  = options_->get<std::vector<std::string>>("precision", {"float32"});
             graph->setDefaultElementType(typeFromString(precison[0])); // only use first type, used for parameter type in graph
             graph->setDevice(devices[j]);
+            // on-line packing of the float32 weights, models converted by marian-conv are packed already
+            if(devices[j].type == DeviceType::cpu) {
+              graph->getBackend()->setOptimized(options_->get<bool>("optimize", false));
+              graph->getBackend()->setGemmType(options_->get<std::string>("gemm-type", "float32"));
+              graph->getBackend()->setQuantizeRange(options_->get<float>("quantize-range", 0.f));
+              graph->getBackend()->setIntraOpThreads(options_->get<size_t>("cpu-intra-op-threads", 1));
+            }
             graph->reserveWorkspaceMB(options_->get<int>("workspace"));
 
             auto model = New<Model>(options_);
@@ -94,28 +164,53 @@ public:
     }
   }
 
+  ~Evaluate() { finalizeMPI(std::move(mpi_)); }
+
   void run() override {
     LOG(info, "Evaluating");
     timer::Timer timer;
 
     Ptr<CorpusBase> corpus = New<Corpus>(options_);
     corpus->prepare();
-    auto batchGenerator = New<BatchGenerator<CorpusBase>>(corpus, options_);
+
+    // MBR batches are sized by their groups of candidates, not by the fitted statistics
+    Ptr<BatchStats> stats;
+    if(options_->get<bool>("mini-batch-fit", false) && options_->get<size_t>("mbr", 0) == 0) {
+      LOG(info, "[batching] Collecting statistics for batch fitting");
+      stats = collectInferenceStats(graphs_[0], models_[0], corpus->getVocabs(), options_);
+    }
+    auto batchGenerator = New<BatchGenerator<CorpusBase>>(corpus, options_, stats);
     batchGenerator->prepare();
 
-    Ptr<VectorCollector> output = VectorCollector::Create(options_);
-    run(batchGenerator, output);
+    if(options_->get<size_t>("mbr", 0) > 0) {
+      ABORT_IF(mpi_->numMPIProcesses() > 1, "--mbr cannot be used with several MPI processes");
+      auto output = New<OutputCollector>(options_->get<std::string>("output"));
+      output->setPrintingStrategy(New<QuietPrinting>());
+      runMbr(batchGenerator, output);
+    } else {
+      // only the main process writes the output, the scores of the others are gathered into it
+      Ptr<VectorCollector> output = mpi_->isMainProcess() ? VectorCollector::Create(options_) : nullptr;
+      Ptr<GatheringVectorCollector> gathering;
+      if(mpi_->numMPIProcesses() > 1)
+        output = gathering = New<GatheringVectorCollector>(mpi_, output);
+      run(batchGenerator, output);
+      if(gathering)
+        gathering->gather();
+    }
     LOG(info, "Total time: {:.5f}s wall", timer.elapsed());
   }
 
   template <typename T>
   void run(Ptr<BatchGenerator<T>> batchGenerator,  Ptr<VectorCollector> collector) {
 
-    size_t batchId = 0;
+    size_t batchId = 0, batchNo = 0;
     {
       ThreadPool pool(graphs_.size(), graphs_.size());
 
       for(auto batch : *batchGenerator) {
+        if(batchNo++ % mpi_->numMPIProcesses() != mpi_->myMPIRank())
+          continue; // evaluated by another MPI process
+
         auto task = [=](size_t id) {
           thread_local Ptr<ExpressionGraph> graph;
           thread_local Ptr<Model> builder;
@@ -128,19 +223,7 @@ public:
           auto scores = builder->build(graph, batch);
           graph->forward();
 
-          // handle copying from fp32 or fp16 scores correctly.
-          std::vector<float> sentVectors;
-          if(scores->value_type() == Type::float32) {
-            scores->val()->get(sentVectors);
-          } else if (scores->value_type() == Type::float16) {
-            std::vector<float16> sentVectors16;
-            scores->val()->get(sentVectors16);
-            sentVectors.reserve(sentVectors16.size());
-            for(auto& v: sentVectors16)
-              sentVectors.push_back(v);
-          } else {
-            ABORT("Unknown value type {}", scores->value_type());
-          }
+          std::vector<float> sentVectors = getValues(scores);
 
           // collect embedding vector per sentence.
           // if we compute similarities this is only one similarity per sentence pair.
@@ -158,6 +241,113 @@ public:
     }
   }
 
+  /*
+   * Minimum Bayes risk decoding with --mbr N: every source is followed by N candidate translations in the input, e.g.
+   * from marian-decoder --output-sampling, and the candidate with the highest mean COMET score when all N candidates
+   * are used as references is selected. Sources and candidates are encoded once each and the embeddings of a source
+   * are cached until all of its candidates have been encoded, possibly in other batches, then the N x N scores are
+   * computed together from the embeddings. Prints "id \t best index \t expected utility \t best candidate".
+   */
+  void runMbr(Ptr<BatchGenerator<CorpusBase>> batchGenerator, Ptr<OutputCollector> collector) {
+    struct Group {
+      std::vector<float> source;
+      std::vector<float> candidates; // [N, dimModel]
+      std::vector<std::string> texts;
+      size_t encoded{0};
+    };
+
+    int numCandidates = (int)options_->get<size_t>("mbr");
+    size_t width = options_->get<size_t>("width", 4);
+
+    std::mutex mutex;
+    std::map<size_t, Group> groups; // groups whose candidates are not all encoded yet
+
+    size_t batchId = 0;
+    {
+      ThreadPool pool(graphs_.size(), graphs_.size());
+
+      for(auto batch : *batchGenerator) {
+        auto task = [=, &mutex, &groups](size_t id) {
+          thread_local Ptr<ExpressionGraph> graph;
+          thread_local Ptr<Model> builder;
+
+          if(!graph) {
+            graph = graphs_[id % graphs_.size()];
+            builder = models_[id % graphs_.size()];
+          }
+
+          // encode every source only once even though it is repeated for each of its candidates
+          const auto& sentenceIds = batch->getSentenceIds();
+          std::vector<size_t> sourceRows, sourceGroups;
+          for(size_t i = 0; i < batch->size(); ++i) {
+            size_t group = sentenceIds[i] / numCandidates;
+            if(std::find(sourceGroups.begin(), sourceGroups.end(), group) == sourceGroups.end()) {
+              sourceRows.push_back(i);
+              sourceGroups.push_back(group);
+            }
+          }
+
+          auto candidates = (*batch)[1];
+          auto sources = (*batch)[0]->select(sourceRows);
+          auto embeddings = builder->embed(graph, New<CorpusBatch>(std::vector<Ptr<SubBatch>>({sources, candidates})));
+          graph->forward();
+
+          int dimModel = std::get<1>(embeddings)->shape()[-1];
+          std::vector<float> srcVectors = getValues(std::get<0>(embeddings));
+          std::vector<float> mtVectors  = getValues(std::get<1>(embeddings));
+
+          std::vector<std::pair<size_t, Group>> complete;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(size_t i = 0; i < sourceGroups.size(); ++i) {
+              auto& group = groups[sourceGroups[i]];
+              if(group.texts.empty()) {
+                group.candidates.resize((size_t)numCandidates * dimModel);
+                group.texts.resize(numCandidates);
+              }
+              group.source.assign(srcVectors.begin() + i * dimModel, srcVectors.begin() + (i + 1) * dimModel);
+            }
+
+            for(size_t i = 0; i < batch->size(); ++i) {
+              auto& group = groups[sentenceIds[i] / numCandidates];
+              size_t k = sentenceIds[i] % numCandidates;
+              std::copy(mtVectors.begin() + i * dimModel, mtVectors.begin() + (i + 1) * dimModel,
+                        group.candidates.begin() + k * dimModel);
+              group.texts[k] = candidates->vocab()->decode(sentenceWords(candidates, i));
+              group.encoded++;
+            }
+
+            for(auto g : sourceGroups) {
+              if(groups[g].encoded == (size_t)numCandidates) {
+                complete.emplace_back(g, std::move(groups[g]));
+                groups.erase(g);
+              }
+            }
+          }
+
+          for(auto& [g, group] : complete) {
+            auto type = graph->getDefaultElementType();
+            auto src = graph->constant({1, 1, dimModel}, inits::fromVector(group.source), Type::float32);
+            auto mt  = graph->constant({numCandidates, 1, dimModel}, inits::fromVector(group.candidates), Type::float32);
+            auto utilities = builder->mbrUtilities(graph, marian::cast(src, type), marian::cast(mt, type), numCandidates);
+            graph->forward();
+
+            std::vector<float> expected = getValues(utilities);
+            size_t best = std::max_element(expected.begin(), expected.end()) - expected.begin();
+            collector->Write((long)g,
+                             fmt::format("{}\t{}\t{:.{}f}\t{}", g, best, expected[best], width, group.texts[best]),
+                             "",
+                             false);
+          }
+        };
+
+        pool.enqueue(task, batchId++);
+      }
+    }
+
+    ABORT_IF(!groups.empty(), "The input does not have --mbr {} candidates for every source", numCandidates);
+  }
+
   std::string getModelConfig() {
     ABORT_IF(!modelWeights_, "Model weights are not loaded");
     YAML::Emitter outYaml;
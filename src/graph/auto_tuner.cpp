@@ -0,0 +1,122 @@
+#include "graph/auto_tuner.h"
+#include "common/file_stream.h"
+#include "common/filesystem.h"
+#include "common/logging.h"
+#include "common/utils.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace marian {
+
+AutoTunerCache::AutoTunerCache(const std::string& path, const std::string& model)
+    : path_(path), prefix_(hardware() + "\t" + model + "\t") {
+  if(path_.empty() || !filesystem::exists(path_))
+    return;
+  io::InputFileStream in(path_);
+  std::string line;
+  size_t lines = 0;
+  while(io::getline(in, line)) {
+    if(line.compare(0, prefix_.size(), prefix_) != 0)
+      continue;
+    auto fields = utils::split(line.substr(prefix_.size()), "\t", /*keepEmpty=*/true);
+    if(fields.size() != 3)
+      continue;
+    decisions_[fields[0] + "\t" + fields[1]] = fields[2]; // the last decision wins
+    lines++;
+  }
+  LOG(info, "[autotune] Loaded {} decisions for this hardware and model from {}", lines, path_);
+}
+
+std::string AutoTunerCache::hardware() {
+  std::string model = "unknown-cpu";
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while(std::getline(cpuinfo, line)) {
+    if(line.compare(0, 10, "model name") == 0) {
+      auto colon = line.find(':');
+      if(colon != std::string::npos) {
+        model = line.substr(colon + 1);
+        utils::trim(model);
+      }
+      break;
+    }
+  }
+  std::replace(model.begin(), model.end(), '\t', ' ');
+  return model;
+}
+
+std::string AutoTunerCache::modelKey(const std::vector<std::string>& modelPaths) {
+  std::vector<std::string> models;
+  for(const auto& path : modelPaths)
+    models.push_back(filesystem::Path(path).filename().string() + ":"
+                     + std::to_string(filesystem::exists(path) ? filesystem::fileSize(path) : 0));
+  return utils::join(models, ",");
+}
+
+bool AutoTunerCache::get(const std::string& tuner, const std::string& key, std::string& variant) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = decisions_.find(tuner + "\t" + key);
+  if(it == decisions_.end())
+    return false;
+  variant = it->second;
+  return true;
+}
+
+void AutoTunerCache::put(const std::string& tuner, const std::string& key, const std::string& variant) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  decisions_[tuner + "\t" + key] = variant;
+  if(path_.empty())
+    return;
+  std::ofstream out(path_, std::ios::app);
+  if(!out)
+    LOG_ONCE(warn, "[autotune] Cannot append to {}, decisions are not kept", path_);
+  else
+    out << prefix_ << tuner << "\t" << key << "\t" << variant << "\n";
+}
+
+VariantTuner::Choice VariantTuner::choose(const std::string& key) {
+  auto decided = decided_.find(key);
+  if(decided != decided_.end())
+    return {decided->second, false};
+
+  auto it = exploring_.find(key);
+  if(it == exploring_.end()) {
+    // decided by an earlier run or another graph
+    std::string cached;
+    if(cache_ && cache_->get(name_, key, cached)) {
+      auto variant = std::find(variants_.begin(), variants_.end(), cached);
+      if(variant != variants_.end())
+        return {decided_[key] = variant - variants_.begin(), false};
+    }
+    Exploration exploration;
+    exploration.runs.assign(variants_.size(), 0);
+    exploration.best.assign(variants_.size(), std::numeric_limits<double>::max());
+    it = exploring_.emplace(key, exploration).first;
+  }
+
+  // round robin over the variants, so that all see the same conditions
+  auto& runs = it->second.runs;
+  size_t next = std::min_element(runs.begin(), runs.end()) - runs.begin();
+  return {next, true};
+}
+
+void VariantTuner::record(const std::string& key, size_t variant, double seconds) {
+  auto it = exploring_.find(key);
+  if(it == exploring_.end())
+    return;
+  auto& exploration = it->second;
+  exploration.runs[variant]++;
+  exploration.best[variant] = std::min(exploration.best[variant], seconds);
+  if(*std::min_element(exploration.runs.begin(), exploration.runs.end()) < runsPerVariant_)
+    return;
+
+  size_t best = std::min_element(exploration.best.begin(), exploration.best.end()) - exploration.best.begin();
+  decided_[key] = best;
+  exploring_.erase(it);
+  LOG(debug, "[autotune] {} {}: {}", name_, key, variants_[best]);
+  if(cache_)
+    cache_->put(name_, key, variants_[best]);
+}
+
+}  // namespace marian
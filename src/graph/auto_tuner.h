@@ -1,14 +1,79 @@
 #pragma once
 
+#include "common/definitions.h"
 #include "common/timer.h"
 
 #include <chrono>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace marian {
 
+/**
+ * Decisions of auto-tuners that persist across runs, see --autotune-cache. The file has one line per decision:
+ * hardware, model, tuner, key and the chosen variant, separated by tabs. Only the lines of this hardware and model
+ * are used, so that one file can be shared by hosts and models. New decisions are appended right away. An empty
+ * path keeps the decisions of the running process only.
+ */
+class AutoTunerCache {
+public:
+  AutoTunerCache(const std::string& path, const std::string& model);
+
+  // The CPU model of this host, e.g. from /proc/cpuinfo
+  static std::string hardware();
+  // The file names and sizes of the models
+  static std::string modelKey(const std::vector<std::string>& modelPaths);
+
+  bool get(const std::string& tuner, const std::string& key, std::string& variant) const;
+  void put(const std::string& tuner, const std::string& key, const std::string& variant);
+
+private:
+  std::string path_;
+  std::string prefix_; // hardware and model
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::string> decisions_; // tuner and key -> variant
+};
+
+/**
+ * Chooses per key, e.g. a GEMM shape, the fastest of a fixed set of variants of an operation that the caller runs
+ * and times itself. Every variant is timed on the first calls of a key and the one with the shortest run wins, which
+ * is kept in the cache if there is one. Not thread-safe, every graph has its own tuners.
+ */
+class VariantTuner {
+public:
+  struct Choice {
+    size_t variant;
+    bool explore; // time the run and record() it
+  };
+
+  VariantTuner(const std::string& name,
+               const std::vector<std::string>& variants,
+               Ptr<AutoTunerCache> cache,
+               size_t runsPerVariant = 5)
+      : name_(name), variants_(variants), cache_(cache), runsPerVariant_(runsPerVariant) {}
+
+  Choice choose(const std::string& key);
+  void record(const std::string& key, size_t variant, double seconds);
+
+private:
+  struct Exploration {
+    std::vector<size_t> runs;
+    std::vector<double> best; // shortest run per variant
+  };
+
+  std::string name_;
+  std::vector<std::string> variants_;
+  Ptr<AutoTunerCache> cache_;
+  size_t runsPerVariant_;
+  std::unordered_map<std::string, size_t> decided_;
+  std::unordered_map<std::string, Exploration> exploring_;
+};
+
 class AutoTunerRecorder {
 public:
   virtual void start(size_t hash) = 0;
@@ -66,6 +66,8 @@ public:
   virtual void allocate() = 0;
   virtual void free() = 0;
   virtual void init() = 0;
+  virtual void resetVal() = 0; // drops the value without freeing it, e.g. after the graph was cleared
+  virtual bool isView() = 0;   // true if the value is a view of the memory of another node
   virtual void init_dependent() {}
   virtual void set_zero_adjoint() {}
 
@@ -109,6 +111,7 @@ public:
   virtual void record(Ptr<AutoTunerRecorder>, size_t, bool) = 0;
 
   virtual void markCheckpoint() = 0;
+  virtual void unmarkCheckpoint() = 0;
   virtual bool isCheckpoint() const = 0;
   virtual void setSubtape(Ptr<std::list<Expr>>) = 0;
   virtual Ptr<std::list<Expr>> getSubtape() = 0;
@@ -1,6 +1,11 @@
 #include "graph/expression_graph.h"
+#include "graph/node_operators_binary.h"
+#include "graph/node_operators_unary.h"
 #include "tensors/tensor_operators.h"
 
+#include <algorithm>
+#include <functional>
+#include <limits>
 #include <sstream>
 
 namespace marian {
@@ -99,7 +104,14 @@ void ExpressionGraph::forwardNext() {
   // @TODO: check if allocation works properly
   tensors_->clearShorttermMemory();
 
+  auto profiler = tensors_->getMemoryProfiler();
+  if(profiler && !profiler->beginPass("forward"))
+    tensors_->setMemoryProfiler(nullptr);
+  if(nodeProfiler_ && !nodeProfiler_->beginPass("forward"))
+    nodeProfiler_ = nullptr;
+
   if(checkpointing_) {
+    applyCheckpointPolicy();
     for(auto top : topNodes_)
       top->markCheckpoint();
 
@@ -121,22 +133,122 @@ void ExpressionGraph::forwardNext() {
         top->getSubtape()->clear();
       }
     }
+
+    collectCheckpointingStatistics();
+  }
+
+  ABORT_IF(parameterShards_ && checkpointing_, "Sharded parameters and gradient checkpointing cannot be combined");
+
+  if(!inferenceOnly_ && offloading_) {
+    ABORT_IF(checkpointing_, "Activation offloading and gradient checkpointing cannot be combined");
+    planOffloads();
   }
 
+  if(inferenceOnly_ && simplification_)
+    simplify();
+  if(inferenceOnly_ && elementwiseFusion_)
+    fuseElementwise();
+
   forward(nodesForward_, /*finalPass=*/!checkpointing_); // if checkPointing, this is not final
 }
 
+// The key of a memoized value for SharedValues: the hash of the node, which is the same in all graphs if the parameters
+// it is computed from are shared, and the memory of its children
+static size_t sharedKey(const Expr& v) {
+  size_t key = v->hash();
+  for(auto& child : v->children())
+    util::hash_combine(key, (size_t)child->val()->data<char>());
+  return key;
+}
+
+// The parameters that v reads, also through views
+static void paramsReadBy(const Expr& v, std::vector<Expr>& params) {
+  params.clear();
+  for(auto& child : v->children()) {
+    Expr root = child;
+    while(root->isView() && root->children().size() == 1)
+      root = root->children()[0];
+    if(root->type() == "param" && std::find(params.begin(), params.end(), root) == params.end())
+      params.push_back(root);
+  }
+}
+
+void ExpressionGraph::gatherParam(const Expr& param) {
+  if(!gatheredParams_.insert({param.get(), param}).second)
+    return;
+  if(!parameterShards_->owns(param))
+    allocateForward(param);
+  parameterShards_->gather(param, param->val());
+}
+
+void ExpressionGraph::releaseParam(Expr param) {
+  if(gatheredParams_.erase(param.get()) == 0 || parameterShards_->owns(param))
+    return;
+  free(param->val());
+  param->val() = nullptr;
+}
+
 void ExpressionGraph::forward(std::list<Expr>& forwardTape, bool finalPass) {
+  // debug output reads values in between, so such tapes run as usual
+  if(inferenceOnly_ && backend_->getCudaGraphs() > 0 && !throwNaN_
+     && std::none_of(forwardTape.begin(), forwardTape.end(), [](const Expr& v) { return v->marked_for_debug(); })) {
+    forwardCaptured(forwardTape);
+    return;
+  }
+
+  auto planner = inferenceOnly_ ? tensors_->getMemoryPlanner() : nullptr;
+  if(planner)
+    planner->begin(tapeKey(forwardTape), tensors_->getAllocator());
+
+  // sharded parameters are gathered for the first node that reads them and released after the last one
+  std::vector<Expr> params;
+  std::unordered_map<Chainable<Tensor>*, std::vector<Expr>> releaseAfter;
+  if(parameterShards_) {
+    std::unordered_map<Chainable<Tensor>*, std::pair<Expr, Expr>> lastReader; // of each parameter
+    for(auto& v : forwardTape) {
+      paramsReadBy(v, params);
+      for(auto& param : params)
+        lastReader[param.get()] = {param, v};
+    }
+    for(auto& kv : lastReader)
+      releaseAfter[kv.second.second.get()].push_back(kv.second.first);
+  }
+
+  size_t step = 0;
   while(!forwardTape.empty()) {
     auto v = forwardTape.front();
 
-    v->allocate();
+    if(parameterShards_) {
+      if(v->type() == "param" && !parameterShards_->owns(v)) { // initialized by its owner, gathered when read
+        forwardTape.pop_front();
+        continue;
+      }
+      paramsReadBy(v, params);
+      for(auto& param : params)
+        gatherParam(param);
+    }
+
+    if(planner)
+      planner->setStep(step++);
+    // memoized values, e.g. packed parameters, are computed by the first graph that shares them
+    bool shared = sharedValues_ && v->memoize() && v->type() != "param" && !v->isView() && !v->val();
+    if(shared)
+      v->val() = TensorBase::New(nullptr, v->shape(), v->value_type(), backend_);
+    else
+      v->allocate();
     v->init();
 
     for(auto& child : v->children())
       ABORT_IF(!child->val(), "De-allocated child {} {} of {} {}", child->getId(), child->type(), v->getId(), v->type());
 
-    v->forward();
+    if(nodeProfiler_)
+      nodeProfiler_->begin();
+    if(shared)
+      sharedValues_->share(sharedKey(v), v->val(), [&v](Tensor) { v->forward(); });
+    else
+      v->forward();
+    if(nodeProfiler_)
+      nodeProfiler_->end(v.get());
 
     if(v->trainable() && throwNaN_) {
       bool isNaN = false, isInf = false;
@@ -165,8 +277,18 @@ void ExpressionGraph::forward(std::list<Expr>& forwardTape, bool finalPass) {
       }
     }
 
-    if(inferenceOnly_)
+    if(inferenceOnly_) {
       v->children().clear();
+      freeConsumed(v);
+    }
+
+    if(!offloadAfter_.empty() || offloadsFreed_ < offloads_.size())
+      offloadConsumed(v);
+
+    auto released = releaseAfter.find(v.get());
+    if(released != releaseAfter.end())
+      for(auto& param : released->second)
+        releaseParam(param);
 
     // If checkpointing is disabled, keep the memory for forward signals for all nodes.
     // If checkpointing is enabled:
@@ -184,6 +306,445 @@ void ExpressionGraph::forward(std::list<Expr>& forwardTape, bool finalPass) {
 
     forwardTape.pop_front();
   }
+
+  if(planner)
+    planner->end();
+}
+
+// Identifies the operations of a tape, their shapes and how they are connected, and how many references each node
+// has, which includes those from outside the tape that keep values alive beyond the pass.
+size_t ExpressionGraph::tapeKey(std::list<Expr>& forwardTape) {
+  std::unordered_map<Chainable<Tensor>*, size_t> positions;
+  size_t key = 0;
+  for(auto& v : forwardTape) {
+    util::hash_combine(key, v->type());
+    util::hash_combine(key, (size_t)v->value_type());
+    for(auto d : v->shape())
+      util::hash_combine(key, d);
+    util::hash_combine(key, v->memoize());
+    util::hash_combine(key, v.useCount());
+    for(auto& child : v->children()) {
+      auto it = positions.find(child.get());
+      util::hash_combine(key, it != positions.end() ? it->second : positions.size() + forwardTape.size());
+    }
+    size_t position = positions.size();
+    positions[v.get()] = position;
+  }
+  return key;
+}
+
+void ExpressionGraph::forwardCaptured(std::list<Expr>& forwardTape) {
+  // Allocate and initialize all nodes first, so that their forward() calls only enqueue kernels. The key identifies
+  // these kernels by the operations, shapes and memory of the nodes and their children, and by the free memory of
+  // the workspace, where the temporaries of the kernels come from. Scalar arguments of the operations are not part
+  // of it, they do not change between the decoder steps that would share a key.
+  size_t key = 0;
+  for(auto& v : forwardTape) {
+    v->allocate();
+    v->init();
+
+    util::hash_combine(key, v->type());
+    util::hash_combine(key, v->name());
+    util::hash_combine(key, (size_t)v->value_type());
+    for(auto d : v->shape())
+      util::hash_combine(key, d);
+    util::hash_combine(key, (size_t)v->val()->memory()->data());
+    for(auto& child : v->children()) {
+      ABORT_IF(!child->val(), "De-allocated child {} {} of {} {}", child->getId(), child->type(), v->getId(), v->type());
+      util::hash_combine(key, (size_t)child->val()->memory()->data());
+    }
+  }
+
+  util::hash_combine(key, tensors_->getAllocator()->hash());
+
+  backend_->runForward(key, [&](bool capturing) {
+    // temporaries must not move the workspace while capturing, the backend falls back to running without
+    tensors_->throwAtReallocation(capturing);
+    for(auto& v : forwardTape)
+      v->forward();
+    tensors_->throwAtReallocation(false);
+  });
+
+  for(auto& v : forwardTape) {
+    v->children().clear();
+    freeConsumed(v);
+  }
+  forwardTape.clear();
+}
+
+void ExpressionGraph::fuseElementwise() {
+  ABORT_IF(!inferenceOnly_, "Elementwise fusion is only supported in inference");
+  const int dims = FusedElementArgs::DIMS;
+
+  // how often each node is a child on the tape and the one node that reads it, if there is only one
+  std::unordered_map<Chainable<Tensor>*, size_t> uses;
+  std::unordered_map<Chainable<Tensor>*, Chainable<Tensor>*> consumer;
+  std::unordered_map<Chainable<Tensor>*, FusedInstruction> instructions;
+  for(auto& v : nodesForward_) {
+    for(auto& child : v->children()) {
+      uses[child.get()]++;
+      auto it = consumer.find(child.get());
+      if(it == consumer.end())
+        consumer[child.get()] = v.get();
+      else if(it->second != v.get())
+        it->second = nullptr;
+    }
+
+    auto nary = dynamic_cast<NaryNodeOp*>(v.get());
+    if(!nary || v->memoize() || v->marked_for_debug() || v->isView() || v->value_type() != Type::float32
+       || v->shape().size() > dims)
+      continue;
+    if(std::any_of(v->children().begin(), v->children().end(), [&](const Expr& child) {
+         return child->value_type() != Type::float32 || child->shape().size() > dims;
+       }))
+      continue;
+    FusedInstruction instr;
+    if(nary->fusedInstruction(instr))
+      instructions[v.get()] = instr;
+  }
+
+  // fused into their consumer: elementwise nodes that are only referenced by the tape and by one elementwise node
+  std::unordered_set<Chainable<Tensor>*> absorbed;
+  for(auto& v : nodesForward_) {
+    auto it = consumer.find(v.get());
+    if(instructions.count(v.get()) > 0 && it != consumer.end() && it->second && instructions.count(it->second) > 0
+       && v.useCount() == 1 + uses[v.get()])
+      absorbed.insert(v.get());
+  }
+  if(absorbed.empty())
+    return;
+
+  std::list<Expr> tape; // still with the absorbed nodes, which stay if their chain cannot be fused
+  std::unordered_set<Chainable<Tensor>*> removed;
+  for(auto& v : nodesForward_) {
+    if(absorbed.count(v.get()) > 0 || instructions.count(v.get()) == 0) {
+      tape.push_back(v);
+      continue;
+    }
+
+    // v is the last node of a chain, the inputs of the chain come first, then one instruction per fused node
+    std::vector<Expr> inputs;
+    std::unordered_map<Chainable<Tensor>*, size_t> slots;
+    std::vector<Chainable<Tensor>*> chain;
+    std::function<void(const Expr&)> collect = [&](const Expr& node) {
+      for(auto& child : node->children()) {
+        if(slots.count(child.get()) > 0)
+          continue;
+        if(absorbed.count(child.get()) > 0) {
+          slots[child.get()] = 0;
+          collect(child);
+          chain.push_back(child.get());
+        } else {
+          slots[child.get()] = inputs.size();
+          inputs.push_back(child);
+        }
+      }
+    };
+    collect(v);
+    chain.push_back(v.get());
+
+    if(chain.size() == 1 || inputs.size() > FusedElementArgs::MAX_INPUTS
+       || chain.size() > FusedElementArgs::MAX_INSTRUCTIONS) {
+      tape.push_back(v);
+      continue;
+    }
+
+    FusedProgram program;
+    for(auto node : chain) {
+      auto instr = instructions[node];
+      const auto& children = node->children();
+      instr.a = (uint8_t)slots[children[0].get()];
+      instr.b = (uint8_t)slots[children[FusedInstruction::isBinary(instr.op) ? 1 : 0].get()];
+      slots[node] = inputs.size() + program.size();
+      program.push_back(instr);
+    }
+
+    for(auto node : chain)
+      removed.insert(node);
+    tape.push_back(Expr(new FusedElementwiseNodeOp(inputs, v, program)));
+  }
+
+  // The fused nodes leave the tape. Their children would otherwise be held until the last node of each chain is
+  // destroyed, which the forward pass of inference avoids by clearing them after each node.
+  for(auto& v : nodesForward_)
+    if(removed.count(v.get()) > 0)
+      v->children().clear();
+  tape.remove_if([&](const Expr& v) { return removed.count(v.get()) > 0; });
+  nodesForward_.swap(tape);
+}
+
+void ExpressionGraph::simplify() {
+  ABORT_IF(!inferenceOnly_, "Graph simplification is only supported in inference");
+
+  std::unordered_map<Chainable<Tensor>*, size_t> uses;
+  for(auto& v : nodesForward_)
+    for(auto& child : v->children())
+      uses[child.get()]++;
+
+  // removed nodes and what their consumers read instead, which precedes them on the tape
+  std::unordered_map<Chainable<Tensor>*, Expr> replacements;
+  std::unordered_set<Chainable<Tensor>*> reshapes; // new replacements, which take the place of the removed node
+  for(auto& v : nodesForward_) {
+    for(auto& child : v->children()) {
+      auto it = replacements.find(child.get());
+      if(it != replacements.end())
+        child = it->second;
+    }
+
+    if(v->children().size() != 1 || v->memoize() || v->marked_for_debug() || v->val()
+       || v.useCount() != 1 + uses[v.get()])
+      continue;
+    auto child = v->child(0);
+    if(v->type() == "cast" && v->value_type() == child->value_type()) {
+      replacements[v.get()] = child;
+    } else if(v->type() == "transpose" && dynamic_cast<TransposeNodeOp*>(v.get())->preservesLayout()) {
+      if(v->shape() == child->shape()) {
+        replacements[v.get()] = child;
+      } else {
+        Expr reshape(new ReshapeNodeOp(child, v->shape()));
+        reshapes.insert(reshape.get());
+        replacements[v.get()] = reshape;
+      }
+    }
+  }
+  if(replacements.empty())
+    return;
+
+  std::list<Expr> tape;
+  for(auto& v : nodesForward_) {
+    auto it = replacements.find(v.get());
+    if(it == replacements.end()) {
+      tape.push_back(v);
+    } else {
+      if(reshapes.count(it->second.get()) > 0)
+        tape.push_back(it->second);
+      v->children().clear();
+    }
+  }
+  nodesForward_.swap(tape);
+}
+
+void ExpressionGraph::freeConsumed(const Expr& v) {
+  if(frozenFrees_.empty())
+    return;
+  auto it = frozenFrees_.find(v.get());
+  if(it == frozenFrees_.end())
+    return;
+  for(auto& node : it->second)
+    node->free();
+  frozenFrees_.erase(it);
+}
+
+static bool isMatrixProduct(const Expr& v) {
+  static const std::unordered_set<std::string> products
+      = {"dot", "affine", "affineWithRelu", "bdot", "bdot_legacy", "csr_dot"};
+  return products.count(v->type()) > 0;
+}
+
+void ExpressionGraph::applyCheckpointPolicy() {
+  if(checkpointEvery_ > 1) {
+    size_t marked = 0;
+    for(auto& v : nodesForward_)
+      if(!v->children().empty() && v->isCheckpoint() && ++marked % checkpointEvery_ != 0)
+        v->unmarkCheckpoint();
+  }
+
+  if(checkpointProducts_) {
+    for(auto& v : nodesForward_)
+      if(isMatrixProduct(v))
+        v->markCheckpoint();
+  }
+}
+
+// a rough estimate: 2 * m * k * n for matrix products, whose output is [..., m, n] and first input [..., m, k], and
+// one operation per element for all other nodes
+static double estimateFlops(const Expr& v) {
+  if(isMatrixProduct(v) && !v->children().empty())
+    return 2.0 * v->child(0)->shape().elements() * v->shape()[-1];
+  return (double)v->shape().elements();
+}
+
+void ExpressionGraph::collectCheckpointingStatistics() {
+  CheckpointingStatistics stats;
+  for(auto& v : nodesForward_) {
+    if(v->children().empty() || v->memoize())
+      continue;
+    size_t bytes = requiredBytes(v->shape(), v->value_type());
+    double flops = estimateFlops(v);
+    stats.activationBytes += bytes;
+    stats.forwardFlops += flops;
+    if(!v->isCheckpoint()) { // on a subtape, freed after the forward pass and recomputed for the backward pass
+      stats.recomputedBytes += bytes;
+      stats.recomputedFlops += flops;
+    }
+  }
+  checkpointingStatistics_ = stats;
+
+  LOG_ONCE(info,
+           "[memory] Gradient checkpointing frees {:.1f} of {:.1f} MB of activations after the forward pass for {:.1f}% "
+           "more forward FLOPs",
+           stats.recomputedBytes / (1024.f * 1024.f), stats.activationBytes / (1024.f * 1024.f),
+           stats.forwardFlops > 0 ? 100.0 * stats.recomputedFlops / stats.forwardFlops : 0.0);
+}
+
+void ExpressionGraph::planOffloads() {
+  releaseOffloads();
+  offloadAfter_.clear();
+
+  // the last reader of each value. Checkpoints that views read stay, the views would not see their restored values.
+  std::unordered_map<Chainable<Tensor>*, Chainable<Tensor>*> lastReader;
+  std::unordered_set<Chainable<Tensor>*> viewed;
+  for(auto& v : nodesForward_) {
+    for(auto& child : v->children()) {
+      lastReader[child.get()] = v.get();
+      if(v->isView())
+        viewed.insert(child.get());
+    }
+  }
+
+  for(auto& v : nodesForward_) {
+    auto it = lastReader.find(v.get());
+    if(!v->isCheckpoint() || v->children().empty() || v->memoize() || v->isView() || viewed.count(v.get()) > 0
+       || it == lastReader.end() || topNodes_.count(v) > 0)
+      continue;
+    offloadAfter_[it->second].push_back(v);
+  }
+}
+
+void ExpressionGraph::offloadConsumed(const Expr& v) {
+  auto it = offloadAfter_.find(v.get());
+  if(it != offloadAfter_.end()) {
+    for(auto& node : it->second)
+      offloads_.push_back({node, backend_->offload(node->val()->data(), node->val()->memory()->size())});
+    offloadAfter_.erase(it);
+  }
+
+  // copies finish in order
+  while(offloadsFreed_ < offloads_.size() && backend_->isOffloaded(offloads_[offloadsFreed_].handle))
+    offloads_[offloadsFreed_++].node->free();
+}
+
+void ExpressionGraph::restoreOffload(size_t i) {
+  auto& offload = offloads_[i];
+  if(i < offloadsFreed_) {
+    offload.node->allocate();
+    backend_->restore(offload.handle, offload.node->val()->data());
+  } else {
+    backend_->restore(offload.handle, nullptr);
+  }
+  offload.node = nullptr;
+}
+
+void ExpressionGraph::releaseOffloads() {
+  for(size_t i = 0; i < offloads_.size(); ++i)
+    if(offloads_[i].node)
+      backend_->restore(offloads_[i].handle, nullptr);
+  offloads_.clear();
+  offloadsFreed_ = 0;
+}
+
+Ptr<FrozenGraph> ExpressionGraph::freeze(const std::vector<std::string>& inputs, const std::vector<Expr>& outputs) {
+  ABORT_IF(!inferenceOnly_, "Only graphs for inference can be frozen");
+
+  // parameters and memoized nodes outlive clear(), they are children of the frozen nodes but not frozen themselves
+  std::unordered_set<Chainable<Tensor>*> reached;
+  std::vector<Expr> stack(outputs.begin(), outputs.end());
+  while(!stack.empty()) {
+    auto v = stack.back();
+    stack.pop_back();
+    if(v->type() == "param" || v->memoize() || !reached.insert(v.get()).second)
+      continue;
+    for(auto& child : v->children())
+      stack.push_back(child);
+  }
+
+  auto frozen = New<FrozenGraph>();
+  std::unordered_map<Chainable<Tensor>*, size_t> index;
+  for(auto& v : nodesForward_) {
+    if(reached.count(v.get()) == 0 || index.count(v.get()) > 0)
+      continue;
+    index[v.get()] = frozen->nodes_.size();
+    frozen->nodes_.push_back(v);
+    frozen->children_.push_back(v->children());
+  }
+  ABORT_IF(index.size() != reached.size(),
+           "Only {} of {} nodes to freeze are on the forward tape, freeze before their forward pass",
+           index.size(), reached.size());
+
+  for(auto& v : frozen->nodes_) {
+    auto constant = std::dynamic_pointer_cast<ConstantNode>(v);
+    if(!constant)
+      continue;
+    if(std::find(inputs.begin(), inputs.end(), v->name()) != inputs.end()) {
+      ABORT_IF(frozen->inputs_.count(v->name()) > 0, "More than one constant with the input name {}", v->name());
+      frozen->inputs_[v->name()] = frozen->constants_.size();
+    }
+    frozen->constants_.push_back({constant, constant->initializer()});
+  }
+  for(auto& name : inputs)
+    ABORT_IF(frozen->inputs_.count(name) == 0, "There is no constant with the input name {} to freeze", name);
+
+  // the last node that reads each value, where reading a view reads the viewed node
+  const size_t keep = std::numeric_limits<size_t>::max();
+  size_t size = frozen->nodes_.size();
+  std::vector<size_t> lastRead(size, 0);
+  for(auto& output : outputs) {
+    auto it = index.find(output.get());
+    if(it != index.end())
+      lastRead[it->second] = keep;
+  }
+  for(size_t i = size; i-- > 0;) {
+    size_t read = frozen->nodes_[i]->isView() ? lastRead[i] : i;
+    for(auto& child : frozen->children_[i]) {
+      auto it = index.find(child.get());
+      if(it != index.end())
+        lastRead[it->second] = std::max(lastRead[it->second], read);
+    }
+  }
+
+  frozen->freeAfter_.resize(size);
+  for(size_t i = 0; i < size; ++i)
+    if(lastRead[i] != keep && !frozen->nodes_[i]->isView())
+      frozen->freeAfter_[lastRead[i]].push_back(frozen->nodes_[i]);
+  for(size_t i = 0; i < size; ++i)
+    if(!frozen->freeAfter_[i].empty())
+      frozenFrees_[frozen->nodes_[i].get()] = frozen->freeAfter_[i];
+
+  // nodes that are built later must not be deduplicated into frozen ones, which may be freed before they are read
+  tensors_->clearShorttermMemory();
+
+  frozen->outputs_ = outputs;
+  return frozen;
+}
+
+const std::vector<Expr>& ExpressionGraph::replay(Ptr<FrozenGraph> frozen,
+                                                 const std::unordered_map<std::string, Ptr<inits::NodeInitializer>>& inputs) {
+  ABORT_IF(!inferenceOnly_, "Only graphs for inference can replay frozen graphs");
+  ABORT_IF(inputs.size() != frozen->inputs_.size(),
+           "Frozen graph has {} inputs, but {} were given", frozen->inputs_.size(), inputs.size());
+
+  std::vector<Ptr<inits::NodeInitializer>> inits;
+  for(auto& constant : frozen->constants_)
+    inits.push_back(constant.second);
+  for(auto& input : inputs) {
+    auto it = frozen->inputs_.find(input.first);
+    ABORT_IF(it == frozen->inputs_.end(), "Frozen graph has no input {}", input.first);
+    inits[it->second] = input.second;
+  }
+
+  for(size_t i = 0; i < frozen->nodes_.size(); ++i) {
+    auto& v = frozen->nodes_[i];
+    v->resetVal(); // memory of the cleared graph
+    v->children() = frozen->children_[i];
+    v->setId(count_++);
+    nodesForward_.push_back(v);
+    if(!frozen->freeAfter_[i].empty())
+      frozenFrees_[v.get()] = frozen->freeAfter_[i];
+  }
+  for(size_t i = 0; i < frozen->constants_.size(); ++i)
+    frozen->constants_[i].first->rebind(inits[i]);
+
+  return frozen->outputs_;
 }
 
 void ExpressionGraph::backward(bool reset, float clipValue) {
@@ -216,11 +777,87 @@ void ExpressionGraph::backward(bool reset, float clipValue) {
 
   tensors_->clearShorttermMemory();
 
+  auto profiler = tensors_->getMemoryProfiler();
+  if(profiler && !profiler->beginPass("backward"))
+    tensors_->setMemoryProfiler(nullptr);
+  if(nodeProfiler_ && !nodeProfiler_->beginPass("backward"))
+    nodeProfiler_ = nullptr;
+
+  // Offloaded checkpoints are restored one ahead: when the backward pass first needs the last one that was issued,
+  // it waits for it and the next one is issued. Others that are needed earlier than expected are issued right away.
+  std::unordered_map<Chainable<Tensor>*, size_t> offloaded;
+  for(size_t i = 0; i < offloads_.size(); ++i)
+    offloaded[offloads_[i].node.get()] = i;
+  size_t restoring = offloads_.size(); // offloads_ from here on were restored
+  bool inFlight = false;
+  auto restoreNext = [&]() {
+    if(restoring > 0) {
+      restoreOffload(--restoring);
+      inFlight = true;
+    }
+  };
+  restoreNext();
+
+  // buckets of gradients that are final are reported last to first, see setGradientBuckets()
+  std::vector<std::pair<size_t, size_t>> buckets;
+  std::vector<size_t> pending; // parameters of each bucket that the backward pass did not reach yet
+  auto bucketOf = [&](Chainable<Tensor>* param) {
+    size_t offset = (param->grad()->memory()->data() - params()->grads()->memory()->data()) / sizeOf(param->grad()->type());
+    auto it = std::upper_bound(buckets.begin(), buckets.end(), offset,
+                               [](size_t o, const std::pair<size_t, size_t>& bucket) { return o < bucket.first; });
+    return (size_t)(it - buckets.begin()) - 1;
+  };
+  if(gradientsReady_) {
+    buckets = gradientBuckets();
+    pending.assign(buckets.size(), 0);
+    for(auto& kv : params()->getMap())
+      pending[bucketOf(kv.second.get())]++;
+  }
+  size_t unreported = buckets.size();
+  auto reportReady = [&]() {
+    while(unreported > 0 && pending[unreported - 1] == 0) {
+      --unreported;
+      gradientsReady_(buckets[unreported].first, buckets[unreported].second);
+    }
+  };
+
   bool firstNaN = true;
   while(!nodesBackward_.empty()) {
     auto v = nodesBackward_.back();  // return the last element
     nodesBackward_.pop_back();       // remove the last element
 
+    if(!offloaded.empty()) {
+      bool needed = false;
+      auto require = [&](Chainable<Tensor>* node) {
+        auto it = offloaded.find(node);
+        if(it == offloaded.end())
+          return;
+        while(restoring > it->second)
+          restoreNext();
+        offloaded.erase(it);
+        needed = true;
+      };
+      require(v.get());
+      for(auto&& child : v->children())
+        require(child.get());
+      if(needed && inFlight) {
+        backend_->waitRestores();
+        inFlight = false;
+        restoreNext();
+      }
+    }
+
+    // sharded parameters are gathered again for the backward pass, with a gradient if they are of other shards
+    if(parameterShards_) {
+      std::vector<Expr> params;
+      paramsReadBy(v, params);
+      for(auto& param : params) {
+        gatherParam(param);
+        if(param->trainable())
+          param->set_zero_adjoint();
+      }
+    }
+
     // for non-top nodes: allocates memory and initialises gradients to 0
     for(auto&& child : v->children())
       if(child->trainable() && child->type() != "param")
@@ -249,8 +886,13 @@ void ExpressionGraph::backward(bool reset, float clipValue) {
       Element(_1 = clip(_1, clipValue), v->grad());
     }
 
-    if(v->trainable())
+    if(v->trainable()) {
+      if(nodeProfiler_)
+        nodeProfiler_->begin();
       v->backward();
+      if(nodeProfiler_)
+        nodeProfiler_->end(v.get());
+    }
 
     if(throwNaN_ && firstNaN) {
       for(auto&& child : v->children()) {
@@ -270,7 +912,56 @@ void ExpressionGraph::backward(bool reset, float clipValue) {
     }
 
     v->children().clear();
+
+    // the gradient of a parameter is final once the backward pass reaches it, after all nodes that read it
+    if(parameterShards_ && v->type() == "param") {
+      bool owned = parameterShards_->owns(v);
+      if(!owned)
+        v->set_zero_adjoint(); // if no node read it
+      parameterShards_->reduce(v, v->grad());
+      releaseParam(v);
+      if(!owned) {
+        free(v->grad());
+        v->grad() = nullptr;
+      }
+    }
+
+    if(!buckets.empty() && v->type() == "param") {
+      pending[bucketOf(v.get())]--;
+      reportReady();
+    }
   }
+
+  if(!buckets.empty()) {
+    std::fill(pending.begin(), pending.end(), 0);
+    reportReady();
+  }
+
+  // parameters that are not trained are never reached
+  while(!gatheredParams_.empty())
+    releaseParam(gatheredParams_.begin()->second);
+
+  releaseOffloads();
+}
+
+std::vector<std::pair<size_t, size_t>> ExpressionGraph::gradientBuckets() {
+  auto grads = params()->grads();
+  size_t elementBytes = sizeOf(grads->type());
+  std::vector<size_t> offsets; // of the gradients of the parameters, in elements
+  for(auto& kv : params()->getMap())
+    offsets.push_back((kv.second->grad()->memory()->data() - grads->memory()->data()) / elementBytes);
+  std::sort(offsets.begin(), offsets.end());
+
+  std::vector<std::pair<size_t, size_t>> buckets;
+  size_t begin = 0;
+  for(auto offset : offsets) {
+    if(offset > begin && (offset - begin) * elementBytes >= gradientBucketBytes_) {
+      buckets.push_back({begin, offset});
+      begin = offset;
+    }
+  }
+  buckets.push_back({begin, grads->size()});
+  return buckets;
 }
 
 Expr ExpressionGraph::dropoutMask(float prob, const Shape& shape, Type valueType) {
@@ -299,7 +990,18 @@ void ExpressionGraph::getItems(std::vector<io::Item>& ioItems, Type saveElementT
 
       Tensor val = p.second->val();
       io::Item item;
-      val->get(item, pName);
+      int axis;
+      if(tensorParallel_ && tensorParallel_->isSplit(p.first, axis)) {
+        // the whole parameter from the parts of all ranks
+        Tensor gathered;
+        getTensorAllocator()->allocate(gathered, {(int)(tensorParallel_->ranks() * val->size())}, val->type());
+        tensorParallel_->allGather(val, gathered);
+        gathered->get(item, pName);
+        item = tensorParallel_->join(item, val->shape(), axis);
+        getTensorAllocator()->free(gathered);
+      } else {
+        val->get(item, pName);
+      }
       item.convert(saveElementType);
       ioItems.emplace_back(std::move(item));
     }
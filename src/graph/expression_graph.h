@@ -7,9 +7,15 @@
 #include "tensors/tensor_allocator.h"
 
 #include "graph/chainable.h"
+#include "graph/frozen_graph.h"
+#include "graph/memory_planner.h"
+#include "graph/memory_profiler.h"
+#include "graph/node_profiler.h"
 #include "graph/node_initializers.h"
 #include "graph/node_operators.h"
 #include "graph/parameters.h"
+#include "graph/shared_values.h"
+#include "graph/tensor_parallel.h"
 
 #include <map>
 #include <unordered_set>
@@ -38,6 +44,8 @@ private:
 
   Ptr<WeakMemory> shortterm_;  // holds all nodes for a graph
   Ptr<Memory> longterm_;  // holds memoized nodes
+  Ptr<MemoryPlanner> planner_; // static memory plans of forward passes, if enabled
+  Ptr<MemoryProfiler> profiler_; // records allocations and frees of node memory, if enabled
 
 public:
   Tensors(Ptr<Backend> backend)
@@ -60,19 +68,42 @@ public:
 
   void allocateForward(Expr node) {
     if(!node->val()) {
-      if(node->memoize())
+      if(node->memoize()) {
         cache_->allocate(node->val(), node->shape(), node->value_type());
-      else
+      } else if(!planner_) {
+        tensors_->allocate(node->val(), node->shape(), node->value_type());
+      } else if(!planner_->allocate(node->val(), node->shape(), node->value_type())) {
         tensors_->allocate(node->val(), node->shape(), node->value_type());
+        planner_->allocated(node->val());
+      }
+      if(profiler_)
+        profiler_->allocated(node.get(), node->val(), node->memoize() ? "cache" : "value");
     }
   }
 
   void allocateBackward(Expr node) {
-    if(!node->grad())
+    if(!node->grad()) {
       tensors_->allocate(node->grad(), node->shape(), node->value_type());
+      if(profiler_)
+        profiler_->allocated(node.get(), node->grad(), "gradient");
+    }
+  }
+
+  void free(const Tensor& tensor) {
+    if(profiler_)
+      profiler_->freed(tensor);
+    if(!planner_ || !planner_->free(tensor))
+      tensors_->free(tensor);
+  }
+
+  // keeps up to maxPlans static memory plans of forward passes, 0 allocates every node dynamically
+  void setMemoryPlans(size_t maxPlans, Ptr<Backend> backend) {
+    planner_ = maxPlans > 0 ? New<MemoryPlanner>(maxPlans, backend) : nullptr;
   }
+  Ptr<MemoryPlanner> getMemoryPlanner() { return planner_; }
 
-  void free(const Tensor& tensor) { tensors_->free(tensor); }
+  void setMemoryProfiler(Ptr<MemoryProfiler> profiler) { profiler_ = profiler; }
+  Ptr<MemoryProfiler> getMemoryProfiler() { return profiler_; }
 
   Ptr<Allocator>       getAllocator() { return tensors_->allocator(); }
   Ptr<TensorAllocator> getTensorAllocator() { return tensors_; }
@@ -112,6 +143,10 @@ public:
   void clear() {
     tensors_->clear();
     shortterm_->clear();
+    if(planner_)
+      planner_->clear();
+    if(profiler_)
+      profiler_->clear();
   }
 
   void clearShorttermMemory() { shortterm_->clear(); }
@@ -119,6 +154,15 @@ public:
   void clearLongtermMemory() { longterm_->clear(); }
 };
 
+// Values and estimated FLOPs of the forward pass of a graph with gradient checkpointing, and how much of them is freed
+// after the forward pass and recomputed during the backward pass
+struct CheckpointingStatistics {
+  size_t activationBytes{0};
+  size_t recomputedBytes{0};
+  double forwardFlops{0};
+  double recomputedFlops{0};
+};
+
 typedef std::map<Type, Ptr<Parameters>> ElementTypeParamsMap; // keep it sorted, hence map not unordered map
 
 /**
@@ -131,6 +175,18 @@ class ExpressionGraph : public std::enable_shared_from_this<ExpressionGraph> {
 
   std::unordered_set<Expr> topNodes_; // current set of roots. In the end, all but one must have been consumed
 
+  // values of frozen nodes to free after the node that reads them last ran, see freeze()
+  std::unordered_map<Chainable<Tensor>*, std::vector<Expr>> frozenFrees_;
+
+  // checkpoints to offload after the node that reads them last in the forward pass ran, see setActivationOffloading()
+  std::unordered_map<Chainable<Tensor>*, std::vector<Expr>> offloadAfter_;
+  struct Offload {
+    Expr node;
+    size_t handle;    // of Backend::offload()
+  };
+  std::vector<Offload> offloads_; // of the last forward pass, in the order the backward pass needs them last to first
+  size_t offloadsFreed_{0};       // offloads_ whose values have been freed, always the first ones
+
 protected:  // (these are protected, not private, for ONNX exporting)
   std::list<Expr> nodesForward_;     ///< contains all nodes used for forward()
   std::list<Expr> nodesBackward_;    ///< contains trainable nodes used for backward()
@@ -148,9 +204,33 @@ private:
   Type defaultElementType_{Type::float32};  // Type used for storing parameters, currently all parameters have to have the same type
 
   bool inferenceOnly_{false};               // a flag holds whether the graph is used for inference only
+  std::string trainableOnly_;               // if not empty, only parameters with this in their names are trained
 
   bool checkpointing_{false};               // use gradient checkpointing if true
+  bool checkpointProducts_{false};          // with checkpointing, keep the outputs of matrix products
+  size_t checkpointEvery_{1};               // with checkpointing, keep every k-th manual checkpoint
+  CheckpointingStatistics checkpointingStatistics_;
+
+  Ptr<NodeProfiler> nodeProfiler_;          // times the nodes of the next passes, if set
+
+  bool elementwiseFusion_{false};           // fuse chains of elementwise nodes in inference if true
+  bool simplification_{false};              // remove no-op nodes from inference tapes if true
+
+  Ptr<SharedValues> sharedValues_;          // parameters and memoized values shared with other CPU inference graphs, if set
+
+  bool offloading_{false};                  // offload checkpoints to host memory between forward and backward if true
 
+  Ptr<ParameterShards> parameterShards_;    // ZeRO-3 style sharding of the parameters with other graphs, if set
+  std::unordered_map<Chainable<Tensor>*, Expr> gatheredParams_; // of all shards, gathered in the current pass
+
+  Ptr<TensorParallel> tensorParallel_;      // Megatron-style split of the attention heads and filter units with other graphs, if set
+  Ptr<io::ModelWeights> tensorParallelWeights_; // loaded by load(), whose items initialize the parameters
+  std::unordered_map<std::string, const io::Item*> tensorParallelItems_; // of tensorParallelWeights_ by parameter name
+
+  size_t gradientBucketBytes_{0};           // of gradientBuckets()
+  std::function<void(size_t, size_t)> gradientsReady_; // called by backward() with buckets whose gradients are final, if set
+
+  size_t stagedLoading_{0};                 // bytes of each staging buffer that load() uploads parameters through, see setStagedLoading()
   bool reloaded_{false};                    // a flag holds whether the graph is reloaded: reloaded is true if the graph loads parameters by load() function.
 
   bool throwNaN_{false};                    // a flag holds whether the graph throws a NaN exception
@@ -212,6 +292,83 @@ public:
   /** Check whether the graph is used for inference only (true) or not */
   bool isInference() { return inferenceOnly_; }
 
+  /**
+   * Keep static memory plans for up to maxPlans different forward passes of an inference graph, see MemoryPlanner.
+   * Repeated passes, e.g. decoder steps of the same batch and beam size, then allocate their node values without the
+   * allocator. 0 allocates every node dynamically.
+   */
+  void setMemoryPlans(size_t maxPlans) { tensors_->setMemoryPlans(maxPlans, backend_); }
+  Ptr<MemoryPlanner> getMemoryPlanner() { return tensors_->getMemoryPlanner(); }
+
+  /**
+   * Record when the next passes forward passes, and the backward passes after them, allocate and free the values and
+   * gradients of nodes, and write a Chrome trace of it, see MemoryProfiler. path gets the device inserted before its
+   * extension, e.g. memory.gpu0.json, as every graph writes its own trace. Call after setDevice(), an empty path
+   * disables the profile.
+   */
+  void setMemoryProfile(const std::string& path, size_t passes = 1) {
+    tensors_->setMemoryProfiler(path.empty() ? nullptr : New<MemoryProfiler>(devicePath(path), passes, allocator()));
+  }
+
+  /**
+   * Time the forward() and backward() calls of all nodes of the next passes forward passes and their backward
+   * passes, then log the top operators by time and, if tracePath is not empty, write every call as a Chrome trace to
+   * it with the device inserted as for setMemoryProfile(), see NodeProfiler. Forward passes that replay CUDA graphs
+   * are not timed. With counters, the table of the CPU also has hardware counters per operator, see
+   * NodeProfiler. 0 passes disable the profile.
+   */
+  void setNodeProfile(size_t passes, size_t top = 20, const std::string& tracePath = "", bool counters = false) {
+    nodeProfiler_ = passes > 0
+        ? New<NodeProfiler>(backend_, passes, top, tracePath.empty() ? tracePath : devicePath(tracePath), counters)
+        : nullptr;
+  }
+
+  /**
+   * Set whether the workspace allocator rounds allocations up to size classes and reuses freed blocks of the same
+   * class instead of best-fit gaps, see Allocator. Call after setDevice() and before anything is allocated.
+   */
+  void setAllocatorSizeClasses(bool sizeClasses) { allocator()->setSizeClasses(sizeClasses); }
+
+  /**
+   * Memory use of the workspace, e.g. its reserved and peak bytes, to choose --workspace from. It reads the state of
+   * the allocator, hence call it from the thread that runs the graph, or between its forward passes.
+   */
+  AllocatorStatistics getWorkspaceStatistics() { return allocator()->statistics(); }
+
+  /**
+   * Set the size of the two page-locked staging buffers that load() uploads the parameters of a GPU graph through,
+   * 0 initializes them from host memory one by one in the first forward pass. With staging, load() allocates and
+   * uploads all parameters right away, ordered by name as in the model files marian writes, and copying the next
+   * piece of the model into one buffer, which reads it from disk for memory-mapped models, overlaps with uploading
+   * the previous piece from the other.
+   */
+  void setStagedLoading(size_t bytes) { stagedLoading_ = bytes; }
+
+  /**
+   * Set whether this CPU inference graph shares the parameters it loads, and the memoized nodes computed from them,
+   * with the other graphs of the process that do the same and load the same model weights, instead of holding a copy
+   * of them, see SharedValues. Call after setDevice() and setInference() and before load().
+   */
+  void setSharedValues(bool shared) {
+    ABORT_IF(shared && (backend_->getDeviceId().type != DeviceType::cpu || !inferenceOnly_),
+             "Shared values are only supported for CPU inference graphs");
+    sharedValues_ = shared ? New<SharedValues>() : nullptr;
+  }
+  Ptr<SharedValues> getSharedValues() { return sharedValues_; }
+
+  /**
+   * Set whether the forward pass of an inference graph first fuses chains of elementwise nodes into single nodes,
+   * see fuseElementwise().
+   */
+  void setElementwiseFusion(bool fusion) { elementwiseFusion_ = fusion; }
+
+  /**
+   * Set whether the forward pass of an inference graph first removes nodes that do not change their input, see
+   * simplify(). Operations on parameters need no pass of their own, their nodes are memoized in inference graphs and
+   * computed only once.
+   */
+  void setGraphSimplification(bool simplification) { simplification_ = simplification; }
+
   /**
    * Set whether the graph uses gradient checkpointing.
    * <a href="https://github.com/cybertronai/gradient-checkpointing">Gradient Checkpointing</a>
@@ -222,6 +379,88 @@ public:
   /** Check whether the graph uses gradient checkpointing or not */
   bool isCheckpointing() { return checkpointing_; }
 
+  /**
+   * Train only the parameters whose names contain namePart, e.g. the low-rank adapters of --lora-rank. The others
+   * are created as fixed parameters, so they get no gradients. An empty namePart trains all parameters again.
+   */
+  void setTrainableOnly(const std::string& namePart) { trainableOnly_ = namePart; }
+
+  /**
+   * Select which nodes gradient checkpointing keeps. "manual" keeps the nodes marked by checkpoint(), "products"
+   * also keeps the outputs of all matrix products, so that only the cheap elementwise, normalization and softmax
+   * nodes in between are recomputed. With every > 1, only every k-th of the manual checkpoints is kept, e.g. one in
+   * every k transformer layers.
+   */
+  void setCheckpointPolicy(const std::string& policy, size_t every = 1) {
+    ABORT_IF(policy != "manual" && policy != "products", "Unknown gradient checkpointing policy '{}'", policy);
+    ABORT_IF(every == 0, "Gradient checkpointing has to keep every k-th checkpoint with k > 0");
+    checkpointProducts_ = policy == "products";
+    checkpointEvery_ = every;
+  }
+
+  /** Memory and compute of the last forward pass with gradient checkpointing */
+  const CheckpointingStatistics& getCheckpointingStatistics() const { return checkpointingStatistics_; }
+
+  /**
+   * Set whether the training graph offloads the values of checkpoints, see checkpoint(), to host memory once the
+   * forward pass no longer reads them and restores them shortly before the backward pass does. Unlike gradient
+   * checkpointing, nothing is recomputed, and on GPUs the copies overlap with the kernels. The nodes in between
+   * checkpoints keep their values, so the savings depend on how much memory the checkpoints take.
+   */
+  void setActivationOffloading(bool offloading) { offloading_ = offloading; }
+
+  /**
+   * During the following backward passes, call ready(begin, end) for each range [begin, end) of gradientBuckets() as
+   * soon as the gradients in it are final, so that e.g. their reduction across devices overlaps the rest of the pass.
+   * The gradient of a parameter is final once the backward pass reaches the parameter node, which precedes all nodes
+   * that read it on the forward tape. Ranges are reported from the last one to the first one, in the same order in
+   * every pass as collective communication needs, so a range that is final early waits for the ranges after it.
+   * Ranges with parameters that get no gradient in this pass are reported at its end. A null ready stops the reports.
+   */
+  void setGradientBuckets(size_t bucketBytes, const std::function<void(size_t, size_t)>& ready) {
+    ABORT_IF(ready && parameterShards_, "Gradient buckets cannot be reported with sharded parameters");
+    gradientBucketBytes_ = bucketBytes;
+    gradientsReady_ = ready;
+  }
+
+  /**
+   * Split the elements of params()->grads() into contiguous ranges that start at a parameter and hold at least the
+   * bucket bytes of setGradientBuckets() apart from the last one. The ranges cover all elements and only depend on
+   * the parameters, so they are the same for all graphs of the same model.
+   */
+  std::vector<std::pair<size_t, size_t>> gradientBuckets();
+
+  /**
+   * Shard the parameters of this training graph with the graphs of the other ranks of shards, ZeRO-3 style: the
+   * graph keeps the values and gradients of the parameters it owns and gathers the others from their owners for
+   * the nodes that read them in the forward and backward pass, which frees their memory after the last reader and
+   * passes their gradients to the owners once the backward pass computed them, see ParameterShards. Must be set
+   * before the first parameter is created and cannot be combined with gradient checkpointing.
+   */
+  void setParameterShards(Ptr<ParameterShards> shards) {
+    ABORT_IF(!paramsByElementType_.empty(), "Parameter shards have to be set before parameters are created");
+    parameterShards_ = shards;
+  }
+
+  Ptr<ParameterShards> getParameterShards() { return parameterShards_; }
+
+  /**
+   * Split the attention heads and filter units of the layers of this graph with the graphs of the other ranks of
+   * tensorParallel, see TensorParallel. The layers create the parameters of the part of this rank, thus load() only
+   * keeps the loaded model, from which param() then initializes the part of each parameter, and getItems() gathers
+   * the parts of all ranks, so it has to be called by the graphs of all ranks. Must be set before the first parameter
+   * is created.
+   */
+  void setTensorParallel(Ptr<TensorParallel> tensorParallel) {
+    ABORT_IF(!paramsByElementType_.empty(), "Tensor parallelism has to be set before parameters are created");
+    tensorParallel_ = tensorParallel;
+  }
+
+  Ptr<TensorParallel> getTensorParallel() { return tensorParallel_; }
+
+  /** Check whether the graph offloads activations or not */
+  bool isActivationOffloading() { return offloading_; }
+
   /**
    * Set namespace (std::string) for the graph.
    * Each graph has its own unique namespace, which is used to form the name of a parameter object.
@@ -283,6 +522,21 @@ public:
     return true;
   }
 
+  /**
+   * Like fits() but only performs the forward pass, for graphs that are only used for inference.
+   */
+  bool fitsForward() {
+    try {
+      tensors_->throwAtReallocation(true);
+      forward();
+      tensors_->throwAtReallocation(false);
+    } catch(const AllocationException&) {
+      tensors_->throwAtReallocation(false);
+      return false;
+    }
+    return true;
+  }
+
   /**
    * Check whether the memory allocated for a tensor object contains a NaN or infinite value.
    * @param t a Tensor object
@@ -308,6 +562,58 @@ public:
    */
   void forwardNext();
 
+  // hash of a forward tape for its memory plan, see setMemoryPlans()
+  size_t tapeKey(std::list<Expr>& forwardTape);
+
+  // path with the device of the graph inserted before its extension, e.g. memory.gpu0.json
+  std::string devicePath(const std::string& path) {
+    auto dot = path.find_last_of('.');
+    auto slash = path.find_last_of('/');
+    bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    auto device = "." + std::string(getDeviceId());
+    return hasExtension ? path.substr(0, dot) + device + path.substr(dot) : path + device;
+  }
+
+  // frees the values of frozen nodes that v was the last one to read, see freeze()
+  void freeConsumed(const Expr& v);
+
+  // applies the checkpoint policy to the marked checkpoints, see setCheckpointPolicy()
+  void applyCheckpointPolicy();
+  // fills checkpointingStatistics_ once the subtapes are known
+  void collectCheckpointingStatistics();
+
+  // selects the checkpoints of the forward tape to offload and the nodes after which to offload them
+  void planOffloads();
+  // offloads the checkpoints that v was the last one to read and frees those whose copies are done
+  void offloadConsumed(const Expr& v);
+  // restores offloads_[i], or only drops its copy if its value was never freed
+  void restoreOffload(size_t i);
+  // drops the copies that were not restored
+  void releaseOffloads();
+
+  // gathers the value of a parameter of any shard that a node reads, see setParameterShards()
+  void gatherParam(const Expr& param);
+  // frees the value of a gathered parameter of another shard
+  void releaseParam(Expr param);
+
+  /**
+   * Replace chains of float32 elementwise nodes on the forward tape, e.g. relu(x * mask + b), by single
+   * FusedElementwiseNodeOp nodes that compute them with one FusedElement() call and without intermediate tensors.
+   * A node is only fused into the node that consumes it if nothing else holds on to it, hence the last node of a chain
+   * keeps its value and all fused results stay the same. Inference only, called by forward() with
+   * setElementwiseFusion(true) and by graphviz() to draw the fused graph.
+   */
+  void fuseElementwise();
+
+  /**
+   * Remove nodes from the forward tape that do not change the value of their child: casts to the type of the child and
+   * transposes that only move axes of size 1, e.g. of the single time step of decoding, which become reshapes. The
+   * nodes that read a removed node read its replacement instead. As in fuseElementwise(), only nodes that nothing
+   * else holds on to are removed. Inference only, called by forward() with setGraphSimplification(true) and by
+   * graphviz().
+   */
+  void simplify();
+
   /**
    * Perform forward pass on a given nodes with finalPass flag.
    * Helper function for forward() and backward().
@@ -316,6 +622,34 @@ public:
    */
   void forward(std::list<Expr>& forwardTape, bool finalPass);
 
+  /**
+   * Perform the forward pass of an inference graph through Backend::runForward(), which replays CUDA graphs
+   * of earlier forward passes on GPUs with setCudaGraphs().
+   * Helper function for forward().
+   * @param forwardTape a pointer to the nodes used for forward pass
+   */
+  void forwardCaptured(std::list<Expr>& forwardTape);
+
+  /**
+   * Freeze the nodes on the forward tape that the outputs depend on, apart from parameters and memoized nodes, so
+   * that replay() can add them to the tape again after the graph was cleared. Freeze before the forward pass of
+   * these nodes and only read the outputs from outside of the frozen graph. Inference only.
+   * @param inputs the names of the constants among these nodes that get new values with every replay()
+   * @param outputs the nodes that are used outside of the frozen graph
+   * @return the frozen graph, see FrozenGraph
+   */
+  Ptr<FrozenGraph> freeze(const std::vector<std::string>& inputs, const std::vector<Expr>& outputs);
+
+  /**
+   * Add the nodes of a frozen graph to the forward tape again, for the next forward pass of a cleared graph. All
+   * other constants keep their values, hence build the same nodes again unless only the inputs differ.
+   * @param frozen a graph returned by freeze()
+   * @param inputs initializers for all inputs of the frozen graph by name, with the shapes of the original inputs
+   * @return the outputs of the frozen graph
+   */
+  const std::vector<Expr>& replay(Ptr<FrozenGraph> frozen,
+                                  const std::unordered_map<std::string, Ptr<inits::NodeInitializer>>& inputs);
+
   /**
    * Perform the backward pass on the trainable nodes of the graph.
    * The back pass refers to the process of computing the output error.
@@ -328,6 +662,11 @@ public:
    * @return a string presenting graph layout in Graphviz format (dot)
    */
   std::string graphviz() {
+    if(inferenceOnly_ && simplification_)
+      simplify();
+    if(inferenceOnly_ && elementwiseFusion_)
+      fuseElementwise();
+
     std::stringstream ss;
     ss << "digraph ExpressionGraph {" << std::endl;
     // ss << "graph[splines=ortho]" << std::endl;
@@ -396,11 +735,17 @@ private:
     if(!namespace_.empty())
       name = namespace_ + "::" + name;
 
+    if(!trainableOnly_.empty() && pname.find(trainableOnly_) == std::string::npos)
+      fixed = true;
+
     Expr p; Ptr<Parameters> params; std::tie
     (p, params) = findParams(name, elementType, typeSpecified);
 
     if(!params) {
-      params = New<Parameters>(elementType);
+      if(parameterShards_)
+        params = New<ShardedParameters>(elementType, parameterShards_);
+      else
+        params = New<Parameters>(elementType);
       params->init(backend_);
       paramsByElementType_.insert({elementType, params});
     } else {
@@ -419,8 +764,16 @@ private:
       }
     }
 
+    // the parameters of a tensor-parallel graph are created from the loaded model with the shape of their part
+    const io::Item* loaded = nullptr;
+    if(tensorParallel_) {
+      auto it = tensorParallelItems_.find(pname);
+      if(it != tensorParallelItems_.end())
+        loaded = it->second;
+    }
+
     // if graph was reloaded do not allow creation of new parameters
-    ABORT_IF(reloaded_,
+    ABORT_IF(reloaded_ && !loaded,
              "Graph was reloaded and parameter '{}' with type {} (specified: {}) is newly created",
              name, elementType, typeSpecified);
 
@@ -428,8 +781,17 @@ private:
     auto other = get(name);
     ABORT_IF(other, "Parameter with name '{}' already exists and has type {}", name, other->value_type());
 
+    // mapped parameters of a graph with shared values have no memory of their own, so parameters that are not loaded
+    // get a shared buffer that only this graph uses
+    auto initializer = loaded ? tensorParallel_->loadPart(*loaded, shape) : init;
+    if(sharedValues_ && inits::sharedKey(init) == 0 && std::dynamic_pointer_cast<MappedParameters>(params)) {
+      size_t key = (size_t)this;
+      util::hash_combine(key, name);
+      initializer = inits::shared(init, sharedValues_, key);
+    }
+
     // create parameter node (adds to tape)
-    p = Expression<ParamNode>(shared_from_this(), shape, init, elementType, fixed);
+    p = Expression<ParamNode>(shared_from_this(), shape, initializer, elementType, fixed);
     LOG(debug, "Created parameter {} with shape {} and type {}", name, shape, elementType);
 
     // set name and id and add to list of parameters
@@ -729,6 +1091,8 @@ public:
     nodesBackward_.clear();
 
     topNodes_.clear();
+    frozenFrees_.clear();
+    releaseOffloads();
 
     tensors_->clear();
   }
@@ -765,7 +1129,14 @@ public:
 
     // if we got here, we mmap either opportunistically or by requirement
     LOG_ONCE(info, "[memory] Memory mapping model parameters in graph");
+    useMappedParameters(modelFile);
+  }
 
+  /**
+   * Replace the parameter objects of the types of the model by MappedParameters, whose tensors get their memory from
+   * their initializers, i.e. from memory-mapped items or shared values.
+   */
+  void useMappedParameters(Ptr<io::ModelWeights> modelFile) {
     // Deal with default parameter set object that might not be a mapped object.
     // This gets assigned during ExpressionGraph::setDevice(...) and by default
     // would contain allocated tensors. Here we replace it with a mmapped version.
@@ -796,8 +1167,16 @@ public:
   /** Load model (mainly parameter objects) from a ModelWeights object */
   void load(Ptr<io::ModelWeights> modelWeights, bool markReloaded = true) {
     prepareMmap(modelWeights);
+    if(sharedValues_) {
+      LOG_ONCE(info, "[memory] Sharing model parameters between CPU graphs");
+      useMappedParameters(modelWeights);
+    }
 
     setReloaded(false);
+    if(tensorParallel_) {
+      tensorParallelWeights_ = modelWeights;
+      tensorParallelItems_.clear();
+    }
     for(auto& item : modelWeights->items()) {
       auto lockGuard = modelWeights->scopedLockGuard();
 
@@ -806,16 +1185,50 @@ public:
       if(pName.substr(0, 8) == "special:")
         continue;
 
+      // the layers create the parameters with the shapes of the part of this rank
+      if(tensorParallel_) {
+        tensorParallelItems_[pName] = &item;
+        continue;
+      }
+
       // if during loading the loaded type is of the same type class as the default element type, allow conversion;
       // otherwise keep the loaded type. This is used when e.g. loading a float32 model as a float16 model as both
       // have type class TypeClass::float_type.
       auto loadElementType = isSameTypeClass(item.type, defaultElementType_) ? defaultElementType_ : item.type;
-      param(pName, item.shape, inits::fromItem(item), loadElementType, /*fixed=*/false);
+      auto init = inits::fromItem(item);
+      // mapped items of the loaded type are used in place, everything else is converted once for all graphs
+      if(sharedValues_ && !(item.mapped && loadElementType == item.type)) {
+        size_t key = (size_t)modelWeights.get();
+        util::hash_combine(key, (size_t)item.data());
+        util::hash_combine(key, pName);
+        init = inits::shared(init, sharedValues_, key);
+      }
+      param(pName, item.shape, init, loadElementType, /*fixed=*/false);
     }
+    // no parameters can be added after a reload, so they can be allocated now
+    if(markReloaded && stagedLoading_ > 0 && backend_->getDeviceId().type == DeviceType::gpu)
+      uploadParameters();
     if(markReloaded)
       setReloaded(true);
   }
 
+private:
+  void uploadParameters() {
+    size_t pinnedUploads = backend_->getPinnedUploads();
+    backend_->setPinnedUploads(stagedLoading_);
+    backend_->setInputUploads(true);
+    for(auto kvParams : paramsByElementType_) {
+      kvParams.second->allocateForward();
+      for(auto p : *kvParams.second)
+        if(p->val()) // sharded parameters of other ranks have none
+          p->init();
+    }
+    backend_->setInputUploads(false);
+    backend_->setPinnedUploads(pinnedUploads); // waits for the uploads out of the staging buffers
+  }
+
+public:
+
 
 public:
 
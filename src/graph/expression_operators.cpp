@@ -9,7 +9,14 @@
 
 #include "graph/auto_tuner.h"
 #include "tensors/cpu/intgemm_interface.h"
+#include "tensors/cpu/bfloat16.h"
+#include "tensors/cpu/sparse_gemm.h"
 #include "tensors/cpu/fbgemm/expanded_gemm.h"
+#include "tensors/gpu/int8.h"
+
+#include <map>
+#include <mutex>
+#include <tuple>
 
 #if USE_FBGEMM
 #include "fbgemm/Utils.h"
@@ -123,8 +130,111 @@ Expr softmax(Expr a, Expr zeroOneMask, int axis /*=-1*/) {
   return softmax(a + logMask, axis);
 }
 
+Expr maskedSoftmax(Expr a, Expr logMask, float scale) {
+  auto graph = a->graph();
+  if(!graph->isInference() || graph->getDeviceId().type != DeviceType::cpu
+     || a->value_type() != Type::float32 || logMask->value_type() != Type::float32) {
+    auto z = scale == 1.f ? a : a * scale;
+    return softmax(z + logMask);
+  }
+
+  auto fwd = [scale](Expr out, const std::vector<Expr>& children) {
+    cpu::MaskedSoftmax(out->val(), children[0]->val(), children[1]->val(), scale);
+  };
+  return lambda({a, logMask}, a->shape(), a->value_type(), fwd, util::hashArgs(std::string("maskedSoftmax"), scale));
+}
+
+Expr maskedPool(Expr x, Expr mask, bool mean) {
+  auto graph = x->graph();
+  if(!graph->isInference() || graph->getDeviceId().type != DeviceType::cpu
+     || x->value_type() != Type::float32 || mask->value_type() != Type::float32) {
+    if(mean)
+      return sum(x * mask, /*axis=*/-3) / sum(mask, /*axis=*/-3);
+    Expr logMask = (1.f - mask) * -9999.f;
+    return max(x * mask + logMask, /*axis=*/-3);
+  }
+
+  Shape outShape = x->shape();
+  outShape.set(-3, 1);
+  auto fwd = [mean](Expr out, const std::vector<Expr>& children) {
+    cpu::MaskedPool(out->val(), children[0]->val(), children[1]->val(), mean);
+  };
+  return lambda({x, mask}, outShape, x->value_type(), fwd, util::hashArgs(std::string("maskedPool"), mean));
+}
+
+Expr cosine(Expr a, Expr b) {
+  auto graph = a->graph();
+  if(!graph->isInference() || graph->getDeviceId().type != DeviceType::cpu
+     || a->value_type() != Type::float32 || b->value_type() != Type::float32)
+    return scalar_product(a, b, /*axis=*/-1) / (sqrt(scalar_product(a, a, /*axis=*/-1)) * sqrt(scalar_product(b, b, /*axis=*/-1)));
+
+  Shape outShape = a->shape();
+  outShape.set(-1, 1);
+  auto fwd = [](Expr out, const std::vector<Expr>& children) {
+    cpu::Cosine(out->val(), children[0]->val(), children[1]->val());
+  };
+  return lambda({a, b}, outShape, a->value_type(), fwd, util::hashArgs(std::string("cosine")));
+}
+
+Expr tiledAttention(Expr q, Expr k, Expr v, Expr logMask, float scale) {
+  auto graph = q->graph();
+  bool float32 = q->value_type() == Type::float32 && k->value_type() == Type::float32
+                 && v->value_type() == Type::float32 && (!logMask || logMask->value_type() == Type::float32);
+  if(!graph->isInference() || !float32) {
+    auto z = bdot_legacy(q, k, false, true, scale);
+    auto weights = logMask ? maskedSoftmax(z, logMask) : softmax(z);
+    return bdot_legacy(weights, v);
+  }
+
+  Shape outShape = q->shape();
+  outShape.set(-1, v->shape()[-1]);
+
+  auto fwd = [scale](Expr out, const std::vector<Expr>& children) {
+    AttentionBias bias;
+    if(children.size() > 3)
+      bias.logMask = children[3]->val();
+    TiledAttention(out->val(), children[0]->val(), children[1]->val(), children[2]->val(), bias, scale);
+  };
+
+  std::vector<Expr> nodes = {q, k, v};
+  if(logMask)
+    nodes.push_back(logMask);
+  return lambda(nodes, outShape, q->value_type(), fwd, util::hashArgs(std::string("tiledAttention"), scale));
+}
+
+Expr embedWithPositions(Expr embeddings, Expr indices, Expr weights, Expr offsets, const Shape& shape,
+                        float scale, int start, int positionAxis) {
+  auto graph = embeddings->graph();
+  int axis = shape.axis(positionAxis);
+  bool cpu = graph->getDeviceId().type == DeviceType::cpu;
+  if(!graph->isInference() || (cpu && embeddings->value_type() != Type::float32)) {
+    int dimRows = (int)(shape.elements() / shape[-1]);
+    auto selected = weights ? csr_dot(Shape({dimRows, embeddings->shape()[0]}), weights, indices, offsets, embeddings)
+                            : rows(embeddings, indices);
+    Shape signalShape(std::vector<int>(shape.size() - axis, 1)); // e.g. [dimWords, 1, dimEmb] for axis -3
+    signalShape.set(0, shape[axis]);
+    signalShape.set(-1, shape[-1]);
+    auto signal = graph->constant(signalShape, inits::sinusoidalPositionEmbeddings(start), embeddings->value_type());
+    return scale * reshape(selected, shape) + signal;
+  }
+
+  auto fwd = [scale, start, positionAxis](Expr out, const std::vector<Expr>& children) {
+    Tensor csrWeights = children.size() > 2 ? children[2]->val() : nullptr;
+    Tensor csrOffsets = children.size() > 2 ? children[3]->val() : nullptr;
+    EmbedWithPositions(out->val(), children[0]->val(), children[1]->val(), csrWeights, csrOffsets, scale, start, positionAxis);
+  };
+
+  std::vector<Expr> nodes = {embeddings, indices};
+  if(weights)
+    nodes.insert(nodes.end(), {weights, offsets});
+  return lambda(nodes, shape, embeddings->value_type(), fwd,
+                util::hashArgs(std::string("embedWithPositions"), scale, start, positionAxis));
+}
+
 // @TODO: add mask
 Expr logsoftmax(Expr a) {
+  if(a->type() == "logsoftmax_shortlist") // already normalized, e.g. when the decoder normalizes fused output logits again
+    return a;
   return Expression<LogSoftmaxNodeOp>(a);
 }
 
@@ -561,7 +671,9 @@ Expr dot(Expr a, Expr b, bool transA, bool transB, float scale) {
   // --optimize --cpu-thread=N with N > 0 are set.
   if(device == DeviceType::cpu) {
     if(isFloat(aElementType) && isFloat(bElementType)) {
-      if(b->memoize() && (a->graph()->getBackend()->getGemmType() == GemmType::FbFp16Packed ||
+      if(b->memoize() && cpu::sparse::isSparse(b, transB)) {
+        return cpu::sparse::affineOrDot(a, b, nullptr, transA, scale);
+      } else if(b->memoize() && (a->graph()->getBackend()->getGemmType() == GemmType::FbFp16Packed ||
         a->graph()->getBackend()->getGemmType() == GemmType::FbInt8Packed)) {
 #if USE_FBGEMM
         if(a->graph()->getBackend()->getGemmType() == GemmType::FbFp16Packed) {
@@ -602,6 +714,8 @@ Expr dot(Expr a, Expr b, bool transA, bool transB, float scale) {
       }
     } else if(isFloat(aElementType) && isIntgemm(bElementType)) {
       return cpu::integer::affineOrDot(a, b, nullptr, transA, transB, scale);
+    } else if(isFloat(aElementType) && isBFloat16(bElementType)) {
+      return cpu::bf16::affineOrDot(a, b, nullptr, transA, transB, scale);
     } else if(isFloat(aElementType) && isPacked(bElementType)) {
 #if USE_FBGEMM
       // 07/10/2019 - Use packed GEMM only if the cpu architecture supports AVX2
@@ -627,6 +741,8 @@ Expr dot(Expr a, Expr b, bool transA, bool transB, float scale) {
     } else {
       ABORT("Combination of types A: {} B: {} not supported", aElementType, bElementType);
     }
+  } else if(isFloat(aElementType) && isGpuInt8(bElementType)) {
+    return gpu::int8gemm::affineOrDot(a, b, nullptr, transA, transB, scale);
   } else {
     return Expression<DotNodeOp>(a, b, transA, transB, scale);
   }
@@ -640,6 +756,68 @@ Expr bdot_legacy(Expr a, Expr b, bool transA, bool transB, float scale) {
   return Expression<DotBatchedLegacyNodeOp>(a, b, transA, transB, scale);
 }
 
+// GEMMs straight from or to heads that are side by side in the last dimension, float16 only on the GPU
+static bool useHeadsGemm(Expr a, Expr b) {
+  auto graph = a->graph();
+  Type type = a->value_type();
+  bool supported = type == Type::float32 || (type == Type::float16 && graph->getDeviceId().type == DeviceType::gpu);
+  return graph->isInference() && supported && b->value_type() == type;
+}
+
+Expr bdotSplitHeads(Expr q, Expr k, int numHeads, float scale) {
+  int dimQuery = q->shape()[-2];
+  int dimKeys  = k->shape()[-2];
+  int dimModel = q->shape()[-1];
+  int batchQ   = q->shape().elements() / (dimQuery * dimModel);
+  int batchK   = k->shape().elements() / (dimKeys * dimModel);
+  ABORT_IF(dimModel % numHeads != 0, "Dimension {} is not divisible by {} heads", dimModel, numHeads);
+  int dimHead  = dimModel / numHeads;
+
+  if(!useHeadsGemm(q, k)) {
+    auto qh = transpose(reshape(q, {batchQ, dimQuery, numHeads, dimHead}), {0, 2, 1, 3});
+    auto kh = transpose(reshape(k, {batchK, dimKeys, numHeads, dimHead}), {0, 2, 1, 3});
+    return bdot_legacy(qh, kh, false, true, scale);
+  }
+
+  auto fwd = [numHeads, scale](Expr out, const std::vector<Expr>& children) {
+    ProdBatchedHeads(out->val(), out->graph()->allocator(), children[0]->val(), children[1]->val(),
+                     /*scores=*/true, numHeads, scale);
+  };
+  return lambda({q, k}, {batchQ, numHeads, dimQuery, dimKeys}, q->value_type(), fwd,
+                util::hashArgs(std::string("bdotSplitHeads"), numHeads, scale));
+}
+
+Expr bdotJoinHeads(Expr weights, Expr v, int numHeads) {
+  int dimQuery = weights->shape()[-2];
+  int dimKeys  = v->shape()[-2];
+  int dimModel = v->shape()[-1];
+  int batchQ   = weights->shape().elements() / (numHeads * dimQuery * dimKeys);
+  int batchV   = v->shape().elements() / (dimKeys * dimModel);
+  ABORT_IF(dimModel % numHeads != 0, "Dimension {} is not divisible by {} heads", dimModel, numHeads);
+  int dimHead  = dimModel / numHeads;
+
+  if(!useHeadsGemm(weights, v)) {
+    auto vh = transpose(reshape(v, {batchV, dimKeys, numHeads, dimHead}), {0, 2, 1, 3});
+    auto output = bdot_legacy(reshape(weights, {batchQ, numHeads, dimQuery, dimKeys}), vh);
+    return reshape(transpose(output, {0, 2, 1, 3}), {batchQ, dimQuery, dimModel});
+  }
+
+  auto fwd = [numHeads](Expr out, const std::vector<Expr>& children) {
+    ProdBatchedHeads(out->val(), out->graph()->allocator(), children[0]->val(), children[1]->val(),
+                     /*scores=*/false, numHeads, 1.f);
+  };
+  return lambda({weights, v}, {batchQ, dimQuery, dimModel}, v->value_type(), fwd,
+                util::hashArgs(std::string("bdotJoinHeads"), numHeads));
+}
+
+// With --fp8, affine transformations by a weight parameter get FP8 GEMMs, whose scalings are named after the
+// parameter. Transposed weights, e.g. tied output layers, stay in the precision of the graph.
+static std::string fp8Scaling(Expr x, Expr W, bool transA = false, bool transB = false) {
+  if(transA || transB || !x->graph()->getBackend()->getFp8() || !std::dynamic_pointer_cast<ParamNode>(W))
+    return "";
+  return W->name();
+}
+
 Expr affineDefault(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
   // general version, MKL, CBlas or CUDA
   std::vector<Expr> nodes = { a, b, bias };
@@ -650,7 +828,7 @@ Expr affineDefault(Expr a, Expr b, Expr bias, bool transA, bool transB, float sc
     Expr ones = a->graph()->ones({ rows, 1 }, bias->value_type());
     nodes.push_back(ones);
   }
-  return Expression<AffineNodeOp>(nodes, transA, transB, scale);
+  return Expression<AffineNodeOp>(nodes, transA, transB, scale, fp8Scaling(a, b, transA, transB));
 }
 
 // This operation used to implement auto-tuning. We have removed it for now due to complexity, but plan to revisit it in the future.
@@ -666,7 +844,9 @@ Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
 
   if(device == DeviceType::cpu) {
     if(isFloat(aElementType) && isFloat(bElementType)) {
-      if(a->graph()->getBackend()->isOptimized()) {
+      if(b->memoize() && cpu::sparse::isSparse(b, transB)) {
+        return cpu::sparse::affineOrDot(a, b, bias, transA, scale);
+      } else if(a->graph()->getBackend()->isOptimized()) {
         if(b->memoize() && (a->graph()->getBackend()->getGemmType() == GemmType::FbFp16Packed ||
           a->graph()->getBackend()->getGemmType() == GemmType::FbInt8Packed)) {
 #if USE_FBGEMM
@@ -710,6 +890,8 @@ Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
       }
     } else if(isFloat(aElementType) && isIntgemm(bElementType)) {
       return cpu::integer::affineOrDot(a, b, bias, transA, transB, scale);
+    } else if(isFloat(aElementType) && isBFloat16(bElementType)) {
+      return cpu::bf16::affineOrDot(a, b, bias, transA, transB, scale);
     } else if(isFloat(aElementType) && isPacked(bElementType)) {
 #if USE_FBGEMM
       // 07/10/2019 - Use packed GEMM only if the cpu architecture supports AVX2
@@ -736,6 +918,8 @@ Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
     } else {
       ABORT("Combination of types A: {} B: {} not supported", aElementType, bElementType);
     }
+  } else if(isFloat(aElementType) && isGpuInt8(bElementType)) {
+    return gpu::int8gemm::affineOrDot(a, b, bias, transA, transB, scale);
   } else {
     // Default GEMM
     ABORT_IF(!isFloat(aElementType) || !isFloat(bElementType),
@@ -746,18 +930,74 @@ Expr affine(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
 }
 
 // @TODO: unify all these
-Expr affineWithReluDropout(Expr x, Expr W, Expr bias, float dropProb) {
+Expr affineWithReluDropout(Expr x, Expr W, Expr bias, float dropProb, const Shape::Axes& axes) {
   auto graph = x->graph();
-  if(graph->isInference() && graph->getDeviceId().type == DeviceType::gpu) {
+  if(graph->isInference() && graph->getDeviceId().type == DeviceType::gpu && isGpuInt8(W->value_type())) {
+    // relu is applied when the int32 result is unquantized
+    return gpu::int8gemm::affineOrDot(x, W, bias, false, false, 1.f, /*doRelu=*/true);
+  } else if(graph->isInference() && graph->getDeviceId().type == DeviceType::gpu) {
     // not doing any dropout in inference mode
-    return Expression<AffineWithReluNodeOp>(x, W, bias);
+    return Expression<AffineWithReluNodeOp>(x, W, bias, fp8Scaling(x, W));
+  } else if(!graph->isInference() && isFloat(x->value_type()) && isFloat(W->value_type())) {
+    // bias, relu and dropout in one node, the CPU in inference goes through affine() for its packed GEMMs
+    int rows = x->shape().elements() / x->shape()[-1];
+    std::vector<Expr> nodes = {x, W, bias, graph->ones({rows, 1}, bias->value_type())};
+    if(dropProb) {
+      Shape outShape = x->shape();
+      outShape.set(-1, W->shape()[-1]);
+      nodes.push_back(graph->dropoutMask(dropProb, outShape.fromAxes(axes)));
+    }
+    return Expression<AffineWithReluNodeOp>(nodes, fp8Scaling(x, W));
   } else {
     Expr output = affine(x, W, bias);
-    output = dropoutReluInplace(output, dropProb, Shape::Axes({-2, -1}));
+    output = dropoutReluInplace(output, dropProb, axes);
     return output;
   }
 }
 
+Expr affineWithReluDropout(Expr x, Expr W, Expr bias, float dropProb) {
+  return affineWithReluDropout(x, W, bias, dropProb, Shape::Axes({-2, -1}));
+}
+
+Expr logsoftmax_shortlist(Expr x, Expr W, Expr indices, Expr bias) {
+  std::vector<Expr> nodes = {x, W, indices};
+  if(bias)
+    nodes.push_back(bias);
+  return Expression<LogSoftmaxShortlistNodeOp>(nodes);
+}
+
+Expr gumbel_sampling(Expr logits, SamplingMethod method, float param, float temperature, bool normalize) {
+  auto noise = constant_like(logits, inits::gumbel());
+  return Expression<GumbelSamplingNodeOp>(logits, noise, method, param, temperature, normalize);
+}
+
+Expr affineRows(Expr x, Expr W, Expr indices, Expr bias) {
+  auto graph = x->graph();
+  if(graph->isInference() && graph->getDeviceId().type == DeviceType::cpu
+     && graph->getBackend()->getGemmType() == GemmType::FbInt8Packed && W->memoize()
+     && isFloat(x->value_type()) && isFloat(W->value_type())) {
+#if USE_FBGEMM
+    if(fbgemm::fbgemmHasAvx2Support()) {
+      Type packType = fbgemm::fbgemmHasAvx512Support() ? Type::packed8avx512 : Type::packed8avx2;
+      // quantized once per graph as W is memoized, only the selected rows are packed for every batch
+      auto quantizedW = cpu::variant::quantize(W, /*transpose=*/true, graph->getBackend()->getQuantizeRange());
+      auto packedWt = cpu::variant::packColumns(packType, quantizedW, indices);
+      Shape shortShape = {(int)indices->shape().elements(), W->shape()[-1]};
+      if(bias)
+        return cpu::variant::affine(packType, x, packedWt, shortShape, index_select(bias, -1, indices), false, true, 1.f);
+      else
+        return cpu::variant::dot(packType, x, packedWt, shortShape, false, true, 1.f);
+    }
+#endif  // USE_FBGEMM
+  }
+
+  auto Wt = index_select(W, 0, indices);
+  if(bias)
+    return affine(x, Wt, index_select(bias, -1, indices), false, true);
+  else
+    return dot(x, Wt, false, true);
+}
+
 Expr dropoutReluInplace(Expr x, Expr mask) {
   return Expression<DropoutReluInplaceNodeOp>(x, mask);
 }
@@ -866,10 +1106,55 @@ Expr cast(Expr a, Type type) {
   }
 }
 
+// Cross-entropy of the logits z of the part of the vocabulary of each rank: log(sum(exp(z))) of the whole vocabulary
+// is that of the partial log-sum-exps of the ranks, and the label only picks a logit on the rank that holds it.
+// Only [rows, ranks] log-sum-exps and [rows, 1] picked and mean logits are exchanged, never the logits.
+static Expr vocabParallelCrossEntropy(Expr logits, Expr indices, float labelSmoothingAlpha, Type outputType) {
+  auto tensorParallel = logits->graph()->getTensorParallel();
+  int dimPart = logits->shape()[-1];
+  int rows = logits->shape().elements() / dimPart;
+  ABORT_IF(rows != (int)indices->shape().elements(),
+           "Number of examples and labels does not match: {} != {}", rows, indices->shape().elements());
+  auto z = cast(reshape(logits, {rows, dimPart}), Type::float32);
+
+  // [ranks, rows] partial log-sum-exps of the ranks
+  auto partialLse = all_gather(reshape(logsumexp(z, /*axis=*/-1), {1, rows}));
+  auto lse = reshape(logsumexp(partialLse, /*axis=*/0), {rows, 1});
+
+  // the labels relative to the first class of this rank, picked if within its part and as 0 otherwise
+  float offset = (float)(tensorParallel->rank() * dimPart);
+  auto labels = reshape(cast(indices, Type::float32) - offset, {rows, 1});
+  auto isLocal = ge(labels, 0.f) * lt(labels, (float)dimPart);
+  auto localLabels = cast(minimum(maximum(labels, 0.f), (float)(dimPart - 1)), Type::uint32);
+  auto picked = all_reduce(gather(z, /*axis=*/-1, localLabels) * isLocal);
+
+  auto ce = lse - picked;
+  if(labelSmoothingAlpha != 0.f) {
+    int dimVocab = dimPart * (int)tensorParallel->ranks();
+    auto mean = all_reduce(sum(z, /*axis=*/-1)) / (float)dimVocab;
+    ce = (1.f - labelSmoothingAlpha) * ce + labelSmoothingAlpha * (lse - mean);
+  }
+
+  Shape shape = logits->shape();
+  shape.set(-1, 1);
+  return cast(reshape(ce, shape), outputType);
+}
+
 Expr cross_entropy(Expr logits, Expr indices, float labelSmoothingAlpha, Type outputType) {
+  if(logits->type() == "chunked-logits")
+    return Expression<ChunkedCrossEntropyNodeOp>(logits, indices, labelSmoothingAlpha, outputType);
+  if(logits->type() == "vocab-parallel-logits")
+    return vocabParallelCrossEntropy(logits, indices, labelSmoothingAlpha, outputType);
   return Expression<CrossEntropyNodeOp>(logits, indices, labelSmoothingAlpha, outputType);
 }
 
+Expr chunked_logits(Expr x, Expr W, Expr bias, bool transB, int chunkRows) {
+  std::vector<Expr> nodes = {x, W};
+  if(bias)
+    nodes.push_back(bias);
+  return Expression<ChunkedLogitsNodeOp>(nodes, transB, chunkRows);
+}
+
 // Unlikelihood loss based on https://arxiv.org/abs/1908.04319
 Expr unlikelihood(Expr logits, Expr indices) {
   int dimBatch = logits->shape()[-2];
@@ -954,11 +1239,72 @@ Expr rmsNorm(Expr x,
   return Expression<RMSNormalizationOp>(nodes, eps);
 }
 
+// whether a dropout mask repeats over the leading rows of x, i.e. its shape is a suffix of the shape of x preceded
+// by ones, as for dropout over the axes {-2, -1} or {-1}
+static bool masksWholeRows(Expr mask, Expr x) {
+  const auto& maskShape = mask->shape();
+  const auto& shape = x->shape();
+  if(maskShape.size() > shape.size())
+    return false;
+  bool suffix = true;
+  for(int i = 1; i <= (int)shape.size(); ++i) {
+    int dim = i <= (int)maskShape.size() ? maskShape[-i] : 1;
+    if(suffix && dim == shape[-i])
+      continue;
+    suffix = false;
+    if(dim != 1)
+      return false;
+  }
+  return maskShape[-1] == shape[-1];
+}
+
+// The GPU fuses dropout, skip connection and normalization in training and inference. The CPU only has a forward
+// pass without dropout, so it fuses in inference only.
+static bool useFusedSkipNorm(Expr x, Expr residual, Expr gamma, Expr mask) {
+  auto graph = x->graph();
+  if(!gamma || x->shape() != residual->shape() || x->value_type() != residual->value_type()
+     || x->value_type() != gamma->value_type())
+    return false;
+  if(graph->getDeviceId().type == DeviceType::gpu)
+    return (x->value_type() == Type::float32 || x->value_type() == Type::float16)
+           && (!mask || (mask->value_type() == x->value_type() && masksWholeRows(mask, x)));
+  return graph->isInference() && !mask && x->value_type() == Type::float32;
+}
+
+static Expr addNormalization(Expr x, Expr residual, Expr gamma, Expr beta, float eps, Expr mask, bool rms) {
+  if(!useFusedSkipNorm(x, residual, gamma, mask)) {
+    auto sum = dropout(x, mask) + residual;
+    return rms ? rmsNorm(sum, gamma, beta, eps) : layerNorm(sum, gamma, beta, eps);
+  }
+
+  std::vector<Expr> nodes = {x, residual, gamma};
+  if(beta)
+    nodes.push_back(beta);
+  if(mask)
+    nodes.push_back(mask);
+  return Expression<AddNormalizationOp>(nodes, (bool)mask, rms, eps);
+}
+
+Expr addLayerNorm(Expr x, Expr residual, Expr gamma, Expr beta, float eps, Expr mask) {
+  return addNormalization(x, residual, gamma, beta, eps, mask, /*rms=*/false);
+}
+
+Expr addRmsNorm(Expr x, Expr residual, Expr gamma, Expr beta, float eps, Expr mask) {
+  return addNormalization(x, residual, gamma, beta, eps, mask, /*rms=*/true);
+}
+
 Expr highway(Expr input1, Expr input2, Expr gate) {
   std::vector<Expr> nodes = {input1, input2, gate};
   return Expression<HighwayNodeOp>(nodes);
 }
 
+Expr cumulative_average(Expr average, Expr x, int count) {
+  ABORT_IF(count < 0, "Cannot average over {} values", count);
+  if(count == 0)
+    return x;
+  return Expression<CumulativeAverageNodeOp>(average, x, count);
+}
+
 Expr highway(const std::string prefix, Expr x) {
   // clang-format off
   size_t outDim = x->shape()[-1];
@@ -981,6 +1327,33 @@ Expr shift(Expr a, Shape shift, float padValue) {
   return Expression<ShiftNodeOp>(a, shift, padValue);
 }
 
+Expr all_reduce(Expr x) {
+  auto tensorParallel = x->graph()->getTensorParallel();
+  ABORT_IF(!tensorParallel, "all_reduce requires a tensor-parallel graph");
+  return Expression<AllReduceNodeOp>(x, tensorParallel);
+}
+
+Expr all_reduce_grad(Expr x) {
+  auto tensorParallel = x->graph()->getTensorParallel();
+  ABORT_IF(!tensorParallel, "all_reduce_grad requires a tensor-parallel graph");
+  return Expression<AllReduceGradNodeOp>(x, tensorParallel);
+}
+
+Expr all_gather(Expr x) {
+  auto tensorParallel = x->graph()->getTensorParallel();
+  ABORT_IF(!tensorParallel, "all_gather requires a tensor-parallel graph");
+  return Expression<AllGatherNodeOp>(x, tensorParallel);
+}
+
+Expr vocab_parallel_logits(Expr logits) {
+  ABORT_IF(!logits->graph()->getTensorParallel(), "vocab_parallel_logits requires a tensor-parallel graph");
+  return Expression<VocabParallelLogitsNodeOp>(logits);
+}
+
+Expr pooling_with_masking(Expr x, Expr mask, int width, bool isEven) {
+  return Expression<PoolingWithMaskingOp>(x, mask, width, isEven);
+}
+
 #ifdef CUDA_FOUND
 #ifdef CUDNN
 
@@ -1042,8 +1415,29 @@ Expr convertFromcudnnFormat(Expr x) {
   return reshape(rows(reshapedX, newIndeces), shape);
 }
 
-Expr pooling_with_masking(Expr x, Expr mask, int width, bool isEven) {
-  return Expression<PoolingWithMaskingOp>(x, mask, width, isEven);
+Expr cudnnBidirectionalGRU(Expr input, const std::vector<Expr>& weights, const std::vector<int>& lengths) {
+  ABORT_IF(weights.size() != 6, "cudnnBidirectionalGRU needs W, U and b of both directions");
+  int dimInput = weights[0]->shape()[-2];
+  int dimState = weights[1]->shape()[-2];
+  auto deviceId = input->graph()->getDeviceId();
+
+  // the cuDNN handle and descriptors are kept for the next batches on the same device
+  typedef std::tuple<size_t, int, int> Key;
+  static std::map<Key, Ptr<BidirectionalGRUWrapper>> wrappers;
+  static std::mutex mutex;
+  Ptr<BidirectionalGRUWrapper> gru;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& cached = wrappers[Key(deviceId.no, dimInput, dimState)];
+    if(!cached) {
+      cudaSetDevice((int)deviceId.no);
+      cached = New<BidirectionalGRUWrapper>(dimInput, dimState);
+    }
+    gru = cached;
+  }
+
+  auto packed = Expression<CudnnGRUWeightsOp>(weights, gru);
+  return Expression<CudnnBidirectionalGRUOp>(input, packed, gru, lengths);
 }
 
 #endif
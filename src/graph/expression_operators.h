@@ -512,6 +512,23 @@ Expr bdot_legacy(Expr a,
                  bool transB = false,
                  float scalar = 1.f);
 
+/**
+ * Attention logits scale * q_h * k_h^T of every head h, where q is [.., dimQuery, numHeads * dimHead] and k is
+ * [.., dimKeys, numHeads * dimHead] with the heads side by side, as they come out of the projections. The result
+ * is [batch, numHeads, dimQuery, dimKeys], where batch is the number of batch entries of q, and batch entries of k
+ * broadcast as in bdot_legacy(). In inference the GEMMs read the heads in place, otherwise q and k are split into
+ * [batch, numHeads, steps, dimHead] with a transposition first.
+ */
+Expr bdotSplitHeads(Expr q, Expr k, int numHeads, float scale = 1.f);
+
+/**
+ * Attention context weights_h * v_h of every head h, the counterpart to bdotSplitHeads(), where weights is
+ * [batch, numHeads, dimQuery, dimKeys] and v is [.., dimKeys, numHeads * dimHead]. The result has the heads side
+ * by side again, [batch, dimQuery, numHeads * dimHead], which in inference is written in place without the
+ * transposition of the split result.
+ */
+Expr bdotJoinHeads(Expr weights, Expr v, int numHeads);
+
 /**
  * Performs an affine transformation.
  * Computes
@@ -528,13 +545,59 @@ Expr affine(Expr a,
             float scalar = 1.f);
 
 /**
- * As above, but efficiently applies relu transformation to output. For inference only.
+ * As above, but efficiently applies relu transformation and dropout to output. The bias and relu
+ * go into the GEMM epilogue and dropout into the same node, for training and inference.
  */
 Expr affineWithReluDropout(Expr a,
                            Expr b,
                            Expr bias,
                            float dropProb = 0.f);
 
+/**
+ * As above, with a dropout mask that is shared along the given axes of the output.
+ */
+Expr affineWithReluDropout(Expr a,
+                           Expr b,
+                           Expr bias,
+                           float dropProb,
+                           const Shape::Axes& axes);
+
+/**
+ * Computes normalized log-probabilities over the rows of @p W that a shortlist selects per query,
+ * i.e. logsoftmax(x * W[indices]^T + bias[indices]), without gathering the selected rows first.
+ * For inference only and float32 weights.
+ * @param x queries of shape [beam, batch, 1, dim]
+ * @param W output embeddings of shape [vocab, dim]
+ * @param indices row indices into @p W of shape [beam, batch, k] or [1, batch, k] (shared over the beam)
+ * @param bias optional bias of shape [1, vocab]
+ * @return log-probabilities of shape [beam, batch, 1, k]
+ */
+Expr logsoftmax_shortlist(Expr x, Expr W, Expr indices, Expr bias = nullptr);
+
+/**
+ * Gumbel-max sampling from truncated rows of @p logits in one kernel, i.e. logsoftmax(logits / temperature + g) with
+ * Gumbel noise g over the logits that the truncation keeps and -inf for the others, so that the best entries of the
+ * result are a sample. Top-k and nucleus truncation find their threshold without sorting the rows.
+ * For inference only and float32 logits.
+ * @param method truncation, see SamplingMethod
+ * @param param k of top-k, probability mass of the nucleus or smallest kept probability of epsilon sampling
+ * @param normalize log-normalize the logits before the thresholds of nucleus and epsilon sampling are applied
+ */
+Expr gumbel_sampling(Expr logits, SamplingMethod method, float param, float temperature = 1.f, bool normalize = false);
+
+/**
+ * Affine transformation with the rows of @p W that a static shortlist selects,
+ * i.e. x * W[indices]^T + bias[indices], or without bias if @p bias is nullptr.
+ * In CPU inference with `--gemm-type packed8avx2/packed8avx512`, the selected rows are packed from an int8
+ * quantization of @p W that is computed once, instead of falling back to a float32 GEMM over the gathered rows.
+ * @param x queries of shape [.., dim]
+ * @param W output embeddings of shape [vocab, dim]
+ * @param indices row indices into @p W of shape [k]
+ * @param bias optional bias of shape [1, vocab]
+ * @return logits of shape [.., k]
+ */
+Expr affineRows(Expr x, Expr W, Expr indices, Expr bias = nullptr);
+
 /**
  * Computes the dot product of CSR-tensor @p A with @p B.
  */
@@ -922,6 +985,46 @@ Expr softmax(Expr x, int axis = -1);
  */
 Expr softmax(Expr a, Expr zeroOneMask, int axis = -1);
 
+/**
+ * Softmax of scaled and masked scores along the last axis, i.e. softmax(scale * a + logMask), where logMask
+ * is added (not multiplied) and broadcasts against a, e.g. for attention. In inference on the CPU this is a
+ * single kernel that reads the scores once instead of one pass for each of scaling, masking and softmax.
+ */
+Expr maskedSoftmax(Expr a, Expr logMask, float scale = 1.f);
+
+/**
+ * Max, or with @p mean the mean, of the encoder states @p x [steps, dimBatch, dimModel] over the steps where
+ * @p mask [steps, dimBatch, 1] is 1, i.e. a sentence embedding [1, dimBatch, dimModel]. In inference on the CPU this
+ * is a single kernel that skips the masked steps instead of masking, reducing and dividing in separate passes.
+ */
+Expr maskedPool(Expr x, Expr mask, bool mean = false);
+
+/**
+ * Cosines of the vectors along the last axis of @p a and @p b of the same shape, with a last dimension of 1. In
+ * inference on the CPU this is a single kernel that computes the dot product and both lengths in one pass.
+ */
+Expr cosine(Expr a, Expr b);
+
+/**
+ * Attention output softmax(scale * q * k^T + logMask) * v, where q is [dimBeam, dimBatch * numHeads, dimQuery, dimHead],
+ * k and v are [.., dimKeys, dimHead] and broadcast along leading dimensions as in bdot_legacy(), and logMask, which
+ * may be null, broadcasts against the scores. In inference with float32 on the CPU or GPU the scores are computed
+ * tile by tile with an online softmax and the [dimQuery, dimKeys] matrix is never materialized, hence memory no
+ * longer grows quadratically with the input length. Otherwise this is the composition of the above operators.
+ */
+Expr tiledAttention(Expr q, Expr k, Expr v, Expr logMask, float scale = 1.f);
+
+/**
+ * Embeddings of shape @p shape with scale and sinusoidal position embeddings applied, i.e.
+ * scale * reshape(rows(embeddings, indices), shape) + sinusoids of the positions start, start + 1, .. along
+ * @p positionAxis as the constant inits::sinusoidalPositionEmbeddings() produces them. With @p weights and
+ * @p offsets the rows are the CSR product csr_dot() of a factored vocabulary instead. In inference the encoder and
+ * decoder inputs come straight from the word indices in one operation, otherwise this is the composition of the
+ * above operators.
+ */
+Expr embedWithPositions(Expr embeddings, Expr indices, Expr weights, Expr offsets, const Shape& shape,
+                        float scale, int start, int positionAxis = -3);
+
 /**
  * Computes the log of the softmax function along the last axis.
  * Applies @f$ \log(\operatorname{softmax}(x)) @f$.
@@ -942,6 +1045,14 @@ Expr sparsemax(Expr a, int axis = -1);
  */
 Expr cross_entropy(Expr a, Expr b, float labelSmoothingAlpha = 0.f, Type outputType = Type::float32);
 
+/**
+ * The logits x * op(W) + bias of an output layer for cross_entropy() only, which then computes the logits and their
+ * gradient in blocks of chunkRows rows instead of holding them for the whole batch. Reading the logits with any
+ * other operator aborts.
+ * @see ChunkedLogitsNodeOp, ChunkedCrossEntropyNodeOp
+ */
+Expr chunked_logits(Expr x, Expr W, Expr bias, bool transB, int chunkRows);
+
 /**
  * Computes the unlikelihood loss.
  * Computes the <a href="https://arxiv.org/abs/1908.04319">unlikelihood</a> loss
@@ -982,6 +1093,20 @@ Expr layerNorm(Expr x, Expr gamma = nullptr, Expr beta = nullptr, float eps = 1e
  */
 Expr rmsNorm(Expr x, Expr gamma = nullptr, Expr beta = nullptr, float eps = 1e-9);
 
+/**
+ * Layer normalization of a skip connection after optional dropout, i.e.
+ * layerNorm(dropout(x, mask) + residual, gamma, beta, eps). On the GPU this is a single kernel in the forward and in
+ * the backward pass, which recomputes the sum instead of storing it, if the mask repeats over the leading rows of x
+ * (e.g. dropout over the axes {-2, -1}). On the CPU, inference without a mask is a single pass over both inputs.
+ */
+Expr addLayerNorm(Expr x, Expr residual, Expr gamma, Expr beta = nullptr, float eps = 1e-9, Expr mask = nullptr);
+
+/**
+ * RMS normalization of a skip connection after optional dropout, i.e.
+ * rmsNorm(dropout(x, mask) + residual, gamma, beta, eps), fused like addLayerNorm().
+ */
+Expr addRmsNorm(Expr x, Expr residual, Expr gamma, Expr beta = nullptr, float eps = 1e-9, Expr mask = nullptr);
+
 /**
  * Highway transformation.
  * Computes the highway tranform on @p y and @p x as gated by @p t:
@@ -997,6 +1122,14 @@ Expr highway(Expr y, Expr x, Expr t);
  */
 Expr highway(const std::string prefix, Expr x);
 
+/**
+ * Cumulative average of @p count earlier values and the next one in a single kernel, i.e.
+ * @f$ (\mathrm{average} \cdot \mathrm{count} + x) / (\mathrm{count} + 1) @f$, e.g. for the incremental
+ * state of average attention networks.
+ * @see CumulativeAverageNodeOp
+ */
+Expr cumulative_average(Expr average, Expr x, int count);
+
 /**
  * Performs dropout using a given mask.
  */
@@ -1077,10 +1210,47 @@ Expr max_pooling(Expr x,
                  int strideWidth = 1);
 
 /**
- * Pooling operation with masking.
- * @warning not implemented
+ * Max pooling with masking over windows of @p width steps of the last axis of @p x [dimBatch, numKernels, steps],
+ * with @p mask [dimBatch, 1, steps]. An even padded convolution has one step too many, set @p isEven to skip it.
+ * The result has shape [dimBatch, numKernels, windows] but the elements of [windows, dimBatch, numKernels].
+ * @see PoolingWithMaskingOp
  */
 Expr pooling_with_masking(Expr x, Expr mask, int width, bool isEven = false);
 
+/**
+ * Sums the partial outputs x of the ranks of a tensor-parallel graph, see ExpressionGraph::setTensorParallel().
+ * The gradient of x is that of the sum on every rank.
+ */
+Expr all_reduce(Expr x);
+
+/**
+ * Passes on the input x that all ranks of a tensor-parallel graph share, and sums the gradients of the ranks for it.
+ * The counterpart of all_reduce() in front of layers whose parameters are split between the ranks.
+ */
+Expr all_reduce_grad(Expr x);
+
+/**
+ * Gathers the parts x of all ranks of a tensor-parallel graph one after the other along the first axis, which then
+ * has ranks() times the size of that of x. The gradient of x is the part of this rank of the gradient of the result.
+ */
+Expr all_gather(Expr x);
+
+/**
+ * Marks the logits of the part of the output vocabulary of this rank of a tensor-parallel graph, the consecutive
+ * classes from rank() times the number of local classes on. cross_entropy() of them combines the partial
+ * log-sum-exps and the picked logits of all ranks instead of gathering the logits of the whole vocabulary.
+ * @see VocabParallelLogitsNodeOp
+ */
+Expr vocab_parallel_logits(Expr logits);
+
+/**
+ * Runs a single-layer bidirectional GRU over the whole sequences with cuDNN, for inference on GPUs.
+ * @param input time-major input of shape [dimTime, dimBatch, dimInput], right-padded
+ * @param weights W, U and b of the forward and then of the backward GRU, as in rnn::GRU with the gates r, z, h
+ * @param lengths the length of each of the dimBatch sequences
+ * @return the states of shape [dimTime, dimBatch, 2 * dimState], forward then backward, zeros at padded positions
+ */
+Expr cudnnBidirectionalGRU(Expr input, const std::vector<Expr>& weights, const std::vector<int>& lengths);
+
 ///@}
 }  // namespace marian
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "graph/node_operators.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+/**
+ * The nodes of a subgraph of an inference graph that was built once, see ExpressionGraph::freeze(). After the graph
+ * was cleared, ExpressionGraph::replay() adds them to the forward tape again with new values for the named input
+ * constants, e.g. the words and the mask of the next batch of the same shape, instead of building and hashing all
+ * nodes again.
+ *
+ * The forward pass of inference clears the children of its nodes to free their values as early as possible, so a
+ * frozen graph keeps the children of its nodes and the value of each node is freed explicitly after the last node
+ * that reads it ran. Outputs are never freed within the forward pass.
+ *
+ * Destroy a frozen graph only after the graph it belongs to was cleared or while none of its outputs are in use.
+ */
+class FrozenGraph {
+  friend class ExpressionGraph;
+
+  std::vector<Expr> nodes_;                  // in the order of the forward tape
+  std::vector<std::vector<Expr>> children_;  // of nodes_, which also includes parameters and memoized nodes
+  std::vector<std::vector<Expr>> freeAfter_; // for each node of nodes_, the values that are no longer needed after it ran
+  std::vector<std::pair<IPtr<ConstantNode>, Ptr<inits::NodeInitializer>>> constants_; // and their initializers
+  std::unordered_map<std::string, size_t> inputs_; // names of input constants and their index into constants_
+  std::vector<Expr> outputs_;
+
+public:
+  ~FrozenGraph() {
+    // the values of a cleared graph must not be freed, their memory may belong to other nodes by now
+    for(auto& node : nodes_)
+      node->resetVal();
+  }
+
+  const std::vector<Expr>& outputs() const { return outputs_; }
+
+  size_t size() const { return nodes_.size(); }
+};
+
+}  // namespace marian
@@ -0,0 +1,177 @@
+#include "graph/memory_planner.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace marian {
+
+static const size_t NOT_FREED = std::numeric_limits<size_t>::max();
+
+void MemoryPlanner::begin(size_t key, Ptr<Allocator> allocator) {
+  end();
+  allocator_ = allocator;
+  key_ = key;
+  step_ = 0;
+  active_ = true;
+
+  auto it = plans_.find(key);
+  if(it == plans_.end()) { // record this pass
+    plan_ = nullptr;
+    recorded_.clear();
+    recordedPieces_.clear();
+    return;
+  }
+
+  plan_ = &it->second;
+  mispredicted_ = false;
+  blockAlive_.assign(plan_->blocks.size(), 0);
+  if(plan_->peak > 0) {
+    arena_ = New<Arena>();
+    arena_->memory = allocator_->alloc(plan_->peak);
+  }
+}
+
+void MemoryPlanner::end() {
+  if(!active_)
+    return;
+  active_ = false;
+
+  if(!plan_) {
+    if(plans_.size() >= maxPlans_)
+      plans_.clear();
+    plans_[key_] = makePlan(recorded_);
+    recorded_.clear();
+    recordedPieces_.clear();
+    return;
+  }
+
+  // blocks that are still alive outlive the pass they were planned for
+  if(arena_ && arena_->alive > 0)
+    mispredicted_ = true;
+  if(mispredicted_)
+    plans_.erase(key_);
+  plan_ = nullptr;
+
+  if(arena_ && arena_->alive == 0)
+    release(arena_);
+  arena_ = nullptr; // otherwise released by free() once its last block is freed
+}
+
+bool MemoryPlanner::allocate(Tensor& t, const Shape& shape, Type type) {
+  if(!active_ || !arena_)
+    return false;
+  auto it = plan_->blockOfStep.find(step_);
+  if(it == plan_->blockOfStep.end())
+    return false;
+
+  size_t index = it->second;
+  const auto& block = plan_->blocks[index];
+  bool rangeFree = std::none_of(block.predecessors.begin(), block.predecessors.end(),
+                                [this](size_t p) { return blockAlive_[p] != 0; });
+  if(!rangeFree || allocator_->alignedSize(requiredBytes(shape, type)) != block.bytes) {
+    mispredicted_ = true;
+    return false;
+  }
+
+  auto piece = allocator_->subPiece(arena_->memory, block.offset, block.bytes);
+  t = TensorBase::New(piece, shape, type, backend_);
+  blockAlive_[index] = 1;
+  arena_->alive++;
+  livePieces_[piece.get()] = std::make_pair(arena_, index);
+  return true;
+}
+
+void MemoryPlanner::allocated(const Tensor& t) {
+  if(!active_ || plan_)
+    return;
+  recordedPieces_[t->memory().get()] = recorded_.size();
+  recorded_.push_back({step_, t->memory()->size(), NOT_FREED});
+}
+
+bool MemoryPlanner::free(const Tensor& t) {
+  auto piece = t->memory().get();
+  if(active_ && !plan_) {
+    auto it = recordedPieces_.find(piece);
+    if(it != recordedPieces_.end()) {
+      recorded_[it->second].freeStep = step_;
+      recordedPieces_.erase(it);
+    }
+    return false;
+  }
+
+  auto it = livePieces_.find(piece);
+  if(it == livePieces_.end())
+    return false;
+  auto arena = it->second.first;
+  if(arena == arena_)
+    blockAlive_[it->second.second] = 0;
+  livePieces_.erase(it);
+  if(--arena->alive == 0 && arena != arena_)
+    release(arena);
+  return true;
+}
+
+void MemoryPlanner::clear() {
+  active_ = false;
+  plan_ = nullptr;
+  arena_ = nullptr;
+  recorded_.clear();
+  recordedPieces_.clear();
+  livePieces_.clear();
+}
+
+void MemoryPlanner::release(Ptr<Arena> arena) {
+  allocator_->free(arena->memory);
+}
+
+/*static*/ MemoryPlanner::Plan MemoryPlanner::makePlan(std::vector<Recorded>& recorded) {
+  Plan plan;
+  for(const auto& r : recorded) {
+    if(r.freeStep == NOT_FREED || plan.blockOfStep.count(r.step) > 0)
+      continue;
+    plan.blockOfStep[r.step] = plan.blocks.size();
+    plan.blocks.push_back({r.step, r.freeStep, r.bytes});
+  }
+
+  auto& blocks = plan.blocks;
+  auto liveTogether = [&](size_t a, size_t b) {
+    return blocks[a].allocStep <= blocks[b].freeStep && blocks[b].allocStep <= blocks[a].freeStep;
+  };
+  auto shareMemory = [&](size_t a, size_t b) {
+    return blocks[a].offset < blocks[b].offset + blocks[b].bytes && blocks[b].offset < blocks[a].offset + blocks[a].bytes;
+  };
+
+  // largest blocks first, each at the lowest offset that the placed blocks living at the same time leave free
+  std::vector<size_t> order(blocks.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return blocks[a].bytes > blocks[b].bytes; });
+
+  std::vector<size_t> placed;
+  for(size_t b : order) {
+    std::vector<size_t> conflicts;
+    for(size_t a : placed)
+      if(liveTogether(a, b))
+        conflicts.push_back(a);
+    std::sort(conflicts.begin(), conflicts.end(), [&](size_t x, size_t y) { return blocks[x].offset < blocks[y].offset; });
+
+    size_t offset = 0;
+    for(size_t a : conflicts) {
+      if(offset + blocks[b].bytes <= blocks[a].offset)
+        break;
+      offset = std::max(offset, blocks[a].offset + blocks[a].bytes);
+    }
+    blocks[b].offset = offset;
+    plan.peak = std::max(plan.peak, offset + blocks[b].bytes);
+    placed.push_back(b);
+  }
+
+  for(size_t b = 0; b < blocks.size(); ++b)
+    for(size_t a = 0; a < blocks.size(); ++a)
+      if(blocks[a].allocStep < blocks[b].allocStep && !liveTogether(a, b) && shareMemory(a, b))
+        blocks[b].predecessors.push_back(a);
+
+  return plan;
+}
+
+}  // namespace marian
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "tensors/allocator.h"
+#include "tensors/tensor.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+/**
+ * Static memory plans for the forward passes of inference graphs, see ExpressionGraph::setMemoryPlans().
+ *
+ * The first forward pass over a tape with a given key runs with the dynamic allocator and records, for every node
+ * that allocates its value, when it is allocated and when it is freed again within the pass. Values that outlive the
+ * pass, e.g. decoder states, stay with the allocator. The other ones become blocks with fixed offsets into one arena,
+ * placed largest first at the lowest offset that no block with an overlapping lifetime occupies. Later passes with
+ * the same key allocate the arena once and hand out its blocks without calling the allocator. The arena is at least
+ * as large as the most memory that is live at any step, and the placement is a heuristic for the NP-hard minimum,
+ * but unlike a best-fit free list it knows all lifetimes in advance and does not fragment over the pass.
+ *
+ * A replayed block is only handed out if all earlier blocks of its range have been freed, otherwise it comes from
+ * the allocator and the plan is recorded again next time. Hence plans stay correct if lifetimes differ between
+ * passes with the same key, they just save less.
+ */
+class MemoryPlanner {
+public:
+  MemoryPlanner(size_t maxPlans, Ptr<Backend> backend) : maxPlans_(maxPlans), backend_(backend) {}
+
+  // Starts the forward pass over a tape with the given key, which identifies its nodes, their shapes and children
+  void begin(size_t key, Ptr<Allocator> allocator);
+  // Ends the forward pass, turns a recording into a plan
+  void end();
+  // The tape position of the node that is allocated or runs next
+  void setStep(size_t step) { step_ = step; }
+
+  // Allocates t from the plan of the current pass and returns true, or returns false if the allocator has to
+  bool allocate(Tensor& t, const Shape& shape, Type type);
+  // To be called after the allocator allocated t for the node of the current step
+  void allocated(const Tensor& t);
+  // Returns true if t is a block of a plan and must not be freed by the allocator
+  bool free(const Tensor& t);
+
+  // Forgets all memory, as when the allocator is cleared. Plans are kept.
+  void clear();
+
+  size_t size() const { return plans_.size(); }
+
+private:
+  struct Block {
+    size_t allocStep;
+    size_t freeStep;
+    size_t bytes;
+    size_t offset{0};
+    std::vector<size_t> predecessors; // earlier blocks that share memory with this one, freed before it is allocated
+  };
+
+  struct Plan {
+    std::unordered_map<size_t, size_t> blockOfStep;
+    std::vector<Block> blocks;
+    size_t peak{0};
+  };
+
+  struct Arena {
+    MemoryPiece::PtrType memory;
+    size_t alive{0};
+  };
+
+  struct Recorded {
+    size_t step;
+    size_t bytes;
+    size_t freeStep;
+  };
+
+  static Plan makePlan(std::vector<Recorded>& recorded);
+  void release(Ptr<Arena> arena);
+
+  size_t maxPlans_;
+  Ptr<Backend> backend_;
+  std::unordered_map<size_t, Plan> plans_;
+
+  Ptr<Allocator> allocator_;
+  size_t key_{0};
+  size_t step_{0};
+  bool active_{false};
+
+  // recording pass
+  std::vector<Recorded> recorded_;
+  std::unordered_map<MemoryPiece*, size_t> recordedPieces_;
+
+  // replayed pass
+  Plan* plan_{nullptr};
+  bool mispredicted_{false};
+  Ptr<Arena> arena_;
+  std::vector<char> blockAlive_;
+  std::unordered_map<MemoryPiece*, std::pair<Ptr<Arena>, size_t>> livePieces_; // also of earlier passes' arenas
+};
+
+}  // namespace marian
@@ -0,0 +1,137 @@
+#include "graph/memory_profiler.h"
+#include "common/file_stream.h"
+#include "common/utils.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace marian {
+
+double MemoryProfiler::now() const {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count();
+}
+
+bool MemoryProfiler::beginPass(const std::string& kind) {
+  if(saved_)
+    return false;
+  if(kind == "forward" && forwardPasses_++ == maxPasses_) {
+    save();
+    return false;
+  }
+  double time = now();
+  if(!passes_.empty() && passes_.back().end < 0)
+    passes_.back().end = time;
+  passes_.push_back({kind, time});
+  return true;
+}
+
+void MemoryProfiler::allocated(Chainable<Tensor>* node, const Tensor& t, const std::string& kind) {
+  if(saved_ || !t)
+    return;
+  std::stringstream shape;
+  shape << t->shape();
+  size_t bytes = t->memory()->size();
+
+  live_[t->memory().get()] = allocations_.size();
+  allocations_.push_back({node->type() + " " + node->name(), kind, shape.str(), node->getId(), bytes, now(), -1, events_++});
+  (kind == "gradient" ? liveGradients_ : liveValues_) += bytes;
+  if(liveValues_ + liveGradients_ > peakBytes_) {
+    peakBytes_ = liveValues_ + liveGradients_;
+    peakEvent_ = events_;
+    peakTime_ = allocations_.back().begin;
+  }
+  sample();
+}
+
+void MemoryProfiler::freed(const Tensor& t) {
+  if(saved_ || !t)
+    return;
+  auto it = live_.find(t->memory().get());
+  if(it == live_.end())
+    return;
+  auto& allocation = allocations_[it->second];
+  allocation.end = now();
+  allocation.endEvent = ++events_;
+  (allocation.kind == "gradient" ? liveGradients_ : liveValues_) -= allocation.bytes;
+  live_.erase(it);
+  sample();
+}
+
+void MemoryProfiler::clear() {
+  if(saved_)
+    return;
+  double time = now();
+  ++events_;
+  for(auto& it : live_) {
+    allocations_[it.second].end = time;
+    allocations_[it.second].endEvent = events_;
+  }
+  live_.clear();
+  liveValues_ = liveGradients_ = 0;
+  sample();
+}
+
+void MemoryProfiler::sample() {
+  samples_.push_back({now(), liveValues_, liveGradients_,
+                      workspace_ ? workspace_->statistics().held : 0});
+}
+
+void MemoryProfiler::save() {
+  if(saved_)
+    return;
+  saved_ = true;
+
+  double time = now();
+  if(!passes_.empty() && passes_.back().end < 0)
+    passes_.back().end = time;
+
+  // the nodes that hold memory at the peak, largest first
+  std::vector<const Allocation*> holders;
+  for(const auto& allocation : allocations_)
+    if(allocation.beginEvent < peakEvent_ && (allocation.endEvent == 0 || allocation.endEvent >= peakEvent_))
+      holders.push_back(&allocation);
+  std::stable_sort(holders.begin(), holders.end(), [](const Allocation* a, const Allocation* b) { return a->bytes > b->bytes; });
+
+  io::OutputFileStream out(path_);
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"marian memory\"}}";
+
+  for(const auto& pass : passes_)
+    out << ",\n{\"name\": \"" << pass.kind << "\", \"cat\": \"pass\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": "
+        << pass.begin << ", \"dur\": " << pass.end - pass.begin << "}";
+
+  for(size_t i = 0; i < allocations_.size(); ++i) {
+    const auto& a = allocations_[i];
+    std::string name = utils::jsonEscape(a.name);
+    out << ",\n{\"name\": \"" << name << "\", \"cat\": \"" << a.kind << "\", \"ph\": \"b\", \"id\": " << i
+        << ", \"pid\": 0, \"tid\": 1, \"ts\": " << a.begin << ", \"args\": {\"node\": " << a.node
+        << ", \"shape\": \"" << utils::jsonEscape(a.shape) << "\", \"bytes\": " << a.bytes << "}}";
+    out << ",\n{\"name\": \"" << name << "\", \"cat\": \"" << a.kind << "\", \"ph\": \"e\", \"id\": " << i
+        << ", \"pid\": 0, \"tid\": 1, \"ts\": " << (a.end < 0 ? time : a.end) << "}";
+  }
+
+  for(const auto& s : samples_)
+    out << ",\n{\"name\": \"live bytes\", \"ph\": \"C\", \"pid\": 0, \"ts\": " << s.time << ", \"args\": {\"values\": "
+        << s.values << ", \"gradients\": " << s.gradients << ", \"workspace\": " << s.workspace << "}}";
+
+  out << ",\n{\"name\": \"peak\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 0, \"tid\": 0, \"ts\": " << peakTime_
+      << ", \"args\": {\"bytes\": " << peakBytes_ << ", \"holders\": [";
+  for(size_t i = 0; i < holders.size(); ++i)
+    out << (i > 0 ? ", " : "") << "\"" << utils::jsonEscape(holders[i]->name) << " " << utils::jsonEscape(holders[i]->shape) << " ("
+        << holders[i]->kind << ", " << holders[i]->bytes << " bytes)\"";
+  out << "]}}\n]}\n";
+
+  LOG(info, "[memory] Wrote memory profile of {} allocations to {}, peak of {:.1f} MB of node memory held by {} nodes",
+      allocations_.size(), path_, peakBytes_ / (1024.f * 1024.f), holders.size());
+  for(size_t i = 0; i < std::min<size_t>(holders.size(), 5); ++i)
+    LOG(info, "[memory]   {:.1f} MB {} {} ({})", holders[i]->bytes / (1024.f * 1024.f), holders[i]->name,
+        holders[i]->shape, holders[i]->kind);
+
+  allocations_.clear();
+  live_.clear();
+  samples_.clear();
+}
+
+}  // namespace marian
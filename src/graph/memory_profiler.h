@@ -0,0 +1,97 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "tensors/allocator.h"
+#include "tensors/tensor.h"
+#include "graph/chainable.h"
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+/**
+ * Records the node values and gradients that a graph allocates from its workspace, see
+ * ExpressionGraph::setMemoryProfile(), and writes them as a trace in the Chrome tracing JSON format, which
+ * chrome://tracing and https://ui.perfetto.dev display:
+ * - one async slice per allocation from allocation to free, named by the type and name of the node, with its
+ *   id, shape and bytes as arguments;
+ * - one slice per forward and backward pass;
+ * - counters of the live bytes of node values, of gradients and of the workspace, which also includes the
+ *   temporaries of kernels and is sampled whenever a node allocates or frees;
+ * - an instant event at the peak of the live node bytes with the nodes that hold memory at that point, largest
+ *   first.
+ * The trace is written once the given number of passes has been recorded or when the profiler is destroyed.
+ */
+class MemoryProfiler {
+public:
+  MemoryProfiler(const std::string& path, size_t maxPasses, Ptr<Allocator> workspace)
+      : path_(path), maxPasses_(maxPasses), workspace_(workspace), start_(std::chrono::steady_clock::now()) {}
+
+  ~MemoryProfiler() { save(); }
+
+  // Starts the pass of the given kind, "forward" or "backward", and ends the one before. Returns false once the
+  // trace has been written, after which the profiler records nothing.
+  bool beginPass(const std::string& kind);
+
+  void allocated(Chainable<Tensor>* node, const Tensor& t, const std::string& kind);
+  void freed(const Tensor& t);
+  // the graph was cleared, all allocations end
+  void clear();
+
+  // writes the trace, once
+  void save();
+
+  bool isActive() const { return !saved_; }
+
+private:
+  struct Allocation {
+    std::string name;
+    std::string kind;   // value, gradient or cache
+    std::string shape;
+    size_t node;
+    size_t bytes;
+    double begin;
+    double end{-1};
+    size_t beginEvent;  // position in the sequence of allocations and frees, to find the holders of the peak
+    size_t endEvent{0};
+  };
+
+  struct Sample {
+    double time;
+    size_t values;
+    size_t gradients;
+    size_t workspace;
+  };
+
+  struct Pass {
+    std::string kind;
+    double begin;
+    double end{-1};
+  };
+
+  double now() const;
+  void sample();
+
+  std::string path_;
+  size_t maxPasses_;
+  Ptr<Allocator> workspace_;
+  std::chrono::steady_clock::time_point start_;
+  bool saved_{false};
+
+  std::vector<Allocation> allocations_;
+  std::unordered_map<MemoryPiece*, size_t> live_; // by the memory of the tensor
+  std::vector<Sample> samples_;
+  std::vector<Pass> passes_;
+  size_t events_{0};
+  size_t liveValues_{0};
+  size_t liveGradients_{0};
+  size_t peakBytes_{0};
+  size_t peakEvent_{0};
+  double peakTime_{0};
+  size_t forwardPasses_{0};
+};
+
+}  // namespace marian
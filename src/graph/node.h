@@ -6,6 +6,7 @@
 
 #include "common/hash.h"
 #include "tensors/backend.h"
+#include "tensors/fused_element.h"
 #include "tensors/tensor.h"
 
 #include "graph/chainable.h"
@@ -105,6 +106,10 @@ public:
   virtual void free() override;
 
   virtual void init() override {};
+
+  virtual void resetVal() override { val_ = nullptr; adj_ = nullptr; }
+
+  virtual bool isView() override { return !destroy_; }
   /**
    * Initialization for backward step of top node
    * in computation graph. Allocates memory and sets gradient
@@ -180,6 +185,11 @@ public:
     isCheckpoint_ = true;
   }
 
+  // used by the checkpoint policies of ExpressionGraph::setCheckpointPolicy() to thin out manual checkpoints
+  virtual void unmarkCheckpoint() override {
+    isCheckpoint_ = false;
+  }
+
   virtual bool isCheckpoint() const override {
     return (children_.empty() || isCheckpoint_); // this node is a checkPoint if it's a leaf or if it has been marked.
   }
@@ -267,5 +277,9 @@ struct NaryNodeOp : public Node {
       return true;
     }
   }
+
+  // Sets the operation of an elementwise node on its children and returns true if it can be fused with other
+  // elementwise nodes, see ExpressionGraph::fuseElementwise()
+  virtual bool fusedInstruction(FusedInstruction& /*instr*/) { return false; }
 };
 }  // namespace marian
@@ -1,4 +1,5 @@
 #include "graph/node_initializers.h"
+#include "graph/shared_values.h"
 #include "layers/word2vec_reader.h"
 #include "tensors/tensor_operators.h"
 
@@ -220,6 +221,33 @@ Ptr<NodeInitializer> fromTensor(Tensor externalTensor) {
   return fromLambda([externalTensor](Tensor t) { t->copyFrom(externalTensor); }, externalTensor->type());
 }
 
+class SharedInit : public NodeInitializer {
+  private:
+    Ptr<NodeInitializer> init_;
+    Ptr<SharedValues> values_;
+    size_t key_;
+
+  public:
+    SharedInit(Ptr<NodeInitializer> init, Ptr<SharedValues> values, size_t key)
+      : init_(init), values_(values), key_(key) {}
+
+    void apply(Tensor tensor) override {
+      init_->setAllocator(allocator_.lock());
+      values_->share(key_, tensor, [this](Tensor t) { init_->apply(t); });
+    }
+
+    size_t key() const { return key_; }
+};
+
+Ptr<NodeInitializer> shared(Ptr<NodeInitializer> init, Ptr<SharedValues> values, size_t key) {
+  return New<SharedInit>(init, values, key);
+}
+
+size_t sharedKey(Ptr<NodeInitializer> init) {
+  auto sharedInit = std::dynamic_pointer_cast<SharedInit>(init);
+  return sharedInit ? sharedInit->key() : 0;
+}
+
 // Computes Google's sinusoidal position embeddings
 Ptr<NodeInitializer> sinusoidalPositionEmbeddings(int start) {
   return fromLambda([start](Tensor t) { SinusoidalPositionEmbeddings(t, start); });
@@ -11,6 +11,7 @@
 namespace marian {
 
 class ExpressionGraph; // Forward declaration
+class SharedValues;    // Forward declaration
 /**
  * The namespace inits.
  * Declare class NodeInitializer and all the available functions to initialise a node.
@@ -238,6 +239,16 @@ Ptr<NodeInitializer> fromItem(const io::Item& item);
  */
 Ptr<NodeInitializer> fromTensor(Tensor tensor);
 
+/**
+ * Initialize tensor with init into a buffer that the CPU inference graphs of the process share, or point it at the
+ * buffer that another graph initialized for the same key, see SharedValues.
+ * @return A NodeInitializer
+ */
+Ptr<NodeInitializer> shared(Ptr<NodeInitializer> init, Ptr<SharedValues> values, size_t key);
+
+/** The key of init if it was created by shared(), otherwise 0 */
+size_t sharedKey(Ptr<NodeInitializer> init);
+
 /**
  * Initialize tensor from a file.
  * Creates a NodeInitializer that will initialize the tensor
@@ -24,12 +24,22 @@ void ConstantNode::allocate() {
 
 void ConstantNode::init() {
   if(!initialized_) {
+    // constants are the inputs of a graph that pinned uploads copy to the device without waiting for it
+    auto backend = val_->getBackend();
+    backend->setInputUploads(true);
     init_->apply(val_);
+    backend->setInputUploads(false);
     initialized_ = true;
   }
   init_.reset();
 }
 
+void ConstantNode::rebind(const Ptr<inits::NodeInitializer>& init) {
+  init_ = init;
+  init_->setAllocator(graph()->allocator());
+  initialized_ = false;
+}
+
 ParamNode::ParamNode(Ptr<ExpressionGraph> graph,
                      const Shape& shape,
                      const Ptr<inits::NodeInitializer>& init,
@@ -43,7 +53,8 @@ ParamNode::ParamNode(Ptr<ExpressionGraph> graph,
                      bool fixed)
     : Node(graph, shape, valueType),
       init_(init),
-      initialized_(false) {
+      initialized_(false),
+      sharedKey_(inits::sharedKey(init)) {
   init_->setAllocator(graph->allocator());
   setTrainable(!fixed);
   setMemoize(graph->isInference());
@@ -23,6 +23,11 @@ struct ConstantNode : public Node {
   virtual void allocate() override;
   virtual void init() override;
 
+  // the initializer until the node is initialized, see ExpressionGraph::freeze()
+  const Ptr<inits::NodeInitializer>& initializer() const { return init_; }
+  // initializes the node again with init at the next forward pass, see ExpressionGraph::replay()
+  void rebind(const Ptr<inits::NodeInitializer>& init);
+
   const std::string type() override { return "const"; }
 
   const std::string form() override { return "diamond"; }
@@ -41,6 +46,24 @@ private:
   Ptr<inits::NodeInitializer> init_;
   bool initialized_;
 };
+
+/**
+ * A constant with a gradient. Its value is given like that of a constant, and the backward pass computes its
+ * gradient like that of a parameter, e.g. for the encoder states that --pipeline-parallel copies from the device of
+ * the encoders and whose gradient it copies back.
+ */
+struct InputNode : public ConstantNode {
+  InputNode(Ptr<ExpressionGraph> graph,
+            const Shape& shape,
+            const Ptr<inits::NodeInitializer>& init,
+            Type valueType = Type::float32)
+      : ConstantNode(graph, shape, init, valueType) {
+    setTrainable(true);
+  }
+
+  const std::string type() override { return "input"; }
+};
+
 /**
  * A parameter node for the graph.
  * A parameter node is used to store model parameters whose value can be
@@ -74,8 +97,9 @@ struct ParamNode : public Node {
 
   const std::string color() override { return "orangered"; }
 
+  // parameters with shared values hash alike in all graphs, so memoized nodes computed from them can be shared too
   virtual size_t hash() override {
-    size_t seed = util::hash<size_t>()((size_t)this);
+    size_t seed = sharedKey_ != 0 ? sharedKey_ : util::hash<size_t>()((size_t)this);
     return seed;
   }
 
@@ -86,5 +110,6 @@ struct ParamNode : public Node {
 private:
   Ptr<inits::NodeInitializer> init_;
   bool initialized_;
+  size_t sharedKey_; // of init_, see inits::shared()
 };
 }  // namespace marian
@@ -243,16 +243,23 @@ private:
   bool transA_;
   bool transB_;
   float scalar_;
+  std::string fp8_; // prefix of the FP8 scalings of the operands with --fp8, empty otherwise
+
+  Fp8Operand fp8(const std::string& operand, bool gradient = false) { return {fp8_ + ":" + operand, gradient}; }
 
 public:
   AffineNodeOp(const std::vector<Expr>& nodes,
                bool transA,
                bool transB,
-               float scalar)
+               float scalar,
+               const std::string& fp8 = "")
       : NaryNodeOp(nodes, newShape(nodes[0], nodes[1], transA, transB)),
         transA_(transA),
         transB_(transB),
-        scalar_(scalar) {}
+        scalar_(scalar),
+        fp8_(fp8) {
+    ABORT_IF(!fp8_.empty() && (transA_ || transB_), "FP8 affine transformations do not transpose their operands");
+  }
 
   Shape newShape(Expr a, Expr b, bool transA, bool transB) {
     auto shapeA = a->shape();
@@ -277,6 +284,23 @@ public:
   NodeOps forwardOps() override {
     using namespace functional;
 
+    if(!fp8_.empty())
+      return {
+        NodeOp(Fp8NextStep(graph()->getBackend(), fp8("x"));
+               Fp8NextStep(graph()->getBackend(), fp8("w"));
+               AffineFp8(val_,
+                         graph()->allocator(),
+                         child(0)->val(),
+                         child(1)->val(),
+                         child(2)->val(),
+                         transA_,
+                         transB_,
+                         scalar_,
+                         /*doRelu=*/false,
+                         fp8("x"),
+                         fp8("w")))
+      };
+
     return {
       NodeOp(Affine(val_,
                     graph()->allocator(),
@@ -291,6 +315,12 @@ public:
     };
   }
 
+  void backward() override {
+    if(!fp8_.empty())
+      Fp8NextStep(graph()->getBackend(), fp8("dy", /*gradient=*/true));
+    NaryNodeOp::backward();
+  }
+
   NodeOps backwardOps() override {
     // D is the adjoint, the matrix of derivatives
     // df/dA += alpha * dot(D, op(B).T)
@@ -377,6 +407,30 @@ public:
           NodeOp(Prod(child(2)->grad(), child(3)->val(), adj_, true, false, 1.f, 1.f, computeTypeC))
       };
 
+    // the gradient in E5M2, the activations and weights in E4M3 as in the forward step
+    if(!fp8_.empty())
+      return {
+          NodeOp(ProdFp8(child(0)->grad(),
+                         graph()->allocator(),
+                         adj_,
+                         child(1)->val(),
+                         false,
+                         true,
+                         1.0,
+                         scalar_, computeTypeA,
+                         fp8("dy", /*gradient=*/true), fp8("w"))),
+          NodeOp(ProdFp8(child(1)->grad(),
+                         graph()->allocator(),
+                         child(0)->val(),
+                         adj_,
+                         true,
+                         false,
+                         1.0,
+                         scalar_, computeTypeB,
+                         fp8("x"), fp8("dy", /*gradient=*/true))),
+          NodeOp(Prod(child(2)->grad(), child(3)->val(), adj_, true, false, 1.f, 1.f, computeTypeC))
+      };
+
     return {
         NodeOp(Prod(child(0)->grad(),
                     adj_,
@@ -423,23 +477,44 @@ public:
 
 };
 
+// relu(a * b + bias), optionally followed by dropout, with the bias and the activation applied in the GEMM epilogue.
+// For training, nodes are {a, b, bias, ones[, mask]} where ones is the column of ones that reduces the bias
+// gradient as in AffineNodeOp and mask is a dropout mask that broadcasts against the output. The mask is
+// non-negative, hence relu(x) * mask == relu(x * mask) and the gradient of the activation and the dropout can be
+// read off the output in a single pass over the adjoint.
 class AffineWithReluNodeOp : public NaryNodeOp {
 private:
   friend class SerializationHelpers;
   bool transA_;
   bool transB_;
   float scalar_;
+  std::string fp8_; // as in AffineNodeOp
+
+  Fp8Operand fp8(const std::string& operand, bool gradient = false) { return {fp8_ + ":" + operand, gradient}; }
 
 public:
   AffineWithReluNodeOp(Expr a,
                        Expr b,
-                       Expr bias)
+                       Expr bias,
+                       const std::string& fp8 = "")
       : NaryNodeOp({a, b, bias}, newShape(a, b, false, false)),
         transA_(false),
         transB_(false),
-        scalar_(1.0) {
+        scalar_(1.0),
+        fp8_(fp8) {
     ABORT_IF(!graph()->isInference(),
-             "AffineWithReluNodeOp currently only supported for inference");
+             "AffineWithReluNodeOp without a column of ones for the bias gradient only supported for inference");
+  }
+
+  AffineWithReluNodeOp(const std::vector<Expr>& nodes, const std::string& fp8 = "")
+      : NaryNodeOp(nodes, newShape(nodes[0], nodes[1], false, false)),
+        transA_(false),
+        transB_(false),
+        scalar_(1.0),
+        fp8_(fp8) {
+    ABORT_IF(nodes.size() < 3 || nodes.size() > 5, "AffineWithReluNodeOp expects 3 to 5 nodes, got {}", nodes.size());
+    ABORT_IF(nodes.size() == 3 && !graph()->isInference(),
+             "AffineWithReluNodeOp without a column of ones for the bias gradient only supported for inference");
   }
 
   Shape newShape(Expr a, Expr b, bool transA, bool transB) {
@@ -463,26 +538,111 @@ public:
   }
 
   NodeOps forwardOps() override {
-    ABORT_IF(!graph()->isInference(),
-             "AffineWithReluNodeOp currently only supported for inference");
+    using namespace functional;
 
-    return {
-      NodeOp(Affine(val_,
-                    graph()->allocator(),
-                    child(0)->val(),
-                    child(1)->val(),
-                    child(2)->val(),
-                    transA_,
-                    transB_,
-                    0.f,
-                    scalar_,
-                    /*doRelu=*/true))
-    };
+    NodeOps ops;
+    if(!fp8_.empty())
+      ops.push_back(NodeOp(Fp8NextStep(graph()->getBackend(), fp8("x"));
+                           Fp8NextStep(graph()->getBackend(), fp8("w"));
+                           AffineFp8(val_,
+                                     graph()->allocator(),
+                                     child(0)->val(),
+                                     child(1)->val(),
+                                     child(2)->val(),
+                                     transA_,
+                                     transB_,
+                                     scalar_,
+                                     /*doRelu=*/true,
+                                     fp8("x"),
+                                     fp8("w"))));
+    else
+      ops.push_back(NodeOp(Affine(val_,
+                                  graph()->allocator(),
+                                  child(0)->val(),
+                                  child(1)->val(),
+                                  child(2)->val(),
+                                  transA_,
+                                  transB_,
+                                  0.f,
+                                  scalar_,
+                                  /*doRelu=*/true)));
+    if(children().size() > 4)
+      ops.push_back(NodeOp(Element(_1 = _1 * _2, val_, child(4)->val())));
+    return ops;
+  }
+
+  void backward() override {
+    using namespace functional;
+    ABORT_IF(children().size() < 4, "Did we lose the column of ones required for backprob of bias??");
+
+    // The adjoint is not read by anyone else after this node, so turn it into the adjoint of the affine
+    // transformation in place before the gradients of the children, which backwardOps() lists per child.
+    if(children().size() > 4)
+      Element(_1 = _1 * ReLUback(_2) * _3, adj_, val_, child(4)->val());
+    else
+      Element(_1 = _1 * ReLUback(_2), adj_, val_);
+
+    if(!fp8_.empty())
+      Fp8NextStep(graph()->getBackend(), fp8("dy", /*gradient=*/true));
+    NaryNodeOp::backward();
   }
 
   NodeOps backwardOps() override {
-    ABORT("AffineWithReluNodeOp cannot be used for training??");
-    return {};
+    auto isParameter = [](Expr p) {
+      return std::dynamic_pointer_cast<ParamNode>(p) != nullptr;
+    };
+
+    // accumulate gradients of activations in float32, see AffineNodeOp
+    auto computeType = [&](Expr child) {
+      Type type = child->trainable() ? child->grad()->type() : Type::float32;
+      if(!isParameter(child) && type == Type::float16)
+        type = Type::float32;
+      return type;
+    };
+    Type computeTypeA = computeType(child(0));
+    Type computeTypeB = computeType(child(1));
+    Type computeTypeC = computeType(child(2));
+
+    if(!fp8_.empty())
+      return {
+          NodeOp(ProdFp8(child(0)->grad(),
+                         graph()->allocator(),
+                         adj_,
+                         child(1)->val(),
+                         false,
+                         true,
+                         1.0,
+                         scalar_, computeTypeA,
+                         fp8("dy", /*gradient=*/true), fp8("w"))),
+          NodeOp(ProdFp8(child(1)->grad(),
+                         graph()->allocator(),
+                         child(0)->val(),
+                         adj_,
+                         true,
+                         false,
+                         1.0,
+                         scalar_, computeTypeB,
+                         fp8("x"), fp8("dy", /*gradient=*/true))),
+          NodeOp(Prod(child(2)->grad(), child(3)->val(), adj_, true, false, 1.f, 1.f, computeTypeC))
+      };
+
+    return {
+        NodeOp(Prod(child(0)->grad(),
+                    adj_,
+                    child(1)->val(),
+                    false,
+                    true,
+                    1.0,
+                    scalar_, computeTypeA)),
+        NodeOp(Prod(child(1)->grad(),
+                    child(0)->val(),
+                    adj_,
+                    true,
+                    false,
+                    1.0,
+                    scalar_, computeTypeB)),
+        NodeOp(Prod(child(2)->grad(), child(3)->val(), adj_, true, false, 1.f, 1.f, computeTypeC))
+    };
   }
 
   const std::string type() override { return "affineWithRelu"; }
@@ -511,6 +671,95 @@ public:
   }
 };
 
+// logsoftmax(x * W[indices]^T + bias[indices]), see logsoftmax_shortlist()
+class LogSoftmaxShortlistNodeOp : public NaryNodeOp {
+public:
+  LogSoftmaxShortlistNodeOp(const std::vector<Expr>& nodes)
+      : NaryNodeOp(nodes, newShape(nodes[0], nodes[1], nodes[2])) {
+    ABORT_IF(!graph()->isInference(),
+             "LogSoftmaxShortlistNodeOp currently only supported for inference");
+  }
+
+  Shape newShape(Expr x, Expr W, Expr indices) {
+    ABORT_IF(x->shape()[-1] != W->shape()[-1],
+             "Shortlisted output requires inner dimensions to match in {} * {}^T", std::string(x->shape()), std::string(W->shape()));
+    ABORT_IF(x->shape().size() != 4 || x->shape()[-2] != 1 || indices->shape().size() != 3,
+             "Shortlisted output expects queries [beam, batch, 1, dim] and indices [beam, batch, k], got {} and {}",
+             std::string(x->shape()), std::string(indices->shape()));
+    ABORT_IF(indices->shape()[-2] != x->shape()[-3] || (indices->shape()[-3] != 1 && indices->shape()[-3] != x->shape()[-4]),
+             "Shortlist indices {} do not match queries {}", std::string(indices->shape()), std::string(x->shape()));
+
+    Shape outShape = x->shape();
+    outShape.set(-1, indices->shape()[-1]);
+    return outShape;
+  }
+
+  NodeOps forwardOps() override {
+    return {
+      NodeOp(LogSoftmaxShortlist(val_,
+                                 child(0)->val(),
+                                 child(1)->val(),
+                                 child(2)->val(),
+                                 children().size() > 3 ? child(3)->val() : nullptr))
+    };
+  }
+
+  NodeOps backwardOps() override {
+    ABORT("LogSoftmaxShortlistNodeOp cannot be used for training??");
+    return {};
+  }
+
+  const std::string type() override { return "logsoftmax_shortlist"; }
+};
+
+// logsoftmax(logits / temperature + noise) over the truncated logits of each row, see gumbel_sampling()
+class GumbelSamplingNodeOp : public NaryNodeOp {
+private:
+  SamplingMethod method_;
+  float param_;
+  float temperature_;
+  bool normalize_;
+
+public:
+  GumbelSamplingNodeOp(Expr logits, Expr noise, SamplingMethod method, float param, float temperature, bool normalize)
+      : NaryNodeOp({logits, noise}, logits->shape()),
+        method_(method),
+        param_(param),
+        temperature_(temperature),
+        normalize_(normalize) {
+    ABORT_IF(logits->shape() != noise->shape(),
+             "Gumbel noise {} does not match the logits {}", std::string(noise->shape()), std::string(logits->shape()));
+  }
+
+  NodeOps forwardOps() override {
+    return {NodeOp(GumbelSampling(val_, child(0)->val(), child(1)->val(), method_, param_, temperature_, normalize_))};
+  }
+
+  NodeOps backwardOps() override {
+    ABORT("GumbelSamplingNodeOp cannot be used for training");
+    return {};
+  }
+
+  const std::string type() override { return "gumbel_sampling"; }
+
+  virtual size_t hash() override {
+    size_t seed = NaryNodeOp::hash();
+    util::hash_combine(seed, (int)method_);
+    util::hash_combine(seed, param_);
+    util::hash_combine(seed, temperature_);
+    util::hash_combine(seed, normalize_);
+    return seed;
+  }
+
+  virtual bool equal(Expr node) override {
+    if(!NaryNodeOp::equal(node))
+      return false;
+    auto cnode = std::dynamic_pointer_cast<GumbelSamplingNodeOp>(node);
+    return cnode && method_ == cnode->method_ && param_ == cnode->param_ && temperature_ == cnode->temperature_
+           && normalize_ == cnode->normalize_;
+  }
+};
+
 class DotBatchedNodeOp : public NaryNodeOp {
 private:
   friend class SerializationHelpers;
@@ -1229,6 +1478,8 @@ struct PlusNodeOp : public ElementBinaryNodeOp {
   }
 
   const std::string type() override { return "+"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Plus; return true; }
 };
 
 struct MinusNodeOp : public ElementBinaryNodeOp {
@@ -1249,6 +1500,8 @@ struct MinusNodeOp : public ElementBinaryNodeOp {
   }
 
   const std::string type() override { return "-"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Minus; return true; }
 };
 
 struct MultNodeOp : public ElementBinaryNodeOp {
@@ -1269,6 +1522,8 @@ struct MultNodeOp : public ElementBinaryNodeOp {
   }
 
   const std::string type() override { return "*"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Mult; return true; }
 };
 
 struct DivNodeOp : public ElementBinaryNodeOp {
@@ -1294,6 +1549,8 @@ struct DivNodeOp : public ElementBinaryNodeOp {
   }
 
   const std::string type() override { return "/"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Div; return true; }
 };
 
 // struct PowNodeOp : public ElementBinaryNodeOp {
@@ -1374,6 +1631,8 @@ struct MaximumNodeOp : public ElementBinaryNodeOp {
   }
 
   const std::string type() override { return "max"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Maximum; return true; }
 };
 
 // TODO: lotsa code dup here!
@@ -1402,6 +1661,8 @@ struct MinimumNodeOp : public ElementBinaryNodeOp {
   }
 
   const std::string type() override { return "min"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Minimum; return true; }
 };
 
 struct CmpNodeOp : public ElementBinaryNodeOp {
@@ -1458,6 +1719,53 @@ private:
   bool not_; // invert result if true
 };
 
+// A chain of elementwise nodes as one node, created by ExpressionGraph::fuseElementwise() in inference. The fused
+// nodes are gone, apart from the last one, which keeps the value for nodes that read it and is drawn by graphviz()
+// in place of this node.
+class FusedElementwiseNodeOp : public NaryNodeOp {
+  Expr target_;
+  FusedProgram program_;
+
+public:
+  FusedElementwiseNodeOp(const std::vector<Expr>& inputs, Expr target, const FusedProgram& program)
+      : NaryNodeOp(inputs, target->shape(), target->value_type()), target_(target), program_(program) {
+    Node::destroy_ = false; // the value belongs to target_
+    setId(target->getId());
+  }
+
+  void allocate() override { target_->allocate(); }
+  void free() override {}
+
+  Tensor& val() override { return target_->val(); }
+
+  NodeOps forwardOps() override {
+    std::vector<Tensor> inputs;
+    for(auto& child : children_)
+      inputs.push_back(child->val());
+    return {NodeOp(FusedElement(target_->val(), inputs, program_))};
+  }
+
+  NodeOps backwardOps() override { ABORT("Fused elementwise nodes only exist in inference"); }
+
+  const std::string type() override { return "fused"; }
+
+  const std::string label() override {
+    std::stringstream label;
+    label << "<fused<br/>" << fusedProgramToString(program_, children_.size()) << " (" << getId() << ")>";
+    return label.str();
+  }
+
+  std::string graphviz() override {
+    std::stringstream ss;
+    ss << "\"" << target_.get() << "\" [shape=\"" << form() << "\", label=" << label()
+       << ", style=\"filled\", penwidth=1, fillcolor=\"" << color() << "\"];" << std::endl;
+    for(auto&& child : children())
+      ss << "\"" << child << "\" -> \"" << target_.get() << "\";" << std::endl;
+    ss << std::endl;
+    return ss.str();
+  }
+};
+
 // In each j-th row, take the corresponding j-th label index i from indices and compute:
 // For each vocabulary item v, the only non-zero element in a row in the sum is the item
 // that matches the label indexed by i (the picked element).
@@ -1511,6 +1819,181 @@ public:
   const std::string type() override { return "x-ent"; }
 };
 
+// The logits x * op(W) + b of an output layer that are only read by cross_entropy(), which computes them in blocks of
+// rows in a ChunkedCrossEntropyNodeOp instead. Has no value and no gradient of its own, a node that reads it would
+// abort with a de-allocated child.
+class ChunkedLogitsNodeOp : public NaryNodeOp {
+private:
+  bool transB_;
+  int chunkRows_;
+
+public:
+  ChunkedLogitsNodeOp(const std::vector<Expr>& nodes, bool transB, int chunkRows) // x, W and optionally b
+      : NaryNodeOp(nodes, newShape(nodes[0], nodes[1], transB)), transB_(transB), chunkRows_(chunkRows) {
+    setTrainable(false); // the gradients of x, W and b are computed by the cross-entropy
+  }
+
+  Shape newShape(Expr x, Expr W, bool transB) {
+    Shape shape = x->shape();
+    shape.set(-1, W->shape()[transB ? -2 : -1]);
+    return shape;
+  }
+
+  void allocate() override {}
+  NodeOps forwardOps() override { return {}; }
+  NodeOps backwardOps() override { return {}; }
+
+  bool transB() const { return transB_; }
+  int chunkRows() const { return chunkRows_; }
+
+  virtual size_t hash() override {
+    size_t seed = NaryNodeOp::hash();
+    util::hash_combine(seed, transB_);
+    util::hash_combine(seed, chunkRows_);
+    return seed;
+  }
+
+  virtual bool equal(Expr node) override {
+    if(!NaryNodeOp::equal(node))
+      return false;
+    auto cnode = std::dynamic_pointer_cast<ChunkedLogitsNodeOp>(node);
+    return cnode && transB_ == cnode->transB_ && chunkRows_ == cnode->chunkRows_;
+  }
+
+  const std::string type() override { return "chunked-logits"; }
+};
+
+// Cross-entropy of the logits of a ChunkedLogitsNodeOp, computed for chunkRows rows at a time: the logits of a block
+// are a GEMM into a scratch tensor of the workspace, which the forward pass reduces to the losses of its rows and the
+// backward pass computes again for their gradient. Only [chunkRows, vocab size] logits are held at any time instead
+// of the logits of the whole batch, their log-softmax and its gradient.
+class ChunkedCrossEntropyNodeOp : public NaryNodeOp {
+private:
+  float labelSmoothingAlpha_;
+  bool transB_;
+  int chunkRows_;
+
+  bool hasBias() { return children().size() == 4; }
+  Expr indices() { return child(children().size() - 1); }
+
+  // rows [begin, begin + rows) of a tensor with cols values per row
+  static Tensor rowsOf(Tensor t, int begin, int rows, int cols) {
+    size_t bytes = sizeOf(t->type());
+    auto memory = MemoryPiece::New(t->memory()->data() + bytes * begin * cols, bytes * rows * cols);
+    return TensorBase::New(memory, Shape({rows, cols}), t->type(), t->getBackend());
+  }
+
+  // calls f(begin, rows, logits of the rows) for every block of rows, with numScratch scratch tensors of the logits'
+  // shape of which the first one holds the logits
+  void forEachChunk(int numScratch, const std::function<void(int, int, const std::vector<Tensor>&)>& f) {
+    auto x = child(0)->val(), W = child(1)->val();
+    int dimModel = x->shape()[-1];
+    int dimRows  = x->shape().elements() / dimModel;
+    int dimVocab = W->shape()[transB_ ? -2 : -1];
+    int chunk    = std::min(chunkRows_, dimRows);
+
+    auto allocator = graph()->allocator();
+    std::vector<MemoryPiece::PtrType> memory;
+    for(int i = 0; i < numScratch; ++i)
+      memory.push_back(allocator->alloc(requiredBytes(Shape({chunk, dimVocab}), x->type())));
+    for(int begin = 0; begin < dimRows; begin += chunk) {
+      int rows = std::min(chunk, dimRows - begin);
+      std::vector<Tensor> scratch;
+      for(auto& piece : memory)
+        scratch.push_back(TensorBase::New(MemoryPiece::New(piece->data(), sizeOf(x->type()) * rows * dimVocab),
+                                          Shape({rows, dimVocab}), x->type(), x->getBackend()));
+      auto xRows = rowsOf(x, begin, rows, dimModel);
+      if(hasBias())
+        Affine(scratch[0], allocator, xRows, W, child(2)->val(), false, transB_, 0.f, 1.f, /*doRelu=*/false);
+      else
+        Prod(scratch[0], xRows, W, false, transB_, 0.f, 1.f);
+      f(begin, rows, scratch);
+    }
+    for(auto& piece : memory)
+      allocator->free(piece);
+  }
+
+  void chunkedForward() {
+    forEachChunk(1, [&](int begin, int rows, const std::vector<Tensor>& scratch) {
+      CrossEntropyPick(rowsOf(val_, begin, rows, 1), scratch[0], rowsOf(indices()->val(), begin, rows, 1),
+                       labelSmoothingAlpha_);
+    });
+  }
+
+  void chunkedBackward() {
+    auto x = child(0), W = child(1);
+    int dimModel = x->shape()[-1];
+    forEachChunk(2, [&](int begin, int rows, const std::vector<Tensor>& scratch) {
+      auto logits = scratch[0], logitsGrad = scratch[1];
+      logitsGrad->set(0.f);
+      CrossEntropyPickBackward(logitsGrad, rowsOf(adj_, begin, rows, 1), logits,
+                               rowsOf(indices()->val(), begin, rows, 1), labelSmoothingAlpha_);
+      auto xRows = rowsOf(x->val(), begin, rows, dimModel);
+      if(x->trainable()) // dx = dlogits * op(W)^T
+        Prod(rowsOf(x->grad(), begin, rows, dimModel), logitsGrad, W->val(), false, !transB_, 1.f, 1.f);
+      if(W->trainable()) { // dW = dlogits^T * x if W is transposed, else x^T * dlogits
+        if(transB_)
+          Prod(W->grad(), logitsGrad, xRows, true, false, 1.f, 1.f);
+        else
+          Prod(W->grad(), xRows, logitsGrad, true, false, 1.f, 1.f);
+      }
+      if(hasBias() && child(2)->trainable())
+        Add(functional::_1, child(2)->grad(), logitsGrad);
+    });
+  }
+
+public:
+  ChunkedCrossEntropyNodeOp(Expr logits, Expr indices, float labelSmoothingAlpha, Type outputType)
+      : NaryNodeOp(childrenOf(logits, indices), newShape(logits), outputType),
+        labelSmoothingAlpha_(labelSmoothingAlpha),
+        transB_(chunked(logits)->transB()),
+        chunkRows_(chunked(logits)->chunkRows()) {
+    matchOrAbort<IndexType>(indices->value_type());
+    int rows = logits->shape().elements() / logits->shape()[-1];
+    ABORT_IF(rows != (int)indices->shape().elements(), "Number of examples and labels does not match: {} != {}",
+             rows, indices->shape().elements());
+  }
+
+  static ChunkedLogitsNodeOp* chunked(Expr logits) {
+    auto node = dynamic_cast<ChunkedLogitsNodeOp*>(logits.get());
+    ABORT_IF(!node, "Chunked cross-entropy of {} {}, not of chunked logits", logits->getId(), logits->type());
+    return node;
+  }
+
+  static std::vector<Expr> childrenOf(Expr logits, Expr indices) {
+    auto nodes = logits->children();
+    nodes.push_back(indices);
+    return nodes;
+  }
+
+  Shape newShape(Expr logits) {
+    Shape shape = logits->shape();
+    shape.set(-1, 1);
+    return shape;
+  }
+
+  NodeOps forwardOps() override { return {NodeOp(chunkedForward())}; }
+  NodeOps backwardOps() override { return {NodeOp(chunkedBackward())}; }
+
+  virtual size_t hash() override {
+    size_t seed = NaryNodeOp::hash();
+    util::hash_combine(seed, labelSmoothingAlpha_);
+    util::hash_combine(seed, transB_);
+    util::hash_combine(seed, chunkRows_);
+    return seed;
+  }
+
+  virtual bool equal(Expr node) override {
+    if(!NaryNodeOp::equal(node))
+      return false;
+    auto cnode = std::dynamic_pointer_cast<ChunkedCrossEntropyNodeOp>(node);
+    return cnode && labelSmoothingAlpha_ == cnode->labelSmoothingAlpha_ && transB_ == cnode->transB_
+           && chunkRows_ == cnode->chunkRows_;
+  }
+
+  const std::string type() override { return "chunked-x-ent"; }
+};
+
 struct ConcatenateNodeOp : public NaryNodeOp {
   ConcatenateNodeOp(const std::vector<Expr>& nodes, int axis)
       : NaryNodeOp(nodes, newShape(nodes, axis)) {
@@ -1692,6 +2175,76 @@ private:
   float eps_;
 };
 
+// Layer or RMS normalization of dropout(x, mask) + residual along the last axis, see addLayerNorm(). Children are
+// {x, residual, gamma, [beta], [mask]}. Neither the dropped-out x nor the sum is stored, the backward pass
+// recomputes them from the inputs.
+struct AddNormalizationOp : public NaryNodeOp {
+public:
+  AddNormalizationOp(const std::vector<Expr>& nodes, bool hasMask, bool rms, float eps)
+      : NaryNodeOp(nodes), hasMask_(hasMask), rms_(rms), eps_(eps) {
+    ABORT_IF(child(0)->shape() != child(1)->shape(), "Skip connection {} does not match input {}",
+             child(1)->shape(), child(0)->shape());
+  }
+
+  NodeOps forwardOps() override {
+    return {NodeOp(AddNormalization(val_, child(0)->val(), mask(), child(1)->val(), child(2)->val(),
+                                    beta() ? beta()->val() : nullptr, eps_, rms_))};
+  }
+
+  // one op for all gradients, non-trainable children get none
+  NodeOps backwardOps() override {
+    return {NodeOp(AddNormalizationGrad(graph()->allocator(),
+                                        gradOf(child(0)),
+                                        gradOf(child(1)),
+                                        gradOf(child(2)),
+                                        beta() ? gradOf(beta()) : nullptr,
+                                        adj_,
+                                        val_,
+                                        child(0)->val(),
+                                        mask(),
+                                        child(1)->val(),
+                                        child(2)->val(),
+                                        beta() ? beta()->val() : nullptr,
+                                        eps_,
+                                        rms_))};
+  }
+
+  virtual void runBackward(const NodeOps& ops) override {
+    for(auto&& op : ops)
+      op();
+  }
+
+  const std::string type() override { return rms_ ? "add_rms_normalization" : "add_layer_normalization"; }
+
+  virtual size_t hash() override {
+    size_t seed = NaryNodeOp::hash();
+    util::hash_combine(seed, hasMask_);
+    util::hash_combine(seed, rms_);
+    util::hash_combine(seed, eps_);
+    return seed;
+  }
+
+  virtual bool equal(Expr node) override {
+    if(!NaryNodeOp::equal(node))
+      return false;
+    auto cnode = std::dynamic_pointer_cast<AddNormalizationOp>(node);
+    if(!cnode)
+      return false;
+    if(hasMask_ != cnode->hasMask_ || rms_ != cnode->rms_ || eps_ != cnode->eps_)
+      return false;
+    return true;
+  }
+
+private:
+  Expr beta() { return children_.size() == (hasMask_ ? 5 : 4) ? child(3) : nullptr; }
+  Tensor mask() { return hasMask_ ? children_.back()->val() : nullptr; }
+  static Tensor gradOf(Expr e) { return e->trainable() ? e->grad() : nullptr; }
+
+  bool hasMask_;
+  bool rms_;
+  float eps_;
+};
+
 // @TODO: rewriting this fixes a bug for this one node. There should be exactly one
 // NodeOp per gradient tensor many other nodes have that bug and need to be fixed.
 // This will only manifest if the first op is not trainable, then gradients for the
@@ -1731,6 +2284,44 @@ struct HighwayNodeOp : public NaryNodeOp {
   const std::string type() override { return "highway"; }
 };
 
+// (average * count + x) / (count + 1), see cumulative_average()
+struct CumulativeAverageNodeOp : public ElementBinaryNodeOp {
+  CumulativeAverageNodeOp(Expr average, Expr x, int count) : ElementBinaryNodeOp(average, x), count_(count) {}
+
+  NodeOps forwardOps() override {
+    using namespace functional;
+    float keep = (float)count_ / (count_ + 1);
+    float add  = 1.f / (count_ + 1);
+    return {NodeOp(Element(_1 = _2 * keep + _3 * add, val_, child(0)->val(), child(1)->val()))};
+  }
+
+  NodeOps backwardOps() override {
+    using namespace functional;
+    float keep = (float)count_ / (count_ + 1);
+    float add  = 1.f / (count_ + 1);
+    return {NodeOp(Add(_1 * keep, child(0)->grad(), adj_)),
+            NodeOp(Add(_1 * add, child(1)->grad(), adj_))};
+  }
+
+  const std::string type() override { return "cumulative_average"; }
+
+  virtual size_t hash() override {
+    size_t seed = NaryNodeOp::hash();
+    util::hash_combine(seed, count_);
+    return seed;
+  }
+
+  virtual bool equal(Expr node) override {
+    if(!NaryNodeOp::equal(node))
+      return false;
+    auto cnode = std::dynamic_pointer_cast<CumulativeAverageNodeOp>(node);
+    return cnode && count_ == cnode->count_;
+  }
+
+private:
+  int count_;
+};
+
 #ifdef CUDNN
 
 class ConvolutionOp : public NaryNodeOp {
@@ -1769,5 +2360,70 @@ public:
 protected:
   ConvolutionWrapper conv_;
 };
+
+// The weights of a bidirectional GRU packed into cuDNN's weight space, memoized like the weights themselves
+class CudnnGRUWeightsOp : public NaryNodeOp {
+public:
+  CudnnGRUWeightsOp(const std::vector<Expr>& weights, Ptr<BidirectionalGRUWrapper> gru)
+      : NaryNodeOp(weights, Shape({(int)((gru->weightSpaceSize() + sizeof(float) - 1) / sizeof(float))}), Type::float32),
+        gru_(gru) {}
+
+  NodeOps forwardOps() override {
+    std::vector<Tensor> weights;
+    for(auto& child : children())
+      weights.push_back(child->val());
+    return {NodeOp(gru_->packWeights(val_, weights))};
+  }
+
+  NodeOps backwardOps() override {
+    ABORT("The bidirectional GRU of cuDNN is only implemented for inference");
+  }
+
+  const std::string type() override { return "cudnn_gru_weights"; }
+
+private:
+  Ptr<BidirectionalGRUWrapper> gru_;
+};
+
+// Runs input [dimTime, dimBatch, dimInput] through a bidirectional GRU, see BidirectionalGRUWrapper
+class CudnnBidirectionalGRUOp : public NaryNodeOp {
+public:
+  CudnnBidirectionalGRUOp(Expr input, Expr weights, Ptr<BidirectionalGRUWrapper> gru, const std::vector<int>& lengths)
+      : NaryNodeOp({input, weights}, newShape(input, gru), Type::float32), gru_(gru), lengths_(lengths) {}
+
+  Shape newShape(Expr input, Ptr<BidirectionalGRUWrapper> gru) {
+    Shape shape = input->shape();
+    shape.set(-1, 2 * gru->dimState());
+    return shape;
+  }
+
+  NodeOps forwardOps() override {
+    return {NodeOp(gru_->forward(graph()->allocator(), child(0)->val(), child(1)->val(), val_, lengths_))};
+  }
+
+  NodeOps backwardOps() override {
+    ABORT("The bidirectional GRU of cuDNN is only implemented for inference");
+  }
+
+  const std::string type() override { return "cudnn_bidirectional_gru"; }
+
+  virtual size_t hash() override {
+    size_t seed = NaryNodeOp::hash();
+    for(auto length : lengths_)
+      util::hash_combine(seed, length);
+    return seed;
+  }
+
+  virtual bool equal(Expr node) override {
+    if(!NaryNodeOp::equal(node))
+      return false;
+    auto cnode = std::dynamic_pointer_cast<CudnnBidirectionalGRUOp>(node);
+    return cnode && lengths_ == cnode->lengths_;
+  }
+
+private:
+  Ptr<BidirectionalGRUWrapper> gru_;
+  std::vector<int> lengths_;
+};
 #endif
 }  // namespace marian
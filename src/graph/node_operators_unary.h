@@ -6,6 +6,7 @@
 #include "tensors/backend.h"
 #include "tensors/tensor_operators.h"
 #include "tensors/tensor.h"
+#include "graph/tensor_parallel.h"
 
 #ifdef CUDNN
 #include "tensors/gpu/cudnn_wrappers.h"
@@ -52,6 +53,12 @@ public:
 
   const std::string type() override { return "scalar_add"; }
 
+  bool fusedInstruction(FusedInstruction& instr) override {
+    instr.op = FusedOpCode::AddScalar;
+    instr.scalar = scalar_;
+    return true;
+  }
+
   virtual size_t hash() override {
     if(!hash_) {
       hash_ = NaryNodeOp::hash();
@@ -110,6 +117,12 @@ public:
 
   const std::string type() override { return "scalar_mult"; }
 
+  bool fusedInstruction(FusedInstruction& instr) override {
+    instr.op = FusedOpCode::MultScalar;
+    instr.scalar = scalar_;
+    return true;
+  }
+
   virtual size_t hash() override {
     if(!hash_) {
       hash_ = NaryNodeOp::hash();
@@ -184,6 +197,8 @@ struct SigmoidNodeOp : public UnaryNodeOp {
   }
 
   const std::string type() override { return "sigmoid"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Sigmoid; return true; }
 };
 
 // struct Scalar2PowNodeOp : public UnaryNodeOp {
@@ -276,6 +291,11 @@ struct TanhNodeOp : public NaryNodeOp {
   const std::string color() override { return "yellow"; }
 
   const std::string type() override { return "tanh"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override {
+    instr.op = FusedOpCode::Tanh;
+    return children_.size() == 1; // tanh of a sum of several children is not fused
+  }
 };
 
 struct ReLUNodeOp : public UnaryNodeOp {
@@ -301,6 +321,8 @@ struct ReLUNodeOp : public UnaryNodeOp {
   }
 
   const std::string type() override { return "ReLU"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::ReLU; return true; }
 };
 
 /**
@@ -398,6 +420,12 @@ struct SwishNodeOp : public UnaryNodeOp {
 
   const std::string type() override { return "swish"; }
 
+  bool fusedInstruction(FusedInstruction& instr) override {
+    instr.op = FusedOpCode::Swish;
+    instr.scalar = b_;
+    return true;
+  }
+
   virtual size_t hash() override {
     if(!hash_) {
       hash_ = NaryNodeOp::hash();
@@ -752,6 +780,8 @@ struct LogNodeOp : public UnaryNodeOp {
   }
 
   const std::string type() override { return "log"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Log; return true; }
 };
 
 struct ExpNodeOp : public UnaryNodeOp {
@@ -768,6 +798,8 @@ struct ExpNodeOp : public UnaryNodeOp {
   }
 
   const std::string type() override { return "exp"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Exp; return true; }
 };
 
 struct SinNodeOp : public UnaryNodeOp {
@@ -835,6 +867,12 @@ struct SqrtNodeOp : public UnaryNodeOp {
 
   const std::string type() override { return "sqrt"; }
 
+  bool fusedInstruction(FusedInstruction& instr) override {
+    instr.op = FusedOpCode::Sqrt;
+    instr.scalar = epsilon_;
+    return true;
+  }
+
   virtual size_t hash() override {
     if(!hash_) {
       size_t seed = NaryNodeOp::hash();
@@ -871,6 +909,8 @@ struct SquareNodeOp : public UnaryNodeOp {
   }
 
   const std::string type() override { return "square"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Square; return true; }
 };
 
 struct NegNodeOp : public UnaryNodeOp {
@@ -887,6 +927,8 @@ struct NegNodeOp : public UnaryNodeOp {
   }
 
   const std::string type() override { return "negate"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Neg; return true; }
 };
 
 struct TransposeNodeOp : public UnaryNodeOp {
@@ -941,6 +983,20 @@ struct TransposeNodeOp : public UnaryNodeOp {
 
   const std::string color() override { return "orange"; }
 
+  // true if only axes of size 1 move, so the value has the memory layout of the child and is a reshape of it
+  bool preservesLayout() {
+    const auto& shape = child(0)->shape();
+    int last = -1;
+    for(auto ax : axes_) {
+      if(shape[ax] == 1)
+        continue;
+      if(ax < last)
+        return false;
+      last = ax;
+    }
+    return true;
+  }
+
 private:
   friend class SerializationHelpers;
   std::vector<int> axes_;
@@ -1338,6 +1394,90 @@ struct AbsNodeOp : public UnaryNodeOp {
   }
 
   const std::string type() override { return "abs"; }
+
+  bool fusedInstruction(FusedInstruction& instr) override { instr.op = FusedOpCode::Abs; return true; }
+};
+
+// the sum of the partial outputs of the tensor-parallel ranks, whose gradient is that of every part
+struct AllReduceNodeOp : public UnaryNodeOp {
+  AllReduceNodeOp(Expr a, Ptr<TensorParallel> tensorParallel) : UnaryNodeOp(a), tensorParallel_(tensorParallel) {}
+
+  NodeOps forwardOps() override {
+    return {NodeOp(val_->copyFrom(child(0)->val()); tensorParallel_->allReduce(val_))};
+  }
+
+  NodeOps backwardOps() override {
+    using namespace functional;
+    return {NodeOp(Add(_1, child(0)->grad(), adj_))};
+  }
+
+  const std::string type() override { return "all_reduce"; }
+
+private:
+  Ptr<TensorParallel> tensorParallel_;
+};
+
+// the identity on the input of all tensor-parallel ranks, whose gradient is the sum of those of the ranks
+struct AllReduceGradNodeOp : public UnaryNodeOp {
+  AllReduceGradNodeOp(Expr a, Ptr<TensorParallel> tensorParallel) : UnaryNodeOp(a), tensorParallel_(tensorParallel) {}
+
+  NodeOps forwardOps() override {
+    return {NodeOp(val_->copyFrom(child(0)->val()))};
+  }
+
+  NodeOps backwardOps() override {
+    using namespace functional;
+    return {NodeOp(tensorParallel_->allReduce(adj_); Add(_1, child(0)->grad(), adj_))};
+  }
+
+  const std::string type() override { return "all_reduce_grad"; }
+
+private:
+  Ptr<TensorParallel> tensorParallel_;
+};
+
+// the parts x of all tensor-parallel ranks one after the other along the first axis, whose gradient is the part of
+// this rank of the gradient of all of them
+struct AllGatherNodeOp : public UnaryNodeOp {
+  AllGatherNodeOp(Expr a, Ptr<TensorParallel> tensorParallel)
+      : UnaryNodeOp(a, newShape(a, tensorParallel->ranks())), tensorParallel_(tensorParallel) {}
+
+  Shape newShape(Expr a, size_t ranks) {
+    Shape shape = a->shape();
+    shape.set(0, shape[0] * (int)ranks);
+    return shape;
+  }
+
+  NodeOps forwardOps() override {
+    return {NodeOp(tensorParallel_->allGather(child(0)->val(), val_))};
+  }
+
+  NodeOps backwardOps() override {
+    using namespace functional;
+    return {NodeOp(Add(_1, child(0)->grad(), partOf(adj_)))};
+  }
+
+  const std::string type() override { return "all_gather"; }
+
+private:
+  Ptr<TensorParallel> tensorParallel_;
+
+  // the part of this rank of a tensor of the shape of the gathered parts
+  Tensor partOf(Tensor gathered) {
+    auto shape = child(0)->shape();
+    size_t bytes = sizeOf(gathered->type()) * shape.elements();
+    auto mem = MemoryPiece::New(gathered->memory()->data() + tensorParallel_->rank() * bytes, bytes);
+    return TensorBase::New(mem, shape, gathered->type(), gathered->getBackend());
+  }
+};
+
+// A view of the logits of the part of the output vocabulary of this rank of a tensor-parallel graph, which
+// cross_entropy() combines with the logits of the other ranks. Has the value and gradient of the logits of the part.
+class VocabParallelLogitsNodeOp : public ReshapeNodeOp {
+public:
+  VocabParallelLogitsNodeOp(Expr logits) : ReshapeNodeOp(logits, logits->shape()) {}
+
+  const std::string type() override { return "vocab-parallel-logits"; }
 };
 
 #ifdef CUDNN
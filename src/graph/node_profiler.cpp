@@ -0,0 +1,110 @@
+#include "graph/node_profiler.h"
+#include "common/file_stream.h"
+#include "common/utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+namespace marian {
+
+NodeProfiler::NodeProfiler(Ptr<Backend> backend, size_t maxPasses, size_t top, const std::string& tracePath, bool counters)
+    : backend_(backend),
+      maxPasses_(maxPasses),
+      top_(top),
+      tracePath_(tracePath),
+      start_(std::chrono::steady_clock::now()),
+      counters_(counters && backend->getDeviceId().type == DeviceType::cpu) {
+  const char* sync = std::getenv("MARIAN_PROFILE_SYNC");
+  synchronize_ = sync && std::string(sync) != "0" && backend_->getDeviceId().type == DeviceType::gpu;
+}
+
+double NodeProfiler::now() const {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count();
+}
+
+bool NodeProfiler::beginPass(const std::string& kind) {
+  if(reported_)
+    return false;
+  forward_ = kind == "forward";
+  if(forward_ && forwardPasses_++ == maxPasses_) {
+    report();
+    return false;
+  }
+  return true;
+}
+
+void NodeProfiler::begin() {
+  if(synchronize_)
+    backend_->synchronize();
+  if(counters_) {
+    if(!perfCounters_)
+      perfCounters_.reset(new PerfCounters());
+    beginCounters_ = perfCounters_->read();
+  }
+  begin_ = now();
+}
+
+void NodeProfiler::end(Chainable<Tensor>* node) {
+  if(synchronize_)
+    backend_->synchronize();
+  double duration = now() - begin_;
+
+  auto& op = operators_[node->type()];
+  if(counters_)
+    op.counters += perfCounters_->read() - beginCounters_;
+  op.calls++;
+  (forward_ ? op.forward : op.backward) += duration;
+  if(!tracePath_.empty())
+    calls_.push_back({node->type(), node->name(), node->getId(), forward_, begin_, duration});
+}
+
+void NodeProfiler::report() {
+  if(reported_)
+    return;
+  reported_ = true;
+
+  std::vector<std::pair<std::string, Operator>> ops(operators_.begin(), operators_.end());
+  std::sort(ops.begin(), ops.end(), [](const std::pair<std::string, Operator>& a, const std::pair<std::string, Operator>& b) {
+    return a.second.forward + a.second.backward > b.second.forward + b.second.backward;
+  });
+  double total = 0;
+  for(const auto& op : ops)
+    total += op.second.forward + op.second.backward;
+
+  LOG(info, "[profile] Time per operator of {} forward passes on {}{}:", std::min(forwardPasses_, maxPasses_),
+      backend_->getDeviceId(), backend_->getDeviceId().type == DeviceType::gpu && !synchronize_
+      ? " (kernel launches only, set MARIAN_PROFILE_SYNC=1 for kernel times)" : "");
+  bool counters = counters_ && perfCounters_ && perfCounters_->available();
+  LOG(info, "[profile] {:>24} {:>8} {:>12} {:>12} {:>10} {:>7}{}", "operator", "calls", "forward ms", "backward ms",
+      "mean us", "share", counters ? fmt::format(" {:>6} {:>11} {:>10}", "IPC", "LLC misses", "est. GB/s") : "");
+  for(size_t i = 0; i < std::min(top_, ops.size()); ++i) {
+    const auto& op = ops[i].second;
+    double time = op.forward + op.backward;
+    LOG(info, "[profile] {:>24} {:>8} {:>12.3f} {:>12.3f} {:>10.1f} {:>6.1f}%{}", ops[i].first, op.calls,
+        op.forward / 1000, op.backward / 1000, time / op.calls, total > 0 ? 100 * time / total : 0.0,
+        counters ? fmt::format(" {:>6.2f} {:>10.1f}% {:>10.2f}", op.counters.ipc(), 100 * op.counters.cacheMissRate(),
+                               time > 0 ? op.counters.bytesFromMemory() / time * 1e-3 : 0.0)
+                 : "");
+  }
+
+  if(!tracePath_.empty()) {
+    io::OutputFileStream out(tracePath_);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, \"args\": {\"name\": \"forward\"}},\n";
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 1, \"args\": {\"name\": \"backward\"}}";
+    for(const auto& call : calls_)
+      out << ",\n{\"name\": \"" << utils::jsonEscape(call.type) << "\", \"cat\": \"node\", \"ph\": \"X\", \"pid\": 0, "
+          << "\"tid\": " << (call.forward ? 0 : 1) << ", \"ts\": " << call.begin << ", \"dur\": " << call.duration
+          << ", \"args\": {\"name\": \"" << utils::jsonEscape(call.name) << "\", \"node\": " << call.node << "}}";
+    out << "\n]}\n";
+    LOG(info, "[profile] Wrote {} node calls to {}", calls_.size(), tracePath_);
+  }
+
+  operators_.clear();
+  calls_.clear();
+}
+
+}  // namespace marian
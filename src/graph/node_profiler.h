@@ -0,0 +1,86 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/perf_counters.h"
+#include "tensors/backend.h"
+#include "tensors/tensor.h"
+#include "graph/chainable.h"
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+/**
+ * Times the forward() and backward() calls of the nodes of a graph, see ExpressionGraph::setNodeProfile(), and
+ * reports the operators, i.e. node types, that take the most time as a table in the log, optionally also every call
+ * as a Chrome trace for chrome://tracing or https://ui.perfetto.dev.
+ *
+ * GPU kernels run asynchronously, so by default the times of GPU nodes are mostly those of launching their kernels.
+ * With the environment variable MARIAN_PROFILE_SYNC=1 the device is synchronized around every node instead, which
+ * attributes the kernel times to the nodes but also removes all overlap between them.
+ *
+ * With counters, the table also has the instructions per cycle, the last-level cache miss rate and the memory
+ * bandwidth estimated from the cache misses of every operator, see PerfCounters. They count the thread that runs the
+ * graph, not the threads of --cpu-intra-op-threads, and reading them adds a few microseconds to every node.
+ *
+ * The report is written once the given number of forward passes, each with its backward pass, has been timed or
+ * when the profiler is destroyed.
+ */
+class NodeProfiler {
+public:
+  NodeProfiler(Ptr<Backend> backend, size_t maxPasses, size_t top, const std::string& tracePath, bool counters = false);
+
+  ~NodeProfiler() { report(); }
+
+  // Starts the pass of the given kind, "forward" or "backward". Returns false once the report has been written,
+  // after which the profiler records nothing.
+  bool beginPass(const std::string& kind);
+
+  // to be called right before and after the forward() or backward() of node
+  void begin();
+  void end(Chainable<Tensor>* node);
+
+  // logs the table and writes the trace, once
+  void report();
+
+private:
+  struct Call {
+    std::string type;
+    std::string name;
+    size_t node;
+    bool forward;
+    double begin; // microseconds since the profiler was created
+    double duration;
+  };
+
+  struct Operator {
+    size_t calls{0};
+    double forward{0};   // microseconds in forward() and backward()
+    double backward{0};
+    PerfCounters::Values counters;
+  };
+
+  double now() const;
+
+  Ptr<Backend> backend_;
+  size_t maxPasses_;
+  size_t top_;
+  std::string tracePath_;
+  bool synchronize_;
+  std::chrono::steady_clock::time_point start_;
+  bool reported_{false};
+
+  bool forward_{true};
+  size_t forwardPasses_{0};
+  double begin_{0};
+  bool counters_;
+  UPtr<PerfCounters> perfCounters_; // opened by the thread of the first node
+  PerfCounters::Values beginCounters_;
+  std::unordered_map<std::string, Operator> operators_;
+  std::vector<Call> calls_; // only with a trace
+};
+
+}  // namespace marian
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "graph/chainable.h"
+#include "tensors/tensor.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+/**
+ * ZeRO-3 style sharding of the parameters of the graphs of data-parallel training, see
+ * ExpressionGraph::setParameterShards(). Every parameter is owned by one rank, whose graph alone keeps its value and
+ * gradient between passes, see ShardedParameters. The other graphs gather the value into their workspace right before
+ * a node of the forward or backward pass reads it and free it again after the last one did, and pass their gradient
+ * to the owner once the backward pass finished it.
+ *
+ * All graphs call gather() and reduce() for the same parameters in the same order, the owner with its own value and
+ * gradient, so implementations can be collective operations, e.g. a broadcast and a reduce from and to the owner.
+ */
+class ParameterShards {
+public:
+  ParameterShards(size_t rank, size_t ranks) : rank_(rank), ranks_(ranks) {
+    ABORT_IF(rank >= ranks, "Rank {} of {} parameter shards does not exist", rank, ranks);
+  }
+  virtual ~ParameterShards() {}
+
+  size_t rank() const { return rank_; }
+  size_t ranks() const { return ranks_; }
+
+  // Assigns each parameter to the rank that owns the fewest bytes so far, in the given order, which has to be the
+  // same for all ranks
+  void assign(const std::vector<Expr>& params) {
+    std::vector<size_t> bytes(ranks_, 0);
+    owners_.clear();
+    for(const auto& p : params) {
+      size_t owner = std::min_element(bytes.begin(), bytes.end()) - bytes.begin();
+      owners_[p->name()] = owner;
+      bytes[owner] += p->shape().elements() * sizeOf(p->value_type());
+    }
+  }
+
+  size_t owner(const Expr& param) const {
+    auto it = owners_.find(param->name());
+    ABORT_IF(it == owners_.end(), "Parameter {} has not been assigned to a shard", param->name());
+    return it->second;
+  }
+
+  bool owns(const Expr& param) const { return owner(param) == rank_; }
+
+  // Sets value to the value of param at its owner
+  virtual void gather(const Expr& param, Tensor value) = 0;
+  // Adds grad to the gradient of param at its owner
+  virtual void reduce(const Expr& param, Tensor grad) = 0;
+
+private:
+  size_t rank_;
+  size_t ranks_;
+  std::unordered_map<std::string, size_t> owners_;
+};
+
+}  // namespace marian
@@ -6,6 +6,7 @@
 
 #include "common/definitions.h"
 #include "graph/chainable.h"
+#include "graph/parameter_shards.h"
 #include "tensors/tensor_allocator.h"
 
 namespace marian {
@@ -125,6 +126,66 @@ public:
   }
 };
 
+// Parameters of a graph that only keeps the values and gradients of the parameters it owns, see ParameterShards. The
+// others have neither outside the passes that gather them, vals() and grads() hold the owned ones.
+class ShardedParameters : public Parameters {
+private:
+  Ptr<ParameterShards> shards_;
+  bool assigned_{false};
+
+  size_t ownedCapacity(Ptr<TensorAllocator> alloc) {
+    size_t sum = 0;
+    for(auto p : params_)
+      if(shards_->owns(p))
+        sum += alloc->capacity(p->shape(), p->value_type());
+    return sum;
+  }
+
+public:
+  ShardedParameters(Type acceptedElementType, Ptr<ParameterShards> shards)
+      : Parameters(acceptedElementType), shards_(shards) {
+    LOG(debug, "Created sharded parameter object of type {}", acceptedElementType);
+  }
+
+  virtual void allocateForward() override {
+    if(!params_.empty() && !assigned_) {
+      // the same order on all ranks
+      std::sort(params_.begin(), params_.end(), [](Expr n1, Expr n2){ return n1->name() < n2->name(); });
+      shards_->assign(params_);
+      assigned_ = true;
+
+      size_t capacity = ownedCapacity(vals_);
+      if(capacity > 0)
+        vals_->reserveExact(capacity);
+      for(auto p : params_)
+        if(!p->val() && shards_->owns(p))
+          vals_->allocate(p->val(), p->shape(), p->value_type());
+    }
+  }
+
+  virtual void allocateBackward() override {
+    if(!params_.empty() && grads_->size() == 0) {
+      size_t capacity = ownedCapacity(grads_);
+      if(capacity == 0)
+        return;
+      grads_->reserveExact(capacity);
+      for(auto p : params_)
+        if(!p->grad() && shards_->owns(p))
+          grads_->allocate(p->grad(), p->shape(), p->value_type());
+    }
+  }
+
+  virtual void set_zero_adjoint() override {
+    if(grads_->size() > 0)
+      grads()->set(0.f);
+  }
+
+  virtual void clear() override {
+    Parameters::clear();
+    assigned_ = false;
+  }
+};
+
 class MappedParameters : public Parameters {
 private:
   Ptr<Backend> backend_;
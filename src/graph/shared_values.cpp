@@ -0,0 +1,46 @@
+#include "graph/shared_values.h"
+#include "common/hash.h"
+
+namespace marian {
+
+std::mutex SharedValues::mutex_;
+std::unordered_map<size_t, Weak<Device>> SharedValues::registry_;
+
+SharedValues::~SharedValues() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  held_.clear();
+  for(auto it = registry_.begin(); it != registry_.end();)
+    it = it->second.expired() ? registry_.erase(it) : std::next(it);
+}
+
+void SharedValues::share(size_t key, Tensor t, const std::function<void(Tensor)>& fill) {
+  auto deviceId = t->getBackend()->getDeviceId();
+  ABORT_IF(deviceId.type != DeviceType::cpu, "Shared values are only supported on the CPU, not on {}", deviceId);
+
+  util::hash_combine(key, t->shape().hash());
+  util::hash_combine(key, (size_t)t->type());
+  size_t bytes = requiredBytes(t->shape(), t->type());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto buffer = registry_[key].lock();
+  bool filled = buffer != nullptr;
+  if(!filled) {
+    buffer = DispatchDevice(deviceId);
+    buffer->reserve(bytes);
+  }
+  t->reset(MemoryPiece::New(buffer->data(), bytes));
+  if(!filled) {
+    fill(t);
+    registry_[key] = buffer;  // only once the value is complete
+  }
+  held_.push_back(buffer);
+}
+
+size_t SharedValues::bytes() const {
+  size_t bytes = 0;
+  for(const auto& buffer : held_)
+    bytes += buffer->size();
+  return bytes;
+}
+
+}  // namespace marian
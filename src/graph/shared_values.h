@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "tensors/device.h"
+#include "tensors/tensor.h"
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+/**
+ * Read-only values that the CPU inference graphs of a process share instead of holding a copy each, see
+ * ExpressionGraph::setSharedValues(): the parameters loaded from the same model weights and the memoized nodes that
+ * are computed from them once, e.g. the packed or quantized weights of --gemm-type packed16, packed8avx2 or intgemm8.
+ *
+ * Values are identified by a key. The first graph that needs the value of a new key fills a new buffer in place and
+ * registers it, later graphs point their tensors at the registered buffer. Every graph holds on to the buffers it
+ * uses, so a buffer is freed together with the last graph that uses it. Buffers are filled under a lock of the
+ * process, hence graphs that are set up in parallel wait for a value that another graph is filling instead of
+ * computing it again.
+ */
+class SharedValues {
+public:
+  ~SharedValues();
+
+  // Points t, which may have no memory yet, at the shared value with the key and the shape and type of t. If there is
+  // none, fill writes the value into a new buffer that t points at.
+  void share(size_t key, Tensor t, const std::function<void(Tensor)>& fill);
+
+  // number and bytes of the buffers this graph uses
+  size_t size() const { return held_.size(); }
+  size_t bytes() const;
+
+private:
+  std::vector<Ptr<Device>> held_;
+
+  static std::mutex mutex_;
+  static std::unordered_map<size_t, Weak<Device>> registry_;
+};
+
+}  // namespace marian
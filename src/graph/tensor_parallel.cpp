@@ -0,0 +1,68 @@
+#include "graph/tensor_parallel.h"
+#include "graph/node_initializers.h"
+
+#include <cstring>
+
+namespace marian {
+
+// items as [outer, ranks * dim[axis], inner] of blocks of dim[axis] * inner elements, the part of each rank
+static void blocksOf(const Shape& part, int axis, Type type, size_t& outer, size_t& blockBytes) {
+  axis = part.axis(axis);
+  outer = 1;
+  for(int i = 0; i < axis; ++i)
+    outer *= part[i];
+  blockBytes = sizeOf(type);
+  for(int i = axis; i < (int)part.size(); ++i)
+    blockBytes *= part[i];
+}
+
+Ptr<inits::NodeInitializer> TensorParallel::loadPart(const io::Item& whole, const Shape& shape) const {
+  if(whole.shape == shape)
+    return inits::fromItem(whole);
+
+  // the one axis along which the whole parameter has the units of all ranks
+  int axis = -1;
+  for(int i = 0; i < (int)shape.size() && whole.shape.size() == shape.size(); ++i) {
+    if(whole.shape[i] == shape[i])
+      continue;
+    ABORT_IF(axis >= 0 || whole.shape[i] != shape[i] * (int)ranks_,
+             "Parameter {} of shape {} is not split between {} tensor-parallel ranks into parts of shape {}",
+             whole.name, whole.shape, ranks_, shape);
+    axis = i;
+  }
+  ABORT_IF(axis < 0, "Parameter {} of shape {} does not match shape {}", whole.name, whole.shape, shape);
+
+  size_t rank = rank_, ranks = ranks_;
+  return inits::fromLambda([&whole, shape, axis, rank, ranks](Tensor tensor) {
+    size_t outer, blockBytes;
+    blocksOf(shape, axis, whole.type, outer, blockBytes);
+    io::Item part;
+    part.name = whole.name;
+    part.shape = shape;
+    part.type = whole.type;
+    part.bytes.resize(part.size());
+    for(size_t o = 0; o < outer; ++o)
+      std::memcpy(part.bytes.data() + o * blockBytes, whole.data() + (o * ranks + rank) * blockBytes, blockBytes);
+    tensor->set(part);
+  }, whole.type);
+}
+
+io::Item TensorParallel::join(const io::Item& gathered, const Shape& part, int axis) const {
+  size_t outer, blockBytes;
+  blocksOf(part, axis, gathered.type, outer, blockBytes);
+
+  io::Item whole;
+  whole.name = gathered.name;
+  whole.shape = part;
+  whole.shape.set(axis, part[axis] * (int)ranks_);
+  whole.type = gathered.type;
+  whole.bytes.resize(whole.size());
+  for(size_t r = 0; r < ranks_; ++r)
+    for(size_t o = 0; o < outer; ++o)
+      std::memcpy(whole.bytes.data() + (o * ranks_ + r) * blockBytes,
+                  gathered.data() + (r * outer + o) * blockBytes,
+                  blockBytes);
+  return whole;
+}
+
+}  // namespace marian
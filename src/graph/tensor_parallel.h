@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/io_item.h"
+#include "tensors/tensor.h"
+
+#include <string>
+#include <unordered_map>
+
+namespace marian {
+
+namespace inits {
+class NodeInitializer;
+}
+
+/**
+ * Megatron-style tensor parallelism of the graphs of several devices, see ExpressionGraph::setTensorParallel(). The
+ * attention layers and filter blocks of the new layer framework split their heads and hidden units between the
+ * ranks: the projections into the heads or hidden units compute the part of the output units (columns) of each rank,
+ * the projections out of them read that part of the input units (rows), and allReduce() sums the partial outputs of
+ * the ranks. All other parameters are replicated. The graphs of all ranks run the same batch and call allReduce() and
+ * allGather() for the same tensors in the same order, so implementations can be collective operations.
+ *
+ * Parameters of all ranks have the names of the whole model and model files hold the whole parameters: a graph loads
+ * the part of its rank of a split parameter, see loadPart(), and getItems() joins the parts of all ranks.
+ */
+class TensorParallel {
+public:
+  TensorParallel(size_t rank, size_t ranks) : rank_(rank), ranks_(ranks) {
+    ABORT_IF(rank >= ranks, "Rank {} of {} tensor-parallel ranks does not exist", rank, ranks);
+  }
+  virtual ~TensorParallel() {}
+
+  size_t rank() const { return rank_; }
+  size_t ranks() const { return ranks_; }
+
+  // the part of each rank of dim units, what names them in the error message
+  int part(int dim, const std::string& what) const {
+    ABORT_IF(dim % (int)ranks_ != 0, "The {} ({}) cannot be split between {} tensor-parallel ranks", what, dim, ranks_);
+    return dim / (int)ranks_;
+  }
+
+  // Records that the parameter of the given name is split along axis
+  void split(const std::string& name, int axis) { splitAxes_[name] = axis; }
+
+  // whether the parameter of the given name is split, and then along which axis
+  bool isSplit(const std::string& name, int& axis) const {
+    auto it = splitAxes_.find(name);
+    if(it == splitAxes_.end())
+      return false;
+    axis = it->second;
+    return true;
+  }
+
+  // Sums tensor over the ranks, in place
+  virtual void allReduce(Tensor tensor) = 0;
+  // Sets gathered, of ranks() times the elements of part, to the parts of all ranks one after the other
+  virtual void allGather(Tensor part, Tensor gathered) = 0;
+
+  // Initializes a parameter of the given shape from the whole loaded item, with the part of this rank if its shape
+  // is that of the item with one axis split. The item has to outlive the initialization.
+  Ptr<inits::NodeInitializer> loadPart(const io::Item& whole, const Shape& shape) const;
+
+  // the whole parameter from the parts of all ranks as allGather() returns them, each of the given shape
+  io::Item join(const io::Item& gathered, const Shape& part, int axis) const;
+
+private:
+  size_t rank_;
+  size_t ranks_;
+  std::unordered_map<std::string, int> splitAxes_;
+};
+
+}  // namespace marian
@@ -35,4 +35,47 @@ Expr Convolution::apply(const std::vector<Expr>&) {
 }
 #endif
 
+Expr CharConvPooling::convolve(Expr x, int kernelWidth, int kernelNum) {
+  auto graph = x->graph();
+  int steps = x->shape()[-3];
+  int dimBatch = x->shape()[-2];
+  int dimEmb = x->shape()[-1];
+  int padWidth = kernelWidth / 2;
+  int outSteps = steps + 2 * padWidth - kernelWidth + 1;
+
+  auto prefix = name_ + "_width_" + std::to_string(kernelWidth);
+  auto kernel = graph->param(prefix + "_conv_kernels", {1, kernelNum, kernelWidth, dimEmb}, inits::glorotUniform());
+  auto bias = graph->param(prefix + "_conv_bias", {1, kernelNum, 1, 1}, inits::zeros());
+
+  auto padded = x;
+  if(padWidth > 0) {
+    auto padding = graph->constant({padWidth, dimBatch, dimEmb}, inits::zeros());
+    padded = concatenate({padding, x, padding}, /*axis=*/-3);
+  }
+
+  // [outSteps, dimBatch, kernelWidth * dimEmb], the windows of embeddings in the order of the kernel elements
+  std::vector<Expr> windows;
+  for(int i = 0; i < kernelWidth; ++i)
+    windows.push_back(slice(padded, /*axis=*/-3, Slice(i, i + outSteps)));
+  auto columns = windows.size() == 1 ? windows[0] : concatenate(windows, /*axis=*/-1);
+
+  auto kernels = reshape(kernel, {kernelNum, kernelWidth * dimEmb});
+  return dot(columns, kernels, /*transA=*/false, /*transB=*/true) + reshape(bias, {kernelNum});
+}
+
+Expr CharConvPooling::operator()(Expr x, Expr mask) {
+  auto masked = x * mask;
+  // the pooling runs over the last axis of [dimBatch, kernelNum, steps]
+  auto poolingMask = transpose(mask, {1, 2, 0});
+
+  std::vector<Expr> outputs;
+  for(int i = 0; i < size_; ++i) {
+    int kernelWidth = kernelWidths_[i];
+    auto relued = relu(convolve(masked, kernelWidth, kernelNums_[i]));
+    auto pooled = pooling_with_masking(transpose(relued, {1, 2, 0}), poolingMask, stride_, kernelWidth % 2 == 0);
+    outputs.push_back(reshape(pooled, {pooled->shape()[-1], pooled->shape()[0], pooled->shape()[1]}));
+  }
+  return concatenate(outputs, -1);
+}
+
 }  // namespace marian
@@ -21,7 +21,14 @@ public:
 };
 
 typedef Accumulator<Convolution> convolution;
+#endif
 
+/**
+ * Convolutions of several widths over the character embeddings of the char-s2s encoder, each followed by a ReLU and a
+ * masked max pooling over windows of stride steps. The convolutions pad the time axis with zeros and multiply the
+ * windows of embeddings (im2col) with the kernels in one GEMM, on CPU and GPU without cuDNN. The parameters are those
+ * of the cuDNN convolution of earlier versions, so existing models load.
+ */
 class CharConvPooling {
 public:
   CharConvPooling(const std::string& prefix,
@@ -36,46 +43,13 @@ public:
         kernelNums_(kernelNums),
         stride_(stride) {}
 
-  Expr operator()(Expr x, Expr mask) {
-    auto graph = x->graph();
-
-    auto masked = x * mask;
-    auto xNCHW = convert2cudnnFormat(masked);
-    auto maskNCHW = convert2cudnnFormat(mask);
-
-    Expr input = xNCHW;
-    std::vector<Expr> outputs;
-
-    for(int i = 0; i < size_; ++i) {
-      int kernelWidth = kernelWidths_[i];
-      int kernelNum = kernelNums_[i];
-      int padWidth = kernelWidth / 2;
-
-      auto output
-          = convolution(graph)  //
-            ("prefix",
-             name_ + "_width_" + std::to_string(kernelWidth))             //
-            ("kernel-dims", std::make_pair(kernelWidth, x->shape()[-1]))  //
-            ("kernel-num", kernelNum)                                     //
-            ("paddings", std::make_pair(padWidth, 0))
-                .apply(input);
-
-      auto relued = relu(output);
-      auto output2 = pooling_with_masking(
-          relued, maskNCHW, stride_, kernelWidth % 2 == 0);
-
-      output2 = reshape(
-          output2,
-          {output2->shape()[-1], output2->shape()[0], output2->shape()[1]});
-      outputs.push_back(output2);
-    }
-
-    auto concatenated = concatenate(outputs, -1);
-
-    return concatenated;
-  }
+  // x [steps, dimBatch, dimEmb] and mask [steps, dimBatch, 1] to [windows, dimBatch, sum of kernelNums]
+  Expr operator()(Expr x, Expr mask);
 
 protected:
+  // convolution of x [steps, dimBatch, dimEmb] with kernelNum kernels of the given width, [steps', dimBatch, kernelNum]
+  Expr convolve(Expr x, int kernelWidth, int kernelNum);
+
   std::string name_;
   int size_;
   int kernelHeight_;
@@ -83,6 +57,5 @@ protected:
   std::vector<int> kernelNums_;
   int stride_;
 };
-#endif
 
 }  // namespace marian
@@ -47,6 +47,14 @@ Embedding::Embedding(Ptr<ExpressionGraph> graph, Ptr<Options> options)
   }
 #endif
 
+  auto tensorParallel = graph_->getTensorParallel();
+  if(tensorParallel) {
+    ABORT_IF(factoredVocab_, "Factored embeddings cannot be split between tensor-parallel ranks");
+    ABORT_IF(options_->hasAndNotEmpty("embFile"), "Embedding vectors cannot be split between tensor-parallel ranks");
+    dimVoc = tensorParallel->part(dimVoc, "vocabulary");
+    tensorParallel->split(name, 0);
+  }
+
   E_ = graph_->param(name, {dimVoc, dimEmb}, initFunc, fixed);
 }
 
@@ -161,10 +169,14 @@ Expr Embedding::apply(const Words& words, const Shape& shape) const /*override f
 Expr Embedding::applyIndices(const std::vector<WordIndex>& embIdx, const Shape& shape) const
 /*override final*/ {
   ABORT_IF(factoredVocab_, "Embedding: applyIndices must not be used with a factored vocabulary");
-  auto embIdxExpr = E_->graph()->indices(embIdx);
-  embIdxExpr->set_name("data_"
-                       + std::to_string(/*batchIndex_=*/0));  // @TODO: how to know the batch index?
-  auto selectedEmbs = rows(E_, embIdxExpr);                   // [(B*W) x E]
+  Expr selectedEmbs;
+  if(graph_->getTensorParallel()) {
+    selectedEmbs = lookupParts(embIdx);                       // [(B*W) x E]
+  } else {
+    Expr table, embIdxExpr;
+    std::tie(table, embIdxExpr) = lookupRows(embIdx);
+    selectedEmbs = rows(table, embIdxExpr);                   // [(B*W) x E]
+  }
   selectedEmbs      = reshape(selectedEmbs, shape);           // [W, B, E]
   // @BUGBUG: We should not broadcast along dimBatch=[-2]. Then we can also dropout before reshape()
   // (test that separately)
@@ -173,6 +185,69 @@ Expr Embedding::applyIndices(const std::vector<WordIndex>& embIdx, const Shape&
   return selectedEmbs;
 }
 
+Expr Embedding::applyWithPositions(const Words& words, const Shape& shape, float scale, int start) const
+/*override final*/ {
+  // dropout and concatenated factor embeddings need the separate operations
+  if(!inference_ || (factoredVocab_ && opt<std::string>("factorsCombine") == "concat") || graph_->getTensorParallel())
+    return IEmbeddingLayer::applyWithPositions(words, shape, scale, start);
+
+  auto graph = E_->graph();
+  if(factoredVocab_) {
+    auto factoredData = factoredVocab_->csr_rows(words);
+    auto weights = graph->constant({(int)factoredData.weights.size()},
+                                   inits::fromVector(factoredData.weights), Type::float32);
+    auto indices = graph->constant(
+        {(int)factoredData.indices.size()}, inits::fromVector(factoredData.indices), Type::uint32);
+    auto offsets = graph->constant(
+        {(int)factoredData.offsets.size()}, inits::fromVector(factoredData.offsets), Type::uint32);
+    return embedWithPositions(E_, indices, weights, offsets, shape, scale, start);
+  }
+
+  Expr table, embIdxExpr;
+  std::tie(table, embIdxExpr) = lookupRows(toWordIndexVector(words));
+  return embedWithPositions(table, embIdxExpr, /*weights=*/nullptr, /*offsets=*/nullptr, shape, scale, start);
+}
+
+/*private*/ std::pair<Expr, Expr> Embedding::lookupRows(const std::vector<WordIndex>& embIdx) const {
+  auto graph = E_->graph();
+  // the words predicted with a static shortlist are all in it, forced words may not be
+  Expr compact = inference_ && shortlist_ ? shortlist_->getCompactEmbeddings(E_) : nullptr;
+  if(compact) {
+    std::vector<WordIndex> compactIdx;
+    compactIdx.reserve(embIdx.size());
+    for(auto wIdx : embIdx) {
+      auto idx = shortlist_->tryForwardMap(wIdx);
+      if(idx == data::Shortlist::npos)
+        break;
+      compactIdx.push_back(idx);
+    }
+    if(compactIdx.size() == embIdx.size())
+      return {compact, graph->indices(compactIdx)};
+  }
+
+  auto embIdxExpr = graph->indices(embIdx);
+  embIdxExpr->set_name("data_" + std::to_string(/*batchIndex_=*/0)); // @TODO: how to know the batch index?
+  return {E_, embIdxExpr};
+}
+
+/*private*/ Expr Embedding::lookupParts(const std::vector<WordIndex>& embIdx) const {
+  auto graph = E_->graph();
+  int dimPart = E_->shape()[0];
+  WordIndex begin = (WordIndex)(graph->getTensorParallel()->rank() * dimPart);
+
+  // the words of the other ranks look up row 0, whose embedding is then masked out
+  std::vector<WordIndex> partIdx(embIdx.size(), 0);
+  std::vector<float> isPart(embIdx.size(), 0.f);
+  for(size_t i = 0; i < embIdx.size(); ++i) {
+    if(embIdx[i] >= begin && embIdx[i] < begin + (WordIndex)dimPart) {
+      partIdx[i] = embIdx[i] - begin;
+      isPart[i] = 1.f;
+    }
+  }
+  auto mask = graph->constant({(int)embIdx.size(), 1}, inits::fromVector(isPart), E_->value_type());
+  return all_reduce(rows(E_, graph->indices(partIdx)) * mask);
+}
+
 // standard encoder word embeddings
 /*private*/ Ptr<IEmbeddingLayer> EncoderDecoderLayerBase::createEmbeddingLayer() const {
   // clang-format off
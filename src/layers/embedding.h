@@ -11,6 +11,8 @@ class FactoredVocab;
  * Note that this also applies dropout if the option is passed (pass 0 when in inference mode).
  * It is best to not use Embedding directly, but rather via getEmbeddingLayer() in
  * EncoderDecoderLayerBase, which knows to pass on all required parameters from options.
+ * Each rank of a tensor-parallel graph holds the embeddings of its part of the vocabulary, so that an output layer
+ * tied to them computes the logits of that part only, see mlp::Output.
  */
 class Embedding : public LayerBase, public IEmbeddingLayer {
   Expr E_;
@@ -18,7 +20,12 @@ class Embedding : public LayerBase, public IEmbeddingLayer {
   Ptr<FactoredVocab> factoredVocab_;
   Expr multiRows(const Words& data, float dropProb) const;
   Expr embedWithConcat(const Words& data) const;
+  // the compact rows (or E_) and the indices of embIdx into them
+  std::pair<Expr, Expr> lookupRows(const std::vector<WordIndex>& embIdx) const;
+  // the rows of the words of the vocabulary part of this rank of a tensor-parallel graph, summed over the ranks
+  Expr lookupParts(const std::vector<WordIndex>& embIdx) const;
   bool inference_{false};
+  Ptr<data::Shortlist> shortlist_;
 
 public:
   /**
@@ -51,6 +58,19 @@ public:
    * @return The expression holding the embedding layer
    */
   Expr applyIndices(const std::vector<WordIndex>& embIdx, const Shape& shape) const override final;
+
+  /**
+   * Apply/Link this embedding layer with scaling and sinusoidal position embeddings to the expression graph.
+   * In inference the lookup, the factor sum, the scaling and the positions are one operation.
+   * @param words Sequence of vocabulary items
+   * @param shape Shape of the words, positions run along axis -3
+   * @param scale Factor for the embeddings
+   * @param start Position of the first word
+   * @return The expression holding the scaled, position-augmented embeddings
+   */
+  Expr applyWithPositions(const Words& words, const Shape& shape, float scale, int start) const override final;
+
+  void setShortlist(Ptr<data::Shortlist> shortlist) override final { shortlist_ = shortlist; }
 };
 
 /**
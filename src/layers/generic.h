@@ -68,6 +68,19 @@ struct IEmbeddingLayer {
 
   // alternative from indices directly
   virtual Expr applyIndices(const std::vector<WordIndex>& embIdx, const Shape& shape) const = 0;
+
+  // scale * apply(words, shape) plus the sinusoidal embeddings of the positions start, start + 1, .. along axis -3,
+  // which Embedding computes in one operation in inference, see embedWithPositions()
+  virtual Expr applyWithPositions(const Words& words, const Shape& shape, float scale, int start) const {
+    auto embeddings = apply(words, shape);
+    auto signal = embeddings->graph()->constant({shape[-3], 1, shape[-1]}, inits::sinusoidalPositionEmbeddings(start));
+    return scale * embeddings + signal;
+  }
+
+  // lets apply() and applyWithPositions() look up the words in the compact copy of the short-listed rows of a static
+  // shortlist during inference, nullptr to use the whole matrix, see --shortlist-compact-embeddings
+  virtual void setShortlist(Ptr<data::Shortlist> /*shortlist*/) {}
+
   virtual ~IEmbeddingLayer() {}
 };
 
@@ -104,6 +117,9 @@ private:
   Ptr<IEmbeddingLayer> createULREmbeddingLayer() const;
 
 public:
+  // the stream of the batch that this layer reads
+  size_t batchIndex() const { return batchIndex_; }
+
   /**
    * Get all embedding layer(s).
    * It lazily creates the embedding layer on first call.
@@ -258,4 +274,19 @@ static inline Expr rmsNorm(Expr x, std::string prefix, std::string suffix = std:
   return marian::rmsNorm(x, scale, nullptr, 1e-6f);
 }
 
+// layerNorm(dropout(x, mask) + residual, prefix, suffix) and rmsNorm(dropout(x, mask) + residual, prefix, suffix),
+// with the same parameters
+static inline Expr addLayerNorm(Expr x, Expr residual, std::string prefix, std::string suffix = std::string(), Expr mask = nullptr) {
+  int dimModel = x->shape()[-1];
+  auto scale = x->graph()->param(prefix + "_ln_scale" + suffix, {1, dimModel}, inits::ones());
+  auto bias = x->graph()->param(prefix + "_ln_bias" + suffix, {1, dimModel}, inits::zeros());
+  return marian::addLayerNorm(x, residual, scale, bias, 1e-6f, mask);
+}
+
+static inline Expr addRmsNorm(Expr x, Expr residual, std::string prefix, std::string suffix = std::string(), Expr mask = nullptr) {
+  int dimModel = x->shape()[-1];
+  auto scale = x->graph()->param(prefix + "_rms_scale" + suffix, {1, dimModel}, inits::ones());
+  return marian::addRmsNorm(x, residual, scale, nullptr, 1e-6f, mask);
+}
+
 }  // namespace marian
@@ -13,8 +13,9 @@ Logits::Logits(Ptr<RationalLoss> logits) {  // single-output constructor
 }
 
 Logits::Logits(std::vector<Ptr<RationalLoss>>&& logits,
-        Ptr<FactoredVocab> embeddingFactorMapping)  // factored-output constructor
-    : logits_(std::move(logits)), factoredVocab_(embeddingFactorMapping) {
+        Ptr<FactoredVocab> embeddingFactorMapping,
+        Expr lemmaFactorMasks /*= nullptr*/)  // factored-output constructor
+    : logits_(std::move(logits)), factoredVocab_(embeddingFactorMapping), lemmaFactorMasks_(lemmaFactorMasks) {
 }
 
 Ptr<ExpressionGraph> Logits::graph() const {
@@ -101,6 +102,14 @@ Expr Logits::getFactoredLogits(size_t groupIndex,
   //  - lemma: add all maxes of applicable factors
   if(groupIndex > 0) {
     sel = sel - max(sel, -1);
+  } else if(lemmaFactorMasks_) {
+    // all maxima at once, as a product with the masks of the lemmas that are fixed for the batch
+    std::vector<Expr> factorMaxima;
+    for(size_t g = 1; g < getNumFactorGroups(); g++)
+      if(logits_[g])  // (the masks have no rows for empty factor groups either)
+        factorMaxima.push_back(max(logits_[g]->loss(), -1));  // [localBeamSize, 1, dimBatch, 1]
+    auto maxima = cast(concatenate(factorMaxima, /*axis=*/-1), sel->value_type());  // [localBeamSize, 1, dimBatch, numFactorGroups]
+    sel = sel + dot(maxima, cast(lemmaFactorMasks_, sel->value_type()));  // those lemmas that don't have a factor get 0
   } else {
     auto numGroups = getNumFactorGroups();
     for(size_t g = 1; g < numGroups; g++) {
@@ -230,48 +239,15 @@ std::vector<Logits::MaskedFactorIndices> Logits::factorizeWords(const Words& wor
 // If 'indices' is given, then return the masks for the indices; otherwise for all lemmas
 std::vector<float> Logits::getFactorMasks(size_t factorGroup, const std::vector<WordIndex>& indices)
     const {  // [lemmaIndex] -> 1.0 for words that do have this factor; else 0
-  size_t n
-      = indices.empty()
-            ? (factoredVocab_->getGroupRange(0).second - factoredVocab_->getGroupRange(0).first)
-            : indices.size();
-  std::vector<float> res;
-  res.reserve(n);
-  // @TODO: we should rearrange lemmaHasFactorGroup as vector[groups[i] of float; then move this
-  // into FactoredVocab
-  for(size_t i = 0; i < n; i++) {
-    auto lemma = indices.empty() ? i : (indices[i] - factoredVocab_->getGroupRange(0).first);
-    res.push_back((float)factoredVocab_->lemmaHasFactorGroup(lemma, factorGroup));
-  }
-  return res;
+  return factoredVocab_->getLemmaFactorGroupMasks(factorGroup, indices);
 }
 
 std::vector<float> Logits::getFactorMasks(size_t factorGroup, Expr indicesExpr)
     const {  // [lemmaIndex] -> 1.0 for words that do have this factor; else 0
-  int batchSize = indicesExpr->shape()[0];
-  int currBeamSize = indicesExpr->shape()[1];
-  int numHypos = batchSize * currBeamSize;
+  // the indices of all hypotheses are flattened, hence the masks come out in the same layout
   std::vector<WordIndex> indices;
   indicesExpr->val()->get(indices);
-
-  //std::cerr << "indices=" << indices.size() << std::endl;
-  size_t n
-      = indices.empty()
-            ? (factoredVocab_->getGroupRange(0).second - factoredVocab_->getGroupRange(0).first)
-            : indices.size() / numHypos;
-  std::vector<float> res;
-  res.reserve(numHypos * n);
-  //std::cerr << "n=" << n << std::endl;
-
-  // @TODO: we should rearrange lemmaHasFactorGroup as vector[groups[i] of float; then move this
-  // into FactoredVocab
-  for (size_t hypoIdx = 0; hypoIdx < numHypos; ++hypoIdx) {
-    for(size_t i = 0; i < n; i++) {
-      size_t idx = hypoIdx * n + i;
-      size_t lemma = indices.empty() ? i : (indices[idx] - factoredVocab_->getGroupRange(0).first);
-      res.push_back((float)factoredVocab_->lemmaHasFactorGroup(lemma, factorGroup));
-    }
-  }
-  return res;
+  return factoredVocab_->getLemmaFactorGroupMasks(factorGroup, indices);
 }
 
 Logits Logits::applyUnaryFunction(
@@ -20,7 +20,8 @@ public:
   explicit Logits(Ptr<RationalLoss> logits);  // single-output constructor
   explicit Logits(Expr logits);  // single-output constructor from Expr only (RationalLoss has no count)
   Logits(std::vector<Ptr<RationalLoss>>&& logits,
-         Ptr<FactoredVocab> embeddingFactorMapping);  // factored-output constructor
+         Ptr<FactoredVocab> embeddingFactorMapping,
+         Expr lemmaFactorMasks = nullptr);  // factored-output constructor, see lemmaFactorMasks_
 
   Expr getLogits() const;  // assume it holds logits: get them, possibly aggregating over factors
   Expr getFactoredLogits(
@@ -85,6 +86,9 @@ private:
   // by the Expr
   std::vector<Ptr<RationalLoss>> logits_;  // [group id][B..., num factors in group]
   Ptr<FactoredVocab> factoredVocab_;
+  // optional [number of non-empty factor groups, lemmas or shortlist], 1.0 if a lemma has the factor group,
+  // used to normalize the lemma scores in getFactoredLogits() without one mask per step and group
+  Expr lemmaFactorMasks_;
 };
 
 // Unary function that returns a Logits object
@@ -184,24 +184,12 @@ Expr searchEncoded(Expr encodedQuery, Expr encodedWeights, int dimK, int firstNR
     }
     else {
 #ifdef CUDA_FOUND
-      Ptr<Backend> backend = out->val()->getBackend();
-
-      const size_t CHUNK = 128;
-      const size_t MBYTE = 1024 * 1024;
-      const size_t GROW = CHUNK * MBYTE;
-      Ptr<Allocator> alloc = marian::New<marian::Allocator>(backend->getDeviceId(), 0, GROW);
-
-      auto memory = alloc->alloc(requiredBytes(out->shape(), marian::Type::uint32));
-
-      // not required for calculations. Useful for debugging
-      Tensor outCounts = nullptr; //marian::TensorBase::New(memory, out->shape(), marian::Type::uint32, backend);
-
-      uint16_t numHash = (uint16_t) encodedWeights->shape()[-1] * 8;
+      int bytesPerVector = encodedWeights->shape()[-1];
+      int wRows = firstNRows != 0 ? firstNRows : encodedWeights->shape().elements() / bytesPerVector;
 
-      marian::gpu::HammmingAndSort(out->val(), outCounts,
-                  encodedWeights->val(), encodedQuery->val(),
-                  dimK, 0, numHash, 
-                  alloc, backend);
+      // returns the indices sorted by increasing index value like the CPU search
+      marian::gpu::HammingTopK(out->val(), encodedQuery->val(), encodedWeights->val(),
+                               dimK, wRows, out->graph()->allocator());
 #endif
     }
   };
@@ -212,10 +200,27 @@ Expr searchEncoded(Expr encodedQuery, Expr encodedWeights, int dimK, int firstNR
 
 Expr search(Expr query, Expr weights, int k, int nBits, int firstNRows, bool abortIfDynamic) {
   int dim = weights->shape()[-1];
-  
+  int rows = weights->shape()[-2];
+
+  // the precomputed index from the model file can only be used if it has been built for the same number of bits
+  auto graph = weights->graph();
+  Expr storedRotation = graph->get(ROTATION_NAME);
+  Expr storedCodes    = graph->get(CODES_NAME);
+  bool useStored = storedCodes
+                   && storedCodes->shape()[-1] == bytesPerVector(nBits)
+                   && storedCodes->shape()[-2] == rows
+                   && (dim == nBits || (storedRotation && storedRotation->shape() == Shape({dim, nBits})));
+  if(storedCodes && !useStored) {
+    ABORT_IF(abortIfDynamic,
+             "LSH index in the model file with shape {} does not match {} bits for weights with shape {}",
+             storedCodes->shape(), nBits, weights->shape());
+    LOG_ONCE(warn, "[warning] LSH index in the model file with shape {} does not match {} bits, recomputing it",
+             storedCodes->shape(), nBits);
+  }
+
   Expr rotMat = nullptr;
   if(dim != nBits) {
-    rotMat = weights->graph()->get("lsh_output_rotation");
+    rotMat = useStored ? storedRotation : nullptr;
     if(rotMat) {
       LOG_ONCE(info, "Reusing parameter LSH rotation matrix {} with shape {}", rotMat->name(), rotMat->shape());
     } else {
@@ -225,12 +230,13 @@ Expr search(Expr query, Expr weights, int k, int nBits, int firstNRows, bool abo
     }
   }
 
-  Expr encodedWeights = weights->graph()->get("lsh_output_codes");
+  Expr encodedWeights = useStored ? storedCodes : nullptr;
   if(encodedWeights) {
     LOG_ONCE(info, "Reusing parameter LSH code matrix {} with shape {}", encodedWeights->name(), encodedWeights->shape());
   } else {
     ABORT_IF(abortIfDynamic, "Dynamic creation of LSH code matrix prohibited");
-    LOG_ONCE(info, "Creating ad-hoc code matrix with shape {}", Shape({weights->shape()[-2], lsh::bytesPerVector(nBits)}));
+    LOG_ONCE(info, "Creating ad-hoc code matrix with shape {}, add it to the model with marian-conv --add-lsh to avoid this",
+             Shape({rows, lsh::bytesPerVector(nBits)}));
     encodedWeights = encode(weights, rotMat);
   }
   
@@ -250,6 +256,45 @@ Ptr<inits::NodeInitializer> randomRotation() {
   return New<RandomRotation>();
 }
 
+IndexInfo indexInfo(Ptr<io::ModelWeights> modelWeights) {
+  IndexInfo info;
+  const io::Item* codes = nullptr;
+  const io::Item* rotation = nullptr;
+  for(const auto& item : modelWeights->items()) {
+    if(item.name == CODES_NAME)
+      codes = &item;
+    else if(item.name == ROTATION_NAME)
+      rotation = &item;
+  }
+
+  if(codes) {
+    info.rows = codes->shape[-2];
+    info.rotation = rotation != nullptr;
+    // without rotation the number of bits is the embedding size, which is a multiple of 8 in practice
+    info.nBits = rotation ? rotation->shape[-1] : codes->shape[-1] * 8;
+  }
+  return info;
+}
+
+std::vector<int> resolveOptions(std::vector<int> lshOpts, Ptr<io::ModelWeights> modelWeights) {
+  if(lshOpts.empty())
+    return lshOpts;
+  ABORT_IF(lshOpts.size() > 2, "--output-approx-knn takes 1 or 2 parameters");
+
+  auto info = indexInfo(modelWeights);
+  if(lshOpts.size() == 1) {
+    ABORT_IF(info.nBits == 0,
+             "--output-approx-knn without number of bits requires an LSH index in the model file, see marian-conv --add-lsh");
+    lshOpts.push_back(info.nBits);
+  }
+
+  if(info.nBits == lshOpts[1])
+    LOG(info, "[data] Using LSH index with {} bits for {} rows from the model file", info.nBits, info.rows);
+  else if(info.nBits != 0)
+    LOG(warn, "[warning] LSH index in the model file has {} bits instead of {}, it will be recomputed", info.nBits, lshOpts[1]);
+  return lshOpts;
+}
+
 void addDummyParameters(Ptr<ExpressionGraph> graph, ParamConvInfo paramInfo) {
   auto weights = graph->get(paramInfo.name);
   int nBitsRot = paramInfo.nBits;
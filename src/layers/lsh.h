@@ -1,5 +1,6 @@
 #pragma once
 
+#include "common/io.h"
 #include "graph/expression_operators.h"
 #include "graph/node_initializers.h"
 
@@ -30,6 +31,25 @@ namespace lsh {
   // same as above, but performs encoding on the fly
   Expr search(Expr query, Expr weights, int k, int nbits, int firstNRows = 0, bool abortIfDynamic = false);
   
+  // names of the parameters that hold a precomputed LSH index, see marian-conv --add-lsh
+  const std::string CODES_NAME    = "lsh_output_codes";
+  const std::string ROTATION_NAME = "lsh_output_rotation";
+
+  // Describes the precomputed LSH index in a model file. Its items are loaded, or memory-mapped for *.bin
+  // files, like any other parameter and used by search() in place of building the index per graph.
+  struct IndexInfo {
+    int nBits{0};          // 0 if the model file does not contain an LSH index
+    int rows{0};           // number of encoded rows of the output weights
+    bool rotation{false};  // true if the weights are rotated to nBits dimensions before encoding
+  };
+
+  IndexInfo indexInfo(Ptr<io::ModelWeights> modelWeights);
+
+  // Completes the --output-approx-knn parameters (k and number of bits): if only k is given, the number
+  // of bits is taken from the LSH index in the model file. Warns if the index has been built for a different
+  // number of bits, as it is recomputed in that case.
+  std::vector<int> resolveOptions(std::vector<int> lshOpts, Ptr<io::ModelWeights> modelWeights);
+
   // struct for parameter conversion used in marian-conv
   struct ParamConvInfo {
     std::string name;
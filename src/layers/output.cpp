@@ -42,6 +42,13 @@ static std::string getLemmaDependency(int lemmaDimEmb, const std::string& lemmaD
     LOG_ONCE(info, "[embedding] Factored outputs enabled");
   }
 
+  // each rank of a tensor-parallel graph holds the output embeddings and biases of its part of the vocabulary
+  auto tensorParallel = graph_->getTensorParallel();
+  if(tensorParallel) {
+    ABORT_IF(factoredVocab_, "Factored outputs cannot be split between tensor-parallel ranks");
+    numOutputClasses = tensorParallel->part(numOutputClasses, "output vocabulary");
+  }
+
   if(tiedParam_) {
     Wt_ = tiedParam_;
   } else {
@@ -52,10 +59,18 @@ static std::string getLemmaDependency(int lemmaDimEmb, const std::string& lemmaD
     } else  // this is the regular case:
       Wt_ = graph_->param(
           name + "_Wt", {numOutputClasses, inputDim}, inits::glorotUniform(false, true));
+    if(tensorParallel)
+      tensorParallel->split(Wt_->name(), isLegacyUntransposedW ? -1 : 0);
   }
+  ABORT_IF(tensorParallel && Wt_->shape()[isLegacyUntransposedW ? -1 : 0] != numOutputClasses,
+           "The tied output embeddings {} of shape {} are not split between tensor-parallel ranks",
+           Wt_->name(), Wt_->shape());
 
-  if(hasBias_)
+  if(hasBias_) {
     b_ = graph_->param(name + "_b", {1, numOutputClasses}, inits::zeros());
+    if(tensorParallel)
+      tensorParallel->split(b_->name(), -1);
+  }
 
   /*const*/ int lemmaDimEmb = options_->get<int>("lemma-dim-emb", 0);
   std::string lemmaDependency = getLemmaDependency(lemmaDimEmb, options_->get<std::string>("lemma-dependency", ""));
@@ -101,15 +116,16 @@ Logits Output::applyAsLogits(Expr input) /*override final*/ {
 
     Expr ret;
 
-    if (b) {
-      // original shortlist. W always has 1 for beam & batch
-      ABORT_UNLESS(!shortlist_->isDynamic(), "affineShortlist. Bias not supported with LSH/dynamic shortlist"); // todo rename ABORT_UNLESS to ASSERT
-      ret = affine(x, W, b, transA, transB);
-    }
-    else if (shortlist_->isDynamic()) {
-      // LSH produces W entry for each beam and batch => need bdot()
+    if (shortlist_->isDynamic()) {
+      // LSH produces W entry for each beam and batch, per-sentence shortlists for each batch entry => need bdot()
       ABORT_IF(!(!transA && transB), "affineShortlist. Only tested with transA==0 and transB==1");
       ret = bdot(x, W, transA, transB);
+      if (b) // only provided by per-sentence shortlists, [1, batch, 1, k]
+        ret = ret + b;
+    }
+    else if (b) {
+      // original shortlist. W always has 1 for beam & batch
+      ret = affine(x, W, b, transA, transB);
     }
     else {
       // original shortlist. W always has 1 for beam & batch
@@ -120,8 +136,25 @@ Logits Output::applyAsLogits(Expr input) /*override final*/ {
     return ret;
   };
 
+  // Dynamic shortlists select different rows per query, which the fused output layer reads in place
+  // instead of gathering them for a batched GEMM, bias and logsoftmax. Not for packed or float16 weights.
+  bool fusedShortlist = shortlist_ && shortlist_->isDynamic() && !factoredVocab_ && !isLegacyUntransposedW
+                        && input->value_type() == Type::float32 && Wt_->value_type() == Type::float32
+                        && (!b_ || b_->value_type() == Type::float32);
+
+  // Static shortlists with int8-packed CPU GEMMs pack the selected rows from a quantization of the whole
+  // output matrix that is computed once, instead of gathering them for a float32 GEMM, see affineRows().
+  bool packedShortlist = shortlist_ && !shortlist_->isDynamic() && !factoredVocab_ && !isLegacyUntransposedW
+                         && graph_->isInference() && graph_->getDeviceId().type == DeviceType::cpu
+                         && graph_->getBackend()->getGemmType() == GemmType::FbInt8Packed
+                         && Wt_->value_type() == Type::float32;
+
+  auto tensorParallel = graph_->getTensorParallel();
+  ABORT_IF(tensorParallel && shortlist_, "Shortlists cannot be used with output layers split between tensor-parallel ranks");
+
   if(shortlist_) {
-    shortlist_->filter(input, Wt_, isLegacyUntransposedW, b_, lemmaEt_);
+    shortlist_->filter(input, Wt_, isLegacyUntransposedW, b_, lemmaEt_,
+                       /*cacheTensors=*/!fusedShortlist && !packedShortlist);
   }
 
   if(factoredVocab_) {
@@ -331,23 +364,82 @@ Logits Output::applyAsLogits(Expr input) /*override final*/ {
         input1 = input1 + f;
       }
     }
-    return Logits(std::move(allLogits), factoredVocab_);
-  } else if(shortlist_) {
+
+    // The masks of the lemmas that have a factor group only change with the batch, unless the
+    // shortlist changes every step, hence they are uploaded once per batch for decoding.
+    if(graph->isInference() && numGroups > 1 && !lemmaFactorMasks_ && !(shortlist_ && shortlist_->isDynamic())) {
+      std::vector<WordIndex> lemmaIndices = shortlist_ ? shortlist_->indices() : std::vector<WordIndex>();
+      std::vector<float> masks;
+      int numRows = 0;
+      for(size_t g = 1; g < numGroups; g++) {
+        if(!allLogits[g])
+          continue;
+        auto groupMasks = factoredVocab_->getLemmaFactorGroupMasks(g, lemmaIndices);
+        masks.insert(masks.end(), groupMasks.begin(), groupMasks.end());
+        numRows++;
+      }
+      if(numRows > 0)
+        lemmaFactorMasks_ = graph->constant({numRows, (int)masks.size() / numRows}, inits::fromVector(masks));
+    }
+    return Logits(std::move(allLogits), factoredVocab_, lemmaFactorMasks_);
+  } else if(fusedShortlist) {
     const Shape &inputShape = input->shape();
     assert(inputShape[1] == 1); // time dimension always 1 for decoding
     input = reshape(input, {inputShape[0], inputShape[2], 1, inputShape[3]});
 
+    // already normalized, logsoftmax() in the decoder passes these through
+    Expr ret = logsoftmax_shortlist(input, Wt_, shortlist_->getIndicesExpr(), b_); // [beam, batch, 1, k]
+    const Shape &retShape = ret->shape();
+    ret = reshape(ret, {retShape[0], 1, retShape[1], retShape[3]});
+    return Logits(ret);
+  } else if(auto sampled = std::dynamic_pointer_cast<data::SampledShortlist>(shortlist_)) {
+    // training with a sampled softmax: all positions of the batch share the candidates, whose logits are corrected
+    // by the log of the probability that they were sampled
+    const auto& logCorrections = sampled->logCorrections();
     Expr Wt = shortlist_->getCachedShortWt();
-    Expr b = shortlist_->getCachedShortb();
-    Expr ret = affineShortlist(input,
-                              Wt,
-                              b,
-                              false,
-                              /*transB=*/isLegacyUntransposedW ? false : true);
+    Wt = reshape(Wt, {Wt->shape()[-2], Wt->shape()[-1]});
+    Expr b = graph_->constant({1, (int)logCorrections.size()}, inits::fromVector(logCorrections), Wt->value_type());
+    if(shortlist_->getCachedShortb())
+      b = b + shortlist_->getCachedShortb();
+    return Logits(affine(input, Wt, b, false, /*transB=*/true));
+  } else if(shortlist_) {
+    const Shape &inputShape = input->shape();
+    assert(inputShape[1] == 1); // time dimension always 1 for decoding
+    input = reshape(input, {inputShape[0], inputShape[2], 1, inputShape[3]});
+
+    Expr ret;
+    if(packedShortlist) {
+      ret = affineRows(input, Wt_, flatten(shortlist_->getIndicesExpr()), b_);
+    } else {
+      Expr Wt = shortlist_->getCachedShortWt();
+      Expr b = shortlist_->getCachedShortb();
+      ret = affineShortlist(input,
+                            Wt,
+                            b,
+                            false,
+                            /*transB=*/isLegacyUntransposedW ? false : true);
+    }
     const Shape &retShape = ret->shape();
     assert(retShape[2] == 1); // time dimension always 1 for decoding
     ret = reshape(ret, {retShape[0], 1, retShape[1], retShape[3]});
     return Logits(ret);
+  } else if(tensorParallel) {
+    // the logits of the vocabulary part of this rank, which the cross-entropy combines with those of the other ranks
+    // without gathering them. Decoding selects the best words of the whole vocabulary from the gathered logits.
+    Expr ret = affineOrDot(all_reduce_grad(input), Wt_, b_, false, /*transB=*/isLegacyUntransposedW ? false : true);
+    if(!graph_->isInference())
+      return Logits(vocab_parallel_logits(ret));
+    const Shape& shape = ret->shape();
+    int dimPart = shape[-1];
+    int rows = shape.elements() / dimPart;
+    ret = transpose(all_gather(transpose(reshape(ret, {rows, dimPart}))));  // [rows, vocab]
+    Shape gathered = shape;
+    gathered.set(-1, ret->shape()[-1]);
+    return Logits(reshape(ret, gathered));
+  } else if(options_->get<int>("chunked-output-loss", 0) > 0 && !graph_->isInference()) {
+    // the logits of the whole batch are never materialized, cross_entropy() computes them in blocks of rows
+    return Logits(chunked_logits(input, Wt_, b_, /*transB=*/isLegacyUntransposedW ? false : true,
+                                 options_->get<int>("chunked-output-loss")));
   } else {
     Expr ret = affineOrDot(input, Wt_, b_, false, /*transB=*/isLegacyUntransposedW ? false : true);
     return Logits(ret);
@@ -24,6 +24,7 @@ private:
   // optional parameters set/updated after construction
   Expr tiedParam_;
   Ptr<data::Shortlist> shortlist_;
+  Expr lemmaFactorMasks_;  // decoding only, see Logits::getFactoredLogits(); cleared by clear()
 
   void lazyConstruct(int inputDim);
 
@@ -55,6 +56,7 @@ public:
   // cachedShortWt_ etc. in the graph's short-term cache
   void clear() override final {
     shortlist_ = nullptr;
+    lemmaFactorMasks_ = nullptr;
   }
 
   Logits applyAsLogits(Expr input) override final;
@@ -204,11 +204,16 @@ Ptr<nn::DecoderState> convertDecoderState(Ptr<DecoderState> state,
 
   auto nnState = New<nn::DecoderSeq2SeqState>(position, encoderContext, encoderMask);
   for(auto& layerState : state->getStates()) {
+    Ptr<nn::DecoderStateItem> item;
     if(alibiState) {
-      nnState->append(New<nn::AlibiDecoderStateItem>(layerState.cell, shift, position));
+      item = New<nn::AlibiDecoderStateItem>(layerState.output, shift, position);
     } else {
-      nnState->append(New<nn::DecoderStateItem>(layerState.cell, position));
+      item = New<nn::DecoderStateItem>(layerState.output, position);
     }
+    // layers that keep two states (e.g. projected keys and values) store the second one in .cell
+    if(layerState.cell != layerState.output)
+      item->setAux(layerState.cell);
+    nnState->append(item);
   }
   return nnState;
 }
@@ -357,5 +362,73 @@ Expr alibiLogMask(Expr mask, Expr query, Expr slopes, Expr biases, Expr shift, i
   return Expression<AlibiLogMaskNode>(nodes, numHeads, start, addCausalMask);
 }
 
+// ALiBi log mask for attention layers that use tiledAttention(), see DeferredLogMask. The node has the inputs and
+// shape of alibiLogMask(), but neither allocates nor computes a value, the bias of every score is evaluated inside
+// of the attention kernel instead.
+class DeferredAlibiLogMaskNode : public AlibiLogMaskNode, public DeferredLogMask {
+private:
+  int numHeads_{8};
+  int start_{0};
+  bool addCausalMask_{false};
+
+public:
+  DeferredAlibiLogMaskNode(const std::vector<Expr>& nodes, int numHeads, int start, bool addCausalMask)
+  : AlibiLogMaskNode(nodes, numHeads, start, addCausalMask),
+    numHeads_(numHeads), start_{start}, addCausalMask_{addCausalMask}
+  {}
+
+  void allocate() override {}
+  void forward() override {}
+  void backward() override {}
+
+  Expr attention(Expr query, Expr keys, Expr values, float scale) override {
+    if(query->value_type() != Type::float32) // no fused kernel for this type, same result via the full mask
+      return tiledAttention(query, keys, values, materialize(), scale);
+
+    int numHeads = numHeads_, start = start_;
+    bool addCausalMask = addCausalMask_;
+    auto fwd = [numHeads, start, addCausalMask, scale](Expr out, const std::vector<Expr>& children) {
+      AttentionBias bias;
+      bias.alibiMask   = children[3]->val();
+      bias.alibiSlopes = children[4]->val();
+      bias.alibiBiases = children[5]->val();
+      bias.alibiShift  = children.size() > 6 ? children[6]->val() : nullptr;
+      bias.numHeads    = numHeads;
+      bias.start       = start;
+      bias.causal      = addCausalMask;
+      TiledAttention(out->val(), children[0]->val(), children[1]->val(), children[2]->val(), bias, scale);
+    };
+
+    Shape outShape = query->shape();
+    outShape.set(-1, values->shape()[-1]);
+
+    // mask, slopes, biases and the optional shift, but not the query the mask was created for
+    std::vector<Expr> nodes = {query, keys, values, child(0), child(2), child(3)};
+    if(children().size() == 5)
+      nodes.push_back(child(4));
+    return lambda(nodes, outShape, query->value_type(), fwd,
+                  util::hashArgs(std::string("alibiTiledAttention"), numHeads, start, addCausalMask, scale));
+  }
+
+  Expr materialize() override {
+    return alibiLogMask(child(0), child(1), child(2), child(3), children().size() == 5 ? child(4) : nullptr,
+                        numHeads_, start_, addCausalMask_);
+  }
+
+  virtual bool equal(Expr node) override {
+    return type() == node->type() && AlibiLogMaskNode::equal(node);
+  }
+
+  const std::string type() override { return "alibi-log-mask-deferred"; }
+};
+
+Expr deferredAlibiLogMask(Expr mask, Expr query, Expr slopes, Expr biases, Expr shift, int numHeads, int start, bool addCausalMask) {
+  std::vector<Expr> nodes = {mask, query, slopes, biases};
+  if(shift)
+    nodes.push_back(shift);
+
+  return Expression<DeferredAlibiLogMaskNode>(nodes, numHeads, start, addCausalMask);
+}
+
 
 } // namespace marian
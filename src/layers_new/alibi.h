@@ -79,6 +79,9 @@ Ptr<nn::DecoderState> convertDecoderState(Ptr<DecoderState> state,
 // efficient operator for ALIBI log mask with shift and optionally learnable parameters
 Expr alibiLogMask(Expr mask, Expr query, Expr shift, Expr slopes, Expr biases, int numHeads, int start, bool addCausalMask = false);
 
+// the same mask as a DeferredLogMask for tiledAttention(), it is never materialized unless the weights are needed
+Expr deferredAlibiLogMask(Expr mask, Expr query, Expr slopes, Expr biases, Expr shift, int numHeads, int start, bool addCausalMask = false);
+
 namespace nn {
 
 class AlibiDecoderStateItem : public DecoderStateItem {
@@ -109,8 +112,10 @@ public:
   AlibiAttentionMaskProcessor(Ptr<ExpressionGraph> graph,
                               Ptr<Options> options)
     : AttentionMaskProcessor(graph, options),
-      trainable(options->get<bool>("transformer-alibi-trainable", false))
-    {}
+      trainable(options->get<bool>("transformer-alibi-trainable", false)) {
+    // the slopes depend on the index of the head among all heads
+    ABORT_IF(graph->getTensorParallel(), "ALiBi does not support tensor parallelism");
+  }
 
   virtual ~AlibiAttentionMaskProcessor() = default;
 
@@ -167,6 +172,12 @@ public:
 
       Expr shift = nullptr;
       int start = 0;
+
+      // long inputs evaluate the bias inside of the attention kernel, see MultiplicativeAttention::tiledAttentionMinKeys
+      int tiledMinKeys = opt<int>("transformer-tiled-attention", 0);
+      if(tiledMinKeys > 0 && graph()->isInference() && mask->shape()[-2] >= tiledMinKeys)
+        return deferredAlibiLogMask(mask, query, slopes, biases, shift, numHeads, start);
+
       auto alibiMask = alibiLogMask(mask, query, slopes, biases, shift, numHeads, start);
       return alibiMask;
     };
@@ -193,7 +204,9 @@ public:
                                      Ptr<Options> options,
                                      bool addCausalMask = false)
     : DecoderAttentionMaskProcessor(graph, options, addCausalMask),
-      trainable(options->get<bool>("transformer-alibi-trainable", false)) {}
+      trainable(options->get<bool>("transformer-alibi-trainable", false)) {
+    ABORT_IF(graph->getTensorParallel(), "ALiBi does not support tensor parallelism");
+  }
 
   virtual ~AlibiDecoderAttentionMaskProcessor() = default;
 
@@ -246,6 +259,9 @@ public:
       }
 
       // @TODO: make sure that we never want to have a causal mask here if start > 0 (this should indicate decoding)
+      int tiledMinKeys = opt<int>("transformer-tiled-attention", 0);
+      if(tiledMinKeys > 0 && graph()->isInference() && mask->shape()[-2] >= tiledMinKeys)
+        return deferredAlibiLogMask(mask, query, slopes, biases, shift, numHeads, start, addCausalMask && start == 0);
       return alibiLogMask(mask, query, slopes, biases, shift, numHeads, start, addCausalMask && start == 0);
     };
 
@@ -17,7 +17,11 @@ Ptr<AttentionLayer> attentionFromOptions(Ptr<ExpressionGraph> graph, Ptr<Options
 
     float attentionDropoutProbability = options->get<float>("transformer-dropout-attention", 0.f);
 
-    return New<MultiHeadAttention>(graph, numHeads, modelDim, modelDim, attentionDropoutProbability, enableCache);
+    int numKvHeads = options->get<int>("transformer-heads-kv", 0);
+
+    auto attention = New<MultiHeadAttention>(graph, numHeads, modelDim, modelDim, attentionDropoutProbability, enableCache, numKvHeads);
+    attention->tiledAttentionMinKeys = options->get<int>("transformer-tiled-attention", 0);
+    return attention;
   }
   else {
     ABORT("Unknown transformer encoder attention type: {}", selfAttentionType);
@@ -11,6 +11,22 @@ namespace marian {
  */
 Expr logMask(Expr mask, int numHeads, bool addCausalMask);
 
+/**
+ * Log mask that is never materialized, but evaluated inside of the attention kernel, e.g. the ALiBi bias of
+ * layers_new/alibi.h for long inputs. Mask processors return it as an expression node without memory of its
+ * own, which attention layers must not use as a regular input.
+ */
+class DeferredLogMask {
+public:
+  virtual ~DeferredLogMask() = default;
+
+  // tiledAttention() with this mask
+  virtual Expr attention(Expr query, Expr keys, Expr values, float scale) = 0;
+
+  // the same mask as a regular expression, e.g. if the attention weights are needed
+  virtual Expr materialize() = 0;
+};
+
 namespace nn {
 
 /**
@@ -86,6 +102,9 @@ protected:
 public:
   Ptr<Dropout> attentionDropout;
 
+  // use tiledAttention() during inference if there are at least this many keys, 0 disables it
+  int tiledAttentionMinKeys{0};
+
   MultiplicativeAttention(Ptr<ExpressionGraph> graph, float dropoutProbability, bool saveAttentionWeights = false)
    : AttentionLayer(graph), AttentionCollector(saveAttentionWeights) {
     attentionDropout = New<Dropout>(graph, dropoutProbability);
@@ -103,15 +122,21 @@ public:
     // multiplicative attention with flattened softmax
     float scale = 1.0f / std::sqrt((float)dimKeys); // scaling to avoid extreme values due to matrix multiplication
 
+    // long inputs never materialize the attention matrix, unless the weights are collected
+    auto deferredMask = logMask ? dynamic_cast<DeferredLogMask*>(logMask.get()) : nullptr;
+    if(deferredMask && saveAttentionWeights)
+      logMask = deferredMask->materialize();
+    else if(deferredMask)
+      return deferredMask->attention(query, keys, values, scale);
+    else if(!saveAttentionWeights && tiledAttentionMinKeys > 0 && graph()->isInference()
+            && keys->shape()[-2] >= tiledAttentionMinKeys)
+      return tiledAttention(query, keys, values, logMask, scale);
+
     // query, keys and values: [dimBeam, dimBatch * numHeads, (dimQuery|dimKeys=dimValues), dimHead]
     auto z = bdot(query, keys, false, true, scale); // [dimBeam, dimBatch * numHeads, dimQuery, dimKeys]
 
-    // mask out garbage beyond end of sequences
-    if(logMask)
-      z = z + logMask;
-
-    // take softmax along src sequence axis (-1)
-    auto weights = softmax(z); // [dimBeam, dimBatch * numHeads, dimQuery, dimKeys]
+    // mask out garbage beyond end of sequences and take softmax along src sequence axis (-1)
+    auto weights = logMask ? maskedSoftmax(z, logMask) : softmax(z); // [dimBeam, dimBatch * numHeads, dimQuery, dimKeys]
 
     if(saveAttentionWeights) {
       collectOneHead(weights);
@@ -137,6 +162,11 @@ public:
  * Extended multiplicative attention layer with multiple heads
  * and separate query, key and value projections, as well as
  * an output projection.
+ *
+ * With numKvHeads < numHeads, this is grouped-query attention (multi-query attention for numKvHeads = 1): keys and
+ * values are projected into numKvHeads heads only, and each of them is shared by numHeads / numKvHeads consecutive
+ * query heads. The projections, and with them the keys and values that decoders keep for earlier positions, are
+ * numHeads / numKvHeads times smaller.
  */
 class MultiHeadAttention : public MultiplicativeAttention {
 protected:
@@ -155,6 +185,7 @@ public:
   Ptr<Linear> oProj; // output projection layer
 
   int numHeads;
+  int numKvHeads; // heads of the keys and values
   int attDim;
   int modelDim;
 
@@ -163,27 +194,49 @@ public:
                      int attDim,
                      int modelDim,
                      float dropoutProbability,
-                     bool enableCache = false)
+                     bool enableCache = false,
+                     int numKvHeads = 0) // 0 for numHeads
     : MultiplicativeAttention(graph, dropoutProbability),
       enableCache_(enableCache),
       cachedKh_(new CachedExpr()),
       cachedVh_(new CachedExpr()),
       numHeads(numHeads),
+      numKvHeads(numKvHeads > 0 ? numKvHeads : numHeads),
       attDim(attDim),
       modelDim(modelDim) {
-    qProj = New<Linear>(graph, attDim);
+    ABORT_IF(numHeads % this->numKvHeads != 0,
+             "The number of heads ({}) must be a multiple of the number of key and value heads ({})",
+             numHeads, this->numKvHeads);
+
+    // each rank of a tensor-parallel graph computes its part of the heads, see TensorParallel
+    auto tensorParallel = graph->getTensorParallel();
+    if(tensorParallel) {
+      this->numHeads   = tensorParallel->part(numHeads, "number of attention heads");
+      this->numKvHeads = tensorParallel->part(this->numKvHeads, "number of key and value heads");
+      this->attDim     = tensorParallel->part(attDim, "attention dimension");
+    }
+
+    qProj = New<Linear>(graph, this->attDim);
     registerLayer(qProj);
-    kProj = New<Linear>(graph, attDim);
+    kProj = New<Linear>(graph, kvDim());
     registerLayer(kProj);
-    vProj = New<Linear>(graph, attDim);
+    vProj = New<Linear>(graph, kvDim());
     registerLayer(vProj);
 
     oProj = New<Linear>(graph, modelDim);
     registerLayer(oProj);
+
+    if(tensorParallel) {
+      qProj->split = kProj->split = vProj->split = Linear::Split::columns;
+      oProj->split = Linear::Split::rows;
+    }
   }
 
   virtual ~MultiHeadAttention() = default;
 
+  // dimension of the projected keys and values
+  int kvDim() const { return attDim / numHeads * numKvHeads; }
+
 protected:
   // join beam and batch dimension and split model dimension in to heads and head dimension. We also need to transpose to
   // be able to do an efficient batched matmul.
@@ -217,31 +270,33 @@ protected:
 public:
   // Apply the multi-head attention to the given query, keys and values
   virtual Expr apply(Expr query, Expr keys, Expr values, Expr mask) const override {
-    // @TODO: implement custom bdot to avoid splitHeads/joinHeads
-    // @TODO: explore FlashAttention-like cpu implementation
-    auto qh = splitHeads(qProj->apply(query));
+    auto q = qProj->apply(query);
 
     // if enabledCache_ is true, we cache the results of the key and value projections
     // otherwise equal is always false and the key and value projections are recomputed
-    Expr kh, vh;
+    Expr k, v;
     if(enableCache_) {
       // @TODO: in original implementation we use shape()->elements(), dunno why
       auto equal = [](Expr a, Expr b) { return a->shape() == b->shape(); };
       // these two get conditionally recomputed if their size changes according to criterion above
-      kh = cachedKh_->apply(keys,   [this](Expr keys)   { return splitHeads(kProj->apply(keys)); }, equal);
-      vh = cachedVh_->apply(values, [this](Expr values) { return splitHeads(vProj->apply(values)); }, equal);
+      k = cachedKh_->apply(keys,   [this](Expr keys)   { return kProj->apply(keys); }, equal);
+      v = cachedVh_->apply(values, [this](Expr values) { return vProj->apply(values); }, equal);
     } else {
-      kh = splitHeads(kProj->apply(keys));
-      vh = splitHeads(vProj->apply(values));
+      k = kProj->apply(keys);
+      v = vProj->apply(values);
     }
 
-    auto output  = MultiplicativeAttention::apply(qh, kh, vh, mask);
+    return attend(q, k, v, mask);
+  }
 
-    // @TODO: combine joinHeads and apply in one matrix multiplication via striding
-    output = joinHeads(output);
-    output = oProj->apply(output);
+  // Key and value projections on their own, so that callers can keep the projections of earlier positions
+  // around, e.g. decoder self-attention during step-wise decoding. Results are [dimBeam, dimBatch, dimSteps, kvDim()].
+  Expr projectKeys(Expr keys)     const { return kProj->apply(keys); }
+  Expr projectValues(Expr values) const { return vProj->apply(values); }
 
-    return output;
+  // Same as apply(), but with keys and values that already went through projectKeys() and projectValues()
+  Expr applyProjected(Expr query, Expr keysProjected, Expr valuesProjected, Expr mask) const {
+    return attend(qProj->apply(query), keysProjected, valuesProjected, mask);
   }
 
   virtual void clear() override {
@@ -249,6 +304,64 @@ public:
     cachedKh_->clear();
     cachedVh_->clear();
   }
+
+private:
+  // Repeats each of the numKvHeads heads of projected keys or values for the query heads that share it, from
+  // [dimBeam, dimBatch, dimSteps, kvDim()] to [dimBeam, dimBatch, dimSteps, attDim]
+  Expr expandKvHeads(Expr input) const {
+    if(numKvHeads == numHeads)
+      return input;
+    int dimSteps = input->shape()[-2];
+    int dimBatch = input->shape()[-3];
+    int dimBeam  = input->shape()[-4];
+    int dimDepth = attDim / numHeads;
+
+    auto output = reshape(input, {dimBeam * dimBatch * dimSteps, numKvHeads, 1, dimDepth});
+    output      = repeat(output, numHeads / numKvHeads, /*axis=*/-2); // [.., numKvHeads, group size, dimDepth]
+    return reshape(output, {dimBeam, dimBatch, dimSteps, attDim});
+  }
+
+  // projected queries are [dimBeam, dimBatch, dimSteps, attDim], keys and values [dimBeam, dimBatch, dimSteps, kvDim()]
+  Expr attend(Expr q, Expr k, Expr v, Expr mask) const {
+    k = expandKvHeads(k);
+    v = expandKvHeads(v);
+
+    // in inference the heads stay side by side and the batched GEMMs read and write them in place, unless the
+    // attention is tiled, see MultiplicativeAttention::apply()
+    bool deferredMask = mask && dynamic_cast<DeferredLogMask*>(mask.get());
+    bool tiled = tiledAttentionMinKeys > 0 && k->shape()[-2] >= tiledAttentionMinKeys;
+
+    Expr output;
+    if(graph()->isInference() && !deferredMask && !tiled) {
+      output = attendJoinedHeads(q, k, v, mask);
+    } else {
+      output = MultiplicativeAttention::apply(splitHeads(q), splitHeads(k), splitHeads(v), mask);
+      output = joinHeads(output);
+    }
+    output = oProj->apply(output);
+
+    return output;
+  }
+
+  // the same as MultiplicativeAttention::apply() on split heads followed by joinHeads()
+  Expr attendJoinedHeads(Expr q, Expr k, Expr v, Expr logMask) const {
+    int dimBeam  = q->shape()[-4];
+    int dimBatch = q->shape()[-3];
+    int dimQuery = q->shape()[-2];
+    int dimKeys  = k->shape()[-2];
+
+    float scale = 1.0f / std::sqrt((float)(attDim / numHeads));
+    auto z = bdotSplitHeads(q, k, numHeads, scale);                          // [dimBeam * dimBatch, numHeads, dimQuery, dimKeys]
+    z = reshape(z, {dimBeam, dimBatch * numHeads, dimQuery, dimKeys});
+
+    auto weights = logMask ? maskedSoftmax(z, logMask) : softmax(z);          // [dimBeam, dimBatch * numHeads, dimQuery, dimKeys]
+    if(saveAttentionWeights)
+      collectOneHead(weights);
+    weights = attentionDropout->apply(weights);
+
+    auto output = bdotJoinHeads(weights, v, numHeads);                        // [dimBeam * dimBatch, dimQuery, attDim]
+    return reshape(output, {dimBeam, dimBatch, dimQuery, attDim});
+  }
 };
 
 /**
@@ -292,17 +405,23 @@ struct DecoderMaskProcessor : public LayerWithOptions, public IBinaryDecoderLaye
   }
 };
 
+// the attention heads that one rank of a tensor-parallel graph computes, all heads otherwise
+static inline int headsOfRank(Ptr<ExpressionGraph> graph, int numHeads) {
+  auto tensorParallel = graph->getTensorParallel();
+  return tensorParallel ? tensorParallel->part(numHeads, "number of attention heads") : numHeads;
+}
+
 /**
  * Attention mask processors are used to process a given attention mask
  * before it is used in an attention computation.
  */
 struct AttentionMaskProcessor : public MaskProcessor {
-  int numHeads{1};
+  int numHeads{1}; // of this rank of a tensor-parallel graph
 
   AttentionMaskProcessor(Ptr<ExpressionGraph> graph,
                          Ptr<Options> options)
     : MaskProcessor(graph, options),
-      numHeads(opt<int>("transformer-heads", 1)) {}
+      numHeads(headsOfRank(graph, opt<int>("transformer-heads", 1))) {}
 
   virtual ~AttentionMaskProcessor() = default;
 
@@ -329,13 +448,13 @@ struct AttentionMaskProcessor : public MaskProcessor {
  * Decoder attention mask processors can take advantage of information from the decoder state.
  */
 struct DecoderAttentionMaskProcessor : public DecoderMaskProcessor {
-  int numHeads{1};
+  int numHeads{1}; // of this rank of a tensor-parallel graph
 
   DecoderAttentionMaskProcessor(Ptr<ExpressionGraph> graph,
                                 Ptr<Options> options,
                                 bool addCausalMask = false)
     : DecoderMaskProcessor(graph, options, addCausalMask),
-      numHeads(opt<int>("transformer-heads", 1)) {}
+      numHeads(headsOfRank(graph, opt<int>("transformer-heads", 1))) {}
 
   virtual ~DecoderAttentionMaskProcessor() = default;
 
@@ -62,6 +62,7 @@ public:
 class DecoderStateItem : public DecoderState {
 private:
   Expr state_; // state of the decoder at a given position, can be nullptr
+  Expr aux_;   // optional second state, e.g. projected values next to projected keys, can be nullptr
 
 public:
   DecoderStateItem(Expr state, size_t position) : DecoderState(position), state_(state) {}
@@ -70,6 +71,9 @@ public:
 
   Expr get() { return state_; }
   void set(Expr state) { state_ = state; }
+
+  Expr getAux() { return aux_; }
+  void setAux(Expr aux) { aux_ = aux; }
 };
 
 class DecoderStateList : public DecoderState {
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "layers/loss.h"
+#include "layers_new/neuralnet.h"
+
+#include <cmath>
+
+namespace marian {
+namespace nn {
+
+/**
+ * Sparse mixture-of-experts feed-forward layer. A linear gate with softmax picks the topK best of numExperts
+ * two-layer FFNs for every token, whose outputs are combined with the renormalized gate probabilities. Each expert
+ * processes at most ceil(capacityFactor * topK * tokens / numExperts) tokens per batch, further tokens are dropped
+ * for that expert, first choices taking precedence over second ones. All experts run as one batched GEMM over
+ * their [capacity, dimModel] inputs, so the FLOPs per token are those of topK FFNs times the capacity factor.
+ *
+ * During training the load balancing loss of the Switch Transformer, numExperts * sum_e f_e * P_e with the
+ * fraction f_e of tokens whose first choice is e and their mean probability P_e, weighted by balanceWeight,
+ * is added as an auxiliary loss.
+ */
+struct MixtureOfExperts final : public Layer, public IUnaryLayer {
+  Expr gate;
+  Expr weight1;
+  Expr bias1;
+  Expr weight2;
+  Expr bias2;
+
+  int numExperts;
+  int topK;
+  int dimFfn;
+  float capacityFactor;
+  float balanceWeight;
+  bool sumLoss; // if the auxiliary loss is combined with the others as "sum", see --multi-loss-type
+
+  Ptr<Activation> activation;
+  Ptr<Dropout> dropout;
+
+  MixtureOfExperts(Ptr<ExpressionGraph> graph,
+                   int numExperts,
+                   int topK,
+                   int dimFfn,
+                   const std::string& actName,
+                   float dropoutProbability,
+                   float capacityFactor,
+                   float balanceWeight,
+                   bool sumLoss = true)
+    : Layer(graph),
+      numExperts(numExperts),
+      topK(topK),
+      dimFfn(dimFfn),
+      capacityFactor(capacityFactor),
+      balanceWeight(balanceWeight),
+      sumLoss(sumLoss) {
+    ABORT_IF(numExperts < 1, "A mixture of experts needs at least one expert");
+    ABORT_IF(topK < 1 || topK > numExperts, "Cannot route to {} of {} experts", topK, numExperts);
+    ABORT_IF(capacityFactor <= 0.f, "The capacity factor of the experts must be positive");
+
+    activation = activationLayerByName(graph, actName);
+    registerLayer(activation);
+    dropout = New<Dropout>(graph, dropoutProbability);
+    registerLayer(dropout);
+  }
+
+  // number of tokens each expert processes for a batch of numTokens tokens
+  int capacity(int numTokens) const {
+    return std::max(1, (int)std::ceil(capacityFactor * topK * numTokens / numExperts));
+  }
+
+  Expr apply(Expr input) const override {
+    int dimModel  = input->shape()[-1];
+    int numTokens = input->shape().elements() / dimModel;
+    int numChoices = topK * numTokens;
+    int cap = capacity(numTokens);
+    Type type = input->value_type();
+
+    registerParameterLazy(gate,    Shape({ dimModel, numExperts }),            inits::glorotUniform());
+    registerParameterLazy(weight1, Shape({ numExperts, dimModel, dimFfn }),    inits::glorotUniform());
+    registerParameterLazy(bias1,   Shape({ numExperts, 1, dimFfn }),           inits::zeros());
+    registerParameterLazy(weight2, Shape({ numExperts, dimFfn, dimModel }),    inits::glorotUniform());
+    registerParameterLazy(bias2,   Shape({ numExperts, 1, dimModel }),         inits::zeros());
+
+    auto x     = reshape(input, {numTokens, dimModel});
+    auto probs = softmax(dot(x, gate));                                         // [numTokens, numExperts]
+
+    // the routing is not differentiable, only the gate probabilities of the chosen experts are
+    auto chosen = topkIndices(stopGradient(probs), topK, /*axis=*/-1);          // [numTokens, topK]
+    auto gates  = gather(probs, -1, chosen);
+    if(topK > 1)
+      gates = gates / sum(gates, /*axis=*/-1);
+
+    // choices ordered by rank, then by token, so that first choices fill the experts first
+    auto expertOfChoice = reshape(transpose(marian::cast(chosen, type)), {numChoices, 1});
+    auto gateOfChoice   = reshape(transpose(gates), {numChoices, 1});
+
+    // position of each choice among those of its expert, it is dropped beyond the capacity
+    auto experts  = graph()->constant({1, numExperts}, inits::range(0.f, (float)numExperts), type);
+    auto oneHot   = eq(expertOfChoice, experts);                                // [numChoices, numExperts]
+    auto position = sum(cumsum(oneHot, /*axis=*/0, /*reverse=*/false, /*exclusive=*/true) * oneHot, /*axis=*/-1);
+    auto keep     = lt(position, (float)cap);
+
+    // slots [expert * capacity + position], dropped choices go to the extra slot numExperts * capacity
+    int numSlots = numExperts * cap;
+    auto slot = keep * (expertOfChoice * (float)cap + position) + (1.f - keep) * (float)numSlots;
+    auto slotOfChoice = marian::cast(reshape(slot, {numChoices}), Type::uint32);
+
+    // dispatch: the token of each slot, empty slots read the zero row numTokens
+    std::vector<float> tokenIds(numChoices);
+    for(int i = 0; i < numChoices; ++i)
+      tokenIds[i] = (float)(i % numTokens);
+    auto tokens = graph()->constant({numChoices}, inits::fromVector(tokenIds), type);
+    auto tokenOfSlot = scatter(graph()->constant({numSlots + 1}, inits::fromValue((float)numTokens), type),
+                               /*axis=*/0, slotOfChoice, tokens);
+    tokenOfSlot = marian::cast(slice(tokenOfSlot, /*axis=*/0, Slice(0, numSlots)), Type::uint32);
+
+    auto padded = concatenate({x, graph()->zeros({1, dimModel}, type)}, /*axis=*/0);
+    auto dispatched = reshape(index_select(padded, /*axis=*/0, tokenOfSlot), {numExperts, cap, dimModel});
+
+    // all experts at once
+    auto hidden = dropout->apply(activation->apply(bdot(dispatched, weight1) + bias1));
+    auto output = reshape(bdot(hidden, weight2) + bias2, {numSlots, dimModel});
+
+    // combine: dropped choices read the zero row numSlots
+    output = concatenate({output, graph()->zeros({1, dimModel}, type)}, /*axis=*/0);
+    auto combined = index_select(output, /*axis=*/0, slotOfChoice) * gateOfChoice;
+    combined = sum(reshape(combined, {topK, numTokens, dimModel}), /*axis=*/0);
+
+    if(getMode() == Mode::train && balanceWeight > 0.f) {
+      auto firstChoices = slice(oneHot, /*axis=*/0, Slice(0, numTokens));      // [numTokens, numExperts]
+      auto fraction     = mean(firstChoices, /*axis=*/0);
+      auto probability  = mean(probs, /*axis=*/0);
+      auto balanceLoss  = (float)numExperts * sum(marian::cast(fraction * probability, Type::float32), /*axis=*/-1);
+      // scaled by the number of tokens like the label-wise losses, also weighted in the labels if summed up
+      float labels = sumLoss ? balanceWeight * numTokens : (float)numTokens;
+      addAuxiliaryLoss(RationalLoss(balanceWeight * numTokens * balanceLoss, labels));
+    }
+
+    return reshape(combined, input->shape());
+  }
+};
+
+}  // namespace nn
+}  // namespace marian
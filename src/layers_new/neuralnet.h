@@ -3,6 +3,8 @@
 #include "layers_new/interface.h"
 #include "graph/node_initializers.h"
 
+#include <algorithm>
+
 namespace marian {
 namespace nn {
 
@@ -69,15 +71,38 @@ struct Swish final : public Activation {
 Ptr<Activation> activationLayerByName(Ptr<ExpressionGraph> graph, const std::string& actName);
 
 // Applies a linear transformation to the incoming data: y = xA^T + b
+// The low-rank adapters that the entries of a batch use, see selectAdapters()
+struct AdapterSelection {
+  std::vector<IndexType> columns; // the columns of Linear::loraA and rows of Linear::loraB of the adapters in the batch
+  Expr mask;                      // [batch, 1, columns] 1 for the columns of the adapter of each entry, nullptr if all
+                                  // entries use the same one
+};
+
 struct Linear : public Layer, public IUnaryLayer {
   Expr weight;
   Expr bias;
 
+  // Low-rank adapters (LoRA), see --lora-rank: loraAdapters adapters of rank loraRank side by side in the columns of
+  // loraA [dimIn, loraAdapters * loraRank] and the rows of loraB [loraAdapters * loraRank, dimOut], which add
+  // loraScale * x loraA loraB to the output. loraB starts out at zero, so a new adapter does not change the layer.
+  Expr loraA;
+  Expr loraB;
+  int loraRank{0};
+  int loraAdapters{1};
+  float loraScale{1.f};
+  Ptr<AdapterSelection> adapterSelection; // nullptr for the sum of all adapters, e.g. of the one that is trained
+
   int dimOut;
   bool useBias{true};
   bool transposed{false};
   Ptr<inits::NodeInitializer> init;
 
+  // How the weight is split between the ranks of a tensor-parallel graph, see TensorParallel: each rank computes
+  // dimOut of the output units (columns), or reads the part of the input units it has and sums its partial output
+  // with those of the other ranks (rows).
+  enum class Split { none, columns, rows };
+  Split split{Split::none};
+
   // Typical constructor that can take an initializer function
   Linear(Ptr<ExpressionGraph> graph,
          int dimOut,
@@ -113,13 +138,127 @@ struct Linear : public Layer, public IUnaryLayer {
       registerParameterLazy(bias, Shape({ dimOut }), inits::zeros());
     }
 
+    if(split == Split::columns) {
+      x = splitColumns(x);
+    } else if(split == Split::rows) {
+      // the bias is added once to the sum of the ranks
+      graph()->getTensorParallel()->split(weight->name(), transposed ? -1 : 0);
+      auto y = all_reduce(marian::dot(x, weight, /*transA=*/false, /*transB=*/transposed));
+      return applyAdapters(x, useBias ? y + bias : y);
+    }
+
+    Expr y;
     if(useBias)
-      return marian::affine(x, weight, bias, /*transA=*/false, /*transB=*/transposed);
+      y = marian::affine(x, weight, bias, /*transA=*/false, /*transB=*/transposed);
     else
-      return marian::dot(x, weight, /*transA=*/false, /*transB=*/transposed);
+      y = marian::dot(x, weight, /*transA=*/false, /*transB=*/transposed);
+    return applyAdapters(x, y);
+  }
+
+protected:
+  // whether applyAdapters() adds anything to the output for the current selection
+  bool hasActiveAdapters() const {
+    return loraRank > 0 && !(adapterSelection && adapterSelection->columns.empty());
+  }
+
+  // Adds the low-rank adapters of the input x to the output y of the layer. All adapters that the batch uses go
+  // through the same two GEMMs, with the columns of the adapters of the other batch entries masked out in between.
+  Expr applyAdapters(Expr x, Expr y) const {
+    if(loraRank <= 0)
+      return y;
+
+    int dimIn = x->shape()[-1];
+    registerParameterLazy(loraA, Shape({ dimIn, loraAdapters * loraRank }), inits::glorotUniform());
+    registerParameterLazy(loraB, Shape({ loraAdapters * loraRank, dimOut }), inits::zeros());
+    ABORT_IF(split != Split::none, "Low-rank adapters cannot be split between tensor-parallel ranks");
+
+    if(!hasActiveAdapters())
+      return y;
+
+    auto down = loraA;
+    auto up = loraB;
+    if(adapterSelection && adapterSelection->columns.size() < (size_t)loraA->shape()[-1]) {
+      down = index_select(loraA, -1, adapterSelection->columns);
+      up = index_select(loraB, 0, adapterSelection->columns);
+    }
+
+    auto hidden = marian::dot(x, down);
+    if(adapterSelection && adapterSelection->mask)
+      hidden = hidden * adapterSelection->mask;
+    return y + marian::dot(hidden, up, /*transA=*/false, /*transB=*/false, loraScale);
+  }
+
+  // Records the split of the parameters for Split::columns and sums the gradients of the input x of all ranks
+  Expr splitColumns(Expr x) const {
+    auto tensorParallel = graph()->getTensorParallel();
+    tensorParallel->split(weight->name(), transposed ? 0 : -1);
+    if(useBias)
+      tensorParallel->split(bias->name(), 0);
+    return all_reduce_grad(x);
   }
 };
 
+// layer itself if it is a Linear layer and all Linear layers below it
+static inline std::vector<Ptr<Linear>> linearLayers(Ptr<Layer> layer) {
+  auto linears = layer->allLayers<Linear>();
+  if(auto linear = layer->as<Linear>())
+    linears.push_back(linear);
+  return linears;
+}
+
+// Adds the given number of low-rank adapters of rank and scale alpha / rank to all Linear layers of layer
+static inline void addAdapters(Ptr<Layer> layer, int rank, float alpha, int adapters = 1) {
+  for(auto linear : linearLayers(layer)) {
+    linear->loraRank = rank;
+    linear->loraAdapters = adapters;
+    linear->loraScale = alpha / rank;
+  }
+}
+
+// Selects the low-rank adapter of every batch entry, -1 for none, in all Linear layers of layer, see
+// Linear::applyAdapters(). An empty list undoes the selection, so the layers apply all of their adapters.
+static inline void selectAdapters(Ptr<Layer> layer, const std::vector<int>& adapters) {
+  auto linears = linearLayers(layer);
+  int rank = 0;
+  for(auto linear : linears)
+    rank = std::max(rank, linear->loraRank);
+  if(rank == 0)
+    return;
+
+  Ptr<AdapterSelection> selection;
+  if(!adapters.empty()) {
+    std::vector<int> used;
+    for(int adapter : adapters)
+      if(adapter >= 0)
+        used.push_back(adapter);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    selection = New<AdapterSelection>();
+    for(int adapter : used)
+      for(int i = 0; i < rank; ++i)
+        selection->columns.push_back((IndexType)(adapter * rank + i));
+
+    // with one adapter for the whole batch its columns are all there is
+    bool mixed = used.size() > 1 || (used.size() == 1 && std::count(adapters.begin(), adapters.end(), -1) > 0);
+    if(mixed) {
+      int dimBatch = (int)adapters.size();
+      int dimColumns = (int)selection->columns.size();
+      std::vector<float> mask(dimBatch * dimColumns, 0.f);
+      for(int b = 0; b < dimBatch; ++b) {
+        if(adapters[b] < 0)
+          continue;
+        int pos = (int)(std::lower_bound(used.begin(), used.end(), adapters[b]) - used.begin());
+        std::fill_n(mask.begin() + b * dimColumns + pos * rank, rank, 1.f);
+      }
+      selection->mask = layer->graph()->constant({dimBatch, 1, dimColumns}, inits::fromVector(mask));
+    }
+  }
+
+  for(auto linear : linears)
+    linear->adapterSelection = selection;
+}
+
 struct Dropout final : public Layer, public IUnaryLayer {
   float dropoutProbability;
   Shape::Axes dropoutAxes{{-2, -1}};
@@ -146,12 +285,21 @@ struct Dropout final : public Layer, public IUnaryLayer {
     }
   }
 
+  // The mask that apply() would multiply with, nullptr if it does nothing. For callers that fuse the dropout
+  // into another operation, see TransformerPrePostProcessor.
+  Expr getMask(Expr input) const {
+    if(getMode() == Mode::eval || dropoutProbability <= 0.f)
+      return nullptr;
+    return graph()->dropoutMask(dropoutProbability, input->shape().fromAxes(dropoutAxes));
+  }
+
   virtual void clear() override {}
 };
 
 struct LinearReluDropout final : public Linear {
   using Linear::weight;
   using Linear::bias;
+  using Linear::split;
 
   using Linear::dimOut;
   using Linear::useBias;
@@ -196,11 +344,21 @@ struct LinearReluDropout final : public Linear {
       registerParameterLazy(bias, Shape({ dimOut }), inits::zeros());
     }
 
+    // the relu of partial outputs is not that of their sum
+    ABORT_IF(split == Split::rows, "LinearReluDropout cannot be split by rows");
+    if(split == Split::columns)
+      x = splitColumns(x);
+
+    float dropProb = getMode() == Mode::eval ? 0.f : dropoutProbability;
+    if(useBias && !transposed && !hasActiveAdapters()) // bias, relu and dropout fused into the GEMM node
+      return marian::affineWithReluDropout(x, weight, bias, dropProb, dropoutAxes);
+
     Expr output;
     if(useBias)
       output = marian::affine(x, weight, bias, /*transA=*/false, /*transB=*/transposed);
     else
       output = marian::dot(x, weight, /*transA=*/false, /*transB=*/transposed);
+    output = applyAdapters(x, output);
 
     if(getMode() == Mode::eval) {
       return marian::dropoutReluInplace(output); // no dropout
@@ -253,6 +411,9 @@ struct Norm : public Layer, public IUnaryLayer {
   }
 
   Expr apply(Expr x) const override = 0;
+
+  // Normalization of dropout(x, mask) + residual, fused where possible, see marian::addLayerNorm()
+  virtual Expr applyAdd(Expr x, Expr residual, Expr mask = nullptr) const = 0;
 };
 
 struct LayerNorm : public Norm {
@@ -269,6 +430,11 @@ struct LayerNorm : public Norm {
     return marian::layerNorm(x, getScale(dimModel), getBias(dimModel), eps);
   }
 
+  Expr applyAdd(Expr x, Expr residual, Expr mask = nullptr) const override {
+    int dimModel = x->shape()[-1];
+    return marian::addLayerNorm(x, residual, getScale(dimModel), getBias(dimModel), eps, mask);
+  }
+
   virtual void clear() override {}
 };
 
@@ -285,6 +451,11 @@ struct RMSNorm : public Norm {
     int dimModel = x->shape()[-1];
     return marian::rmsNorm(x, getScale(dimModel), getBias(dimModel), eps);
   }
+
+  Expr applyAdd(Expr x, Expr residual, Expr mask = nullptr) const override {
+    int dimModel = x->shape()[-1];
+    return marian::addRmsNorm(x, residual, getScale(dimModel), getBias(dimModel), eps, mask);
+  }
 };
 
 } // namespace nn
@@ -3,10 +3,12 @@
 #include "layers_new/attention.h"
 #include "layers_new/decoder.h"
 #include "layers_new/embeddings.h"
+#include "layers_new/moe.h"
 #include "layers_new/neuralnet.h"
 #include "layers_new/rnn.h"
 
 #include <cmath>
+#include <functional>
 
 namespace marian {
 namespace nn {
@@ -49,8 +51,17 @@ public:
 
   Expr apply(Expr input, Expr previous = nullptr) const override {
     Expr output = input;
-    for(char action : actionDesc) {
-      if(action == 'd')
+    for(size_t i = 0; i < actionDesc.size(); ++i) {
+      char action = actionDesc[i];
+      // skip connection and normalization ("an" or "ar"), possibly after dropout ("dan" or "dar"), are fused into
+      // one kernel where available
+      size_t skip = action == 'd' ? i + 1 : i;
+      if(previous && skip + 1 < actionDesc.size() && actionDesc[skip] == 'a'
+         && (actionDesc[skip + 1] == 'n' || actionDesc[skip + 1] == 'r')) {
+        output = norm->applyAdd(output, previous, skip > i ? dropout->getMask(output) : nullptr);
+        i = skip + 1;
+      }
+      else if(action == 'd')
         output = dropout->apply(output);
       else if(action == 'a' && previous)
         output = output + previous;
@@ -157,23 +168,22 @@ public:
     layers = New<Sequential>(graph);
     registerLayer(layers);
 
-    if(actName == "relu") {
-      layers->append(New<LinearReluDropout>(graph, ffnDim, ffnDropoutProbability));
+    int numExperts = opt<int>("transformer-moe-experts", 0);
+    if(numExperts > 0) {
+      ABORT_IF(graph->getTensorParallel(), "--transformer-moe-experts does not support tensor parallelism");
+      ABORT_IF(depth != 2, "--transformer-moe-experts needs a filter depth of 2, not {}", depth);
+      layers->append(New<MixtureOfExperts>(graph,
+                                           numExperts,
+                                           opt<int>("transformer-moe-top-k", 2),
+                                           ffnDim,
+                                           actName,
+                                           ffnDropoutProbability,
+                                           opt<float>("transformer-moe-capacity-factor", 1.25f),
+                                           opt<float>("transformer-moe-balance-weight", 0.01f),
+                                           opt<std::string>("multi-loss-type", "sum") == "sum"));
     } else {
-      layers->append(New<Linear>(graph, ffnDim));
-      layers->append(activationLayerByName(graph, actName));
-      layers->append(New<Dropout>(graph, ffnDropoutProbability));
-    }
-    for(int i = 1; i < depth-1; ++i) {
-      if(actName == "relu") {
-        layers->append(New<LinearReluDropout>(graph, ffnDim, ffnDropoutProbability));
-      } else {
-        layers->append(New<Linear>(graph, ffnDim));
-        layers->append(activationLayerByName(graph, actName));
-        layers->append(New<Dropout>(graph, ffnDropoutProbability));
-      }
+      appendDenseFilter(graph, ffnDim, modelDim, depth, actName, ffnDropoutProbability);
     }
-    layers->append(New<Linear>(graph, modelDim));
 
     postprocessor = New<TransformerPrePostProcessor>(
       graph,
@@ -188,6 +198,49 @@ public:
     output      = postprocessor->apply(output, input); // optional postprocessing, optional skip connection
     return output;
   }
+
+private:
+  void appendDenseFilter(Ptr<ExpressionGraph> graph,
+                         int ffnDim,
+                         int modelDim,
+                         int depth,
+                         const std::string& actName,
+                         float ffnDropoutProbability) {
+    // each rank of a tensor-parallel graph computes its part of the units of the first layer and the partial output
+    // of the last layer from it, see TensorParallel
+    auto tensorParallel = graph->getTensorParallel();
+    if(tensorParallel) {
+      ABORT_IF(depth != 2, "Tensor parallelism needs a filter depth of 2, not {}", depth);
+      ffnDim = tensorParallel->part(ffnDim, "filter dimension");
+    }
+
+    Ptr<Linear> first;
+    if(actName == "relu") {
+      first = New<LinearReluDropout>(graph, ffnDim, ffnDropoutProbability);
+      layers->append(first);
+    } else {
+      first = New<Linear>(graph, ffnDim);
+      layers->append(first);
+      layers->append(activationLayerByName(graph, actName));
+      layers->append(New<Dropout>(graph, ffnDropoutProbability));
+    }
+    for(int i = 1; i < depth-1; ++i) {
+      if(actName == "relu") {
+        layers->append(New<LinearReluDropout>(graph, ffnDim, ffnDropoutProbability));
+      } else {
+        layers->append(New<Linear>(graph, ffnDim));
+        layers->append(activationLayerByName(graph, actName));
+        layers->append(New<Dropout>(graph, ffnDropoutProbability));
+      }
+    }
+    auto last = New<Linear>(graph, modelDim);
+    layers->append(last);
+
+    if(tensorParallel) {
+      first->split = Linear::Split::columns;
+      last->split  = Linear::Split::rows;
+    }
+  }
 };
 
 /**
@@ -404,8 +457,8 @@ public:
 
 /**
  * Base class for transformer auto-regressive blocks. These are blocks that can be used in the decoder
- * and that take the previous step's output as input. Currently this is either a self-attention block
- * or an RNN block.
+ * and that take the previous step's output as input. Currently this is a self-attention block, an RNN
+ * block or an average attention block.
  */
 class TransformerDecoderAutoRegressiveBlock : public LayerWithOptions, public IBinaryDecoderLayer {
 public:
@@ -439,6 +492,12 @@ public:
 
   virtual ~TransformerDecoderAutoRegressiveBlock() = default;
 
+  // Extends the state by the newest position of input without computing the block's output, for the layers
+  // above an early exit of the decoder, see TransformerDecoder::apply()
+  virtual void skip(Expr /*input*/, Ptr<DecoderState> /*state*/) const {
+    ABORT("Early exit is not supported by {}", className());
+  }
+
   using IBinaryDecoderLayer::initState;
   using IBinaryDecoderLayer::apply;
 };
@@ -471,9 +530,31 @@ public:
     state->setPosition(0);
   }
 
+  // The keys and values of the newest position are those of input, as if the layers up to here had
+  // been the whole decoder
+  void skip(Expr input, Ptr<DecoderState> state) const override {
+    auto output = preprocessor->apply(input);
+    auto multiHead = selfAttention->as<MultiHeadAttention>();
+    ABORT_IF(!multiHead || output->shape()[-2] != 1, "Early exit requires step-wise multi-head self-attention");
+    extendState(multiHead, output, state);
+  }
+
   Expr apply(Expr input, Expr inputMask, Ptr<DecoderState> state) const override {
     auto output = preprocessor->apply(input);           // optional preprocessing
 
+    // Step-wise decoding: keep the projected keys and values of earlier positions in the state,
+    // so that only the newest position needs to be projected.
+    auto multiHead = selfAttention->as<MultiHeadAttention>();
+    if(multiHead && output->shape()[-2] == 1) {
+      Expr keys, values;
+      std::tie(keys, values) = extendState(multiHead, output, state);
+
+      auto logMask = selfMaskProcessor->apply(output, inputMask, state);
+      output       = multiHead->applyProjected(output, keys, values, logMask);
+      output       = postprocessor->apply(output, input);  // optional postprocessing, optional skip connection
+      return output;
+    }
+
     // Here we extend the state with the keys and values from the previous step.
     auto query      = output;
     auto keysValues = output;
@@ -488,6 +569,21 @@ public:
     output       = postprocessor->apply(output, input);  // optional postprocessing, optional skip connection
     return output;
   }
+
+private:
+  // appends the projected keys and values of the newest position to those in the state and returns all of them
+  std::pair<Expr, Expr> extendState(Ptr<MultiHeadAttention> multiHead, Expr output, Ptr<DecoderState> state) const {
+    auto item = state->as<DecoderStateItem>();
+    auto keys   = multiHead->projectKeys(output);   // [dimBeam, dimBatch, 1, kvDim], smaller than attDim with grouped-query attention
+    auto values = multiHead->projectValues(output); // [dimBeam, dimBatch, 1, kvDim]
+    if(state->getPosition() > 0) {
+      keys   = concatenate({item->get(),    keys},   /*axis=*/-2); // [dimBeam, dimBatch, dimHistory + 1, kvDim]
+      values = concatenate({item->getAux(), values}, /*axis=*/-2); // [dimBeam, dimBatch, dimHistory + 1, kvDim]
+    }
+    item->set(keys);
+    item->setAux(values);
+    return {keys, values};
+  }
 };
 
 /**
@@ -524,6 +620,99 @@ public:
   }
 };
 
+/**
+ * Average attention network (AAN) block from https://arxiv.org/pdf/1805.00631.pdf that can be used as a
+ * replacement for the self-attention block in the decoder. Each position attends to the average of its input and
+ * all earlier inputs, which goes through a feed-forward network and is gated with the input. During step-wise
+ * decoding the state is the running average only, [dimBeam, dimBatch, 1, dimModel], which each step updates with
+ * one fused kernel, see cumulative_average(). Over whole sequences the averages are a cumulative sum.
+ */
+class TransformerDecoderAANBlock final : public TransformerDecoderAutoRegressiveBlock {
+public:
+  Ptr<Sequential> ffn;
+  Ptr<Linear> inputGate;
+  Ptr<Linear> forgetGate;
+
+  using TransformerDecoderAutoRegressiveBlock::preprocessor;
+  using TransformerDecoderAutoRegressiveBlock::postprocessor;
+
+  TransformerDecoderAANBlock(Ptr<ExpressionGraph> graph,
+                             Ptr<Options> options,
+                             Ptr<DecoderMaskProcessor> selfMaskProcessorInit = nullptr)
+    : TransformerDecoderAutoRegressiveBlock(graph, options, selfMaskProcessorInit)
+  {
+    int modelDim = opt<int>("transformer-dim-model", opt<int>("dim-emb"));
+    int aanDim   = opt<int>("transformer-dim-aan", 2048);
+    int depth    = opt<int>("transformer-aan-depth", 2);
+    auto actName = opt<std::string>("transformer-aan-activation", "swish");
+    float ffnDropoutProbability = opt<float>("transformer-dropout-ffn", 0.f);
+
+    // a depth of 1 applies no feed-forward network to the averages
+    if(depth > 1) {
+      ffn = New<Sequential>(graph);
+      registerLayer(ffn);
+      for(int i = 1; i < depth; ++i) {
+        ffn->append(New<Linear>(graph, aanDim));
+        ffn->append(activationLayerByName(graph, actName));
+        ffn->append(New<Dropout>(graph, ffnDropoutProbability));
+      }
+      if(aanDim != modelDim) // bring it back to the model dimension
+        ffn->append(New<Linear>(graph, modelDim));
+    }
+
+    if(!opt<bool>("transformer-aan-nogate", false)) {
+      inputGate = New<Linear>(graph, modelDim);
+      registerLayer(inputGate);
+      forgetGate = New<Linear>(graph, modelDim);
+      registerLayer(forgetGate);
+    }
+  }
+
+  void initState(Ptr<DecoderState> state) const override {
+    state->setPosition(0);
+  }
+
+  // The average of the newest position includes input, as if the layers up to here had been the whole decoder
+  void skip(Expr input, Ptr<DecoderState> state) const override {
+    ABORT_IF(input->shape()[-2] != 1, "Early exit requires step-wise decoding");
+    average(input, state);
+  }
+
+  Expr apply(Expr input, Expr /*inputMask*/, Ptr<DecoderState> state) const override {
+    auto output = preprocessor->apply(average(input, state)); // optional preprocessing
+    if(ffn)
+      output = ffn->apply(output);
+    if(inputGate)
+      output = sigmoid(inputGate->apply(input)) * input + sigmoid(forgetGate->apply(output)) * output;
+    output      = postprocessor->apply(output, input);        // optional postprocessing, optional skip connection
+    return output;
+  }
+
+private:
+  // averages input [dimBeam, dimBatch, dimTime, dimModel] over the time steps up to each position, including
+  // those in the state, and stores the average of the last position in the state
+  Expr average(Expr input, Ptr<DecoderState> state) const {
+    auto item = state->as<DecoderStateItem>();
+    int position = (int)state->getPosition();
+    int dimTime  = input->shape()[-2];
+
+    Expr averages;
+    if(dimTime == 1) {
+      averages = position > 0 ? cumulative_average(item->get(), input, position) : input;
+    } else {
+      // padding is at the end, so the causal averages of the words are not affected by it
+      ABORT_IF(position > 0, "Average attention continues from a state for single steps only");
+      std::vector<float> counts(dimTime);
+      for(int i = 0; i < dimTime; ++i)
+        counts[i] = 1.f / (i + 1);
+      auto scale = graph()->constant({dimTime, 1}, inits::fromVector(counts), input->value_type());
+      averages = cumsum(input, /*axis=*/-2) * scale;
+    }
+    item->set(dimTime == 1 ? averages : slice(averages, /*axis=*/-2, dimTime - 1));
+    return averages;
+  }
+};
+
 /**
  * A full transformer (LM) decoder layer consists of a self-attention block followed by
  * a filter block. Skip connections etc. are handled inside the blocks, see above.
@@ -543,6 +732,8 @@ public:
       autoRegressiveBlock = New<TransformerDecoderSelfAttentionBlock>(graph, options, selfMaskProcessorInit);
     } else if(autoRegressionType == "rnn") {
       autoRegressiveBlock = New<TransformerDecoderRNNBlock>(graph, options, selfMaskProcessorInit);
+    } else if(autoRegressionType == "average-attention") {
+      autoRegressiveBlock = New<TransformerDecoderAANBlock>(graph, options, selfMaskProcessorInit);
     } else {
       ABORT("Unknown auto-regression block type {}", autoRegressionType);
     }
@@ -619,6 +810,11 @@ private:
   Ptr<AttentionCollector> attentionCollector_;
 
 public:
+  // Called after each layer but the last with the number of the layer (from 1) and the decoder output if it ended
+  // there, i.e. after the final postprocessor, [beam depth=1, max length, batch size, vector dim]. Returns true to
+  // exit early, see apply().
+  typedef std::function<bool(size_t layer, Expr output)> EarlyExitFunc;
+
   Ptr<PositionEmbeddingLayer> positionEmbedding;
   Ptr<TransformerPrePostProcessor> preprocessor;
   Ptr<TransformerPrePostProcessor> postprocessor;
@@ -688,6 +884,11 @@ public:
           for(auto linear : autoRegLayerSA->allLayers<Linear>())
             linear->init = inits::glorotUniform(true, true, /*scale=*/ 1.f / std::sqrt((float)i + 1));
 
+        auto autoRegLayerAAN = currentLayer->autoRegressiveBlock->as<TransformerDecoderAANBlock>();
+        if(autoRegLayerAAN)
+          for(auto linear : autoRegLayerAAN->allLayers<Linear>())
+            linear->init = inits::glorotUniform(true, true, /*scale=*/ 1.f / std::sqrt((float)i + 1));
+
         for(auto linear : currentLayer->crossAttentionBlock->allLayers<Linear>())
           linear->init = inits::glorotUniform(true, true, /*scale=*/ 1.f / std::sqrt((float)i + 1));
 
@@ -736,6 +937,13 @@ public:
   }
 
   Expr apply(Expr input, Expr inputMask, Ptr<DecoderState> state) const override {
+    return apply(input, inputMask, state, nullptr);
+  }
+
+  // With earlyExit, the decoder stops after the first layer for which it returns true and returns the output passed
+  // to it. The layers above only extend their states with the keys and values of that layer's output, which requires
+  // self-attention blocks and a single new position.
+  Expr apply(Expr input, Expr inputMask, Ptr<DecoderState> state, const EarlyExitFunc& earlyExit) const {
     // first and last operations (see at the bottom of this function) switch the time and batch
     // dimensions. This order is more natural for the transformer, but more difficult to handle
     // during beam search or when using RNNs. Hence the input/output transpositions here.
@@ -772,10 +980,19 @@ public:
     // get an iterator to per-layer states
     auto layerStateIt = state->as<nn::DecoderStateList>()->begin();
     // traverse the layers, use the same mask for each
-    for(auto layer : *layers) {
+    for(size_t i = 0; i < layers->size(); ++i) {
       // @TODO: can we put logmask computation inside this layer? Then we can reduce the number of arguments here
       // and use only the decoder state to provide context and mask.
-      output = layer->as<TransformerDecoderLayerWithCrossAttention>()->apply(output, inputMask, context, contextMask, /*in/out=*/*layerStateIt++);
+      output = layers->at(i)->as<TransformerDecoderLayerWithCrossAttention>()->apply(output, inputMask, context, contextMask, /*in/out=*/*layerStateIt++);
+
+      if(earlyExit && i + 1 < layers->size()) {
+        auto exitOutput = swapTimeBatch(postprocessor->apply(output, prevOutput));
+        if(earlyExit(i + 1, exitOutput)) {
+          for(size_t j = i + 1; j < layers->size(); ++j)
+            layers->at(j)->as<TransformerDecoderLayerWithCrossAttention>()->autoRegressiveBlock->skip(output, *layerStateIt++);
+          return exitOutput;
+        }
+      }
     }
 
     // apply final postprocessor if requred, e.g. final layer-norm for pre-norm or final skip connection
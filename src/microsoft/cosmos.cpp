@@ -49,38 +49,10 @@ private:
   Ptr<EmbedderModel> model_;
   Ptr<io::ModelWeights> modelFile_;
 
-public:
-  Embedder(const std::string& modelPath, const std::string& vocabPath, bool computeSimilarity = false) {
-    options_ = New<Options>("inference", true,
-                            "shuffle", "none",
-                            "mini-batch", MAX_BATCH_SIZE,
-                            "maxi-batch", 100,
-                            "maxi-batch-sort", "src",
-                            "max-length", MAX_LENGTH,
-                            "max-length-crop", true,
-                            "compute-similarity", computeSimilarity,
-                            "vocabs", std::vector<std::string>(computeSimilarity ? 2 : 1, vocabPath));
-
-    vocab_ = New<Vocab>(options_, 0);
-    vocab_->load(vocabPath, 0);
-
-    graph_ = New<ExpressionGraph>(/*inference=*/true);
-    graph_->setDevice(CPU0);
-    graph_->reserveWorkspaceMB(512);
-
-    modelFile_ = New<io::ModelWeights>(modelPath);
-    YAML::Node config = modelFile_->getYamlFromModel();
-
-    Ptr<Options> modelOpts = New<Options>();
-    modelOpts->merge(options_);
-    modelOpts->merge(config);
+  Ptr<Options> modelOpts_;
+  Ptr<EmbedderModel> embeddingModel_; // of a similarity scorer for similarityMatrix(), on the parameters of model_
 
-    model_ = New<EmbedderModel>(modelOpts);
-    model_->load(graph_, modelFile_);
-  }
-
-  // Compute embedding vectors for a batch of sentences
-  std::vector<std::vector<float>> embed(const std::string& input) {
+  std::vector<std::vector<float>> embed(Ptr<EmbedderModel> model, const std::string& input) {
     auto text = New<data::TextInput>(std::vector<std::string>({input}),
                                      std::vector<Ptr<Vocab>>({vocab_}),
                                      options_);
@@ -91,7 +63,7 @@ public:
     std::vector<std::vector<float>> output;
 
     for(auto batch : batchGenerator) {
-      auto embeddings = model_->build(graph_, batch);
+      auto embeddings = model->build(graph_, batch);
       graph_->forward();
 
       std::vector<float> sentVectors;
@@ -115,6 +87,59 @@ public:
     return output;
   }
 
+  // the embeddings of all lines scaled to length 1, one row per line
+  std::vector<float> normalizedEmbeddings(const std::string& input, size_t& rows, size_t& dimEmb) {
+    auto vectors = embed(embeddingModel_, input);
+    rows = vectors.size();
+    dimEmb = vectors.empty() ? 0 : vectors[0].size();
+    std::vector<float> joined;
+    joined.reserve(rows * dimEmb);
+    for(const auto& vector : vectors) {
+      float norm = 0.f;
+      for(float v : vector)
+        norm += v * v;
+      norm = norm > 0.f ? 1.f / std::sqrt(norm) : 0.f;
+      for(float v : vector)
+        joined.push_back(v * norm);
+    }
+    return joined;
+  }
+
+public:
+  Embedder(const std::string& modelPath, const std::string& vocabPath, bool computeSimilarity = false) {
+    options_ = New<Options>("inference", true,
+                            "shuffle", "none",
+                            "mini-batch", MAX_BATCH_SIZE,
+                            "maxi-batch", 100,
+                            "maxi-batch-sort", "src",
+                            "max-length", MAX_LENGTH,
+                            "max-length-crop", true,
+                            "compute-similarity", computeSimilarity,
+                            "vocabs", std::vector<std::string>(computeSimilarity ? 2 : 1, vocabPath));
+
+    vocab_ = New<Vocab>(options_, 0);
+    vocab_->load(vocabPath, 0);
+
+    graph_ = New<ExpressionGraph>(/*inference=*/true);
+    graph_->setDevice(CPU0);
+    graph_->reserveWorkspaceMB(512);
+
+    modelFile_ = New<io::ModelWeights>(modelPath);
+    YAML::Node config = modelFile_->getYamlFromModel();
+
+    modelOpts_ = New<Options>();
+    modelOpts_->merge(options_);
+    modelOpts_->merge(config);
+
+    model_ = New<EmbedderModel>(modelOpts_);
+    model_->load(graph_, modelFile_);
+  }
+
+  // Compute embedding vectors for a batch of sentences
+  std::vector<std::vector<float>> embed(const std::string& input) {
+    return embed(model_, input);
+  }
+
   // Compute cosine similarity scores for a two batches of corresponding sentences
   std::vector<float> similarity(const std::string& input1, const std::string& input2) {
     auto text = New<data::TextInput>(std::vector<std::string>({input1, input2}),
@@ -144,6 +169,34 @@ public:
 
     return output;
   };
+
+  // Compute the cosine similarity scores of all pairs of a query and a candidate as [query][candidate]
+  std::vector<std::vector<float>> similarityMatrix(const std::string& queries, const std::string& candidates) {
+    // the single-sentence embedder of the same model, whose parameters are already in the graph
+    if(!embeddingModel_) {
+      embeddingModel_ = New<EmbedderModel>(modelOpts_->with("compute-similarity", false));
+      embeddingModel_->load(graph_, modelFile_);
+    }
+
+    size_t numQueries, numCandidates, dimQuery, dimCandidate;
+    auto vQueries = normalizedEmbeddings(queries, numQueries, dimQuery);
+    auto vCandidates = normalizedEmbeddings(candidates, numCandidates, dimCandidate);
+    std::vector<std::vector<float>> output(numQueries);
+    if(numQueries == 0 || numCandidates == 0)
+      return output;
+
+    graph_->clear();
+    auto q = graph_->constant({(int)numQueries, (int)dimQuery}, inits::fromVector(vQueries));
+    auto c = graph_->constant({(int)numCandidates, (int)dimCandidate}, inits::fromVector(vCandidates));
+    auto cosines = maximum(0, dot(q, c, /*transA=*/false, /*transB=*/true)); // clipped to [0, 1] like similarity()
+    graph_->forward();
+
+    std::vector<float> vCosines;
+    cosines->val()->get(vCosines);
+    for(size_t i = 0; i < numQueries; ++i)
+      output[i].assign(vCosines.begin() + i * numCandidates, vCosines.begin() + (i + 1) * numCandidates);
+    return output;
+  }
 };
 
 /* Interface functions ***************************************************************************/
@@ -178,6 +231,11 @@ std::vector<float> MarianCosineScorer::score(const std::string& input1, const st
   return embedder_->similarity(input1, input2);
 };
 
+std::vector<std::vector<float>> MarianCosineScorer::scoreAll(const std::string& queries, const std::string& candidates) {
+  ABORT_IF(!embedder_, "Embedder is not defined??");
+  return embedder_->similarityMatrix(queries, candidates);
+}
+
 bool MarianCosineScorer::load(const std::string& modelPath, const std::string& vocabPath) {
   embedder_ = New<Embedder>(modelPath, vocabPath, /*computeSimilarity*/true);
   ABORT_IF(!embedder_, "Embedder is not defined??");
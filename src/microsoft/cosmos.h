@@ -53,6 +53,13 @@ namespace cosmos {
        * Returns a vector of similarity scores in order corresponding to input sentence order.
        */
       std::vector<float> score(const std::string& input1, const std::string& input2);
+
+      /**
+       * `queries` and `candidates` are big strings with multiple sentences separated by '\n'.
+       * Returns the similarity scores of every query with every candidate as [query][candidate],
+       * computed from the embeddings of both sets in a single matrix product.
+       */
+      std::vector<std::vector<float>> scoreAll(const std::string& queries, const std::string& candidates);
       
       /** 
        * `modelPath` is a Marian model, `vocabPath` a matching SentencePiece model with *.spm suffix.
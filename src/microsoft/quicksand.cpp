@@ -73,6 +73,10 @@ private:
 
   std::vector<Ptr<Vocab>> vocabs_;
 
+  Ptr<BeamSearch> search_;                          // reused by all calls to decode()
+  Ptr<data::ShortlistGenerator> lshGenerator_;      // created on the first call with --output-approx-knn
+  std::vector<Ptr<data::SubBatch>> flatSubBatches_; // of the last flat decode(), reused for batches of the same size
+
   static inline std::unordered_map<size_t, YAML::Node> configCache_;
   static inline std::mutex configCacheMutex_;
 public:
@@ -129,6 +133,8 @@ public:
 
     // run parameter init once, this is required for graph_->get("parameter name") to work correctly
     graph_->forward();
+
+    search_ = New<BeamSearch>(options_, scorers_, vocabs_[1]);
   }
 
   YAML::Node* getConfigFromCache(size_t key){
@@ -148,26 +154,39 @@ public:
 
   void setWorkspace(uint8_t* data, size_t size) override { device_->set(data, size); }
 
-  QSNBestBatch decode(const std::vector<QSBatch>& qsBatches,
-                      size_t maxLength,
-                      const std::unordered_set<WordIndex>& shortlist) override {
+  void setShortlist(const std::unordered_set<WordIndex>& shortlist) {
     std::vector<int> lshOpts = options_->get<std::vector<int>>("output-approx-knn", {});
     ABORT_IF(lshOpts.size() != 0 && lshOpts.size() != 2, "--output-approx-knn takes 2 parameters");
     ABORT_IF(lshOpts.size() == 2 && shortlist.size() > 0, "LSH and shortlist cannot be used at the same time");
 
     if(lshOpts.size() == 2 || shortlist.size() > 0) {
       Ptr<data::ShortlistGenerator> shortListGen;
-      // both ShortListGenerators are thin wrappers, hence no problem with calling this per query
       if(lshOpts.size() == 2) {
         // Setting abortIfDynamic to true disallows memory allocation for LSH parameters, this is specifically for use in Quicksand.
         // If we want to use the LSH in Quicksand we need to create a binary model that contains the LSH parameters via conversion.
-        shortListGen = New<data::LSHShortlistGenerator>(lshOpts[0], lshOpts[1], vocabs_[1]->lemmaSize(), /*abortIfDynamic=*/true);
+        if(!lshGenerator_)
+          lshGenerator_ = New<data::LSHShortlistGenerator>(lshOpts[0], lshOpts[1], vocabs_[1]->lemmaSize(), /*abortIfDynamic=*/true);
+        shortListGen = lshGenerator_;
       } else {
+        // a thin wrapper, hence no problem with creating this per query
         shortListGen = New<data::FakeShortlistGenerator>(shortlist);
       }
       for(auto scorer : scorers_)
         scorer->setShortlistGenerator(shortListGen);
     }
+  }
+
+  Histories search(const std::vector<Ptr<data::SubBatch>>& subBatches) {
+    auto batch = New<data::CorpusBatch>(subBatches);
+    std::vector<size_t> sentIds(batch->size(), 0);
+    batch->setSentenceIds(sentIds);
+    return search_->search(graph_, batch);
+  }
+
+  QSNBestBatch decode(const std::vector<QSBatch>& qsBatches,
+                      size_t maxLength,
+                      const std::unordered_set<WordIndex>& shortlist) override {
+    setShortlist(shortlist);
 
     ABORT_IF(qsBatches.empty(),    "No input batch provided");
     ABORT_IF(qsBatches.size() > 2, "More than two sub-batches provided");
@@ -195,13 +214,8 @@ public:
       subBatches.push_back(tgtSubBatch);
     }
 
-    auto batch = New<data::CorpusBatch>(subBatches);
-    std::vector<size_t> sentIds(batch->size(), 0);
-    batch->setSentenceIds(sentIds);
-
     // decode
-    auto search = New<BeamSearch>(options_, scorers_, vocabs_[1]);
-    Histories histories = search->search(graph_, batch);
+    Histories histories = search(subBatches);
 
     // convert to QuickSAND format
     QSNBestBatch qsNbestBatch;
@@ -238,6 +252,65 @@ public:
 
     return qsNbestBatch;
   }
+
+  void decode(const QSFlatBatch* batches,
+              size_t numBatches,
+              size_t maxLength,
+              const std::unordered_set<WordIndex>& shortlist,
+              QSFlatNBest& nbest) override {
+    setShortlist(shortlist);
+
+    ABORT_IF(numBatches == 0, "No input batch provided");
+    ABORT_IF(numBatches > 2,  "More than two sub-batches provided");
+
+    flatSubBatches_.resize(numBatches);
+    for(size_t b = 0; b < numBatches; ++b) {
+      const auto& input = batches[b];
+      ABORT_IF(input.numSentences != batches[0].numSentences, "Sub-batches with different numbers of sentences provided");
+
+      size_t width = 0;
+      for(size_t j = 0; j < input.numSentences; ++j)
+        width = std::max(width, input.offsets[j + 1] - input.offsets[j]);
+      width = std::min(width, maxLength);
+
+      // the search does not keep the batch, so the sub-batch of the last call can be refilled
+      auto& subBatch = flatSubBatches_[b];
+      if(!subBatch || subBatch->batchSize() != input.numSentences || subBatch->batchWidth() != width) {
+        subBatch = New<data::SubBatch>(input.numSentences, width, vocabs_[b]);
+      } else {
+        std::fill(subBatch->data().begin(), subBatch->data().end(), vocabs_[b]->getEosId());
+        std::fill(subBatch->mask().begin(), subBatch->mask().end(), 0.f);
+      }
+
+      for(size_t j = 0; j < input.numSentences; ++j) {
+        size_t length = std::min(input.offsets[j + 1] - input.offsets[j], width);
+        for(size_t i = 0; i < length; ++i) {
+          size_t idx = subBatch->locate(/*batchIdx=*/j, /*wordPos=*/i);
+          subBatch->data()[idx] = marian::Word::fromWordIndex(input.words[input.offsets[j] + i]);
+          subBatch->mask()[idx] = 1;
+        }
+      }
+    }
+
+    Histories histories = search(flatSubBatches_);
+
+    nbest.numHyps = 0;
+    nbest.numWords = 0;
+    nbest.hypOffsets[0] = 0;
+    nbest.wordOffsets[0] = 0;
+    for(size_t j = 0; j < histories.size(); ++j) {
+      for(const Result& result : histories[j]->nBest(SIZE_MAX)) {
+        const auto& words = std::get<0>(result);
+        ABORT_IF(nbest.numHyps == nbest.hypsCapacity, "More than {} hypotheses for the n-best buffers", nbest.hypsCapacity);
+        ABORT_IF(nbest.numWords + words.size() > nbest.wordsCapacity, "More than {} words for the n-best buffers", nbest.wordsCapacity);
+        for(auto word : words)
+          nbest.words[nbest.numWords++] = word.toWordIndex();
+        nbest.scores[nbest.numHyps] = std::get<2>(result);
+        nbest.wordOffsets[++nbest.numHyps] = nbest.numWords;
+      }
+      nbest.hypOffsets[j + 1] = nbest.numHyps;
+    }
+  }
 };
 
 Ptr<IBeamSearchDecoder> newDecoder(Ptr<Options> options,
@@ -29,6 +29,30 @@ typedef std::tuple<WordIndices, AlignmentSets, float> QSSentenceWithProb;
 typedef std::vector<QSSentenceWithProb> QSNBest;
 typedef std::vector<QSNBest> QSNBestBatch;
 
+// A batch of sentences in memory owned by the caller, which IBeamSearchDecoder::decode() reads without copying it into
+// nested vectors first. The word ids of sentence i are words[offsets[i]] to words[offsets[i + 1] - 1], so offsets has
+// numSentences + 1 entries.
+struct QSFlatBatch {
+  const WordIndex* words;
+  const size_t* offsets;
+  size_t numSentences;
+};
+
+// Buffers owned by the caller, into which IBeamSearchDecoder::decode() writes the n-best lists of a QSFlatBatch. The
+// hypotheses of sentence i are hypOffsets[i] to hypOffsets[i + 1] - 1, and hypothesis h has the score scores[h] and
+// the words words[wordOffsets[h]] to words[wordOffsets[h + 1] - 1]. decode() aborts if a buffer is too small.
+struct QSFlatNBest {
+  WordIndex* words;     // wordsCapacity entries
+  size_t wordsCapacity;
+  float* scores;        // hypsCapacity entries
+  size_t* wordOffsets;  // hypsCapacity + 1 entries
+  size_t hypsCapacity;
+  size_t* hypOffsets;   // numSentences + 1 entries
+
+  size_t numHyps;       // set by decode()
+  size_t numWords;      // set by decode()
+};
+
 enum class DecoderCpuAvxVersion {
   AVX,
   AVX2,
@@ -66,6 +90,16 @@ public:
                               const std::unordered_set<WordIndex>& shortlist)
       = 0;
 
+  // Like the above, but reads the batches from and writes the results to memory owned by the caller, without
+  // alignments. The decoder keeps its sub-batches and reuses them while their size does not change, so calls for
+  // batches of the same dimensions allocate no input buffers.
+  virtual void decode(const QSFlatBatch* batches,
+                      size_t numBatches,
+                      size_t maxLength,
+                      const std::unordered_set<WordIndex>& shortlist,
+                      QSFlatNBest& nbest)
+      = 0;
+
   virtual void setWorkspace(uint8_t* data, size_t size) = 0;
 };
 
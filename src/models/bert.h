@@ -252,6 +252,9 @@ public:
     return embeddings + signal;
   }
 
+  // sentence embeddings are added with the positions
+  virtual bool fusePositionEmbeddings() const override { return false; }
+
   virtual Expr addSpecialEmbeddings(Expr input, int start = 0, Ptr<data::CorpusBatch> batch = nullptr) const override {
     bool trainPosEmbeddings = opt<bool>("transformer-train-position-embeddings", true);
     bool trainTypeEmbeddings = opt<bool>("bert-train-type-embeddings", true);
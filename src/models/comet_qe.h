@@ -153,7 +153,20 @@ struct CometBatchEncoder final : public nn::LayerWithOptions,
     ABORT_IF(this->graph() != graph, "Graph used for construction and graph parameter do not match");
 #endif
 
-    const auto& [batchEmbedding, batchMask] = apply((*batch)[batchIndex_]);
+    auto subBatch = (*batch)[batchIndex_];
+
+    // In inference, encode every distinct sentence only once, e.g. the source and reference shared by many
+    // hypotheses, and broadcast the embeddings back to all sentences of the batch for the pooler
+    std::vector<size_t> firstRows;
+    std::vector<IndexType> rowOf;
+    if(graph->isInference() && subBatch->distinct(firstRows, rowOf)) {
+      const auto& [distinctEmbedding, distinctMask] = apply(subBatch->select(firstRows));
+      auto batchEmbedding = index_select(distinctEmbedding, /*axis=*/-3, rowOf); // [batch, 1, modelDim]
+      auto batchMask      = index_select(distinctMask, /*axis=*/-2, rowOf);      // [time, batch, 1]
+      return New<EncoderState>(batchEmbedding, batchMask, batch);
+    }
+
+    const auto& [batchEmbedding, batchMask] = apply(subBatch);
     return New<EncoderState>(batchEmbedding, batchMask, batch);
   }
 
@@ -400,6 +413,53 @@ public:
     }
   }
 
+  /**
+   * Expected utilities for minimum Bayes risk decoding with a COMET model, i.e. the mean score of each of N
+   * candidates for a source with the same N candidates as pseudo-references. src [groups, 1, dimModel] and
+   * mt [groups * N, 1, dimModel] are sentence embeddings, so every candidate is encoded only once. The first
+   * layer is linear in the six features of a pair, hence the parts for the candidate and the reference are
+   * computed for N rows each and only the mt * ref and |mt - ref| parts for all N x N pairs.
+   * Returns the [groups, N] expected utilities.
+   */
+  Expr mbrUtilities(Ptr<ExpressionGraph> graph, Expr src, Expr mt, int numCandidates) {
+    PoolerBase::graph_ = graph;
+    setGraph(graph);
+
+    auto modelType = LayerWithOptions::opt<std::string>("type");
+    ABORT_IF(modelType != "comet", "MBR decoding requires a COMET model with references, not {}", modelType);
+
+    auto first = layers->at(0)->as<nn::Linear>();
+    ABORT_IF(!first || first->transposed, "Expected the first layer of the COMET regressor to be linear");
+
+    int dimModel  = mt->shape()[-1];
+    int dimGroups = src->shape().elements() / dimModel;
+    ABORT_IF(mt->shape().elements() != dimGroups * numCandidates * dimModel,
+             "Expected {} candidate embeddings for each of {} sources", numCandidates, dimGroups);
+
+    auto source = reshape(src, {dimGroups, 1, 1, dimModel});
+    auto hyp    = reshape(mt,  {dimGroups, numCandidates, 1, dimModel}); // candidate i
+    auto ref    = reshape(mt,  {dimGroups, 1, numCandidates, dimModel}); // pseudo-reference j
+
+    // candidate part with bias, the zero reference features do not contribute. This also registers the weight.
+    auto zeros   = graph->constant({dimGroups, numCandidates, 1, 3 * dimModel}, inits::zeros(), mt->value_type());
+    auto hypPart = first->apply(concatenate({hyp, zeros, hyp * source, abs(hyp - source)}, /*axis=*/-1));
+
+    auto weight   = first->weight; // [6 * dimModel, dimHidden] for {mt, ref, prodRef, diffRef, prodSrc, diffSrc}
+    ABORT_IF(!isFloat(weight->value_type()),
+             "MBR needs the first pooler layer in a float type, not {}; convert the model without packing it",
+             weight->value_type());
+    auto refPart  = dot(ref, slice(weight, /*axis=*/0, Slice(dimModel, 2 * dimModel)));
+    auto pairPart = dot(concatenate({hyp * ref, abs(hyp - ref)}, /*axis=*/-1),
+                        slice(weight, /*axis=*/0, Slice(2 * dimModel, 4 * dimModel)));
+
+    auto output = hypPart + refPart + pairPart; // [groups, N, N, dimHidden]
+    for(size_t i = 1; i < layers->size(); ++i)
+      output = layers->at(i)->apply(output);
+
+    output = mean(marian::cast(output, Type::float32), /*axis=*/-2); // average over the pseudo-references
+    return reshape(output, {dimGroups, numCandidates});
+  }
+
   void clear() override {}
 };
 
@@ -4,6 +4,7 @@
 #include "layers/guided_alignment.h"
 #include "layers/loss.h"
 #include "layers/weight.h"
+#include "layers_new/interface.h"
 #include "models/encoder_classifier.h"
 #include "models/encoder_decoder.h"
 #include "models/encoder_pooler.h"
@@ -89,6 +90,19 @@ public:
       multiLoss->push_back(alignmentLoss);
     }
 
+    // losses of new-style layers, e.g. the load balancing of mixtures of experts
+    if(!inference_) {
+      std::vector<Ptr<nn::Layer>> layers;
+      for(auto encoder : encdec->getEncoders())
+        layers.push_back(std::dynamic_pointer_cast<nn::Layer>(encoder));
+      for(auto decoder : encdec->getDecoders())
+        layers.push_back(std::dynamic_pointer_cast<nn::Layer>(decoder));
+      for(auto layer : layers)
+        if(layer)
+          for(const auto& loss : layer->getAuxiliaryLosses(/*recurse=*/true))
+            multiLoss->push_back(loss);
+    }
+
     return multiLoss;
   }
 };
@@ -209,6 +223,7 @@ class Trainer : public ICriterionFunction {
 protected:
   Ptr<IModel> model_;
   Ptr<ICost> cost_;
+  Ptr<TrainingObserver> observer_;
 
 public:
   Trainer(Ptr<IModel> model, Ptr<ICost> cost) : model_(model), cost_(cost) {}
@@ -236,6 +251,9 @@ public:
   };
 
   virtual void clear(Ptr<ExpressionGraph> graph) override { model_->clear(graph); };
+
+  void setTrainingObserver(Ptr<TrainingObserver> observer) { observer_ = observer; }
+  virtual Ptr<TrainingObserver> getTrainingObserver() override { return observer_; }
 };
 
 class ILogProb {
@@ -346,6 +364,15 @@ public:
     return cost_->apply(nextState);
   }
 
+  virtual Ptr<DecoderState> stepTokens(Ptr<ExpressionGraph> graph,
+                                       Ptr<DecoderState> state,
+                                       const Words& words,
+                                       int dimBatch,
+                                       int dimSteps) override {
+    auto nextState = encdec_->stepTokens(graph, state, words, dimBatch, dimSteps);
+    return cost_->apply(nextState);
+  }
+
   virtual Logits build(Ptr<ExpressionGraph> /*graph*/,
                        Ptr<data::CorpusBatch> /*batch*/,
                        bool /*clearGraph*/ = true) override {
@@ -362,6 +389,8 @@ public:
   virtual Ptr<data::Shortlist> getShortlist() override { return encdec_->getShortlist(); };
 
   virtual data::SoftAlignment getAlignment() override { return encdec_->getAlignment(); }
+
+  virtual std::vector<Expr> getAlignmentNodes() override { return encdec_->getAlignmentNodes(); }
 };
 
 }  // namespace models
@@ -13,6 +13,37 @@ class DecoderBase : public EncoderDecoderLayerBase {
 protected:
   Ptr<data::Shortlist> shortlist_;
 
+  // Whether a decoding step may exit after decoder layer 'layer' (from 1) of 'depth' layers, see --early-exit-layers
+  bool isEarlyExitLayer(size_t layer, size_t depth) const {
+    if(!inference_ || layer >= depth || opt<float>("early-exit-threshold", 0.f) <= 0.f
+       || options_->hasAndNotEmpty("alignment")) // the attention weights may come from a skipped layer
+      return false;
+    auto layers = opt<std::vector<size_t>>("early-exit-layers", std::vector<size_t>());
+    return std::find(layers.begin(), layers.end(), layer) != layers.end();
+  }
+
+  // Runs the graph up to logits computed at an exit layer and returns whether the probability of the best word
+  // exceeds that of the second best by at least --early-exit-threshold for every hypothesis of the step
+  bool confidentToExit(Expr logits) const {
+    auto best    = topkValues(softmax(logits), /*k=*/2, /*axis=*/-1);                   // [..., 2]
+    auto margins = cast(slice(best, -1, 0) - slice(best, -1, 1), Type::float32); // [..., 1]
+    graph_->forward();
+
+    std::vector<float> values;
+    margins->val()->get(values);
+    float threshold = opt<float>("early-exit-threshold");
+    return std::all_of(values.begin(), values.end(), [threshold](float margin) { return margin >= threshold; });
+  }
+
+  // The embedding layer for the words of the previous step, which reads them from the compact rows of a static
+  // shortlist with --shortlist-compact-embeddings
+  Ptr<IEmbeddingLayer> getPredictionEmbeddingLayer() const {
+    auto embeddingLayer = getEmbeddingLayer();
+    bool compact = shortlist_ && !shortlist_->isDynamic() && opt<bool>("shortlist-compact-embeddings", false);
+    embeddingLayer->setShortlist(compact ? shortlist_ : nullptr);
+    return embeddingLayer;
+  }
+
 public:
   DecoderBase(Ptr<ExpressionGraph> graph, Ptr<Options> options) :
     EncoderDecoderLayerBase(graph, options, "decoder", /*batchIndex=*/1,
@@ -36,23 +67,16 @@ public:
     Expr y, yMask; std::tie
     (y, yMask) = getEmbeddingLayer()->apply(subBatch);
 
-    // @TODO: during training there is currently no code path that leads to using a shortlist
-#if 0
-    const Words& data =
-      /*if*/ (shortlist_) ?
-        shortlist_->mappedIndices()
-      /*else*/ :
-        subBatch->data();
-#endif
-
-    ABORT_IF(shortlist_, "How did a shortlist make it into training?");
+    // the only shortlist in training are the candidates of a sampled softmax, the labels are positions in them
+    auto sampled = std::dynamic_pointer_cast<data::SampledShortlist>(shortlist_);
+    ABORT_IF(shortlist_ && !sampled, "How did a shortlist make it into training?");
 
     auto yDelayed = shift(y, {1, 0, 0}); // insert zero at front; first word gets predicted from a target embedding of 0
 
     state->setTargetHistoryEmbeddings(yDelayed);
     state->setTargetMask(yMask);
     
-    const Words& data = subBatch->data();
+    const Words& data = sampled ? sampled->mappedIndices() : subBatch->data();
     state->setTargetWords(data);
   }
 
@@ -60,15 +84,16 @@ public:
                                         Ptr<DecoderState> state,
                                         const Words& words,
                                         int dimBatch,
-                                        int dimBeam) {
+                                        int dimBeam,
+                                        int dimSteps = 1) { // words: [dimBeam, dimSteps, dimBatch] flattened
     graph_ = graph;
-    auto embeddingLayer = getEmbeddingLayer();
+    auto embeddingLayer = getPredictionEmbeddingLayer();
     Expr selectedEmbs;
     int dimEmb = opt<int>("dim-emb");
     if(words.empty())
       selectedEmbs = graph_->constant({1, 1, dimBatch, dimEmb}, inits::zeros());
     else
-      selectedEmbs = embeddingLayer->apply(words, {dimBeam, 1, dimBatch, dimEmb});
+      selectedEmbs = embeddingLayer->apply(words, {dimBeam, dimSteps, dimBatch, dimEmb});
     state->setTargetHistoryEmbeddings(selectedEmbs);
     state->setTargetWords(words);
   }
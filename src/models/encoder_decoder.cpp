@@ -1,10 +1,13 @@
 #include "models/encoder_decoder.h"
 #include "common/cli_helper.h"
 #include "common/filesystem.h"
+#include "common/tracing.h"
 #include "common/version.h"
 
 #include "models/transformer_new.h"
 
+#include <map>
+
 namespace marian {
 
 EncoderDecoder::EncoderDecoder(Ptr<ExpressionGraph> graph, Ptr<Options> options)
@@ -38,6 +41,7 @@ EncoderDecoder::EncoderDecoder(Ptr<ExpressionGraph> graph, Ptr<Options> options)
     modelFeatures_.insert(feature);
 
   modelFeatures_.insert("transformer-heads");
+  modelFeatures_.insert("transformer-heads-kv");
   modelFeatures_.insert("transformer-no-projection");
   modelFeatures_.insert("transformer-rnn-projection");
   modelFeatures_.insert("transformer-dim-ffn");
@@ -45,6 +49,9 @@ EncoderDecoder::EncoderDecoder(Ptr<ExpressionGraph> graph, Ptr<Options> options)
   modelFeatures_.insert("transformer-ffn-depth");
   modelFeatures_.insert("transformer-decoder-ffn-depth");
   modelFeatures_.insert("transformer-ffn-activation");
+  modelFeatures_.insert("transformer-moe-experts");
+  modelFeatures_.insert("transformer-moe-top-k");
+  modelFeatures_.insert("transformer-moe-capacity-factor");
   modelFeatures_.insert("transformer-dim-aan");
   modelFeatures_.insert("transformer-aan-depth");
   modelFeatures_.insert("transformer-aan-activation");
@@ -176,6 +183,21 @@ void EncoderDecoder::save(Ptr<ExpressionGraph> graph,
     createDecoderConfig(name);
 }
 
+void EncoderDecoder::save(const std::vector<Ptr<ExpressionGraph>>& graphs,
+                          const std::string& name,
+                          bool saveTranslatorConfig) {
+  LOG(info, "Saving model weights and runtime parameters to {}", name);
+
+  std::vector<io::Item> items;
+  for(auto graph : graphs)
+    graph->getItems(items);
+  io::addMetaToItems(getModelParametersAsString(), "special:model.yml", items);
+  io::saveItems(name, items);
+
+  if(saveTranslatorConfig)
+    createDecoderConfig(name);
+}
+
 void EncoderDecoder::clear(Ptr<ExpressionGraph> graph) {
   graph->clear();
 
@@ -197,14 +219,86 @@ void EncoderDecoder::clear(Ptr<ExpressionGraph> graph) {
   }
 }
 
+// Batches that repeat a source, e.g. of n-best lists for rescoring, only need to be encoded once per distinct source.
+// Returns the batch of the first occurrence of each distinct combination of the given source streams together with the
+// row of every entry of batch in it, or nullptr if all are distinct.
+static Ptr<data::CorpusBatch> distinctSources(Ptr<data::CorpusBatch> batch,
+                                              const std::vector<size_t>& streams,
+                                              std::vector<IndexType>& rows) {
+  size_t dimBatch = batch->size();
+  std::map<std::vector<WordIndex>, IndexType> distinct;
+  std::vector<size_t> firsts;
+  rows.resize(dimBatch);
+  for(size_t b = 0; b < dimBatch; ++b) {
+    std::vector<WordIndex> key;
+    for(auto stream : streams) {
+      const auto& subBatch = (*batch)[stream];
+      for(size_t i = 0; i < subBatch->batchWidth(); ++i) {
+        size_t idx = subBatch->locate(b, i);
+        if(subBatch->mask()[idx] != 0)
+          key.push_back(subBatch->data()[idx].toWordIndex());
+      }
+      key.push_back(Word::NONE.toWordIndex()); // separates the streams
+    }
+    auto inserted = distinct.emplace(std::move(key), (IndexType)firsts.size());
+    if(inserted.second)
+      firsts.push_back(b);
+    rows[b] = inserted.first->second;
+  }
+  if(firsts.size() == dimBatch)
+    return nullptr;
+
+  std::vector<Ptr<data::SubBatch>> subBatches;
+  for(size_t stream = 0; stream < batch->sets(); ++stream) {
+    const auto& subBatch = (*batch)[stream];
+    auto distinctBatch = New<data::SubBatch>(firsts.size(), subBatch->batchWidth(), subBatch->vocab());
+    for(size_t b = 0; b < firsts.size(); ++b) {
+      for(size_t i = 0; i < subBatch->batchWidth(); ++i) {
+        distinctBatch->data()[distinctBatch->locate(b, i)] = subBatch->data()[subBatch->locate(firsts[b], i)];
+        distinctBatch->mask()[distinctBatch->locate(b, i)] = subBatch->mask()[subBatch->locate(firsts[b], i)];
+      }
+    }
+    subBatches.push_back(distinctBatch);
+  }
+  return New<data::CorpusBatch>(subBatches);
+}
+
+std::vector<Ptr<EncoderState>> EncoderDecoder::encode(Ptr<ExpressionGraph> graph,
+                                                      Ptr<data::CorpusBatch> batch) {
+  // during inference the encoders only run on the distinct sources, whose states are then copied to their repetitions
+  std::vector<IndexType> rows;
+  Ptr<data::CorpusBatch> encoderBatch;
+  if(inference_) {
+    std::vector<size_t> streams;
+    for(auto& encoder : encoders_)
+      streams.push_back(encoder->batchIndex());
+    encoderBatch = distinctSources(batch, streams, rows);
+  }
+
+  std::vector<Ptr<EncoderState>> encoderStates;
+  for(auto& encoder : encoders_) {
+    if(encoderBatch) {
+      auto state = encoder->build(graph, encoderBatch);
+      encoderStates.push_back(New<EncoderState>(index_select(state->getContext(), -2, rows),
+                                                index_select(state->getMask(), -2, rows),
+                                                batch));
+    } else {
+      encoderStates.push_back(encoder->build(graph, batch));
+    }
+  }
+  return encoderStates;
+}
+
 Ptr<DecoderState> EncoderDecoder::startState(Ptr<ExpressionGraph> graph,
                                              Ptr<data::CorpusBatch> batch) {
   std::vector<Ptr<EncoderState>> encoderStates;
-  for(auto& encoder : encoders_)
-    encoderStates.push_back(encoder->build(graph, batch));
+  std::swap(encoderStates, encoderStates_); // the states of setEncoderStates() are used once
+  if(encoderStates.empty())
+    encoderStates = encode(graph, batch);
 
   // initialize shortlist here
   if(shortlistGenerator_) {
+    tracing::Span span("shortlist");
     auto shortlist = shortlistGenerator_->generate(batch);
     decoders_[0]->setShortlist(shortlist);
   }
@@ -221,6 +315,9 @@ Ptr<DecoderState> EncoderDecoder::step(Ptr<ExpressionGraph> graph,
 
   // create updated state that reflects reordering and dropping of hypotheses
   state = hypIndices.empty() ? state : state->select(hypIndices, words, batchIndices, beamSize);
+  // per-sentence shortlists drop the same batch entries
+  if(auto shortlist = decoders_[0]->getShortlist())
+    shortlist->select(batchIndices);
 
   // Fill state with embeddings based on last prediction
   decoders_[0]->embeddingsFromPrediction(graph, state, words, (int)batchIndices.size(), beamSize);
@@ -229,6 +326,17 @@ Ptr<DecoderState> EncoderDecoder::step(Ptr<ExpressionGraph> graph,
   return nextState;
 }
 
+Ptr<DecoderState> EncoderDecoder::stepTokens(Ptr<ExpressionGraph> graph,
+                                             Ptr<DecoderState> state,
+                                             const Words& words, // [step * dimBatch + batchIndex]
+                                             int dimBatch,
+                                             int dimSteps) {
+  ABORT_IF(words.size() != (size_t)dimBatch * dimSteps,
+           "Expected {} x {} words for a multi-token step, got {}", dimSteps, dimBatch, words.size());
+  decoders_[0]->embeddingsFromPrediction(graph, state, words, dimBatch, /*dimBeam=*/1, dimSteps);
+  return decoders_[0]->step(graph, state);
+}
+
 Ptr<DecoderState> EncoderDecoder::stepAll(Ptr<ExpressionGraph> graph,
                                           Ptr<data::CorpusBatch> batch,
                                           bool clearGraph) {
@@ -34,6 +34,15 @@ public:
                                  int beamSize)
       = 0;
 
+  // Advance the decoder by several target positions at once without reordering hypotheses,
+  // used for speculative decoding. Beam size is 1, words are laid out as [step, batch index].
+  virtual Ptr<DecoderState> stepTokens(Ptr<ExpressionGraph> graph,
+                                       Ptr<DecoderState> state,
+                                       const Words& words,
+                                       int dimBatch,
+                                       int dimSteps)
+      = 0;
+
   virtual Ptr<Options> getOptions() = 0;
 
   virtual void setShortlistGenerator(
@@ -43,6 +52,9 @@ public:
   virtual Ptr<data::Shortlist> getShortlist() = 0;
 
   virtual data::SoftAlignment getAlignment() = 0;
+
+  // the nodes behind getAlignment(), [tgt index][beam depth, max src length, batch size, 1]
+  virtual std::vector<Expr> getAlignmentNodes() = 0;
 };
 
 class EncoderDecoder : public IEncoderDecoder, public LayerBase {
@@ -57,6 +69,8 @@ protected:
 
   std::set<std::string> modelFeatures_;
 
+  std::vector<Ptr<EncoderState>> encoderStates_; // of setEncoderStates(), used by the next startState()
+
   Config::YamlNode getModelParameters();
   std::string getModelParametersAsString();
 
@@ -85,6 +99,11 @@ public:
                     const std::string& name,
                     bool saveTranslatorConfig = false) override;
 
+  // saves the parameters of several graphs into one model file, e.g. of the stages of --pipeline-parallel
+  void save(const std::vector<Ptr<ExpressionGraph>>& graphs,
+            const std::string& name,
+            bool saveTranslatorConfig = false);
+
   virtual void clear(Ptr<ExpressionGraph> graph) override;
 
   template <typename T>
@@ -122,11 +141,22 @@ public:
     return softAlignments; // [tgt index][beam depth * max src length * batch size]
   };
 
+  virtual std::vector<Expr> getAlignmentNodes() override {
+    return decoders_[0]->getAlignments(); // [tgt index][beam depth, max src length, batch size, 1]
+  }
+
   /*********************************************************************/
 
   virtual Ptr<DecoderState> startState(Ptr<ExpressionGraph> graph,
                                        Ptr<data::CorpusBatch> batch) override;
 
+  // runs the encoders on batch, as startState() does
+  std::vector<Ptr<EncoderState>> encode(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch);
+
+  // the next startState() starts the decoder from these states instead of running the encoders, e.g. with
+  // --pipeline-parallel where the encoders run on another device
+  void setEncoderStates(const std::vector<Ptr<EncoderState>>& encoderStates) { encoderStates_ = encoderStates; }
+
   virtual Ptr<DecoderState> step(Ptr<ExpressionGraph> graph,
                                  Ptr<DecoderState> state,
                                  const std::vector<IndexType>& hypIndices,
@@ -134,6 +164,12 @@ public:
                                  const std::vector<IndexType>& batchIndices,
                                  int beamSize) override;
 
+  virtual Ptr<DecoderState> stepTokens(Ptr<ExpressionGraph> graph,
+                                       Ptr<DecoderState> state,
+                                       const Words& words,
+                                       int dimBatch,
+                                       int dimSteps) override;
+
   virtual Ptr<DecoderState> stepAll(Ptr<ExpressionGraph> graph,
                                     Ptr<data::CorpusBatch> batch,
                                     bool clearGraph = true);
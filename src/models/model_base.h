@@ -5,6 +5,7 @@
 #include "common/io_item.h"
 #include "layers/loss.h"
 #include "layers/generic.h"
+#include "training/training_state.h"
 
 namespace marian {
 namespace models {
@@ -69,6 +70,9 @@ public:
       = 0;
 
   virtual void clear(Ptr<ExpressionGraph> graph) = 0;
+
+  // follows the training progress if the criterion changes during training, registered with the scheduler
+  virtual Ptr<TrainingObserver> getTrainingObserver() { return nullptr; }
 };
 
 }  // namespace models
@@ -19,9 +19,7 @@
 #include "models/comet_qe.h"
 #include "models/bleurt.h"
 
-#ifdef CUDNN
 #include "models/char_s2s.h"
-#endif
 
 #ifdef COMPILE_EXAMPLES
 #include "examples/mnist/model.h"
@@ -40,10 +38,8 @@ Ptr<EncoderBase> EncoderFactory::construct(Ptr<ExpressionGraph> graph) {
   if(options_->get<std::string>("type") == "laser" || options_->get<std::string>("type") == "laser-sim")
     return New<EncoderLaser>(graph, options_);
 
-#ifdef CUDNN
   if(options_->get<std::string>("type") == "char-s2s")
     return New<CharS2SEncoder>(graph, options_);
-#endif
 
   if(options_->get<std::string>("type") == "transformer")
     return NewEncoderTransformer(graph, options_);
@@ -465,8 +461,7 @@ Ptr<IModel> createBaseModelByType(std::string type, usage use, Ptr<Options> opti
   else if(type == "mnist-ffnn")
     return New<MnistFeedForwardNet>(options);
 #endif
-#ifdef CUDNN
-#ifdef COMPILE_EXAMPLES
+#if defined(CUDNN) && defined(COMPILE_EXAMPLES)
   else if(type == "mnist-lenet")
     return New<MnistLeNet>(options);
 #endif
@@ -478,7 +473,6 @@ Ptr<IModel> createBaseModelByType(std::string type, usage use, Ptr<Options> opti
         .push_back(models::decoder()("type", "s2s"))
         .construct(graph);
   }
-#endif
 
   // clang-format on
   else
@@ -520,8 +514,17 @@ Ptr<ICriterionFunction> createCriterionFunctionFromOptions(Ptr<Options> options,
   ABORT_IF(use != usage::training && use != usage::scoring, "'Usage' parameter must be 'training' or 'scoring'");
   // note: usage::scoring means "score the loss function", hence it uses a Trainer (not Scorer, which is for decoding)
   // @TODO: Should we define a new class that does not compute gradients?
-  if (std::dynamic_pointer_cast<EncoderDecoder>(baseModel))
-    return New<Trainer>(baseModel, New<EncoderDecoderCECost>(options));
+  if (auto encdec = std::dynamic_pointer_cast<EncoderDecoder>(baseModel)) {
+    auto trainer = New<Trainer>(baseModel, New<EncoderDecoderCECost>(options));
+    // the candidates of a sampled softmax are a shortlist of each training batch
+    if(use == usage::training && options->get<size_t>("sampled-softmax", 0) > 0) {
+      auto dimVocabs = options->get<std::vector<int>>("dim-vocabs");
+      auto generator = New<data::SampledShortlistGenerator>(options, dimVocabs.size() - 1, dimVocabs.back());
+      encdec->setShortlistGenerator(generator);
+      trainer->setTrainingObserver(generator);
+    }
+    return trainer;
+  }
   else if (std::dynamic_pointer_cast<EncoderClassifier>(baseModel))
     return New<Trainer>(baseModel, New<EncoderClassifierCECost>(options));
 #ifdef COMPILE_EXAMPLES
@@ -54,11 +54,7 @@ public:
     auto context = encoderStates[0]->getContext();
     auto batchMask = encoderStates[0]->getMask();
 
-    // do a max pool here
-    Expr logMask = (1.f - batchMask) * -9999.f;
-    Expr maxPool = max(context * batchMask + logMask, /*axis=*/-3);
-
-    return {maxPool};
+    return {maskedPool(context, batchMask)};
   }
 
   void clear() override {}
@@ -110,8 +106,7 @@ public:
       auto type = options_->get<std::string>("original-type");
       if(type == "laser" || type == "laser-sim") {
         // LASER models do a max pool here
-        Expr logMask = (1.f - batchMask) * -9999.f;
-        pool         = max(context * batchMask + logMask, /*axis=*/-3);
+        pool         = maskedPool(context, batchMask);
       } else if(type == "transformer") { 
         // Our own implementation in transformer.h uses a slice of the first element
         pool         = slice(context, -3, 0);
@@ -128,20 +123,9 @@ public:
     if(!trainRank) { // inference, compute one cosine similarity only
       ABORT_IF(vecs.size() != 2, "We are expecting two inputs for similarity computation");
 
-      // efficiently compute vector length with bdot
-      auto vnorm = [](Expr e) {
-        int dimModel = e->shape()[-1];
-        int dimBatch = e->shape()[-2];
-        e = reshape(e, {dimBatch, 1, dimModel});
-        return reshape(sqrt(bdot(e, e, false, true)), {dimBatch, 1});
-      };
-
-      auto dotProduct = scalar_product(vecs[0], vecs[1], /*axis*/-1);
-      auto length0 = vnorm(vecs[0]); // will be hashed and reused in the graph
-      auto length1 = vnorm(vecs[1]);
-      auto cosine = dotProduct / ( length0 * length1 );
-      cosine = maximum(0, cosine); // clip to [0, 1] - should we actually do that?
-      outputs.push_back(cosine);
+      auto similarity = cosine(vecs[0], vecs[1]);
+      similarity = maximum(0, similarity); // clip to [0, 1] - should we actually do that?
+      outputs.push_back(similarity);
     } else { // compute outputs for embedding similarity ranking
       if(vecs.size() == 2) { // implies we are sampling negative examples from the batch, since otherwise there is nothing to train
         LOG_ONCE(info, "Sampling negative examples from batch");
@@ -12,10 +12,12 @@ class EncoderS2S : public EncoderBase {
   using EncoderBase::EncoderBase;
 public:
   virtual ~EncoderS2S() {}
+  // lengths of the sequences, if given, let the first bidirectional layer run through cuDNN with --rnn-cudnn
   Expr applyEncoderRNN(Ptr<ExpressionGraph> graph,
                        Expr embeddings,
                        Expr mask,
-                       std::string type) {
+                       std::string type,
+                       const std::vector<int>& lengths = {}) {
     int first, second;
     if(type == "bidirectional" || type == "alternating") {
       // build two separate stacks, concatenate top output
@@ -43,7 +45,8 @@ public:
         ("dimState", opt<int>("dim-rnn"))                          //
         ("dropout", dropoutRnn)                                    //
         ("layer-normalization", opt<bool>("layer-normalization"))  //
-        ("skip", opt<bool>("skip"));
+        ("skip", opt<bool>("skip"))                                //
+        ("cudnn", inference_ && opt<bool>("rnn-cudnn", false));
 
     for(int i = 1; i <= first; ++i) {
       auto stacked = rnn::stacked_cell();
@@ -88,9 +91,9 @@ public:
       rnnBw.push_back(stacked);
     }
 
-    auto context = concatenate({rnnFw.construct(graph)->transduce(embeddings, mask),
-                                rnnBw.construct(graph)->transduce(embeddings, mask)},
-                               /*axis =*/ -1);
+    // both directions run in the same steps where their cells allow it
+    auto contexts = rnn::RNN::transduceJointly(rnnFw.construct(graph), rnnBw.construct(graph), embeddings, mask, lengths);
+    auto context = concatenate({contexts.first, contexts.second}, /*axis =*/ -1);
 
     if(second > 0) {
       // add more layers (unidirectional) by transducing the output of the
@@ -130,8 +133,18 @@ public:
     Expr batchEmbeddings, batchMask; std::tie
     (batchEmbeddings, batchMask) = getEmbeddingLayer()->apply((*batch)[batchIndex_]);
 
+    // the sentences are right-padded, the time-major mask gives their lengths
+    std::vector<int> lengths;
+    if(inference_ && opt<bool>("rnn-cudnn", false)) {
+      auto subBatch = (*batch)[batchIndex_];
+      lengths.resize(subBatch->batchSize(), 0);
+      const auto& mask = subBatch->mask();
+      for(size_t i = 0; i < mask.size(); ++i)
+        lengths[i % lengths.size()] += mask[i] != 0.f;
+    }
+
     Expr context = applyEncoderRNN(
-        graph_, batchEmbeddings, batchMask, opt<std::string>("enc-type"));
+        graph_, batchEmbeddings, batchMask, opt<std::string>("enc-type"), lengths);
 
     return New<EncoderState>(context, batchMask, batch);
   }
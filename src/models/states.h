@@ -11,6 +11,7 @@ private:
   Expr context_;
   Expr mask_;  // [beam depth=1, max length, batch size, vector dim=1] source mask
   Ptr<data::CorpusBatch> batch_;
+  std::vector<int> adapters_; // [batch size] low-rank adapter of each active batch entry, see --lora-adapters
 
 public:
   EncoderState(Expr context, Expr mask, Ptr<data::CorpusBatch> batch)
@@ -26,11 +27,18 @@ public:
   // source batch mask; may have additional positions suppressed
   virtual const Words& getSourceWords() { return batch_->front()->data(); }
 
+  const std::vector<int>& getAdapters() const { return adapters_; }
+  void setAdapters(const std::vector<int>& adapters) { adapters_ = adapters; }
+
   // Sub-select active batch entries from encoder context and context mask
   Ptr<EncoderState> select(const std::vector<IndexType>& batchIndices) {  // [batchIndex] indices of active batch entries
     // Dimension -2 is OK for both, RNN and Transformer models as the encoder context in Transformer
     // gets transposed to the same dimension layout
-    return New<EncoderState>(index_select(context_, -2, batchIndices), index_select(mask_, -2, batchIndices), batch_);
+    auto selected = New<EncoderState>(index_select(context_, -2, batchIndices), index_select(mask_, -2, batchIndices), batch_);
+    for(auto batchIndex : batchIndices)
+      if(batchIndex < adapters_.size())
+        selected->adapters_.push_back(adapters_[batchIndex]);
+    return selected;
   }
 };
 
@@ -107,6 +115,22 @@ public:
     return selectedState;
   }
 
+  // Roll a batch-major state back to its first `length` target positions, e.g. to discard
+  // tokens that were rejected during speculative decoding. States are [beam, batch, time, dim].
+  virtual Ptr<DecoderState> truncate(size_t length) const {
+    ABORT_IF(!isBatchMajor_, "Only batch-major decoder states can be truncated");
+    auto keep = [length](Expr x) {
+      return x && x->shape()[-2] != (int)length ? slice(x, -2, Slice(0, (int)length)) : x;
+    };
+    rnn::States truncated;
+    for(const auto& layerState : states_)
+      truncated.push_back(rnn::State({keep(layerState.output), keep(layerState.cell)}));
+
+    auto state = Create(truncated, logProbs_, encStates_, batch_, isBatchMajor_);
+    state->setPosition(length);
+    return state;
+  }
+
   virtual const rnn::States& getStates() const { return states_; }
 
   virtual Expr getTargetHistoryEmbeddings() const { return targetHistoryEmbeddings_; };
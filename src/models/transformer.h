@@ -5,6 +5,9 @@
 
 #include "marian.h"
 
+#include "3rd_party/any_type.h"
+
+#include "data/vocab_base.h"
 #include "layers/constructors.h"
 #include "models/decoder.h"
 #include "models/encoder.h"
@@ -39,24 +42,84 @@ protected:
   // It can be accessed by getAlignments(). @TODO: move into a state or return-value object
   std::vector<Expr> alignments_; // [max tgt len or 1][beam depth, max src length, batch size, 1]
 
+  // With --transformer-packed-ffn, the rows of the unmasked words of the current batch among the
+  // [batch size * max length] rows of a layer, and for each of those rows its row in the packed layer or the number
+  // of unmasked words for padding. Set by packBatch(), nullptr if there is nothing to pack.
+  Expr packRows_, unpackRows_;
+
+  // Converted option values by the address of their key. Graph construction reads the same options for every layer
+  // and, during translation, for every step, so each string literal key is looked up and converted only once. Keys
+  // that are not literals go through the std::string overloads, which are not cached.
+  struct CachedOpt {
+    bool set;
+    any_type value; // empty if the option is not set
+  };
+  mutable std::unordered_map<const char*, CachedOpt> optCache_;
+
+  template <typename T>
+  const CachedOpt& cachedOpt(const char* const key) const {
+    auto it = optCache_.find(key);
+    if(it == optCache_.end()) {
+      bool set = options_->has(key);
+      it = optCache_.emplace(key, CachedOpt{set, set ? any_type(options_->template get<T>(key)) : any_type()}).first;
+    }
+    return it->second;
+  }
+
   // @TODO: make this go away
   template <typename T>
-  T opt(const char* const key) const { Ptr<Options> options = options_; return options->get<T>(key); }
+  T opt(const char* const key) const {
+    const auto& cached = cachedOpt<T>(key);
+    if(cached.set && cached.value.template is<T>())
+      return cached.value.template as<T>();
+    return options_->template get<T>(key); // not set or first read as another type
+  }
 
   template <typename T>
-  T opt(const std::string& key) const { return opt<T>(key.c_str()); }
+  T opt(const std::string& key) const { return options_->template get<T>(key); }
 
   template <typename T>
-  T opt(const char* const key, const T& def) const { Ptr<Options> options = options_; return options->get<T>(key, def);  }
+  T opt(const char* const key, const T& def) const {
+    const auto& cached = cachedOpt<T>(key);
+    if(!cached.set)
+      return def;
+    if(cached.value.template is<T>())
+      return cached.value.template as<T>();
+    return options_->template get<T>(key, def);
+  }
 
   template <typename T>
-  T opt(const std::string& key, const T& def) const { opt<T>(key.c_str(), def); }
+  T opt(const std::string& key, const T& def) const { return options_->template get<T>(key, def); }
 
 public:
-  Transformer(Ptr<ExpressionGraph> graph, Ptr<Options> options) : EncoderOrDecoderBase(graph, options) {}
+  Transformer(Ptr<ExpressionGraph> graph, Ptr<Options> options) : EncoderOrDecoderBase(graph, options) {
+    int numKvHeads = options->get<int>("transformer-heads-kv", 0);
+    ABORT_IF(numKvHeads > 0 && numKvHeads != options->get<int>("transformer-heads"),
+             "--transformer-heads-kv is only supported by --type transformer-new");
+    ABORT_IF(options->get<int>("transformer-moe-experts", 0) > 0,
+             "--transformer-moe-experts is only supported by --type transformer-new");
+  }
 
   static Expr transposeTimeBatch(Expr input) { return transpose(input, {0, 2, 1, 3}); }
 
+  // Prepares the feed-forward layers of the current batch to run on the unmasked words of subBatch only
+  void packBatch(Ptr<data::SubBatch> subBatch) {
+    packRows_ = unpackRows_ = nullptr;
+    if(!subBatch || !opt<bool>("transformer-packed-ffn", false))
+      return;
+
+    auto positions = subBatch->packedPositions();
+    size_t rows = subBatch->batchSize() * subBatch->batchWidth();
+    if(positions.size() == rows) // no padding
+      return;
+
+    std::vector<IndexType> unpack(rows, (IndexType)positions.size()); // padding gets the zero row appended in LayerFFN()
+    for(size_t i = 0; i < positions.size(); ++i)
+      unpack[positions[i]] = (IndexType)i;
+    packRows_ = graph_->indices(positions);
+    unpackRows_ = graph_->indices(unpack);
+  }
+
   Expr addPositionalEmbeddings(Expr input, int start = 0, bool trainPosEmbeddings = false) const {
     int dimEmb   = input->shape()[-1];
     int dimWords = input->shape()[-3];
@@ -125,13 +188,27 @@ public:
     return addPositionalEmbeddings(input, start, trainPosEmbeddings);
   }
 
-  Expr triangleMask(int length) const {
+  // In inference, constant sinusoidal positions are added by the embedding layer together with the lookup and the
+  // scaling of addPositionalEmbeddings() instead of addSpecialEmbeddings(), see Embedding::applyWithPositions().
+  virtual bool fusePositionEmbeddings() const {
+#ifdef USE_ONNX
+    return false;
+#else
+    return inference_ && !opt<bool>("ulr", false)
+           && !opt<bool>("transformer-disable-position-embeddings", false)
+           && !opt<bool>("transformer-train-positions", false);
+#endif
+  }
+
+  // causal mask for `length` new positions preceded by `history` already decoded positions
+  Expr triangleMask(int length, int history = 0) const {
     // fill triangle mask
-    std::vector<float> vMask(length * length, 0);
+    int dimKeys = history + length;
+    std::vector<float> vMask(length * dimKeys, 0);
     for(int i = 0; i < length; ++i)
-      for(int j = 0; j <= i; ++j)
-        vMask[i * length + j] = 1.f;
-    return graph_->constant({1, length, length}, inits::fromVector(vMask));
+      for(int j = 0; j <= history + i; ++j)
+        vMask[i * dimKeys + j] = 1.f;
+    return graph_->constant({1, length, dimKeys}, inits::fromVector(vMask));
   }
 
   // convert multiplicative 1/0 mask to additive 0/-inf log mask, and transpose to match result of bdot() op in Attention()
@@ -188,10 +265,21 @@ public:
 
   Expr postProcess(std::string prefix, std::string ops, Expr input, Expr prevInput, float dropProb = 0.0f) const {
     auto output = input;
-    for(auto op : ops) {
+    for(size_t i = 0; i < ops.size(); ++i) {
+      char op = ops[i];
+      // dropout, skip connection and normalization, fused into one kernel where available
+      if(op == 'd' && i + 2 < ops.size() && ops[i + 1] == 'a' && (ops[i + 2] == 'n' || ops[i + 2] == 'r')) {
+        auto mask = dropProb ? graph_->dropoutMask(dropProb, output->shape().fromAxes({-2, -1})) : nullptr;
+        i += 2;
+        output = ops[i] == 'n' ? addLayerNorm(output, prevInput, prefix, "", mask)
+                               : addRmsNorm(output, prevInput, prefix, "", mask);
+      }
       // dropout
-      if(op == 'd')
+      else if(op == 'd')
         output = dropout(output, dropProb, Shape::Axes({-2, -1}));
+      // skip connection followed by a normalization, fused into one kernel where available
+      else if(op == 'a' && i + 1 < ops.size() && (ops[i + 1] == 'n' || ops[i + 1] == 'r'))
+        output = ops[++i] == 'n' ? addLayerNorm(output, prevInput, prefix) : addRmsNorm(output, prevInput, prefix);
       // skip connection
       else if(op == 'a')
         output = output + prevInput;
@@ -246,23 +334,21 @@ public:
                  int dimBeam = 1) {
     int dk = k->shape()[-1];
 
-    // to avoid mistakenly using the old transformer framework for new features
-    auto maskType = opt<std::string>("transformer-attention-mask", "default");
-    ABORT_IF(maskType != "default",
-             "You specified --transformer-attention-mask={} which is not implemented for legacy Transformer", maskType  );
-
     // softmax over batched dot product of query and keys (applied over all
     // time steps and batch entries), also add mask for illegal connections
 
     // multiplicative attention with flattened softmax
     float scale = 1.0f / std::sqrt((float)dk); // scaling to avoid extreme values due to matrix multiplication
-    auto z = bdot_legacy(q, k, false, true, scale); // [-4: beam depth * batch size, -3: num heads, -2: max tgt length, -1: max src length]
 
-    // mask out garbage beyond end of sequences
-    z = z + mask;
+    // long inputs never materialize the attention matrix in inference, unless the weights are collected
+    int tiledMinKeys = opt<int>("transformer-tiled-attention", 0);
+    if(inference_ && !saveAttentionWeights && tiledMinKeys > 0 && k->shape()[-2] >= tiledMinKeys)
+      return tiledAttention(q, k, v, mask, scale); // [-4: beam depth * batch size, -3: num heads, -2: max tgt length, -1: split vector dim]
 
-    // take softmax along src sequence axis (-1)
-    auto weights = softmax(z); // [-4: beam depth * batch size, -3: num heads, -2: max tgt length, -1: max src length]
+    auto z = bdot_legacy(q, k, false, true, scale); // [-4: beam depth * batch size, -3: num heads, -2: max tgt length, -1: max src length]
+
+    // mask out garbage beyond end of sequences and take softmax along src sequence axis (-1), one kernel on the CPU
+    auto weights = maskedSoftmax(z, mask); // [-4: beam depth * batch size, -3: num heads, -2: max tgt length, -1: max src length]
 
     if(saveAttentionWeights)
       collectOneHead(weights, dimBeam);
@@ -284,20 +370,23 @@ public:
                  const Expr &values, // [-4: beam depth, -3: batch size, -2: max kv length, -1: vector dim]
                  const Expr &mask,   // [-4: batch size, -3: num heads broadcast=1, -2: max length broadcast=1, -1: max length]
                  bool cache = false,
-                 bool saveAttentionWeights = false) {
+                 bool saveAttentionWeights = false,
+                 Expr projectedKeys = nullptr,    // keys and values that are already projected, e.g. by
+                 Expr projectedValues = nullptr) { // DecoderTransformer::projectCrossAttention()
     int dimModel = q->shape()[-1];
     // @TODO: good opportunity to implement auto-batching here or do something manually?
     auto Wq = graph_->param(prefix + "_Wq", {dimModel, dimModel}, inits::glorotUniform(true, true, depthScaling_ ? 1.f / sqrtf((float)depth_) : 1.f));
     auto bq = graph_->param(prefix + "_bq", {       1, dimModel}, inits::zeros());
-    auto qh = affine(q, Wq, bq);
+    auto qh = affine(q, Wq, bq); // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
 
-    qh = SplitHeads(qh, dimHeads); // [-4: beam depth * batch size, -3: num heads, -2: max length, -1: split vector dim]
-
-    Expr kh;
+    // heads are split in MultiHeadProjected()
+    Expr kh = projectedKeys;
     // Caching transformation of the encoder that should not be created again.
     // @TODO: set this automatically by memoizing encoder context and
     // memoization propagation (short-term)
-    if (cache                                                                          // if caching
+    if (kh) {
+      // projected by the caller
+    } else if (cache                                                                   // if caching
         && cache_.count(prefix + "_keys") > 0                                          // and the keys expression has been seen
         && cache_[prefix + "_keys"]->shape().elements() == keys->shape().elements()) { // and the underlying element size did not change
       kh = cache_[prefix + "_keys"];                                                   // then return cached tensor
@@ -307,13 +396,14 @@ public:
       auto Wk = graph_->param(prefix + "_Wk", {dimKeys, dimModel}, inits::glorotUniform(true, true, depthScaling_ ? 1.f / sqrtf((float)depth_) : 1.f));
       auto bk = graph_->param(prefix + "_bk", {1,        dimModel}, inits::zeros());
 
-      kh = affine(keys, Wk, bk);     // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
-      kh = SplitHeads(kh, dimHeads); // [-4: batch size, -3: num heads, -2: max length, -1: split vector dim]
+      kh = affine(keys, Wk, bk); // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
       cache_[prefix + "_keys"] = kh;
     }
 
-    Expr vh;
-    if (cache
+    Expr vh = projectedValues;
+    if (vh) {
+      // projected by the caller
+    } else if (cache
         && cache_.count(prefix + "_values") > 0
         && cache_[prefix + "_values"]->shape().elements() == values->shape().elements()) {
       vh = cache_[prefix + "_values"];
@@ -322,18 +412,51 @@ public:
       auto Wv = graph_->param(prefix + "_Wv", {dimValues, dimModel}, inits::glorotUniform(true, true, depthScaling_ ? 1.f / sqrtf((float)depth_) : 1.f));
       auto bv = graph_->param(prefix + "_bv", {1,        dimModel}, inits::zeros());
 
-      vh = affine(values, Wv, bv); // [-4: batch size, -3: num heads, -2: max length, -1: split vector dim]
-      vh = SplitHeads(vh, dimHeads);
+      vh = affine(values, Wv, bv); // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
       cache_[prefix + "_values"] = vh;
     }
 
-    int dimBeam = q->shape()[-4];
+    return MultiHeadProjected(prefix, dimOut, dimHeads, qh, kh, vh, mask, saveAttentionWeights);
+  }
+
+  // Second half of MultiHead(): attention over already projected queries, keys and values, followed by
+  // the output projection. Used directly by incremental decoder self-attention.
+  Expr MultiHeadProjected(std::string prefix,
+                          int dimOut,
+                          int dimHeads,
+                          Expr q,             // [-4: beam depth, -3: batch size, -2: max q length, -1: vector dim]
+                          Expr k,             // [-4: beam depth, -3: batch size, -2: max kv length, -1: vector dim]
+                          Expr v,             // [-4: beam depth, -3: batch size, -2: max kv length, -1: vector dim]
+                          const Expr& mask,   // [-4: batch size, -3: num heads broadcast=1, -2: max length broadcast=1, -1: max length]
+                          bool saveAttentionWeights = false) {
+    int dimBeam  = q->shape()[-4];
+    int dimBatch = q->shape()[-3];
+    int dimSteps = q->shape()[-2];
+    int dimModel = v->shape()[-1];
 
-    // apply multi-head attention to downscaled inputs
-    auto output
-        = Attention(prefix, qh, kh, vh, mask, saveAttentionWeights, dimBeam); // [-4: beam depth * batch size, -3: num heads, -2: max length, -1: split vector dim]
+    // to avoid mistakenly using the old transformer framework for new features
+    auto maskType = opt<std::string>("transformer-attention-mask", "default");
+    ABORT_IF(maskType != "default",
+             "You specified --transformer-attention-mask={} which is not implemented for legacy Transformer", maskType  );
 
-    output = JoinHeads(output, dimBeam); // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
+    Expr output;
+    int tiledMinKeys = opt<int>("transformer-tiled-attention", 0);
+    bool tiled = !saveAttentionWeights && tiledMinKeys > 0 && k->shape()[-2] >= tiledMinKeys;
+    if(inference_ && !tiled) {
+      // the batched GEMMs read and write the heads in place, without the copies of SplitHeads() and JoinHeads()
+      float scale = 1.0f / std::sqrt((float)(k->shape()[-1] / dimHeads));
+      auto z = bdotSplitHeads(q, k, dimHeads, scale); // [-4: beam depth * batch size, -3: num heads, -2: max tgt length, -1: max src length]
+      auto weights = maskedSoftmax(z, mask);
+      if(saveAttentionWeights)
+        collectOneHead(weights, dimBeam);
+      output = bdotJoinHeads(weights, v, dimHeads);                         // [beam depth * batch size, max length, vector dim]
+      output = reshape(output, {dimBeam, dimBatch, dimSteps, dimModel});    // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
+    } else {
+      // apply multi-head attention to downscaled inputs
+      output = Attention(prefix, SplitHeads(q, dimHeads), SplitHeads(k, dimHeads), SplitHeads(v, dimHeads),
+                         mask, saveAttentionWeights, dimBeam); // [-4: beam depth * batch size, -3: num heads, -2: max length, -1: split vector dim]
+      output = JoinHeads(output, dimBeam); // [-4: beam depth, -3: batch size, -2: max length, -1: vector dim]
+    }
 
     int dimAtt = output->shape()[-1];
 
@@ -377,7 +500,9 @@ public:
                       int dimHeads,
                       bool buggy_prenorm = false,
                       bool cache = false,
-                      bool saveAttentionWeights = false) {
+                      bool saveAttentionWeights = false,
+                      Expr projectedKeys = nullptr,
+                      Expr projectedValues = nullptr) {
     int dimModel = input->shape()[-1];
 
     float dropProb = inference_ ? 0 : opt<float>("transformer-dropout");
@@ -394,7 +519,66 @@ public:
         values = output;
     }
     // multi-head self-attention over previous input
-    output = MultiHead(prefix, dimModel, dimHeads, output, keys, values, mask, cache, saveAttentionWeights);
+    output = MultiHead(prefix, dimModel, dimHeads, output, keys, values, mask, cache, saveAttentionWeights, projectedKeys, projectedValues);
+
+    auto opsPost = opt<std::string>("transformer-postprocess");
+    output = postProcess(prefix + "_Wo", opsPost, output, input, dropProb);
+
+    return output;
+  }
+
+  // Projects (new) keys or values with the self-attention weights of layer 'prefix'. Parameter
+  // names match the ones created in MultiHead().
+  Expr ProjectSelfAttention(std::string prefix, const std::string& kv, Expr input) {
+    int dimModel = input->shape()[-1];
+    auto W = graph_->param(prefix + "_W" + kv, {dimModel, dimModel}, inits::glorotUniform(true, true, depthScaling_ ? 1.f / sqrtf((float)depth_) : 1.f));
+    auto b = graph_->param(prefix + "_b" + kv, {1,        dimModel}, inits::zeros());
+    return affine(input, W, b); // [-4: beam depth, -3: batch size, -2: length, -1: vector dim]
+  }
+
+  // Step-wise decoder self-attention. Instead of the history of layer inputs the decoder state keeps
+  // the already projected keys (in .output) and values (in .cell), so every step only projects the
+  // newest position rather than re-projecting the whole history. Results are identical to the
+  // non-incremental code path below, including its treatment of pre-normalized keys.
+  Expr DecoderLayerSelfAttentionIncremental(rnn::State& decoderLayerState,
+                                            const rnn::State& prevdecoderLayerState,
+                                            std::string prefix,
+                                            Expr input,    // [-4: beam depth, -3: batch size, -2: 1, -1: vector dim]
+                                            Expr selfMask, // already log-mask
+                                            int startPos,
+                                            bool buggy_prenorm = false) {
+    int dimModel = input->shape()[-1];
+    int dimHeads = opt<int>("transformer-heads");
+
+    float dropProb = inference_ ? 0 : opt<float>("transformer-dropout");
+    auto opsPre = opt<std::string>("transformer-preprocess");
+    auto output = preProcess(prefix + "_Wo", opsPre, input, dropProb);
+
+    // The history is built from un-normalized layer inputs. Only at the very first step the
+    // keys are identical to the query (and hence normalized), see LayerAttention().
+    auto keysValuesStep = (startPos == 0 && !buggy_prenorm) ? output : input;
+    auto kStep = ProjectSelfAttention(prefix, "k", keysValuesStep);
+    auto vStep = ProjectSelfAttention(prefix, "v", keysValuesStep);
+
+    Expr kAll = kStep, vAll = vStep;
+    if(startPos > 0) {
+      kAll = concatenate({prevdecoderLayerState.output, kStep}, /*axis=*/-2);
+      vAll = concatenate({prevdecoderLayerState.cell,   vStep}, /*axis=*/-2);
+    }
+
+    if(keysValuesStep == input) {
+      decoderLayerState.output = kAll;
+      decoderLayerState.cell   = vAll;
+    } else { // the history needs to contain the projection of the raw input
+      decoderLayerState.output = ProjectSelfAttention(prefix, "k", input);
+      decoderLayerState.cell   = ProjectSelfAttention(prefix, "v", input);
+    }
+
+    auto Wq = graph_->param(prefix + "_Wq", {dimModel, dimModel}, inits::glorotUniform(true, true, depthScaling_ ? 1.f / sqrtf((float)depth_) : 1.f));
+    auto bq = graph_->param(prefix + "_bq", {       1, dimModel}, inits::zeros());
+    auto qh = affine(output, Wq, bq);
+
+    output = MultiHeadProjected(prefix, dimModel, dimHeads, qh, kAll, vAll, selfMask);
 
     auto opsPost = opt<std::string>("transformer-postprocess");
     output = postProcess(prefix + "_Wo", opsPost, output, input, dropProb);
@@ -411,6 +595,11 @@ public:
                                   bool buggy_prenorm = false) {
     selfMask = transposedLogMask(selfMask);
 
+    // during decoding we advance one (or, for speculative decoding, several) target positions
+    // at a time, keep projected keys and values
+    if(inference_ && (input->shape()[-2] == 1 || startPos > 0))
+      return DecoderLayerSelfAttentionIncremental(decoderLayerState, prevdecoderLayerState, prefix, input, selfMask, startPos, buggy_prenorm);
+
     auto values = input;
     if(startPos > 0) {
       values = concatenate({prevdecoderLayerState.output, input}, /*axis=*/-2);
@@ -447,11 +636,22 @@ public:
     float ffnDropProb = inference_ ? 0 : opt<float>("transformer-dropout-ffn");
     auto initFn = inits::glorotUniform(true, true, depthScaling_ ? 1.f / sqrtf((float)depth_) : 1.f);
 
+    // skip the padding, the FF layers only see the [words, vector dim] rows of the unmasked words
+    bool packed = unpackRows_ && output->shape().elements() == unpackRows_->shape().elements() * dimModel;
+    if(packed)
+      output = rows(flatten_2d(output), packRows_);
+
     // the stack of FF layers
     for(int i = 1; i < depthFfn; ++i)
         output = denseInline(output, prefix, /*suffix=*/std::to_string(i), dimFfn, initFn, actName, ffnDropProb);
     output = denseInline(output, prefix, /*suffix=*/std::to_string(depthFfn), dimModel, initFn);
 
+    // back to the padded layout with zeros for the padding, which the masks hide from everything downstream
+    if(packed) {
+      auto padding = graph_->constant({1, dimModel}, inits::zeros(), output->value_type());
+      output = reshape(rows(concatenate({output, padding}, /*axis=*/-2), unpackRows_), input->shape());
+    }
+
     auto opsPost = opt<std::string>("transformer-postprocess");
     output = postProcess(prefix + "_ffn", opsPost, output, input, dropProb);
 
@@ -507,7 +707,7 @@ public:
     auto output = input;
     if(startPos > 0) {
       // we are decoding at a position after 0
-      output = (prevDecoderState.output * (float)startPos + input) / float(startPos + 1);
+      output = cumulative_average(prevDecoderState.output, input, startPos);
     }
     else if(startPos == 0 && output->shape()[-2] > 1) {
       // we are training or scoring, because there is no history and
@@ -569,6 +769,104 @@ public:
 class EncoderTransformer : public Transformer<EncoderBase> {
   typedef Transformer<EncoderBase> Base;
   using Base::Base;
+
+  // with --frozen-graphs, the built encoder graphs by the width and the size of their batches
+  std::unordered_map<size_t, Ptr<FrozenGraph>> frozenGraphs_;
+
+  // with --transformer-encoder-prefix-cache, the source words of the last single-sentence batch and, on the host, the
+  // projected self-attention keys and values of every layer and the encoder output at its positions
+  struct PrefixCache {
+    Words words;
+    std::vector<std::vector<float>> keys;   // by layer, [length, vector dim]
+    std::vector<std::vector<float>> values; // by layer, [length, vector dim]
+    std::vector<float> context;             // [length, vector dim]
+  };
+  PrefixCache prefixCache_;
+
+  bool usePrefixCache(int dimBatch) const {
+    if(!inference_ || dimBatch != 1 || !opt<bool>("transformer-encoder-prefix-cache", false))
+      return false;
+    ABORT_IF(!opt<bool>("transformer-encoder-causal", false),
+             "--transformer-encoder-prefix-cache requires a model trained with --transformer-encoder-causal");
+    if(graph_->getDefaultElementType() != Type::float32) {
+      LOG_ONCE(warn, "[transformer] --transformer-encoder-prefix-cache only caches float32 encoder states");
+      return false;
+    }
+    return true;
+  }
+
+  // Encodes a single sentence whose first words may be the ones of the previous sentence of this encoder, see
+  // --transformer-encoder-prefix-cache. With causal self-attention the keys, values and outputs at those positions do
+  // not depend on the words after them, so only the remaining positions are encoded, attending to the cached keys
+  // and values. layer and prevLayer are the embeddings of all positions after and before --transformer-postprocess-emb.
+  Ptr<EncoderState> applyWithPrefixCache(Ptr<data::CorpusBatch> batch, Expr layer, Expr prevLayer, Expr batchMask) {
+    const auto& words = (*batch)[batchIndex_]->data();
+    int dimSrcWords = (int)words.size();
+    int dimModel = layer->shape()[-1];
+    auto& cache = prefixCache_;
+
+    // the last position is always encoded, as a sentence needs at least one query
+    int dimPrefix = 0;
+    int maxPrefix = std::min((int)cache.words.size(), dimSrcWords - 1);
+    while(dimPrefix < maxPrefix && cache.words[dimPrefix] == words[dimPrefix])
+      dimPrefix++;
+    int dimNew = dimSrcWords - dimPrefix;
+
+    // prepends the cached states of the prefix to the ones of the new positions, [1, 1, length, vector dim]
+    auto withPrefix = [&](const std::vector<float>& cached, Expr states) {
+      if(dimPrefix == 0)
+        return states;
+      std::vector<float> prefix(cached.begin(), cached.begin() + dimPrefix * dimModel);
+      return concatenate({graph_->constant({1, 1, dimPrefix, dimModel}, inits::fromVector(prefix)), states}, /*axis=*/-2);
+    };
+
+    layer     = slice(layer,     /*axis=*/-2, Slice(dimPrefix, dimSrcWords)); // [1, 1, new length, vector dim]
+    prevLayer = slice(prevLayer, /*axis=*/-2, Slice(dimPrefix, dimSrcWords));
+    auto layerMask = transposedLogMask(triangleMask(dimNew, dimPrefix)); // [1, 1, new length, length], no padding
+
+    auto opsPre = opt<std::string>("transformer-preprocess");
+    auto encDepth = opt<int>("enc-depth");
+    auto buggy_prenorm = opt<bool>("buggy-prenorm", false);
+    std::vector<Expr> keys, values;
+    for(int i = 1; i <= encDepth; ++i) {
+      depth_ = i;
+      auto prefix = prefix_ + "_l" + std::to_string(i) + "_self";
+      // the keys and values are normalized like the query of LayerAttention()
+      auto keysValues = buggy_prenorm ? layer : preProcess(prefix + "_Wo", opsPre, layer, /*dropProb=*/0.f);
+      keys.push_back(withPrefix(i <= (int)cache.keys.size() ? cache.keys[i - 1] : std::vector<float>(),
+                                ProjectSelfAttention(prefix, "k", keysValues)));
+      values.push_back(withPrefix(i <= (int)cache.values.size() ? cache.values[i - 1] : std::vector<float>(),
+                                  ProjectSelfAttention(prefix, "v", keysValues)));
+      layer = LayerAttention(prefix, layer, layer, layer, layerMask, opt<int>("transformer-heads"), buggy_prenorm,
+                             /*cache=*/false, /*saveAttentionWeights=*/false, keys.back(), values.back());
+      layer = LayerFFN(prefix_ + "_l" + std::to_string(i) + "_ffn", layer);
+    }
+    if(!buggy_prenorm)
+      layer = postProcess(prefix_ + "_top", opt<std::string>("transformer-postprocess-top", ""), layer, prevLayer, 0.f);
+    auto output = withPrefix(cache.context, layer); // [1, 1, length, vector dim]
+
+    // the states of all positions are cached for the next sentence, hence forwarded now instead of with the first
+    // decoder step
+    graph_->forward();
+    cache.words = words;
+    cache.keys.resize(encDepth);
+    cache.values.resize(encDepth);
+    for(int i = 0; i < encDepth; ++i) {
+      keys[i]->val()->get(cache.keys[i]);
+      values[i]->val()->get(cache.values[i]);
+    }
+    output->val()->get(cache.context);
+
+    return New<EncoderState>(transposeTimeBatch(output), batchMask, batch);
+  }
+
+  // the only inputs of frozen graphs are the words and the mask of the fused embeddings, see apply()
+  bool freezeGraphs() const {
+    return opt<size_t>("frozen-graphs", 0) > 0 && fusePositionEmbeddings()
+           && !opt<bool>("transformer-packed-ffn", false)
+           && !createFactoredVocab(opt<std::vector<std::string>>("vocabs")[batchIndex_]);
+  }
+
 public:
   EncoderTransformer(Ptr<ExpressionGraph> graph, Ptr<Options> options) : Transformer(graph, options) {
     depthScaling_ = options_->get<bool>("transformer-depth-scaling", false);
@@ -586,13 +884,39 @@ public:
   Ptr<EncoderState> apply(Ptr<data::CorpusBatch> batch) {
     int dimBatch = (int)batch->size();
     int dimSrcWords = (int)(*batch)[batchIndex_]->batchWidth();
+
+    bool prefixCache = usePrefixCache(dimBatch);
+
+    // a batch of the same shape as an earlier one only needs new words and a new mask for the graph of that batch
+    bool freeze = freezeGraphs() && !prefixCache;
+    size_t frozenKey = util::hashArgs(dimSrcWords, dimBatch);
+    if(freeze) {
+      auto it = frozenGraphs_.find(frozenKey);
+      if(it != frozenGraphs_.end()) {
+        auto subBatch = (*batch)[batchIndex_];
+        auto outputs = graph_->replay(it->second, {{"data_0", inits::fromVector(toWordIndexVector(subBatch->data()))},
+                                                   {"data_0_mask", inits::fromVector(subBatch->mask())}});
+        return New<EncoderState>(outputs[0], outputs[1], batch);
+      }
+    }
     // create the embedding matrix, considering tying and some other options
     // embed the source words in the batch
     Expr batchEmbeddings, batchMask;
 
     auto embeddingLayer = getEmbeddingLayer(opt<bool>("ulr", false));
-    std::tie(batchEmbeddings, batchMask) = embeddingLayer->apply((*batch)[batchIndex_]);
-    batchEmbeddings = addSpecialEmbeddings(batchEmbeddings, /*start=*/0, batch);
+    if(fusePositionEmbeddings()) {
+      auto subBatch = (*batch)[batchIndex_];
+      int dimEmb = opt<int>("dim-emb");
+      batchEmbeddings = embeddingLayer->applyWithPositions(subBatch->data(), {dimSrcWords, dimBatch, dimEmb},
+                                                           std::sqrt((float)dimEmb), /*start=*/0);
+      batchMask = graph_->constant({dimSrcWords, dimBatch, 1}, inits::fromVector(subBatch->mask()));
+      batchMask->set_name("data_" + std::to_string(/*batchIndex_=*/0) + "_mask");
+      packBatch(subBatch);
+    } else {
+      std::tie(batchEmbeddings, batchMask) = embeddingLayer->apply((*batch)[batchIndex_]);
+      packBatch((*batch)[batchIndex_]);
+      batchEmbeddings = addSpecialEmbeddings(batchEmbeddings, /*start=*/0, batch);
+    }
 
     // reorganize batch and timestep
     batchEmbeddings = atleast_nd(batchEmbeddings, 4); // [beam depth=1, max length, batch size, vector dim]
@@ -607,8 +931,13 @@ public:
     float dropProb = inference_ ? 0 : opt<float>("transformer-dropout");
     layer = preProcess(prefix_ + "_emb", opsEmb, layer, dropProb);
 
+    if(prefixCache)
+      return applyWithPrefixCache(batch, layer, prevLayer, batchMask);
+
     // LayerAttention expects mask in a different layout
     layerMask = reshape(layerMask, {1, dimBatch, 1, dimSrcWords}); // [1,          batch size,            1,                      max length]
+    if(opt<bool>("transformer-encoder-causal", false))
+      layerMask = layerMask * triangleMask(dimSrcWords);           // [1,          batch size,            max length,             max length]
     layerMask = transposedLogMask(layerMask);                      // [batch size, num heads broadcast=1, max length broadcast=1, max length]
 
     // apply encoder layers
@@ -642,6 +971,12 @@ public:
     // into making this more natural.
     auto context = transposeTimeBatch(layer); // [-4: beam depth=1, -3: max length, -2: batch size, -1: vector dim]
 
+    if(freeze) {
+      if(frozenGraphs_.size() >= opt<size_t>("frozen-graphs"))
+        frozenGraphs_.clear(); // all of them belong to earlier batches of the cleared graph
+      frozenGraphs_[frozenKey] = graph_->freeze({"data_0", "data_0_mask"}, {context, batchMask});
+    }
+
     return New<EncoderState>(context, batchMask, batch);
   }
 
@@ -658,7 +993,69 @@ private:
   // To be removed after refactoring of transformer.h
   std::unordered_map<std::string, Ptr<rnn::RNN>> perLayerRnn_;
 
+  // During inference, the cross-attention keys and values of all decoder layers for the context of one encoder,
+  // projected once per batch by projectCrossAttention() instead of being looked up by name in cache_ at every step.
+  struct CrossAttentionKV {
+    Expr context;              // the encoder context they were projected from
+    std::vector<Expr> keys;    // by decoder layer, [-4: beam depth=1, -3: batch size, -2: max length, -1: vector dim]
+    std::vector<Expr> values;
+  };
+  std::vector<CrossAttentionKV> crossKV_; // by encoder
+
 private:
+  static std::string crossAttentionPrefix(const std::string& layerPrefix, size_t encoder) {
+    std::string prefix = layerPrefix + "_context";
+    if(encoder > 0)
+      prefix += "_enc" + std::to_string(encoder + 1);
+    return prefix;
+  }
+
+  // Projects the keys and values of encoder j's context for all decoder layers with a single GEMM over the
+  // concatenated weights, unless they were already projected from the same context. contextBatchMajor is the
+  // transposed context, [-4: beam depth=1, -3: batch size, -2: max length, -1: vector dim].
+  const CrossAttentionKV& projectCrossAttention(size_t j, Expr context, Expr contextBatchMajor,
+                                                const std::vector<std::string>& layerPrefixes) {
+    if(crossKV_.size() <= j)
+      crossKV_.resize(j + 1);
+    auto& kv = crossKV_[j];
+    if(kv.context == context)
+      return kv;
+
+    int dimKeys  = contextBatchMajor->shape()[-1];
+    int dimModel = opt<int>("dim-emb");
+    std::vector<Expr> weights, biases;
+    bool fuse = true;
+    for(size_t i = 0; i < layerPrefixes.size(); ++i) {
+      depth_ = i + 1; // scales the initialization like MultiHead() would
+      auto prefix = crossAttentionPrefix(layerPrefixes[i], j);
+      for(auto name : {"k", "v"}) {
+        weights.push_back(graph_->param(prefix + "_W" + name, {dimKeys, dimModel}, inits::glorotUniform(true, true, depthScaling_ ? 1.f / sqrtf((float)depth_) : 1.f)));
+        biases.push_back(graph_->param(prefix + "_b" + name, {1, dimModel}, inits::zeros()));
+        fuse = fuse && weights.back()->value_type() == biases.back()->value_type() && isFloat(weights.back()->value_type());
+      }
+    }
+
+    std::vector<Expr> projections;
+    if(fuse) {
+      // [-4: beam depth=1, -3: batch size, -2: max length, -1: 2 * num layers * vector dim], keys and values alternating
+      auto all = affine(contextBatchMajor, concatenate(weights, /*axis=*/-1), concatenate(biases, /*axis=*/-1));
+      for(int p = 0; p < (int)weights.size(); ++p)
+        projections.push_back(slice(all, /*axis=*/-1, Slice(p * dimModel, (p + 1) * dimModel)));
+    } else { // e.g. packed integer weights, which cannot be concatenated
+      for(size_t p = 0; p < weights.size(); ++p)
+        projections.push_back(affine(contextBatchMajor, weights[p], biases[p]));
+    }
+
+    kv.context = context;
+    kv.keys.clear();
+    kv.values.clear();
+    for(size_t p = 0; p < projections.size(); p += 2) {
+      kv.keys.push_back(projections[p]);
+      kv.values.push_back(projections[p + 1]);
+    }
+    return kv;
+  }
+
   // @TODO: move this out for sharing with other models
   void lazyCreateOutputLayer()
   {
@@ -673,6 +1070,7 @@ private:
         "vocab", opt<std::vector<std::string>>("vocabs")[batchIndex_], // for factored outputs
         "output-omit-bias", opt<bool>("output-omit-bias", false),
         "output-approx-knn", opt<std::vector<int>>("output-approx-knn", {}),
+        "chunked-output-loss", opt<int>("chunked-output-loss", 0),
         "lemma-dim-emb", opt<int>("lemma-dim-emb", 0), // for factored outputs
         "lemma-dependency", opt<std::string>("lemma-dependency", ""), // for factored outputs
         "factors-combine", opt<std::string>("factors-combine", "sum")); // for factored outputs
@@ -712,6 +1110,35 @@ public:
     }
   }
 
+  virtual void embeddingsFromBatch(Ptr<ExpressionGraph> graph,
+                                   Ptr<DecoderState> state,
+                                   Ptr<data::CorpusBatch> batch) override {
+    Base::embeddingsFromBatch(graph, state, batch);
+    if(fusePositionEmbeddings()) // e.g. rescoring, the shifted embeddings cannot be fused
+      state->setTargetHistoryEmbeddings(addSpecialEmbeddings(state->getTargetHistoryEmbeddings(), (int)state->getPosition()));
+  }
+
+  virtual void embeddingsFromPrediction(Ptr<ExpressionGraph> graph,
+                                        Ptr<DecoderState> state,
+                                        const Words& words,
+                                        int dimBatch,
+                                        int dimBeam,
+                                        int dimSteps = 1) override {
+    if(!fusePositionEmbeddings() || words.empty()) {
+      Base::embeddingsFromPrediction(graph, state, words, dimBatch, dimBeam, dimSteps);
+      if(fusePositionEmbeddings())
+        state->setTargetHistoryEmbeddings(addSpecialEmbeddings(state->getTargetHistoryEmbeddings(), (int)state->getPosition()));
+      return;
+    }
+
+    graph_ = graph;
+    int dimEmb = opt<int>("dim-emb");
+    auto embeddings = getPredictionEmbeddingLayer()->applyWithPositions(words, {dimBeam, dimSteps, dimBatch, dimEmb},
+                                                                        std::sqrt((float)dimEmb), (int)state->getPosition());
+    state->setTargetHistoryEmbeddings(embeddings);
+    state->setTargetWords(words);
+  }
+
   virtual Ptr<DecoderState> step(Ptr<ExpressionGraph> graph,
                                  Ptr<DecoderState> state) override {
     ABORT_IF(graph != graph_, "An inconsistent graph parameter was passed to step()");
@@ -723,6 +1150,9 @@ public:
     auto embeddings  = state->getTargetHistoryEmbeddings(); // [-4: beam depth=1, -3: max length, -2: batch size, -1: vector dim]
     auto decoderMask = state->getTargetMask();              // [max length, batch size, 1]  --this is a hypothesis
 
+    // teacher-forced training sees the whole target side, which is packed like the source in the encoder
+    packBatch(!inference_ && state->getBatch() ? (*state->getBatch())[batchIndex_] : nullptr);
+
     //************************************************************************//
 
     int dimBeam = 1;
@@ -734,7 +1164,8 @@ public:
     // Used for position embeddings and creating new decoder states.
     int startPos = (int)state->getPosition();
 
-    auto scaledEmbeddings = addSpecialEmbeddings(embeddings, startPos);
+    // embeddingsFromPrediction() already scaled the embeddings and added their positions if they are fused
+    auto scaledEmbeddings = fusePositionEmbeddings() ? embeddings : addSpecialEmbeddings(embeddings, startPos);
     scaledEmbeddings = atleast_nd(scaledEmbeddings, 4);
 
     // reorganize batch and timestep
@@ -750,7 +1181,14 @@ public:
 
     int dimTrgWords = query->shape()[-2];
     int dimBatch    = query->shape()[-3];
-    auto selfMask = triangleMask(dimTrgWords);  // [ (1,) 1, max length, max length]
+    // several new positions on top of a decoded history only occur with speculative decoding
+    bool multiStep = inference_ && startPos > 0 && dimTrgWords > 1;
+    ABORT_IF(multiStep && opt<std::string>("transformer-decoder-autoreg", "self-attention") != "self-attention",
+             "Multi-token decoding steps require a self-attention decoder");
+    ABORT_IF(multiStep && opt<bool>("transformer-train-positions", false),
+             "Multi-token decoding steps are not supported with trained positional embeddings");
+
+    auto selfMask = triangleMask(dimTrgWords, multiStep ? startPos : 0);  // [ (1,) 1, max length, history + max length]
     if(decoderMask) {
       decoderMask = atleast_nd(decoderMask, 4);             // [ 1, max length, batch size, 1 ]
       decoderMask = reshape(transposeTimeBatch(decoderMask),// [ 1, batch size, max length, 1 ]
@@ -758,9 +1196,23 @@ public:
       selfMask = selfMask * decoderMask;
     }
 
+    auto decDepth = opt<int>("dec-depth");
+    std::vector<size_t> tiedLayers = opt<std::vector<size_t>>("transformer-tied-layers",
+                                                              std::vector<size_t>());
+    ABORT_IF(!tiedLayers.empty() && tiedLayers.size() != decDepth,
+             "Specified layer tying for {} layers, but decoder has {} layers",
+             tiedLayers.size(),
+             decDepth);
+
+    std::vector<std::string> layerPrefixes;
+    for(int i = 0; i < decDepth; ++i)
+      layerPrefixes.push_back(prefix_ + "_l" + std::to_string(tiedLayers.empty() ? i + 1 : tiedLayers[i]));
+
     // gather encoder contexts
     std::vector<Expr> encoderContexts;
     std::vector<Expr> encoderMasks;
+    std::vector<const CrossAttentionKV*> crossKV; // projected cross-attention keys and values, during inference
+    bool projectCross = inference_ && !options_->get<bool>("transformer-pool", false);
     for(auto encoderState : state->getEncoderStates()) {
       auto encoderContext = encoderState->getContext(); // encoder output
       auto encoderMask = encoderState->getMask(); // note: may differ from Encoder self-attention mask in that additional positions are banned for cross-attention
@@ -783,6 +1235,9 @@ public:
       if(dimBeam > 1)
         encoderMask = repeat(encoderMask, dimBeam, /*axis=*/ -4);
 
+      if(projectCross)
+        crossKV.push_back(&projectCrossAttention(encoderContexts.size(), encoderState->getContext(), encoderContext, layerPrefixes));
+
       encoderContexts.push_back(encoderContext);
       encoderMasks.push_back(encoderMask);
 
@@ -793,14 +1248,6 @@ public:
     rnn::States prevDecoderStates = state->getStates();
     rnn::States decoderStates;
     // apply decoder layers
-    auto decDepth = opt<int>("dec-depth");
-    std::vector<size_t> tiedLayers = opt<std::vector<size_t>>("transformer-tied-layers",
-                                                              std::vector<size_t>());
-    ABORT_IF(!tiedLayers.empty() && tiedLayers.size() != decDepth,
-             "Specified layer tying for {} layers, but decoder has {} layers",
-             tiedLayers.size(),
-             decDepth);
-
     for(int i = 0; i < decDepth; ++i) {
       depth_ = i + 1;
 
@@ -831,10 +1278,7 @@ public:
       // Iterate over multiple encoders and simply stack the attention blocks
       if(encoderContexts.size() > 0) {
         for(size_t j = 0; j < encoderContexts.size(); ++j) { // multiple encoders are applied one after another
-          std::string prefix
-            = prefix_ + "_l" + layerNo + "_context";
-          if(j > 0)
-            prefix += "_enc" + std::to_string(j + 1);
+          std::string prefix = crossAttentionPrefix(layerPrefixes[i], j);
 
           // if training is performed with guided_alignment or if alignment is requested during
           // decoding or scoring return the attention weights of one head of the last layer.
@@ -866,7 +1310,9 @@ public:
                                    opt<int>("transformer-heads"),
                                    buggy_prenorm,
                                    /*cache=*/true,
-                                   saveAttentionWeights);
+                                   saveAttentionWeights,
+                                   projectCross ? crossKV[j]->keys[i]   : nullptr,
+                                   projectCross ? crossKV[j]->values[i] : nullptr);
           }
         }
       }
@@ -879,11 +1325,41 @@ public:
       query = LayerFFN(prefix_ + "_l" + layerNo + "_ffn", query, /*isDecoder=*/true); // [-4: beam depth=1, -3: batch size, -2: max length, -1: vector dim]
 
       checkpoint(query);
+
+      // Confidence-based early exit: the output layer is applied to this layer as if it was the last one, and if it
+      // is confident enough, the layers above only add the keys and values of this layer's output to their states.
+      if(dimTrgWords == 1 && layerType == "self-attention" && isEarlyExitLayer(i + 1, decDepth)) {
+        auto exitLogits = LayerOutput(query, prevQuery, dropProb);
+        if(confidentToExit(exitLogits.getLogits())) {
+          for(int l = i + 1; l < decDepth; ++l) {
+            depth_ = l + 1;
+            rnn::State prevSkippedState, skippedState;
+            if(prevDecoderStates.size() > 0)
+              prevSkippedState = prevDecoderStates[l];
+            std::string prefix = layerPrefixes[l] + "_self";
+            // the history holds the projections of the raw layer inputs, see DecoderLayerSelfAttentionIncremental()
+            skippedState.output = ProjectSelfAttention(prefix, "k", query);
+            skippedState.cell   = ProjectSelfAttention(prefix, "v", query);
+            if(startPos > 0) {
+              skippedState.output = concatenate({prevSkippedState.output, skippedState.output}, /*axis=*/-2);
+              skippedState.cell   = concatenate({prevSkippedState.cell,   skippedState.cell},   /*axis=*/-2);
+            }
+            decoderStates.push_back(skippedState);
+          }
+          return nextState(state, decoderStates, exitLogits, dimTrgWords, multiStep);
+        }
+      }
     }
 
-    // This allows to run a final layernorm operation after going through the transformer layer stack.
-    // By default the operations are empty, but with prenorm (--transformer-preprocess n --transformer-postprocess da)
-    // it is recommended to normalize here. Can also be used to add a skip connection from the very bottom if requested.
+    auto logits = LayerOutput(query, prevQuery, dropProb); // [-4: beam depth=1, -3: max length, -2: batch size, -1: vocab or shortlist dim]
+    return nextState(state, decoderStates, logits, dimTrgWords, multiStep);
+  }
+
+  // This allows to run a final layernorm operation after going through the transformer layer stack, followed by
+  // the output layer. By default the operations are empty, but with prenorm (--transformer-preprocess n
+  // --transformer-postprocess da) it is recommended to normalize here. Can also be used to add a skip connection
+  // from the very bottom if requested.
+  Logits LayerOutput(Expr query, Expr prevQuery, float dropProb) {
     auto opsTop = opt<std::string>("transformer-postprocess-top", "");
     query = postProcess(prefix_ + "_top", opsTop, query, prevQuery, dropProb);
 
@@ -893,17 +1369,20 @@ public:
     // final feed-forward layer (output)
     if(shortlist_)
       output_->setShortlist(shortlist_);
-    auto logits = output_->applyAsLogits(decoderContext); // [-4: beam depth=1, -3: max length, -2: batch size, -1: vocab or shortlist dim]
+    return output_->applyAsLogits(decoderContext); // [-4: beam depth=1, -3: max length, -2: batch size, -1: vocab or shortlist dim]
+  }
 
+  Ptr<DecoderState> nextState(Ptr<DecoderState> state, const rnn::States& decoderStates, const Logits& logits,
+                              int dimTrgWords, bool multiStep) {
     // return unormalized(!) probabilities
-    Ptr<DecoderState> nextState;
+    Ptr<DecoderState> next;
     if (opt<std::string>("transformer-decoder-autoreg", "self-attention") == "rnn") {
-      nextState = New<DecoderState>(decoderStates, logits, state->getEncoderStates(), state->getBatch(), state->isBatchMajor());
+      next = New<DecoderState>(decoderStates, logits, state->getEncoderStates(), state->getBatch(), state->isBatchMajor());
     } else {
-      nextState = New<DecoderState>(decoderStates, logits, state->getEncoderStates(), state->getBatch(), state->isBatchMajor());
+      next = New<DecoderState>(decoderStates, logits, state->getEncoderStates(), state->getBatch(), state->isBatchMajor());
     }
-    nextState->setPosition(state->getPosition() + 1);
-    return nextState;
+    next->setPosition(state->getPosition() + (multiStep ? dimTrgWords : 1));
+    return next;
   }
 
   // helper function for guided alignment
@@ -916,6 +1395,7 @@ public:
     if (output_)
       output_->clear();
     cache_.clear();
+    crossKV_.clear();
     alignments_.clear();
     perLayerRnn_.clear(); // this needs to be cleared between batches.
     // @TODO: figure out how to detect stale nodes i.e. nodes that are referenced,
@@ -11,6 +11,15 @@
 
 namespace marian {
 
+// Adds the low-rank adapters of --lora-rank to the linear layers of layer, one for each of --lora-adapters
+static inline void addAdaptersFromOptions(Ptr<nn::Layer> layer, Ptr<Options> options) {
+  int rank = options->get<int>("lora-rank", 0);
+  if(rank <= 0)
+    return;
+  size_t adapters = options->get<std::vector<std::string>>("lora-adapters", {}).size();
+  nn::addAdapters(layer, rank, options->get<float>("lora-alpha", 16.f), (int)std::max(adapters, (size_t)1));
+}
+
 // Wrapper for backwards compatibility that uses current encoder/decoder framework
 struct TransformerBatchEncoder : public nn::LayerWithOptions,
                                  public nn::IEmbeddingLayer,  // TransformerBatchEncoder is an IEmbeddingLayer that produces contextual embeddings
@@ -24,6 +33,7 @@ struct TransformerBatchEncoder : public nn::LayerWithOptions,
   {
     encoder = New<nn::TransformerEncoder>(graph, options);
     registerLayer(encoder);
+    addAdaptersFromOptions(encoder, options);
   }
 
   // @TODO: subBatch should be of type Expr
@@ -59,8 +69,11 @@ struct TransformerBatchEncoder : public nn::LayerWithOptions,
     ABORT_IF(this->graph() != graph, "Graph used for construction and graph parameter do not match");
 #endif
 
+    nn::selectAdapters(encoder, batch->getAdapters());
     const auto& [batchEmbedding, batchMask] = apply((*batch)[batchIndex_]);
-    return New<EncoderState>(batchEmbedding, batchMask, batch);
+    auto state = New<EncoderState>(batchEmbedding, batchMask, batch);
+    state->setAdapters(batch->getAdapters());
+    return state;
   }
 
   virtual void clear() override {
@@ -106,6 +119,7 @@ public:
 
     decoder = New<nn::TransformerDecoder>(graph, options);
     registerLayer(decoder);
+    addAdaptersFromOptions(decoder, options);
 
   }
 
@@ -158,23 +172,49 @@ public:
 
     //************************************************************************//
 
+    ABORT_IF(state->getPosition() > 0 && embeddings->shape()[-3] > 1,
+             "Multi-token decoding steps are not supported by the new transformer layers");
+
     // Convert old style decoder state to new decoder state
     using namespace models;
     usage modelUsage = (usage)db::opt<int>("usage", (int)usage::translation);
     auto nnState = convertDecoderState(state, graph(), /*decoding=*/modelUsage == usage::translation);
-    auto decoderContext = decoder->apply(embeddings, decoderMask, nnState);
 
-    // final feed-forward layer (output)
     if(shortlist_)
       output_->setShortlist(shortlist_);
-    auto logits = output_->applyAsLogits(decoderContext); // [-4: beam depth=1, -3: max length, -2: batch size, -1: vocab or shortlist dim]
+
+    // the adapters of the batch entries that are still being decoded
+    nn::selectAdapters(decoder, state->getEncoderStates()[0]->getAdapters());
+
+    // Confidence-based early exit, the output layer is applied to the layers that the step may end after
+    Logits logits;
+    bool exited = false;
+    nn::TransformerDecoder::EarlyExitFunc earlyExit;
+    size_t decDepth = db::opt<size_t>("dec-depth");
+    auto autoRegressionType = db::opt<std::string>("transformer-decoder-autoreg", "self-attention");
+    if(embeddings->shape()[-3] == 1 && (autoRegressionType == "self-attention" || autoRegressionType == "average-attention")) {
+      earlyExit = [&](size_t layer, Expr output) {
+        if(!isEarlyExitLayer(layer, decDepth))
+          return false;
+        logits = output_->applyAsLogits(output);
+        exited = confidentToExit(logits.getLogits());
+        return exited;
+      };
+    }
+    auto decoderContext = decoder->apply(embeddings, decoderMask, nnState, earlyExit);
+
+    // final feed-forward layer (output)
+    if(!exited)
+      logits = output_->applyAsLogits(decoderContext); // [-4: beam depth=1, -3: max length, -2: batch size, -1: vocab or shortlist dim]
 
     // Convert new style decoder state to old decoder state
     // @TODO: This is such a mess!
     rnn::States decoderStates;
     for(auto layerState : *nnState->as<nn::DecoderStateList>()) {
-      auto cellState = layerState->as<nn::DecoderStateItem>()->get();
-      decoderStates.push_back(rnn::State({ cellState, cellState }));
+      auto item = layerState->as<nn::DecoderStateItem>();
+      auto cellState = item->get();
+      auto auxState  = item->getAux();
+      decoderStates.push_back(rnn::State({ cellState, auxState ? auxState : cellState }));
     }
     // return unnormalized(!) probabilities
     return state->next(decoderStates, logits);
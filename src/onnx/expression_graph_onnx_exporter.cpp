@@ -5,11 +5,37 @@
 #include "models/model_factory.h"
 #include "models/encoder_decoder.h"
 #include "data/corpus_base.h"
+#include "data/shortlist.h"
 #include "tensors/cpu/expression_graph_packable.h"
 
 #include <memory>
+#include <numeric>
 
 namespace marian {
+  // A shortlist of the first words of the vocabulary, whose indices become the input shortlist_indices
+  // of the decoder steps
+  class ONNXShortlist : public data::Shortlist {
+    static std::vector<WordIndex> firstWords(size_t size) {
+      std::vector<WordIndex> indices(size);
+      std::iota(indices.begin(), indices.end(), 0);
+      return indices;
+    }
+
+  public:
+    ONNXShortlist(size_t size) : Shortlist(firstWords(size)) {}
+
+    // the indices that the output layer reads, once the first decoder step has been run
+    Expr indices() const { return indicesExpr_; }
+  };
+
+  class ONNXShortlistGenerator : public data::ShortlistGenerator {
+    Ptr<ONNXShortlist> shortlist_;
+
+  public:
+    ONNXShortlistGenerator(Ptr<ONNXShortlist> shortlist) : shortlist_(shortlist) {}
+    Ptr<data::Shortlist> generate(Ptr<data::CorpusBatch> /*batch*/) const override { return shortlist_; }
+  };
+
   // The goal is to export three functions:
   //  - encode_source(): encodes the source
   //                     output: encoder_state
@@ -29,11 +55,22 @@ namespace marian {
   //  - Dynamic objects that depend on the input are not supported.
   //    For example constants whose shape depends on the input length.
   //    That's why we had to change the sinusoidal embeddings from a constant to a computation.
-  //  - The input length is represented by a "unique" dimension value (97). This brittle.
-  //    That dimension value must not occur naturally in the model.
-  //    That dimension must also not be used in dimension calculations.
-  //    E.g. the exporter does not recognize if a constant is added to it, or if it gets multiplied.
-  void ExpressionGraphONNXExporter::exportToONNX(const std::string& modelToPrefix, Ptr<Options> modelOptions, const std::vector<std::string>& vocabPaths)
+  //  - The dynamic axes (source length, batch size, lengths of the decoder state and shortlist size)
+  //    are represented by "unique" dimension values (97, 89, 73 and 74, 83). This is brittle.
+  //    These dimension values must not occur naturally in the model.
+  //    They must also not be used in dimension calculations other than multiplications in Reshape.
+  //    E.g. the exporter does not recognize if a constant is added to it.
+  // Decoder states are inputs and outputs of the decoder steps. For transformers, these are the projected
+  // self-attention keys and values of all previous target positions of each layer (the KV cache):
+  // past_keys_L and past_values_L of [1, BATCH_SIZE, PAST_LENGTH, dimModel] are read by decode_next(), which
+  // returns present_keys_L and present_values_L of PRESENT_LENGTH = PAST_LENGTH + 1.
+  // There is no separate beam axis: a beam search runs the hypotheses of all sentences as entries of the batch,
+  // repeats the encoder contexts and masks for them and reorders the decoder states along the batch axis.
+  // If shortlisted, the decoder steps compute the logits of the words of the input shortlist_indices only.
+  // With int8, the MatMuls with the weights of affine layers become MatMulIntegers of dynamically quantized
+  // activations and int8 weights with per-column scales, which ONNX Runtime runs with int8 kernels.
+  void ExpressionGraphONNXExporter::exportToONNX(const std::string& modelToPrefix, Ptr<Options> modelOptions, const std::vector<std::string>& vocabPaths,
+                                                 bool shortlisted, bool int8, float quantizeRange)
   {
     auto graph = shared_from_this();
 
@@ -62,10 +99,36 @@ namespace marian {
       outputBiasVal->set(outputBiasVec);
     }
 
-    // the input length is represented by a value that hopefully is not used elsewhere
-    const size_t sentinelDim = 97;  // who uses prime numbers as dimensions anyways!
+    // the dynamic axes are represented by values that hopefully are not used elsewhere
+    // who uses prime numbers as dimensions anyways!
+    const size_t sourceLengthDim  = 97;
+    const size_t batchDim         = 89;
+    const size_t shortlistDim     = 83;
+    const size_t pastLengthDim    = 73;  // of the decoder states that decode_next() reads
+    const size_t presentLengthDim = pastLengthDim + 1;  // and returns
+    DynamicAxes dynamicAxes = {{sourceLengthDim,  "SOURCE_LENGTH"},
+                               {batchDim,         "BATCH_SIZE"},
+                               {pastLengthDim,    "PAST_LENGTH"},
+                               {presentLengthDim, "PRESENT_LENGTH"}};
     size_t numEncoders = vocabs.size() - 1;  // @TODO: test this exporter for >1 encoder
 
+    Ptr<ONNXShortlist> shortlist;
+    if (shortlisted) {
+      ABORT_IF(vocabs.back()->size() <= shortlistDim, "The target vocabulary is too small for a shortlisted export");
+      dynamicAxes[shortlistDim] = "SHORTLIST_SIZE";
+      shortlist = New<ONNXShortlist>(shortlistDim);
+      model->setShortlistGenerator(New<ONNXShortlistGenerator>(shortlist));
+    }
+
+    std::vector<IndexType> batchIndices(batchDim);
+    std::iota(batchIndices.begin(), batchIndices.end(), 0);
+    auto randWords = [&]() {
+      Words words(batchDim);
+      for (auto& word : words)
+        word = vocabs.back()->randWord();
+      return words;
+    };
+
     // some helper functions
     auto extractInputByName = [&](const std::string& name) {
       auto expr = tryFindForwardNodeByName(name);
@@ -87,11 +150,14 @@ namespace marian {
       }
       return embeddingInputs;
     };
-    auto extractStates = [&](Ptr<DecoderState> decoderState) {
-      std::vector<Expr> states;  // all decoder-state Exprs in a long list
+    // all decoder-state Exprs in a long list, for transformers the keys and values of each layer
+    bool isTransformer = modelOptions->get<std::string>("type") == "transformer";
+    auto extractStates = [&](Ptr<DecoderState> decoderState, const std::string& prefix) {
+      std::vector<std::pair<std::string, Expr>> states;
       for (const auto& d : decoderState->getStates()) {
-        states.push_back(d.output);
-        states.push_back(d.cell);
+        auto layer = std::to_string(states.size() / 2);
+        states.emplace_back(isTransformer ? prefix + "_keys_"   + layer : prefix + "_decoder_state_" + std::to_string(states.size()), d.output);
+        states.emplace_back(isTransformer ? prefix + "_values_" + layer : prefix + "_decoder_state_" + std::to_string(states.size()), d.cell);
       }
       return states;
     };
@@ -100,7 +166,7 @@ namespace marian {
     // This adds the operations to the tape.
     std::vector<Ptr<data::SubBatch>> subBatches;
     for (size_t batchIndex = 0; batchIndex < numEncoders; batchIndex++) {
-      auto sb = New<data::SubBatch>(1, sentinelDim, vocabs[batchIndex]);
+      auto sb = New<data::SubBatch>(batchDim, sourceLengthDim, vocabs[batchIndex]);
       // set word indices to random values
       std::transform(sb->data().begin(), sb->data().end(), sb->data().begin(),
         [&](Word) -> Word { return vocabs[batchIndex]->randWord(); });
@@ -121,13 +187,24 @@ namespace marian {
     // run it further until the first prediction --> decode_first()
     // This adds more operations to the tape.
     auto decodeFirstState = model->step(graph, startState, /*hypIndices=*/{},
-      /*words=*/{}, /*batchIndices=*/{ 0 }, /*beamSize=*/1);
+      /*words=*/{}, batchIndices, /*beamSize=*/1);
     auto decodeFirstPosRangeInput = extractInputByName("data_" + std::to_string(numEncoders) + "_posrange");
+    std::vector<std::pair<std::string, Expr>> shortlistInputs;
+    if (shortlist)
+      shortlistInputs.emplace_back("shortlist_indices", shortlist->indices());
+
+    // run it further until the decoder state has PAST_LENGTH positions
+    // These steps are not exported, but their inputs have to be neutralized as well.
+    auto pastState = decodeFirstState;
+    for (size_t length = 1; length < pastLengthDim; length++) {
+      pastState = model->step(graph, pastState, /*hypIndices=*/{}, randWords(), batchIndices, /*beamSize=*/1);
+      extractEmbeddingInputs(/*forEncoder=*/false);
+      extractInputByName("data_" + std::to_string(numEncoders) + "_posrange");
+    }
 
     // run it further until the next prediction --> decode_next()
     // This adds more operations to the tape.
-    auto decodeNextState = model->step(graph, decodeFirstState, /*hypIndices=*/{},
-      /*words=*/{ vocabs.back()->randWord() }, /*batchIndices=*/{ 0 }, /*beamSize=*/1);
+    auto decodeNextState = model->step(graph, pastState, /*hypIndices=*/{}, randWords(), batchIndices, /*beamSize=*/1);
     auto decodeNextEmbeddingInput = extractEmbeddingInputs(/*forEncoder=*/false);
     auto decodeNextPosRangeInput = extractInputByName("data_" + std::to_string(numEncoders) + "_posrange");
 
@@ -146,33 +223,35 @@ namespace marian {
     outputs = encoderContexts;
     functionDefs["encode_source"] = std::make_pair(std::move(inputs), std::move(outputs));
 
-    // descriptor for decode_first(data_1_posrange, encoder_context_0, data_0_mask) -> logits, out_decoder_state_0, out_decoder_state_1, ...
+    // descriptor for decode_first(data_1_posrange, encoder_context_0, data_0_mask[, shortlist_indices]) -> first_logits, present_keys_0, present_values_0, ...
     inputs.emplace_back(decodeFirstPosRangeInput);
     for (size_t i = 0; i < numEncoders; i++) {
       inputs.emplace_back(encoderContexts[i]);
       inputs.emplace_back(encoderEmbeddingInputs[1+2*i]);
     }
+    inputs.insert(inputs.end(), shortlistInputs.begin(), shortlistInputs.end());
     outputs.emplace_back(std::make_pair("first_logits", decodeFirstState->getLogProbs().getLogits()));
-    for (const auto& dss : extractStates(decodeFirstState))
-      outputs.emplace_back(std::make_pair("first_decoder_state_" + std::to_string(outputs.size()-1), dss));
+    for (const auto& dss : extractStates(decodeFirstState, "present"))
+      outputs.emplace_back(dss);
     functionDefs["decode_first"] = std::make_pair(std::move(inputs), std::move(outputs));
 
-    // descriptor for decode_next(prev_word, data_1_posrange, encoder_context_0, data_0_mask, decoder_state_0, decoder_state_1, ...) -> logits, decoder_state_0, decoder_state_1, ...
+    // descriptor for decode_next(prev_word, data_1_posrange, encoder_context_0, data_0_mask[, shortlist_indices], past_keys_0, past_values_0, ...) -> next_logits, present_keys_0, present_values_0, ...
     inputs.emplace_back(std::make_pair("prev_word", decodeNextEmbeddingInput[0].second));
     inputs.emplace_back(decodeNextPosRangeInput);
     for (size_t i = 0; i < numEncoders; i++) {
       inputs.emplace_back(encoderContexts[i]);
       inputs.emplace_back(encoderEmbeddingInputs[1 + 2 * i]);
     }
-    for (const auto& dss : extractStates(decodeFirstState))
-      inputs.emplace_back(std::make_pair("decoder_state_" + std::to_string(inputs.size() - (numEncoders*2 + 2)), dss));
+    inputs.insert(inputs.end(), shortlistInputs.begin(), shortlistInputs.end());
+    for (const auto& dss : extractStates(pastState, "past"))
+      inputs.emplace_back(dss);
     outputs.emplace_back(std::make_pair("next_logits", decodeNextState->getLogProbs().getLogits()));
-    for (const auto& dss : extractStates(decodeNextState))
-      outputs.emplace_back(std::make_pair("next_decoder_state_" + std::to_string(outputs.size() - 1), dss));
+    for (const auto& dss : extractStates(decodeNextState, "present"))
+      outputs.emplace_back(dss);
     functionDefs["decode_next"] = std::make_pair(std::move(inputs), std::move(outputs));
 
     // now export the sub-graph as given by the function descriptor
-    serializeToONNX(modelToPrefix, std::move(functionDefs), sentinelDim);
+    serializeToONNX(modelToPrefix, std::move(functionDefs), dynamicAxes, int8, quantizeRange);
   }
 }
 
@@ -1,19 +1,38 @@
 #include "graph/expression_graph.h"
 
+#ifdef USE_ONNX
+namespace onnx {
+  class ValueInfoProto;
+  class TensorProto;
+}
+#endif // USE_ONNX
+
 namespace marian {
+  // [sentinel dimension value] -> name of the dynamic ONNX axis it stands for
+  typedef std::map<size_t, std::string> DynamicAxes;
+
   // export of Marian models to ONNX
   class ExpressionGraphONNXExporter : public ExpressionGraph {
 #ifdef USE_ONNX
     public:
-    // export a seq2seq model to a set of ONNX files
-    void exportToONNX(const std::string& modelToPrefix, Ptr<Options> modelOptions, const std::vector<std::string>& vocabPaths);
+    // export a seq2seq model to a set of ONNX files, with the output layer restricted to the words of an input
+    // shortlist_indices if shortlisted, and with int8 weights of the affine layers if int8, quantized with
+    // --quantize-range quantizeRange
+    void exportToONNX(const std::string& modelToPrefix, Ptr<Options> modelOptions, const std::vector<std::string>& vocabPaths,
+                      bool shortlisted = false, bool int8 = false, float quantizeRange = 0.f);
 
   private:
     // [name] -> (vector(name, Expr), vector(name, Expr))
     typedef std::map<std::string, std::pair<std::vector<std::pair<std::string, Expr>>, std::vector<std::pair<std::string, Expr>> >> FunctionDefs;
 
     // serialize the current nodesForward_ to an ONNX file. This operation is destructive.
-    void serializeToONNX(const std::string& filename, FunctionDefs&& functionDefs, size_t sentinelDim);
+    void serializeToONNX(const std::string& filename, FunctionDefs&& functionDefs, const DynamicAxes& dynamicAxes,
+                         bool int8, float quantizeRange);
+
+    // adds the int8 version of weight matrix W for MatMulInteger to the inputs and initializers of an ONNX graph
+    void quantizedWeightsInitializers(Expr W, const std::string& name, float quantizeRange,
+                                      std::vector<onnx::ValueInfoProto>& inputs,
+                                      std::vector<onnx::TensorProto>& initializers);
 
     // find a node on the current forward tape
     Expr tryFindForwardNodeByName(const std::string& nodeName) const;
@@ -5,6 +5,7 @@
 #include "graph/node_operators_unary.h"
 #include "graph/node_operators_binary.h"
 #include "common/version.h"
+#include "tensors/gpu/int8.h"
 #define AuxillaryParseTableField AuxiliaryParseTableField  // in protobuf 3.12, the generated source has a spelling error
 #include "3rd_party/onnx/protobuf/onnx-ml.pb-wrapper.h"
 #include <iostream>
@@ -490,10 +491,15 @@ namespace marian {
 
   using namespace onnx; // all -Proto classes come from here
 
-  const std::string LENGTH_AXIS_NAME = "SOURCE_LENGTH";  // the source length is a named (dynamic) axis with this name
+  // whether a dimension is a dynamic axis or a multiple of one, e.g. the batch size times the number of heads
+  static bool isDynamicDim(size_t dim, const DynamicAxes& dynamicAxes) {
+    return std::any_of(dynamicAxes.begin(), dynamicAxes.end(), [&](const std::pair<const size_t, std::string>& axis) {
+      return dim % axis.first == 0;
+    });
+  }
 
   // C++ port of a subset of https://github.com/onnx/onnx/blob/master/onnx/helper.py
-  static ValueInfoProto makeValueInfoProto(std::string name, TensorProto_DataType dataType, std::vector<size_t> shape, size_t sentinelDim) {
+  static ValueInfoProto makeValueInfoProto(std::string name, TensorProto_DataType dataType, std::vector<size_t> shape, const DynamicAxes& dynamicAxes) {
     ValueInfoProto valueInfo;
     valueInfo.set_name(name);
     auto* valueInfoType = valueInfo.mutable_type();
@@ -501,8 +507,8 @@ namespace marian {
     valueInfoTensorType->set_elem_type(dataType);
     auto* valueInfoTensorTypeShape = valueInfoTensorType->mutable_shape();
     for (auto dim : shape)
-      if (dim == sentinelDim)
-        valueInfoTensorTypeShape->add_dim()->set_dim_param(LENGTH_AXIS_NAME);
+      if (dynamicAxes.find(dim) != dynamicAxes.end())
+        valueInfoTensorTypeShape->add_dim()->set_dim_param(dynamicAxes.at(dim));
       else
         valueInfoTensorTypeShape->add_dim()->set_dim_value(dim);
     return valueInfo;
@@ -653,6 +659,7 @@ namespace marian {
       {"sliceView"              , "Slice"},
       {"shift"                  , "Pad"},
       {"rows"                   , "Gather"},
+      {"cols"                   , "Gather"},
       {"select"                 , "Gather"},
       // The following are never emitted to ONNX. Keep our original type names to avoid special-casing lots of code.
       {"const"                  , "const"},
@@ -721,7 +728,7 @@ namespace marian {
     }
   }
 
-  static void logNode(const NodeProto& node, const std::vector<size_t>& shape, size_t sentinelDim) {
+  static void logNode(const NodeProto& node, const std::vector<size_t>& shape, const DynamicAxes& dynamicAxes) {
     std::string s = node.name() + " = " + node.op_type() + "(";
     auto addComma = [&]() { if (s.back() != '(' && s.back() != '[') s += ", "; };
     for (int i = 0; i < node.input_size(); i++) {
@@ -737,8 +744,8 @@ namespace marian {
     s += (") : [");
     for (auto dim : shape) {
       addComma();
-      if (dim == sentinelDim)
-          s += LENGTH_AXIS_NAME;
+      if (dynamicAxes.find(dim) != dynamicAxes.end())
+          s += dynamicAxes.at(dim);
       else
           s += std::to_string(dim);
     }
@@ -752,7 +759,7 @@ namespace marian {
   static void addExprNode(Expr expr, std::vector<NodeProto>& nodes, std::vector<ValueInfoProto>& inputs,
                           std::vector<TensorProto>& initializers,
                           const std::map<Expr, std::string>& nameOverrides, const InputsMap& inputsMap,
-                          size_t sentinelDim) {
+                          const DynamicAxes& dynamicAxes, const std::set<Expr>& quantizedWeights) {
     // get all children
     // These may reference inputs, and hence must be mapped right here.
     // The original child in this case is not on the tape.
@@ -797,7 +804,7 @@ namespace marian {
       for (auto& dim : shape)
         n *= dim;
       std::vector<float> zeros(n);
-      inputs.      push_back(makeValueInfoProto(paddingName, TensorProto_DataType::TensorProto_DataType_FLOAT, shape, sentinelDim));
+      inputs.      push_back(makeValueInfoProto(paddingName, TensorProto_DataType::TensorProto_DataType_FLOAT, shape, dynamicAxes));
       initializers.push_back(makeTensorProto   (paddingName, TensorProto_DataType::TensorProto_DataType_FLOAT, shape, zeros));
       LOG(info, "Pad constant {}", paddingName);
       // Concat([paddingNode, sliceNode], axis=0)
@@ -809,6 +816,22 @@ namespace marian {
     }
 #endif
 
+    if (op == "MatMul" && quantizedWeights.find(children[1]) != quantizedWeights.end()) {
+      // int8 MatMul as in the dynamic quantization of ONNX Runtime: the activations are quantized per tensor at
+      // runtime and multiplied with the weights quantized per column, see quantizedWeightsInitializers()
+      auto weightName = inputNames[1];
+      nodes.push_back(makeNode("DynamicQuantizeLinear", name + "_Quantize", {inputNames[0]},
+                               {name + "_XQ", name + "_XScale", name + "_XZeroPoint"}));
+      nodes.push_back(makeNode("MatMulInteger", name + "_MatMulInteger",
+                               {name + "_XQ", weightName + "_quantized", name + "_XZeroPoint", weightName + "_zero_point"},
+                               {name + "_MatMulInteger"}));
+      nodes.push_back(makeNode("Cast", name + "_Cast", {name + "_MatMulInteger"}, {name + "_Cast"},
+                               "to", (int)TensorProto_DataType::TensorProto_DataType_FLOAT));
+      nodes.push_back(makeNode("Mul", name + "_Scale", {name + "_XScale", weightName + "_scale"}, {name + "_Scale"}));
+      nodes.push_back(makeNode("Mul", name, {name + "_Cast", name + "_Scale"}, {name}));
+      return;
+    }
+
     auto node = makeNode(op, name, inputNames, {name});
     //LOG(info, "NODE {} {} -> {}", name, expr->type(), E::mapExprOp(expr));
 
@@ -820,12 +843,22 @@ namespace marian {
       *node.add_input() = shapeInputName;
       // create a new input and a new initializer
       auto shape = getExprShape(expr);
+      auto inputShape = getExprShape(children[0]);
       auto shape64 = std::vector<int64_t>(shape.begin(), shape.end());
-      for (auto& dim : shape64)
-        if (dim == (int64_t)sentinelDim)
-          dim = -1;  // means that this one is inferred at runtime
+      bool inferred = false;
+      for (size_t i = 0; i < shape.size(); i++) {
+        if (!isDynamicDim(shape[i], dynamicAxes))
+          continue;
+        if (i < inputShape.size() && inputShape[i] == shape[i])
+          shape64[i] = 0;  // means that this one is copied from the input at runtime
+        else {
+          ABORT_IF(inferred, "Reshape of {} to {} changes more than one dynamic axis", expr->child(0)->shape(), expr->shape());
+          shape64[i] = -1; // means that this one is inferred at runtime
+          inferred = true;
+        }
+      }
       std::vector<size_t> shapeShape{shape.size()}; // ONNX Reshape requires shape in INT64
-      inputs.      push_back(makeValueInfoProto(shapeInputName, TensorProto_DataType::TensorProto_DataType_INT64, shapeShape, sentinelDim));
+      inputs.      push_back(makeValueInfoProto(shapeInputName, TensorProto_DataType::TensorProto_DataType_INT64, shapeShape, dynamicAxes));
       initializers.push_back(makeTensorProto   (shapeInputName, TensorProto_DataType::TensorProto_DataType_INT64, shapeShape, shape64));
       std::string s = shapeInputName;
       for (auto& dim : shape64)
@@ -860,6 +893,10 @@ namespace marian {
       ABORT_IF(expr->shape().size() != 2, "Unexpected input shape for rows()");
       addAttribute(node, "axis", 0);
     }
+    else if (expr->type() == "cols") { // becomes Gather along the last axis, e.g. for the shortlisted output bias
+      ABORT_IF(expr->shape().size() != 2, "Unexpected input shape for cols()");
+      addAttribute(node, "axis", 1);
+    }
     // slice attributes (starts, ends)
     Slice slice;
     if (E::tryGetSliceAttribute<SliceViewNodeOp>(expr, slice)) {
@@ -924,18 +961,51 @@ namespace marian {
     nodes.push_back(node);
   }
 
+  // The int8 weights, per-column scales and zero points of a weight matrix W of shape [K, N] for MatMulInteger,
+  // quantized as for --gemm-type int8gpu, see gpu::int8gemm::QuantizeB()
+  void ExpressionGraphONNXExporter::quantizedWeightsInitializers(Expr W, const std::string& name, float quantizeRange,
+                                                                 std::vector<ValueInfoProto>& inputs,
+                                                                 std::vector<TensorProto>& initializers) {
+    size_t rows = W->shape()[-2];
+    size_t cols = W->shape()[-1];
+    Tensor int8gpu;
+    getTensorAllocator()->allocate(int8gpu, W->shape(), Type::int8gpu);
+    gpu::int8gemm::QuantizeB(int8gpu, W->val(), quantizeRange);
+
+    // int8gpu is stored transposed and followed by the unquantization multipliers of the columns
+    const int8_t* transposed = int8gpu->data<int8_t>();
+    std::vector<int8_t> quantized(rows * cols);
+    for (size_t i = 0; i < rows; i++)
+      for (size_t j = 0; j < cols; j++)
+        quantized[i * cols + j] = transposed[j * rows + i];
+    const float* unquantMults = (const float*)(transposed + rows * cols);
+    std::vector<float> scales(unquantMults, unquantMults + cols);
+    std::vector<int8_t> zeroPoints(cols, 0);
+    getTensorAllocator()->free(int8gpu);
+
+    const auto INT8 = TensorProto_DataType::TensorProto_DataType_INT8;
+    const auto FLOAT = TensorProto_DataType::TensorProto_DataType_FLOAT;
+    inputs.      push_back(makeValueInfoProto(name + "_quantized",  INT8,  {rows, cols}, {}));
+    initializers.push_back(makeTensorProto   (name + "_quantized",  INT8,  {rows, cols}, quantized));
+    inputs.      push_back(makeValueInfoProto(name + "_scale",      FLOAT, {cols}, {}));
+    initializers.push_back(makeTensorProto   (name + "_scale",      FLOAT, {cols}, scales));
+    inputs.      push_back(makeValueInfoProto(name + "_zero_point", INT8,  {cols}, {}));
+    initializers.push_back(makeTensorProto   (name + "_zero_point", INT8,  {cols}, zeroPoints));
+  }
+
   // serialize the nodesForward_ of a graph right after build() into an ONNX-formatted file
   // We declare this to be ONNX operator set 9. @TODO: Which ONNX version does this correspond to?
   // The nodes must only contain operations supported by ONNX, so the caller must first call
   // expandMacroOpsForONNX().
-  // One batch axis can be variable-length. It is recognized via a hack: by a special
-  // dimension value that otherwise never naturally occurs, e.g. a larger prime number.
-  // We will not recognize derivates of this value, such as value+1 or value x another dimension.
-  // @TODO: This presently does not support variable batch dimensions. How does ONNX handle them?
+  // Dynamic axes (source length, batch size, ...) are recognized via a hack: by special
+  // dimension values that otherwise never naturally occur, e.g. larger prime numbers, see DynamicAxes.
+  // Reshape also recognizes multiples of them, such as the batch size x the number of heads,
+  // but we will not recognize other derivates of these values, such as value+1.
   // @TODO: How to handle guided alignment? That's another input. Name? Shape?
   // This is based on the simple example in
   // https://github.com/onnx/onnx/blob/master/onnx/examples/make_model.ipynb
-  void ExpressionGraphONNXExporter::serializeToONNX(const std::string& fileRoot, FunctionDefs&& functionDefs, size_t sentinelDim) {
+  void ExpressionGraphONNXExporter::serializeToONNX(const std::string& fileRoot, FunctionDefs&& functionDefs, const DynamicAxes& dynamicAxes,
+                                                    bool int8, float quantizeRange) {
     GOOGLE_PROTOBUF_VERIFY_VERSION;
 
     // @TODO: expansion must deal with multiple sub-tapes (encoder, init)
@@ -1015,6 +1085,21 @@ namespace marian {
 
       std::vector<ValueInfoProto> inputsParamsAndConstants; // parameters and constants all are considered inputs, just with initializers
 
+      // with int8, the weights of affine layers that are only read by MatMuls are replaced by int8 weights
+      std::set<Expr> quantizedWeights, floatWeights;
+      for (const auto& expr : nodesForward_) {
+        auto children = expr->children();
+        for (size_t i = 0; i < children.size(); i++) {
+          auto child = inputsMap(children[i]);
+          if (child->type() != "param")
+            continue;
+          if (int8 && expr->type() == "dot" && i == 1 && gpu::int8gemm::isConvertible(child->name(), child->shape()))
+            quantizedWeights.insert(child);
+          else
+            floatWeights.insert(child);
+        }
+      }
+
       // Create a the nodes -> array of NodeProto
       std::vector<NodeProto> nodes;
       std::vector<TensorProto> initializers; // constants are inputs with initializers that hold their values. They go here.
@@ -1025,8 +1110,13 @@ namespace marian {
         if (expr->type() == "param" ||
             (expr->type() == "const" && expr->name().find("opRandomUniform_") != 0)) { // leaves are not nodes in ONNX (except for the uniform placeholder @HACKHACK 2)
           //LOG(info, "exporting leaf name {} op {} ({})", getExprName(expr), E::mapExprOp(expr), expr->children().size());
+          if (quantizedWeights.find(expr) != quantizedWeights.end()) {
+            quantizedWeightsInitializers(expr, getExprName(expr, nameOverrides), quantizeRange, inputsParamsAndConstants, initializers);
+            if (floatWeights.find(expr) == floatWeights.end())
+              continue;
+          }
           auto shape = getExprShape(expr);
-          inputsParamsAndConstants.push_back(makeValueInfoProto(getExprName(expr, nameOverrides), getExprDataType(expr), shape, sentinelDim));
+          inputsParamsAndConstants.push_back(makeValueInfoProto(getExprName(expr, nameOverrides), getExprDataType(expr), shape, dynamicAxes));
           // don't create an initializers entry for inputs
           if (std::any_of(inputsMap.begin(), inputsMap.end(), [&](const std::pair<Expr, Expr>& inputMap) {
                 return inputMap.second == expr;
@@ -1043,10 +1133,10 @@ namespace marian {
           initializers.push_back(makeExprTensorProto(expr, nameOverrides));
           continue;      // parameters must become initializers, name=input name
         }
-        addExprNode(expr, nodes, inputsParamsAndConstants, initializers, nameOverrides, inputsMap, sentinelDim);
-        logNode(nodes.back(), getExprShape(expr), sentinelDim);
+        addExprNode(expr, nodes, inputsParamsAndConstants, initializers, nameOverrides, inputsMap, dynamicAxes, quantizedWeights);
+        logNode(nodes.back(), getExprShape(expr), dynamicAxes);
 
-        auto valueInfo = makeValueInfoProto(nodes.back().name(), getExprDataType(expr), getExprShape(expr), sentinelDim);
+        auto valueInfo = makeValueInfoProto(nodes.back().name(), getExprDataType(expr), getExprShape(expr), dynamicAxes);
         if (outputsSet.find(expr) != outputsSet.end())
           outputs.push_back(valueInfo);
         //else // we add expected-shape information, to more easily be able to track down where it may fail
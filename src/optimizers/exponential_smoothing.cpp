@@ -8,6 +8,19 @@
 namespace marian {
 
 void ExponentialSmoothing::updateAvgParams(Tensor paramsAvg, Tensor params, size_t batches, size_t actualBatchTrgWords) {
+  float decayBy = avgDecay(batches, actualBatchTrgWords);
+  using namespace functional;
+  Element(_1 = ((1.f - decayBy) * _1) + (decayBy * _2), paramsAvg, params);
+}
+
+float ExponentialSmoothing::avgDecay(size_t batches, size_t actualBatchTrgWords) {
+  double keep = 1.;
+  for(size_t i = 0; i < mvFreq_ && i <= batches; ++i)
+    keep *= 1. - stepDecay(batches - i, actualBatchTrgWords);
+  return (float)(1. - keep);
+}
+
+float ExponentialSmoothing::stepDecay(size_t batches, size_t actualBatchTrgWords) {
   double beta = 1. - mvDecayBy_;
 
   // correction term if batch size is different from what mvDecayBy_ was specified for
@@ -18,10 +31,8 @@ void ExponentialSmoothing::updateAvgParams(Tensor paramsAvg, Tensor params, size
   }
 
   // reduce effect of decay parameter in early training stages
-  float decayBy = std::max(1.f - (float)beta,
-                           1.f - (float)(batches + 1) / (float)(batches + 10));
-  using namespace functional;
-  Element(_1 = ((1.f - decayBy) * _1) + (decayBy * _2), paramsAvg, params);
+  return std::max(1.f - (float)beta,
+                  1.f - (float)(batches + 1) / (float)(batches + 10));
 }
 
 }  // namespace marian
@@ -17,13 +17,24 @@ public:
       mvDecayBy_ = options->get<float>("exponential-smoothing", 0);
       refBatchTrgWords_ = options->get<size_t>("mini-batch-words-ref", 0); // adjust as if our MB size (in target labels) was this value
       mvAvg_ = (mvDecayBy_ > 0);
+      mvFreq_ = std::max<size_t>(1, options->get<size_t>("exponential-smoothing-freq", 1));
     }
 
 protected:
   void updateAvgParams(Tensor paramsAvg, Tensor params, size_t batches, size_t actualBatchTrgWords);
+  // the factor by which updateAvgParams() moves the average towards the parameters after update batches, as much as
+  // the decays of the last mvFreq_ updates together, the parameters of the updates in between are not averaged
+  float avgDecay(size_t batches, size_t actualBatchTrgWords);
+  // whether the average is updated after update batches
+  bool updatesAvg(size_t batches) const { return mvAvg_ && (batches + 1) % mvFreq_ == 0; }
 
   bool mvAvg_{false};
   float mvDecayBy_{1e-4f};     // decay prior model by this factor
   size_t refBatchTrgWords_{0}; // mvDecayBy_ is specified for this batch size (in target words) (0 means not specified)
+  size_t mvFreq_{1};           // update the average every mvFreq_ updates
+
+private:
+  // the decay of the average after a single update
+  float stepDecay(size_t batches, size_t actualBatchTrgWords);
 };
 }  // namespace marian
@@ -0,0 +1,231 @@
+#include "optimizers/gradient_compressor.h"
+#include "tensors/tensor_operators.h"
+
+#include "functional/functional.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace marian {
+
+// float32 view of shape into buffer at offset
+static Tensor view(Tensor buffer, size_t offset, const Shape& shape) {
+  auto mem = MemoryPiece::New(buffer->memory()->data() + sizeof(float) * offset, sizeof(float) * shape.elements());
+  return TensorBase::New(mem, shape, Type::float32, buffer->getBackend());
+}
+
+// Sets Q^T at random, the same on all devices since they draw the same sequence
+static void randomize(Tensor q, std::mt19937& random) {
+  std::normal_distribution<float> normal(0.f, 1.f);
+  std::vector<float> values(q->size());
+  for(auto& v : values)
+    v = normal(random);
+  q->set(values);
+}
+
+/* Computes the inverse of the Cholesky factor L of gram = P^T P = L L^T, so that the rows of inverse * P^T are
+ * orthonormal. Directions in which P has (almost) no length are dropped instead of amplified, returns false if
+ * any were.
+ * @param gram the [rank, rank] matrix P^T P
+ * @param inverse will contain the [rank, rank] lower triangular matrix L^-1
+ */
+static bool inverseCholeskyFactor(const float* gram, float* inverse, size_t rank) {
+  std::vector<double> L(rank * rank, 0.0), inv(rank * rank, 0.0);
+  double scale = 0;
+  for(size_t i = 0; i < rank; ++i)
+    scale = std::max(scale, (double)gram[i * rank + i]);
+
+  bool full = true;
+  for(size_t j = 0; j < rank; ++j) {
+    double d = gram[j * rank + j];
+    for(size_t k = 0; k < j; ++k)
+      d -= L[j * rank + k] * L[j * rank + k];
+    if(d <= 1e-6 * scale || d <= 0) { // row j stays 0
+      full = false;
+      continue;
+    }
+    L[j * rank + j] = std::sqrt(d);
+    for(size_t i = j + 1; i < rank; ++i) {
+      double s = gram[i * rank + j];
+      for(size_t k = 0; k < j; ++k)
+        s -= L[i * rank + k] * L[j * rank + k];
+      L[i * rank + j] = s / L[j * rank + j];
+    }
+  }
+
+  for(size_t i = 0; i < rank; ++i) {
+    if(L[i * rank + i] == 0)
+      continue;
+    inv[i * rank + i] = 1.0 / L[i * rank + i];
+    for(size_t j = 0; j < i; ++j) {
+      double s = 0;
+      for(size_t k = j; k < i; ++k)
+        s += L[i * rank + k] * inv[k * rank + j];
+      inv[i * rank + j] = -s / L[i * rank + i];
+    }
+  }
+
+  std::copy(inv.begin(), inv.end(), inverse);
+  return full;
+}
+
+GradientCompressor::GradientCompressor(const std::string& mode, size_t rank, size_t devices)
+    : mode_(mode), rank_(rank), devices_(devices), random_(1234) {
+  ABORT_IF(mode_ != "fp16" && mode_ != "powersgd", "Unknown gradient compression {}", mode_);
+  ABORT_IF(mode_ == "powersgd" && rank_ == 0, "PowerSGD gradient compression requires a rank > 0");
+}
+
+void GradientCompressor::lazyInit(Ptr<ExpressionGraph> graph) {
+  if(errorResidual_)
+    return;
+
+  auto grads = graph->params()->grads();
+  ABORT_IF(grads->type() != Type::float32, "Gradient compression requires float32 gradients, not {}", grads->type());
+
+  struct Layout { size_t offset, rows, cols, p, q; };
+  std::vector<Layout> layouts;
+  size_t pSize = 0, qSize = 0, compressed = 0;
+  if(mode_ == "powersgd") {
+    for(auto param : *graph->params()) {
+      auto grad = param->grad();
+      size_t offset = (grad->memory()->data() - grads->memory()->data()) / sizeof(float);
+      size_t cols = grad->shape()[-1];
+      size_t rows = grad->size() / cols;
+      if(rank_ * (rows + cols) < rows * cols) {
+        layouts.push_back({offset, rows, cols, pSize, qSize});
+        pSize += rank_ * rows;
+        qSize += rank_ * cols;
+        compressed += rows * cols;
+      } else {
+        uncompressed_.push_back(grad);
+      }
+    }
+    LOG(info, "Compressing the gradients of {} matrices to rank {} with PowerSGD, {} of {} values are communicated",
+        layouts.size(), rank_, grads->size() - compressed + pSize + qSize, grads->size());
+  } else {
+    LOG(info, "Compressing the gradients to fp16");
+  }
+
+  int numElements = (int)grads->size();
+  std::vector<Shape> shapes = {{1, numElements}};
+  std::vector<Type> types = {Type::float32};
+  if(mode_ == "fp16") {
+    shapes.push_back({1, numElements});
+    types.push_back(Type::float16);
+  } else if(!layouts.empty()) {
+    shapes.push_back({1, (int)pSize});
+    shapes.push_back({1, (int)pSize});
+    shapes.push_back({1, (int)qSize});
+    shapes.push_back({(int)layouts.size(), (int)rank_, (int)rank_});
+    types.resize(shapes.size(), Type::float32);
+  }
+
+  std::vector<size_t> bytes;
+  for(size_t i = 0; i < shapes.size(); ++i)
+    bytes.push_back(requiredBytes(shapes[i], types[i]));
+  auto allocator = New<TensorAllocator>(graph->getBackend());
+  allocator->reserveExact(bytes);
+  allocators_.push_back(allocator);
+
+  allocator->allocate(errorResidual_, shapes[0], types[0]);
+  errorResidual_->set(0);
+  if(mode_ == "fp16") {
+    allocator->allocate(half_, shapes[1], types[1]);
+  } else if(!layouts.empty()) {
+    allocator->allocate(p_, shapes[1]);
+    allocator->allocate(pTemp_, shapes[2]);
+    allocator->allocate(q_, shapes[3]);
+    allocator->allocate(gram_, shapes[4]);
+    for(const auto& l : layouts) {
+      Shape shape = {(int)l.rows, (int)l.cols};
+      matrices_.push_back({view(grads, l.offset, shape),
+                           view(errorResidual_, l.offset, shape),
+                           view(p_, l.p, {(int)rank_, (int)l.rows}),
+                           view(pTemp_, l.p, {(int)rank_, (int)l.rows}),
+                           view(q_, l.q, {(int)rank_, (int)l.cols})});
+    }
+    randomize(q_, random_);
+  }
+}
+
+// Cholesky QR of the summed P of all matrices, with one transfer of their Gram matrices to the host and back
+void GradientCompressor::orthonormalize() {
+  size_t size = rank_ * rank_;
+  for(size_t k = 0; k < matrices_.size(); ++k)
+    Prod(view(gram_, k * size, {(int)rank_, (int)rank_}), matrices_[k].p, matrices_[k].p, false, true, 0.f, 1.f);
+
+  std::vector<float> gram, inverse(gram_->size());
+  gram_->get(gram);
+  std::vector<char> dropped(matrices_.size());
+  for(size_t k = 0; k < matrices_.size(); ++k)
+    dropped[k] = !inverseCholeskyFactor(&gram[k * size], &inverse[k * size], rank_);
+  gram_->set(inverse);
+
+  for(size_t k = 0; k < matrices_.size(); ++k)
+    Prod(matrices_[k].pTemp, view(gram_, k * size, {(int)rank_, (int)rank_}), matrices_[k].p, false, false, 0.f, 1.f);
+  p_->copyFrom(pTemp_);
+
+  dropped_.swap(dropped);
+}
+
+std::vector<Tensor> GradientCompressor::reduce(size_t step, Ptr<ExpressionGraph> graph) {
+  using namespace functional;
+  auto grads = graph->params()->grads();
+
+  if(step == 0) {
+    lazyInit(graph);
+    Element(_1 += _2, grads, errorResidual_); // add the previous error residual to the current gradients
+  }
+
+  if(mode_ == "fp16") {
+    float devices = (float)devices_;
+    if(step == 0) {
+      Element(_1 /= devices, grads);
+      CopyCast(half_, grads);
+      CopyCast(errorResidual_, half_);
+      Element(_1 = (_2 - _1) * devices, errorResidual_, grads); // new error residual = gradients - compressed gradients
+      return {half_};
+    }
+    if(step == 1) {
+      CopyCast(grads, half_);
+      Element(_1 *= devices, grads);
+    }
+    return {};
+  }
+
+  // powersgd
+  if(step == 0) {
+    std::vector<marian::Tensor> summed = uncompressed_;
+    if(!matrices_.empty()) {
+      for(auto& m : matrices_)
+        Prod(m.p, m.q, m.grad, false, true, 0.f, 1.f); // P^T = Q^T M^T
+      summed.push_back(p_);
+    }
+    return summed;
+  }
+  if(matrices_.empty())
+    return {};
+
+  if(step == 1) {
+    orthonormalize();
+    for(auto& m : matrices_) {
+      Prod(m.q, m.p, m.grad, false, false, 0.f, 1.f);    // Q^T = P^T M of this device, summed below
+      m.residual->copyFrom(m.grad);
+      Prod(m.residual, m.p, m.q, true, false, 1.f, -1.f); // new error residual = M - P Q^T
+    }
+    return {q_};
+  }
+
+  if(step == 2) {
+    for(size_t k = 0; k < matrices_.size(); ++k) {
+      auto& m = matrices_[k];
+      Prod(m.grad, m.p, m.q, true, false, 0.f, 1.f); // the sum of M is approximated by P times the sum of Q^T
+      if(dropped_[k])  // the power iteration would not recover the dropped directions, start over
+        randomize(m.q, random_);
+    }
+  }
+  return {};
+}
+
+}  // namespace marian
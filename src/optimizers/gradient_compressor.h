@@ -0,0 +1,64 @@
+#pragma once
+
+#include "graph/expression_graph.h"
+#include "tensors/tensor.h"
+#include "tensors/tensor_allocator.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace marian {
+
+/* Class to compress the gradients that a communicator sums over all devices, with the same error-feedback
+ * mechanism as ModelQuantizer: what the compression of an update loses on a device is added to the gradients of
+ * its next update. Both schemes only need sums, so they replace an all-reduce of the gradients:
+ * - "fp16" sums the gradients in half precision, divided by the number of devices to stay in range;
+ * - "powersgd" sums the gradient M of each matrix as the rank-r approximation P Q^T of PowerSGD
+ *   (Vogels et al., 2019, https://arxiv.org/abs/1905.13727), from one step of power iteration that starts from
+ *   the Q of the previous update. Parameters that a rank-r approximation does not make smaller are summed as they are.
+ * Example, with one compressor per device:
+ *   for(size_t step = 0;; ++step) {
+ *     auto tensors = compressor->reduce(step, graph); // for each device
+ *     if(tensors.empty())
+ *       break;
+ *     // all-reduce tensors with the same index over all devices in place
+ *   }
+ * Afterwards graph->params()->grads() holds the compressed sum. Use the same compressor for the same graph.
+ */
+class GradientCompressor {
+public:
+  GradientCompressor(const std::string& mode, size_t rank, size_t devices);
+
+  // Finishes the all-reduces of step - 1 and returns the tensors that step sums over all devices, or none if the
+  // gradients of graph have been reduced
+  std::vector<Tensor> reduce(size_t step, Ptr<ExpressionGraph> graph);
+
+protected:
+  struct Matrix {
+    Tensor grad;     // view into the gradients, [rows, cols]
+    Tensor residual; // view into errorResidual_
+    Tensor p;        // P^T, [rank, rows], view into p_
+    Tensor pTemp;    // orthonormalized P^T, view into pTemp_
+    Tensor q;        // Q^T, [rank, cols], view into q_
+  };
+
+  void lazyInit(Ptr<ExpressionGraph> graph);
+  void orthonormalize();
+
+  std::string mode_;
+  size_t rank_;
+  size_t devices_;
+
+  std::vector<Ptr<TensorAllocator>> allocators_;
+
+  Tensor errorResidual_; // Tensor to store the error-residual, in the layout of the gradients
+  Tensor half_;          // fp16: the gradients in half precision
+  Tensor p_, pTemp_, q_; // powersgd: the factors of all matrices
+  Tensor gram_;          // powersgd: P^T P of each matrix, and the inverse of its Cholesky factor
+  std::vector<Matrix> matrices_;
+  std::vector<Tensor> uncompressed_; // powersgd: views into the gradients of the other parameters
+  std::vector<char> dropped_;        // powersgd: whether the update lost a direction of P of each matrix
+  std::mt19937 random_;              // powersgd: for Q, seeded the same on all devices
+};
+}  // namespace marian
@@ -8,13 +8,18 @@ namespace marian {
 
 float OptimizerBase::update(Tensor params, Tensor grads, size_t mbSize, float costScaleFactor) {
   int elements = (int)params->size();
+  waitForSmoothing(); // the update overwrites the parameters that are averaged
 
   LOG_ONCE(info, "Parameter type {}, optimization type {}, casting types {}",
            params->type(), optimizerType_, castOptimizerType_);
 
+  // the fused update reads the gradients in their own type and reverses cost scaling itself
+  bool fused = fusedUpdate_ && hasFusedUpdate();
+  LOG_ONCE(info, "[optimizers] Fused parameter update {}", fused ? "enabled" : "disabled");
+
   int numAllocateShards = 0;
   if(mvAvg_) numAllocateShards += 1; // one shard for exp smoothing
-  if(castOptimizerType_) numAllocateShards += 2; // two shards for conversion
+  if(castOptimizerType_) numAllocateShards += fused ? 1 : 2; // two shards for conversion, gradients are not converted if fused
 
   // allocate storage for shards
   if(numAllocateShards > 0 && !baseAlloc_) {
@@ -36,7 +41,8 @@ float OptimizerBase::update(Tensor params, Tensor grads, size_t mbSize, float co
     if(!pm_) {
       // create parameter master copy and temporary gradient shard
       baseAlloc_->allocate(pm_, {1, elements}, optimizerType_);
-      baseAlloc_->allocate(gd_, {1, elements}, optimizerType_);
+      if(!fused)
+        baseAlloc_->allocate(gd_, {1, elements}, optimizerType_);
 
       // keep parameter master copy around and initialize once, converting types
       CopyCast(pm_, params);
@@ -51,13 +57,13 @@ float OptimizerBase::update(Tensor params, Tensor grads, size_t mbSize, float co
     alloc_ = New<Allocator>(pm_->getBackend()->getDeviceId(), size, size);
   }
 
-  if(castOptimizerType_)
+  if(castOptimizerType_ && !fused)
     CopyCast(gd_, grads);
   else
     gd_ = grads;
 
   // reverse cost scaling when used
-  if(costScaleFactor != 1.f)
+  if(costScaleFactor != 1.f && !fused)
     Element(functional::_1 = functional::_1 / costScaleFactor, gd_);
 
   // clip gradients when used
@@ -81,7 +87,34 @@ float OptimizerBase::update(Tensor params, Tensor grads, size_t mbSize, float co
     auto clipAlloc = New<Allocator>(pm_->getBackend()->getDeviceId(), /*bytes=*/prealloc, /*step=*/1024);
     clipper_->setAllocator(clipAlloc);
   }
-  float gNorm = clipper_->clip(gd_); // clip or rescale, report norm from before clipping
+  // On CPUs the average can be updated while the next batch is computed, which only reads the parameters. On GPUs
+  // its kernel runs on the stream of the update.
+  bool smooth = updatesAvg(batchesSeen_);
+  if(mvAvg_ && !fused && !avgThread_ && options_->get<bool>("exponential-smoothing-async", false)) {
+    if(params->getBackend()->getDeviceId().type == DeviceType::cpu)
+      avgThread_.reset(new ThreadPool(1));
+    else
+      LOG_ONCE(warn, "[optimizers] --exponential-smoothing-async only applies to CPU devices");
+  }
+
+  // a norm that is only reported costs a reduction and a wait for its result, 0 is not reported
+  bool skipNorm = !reportNorm_ && std::dynamic_pointer_cast<ReportNormClipper>(clipper_);
+
+  float gNorm;
+  if(fused) {
+    // the gradients are still cost-scaled, so are the clipping threshold and the norm
+    gNorm = skipNorm ? 0.f : clipper_->clip(gd_, costScaleFactor) / costScaleFactor;
+    updateFusedImpl(pm_, gd_,
+                    smooth ? avg_ : nullptr,
+                    castOptimizerType_ ? params : nullptr,
+                    1.f / costScaleFactor,
+                    smooth ? avgDecay(batchesSeen_, mbSize) : 0.f,
+                    mbSize);
+    params->getBackend()->synchronize();
+    return gNorm;
+  }
+
+  gNorm = skipNorm ? 0.f : clipper_->clip(gd_); // clip or rescale, report norm from before clipping
 
   // perform update on master copy with cast gradients
   // if a type cast has been performed. Otherwise the
@@ -89,8 +122,12 @@ float OptimizerBase::update(Tensor params, Tensor grads, size_t mbSize, float co
   updateImpl(pm_, gd_, mbSize);
 
   // if exponential smoothing is used update the average
-  if(mvAvg_)
+  if(smooth && avgThread_) {
+    size_t batches = batchesSeen_;
+    avgUpdate_ = avgThread_->enqueue([this, batches, mbSize]() { updateAvgParams(avg_, pm_, batches, mbSize); });
+  } else if(smooth) {
     updateAvgParams(avg_, pm_, batchesSeen_, mbSize);
+  }
 
   // undo paramter type cast if required
   if(castOptimizerType_)
@@ -104,6 +141,7 @@ float OptimizerBase::update(Tensor params, Tensor grads, size_t mbSize, float co
 void OptimizerBase::swapWithSmoothed(Tensor params) {
   if(!mvAvg_) // no smoothing, don't do anything
     return;
+  waitForSmoothing();
 
   // This assumes that two swaps are going to happen eventually.
   if(castOptimizerType_) {
@@ -124,6 +162,7 @@ void OptimizerBase::swapWithSmoothed(Tensor params) {
 void OptimizerBase::replaceWithSmoothed(Tensor params) {
   if(!mvAvg_) // no smoothing, don't do anything
     return;
+  waitForSmoothing();
 
   // This function will overwrite the original parameters which are then lost.
   if(castOptimizerType_) {
@@ -203,6 +242,7 @@ void OptimizerBase::load(std::vector<io::Item>& items,
       scatterFn(iAvg,
         [&](size_t localDeviceIndex, const char* begin, const char* end) {
           auto opt = opts[localDeviceIndex];
+          opt->waitForSmoothing();
           if(!opt->avg_) { // lazily allocate
             size_t size = end - begin;  // this is size in bytes now
             if(!opt->baseAlloc_) {
@@ -240,6 +280,7 @@ void OptimizerBase::save(std::vector<io::Item>& items,
     io::Item avg = gatherFn(
       [&](size_t localDeviceIndex) {
         auto opt = opts[localDeviceIndex];
+        opt->waitForSmoothing();
         io::Item item;
         opt->avg_->get(item, "exp_smoothing");
         return item;
@@ -370,8 +411,7 @@ void Adagrad::resetStats() {
 }
 
 // Adam
-void Adam::updateImpl(Tensor params, Tensor grads, size_t actualMBSize) {
-  // lazy allocation
+void Adam::lazyAlloc(Tensor params) {
   if(!alloc_) {
     LOG_ONCE(info, "Allocating memory for Adam-specific shards");
     alloc_ = New<TensorAllocator>(params->getBackend());
@@ -388,7 +428,9 @@ void Adam::updateImpl(Tensor params, Tensor grads, size_t actualMBSize) {
     alloc_->allocate(vt_, {1, elements}, params->type());
     vt_->set(0.f);
   }
+}
 
+FusedAdamArgs Adam::nextStep(Type paramType, size_t actualMBSize) {
   double T = 1, Tref = 1;
   if(OptimizerBase::refMBWordsParam_ > 0) {
     T = (double)actualMBSize;
@@ -417,28 +459,40 @@ void Adam::updateImpl(Tensor params, Tensor grads, size_t actualMBSize) {
   denom1_ = (beta1 * denom1_) + (1 - beta1); // momentum smoothing
   denom2_ = (beta2 * denom2_) + (1 - beta2); // RMS normalization
 
+  // make sure eps_ does not drop below minimum value, this is important
+  // when training with mixed precision. Otherwise we divide by 0.
+  // We multiply the minimum by 2 in order to step away from the abyss.
+  eps_ = std::max(NumericLimits<float>(paramType).min * 2.f, eps_);
+
+  FusedAdamArgs args;
+  args.beta1  = (float)beta1;
+  args.beta1c = float(1 - beta1);
+  args.beta2  = (float)beta2;
+  args.beta2c = float(1 - beta2);
+  args.eta    = (float)eta;
+  args.denom1 = (float)denom1_;
+  args.denom2 = (float)denom2_;
+  args.eps    = eps_;
+  args.decay  = (float)decay;
+  return args;
+}
+
+void Adam::updateImpl(Tensor params, Tensor grads, size_t actualMBSize) {
+  lazyAlloc(params);
+  auto args = nextStep(params->type(), actualMBSize);
+
   // numerators. Divide by T to convert ce-sum gradient to avg gradient.
   using namespace functional;
 #if 0 // why the division by T or T^2 here? It's T=1 without mb-ref anyway and we have the adjustment above, also converges a lot(!) slower with T != 1
-  Element(_1 = ((float)beta1 * _1) + float((1 - beta1) / T    ) *  _2,       mt_, grads); // momentum smoothing. At steady state: =smoothed avg gradient
-  Element(_1 = ((float)beta2 * _1) + float((1 - beta2) / T / T) * (_2 * _2), vt_, grads); // RMS normalization.  At steady state: =mean square of the avg gradients
+  Element(_1 = (args.beta1 * _1) + float((1 - beta1) / T    ) *  _2,       mt_, grads); // momentum smoothing. At steady state: =smoothed avg gradient
+  Element(_1 = (args.beta2 * _1) + float((1 - beta2) / T / T) * (_2 * _2), vt_, grads); // RMS normalization.  At steady state: =mean square of the avg gradients
 #else
-  Element(_1 = ((float)beta1 * _1) + float((1 - beta1)) *  _2,       mt_, grads); // momentum smoothing. At steady state: =smoothed avg gradient
-  Element(_1 = ((float)beta2 * _1) + float((1 - beta2)) * (_2 * _2), vt_, grads); // RMS normalization.  At steady state: =mean square of the avg gradients
+  Element(_1 = (args.beta1 * _1) + args.beta1c *  _2,       mt_, grads); // momentum smoothing. At steady state: =smoothed avg gradient
+  Element(_1 = (args.beta2 * _1) + args.beta2c * (_2 * _2), vt_, grads); // RMS normalization.  At steady state: =mean square of the avg gradients
 #endif
 
-  // make sure eps_ does not drop below minimum value, this is important
-  // when training with mixed precision. Otherwise we divide by 0.
-  // We multiply the minimum by 2 in order to step away from the abyss.
-  eps_ = std::max(NumericLimits<float>(params->type()).min * 2.f, eps_);
-
-  // make sure eps_ does not drop below minimum value, this is important
-  // when training with mixed precision. Otherwise we divide by 0.
-  // We multiply the minimum by 2 in order to step away from the abyss.
-  eps_ = std::max(NumericLimits<float>(params->type()).min * 2.f, eps_);
-
   // apply Adam normalization
-  float etaf = (float)eta, denom1f = (float)denom1_, denom2f = (float)denom2_, decayf = (float)decay; // (get casts out of Element expression for readability)
+  float etaf = args.eta, denom1f = args.denom1, denom2f = args.denom2, decayf = args.decay; // (get casts out of Element expression for readability)
   Element(_1 -= etaf                               // learning-rate: x_t = x_{t-1} - \eta * (...)
                 * ((  (     _2 / denom1f)          // momentum-smoothed per-sample gradient: m_{t-1}
                     / (sqrt(_3 / denom2f) + eps_)) // normalize by RMS: \sqrt(v_{t-1})
@@ -449,6 +503,16 @@ void Adam::updateImpl(Tensor params, Tensor grads, size_t actualMBSize) {
           );
 }
 
+// Same arithmetic as updateImpl() and updateAvgParams(), in one kernel over params, grads, mt_, vt_, avg and out
+void Adam::updateFusedImpl(Tensor params, Tensor grads, Tensor avg, Tensor out,
+                           float gradScale, float avgDecay, size_t actualMBSize) {
+  lazyAlloc(params);
+  auto args = nextStep(params->type(), actualMBSize);
+  args.gradScale = gradScale;
+  args.avgDecay = avgDecay;
+  FusedAdam(params, grads, mt_, vt_, avg, out, args);
+}
+
 void Adam::load(std::vector<io::Item>& items,
                 const std::vector<Ptr<OptimizerBase>>& opts,
                 const std::vector<Ptr<Backend>>& backends,
@@ -558,6 +622,408 @@ void Adam::resetStats() {
   denom2_ = 0;
 }
 
+// Adam8bit
+Adam8bit::Adam8bit(Ptr<Options> options) : Adam(options) {
+  ABORT_IF(optimizerType_ != Type::float32, "8-bit Adam requires float32 optimization, not {}", optimizerType_);
+}
+
+void Adam8bit::lazyAllocQuantized(Ptr<Backend> backend, size_t elements) {
+  if(mq_)
+    return;
+
+  LOG_ONCE(info, "Allocating memory for 8-bit Adam-specific shards");
+  if(!alloc_)
+    alloc_ = New<TensorAllocator>(backend);
+
+  int blocks = (int)((elements + Adam8bitCodec::BLOCK - 1) / Adam8bitCodec::BLOCK);
+  alloc_->reserveExact({elements, elements, 2 * blocks * sizeof(float)});
+  alloc_->allocate(mq_, {1, (int)elements}, Type::int8);
+  alloc_->allocate(vq_, {1, (int)elements}, Type::uint8);
+  alloc_->allocate(scales_, {2, blocks}, Type::float32);
+  mq_->set(0.f);
+  vq_->set(0.f);
+  scales_->set(0.f);
+}
+
+void Adam8bit::updateImpl(Tensor params, Tensor grads, size_t actualMBSize) {
+  lazyAllocQuantized(params->getBackend(), params->size());
+  auto args = nextStep(params->type(), actualMBSize);
+  FusedAdam8bit(params, grads, mq_, vq_, scales_, nullptr, nullptr, args);
+}
+
+void Adam8bit::updateFusedImpl(Tensor params, Tensor grads, Tensor avg, Tensor out,
+                               float gradScale, float avgDecay, size_t actualMBSize) {
+  lazyAllocQuantized(params->getBackend(), params->size());
+  auto args = nextStep(params->type(), actualMBSize);
+  args.gradScale = gradScale;
+  args.avgDecay = avgDecay;
+  FusedAdam8bit(params, grads, mq_, vq_, scales_, avg, out, args);
+}
+
+// the first or second moment of an Adam8bit shard in float32, on the host
+static std::vector<float> dequantizeMoment(Tensor quantized, Tensor scales, bool second) {
+  std::vector<float> maxima, values(quantized->size());
+  scales->get(maxima);
+  size_t blocks = maxima.size() / 2;
+  if(second) {
+    std::vector<uint8_t> q;
+    quantized->get(q);
+    for(size_t i = 0; i < q.size(); ++i)
+      values[i] = Adam8bitCodec::decodeV(q[i], maxima[blocks + i / Adam8bitCodec::BLOCK]);
+  } else {
+    std::vector<int8_t> q;
+    quantized->get(q);
+    for(size_t i = 0; i < q.size(); ++i)
+      values[i] = Adam8bitCodec::decodeM(q[i], maxima[i / Adam8bitCodec::BLOCK]);
+  }
+  return values;
+}
+
+// the inverse of dequantizeMoment()
+static void quantizeMoment(const std::vector<float>& values, Tensor quantized, Tensor scales, bool second) {
+  ABORT_IF(values.size() != quantized->size(), "8-bit Adam shard of size {} for a moment of size {}",
+           quantized->size(), values.size());
+  size_t blocks = scales->size() / 2;
+  std::vector<float> maxima(blocks, 0.f);
+  for(size_t i = 0; i < values.size(); ++i)
+    maxima[i / Adam8bitCodec::BLOCK] = std::max(maxima[i / Adam8bitCodec::BLOCK], std::abs(values[i]));
+
+  if(second) {
+    std::vector<uint8_t> q(values.size());
+    for(size_t i = 0; i < q.size(); ++i)
+      q[i] = Adam8bitCodec::encodeV(values[i], maxima[i / Adam8bitCodec::BLOCK]);
+    quantized->set(q);
+  } else {
+    std::vector<int8_t> q(values.size());
+    for(size_t i = 0; i < q.size(); ++i)
+      q[i] = Adam8bitCodec::encodeM(values[i], maxima[i / Adam8bitCodec::BLOCK]);
+    quantized->set(q);
+  }
+  scales->subtensor(second ? blocks : 0, blocks)->set(maxima);
+}
+
+static std::vector<float> floatsFromBytes(const char* begin, const char* end) {
+  std::vector<float> values((end - begin) / sizeof(float));
+  std::copy(begin, end, (char*)values.data());
+  return values;
+}
+
+void Adam8bit::load(std::vector<io::Item>& items,
+                    const std::vector<Ptr<OptimizerBase>>& opts,
+                    const std::vector<Ptr<Backend>>& backends,
+                    const ScatterStateFunc& scatterFn,
+                    bool isMainProcess) {
+  OptimizerBase::load(items, opts, backends, scatterFn, isMainProcess);
+
+  if(isMainProcess)
+    LOG(info, "Loading 8-bit Adam parameters");
+
+  io::Item iMt;
+  io::Item iVt;
+  std::array<double, 2> vDenoms = {0, 0};
+
+  for(auto item : items) {
+    if(item.name == "adam_mt") {
+      iMt = std::move(item);
+    } else if(item.name == "adam_vt") {
+      iVt = std::move(item);
+    } else if(item.name == "adam_denoms") {
+      ABORT_IF(item.size() != 2 * sizeof(double), "adam_denoms should have 2 entries not {} bytes", item.size());
+      std::copy((double*)item.data(), ((double*)item.data()) + 2, vDenoms.begin());
+    }
+  }
+
+  if(iMt.bytes.empty() || iVt.bytes.empty()) {
+    LOG(warn, "[warn] Adam parameters not found in .npz file");
+    return;
+  }
+
+  ABORT_IF(iMt.type != Type::float32 || iVt.type != Type::float32,
+           "8-bit Adam loads float32 moments, not {}", iMt.type);
+  ABORT_IF(iMt.size() != iVt.size(), "mt and vt have different sizes??");
+
+  scatterFn(iMt,
+    [&](size_t localDeviceIndex, const char* begin, const char* end) {
+      auto opt = std::dynamic_pointer_cast<Adam8bit>(opts[localDeviceIndex]);
+
+      // denominators need to be set in all shards, hijack this scatter
+      opt->denom1_ = vDenoms[0];
+      opt->denom2_ = vDenoms[1];
+
+      auto values = floatsFromBytes(begin, end);
+      opt->lazyAllocQuantized(backends[localDeviceIndex], values.size());
+      quantizeMoment(values, opt->mq_, opt->scales_, /*second=*/false);
+    });
+
+  scatterFn(iVt,
+    [&](size_t localDeviceIndex, const char* begin, const char* end) {
+      auto opt = std::dynamic_pointer_cast<Adam8bit>(opts[localDeviceIndex]);
+      quantizeMoment(floatsFromBytes(begin, end), opt->vq_, opt->scales_, /*second=*/true);
+    });
+}
+
+void Adam8bit::save(std::vector<io::Item>& items,
+                    const std::vector<Ptr<OptimizerBase>>& opts,
+                    const GatherStateFunc& gatherFn,
+                    bool isMainProcess) {
+  OptimizerBase::save(items, opts, gatherFn, isMainProcess); // collect parameters from base
+
+  if(isMainProcess)
+    LOG(info, "Saving 8-bit Adam parameters");
+
+  // the dequantized moments, as saved by Adam
+  for(bool second : {false, true}) {
+    io::Item moment = gatherFn(
+      [&](size_t localDeviceIndex) {
+        auto opt = std::dynamic_pointer_cast<Adam8bit>(opts[localDeviceIndex]);
+        return io::fromVector(dequantizeMoment(second ? opt->vq_ : opt->mq_, opt->scales_, second),
+                              second ? "adam_vt" : "adam_mt");
+      });
+    items.emplace_back(std::move(moment));
+  }
+
+  std::vector<double> vDenoms{denom1_, denom2_};
+  items.emplace_back(io::fromVector(vDenoms, "adam_denoms"));
+}
+
+void Adam8bit::resetStats() {
+  if(mq_) {
+    mq_->set(0.f);
+    vq_->set(0.f);
+    scales_->set(0.f);
+  }
+
+  denom1_ = 0;
+  denom2_ = 0;
+}
+
+// Adafactor
+Adafactor::Adafactor(Ptr<Options> options) : OptimizerBase(options) {
+  ABORT_IF(optimizerType_ != Type::float32, "Adafactor requires float32 optimization, not {}", optimizerType_);
+}
+
+// float32 view of shape into buffer at offset
+static Tensor view(Tensor buffer, size_t offset, const Shape& shape) {
+  auto mem = MemoryPiece::New(buffer->memory()->data() + sizeof(float) * offset, sizeof(float) * shape.elements());
+  return TensorBase::New(mem, shape, Type::float32, buffer->getBackend());
+}
+
+void Adafactor::setParameterLayout(Ptr<Parameters> params, size_t offset) {
+  if(hasLayout_)
+    return;
+
+  auto vals = params->vals();
+  for(auto param : *params) {
+    auto val = param->val();
+    size_t cols = val->shape()[-1];
+    size_t rows = val->size() / cols;
+    if(rows > 1 && cols > 1)
+      layout_.push_back({(val->memory()->data() - vals->memory()->data()) / sizeOf(val->type()), rows, cols});
+  }
+  std::sort(layout_.begin(), layout_.end(), [](const Matrix& a, const Matrix& b) { return a.offset < b.offset; });
+  shardOffset_ = offset;
+  hasLayout_ = true;
+}
+
+void Adafactor::lazyInit(Tensor params) {
+  if(stats_)
+    return;
+
+  if(!hasLayout_)
+    LOG_ONCE(warn, "[warn] Adafactor got no parameter layout, the second moments are not factored");
+
+  elements_ = params->size();
+  size_t stats = 0;
+  auto keep = [&](size_t begin, size_t end) {
+    if(begin < end) {
+      segments_.push_back({begin, 1, end - begin, false, 0, 0, stats});
+      stats += end - begin;
+    }
+  };
+
+  // factor the full rows of each matrix in the shard, keep everything in between
+  size_t pos = 0;
+  for(const auto& m : layout_) {
+    size_t begin = std::max(m.offset, shardOffset_ + pos);
+    size_t end = std::min(m.offset + m.rows * m.cols, shardOffset_ + elements_);
+    if(begin >= end)
+      continue;
+    size_t firstRow = (begin - m.offset + m.cols - 1) / m.cols;
+    size_t lastRow = (end - m.offset) / m.cols;
+    if(lastRow < firstRow + 2) // a single row is not smaller factored
+      continue;
+
+    size_t rowsBegin = m.offset + firstRow * m.cols - shardOffset_;
+    size_t rows = lastRow - firstRow;
+    keep(pos, rowsBegin);
+    segments_.push_back({rowsBegin, rows, m.cols, true, stats, stats + rows, 0});
+    stats += rows + m.cols;
+    pos = rowsBegin + rows * m.cols;
+  }
+  keep(pos, elements_);
+
+  scratch_ = stats;
+  stats += 2 * segments_.size();
+  LOG_ONCE(info, "Allocating memory for Adafactor-specific shards, {} values for {} parameters", stats, elements_);
+
+  alloc_ = New<TensorAllocator>(params->getBackend());
+  alloc_->reserveExact(stats * sizeof(float));
+  alloc_->allocate(stats_, {1, (int)stats}, Type::float32);
+  stats_->set(0.f);
+
+  if(!loaded_.empty()) {
+    ABORT_IF(loaded_.size() != elements_, "Adafactor shard of size {} for a second moment of size {}",
+             elements_, loaded_.size());
+    stats_->subtensor(0, scratch_)->set(factor(loaded_));
+    loaded_.clear();
+  }
+}
+
+void Adafactor::updateImpl(Tensor params, Tensor grads, size_t actualMBSize) {
+  actualMBSize; // not used in Adafactor
+  lazyInit(params);
+
+  step_ += 1;
+  float beta2 = 1.f - (float)std::pow(step_, -(double)decayRate_);
+  float eta = eta_, eps = eps_, clip = clip_, decay = w_;
+
+  using namespace functional;
+  for(size_t k = 0; k < segments_.size(); ++k) {
+    const auto& s = segments_[k];
+    marian::Shape shape = {(int)s.rows, (int)s.cols};
+    auto g = view(grads, s.offset, shape);
+    auto p = view(params, s.offset, shape);
+    auto squares = view(stats_, scratch_ + 2 * k + 1, {1, 1});
+
+    // g becomes the update g / sqrt(v)
+    if(s.factored) {
+      auto r = view(stats_, s.rowSums, {(int)s.rows, 1});
+      auto c = view(stats_, s.colSums, {1, (int)s.cols});
+      auto total = view(stats_, scratch_ + 2 * k, {1, 1});
+      Element(_1 = beta2 * _1, r);
+      Add(_1 * _1 + eps, 1.f - beta2, r, g);
+      Element(_1 = beta2 * _1, c);
+      Add(_1 * _1 + eps, 1.f - beta2, c, g);
+      Reduce(_1, total, r);
+      Element(_1 = _1 / sqrt(_2 * _3 / _4), g, r, c, total); // v = r c / sum(r)
+    } else {
+      auto v = view(stats_, s.dense, shape);
+      Element(_1 = beta2 * _1 + (1.f - beta2) * (_2 * _2 + eps), v, g);
+      Element(_1 = _1 / sqrt(_2), g, v);
+    }
+
+    // clip the root mean square of the update to clip_
+    Reduce(_1 * _1, squares, g);
+    float n = (float)(s.rows * s.cols);
+    Element(_1 -= eta * (_2 / max(sqrt(_3 / n) / clip, 1.f) + decay * _1), p, g, squares);
+  }
+}
+
+std::vector<float> Adafactor::expand() {
+  std::vector<float> stats, second(elements_);
+  stats_->get(stats);
+  for(const auto& s : segments_) {
+    if(s.factored) {
+      double total = 0;
+      for(size_t r = 0; r < s.rows; ++r)
+        total += stats[s.rowSums + r];
+      for(size_t r = 0; r < s.rows; ++r)
+        for(size_t c = 0; c < s.cols; ++c)
+          second[s.offset + r * s.cols + c] = total > 0 ? (float)(stats[s.rowSums + r] * stats[s.colSums + c] / total) : 0.f;
+    } else {
+      std::copy(stats.begin() + s.dense, stats.begin() + s.dense + s.cols, second.begin() + s.offset);
+    }
+  }
+  return second;
+}
+
+// the row and column sums of the expanded second moment are the ones it was expanded from
+std::vector<float> Adafactor::factor(const std::vector<float>& second) {
+  std::vector<float> stats(scratch_, 0.f);
+  for(const auto& s : segments_) {
+    if(s.factored) {
+      for(size_t r = 0; r < s.rows; ++r) {
+        for(size_t c = 0; c < s.cols; ++c) {
+          float v = second[s.offset + r * s.cols + c];
+          stats[s.rowSums + r] += v;
+          stats[s.colSums + c] += v;
+        }
+      }
+    } else {
+      std::copy(second.begin() + s.offset, second.begin() + s.offset + s.cols, stats.begin() + s.dense);
+    }
+  }
+  return stats;
+}
+
+void Adafactor::load(std::vector<io::Item>& items,
+                     const std::vector<Ptr<OptimizerBase>>& opts,
+                     const std::vector<Ptr<Backend>>& backends,
+                     const ScatterStateFunc& scatterFn,
+                     bool isMainProcess) {
+  OptimizerBase::load(items, opts, backends, scatterFn, isMainProcess);
+
+  if(isMainProcess)
+    LOG(info, "Loading Adafactor parameters");
+
+  io::Item iVt;
+  double step = 0;
+  for(auto item : items) {
+    if(item.name == "adafactor_vt") {
+      iVt = std::move(item);
+    } else if(item.name == "adafactor_step") {
+      ABORT_IF(item.size() != sizeof(double), "adafactor_step should have 1 entry not {} bytes", item.size());
+      step = *(double*)item.data();
+    }
+  }
+
+  if(iVt.bytes.empty()) {
+    LOG(warn, "[warn] Adafactor parameters not found in checkpoint");
+    return;
+  }
+
+  ABORT_IF(iVt.type != Type::float32, "Adafactor loads a float32 second moment, not {}", iVt.type);
+
+  // The shards are laid out on their first update, until then the second moment is kept as it is
+  scatterFn(iVt,
+    [&](size_t localDeviceIndex, const char* begin, const char* end) {
+      auto opt = std::dynamic_pointer_cast<Adafactor>(opts[localDeviceIndex]);
+      opt->step_ = step;
+      opt->loaded_ = floatsFromBytes(begin, end);
+      if(opt->stats_) {
+        opt->stats_->subtensor(0, opt->scratch_)->set(opt->factor(opt->loaded_));
+        opt->loaded_.clear();
+      }
+    });
+}
+
+void Adafactor::save(std::vector<io::Item>& items,
+                     const std::vector<Ptr<OptimizerBase>>& opts,
+                     const GatherStateFunc& gatherFn,
+                     bool isMainProcess) {
+  OptimizerBase::save(items, opts, gatherFn, isMainProcess); // collect parameters from base
+
+  if(isMainProcess)
+    LOG(info, "Saving Adafactor parameters");
+
+  // the second moment of every parameter, so that the checkpoint does not depend on the sharding
+  io::Item vt = gatherFn(
+    [&](size_t localDeviceIndex) {
+      auto opt = std::dynamic_pointer_cast<Adafactor>(opts[localDeviceIndex]);
+      return io::fromVector(opt->stats_ ? opt->expand() : opt->loaded_, "adafactor_vt");
+    });
+  items.emplace_back(std::move(vt));
+
+  std::vector<double> vStep{step_};
+  items.emplace_back(io::fromVector(vStep, "adafactor_step"));
+}
+
+void Adafactor::resetStats() {
+  if(stats_)
+    stats_->set(0.f);
+  step_ = 0;
+}
+
 Ptr<OptimizerBase> Optimizer(Ptr<Options> options) {
   auto optType = options->get<std::string>("optimizer");
   auto params = options->has("optimizer-params")
@@ -570,6 +1036,10 @@ Ptr<OptimizerBase> Optimizer(Ptr<Options> options) {
     opt = New<Adagrad>(options);
   } else if(optType == "adam") {
     opt = New<Adam>(options);
+  } else if(optType == "adam8bit") {
+    opt = New<Adam8bit>(options);
+  } else if(optType == "adafactor") {
+    opt = New<Adafactor>(options);
   } else {
     ABORT("Unknown optimizer type: {}", optType);
   }
@@ -5,8 +5,10 @@
 #include "optimizers/clippers.h"
 #include "optimizers/exponential_smoothing.h"
 #include "tensors/backend.h"
+#include "tensors/fused_adam.h"
 #include "tensors/tensor.h"
 #include "training/training_state.h"
+#include "3rd_party/threadpool.h"
 
 #include <algorithm>
 #include <map>
@@ -24,7 +26,8 @@ public:
     options_(options),
     eta_(options_->get<float>("learn-rate")),
     refMBWordsParam_(options_->get<size_t>("mini-batch-words-ref", 0)),
-    normalizedGradient_{options_->get<bool>("normalize-gradient", false)} // @TODO: get rid of this if we manage to confirm that it does not help with fp16 training
+    normalizedGradient_{options_->get<bool>("normalize-gradient", false)}, // @TODO: get rid of this if we manage to confirm that it does not help with fp16 training
+    fusedUpdate_{options_->get<bool>("fused-optimizer", false)}
   {
 
     auto precisions = options_->get<std::vector<std::string>>("precision", {"float32", "float32"});
@@ -119,8 +122,22 @@ public:
   // This is different from swapping (swapping twice restores original state) as the original parameters get overwritten. 
   void replaceWithSmoothed(Tensor params);
 
+  // The parameters that the shards passed to update() are ranges of, starting at element offset of params->vals().
+  // Only optimizers that treat matrices differently from vectors need it, e.g. Adafactor.
+  virtual void setParameterLayout(Ptr<Parameters> /*params*/, size_t /*offset*/) {}
+
+  // whether update() computes the gradient norm if it does not clip, e.g. only for updates that are displayed
+  void setReportNorm(bool reportNorm) { reportNorm_ = reportNorm; }
+
+  // waits for the update of the average that --exponential-smoothing-async runs on a background thread
+  void waitForSmoothing() {
+    if(avgUpdate_.valid())
+      avgUpdate_.get();
+  }
+
   // return stateful optimizer shards, for base that's only averaged parameters
   virtual std::vector<Tensor> getShards() { 
+    waitForSmoothing();
     if(avg_)
       return { avg_ }; 
     else
@@ -131,12 +148,23 @@ protected:
   virtual void updateImpl(Tensor params, Tensor grads, size_t actualMBSize) = 0;
   virtual void resetStats() = 0;
 
+  // Optimizers with a fused update override both: updateFusedImpl() does what updateImpl(), updateAvgParams() and
+  // the cast back to the parameter type do, in one pass. It reads the gradients in their own type multiplied by
+  // gradScale, updates the average avg by avgDecay if given and writes the parameters to out if given.
+  virtual bool hasFusedUpdate() const { return false; }
+  virtual void updateFusedImpl(Tensor /*params*/, Tensor /*grads*/, Tensor /*avg*/, Tensor /*out*/,
+                               float /*gradScale*/, float /*avgDecay*/, size_t /*actualMBSize*/) {
+    ABORT("This optimizer has no fused update");
+  }
+
   Ptr<Options> options_;
 
   float eta_;                      // Learning rate
   size_t refMBWordsParam_{0};      // reference MB size. This enables automatic adjustment of optimizer hyper-parameters to MB size. 0 means no adjustment
   size_t batchesSeen_{0};          // updates seen so far
   bool normalizedGradient_{false}; // has the gradient been normalized by MB size? @TODO: get rid of this if we manage to confirm that it does not help with fp16 training
+  bool fusedUpdate_{false};        // use updateFusedImpl() if the optimizer has one
+  bool reportNorm_{true};          // see setReportNorm()
 
   Type optimizerType_{Type::float32};
   bool castOptimizerType_{false};
@@ -147,6 +175,8 @@ protected:
   Ptr<Allocator> alloc_;
 
   Tensor avg_;
+  UPtr<ThreadPool> avgThread_;   // updates avg_ on CPUs with --exponential-smoothing-async
+  std::future<void> avgUpdate_;  // of avg_ on avgThread_, reads pm_ until it is done
 
   Tensor pm_;
   Tensor gd_;
@@ -246,10 +276,18 @@ public:
     return shards;
   }
 
-private:
+protected:
   void updateImpl(Tensor params, Tensor grads, size_t actualMBSize) override;
   void resetStats() override;
 
+  bool hasFusedUpdate() const override { return true; }
+  void updateFusedImpl(Tensor params, Tensor grads, Tensor avg, Tensor out,
+                       float gradScale, float avgDecay, size_t actualMBSize) override;
+
+  void lazyAlloc(Tensor params);
+  // advances the bias corrections and returns the hyper-parameters of this update
+  FusedAdamArgs nextStep(Type paramType, size_t actualMBSize);
+
   // Adam parameters:
   // [beta1, beta2, eps, w, refMBWords]
   virtual void setParams(const std::vector<float>& params) override {
@@ -281,5 +319,138 @@ private:
   Tensor vt_;
 };
 
+/**
+ * @brief Adam with block-wise 8-bit moments
+ *
+ * https://arxiv.org/abs/2110.02861
+ *
+ * Keeps both moments in one byte per value instead of the four of float32, see Adam8bitCodec. The update itself is
+ * the one of Adam in float32, in FusedAdam8bit(). Checkpoints contain the dequantized moments under the names of
+ * Adam, so training can switch between both.
+ */
+class Adam8bit : public Adam {
+public:
+  Adam8bit(Ptr<Options> options);
+
+  void load(std::vector<io::Item>& /*items*/,
+            const std::vector<Ptr<OptimizerBase>>& /*opts*/,
+            const std::vector<Ptr<Backend>>& /*backends*/,
+            const ScatterStateFunc& /*scatterFn*/,
+            bool isMainProcess) override;
+
+  void save(std::vector<io::Item>& items,
+            const std::vector<Ptr<OptimizerBase>>& opts,
+            const GatherStateFunc& gatherFn,
+            bool isMainProcess) override;
+
+  std::vector<Tensor> getShards() override {
+    auto shards = OptimizerBase::getShards();
+    shards.push_back(mq_);
+    shards.push_back(vq_);
+    shards.push_back(scales_);
+    return shards;
+  }
+
+private:
+  void updateImpl(Tensor params, Tensor grads, size_t actualMBSize) override;
+  void updateFusedImpl(Tensor params, Tensor grads, Tensor avg, Tensor out,
+                       float gradScale, float avgDecay, size_t actualMBSize) override;
+  void resetStats() override;
+
+  void lazyAllocQuantized(Ptr<Backend> backend, size_t elements);
+
+  Tensor mq_;     // first moment, int8
+  Tensor vq_;     // second moment, uint8
+  Tensor scales_; // block maxima of the first and then of the second moment
+};
+
+/**
+ * @brief Adafactor optimizer
+ *
+ * https://arxiv.org/abs/1804.04235
+ *
+ * Without momentum, and with the second moment of each matrix factored into its row and column sums, so that the state
+ * is the size of the rows plus the columns instead of the size of the matrix. The second moment of vectors, and of
+ * the partial rows at the ends of a shard, is kept as it is. The matrices are found from setParameterLayout(),
+ * without it the whole shard is treated as a vector. Copies the learning rate (schedule) of the other optimizers
+ * rather than using a relative step size. Overwrites the gradients with the update.
+ */
+class Adafactor : public OptimizerBase {
+public:
+  Adafactor(Ptr<Options> options);
+
+  void load(std::vector<io::Item>& /*items*/,
+            const std::vector<Ptr<OptimizerBase>>& /*opts*/,
+            const std::vector<Ptr<Backend>>& /*backends*/,
+            const ScatterStateFunc& /*scatterFn*/,
+            bool isMainProcess) override;
+
+  void save(std::vector<io::Item>& items,
+            const std::vector<Ptr<OptimizerBase>>& opts,
+            const GatherStateFunc& gatherFn,
+            bool isMainProcess) override;
+
+  void setParameterLayout(Ptr<Parameters> params, size_t offset) override;
+
+  std::vector<Tensor> getShards() override {
+    auto shards = OptimizerBase::getShards();
+    shards.push_back(stats_);
+    return shards;
+  }
+
+  // Adafactor parameters:
+  // [decay rate of beta2, eps, clipping threshold, w]
+  void setParams(const std::vector<float>& params) override {
+    if(params.size() > 0)
+      decayRate_ = params[0];
+    if(params.size() > 1)
+      eps_ = params[1];
+    if(params.size() > 2)
+      clip_ = params[2];
+    if(params.size() > 3)
+      w_ = params[3];
+  }
+
+private:
+  // A part of the shard whose second moment is either factored, [rows, cols] with the row and column sums at
+  // rowSums and colSums of stats_, or kept, [1, rows * cols] at dense of stats_
+  struct Segment {
+    size_t offset; // in the shard
+    size_t rows, cols;
+    bool factored;
+    size_t rowSums, colSums, dense;
+  };
+
+  void updateImpl(Tensor params, Tensor grads, size_t actualMBSize) override;
+  void resetStats() override;
+
+  void lazyInit(Tensor params);
+  // the second moment of each value of the shard, from the row and column sums of factored segments
+  std::vector<float> expand();
+  // the inverse of expand()
+  std::vector<float> factor(const std::vector<float>& second);
+
+  float decayRate_ = 0.8f; // beta2 = 1 - step^-decayRate
+  float eps_ = 1e-30f;     // added to the squared gradients
+  float clip_ = 1.f;       // of the root mean square of the update of each segment
+  float w_ = 0.f;          // weight decay
+
+  struct Matrix {
+    size_t offset, rows, cols;
+  };
+  std::vector<Matrix> layout_; // the parameters that are matrices, by their offset in params->vals()
+  size_t shardOffset_{0};      // of the shard in params->vals()
+  bool hasLayout_{false};
+  size_t elements_{0};         // of the shard
+  std::vector<Segment> segments_;
+
+  double step_{0};
+  std::vector<float> loaded_; // the second moment from a checkpoint, factored on the first update
+
+  Ptr<TensorAllocator> alloc_;
+  Tensor stats_;   // the row and column sums, the kept second moments and two scratch values per segment
+  size_t scratch_; // offset of the scratch values in stats_
+};
+
 Ptr<OptimizerBase> Optimizer(Ptr<Options> options);
 }  // namespace marian
@@ -0,0 +1,69 @@
+#include "optimizers/pruner.h"
+#include "tensors/tensor_allocator.h"
+#include "tensors/tensor_operators.h"
+
+#include "functional/functional.h"
+
+namespace marian {
+
+void ModelPruner::prune(Ptr<ExpressionGraph> graph, size_t updates) {
+  if(pattern_.empty() || updates < after_)
+    return;
+
+  if(!mask_ || (freq_ > 0 && (updates - after_) % freq_ == 0))
+    computeMask(graph);
+
+  using namespace functional;
+  Element(_1 *= _2, graph->params()->vals(), mask_);
+}
+
+/* Computes the mask of the weight matrices that have the pattern from the current parameters, all others are kept.
+ * This copies the parameters to the CPU, which only happens every --prune-freq updates.
+ */
+void ModelPruner::computeMask(Ptr<ExpressionGraph> graph) {
+  auto vals = graph->params()->vals();
+  int numElements = (int)vals->size();
+
+  if(!mask_) {
+    auto allocator = New<TensorAllocator>(graph->getBackend());
+    allocator->reserveExact(vals->memory()->size());
+    allocator->allocate(mask_, {1, numElements}, vals->type());
+    allocators_.push_back(allocator);
+
+    if(vals->type() != Type::float32) {
+      auto allocatorValues = New<TensorAllocator>(graph->getBackend());
+      allocatorValues->reserveExact(numElements * sizeof(float));
+      allocatorValues->allocate(values_, {1, numElements}, Type::float32);
+      allocators_.push_back(allocatorValues);
+    }
+  }
+
+  std::vector<float> values;
+  if(values_) {
+    CopyCast(values_, vals);
+    values_->get(values);
+  } else {
+    vals->get(values);
+  }
+
+  std::vector<float> mask(numElements, 1.f);
+  size_t numPruned = 0;
+  for(auto p : *graph->params()) {
+    if(!pattern_.appliesTo(p->name(), p->shape()))
+      continue;
+    size_t offset = (p->val()->data<char>() - vals->data<char>()) / sizeOf(vals->type());
+    pattern_.mask(values.data() + offset, p->shape()[0], p->shape()[1], mask.data() + offset);
+    numPruned++;
+  }
+
+  if(values_) {
+    values_->set(mask);
+    CopyCast(mask_, values_);
+  } else {
+    mask_->set(mask);
+  }
+
+  LOG_ONCE(info, "[training] Pruning {} weight matrices to the {} sparsity pattern", numPruned, pattern_.toString());
+}
+
+}  // namespace marian
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common/options.h"
+#include "common/sparsity.h"
+#include "graph/expression_graph.h"
+#include "tensors/tensor.h"
+#include "tensors/tensor_allocator.h"
+
+namespace marian {
+
+/* Class to implement magnitude pruning of the weight matrices in a model graph to the N:M pattern of --prune-pattern.
+ * From update --prune-after on, the weights that are not the largest of their group are set to zero after every
+ * update. The masks of the kept weights are recomputed every --prune-freq updates from the weights after the update,
+ * so that pruned weights whose gradients moved them far enough can grow back, otherwise they stay fixed.
+ * Example:
+ *   auto mp = New<ModelPruner>(options_);
+ *   mp->prune(graph_, updates);
+ *
+ * Like ModelQuantizer, use the same ModelPruner object to prune the same graph.
+ */
+class ModelPruner {
+public:
+  ModelPruner(Ptr<Options> options)
+      : pattern_(options->get<std::string>("prune-pattern", "")),
+        after_{options->get<size_t>("prune-after", 0)},
+        freq_{options->get<size_t>("prune-freq", 0)} {}
+
+  // updates is the number of updates including the one that just changed the parameters
+  void prune(Ptr<ExpressionGraph> graph, size_t updates);
+
+protected:
+  void computeMask(Ptr<ExpressionGraph> graph);
+
+  SparsityPattern pattern_;
+  size_t after_;
+  size_t freq_;
+
+  std::vector<Ptr<TensorAllocator>> allocators_;
+
+  Tensor mask_;   // 1 for kept and 0 for pruned weights, over all parameters of the graph
+  Tensor values_; // float32 copy of the parameters for computing the mask, if they are of another type
+};
+}  // namespace marian
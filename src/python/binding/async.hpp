@@ -0,0 +1,100 @@
+#pragma once
+
+#include "pybind11/pybind11.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace pymarian {
+  namespace py = pybind11;
+
+  /**
+   * Runs jobs in submission order on a background C++ thread and hands their results to Python as
+   * concurrent.futures.Future objects, which can be awaited in asyncio via asyncio.wrap_future().
+   * The GIL is only taken to deliver a result, never while a job is running.
+   */
+  class AsyncRunner {
+  private:
+    std::mutex mutex_;
+    std::condition_variable jobsChanged_;
+    std::deque<std::function<void()>> jobs_;
+    bool stop_{false};
+    std::thread worker_;
+
+    void loop() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for(;;) {
+        jobsChanged_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+        if(jobs_.empty()) // stopped and nothing left to do
+          return;
+        auto job = std::move(jobs_.front());
+        jobs_.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+      }
+    }
+
+  public:
+    AsyncRunner() : worker_([this]() { loop(); }) {}
+
+    // finishes all submitted jobs, which need the GIL to deliver their results
+    ~AsyncRunner() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      jobsChanged_.notify_all();
+      if(PyGILState_Check()) {
+        py::gil_scoped_release release;
+        worker_.join();
+      } else {
+        worker_.join();
+      }
+    }
+
+    /**
+     * @brief Queue a job, must be called with the GIL held
+     *
+     * @param job - runs without the GIL, must not capture Python objects
+     * @return py::object - a concurrent.futures.Future that receives the result of job,
+     *                      or a RuntimeError if job throws
+     */
+    template <class Result>
+    py::object submit(std::function<Result()> job) {
+      // the future is shared with the worker thread, it is only touched there while holding the GIL
+      auto future = new py::object(py::module_::import("concurrent.futures").attr("Future")());
+      py::object handle = *future;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back([future, job]() {
+          std::exception_ptr error;
+          Result result;
+          try {
+            result = job();
+          } catch(...) {
+            error = std::current_exception();
+          }
+
+          py::gil_scoped_acquire acquire;
+          try {
+            if(error)
+              std::rethrow_exception(error);
+            future->attr("set_result")(py::cast(std::move(result)));
+          } catch(const std::exception& e) {
+            future->attr("set_exception")(py::module_::import("builtins").attr("RuntimeError")(e.what()));
+          }
+          delete future;
+        });
+      }
+      jobsChanged_.notify_one();
+      return handle;
+    }
+  };
+
+}
@@ -26,17 +26,25 @@ PYBIND11_MODULE(_pymarian, m) {
         .def(py::init<std::string>())
         .def("translate", py::overload_cast<const std::string&, const py::kwargs&>(&TranslateServicePyWrapper::run))
         .def("translate", py::overload_cast<const std::vector<std::string>&, const py::kwargs&>(&TranslateServicePyWrapper::run))
+        .def("translate_stream", &TranslateServicePyWrapper::runStreaming)
+        .def("translate_ids", &TranslateServicePyWrapper::runIds)
+        .def("workspace_stats", &TranslateServicePyWrapper::workspaceStats)
+        .def("reload", &TranslateServicePyWrapper::reload, py::arg("models") = std::vector<std::string>())
+        .def("translate_async", py::overload_cast<const std::string&, const py::kwargs&>(&TranslateServicePyWrapper::runAsync))
+        .def("translate_async", py::overload_cast<const std::vector<std::string>&, const py::kwargs&>(&TranslateServicePyWrapper::runAsync))
         ;
 
     py::class_<EvaluatorPyWrapper>(m, "Evaluator")
         .def(py::init<std::string>())
         .def("evaluate", py::overload_cast<const StrVectors&>(&EvaluatorPyWrapper::run))
+        .def("evaluate_async", &EvaluatorPyWrapper::runAsync)
         .def("get_model_config", py::overload_cast<>(&EvaluatorPyWrapper::getModelConfig))
         ;
 
     py::class_<PyTrainer>(m, "Trainer")
         .def(py::init<std::string>())
         .def("train", py::overload_cast<>(&PyTrainer::train))
+        .def("train", py::overload_cast<py::object>(&PyTrainer::train), py::arg("data"))
         ;
 
       py::class_<PyEmbedder>(m, "Embedder")
@@ -1,6 +1,7 @@
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
 
+#include "async.hpp"
 #include "marian.h"
 
 #include "common/logging.h"
@@ -37,6 +38,7 @@ namespace pymarian {
     Ptr<marian::Options> options_;
     Ptr<Evaluator> evaluator_;
     std::vector<Ptr<Vocab>> vocabs_;
+    std::unique_ptr<AsyncRunner> async_; // created on first use, declared last so its jobs finish first
 
   public:
   /**
@@ -114,6 +116,19 @@ namespace pymarian {
       return outputs;
     }
 
+    /**
+     * Run the evaluator on the given input in the background, see run().
+     * Jobs run one after another, the Evaluator is not used concurrently.
+     *
+     * @param inputs - table of strings : rows x columns
+     * @return concurrent.futures.Future of the table of floats : rows x columns
+    */
+    auto runAsync(const StrVectors& inputs) -> py::object {
+      if(!async_)
+        async_.reset(new AsyncRunner());
+      return async_->submit<FloatVectors>([this, inputs]() { return run(inputs); });
+    }
+
     auto getModelConfig() -> std::string {
       return evaluator_->getModelConfig();
     }
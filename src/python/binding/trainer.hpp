@@ -1,3 +1,4 @@
+#include "pybind11/numpy.h"
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
 #include <signal.h>
@@ -19,6 +20,55 @@ using namespace marian;
 namespace pymarian {
 
 
+    /**
+     * The sentence tuples of a Python iterable for --train-feed, each a sequence of one array of word ids per
+     * stream, e.g. of numpy uint32 arrays. Each epoch iterates anew over the iterable. The batch generator calls
+     * next() from its own thread, which takes the GIL only while converting one item, so that Python prepares the
+     * data while the devices train.
+     */
+    class PySentenceFeed : public data::SentenceFeed {
+    private:
+        py::object data_;
+        py::object iterator_;
+
+    public:
+        PySentenceFeed(py::object data) : data_(data) {}
+
+        void restart() override {
+            py::gil_scoped_acquire acquire;
+            iterator_ = py::iter(data_);
+        }
+
+        bool next(std::vector<Words>& streams) override {
+            py::gil_scoped_acquire acquire;
+            try {
+                auto item = py::reinterpret_steal<py::object>(PyIter_Next(iterator_.ptr()));
+                if(!item) {
+                    if(PyErr_Occurred())
+                        throw py::error_already_set();
+                    return false;
+                }
+                auto sequence = item.cast<py::sequence>();
+                streams.resize(sequence.size());
+                for(size_t i = 0; i < streams.size(); ++i) {
+                    // no copy for C-contiguous uint32 arrays, a converted one otherwise
+                    auto ids = py::array_t<uint32_t, py::array::c_style | py::array::forcecast>::ensure(sequence[i]);
+                    ABORT_IF(!ids || ids.ndim() != 1, "Stream {} of a training sentence is not a sequence of word ids", i);
+                    const uint32_t* data = ids.data();
+                    streams[i].resize(ids.size());
+                    for(size_t j = 0; j < streams[i].size(); ++j)
+                        streams[i][j] = Word::fromWordIndex(data[j]);
+                }
+                return true;
+            } catch(const py::error_already_set& e) {
+                ABORT("Reading the training data failed: {}", e.what());
+            } catch(const py::cast_error& e) {
+                ABORT("A training sentence is not a sequence of one array of word ids per stream: {}", e.what());
+            }
+        }
+    };
+
+
     class PyTrainer {
 
     private:
@@ -46,6 +96,30 @@ namespace pymarian {
             // stands for).
             return getSignalFlag(SIGTERM) ? 128 + SIGTERM : EXIT_SUCCESS;
         }
+
+        /**
+         * @brief Train on the sentence tuples of a Python iterable instead of --train-sets, see --train-feed
+         *
+         * The GIL is released while training and taken by the batch generator for each item it reads.
+         *
+         * @param data - iterable of sentence tuples, each a sequence of one array of word ids per stream, e.g.
+         *               [(np.array([3, 17, 0], dtype=np.uint32), np.array([5, 0], dtype=np.uint32)), ...].
+         *               </s> is appended where it is missing. Iterated anew for every epoch, so a generator
+         *               gives a single epoch.
+         * @return int - the exit code as of train()
+         */
+        int train(py::object data) {
+            ABORT_IF(!options_->get<bool>("train-feed", false), "Training on Python data requires train_feed=True");
+            auto feed = New<PySentenceFeed>(data);
+            trainer_->setFeed(feed);
+            {
+                py::gil_scoped_release release;
+                trainer_->run();
+            }
+            // the last reference to the Python objects goes while holding the GIL
+            trainer_->setFeed(nullptr);
+            return getSignalFlag(SIGTERM) ? 128 + SIGTERM : EXIT_SUCCESS;
+        }
     };
 
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
+#include "pybind11/numpy.h"
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
 
+#include "async.hpp"
 #include "marian.h"
 
 #include "common/logging.h"
@@ -19,6 +21,13 @@ namespace pymarian {
   class TranslateServicePyWrapper {
   private:
     Ptr<TranslateService<BeamSearch>> pImpl_;
+    std::unique_ptr<AsyncRunner> async_; // created on first use, declared last so its jobs finish before pImpl_ goes away
+
+    AsyncRunner& async() {
+      if(!async_)
+        async_.reset(new AsyncRunner());
+      return *async_;
+    }
 
     /**
      * @brief Convert a pybind11::kwargs object to a YAML string
@@ -63,6 +72,160 @@ namespace pymarian {
     std::string run(const std::string& input, const py::kwargs& kwargs) {
       return this->pImpl_->run(input, convertKwargsToYamlString(kwargs));
     }
+
+    /**
+     * @brief Translate a vector of strings in the background
+     *
+     * @param inputs - the vector of strings to translate
+     * @param kwargs - the kwargs object from pybind11
+     * @return py::object - a concurrent.futures.Future of the vector of translated strings
+     */
+    py::object runAsync(const std::vector<std::string>& inputs, const py::kwargs& kwargs) {
+      auto yaml = convertKwargsToYamlString(kwargs);
+      auto pImpl = pImpl_;
+      return async().submit<std::vector<std::string>>([pImpl, inputs, yaml]() { return pImpl->run(inputs, yaml); });
+    }
+
+    /**
+     * @brief Translate a single string in the background
+     *
+     * @param input - the string to translate
+     * @param kwargs - the kwargs object from pybind11
+     * @return py::object - a concurrent.futures.Future of the translated string
+     */
+    py::object runAsync(const std::string& input, const py::kwargs& kwargs) {
+      auto yaml = convertKwargsToYamlString(kwargs);
+      auto pImpl = pImpl_;
+      return async().submit<std::string>([pImpl, input, yaml]() { return pImpl->run(input, yaml); });
+    }
+
+    /**
+     * @brief Translate a (multi-line) string and stream out finished lines
+     *
+     * @param input - the string to translate
+     * @param callback - called as callback(line_number, translation) for every line as soon as it is
+     *                   translated, lines may arrive out of order
+     * @param kwargs - the kwargs object from pybind11
+     * @return std::string - the translated string
+     */
+    std::string runStreaming(const std::string& input, const py::function& callback, const py::kwargs& kwargs) {
+      auto yaml = convertKwargsToYamlString(kwargs);
+      // the callback is invoked from decoder threads, which need to hold the GIL while in Python
+      auto onTranslation = [&callback](size_t lineNo, const std::string& translation) {
+        py::gil_scoped_acquire acquire;
+        callback(lineNo, translation);
+      };
+      py::gil_scoped_release release;
+      return this->pImpl_->run(input, yaml, onTranslation);
+    }
+
+    /**
+     * @brief Translate a batch of pre-tokenized sentences given as vocabulary ids
+     *
+     * The GIL is released for the whole decode, inputs and outputs are copied in bulk from and into
+     * numpy arrays, there are no Python objects per word or score.
+     *
+     * @param ids - word ids of all sentences concatenated, e.g. np.frombuffer(buf, dtype=np.uint32)
+     * @param lengths - number of ids per sentence, </s> is added if missing
+     * @param kwargs - the kwargs object from pybind11
+     * @return py::tuple - (ids, lengths, scores, alignments): word ids of all best translations without </s>
+     *                     concatenated (uint32), their lengths (int64), normalized sentence scores (float32),
+     *                     and with alignment=soft one float32 array [trg pos, src pos] per sentence
+     */
+    py::tuple runIds(py::array_t<uint32_t, py::array::c_style | py::array::forcecast> ids,
+                     py::array_t<int64_t, py::array::c_style | py::array::forcecast> lengths,
+                     const py::kwargs& kwargs) {
+      auto yaml = convertKwargsToYamlString(kwargs);
+
+      auto idsView = ids.unchecked<1>();
+      auto lengthsView = lengths.unchecked<1>();
+      std::vector<Words> sentences(lengthsView.shape(0));
+      py::ssize_t pos = 0;
+      for(py::ssize_t i = 0; i < lengthsView.shape(0); ++i) {
+        ABORT_IF(lengthsView(i) < 0 || pos + lengthsView(i) > idsView.shape(0), "Sentence lengths exceed the number of ids");
+        auto& words = sentences[i];
+        words.reserve(lengthsView(i) + 1);
+        for(py::ssize_t j = 0; j < lengthsView(i); ++j)
+          words.push_back(Word::fromWordIndex(idsView(pos++)));
+      }
+
+      std::vector<TranslateService<BeamSearch>::IdTranslation> translations;
+      {
+        py::gil_scoped_release release;
+        translations = this->pImpl_->translateIds({sentences}, yaml);
+      }
+
+      size_t numWords = 0;
+      for(const auto& translation : translations)
+        numWords += translation.words.size();
+
+      py::array_t<uint32_t> outIds(numWords);
+      py::array_t<int64_t> outLengths(translations.size());
+      py::array_t<float> outScores(translations.size());
+      py::list outAlignments;
+      auto outIdsView = outIds.mutable_unchecked<1>();
+      auto outLengthsView = outLengths.mutable_unchecked<1>();
+      auto outScoresView = outScores.mutable_unchecked<1>();
+      pos = 0;
+      for(size_t i = 0; i < translations.size(); ++i) {
+        const auto& translation = translations[i];
+        for(auto word : translation.words)
+          outIdsView(pos++) = (uint32_t)word.toWordIndex();
+        outLengthsView(i) = (int64_t)translation.words.size();
+        outScoresView(i) = translation.score;
+
+        const auto& alignment = translation.alignment;
+        if(!alignment.empty()) {
+          py::array_t<float> matrix({alignment.size(), alignment.front().size()});
+          auto matrixView = matrix.mutable_unchecked<2>();
+          for(size_t t = 0; t < alignment.size(); ++t)
+            for(size_t s = 0; s < alignment[t].size() && s < alignment.front().size(); ++s)
+              matrixView(t, s) = alignment[t][s];
+          outAlignments.append(matrix);
+        }
+      }
+      return py::make_tuple(outIds, outLengths, outScores, outAlignments);
+    }
+
+    /**
+     * @brief Memory use of the workspace of every graph after its last batch, e.g. to choose --workspace from
+     *
+     * @return py::list - a dict per graph with the device, the bytes reserved, used, held, cached, free and at
+     * peak, the number of gaps and of allocations, and the fragmentation of the free memory
+     */
+    py::list workspaceStats() const {
+      py::list out;
+      auto statistics = this->pImpl_->workspaceStatistics();
+      for(size_t i = 0; i < statistics.size(); ++i) {
+        const auto& stats = statistics[i];
+        py::dict graph;
+        graph["device"] = (std::string)this->pImpl_->graphDevice(i);
+        graph["reserved"] = stats.reserved;
+        graph["used"] = stats.used;
+        graph["held"] = stats.held;
+        graph["peak"] = stats.peak;
+        graph["cached"] = stats.cached;
+        graph["available"] = stats.available;
+        graph["largest_gap"] = stats.largestGap;
+        graph["gaps"] = stats.gaps;
+        graph["allocations"] = stats.allocations;
+        graph["reused"] = stats.reused;
+        graph["fragmentation"] = stats.fragmentation();
+        out.append(graph);
+      }
+      return out;
+    }
+
+    /**
+     * @brief Load the models again and switch to them once they are warmed up, translations that have already
+     * started finish with the previous models
+     *
+     * @param models - the model files, by default those the translator was created with
+     */
+    void reload(const std::vector<std::string>& models) {
+      py::gil_scoped_release release;
+      this->pImpl_->reload(models);
+    }
   };
 
 }
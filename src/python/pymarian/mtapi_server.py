@@ -7,6 +7,7 @@ Implements Microsoft's MTAPI (https://docs.microsoft.com/en-us/azure/cognitive-s
 import argparse
 import json
 import logging as log
+from concurrent.futures import Future
 from typing import List
 
 import pymarian
@@ -36,21 +37,27 @@ class MarianService:
 
     def translate(self, text: List[str]) -> List[str]:
         """Translates a list of sentences from source to target language."""
+        return self.translate_async(text).result()
+
+    def translate_async(self, text: List[str]) -> Future:
+        """Same as translate(), but returns a future of the translation while decoding runs in the background."""
         text = self.norm.normalize(text)
         input_lines = self.splitter.split(text)
-        output_lines = self.translator.translate(input_lines)
-        return " ".join(output_lines)
+        output_future = self.translator.translate_async(input_lines)
+        joined = Future()
+        output_future.add_done_callback(
+            lambda f: joined.set_exception(f.exception()) if f.exception() else joined.set_result(" ".join(f.result()))
+        )
+        return joined
 
 
 def attach_routes(app: Flask, service: MarianService):
     @app.route('/translate', methods=["GET", "POST"])
     def translate():
         request_data = request.get_json()
-        outputs = []
-        for source in request_data:
-            text = source["text"]
-            translation = service.translate(text)
-            outputs.append(translation)
+        # preprocess the next text while the previous ones are decoded
+        futures = [service.translate_async(source["text"]) for source in request_data]
+        outputs = [future.result() for future in futures]
         response = [
             {"translations": [{"text": output, "to": service.target_lang} for output in outputs]},
         ]
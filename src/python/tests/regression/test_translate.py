@@ -2,6 +2,7 @@ import tarfile
 import urllib.request
 from pathlib import Path
 
+import numpy as np
 from pymarian import Translator
 
 from . import BASE_ARGS
@@ -47,3 +48,49 @@ def test_ende_force_decode():
     force_decode_config = dict(force_decode=True, tsv=True, tsv_fields=2)
     hyp = translator.translate("Hello. Good morning.\tIsch", **force_decode_config)
     assert hyp == "Isch am Guten Morgen ."
+
+
+def test_ende_ids():
+
+    model_file = str(DATA_DIR / 'model.base.npz')
+    vocab_file = str(DATA_DIR / 'en-de.spm')
+    args = BASE_ARGS | dict(models=model_file, vocabs=[vocab_file, vocab_file], quiet=True)
+    translator = Translator(**args)
+    ids = np.array([100, 200, 300, 400], dtype=np.uint32)
+    lengths = np.array([3, 1], dtype=np.int64)
+    out_ids, out_lengths, scores, alignments = translator.translate_ids(ids, lengths)
+    assert out_lengths.shape == (2,)
+    assert out_ids.shape == (out_lengths.sum(),)
+    assert out_ids.dtype == np.uint32
+    assert scores.dtype == np.float32 and scores.shape == (2,)
+    assert alignments == []
+
+    _, out_lengths, _, alignments = translator.translate_ids(ids, lengths, alignment='soft')
+    assert len(alignments) == 2
+    assert alignments[0].shape[0] == out_lengths[0] + 1  # including </s>
+
+
+def test_ende_workspace_stats():
+
+    model_file = str(DATA_DIR / 'model.base.npz')
+    vocab_file = str(DATA_DIR / 'en-de.spm')
+    args = BASE_ARGS | dict(models=model_file, vocabs=[vocab_file, vocab_file], quiet=True)
+    translator = Translator(**args)
+    translator.translate("Hello. Good morning.")
+    stats = translator.workspace_stats()
+    assert len(stats) >= 1
+    for graph in stats:
+        assert 0 < graph['peak'] <= graph['reserved']
+        assert graph['allocations'] > 0
+        assert 0.0 <= graph['fragmentation'] <= 1.0
+
+
+def test_ende_async():
+
+    model_file = str(DATA_DIR / 'model.base.npz')
+    vocab_file = str(DATA_DIR / 'en-de.spm')
+    args = BASE_ARGS | dict(models=model_file, vocabs=[vocab_file, vocab_file], quiet=True)
+    translator = Translator(**args)
+    futures = [translator.translate_async("Hello. Good morning.") for _ in range(3)]
+    assert [future.result() for future in futures] == ["Hallo , Guten Morgen ."] * 3
+    assert translator.translate_async(["Hello. Good morning."]).result() == ["Hallo , Guten Morgen ."]
@@ -74,6 +74,13 @@ public:
       auto precison = options_->get<std::vector<std::string>>("precision", {"float32"});
       graph->setDefaultElementType(typeFromString(precison[0])); // only use first type, used for parameter type in graph
       graph->setDevice(device);
+      // the same on-line packing and quantization of the weights as in the translator, e.g. --gemm-type packed8
+      if(device.type == DeviceType::cpu) {
+        graph->getBackend()->setOptimized(options_->get<bool>("optimize", false));
+        graph->getBackend()->setGemmType(options_->get<std::string>("gemm-type", "float32"));
+        graph->getBackend()->setQuantizeRange(options_->get<float>("quantize-range", 0.f));
+        graph->getBackend()->setIntraOpThreads(options_->get<size_t>("cpu-intra-op-threads", 1));
+      }
       graph->reserveWorkspaceMB(options_->get<int>("workspace"));
       graphs_.push_back(graph);
     }
@@ -103,6 +110,7 @@ public:
                                      ? std::static_pointer_cast<ScoreCollector>(
                                            New<ScoreCollectorNBest>(options_))
                                      : New<ScoreCollector>(options_);
+    size_t reorderWindow = options_->get<size_t>("output-reorder-window", 0);
 
     auto alignment = options_->get<std::string>("alignment", "");
     auto summary = options_->get<std::string>("summary", "");
@@ -123,6 +131,10 @@ public:
       ThreadPool pool(graphs_.size(), graphs_.size());
 
       for(auto batch : *batchGenerator) {
+        // do not score ahead while too many scores wait for a slow earlier one
+        if(reorderWindow > 0)
+          output->waitForPending(reorderWindow);
+
         auto task = [=, &sumLoss, &sumWords, &sumSamples, &smutex](size_t id) {
           thread_local Ptr<ExpressionGraph> graph;
           thread_local Ptr<Model> builder;
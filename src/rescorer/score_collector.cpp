@@ -9,6 +9,7 @@ namespace marian {
 
 ScoreCollector::ScoreCollector(const Ptr<Options>& options)
     : nextId_(0),
+      unordered_(options->get<bool>("output-unordered", false)),
       alignment_(options->get<std::string>("alignment", "")),
       alignmentThreshold_(getAlignmentThreshold(alignment_)) {
 
@@ -20,7 +21,11 @@ ScoreCollector::ScoreCollector(const Ptr<Options>& options)
 
 void ScoreCollector::Write(long id, const std::string& message) {
   std::lock_guard<std::mutex> lock(mutex_);
-  if(id == nextId_) {
+  if(unordered_) {
+    if(prefixIds_)
+      *outStrm_ << id << "\t";
+    *outStrm_ << message << std::endl;
+  } else if(id == nextId_) {
     *outStrm_ << message << std::endl;
 
     ++nextId_;
@@ -48,12 +53,18 @@ void ScoreCollector::Write(long id, const std::string& message) {
       }
     }
 
+    drained_.notify_all();
   } else {
     // save for later
     outputs_[id] = message;
   }
 }
 
+void ScoreCollector::waitForPending(size_t maxPending) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  drained_.wait(lock, [&]() { return outputs_.size() < maxPending; });
+}
+
 void ScoreCollector::Write(long id,
                            float score,
                            const data::SoftAlignment& align /*= {}*/,
@@ -83,6 +94,7 @@ ScoreCollectorNBest::ScoreCollectorNBest(const Ptr<Options>& options)
     : ScoreCollector(options),
       nBestList_(options->get<std::vector<std::string>>("train-sets").back()),
       fname_(options->get<std::string>("n-best-feature")) {
+  prefixIds_ = false;
   file_.reset(new io::InputFileStream(nBestList_));
 }
 
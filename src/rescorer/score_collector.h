@@ -5,6 +5,7 @@
 #include "common/file_stream.h"
 #include "data/alignment.h"
 
+#include <condition_variable>
 #include <map>
 #include <mutex>
 
@@ -21,10 +22,16 @@ public:
                      const data::SoftAlignment& align = {},
                      const std::vector<float>& wordScores = {});
 
+  // Blocks until fewer than maxPending scores wait for an earlier one, see OutputCollector::waitForPending()
+  void waitForPending(size_t maxPending);
+
 protected:
   long nextId_{0};
   UPtr<std::ostream> outStrm_;
+  bool unordered_{false}; // --output-unordered: print "<id>\t<score>" as soon as it arrives
+  bool prefixIds_{true};  // n-best lists already contain the ids
   std::mutex mutex_;
+  std::condition_variable drained_;
 
   typedef std::map<long, std::string> Outputs;
   Outputs outputs_;
@@ -315,6 +315,12 @@ public:
 
     return {output, state.cell};  // no cell state, hence copy
   }
+
+  GRUWeights plainGRU() const override {
+    if(final_ || layerNorm_ || dropout_ > 0.0f || !W_)
+      return {};
+    return {W_, U_, b_};
+  }
 };
 
 /**
@@ -535,6 +541,12 @@ public:
 
     return {output, state.cell};  // no cell state, hence copy
   }
+
+  GRUWeights plainGRU() const override {
+    if(final_ || layerNorm_ || transition_ || dropout_ > 0.0f || !WWx_)
+      return {};
+    return {WWx_, UUx_, bbx_};
+  }
 };
 
 /******************************************************************************/
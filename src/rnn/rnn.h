@@ -248,6 +248,139 @@ public:
   }
 
   virtual Ptr<Cell> at(int i) override { return rnns_[i]->at(0); }
+
+  /**
+   * Transduces input with two RNNs of the same depth that do not depend on each other, e.g. the forward and the
+   * backward RNN of a bidirectional encoder, and returns both outputs. Layers with plain GRU cells, see
+   * Cell::plainGRU(), run both RNNs in the same time steps with one batched GEMM for both recurrences, which
+   * halves the number of sequential steps. Other layers run one RNN after the other.
+   *
+   * With the option "cudnn" of a and the lengths of the right-padded sequences, a first layer of a forward and a
+   * backward plain GRU on a GPU runs as a single cuDNN bidirectional GRU over the whole sequences instead. Its
+   * outputs at padded positions are zeros, not the last state.
+   */
+  static std::pair<Expr, Expr> transduceJointly(Ptr<RNN> a, Ptr<RNN> b, Expr input, Expr mask = nullptr,
+                                                const std::vector<int>& lengths = {}) {
+    ABORT_IF(a->rnns_.empty() || a->rnns_.size() != b->rnns_.size(), "Joint RNNs need the same number of layers");
+
+    Expr layerInputA = input, layerInputB = input;
+    for(size_t i = 0; i < a->rnns_.size(); ++i) {
+      Expr layerOutputA, layerOutputB;
+      bool lazy = !a->at((int)i)->getLazyInputs(a).empty() || !b->at((int)i)->getLazyInputs(b).empty();
+      bool cudnn = !lazy && i == 0 && !lengths.empty() && a->options_->get<bool>("cudnn", false);
+      bool joint = (cudnn && transduceLayersWithCudnn(a->rnns_[i], b->rnns_[i], input, lengths, layerOutputA, layerOutputB))
+                   || (!lazy && transduceLayersJointly(a->rnns_[i], b->rnns_[i], layerInputA, layerInputB, mask, layerOutputA, layerOutputB));
+      if(!joint) {
+        layerOutputA = a->transduceLayer(i, layerInputA, mask);
+        layerOutputB = b->transduceLayer(i, layerInputB, mask);
+      }
+
+      layerInputA = a->skip_ && (a->skipFirst_ || i > 0) ? layerOutputA + layerInputA : layerOutputA;
+      layerInputB = b->skip_ && (b->skipFirst_ || i > 0) ? layerOutputB + layerInputB : layerOutputB;
+    }
+    return {layerInputA, layerInputB};
+  }
+
+private:
+  Expr transduceLayer(size_t i, Expr layerInput, Expr mask) {
+    auto lazyInputs = rnns_[i]->at(0)->getLazyInputs(shared_from_this());
+    if(!lazyInputs.empty()) {
+      lazyInputs.push_back(layerInput);
+      layerInput = concatenate(lazyInputs, /*axis =*/ -1);
+    }
+    return rnns_[i]->transduce(layerInput, mask);
+  }
+
+  // Runs two layers of plain GRU cells in the same steps, the backward one over its reversed input. The states of
+  // both are stacked along the batch axis, [1, 2 * dimBatch, dimState], and their recurrent weights are applied as
+  // one batched GEMM. Their biases are added to the inputs beforehand. Returns false for other cells.
+  static bool transduceLayersJointly(Ptr<SingleLayerRNN> a, Ptr<SingleLayerRNN> b,
+                                     Expr inputA, Expr inputB, Expr mask,
+                                     Expr& outputA, Expr& outputB) {
+    auto weightsA = a->cell_->plainGRU();
+    auto weightsB = b->cell_->plainGRU();
+    if(!weightsA.U || !weightsB.U || weightsA.U->shape() != weightsB.U->shape())
+      return false;
+    Expr Ua = weightsA.U, ba = weightsA.b, Ub = weightsB.U, bb = weightsB.b;
+
+    auto graph   = inputA->graph();
+    int dimTime  = inputA->shape()[-3];
+    int dimBatch = inputA->shape()[-2];
+    int dimState = Ua->shape()[-2];
+
+    std::vector<IndexType> reversed(dimTime);
+    for(int t = 0; t < dimTime; ++t)
+      reversed[t] = (IndexType)(dimTime - t - 1);
+    auto inStepOrder = [&](Ptr<SingleLayerRNN> rnn, Expr e) { // also restores the time order of outputs
+      return rnn->direction_ == dir::backward ? index_select(e, -3, reversed) : e;
+    };
+
+    a->cell_->clear();
+    b->cell_->clear();
+    auto xWa = a->cell_->applyInput({inputA}).front() + ba;
+    auto xWb = b->cell_->applyInput({inputB}).front() + bb;
+    auto xW  = concatenate({inStepOrder(a, xWa), inStepOrder(b, xWb)}, /*axis =*/ -2); // [dimTime, 2 * dimBatch, 3 * dimState]
+    Expr masks;
+    if(mask)
+      masks = concatenate({inStepOrder(a, mask), inStepOrder(b, mask)}, /*axis =*/ -2);
+
+    auto U = concatenate({reshape(Ua, {1, dimState, 3 * dimState}), reshape(Ub, {1, dimState, 3 * dimState})},
+                         /*axis =*/ -3);  // [2, dimState, 3 * dimState]
+    auto noBias = graph->zeros({1, 3 * dimState});
+
+    Expr state = graph->zeros({1, 2 * dimBatch, dimState});
+    std::vector<Expr> steps;
+    for(int t = 0; t < dimTime; ++t) {
+      auto sU = reshape(bdot(reshape(state, {2, dimBatch, dimState}), U), {1, 2 * dimBatch, 3 * dimState});
+      auto xWt = slice(xW, -3, t);
+      state = masks ? gruOps({state, xWt, sU, noBias, slice(masks, -3, t)})
+                    : gruOps({state, xWt, sU, noBias});
+      steps.push_back(state);
+    }
+
+    auto outputs = concatenate(steps, /*axis =*/ -3); // [dimTime, 2 * dimBatch, dimState]
+    outputA = inStepOrder(a, slice(outputs, -2, Slice(0, dimBatch)));
+    outputB = inStepOrder(b, slice(outputs, -2, Slice(dimBatch, 2 * dimBatch)));
+
+    auto cell = graph->zeros({1, dimBatch, dimState});
+    a->last_ = States({State{slice(outputA, -3, dimTime - 1), cell}});
+    b->last_ = States({State{slice(outputB, -3, dimTime - 1), cell}});
+    return true;
+  }
+
+  // Runs a forward and a backward layer of plain GRU cells that read the same input as one cuDNN bidirectional GRU,
+  // returns false if they are not such layers or the graph is not on a GPU with cuDNN
+  static bool transduceLayersWithCudnn(Ptr<SingleLayerRNN> a, Ptr<SingleLayerRNN> b,
+                                       Expr input, const std::vector<int>& lengths,
+                                       Expr& outputA, Expr& outputB) {
+#if defined(CUDA_FOUND) && defined(CUDNN)
+    bool aForward = a->direction_ == dir::forward && b->direction_ == dir::backward;
+    bool bForward = b->direction_ == dir::forward && a->direction_ == dir::backward;
+    if(input->graph()->getDeviceId().type != DeviceType::gpu || input->value_type() != Type::float32
+       || (!aForward && !bForward))
+      return false;
+    auto fw = (aForward ? a : b)->cell_->plainGRU();
+    auto bw = (aForward ? b : a)->cell_->plainGRU();
+    if(!fw.W || !bw.W || fw.W->shape() != bw.W->shape() || fw.U->shape() != bw.U->shape())
+      return false;
+
+    int dimState = fw.U->shape()[-2];
+    auto outputs = cudnnBidirectionalGRU(input, {fw.W, fw.U, fw.b, bw.W, bw.U, bw.b}, lengths); // [dimTime, dimBatch, 2 * dimState]
+    auto outputFw = slice(outputs, -1, Slice(0, dimState));
+    auto outputBw = slice(outputs, -1, Slice(dimState, 2 * dimState));
+    outputA = aForward ? outputFw : outputBw;
+    outputB = aForward ? outputBw : outputFw;
+
+    auto cell = input->graph()->zeros({1, input->shape()[-2], dimState});
+    int dimTime = input->shape()[-3];
+    a->last_ = States({State{slice(outputA, -3, dimTime - 1), cell}});
+    b->last_ = States({State{slice(outputB, -3, dimTime - 1), cell}});
+    return true;
+#else
+    LOG_ONCE(warn, "[rnn] Marian was compiled without cuDNN, --rnn-cudnn is ignored");
+    return false;
+#endif
+  }
 };
 }  // namespace rnn
 }  // namespace marian
@@ -34,12 +34,30 @@ struct State {
 
     ABORT_IF(dimTime != 1 && !isBatchMajor, "unexpected time extent for RNN state"); // (the reshape()/rows() trick won't work in this case)
     int numCols = isBatchMajor ? dimDepth * dimTime : dimDepth;
+    Shape selectedShape = { beamSize, isBatchMajor ? dimBatch : dimTime, isBatchMajor ? dimTime : dimBatch, dimDepth };
+
+    // If no hypothesis moved and no batch entry was dropped, the selection is the identity.
+    // Return a reshaped view instead of gathering the whole state, e.g. for greedy search or
+    // beam entries that kept their position. This is frequent for long histories.
+    if(isIdentity(selIdx, sel->shape().elements() / numCols))
+      return reshape(sel, selectedShape);
+
     // @TODO: Can this complex operation be more easily written using index_select()?
     sel = reshape(sel, { sel->shape().elements() / numCols, numCols }); // [beamSize * dimBatch, dimDepth] or [beamSize * dimBatch, dimTime * dimDepth]
     sel = rows(sel, selIdx);
-    sel = reshape(sel, { beamSize, isBatchMajor ? dimBatch : dimTime, isBatchMajor ? dimTime : dimBatch, dimDepth });
+    sel = reshape(sel, selectedShape);
     return sel;
   }
+
+  // true if selIdx selects all numRows rows in their original order
+  static bool isIdentity(const std::vector<IndexType>& selIdx, int numRows) {
+    if((int)selIdx.size() != numRows)
+      return false;
+    for(size_t i = 0; i < selIdx.size(); ++i)
+      if(selIdx[i] != (IndexType)i)
+        return false;
+    return true;
+  }
 };
 
 class States {
@@ -141,6 +159,13 @@ public:
 
 class RNN;
 
+// Weights of a GRU cell, see Cell::plainGRU()
+struct GRUWeights {
+  Expr W; // [dimInput, 3 * dimState]
+  Expr U; // [dimState, 3 * dimState]
+  Expr b; // [1, 3 * dimState]
+};
+
 class Cell : public Stackable {
 protected:
   std::vector<std::function<Expr(Ptr<rnn::RNN>)>> lazyInputs_;
@@ -167,6 +192,11 @@ public:
   virtual std::vector<Expr> applyInput(std::vector<Expr> inputs) = 0;
   virtual State applyState(std::vector<Expr>, State, Expr = nullptr) = 0;
 
+  // The weights of a GRU cell whose applyState() is gruOps(state, input * W, state * U, b), i.e. without final, layer
+  // normalization, dropout or transition. RNN::transduceJointly() runs such cells of independent RNNs in the same
+  // steps. nullptrs otherwise.
+  virtual GRUWeights plainGRU() const { return {}; }
+
   virtual void clear() override {}
 };
 
@@ -247,6 +277,12 @@ public:
     return hidden;
   };
 
+  GRUWeights plainGRU() const override {
+    if(stackables_.size() != 1 || !stackables_[0]->is<Cell>())
+      return {};
+    return stackables_[0]->as<Cell>()->plainGRU();
+  }
+
   Ptr<Stackable> operator[](int i) { return stackables_[i]; }
 
   Ptr<Stackable> at(int i) { return stackables_[i]; }
@@ -2,13 +2,16 @@
 
 #include <cstdint>
 #include <deque>
+#include <iomanip>
 #include <memory>
 #include <set>
+#include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "common/definitions.h"
+#include "common/hash.h"
 #include "common/types.h"
 #include "tensors/device.h"
 #include "tensors/memory_piece.h"
@@ -78,6 +81,43 @@ public:
   Gap rest(size_t offset) const { return Gap(data_ + offset, size_ - offset); }
 };
 
+// Memory use of an Allocator, see Allocator::statistics()
+struct AllocatorStatistics {
+  size_t reserved{0};    // bytes of the device memory
+  size_t used{0};        // bytes of the allocated pieces
+  size_t held{0};        // bytes of the blocks that hold them, larger than used with size classes
+  size_t peak{0};        // most bytes held at any time since the allocator was created
+  size_t cached{0};      // bytes of freed blocks that are kept for their size class
+  size_t available{0};   // bytes of the gaps
+  size_t largestGap{0};
+  size_t gaps{0};
+  size_t allocations{0};
+  size_t reused{0};      // allocations served from the blocks of a size class
+
+  // 0 if all gaps are one piece of memory, close to 1 if the free memory is split into many small gaps
+  float fragmentation() const { return available > 0 ? 1.f - (float)largestGap / available : 0.f; }
+
+  std::string toString() const {
+    const float MB = 1024.f * 1024.f;
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << used / MB << " MB used in " << held / MB << " MB, peak " << peak / MB
+       << " MB, " << cached / MB << " MB cached, " << available / MB << " MB free in " << gaps
+       << " gaps with fragmentation " << std::setprecision(2) << fragmentation() << ", " << reused << " of "
+       << allocations << " allocations reused";
+    return ss.str();
+  }
+};
+
+/**
+ * Allocates pieces of the memory of a device, which it grows by step bytes whenever no gap is large enough.
+ *
+ * By default each allocation takes the smallest gap it fits into and frees merge with their adjacent gaps. With
+ * setSizeClasses(true), allocations are rounded up to a size class instead, four per power of two, and freed blocks
+ * are kept in a free list per class for the next allocation of that class. Workloads with many allocations of slowly
+ * varying sizes, e.g. training on batches of different lengths, then reuse the same blocks rather than splitting gaps
+ * into ever smaller pieces, for at most 25% more memory per allocation. The free lists are merged back into the gaps
+ * before the allocator grows.
+ */
 class Allocator {
 private:
   Ptr<Device> device_;
@@ -86,15 +126,22 @@ private:
   size_t alignment_{256};
 
   bool throw_{false};
+  bool sizeClasses_{false};
 
   std::set<Gap> gaps_;
+  std::unordered_map<size_t, std::vector<uint8_t*>> freeBlocks_; // by size class, if sizeClasses_
+  AllocatorStatistics stats_;
   std::unordered_map<uint8_t*, MemoryPiece::PtrType> allocated_;
+  std::unordered_map<uint8_t*, std::vector<MemoryPiece::PtrType>> subPieces_; // by the allocated piece they are in
 
   void grow(size_t add) {
     add = alignedSize(add);
     uint8_t* oldData = device_->data();
     size_t oldSize = device_->size();
 
+    LOG(info, "[memory] Growing workspace by {} MB (device {}): {}", add / (1024 * 1024), device_->getDeviceId(),
+        statistics().toString());
+
     device_->reserve(oldSize + add);
 
     std::set<Gap> oldGaps;
@@ -112,15 +159,53 @@ private:
       allocated_[newPtr] = oldAllocated[it.first];
       allocated_[newPtr]->setPtr(newPtr);
     }
+
+    std::unordered_map<uint8_t*, std::vector<MemoryPiece::PtrType>> oldSubPieces;
+    subPieces_.swap(oldSubPieces);
+    for(auto& it : oldSubPieces) {
+      uint8_t* newPtr = device_->data() + std::distance(oldData, it.first);
+      for(auto& sub : it.second)
+        sub->setPtr(device_->data() + std::distance(oldData, sub->data()));
+      subPieces_[newPtr] = std::move(it.second);
+    }
+
+    for(auto& it : freeBlocks_)
+      for(auto& ptr : it.second)
+        ptr = device_->data() + std::distance(oldData, ptr);
+  }
+
+  // 4 classes per power of two above 4 * alignment_, bytes is aligned
+  size_t sizeClass(size_t bytes) const {
+    if(bytes <= 4 * alignment_)
+      return bytes;
+    size_t power = 1;
+    while(power <= bytes / 2)
+      power *= 2;
+    size_t step = power / 4;
+    return alignedSize((bytes + step - 1) / step * step);
+  }
+
+  // returns the cached blocks of all size classes to the gaps
+  void releaseFreeBlocks() {
+    for(auto& it : freeBlocks_)
+      for(auto ptr : it.second)
+        insertGap(Gap(ptr, it.first), true);
+    freeBlocks_.clear();
+    stats_.cached = 0;
   }
 
   Gap getGap(size_t size) {
     size = alignedSize(size);
     auto it = std::lower_bound(gaps_.begin(), gaps_.end(), Gap(nullptr, size));
 
+    if(it == gaps_.end() && stats_.cached > 0) {
+      releaseFreeBlocks();
+      it = std::lower_bound(gaps_.begin(), gaps_.end(), Gap(nullptr, size));
+    }
+
     if(throw_ && it == gaps_.end()) {
       //ABORT("Trying to allocate {}, but only {} available.", available_, size);
-      throw AllocationException(available_, size);
+      throw AllocationException(available(), size);
     }
 
     // @TODO: compact memory before re-allocation attempt, maybe by left shifting memory over currently largest gap
@@ -182,6 +267,14 @@ public:
 
   void throwAtReallocation(bool throwRealloc) { throw_ = throwRealloc; }
 
+  // switches between size classes and best-fit gaps, see the class comment. Only while nothing is allocated.
+  void setSizeClasses(bool sizeClasses) {
+    ABORT_IF(!allocated_.empty(), "Cannot switch the allocation mode while {} pieces are allocated", allocated_.size());
+    if(!sizeClasses)
+      releaseFreeBlocks();
+    sizeClasses_ = sizeClasses;
+  }
+
   void reserve(size_t bytes) {
     bytes = alignedSize(bytes);
     if(bytes > 0)
@@ -201,18 +294,42 @@ public:
 
   MemoryPiece::PtrType alloc(size_t bytes) {
     bytes = alignedSize(bytes);
-    Gap gap = getGap(bytes);
-
-    if(gap.size() > bytes) {
-      insertGap(gap.rest(bytes), false);
+    size_t blockBytes = sizeClasses_ ? sizeClass(bytes) : bytes;
+
+    uint8_t* ptr;
+    auto block = freeBlocks_.find(blockBytes);
+    if(block != freeBlocks_.end() && !block->second.empty()) {
+      ptr = block->second.back();
+      block->second.pop_back();
+      stats_.cached -= blockBytes;
+      stats_.reused++;
+    } else {
+      Gap gap = getGap(blockBytes);
+      if(gap.size() > blockBytes) {
+        insertGap(gap.rest(blockBytes), false);
+      }
+      ptr = gap.data();
     }
 
-    auto ptr = gap.data();
+    // the piece has the requested size, free() finds the size of its block from it
     auto mp = MemoryPiece::New(ptr, bytes);
     allocated_[ptr] = mp;
+    stats_.used += bytes;
+    stats_.held += blockBytes;
+    stats_.peak = std::max(stats_.peak, stats_.held);
+    stats_.allocations++;
     return mp;
   }
 
+  // A piece of bytes at offset inside the allocated piece mp, which moves with mp when the allocator grows. It is
+  // not allocated itself, free() ignores it, and it is valid as long as mp is.
+  MemoryPiece::PtrType subPiece(MemoryPiece::PtrType mp, size_t offset, size_t bytes) {
+    ABORT_IF(offset + bytes > mp->size(), "Piece of {} bytes at {} does not fit into {} bytes", bytes, offset, mp->size());
+    auto sub = MemoryPiece::New(mp->data() + offset, bytes);
+    subPieces_[mp->data()].push_back(sub);
+    return sub;
+  }
+
   bool free(uint8_t* ptr, size_t bytes) {
     bytes = alignedSize(bytes);
 
@@ -224,13 +341,25 @@ public:
     auto it = allocated_.find(ptr);
     if(it != allocated_.end()) {
       allocated_.erase(ptr);
-      insertGap(Gap(ptr, bytes), true);
+      subPieces_.erase(ptr);
+      size_t blockBytes = sizeClasses_ ? sizeClass(bytes) : bytes;
+      stats_.used -= bytes;
+      stats_.held -= blockBytes;
+      if(sizeClasses_) {
+        freeBlocks_[blockBytes].push_back(ptr);
+        stats_.cached += blockBytes;
+      } else {
+        insertGap(Gap(ptr, bytes), true);
+      }
       return true;
     }
     return false;
   }
 
   bool free(MemoryPiece::PtrType mp) {
+    auto it = allocated_.find(mp->data());
+    if(it != allocated_.end() && it->second != mp) // e.g. a sub piece at the start of an allocated piece
+      return false;
     if(free(mp->data(), mp->size())) {
       mp->set(nullptr, 0);
       return true;
@@ -242,6 +371,9 @@ public:
     available_ = 0;
     gaps_.clear();
     allocated_.clear();
+    subPieces_.clear();
+    freeBlocks_.clear();
+    stats_.used = stats_.held = stats_.cached = 0;
     insertGap({device_->data(), device_->size()}, false);
   }
 
@@ -251,7 +383,35 @@ public:
 
   size_t size() { return device_->size(); }
 
-  size_t available() { return available_; }
+  size_t available() { return available_ + stats_.cached; }
+
+  AllocatorStatistics statistics() {
+    auto stats = stats_;
+    stats.reserved = device_->size();
+    stats.available = available_;
+    stats.gaps = gaps_.size();
+    stats.largestGap = gaps_.empty() ? 0 : gaps_.rbegin()->size();
+    return stats;
+  }
+
+  // Fingerprint of the free memory. The same sequence of alloc() and free() calls returns the same
+  // addresses from two states with the same fingerprint.
+  size_t hash() {
+    size_t seed = util::hash<size_t>()((size_t)device_->data());
+    for(const auto& gap : gaps_) {
+      util::hash_combine(seed, (size_t)gap.data());
+      util::hash_combine(seed, gap.size());
+    }
+    size_t blocks = 0; // independent of the order of the size classes
+    for(const auto& it : freeBlocks_) {
+      size_t classSeed = util::hash<size_t>()(it.first);
+      for(auto ptr : it.second)
+        util::hash_combine(classSeed, (size_t)ptr);
+      blocks += classSeed;
+    }
+    util::hash_combine(seed, blocks);
+    return seed;
+  }
 
   DeviceId getDeviceId() { return device_->getDeviceId(); }
 };
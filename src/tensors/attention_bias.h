@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "functional/defs.h"
+#include "tensors/tensor.h"
+
+#include <cmath>
+
+namespace marian {
+
+// Additive bias of the attention scores [dimBeam, dimBatch * numHeads, dimQuery, dimKeys] for TiledAttention().
+// The bias is evaluated for every score where it is needed, hence neither the bias nor the scores are ever
+// materialized as a whole.
+struct AttentionBias {
+  // log mask that broadcasts against the scores, e.g. [1, dimBatch * numHeads, 1, dimKeys], may be null
+  marian::Tensor logMask;
+
+  // ALiBi bias as computed by alibiLogMask() in layers_new/alibi.cpp, only used if alibiMask is set
+  marian::Tensor alibiMask;   // [1, dimBatch, dimKeys, 1], 0 for padding
+  marian::Tensor alibiSlopes; // [numHeads, 1, 1]
+  marian::Tensor alibiBiases; // [numHeads, 1, 1]
+  marian::Tensor alibiShift;  // [dimBeam, dimBatch, dimQuery, 1], may be null
+  int numHeads{1};
+  int start{0};
+  bool causal{false};
+};
+
+// Plain pointers and strides of an AttentionBias that are passed by value into the CPU and GPU kernels.
+// Strides are 0 along broadcast dimensions.
+struct AttentionBiasArgs {
+  const float* logMask{nullptr};
+  int maskStrides[4]{0, 0, 0, 0}; // beam, batch * heads, query, key
+
+  const float* alibiMask{nullptr};
+  const float* slopes{nullptr};
+  const float* biases{nullptr};
+  const float* shift{nullptr};
+  int shiftStrides[3]{0, 0, 0}; // beam, batch, query
+  int numHeads{1};
+  int start{0};
+  int dimKeys{0};
+  bool causal{false};
+
+  AttentionBiasArgs(const AttentionBias& bias, const marian::Shape& scores) {
+    // trailing dimensions of a tensor of up to four dimensions, missing leading ones broadcast
+    auto dim = [](const marian::Shape& shape, int d) { return -d <= (int)shape.size() ? shape[d] : 1; };
+    // strides like functional::Shape, but 0 for dimensions of size 1 that broadcast
+    auto strides = [&](const marian::Shape& shape, int* out, int n) {
+      int stride = 1;
+      for(int i = n - 1; i >= 0; --i) {
+        int d = dim(shape, i - n);
+        out[i] = d == 1 ? 0 : stride;
+        stride *= d;
+      }
+    };
+
+    if(bias.logMask) {
+      const auto& shape = bias.logMask->shape();
+      ABORT_IF(shape.size() > 4, "Attention mask of shape {} has more than four dimensions", shape);
+      for(int d = -1; d >= -4; --d)
+        ABORT_IF(dim(shape, d) != 1 && dim(shape, d) != dim(scores, d),
+                 "Attention mask of shape {} does not broadcast to scores of shape {}", shape, scores);
+      logMask = bias.logMask->data();
+      strides(shape, maskStrides, 4);
+    }
+
+    if(bias.alibiMask) {
+      alibiMask = bias.alibiMask->data();
+      slopes    = bias.alibiSlopes->data();
+      biases    = bias.alibiBiases->data();
+      numHeads  = bias.numHeads;
+      start     = bias.start;
+      causal    = bias.causal;
+      dimKeys   = bias.alibiMask->shape()[-2];
+      ABORT_IF(dimKeys != dim(scores, -1), "ALiBi mask of shape {} does not match scores of shape {}",
+               bias.alibiMask->shape(), scores);
+      if(bias.alibiShift) {
+        shift = bias.alibiShift->data();
+        marian::Shape shiftShape = bias.alibiShift->shape(); // [dimBeam, dimBatch, dimQuery, 1]
+        int s[4];
+        strides(shiftShape, s, 4);
+        shiftStrides[0] = s[0];
+        shiftStrides[1] = s[1];
+        shiftStrides[2] = s[2];
+      }
+    }
+  }
+
+  // bias of the score of query position `query` and key position `key` in batch entry `batchHead` of beam `beam`,
+  // the same value as z + logMask or z + alibiLogMask(...) would add when materialized
+  HOST_DEVICE_INLINE float operator()(int beam, int batchHead, int query, int key) const {
+    float x = 0.f;
+    if(logMask)
+      x = logMask[beam * maskStrides[0] + batchHead * maskStrides[1] + query * maskStrides[2] + key * maskStrides[3]];
+    if(alibiMask) {
+      int batch    = batchHead / numHeads;
+      int head     = batchHead % numHeads;
+      int queryPos = query + start;
+
+      float relPos = (float)key - (float)queryPos;
+      if(shift)
+        relPos -= shift[beam * shiftStrides[0] + batch * shiftStrides[1] + query * shiftStrides[2]];
+
+      bool masked = alibiMask[batch * dimKeys + key] == 0.f || (causal && key > queryPos);
+      x += masked ? -INFINITY : slopes[head] * fabsf(relPos + biases[head]);
+    }
+    return x;
+  }
+};
+
+}  // namespace marian
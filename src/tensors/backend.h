@@ -1,13 +1,18 @@
 #pragma once
 
 #include "common/definitions.h"
+#include "common/sparsity.h"
 #include "tensors/rand.h"
 
+#include <functional>
+
 namespace marian {
 
+class AutoTunerCache;
+
 // GEMM type enum
 typedef enum {
-  Auto = 0,            // auto tuning between available GEMMs
+  Auto = 0,            // fp32 with GEMM schedules tuned per shape
   Float32 = 1,         // MKL based GEMM, fp32
   FbFp16Packed = 10,   // FBGEMM based fp16 GEMM with packing
   FbInt8Packed = 11    // FBGEMM based int8 GEMM with packing
@@ -18,6 +23,7 @@ protected:
   DeviceId deviceId_;
   size_t seed_;
   Ptr<RandomGenerator> randomGenerator_;
+  bool inputUploads_{false};
   
 public:
   Backend(DeviceId deviceId, size_t seed)
@@ -25,6 +31,8 @@ public:
   virtual ~Backend() {};
   virtual DeviceId getDeviceId() { return deviceId_; };
   virtual Ptr<RandomGenerator> getRandomGenerator() { return randomGenerator_; }
+  // restarts the random numbers from seed, e.g. to draw the same dropout masks when a forward pass is repeated
+  void setRandomSeed(size_t seed) { randomGenerator_ = createRandomGenerator(seed, deviceId_); }
 
   // for GPU only, calls cudaSetDevice, does nothing on CPU. Maybe change name.
   virtual void setDevice() = 0;
@@ -43,6 +51,49 @@ public:
   // for GPU, there's no quantization. so, it does nothing.
   virtual void setQuantizeRange(float range) = 0;
   virtual float getQuantizeRange() = 0;
+  // for CPU, sets the N:MxW sparsity pattern of the weight matrices that the sparse kernel multiplies with.
+  // for GPU, there's no sparse kernel. so, it does nothing.
+  virtual void setSparseGemm(const std::string& pattern) = 0;
+  virtual SparsityPattern getSparseGemm() = 0;
+  // for CPU, keeps the decisions of the GEMM tuner of --gemm-type auto in cache, see --autotune-cache.
+  // for GPU, there's no GEMM tuner. so, it does nothing.
+  virtual void setAutoTunerCache(Ptr<AutoTunerCache> cache) = 0;
+  // for CPU, sets the number of threads that share the work of large kernels of one graph.
+  // for GPU, kernels are parallel anyway. so, it does nothing.
+  virtual void setIntraOpThreads(size_t threads) = 0;
+  // for GPU, keeps up to this many CUDA graphs of captured forward passes for replay, 0 disables them.
+  // for CPU, there are no CUDA graphs. so, it does nothing.
+  virtual void setCudaGraphs(size_t maxGraphs) = 0;
+  virtual size_t getCudaGraphs() = 0;
+  // Runs forward(capturing), which enqueues the kernels of a forward pass. For GPU with CUDA graphs, calls with
+  // the same key have to enqueue the same kernels on the same memory, so that they can replay a captured graph.
+  virtual void runForward(size_t /*key*/, const std::function<void(bool)>& forward) { forward(/*capturing=*/false); }
+  // for GPU, runs the GEMMs of affine layers in FP8 with scales from an amax history of this many steps, 0 disables FP8.
+  // for CPU, there is no FP8. so, it does nothing.
+  virtual void setFp8(size_t amaxHistory) = 0;
+  virtual size_t getFp8() = 0;
+  // for GPU, uploads the host data of graph inputs through two page-locked staging buffers of this many bytes each
+  // without waiting for the device, 0 copies synchronously.
+  // for CPU, there is nothing to upload. so, it does nothing.
+  virtual void setPinnedUploads(size_t bytes) = 0;
+  virtual size_t getPinnedUploads() = 0;
+  // copies bytes of host memory src to dest in the memory of this backend
+  virtual void upload(void* dest, const void* src, size_t bytes) = 0;
+
+  // Copies of device memory in host memory, for activation offloading in training. offload() copies bytes of src
+  // after the work enqueued so far and returns a handle, isOffloaded() tells whether src may be reused, and
+  // restore() copies the copy back into dest, or drops it if dest is null. Work enqueued after waitRestores()
+  // sees all of them.
+  // for GPU, the copies run on a separate stream from and to page-locked memory and overlap with the kernels.
+  // for CPU, they are synchronous copies to the heap, which save no memory.
+  virtual size_t offload(const void* src, size_t bytes) = 0;
+  virtual bool isOffloaded(size_t handle) = 0;
+  virtual void restore(size_t handle, void* dest) = 0;
+  virtual void waitRestores() = 0;
+
+  // set while a graph initializes its constants from host data, the inputs the pinned uploads are meant for
+  void setInputUploads(bool inputUploads) { inputUploads_ = inputUploads; }
+  bool isInputUploads() const { return inputUploads_; }
 };
 
 Ptr<Backend> BackendByDeviceId(DeviceId deviceId, size_t seed);
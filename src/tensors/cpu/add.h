@@ -10,13 +10,14 @@
 #include "functional/tensor.h"
 #include "functional/tmp.h"
 #include "tensors/tensor.h"
+#include "tensors/cpu/multiversion.h"
 
 namespace marian {
 
 namespace cpu {
 
 template <size_t K, class Functor, class AggFunctor>
-void gAggregateGeneric(Functor functor, float aggInit, AggFunctor aggFunctor,
+CPU_MULTIVERSION void gAggregateGeneric(Functor functor, float aggInit, AggFunctor aggFunctor,
                  const functional::Shape full,
                  functional::Tensor<float> out,
                  functional::Array<functional::Tensor<float>, K> ins,
@@ -43,7 +44,7 @@ void gAggregateGeneric(Functor functor, float aggInit, AggFunctor aggFunctor,
 }
 
 template <size_t K, class Functor, class AggFunctor>
-void gAggregateEqual(Functor functor, AggFunctor aggFunctor,
+CPU_MULTIVERSION void gAggregateEqual(Functor functor, AggFunctor aggFunctor,
                functional::Tensor<float> out,
                functional::Array<functional::Tensor<float>, K> ins,
                float scale,
@@ -66,7 +67,7 @@ void gAggregateEqual(Functor functor, AggFunctor aggFunctor,
 }
 
 template <size_t K, class Functor, class AggFunctor>
-void gAggregateReduce(Functor functor, float aggInit, AggFunctor aggFunctor,
+CPU_MULTIVERSION void gAggregateReduce(Functor functor, float aggInit, AggFunctor aggFunctor,
                 const functional::Shape full,
                 functional::Tensor<float> out,
                 functional::Array<functional::Tensor<float>, K> ins,
@@ -0,0 +1,128 @@
+#include "tensors/cpu/amx_int8.h"
+#include "tensors/cpu/backend.h"
+
+#include "prod_blas.h"
+
+#include <cmath>
+#include <vector>
+
+// The packed int8 GEMM API has been part of MKL for long, AMX kernels behind it need oneMKL 2021.1 or newer
+#if MKL_FOUND && defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 20210000
+#define MKL_AMX_GEMM 1
+#else
+#define MKL_AMX_GEMM 0
+#endif
+
+namespace marian {
+namespace cpu {
+namespace amx {
+
+bool isAvailable() {
+  return MKL_AMX_GEMM;
+}
+
+#if MKL_AMX_GEMM
+// B is k x n; the packed size does not depend on the number of rows m of A
+static size_t mklPackedSize(int k, int n) {
+  return cblas_gemm_s8u8s32_pack_get_size(CblasBMatrix, /*m=*/1, n, k);
+}
+#endif
+
+size_t packedBytes(const Shape& shape) {
+#if MKL_AMX_GEMM
+  int k = shape.elements() / shape[-1];
+  int n = shape[-1];
+  return mklPackedSize(k, n) + sizeof(float);
+#else
+  shape;
+  ABORT("Type {} needs marian compiled with oneMKL 2021.1 or newer", Type::intgemm8amx);
+#endif
+}
+
+float& getQuantMult(marian::Tensor packed) {
+  ABORT_IF(packed->type() != Type::intgemm8amx, "getQuantMult does not work for type {}", packed->type());
+  return *reinterpret_cast<float*>(packed->data<char>() + packedBytes(packed->shape()) - sizeof(float));
+}
+
+static float maxAbsolute(const float* begin, const float* end) {
+  float maxAbs = 0.f;
+  for(auto it = begin; it != end; ++it)
+    maxAbs = std::max(maxAbs, std::abs(*it));
+  return maxAbs;
+}
+
+static inline int quantize(float x, float quantMult) {
+  return (int)std::max(-127.f, std::min(127.f, std::nearbyint(x * quantMult)));
+}
+
+void PackB(marian::Tensor out, const marian::Tensor in, float quantMult) {
+#if MKL_AMX_GEMM
+  ABORT_IF(out->type() != Type::intgemm8amx, "Output of AMX packing has type {}", out->type());
+  ABORT_IF(out->shape() != in->shape(), "Shapes {} and {} differ in AMX packing", out->shape(), in->shape());
+  int k = in->shape().elements() / in->shape()[-1];
+  int n = in->shape()[-1];
+
+  std::vector<MKL_INT8> quantized(in->shape().elements());
+  const float* src = in->data();
+  for(size_t i = 0; i < quantized.size(); ++i)
+    quantized[i] = (MKL_INT8)quantize(src[i], quantMult);
+
+  cblas_gemm_s8u8s32_pack(CblasRowMajor, CblasBMatrix, CblasNoTrans, /*m=*/1, n, k, quantized.data(), n, out->data<char>());
+  getQuantMult(out) = quantMult;
+#else
+  out; in; quantMult;
+  ABORT("Type {} needs marian compiled with oneMKL 2021.1 or newer", Type::intgemm8amx);
+#endif
+}
+
+void Affine(marian::Tensor C,
+            const marian::Tensor& A,
+            const marian::Tensor& B,
+            const marian::Tensor& bias,
+            float scale) {
+#if MKL_AMX_GEMM
+  int m = A->shape().elements() / A->shape()[-1];
+  int k = A->shape()[-1];
+  int n = B->shape()[-1];
+  ABORT_IF(B->shape().elements() / n != k, "AMX GEMM of shapes {} and {} does not match", A->shape(), B->shape());
+
+  const float* a = A->data();
+  float aQuantMult = 127.f / std::max(maxAbsolute(a, a + A->shape().elements()), 1e-9f);
+  float unquantMult = scale / (aQuantMult * getQuantMult(B));
+  const float* biasData = bias ? bias->data() : nullptr;
+
+  // In row-major layout MKL expects unsigned A and signed B, hence A is shifted by 128 and
+  // the offset ao = -128 takes the shift back out in the int32 accumulators.
+  const size_t minRows = std::max<size_t>(8, ((size_t)1 << 20) / std::max<size_t>((size_t)n * k, 1));
+  parallelFor(C->getBackend(), m, minRows, [&](size_t begin, size_t end) {
+    int rows = (int)(end - begin);
+    thread_local std::vector<MKL_UINT8> aQuant;
+    thread_local std::vector<MKL_INT32> cInt;
+    aQuant.resize((size_t)rows * k);
+    cInt.resize((size_t)rows * n);
+
+    const float* aRows = a + begin * k;
+    for(size_t i = 0; i < aQuant.size(); ++i)
+      aQuant[i] = (MKL_UINT8)(quantize(aRows[i], aQuantMult) + 128);
+
+    MKL_INT32 co = 0;
+    cblas_gemm_s8u8s32_compute(CblasRowMajor, CblasNoTrans, CblasPacked, CblasFixOffset,
+                               rows, n, k,
+                               1.f, aQuant.data(), k, /*ao=*/-128,
+                               B->data<char>(), n, /*bo=*/0,
+                               0.f, cInt.data(), n, &co);
+
+    float* c = C->data() + begin * n;
+    for(int i = 0; i < rows; ++i)
+      for(int j = 0; j < n; ++j)
+        c[i * n + j] = cInt[(size_t)i * n + j] * unquantMult + (biasData ? biasData[j] : 0.f);
+  });
+#else
+  C; A; B; bias; scale;
+  ABORT("Type {} needs marian compiled with oneMKL 2021.1 or newer", Type::intgemm8amx);
+#endif
+}
+
+}  // namespace amx
+}  // namespace cpu
+}  // namespace marian
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "tensors/tensor.h"
+
+namespace marian {
+namespace cpu {
+namespace amx {
+
+// Int8 GEMMs for Type::intgemm8amx, run by oneMKL's cblas_gemm_s8u8s32 on packed weights. oneMKL picks
+// AMX tile instructions where the CPU has them (Sapphire Rapids and newer) and AVX512-VNNI kernels otherwise.
+// The packed layout is opaque; the quantization multiplier of B is stored at the back of the tensor, as
+// for the other intgemm types.
+
+// true if this build has the oneMKL int8 GEMM
+bool isAvailable();
+
+// number of bytes of a packed B matrix of the given (unpacked float32) shape, quantization multiplier included
+size_t packedBytes(const Shape& shape);
+
+float& getQuantMult(marian::Tensor packed);
+
+// quantizes the float32 matrix in (k x n) with quantMult and packs it into out of type Type::intgemm8amx
+void PackB(marian::Tensor out, const marian::Tensor in, float quantMult);
+
+// C = scale * A * B (+ bias) with float32 A and C and packed B. A is quantized on the fly with a
+// per-tensor quantization multiplier like intgemm's PrepareA().
+void Affine(marian::Tensor C,
+            const marian::Tensor& A,
+            const marian::Tensor& B,
+            const marian::Tensor& bias,
+            float scale);
+
+}  // namespace amx
+}  // namespace cpu
+}  // namespace marian
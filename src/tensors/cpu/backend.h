@@ -1,9 +1,14 @@
 #pragma once
 
+#include <cstring>
 #include <functional>
 #include <random>
+#include <unordered_map>
+#include <vector>
 
+#include "3rd_party/threadpool.h"
 #include "common/config.h"
+#include "graph/auto_tuner.h"
 #include "tensors/backend.h"
 
 namespace marian {
@@ -14,6 +19,13 @@ protected:
   bool optimized_{false};
   GemmType gemmType_{GemmType::Float32};
   float quantizeRange_{0.f};
+  SparsityPattern sparseGemm_;
+  Ptr<AutoTunerCache> autoTunerCache_;
+  UPtr<VariantTuner> gemmTuner_; // of --gemm-type auto, created on first use
+  size_t intraOpThreads_{1};
+  Ptr<ThreadPool> intraOpPool_; // intraOpThreads_ - 1 workers, the calling thread does its share
+  std::unordered_map<size_t, std::vector<char>> offloads_;
+  size_t lastOffload_{0};
 
 public:
   Backend(DeviceId deviceId, size_t seed) : marian::Backend(deviceId, seed) {}
@@ -42,7 +54,92 @@ public:
   // for GPU, there's no quantization. so, it does nothing.
   void setQuantizeRange(float range) override { quantizeRange_ = range; }
   float getQuantizeRange() override { return quantizeRange_; }
+  // for CPU, sets the sparsity pattern of the weight matrices for the sparse kernel, see --sparse-gemm.
+  void setSparseGemm(const std::string& pattern) override { sparseGemm_ = SparsityPattern(pattern); }
+  SparsityPattern getSparseGemm() override { return sparseGemm_; }
+  // for CPU, keeps the decisions of the GEMM tuner of --gemm-type auto in cache. Call before the first GEMM.
+  void setAutoTunerCache(Ptr<AutoTunerCache> cache) override { autoTunerCache_ = cache; }
+
+  // Ways to split a float32 GEMM over the intra-op threads with --gemm-type auto, see cpu::Prod()
+  enum class GemmSplit : size_t { Rows = 0, Columns = 1, None = 2 };
+
+  // The tuner of the GEMM split with --gemm-type auto and several intra-op threads, nullptr otherwise
+  VariantTuner* getGemmTuner() {
+    if(gemmType_ != GemmType::Auto || intraOpThreads_ <= 1)
+      return nullptr;
+    if(!gemmTuner_)
+      gemmTuner_.reset(new VariantTuner("cpu-sgemm-split", {"rows", "columns", "none"}, autoTunerCache_));
+    return gemmTuner_.get();
+  }
+
+  // for CPU, sets the number of threads that share the work of large kernels of one graph.
+  // Every graph of --cpu-threads gets its own pool, so the total is the product of both.
+  void setIntraOpThreads(size_t threads) override {
+    intraOpThreads_ = std::max<size_t>(threads, 1);
+    intraOpPool_ = intraOpThreads_ > 1 ? New<ThreadPool>(intraOpThreads_ - 1) : nullptr;
+  }
+  size_t getIntraOpThreads() const { return intraOpThreads_; }
+
+  // for CPU, there are no CUDA graphs. so, it does nothing.
+  void setCudaGraphs(size_t maxGraphs) override {
+    LOG_ONCE(info, "setCudaGraphs() not supported for CPU_{}", maxGraphs);
+  }
+  size_t getCudaGraphs() override { return 0; }
+
+  // for CPU, there is no FP8. so, it does nothing.
+  void setFp8(size_t amaxHistory) override {
+    LOG_ONCE(info, "setFp8() not supported for CPU_{}", amaxHistory);
+  }
+  size_t getFp8() override { return 0; }
+
+  void setPinnedUploads(size_t bytes) override {
+    LOG_ONCE(info, "setPinnedUploads() not supported for CPU_{}", bytes);
+  }
+  size_t getPinnedUploads() override { return 0; }
+  void upload(void* dest, const void* src, size_t bytes) override { std::memcpy(dest, src, bytes); }
+
+  // for CPU, activations are offloaded to plain heap memory, synchronously
+  size_t offload(const void* src, size_t bytes) override {
+    auto& copy = offloads_[++lastOffload_];
+    copy.assign((const char*)src, (const char*)src + bytes);
+    return lastOffload_;
+  }
+  bool isOffloaded(size_t /*handle*/) override { return true; }
+  void restore(size_t handle, void* dest) override {
+    auto it = offloads_.find(handle);
+    ABORT_IF(it == offloads_.end(), "Unknown offloaded copy {}", handle);
+    if(dest)
+      std::memcpy(dest, it->second.data(), it->second.size());
+    offloads_.erase(it);
+  }
+  void waitRestores() override {}
+
+  // Calls fn(begin, end) for consecutive ranges that cover [0, n), each with at least minItems items
+  // unless n is smaller, one range per intra-op thread at most. The calling thread processes the
+  // first range and returns after all ranges are done. Ranges must not write to shared memory.
+  void parallelFor(size_t n, size_t minItems, const std::function<void(size_t, size_t)>& fn) {
+    size_t numRanges = intraOpPool_ ? std::min(intraOpThreads_, n / std::max<size_t>(minItems, 1)) : 1;
+    if(numRanges <= 1) {
+      fn(0, n);
+      return;
+    }
+    size_t rangeSize = (n + numRanges - 1) / numRanges;
+    std::vector<std::future<void>> pending;
+    for(size_t begin = rangeSize; begin < n; begin += rangeSize)
+      pending.push_back(intraOpPool_->enqueue([&fn, begin, rangeSize, n]() { fn(begin, std::min(begin + rangeSize, n)); }));
+    fn(0, rangeSize);
+    for(auto& range : pending)
+      range.get(); // re-throws exceptions of the workers
+  }
 };
 
+// parallelFor() of a tensor's backend, which is a CPU backend inside of the CPU kernels
+inline void parallelFor(Ptr<marian::Backend> backend,
+                        size_t n,
+                        size_t minItems,
+                        const std::function<void(size_t, size_t)>& fn) {
+  std::static_pointer_cast<Backend>(backend)->parallelFor(n, minItems, fn);
+}
+
 }  // namespace cpu
 }  // namespace marian
@@ -0,0 +1,137 @@
+#include "tensors/cpu/bfloat16.h"
+#include "tensors/cpu/backend.h"
+#include "tensors/tensor.h"
+
+#include "prod_blas.h"
+
+#include <vector>
+
+// cblas_gemm_bf16bf16f32 is available since oneMKL 2021.1, it uses AVX512-BF16 or AMX-BF16 instructions
+// when the CPU supports them and emulates them otherwise
+#if MKL_FOUND && defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 20210000
+#define MKL_BF16_GEMM 1
+#else
+#define MKL_BF16_GEMM 0
+#endif
+
+namespace marian {
+namespace cpu {
+namespace bf16 {
+
+static void fromFloat(uint16_t* out, const float* in, size_t n) {
+#ifdef __AVX512BF16__
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16) {
+    __m256bh v = _mm512_cvtneps_pbh(_mm512_loadu_ps(in + i));
+    _mm256_storeu_si256((__m256i*)(out + i), (__m256i)v);
+  }
+  for(; i < n; ++i)
+    out[i] = fromFloat(in[i]);
+#else
+  for(size_t i = 0; i < n; ++i)
+    out[i] = fromFloat(in[i]);
+#endif
+}
+
+void FromFloat(marian::Tensor out, const marian::Tensor in) {
+  ABORT_IF(out->type() != Type::bfloat16, "Output of bfloat16 conversion has type {}", out->type());
+  ABORT_IF(in->type() != Type::float32, "Input of bfloat16 conversion has type {}", in->type());
+  ABORT_IF(out->shape() != in->shape(), "Shapes {} and {} differ in bfloat16 conversion", out->shape(), in->shape());
+  fromFloat(out->data<uint16_t>(), in->data(), in->shape().elements());
+}
+
+void Affine(marian::Tensor C,
+            const marian::Tensor& A,
+            const marian::Tensor& B,
+            const marian::Tensor& bias,
+            bool transA,
+            bool transB,
+            float scale) {
+#if BLAS_FOUND
+  int m = A->shape().elements() / A->shape()[-1];
+  int k = A->shape()[-1];
+  if(transA)
+    std::swap(m, k);
+
+  int n = B->shape()[-1];
+  if(transB)
+    n = B->shape().elements() / B->shape()[-1];
+
+  int lda = A->shape()[-1];
+  int ldb = B->shape()[-1];
+  int ldc = n;
+
+  // the bias is added by the GEMM via beta = 1
+  float beta = 0.f;
+  if(bias) {
+    const float* b = bias->data();
+    for(int i = 0; i < m; ++i)
+      std::copy(b, b + n, C->data() + (size_t)i * ldc);
+    beta = 1.f;
+  }
+
+#if MKL_BF16_GEMM
+  // blocks of rows of C over the intra-op threads as in cpu::Prod, each block converts its rows of A
+  const size_t minRows = std::max<size_t>(8, ((size_t)1 << 20) / std::max<size_t>((size_t)n * k, 1));
+  parallelFor(C->getBackend(), m, minRows, [&](size_t begin, size_t end) {
+    int rows = (int)(end - begin);
+    thread_local std::vector<MKL_BF16> aBF16;
+    // a block of A: rows x k, or k x rows taken from the columns of a transposed A
+    aBF16.resize((size_t)rows * k);
+    if(transA) {
+      for(int j = 0; j < k; ++j)
+        fromFloat(aBF16.data() + (size_t)j * rows, A->data() + (size_t)j * lda + begin, rows);
+    } else {
+      fromFloat(aBF16.data(), A->data() + begin * lda, (size_t)rows * k);
+    }
+    cblas_gemm_bf16bf16f32(CblasRowMajor,
+                           transA ? CblasTrans : CblasNoTrans,
+                           transB ? CblasTrans : CblasNoTrans,
+                           rows,
+                           n,
+                           k,
+                           scale,
+                           aBF16.data(),
+                           transA ? rows : k,
+                           B->data<MKL_BF16>(),
+                           ldb,
+                           beta,
+                           C->data() + begin * ldc,
+                           ldc);
+  });
+#else
+  // no bfloat16 GEMM available, expand B to float32 for every multiplication. Correct, but slower than
+  // running the float32 model, hence only meant for testing converted models on other builds.
+  LOG_ONCE(warn, "[cpu] This build has no bfloat16 GEMM (needs oneMKL 2021.1 or newer), bfloat16 weights are converted to float32 at runtime");
+  size_t bElements = B->shape().elements();
+  std::vector<float> bFloat(bElements);
+  const uint16_t* bData = B->data<uint16_t>();
+  for(size_t i = 0; i < bElements; ++i)
+    bFloat[i] = toFloat(bData[i]);
+
+  const size_t minRows = std::max<size_t>(8, ((size_t)1 << 20) / std::max<size_t>((size_t)n * k, 1));
+  parallelFor(C->getBackend(), m, minRows, [&](size_t begin, size_t end) {
+    sgemm(transA,
+          transB,
+          (int)(end - begin),
+          n,
+          k,
+          scale,
+          A->data() + (transA ? begin : begin * lda),
+          lda,
+          bFloat.data(),
+          ldb,
+          beta,
+          C->data() + begin * ldc,
+          ldc);
+  });
+#endif
+#else
+  C; A; B; bias; transA; transB; scale;
+  ABORT("You need to compile with MKL in order to use the CPU version");
+#endif
+}
+
+}  // namespace bf16
+}  // namespace cpu
+}  // namespace marian
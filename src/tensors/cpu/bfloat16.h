@@ -0,0 +1,72 @@
+#pragma once
+
+#include "graph/expression_operators.h"
+#include "graph/node.h"
+#include "graph/node_operators_unary.h"
+
+#include <cstring>
+
+namespace marian {
+namespace cpu {
+namespace bf16 {
+
+// Round-to-nearest-even conversion to bfloat16, i.e. the upper 16 bits of the float32 representation.
+// NaNs stay (quiet) NaNs instead of being rounded to infinity.
+static inline uint16_t fromFloat(float x) {
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  if((bits & 0x7FFFFFFFu) > 0x7F800000u)
+    return (uint16_t)((bits >> 16) | 0x0040u);
+  bits += 0x7FFFu + ((bits >> 16) & 1u);
+  return (uint16_t)(bits >> 16);
+}
+
+static inline float toFloat(uint16_t x) {
+  uint32_t bits = (uint32_t)x << 16;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// Converts a float32 tensor into a Type::bfloat16 tensor of the same shape and memory layout
+void FromFloat(marian::Tensor out, const marian::Tensor in);
+
+// C = scale * op(A) * op(B) (+ bias). A and C are float32, B is Type::bfloat16 with the same shape and
+// layout as the float32 matrix it was converted from. Accumulation happens in float32.
+void Affine(marian::Tensor C,
+            const marian::Tensor& A,
+            const marian::Tensor& B,
+            const marian::Tensor& bias,
+            bool transA,
+            bool transB,
+            float scale);
+
+/*
+ * dot(...) or affine(...) with a float32 activation matrix A and a bfloat16 parameter matrix B, e.g. one that
+ * was converted with `marian-conv --gemm-type bfloat16`. Everything apart from the GEMM stays in float32.
+ */
+static inline Expr affineOrDot(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale) {
+  ABORT_IF(!isFloat(a->value_type()), "BFloat16 GEMM expects type of A to be float32 not {}", a->value_type());
+  ABORT_IF(!isBFloat16(b->value_type()), "BFloat16 GEMM expects type of B to be bfloat16 not {}", b->value_type());
+
+  if(transA) // batches of A are folded into rows below, so handle the transposition first as intgemm does
+    a = transpose(a);
+
+  Shape outShape = a->shape();
+  outShape.set(-1, transB ? b->shape()[-2] : b->shape()[-1]);
+
+  auto dotOrAffineNodeOp = [=](Expr out, const std::vector<Expr>& children) {
+    Tensor bias = children.size() > 2 ? children[2]->val() : nullptr;
+    Affine(out->val(), children[0]->val(), children[1]->val(), bias, /*transA=*/false, transB, scale);
+  };
+
+  std::vector<Expr> children = {a, b};
+  if(bias)
+    children.push_back(bias);
+
+  return lambda(children, outShape, Type::float32, dotOrAffineNodeOp); // inference-only Lambda node
+}
+
+}  // namespace bf16
+}  // namespace cpu
+}  // namespace marian
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "tensors/tensor.h"
+#include "tensors/cpu/multiversion.h"
 
 namespace marian {
 namespace cpu {
@@ -62,7 +63,7 @@ struct E<F::Shape::size()> {
 };
 
 template <typename ElementType, class Functor, class... Tensors>
-void element(const Functor& functor, marian::Tensor out, Tensors... tensors) {
+CPU_MULTIVERSION void element(const Functor& functor, marian::Tensor out, Tensors... tensors) {
 
   // Number of input tensors + 1 (output tensor)
   constexpr size_t argNum = sizeof...(tensors) + 1;
@@ -1,8 +1,15 @@
 #pragma once
 
+#include "common/binary.h"
+#include "common/utils.h"
 #include "graph/expression_graph.h"
 #include "fbgemm/packed_gemm.h"
 #include "tensors/cpu/integer_common.h"
+#include "tensors/cpu/bfloat16.h"
+#include "tensors/gpu/int8.h"
+#include "3rd_party/threadpool.h"
+
+#include <thread>
 
 namespace marian {
   namespace cpu {
@@ -26,31 +33,32 @@ public:
 
   virtual ~ExpressionGraphPackable() {}
 
-  // Convert model weights into packed format and save to IO items.
-  std::vector<io::Item> pack(Type gemmElementType = Type::float32, Type saveElementType = Type::float32) {
-    std::vector<io::Item> ioItems;
-
-    // handle packable parameters first (a float32 parameter is packable)
-    auto packableParameters = paramsByElementType_[Type::float32];
-    // sorted by name in std::map
-    for (auto p : packableParameters->getMap()) {
-      std::string pName = p.first;
-
-      LOG(info, "Processing parameter {} with shape {} and type {}", pName, p.second->shape(), p.second->value_type());
+  // Weight matrix of a layers_new nn::Linear, e.g. in the encoders of BERT, COMET and BLEURT models. Matrices whose
+  // dimensions do not fit the tiles of the integer GEMMs, like the [dimHidden, 1] output layer of a metric, stay float32.
+  static bool isLinearWeight(const std::string& pName, const Shape& shape) {
+    return utils::endsWith(pName, "->weight") && shape.size() == 2 && shape[-2] % 64 == 0 && shape[-1] % 8 == 0;
+  }
 
-      if (!namespace_.empty()) {
-        if (pName.substr(0, namespace_.size() + 2) == namespace_ + "::")
-          pName = pName.substr(namespace_.size() + 2);
-      }
+  // Weights used by affine and dot ops, "_W" names of the legacy layers or the weights of nn::Linear
+  static bool isPackableWeight(const std::string& pName, const Shape& shape) {
+    return pName.find("_W") == pName.length() - 3 || pName.find("_W") == pName.length() - 2
+           || isLinearWeight(pName, shape);
+  }
 
-      Tensor val = p.second->val();
+  // Convert model weights into packed format and save to IO items. The float32 parameters are packed on this many
+  // threads, 0 uses all cores.
+  std::vector<io::Item> pack(Type gemmElementType = Type::float32, Type saveElementType = Type::float32, float quantizeRange = 0.f, size_t threads = 1) {
+    std::vector<io::Item> ioItems;
 
+    // handle packable parameters first (a float32 parameter is packable). Each one is packed with allocators of its
+    // own, so they are packed in parallel and then saved in the order of their names.
+    auto packOne = [&](std::string pName, Tensor val) -> io::Item {
       // save as packed format
       // @TODO Hardcoded to find packable weights
       // int8 - all the weights used for affine op and dot op
       // fp16 - all the weights used for affine op
       if ((gemmElementType == Type::packed8avx2 || gemmElementType == Type::packed8avx512)
-        && (pName.find("_W") == pName.length() - 3 || pName.find("_W") == pName.length() - 2)) {
+        && isPackableWeight(pName, val->shape())) {
 #if USE_FBGEMM
         using namespace marian::cpu::variant;
         // packing information - size
@@ -91,12 +99,13 @@ public:
         item.bytes.resize(mem->size());
         copy(backend_, mem->data<char>(), mem->data<char>() + mem->size(), item.bytes.data());
 
-        ioItems.emplace_back(std::move(item));
+        return item;
 #else
         ABORT("Packed type {} only supported when compiled with -DUSE_FBGEMM=on", gemmElementType);
 #endif
       // fp16 quantization option
-      } else if (gemmElementType == Type::packed16 && pName.find("_W") == pName.length() - 3) {
+      } else if (gemmElementType == Type::packed16
+                 && (pName.find("_W") == pName.length() - 3 || isLinearWeight(pName, val->shape()))) {
 #if USE_FBGEMM
         using namespace marian::cpu::variant;
 
@@ -146,12 +155,58 @@ public:
         item.bytes.resize(mem->size());
         copy(backend_, mem->data<char>(), mem->data<char>() + mem->size(), item.bytes.data());
 
-        ioItems.emplace_back(std::move(item));
+        return item;
 #else
         ABORT("Packed type {} only supported when compiled with -DUSE_FBGEMM=on", gemmElementType);
+#endif
+      } else if (gemmElementType == Type::intgemm8amx &&
+      isPackableWeight(pName, val->shape())) {
+#if COMPILE_CPU && !defined(ARM)
+        cpu::integer::passOrAbort(gemmElementType); // Check if the build supports the GEMM type
+        auto allocator = New<TensorAllocator>(getBackend());
+
+        // packed by oneMKL in the normal (not transposed) orientation, quantMult is stored at the end
+        Tensor paramMat;
+        allocator->allocate(paramMat, val->shape(), gemmElementType);
+        cpu::amx::PackB(paramMat, val, cpu::integer::computeQuantMult<Type::intgemm8>(val));
+
+        io::Item item;
+        item.name = pName;
+        item.shape = val->shape();
+        item.type = gemmElementType;
+
+        auto mem = paramMat->memory();
+        item.bytes.resize(mem->size());
+        copy(backend_, mem->data<char>(), mem->data<char>() + mem->size(), item.bytes.data());
+        return item;
+#else
+        ABORT("Packed type {} only supported when compiled with -DCOMPILE_CPU=on", gemmElementType);
+#endif
+      } else if (gemmElementType == Type::intgemm8ruy &&
+      isPackableWeight(pName, val->shape())) {
+#if COMPILE_CPU
+        // only quantized, in the original shape and layout, ruy packs the matrix when it is first used.
+        // Conversion works on any CPU, also without ruy, which is only needed for decoding.
+        auto allocator = New<TensorAllocator>(getBackend());
+
+        Tensor paramMat; // this allocates extra 4 bytes at the end for the quantMult
+        allocator->allocate(paramMat, val->shape(), gemmElementType);
+        cpu::ruygemm::QuantizeB(paramMat, val, cpu::ruygemm::computeQuantMult(val));
+
+        io::Item item;
+        item.name = pName;
+        item.shape = val->shape();
+        item.type = gemmElementType;
+
+        auto mem = paramMat->memory();
+        item.bytes.resize(mem->size());
+        copy(backend_, mem->data<char>(), mem->data<char>() + mem->size(), item.bytes.data());
+        return item;
+#else
+        ABORT("Packed type {} only supported when compiled with -DCOMPILE_CPU=on", gemmElementType);
 #endif
       } else if (isIntgemm(gemmElementType) &&
-      (pName.find("_W") == pName.length() - 3 || pName.find("_W") == pName.length() - 2 /* || pName.find("Wemb") != std::string::npos*/)) {
+      isPackableWeight(pName, val->shape()) /* || pName.find("Wemb") != std::string::npos*/) {
 #if COMPILE_CPU && !defined(ARM)
         using cpu::integer::cols;
         using cpu::integer::rows;
@@ -247,17 +302,77 @@ public:
         auto mem = paramMat->memory();
         item.bytes.resize(mem->size());
         copy(backend_, mem->data<char>(), mem->data<char>() + mem->size(), item.bytes.data());
-        ioItems.emplace_back(std::move(item));
+        return item;
 #else
         ABORT("Packed type {} only supported when compiled with -DCOMPILE_CPU=on", gemmElementType);
+#endif
+      } else if (gemmElementType == Type::int8gpu && gpu::int8gemm::isConvertible(pName, val->shape())) {
+        // quantized per output channel and transposed on the CPU, decoding needs a GPU
+        auto allocator = New<TensorAllocator>(getBackend());
+
+        Tensor paramMat; // this allocates extra 4 bytes per column at the end for the multipliers
+        allocator->allocate(paramMat, val->shape(), gemmElementType);
+        gpu::int8gemm::QuantizeB(paramMat, val, quantizeRange);
+
+        io::Item item;
+        item.name = pName;
+        item.shape = val->shape();
+        item.type = gemmElementType;
+
+        auto mem = paramMat->memory();
+        item.bytes.resize(mem->size());
+        copy(backend_, mem->data<char>(), mem->data<char>() + mem->size(), item.bytes.data());
+        return item;
+      } else if (gemmElementType == Type::bfloat16 &&
+      isPackableWeight(pName, val->shape())) {
+#if COMPILE_CPU
+        // same memory layout as float32, only the lower 16 bits of the mantissa are rounded away
+        auto allocator = New<TensorAllocator>(getBackend());
+
+        Tensor paramMat;
+        allocator->allocate(paramMat, val->shape(), Type::bfloat16);
+        cpu::bf16::FromFloat(paramMat, val);
+
+        io::Item item;
+        item.name = pName;
+        item.shape = val->shape();
+        item.type = Type::bfloat16;
+
+        auto mem = paramMat->memory();
+        item.bytes.resize(mem->size());
+        copy(backend_, mem->data<char>(), mem->data<char>() + mem->size(), item.bytes.data());
+        return item;
+#else
+        ABORT("Type {} only supported when compiled with -DCOMPILE_CPU=on", gemmElementType);
 #endif
       } else {
         ABORT_IF(saveElementType != Type::float32, "We currently do not know how to save matrices as {}", saveElementType);
         io::Item item;
         val->get(item, pName);
         item.convert(saveElementType);
-        ioItems.emplace_back(std::move(item));
+        return item;
       }
+    };
+
+    auto packableParameters = paramsByElementType_[Type::float32];
+    std::vector<std::pair<std::string, Tensor>> packable; // sorted by name in std::map
+    for (auto p : packableParameters->getMap()) {
+      std::string pName = p.first;
+      if (!namespace_.empty()) {
+        if (pName.substr(0, namespace_.size() + 2) == namespace_ + "::")
+          pName = pName.substr(namespace_.size() + 2);
+      }
+      packable.push_back({pName, p.second->val()});
+    }
+
+    ThreadPool pool(threads > 0 ? threads : std::max<size_t>(1, std::thread::hardware_concurrency()));
+    std::vector<std::future<io::Item>> packed;
+    for (auto& p : packable)
+      packed.emplace_back(pool.enqueue(packOne, p.first, p.second));
+    for (size_t i = 0; i < packed.size(); ++i) {
+      ioItems.emplace_back(packed[i].get());
+      LOG(info, "[{}/{}] Processed parameter {} with shape {} and type {}",
+          i + 1, packed.size(), packable[i].first, packable[i].second->shape(), packable[i].second->type());
     }
 
     // Now handle all non-float32 parameters
@@ -285,8 +400,23 @@ public:
     return ioItems;
   }
 
-  void packAndSave(const std::string& name, const std::string& meta, Type gemmElementType = Type::float32, Type saveElementType = Type::float32) {
-    auto ioItems = pack(gemmElementType, saveElementType);
+  // The matrices are also packed for each type of variants, and stored next to those of gemmElementType where the
+  // packing differs, see io::binary::selectVariant().
+  void packAndSave(const std::string& name, const std::string& meta, Type gemmElementType = Type::float32, Type saveElementType = Type::float32, float quantizeRange = 0.f, size_t threads = 1, const std::vector<Type>& variants = {}) {
+    auto ioItems = pack(gemmElementType, saveElementType, quantizeRange, threads);
+    if (!variants.empty()) {
+      std::string list = fmt::format("{}", gemmElementType);
+      for (auto variant : variants) {
+        LOG(info, "Packing the {} variant", variant);
+        for (auto& item : pack(variant, saveElementType, quantizeRange, threads))
+          if (item.type == variant) { // the other parameters are the same in each variant
+            item.name = io::binary::variantName(variant, item.name);
+            ioItems.emplace_back(std::move(item));
+          }
+        list += " " + fmt::format("{}", variant);
+      }
+      io::addMetaToItems(list, io::binary::VARIANTS_NAME, ioItems);
+    }
     if (!meta.empty())
       io::addMetaToItems(meta, "special:model.yml", ioItems);
     io::saveItems(name, ioItems);
@@ -201,6 +201,125 @@ struct FbgemmPacked8PackNodeOp : public UnaryNodeOp {
 };
 
 
+// Quantize a matrix (int8) column by column without packing it, so that selections of its columns can be packed
+// by FbgemmPacked8PackColumnsNodeOp without quantizing them again. Like the packing of a whole weight matrix,
+// this is memoized and runs once per graph.
+// bool transpose_: transpose
+// int nrow_: the number of rows
+// int ncol_: the number of columns
+// uint64_t quantsize_: the size of the quantized matrix (int8 columns + quantization scale, offset and zero point)
+struct FbgemmPacked8QuantizeNodeOp : public UnaryNodeOp {
+  bool transpose_;
+  int nrow_;
+  int ncol_;
+  uint64_t quantsize_;
+  float quantizeRange_;
+
+  FbgemmPacked8QuantizeNodeOp(Expr a, bool transpose, float quantizeRange)
+      : UnaryNodeOp(a, newShape(a, transpose), Type::uint8),
+        transpose_(transpose),
+        quantizeRange_(quantizeRange) {
+    if(!memoize_)
+      ABORT("Only constant weight node can be quantized");
+  }
+
+  NodeOps forwardOps() override {
+#if USE_FBGEMM
+    return {NodeOp(fbgemmPacked8Quantize(val_,
+                                         child(0)->val()->data(),
+                                         transpose_,
+                                         nrow_,
+                                         ncol_,
+                                         quantizeRange_))
+    };
+#else // USE_FBGEMM
+    ABORT("FbgemmPacked8QuantizeNodeOp can only be used with FBGEMM enabled.");
+    return { NodeOp(0) };
+#endif  // USE_FBGEMM
+  }
+
+  NodeOps backwardOps() override {
+    ABORT("FbgemmPacked8QuantizeNodeOp only available for inference");
+    return {NodeOp(0)};
+  }
+
+  const std::string type() override { return "quantMatInt8"; }
+
+#if USE_FBGEMM
+  Shape newShape(Expr a, bool transpose) {
+    fbgemmPacked8QuantizeInfo(a->shape(), transpose, nrow_, ncol_, quantsize_);
+    Shape outShape({(int)quantsize_});
+    return outShape;
+  }
+#else
+  Shape newShape(Expr /*a*/, bool /*transpose*/) {
+    ABORT("Packed GEMM requires a build with USE_FBGEMM enabled");
+    return Shape();
+  }
+#endif  // USE_FBGEMM
+};
+
+// Pack the columns with the given indices of a matrix quantized by FbgemmPacked8QuantizeNodeOp (int8),
+// e.g. the shortlisted rows of the output layer. The result is the same as FbgemmPacked8PackNodeOp of the selected
+// columns. Recently packed selections are cached, see fbgemmPacked8PackColumns().
+// marian::Type packType_: the type the input matrix is packed - packed8avx2 or packed8avx512
+// int nrow_: the number of rows
+// int ncol_: the number of columns of the quantized matrix
+// uint64_t packsize_: the size of the packed matrix of the selected columns
+struct FbgemmPacked8PackColumnsNodeOp : public NaryNodeOp {
+  marian::Type packType_;
+  int nrow_;
+  int ncol_;
+  uint64_t packsize_;
+
+  FbgemmPacked8PackColumnsNodeOp(Expr quantized, Expr indices, marian::Type packType)
+      : NaryNodeOp({quantized, indices}, newShape(quantized, indices, packType), Type::uint8),
+        packType_(packType) {
+    ABORT_IF(indices->value_type() != Type::uint32, "Column indices must be of type uint32");
+  }
+
+  NodeOps forwardOps() override {
+#if USE_FBGEMM
+    return {NodeOp(fbgemmPacked8PackColumns(val_,
+                                            child(0)->val(),
+                                            child(1)->val(),
+                                            packType_,
+                                            nrow_,
+                                            ncol_,
+                                            packsize_))
+    };
+#else // USE_FBGEMM
+    ABORT("FbgemmPacked8PackColumnsNodeOp can only be used with FBGEMM enabled.");
+    return { NodeOp(0) };
+#endif  // USE_FBGEMM
+  }
+
+  NodeOps backwardOps() override {
+    ABORT("FbgemmPacked8PackColumnsNodeOp only available for inference");
+    return {NodeOp(0)};
+  }
+
+  const std::string type() override { return "packColsInt8"; }
+
+#if USE_FBGEMM
+  Shape newShape(Expr quantized, Expr indices, marian::Type packType) {
+    auto quantizeNode = std::dynamic_pointer_cast<FbgemmPacked8QuantizeNodeOp>(quantized);
+    ABORT_IF(!quantizeNode, "Only the output of FbgemmPacked8QuantizeNodeOp can be packed by columns");
+    nrow_ = quantizeNode->nrow_;
+    ncol_ = quantizeNode->ncol_;
+
+    int selectedCols;
+    fbgemmPacked8PackInfo({(int)indices->shape().elements(), nrow_}, packType, /*transpose=*/true, nrow_, selectedCols, packsize_);
+    Shape outShape({(int)packsize_});
+    return outShape;
+  }
+#else
+  Shape newShape(Expr /*quantized*/, Expr /*indices*/, marian::Type /*packType*/) {
+    ABORT("Packed GEMM requires a build with USE_FBGEMM enabled");
+    return Shape();
+  }
+#endif  // USE_FBGEMM
+};
 // Affine transform (matrix multiplication) using packed B matrix
 // float scalar_: scalar multiplier
 // size_t m_: the number of rows in A and C
@@ -420,6 +539,21 @@ static inline Expr pack(Type elementType, Expr a, PackMatrix packMat, bool trans
   }
 }
 
+// Quantize a weight matrix into int8 once, see FbgemmPacked8QuantizeNodeOp
+static inline Expr quantize(Expr a, bool transpose, float quantizeRange = 0.f) {
+  return Expression<FbgemmPacked8QuantizeNodeOp>(a, transpose, quantizeRange);
+}
+
+// Pack the columns `indices` of a matrix returned by quantize() for dot() or affine() with a packed8 type
+static inline Expr packColumns(Type elementType, Expr quantized, Expr indices) {
+  if (isPacked(elementType) && sizeOf(elementType) == 1)
+    return Expression<FbgemmPacked8PackColumnsNodeOp>(quantized, indices, elementType);
+  else {
+    ABORT("Only int8 is available. {}", elementType);
+    return nullptr;
+  }
+}
+
 static inline Expr dot(Type elementType, Expr a, Expr b, Shape bShape, bool transA, bool transB, float scalar) {
   std::vector<Expr> nodes = {a, b};
 
@@ -2,8 +2,12 @@
 #include "tensors/tensor_allocator.h"
 #include "tensors/tensor_operators.h"
 
+#include "common/hash.h"
+
 #include <cassert>
 #include <cstddef>
+#include <list>
+#include <mutex>
 #include <unordered_map>
 //#include <chrono>
 
@@ -268,6 +272,55 @@ inline void colOffsetsWithZeroPtS8acc32(
   }
 }
 
+// Computes the quantization scale and zero point of each column of a [k, n] matrix for fbgemmPacked8Pack(),
+// either from the min/max range or the quantRangeStdDevs sigma range of the column
+static void quantizationParams(const float* data,
+                               const bool transpose,
+                               const int k,
+                               const int n,
+                               const float quantRangeStdDevs,
+                               float* quantScaleB,
+                               int32_t* quantZeropointB) {
+  float val = 0;
+
+  // Use half of the quantization range to prevent overflow of VPMADDUBSW
+  constexpr static int quantizedRange = 127;
+  constexpr static int quantizedMax = 63;
+
+  // This routine compute the quantization range for each column - either one of min/max range or quantRangeStdDevs sigma range.
+  for (size_t jj = 0; jj < n; jj++) { // for each column, collect stats (min/max or mean/std.dev.)
+    float min = std::numeric_limits<float>::max(), max = std::numeric_limits<float>::lowest();
+    double mean = 0, sqrSum = 0;
+    for (size_t ii = 0; ii < k; ii++) { // in a column, go throuhg all the rows and collect stats
+      val = getVal2dArr(data, ii, jj, k, n, transpose);
+      // If quantRangeStdDevs is 0.f, min/max values of the columns is used as a quantization range
+      if(quantRangeStdDevs == 0.f) {
+        if(min > val)
+          min = val;
+        if(max < val)
+          max = val;
+      } else {
+        // Quantize by std.dev. range
+        mean += val;
+        sqrSum += val * val;
+      }
+    }
+    // If a quantization range (in multiples of std. dev.) is given with a non-zero value,
+    // it calculate the range for this column (different quantization scale/offset are used for each column)
+    if(quantRangeStdDevs != 0.f) {
+      mean /= k;
+      sqrSum /= k;
+      sqrSum -= mean * mean;
+      sqrSum = sqrt(sqrSum);
+      min = (float)(mean - quantRangeStdDevs * sqrSum);
+      max = (float)(mean + quantRangeStdDevs * sqrSum);
+    }
+    // based on the quantization range, this computes the scale and offset for the quantization
+    quantScaleB[jj] = (max - min) / quantizedRange;
+    quantZeropointB[jj] = (int32_t)(quantizedMax - max / quantScaleB[jj]);
+  }
+}
+
 // Pack a matrix (fp16) into cache utilization efficient way (block format) into fp16
 // out: output tensor - packed format
 // inData: input tensor data - pointer of float data
@@ -357,46 +410,8 @@ void fbgemmPacked8Pack(marian::Tensor out,
   // 1. collect stats for each column
   float* quantScaleB = new float[n];
   int32_t* quantZeropointB = new int32_t[n];
-
   const float* data = inData;
-  float val = 0;
-
-  // Use half of the quantization range to prevent overflow of VPMADDUBSW
-  constexpr static int quantizedRange = 127;
-  constexpr static int quantizedMax = 63;
-
-  // This routine compute the quantization range for each column - either one of min/max range or quantRangeStdDevs sigma range.
-  for (size_t jj = 0; jj < n; jj++) { // for each column, collect stats (min/max or mean/std.dev.)
-    float min = std::numeric_limits<float>::max(), max = std::numeric_limits<float>::lowest();
-    double mean = 0, sqrSum = 0;
-    for (size_t ii = 0; ii < k; ii++) { // in a column, go throuhg all the rows and collect stats
-      val = getVal2dArr(data, ii, jj, k, n, transpose);
-      // If quantRangeStdDevs is 0.f, min/max values of the columns is used as a quantization range
-      if(quantRangeStdDevs == 0.f) {
-        if(min > val)
-          min = val;
-        if(max < val)
-          max = val;
-      } else {
-        // Quantize by std.dev. range
-        mean += val;
-        sqrSum += val * val;
-      }
-    }
-    // If a quantization range (in multiples of std. dev.) is given with a non-zero value,
-    // it calculate the range for this column (different quantization scale/offset are used for each column)
-    if(quantRangeStdDevs != 0.f) {
-      mean /= k;
-      sqrSum /= k;
-      sqrSum -= mean * mean;
-      sqrSum = sqrt(sqrSum);
-      min = (float)(mean - quantRangeStdDevs * sqrSum);
-      max = (float)(mean + quantRangeStdDevs * sqrSum);
-    }
-    // based on the quantization range, this computes the scale and offset for the quantization
-    quantScaleB[jj] = (max - min) / quantizedRange;
-    quantZeropointB[jj] = (int32_t)(quantizedMax - max / quantScaleB[jj]);
-  }
+  quantizationParams(data, transpose, k, n, quantRangeStdDevs, quantScaleB, quantZeropointB);
 
   // 2. quantize
   int8_t* quantized = 0;
@@ -455,6 +470,169 @@ void fbgemmPacked8Pack(marian::Tensor out,
   delete[] quantZeropointB;
 }
 
+// Returns the byte size of a matrix quantized into int8 by fbgemmPacked8Quantize().
+// shape: shape of the tensor to be quantized
+// transpose: the matrix is transposed
+// nrow (out): the number of rows
+// ncol (out): the number of columns
+// quantsize (out): the size of the quantized matrix in byte
+void fbgemmPacked8QuantizeInfo(const marian::Shape& shape,
+                               const bool transpose,
+                               int& nrow,
+                               int& ncol,
+                               uint64_t& quantsize) {
+  // Should be 2D - weight matrix
+  ABORT_IF(shape.size() != 2,
+           "Weight Matrix should be 2D");
+  nrow = transpose ? shape[1] : shape[0];
+  ncol = transpose ? shape[0] : shape[1];
+  // int8 values of all columns, then quantization scales, offsets and column offsets as at the end of a packed matrix
+  quantsize = (uint64_t)ncol * (nrow + sizeof(float) + sizeof(int32_t) + sizeof(int32_t));
+}
+
+// Quantize a matrix into int8 column by column exactly as fbgemmPacked8Pack() does, but without packing it.
+void fbgemmPacked8Quantize(marian::Tensor out,
+                           const float* inData,
+                           const bool transpose,
+                           const int nrow,
+                           const int ncol,
+                           const float quantRangeStdDevs) {
+  int k = nrow;
+  int n = ncol;
+
+  int8_t* quantized = out->data<int8_t>();   // [n, k], one column after the other
+  int8_t* params = quantized + (size_t)n * k; // scales, zero points and column offsets
+  float* quantScaleB = new float[n];
+  int32_t* quantZeropointB = new int32_t[n];
+  quantizationParams(inData, transpose, k, n, quantRangeStdDevs, quantScaleB, quantZeropointB);
+
+  for (int jj = 0; jj < n; jj++) {
+    TensorQuantizationParams bQuantParam;
+    bQuantParam.scale = quantScaleB[jj];
+    bQuantParam.zero_point = quantZeropointB[jj];
+    bQuantParam.precision = 7;  // Use half of the quantization range to prevent overflow of VPMADDUBSW
+
+    if (transpose)
+      fbgemm::Quantize<int8_t>(inData + jj * k, quantized + jj * k, k, bQuantParam);
+    else {
+      for (int ii = 0; ii < k; ii++) {
+        quantized[jj * k + ii] = fbgemm::Quantize<int8_t>(inData[ii * n + jj], bQuantParam);
+      }
+    }
+  }
+
+  int32_t* colOffsets = new int32_t[n];
+  colOffsetsWithZeroPtS8acc32(/*transpose=*/true, k, n, quantized, quantZeropointB, colOffsets, 1);
+
+  // the parameters are not aligned, hence copied as bytes
+  memcpy(params, quantScaleB, n * sizeof(float));
+  memcpy(params + n * sizeof(float), quantZeropointB, n * sizeof(int32_t));
+  memcpy(params + n * (sizeof(float) + sizeof(int32_t)), colOffsets, n * sizeof(int32_t));
+
+  delete[] colOffsets;
+  delete[] quantScaleB;
+  delete[] quantZeropointB;
+}
+
+// Small LRU cache of packed column selections, shared by the threads of all graphs. A shortlist stays the same for
+// all decoding steps of a batch and often repeats across batches, so its packed matrix is reused instead of repacked.
+class PackedColumnsCache {
+private:
+  typedef std::pair<size_t, std::vector<int8_t>> Entry;
+
+  std::mutex mutex_;
+  std::list<Entry> entries_; // most recently used first
+  std::unordered_map<size_t, std::list<Entry>::iterator> index_;
+
+  const size_t capacity_{16};
+
+public:
+  // Copies the packed matrix for `key` into `out` and returns true if it is cached
+  bool get(size_t key, int8_t* out, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if(it == index_.end() || it->second->second.size() != size)
+      return false;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    memcpy(out, it->second->second.data(), size);
+    return true;
+  }
+
+  void put(size_t key, const int8_t* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(index_.count(key) > 0) // packed by another thread in the meantime
+      return;
+    entries_.emplace_front(key, std::vector<int8_t>(data, data + size));
+    index_[key] = entries_.begin();
+    if(entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+};
+
+static PackedColumnsCache packedColumnsCache;
+
+// Pack the columns `indices` of a matrix quantized by fbgemmPacked8Quantize()
+void fbgemmPacked8PackColumns(marian::Tensor out,
+                              const marian::Tensor quantized,
+                              const marian::Tensor indices,
+                              const marian::Type packType,
+                              const int nrow,
+                              const int ncol,
+                              const uint64_t packsize) {
+  int k = nrow;
+  int n = (int)indices->size();
+  const uint32_t* cols = indices->data<uint32_t>();
+  const int8_t* quantizedB = quantized->data<int8_t>();
+  const int8_t* params = quantizedB + (size_t)ncol * k;
+
+  // 1. gather the quantization parameters of the selected columns
+  std::vector<float> quantScaleB(n);
+  std::vector<int32_t> quantZeropointB(n), colOffsets(n);
+  for (int jj = 0; jj < n; jj++) {
+    uint32_t col = cols[jj];
+    ABORT_IF(col >= (uint32_t)ncol, "Column index {} exceeds the number of columns {}.", col, ncol);
+    memcpy(&quantScaleB[jj], params + col * sizeof(float), sizeof(float));
+    memcpy(&quantZeropointB[jj], params + ncol * sizeof(float) + col * sizeof(int32_t), sizeof(int32_t));
+    memcpy(&colOffsets[jj], params + ncol * (sizeof(float) + sizeof(int32_t)) + col * sizeof(int32_t), sizeof(int32_t));
+  }
+
+  // the scales identify the quantized matrix in addition to its address, which may be reused by another model
+  size_t key = util::hash<const void*>()(quantizedB);
+  util::hash_combine(key, (size_t)packType);
+  util::hash_combine(key, k);
+  for (int jj = 0; jj < n; jj++) {
+    util::hash_combine(key, cols[jj]);
+    util::hash_combine(key, quantScaleB[jj]);
+  }
+
+  int8_t* packedBuf = out->data<int8_t>();
+  if(packedColumnsCache.get(key, packedBuf, packsize))
+    return;
+
+  // 2. gather the quantized columns
+  std::vector<int8_t> gathered((size_t)n * k);
+  for (int jj = 0; jj < n; jj++)
+    memcpy(gathered.data() + (size_t)jj * k, quantizedB + (size_t)cols[jj] * k, k);
+
+  for(auto i = 0; i < packsize; i++) {
+    packedBuf[i] = 0;
+  }
+
+  // 3. packing, the columns are contiguous, i.e. a transposed [k, n] matrix
+  const fbgemm::BlockingFactors* blockingParams = getBlockingFactors(packType);
+
+  PackBMatrix<int8_t> packedBN(
+      matrix_op_t::Transpose, k, n, gathered.data(), k, packedBuf, 1, blockingParams);
+
+  memcpy(packedBuf + (packsize - n * (sizeof(float) + sizeof(int32_t) + sizeof(int32_t))), quantScaleB.data(), n * sizeof(float));
+  memcpy(packedBuf + (packsize - n * (sizeof(int32_t) + sizeof(int32_t))), quantZeropointB.data(), n * sizeof(int32_t));
+  memcpy(packedBuf + (packsize - n * sizeof(int32_t)), colOffsets.data(), n * sizeof(int32_t));
+
+  packedColumnsCache.put(key, packedBuf, packsize);
+}
+
 // GEMM operation on the packed B matrix
 // C: output matrix
 // A: A matrix
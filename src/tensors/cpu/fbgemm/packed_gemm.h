@@ -110,6 +110,55 @@ void fbgemmPacked8Pack(marian::Tensor out,
                        const uint64_t packsize,
                        const float quantRangeStdDevs = 0.f); // @TODO: change to size_t where appropriate
 
+// Returns the byte size of a matrix quantized into int8 by fbgemmPacked8Quantize().
+// shape: shape of the tensor to be quantized
+// transpose: the matrix is transposed
+// nrow (out): the number of rows
+// ncol (out): the number of columns
+// quantsize (out): the size of the quantized matrix in byte
+void fbgemmPacked8QuantizeInfo(const marian::Shape& shape,
+                               const bool transpose,
+                               /*out*/int& nrow,
+                               /*out*/int& ncol,
+                               /*out*/uint64_t& quantsize);
+
+// Quantize a matrix into int8 column by column exactly as fbgemmPacked8Pack() does, but without packing it.
+// The quantized columns are stored one after the other, followed by the quantization scales, zero points and
+// column offsets of all columns. Any selection of columns can then be packed with fbgemmPacked8PackColumns()
+// without computing the quantization again.
+// out: output tensor - quantized columns and quantization parameters, see fbgemmPacked8QuantizeInfo()
+// inData: input tensor data - pointer of float data
+// transpose: the matrix is transposed
+// nrow: the number of rows
+// ncol: the number of columns
+// quantRangeStdDevs: the range to be quantized for the original float data in multiples standard deviation,
+//                    see fbgemmPacked8Pack()
+void fbgemmPacked8Quantize(marian::Tensor out,
+                           const float* inData,
+                           const bool transpose,
+                           const int nrow,
+                           const int ncol,
+                           const float quantRangeStdDevs = 0.f);
+
+// Pack the columns `indices` of a matrix quantized by fbgemmPacked8Quantize(), e.g. the shortlisted rows of the
+// output layer. The result is the same as fbgemmPacked8Pack() of these columns of the float matrix. Recently packed
+// selections are kept in a small cache that is shared by all threads and keyed by a hash of the indices, so decoding
+// steps with the same shortlist only copy the packed matrix.
+// out: output tensor - packed format of a [nrow, indices] matrix, see fbgemmPacked8PackInfo()
+// quantized: output of fbgemmPacked8Quantize()
+// indices: the columns to be packed (uint32)
+// packType: Type to be packed - packed8avx2 or packed8avx512
+// nrow: the number of rows of the quantized matrix
+// ncol: the number of columns of the quantized matrix
+// packsize: the size of the packed matrix
+void fbgemmPacked8PackColumns(marian::Tensor out,
+                              const marian::Tensor quantized,
+                              const marian::Tensor indices,
+                              const marian::Type packType,
+                              const int nrow,
+                              const int ncol,
+                              const uint64_t packsize);
+
 // GEMM operation on the packed B matrix
 // C: output matrix
 // A: A matrix
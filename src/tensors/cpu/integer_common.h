@@ -4,6 +4,8 @@
 #include "tensors/tensor_operators.h"
 #include "tensors/cpu/aligned.h"
 #include "common/io_item.h"
+#include "tensors/cpu/amx_int8.h"
+#include "tensors/cpu/ruy_int8.h"
 
 #if COMPILE_CPU && !defined(ARM)
 #include "3rd_party/intgemm/intgemm/intgemm.h"
@@ -143,7 +145,35 @@ static inline Type getIntgemmType(Type vtype) {
 #endif
 }
 
+// whether this CPU and build can multiply matrices of type vtype, the same conditions as passOrAbort() without aborting
+static inline bool isSupported(Type vtype) {
+  if (isRuy(vtype))
+    return cpu::ruygemm::isAvailable();
+#if COMPILE_CPU && !defined(ARM)
+  if (isAmx(vtype))
+    return cpu::amx::isAvailable();
+  if (vtype == Type::intgemm8avx512vnni)
+    return intgemm::kCPU >= intgemm::CPUType::AVX512VNNI;
+  if (isAvx512(vtype))
+    return intgemm::kCPU >= intgemm::CPUType::AVX512BW;
+  if (isAvx2(vtype))
+    return intgemm::kCPU >= intgemm::CPUType::AVX2;
+  if (isSsse3(vtype))
+    return intgemm::kCPU >= intgemm::CPUType::SSSE3;
+  if (isSse2(vtype))
+    return intgemm::kCPU >= intgemm::CPUType::SSE2;
+  return true;
+#else
+  return !isIntgemm(vtype) && !isPacked(vtype);
+#endif
+}
+
 static inline bool passOrAbort(Type vtype) {
+  // ruy has kernels for ARM and x86 CPUs, only the build matters
+  if (vtype == Type::intgemm8ruy) {
+    ABORT_IF(!cpu::ruygemm::isAvailable(), "Models of type {} need marian compiled with -DUSE_RUY_SGEMM=on", vtype);
+    return true;
+  }
 #if COMPILE_CPU && !defined(ARM)
   if (vtype == Type::intgemm8 || vtype == Type::intgemm16) {
     return true;
@@ -157,6 +187,9 @@ static inline bool passOrAbort(Type vtype) {
     ABORT_IF(intgemm::kCPU < intgemm::CPUType::AVX512BW, "Your CPU doesn't support the architecture necessary to decode model of type {}. Try older architecture instead.", vtype);
   } else if (vtype == Type::intgemm8avx512vnni) {
     ABORT_IF(intgemm::kCPU < intgemm::CPUType::AVX512VNNI, "Your CPU doesn't support the architecture necessary to decode model of type {}. Try older architecture instead.", vtype);
+  } else if (vtype == Type::intgemm8amx) {
+    // oneMKL falls back to AVX512-VNNI or older kernels on CPUs without AMX, only the build matters
+    ABORT_IF(!cpu::amx::isAvailable(), "Models of type {} need marian compiled with oneMKL 2021.1 or newer", vtype);
   }
   return true;
 #else
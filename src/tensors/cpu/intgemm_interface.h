@@ -3,6 +3,8 @@
 #include "graph/node.h"
 #include "graph/node_operators_unary.h"
 #include "integer_common.h"
+#include "amx_int8.h"
+#include "ruy_int8.h"
 
 namespace marian {
 
@@ -98,6 +100,57 @@ static inline Expr affineOrDotTyped(Expr a, Expr bQuant, Expr bias, bool transA,
 #endif
 }
 
+/*
+ * Same as affineOrDotTyped() for Type::intgemm8amx, where B was quantized and packed by oneMKL in marian-conv.
+ * A is quantized inside of the GEMM, see cpu::amx::Affine().
+ */
+static inline Expr affineOrDotAmx(Expr a, Expr bPacked, Expr bias, bool transA, bool transB, float scale) {
+  ABORT_IF(!isFloat(a->value_type()), "AMX GEMM expects type of A to be float32 not {}", a->value_type());
+  ABORT_IF(transB, "AMX GEMM does not support a transposed B, the packed layout of {} is fixed", bPacked->value_type());
+
+  if(transA)
+    a = transpose(a);
+
+  Shape outShape = a->shape();
+  outShape.set(-1, bPacked->shape()[-1]);
+
+  auto dotOrAffineNodeOp = [=](Expr out, const std::vector<Expr>& children) {
+    Tensor bias = children.size() > 2 ? children[2]->val() : nullptr;
+    cpu::amx::Affine(out->val(), children[0]->val(), children[1]->val(), bias, scale);
+  };
+
+  std::vector<Expr> children = {a, bPacked};
+  if(bias)
+    children.push_back(bias);
+
+  return lambda(children, outShape, Type::float32, dotOrAffineNodeOp); // inference-only Lambda node
+}
+
+/*
+ * Same as affineOrDotTyped() for Type::intgemm8ruy, where B was quantized in marian-conv and is packed by ruy
+ * when it is first used. Unlike the other intgemm types, B may be transposed, see cpu::ruygemm::Affine().
+ */
+static inline Expr affineOrDotRuy(Expr a, Expr bQuant, Expr bias, bool transA, bool transB, float scale) {
+  ABORT_IF(!isFloat(a->value_type()), "Ruy GEMM expects type of A to be float32 not {}", a->value_type());
+
+  if(transA)
+    a = transpose(a);
+
+  Shape outShape = a->shape();
+  outShape.set(-1, transB ? bQuant->shape()[-2] : bQuant->shape()[-1]);
+
+  auto dotOrAffineNodeOp = [=](Expr out, const std::vector<Expr>& children) {
+    Tensor bias = children.size() > 2 ? children[2]->val() : nullptr;
+    cpu::ruygemm::Affine(out->val(), children[0]->val(), children[1]->val(), bias, transB, scale);
+  };
+
+  std::vector<Expr> children = {a, bQuant};
+  if(bias)
+    children.push_back(bias);
+
+  return lambda(children, outShape, Type::float32, dotOrAffineNodeOp); // inference-only Lambda node
+}
+
 // Dispatch correct hardware-agnostic or hardware-specific matrix multiplies
 static inline Expr affineOrDot(Expr a, Expr bQuant, Expr bias, bool transA, bool transB, float scale) {
   Type bQuantElementType = bQuant->value_type();
@@ -114,6 +167,10 @@ static inline Expr affineOrDot(Expr a, Expr bQuant, Expr bias, bool transA, bool
       return cpu::integer::affineOrDotTyped<Type::intgemm8avx512>(a, bQuant, bias, transA, transB, scale);
     case Type::intgemm8avx512vnni :
       return cpu::integer::affineOrDotTyped<Type::intgemm8avx512vnni>(a, bQuant, bias, transA, transB, scale);
+    case Type::intgemm8amx :
+      return cpu::integer::affineOrDotAmx(a, bQuant, bias, transA, transB, scale);
+    case Type::intgemm8ruy :
+      return cpu::integer::affineOrDotRuy(a, bQuant, bias, transA, transB, scale);
     //case Type::intgemm16 :  // The generic case selects CPU automatically, but we set all the types manually anyways.
     //  return cpu::integer::affineOrDotTyped<Type::intgemm16>(a, bQuant, bias, transA, transB, scale);
     case Type::intgemm16sse2 :
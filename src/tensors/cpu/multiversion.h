@@ -0,0 +1,16 @@
+#pragma once
+
+// Runtime dispatch of the CPU element-wise loops for binaries that are built for a generic x86-64 target
+// (-DCOMPILE_CPU_MULTIVERSION=on). Functions marked with CPU_MULTIVERSION are compiled once per listed target
+// and the dynamic loader resolves each of them to the best version for the host CPU the first time it is called,
+// the same choice intgemm makes for its GEMMs. Inline callees such as the functors and the float32x4 operators
+// are compiled into every version, so the AVX2 and AVX-512 versions get wider auto-vectorization and VEX/EVEX
+// encodings while the default version still runs on any x86-64 CPU.
+//
+// ARMv8 always has NEON and -march=native builds already target the host, so neither gets any clones.
+#if MARIAN_CPU_MULTIVERSION && !defined(__CUDACC__) && defined(__x86_64__) && defined(__GNUC__) \
+    && !defined(__AVX512F__)
+#define CPU_MULTIVERSION __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define CPU_MULTIVERSION
+#endif
@@ -3,7 +3,9 @@
  *   SPDX-License-Identifier: MIT
  */
 
+#include "common/timer.h"
 #include "tensors/cpu/backend.h"
+#include "tensors/heads_gemm.h"
 #include "tensors/tensor.h"
 #include "tensors/tensor_allocator.h"
 
@@ -42,19 +44,66 @@ void Prod(marian::Tensor C,
   if(transB)
     ldc = B->shape().elements() / B->shape()[-1];
 
-  sgemm(transA,
-        transB,
-        m,
-        n,
-        k,
-        alpha,
-        A->data(),
-        lda,
-        B->data(),
-        ldb,
-        beta,
-        C->data(),
-        ldc);
+  // With --gemm-type auto, the split over the intra-op threads is tuned per shape of GEMMs that are large enough
+  // to be split at all, e.g. the output layer of a decoder step has too few rows for the split by rows
+  auto backend = std::static_pointer_cast<cpu::Backend>(C->getBackend());
+  auto tuner = backend->getGemmTuner();
+  std::string key;
+  VariantTuner::Choice choice{(size_t)Backend::GemmSplit::Rows, false};
+  if(tuner && (size_t)m * n * k >= ((size_t)1 << 20)) {
+    key = std::to_string(m) + "x" + std::to_string(n) + "x" + std::to_string(k) + (transA ? "T" : "N")
+          + (transB ? "T" : "N") + "/" + std::to_string(backend->getIntraOpThreads());
+    choice = tuner->choose(key);
+  }
+  timer::Timer timer;
+
+  // large GEMMs are split into blocks of rows of C over the intra-op threads by default, each block reads the
+  // matching rows of A, or columns if A is transposed. Blocks of columns of C read the matching columns of B, or
+  // rows if B is transposed.
+  const size_t minRows = std::max<size_t>(8, ((size_t)1 << 20) / std::max<size_t>((size_t)n * k, 1));
+  const size_t minCols = std::max<size_t>(64, ((size_t)1 << 20) / std::max<size_t>((size_t)m * k, 1));
+  switch((Backend::GemmSplit)choice.variant) {
+    case Backend::GemmSplit::Rows:
+      parallelFor(C->getBackend(), m, minRows, [&](size_t begin, size_t end) {
+        sgemm(transA,
+              transB,
+              (int)(end - begin),
+              n,
+              k,
+              alpha,
+              A->data() + (transA ? begin : begin * lda),
+              lda,
+              B->data(),
+              ldb,
+              beta,
+              C->data() + begin * ldc,
+              ldc);
+      });
+      break;
+    case Backend::GemmSplit::Columns:
+      parallelFor(C->getBackend(), n, minCols, [&](size_t begin, size_t end) {
+        sgemm(transA,
+              transB,
+              m,
+              (int)(end - begin),
+              k,
+              alpha,
+              A->data(),
+              lda,
+              B->data() + (transB ? begin * ldb : begin),
+              ldb,
+              beta,
+              C->data() + begin,
+              ldc);
+      });
+      break;
+    case Backend::GemmSplit::None:
+      sgemm(transA, transB, m, n, k, alpha, A->data(), lda, B->data(), ldb, beta, C->data(), ldc);
+      break;
+  }
+
+  if(choice.explore)
+    tuner->record(key, choice.variant, timer.elapsed());
 #else
   C; A; B; transA; transB; beta; scalar;
   ABORT("You need to compile with MKL in order to use the CPU version");
@@ -348,6 +397,41 @@ void ProdBatchedLegacy(marian::Tensor C,
 #endif
 }
 
+void ProdBatchedHeads(marian::Tensor C,
+                      Ptr<Allocator> /*allocator*/,
+                      const marian::Tensor A,
+                      const marian::Tensor B,
+                      bool scores,
+                      int numHeads,
+                      float scalar) {
+#if BLAS_FOUND
+  matchOrAbort<float>(C->type());
+  HeadsGemm g(C, A, B, scores, numHeads);
+
+  // the GEMMs of all heads write disjoint parts of C and are spread over the intra-op threads
+  size_t minGemms = std::max<size_t>(1, ((size_t)1 << 20) / std::max<size_t>((size_t)g.m * g.n * g.k, 1));
+  parallelFor(C->getBackend(), g.offsetsC.size(), minGemms, [&](size_t begin, size_t end) {
+    for(size_t i = begin; i < end; ++i)
+      sgemm(false,
+            g.transB,
+            g.m,
+            g.n,
+            g.k,
+            scalar,
+            A->data() + g.offsetsA[i],
+            g.lda,
+            B->data() + g.offsetsB[i],
+            g.ldb,
+            0.f,
+            C->data() + g.offsetsC[i],
+            g.ldc);
+  });
+#else
+  C; A; B; scores; numHeads; scalar;
+  ABORT("You need to compile with MKL in order to use the CPU version");
+#endif
+}
+
 void ProdWithBias(marian::Tensor C,
                   const marian::Tensor& A,
                   const marian::Tensor& B,
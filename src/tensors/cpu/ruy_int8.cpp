@@ -0,0 +1,153 @@
+#include "tensors/cpu/ruy_int8.h"
+#include "tensors/cpu/backend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if USE_RUY_SGEMM
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcomment"
+#include "ruy/ruy.h"
+#pragma GCC diagnostic pop
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace marian {
+namespace cpu {
+namespace ruygemm {
+
+bool isAvailable() {
+#if USE_RUY_SGEMM
+  return true;
+#else
+  return false;
+#endif
+}
+
+static float maxAbsolute(const float* x, size_t n) {
+  size_t i = 0;
+  float maxAbs = 0.f;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+  float32x4_t vMax = vdupq_n_f32(0.f);
+  for(; i + 4 <= n; i += 4)
+    vMax = vmaxq_f32(vMax, vabsq_f32(vld1q_f32(x + i)));
+  maxAbs = vmaxvq_f32(vMax);
+#endif
+  for(; i < n; ++i)
+    maxAbs = std::max(maxAbs, std::abs(x[i]));
+  return maxAbs;
+}
+
+// round to nearest and saturate to [-127, 127], -128 is never used as in intgemm
+static void quantize(const float* x, int8_t* out, size_t n, float quantMult) {
+  size_t i = 0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+  const float32x4_t vMult = vdupq_n_f32(quantMult);
+  const int32x4_t vMin = vdupq_n_s32(-127), vMax = vdupq_n_s32(127);
+  for(; i + 8 <= n; i += 8) {
+    int32x4_t lo = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(x + i), vMult));
+    int32x4_t hi = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(x + i + 4), vMult));
+    lo = vminq_s32(vmaxq_s32(lo, vMin), vMax);
+    hi = vminq_s32(vmaxq_s32(hi, vMin), vMax);
+    vst1_s8(out + i, vqmovn_s16(vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi))));
+  }
+#endif
+  for(; i < n; ++i)
+    out[i] = (int8_t)std::max(-127.f, std::min(127.f, std::nearbyint(x[i] * quantMult)));
+}
+
+// out = unquantMult * in (+ bias) for one row of n int32 accumulators
+static void unquantizeRow(const int32_t* in, float* out, const float* bias, int n, float unquantMult) {
+  int j = 0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+  const float32x4_t vMult = vdupq_n_f32(unquantMult);
+  for(; j + 4 <= n; j += 4) {
+    float32x4_t c = vmulq_f32(vcvtq_f32_s32(vld1q_s32(in + j)), vMult);
+    if(bias)
+      c = vaddq_f32(c, vld1q_f32(bias + j));
+    vst1q_f32(out + j, c);
+  }
+#endif
+  for(; j < n; ++j)
+    out[j] = in[j] * unquantMult + (bias ? bias[j] : 0.f);
+}
+
+float computeQuantMult(const marian::Tensor in) {
+  return 127.f / std::max(maxAbsolute(in->data(), in->shape().elements()), 1e-9f);
+}
+
+float& getQuantMult(marian::Tensor quantized) {
+  ABORT_IF(quantized->type() != Type::intgemm8ruy, "getQuantMult does not work for type {}", quantized->type());
+  return *reinterpret_cast<float*>(quantized->data<int8_t>() + quantized->shape().elements());
+}
+
+void QuantizeB(marian::Tensor out, const marian::Tensor in, float quantMult) {
+  ABORT_IF(out->type() != Type::intgemm8ruy, "Output of ruy quantization has type {}", out->type());
+  ABORT_IF(out->shape() != in->shape(), "Shapes {} and {} differ in ruy quantization", out->shape(), in->shape());
+  quantize(in->data(), out->data<int8_t>(), in->shape().elements(), quantMult);
+  getQuantMult(out) = quantMult;
+}
+
+void Affine(marian::Tensor C,
+            const marian::Tensor& A,
+            const marian::Tensor& B,
+            const marian::Tensor& bias,
+            bool transB,
+            float scale) {
+#if USE_RUY_SGEMM
+  int m = A->shape().elements() / A->shape()[-1];
+  int k = A->shape()[-1];
+  int bRows = B->shape().elements() / B->shape()[-1];
+  int bCols = B->shape()[-1];
+  int n = transB ? bRows : bCols;
+  ABORT_IF((transB ? bCols : bRows) != k, "Ruy GEMM of shapes {} and {} does not match", A->shape(), B->shape());
+
+  // the packed B stays in the cache of this context, hence one context per thread for the lifetime of the thread
+  thread_local ::ruy::Context context;
+  context.set_max_num_threads((int)std::static_pointer_cast<cpu::Backend>(C->getBackend())->getIntraOpThreads());
+
+  thread_local std::vector<int8_t> aQuant;
+  thread_local std::vector<int32_t> cInt;
+  aQuant.resize((size_t)m * k);
+  cInt.resize((size_t)m * n);
+
+  const float* a = A->data();
+  float aQuantMult = 127.f / std::max(maxAbsolute(a, A->shape().elements()), 1e-9f);
+  quantize(a, aQuant.data(), aQuant.size(), aQuantMult);
+
+  ::ruy::Matrix<int8_t> lhs;
+  ::ruy::MakeSimpleLayout(m, k, ::ruy::Order::kRowMajor, lhs.mutable_layout());
+  lhs.set_data(aQuant.data());
+
+  // B is stored row-major in its own shape, so a transposed B is a column-major k x n matrix
+  ::ruy::Matrix<int8_t> rhs;
+  ::ruy::MakeSimpleLayout(k, n, transB ? ::ruy::Order::kColMajor : ::ruy::Order::kRowMajor, rhs.mutable_layout());
+  rhs.set_data(B->data<int8_t>());
+  rhs.set_cache_policy(::ruy::CachePolicy::kAlwaysCache); // weights do not change, pack them once
+
+  ::ruy::Matrix<int32_t> dst;
+  ::ruy::MakeSimpleLayout(m, n, ::ruy::Order::kRowMajor, dst.mutable_layout());
+  dst.set_data(cInt.data());
+
+  ::ruy::MulParams<int32_t, int32_t> mulParams; // raw int32 accumulators
+  ::ruy::Mul(lhs, rhs, mulParams, &context, &dst);
+
+  float unquantMult = scale / (aQuantMult * getQuantMult(B));
+  const float* biasData = bias ? bias->data() : nullptr;
+  float* c = C->data();
+  for(int i = 0; i < m; ++i)
+    unquantizeRow(cInt.data() + (size_t)i * n, c + (size_t)i * n, biasData, n, unquantMult);
+#else
+  C; A; B; bias; transB; scale;
+  ABORT("Type {} needs marian compiled with ruy, use -DUSE_RUY_SGEMM=on", Type::intgemm8ruy);
+#endif
+}
+
+}  // namespace ruygemm
+}  // namespace cpu
+}  // namespace marian
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "tensors/tensor.h"
+
+namespace marian {
+namespace cpu {
+namespace ruygemm {
+
+// Int8 GEMMs for Type::intgemm8ruy, run by ruy (src/3rd_party/ruy), which has NEON and dot-product kernels for
+// ARM64 CPUs. B is stored quantized in its original shape and row-major layout with the quantization multiplier
+// at the back, as for the other intgemm types. ruy packs B when it is first used and keeps the packed matrix in
+// the cache of the calling thread's ruy context, so later GEMMs with the same weights only pack A.
+
+// true if this build has ruy, i.e. was compiled with -DUSE_RUY_SGEMM=on
+bool isAvailable();
+
+// quantization multiplier 127 / max |x| of a float32 matrix
+float computeQuantMult(const marian::Tensor in);
+
+float& getQuantMult(marian::Tensor quantized);
+
+// quantizes the float32 matrix in with quantMult into out of type Type::intgemm8ruy and the same shape
+void QuantizeB(marian::Tensor out, const marian::Tensor in, float quantMult);
+
+// C = scale * A * op(B) (+ bias) with float32 A and C and quantized B. A is quantized on the fly with a
+// per-tensor quantization multiplier like intgemm's PrepareA().
+void Affine(marian::Tensor C,
+            const marian::Tensor& A,
+            const marian::Tensor& B,
+            const marian::Tensor& bias,
+            bool transB,
+            float scale);
+
+}  // namespace ruygemm
+}  // namespace cpu
+}  // namespace marian
@@ -0,0 +1,115 @@
+#include "tensors/cpu/sparse_gemm.h"
+#include "tensors/tensor.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace marian {
+namespace cpu {
+namespace sparse {
+
+size_t packedSize(const Shape& shape, const SparsityPattern& pattern) {
+  ABORT_IF(shape.size() != 2 || shape[0] % pattern.group != 0 || shape[1] % pattern.width != 0,
+           "A matrix of shape {} cannot have the {} sparsity pattern", std::string(shape), pattern.toString());
+  size_t blocks = (size_t)(shape[1] / pattern.width) * (shape[0] / pattern.group);
+  return blocks * pattern.keep * (1 + pattern.width);
+}
+
+void Pack(marian::Tensor packed, const marian::Tensor& B, const SparsityPattern& pattern, const std::string& name) {
+  int rows = B->shape()[0];
+  int cols = B->shape()[1];
+  const float* b = B->data();
+  ABORT_IF(!pattern.matches(b, rows, cols),
+           "Parameter {} does not have the {} sparsity pattern of --sparse-gemm, prune it with --prune-pattern or "
+           "marian-conv --prune-pattern", name, pattern.toString());
+
+  int keep = pattern.keep, group = pattern.group, width = pattern.width;
+  float* out = packed->data();
+  std::vector<int> kept;
+  for(int j0 = 0; j0 < cols; j0 += width) {
+    for(int g = 0; g < rows; g += group) {
+      // the non-zero rows, filled up with zero rows if there are fewer
+      kept.clear();
+      for(int r = g; r < g + group; ++r)
+        if(std::any_of(b + (size_t)r * cols + j0, b + (size_t)r * cols + j0 + width, [](float w) { return w != 0.f; }))
+          kept.push_back(r);
+      for(int r = g; r < g + group && (int)kept.size() < keep; ++r)
+        if(std::find(kept.begin(), kept.end(), r) == kept.end())
+          kept.push_back(r);
+
+      for(int i = 0; i < keep; ++i)
+        *out++ = (float)kept[i]; // exact up to 2^24 rows
+      for(int i = 0; i < keep; ++i) {
+        std::copy(b + (size_t)kept[i] * cols + j0, b + (size_t)kept[i] * cols + j0 + width, out);
+        out += width;
+      }
+    }
+  }
+}
+
+// Width > 0 fixes the block width at compile time, so that the accumulation over it is vectorized
+template <int Width>
+static void affine(float* c,
+                   const float* a,
+                   const float* packed,
+                   const float* bias,
+                   int numRows,
+                   int rows,
+                   int cols,
+                   const SparsityPattern& pattern,
+                   float scale) {
+  const int width = Width > 0 ? Width : pattern.width;
+  const int keep = pattern.keep;
+  const int groups = rows / pattern.group;
+  const size_t blockSize = (size_t)groups * keep * (1 + width);
+
+  std::vector<float> acc(width);
+  for(int j0 = 0, block = 0; j0 < cols; j0 += width, ++block) {
+    // the kept weights of a column block stay in the cache for all rows of A
+    const float* blockB = packed + block * blockSize;
+    for(int t = 0; t < numRows; ++t) {
+      const float* at = a + (size_t)t * rows;
+      std::fill(acc.begin(), acc.end(), 0.f);
+      const float* p = blockB;
+      for(int g = 0; g < groups; ++g) {
+        const float* w = p + keep;
+        for(int i = 0; i < keep; ++i) {
+          float x = at[(int)p[i]];
+          for(int j = 0; j < width; ++j)
+            acc[j] += x * w[j];
+          w += width;
+        }
+        p = w;
+      }
+      float* ct = c + (size_t)t * cols + j0;
+      for(int j = 0; j < width; ++j)
+        ct[j] = scale * acc[j] + (bias ? bias[j0 + j] : 0.f);
+    }
+  }
+}
+
+void Affine(marian::Tensor C,
+            const marian::Tensor& A,
+            const marian::Tensor& packedB,
+            const marian::Tensor& bias,
+            const SparsityPattern& pattern,
+            float scale) {
+  int rows = A->shape()[-1];
+  int cols = C->shape()[-1];
+  int numRows = A->shape().elements() / rows;
+  ABORT_IF(packedB->size() != packedSize(Shape({rows, cols}), pattern),
+           "Packed sparse matrix does not match a [{}, {}] matrix with the {} pattern", rows, cols, pattern.toString());
+  ABORT_IF(bias && bias->shape().elements() != cols, "Bias of the sparse GEMM does not have {} elements", cols);
+
+  const float* b = bias ? bias->data() : nullptr;
+  switch(pattern.width) {
+    case 8:  affine<8>(C->data(), A->data(), packedB->data(), b, numRows, rows, cols, pattern, scale); break;
+    case 16: affine<16>(C->data(), A->data(), packedB->data(), b, numRows, rows, cols, pattern, scale); break;
+    case 32: affine<32>(C->data(), A->data(), packedB->data(), b, numRows, rows, cols, pattern, scale); break;
+    default: affine<0>(C->data(), A->data(), packedB->data(), b, numRows, rows, cols, pattern, scale); break;
+  }
+}
+
+}  // namespace sparse
+}  // namespace cpu
+}  // namespace marian
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "common/sparsity.h"
+#include "graph/expression_operators.h"
+#include "graph/node.h"
+#include "graph/node_operators_unary.h"
+
+namespace marian {
+namespace cpu {
+namespace sparse {
+
+// Number of floats of a [rows, cols] matrix packed with pattern: for every block of width columns and every group of
+// M rows, the indices of the N kept rows followed by their N x width weights
+size_t packedSize(const Shape& shape, const SparsityPattern& pattern);
+
+// Packs the float32 matrix B, whose weights must have the pattern, see SparsityPattern::matches()
+void Pack(marian::Tensor packed, const marian::Tensor& B, const SparsityPattern& pattern, const std::string& name);
+
+// C = scale * A * B (+ bias) with A [..., rows] and B packed by Pack() from a [rows, cols] matrix
+void Affine(marian::Tensor C,
+            const marian::Tensor& A,
+            const marian::Tensor& packedB,
+            const marian::Tensor& bias,
+            const SparsityPattern& pattern,
+            float scale);
+
+// The packed weights of a parameter matrix, memoized like the other packed formats
+struct SparsePackNodeOp : public UnaryNodeOp {
+  SparsityPattern pattern_;
+
+  SparsePackNodeOp(Expr b, const SparsityPattern& pattern)
+      : UnaryNodeOp(b, Shape({(int)packedSize(b->shape(), pattern)}), Type::float32), pattern_(pattern) {
+    ABORT_IF(!memoize_, "Only constant weight node can be packed");
+  }
+
+  NodeOps forwardOps() override {
+    return {NodeOp(Pack(val_, child(0)->val(), pattern_, child(0)->name()))};
+  }
+
+  NodeOps backwardOps() override {
+    ABORT("SparsePackNodeOp only available for inference");
+    return {NodeOp(0)};
+  }
+
+  const std::string type() override { return "sparsePack"; }
+
+  virtual size_t hash() override {
+    size_t seed = NaryNodeOp::hash();
+    util::hash_combine(seed, pattern_.keep);
+    util::hash_combine(seed, pattern_.group);
+    util::hash_combine(seed, pattern_.width);
+    return seed;
+  }
+
+  virtual bool equal(Expr node) override {
+    if(!NaryNodeOp::equal(node))
+      return false;
+    auto cnode = std::dynamic_pointer_cast<SparsePackNodeOp>(node);
+    if(!cnode)
+      return false;
+    return pattern_.keep == cnode->pattern_.keep && pattern_.group == cnode->pattern_.group
+           && pattern_.width == cnode->pattern_.width;
+  }
+};
+
+// Whether B is a float32 parameter matrix with the pattern of --sparse-gemm in this graph
+static inline bool isSparse(Expr b, bool transB) {
+  if(transB || b->type() != "param" || b->value_type() != Type::float32)
+    return false;
+  return b->graph()->getBackend()->getSparseGemm().appliesTo(b->name(), b->shape());
+}
+
+/*
+ * dot(...) or affine(...) with a float32 activation matrix A and a parameter matrix B pruned to the pattern of
+ * --sparse-gemm, whose non-zero weights are packed once and then multiplied without reading the pruned ones.
+ */
+static inline Expr affineOrDot(Expr a, Expr b, Expr bias, bool transA, float scale) {
+  ABORT_IF(!isFloat(a->value_type()), "Sparse GEMM expects type of A to be float32 not {}", a->value_type());
+  auto pattern = b->graph()->getBackend()->getSparseGemm();
+
+  if(transA) // batches of A are folded into rows below
+    a = transpose(a);
+
+  Shape outShape = a->shape();
+  outShape.set(-1, b->shape()[-1]);
+
+  auto packedB = Expression<SparsePackNodeOp>(b, pattern);
+  auto dotOrAffineNodeOp = [=](Expr out, const std::vector<Expr>& children) {
+    Tensor bias = children.size() > 2 ? children[2]->val() : nullptr;
+    Affine(out->val(), children[0]->val(), children[1]->val(), bias, pattern, scale);
+  };
+
+  std::vector<Expr> children = {a, packedB};
+  if(bias)
+    children.push_back(bias);
+
+  return lambda(children, outShape, Type::float32, dotOrAffineNodeOp); // inference-only Lambda node
+}
+
+}  // namespace sparse
+}  // namespace cpu
+}  // namespace marian
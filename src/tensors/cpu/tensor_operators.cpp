@@ -16,10 +16,21 @@
 #include <mkl.h>
 #endif
 
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace marian {
 
 namespace cpu {
 
+// rows of at least this many elements in total are worth a thread of their own, see Backend::parallelFor()
+static const size_t MIN_PARALLEL_ELEMENTS = 16384;
+
+static size_t minParallelRows(int cols) {
+  return std::max<size_t>(1, MIN_PARALLEL_ELEMENTS / std::max(cols, 1));
+}
+
 void IsNaN(const Tensor /*in*/, Ptr<Allocator> /*allocator*/, bool& /*isNaN*/, bool& /*isInf*/) {
   ABORT("Not implemented");
 }
@@ -223,12 +234,13 @@ void Transpose0213(Tensor out, Tensor in) {
 
   int r1 = in->shape()[-2];
   int r2 = in->shape()[-3];
-  int rest = rows / (r1 * r2);
 
-  for(int k = 0; k < rest; ++k) {
-    int shift = k * r1 * r2;
-    for(int j = 0; j < r1 * r2; ++j) {
-      int src = j + shift;
+  // every input row goes to a different output row
+  parallelFor(out->getBackend(), rows, minParallelRows(cols), [&](size_t begin, size_t end) {
+    for(int row = (int)begin; row < (int)end; ++row) {
+      int j = row % (r1 * r2);
+      int shift = row - j;
+      int src = row;
       int dst = j / r1 + (j % r1) * r2 + shift;
 
       const float* inRow = in->data() + src * cols;
@@ -243,7 +255,7 @@ void Transpose0213(Tensor out, Tensor in) {
         }
       }
     }
-  }
+  });
 }
 
 // This function is called only when MKL is available.
@@ -368,25 +380,27 @@ void TransposeGeneric(Tensor out, Tensor in, const std::vector<int>& vAxis) {
   int length = out->shape().elements();
 
   constexpr size_t N = functional::Shape::size();
-  functional::Array<int, N> oDims;
-  functional::Array<int, N> pDims;
   functional::Tensor<float> gOut = out;
   functional::Tensor<float> gIn = in;
 
-  for(int index = 0; index < length; ++index) {
-    gOut.shape().dims(index, oDims);
-    for(size_t i = 0; i < N; ++i)
-      pDims[permute[i]] = oDims[i];
+  parallelFor(out->getBackend(), length, MIN_PARALLEL_ELEMENTS, [&](size_t begin, size_t end) {
+    functional::Array<int, N> oDims; // per range
+    functional::Array<int, N> pDims;
+    for(int index = (int)begin; index < (int)end; ++index) {
+      gOut.shape().dims(index, oDims);
+      for(size_t i = 0; i < N; ++i)
+        pDims[permute[i]] = oDims[i];
 
-    // @TODO: where does this change come from?
-    int inIndex = gIn.shape().index(pDims);
+      // @TODO: where does this change come from?
+      int inIndex = gIn.shape().index(pDims);
 
-    // @TODO: use internal conversion instead of raw indices
-    if(add)
-      gOut.data()[index] += gIn.data()[inIndex];
-    else
-      gOut.data()[index] = gIn.data()[inIndex];
-  }
+      // @TODO: use internal conversion instead of raw indices
+      if(add)
+        gOut.data()[index] += gIn.data()[inIndex];
+      else
+        gOut.data()[index] = gIn.data()[inIndex];
+    }
+  });
 }
 
 void TransposeND(Tensor out, Tensor in, const std::vector<int>& vAxis) {
@@ -423,7 +437,8 @@ void Softmax(Tensor out, Tensor in) {
   int rows = fout.shape().elements() / fout.shape().back();
   int cols = fout.shape().back();
 
-  for(int j = 0; j < rows; ++j) {
+  parallelFor(out->getBackend(), rows, minParallelRows(cols * (int)(sizeof(ElementType) / sizeof(float))), [&](size_t begin, size_t end) {
+  for(int j = (int)begin; j < (int)end; ++j) {
     ElementType* so = pOut + j * cols;
     const ElementType* sp = pIn + j * cols;
 
@@ -449,6 +464,7 @@ void Softmax(Tensor out, Tensor in) {
       so[i] = Ops<ElementType>::div(so[i], sums);
     }
   }
+  });
 }
 
 
@@ -469,6 +485,163 @@ void Softmax(Tensor out, Tensor in) {
   }
 }
 
+// softmax(scale * in + logMask) along the last axis in one pass over each row of in, e.g. for attention
+// scores. logMask broadcasts against in, its last dimension is either the one of in or 1.
+template <typename ElementType>
+void MaskedSoftmax(Tensor out, Tensor in, Tensor logMask, float scale) {
+  using namespace functional;
+  functional::Tensor<ElementType> fout = out;
+  const functional::Tensor<ElementType> fin = in;
+
+  ElementType* pOut = fout.data();
+  const ElementType* pIn = fin.data();
+  const float* pMask = logMask->data();
+
+  int rows = fout.shape().elements() / fout.shape().back();
+  int cols = fout.shape().back();
+  const marian::Shape& inShape = in->shape();
+  const marian::Shape& maskShape = logMask->shape();
+  bool maskRows = maskShape[-1] > 1; // otherwise one mask value per row
+  int maskCols = maskShape[-1];
+
+  // offset of the mask row that broadcasts to row j of in, dimensions missing in the mask broadcast too
+  auto maskOffset = [&](int j) {
+    size_t offset = 0, stride = maskCols;
+    for(int d = -2; d >= -(int)inShape.size(); --d) {
+      int dim = inShape[d];
+      int maskDim = -d <= (int)maskShape.size() ? maskShape[d] : 1;
+      if(maskDim > 1)
+        offset += (j % dim) * stride;
+      stride *= maskDim;
+      j /= dim;
+    }
+    return offset;
+  };
+
+  typename Ops<ElementType>::Single scales = scale;
+  parallelFor(out->getBackend(), rows, minParallelRows(cols * (int)(sizeof(ElementType) / sizeof(float))), [&](size_t begin, size_t end) {
+  for(int j = (int)begin; j < (int)end; ++j) {
+    ElementType* so = pOut + j * cols;
+    const ElementType* sp = pIn + j * cols;
+    const float* sm = pMask + maskOffset(j);
+    const ElementType* smRow = reinterpret_cast<const ElementType*>(sm);
+
+    // scaled and masked scores are kept in the output row, which stays in cache for the next two passes
+    ElementType max = Ops<ElementType>::add(Ops<ElementType>::mul(sp[0], scales), maskRows ? smRow[0] : ElementType(sm[0]));
+    for(int i = 0; i < cols; ++i) {
+      ElementType x = Ops<ElementType>::add(Ops<ElementType>::mul(sp[i], scales), maskRows ? smRow[i] : ElementType(sm[0]));
+      so[i] = x;
+      max = Ops<ElementType>::max(max, x);
+    }
+    typename Ops<ElementType>::Single maxs = Ops<ElementType>::maxReduce(max);
+
+    ElementType sum = 0.f;
+    for(int i = 0; i < cols; ++i) {
+      ElementType ex = Ops<ElementType>::exp(Ops<ElementType>::sub(so[i], maxs));
+      sum = Ops<ElementType>::add(sum, ex);
+      so[i] = ex;
+    }
+    typename Ops<ElementType>::Single sums = Ops<ElementType>::sumReduce(sum);
+
+    for(int i = 0; i < cols; ++i) {
+      so[i] = Ops<ElementType>::div(so[i], sums);
+    }
+  }
+  });
+}
+
+void MaskedSoftmax(Tensor out, Tensor in, Tensor logMask, float scale) {
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(in->type());
+  matchOrAbort<float>(logMask->type());
+  int cols = out->shape()[-1];
+  for(int d = 1; d <= (int)logMask->shape().size(); ++d)
+    ABORT_IF(d > (int)in->shape().size() || (logMask->shape()[-d] != in->shape()[-d] && logMask->shape()[-d] != 1),
+             "Mask of shape {} does not broadcast to scores of shape {}", logMask->shape(), in->shape());
+
+#ifdef __AVX__
+  if(cols % 8 == 0) {
+    MaskedSoftmax<float32x8>(out, in, logMask, scale);
+    return;
+  }
+#endif
+  if(cols % 4 == 0) {
+    MaskedSoftmax<float32x4>(out, in, logMask, scale);
+  } else {
+    MaskedSoftmax<float>(out, in, logMask, scale);
+  }
+}
+
+// the masked steps of a sentence are skipped instead of being multiplied with 0 and, for the max, pushed down
+void MaskedPool(Tensor out, Tensor in, Tensor mask, bool mean) {
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(in->type());
+  matchOrAbort<float>(mask->type());
+  int steps = in->shape()[-3];
+  int dimBatch = in->shape()[-2];
+  int dimModel = in->shape()[-1];
+  ABORT_IF(mask->shape().elements() != steps * dimBatch,
+           "Mask of shape {} does not match states of shape {}", mask->shape(), in->shape());
+
+  const float* pIn = in->data();
+  const float* pMask = mask->data();
+  float* pOut = out->data();
+  parallelFor(out->getBackend(), dimBatch, minParallelRows(steps * dimModel), [&](size_t begin, size_t end) {
+  for(int b = (int)begin; b < (int)end; ++b) {
+    float* so = pOut + b * dimModel;
+    float weights = 0.f;
+    for(int t = 0; t < steps; ++t) {
+      float m = pMask[t * dimBatch + b];
+      if(m == 0.f)
+        continue;
+      const float* sp = pIn + (t * dimBatch + b) * dimModel;
+      if(weights == 0.f) {
+        for(int i = 0; i < dimModel; ++i)
+          so[i] = sp[i] * m;
+      } else if(mean) {
+        for(int i = 0; i < dimModel; ++i)
+          so[i] += sp[i] * m;
+      } else {
+        for(int i = 0; i < dimModel; ++i)
+          so[i] = std::max(so[i], sp[i] * m);
+      }
+      weights += m;
+    }
+    if(weights == 0.f)
+      std::fill(so, so + dimModel, 0.f);
+    else if(mean)
+      for(int i = 0; i < dimModel; ++i)
+        so[i] /= weights;
+  }
+  });
+}
+
+void Cosine(Tensor out, Tensor a, Tensor b) {
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(a->type());
+  matchOrAbort<float>(b->type());
+  ABORT_IF(a->shape() != b->shape(), "Cosines of rows of shapes {} and {}", a->shape(), b->shape());
+  int cols = a->shape()[-1];
+  int rows = a->shape().elements() / cols;
+
+  const float* pA = a->data();
+  const float* pB = b->data();
+  float* pOut = out->data();
+  parallelFor(out->getBackend(), rows, minParallelRows(2 * cols), [&](size_t begin, size_t end) {
+  for(int j = (int)begin; j < (int)end; ++j) {
+    const float* sa = pA + j * cols;
+    const float* sb = pB + j * cols;
+    float ab = 0.f, aa = 0.f, bb = 0.f;
+    for(int i = 0; i < cols; ++i) {
+      ab += sa[i] * sb[i];
+      aa += sa[i] * sa[i];
+      bb += sb[i] * sb[i];
+    }
+    pOut[j] = ab / (std::sqrt(aa) * std::sqrt(bb));
+  }
+  });
+}
+
 
 template <typename ElementType>
 void LogSoftmax(Tensor out, Tensor in) {
@@ -483,7 +656,8 @@ void LogSoftmax(Tensor out, Tensor in) {
   int rows = fout.shape().elements() / fout.shape().back();
   int cols = fout.shape().back();
 
-  for(int j = 0; j < rows; ++j) {
+  parallelFor(out->getBackend(), rows, minParallelRows(cols * (int)(sizeof(ElementType) / sizeof(float))), [&](size_t begin, size_t end) {
+  for(int j = (int)begin; j < (int)end; ++j) {
     ElementType* so = pOut + j * cols;
     const ElementType* sp = pIn + j * cols;
 
@@ -506,6 +680,7 @@ void LogSoftmax(Tensor out, Tensor in) {
       so[i] = Ops<ElementType>::sub(so[i], logSum);
     }
   }
+  });
 }
 
 void LogSoftmax(Tensor out, Tensor in) {
@@ -525,6 +700,123 @@ void LogSoftmax(Tensor out, Tensor in) {
   }
 }
 
+// Fused shortlisted output layer, reads the selected rows of W in place and normalizes each row of
+// logits in out, see logsoftmax_shortlist()
+void LogSoftmaxShortlist(Tensor out, const Tensor x, const Tensor W, const Tensor indices, const Tensor bias) {
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(x->type());
+  matchOrAbort<float>(W->type());
+  matchOrAbort<IndexType>(indices->type());
+
+  int dim = x->shape()[-1];
+  int k = out->shape()[-1];
+  int numQueries = out->shape().elements() / k;
+  int numIndexRows = indices->shape().elements() / k; // indices are shared over the beam if this is the batch size
+
+  const float* px = x->data();
+  const float* pW = W->data();
+  const IndexType* pIndices = indices->data<IndexType>();
+  const float* pBias = bias ? bias->data() : nullptr;
+  float* pOut = out->data();
+
+  for(int q = 0; q < numQueries; ++q) {
+    const float* xq = px + (size_t)q * dim;
+    const IndexType* rowIndices = pIndices + (size_t)(q % numIndexRows) * k;
+    float* so = pOut + (size_t)q * k;
+    for(int j = 0; j < k; ++j) {
+      const float* w = pW + (size_t)rowIndices[j] * dim;
+      float sum = 0.f;
+      for(int d = 0; d < dim; ++d)
+        sum += xq[d] * w[d];
+      so[j] = pBias ? sum + pBias[rowIndices[j]] : sum;
+    }
+  }
+
+  cpu::LogSoftmax(out, out); // row-wise and safe in place
+}
+
+// The smallest logit of the row that GumbelSampling() keeps, buffer is scratch memory of the calling thread
+static float samplingThreshold(const float* row, int cols, SamplingMethod method, float param, bool normalize,
+                               std::vector<float>& buffer) {
+  if(method == SamplingMethod::Full)
+    return -std::numeric_limits<float>::infinity();
+
+  float max = *std::max_element(row, row + cols);
+  float logSum = 0.f; // log-normalizer of the row, the kept logits of top-k do not depend on it
+  if(normalize && method != SamplingMethod::TopK) {
+    float sum = 0.f;
+    for(int i = 0; i < cols; ++i)
+      sum += std::exp(row[i] - max);
+    logSum = max + std::log(sum);
+  }
+  if(method == SamplingMethod::Epsilon)
+    return std::min(max, std::log(param) + logSum); // keeps at least the best logit
+
+  buffer.assign(row, row + cols);
+  if(method == SamplingMethod::TopK) {
+    int k = std::min(std::max((int)param, 1), cols);
+    std::nth_element(buffer.begin(), buffer.begin() + k - 1, buffer.end(), std::greater<float>());
+    return buffer[k - 1];
+  }
+
+  // The nucleus is the shortest prefix of the logits in descending order with a probability mass above param. Only
+  // the largest logits are sorted, and more of them while their mass is not large enough.
+  for(int k = std::min(64, cols);; k = std::min(4 * k, cols)) {
+    std::nth_element(buffer.begin(), buffer.begin() + k - 1, buffer.end(), std::greater<float>());
+    std::sort(buffer.begin(), buffer.begin() + k, std::greater<float>());
+    float mass = 0.f; // of the logits before i
+    for(int i = 0; i < k; ++i) {
+      if(mass > param)
+        return buffer[std::max(i - 1, 0)];
+      mass += std::exp(buffer[i] - logSum);
+    }
+    if(mass > param || k == cols)
+      return buffer[k - 1];
+  }
+}
+
+// Gumbel-max sampling with truncation in one kernel per row, see gumbel_sampling()
+void GumbelSampling(Tensor out,
+                    const Tensor logits,
+                    const Tensor noise,
+                    SamplingMethod method,
+                    float param,
+                    float temperature,
+                    bool normalize) {
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(logits->type());
+  matchOrAbort<float>(noise->type());
+
+  int cols = out->shape()[-1];
+  int rows = out->shape().elements() / cols;
+  const float* pLogits = logits->data();
+  const float* pNoise = noise->data();
+  float* pOut = out->data();
+  const float minusInf = -std::numeric_limits<float>::infinity();
+
+  parallelFor(out->getBackend(), rows, minParallelRows(cols), [&](size_t begin, size_t end) {
+    std::vector<float> buffer;
+    for(size_t j = begin; j < end; ++j) {
+      const float* sp = pLogits + j * cols;
+      const float* sg = pNoise + j * cols;
+      float* so = pOut + j * cols;
+
+      float threshold = samplingThreshold(sp, cols, method, param, normalize, buffer);
+      float max = minusInf;
+      for(int i = 0; i < cols; ++i) {
+        so[i] = sp[i] >= threshold ? sp[i] / temperature + sg[i] : minusInf;
+        max = std::max(max, so[i]);
+      }
+      float sum = 0.f;
+      for(int i = 0; i < cols; ++i)
+        sum += std::exp(so[i] - max);
+      float logSum = max + std::log(sum);
+      for(int i = 0; i < cols; ++i)
+        so[i] -= logSum;
+    }
+  });
+}
+
 // @TODO: Remove remaining underscores in CPU kernels
 void SoftmaxGrad(Tensor grad_, Tensor adj_, Tensor val_) {
   int rows = grad_->shape().elements() / grad_->shape()[-1];
@@ -1082,84 +1374,222 @@ void AttBack(Tensor gVa_,
   }
 }
 
-MARIAN_FFAST_MATH_BEGIN
-template <int alphaStride, int betaStride, bool hasBeta>
-void LayerNormalizationImpl(float* out,
-                            const float* in,
-                            const float* alpha,
-                            const float* beta,
-                            float eps,
-                            int rows,
-                            int cols) {
-  #pragma omp parallel for
-  for(int j = 0; j < rows; ++j) {
-    float* so = out + j * cols;
-    const float* sp = in + j * cols;
+// Explicit SIMD for the normalization kernels below, which mostly run on rows of a few hundred
+// or thousand floats. The widest instruction set the file is compiled for is used.
+#if defined(__AVX512F__)
+typedef __m512 VecF;
+static const int VEC_WIDTH = 16;
+static inline VecF vload(const float* p) { return _mm512_loadu_ps(p); }
+static inline void vstore(float* p, VecF v) { _mm512_storeu_ps(p, v); }
+static inline VecF vset1(float x) { return _mm512_set1_ps(x); }
+static inline VecF vadd(VecF a, VecF b) { return _mm512_add_ps(a, b); }
+static inline VecF vsub(VecF a, VecF b) { return _mm512_sub_ps(a, b); }
+static inline VecF vmul(VecF a, VecF b) { return _mm512_mul_ps(a, b); }
+static inline VecF vfmadd(VecF a, VecF b, VecF c) { return _mm512_fmadd_ps(a, b, c); }
+static inline float vsum(VecF v) { return _mm512_reduce_add_ps(v); }
+#elif defined(__AVX__)
+typedef __m256 VecF;
+static const int VEC_WIDTH = 8;
+static inline VecF vload(const float* p) { return _mm256_loadu_ps(p); }
+static inline void vstore(float* p, VecF v) { _mm256_storeu_ps(p, v); }
+static inline VecF vset1(float x) { return _mm256_set1_ps(x); }
+static inline VecF vadd(VecF a, VecF b) { return _mm256_add_ps(a, b); }
+static inline VecF vsub(VecF a, VecF b) { return _mm256_sub_ps(a, b); }
+static inline VecF vmul(VecF a, VecF b) { return _mm256_mul_ps(a, b); }
+#ifdef __FMA__
+static inline VecF vfmadd(VecF a, VecF b, VecF c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+static inline VecF vfmadd(VecF a, VecF b, VecF c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+static inline float vsum(VecF v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+typedef float32x4_t VecF;
+static const int VEC_WIDTH = 4;
+static inline VecF vload(const float* p) { return vld1q_f32(p); }
+static inline void vstore(float* p, VecF v) { vst1q_f32(p, v); }
+static inline VecF vset1(float x) { return vdupq_n_f32(x); }
+static inline VecF vadd(VecF a, VecF b) { return vaddq_f32(a, b); }
+static inline VecF vsub(VecF a, VecF b) { return vsubq_f32(a, b); }
+static inline VecF vmul(VecF a, VecF b) { return vmulq_f32(a, b); }
+static inline VecF vfmadd(VecF a, VecF b, VecF c) { return vfmaq_f32(c, a, b); }
+static inline float vsum(VecF v) { return vaddvq_f32(v); }
+#else
+#define NORM_SCALAR_ONLY 1
+#endif
 
-    float sum = 0.f;
-    #pragma omp simd reduction(+ : sum)
-    for(int i = 0; i < cols; ++i) {
-      sum += sp[i];
+// Normalizes one row of cols elements: so = alpha * (x - mean) / sigma + beta with x = sp (+ res) for layer
+// normalization, and so = alpha * x / rms + beta for RMS normalization. With a residual the sum x is written
+// to so in the first pass and read back from there, so the inputs are read once.
+template <bool rms, int alphaStride, int betaStride, bool hasBeta, bool hasResidual>
+static inline void NormalizeRow(float* so,
+                                const float* sp,
+                                const float* res,
+                                const float* alpha,
+                                const float* beta,
+                                float eps,
+                                int cols) {
+  int i = 0;
+  float sum = 0.f, sqSum = 0.f;
+#ifndef NORM_SCALAR_ONLY
+  const int vecCols = cols - cols % VEC_WIDTH;
+  VecF vSum = vset1(0.f), vSqSum = vset1(0.f);
+  for(; i < vecCols; i += VEC_WIDTH) {
+    VecF x = vload(sp + i);
+    if(hasResidual) {
+      x = vadd(x, vload(res + i));
+      vstore(so + i, x);
     }
+    vSum = vadd(vSum, x);
+    vSqSum = vfmadd(x, x, vSqSum);
+  }
+  sum = vsum(vSum);
+  sqSum = vsum(vSqSum);
+#endif
+  for(; i < cols; ++i) {
+    float x = sp[i];
+    if(hasResidual) {
+      x += res[i];
+      so[i] = x;
+    }
+    sum += x;
+    sqSum += x * x;
+  }
+  const float* src = hasResidual ? so : sp;
 
-    float mean = sum / cols;
-    float sqSum = 0.f;
-    #pragma omp simd reduction(+ : sqSum)
-    for(int i = 0; i < cols; ++i) {
-      float ex = sp[i] - mean;
+  float mean = 0.f;
+  if(rms) {
+    sqSum = sqSum / cols;
+  } else {
+    // second pass around the mean, the single-pass variance is too imprecise for rows with a large mean
+    mean = sum / cols;
+    sqSum = 0.f;
+    i = 0;
+#ifndef NORM_SCALAR_ONLY
+    VecF vMean = vset1(mean);
+    vSqSum = vset1(0.f);
+    for(; i < vecCols; i += VEC_WIDTH) {
+      VecF ex = vsub(vload(src + i), vMean);
+      vSqSum = vfmadd(ex, ex, vSqSum);
+    }
+    sqSum = vsum(vSqSum);
+#endif
+    for(; i < cols; ++i) {
+      float ex = src[i] - mean;
       sqSum += ex * ex;
     }
+    sqSum = sqSum / cols;
+  }
 
-    float sigma = std::sqrt(sqSum / cols + eps);
-
-    #pragma omp simd
-    for(int i = 0; i < cols; ++i) {
-      float t = alpha[alphaStride * i] * ((sp[i] - mean) / sigma);
-      if(hasBeta)
-        t += beta[betaStride * i];
+  float invSigma = 1.f / std::sqrt(sqSum + eps);
+
+  i = 0;
+#ifndef NORM_SCALAR_ONLY
+  VecF vMean = vset1(mean), vInvSigma = vset1(invSigma);
+  VecF vAlpha = vset1(alpha[0]), vBeta = vset1(hasBeta ? beta[0] : 0.f);
+  for(; i < vecCols; i += VEC_WIDTH) {
+    if(alphaStride)
+      vAlpha = vload(alpha + i);
+    VecF t = vmul(vAlpha, vmul(vsub(vload(src + i), vMean), vInvSigma));
+    if(hasBeta)
+      t = vadd(t, betaStride ? vload(beta + i) : vBeta);
+    vstore(so + i, t);
+  }
+#endif
+  for(; i < cols; ++i) {
+    float t = alpha[alphaStride * i] * ((src[i] - mean) * invSigma);
+    if(hasBeta)
+      t += beta[betaStride * i];
+    so[i] = t;
+  }
+}
 
-      so[i] = t;
-    }
+template <bool rms, int alphaStride, int betaStride, bool hasBeta, bool hasResidual>
+void NormalizationImpl(float* out,
+                       const float* in,
+                       const float* residual,
+                       const float* alpha,
+                       const float* beta,
+                       float eps,
+                       int rows,
+                       int cols) {
+  #pragma omp parallel for
+  for(int j = 0; j < rows; ++j) {
+    NormalizeRow<rms, alphaStride, betaStride, hasBeta, hasResidual>(
+        out + j * cols, in + j * cols, hasResidual ? residual + j * cols : nullptr, alpha, beta, eps, cols);
   }
 }
-MARIAN_FFAST_MATH_END
 
-template <int alphaStride>
-inline void LayerNormalizationDispatchBeta(float* out,
-                                           const float* in,
-                                           const float* alpha,
-                                           Tensor beta,
-                                           float eps,
-                                           int rows,
-                                           int cols) {
+template <bool rms, int alphaStride, bool hasResidual>
+inline void NormalizationDispatchBeta(float* out,
+                                      const float* in,
+                                      const float* residual,
+                                      const float* alpha,
+                                      Tensor beta,
+                                      float eps,
+                                      int rows,
+                                      int cols) {
   if (beta) {
     if (beta->shape().back() > 1) {
-      LayerNormalizationImpl<alphaStride, 1, true>(out, in, alpha, beta->data(), eps, rows, cols);
+      NormalizationImpl<rms, alphaStride, 1, true, hasResidual>(out, in, residual, alpha, beta->data(), eps, rows, cols);
     } else {
-      LayerNormalizationImpl<alphaStride, 0, true>(out, in, alpha, beta->data(), eps, rows, cols);
+      NormalizationImpl<rms, alphaStride, 0, true, hasResidual>(out, in, residual, alpha, beta->data(), eps, rows, cols);
     }
   } else {
-    LayerNormalizationImpl<alphaStride, 0, false>(out, in, alpha, nullptr, eps, rows, cols);
+    NormalizationImpl<rms, alphaStride, 0, false, hasResidual>(out, in, residual, alpha, nullptr, eps, rows, cols);
   }
 }
 
-void LayerNormalization(Tensor out_,
-                        Tensor in_,
-                        Tensor gamma_,
-                        Tensor beta,
-                        float eps) {
+// Shared by layer and RMS normalization with and without residual, rows are split over the intra-op threads
+template <bool rms>
+static void Normalization(Tensor out_, Tensor in_, Tensor residual_, Tensor gamma_, Tensor beta, float eps) {
   float* out = out_->data();
   const float* in = in_->data();
+  const float* residual = residual_ ? residual_->data() : nullptr;
   const float* alpha = gamma_->data();
   const int alphaStride = gamma_->shape().back() > 1;  // broadcasting for alpha and beta
 
   int rows = in_->shape().elements() / in_->shape().back();
   int cols = in_->shape().back();
-  if (alphaStride == 0) {
-    LayerNormalizationDispatchBeta<0>(out, in, alpha, beta, eps, rows, cols);
-  } else {
-    LayerNormalizationDispatchBeta<1>(out, in, alpha, beta, eps, rows, cols);
-  }
+  ABORT_IF(residual_ && residual_->shape() != in_->shape(),
+           "Residual of shape {} does not match input of shape {}", residual_->shape(), in_->shape());
+  parallelFor(out_->getBackend(), rows, minParallelRows(cols), [&](size_t begin, size_t end) {
+    int offset = (int)begin * cols;
+    const float* res = residual ? residual + offset : nullptr;
+    int numRows = (int)(end - begin);
+    if (alphaStride == 0) {
+      if(res)
+        NormalizationDispatchBeta<rms, 0, true>(out + offset, in + offset, res, alpha, beta, eps, numRows, cols);
+      else
+        NormalizationDispatchBeta<rms, 0, false>(out + offset, in + offset, nullptr, alpha, beta, eps, numRows, cols);
+    } else {
+      if(res)
+        NormalizationDispatchBeta<rms, 1, true>(out + offset, in + offset, res, alpha, beta, eps, numRows, cols);
+      else
+        NormalizationDispatchBeta<rms, 1, false>(out + offset, in + offset, nullptr, alpha, beta, eps, numRows, cols);
+    }
+  });
+}
+
+void LayerNormalization(Tensor out,
+                        Tensor in,
+                        Tensor gamma,
+                        Tensor beta,
+                        float eps) {
+  Normalization</*rms=*/false>(out, in, nullptr, gamma, beta, eps);
+}
+
+void AddLayerNormalization(Tensor out,
+                           Tensor in,
+                           Tensor residual,
+                           Tensor gamma,
+                           Tensor beta,
+                           float eps) {
+  Normalization</*rms=*/false>(out, in, residual, gamma, beta, eps);
 }
 
 MARIAN_FFAST_MATH_BEGIN
@@ -1275,74 +1705,21 @@ void LayerNormalizationGrad(Tensor gradX_,
 }
 MARIAN_FFAST_MATH_END
 
-MARIAN_FFAST_MATH_BEGIN
-template <int alphaStride, int betaStride, bool hasBeta>
-void RMSNormalizationImpl(float* out,
-                          const float* in,
-                          const float* alpha,
-                          const float* beta,
-                          float eps,
-                          int rows,
-                          int cols) {
-  #pragma omp parallel for
-  for(int j = 0; j < rows; ++j) {
-    float* so = out + j * cols;
-    const float* sp = in + j * cols;
-
-    float sqSum = 0.f;
-    #pragma omp simd reduction(+ : sqSum)
-    for(int i = 0; i < cols; ++i) {
-      sqSum += sp[i] * sp[i];
-    }
-
-    float rms = std::sqrt(sqSum / cols + eps);
-
-    #pragma omp simd
-    for(int i = 0; i < cols; ++i) {
-      float t = alpha[alphaStride * i] * (sp[i] / rms);
-      if(hasBeta)
-        t += beta[betaStride * i];
-
-      so[i] = t;
-    }
-  }
-}
-MARIAN_FFAST_MATH_END
-
-template <int alphaStride>
-inline void RMSNormalizationDispatchBeta(float* out,
-                                           const float* in,
-                                           const float* alpha,
-                                           Tensor beta,
-                                           float eps,
-                                           int rows,
-                                           int cols) {
-  if (beta) {
-    if (beta->shape().back() > 1) {
-      RMSNormalizationImpl<alphaStride, 1, true>(out, in, alpha, beta->data(), eps, rows, cols);
-    } else {
-      RMSNormalizationImpl<alphaStride, 0, true>(out, in, alpha, beta->data(), eps, rows, cols);
-    }
-  } else {
-    RMSNormalizationImpl<alphaStride, 0, false>(out, in, alpha, nullptr, eps, rows, cols);
-  }
-}
-
 void RMSNormalization(Tensor out,
                       Tensor in,
                       Tensor gamma,
                       Tensor beta,
                       float eps) {
-  const float* alpha = gamma->data();
-  const int alphaStride = gamma->shape().back() > 1;  // broadcasting for alpha and beta
+  Normalization</*rms=*/true>(out, in, nullptr, gamma, beta, eps);
+}
 
-  int rows = in->shape().elements() / in->shape().back();
-  int cols = in->shape().back();
-  if (alphaStride == 0) {
-    RMSNormalizationDispatchBeta<0>(out->data(), in->data(), alpha, beta, eps, rows, cols);
-  } else {
-    RMSNormalizationDispatchBeta<1>(out->data(), in->data(), alpha, beta, eps, rows, cols);
-  }
+void AddRMSNormalization(Tensor out,
+                         Tensor in,
+                         Tensor residual,
+                         Tensor gamma,
+                         Tensor beta,
+                         float eps) {
+  Normalization</*rms=*/true>(out, in, residual, gamma, beta, eps);
 }
 
 MARIAN_FFAST_MATH_BEGIN
@@ -1745,6 +2122,218 @@ void SinusoidalPositionEmbeddings(marian::Tensor t, int start) {
   }
 }
 
+void EmbedWithPositions(marian::Tensor out,
+                        const marian::Tensor embeddings,
+                        const marian::Tensor indices,
+                        const marian::Tensor weights,
+                        const marian::Tensor offsets,
+                        float scale,
+                        int start,
+                        int positionAxis) {
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(embeddings->type());
+  ABORT_IF((weights == nullptr) != (offsets == nullptr), "Embedding weights and offsets come together");
+
+  const auto& shape = out->shape();
+  int dimEmb  = shape[-1];
+  int rows    = (int)(shape.elements() / dimEmb);
+  int axis    = shape.axis(positionAxis);
+  ABORT_IF(axis == shape.size() - 1, "Positions cannot run along the embedding axis");
+  int dimPositions = shape[axis];
+  int stride  = 1; // rows between consecutive positions
+  for(int i = axis + 1; i < shape.size() - 1; ++i)
+    stride *= shape[i];
+
+  // the frequencies of SinusoidalPositionEmbeddings() per column
+  int numTimescales = dimEmb / 2;
+  float logTimescaleIncrement = std::log(10000.f) / ((float)dimEmb / 2 - 1.f);
+  std::vector<float> frequencies(dimEmb);
+  for(int i = 0; i < dimEmb; ++i)
+    frequencies[i] = std::exp((i % numTimescales) * -logTimescaleIncrement);
+
+  const float* E = embeddings->data();
+  const IndexType* idx = indices->data<IndexType>();
+  const float* w = weights ? weights->data() : nullptr;
+  const IndexType* offs = offsets ? offsets->data<IndexType>() : nullptr;
+
+  for(int r = 0; r < rows; ++r) {
+    float* outRow = out->data() + (size_t)r * dimEmb;
+    if(offs) {
+      std::fill(outRow, outRow + dimEmb, 0.f);
+      for(IndexType k = offs[r]; k < offs[r + 1]; ++k) {
+        const float* embRow = E + (size_t)idx[k] * dimEmb;
+        for(int i = 0; i < dimEmb; ++i)
+          outRow[i] += w[k] * embRow[i];
+      }
+    } else {
+      std::copy(E + (size_t)idx[r] * dimEmb, E + (size_t)(idx[r] + 1) * dimEmb, outRow);
+    }
+
+    float position = (float)((r / stride) % dimPositions + start);
+    for(int i = 0; i < dimEmb; ++i) {
+      float v = position * frequencies[i];
+      outRow[i] = scale * outRow[i] + (i < numTimescales ? std::sin(v) : std::cos(v));
+    }
+  }
+}
+
+template <typename T, typename G, typename O>
+static void FusedAdamTyped(marian::Tensor params, const marian::Tensor grads, marian::Tensor mt, marian::Tensor vt,
+                           marian::Tensor avg, marian::Tensor out, const FusedAdamArgs& args) {
+  T* p = params->data<T>();
+  const G* g = grads->data<G>();
+  T* m = mt->data<T>();
+  T* v = vt->data<T>();
+  T* a = avg ? avg->data<T>() : nullptr;
+  O* o = out ? out->data<O>() : nullptr;
+  for(size_t i = 0, n = params->size(); i < n; ++i) {
+    float mi = (float)m[i], vi = (float)v[i];
+    float pi = args.apply((float)p[i], (float)g[i], mi, vi);
+    m[i] = (T)mi;
+    v[i] = (T)vi;
+    p[i] = (T)pi;
+    if(a)
+      a[i] = (T)args.smooth((float)a[i], pi);
+    if(o)
+      o[i] = (O)pi;
+  }
+}
+
+void FusedAdam(marian::Tensor params, const marian::Tensor grads, marian::Tensor mt, marian::Tensor vt,
+               marian::Tensor avg, marian::Tensor out, const FusedAdamArgs& args) {
+  size_t n = params->size();
+  ABORT_IF(grads->size() != n || mt->size() != n || vt->size() != n || (avg && avg->size() != n) || (out && out->size() != n),
+           "FusedAdam() over tensors of different sizes");
+  ABORT_IF(out && out->type() != grads->type(), "FusedAdam() output of type {} for gradients of type {}", out->type(), grads->type());
+  if(params->type() == Type::float32 && grads->type() == Type::float32)
+    FusedAdamTyped<float, float, float>(params, grads, mt, vt, avg, out, args);
+  else if(params->type() == Type::float32 && grads->type() == Type::float16)
+    FusedAdamTyped<float, float16, float16>(params, grads, mt, vt, avg, out, args);
+  else if(params->type() == Type::float16 && grads->type() == Type::float16)
+    FusedAdamTyped<float16, float16, float16>(params, grads, mt, vt, avg, out, args);
+  else
+    ABORT("FusedAdam() not implemented for parameters of type {} and gradients of type {}", params->type(), grads->type());
+}
+
+template <typename G>
+static void FusedAdam8bitTyped(marian::Tensor params, const marian::Tensor grads, marian::Tensor mq, marian::Tensor vq,
+                               marian::Tensor scales, marian::Tensor avg, marian::Tensor out, const FusedAdamArgs& args) {
+  const size_t BLOCK = Adam8bitCodec::BLOCK;
+  size_t n = params->size();
+  size_t blocks = (n + BLOCK - 1) / BLOCK;
+  float* p = params->data<float>();
+  const G* g = grads->data<G>();
+  int8_t* mqs = mq->data<int8_t>();
+  uint8_t* vqs = vq->data<uint8_t>();
+  float* mMax = scales->data<float>();
+  float* vMax = mMax + blocks;
+  float* a = avg ? avg->data<float>() : nullptr;
+  G* o = out ? out->data<G>() : nullptr;
+
+  float m[BLOCK], v[BLOCK];
+  for(size_t b = 0; b < blocks; ++b) {
+    size_t begin = b * BLOCK, size = std::min(BLOCK, n - begin);
+    float mNew = 0.f, vNew = 0.f;
+    for(size_t i = 0; i < size; ++i) {
+      size_t j = begin + i;
+      m[i] = Adam8bitCodec::decodeM(mqs[j], mMax[b]);
+      v[i] = Adam8bitCodec::decodeV(vqs[j], vMax[b]);
+      p[j] = args.apply(p[j], (float)g[j], m[i], v[i]);
+      if(a)
+        a[j] = args.smooth(a[j], p[j]);
+      if(o)
+        o[j] = (G)p[j];
+      mNew = std::max(mNew, std::abs(m[i]));
+      vNew = std::max(vNew, v[i]);
+    }
+    mMax[b] = mNew;
+    vMax[b] = vNew;
+    for(size_t i = 0; i < size; ++i) {
+      mqs[begin + i] = Adam8bitCodec::encodeM(m[i], mNew);
+      vqs[begin + i] = Adam8bitCodec::encodeV(v[i], vNew);
+    }
+  }
+}
+
+void FusedAdam8bit(marian::Tensor params, const marian::Tensor grads, marian::Tensor mq, marian::Tensor vq,
+                   marian::Tensor scales, marian::Tensor avg, marian::Tensor out, const FusedAdamArgs& args) {
+  size_t n = params->size();
+  size_t blocks = (n + Adam8bitCodec::BLOCK - 1) / Adam8bitCodec::BLOCK;
+  ABORT_IF(grads->size() != n || mq->size() != n || vq->size() != n || scales->size() != 2 * blocks
+           || (avg && avg->size() != n) || (out && out->size() != n),
+           "FusedAdam8bit() over tensors of different sizes");
+  ABORT_IF(params->type() != Type::float32 || mq->type() != Type::int8 || vq->type() != Type::uint8,
+           "FusedAdam8bit() requires float32 parameters and int8 and uint8 moments");
+  ABORT_IF(out && out->type() != grads->type(), "FusedAdam8bit() output of type {} for gradients of type {}", out->type(), grads->type());
+  if(grads->type() == Type::float32)
+    FusedAdam8bitTyped<float>(params, grads, mq, vq, scales, avg, out, args);
+  else if(grads->type() == Type::float16)
+    FusedAdam8bitTyped<float16>(params, grads, mq, vq, scales, avg, out, args);
+  else
+    ABORT("FusedAdam8bit() not implemented for gradients of type {}", grads->type());
+}
+
+// Runs the program over blocks of a row at a time, so that each instruction is one loop over contiguous slots
+void FusedElement(marian::Tensor out, const std::vector<marian::Tensor>& inputs, const FusedProgram& program) {
+  matchOrAbort<float>(out->type());
+  FusedElementArgs args(out, inputs, program);
+  const int DIMS = FusedElementArgs::DIMS;
+  const int BLOCK = 128;
+
+  int numInputs = args.numInputs;
+  int numSlots = numInputs + args.numInstructions;
+  int cols = args.dims[DIMS - 1];
+  if(cols == 0)
+    return;
+  int rows = (int)(out->shape().elements() / cols);
+
+  std::vector<float> memory((size_t)numSlots * BLOCK);
+  std::vector<const float*> slots(numSlots);
+  float* y = out->data();
+
+  for(int r = 0; r < rows; ++r) {
+    int offsets[FusedElementArgs::MAX_INPUTS] = {0};
+    for(int d = DIMS - 2, index = r; d >= 0; --d) {
+      int coord = index % args.dims[d];
+      index /= args.dims[d];
+      for(int k = 0; k < numInputs; ++k)
+        offsets[k] += coord * args.strides[k][d];
+    }
+
+    for(int j0 = 0; j0 < cols; j0 += BLOCK) {
+      int n = std::min(BLOCK, cols - j0);
+      for(int k = 0; k < numInputs; ++k) {
+        const float* x = args.inputs[k] + offsets[k];
+        if(args.strides[k][DIMS - 1] != 0) {
+          slots[k] = x + j0;
+        } else { // broadcast along the row
+          float* slot = memory.data() + (size_t)k * BLOCK;
+          std::fill(slot, slot + n, x[0]);
+          slots[k] = slot;
+        }
+      }
+
+      for(int i = 0; i < args.numInstructions; ++i) {
+        const auto& instr = args.program[i];
+        float* dst = i + 1 == args.numInstructions ? y + (size_t)r * cols + j0
+                                                   : memory.data() + (size_t)(numInputs + i) * BLOCK;
+        const float* a = slots[instr.a];
+        const float* b = slots[instr.b];
+        switch(instr.op) {
+          case FusedOpCode::Plus:       for(int j = 0; j < n; ++j) dst[j] = a[j] + b[j]; break;
+          case FusedOpCode::Minus:      for(int j = 0; j < n; ++j) dst[j] = a[j] - b[j]; break;
+          case FusedOpCode::Mult:       for(int j = 0; j < n; ++j) dst[j] = a[j] * b[j]; break;
+          case FusedOpCode::AddScalar:  for(int j = 0; j < n; ++j) dst[j] = a[j] + instr.scalar; break;
+          case FusedOpCode::MultScalar: for(int j = 0; j < n; ++j) dst[j] = instr.scalar * a[j]; break;
+          case FusedOpCode::ReLU:       for(int j = 0; j < n; ++j) dst[j] = a[j] > 0.f ? a[j] : 0.f; break;
+          default:                      for(int j = 0; j < n; ++j) dst[j] = FusedElementArgs::apply(instr, a[j], b[j]);
+        }
+        slots[numInputs + i] = dst;
+      }
+    }
+  }
+}
+
 void HighwayForward(Tensor out,
                    const Tensor in1,
                    const Tensor in2,
@@ -1767,21 +2356,70 @@ void HighwayBackward(Tensor out1,
   cpu::Element(_1 += sigmoid(_2) * (1.f - sigmoid(_2)) * (_3 - _4) * _5, outt, t, in1, in2, adj);
 }
 
-void PoolingWithMaskingForward(Tensor /*out*/,
-                               Tensor /*in*/,
-                               Tensor /*mask*/,
-                               int /*width*/,
-                               bool /*isEven*/) {
-  ABORT("Not implemented!");
+// Max pooling of the rows of in [dimBatch, numKernels, cols] over windows of width masked columns, the last window
+// may be shorter and an even padded convolution has one column too many. Like the GPU kernels, the output is
+// [windows, dimBatch * numKernels] in memory while its shape is [dimBatch, numKernels, windows].
+void PoolingWithMaskingForward(Tensor out,
+                               Tensor in,
+                               Tensor mask,
+                               int width,
+                               bool isEven) {
+  matchOrAbort<float>(out->type());
+  int inCols = in->shape()[2];
+  int outRows = out->shape()[2];
+  int outCols = out->shape()[0] * out->shape()[1];
+  int numKernels = out->shape()[1];
+  int maskCols = mask->shape()[2];
+  int lastWidth = ((inCols - isEven) % width == 0) ? width : (inCols - isEven) % width;
+
+  const float* inData = in->data();
+  const float* maskData = mask->data();
+  float* outData = out->data();
+  for(int rowId = 0; rowId < outCols; ++rowId) {
+    const float* row = inData + rowId * inCols;
+    const float* rowMask = maskData + (rowId / numKernels) * maskCols;
+    for(int colId = 0; colId < outRows; ++colId) {
+      int offset = colId * width;
+      int w = colId == outRows - 1 ? lastWidth : width;
+      float currentMax = row[offset] * rowMask[offset];
+      for(int i = 1; i < w; ++i)
+        currentMax = std::max(currentMax, row[offset + i] * rowMask[offset + i]);
+      outData[rowId + colId * outCols] = currentMax;
+    }
+  }
 }
 
-void PoolingWithMaskingBackward(Tensor /*adj*/,
-                                Tensor /*adjIn*/,
-                                Tensor /*in*/,
-                                Tensor /*mask*/,
-                                int /*width*/,
-                                bool /*isEven*/) {
-  ABORT("Not implemented!");
+void PoolingWithMaskingBackward(Tensor adj,
+                                Tensor adjIn,
+                                Tensor in,
+                                Tensor mask,
+                                int width,
+                                bool isEven) {
+  matchOrAbort<float>(adj->type());
+  int inCols = in->shape()[2];
+  int adjRows = adj->shape()[2];
+  int adjCols = adj->shape()[0] * adj->shape()[1];
+  int numKernels = adj->shape()[1];
+  int maskCols = mask->shape()[2];
+  int lastWidth = ((inCols - isEven) % width == 0) ? width : (inCols - isEven) % width;
+
+  const float* inData = in->data();
+  const float* maskData = mask->data();
+  const float* adjData = adj->data();
+  float* adjInData = adjIn->data();
+  for(int rowId = 0; rowId < adjCols; ++rowId) {
+    const float* row = inData + rowId * inCols;
+    const float* rowMask = maskData + (rowId / numKernels) * maskCols;
+    for(int colId = 0; colId < adjRows; ++colId) {
+      int offset = colId * width;
+      int w = colId == adjRows - 1 ? lastWidth : width;
+      int currentMaxIdx = offset;
+      for(int i = offset + 1; i < offset + w; ++i)
+        if(row[i] * rowMask[i] > row[currentMaxIdx] * rowMask[currentMaxIdx])
+          currentMaxIdx = i;
+      adjInData[rowId * inCols + currentMaxIdx] += adjData[rowId + colId * adjCols];
+    }
+  }
 }
 }  // namespace cpu
 }  // namespace marian
@@ -0,0 +1,138 @@
+#include "tensors/tensor_operators.h"
+#include "tensors/cpu/backend.h"
+
+#include "prod_blas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace marian {
+namespace cpu {
+
+// Tiles of queries and keys, a score tile of 64x256 floats and the accumulators stay within L2
+static const int ATTENTION_QUERY_TILE = 64;
+static const int ATTENTION_KEY_TILE = 256;
+
+// out = softmax(scale * q * k^T + bias) * v with an online softmax over tiles of keys, see TiledAttention() in
+// tensor_operators.h. For each tile of queries, the scores against one tile of keys are computed with a small
+// GEMM, exponentiated against the running maximum of each query row and multiplied into the accumulators, which
+// are rescaled whenever the running maximum grows. The full [dimQuery, dimKeys] matrix never exists.
+void TiledAttention(marian::Tensor out,
+                    const marian::Tensor q,
+                    const marian::Tensor k,
+                    const marian::Tensor v,
+                    const AttentionBias& bias,
+                    float scale) {
+#if BLAS_FOUND
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(q->type());
+  matchOrAbort<float>(k->type());
+  matchOrAbort<float>(v->type());
+
+  int dimQuery = q->shape()[-2];
+  int dimHead  = q->shape()[-1];
+  int dimKeys  = k->shape()[-2];
+  int dimValue = v->shape()[-1];
+  ABORT_IF(k->shape()[-1] != dimHead, "Keys of shape {} do not match queries of shape {}", k->shape(), q->shape());
+  ABORT_IF(v->shape()[-2] != dimKeys, "Values of shape {} do not match keys of shape {}", v->shape(), k->shape());
+
+  int qBatches = q->shape().elements() / (dimQuery * dimHead);
+  int kBatches = k->shape().elements() / (dimKeys * dimHead);
+  ABORT_IF(v->shape().elements() / (dimKeys * dimValue) != kBatches, "Values of shape {} do not match keys of shape {}",
+           v->shape(), k->shape());
+  ABORT_IF(qBatches % kBatches != 0, "Keys of shape {} do not broadcast to queries of shape {}", k->shape(), q->shape());
+
+  // batches of queries are [dimBeam, dimBatch * numHeads], keys and values broadcast along leading batches as in
+  // bdot_legacy(), e.g. if they are shared across the beam
+  int dimBatchHeads = q->shape().size() >= 3 ? q->shape()[-3] : 1;
+  marian::Shape scores = {qBatches / dimBatchHeads, dimBatchHeads, dimQuery, dimKeys};
+  AttentionBiasArgs biasArgs(bias, scores);
+
+  const float* pq = q->data();
+  const float* pk = k->data();
+  const float* pv = v->data();
+  float* po = out->data();
+
+  int queryTiles = (dimQuery + ATTENTION_QUERY_TILE - 1) / ATTENTION_QUERY_TILE;
+  size_t tiles = (size_t)qBatches * queryTiles;
+  parallelFor(out->getBackend(), tiles, 1, [&](size_t begin, size_t end) {
+    std::vector<float> s(ATTENTION_QUERY_TILE * ATTENTION_KEY_TILE); // scores and probabilities of one tile
+    std::vector<float> acc(ATTENTION_QUERY_TILE * dimValue);
+    std::vector<float> rowMax(ATTENTION_QUERY_TILE), rowSum(ATTENTION_QUERY_TILE);
+
+    for(size_t tile = begin; tile < end; ++tile) {
+      int b = (int)(tile / queryTiles);
+      int q0 = (int)(tile % queryTiles) * ATTENTION_QUERY_TILE;
+      int tq = std::min(ATTENTION_QUERY_TILE, dimQuery - q0);
+      int beam = b / dimBatchHeads, batchHead = b % dimBatchHeads;
+
+      const float* qt = pq + ((size_t)b * dimQuery + q0) * dimHead;
+      const float* kb = pk + (size_t)(b % kBatches) * dimKeys * dimHead;
+      const float* vb = pv + (size_t)(b % kBatches) * dimKeys * dimValue;
+
+      std::fill(acc.begin(), acc.begin() + tq * dimValue, 0.f);
+      std::fill(rowMax.begin(), rowMax.end(), -INFINITY);
+      std::fill(rowSum.begin(), rowSum.end(), 0.f);
+
+      for(int k0 = 0; k0 < dimKeys; k0 += ATTENTION_KEY_TILE) {
+        int tk = std::min(ATTENTION_KEY_TILE, dimKeys - k0);
+        sgemm(false, true, tq, tk, dimHead, scale,
+              const_cast<float*>(qt), dimHead,
+              const_cast<float*>(kb + (size_t)k0 * dimHead), dimHead,
+              0.f, s.data(), tk);
+
+        for(int i = 0; i < tq; ++i) {
+          float* si = s.data() + i * tk;
+          float tileMax = -INFINITY;
+          for(int j = 0; j < tk; ++j) {
+            si[j] += biasArgs(beam, batchHead, q0 + i, k0 + j);
+            tileMax = std::max(tileMax, si[j]);
+          }
+
+          float newMax = std::max(rowMax[i], tileMax);
+          if(newMax == -INFINITY) { // all keys so far are masked, nothing to accumulate
+            std::fill(si, si + tk, 0.f);
+            continue;
+          }
+
+          float sum = 0.f;
+          for(int j = 0; j < tk; ++j) {
+            si[j] = std::exp(si[j] - newMax);
+            sum += si[j];
+          }
+
+          // rescale what was accumulated against the previous maximum
+          float correction = std::exp(rowMax[i] - newMax);
+          if(correction != 1.f) {
+            float* ai = acc.data() + i * dimValue;
+            for(int d = 0; d < dimValue; ++d)
+              ai[d] *= correction;
+          }
+          rowSum[i] = rowSum[i] * correction + sum;
+          rowMax[i] = newMax;
+        }
+
+        sgemm(false, false, tq, dimValue, tk, 1.f,
+              s.data(), tk,
+              const_cast<float*>(vb + (size_t)k0 * dimValue), dimValue,
+              1.f, acc.data(), dimValue);
+      }
+
+      float* ot = po + ((size_t)b * dimQuery + q0) * dimValue;
+      for(int i = 0; i < tq; ++i) {
+        // rows without any unmasked key get zeros, where the composed softmax would produce NaNs
+        float norm = rowSum[i] > 0.f ? 1.f / rowSum[i] : 0.f;
+        for(int d = 0; d < dimValue; ++d)
+          ot[i * dimValue + d] = acc[i * dimValue + d] * norm;
+      }
+    }
+  });
+#else
+  out; q; k; v; bias; scale;
+  ABORT("You need to compile with MKL in order to use the CPU version");
+#endif
+}
+
+}  // namespace cpu
+}  // namespace marian
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+namespace marian {
+
+// Longest amax history of the FP8 scalings of --fp8
+static const int FP8_MAX_AMAX_HISTORY = 1024;
+
+// Delayed per-tensor scaling of one operand of the FP8 GEMMs of an affine layer, kept in device memory by the GPU
+// backend and updated by kernels, so that no step waits for the host. Values are multiplied by scale before their
+// conversion to FP8 and the GEMM output by scaleInv. scale maps the maximum absolute value (amax) that the operand had
+// over the last `length` steps to the largest FP8 value, the amax of the current step only goes into the next scale.
+struct Fp8ScalingState {
+  float amax{0.f}; // of the current step, accumulated by every quantization of the operand
+  float scale{1.f};
+  float scaleInv{1.f};
+  int pos{0};      // slot of the history that receives the amax of the current step
+  int length{1};
+  float history[FP8_MAX_AMAX_HISTORY] = {};
+};
+
+// Operand of an FP8 GEMM, see gpu::ProdFp8(): the name of its scaling in the backend and whether it is a gradient.
+// Gradients are converted to E5M2 for range, everything else to E4M3 for precision.
+struct Fp8Operand {
+  std::string scaling;
+  bool gradient{false};
+};
+
+}  // namespace marian
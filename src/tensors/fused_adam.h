@@ -0,0 +1,64 @@
+#pragma once
+
+#include "functional/defs.h"
+#include "functional/operators.h"
+
+#include <cmath>
+#include <cstdint>
+
+namespace marian {
+
+// The hyper-parameters of one Adam update of a shard by FusedAdam(), passed by value into the CPU and GPU kernels.
+// The arithmetic is the one of Adam::updateImpl() and ExponentialSmoothing::updateAvgParams().
+struct FusedAdamArgs {
+  float gradScale{1.f};  // multiplies the gradients, e.g. 1 / cost scaling factor
+  float beta1, beta1c;   // momentum smoothing and 1 - beta1
+  float beta2, beta2c;   // RMS normalization and 1 - beta2
+  float eta;             // learning rate
+  float denom1, denom2;  // bias corrections of the moments
+  float eps;
+  float decay{0.f};      // weight decay
+  float avgDecay{0.f};   // exponential smoothing of the parameters, if an average is updated
+
+  // updates the moments m and v with the gradient g and returns the updated parameter p
+  HOST_DEVICE_INLINE float apply(float p, float g, float& m, float& v) const {
+    typedef functional::Ops<float> Ops;
+    g *= gradScale;
+    m = beta1 * m + beta1c * g;
+    v = beta2 * v + beta2c * (g * g);
+    return p - eta * ((m / denom1) / (Ops::sqrt(v / denom2) + eps) + decay * p);
+  }
+
+  HOST_DEVICE_INLINE float smooth(float avg, float p) const { return (1.f - avgDecay) * avg + avgDecay * p; }
+};
+
+// The 8-bit storage of the Adam moments of Adam8bit, see FusedAdam8bit(). Each block of BLOCK consecutive values is
+// stored relative to its absolute maximum, with a companding that keeps more precision for small values:
+// m = max * sign(q) * (q / 127)^2 in int8 and v = max * (q / 255)^4 in uint8.
+struct Adam8bitCodec {
+  static const int BLOCK = 256;
+
+  HOST_DEVICE_INLINE static float decodeM(int8_t q, float max) {
+    float r = q / 127.f;
+    return max * r * fabsf(r);
+  }
+  HOST_DEVICE_INLINE static int8_t encodeM(float m, float max) {
+    if(max <= 0.f)
+      return 0;
+    int q = (int)(127.f * sqrtf(fminf(fabsf(m) / max, 1.f)) + 0.5f);
+    return (int8_t)(m < 0.f ? -q : q);
+  }
+
+  HOST_DEVICE_INLINE static float decodeV(uint8_t q, float max) {
+    float r = q / 255.f;
+    r *= r;
+    return max * r * r;
+  }
+  HOST_DEVICE_INLINE static uint8_t encodeV(float v, float max) {
+    if(max <= 0.f)
+      return 0;
+    return (uint8_t)(int)(255.f * sqrtf(sqrtf(fminf(v / max, 1.f))) + 0.5f);
+  }
+};
+
+}  // namespace marian
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "functional/defs.h"
+#include "functional/operators.h"
+#include "tensors/tensor.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace marian {
+
+// Elementwise operations that FusedElement() evaluates, each with the same result as the node it replaces
+enum class FusedOpCode : uint8_t {
+  Plus, Minus, Mult, Div, Maximum, Minimum,      // binary
+  AddScalar, MultScalar,                         // a + scalar, scalar * a
+  Neg, Abs, Exp, Log, Sqrt, Square,              // sqrt(a + scalar)
+  Sigmoid, Tanh, ReLU, Swish                     // a * sigmoid(scalar * a)
+};
+
+// One instruction of a fused program. Slots [0, number of inputs) hold the input values, instruction i writes slot
+// number of inputs + i from the slots a and b, which it only reads if it is binary. The last slot is the result.
+struct FusedInstruction {
+  FusedOpCode op;
+  uint8_t a{0};
+  uint8_t b{0};
+  float scalar{0.f};
+
+  static bool isBinary(FusedOpCode op) { return op <= FusedOpCode::Minimum; }
+};
+
+typedef std::vector<FusedInstruction> FusedProgram;
+
+// the program as an expression of the inputs x0, x1, ..., e.g. "relu(((x0 * x1) + x2))", for graphviz()
+static inline std::string fusedProgramToString(const FusedProgram& program, size_t numInputs) {
+  static const char* names[] = {"+", "-", "*", "/", "max", "min", "+", "*",
+                                "-", "abs", "exp", "log", "sqrt", "sqr", "sigmoid", "tanh", "relu", "swish"};
+  std::vector<std::string> slots;
+  for(size_t i = 0; i < numInputs; ++i)
+    slots.push_back("x" + std::to_string(i));
+  for(const auto& instr : program) {
+    std::stringstream ss;
+    const char* name = names[(size_t)instr.op];
+    switch(instr.op) {
+      case FusedOpCode::Plus: case FusedOpCode::Minus: case FusedOpCode::Mult: case FusedOpCode::Div:
+        ss << "(" << slots[instr.a] << " " << name << " " << slots[instr.b] << ")"; break;
+      case FusedOpCode::Maximum: case FusedOpCode::Minimum:
+        ss << name << "(" << slots[instr.a] << ", " << slots[instr.b] << ")"; break;
+      case FusedOpCode::AddScalar: ss << "(" << slots[instr.a] << " + " << instr.scalar << ")"; break;
+      case FusedOpCode::MultScalar: ss << "(" << instr.scalar << " * " << slots[instr.a] << ")"; break;
+      case FusedOpCode::Neg: ss << "-" << slots[instr.a]; break;
+      default: ss << name << "(" << slots[instr.a] << ")";
+    }
+    slots.push_back(ss.str());
+  }
+  return slots.back();
+}
+
+// Plain pointers, strides and the program of a fused elementwise operation over float32 tensors of up to four
+// dimensions, passed by value into the CPU and GPU kernels. Input strides are 0 along broadcast dimensions.
+struct FusedElementArgs {
+  static const int MAX_INPUTS       = 8;
+  static const int MAX_INSTRUCTIONS = 16;
+  static const int DIMS             = 4;
+
+  const float* inputs[MAX_INPUTS];
+  int strides[MAX_INPUTS][DIMS];
+  int dims[DIMS];
+  FusedInstruction program[MAX_INSTRUCTIONS];
+  int numInputs{0};
+  int numInstructions{0};
+
+  FusedElementArgs(const marian::Tensor& out, const std::vector<marian::Tensor>& ins, const FusedProgram& prog) {
+    ABORT_IF(ins.size() > MAX_INPUTS || prog.size() > MAX_INSTRUCTIONS || prog.empty(),
+             "Fused program with {} inputs and {} instructions is not supported", ins.size(), prog.size());
+    ABORT_IF(out->shape().size() > DIMS, "Fused elementwise output of shape {} has more than {} dimensions",
+             out->shape(), DIMS);
+    auto dim = [](const marian::Shape& shape, int d) { return -d <= (int)shape.size() ? shape[d] : 1; };
+    for(int d = 0; d < DIMS; ++d)
+      dims[d] = dim(out->shape(), d - DIMS);
+
+    numInputs = (int)ins.size();
+    for(int k = 0; k < numInputs; ++k) {
+      const auto& shape = ins[k]->shape();
+      ABORT_IF(ins[k]->type() != Type::float32, "Fused elementwise input {} has type {}", k, ins[k]->type());
+      int stride = 1;
+      for(int d = DIMS - 1; d >= 0; --d) {
+        int n = dim(shape, d - DIMS);
+        ABORT_IF(n != 1 && n != dims[d], "Fused elementwise input of shape {} does not broadcast to {}",
+                 shape, out->shape());
+        strides[k][d] = n == 1 ? 0 : stride;
+        stride *= n;
+      }
+      inputs[k] = ins[k]->data();
+    }
+
+    numInstructions = (int)prog.size();
+    for(int i = 0; i < numInstructions; ++i)
+      program[i] = prog[i];
+  }
+
+  static HOST_DEVICE_INLINE float apply(const FusedInstruction& instr, float a, float b) {
+    typedef functional::Ops<float> Ops;
+    switch(instr.op) {
+      case FusedOpCode::Plus:       return a + b;
+      case FusedOpCode::Minus:      return a - b;
+      case FusedOpCode::Mult:       return a * b;
+      case FusedOpCode::Div:        return a / b;
+      case FusedOpCode::Maximum:    return Ops::max(a, b);
+      case FusedOpCode::Minimum:    return Ops::min(a, b);
+      case FusedOpCode::AddScalar:  return a + instr.scalar;
+      case FusedOpCode::MultScalar: return instr.scalar * a;
+      case FusedOpCode::Neg:        return -a;
+      case FusedOpCode::Abs:        return Ops::abs(a);
+      case FusedOpCode::Exp:        return Ops::exp(a);
+      case FusedOpCode::Log:        return Ops::log(a);
+      case FusedOpCode::Sqrt:       return Ops::sqrt(a + instr.scalar);
+      case FusedOpCode::Square:     return a * a;
+      case FusedOpCode::Sigmoid:    return Ops::sigmoid(a);
+      case FusedOpCode::Tanh:       return Ops::tanh(a);
+      case FusedOpCode::ReLU:       return Ops::relu(a);
+      case FusedOpCode::Swish:      return a * Ops::sigmoid(instr.scalar * a);
+    }
+    return 0.f;
+  }
+
+  // the result at the position index of the output
+  HOST_DEVICE_INLINE float operator()(int index) const {
+    float slots[MAX_INPUTS + MAX_INSTRUCTIONS];
+    int coords[DIMS];
+    for(int d = DIMS - 1; d >= 0; --d) {
+      coords[d] = index % dims[d];
+      index /= dims[d];
+    }
+    for(int k = 0; k < numInputs; ++k) {
+      int offset = 0;
+      for(int d = 0; d < DIMS; ++d)
+        offset += coords[d] * strides[k][d];
+      slots[k] = inputs[k][offset];
+    }
+    for(int i = 0; i < numInstructions; ++i) {
+      const auto& instr = program[i];
+      slots[numInputs + i] = apply(instr, slots[instr.a], slots[instr.b]);
+    }
+    return slots[numInputs + numInstructions - 1];
+  }
+};
+
+}  // namespace marian
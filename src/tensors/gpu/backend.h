@@ -1,7 +1,9 @@
 #pragma once
 
 #include "common/config.h"
+#include "tensors/allocator.h"
 #include "tensors/backend.h"  // note: this is one folder up
+#include "tensors/fp8.h"
 #include "tensors/gpu/cuda_helpers.h"
 #include "tensors/gpu/cusparse_include.h"
 #include "common/logging.h"
@@ -10,6 +12,14 @@
 #include <cuda.h>
 #include <curand.h>
 
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
 
 namespace marian {
 namespace gpu {
@@ -35,6 +45,11 @@ public:
 
   ~Backend() {
     setDevice();
+    clearCudaGraphs();
+    freeStaging();
+    freeOffloads();
+    for(auto& scaling : fp8Scalings_)
+      CUDA_CHECK(cudaFree(scaling.second));
     if(cusparseHandle_) {
       cusparseDestroy(cusparseHandle_);
       cusparseHandle_ = 0;
@@ -47,12 +62,22 @@ public:
 
   void setDevice() override { CUDA_CHECK(cudaSetDevice((int)deviceId_.no)); }
 
-  void synchronize() override { CUDA_CHECK(cudaStreamSynchronize(0)); }
+  // Waits for all work on the device, as the communicators call this for the graphs of other threads, see
+  // getCudaStream(). Only training synchronizes explicitly, and there each device has a single graph.
+  void synchronize() override { CUDA_CHECK(cudaDeviceSynchronize()); }
+
+  // The stream of the graph of this backend. Every graph runs on its own thread and all of its work goes to the
+  // per-thread default stream of that thread: the kernels (--default-stream per-thread), the runtime calls of
+  // C++ files (CUDA_API_PER_THREAD_DEFAULT_STREAM) and the cuBLAS and cuSPARSE handles. So graphs on the same
+  // device, e.g. the decoders of --in-flight-batches, do not wait for each other on the legacy default stream,
+  // and the uploads of one overlap with the kernels of another.
+  cudaStream_t getCudaStream() const { return cudaStreamPerThread; }
 
   cublasHandle_t getCublasHandle() {
     if(!cublasHandle_) { // lazy initialization here to avoid memory usage when unused
       setDevice();
-      cublasCreate(&cublasHandle_);
+      CUBLAS_CHECK(cublasCreate(&cublasHandle_));
+      CUBLAS_CHECK(cublasSetStream(cublasHandle_, getCudaStream()));
     }
     return cublasHandle_;
   }
@@ -60,7 +85,8 @@ public:
   cusparseHandle_t getCusparseHandle() {
     if(!cusparseHandle_) { // lazy initialization here to avoid memory usage when unused
       setDevice();
-      cusparseCreate(&cusparseHandle_);
+      CUSPARSE_CHECK(cusparseCreate(&cusparseHandle_));
+      CUSPARSE_CHECK(cusparseSetStream(cusparseHandle_, getCudaStream()));
     }
     return cusparseHandle_;
   }
@@ -95,6 +121,247 @@ public:
     return 0.f;
   }
 
+  // for CPU, sets the sparsity pattern of the weight matrices for the sparse kernel.
+  // for GPU, there's no sparse kernel. so, it does nothing.
+  void setSparseGemm(const std::string& pattern) override {
+    LOG_ONCE(info, "setSparseGemm() not supported for GPU_{}", pattern);
+  }
+  SparsityPattern getSparseGemm() override { return SparsityPattern(); }
+
+  // for CPU, keeps the decisions of the GEMM tuner.
+  // for GPU, there's no GEMM tuner. so, it does nothing.
+  void setAutoTunerCache(Ptr<AutoTunerCache> /*cache*/) override {
+    LOG_ONCE(info, "setAutoTunerCache() not supported for GPU");
+  }
+
+  // for CPU, sets the number of threads that share the work of large kernels of one graph.
+  // for GPU, kernels are parallel anyway. so, it does nothing.
+  void setIntraOpThreads(size_t threads) override {
+    LOG_ONCE(info, "setIntraOpThreads() not supported for GPU_{}", threads);
+  }
+
+  // for GPU, keeps up to maxGraphs CUDA graphs of forward passes for replay, see runForward(). 0 disables them.
+  void setCudaGraphs(size_t maxGraphs) override {
+#if CUDA_VERSION < 11040
+    ABORT_IF(maxGraphs > 0, "CUDA graphs require CUDA 11.4 or newer");
+#endif
+    setDevice();
+    clearCudaGraphs();
+    maxCudaGraphs_ = maxGraphs;
+  }
+  size_t getCudaGraphs() override { return maxCudaGraphs_; }
+
+  // The first call with a key runs forward() as usual. The second one captures the kernels that forward() enqueues
+  // into a CUDA graph instead and all later ones only launch that graph, which saves the launch overhead of the many
+  // small kernels of a decoder step. Beyond getCudaGraphs() graphs, the least recently used one is dropped. Keys whose
+  // capture fails, because the workspace would have to grow, run forward() as usual from then on.
+  void runForward(size_t key, const std::function<void(bool)>& forward) override {
+    if(maxCudaGraphs_ == 0) {
+      forward(/*capturing=*/false);
+      return;
+    }
+#if CUDA_VERSION >= 11040
+    setDevice();
+    auto it = cudaGraphs_.find(key);
+    if(it != cudaGraphs_.end()) {
+      cudaGraphsLru_.splice(cudaGraphsLru_.begin(), cudaGraphsLru_, it->second.position);
+      CUDA_CHECK(cudaGraphLaunch(it->second.exec, getCudaStream()));
+      return;
+    }
+
+    if(failedKeys_.count(key) > 0 || seenKeys_.count(key) == 0) { // not capturable or seen for the first time
+      if(failedKeys_.count(key) == 0)
+        rememberKey(seenKeys_, key);
+      forward(/*capturing=*/false);
+      return;
+    }
+    seenKeys_.erase(key);
+
+    cudaGraph_t graph = nullptr;
+    CUDA_CHECK(cudaStreamBeginCapture(getCudaStream(), cudaStreamCaptureModeRelaxed));
+    bool captured = true;
+    try {
+      forward(/*capturing=*/true);
+    } catch(const AllocationException&) {
+      captured = false;
+    }
+    captured = cudaStreamEndCapture(getCudaStream(), &graph) == cudaSuccess && captured;
+
+    cudaGraphExec_t exec = nullptr;
+    if(captured)
+      CUDA_CHECK(cudaGraphInstantiateWithFlags(&exec, graph, 0));
+    if(graph)
+      CUDA_CHECK(cudaGraphDestroy(graph));
+    if(!captured) {
+      cudaGetLastError(); // resets the error of an invalidated capture
+      LOG_ONCE(info, "[gpu] A forward pass could not be captured into a CUDA graph, e.g. because --workspace is too small");
+      rememberKey(failedKeys_, key);
+      forward(/*capturing=*/false);
+      return;
+    }
+
+    if(cudaGraphs_.size() == maxCudaGraphs_) {
+      auto last = cudaGraphs_.find(cudaGraphsLru_.back());
+      CUDA_CHECK(cudaGraphExecDestroy(last->second.exec));
+      cudaGraphs_.erase(last);
+      cudaGraphsLru_.pop_back();
+    }
+    cudaGraphsLru_.push_front(key);
+    cudaGraphs_[key] = {exec, cudaGraphsLru_.begin()};
+    CUDA_CHECK(cudaGraphLaunch(exec, getCudaStream()));
+#else
+    key;
+    forward(/*capturing=*/false);
+#endif
+  }
+
+  // for GPU, runs the GEMMs of affine layers in FP8 on devices that have FP8 tensor cores, see gpu::ProdFp8().
+  // Elsewhere, they stay in the precision of the graph.
+  void setFp8(size_t amaxHistory) override {
+    ABORT_IF(amaxHistory > FP8_MAX_AMAX_HISTORY, "FP8 amax history of {} steps is longer than the maximum of {}",
+             amaxHistory, FP8_MAX_AMAX_HISTORY);
+#if CUDA_VERSION >= 11080
+    if(amaxHistory > 0 && compute_.major * 10 + compute_.minor < 89) {
+      LOG(warn, "[gpu] FP8 GEMMs require compute capability 8.9 or higher, device {} has {}.{}, not using FP8",
+          deviceId_.no, compute_.major, compute_.minor);
+      amaxHistory = 0;
+    }
+#else
+    if(amaxHistory > 0) {
+      LOG(warn, "[gpu] FP8 GEMMs require CUDA 11.8 or newer, not using FP8");
+      amaxHistory = 0;
+    }
+#endif
+    fp8AmaxHistory_ = amaxHistory;
+  }
+  size_t getFp8() override { return fp8AmaxHistory_; }
+
+  void setPinnedUploads(size_t bytes) override {
+    setDevice();
+    freeStaging();
+    stagingBytes_ = bytes;
+  }
+  size_t getPinnedUploads() override { return stagingBytes_; }
+
+  // Copies bytes of host memory src to the device memory dest. Graph inputs, see isInputUploads(), are copied into
+  // the current page-locked staging buffer and uploaded by cudaMemcpyAsync() on getCudaStream(), so the host does
+  // not wait for the kernels that are already enqueued, e.g. those of the previous batch, and src may be freed right
+  // away. The copy still runs after these kernels, as the memory of the allocator that dest comes from may be in
+  // use by them until then. Once the current buffer is full the other one takes over, after the copies out of it
+  // are done, which they usually are long before. Copies larger than a buffer are split into buffer-sized pieces,
+  // so that copying a piece into one buffer overlaps with uploading the previous piece from the other.
+  void upload(void* dest, const void* src, size_t bytes) override {
+    setDevice();
+    if(!isInputUploads() || stagingBytes_ == 0) {
+      CUDA_CHECK(cudaMemcpy(dest, src, bytes, cudaMemcpyHostToDevice));
+      return;
+    }
+    while(bytes > stagingBytes_) {
+      upload(dest, src, stagingBytes_);
+      dest = (char*)dest + stagingBytes_;
+      src = (const char*)src + stagingBytes_;
+      bytes -= stagingBytes_;
+    }
+
+    auto* buffer = &staging_[currentStaging_];
+    if(buffer->used + bytes > stagingBytes_) {
+      currentStaging_ = 1 - currentStaging_;
+      buffer = &staging_[currentStaging_];
+      if(buffer->data)
+        CUDA_CHECK(cudaEventSynchronize(buffer->copied));
+      buffer->used = 0;
+    }
+    if(!buffer->data) {
+      CUDA_CHECK(cudaMallocHost(&buffer->data, stagingBytes_));
+      CUDA_CHECK(cudaEventCreateWithFlags(&buffer->copied, cudaEventDisableTiming));
+    }
+
+    char* staged = buffer->data + buffer->used;
+    std::memcpy(staged, src, bytes);
+    CUDA_CHECK(cudaMemcpyAsync(dest, staged, bytes, cudaMemcpyHostToDevice, getCudaStream()));
+    CUDA_CHECK(cudaEventRecord(buffer->copied, getCudaStream()));
+    buffer->used += (bytes + 255) / 256 * 256; // keep the staged copies aligned
+  }
+
+  // Copies bytes of device memory src into page-locked host memory on the copy stream, after the kernels enqueued
+  // on getCudaStream() so far. The host buffers are kept for later offloads once their copies were restored.
+  size_t offload(const void* src, size_t bytes) override {
+    setDevice();
+    if(!copyStream_) {
+      CUDA_CHECK(cudaStreamCreateWithFlags(&copyStream_, cudaStreamNonBlocking));
+      CUDA_CHECK(cudaEventCreateWithFlags(&restored_, cudaEventDisableTiming));
+    }
+    reclaimHostBuffers();
+
+    HostCopy copy;
+    auto buffer = hostBuffers_.lower_bound(bytes);
+    if(buffer != hostBuffers_.end() && buffer->first <= 2 * bytes) {
+      copy.capacity = buffer->first;
+      copy.data = buffer->second;
+      hostBuffers_.erase(buffer);
+    } else {
+      copy.capacity = bytes;
+      CUDA_CHECK(cudaMallocHost(&copy.data, bytes));
+    }
+    copy.bytes = bytes;
+    CUDA_CHECK(cudaEventCreateWithFlags(&copy.copied, cudaEventDisableTiming));
+
+    waitForCompute();
+    CUDA_CHECK(cudaMemcpyAsync(copy.data, src, bytes, cudaMemcpyDeviceToHost, copyStream_));
+    CUDA_CHECK(cudaEventRecord(copy.copied, copyStream_));
+    offloads_[++lastOffload_] = copy;
+    return lastOffload_;
+  }
+
+  bool isOffloaded(size_t handle) override {
+    auto it = offloads_.find(handle);
+    ABORT_IF(it == offloads_.end(), "Unknown offloaded copy {}", handle);
+    auto status = cudaEventQuery(it->second.copied);
+    if(status == cudaErrorNotReady)
+      return false;
+    CUDA_CHECK(status);
+    return true;
+  }
+
+  // Copies an offloaded copy back into dest on the copy stream, after the kernels enqueued on getCudaStream() so
+  // far, which may still use the memory dest was allocated from.
+  void restore(size_t handle, void* dest) override {
+    setDevice();
+    auto it = offloads_.find(handle);
+    ABORT_IF(it == offloads_.end(), "Unknown offloaded copy {}", handle);
+    auto copy = it->second;
+    offloads_.erase(it);
+    if(dest) {
+      waitForCompute();
+      CUDA_CHECK(cudaMemcpyAsync(dest, copy.data, copy.bytes, cudaMemcpyHostToDevice, copyStream_));
+      CUDA_CHECK(cudaEventRecord(restored_, copyStream_));
+    }
+    CUDA_CHECK(cudaEventRecord(copy.copied, copyStream_)); // the buffer is free once this completes
+    releasing_.push_back(copy);
+  }
+
+  void waitRestores() override {
+    if(copyStream_)
+      CUDA_CHECK(cudaStreamWaitEvent(getCudaStream(), restored_, 0));
+  }
+
+  // The scaling of the FP8 operand with the given name in device memory, created with an empty history on first use.
+  // Scalings live as long as the backend, i.e. across all batches of a graph.
+  Fp8ScalingState* getFp8Scaling(const std::string& name) {
+    auto it = fp8Scalings_.find(name);
+    if(it != fp8Scalings_.end())
+      return it->second;
+
+    Fp8ScalingState initial;
+    initial.length = (int)std::max<size_t>(fp8AmaxHistory_, 1);
+    Fp8ScalingState* scaling = nullptr;
+    setDevice();
+    CUDA_CHECK(cudaMalloc(&scaling, sizeof(Fp8ScalingState)));
+    CUDA_CHECK(cudaMemcpy(scaling, &initial, sizeof(Fp8ScalingState), cudaMemcpyHostToDevice));
+    fp8Scalings_[name] = scaling;
+    return scaling;
+  }
+
   CudaCompute getCudaComputeCapability() { return compute_; }
 
   size_t getGlobalMemorySize() override {
@@ -104,6 +371,109 @@ public:
   }
 
 private:
+#if CUDA_VERSION >= 11040
+  struct CudaGraph {
+    cudaGraphExec_t exec;
+    std::list<size_t>::iterator position; // in cudaGraphsLru_
+  };
+
+  // keys seen once are captured the next time, keys that failed to capture never again. Both sets are reset
+  // once they hold many more keys than graphs, so they do not grow without bounds.
+  void rememberKey(std::unordered_set<size_t>& keys, size_t key) {
+    if(keys.size() >= 16 * maxCudaGraphs_)
+      keys.clear();
+    keys.insert(key);
+  }
+#endif
+
+  void freeStaging() {
+    for(auto& buffer : staging_) {
+      if(buffer.data) {
+        CUDA_CHECK(cudaEventSynchronize(buffer.copied));
+        CUDA_CHECK(cudaEventDestroy(buffer.copied));
+        CUDA_CHECK(cudaFreeHost(buffer.data));
+      }
+      buffer = StagingBuffer();
+    }
+    currentStaging_ = 0;
+  }
+
+  // the copy stream waits for the kernels enqueued on getCudaStream() so far
+  void waitForCompute() {
+    cudaEvent_t enqueued;
+    CUDA_CHECK(cudaEventCreateWithFlags(&enqueued, cudaEventDisableTiming));
+    CUDA_CHECK(cudaEventRecord(enqueued, getCudaStream()));
+    CUDA_CHECK(cudaStreamWaitEvent(copyStream_, enqueued, 0));
+    CUDA_CHECK(cudaEventDestroy(enqueued)); // released once the wait is done
+  }
+
+  void reclaimHostBuffers() {
+    auto done = std::partition(releasing_.begin(), releasing_.end(),
+                               [](const HostCopy& copy) { return cudaEventQuery(copy.copied) == cudaErrorNotReady; });
+    for(auto it = done; it != releasing_.end(); ++it) {
+      CUDA_CHECK(cudaEventDestroy(it->copied));
+      hostBuffers_.emplace(it->capacity, it->data);
+    }
+    releasing_.erase(done, releasing_.end());
+  }
+
+  void freeOffloads() {
+    if(!copyStream_)
+      return;
+    CUDA_CHECK(cudaStreamSynchronize(copyStream_));
+    for(auto& it : offloads_)
+      releasing_.push_back(it.second);
+    offloads_.clear();
+    reclaimHostBuffers();
+    for(auto& buffer : hostBuffers_)
+      CUDA_CHECK(cudaFreeHost(buffer.second));
+    hostBuffers_.clear();
+    CUDA_CHECK(cudaEventDestroy(restored_));
+    CUDA_CHECK(cudaStreamDestroy(copyStream_));
+    copyStream_ = 0;
+  }
+
+  void clearCudaGraphs() {
+#if CUDA_VERSION >= 11040
+    for(auto& graph : cudaGraphs_)
+      CUDA_CHECK(cudaGraphExecDestroy(graph.second.exec));
+    cudaGraphs_.clear();
+    cudaGraphsLru_.clear();
+    seenKeys_.clear();
+    failedKeys_.clear();
+#endif
+  }
+
+  size_t maxCudaGraphs_{0};
+#if CUDA_VERSION >= 11040
+  std::unordered_map<size_t, CudaGraph> cudaGraphs_;
+  std::list<size_t> cudaGraphsLru_;                // most recently launched first
+  std::unordered_set<size_t> seenKeys_, failedKeys_;
+#endif
+  struct StagingBuffer {
+    char* data{nullptr};    // page-locked, allocated on first use
+    size_t used{0};
+    cudaEvent_t copied{0};  // recorded after the last upload out of this buffer
+  };
+  size_t stagingBytes_{0};
+  StagingBuffer staging_[2];
+  int currentStaging_{0};
+
+  struct HostCopy {
+    char* data{nullptr};    // page-locked
+    size_t capacity{0};
+    size_t bytes{0};
+    cudaEvent_t copied{0};  // recorded after the last copy from or to data
+  };
+  cudaStream_t copyStream_{0};            // of offload() and restore(), created on first use
+  cudaEvent_t restored_{0};               // recorded after the last restore()
+  std::unordered_map<size_t, HostCopy> offloads_;
+  std::vector<HostCopy> releasing_;      // restored copies, whose buffers are reused after their last copy
+  std::multimap<size_t, char*> hostBuffers_; // by capacity
+  size_t lastOffload_{0};
+
+  size_t fp8AmaxHistory_{0};
+  std::unordered_map<std::string, Fp8ScalingState*> fp8Scalings_;
   cublasHandle_t cublasHandle_{0};     // make sure it's 0, so it can be initalized lazily
   cusparseHandle_t cusparseHandle_{0}; // as above
   CudaCompute compute_;
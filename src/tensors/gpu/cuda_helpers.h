@@ -50,6 +50,15 @@ inline void gpuAssert(cudaError_t code, const char* exprString,
            "CUDA Error {}: {} - {}:{}: {}", code, cudaGetErrorString(code), file, line, exprString);
 }
 
+// Waits for the kernels on the per-thread default stream, unless they are being captured into a CUDA graph, see
+// gpu::Backend::runForward(). Capturing does not run them, and the graph keeps their order anyway.
+inline void synchronizeUnlessCapturing() {
+  cudaStreamCaptureStatus status = cudaStreamCaptureStatusNone;
+  CUDA_CHECK(cudaStreamIsCapturing(cudaStreamPerThread, &status));
+  if(status == cudaStreamCaptureStatusNone)
+    CUDA_CHECK(cudaStreamSynchronize(cudaStreamPerThread));
+}
+
 // @TODO: is this used anywhere?
 template <typename T>
 void CudaCopy(const T* start, const T* end, T* dest) {
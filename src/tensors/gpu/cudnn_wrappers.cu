@@ -1,4 +1,5 @@
 #include "tensors/gpu/cudnn_wrappers.h"
+#include "tensors/gpu/cuda_helpers.h"
 
 namespace marian {
 
@@ -319,6 +320,153 @@ PoolingWrapper::~PoolingWrapper() {
   CUDNN_CALL(cudnnDestroyPoolingDescriptor(poolingDesc_));
 }
 
+/******************************************************************************
+ * BidirectionalGRUWrapper
+ *****************************************************************************/
+
+#if CUDNN_MAJOR >= 8
+
+BidirectionalGRUWrapper::BidirectionalGRUWrapper(int dimInput, int dimState)
+    : dimInput_(dimInput), dimState_(dimState) {
+  // dropout is not applied, but the descriptor needs its states
+  CUDNN_CALL(cudnnCreateDropoutDescriptor(&dropoutDesc_));
+  CUDNN_CALL(cudnnDropoutGetStatesSize(cudnnHandle_, &dropoutStateSize_));
+  CUDA_CHECK(cudaMalloc(&dropoutStates_, dropoutStateSize_));
+  CUDNN_CALL(cudnnSetDropoutDescriptor(dropoutDesc_, cudnnHandle_, 0.f, dropoutStates_, dropoutStateSize_, 0));
+
+  // marian's GRU adds the bias to xW only, the recurrent bias stays zero
+  CUDNN_CALL(cudnnCreateRNNDescriptor(&rnnDesc_));
+  CUDNN_CALL(cudnnSetRNNDescriptor_v8(rnnDesc_,
+                                      CUDNN_RNN_ALGO_STANDARD,
+                                      CUDNN_GRU,
+                                      CUDNN_RNN_DOUBLE_BIAS,
+                                      CUDNN_BIDIRECTIONAL,
+                                      CUDNN_LINEAR_INPUT,
+                                      CUDNN_DATA_FLOAT,
+                                      CUDNN_DATA_FLOAT,
+                                      CUDNN_DEFAULT_MATH,
+                                      dimInput_,
+                                      dimState_,
+                                      dimState_,
+                                      /*numLayers=*/1,
+                                      dropoutDesc_,
+                                      CUDNN_RNN_PADDED_IO_ENABLED));
+  CUDNN_CALL(cudnnGetRNNWeightSpaceSize(cudnnHandle_, rnnDesc_, &weightSpaceSize_));
+}
+
+void BidirectionalGRUWrapper::packWeights(Tensor weightSpace, const std::vector<Tensor>& weights) {
+  ABORT_IF(weights.size() != 6, "A bidirectional GRU needs W, U and b of both directions");
+  ABORT_IF(weightSpace->memory()->size() < weightSpaceSize_, "Weight space of the bidirectional GRU is too small");
+  cudaSetDevice(weightSpace->getDeviceId().no);
+  CUDA_CHECK(cudaMemset(weightSpace->data(), 0, weightSpaceSize_));
+
+  cudnnTensorDescriptor_t mDesc, bDesc;
+  CUDNN_CALL(cudnnCreateTensorDescriptor(&mDesc));
+  CUDNN_CALL(cudnnCreateTensorDescriptor(&bDesc));
+
+  for(int direction = 0; direction < 2; ++direction) {
+    std::vector<float> W, U, b;
+    weights[3 * direction + 0]->get(W);
+    weights[3 * direction + 1]->get(U);
+    weights[3 * direction + 2]->get(b);
+
+    // linear layers 0-2 multiply the input, 3-5 the state, for the gates r, z and h
+    for(int linLayer = 0; linLayer < 6; ++linLayer) {
+      void* mAddr = nullptr;
+      void* bAddr = nullptr;
+      CUDNN_CALL(cudnnGetRNNWeightParams(cudnnHandle_, rnnDesc_, direction, weightSpaceSize_, weightSpace->data(),
+                                         linLayer, mDesc, &mAddr, bDesc, &bAddr));
+
+      bool input = linLayer < 3;
+      int gate = linLayer % 3;
+      int cols = input ? dimInput_ : dimState_;
+      const auto& source = input ? W : U;
+
+      // marian multiplies rows with [cols, 3 * dimState], cuDNN columns with [dimState, cols] for each gate
+      std::vector<float> matrix(dimState_ * cols);
+      for(int i = 0; i < dimState_; ++i)
+        for(int j = 0; j < cols; ++j)
+          matrix[i * cols + j] = source[j * 3 * dimState_ + gate * dimState_ + i];
+      CUDA_CHECK(cudaMemcpy(mAddr, matrix.data(), matrix.size() * sizeof(float), cudaMemcpyHostToDevice));
+
+      if(input)
+        CUDA_CHECK(cudaMemcpy(bAddr, b.data() + gate * dimState_, dimState_ * sizeof(float), cudaMemcpyHostToDevice));
+    }
+  }
+
+  cudnnDestroyTensorDescriptor(mDesc);
+  cudnnDestroyTensorDescriptor(bDesc);
+}
+
+void BidirectionalGRUWrapper::forward(Ptr<Allocator> allocator,
+                                      Tensor x,
+                                      Tensor weightSpace,
+                                      Tensor y,
+                                      const std::vector<int>& lengths) {
+  cudaSetDevice(x->getDeviceId().no);
+
+  int dimTime = x->shape()[-3];
+  int dimBatch = x->shape()[-2];
+  ABORT_IF((int)lengths.size() != dimBatch, "Expected {} sequence lengths, got {}", dimBatch, lengths.size());
+
+  float paddingFill = 0.f;
+  cudnnRNNDataDescriptor_t xDesc, yDesc;
+  CUDNN_CALL(cudnnCreateRNNDataDescriptor(&xDesc));
+  CUDNN_CALL(cudnnCreateRNNDataDescriptor(&yDesc));
+  CUDNN_CALL(cudnnSetRNNDataDescriptor(xDesc, CUDNN_DATA_FLOAT, CUDNN_RNN_DATA_LAYOUT_SEQ_MAJOR_UNPACKED,
+                                       dimTime, dimBatch, dimInput_, lengths.data(), &paddingFill));
+  CUDNN_CALL(cudnnSetRNNDataDescriptor(yDesc, CUDNN_DATA_FLOAT, CUDNN_RNN_DATA_LAYOUT_SEQ_MAJOR_UNPACKED,
+                                       dimTime, dimBatch, 2 * dimState_, lengths.data(), &paddingFill));
+
+  // both directions start from zero states, the final states are not needed
+  cudnnTensorDescriptor_t hDesc;
+  int hDims[3] = {2, dimBatch, dimState_};
+  int hStrides[3] = {dimBatch * dimState_, dimState_, 1};
+  CUDNN_CALL(cudnnCreateTensorDescriptor(&hDesc));
+  CUDNN_CALL(cudnnSetTensorNdDescriptor(hDesc, CUDNN_DATA_FLOAT, 3, hDims, hStrides));
+
+  size_t workSpaceSize = 0, reserveSpaceSize = 0;
+  CUDNN_CALL(cudnnGetRNNTempSpaceSizes(cudnnHandle_, rnnDesc_, CUDNN_FWD_MODE_INFERENCE, xDesc,
+                                       &workSpaceSize, &reserveSpaceSize));
+  auto workSpace = allocator->alloc(std::max<size_t>(workSpaceSize, 1));
+  auto devLengths = allocator->alloc<int>(lengths.size());
+  CUDA_CHECK(cudaMemcpy(devLengths->data(), lengths.data(), lengths.size() * sizeof(int), cudaMemcpyHostToDevice));
+
+  CUDNN_CALL(cudnnRNNForward(cudnnHandle_, rnnDesc_, CUDNN_FWD_MODE_INFERENCE, devLengths->data<int>(),
+                             xDesc, x->data(), yDesc, y->data(),
+                             hDesc, nullptr, nullptr,
+                             hDesc, nullptr, nullptr,
+                             weightSpaceSize_, weightSpace->data(),
+                             workSpaceSize, workSpace->data(),
+                             0, nullptr));
+
+  allocator->free(workSpace);
+  allocator->free(devLengths);
+  cudnnDestroyTensorDescriptor(hDesc);
+  cudnnDestroyRNNDataDescriptor(xDesc);
+  cudnnDestroyRNNDataDescriptor(yDesc);
+}
+
+BidirectionalGRUWrapper::~BidirectionalGRUWrapper() {
+  cudnnDestroyRNNDescriptor(rnnDesc_);
+  cudnnDestroyDropoutDescriptor(dropoutDesc_);
+  cudaFree(dropoutStates_);
+}
+
+#else
+
+BidirectionalGRUWrapper::BidirectionalGRUWrapper(int, int) {
+  ABORT("The bidirectional GRU of cuDNN needs cuDNN 8 or newer");
+}
+
+void BidirectionalGRUWrapper::packWeights(Tensor, const std::vector<Tensor>&) {}
+
+void BidirectionalGRUWrapper::forward(Ptr<Allocator>, Tensor, Tensor, Tensor, const std::vector<int>&) {}
+
+BidirectionalGRUWrapper::~BidirectionalGRUWrapper() {}
+
+#endif
+
 #else
 
 CUDNNWrapper::CUDNNWrapper() {
@@ -391,5 +539,23 @@ void PoolingWrapper::backward(Tensor, Tensor, Tensor, Tensor) {
 
 PoolingWrapper::~PoolingWrapper() {}
 
+BidirectionalGRUWrapper::BidirectionalGRUWrapper(int, int) {
+  ABORT("To use the bidirectional GRU of cuDNN, recompile with CUDNN (cmake flag -DUSE_CUDNN=on)");
+}
+
+int BidirectionalGRUWrapper::dimState() const {
+  return 0;
+}
+
+size_t BidirectionalGRUWrapper::weightSpaceSize() const {
+  return 0;
+}
+
+void BidirectionalGRUWrapper::packWeights(Tensor, const std::vector<Tensor>&) {}
+
+void BidirectionalGRUWrapper::forward(Ptr<Allocator>, Tensor, Tensor, Tensor, const std::vector<int>&) {}
+
+BidirectionalGRUWrapper::~BidirectionalGRUWrapper() {}
+
 #endif
 }  // namespace marian
@@ -3,8 +3,11 @@
 #include <iostream>
 
 #include "common/shape.h"
+#include "tensors/allocator.h"
 #include "tensors/tensor.h"
 
+#include <vector>
+
 #ifdef CUDNN
 
 #include <cudnn.h>
@@ -88,6 +91,40 @@ protected:
   cudnnPoolingDescriptor_t poolingDesc_;
   cudnnPoolingMode_t poolingMode_;
 };
+
+/**
+ * Single-layer bidirectional GRU for inference, x is [dimTime, dimBatch, dimInput] and y [dimTime, dimBatch, 2 *
+ * dimState] with the forward and then the backward states. The weights of both directions are packed into cuDNN's
+ * weight space once with packWeights().
+ */
+class BidirectionalGRUWrapper : public CUDNNWrapper {
+public:
+  BidirectionalGRUWrapper(int dimInput, int dimState);
+
+  int dimState() const { return dimState_; }
+
+  // bytes of the weight space
+  size_t weightSpaceSize() const { return weightSpaceSize_; }
+
+  // packs W [dimInput, 3 * dimState], U [dimState, 3 * dimState] and b [1, 3 * dimState] of the forward and the
+  // backward GRU, in this order, into weightSpace, with the gates in the order r, z, h of marian's GRU
+  void packWeights(Tensor weightSpace, const std::vector<Tensor>& weights);
+
+  // runs the right-padded sequences of lengths through the GRU, padded outputs are zeros
+  void forward(Ptr<Allocator> allocator, Tensor x, Tensor weightSpace, Tensor y, const std::vector<int>& lengths);
+
+  virtual ~BidirectionalGRUWrapper();
+
+protected:
+  int dimInput_;
+  int dimState_;
+  size_t weightSpaceSize_{0};
+  size_t dropoutStateSize_{0};
+  void* dropoutStates_{nullptr};
+
+  cudnnDropoutDescriptor_t dropoutDesc_;
+  cudnnRNNDescriptor_t rnnDesc_;
+};
 }  // namespace marian
 
 #else
@@ -141,6 +178,21 @@ public:
 
   virtual ~PoolingWrapper();
 };
+
+class BidirectionalGRUWrapper : public CUDNNWrapper {
+public:
+  BidirectionalGRUWrapper(int dimInput, int dimState);
+
+  int dimState() const;
+
+  size_t weightSpaceSize() const;
+
+  void packWeights(Tensor weightSpace, const std::vector<Tensor>& weights);
+
+  void forward(Ptr<Allocator> allocator, Tensor x, Tensor weightSpace, Tensor y, const std::vector<int>& lengths);
+
+  virtual ~BidirectionalGRUWrapper();
+};
 }  // namespace marian
 
 #endif
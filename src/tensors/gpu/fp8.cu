@@ -0,0 +1,247 @@
+#include "tensors/gpu/backend.h"
+#include "tensors/gpu/cuda_helpers.h"
+#include "tensors/gpu/prod.h"
+
+#include <cublas_v2.h>
+
+#if CUDA_VERSION >= 11080
+#include <cublasLt.h>
+#include <cuda_fp8.h>
+#endif
+
+namespace marian {
+namespace gpu {
+
+#if CUDA_VERSION >= 11080
+
+// largest finite values of the two FP8 formats
+static const float FP8_E4M3_MAX = 448.f;
+static const float FP8_E5M2_MAX = 57344.f;
+
+// cuBLASLt needs leading dimensions of FP8 operands that are multiples of 16 bytes, so the inner dimension is
+// padded with zeros
+static const int FP8_ALIGNMENT = 16;
+static const size_t FP8_WORKSPACE_BYTES = 4 << 20;
+
+// One warp: pushes the amax of the finished step into the history, unless it overflowed, which cost scaling
+// skips anyway, and derives the scale of the next step from the maximum over the history. Without any amax
+// so far, the scale stays as it is, i.e. 1 initially.
+__global__ static void gFp8NextStep(Fp8ScalingState* state, float fp8Max) {
+  if(threadIdx.x == 0) {
+    float amax = state->amax;
+    if(isfinite(amax)) {
+      state->history[state->pos] = amax;
+      state->pos = (state->pos + 1) % state->length;
+    }
+    state->amax = 0.f;
+  }
+  __syncwarp();
+
+  float amax = 0.f;
+  for(int i = threadIdx.x; i < state->length; i += 32)
+    amax = fmaxf(amax, state->history[i]);
+  for(int offset = 16; offset > 0; offset /= 2)
+    amax = fmaxf(amax, __shfl_xor_sync(0xffffffff, amax, offset));
+
+  if(threadIdx.x == 0 && amax > 0.f) {
+    state->scale    = fp8Max / amax;
+    state->scaleInv = amax / fp8Max;
+  }
+}
+
+// out[r][c] = fp8(scale * in[r][c]) for an in of [rows, cols], or fp8(scale * in[c][r]) for an in of [cols, rows] if
+// transpose, with columns [cols, ldOut) of out set to zero. Blocks of 32x8 threads convert tiles of 32x32 through
+// shared memory, so that reads and writes are coalesced in both cases. The amax of in goes to state->amax.
+template <typename T>
+__global__ static void gQuantizeFp8(uint8_t* out,
+                                    const T* in,
+                                    int rows,
+                                    int cols,
+                                    int ldOut,
+                                    bool transpose,
+                                    __nv_fp8_interpretation_t format,
+                                    Fp8ScalingState* state) {
+  __shared__ float tile[32][33];
+  int r0 = blockIdx.y * 32;
+  int c0 = blockIdx.x * 32;
+  float scale = state->scale;
+
+  float amax = 0.f;
+  for(int i = threadIdx.y; i < 32; i += blockDim.y) {
+    int r = transpose ? r0 + threadIdx.x : r0 + i;
+    int c = transpose ? c0 + i : c0 + threadIdx.x;
+    float x = 0.f;
+    if(r < rows && c < cols)
+      x = (float)(transpose ? in[(size_t)c * rows + r] : in[(size_t)r * cols + c]);
+    amax = fmaxf(amax, fabsf(x));
+    if(transpose)
+      tile[threadIdx.x][i] = x;
+    else
+      tile[i][threadIdx.x] = x;
+  }
+  __syncthreads();
+
+  for(int i = threadIdx.y; i < 32; i += blockDim.y) {
+    int r = r0 + i;
+    int c = c0 + threadIdx.x;
+    if(r < rows && c < ldOut)
+      out[(size_t)r * ldOut + c] = __nv_cvt_float_to_fp8(tile[i][threadIdx.x] * scale, __NV_SATFINITE, format);
+  }
+
+  for(int offset = 16; offset > 0; offset /= 2)
+    amax = fmaxf(amax, __shfl_xor_sync(0xffffffff, amax, offset));
+  if(threadIdx.x == 0) // non-negative floats compare like their bits as ints
+    atomicMax((int*)&state->amax, __float_as_int(amax));
+}
+
+static void quantizeFp8(uint8_t* out,
+                        const marian::Tensor& in,
+                        int rows,
+                        int cols,
+                        int ldOut,
+                        bool transpose,
+                        bool gradient,
+                        Fp8ScalingState* state) {
+  dim3 threads(32, 8);
+  dim3 blocks((ldOut + 31) / 32, (rows + 31) / 32);
+  ABORT_IF(blocks.y > 65535, "Too many rows ({}) for the FP8 conversion", rows);
+  auto format = gradient ? __NV_E5M2 : __NV_E4M3;
+  if(in->type() == Type::float32) {
+    gQuantizeFp8<<<blocks, threads>>>(out, in->data<float>(), rows, cols, ldOut, transpose, format, state);
+#if COMPILE_FP16
+  } else if(in->type() == Type::float16) {
+    gQuantizeFp8<<<blocks, threads>>>(out, in->data<half>(), rows, cols, ldOut, transpose, format, state);
+#endif
+  } else {
+    ABORT("FP8 conversion not implemented for type {}", in->type());
+  }
+  CUDA_CHECK(cudaGetLastError());
+}
+
+static bool isFp8Input(Type type) {
+  return type == Type::float32 || type == Type::float16;
+}
+
+#endif
+
+bool ProdFp8(marian::Tensor C,
+             Ptr<Allocator> allocator,
+             const marian::Tensor& A,
+             const marian::Tensor& B,
+             bool transA,
+             bool transB,
+             float beta,
+             float scalar,
+             const Fp8Operand& fp8A,
+             const Fp8Operand& fp8B) {
+#if CUDA_VERSION >= 11080
+  auto backend = std::static_pointer_cast<gpu::Backend>(C->getBackend());
+  if(backend->getFp8() == 0 || (fp8A.gradient && fp8B.gradient)) // there are no E5M2 x E5M2 GEMMs
+    return false;
+  if(!isFp8Input(A->type()) || !isFp8Input(B->type()) || !isFp8Input(C->type()))
+    return false;
+
+  int m = A->shape().elements() / A->shape().back();
+  int k = A->shape().back();
+  if(transA)
+    std::swap(m, k);
+
+  int l = B->shape().elements() / B->shape().back();
+  int n = B->shape().back();
+  if(transB)
+    std::swap(l, n);
+
+  ABORT_IF(k != l, "Matrix product requires inner dimensions to match in {}{} * {}{}", A->shape(), transA, B->shape(), transB);
+  ABORT_IF((size_t)m * n != C->shape().elements(), "FP8 product of {} and {} does not fit into {}", A->shape(), B->shape(), C->shape());
+
+  // rows of C are leading dimensions of the output of cuBLASLt
+  size_t sizeC = sizeOf(C->type());
+  if((n * sizeC) % FP8_ALIGNMENT != 0 || (uintptr_t)C->data<uint8_t>() % FP8_ALIGNMENT != 0)
+    return false;
+
+  CUDA_CHECK(cudaSetDevice((int)C->getDeviceId().no));
+  Fp8ScalingState* scalingA = backend->getFp8Scaling(fp8A.scaling);
+  Fp8ScalingState* scalingB = backend->getFp8Scaling(fp8B.scaling);
+
+  // Row-major C = op(A) * op(B) is column-major C^T = op(B)^T * op(A)^T, and cuBLASLt only takes FP8 operands
+  // with the first one transposed: the first operand is op(B)^T as a row-major [n, kPad] matrix and the second
+  // one op(A) as a row-major [m, kPad] matrix, both contiguous along the inner dimension.
+  int kPad = (k + FP8_ALIGNMENT - 1) / FP8_ALIGNMENT * FP8_ALIGNMENT;
+  auto a8 = allocator->alloc<uint8_t>((size_t)m * kPad);
+  auto b8 = allocator->alloc<uint8_t>((size_t)n * kPad);
+  quantizeFp8(a8->data<uint8_t>(), A, m, k, kPad, /*transpose=*/transA, fp8A.gradient, scalingA);
+  quantizeFp8(b8->data<uint8_t>(), B, n, k, kPad, /*transpose=*/!transB, fp8B.gradient, scalingB);
+
+  auto ltHandle = (cublasLtHandle_t)backend->getCublasHandle(); // A cublas handle encapsulates an lt handle
+  cudaDataType typeA = fp8B.gradient ? CUDA_R_8F_E5M2 : CUDA_R_8F_E4M3;
+  cudaDataType typeB = fp8A.gradient ? CUDA_R_8F_E5M2 : CUDA_R_8F_E4M3;
+  cudaDataType typeC = C->type() == Type::float32 ? CUDA_R_32F : CUDA_R_16F;
+  cublasOperation_t opT = CUBLAS_OP_T, opN = CUBLAS_OP_N;
+  const float* scaleA = &scalingB->scaleInv;
+  const float* scaleB = &scalingA->scaleInv;
+  int8_t fastAccum = !fp8A.gradient && !fp8B.gradient; // full-precision accumulation for the gradients
+
+  cublasLtMatmulDesc_t operationDesc = NULL;
+  cublasLtMatrixLayout_t Adesc = NULL, Bdesc = NULL, Cdesc = NULL;
+  cublasLtMatmulPreference_t preference = NULL;
+
+  CUBLAS_CHECK(cublasLtMatmulDescCreate(&operationDesc, CUBLAS_COMPUTE_32F, CUDA_R_32F));
+  CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(operationDesc, CUBLASLT_MATMUL_DESC_TRANSA, &opT, sizeof(opT)));
+  CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(operationDesc, CUBLASLT_MATMUL_DESC_TRANSB, &opN, sizeof(opN)));
+  CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(operationDesc, CUBLASLT_MATMUL_DESC_A_SCALE_POINTER, &scaleA, sizeof(scaleA)));
+  CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(operationDesc, CUBLASLT_MATMUL_DESC_B_SCALE_POINTER, &scaleB, sizeof(scaleB)));
+  CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(operationDesc, CUBLASLT_MATMUL_DESC_FAST_ACCUM, &fastAccum, sizeof(fastAccum)));
+
+  CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&Adesc, typeA, kPad, n, kPad));
+  CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&Bdesc, typeB, kPad, m, kPad));
+  CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&Cdesc, typeC, n, m, n));
+
+  size_t workspaceSize = FP8_WORKSPACE_BYTES;
+  auto workspace = allocator->alloc<uint8_t>(workspaceSize);
+  CUBLAS_CHECK(cublasLtMatmulPreferenceCreate(&preference));
+  CUBLAS_CHECK(cublasLtMatmulPreferenceSetAttribute(preference, CUBLASLT_MATMUL_PREF_MAX_WORKSPACE_BYTES, &workspaceSize, sizeof(workspaceSize)));
+
+  int returnedResults = 0;
+  cublasLtMatmulHeuristicResult_t heuristicResult = {};
+  CUBLAS_CHECK(cublasLtMatmulAlgoGetHeuristic(ltHandle, operationDesc, Adesc, Bdesc, Cdesc, Cdesc, preference, 1, &heuristicResult, &returnedResults));
+
+  if(returnedResults > 0) {
+    CUBLAS_CHECK(cublasLtMatmul(ltHandle, operationDesc, &scalar, b8->data(), Adesc, a8->data(), Bdesc, &beta,
+                                C->data(), Cdesc, C->data(), Cdesc, &heuristicResult.algo,
+                                workspace->data(), workspaceSize, backend->getCudaStream()));
+  } else {
+    LOG_ONCE(warn, "[gpu] cuBLASLt has no FP8 GEMM for C {} = op(A) {} * op(B) {}, using higher precision",
+             C->shape(), A->shape(), B->shape());
+  }
+
+  CUBLAS_CHECK(cublasLtMatmulPreferenceDestroy(preference));
+  CUBLAS_CHECK(cublasLtMatrixLayoutDestroy(Cdesc));
+  CUBLAS_CHECK(cublasLtMatrixLayoutDestroy(Bdesc));
+  CUBLAS_CHECK(cublasLtMatrixLayoutDestroy(Adesc));
+  CUBLAS_CHECK(cublasLtMatmulDescDestroy(operationDesc));
+
+  allocator->free(workspace);
+  allocator->free(b8);
+  allocator->free(a8);
+  return returnedResults > 0;
+#else
+  C; allocator; A; B; transA; transB; beta; scalar; fp8A; fp8B;
+  return false;
+#endif
+}
+
+void Fp8NextStep(Ptr<marian::Backend> backend, const Fp8Operand& operand) {
+#if CUDA_VERSION >= 11080
+  auto gpuBackend = std::static_pointer_cast<gpu::Backend>(backend);
+  if(gpuBackend->getFp8() == 0)
+    return;
+  gpuBackend->setDevice();
+  gFp8NextStep<<<1, 32>>>(gpuBackend->getFp8Scaling(operand.scaling), operand.gradient ? FP8_E5M2_MAX : FP8_E4M3_MAX);
+  CUDA_CHECK(cudaGetLastError());
+#else
+  backend; operand;
+#endif
+}
+
+}  // namespace gpu
+}  // namespace marian
@@ -0,0 +1,180 @@
+#include "tensors/tensor_operators.h"
+#include "tensors/allocator.h"
+#include "tensors/gpu/cuda_helpers.h"
+
+#include <cub/cub.cuh>
+
+#include <cstdint>
+
+namespace marian {
+namespace gpu {
+
+// Top-k search over packed LSH codes by hamming distance, GPU counterpart to lsh::hammingTopK().
+//
+// HammingHistogram computes the distances of a tile of HAMMING_QUERY_TILE queries against
+// HAMMING_THREADS code rows per block. The queries of a tile are kept in shared memory, hence every
+// code row is read from global memory once per tile instead of once per query, as 128-bit vectors
+// whenever the code size allows it. Distances are counted in per-block histograms in shared memory
+// that are merged into one histogram per query in global memory.
+//
+// HammingSelect then finds the distance of the k-th best row of each query from its histogram and
+// compacts the selected rows with a block-wide scan. The output is in increasing order of row index,
+// as required for the reverse look-up of LSHShortlist, and ties at the k-th distance go to the lowest
+// row indices, so the result does not depend on thread scheduling.
+
+static const int HAMMING_QUERY_TILE = 8;
+static const int HAMMING_THREADS = 256;
+static const size_t HAMMING_SHARED_MEM_SIZE = 48000;
+
+__device__ inline int popcountXor(uint32_t a, uint32_t b) {
+  return __popc(a ^ b);
+}
+
+__device__ inline int popcountXor(const uint4& a, const uint4& b) {
+  return __popc(a.x ^ b.x) + __popc(a.y ^ b.y) + __popc(a.z ^ b.z) + __popc(a.w ^ b.w);
+}
+
+template <class Word>
+__global__ void HammingHistogram(const Word* codes,       // [numCodes, wordsPerVector]
+                                 const Word* queries,     // [numQueries, wordsPerVector]
+                                 uint16_t* distances,     // [numQueries, numCodes]
+                                 uint32_t* histograms,    // [numQueries, range], zero-initialized
+                                 int numCodes,
+                                 int numQueries,
+                                 int wordsPerVector,
+                                 int range) {
+  extern __shared__ uint4 sharedMem[]; // uint4 for the alignment of vectorized query words
+  Word* sharedQueries = (Word*)sharedMem;                                                   // [HAMMING_QUERY_TILE, wordsPerVector]
+  uint32_t* sharedCounts = (uint32_t*)(sharedQueries + HAMMING_QUERY_TILE * wordsPerVector); // [HAMMING_QUERY_TILE, range]
+
+  int queryBegin = blockIdx.y * HAMMING_QUERY_TILE;
+  int tileQueries = min(HAMMING_QUERY_TILE, numQueries - queryBegin);
+
+  for(int i = threadIdx.x; i < HAMMING_QUERY_TILE * wordsPerVector; i += blockDim.x)
+    sharedQueries[i] = i < tileQueries * wordsPerVector ? queries[(size_t)queryBegin * wordsPerVector + i] : Word();
+  for(int i = threadIdx.x; i < HAMMING_QUERY_TILE * range; i += blockDim.x)
+    sharedCounts[i] = 0;
+  __syncthreads();
+
+  int row = blockIdx.x * blockDim.x + threadIdx.x;
+  if(row < numCodes) {
+    int dist[HAMMING_QUERY_TILE] = {0};
+    const Word* code = codes + (size_t)row * wordsPerVector;
+    for(int w = 0; w < wordsPerVector; ++w) {
+      Word codeWord = code[w];
+#pragma unroll
+      for(int q = 0; q < HAMMING_QUERY_TILE; ++q) // all threads read the same query word, a shared memory broadcast
+        dist[q] += popcountXor(codeWord, sharedQueries[q * wordsPerVector + w]);
+    }
+#pragma unroll
+    for(int q = 0; q < HAMMING_QUERY_TILE; ++q) {
+      if(q < tileQueries) {
+        distances[(size_t)(queryBegin + q) * numCodes + row] = (uint16_t)dist[q];
+        atomicAdd(&sharedCounts[q * range + dist[q]], 1u);
+      }
+    }
+  }
+  __syncthreads();
+
+  for(int i = threadIdx.x; i < tileQueries * range; i += blockDim.x)
+    if(sharedCounts[i] > 0)
+      atomicAdd(&histograms[(size_t)queryBegin * range + i], sharedCounts[i]);
+}
+
+__global__ void HammingSelect(const uint16_t* distances,  // [numQueries, numCodes]
+                              const uint32_t* histograms, // [numQueries, range]
+                              uint32_t* outIdx,           // [numQueries, k]
+                              int numCodes,
+                              int k,
+                              int range) {
+  typedef cub::BlockScan<uint32_t, HAMMING_THREADS> BlockScan;
+  __shared__ typename BlockScan::TempStorage scanStorage;
+  __shared__ int threshold;
+  __shared__ uint32_t tiesNeeded;
+
+  int query = blockIdx.x;
+  const uint16_t* queryDistances = distances + (size_t)query * numCodes;
+  uint32_t* queryOut = outIdx + (size_t)query * k;
+
+  // distances below the threshold are always selected, the first tiesNeeded rows at the threshold as well
+  if(threadIdx.x == 0) {
+    const uint32_t* histogram = histograms + (size_t)query * range;
+    uint32_t below = 0;
+    int t = 0;
+    while(t < range - 1 && below + histogram[t] < (uint32_t)k)
+      below += histogram[t++];
+    threshold = t;
+    tiesNeeded = k - below;
+  }
+  __syncthreads();
+
+  uint32_t offset = 0;    // selected rows in previous tiles
+  uint32_t tiesTaken = 0; // selected rows at the threshold in previous tiles
+  for(int tileBegin = 0; tileBegin < numCodes; tileBegin += HAMMING_THREADS) {
+    int row = tileBegin + threadIdx.x;
+    int dist = row < numCodes ? queryDistances[row] : range; // out of range, never selected
+    // count rows below the threshold in the lower and ties in the upper 16 bits, a tile has at most 256 of each
+    uint32_t flags = (dist < threshold ? 1u : 0u) | (dist == threshold ? 1u << 16 : 0u);
+    uint32_t before, total;
+    BlockScan(scanStorage).ExclusiveSum(flags, before, total);
+
+    uint32_t tiesLeft = tiesNeeded - tiesTaken;
+    uint32_t belowBefore = before & 0xFFFF, tiesBefore = before >> 16;
+    bool selected = dist < threshold || (dist == threshold && tiesBefore < tiesLeft);
+    if(selected)
+      queryOut[offset + belowBefore + min(tiesBefore, tiesLeft)] = row;
+
+    uint32_t tiesInTile = min(total >> 16, tiesLeft);
+    offset += (total & 0xFFFF) + tiesInTile;
+    tiesTaken += tiesInTile;
+    __syncthreads(); // scanStorage is reused by the next tile
+  }
+}
+
+void HammingTopK(marian::Tensor outIdx,
+                 const marian::Tensor queryCodes,
+                 const marian::Tensor codes,
+                 int k,
+                 int numCodes,
+                 marian::Ptr<marian::Allocator> allocator) {
+  CUDA_CHECK(cudaSetDevice(outIdx->getDeviceId().no));
+
+  int bytesPerVector = codes->shape()[-1];
+  ABORT_IF(bytesPerVector % sizeof(uint32_t) != 0, "LSH codes on the GPU need a multiple of 32 bits");
+  ABORT_IF(queryCodes->shape()[-1] != bytesPerVector, "Query and index bit vectors need to be of same size");
+  ABORT_IF(k > numCodes, "k is larger than number of candidate values?");
+  int numQueries = queryCodes->shape().elements() / bytesPerVector;
+  int range = bytesPerVector * 8 + 1; // all possible distances
+
+  bool vectorized = bytesPerVector % sizeof(uint4) == 0;
+  int wordsPerVector = vectorized ? bytesPerVector / (int)sizeof(uint4) : bytesPerVector / (int)sizeof(uint32_t);
+  size_t sharedMem = HAMMING_QUERY_TILE * bytesPerVector + HAMMING_QUERY_TILE * range * sizeof(uint32_t);
+  ABORT_IF(sharedMem > HAMMING_SHARED_MEM_SIZE,
+           "LSH codes of {} bits are too long for the GPU hamming search", bytesPerVector * 8);
+
+  auto distancesMemory = allocator->alloc<uint16_t>((size_t)numQueries * numCodes);
+  auto histogramsMemory = allocator->alloc<uint32_t>((size_t)numQueries * range);
+  CUDA_CHECK(cudaMemsetAsync(histogramsMemory->data(), 0, histogramsMemory->size()));
+
+  dim3 blocks((numCodes + HAMMING_THREADS - 1) / HAMMING_THREADS, (numQueries + HAMMING_QUERY_TILE - 1) / HAMMING_QUERY_TILE);
+  if(vectorized)
+    HammingHistogram<uint4><<<blocks, HAMMING_THREADS, sharedMem>>>(
+        codes->data<uint4>(), queryCodes->data<uint4>(), distancesMemory->data<uint16_t>(),
+        histogramsMemory->data<uint32_t>(), numCodes, numQueries, wordsPerVector, range);
+  else
+    HammingHistogram<uint32_t><<<blocks, HAMMING_THREADS, sharedMem>>>(
+        codes->data<uint32_t>(), queryCodes->data<uint32_t>(), distancesMemory->data<uint16_t>(),
+        histogramsMemory->data<uint32_t>(), numCodes, numQueries, wordsPerVector, range);
+  CUDA_CHECK(cudaGetLastError());
+
+  HammingSelect<<<numQueries, HAMMING_THREADS>>>(
+      distancesMemory->data<uint16_t>(), histogramsMemory->data<uint32_t>(), outIdx->data<uint32_t>(),
+      numCodes, k, range);
+  CUDA_CHECK(cudaGetLastError());
+
+  allocator->free(distancesMemory);
+  allocator->free(histogramsMemory);
+}
+
+}  // namespace gpu
+}  // namespace marian
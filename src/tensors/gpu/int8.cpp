@@ -0,0 +1,62 @@
+#include "tensors/gpu/int8.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace marian {
+namespace gpu {
+namespace int8gemm {
+
+bool isConvertible(const std::string& name, const Shape& shape) {
+  bool affineWeight = name.find("_W") == name.length() - 3 || name.find("_W") == name.length() - 2;
+  bool outputLayer = name.find("_Wt") == name.length() - 3 || name.find("ff_logit_out") != std::string::npos;
+  return affineWeight && !outputLayer && shape.size() == 2 && shape[-2] % 4 == 0 && shape[-1] % 4 == 0;
+}
+
+// Runs on the CPU of marian-conv, the layout is described in int8.h
+void QuantizeB(marian::Tensor out, const marian::Tensor in, float quantizeRange) {
+  ABORT_IF(in->getBackend()->getDeviceId().type != DeviceType::cpu || out->getBackend()->getDeviceId().type != DeviceType::cpu,
+           "Conversion to {} runs on the CPU", Type::int8gpu);
+  matchOrAbort<float>(in->type());
+  matchOrAbort<int8gpu>(out->type());
+  ABORT_IF(in->shape() != out->shape(), "Shapes {} and {} do not match", in->shape(), out->shape());
+
+  int rows = in->shape()[-2];
+  int cols = in->shape()[-1];
+  const float* x = in->data();
+  int8_t* q = out->data<int8_t>();
+  float* unquantMults = (float*)(q + (size_t)rows * cols);
+
+  for(int j = 0; j < cols; ++j) {
+    float maxAbs = 0.f;
+    double mean = 0, sqrSum = 0;
+    for(int i = 0; i < rows; ++i) {
+      float v = x[(size_t)i * cols + j];
+      maxAbs = std::max(maxAbs, std::abs(v));
+      mean += v;
+      sqrSum += v * v;
+    }
+
+    // as for the packed8 types, --quantize-range clips the column to a multiple of its standard deviation
+    float range = maxAbs;
+    if(quantizeRange != 0.f) {
+      mean /= rows;
+      double stddev = std::sqrt(std::max(sqrSum / rows - mean * mean, 0.0));
+      range = std::min(range, (float)(std::abs(mean) + quantizeRange * stddev));
+    }
+
+    float quantMult = range > 0.f ? 127.f / range : 1.f;
+    unquantMults[j] = 1.f / quantMult;
+
+    // round to nearest and saturate to [-127, 127], -128 is never used as in intgemm
+    for(int i = 0; i < rows; ++i) {
+      float v = std::round(x[(size_t)i * cols + j] * quantMult);
+      q[(size_t)j * rows + i] = (int8_t)std::max(-127.f, std::min(127.f, v));
+    }
+  }
+}
+
+}  // namespace int8gemm
+}  // namespace gpu
+}  // namespace marian
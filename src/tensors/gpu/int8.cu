@@ -0,0 +1,206 @@
+#include "tensors/gpu/int8.h"
+#include "tensors/gpu/backend.h"
+#include "tensors/gpu/cuda_helpers.h"
+#include "tensors/gpu/prod.h"
+
+#include <cublas_v2.h>
+
+#include <algorithm>
+
+#if CUDA_VERSION >= 11000
+#include <cublasLt.h>
+#endif
+
+namespace marian {
+namespace gpu {
+namespace int8gemm {
+
+static const int INT8_THREADS = 256;
+static const size_t INT8_WORKSPACE_BYTES = 4 << 20;
+
+// One block per row of in: out = round(in * 127 / max |row|), saturated to [-127, 127] as for the weights, and
+// unquantMults[row] = max |row| / 127.
+template <typename T>
+__global__ static void gQuantizeRows(int8_t* out, float* unquantMults, const T* in, int cols) {
+  __shared__ float sMax[INT8_THREADS];
+  const T* row = in + (size_t)blockIdx.x * cols;
+
+  float maxAbs = 0.f;
+  for(int j = threadIdx.x; j < cols; j += blockDim.x)
+    maxAbs = fmaxf(maxAbs, fabsf((float)row[j]));
+  sMax[threadIdx.x] = maxAbs;
+  __syncthreads();
+  for(int stride = blockDim.x / 2; stride > 0; stride >>= 1) {
+    if(threadIdx.x < stride)
+      sMax[threadIdx.x] = fmaxf(sMax[threadIdx.x], sMax[threadIdx.x + stride]);
+    __syncthreads();
+  }
+  maxAbs = sMax[0];
+
+  float quantMult = maxAbs > 0.f ? 127.f / maxAbs : 1.f;
+  int8_t* q = out + (size_t)blockIdx.x * cols;
+  for(int j = threadIdx.x; j < cols; j += blockDim.x)
+    q[j] = (int8_t)fminf(127.f, fmaxf(-127.f, rintf((float)row[j] * quantMult)));
+  if(threadIdx.x == 0)
+    unquantMults[blockIdx.x] = 1.f / quantMult;
+}
+
+// out = scale * in * rowMults[row] * colMults[col] (+ bias[col]), with relu if doRelu
+template <typename T>
+__global__ static void gUnquantize(T* out,
+                                   const int32_t* in,
+                                   const float* rowMults,
+                                   const float* colMults,
+                                   const T* bias,
+                                   int rows,
+                                   int cols,
+                                   float scale,
+                                   bool doRelu) {
+  size_t size = (size_t)rows * cols;
+  for(size_t index = blockIdx.x * blockDim.x + threadIdx.x; index < size; index += (size_t)gridDim.x * blockDim.x) {
+    int j = (int)(index % cols);
+    float v = scale * (float)in[index] * rowMults[index / cols] * colMults[j];
+    if(bias)
+      v += (float)bias[j];
+    if(doRelu)
+      v = fmaxf(v, 0.f);
+    out[index] = (T)v;
+  }
+}
+
+// unquantized copy of the transposed [N, K] weights for the fallback GEMM
+template <typename T>
+__global__ static void gUnquantizeB(T* out, const int8_t* in, const float* colMults, int rows, int cols) {
+  size_t size = (size_t)rows * cols;
+  for(size_t index = blockIdx.x * blockDim.x + threadIdx.x; index < size; index += (size_t)gridDim.x * blockDim.x)
+    out[index] = (T)((float)in[index] * colMults[index / cols]);
+}
+
+static int blocksFor(size_t size) {
+  return (int)std::min((size_t)MAX_BLOCKS, (size + INT8_THREADS - 1) / INT8_THREADS);
+}
+
+template <typename T>
+static void affineTyped(marian::Tensor C,
+                        Ptr<Allocator> allocator,
+                        const marian::Tensor& A,
+                        const marian::Tensor& B,
+                        const marian::Tensor& bias,
+                        float scale,
+                        bool doRelu) {
+  auto backend = std::static_pointer_cast<gpu::Backend>(C->getBackend());
+  int k = B->shape()[-2];
+  int n = B->shape()[-1];
+  int m = (int)(A->shape().elements() / k);
+  ABORT_IF(A->shape()[-1] != k, "Matrix product requires inner dimensions to match in {} * {}", A->shape(), B->shape());
+  ABORT_IF((size_t)m * n != C->shape().elements(), "Int8 product of {} and {} does not fit into {}", A->shape(), B->shape(), C->shape());
+
+  const int8_t* b8 = B->data<int8_t>();
+  const float* colMults = (const float*)(b8 + (size_t)k * n);
+  const T* biasData = bias ? bias->data<T>() : nullptr;
+
+  bool done = false;
+#if CUDA_VERSION >= 11000
+  auto compute = backend->getCudaComputeCapability();
+  if(compute.major * 10 + compute.minor >= 75) {
+    auto a8 = allocator->alloc<int8_t>((size_t)m * k);
+    auto rowMults = allocator->alloc<float>(m);
+    auto c32 = allocator->alloc<int32_t>((size_t)m * n);
+    gQuantizeRows<<<m, INT8_THREADS>>>(a8->data<int8_t>(), rowMults->data<float>(), A->data<T>(), k);
+    CUDA_CHECK(cudaGetLastError());
+
+    // Row-major C = A * B is column-major C^T = B^T * A^T, and cuBLASLt only takes int8 operands with the first
+    // one transposed: the first operand is the stored [n, k] matrix, the second one A as row-major [m, k].
+    auto ltHandle = (cublasLtHandle_t)backend->getCublasHandle(); // A cublas handle encapsulates an lt handle
+    cublasOperation_t opT = CUBLAS_OP_T, opN = CUBLAS_OP_N;
+    int32_t alpha = 1, beta = 0;
+
+    cublasLtMatmulDesc_t operationDesc = NULL;
+    cublasLtMatrixLayout_t Adesc = NULL, Bdesc = NULL, Cdesc = NULL;
+    cublasLtMatmulPreference_t preference = NULL;
+
+    CUBLAS_CHECK(cublasLtMatmulDescCreate(&operationDesc, CUBLAS_COMPUTE_32I, CUDA_R_32I));
+    CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(operationDesc, CUBLASLT_MATMUL_DESC_TRANSA, &opT, sizeof(opT)));
+    CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(operationDesc, CUBLASLT_MATMUL_DESC_TRANSB, &opN, sizeof(opN)));
+
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&Adesc, CUDA_R_8I, k, n, k));
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&Bdesc, CUDA_R_8I, k, m, k));
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&Cdesc, CUDA_R_32I, n, m, n));
+
+    size_t workspaceSize = INT8_WORKSPACE_BYTES;
+    auto workspace = allocator->alloc<uint8_t>(workspaceSize);
+    CUBLAS_CHECK(cublasLtMatmulPreferenceCreate(&preference));
+    CUBLAS_CHECK(cublasLtMatmulPreferenceSetAttribute(preference, CUBLASLT_MATMUL_PREF_MAX_WORKSPACE_BYTES, &workspaceSize, sizeof(workspaceSize)));
+
+    int returnedResults = 0;
+    cublasLtMatmulHeuristicResult_t heuristicResult = {};
+    CUBLAS_CHECK(cublasLtMatmulAlgoGetHeuristic(ltHandle, operationDesc, Adesc, Bdesc, Cdesc, Cdesc, preference, 1, &heuristicResult, &returnedResults));
+
+    if(returnedResults > 0) {
+      CUBLAS_CHECK(cublasLtMatmul(ltHandle, operationDesc, &alpha, b8, Adesc, a8->data(), Bdesc, &beta,
+                                  c32->data(), Cdesc, c32->data(), Cdesc, &heuristicResult.algo,
+                                  workspace->data(), workspaceSize, backend->getCudaStream()));
+      size_t size = (size_t)m * n;
+      gUnquantize<<<blocksFor(size), INT8_THREADS>>>(C->data<T>(), c32->data<int32_t>(), rowMults->data<float>(),
+                                                     colMults, biasData, m, n, scale, doRelu);
+      CUDA_CHECK(cudaGetLastError());
+      done = true;
+    }
+
+    CUBLAS_CHECK(cublasLtMatmulPreferenceDestroy(preference));
+    CUBLAS_CHECK(cublasLtMatrixLayoutDestroy(Cdesc));
+    CUBLAS_CHECK(cublasLtMatrixLayoutDestroy(Bdesc));
+    CUBLAS_CHECK(cublasLtMatrixLayoutDestroy(Adesc));
+    CUBLAS_CHECK(cublasLtMatmulDescDestroy(operationDesc));
+
+    allocator->free(workspace);
+    allocator->free(c32);
+    allocator->free(rowMults);
+    allocator->free(a8);
+  }
+#endif
+
+  if(!done) {
+    LOG_ONCE(warn, "[gpu] cuBLASLt has no int8 GEMM for C {} = A {} * B {} on this device, using unquantized weights",
+             C->shape(), A->shape(), B->shape());
+    ABORT_IF(doRelu && !bias, "GPU int8 GEMM with relu expects a bias");
+
+    size_t size = (size_t)n * k;
+    auto memory = allocator->alloc<T>(size);
+    auto unquantized = TensorBase::New(memory, Shape({n, k}), A->type(), backend);
+    gUnquantizeB<<<blocksFor(size), INT8_THREADS>>>(unquantized->data<T>(), b8, colMults, n, k);
+    CUDA_CHECK(cudaGetLastError());
+
+    gpu::Prod(C, A, unquantized, /*transA=*/false, /*transB=*/true, /*beta=*/0.f, scale);
+    if(bias)
+      gpu::BiasAdd(C, bias, doRelu);
+    allocator->free(memory);
+  }
+}
+
+void Affine(marian::Tensor C,
+            Ptr<Allocator> allocator,
+            const marian::Tensor& A,
+            const marian::Tensor& B,
+            const marian::Tensor& bias,
+            float scale,
+            bool doRelu) {
+  CUDA_CHECK(cudaSetDevice((int)C->getDeviceId().no));
+  matchOrAbort<int8gpu>(B->type());
+  ABORT_IF(A->type() != C->type() || (bias && bias->type() != C->type()),
+           "GPU int8 GEMM expects A {}, bias and C {} of the same type", A->type(), C->type());
+
+  if(C->type() == Type::float32) {
+    affineTyped<float>(C, allocator, A, B, bias, scale, doRelu);
+#if COMPILE_FP16
+  } else if(C->type() == Type::float16) {
+    affineTyped<half>(C, allocator, A, B, bias, scale, doRelu);
+#endif
+  } else {
+    ABORT("GPU int8 GEMM not implemented for type {}", C->type());
+  }
+}
+
+}  // namespace int8gemm
+}  // namespace gpu
+}  // namespace marian
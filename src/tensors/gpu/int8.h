@@ -0,0 +1,78 @@
+#pragma once
+
+#include "graph/expression_operators.h"
+#include "graph/node.h"
+#include "graph/node_operators_unary.h"
+
+#include <string>
+
+namespace marian {
+namespace gpu {
+namespace int8gemm {
+
+// Int8 GEMMs for Type::int8gpu, run by cuBLASLt on the int8 tensor cores of GPUs with compute capability 7.5 or
+// higher, e.g. T4 and L4 cards. A parameter matrix W of shape [K, N] is converted by marian-conv into N output
+// channels that are quantized separately, each with the unquantization multiplier range / 127, where range is the
+// maximum absolute value of the column or, with --quantize-range r, at most |mean| + r * stddev of the column.
+// The int8 matrix is stored transposed, i.e. as row-major [N, K], as cuBLASLt expects int8 operands with the
+// first one transposed, and is followed by the N float32 multipliers. The tensor keeps the shape [K, N].
+// Activations are quantized per row when they are multiplied, so padding and outliers of one sentence do not
+// change the precision of another.
+
+// true for the parameters that marian-conv converts to Type::int8gpu: the weights of affine layers ("_W" and its
+// variants like "_Wq") whose dimensions are multiples of 4, as cuBLASLt needs for int8 operands. Output layers
+// ("_Wt" and the legacy "ff_logit_out_W") stay in float, since short lists select their rows.
+bool isConvertible(const std::string& name, const Shape& shape);
+
+// quantizes the float32 matrix in of shape [K, N] on the CPU into out of Type::int8gpu and the same shape
+void QuantizeB(marian::Tensor out, const marian::Tensor in, float quantizeRange);
+
+#ifdef CUDA_FOUND
+// C = scale * A * B (+ bias) with float32 or float16 A, bias and C of the same type and B of Type::int8gpu, with
+// relu applied to the result if doRelu. Falls back to a GEMM in the type of A against an unquantized copy of B if
+// cuBLASLt has no int8 GEMM for these shapes on this device.
+void Affine(marian::Tensor C,
+            Ptr<Allocator> allocator,
+            const marian::Tensor& A,
+            const marian::Tensor& B,
+            const marian::Tensor& bias,
+            float scale,
+            bool doRelu);
+#endif
+
+/*
+ * dot(...), affine(...) or affineWithReluDropout(...) in inference with a float activation matrix A and a
+ * parameter matrix B that was converted with `marian-conv --gemm-type int8gpu`.
+ */
+static inline Expr affineOrDot(Expr a, Expr b, Expr bias, bool transA, bool transB, float scale, bool doRelu = false) {
+  ABORT_IF(!isFloat(a->value_type()), "GPU int8 GEMM expects type of A to be float32 or float16 not {}", a->value_type());
+  ABORT_IF(!isGpuInt8(b->value_type()), "GPU int8 GEMM expects type of B to be int8gpu not {}", b->value_type());
+  ABORT_IF(transB, "GPU int8 GEMM does not support transposed B, was a transposed parameter converted to {}?", b->value_type());
+  ABORT_IF(a->graph()->getDeviceId().type != DeviceType::gpu, "Parameters of type {} are only supported on the GPU", b->value_type());
+
+  if(transA) // batches of A are folded into rows below, so handle the transposition first as intgemm does
+    a = transpose(a);
+
+  Shape outShape = a->shape();
+  outShape.set(-1, b->shape()[-1]);
+
+  auto dotOrAffineNodeOp = [=](Expr out, const std::vector<Expr>& children) {
+#ifdef CUDA_FOUND
+    Tensor bias = children.size() > 2 ? children[2]->val() : nullptr;
+    int8gemm::Affine(out->val(), out->graph()->allocator(), children[0]->val(), children[1]->val(), bias, scale, doRelu);
+#else
+    out; children;
+    ABORT("GPU int8 GEMMs need marian compiled with CUDA");
+#endif
+  };
+
+  std::vector<Expr> children = {a, b};
+  if(bias)
+    children.push_back(bias);
+
+  return lambda(children, outShape, a->value_type(), dotOrAffineNodeOp); // inference-only Lambda node
+}
+
+}  // namespace int8gemm
+}  // namespace gpu
+}  // namespace marian
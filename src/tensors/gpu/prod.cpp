@@ -4,11 +4,13 @@
 #endif
 
 #include <cublas_v2.h>
+#include <climits>
 
 // clang-format off
 #include "tensors/gpu/prod.h"
 #include "tensors/gpu/backend.h"
 #include "tensors/gpu/cuda_helpers.h"
+#include "tensors/heads_gemm.h"
 // clang-format on
 
 #if CUDA_VERSION >= 11000
@@ -335,6 +337,42 @@ void Prod(marian::Tensor C,
   }
 }
 
+// Batched GEMM on the matrices described by the operands, whose pointer arrays are written by BatchedGemmPointers()
+// into temporary device memory. The operands are passed in cuBLAS order, i.e. b first for row-major matrices.
+template <typename ElementType, typename ComputeType>
+static void batchedGemm(Ptr<gpu::Backend> backend,
+                        Ptr<Allocator> allocator,
+                        cublasOperation_t opB,
+                        cublasOperation_t opA,
+                        int n, int m, int k,
+                        ComputeType alpha,
+                        const BatchedGemmOperand& b, int ldb,
+                        const BatchedGemmOperand& a, int lda,
+                        ComputeType beta,
+                        const BatchedGemmOperand& c, int ldc,
+                        int batch) {
+  auto cublasHandle = backend->getCublasHandle();
+  auto compute = backend->getCudaComputeCapability();
+
+  IPtr<MemoryPiece> mp_ptrs = allocator->alloc<void*>(3 * batch);
+  void** ptrs = mp_ptrs->data<void*>();
+  BatchedGemmPointers(ptrs, b, a, c, batch);
+
+  setTensorMode(cublasHandle);
+  TypedGemm<ElementType, ComputeType>::batchedGemm(cublasHandle, compute,
+                                                   opB, opA,
+                                                   n, m, k,
+                                                   &alpha,
+                                                   (const ElementType**)ptrs, ldb,
+                                                   (const ElementType**)(ptrs + batch), lda,
+                                                   &beta,
+                                                   (ElementType**)(ptrs + 2 * batch), ldc,
+                                                   batch);
+  unsetTensorMode(cublasHandle);
+
+  allocator->free(mp_ptrs);
+}
+
 template <typename ElementType, typename ComputeType>
 void ProdBatchedTyped(marian::Tensor C,                 
                       Ptr<Allocator> allocator,
@@ -392,8 +430,6 @@ void ProdBatchedTyped(marian::Tensor C,
   cublasOperation_t opB = transB ? CUBLAS_OP_T : CUBLAS_OP_N;
 
   auto backend = std::static_pointer_cast<gpu::Backend>(C->getBackend());
-  auto cublasHandle = backend->getCublasHandle();
-  auto compute = backend->getCudaComputeCapability();
 
   int strideA = m * k;
   int strideB = n * k;
@@ -406,46 +442,18 @@ void ProdBatchedTyped(marian::Tensor C,
   functional::Shape bShapeMetaF = bShapeMeta;
   functional::Shape cShapeMetaF = cShapeMeta;
 
-  std::vector<const ElementType*> aptr;
-  std::vector<const ElementType*> bptr;
-  std::vector<ElementType*> cptr;
-
-  functional::Array<int, functional::Shape::size()> dims;
-  for(int i = 0; i < batchC; i++) {
-    cShapeMetaF.dims(i, dims);
-    auto aIndex = aShapeMetaF.bindex(dims);
-    auto bIndex = bShapeMetaF.bindex(dims);
-
-    aptr.push_back(A->data<ElementType>() + aIndex * strideA);
-    bptr.push_back(B->data<ElementType>() + bIndex * strideB);
-    cptr.push_back(C->data<ElementType>() + i * strideC);
+  // matrix i of C is at index i of the meta-shape, the same index cShapeMetaF.dims(i, ...) maps to the
+  // broadcast matrices of A and B via bindex()
+  BatchedGemmOperand aOp(A->data<ElementType>()), bOp(B->data<ElementType>()), cOp(C->data<ElementType>());
+  for(int d = 0; d < (int)functional::Shape::size(); ++d) {
+    if(aShapeMetaF.bstride(d) != 0)
+      aOp.add(cShapeMetaF.stride(d), cShapeMetaF[d], (size_t)aShapeMetaF.bstride(d) * strideA * sizeof(ElementType));
+    if(bShapeMetaF.bstride(d) != 0)
+      bOp.add(cShapeMetaF.stride(d), cShapeMetaF[d], (size_t)bShapeMetaF.bstride(d) * strideB * sizeof(ElementType));
   }
+  cOp.add(1, batchC, (size_t)strideC * sizeof(ElementType));
 
-  // auto fails here from weird reason
-  IPtr<MemoryPiece> mp_aptr = allocator->alloc<const ElementType*>(aptr.size());
-  CudaCopy(aptr.data(), aptr.data() + aptr.size(), mp_aptr->data<const ElementType*>());
-
-  IPtr<MemoryPiece> mp_bptr = allocator->alloc<const ElementType*>(bptr.size());
-  CudaCopy(bptr.data(), bptr.data() + bptr.size(), mp_bptr->data<const ElementType*>());
-
-  IPtr<MemoryPiece> mp_cptr = allocator->alloc<ElementType*>(cptr.size());
-  CudaCopy(cptr.data(), cptr.data() + cptr.size(), mp_cptr->data<ElementType*>());
-
-  setTensorMode(cublasHandle);
-  TypedGemm<ElementType, ComputeType>::batchedGemm(cublasHandle, compute,
-                                                   opB, opA,
-                                                   n, m, k,
-                                                   &alpha,
-                                                   mp_bptr->data<const ElementType*>(), ldb,
-                                                   mp_aptr->data<const ElementType*>(), lda,
-                                                   &beta,
-                                                   mp_cptr->data<ElementType*>(), ldc,
-                                                   batchC);
-  unsetTensorMode(cublasHandle);
-
-  allocator->free(mp_aptr);
-  allocator->free(mp_bptr);
-  allocator->free(mp_cptr);
+  batchedGemm<ElementType, ComputeType>(backend, allocator, opB, opA, n, m, k, alpha, bOp, ldb, aOp, lda, beta, cOp, ldc, batchC);
 }
 
 // @TODO: add version with compute type for completeness
@@ -504,49 +512,18 @@ void ProdBatchedTypedLegacy(marian::Tensor C,
   cublasOperation_t opB = transB ? CUBLAS_OP_T : CUBLAS_OP_N;
 
   auto backend = std::static_pointer_cast<gpu::Backend>(C->getBackend());
-  auto cublasHandle = backend->getCublasHandle();
-  auto compute = backend->getCudaComputeCapability();
 
   auto strideA = batchA == 1 ? 0 : m * k;
   auto strideB = batchB == 1 ? 0 : n * k;
   auto strideC = n * m;
   auto batchC = std::max(batchA, batchB);
 
-  std::vector<const ElementType*> aptr;
-  std::vector<const ElementType*> bptr;
-  std::vector<ElementType*> cptr;
+  BatchedGemmOperand aOp(A->data<ElementType>()), bOp(B->data<ElementType>()), cOp(C->data<ElementType>());
+  aOp.add(1, batchA, (size_t)strideA * sizeof(ElementType));
+  bOp.add(1, batchB, (size_t)strideB * sizeof(ElementType));
+  cOp.add(1, batchC, (size_t)strideC * sizeof(ElementType));
 
-  for(int i = 0; i < batchC; i++) {
-    aptr.push_back(A->data<ElementType>() + (i % batchA) * strideA);
-    bptr.push_back(B->data<ElementType>() + (i % batchB) * strideB);
-    cptr.push_back(C->data<ElementType>() + i * strideC);
-  }
-
-  // auto fails here from weird reason
-  IPtr<MemoryPiece> mp_aptr = allocator->alloc<const ElementType*>(aptr.size());
-  CudaCopy(aptr.data(), aptr.data() + aptr.size(), mp_aptr->data<const ElementType*>());
-
-  IPtr<MemoryPiece> mp_bptr = allocator->alloc<const ElementType*>(bptr.size());
-  CudaCopy(bptr.data(), bptr.data() + bptr.size(), mp_bptr->data<const ElementType*>());
-
-  IPtr<MemoryPiece> mp_cptr = allocator->alloc<ElementType*>(cptr.size());
-  CudaCopy(cptr.data(), cptr.data() + cptr.size(), mp_cptr->data<ElementType*>());
-
-  setTensorMode(cublasHandle);
-  TypedGemm<ElementType, ComputeType>::batchedGemm(cublasHandle, compute,
-                                                   opB, opA,
-                                                   n, m, k,
-                                                   &alpha,
-                                                   mp_bptr->data<const ElementType*>(), ldb,
-                                                   mp_aptr->data<const ElementType*>(), lda,
-                                                   &beta,
-                                                   mp_cptr->data<ElementType*>(), ldc,
-                                                   batchC);
-  unsetTensorMode(cublasHandle);
-
-  allocator->free(mp_aptr);
-  allocator->free(mp_bptr);
-  allocator->free(mp_cptr);
+  batchedGemm<ElementType, ComputeType>(backend, allocator, opB, opA, n, m, k, alpha, bOp, ldb, aOp, lda, beta, cOp, ldc, batchC);
 }
 
 // @TODO: add version with compute type for completeness
@@ -573,6 +550,60 @@ void ProdBatchedLegacy(marian::Tensor C,
   }
 }
 
+template <typename ElementType, typename ComputeType>
+void ProdBatchedHeadsTyped(marian::Tensor C,
+                           Ptr<Allocator> allocator,
+                           const marian::Tensor A,
+                           const marian::Tensor B,
+                           bool scores,
+                           int numHeads,
+                           ComputeType scalar) {
+  CUDA_CHECK(cudaSetDevice((int)C->getDeviceId().no));
+  ComputeType alpha = scalar;
+  ComputeType beta = 0;
+
+  HeadsGemm g(C, A, B, scores, numHeads);
+  int batchC = (int)g.offsetsC.size();
+
+  // GEMM i is head i % numHeads of batch entry i / numHeads, with the same offsets as g.offsetsA/B/C
+  size_t size = sizeof(ElementType);
+  BatchedGemmOperand aOp(A->data<ElementType>()), bOp(B->data<ElementType>()), cOp(C->data<ElementType>());
+  BatchedGemmOperand& joined = scores ? aOp : cOp;
+  BatchedGemmOperand& split  = scores ? cOp : aOp;
+  joined.add(numHeads, INT_MAX, g.joinedA * size);
+  joined.add(1, numHeads, (size_t)g.dimHead * size);
+  split.add(1, INT_MAX, g.matrix * size);
+  bOp.add(numHeads, g.batchB, g.joinedB * size);
+  bOp.add(1, numHeads, (size_t)g.dimHead * size);
+
+  auto backend = std::static_pointer_cast<gpu::Backend>(C->getBackend());
+
+  // column-major cuBLAS computes C^T = op(B)^T * A^T, as in ProdBatchedTypedLegacy()
+  batchedGemm<ElementType, ComputeType>(backend, allocator,
+                                        g.transB ? CUBLAS_OP_T : CUBLAS_OP_N, CUBLAS_OP_N,
+                                        g.n, g.m, g.k,
+                                        alpha, bOp, g.ldb, aOp, g.lda,
+                                        beta, cOp, g.ldc, batchC);
+}
+
+void ProdBatchedHeads(marian::Tensor C,
+                      Ptr<Allocator> allocator,
+                      const marian::Tensor A,
+                      const marian::Tensor B,
+                      bool scores,
+                      int numHeads,
+                      float scalar) {
+  if(C->type() == Type::float32) {
+    ProdBatchedHeadsTyped<float, float>(C, allocator, A, B, scores, numHeads, scalar);
+#if COMPILE_FP16
+  } else if(C->type() == Type::float16) { // compute type float as for ProdBatchedLegacy()
+    ProdBatchedHeadsTyped<half, float>(C, allocator, A, B, scores, numHeads, scalar);
+#endif
+  } else {
+    ABORT("ProdBatchedHeads not implemented for element type {}", C->type());
+  }
+}
+
 
 #if CUDA_VERSION >= 11000 // Earlier versions of cublasLT do not support bias addition for fp32 and fp16.
 
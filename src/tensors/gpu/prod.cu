@@ -2,6 +2,7 @@
 #include "tensors/tensor.h"
 #include "tensors/gpu/cuda_helpers.h"
 #include "tensors/gpu/backend.h"
+#include "tensors/gpu/prod.h"
 
 namespace marian {
 namespace gpu {
@@ -32,6 +33,36 @@ struct reluAct {
   }
 };
 
+__device__ static inline void* gOperandPointer(const BatchedGemmOperand& op, int i) {
+  const uint8_t* p = op.base;
+  for(int t = 0; t < op.terms; ++t)
+    p += (size_t)((i / op.div[t]) % op.mod[t]) * op.stride[t];
+  return (void*)p;
+}
+
+__global__ static void gBatchedGemmPointers(void** pointers,
+                                            BatchedGemmOperand a,
+                                            BatchedGemmOperand b,
+                                            BatchedGemmOperand c,
+                                            int batch) {
+  for(int i = blockIdx.x * blockDim.x + threadIdx.x; i < batch; i += blockDim.x * gridDim.x) {
+    pointers[i]             = gOperandPointer(a, i);
+    pointers[batch + i]     = gOperandPointer(b, i);
+    pointers[2 * batch + i] = gOperandPointer(c, i);
+  }
+}
+
+void BatchedGemmPointers(void** pointers,
+                         const BatchedGemmOperand& a,
+                         const BatchedGemmOperand& b,
+                         const BatchedGemmOperand& c,
+                         int batch) {
+  int threads = std::min(MAX_THREADS, batch);
+  int blocks  = std::min(MAX_BLOCKS, batch / threads + (batch % threads != 0));
+  gBatchedGemmPointers<<<blocks, threads>>>(pointers, a, b, c, batch);
+  CUDA_CHECK(cudaGetLastError());
+}
+
 void BiasAdd(marian::Tensor C, const marian::Tensor& bias, bool do_relu) {
   auto backend = std::static_pointer_cast<gpu::Backend>(C->getBackend());
   CUDA_CHECK(cudaSetDevice(backend->getDeviceId().no));
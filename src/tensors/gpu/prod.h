@@ -1,11 +1,43 @@
 #pragma once
 
+#include "tensors/fp8.h"
 #include "tensors/tensor.h"
 #include "tensors/tensor_operators.h"
 
 namespace marian {
 namespace gpu {
 
+// Address of matrix i of one operand of a batched GEMM, base plus the sum of ((i / div) % mod) * stride in bytes
+// over up to MAX_TERMS terms. This covers the broadcasting of bdot() and the heads of HeadsGemm, so the arrays of
+// matrix pointers can be written on the device by BatchedGemmPointers().
+struct BatchedGemmOperand {
+  static const int MAX_TERMS = 4;
+
+  const uint8_t* base{nullptr};
+  int terms{0};
+  int div[MAX_TERMS];
+  int mod[MAX_TERMS];
+  size_t stride[MAX_TERMS];
+
+  BatchedGemmOperand(const void* base) : base((const uint8_t*)base) {}
+
+  void add(int d, int m, size_t s) {
+    ABORT_IF(terms == MAX_TERMS, "Too many terms for the matrices of a batched GEMM");
+    div[terms] = d;
+    mod[terms] = m;
+    stride[terms++] = s;
+  }
+};
+
+// Writes the addresses of the batch matrices of a, b and c to pointers[0, batch), [batch, 2 * batch) and
+// [2 * batch, 3 * batch) with a kernel, instead of copying them from the host and waiting for the copy.
+// The kernel is also part of a CUDA graph when the GEMM is captured, see gpu::Backend::runForward().
+void BatchedGemmPointers(void** pointers,
+                         const BatchedGemmOperand& a,
+                         const BatchedGemmOperand& b,
+                         const BatchedGemmOperand& c,
+                         int batch);
+
 void BiasAdd(marian::Tensor C,
              const marian::Tensor& bias,
              bool do_relu = false);
@@ -38,6 +70,25 @@ void Prod(marian::Tensor C,
           float beta = 0,
           float scalar = 1);
 
+// C = scalar * op(A) * op(B) + beta * C in FP8 with float32 accumulation, for --fp8. Both operands are converted to
+// FP8 with the current scale of their scaling, which also collects their amax, see Fp8ScalingState. A, B and C are
+// float32 or float16 and treated as matrices like in Prod(). Returns false without computing anything if FP8 GEMMs
+// are disabled or not available for these shapes, e.g. if rows of C are not aligned to 16 bytes.
+bool ProdFp8(marian::Tensor C,
+             Ptr<Allocator> allocator,
+             const marian::Tensor& A,
+             const marian::Tensor& B,
+             bool transA,
+             bool transB,
+             float beta,
+             float scalar,
+             const Fp8Operand& fp8A,
+             const Fp8Operand& fp8B);
+
+// Moves the amax of the current step of the scaling into its history and computes the scale for the next step
+// from the history. Called once per step for every operand, before its first ProdFp8() in that step.
+void Fp8NextStep(Ptr<marian::Backend> backend, const Fp8Operand& operand);
+
 void ProdBatched(marian::Tensor C,
                  Ptr<Allocator> allocator,
                  const marian::Tensor A,
@@ -258,15 +258,15 @@ void ConcatCont(Tensor out, const std::vector<Tensor>& inputs, int axis) {
       size_t size = (in->shape().elements() / step) * sizeOf(out->type());
       size_t offset2 = i * size;
 
-      cudaMemcpy(out->data<uint8_t>() + offset1,
-                 in->data<uint8_t>() + offset2,
-                 size,
-                 cudaMemcpyDeviceToDevice);
+      CUDA_CHECK(cudaMemcpyAsync(out->data<uint8_t>() + offset1,
+                                 in->data<uint8_t>() + offset2,
+                                 size,
+                                 cudaMemcpyDeviceToDevice));
 
       offset1 += size;
     }
   }
-  cudaStreamSynchronize(0);
+  synchronizeUnlessCapturing();
 }
 
 template <bool add, typename T>
@@ -326,7 +326,7 @@ void Concatenate1(Tensor out, const std::vector<Tensor>& inputs) {
     }
     offset += cols_in;
   }
-  cudaStreamSynchronize(0);
+  synchronizeUnlessCapturing();
 }
 
 template <typename T>
@@ -412,7 +412,7 @@ void Concatenate2(Tensor out, Tensor in1, Tensor in2) {
     ABORT("Concatenate2 not implemented for type {}", out->type());
   }
 
-  cudaStreamSynchronize(0);
+  synchronizeUnlessCapturing();
 }
 
 void Concatenate(Tensor out, const std::vector<Tensor>& inputs, int ax) {
@@ -452,7 +452,7 @@ void Split1(std::vector<Tensor>& outputs, const Tensor in) {
 
     offset += cols_out;
   }
-  cudaStreamSynchronize(0);
+  synchronizeUnlessCapturing();
 }
 
 // @TODO: this function is just a temporary fix until I come up with
@@ -502,7 +502,7 @@ void SplitCont(std::vector<Tensor>& outputs, const Tensor in, int axis) {
       offset1 += size;
     }
   }
-  cudaStreamSynchronize(0);
+  synchronizeUnlessCapturing();
 }
 
 void Deconcatenate(std::vector<Tensor>& outputs, const Tensor in, int ax) {
@@ -836,6 +836,242 @@ void SinusoidalPositionEmbeddings(Tensor out, int start) {
   }
 }
 
+// one block per group of rows as in gSinusoidalPositionEmbeddings, see cpu::EmbedWithPositions()
+template <typename T>
+__global__ void gEmbedWithPositions(T* out,
+                                    const T* embeddings,
+                                    const IndexType* indices,
+                                    const float* weights,  // nullptr for one embedding per row
+                                    const IndexType* offsets,
+                                    int rows,
+                                    int cols,
+                                    float scale,
+                                    int start,
+                                    int stride,
+                                    int dimPositions) {
+  using namespace functional;
+
+  int numTimescales = cols / 2;
+  float logTimescaleIncrement = Ops<float>::log(10000.f) / ((float)cols / 2.f - 1.f);
+
+  for(int bid = 0; bid < rows; bid += gridDim.x) {
+    int j = bid + blockIdx.x;
+    if(j < rows) {
+      T* outRow = out + (size_t)j * cols;
+      float position = (float)((j / stride) % dimPositions + start);
+      for(int tid = 0; tid < cols; tid += blockDim.x) {
+        int i = tid + threadIdx.x;
+        if(i < cols) {
+          float sum = 0.f;
+          if(weights) {
+            for(IndexType k = offsets[j]; k < offsets[j + 1]; ++k)
+              sum += weights[k] * (float)embeddings[(size_t)indices[k] * cols + i];
+          } else {
+            sum = (float)embeddings[(size_t)indices[j] * cols + i];
+          }
+          float v = position * Ops<float>::exp((float)(i % numTimescales) * -logTimescaleIncrement);
+          outRow[i] = (T)(scale * sum + (i < numTimescales ? Ops<float>::sin(v) : Ops<float>::cos(v)));
+        }
+      }
+    }
+  }
+}
+
+void EmbedWithPositions(Tensor out,
+                        const Tensor embeddings,
+                        const Tensor indices,
+                        const Tensor weights,
+                        const Tensor offsets,
+                        float scale,
+                        int start,
+                        int positionAxis) {
+  cudaSetDevice(out->getDeviceId().no);
+  ABORT_IF(out->type() != embeddings->type(), "Embeddings {} and output {} differ in type", embeddings->type(), out->type());
+  ABORT_IF((weights == nullptr) != (offsets == nullptr), "Embedding weights and offsets come together");
+  if(weights)
+    matchOrAbort<float>(weights->type());
+
+  const auto& shape = out->shape();
+  int cols = shape[-1];
+  int rows = (int)(shape.elements() / cols);
+  int axis = shape.axis(positionAxis);
+  ABORT_IF(axis == shape.size() - 1, "Positions cannot run along the embedding axis");
+  int stride = 1;
+  for(int i = axis + 1; i < shape.size() - 1; ++i)
+    stride *= shape[i];
+
+  int blocks = std::min(MAX_BLOCKS, rows);
+  int threads = std::min(MAX_THREADS, cols);
+
+  const IndexType* idx = indices->data<IndexType>();
+  const float* w = weights ? weights->data<float>() : nullptr;
+  const IndexType* offs = offsets ? offsets->data<IndexType>() : nullptr;
+
+  if(out->type() == Type::float32) {
+    gEmbedWithPositions<float><<<blocks, threads>>>(out->data<float>(), embeddings->data<float>(), idx, w, offs,
+                                                    rows, cols, scale, start, stride, shape[axis]);
+#if COMPILE_FP16
+  } else if (out->type() == Type::float16) {
+    gEmbedWithPositions<half><<<blocks, threads>>>(out->data<half>(), embeddings->data<half>(), idx, w, offs,
+                                                   rows, cols, scale, start, stride, shape[axis]);
+#endif
+  } else {
+    ABORT("EmbedWithPositions not implemented for type {}", out->type());
+  }
+}
+
+
+// one thread per element, all threads of a warp run the same instruction, see cpu::FusedElement()
+__global__ void gFusedElement(float* out, FusedElementArgs args, int size) {
+  for(int bid = 0; bid < size; bid += blockDim.x * gridDim.x) {
+    int index = bid + blockDim.x * blockIdx.x + threadIdx.x;
+    if(index < size)
+      out[index] = args(index);
+  }
+}
+
+void FusedElement(Tensor out, const std::vector<Tensor>& inputs, const FusedProgram& program) {
+  cudaSetDevice(out->getDeviceId().no);
+  matchOrAbort<float>(out->type());
+  FusedElementArgs args(out, inputs, program);
+
+  int size = (int)out->size();
+  if(size == 0)
+    return;
+  int threads = std::min(MAX_THREADS, size);
+  int blocks = std::min(MAX_BLOCKS, size / threads + (size % threads != 0));
+  gFusedElement<<<blocks, threads>>>(out->data(), args, size);
+  CUDA_CHECK(cudaGetLastError());
+}
+
+// one thread per element, see cpu::FusedAdam()
+template <typename T, typename G, typename O>
+__global__ void gFusedAdam(T* p, const G* g, T* m, T* v, T* a, O* o, FusedAdamArgs args, int size) {
+  for(int bid = 0; bid < size; bid += blockDim.x * gridDim.x) {
+    int i = bid + blockDim.x * blockIdx.x + threadIdx.x;
+    if(i < size) {
+      float mi = (float)m[i], vi = (float)v[i];
+      float pi = args.apply((float)p[i], (float)g[i], mi, vi);
+      m[i] = (T)mi;
+      v[i] = (T)vi;
+      p[i] = (T)pi;
+      if(a)
+        a[i] = (T)args.smooth((float)a[i], pi);
+      if(o)
+        o[i] = (O)pi;
+    }
+  }
+}
+
+template <typename T, typename G, typename O>
+static void FusedAdamTyped(Tensor params, const Tensor grads, Tensor mt, Tensor vt, Tensor avg, Tensor out,
+                           const FusedAdamArgs& args) {
+  int size = (int)params->size();
+  if(size == 0)
+    return;
+  int threads = std::min(MAX_THREADS, size);
+  int blocks = std::min(MAX_BLOCKS, size / threads + (size % threads != 0));
+  gFusedAdam<T, G, O><<<blocks, threads>>>(params->data<T>(), grads->data<G>(), mt->data<T>(), vt->data<T>(),
+                                           avg ? avg->data<T>() : nullptr, out ? out->data<O>() : nullptr, args, size);
+  CUDA_CHECK(cudaGetLastError());
+}
+
+void FusedAdam(Tensor params, const Tensor grads, Tensor mt, Tensor vt, Tensor avg, Tensor out,
+               const FusedAdamArgs& args) {
+  cudaSetDevice(params->getDeviceId().no);
+  size_t n = params->size();
+  ABORT_IF(grads->size() != n || mt->size() != n || vt->size() != n || (avg && avg->size() != n) || (out && out->size() != n),
+           "FusedAdam() over tensors of different sizes");
+  ABORT_IF(out && out->type() != grads->type(), "FusedAdam() output of type {} for gradients of type {}", out->type(), grads->type());
+  if(params->type() == Type::float32 && grads->type() == Type::float32)
+    FusedAdamTyped<float, float, float>(params, grads, mt, vt, avg, out, args);
+#if COMPILE_FP16
+  else if(params->type() == Type::float32 && grads->type() == Type::float16)
+    FusedAdamTyped<float, half, half>(params, grads, mt, vt, avg, out, args);
+  else if(params->type() == Type::float16 && grads->type() == Type::float16)
+    FusedAdamTyped<half, half, half>(params, grads, mt, vt, avg, out, args);
+#endif
+  else
+    ABORT("FusedAdam() not implemented for parameters of type {} and gradients of type {}", params->type(), grads->type());
+}
+
+// one thread block per block of Adam8bitCodec, which finds the new maxima of the moments in shared memory
+template <typename G>
+__global__ void gFusedAdam8bit(float* p, const G* g, int8_t* mq, uint8_t* vq, float* mMax, float* vMax, float* a, G* o,
+                               FusedAdamArgs args, int size, int blocks) {
+  __shared__ float mShared[Adam8bitCodec::BLOCK];
+  __shared__ float vShared[Adam8bitCodec::BLOCK];
+  int t = threadIdx.x;
+  for(int b = blockIdx.x; b < blocks; b += gridDim.x) {
+    int j = b * Adam8bitCodec::BLOCK + t;
+    float m = 0.f, v = 0.f;
+    if(j < size) {
+      m = Adam8bitCodec::decodeM(mq[j], mMax[b]);
+      v = Adam8bitCodec::decodeV(vq[j], vMax[b]);
+      float pj = args.apply(p[j], (float)g[j], m, v);
+      p[j] = pj;
+      if(a)
+        a[j] = args.smooth(a[j], pj);
+      if(o)
+        o[j] = (G)pj;
+    }
+    mShared[t] = fabsf(m);
+    vShared[t] = v;
+    __syncthreads();
+    for(int s = Adam8bitCodec::BLOCK / 2; s > 0; s >>= 1) {
+      if(t < s) {
+        mShared[t] = fmaxf(mShared[t], mShared[t + s]);
+        vShared[t] = fmaxf(vShared[t], vShared[t + s]);
+      }
+      __syncthreads();
+    }
+    float mNew = mShared[0], vNew = vShared[0];
+    if(j < size) {
+      mq[j] = Adam8bitCodec::encodeM(m, mNew);
+      vq[j] = Adam8bitCodec::encodeV(v, vNew);
+    }
+    if(t == 0) {
+      mMax[b] = mNew;
+      vMax[b] = vNew;
+    }
+    __syncthreads(); // before the shared memory is reused
+  }
+}
+
+template <typename G>
+static void FusedAdam8bitTyped(Tensor params, const Tensor grads, Tensor mq, Tensor vq, Tensor scales, Tensor avg,
+                               Tensor out, const FusedAdamArgs& args) {
+  int size = (int)params->size();
+  if(size == 0)
+    return;
+  int blocks = (size + Adam8bitCodec::BLOCK - 1) / Adam8bitCodec::BLOCK;
+  float* mMax = scales->data<float>();
+  gFusedAdam8bit<G><<<std::min(MAX_BLOCKS, blocks), Adam8bitCodec::BLOCK>>>(
+      params->data<float>(), grads->data<G>(), mq->data<int8_t>(), vq->data<uint8_t>(), mMax, mMax + blocks,
+      avg ? avg->data<float>() : nullptr, out ? out->data<G>() : nullptr, args, size, blocks);
+  CUDA_CHECK(cudaGetLastError());
+}
+
+void FusedAdam8bit(Tensor params, const Tensor grads, Tensor mq, Tensor vq, Tensor scales, Tensor avg, Tensor out,
+                   const FusedAdamArgs& args) {
+  cudaSetDevice(params->getDeviceId().no);
+  size_t n = params->size();
+  size_t blocks = (n + Adam8bitCodec::BLOCK - 1) / Adam8bitCodec::BLOCK;
+  ABORT_IF(grads->size() != n || mq->size() != n || vq->size() != n || scales->size() != 2 * blocks
+           || (avg && avg->size() != n) || (out && out->size() != n),
+           "FusedAdam8bit() over tensors of different sizes");
+  ABORT_IF(params->type() != Type::float32 || mq->type() != Type::int8 || vq->type() != Type::uint8,
+           "FusedAdam8bit() requires float32 parameters and int8 and uint8 moments");
+  ABORT_IF(out && out->type() != grads->type(), "FusedAdam8bit() output of type {} for gradients of type {}", out->type(), grads->type());
+  if(grads->type() == Type::float32)
+    FusedAdam8bitTyped<float>(params, grads, mq, vq, scales, avg, out, args);
+#if COMPILE_FP16
+  else if(grads->type() == Type::float16)
+    FusedAdam8bitTyped<half>(params, grads, mq, vq, scales, avg, out, args);
+#endif
+  else
+    ABORT("FusedAdam8bit() not implemented for gradients of type {}", grads->type());
+}
 
 // @TODO: refactor to reuse code from softmax, add comments
 template <typename T, typename AccType = float>
@@ -947,6 +1183,237 @@ void LogSoftmax(Tensor out, Tensor in) {
   }
 }
 
+// Fused shortlisted output layer, one block per query: each warp computes the logits of some of the
+// selected rows of W with coalesced reads of these rows, then the block normalizes the row of logits
+// in the output, see logsoftmax_shortlist()
+__global__ void gLogSoftmaxShortlist(float* out,
+                                     const float* x,
+                                     const float* W,
+                                     const IndexType* indices,
+                                     const float* bias,
+                                     int numQueries,
+                                     int numIndexRows,
+                                     int k,
+                                     int dim) {
+  extern __shared__ float _shareShortlist[];
+  float* _x   = _shareShortlist;       // [dim] query
+  float* _red = _shareShortlist + dim; // [blockDim.x] for reductions
+
+  int warp = threadIdx.x / 32;
+  int lane = threadIdx.x % 32;
+  int numWarps = blockDim.x / 32;
+
+  for(int bid = 0; bid < numQueries; bid += gridDim.x) {
+    int q = bid + blockIdx.x;
+    if(q < numQueries) {
+      for(int d = threadIdx.x; d < dim; d += blockDim.x)
+        _x[d] = x[(size_t)q * dim + d];
+      __syncthreads();
+
+      const IndexType* rowIndices = indices + (size_t)(q % numIndexRows) * k;
+      float* so = out + (size_t)q * k;
+      for(int j = warp; j < k; j += numWarps) {
+        const float* w = W + (size_t)rowIndices[j] * dim;
+        float sum = 0.f;
+        for(int d = lane; d < dim; d += 32)
+          sum += _x[d] * w[d];
+        for(int offset = 16; offset > 0; offset /= 2)
+          sum += __shfl_down_sync(0xffffffff, sum, offset);
+        if(lane == 0)
+          so[j] = bias ? sum + bias[rowIndices[j]] : sum;
+      }
+      __syncthreads(); // logits of this block are visible to all its threads
+
+      float max = -CUDA_FLT_MAX;
+      for(int j = threadIdx.x; j < k; j += blockDim.x)
+        max = fmaxf(max, so[j]);
+      _red[threadIdx.x] = max;
+      for(int len = blockDim.x / 2; len > 0; len /= 2) {
+        __syncthreads();
+        if(threadIdx.x < len)
+          _red[threadIdx.x] = fmaxf(_red[threadIdx.x], _red[threadIdx.x + len]);
+      }
+      __syncthreads();
+      max = _red[0];
+      __syncthreads();
+
+      float sum = 0.f;
+      for(int j = threadIdx.x; j < k; j += blockDim.x)
+        sum += __expf(so[j] - max);
+      _red[threadIdx.x] = sum;
+      for(int len = blockDim.x / 2; len > 0; len /= 2) {
+        __syncthreads();
+        if(threadIdx.x < len)
+          _red[threadIdx.x] += _red[threadIdx.x + len];
+      }
+      __syncthreads();
+      float logSum = max + __logf(_red[0]);
+
+      for(int j = threadIdx.x; j < k; j += blockDim.x)
+        so[j] -= logSum;
+    }
+    __syncthreads();
+  }
+}
+
+void LogSoftmaxShortlist(Tensor out, const Tensor x, const Tensor W, const Tensor indices, const Tensor bias) {
+  cudaSetDevice(out->getDeviceId().no);
+
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(x->type());
+  matchOrAbort<float>(W->type());
+  matchOrAbort<IndexType>(indices->type());
+
+  int dim = x->shape()[-1];
+  int k = out->shape()[-1];
+  int numQueries = out->shape().elements() / k;
+  int numIndexRows = indices->shape().elements() / k;
+
+  const int threads = 256; // power of 2 for the reductions, multiple of the warp size
+  int blocks = std::min(MAX_BLOCKS, numQueries);
+  size_t shared = (dim + threads) * sizeof(float);
+  ABORT_IF(shared > 48000, "Dimension {} too large for shortlisted output layer", dim);
+
+  gLogSoftmaxShortlist<<<blocks, threads, shared>>>(out->data<float>(),
+                                                    x->data<float>(),
+                                                    W->data<float>(),
+                                                    indices->data<IndexType>(),
+                                                    bias ? bias->data<float>() : nullptr,
+                                                    numQueries,
+                                                    numIndexRows,
+                                                    k,
+                                                    dim);
+  CUDA_CHECK(cudaGetLastError());
+}
+
+// Orders floats like their values as unsigned integers, so that thresholds can be bisected bit by bit
+__device__ inline unsigned int orderedKey(float x) {
+  unsigned int u = __float_as_uint(x);
+  return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+// Sum (or maximum) of value over the threads of the block, _red has blockDim.x elements
+template <bool isMax>
+__device__ inline float blockReduce(float value, float* _red) {
+  _red[threadIdx.x] = value;
+  for(int len = blockDim.x / 2; len > 0; len /= 2) {
+    __syncthreads();
+    if(threadIdx.x < len)
+      _red[threadIdx.x] = isMax ? fmaxf(_red[threadIdx.x], _red[threadIdx.x + len])
+                                : _red[threadIdx.x] + _red[threadIdx.x + len];
+  }
+  __syncthreads();
+  float result = _red[0];
+  __syncthreads();
+  return result;
+}
+
+// Gumbel-max sampling with truncation, one block per row. Instead of sorting the row, the threshold of top-k and
+// nucleus truncation is found bit by bit from the ordered key of the smallest kept logit, with one reduction of the
+// count or probability mass of the logits above each candidate, see gumbel_sampling()
+__global__ void gGumbelSampling(float* out,
+                                const float* logits,
+                                const float* noise,
+                                int rows,
+                                int cols,
+                                SamplingMethod method,
+                                float param,
+                                float temperature,
+                                bool normalize) {
+  extern __shared__ float _shareSampling[]; // [blockDim.x] for reductions
+  const float minusInf = __int_as_float(0xff800000);
+
+  for(int bid = 0; bid < rows; bid += gridDim.x) {
+    int j = bid + blockIdx.x;
+    if(j < rows) {
+      const float* sp = logits + (size_t)j * cols;
+      const float* sg = noise + (size_t)j * cols;
+      float* so = out + (size_t)j * cols;
+
+      unsigned int minKey = 0; // keeps all logits
+      if(method != SamplingMethod::Full) {
+        float max = minusInf;
+        for(int i = threadIdx.x; i < cols; i += blockDim.x)
+          max = fmaxf(max, sp[i]);
+        max = blockReduce<true>(max, _shareSampling);
+
+        float logSum = 0.f;
+        if(normalize && method != SamplingMethod::TopK) {
+          float sum = 0.f;
+          for(int i = threadIdx.x; i < cols; i += blockDim.x)
+            sum += __expf(sp[i] - max);
+          logSum = max + __logf(blockReduce<false>(sum, _shareSampling));
+        }
+
+        if(method == SamplingMethod::Epsilon) {
+          minKey = orderedKey(fminf(max, __logf(param) + logSum)); // keeps at least the best logit
+        } else {
+          // the largest key of which the logits at least as large are at least k or have a mass above param
+          for(int bit = 31; bit >= 0; --bit) {
+            unsigned int candidate = minKey | (1u << bit);
+            float above = 0.f;
+            for(int i = threadIdx.x; i < cols; i += blockDim.x)
+              if(orderedKey(sp[i]) >= candidate)
+                above += method == SamplingMethod::TopK ? 1.f : __expf(sp[i] - logSum);
+            above = blockReduce<false>(above, _shareSampling);
+            if(method == SamplingMethod::TopK ? above >= param : above > param)
+              minKey = candidate;
+          }
+        }
+      }
+
+      float max = minusInf;
+      for(int i = threadIdx.x; i < cols; i += blockDim.x) {
+        so[i] = orderedKey(sp[i]) >= minKey ? sp[i] / temperature + sg[i] : minusInf;
+        max = fmaxf(max, so[i]);
+      }
+      max = blockReduce<true>(max, _shareSampling);
+
+      float sum = 0.f;
+      for(int i = threadIdx.x; i < cols; i += blockDim.x)
+        sum += __expf(so[i] - max);
+      float logSum = max + __logf(blockReduce<false>(sum, _shareSampling));
+
+      for(int i = threadIdx.x; i < cols; i += blockDim.x)
+        so[i] -= logSum;
+    }
+    __syncthreads();
+  }
+}
+
+void GumbelSampling(Tensor out,
+                    const Tensor logits,
+                    const Tensor noise,
+                    SamplingMethod method,
+                    float param,
+                    float temperature,
+                    bool normalize) {
+  cudaSetDevice(out->getDeviceId().no);
+
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(logits->type());
+  matchOrAbort<float>(noise->type());
+
+  int cols = out->shape()[-1];
+  int rows = out->shape().elements() / cols;
+
+  if(method == SamplingMethod::TopK)
+    param = (float)std::min(std::max((int)param, 1), cols);
+
+  const int threads = 256; // power of 2 for the reductions
+  int blocks = std::min(MAX_BLOCKS, rows);
+  gGumbelSampling<<<blocks, threads, threads * sizeof(float)>>>(out->data<float>(),
+                                                                logits->data<float>(),
+                                                                noise->data<float>(),
+                                                                rows,
+                                                                cols,
+                                                                method,
+                                                                param,
+                                                                temperature,
+                                                                normalize);
+  CUDA_CHECK(cudaGetLastError());
+}
+
 ///////////////////////////////////////////////////////
 
 template <typename T, typename AccType = float>
@@ -2698,6 +3165,296 @@ void RMSNormalizationGrad(Ptr<Allocator> allocator,
     allocator->free(tempOnesMemory);
 }
 
+// Sum of v over the threads of a block, with the same tree reduction as the kernels above
+template <typename AccType>
+__device__ inline AccType gBlockSum(AccType* shared, AccType v) {
+  shared[threadIdx.x] = v;
+  __syncthreads();
+  int len = blockDim.x;
+  while(len != 1) {
+    __syncthreads();
+    int skip = (len + 1) >> 1;
+    if(threadIdx.x < (len >> 1))
+      shared[threadIdx.x] += shared[threadIdx.x + skip];
+    len = (len + 1) >> 1;
+  }
+  __syncthreads();
+  AccType sum = shared[0];
+  __syncthreads(); // shared is reused by the next reduction
+  return sum;
+}
+
+// Input of the normalization in AddNormalization(), in * mask + residual. The mask repeats every maskRows rows,
+// e.g. for dropout over the axes {-2, -1} of [beam, batch, steps, dim] it is [steps, dim].
+template <typename T, typename AccType>
+__device__ inline AccType gAddNormInput(const T* in, const T* mask, const T* residual, int j, int cols, int maskRows, int id) {
+  AccType xv = (AccType)in[j * cols + id];
+  if(mask)
+    xv *= (AccType)mask[(j % maskRows) * cols + id];
+  return xv + (AccType)residual[j * cols + id];
+}
+
+template <typename T, typename AccType, bool rms>
+__global__ void gAddNormalization(T* out,
+                                  const T* in,
+                                  const T* mask,
+                                  const T* residual,
+                                  const T* gamma,
+                                  const T* beta,
+                                  int rows,
+                                  int cols,
+                                  int maskRows,
+                                  AccType eps) {
+  extern __shared__ uint8_t _sharedBytes[];
+  AccType* shared = (AccType*)_sharedBytes;
+
+  AccType N = cols;
+
+  for(int bid = 0; bid < rows; bid += gridDim.x) {
+    int j = bid + blockIdx.x;
+    if(j < rows) {
+      AccType mean = (AccType)0.f;
+      if(!rms) {
+        AccType sum = (AccType)0.f;
+        for(int id = threadIdx.x; id < cols; id += blockDim.x)
+          sum += gAddNormInput<T, AccType>(in, mask, residual, j, cols, maskRows, id);
+        mean = gBlockSum(shared, sum) / N;
+      }
+
+      AccType sqSum = (AccType)0.f;
+      for(int id = threadIdx.x; id < cols; id += blockDim.x) {
+        AccType ex = gAddNormInput<T, AccType>(in, mask, residual, j, cols, maskRows, id) - mean;
+        sqSum += ex * ex;
+      }
+      AccType sigma = functional::Ops<AccType>::sqrt(gBlockSum(shared, sqSum) / N + eps);
+
+      T* yRow = out + j * cols;
+      for(int id = threadIdx.x; id < cols; id += blockDim.x) {
+        AccType xv     = gAddNormInput<T, AccType>(in, mask, residual, j, cols, maskRows, id);
+        AccType gammav = (AccType)gamma[id];
+        AccType betav  = beta ? (AccType)beta[id] : (AccType)0.f;
+        yRow[id]       = (T)(gammav * (xv - mean) / sigma + betav);
+      }
+    }
+  }
+}
+
+static int addNormMaskRows(Tensor mask, int cols) {
+  return mask ? (int)(mask->shape().elements() / cols) : 1;
+}
+
+void AddNormalization(Tensor out,
+                      Tensor in,
+                      Tensor mask,
+                      Tensor residual,
+                      Tensor gamma,
+                      Tensor beta,
+                      float eps,
+                      bool rms) {
+  cudaSetDevice(out->getDeviceId().no);
+
+  int rows = in->shape().elements() / in->shape().back();
+  int cols = in->shape().back();
+  int maskRows = addNormMaskRows(mask, cols);
+
+  int blocks = std::min(MAX_BLOCKS, (int)rows);
+  int threads = std::min(MAX_THREADS, (int)cols);
+  int shared = threads * sizeof(float);
+
+  if(out->type() == Type::float32) {
+    auto kernel = rms ? gAddNormalization<float, float, true> : gAddNormalization<float, float, false>;
+    kernel<<<blocks, threads, shared>>>(out->data<float>(),
+                                        in->data<float>(),
+                                        mask ? mask->data<float>() : nullptr,
+                                        residual->data<float>(),
+                                        gamma->data<float>(),
+                                        beta ? beta->data<float>() : nullptr,
+                                        rows,
+                                        cols,
+                                        maskRows,
+                                        eps);
+#if COMPILE_FP16
+  } else if (out->type() == Type::float16) {
+    auto kernel = rms ? gAddNormalization<half, float, true> : gAddNormalization<half, float, false>;
+    kernel<<<blocks, threads, shared>>>(out->data<half>(),
+                                        in->data<half>(),
+                                        mask ? mask->data<half>() : nullptr,
+                                        residual->data<half>(),
+                                        gamma->data<half>(),
+                                        beta ? beta->data<half>() : nullptr,
+                                        rows,
+                                        cols,
+                                        maskRows,
+                                        eps);
+#endif
+  } else {
+    ABORT("AddNormalization not implemented for type {}", out->type());
+  }
+}
+
+// Same gradient as gLayerNormalizationGrad() and gRMSNormalizationGrad() with respect to the sum, which is then
+// propagated to in (through the mask) and to residual. gradIn and gradResidual are null if not trainable.
+template <typename T, typename AccType, bool rms>
+__global__ void gAddNormalizationGrad(T* gradIn,
+                                      T* gradResidual,
+                                      T* gradGamma,
+                                      const T* adj,
+                                      const T* y,
+                                      const T* in,
+                                      const T* mask,
+                                      const T* residual,
+                                      const T* gamma,
+                                      const T* beta,
+                                      int rows,
+                                      int cols,
+                                      int maskRows,
+                                      AccType eps) {
+  extern __shared__ uint8_t sharedBytes[];
+  AccType* shared = (AccType*)sharedBytes;
+
+  AccType N = cols;
+
+  for(int bid = 0; bid < rows; bid += gridDim.x) {
+    int j = bid + blockIdx.x;
+    if(j < rows) {
+      const T* yRow   =   y + j * cols;
+      const T* adjRow = adj + j * cols;
+
+      AccType sumX = (AccType)0.f, sumAdj = (AccType)0.f, sumAdjL = (AccType)0.f;
+      for(int id = threadIdx.x; id < cols; id += blockDim.x) {
+        AccType betav = beta ? (AccType)beta[id] : (AccType)0.f;
+        AccType adjv  = adjRow[id];
+        AccType lv    = ((AccType)yRow[id] - betav) / (AccType)gamma[id]; // normalized sum from the output
+        if(!rms)
+          sumX += gAddNormInput<T, AccType>(in, mask, residual, j, cols, maskRows, id);
+        sumAdj  += adjv;
+        sumAdjL += adjv * lv;
+      }
+      AccType mean = rms ? (AccType)0.f : gBlockSum(shared, sumX) / N;
+      sumAdj       = rms ? (AccType)0.f : gBlockSum(shared, sumAdj);
+      sumAdjL      = gBlockSum(shared, sumAdjL);
+
+      AccType sqSum = (AccType)0.f;
+      for(int id = threadIdx.x; id < cols; id += blockDim.x) {
+        AccType ex = gAddNormInput<T, AccType>(in, mask, residual, j, cols, maskRows, id) - mean;
+        sqSum += ex * ex;
+      }
+      AccType sigma = functional::Ops<AccType>::sqrt(gBlockSum(shared, sqSum) / N + eps);
+
+      for(int id = threadIdx.x; id < cols; id += blockDim.x) {
+        AccType xv     = gAddNormInput<T, AccType>(in, mask, residual, j, cols, maskRows, id);
+        AccType gammav = (AccType)gamma[id];
+        AccType adjv   = adjRow[id];
+        AccType lv     = (xv - mean) / sigma;
+
+        AccType gradSv = gammav * (N * adjv - lv * sumAdjL - sumAdj) / (N * sigma);
+
+        // same clipping and NaN removal as in gLayerNormalizationGrad()
+        AccType sign = functional::Ops<AccType>::sgn(gradSv);
+        AccType cutoff = (AccType)1000.f;
+        gradSv = functional::Ops<AccType>::abs(gradSv) > cutoff ? sign * cutoff : gradSv;
+        gradSv = isnan(gradSv) ? 0.f : gradSv;
+
+        if(gradIn)
+          gradIn[j * cols + id] += (T)(mask ? gradSv * (AccType)mask[(j % maskRows) * cols + id] : gradSv);
+        if(gradResidual)
+          gradResidual[j * cols + id] += (T)gradSv;
+        if(gradGamma)
+          gradGamma[j * cols + id] = (T)(adjv * lv); // summed up over rows by the caller
+      }
+    }
+  }
+}
+
+void AddNormalizationGrad(Ptr<Allocator> allocator,
+                          Tensor gradIn,
+                          Tensor gradResidual,
+                          Tensor gradGamma,
+                          Tensor gradBeta,
+                          Tensor adj,
+                          Tensor y,
+                          Tensor in,
+                          Tensor mask,
+                          Tensor residual,
+                          Tensor gamma,
+                          Tensor beta,
+                          float eps,
+                          bool rms) {
+  cudaSetDevice(adj->getDeviceId().no);
+  int rows = y->shape().elements() / y->shape()[-1];
+  int cols = y->shape()[-1];
+  int maskRows = addNormMaskRows(mask, cols);
+
+  int threads = std::min(MAX_THREADS, cols);
+  int blocks = std::min(MAX_BLOCKS, rows);
+  int shared = sizeof(float) * threads;
+
+  // per-row gradients of gamma, reduced below with a matrix product as in LayerNormalizationGrad()
+  MemoryPiece::PtrType tempGradGammaMemory;
+  Tensor tempGradGamma;
+  if(gradGamma) {
+    tempGradGammaMemory = allocator->alloc(adj->memory()->size());
+    tempGradGamma = TensorBase::New(tempGradGammaMemory, adj->shape(), adj->type(), adj->getBackend());
+  }
+
+  MemoryPiece::PtrType tempOnesMemory;
+  Tensor tempOnes;
+  if(gradGamma || gradBeta) {
+    tempOnesMemory = allocator->alloc(rows * sizeOf(adj->type()));
+    tempOnes = TensorBase::New(tempOnesMemory, Shape({1, rows}), adj->type(), adj->getBackend());
+    tempOnes->set(1.f);
+  }
+
+  if(adj->type() == Type::float32) {
+    auto kernel = rms ? gAddNormalizationGrad<float, float, true> : gAddNormalizationGrad<float, float, false>;
+    kernel<<<blocks, threads, shared>>>(gradIn ? gradIn->data<float>() : nullptr,
+                                        gradResidual ? gradResidual->data<float>() : nullptr,
+                                        gradGamma ? tempGradGamma->data<float>() : nullptr,
+                                        adj->data<float>(),
+                                        y->data<float>(),
+                                        in->data<float>(),
+                                        mask ? mask->data<float>() : nullptr,
+                                        residual->data<float>(),
+                                        gamma->data<float>(),
+                                        beta ? beta->data<float>() : nullptr,
+                                        rows,
+                                        cols,
+                                        maskRows,
+                                        eps);
+#if COMPILE_FP16
+  } else if (adj->type() == Type::float16) {
+    auto kernel = rms ? gAddNormalizationGrad<half, float, true> : gAddNormalizationGrad<half, float, false>;
+    kernel<<<blocks, threads, shared>>>(gradIn ? gradIn->data<half>() : nullptr,
+                                        gradResidual ? gradResidual->data<half>() : nullptr,
+                                        gradGamma ? tempGradGamma->data<half>() : nullptr,
+                                        adj->data<half>(),
+                                        y->data<half>(),
+                                        in->data<half>(),
+                                        mask ? mask->data<half>() : nullptr,
+                                        residual->data<half>(),
+                                        gamma->data<half>(),
+                                        beta ? beta->data<half>() : nullptr,
+                                        rows,
+                                        cols,
+                                        maskRows,
+                                        eps);
+#endif
+  } else {
+    ABORT("AddNormalizationGrad not implemented for type {}", adj->type());
+  }
+
+  if(gradGamma) {
+    gpu::Prod(gradGamma, tempOnes, tempGradGamma, false, false, 1, 1, Type::float32); // beta set to one to add
+    allocator->free(tempGradGammaMemory);
+  }
+
+  if(gradBeta) // dC/dbeta = adj - inverse broadcasting (reduction)
+    gpu::Prod(gradBeta, tempOnes, adj, false, false, 1, 1, Type::float32); // beta set to one to add
+
+  if(tempOnes)
+    allocator->free(tempOnesMemory);
+}
+
 
 template <bool add, typename T>
 __global__ void gShift(T* out,
@@ -3374,13 +4131,15 @@ __global__ void gMaxPoolingBackward(float* adj,
   int rowId = tid / adjRows;
   int colId = tid % adjRows;
 
-  float* b = in + (rowId * inCols) + (colId * width);
+  // the offset of the window, the last one may be shorter
+  int offset = colId * width;
+  float* b = in + (rowId * inCols) + offset;
+  float* localMask = mask + (rowId / numKernels) * maskCols + offset;
 
   if(colId == adjRows - 1) {
     width = lastWidth;
   }
 
-  float* localMask = mask + (rowId / numKernels) * maskCols + colId * width;
   size_t currentMaxIdx = 0;
   for(int i = 1; i < width; ++i) {
     if(b[i] * localMask[i] > b[currentMaxIdx] * localMask[currentMaxIdx]) {
@@ -3388,7 +4147,7 @@ __global__ void gMaxPoolingBackward(float* adj,
     }
   }
 
-  adjIn[(rowId * inCols) + (colId * width) + currentMaxIdx]
+  adjIn[(rowId * inCols) + offset + currentMaxIdx]
       += adj[rowId + (colId * adjCols)];
 }
 
@@ -3469,177 +4228,5 @@ void Float2Bit(marian::Tensor output, const marian::Tensor input)
   CUDA_CHECK(cudaGetLastError());
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////
-// Calc hamming distance between input and weight hash. Return sorted indices and counts accoding to counting sort algo
-// https://www.geeksforgeeks.org/counting-sort/
-__global__ void HammmingAndSort(const uint32_t *weightHash,
-                      const uint32_t *inputHash,
-                      uint16_t *hamming,
-                      uint32_t *outCounts,
-                      uint32_t *outIdx,
-                      uint32_t kBest, uint16_t minVal, uint16_t maxVal, uint16_t range,
-                      int hashDim, int dim, int batch)
-{
-  extern __shared__ uint32_t sharedCounts[];
-
-  int batchIdx = blockIdx.x;
-
-  uint32_t *stopVal = sharedCounts + range;
-  uint16_t *hammingBatchOffset = hamming
-                              ? hamming + batchIdx * dim
-                              : (uint16_t*) (sharedCounts + range);
-
-  uint32_t *outCountsBatchOffset = outCounts ? outCounts + batchIdx * kBest : nullptr;
-  uint32_t *outIdxBatchOffset = outIdx ? outIdx + batchIdx * kBest : nullptr;
-  const uint32_t *inputHashOffset = inputHash + batchIdx * hashDim;
-
-  // init count array
-  int countsIdx = threadIdx.x;
-  while (countsIdx < range) {
-    sharedCounts[countsIdx] = 0;
-    countsIdx += blockDim.x;
-  }
-
-  __syncthreads();
-  int dimIdx = threadIdx.x;
-  while (dimIdx < dim) {
-    // Hamming distance between input and hashes
-    const uint32_t *weightHashOffset = weightHash + dimIdx * hashDim;
-
-    uint16_t dist = 0;
-    for (int hashDimIdx = 0; hashDimIdx < hashDim; ++hashDimIdx) {
-      const uint32_t &inputHashes = inputHashOffset[hashDimIdx];
-      const uint32_t &weightHashes = weightHashOffset[hashDimIdx];
-      uint32_t diff = inputHashes ^ weightHashes;
-      uint16_t distT = __popc(diff);
-      dist += distT;
-    }
-
-    hammingBatchOffset[dimIdx] = dist;
-
-    // counts
-    uint32_t countIdx = dist - minVal;
-    assert(countIdx < range);
-#if __CUDA_ARCH__ >= 600
-    atomicAdd_block(&sharedCounts[countIdx], 1);
-#endif
-    dimIdx += blockDim.x;
-  }
-
-  // Start counting sort algorithm
-  __syncthreads();
-  // Calc acumulate counts
-  if (threadIdx.x == 0) {
-    if (sharedCounts[0] >= kBest) {
-      (*stopVal) = 0;
-    }
-    else {
-      for (int rangeIdx = 1; rangeIdx < range; ++rangeIdx) {
-        uint32_t preval = sharedCounts[rangeIdx - 1];
-        sharedCounts[rangeIdx] += preval;
-        if (sharedCounts[rangeIdx] >= kBest) {
-          (*stopVal) = rangeIdx;
-          break;
-        }
-      }
-    }
-  }
-
-  // init output - reuse count array
-  __syncthreads();
-  int rangeIdx = (*stopVal) + threadIdx.x + 1;
-  while (rangeIdx < range) {
-    sharedCounts[rangeIdx] = NPP_MAX_32U;
-    rangeIdx += blockDim.x;
-  }
-
-  __syncthreads();
-  // Reduce
-  dimIdx = threadIdx.x;
-  while (dimIdx < dim) {
-    uint16_t val = hammingBatchOffset[dimIdx];
-    assert(val >= minVal);
-    assert(val <= maxVal);
-
-    uint32_t countIdx = val - minVal;
-    assert(countIdx < range);
-    uint32_t &outIdx = sharedCounts[countIdx];
-
-    if (outIdx != NPP_MAX_32U) {
-      uint32_t prevOutIdx;
-// Not supported in Maxwells or older
-// Not supported in Maxwells or older
-#if __CUDA_ARCH__ >= 600
-      prevOutIdx = atomicAdd_block(&outIdx, (uint32_t) -1);
-#else
-      prevOutIdx = 0;
-#endif
-      assert(prevOutIdx > 0);
-      assert(prevOutIdx - 1 < dim);
-
-      if (prevOutIdx - 1 < kBest) {
-        if (outCountsBatchOffset) outCountsBatchOffset[prevOutIdx - 1] = val;
-        if (outIdxBatchOffset) outIdxBatchOffset[prevOutIdx - 1] = dimIdx;
-      }
-    }
-
-    dimIdx += blockDim.x;
-  }
-}
-
-// Calc hamming distance between input and weight hash. Return sorted indices and counts accoding to counting sort algo
-// https://www.geeksforgeeks.org/counting-sort/
-void HammmingAndSort(marian::Tensor outIdx, marian::Tensor outCounts,
-                  const marian::Tensor weightHash,
-                  const marian::Tensor inputHash,
-                  uint32_t kBest, uint16_t minVal, uint16_t maxVal,
-                  marian::Ptr<marian::Allocator> &alloc,
-                  marian::Ptr<marian::Backend> &backend)
-{
-  size_t SHARED_MEM_SIZE = 48000;
-
-  assert(weightHash->shape()[-1] == inputHash->shape()[-1]);
-  int hashDim = weightHash->shape()[-1] / 4;
-
-  int dim = weightHash->shape().elements() / weightHash->shape()[-1];
-  int inputBatch = inputHash->shape().elements() / inputHash->shape()[-1];
-
-  uint16_t range = maxVal - minVal + 1;
-
-  marian::Shape hammingShape = inputHash->shape();
-  hammingShape.set(-1, (int) kBest);
-
-
-  size_t mem = range * sizeof(uint32_t) // counts
-              + sizeof(uint32_t)    // stopval
-              + dim * sizeof(uint16_t); // hamming;
-
-  marian::Tensor hamming;
-  if (mem > SHARED_MEM_SIZE) {
-    // shared memory too small. Write haming distance to global mem instead
-    mem = range *sizeof(uint32_t) + sizeof(uint32_t);
-    assert(mem <= SHARED_MEM_SIZE);
-
-    hammingShape.set(-1, dim);
-    auto memory = alloc->alloc(requiredBytes(hammingShape, marian::Type::uint16));
-
-    hamming = marian::TensorBase::New(memory, hammingShape, marian::Type::uint16, backend);
-  }
-
-  HammmingAndSort<<<inputBatch, 256, mem>>>
-              (weightHash->data<uint32_t>(),
-              inputHash->data<uint32_t>(),
-              hamming ? hamming->data<uint16_t>() : nullptr,
-              outCounts ? outCounts->data<uint32_t>() : nullptr,
-              outIdx ? outIdx->data<uint32_t>() : nullptr,
-              kBest, minVal, maxVal, range,
-              hashDim, dim, inputBatch);
-  CUDA_CHECK(cudaGetLastError());
-
-  if (hamming) {
-    alloc->free(hamming->memory());
-  }
-}
-
 }  // namespace gpu
 }  // namespace marian
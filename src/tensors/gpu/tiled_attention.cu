@@ -0,0 +1,144 @@
+#include "tensors/tensor_operators.h"
+#include "tensors/gpu/cuda_helpers.h"
+
+namespace marian {
+namespace gpu {
+
+// GPU counterpart to cpu::TiledAttention(). One block handles one query row and walks over the keys in tiles of
+// ATTENTION_THREADS, one key per thread: the scores of a tile are reduced to the block maximum and sum of the online
+// softmax, the probabilities go to shared memory and every thread accumulates them into its own components of
+// the output row, which are rescaled whenever the running maximum grows. Reads of the values are coalesced across
+// the threads of a block, the scores of other tiles are never stored.
+
+static const int ATTENTION_THREADS = 128;
+
+template <bool isMax>
+__device__ inline float blockReduce(float x, float* shared) {
+  shared[threadIdx.x] = x;
+  __syncthreads();
+  for(int stride = blockDim.x / 2; stride > 0; stride >>= 1) {
+    if(threadIdx.x < stride)
+      shared[threadIdx.x] = isMax ? max(shared[threadIdx.x], shared[threadIdx.x + stride])
+                                  : shared[threadIdx.x] + shared[threadIdx.x + stride];
+    __syncthreads();
+  }
+  float result = shared[0];
+  __syncthreads(); // shared is reused by the next reduction
+  return result;
+}
+
+__global__ void gTiledAttention(float* out,       // [qBatches, dimQuery, dimValue]
+                                const float* q,   // [qBatches, dimQuery, dimHead]
+                                const float* k,   // [kBatches, dimKeys, dimHead]
+                                const float* v,   // [kBatches, dimKeys, dimValue]
+                                AttentionBiasArgs bias,
+                                int dimQuery,
+                                int dimHead,
+                                int dimKeys,
+                                int dimValue,
+                                int kBatches,
+                                int dimBatchHeads,
+                                float scale) {
+  extern __shared__ float sharedMem[];
+  float* sq   = sharedMem;               // [dimHead]
+  float* sacc = sq + dimHead;            // [dimValue]
+  float* sp   = sacc + dimValue;         // [ATTENTION_THREADS]
+  float* sred = sp + ATTENTION_THREADS;  // [ATTENTION_THREADS]
+
+  int query = blockIdx.x;
+  int b     = blockIdx.y;
+  int beam = b / dimBatchHeads, batchHead = b % dimBatchHeads;
+
+  const float* qRow = q + ((size_t)b * dimQuery + query) * dimHead;
+  const float* kb   = k + (size_t)(b % kBatches) * dimKeys * dimHead;
+  const float* vb   = v + (size_t)(b % kBatches) * dimKeys * dimValue;
+
+  for(int d = threadIdx.x; d < dimHead; d += blockDim.x)
+    sq[d] = qRow[d] * scale;
+  for(int d = threadIdx.x; d < dimValue; d += blockDim.x)
+    sacc[d] = 0.f;
+  __syncthreads();
+
+  float runMax = -INFINITY, runSum = 0.f; // identical in all threads of the block
+  for(int k0 = 0; k0 < dimKeys; k0 += blockDim.x) {
+    int key = k0 + threadIdx.x;
+    int tk = min((int)blockDim.x, dimKeys - k0);
+
+    float s = -INFINITY;
+    if(key < dimKeys) {
+      const float* kRow = kb + (size_t)key * dimHead;
+      float dot = 0.f;
+      for(int d = 0; d < dimHead; ++d)
+        dot += sq[d] * kRow[d];
+      s = dot + bias(beam, batchHead, query, key);
+    }
+
+    float newMax = max(runMax, blockReduce<true>(s, sred));
+    if(newMax == -INFINITY) // all keys so far are masked, the same branch for the whole block
+      continue;
+
+    float p = key < dimKeys ? __expf(s - newMax) : 0.f;
+    sp[threadIdx.x] = p;
+    float sum = blockReduce<false>(p, sred); // also makes sp visible to all threads
+
+    float correction = __expf(runMax - newMax);
+    runSum = runSum * correction + sum;
+    runMax = newMax;
+
+    for(int d = threadIdx.x; d < dimValue; d += blockDim.x) {
+      float a = sacc[d] * correction;
+      const float* vCol = vb + (size_t)k0 * dimValue + d;
+      for(int j = 0; j < tk; ++j)
+        a += sp[j] * vCol[(size_t)j * dimValue];
+      sacc[d] = a;
+    }
+    __syncthreads(); // sp is overwritten by the next tile
+  }
+
+  // rows without any unmasked key get zeros, as on the CPU
+  float norm = runSum > 0.f ? 1.f / runSum : 0.f;
+  float* oRow = out + ((size_t)b * dimQuery + query) * dimValue;
+  for(int d = threadIdx.x; d < dimValue; d += blockDim.x)
+    oRow[d] = sacc[d] * norm;
+}
+
+void TiledAttention(marian::Tensor out,
+                    const marian::Tensor q,
+                    const marian::Tensor k,
+                    const marian::Tensor v,
+                    const AttentionBias& bias,
+                    float scale) {
+  CUDA_CHECK(cudaSetDevice(out->getDeviceId().no));
+  matchOrAbort<float>(out->type());
+  matchOrAbort<float>(q->type());
+  matchOrAbort<float>(k->type());
+  matchOrAbort<float>(v->type());
+
+  int dimQuery = q->shape()[-2];
+  int dimHead  = q->shape()[-1];
+  int dimKeys  = k->shape()[-2];
+  int dimValue = v->shape()[-1];
+  ABORT_IF(k->shape()[-1] != dimHead, "Keys of shape {} do not match queries of shape {}", k->shape(), q->shape());
+  ABORT_IF(v->shape()[-2] != dimKeys, "Values of shape {} do not match keys of shape {}", v->shape(), k->shape());
+
+  int qBatches = q->shape().elements() / (dimQuery * dimHead);
+  int kBatches = k->shape().elements() / (dimKeys * dimHead);
+  ABORT_IF(v->shape().elements() / (dimKeys * dimValue) != kBatches, "Values of shape {} do not match keys of shape {}",
+           v->shape(), k->shape());
+  ABORT_IF(qBatches % kBatches != 0, "Keys of shape {} do not broadcast to queries of shape {}", k->shape(), q->shape());
+  ABORT_IF(qBatches > 65535, "Too many attention batches ({}) for the GPU tiled attention", qBatches);
+
+  int dimBatchHeads = q->shape().size() >= 3 ? q->shape()[-3] : 1;
+  marian::Shape scores = {qBatches / dimBatchHeads, dimBatchHeads, dimQuery, dimKeys};
+  AttentionBiasArgs biasArgs(bias, scores);
+
+  size_t sharedMem = (dimHead + dimValue + 2 * ATTENTION_THREADS) * sizeof(float);
+  dim3 blocks(dimQuery, qBatches);
+  gTiledAttention<<<blocks, ATTENTION_THREADS, sharedMem>>>(
+      out->data(), q->data(), k->data(), v->data(), biasArgs,
+      dimQuery, dimHead, dimKeys, dimValue, kBatches, dimBatchHeads, scale);
+  CUDA_CHECK(cudaGetLastError());
+}
+
+}  // namespace gpu
+}  // namespace marian
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "tensors/tensor.h"
+
+#include <vector>
+
+namespace marian {
+
+// Geometry of ProdBatchedHeads(): one GEMM per pair of batch entry and head, with the heads of the projected
+// queries, keys and values side by side in the last dimension, [batch, steps, numHeads * dimHead], as they come
+// out of the projections. A matrix of such an operand starts at batch * steps * numHeads * dimHead + head * dimHead
+// with a leading dimension of numHeads * dimHead, so no transposition into [batch, numHeads, steps, dimHead] is
+// needed before or after the GEMM.
+//
+//  - scores:  C [batch, numHeads, dimQuery, dimKeys] = A [batch, dimQuery, numHeads * dimHead] * B^T with
+//             B [batch, dimKeys, numHeads * dimHead], i.e. the attention logits
+//  - context: C [batch, dimQuery, numHeads * dimHead] = A [batch, numHeads, dimQuery, dimKeys] * B with
+//             B [batch, dimKeys, numHeads * dimHead], i.e. the attention output with joined heads
+//
+// Batch entries of B broadcast as in ProdBatchedLegacy(), i.e. entry i of A uses entry i % batchB of B.
+struct HeadsGemm {
+  int m, n, k;
+  int lda, ldb, ldc;
+  bool transB;
+  int numHeads, dimHead, batchB;
+  size_t joinedA, joinedB, matrix;                   // elements per batch entry of the operands, see below
+  std::vector<size_t> offsetsA, offsetsB, offsetsC; // in elements, one per GEMM
+
+  HeadsGemm(const marian::Tensor C, const marian::Tensor A, const marian::Tensor B, bool scores, int numHeads)
+      : numHeads(numHeads) {
+    const auto& aShape = A->shape();
+    const auto& bShape = B->shape();
+    int dimKeys = bShape[-2];
+    ABORT_IF(bShape[-1] % numHeads != 0, "Last dimension of {} is not divisible by {} heads", bShape, numHeads);
+    dimHead = bShape[-1] / numHeads;
+    batchB = (int)(bShape.elements() / bShape[-1] / dimKeys);
+
+    int batchA, dimQuery;
+    if(scores) {
+      ABORT_IF(aShape[-1] != bShape[-1], "Queries {} and keys {} have different sizes", aShape, bShape);
+      dimQuery = aShape[-2];
+      batchA = (int)(aShape.elements() / aShape[-1] / dimQuery);
+      m = dimQuery; n = dimKeys; k = dimHead;
+      lda = numHeads * dimHead; ldb = numHeads * dimHead; ldc = dimKeys;
+      transB = true;
+    } else {
+      ABORT_IF(aShape[-1] != dimKeys || aShape[-3] != numHeads,
+               "Attention weights {} do not match values {} with {} heads", aShape, bShape, numHeads);
+      dimQuery = aShape[-2];
+      batchA = (int)(aShape.elements() / (numHeads * dimQuery * dimKeys));
+      m = dimQuery; n = dimHead; k = dimKeys;
+      lda = dimKeys; ldb = numHeads * dimHead; ldc = numHeads * dimHead;
+      transB = false;
+    }
+    ABORT_IF(batchA % batchB != 0, "Batch of {} does not broadcast to batch of {}", bShape, aShape);
+    ABORT_IF((int)(C->shape().elements()) != batchA * numHeads * m * n, "Output {} does not match inputs {} and {}",
+             C->shape(), aShape, bShape);
+
+    joinedA = (size_t)dimQuery * numHeads * dimHead; // one batch entry of queries or output context
+    joinedB = (size_t)dimKeys * numHeads * dimHead;  // one batch entry of keys or values
+    matrix  = (size_t)dimQuery * dimKeys;            // one head of one batch entry of scores
+    for(int b = 0; b < batchA; ++b) {
+      for(int h = 0; h < numHeads; ++h) {
+        size_t joined = b * joinedA + h * dimHead, split = (b * numHeads + h) * matrix;
+        offsetsA.push_back(scores ? joined : split);
+        offsetsB.push_back((b % batchB) * joinedB + h * dimHead);
+        offsetsC.push_back(scores ? split : joined);
+      }
+    }
+  }
+};
+
+}  // namespace marian
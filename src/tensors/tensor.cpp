@@ -132,6 +132,10 @@ void TensorBase::set(const io::Item& item) {
   ABORT_IF(item.type != type_, "Tensor type {} and item type {} do not match", type_, item.type);
   ABORT_IF(item.shape != shape_, "Tensor shape {} and item shape {} do not match", shape_, item.shape);
   ABORT_IF(item.size() > memory_->size(), "Item data size {} too large for memory {}", item.size(), memory_->size());
+  if(backend_->getDeviceId().type != DeviceType::cpu && backend_->isInputUploads() && backend_->getPinnedUploads() > 0) {
+    backend_->upload(memory_->data<char>(), item.data(), item.size()); // staged, see ExpressionGraph::setStagedLoading()
+    return;
+  }
   copy(backend_,
        item.data(),
        item.data() + item.size(),
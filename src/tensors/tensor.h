@@ -186,7 +186,10 @@ public:
     }
 #ifdef CUDA_FOUND
     else {
-      gpu::copy(backend_, begin, end, data<T>());
+      if(backend_->isInputUploads() && backend_->getPinnedUploads() > 0)
+        backend_->upload(data<T>(), begin, (end - begin) * sizeof(T));
+      else
+        gpu::copy(backend_, begin, end, data<T>());
     }
 #endif
   }
@@ -4,7 +4,11 @@
 #include "tensors/allocator.h"
 #include "tensors/tensor.h"
 
+#include "tensors/attention_bias.h"
 #include "tensors/dispatch.h"
+#include "tensors/fp8.h"
+#include "tensors/fused_adam.h"
+#include "tensors/fused_element.h"
 
 #include "functional/shape.h"
 #include "functional/tensor.h"
@@ -45,10 +49,9 @@ DISPATCH4(IsNaN, const Tensor, Ptr<Allocator>, bool&, bool&);
 namespace gpu {
 bool SanitizeGradient(marian::Tensor in, Ptr<Allocator> allocator, bool pruneNaN, bool clipInf);
 void Float2Bit(marian::Tensor output, const marian::Tensor input);
-void HammmingAndSort(marian::Tensor outIdx, marian::Tensor outCounts,
-                  const marian::Tensor weightHash, const marian::Tensor inputHash,
-                  uint32_t kBest, uint16_t minVal, uint16_t maxVal, 
-                  marian::Ptr<marian::Allocator> &alloc, marian::Ptr<marian::Backend> &backend);
+// Indices of the k code rows with the smallest hamming distance to each query, ascending per query
+void HammingTopK(marian::Tensor outIdx, const marian::Tensor queryCodes, const marian::Tensor codes,
+                 int k, int numCodes, marian::Ptr<marian::Allocator> allocator);
 }
 #endif
 
@@ -129,16 +132,98 @@ DISPATCH8(Prod, marian::Tensor, const marian::Tensor&, const marian::Tensor&, bo
 
 DISPATCH8(ProdBatched, marian::Tensor, Ptr<Allocator>, const marian::Tensor, const marian::Tensor, bool, bool, float, float)
 DISPATCH8(ProdBatchedLegacy, marian::Tensor, Ptr<Allocator>, const marian::Tensor, const marian::Tensor, bool, bool, float, float)
+// attention scores or context straight from and to [batch, steps, numHeads * dimHead] without splitting heads, see HeadsGemm
+DISPATCH7(ProdBatchedHeads, marian::Tensor, Ptr<Allocator>, const marian::Tensor, const marian::Tensor, bool, int, float)
 DISPATCH9(CSRProd, marian::Tensor, Ptr<Allocator>, const marian::Tensor&, const marian::Tensor&, const marian::Tensor&, const marian::Tensor&, bool, bool, float)
 
 DISPATCH10(Affine, marian::Tensor, Ptr<Allocator>, const marian::Tensor&, const marian::Tensor&, const marian::Tensor&, bool, bool, float, float, bool)
+// clang-format on
+
+// Affine() and Prod() of the affine layers of --fp8, with both operands of the GEMM in FP8 where FP8 GEMMs are
+// available, see gpu::ProdFp8(), and as Affine() and Prod() otherwise.
+static inline void AffineFp8(marian::Tensor C,
+                             Ptr<Allocator> allocator,
+                             const marian::Tensor& A,
+                             const marian::Tensor& B,
+                             const marian::Tensor& bias,
+                             bool transA,
+                             bool transB,
+                             float scalar,
+                             bool doRelu,
+                             const Fp8Operand& fp8A,
+                             const Fp8Operand& fp8B) {
+#ifdef CUDA_FOUND
+  if(C->getBackend()->getDeviceId().type == DeviceType::gpu
+     && gpu::ProdFp8(C, allocator, A, B, transA, transB, 0.f, scalar, fp8A, fp8B)) {
+    gpu::BiasAdd(C, bias, doRelu);
+    return;
+  }
+#else
+  fp8A; fp8B;
+#endif
+  Affine(C, allocator, A, B, bias, transA, transB, 0.f, scalar, doRelu);
+}
+
+static inline void ProdFp8(marian::Tensor C,
+                           Ptr<Allocator> allocator,
+                           const marian::Tensor& A,
+                           const marian::Tensor& B,
+                           bool transA,
+                           bool transB,
+                           float beta,
+                           float scalar,
+                           Type computeType,
+                           const Fp8Operand& fp8A,
+                           const Fp8Operand& fp8B) {
+#ifdef CUDA_FOUND
+  if(C->getBackend()->getDeviceId().type == DeviceType::gpu
+     && gpu::ProdFp8(C, allocator, A, B, transA, transB, beta, scalar, fp8A, fp8B))
+    return;
+#else
+  allocator; fp8A; fp8B;
+#endif
+  Prod(C, A, B, transA, transB, beta, scalar, computeType);
+}
+
+// next step of the scaling of an FP8 operand, see gpu::Fp8NextStep()
+static inline void Fp8NextStep(Ptr<Backend> backend, const Fp8Operand& operand) {
+#ifdef CUDA_FOUND
+  if(backend->getDeviceId().type == DeviceType::gpu)
+    gpu::Fp8NextStep(backend, operand);
+#else
+  backend; operand;
+#endif
+}
+// clang-format off
 
 DISPATCH2(Softmax, marian::Tensor, marian::Tensor)
 DISPATCH3(SoftmaxGrad, marian::Tensor, marian::Tensor, marian::Tensor)
 
+namespace cpu {
+// softmax(scale * in + logMask) in one pass per row, logMask broadcasts against in (CPU only)
+void MaskedSoftmax(marian::Tensor out, marian::Tensor in, marian::Tensor logMask, float scale);
+// max or mean of in [steps, dimBatch, dimModel] over the steps where mask [steps, dimBatch, 1] is 1 (CPU only)
+void MaskedPool(marian::Tensor out, marian::Tensor in, marian::Tensor mask, bool mean);
+// cosines of the rows of a and b along the last axis in one pass over both (CPU only)
+void Cosine(marian::Tensor out, marian::Tensor a, marian::Tensor b);
+}
+
+// out = softmax(scale * q * k^T + bias) * v without materializing the scores, q is [dimBeam, dimBatch * numHeads,
+// dimQuery, dimHead], k and v are [.., dimKeys, dimHead] and broadcast along leading dimensions as in bdot_legacy()
+DISPATCH6(TiledAttention, marian::Tensor, const marian::Tensor, const marian::Tensor, const marian::Tensor, const AttentionBias&, float)
+
 DISPATCH2(LogSoftmax, marian::Tensor, marian::Tensor)
+DISPATCH5(LogSoftmaxShortlist, marian::Tensor, const marian::Tensor, const marian::Tensor, const marian::Tensor, const marian::Tensor)
 DISPATCH3(LogSoftmaxGrad, marian::Tensor, marian::Tensor, marian::Tensor)
 
+// Truncation of the distribution that GumbelSampling() samples from, see --output-sampling
+enum class SamplingMethod : int { Full = 0, TopK = 1, Nucleus = 2, Epsilon = 3 };
+
+// out = logsoftmax(logits / temperature + noise) over the logits of each row that the truncation keeps, -inf for the
+// others, which needs no sort of the row: param is k for TopK, the probability mass for Nucleus and the smallest
+// probability for Epsilon, with normalize the logits are log-normalized before they are compared with the latter two
+DISPATCH7(GumbelSampling, marian::Tensor, const marian::Tensor, const marian::Tensor, SamplingMethod, float, float, bool)
+
 DISPATCH4(CrossEntropyPick, marian::Tensor, marian::Tensor, marian::Tensor, float)
 DISPATCH5(CrossEntropyPickBackward, marian::Tensor, marian::Tensor, marian::Tensor, marian::Tensor, float)
 
@@ -169,6 +254,24 @@ static inline void Dropout(Tensor tensor, float dropProb) {
 
 DISPATCH2(SinusoidalPositionEmbeddings, marian::Tensor, int);
 
+// out = scale * embeddings[indices] + sinusoidal position embeddings in one pass, see embedWithPositions(). With
+// weights and offsets, row r of out sums weights[k] * embeddings[indices[k]] for k in [offsets[r], offsets[r + 1])
+// like csr_dot() does for factored vocabularies, otherwise row r is the single row indices[r]. The position of row
+// r is start plus its coordinate along positionAxis of out, the sinusoids are those of SinusoidalPositionEmbeddings().
+DISPATCH8(EmbedWithPositions, marian::Tensor, const marian::Tensor, const marian::Tensor, const marian::Tensor, const marian::Tensor, float, int, int);
+
+// out = the result of a fused elementwise program over float32 inputs that broadcast against out, in one pass that
+// writes no intermediate tensors, see FusedElementwiseNodeOp
+DISPATCH3(FusedElement, marian::Tensor, const std::vector<marian::Tensor>&, const FusedProgram&);
+
+// One pass of Adam over a shard: reads params, grads, mt and vt once, writes the updated moments and parameters and,
+// if given, the exponential average avg of the parameters and out, the parameters cast to the type of the graph.
+// mt, vt and avg have the type of params, out the one of grads.
+DISPATCH7(FusedAdam, marian::Tensor, const marian::Tensor, marian::Tensor, marian::Tensor, marian::Tensor, marian::Tensor, const FusedAdamArgs&);
+// FusedAdam() over float32 parameters with the moments in int8 and uint8 and their block maxima in scales, first the
+// ones of the first moment, see Adam8bitCodec
+DISPATCH8(FusedAdam8bit, marian::Tensor, const marian::Tensor, marian::Tensor, marian::Tensor, marian::Tensor, marian::Tensor, marian::Tensor, const FusedAdamArgs&);
+
 #ifdef CUDA_FOUND
 namespace gpu {
 void Deconcatenate(std::vector<marian::Tensor>& outputs,
@@ -197,6 +300,12 @@ static inline void Deconcatenate(std::vector<marian::Tensor>& outputs,
 // clang-format off
 DISPATCH5(LayerNormalization, marian::Tensor, marian::Tensor, marian::Tensor, marian::Tensor, float)
 
+// layer and RMS normalization of in + residual, the sum is never written to a tensor of its own (CPU only)
+namespace cpu {
+void AddLayerNormalization(marian::Tensor out, marian::Tensor in, marian::Tensor residual, marian::Tensor gamma, marian::Tensor beta, float eps);
+void AddRMSNormalization(marian::Tensor out, marian::Tensor in, marian::Tensor residual, marian::Tensor gamma, marian::Tensor beta, float eps);
+}
+
 #ifdef CUDA_FOUND
 namespace gpu {
 void LayerNormalizationGrad(Ptr<Allocator> allocator,
@@ -292,6 +401,68 @@ static inline void RMSNormalizationGrad(
     cpu::RMSNormalizationGrad(gradX, gradGamma, gradBeta, adj, y, x, gamma, beta, eps);
 }
 
+// Layer or RMS normalization of in * mask + residual. The GPU fuses the dropout mask, which repeats over the leading
+// rows of in, and has a backward pass that recomputes the sum from the inputs. The CPU only has the forward pass
+// without a mask, see AddLayerNormalization().
+#ifdef CUDA_FOUND
+namespace gpu {
+void AddNormalization(Tensor out, Tensor in, Tensor mask, Tensor residual, Tensor gamma, Tensor beta, float eps, bool rms);
+void AddNormalizationGrad(Ptr<Allocator> allocator,
+                          Tensor gradIn,
+                          Tensor gradResidual,
+                          Tensor gradGamma,
+                          Tensor gradBeta,
+                          Tensor adj,
+                          Tensor y,
+                          Tensor in,
+                          Tensor mask,
+                          Tensor residual,
+                          Tensor gamma,
+                          Tensor beta,
+                          float eps,
+                          bool rms);
+}
+#endif
+
+static inline void AddNormalization(
+    Tensor out, Tensor in, Tensor mask, Tensor residual, Tensor gamma, Tensor beta, float eps, bool rms) {
+#ifdef CUDA_FOUND
+  if(out->getBackend()->getDeviceId().type == DeviceType::gpu) {
+    gpu::AddNormalization(out, in, mask, residual, gamma, beta, eps, rms);
+    return;
+  }
+#endif
+  ABORT_IF(mask, "Dropout is not fused into the normalization on the CPU");
+  if(rms)
+    cpu::AddRMSNormalization(out, in, residual, gamma, beta, eps);
+  else
+    cpu::AddLayerNormalization(out, in, residual, gamma, beta, eps);
+}
+
+static inline void AddNormalizationGrad(Ptr<Allocator> allocator,
+                                        Tensor gradIn,
+                                        Tensor gradResidual,
+                                        Tensor gradGamma,
+                                        Tensor gradBeta,
+                                        Tensor adj,
+                                        Tensor y,
+                                        Tensor in,
+                                        Tensor mask,
+                                        Tensor residual,
+                                        Tensor gamma,
+                                        Tensor beta,
+                                        float eps,
+                                        bool rms) {
+#ifdef CUDA_FOUND
+  if(adj->getBackend()->getDeviceId().type == DeviceType::gpu) {
+    gpu::AddNormalizationGrad(allocator, gradIn, gradResidual, gradGamma, gradBeta, adj, y, in, mask, residual, gamma, beta, eps, rms);
+    return;
+  }
+#endif
+  allocator; gradIn; gradResidual; gradGamma; gradBeta; adj; y; in; mask; residual; gamma; beta; eps; rms;
+  ABORT("AddNormalizationGrad is not implemented for the CPU");
+}
+
 DISPATCH4(HighwayForward, marian::Tensor, const marian::Tensor, const marian::Tensor, const marian::Tensor)
 DISPATCH7(HighwayBackward, marian::Tensor, marian::Tensor, marian::Tensor, const marian::Tensor, const marian::Tensor, const marian::Tensor, const marian::Tensor)
 
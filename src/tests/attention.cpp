@@ -0,0 +1,57 @@
+#include "marian.h"
+#include "common/timer.h"
+
+// Times the attention scores of one layer for different sequence lengths: the dot product of queries and
+// keys, masking and softmax as separate operations and as maskedSoftmax(), followed by the product with
+// the values, and tiledAttention(), which never materializes the scores. Not a real test, just used for
+// benchmarking by hand, like prod.cpp.
+int main(int /*argc*/, char** /*argv*/) {
+  using namespace marian;
+
+#ifdef CUDA_FOUND
+  DeviceId device = {0, DeviceType::gpu};
+#else
+  DeviceId device = {0, DeviceType::cpu};
+#endif
+
+  const int dimBatch = 8;
+  const int numHeads = 8;
+  const int dimHead = 64;
+  const int iterations = 20;
+
+  for(int length : {64, 256, 1024, 2048}) {
+    auto g = New<ExpressionGraph>(true);
+    g->setDevice(device);
+    g->reserveWorkspaceMB(4096);
+
+    LOG(info, "Batch size {}, {} heads, sequence length {}", dimBatch, numHeads, length);
+    enum class Mode { composed, fused, tiled };
+    auto run = [&](const std::string& name, Mode mode) {
+      LOG(info, name);
+      timer::AutoTimer timer;
+      for(int i = 0; i < iterations; ++i) {
+        g->clear();
+        auto q = g->constant({dimBatch, numHeads, length, dimHead}, inits::normal());
+        auto k = g->constant({dimBatch, numHeads, length, dimHead}, inits::normal());
+        auto v = g->constant({dimBatch, numHeads, length, dimHead}, inits::normal());
+        auto mask = g->constant({dimBatch, 1, 1, length}, inits::zeros());
+
+        float scale = 1.f / std::sqrt((float)dimHead);
+        if(mode == Mode::tiled) {
+          auto output = tiledAttention(q, k, v, mask, scale);
+        } else {
+          auto z = bdot(q, k, false, true);
+          auto weights = mode == Mode::fused ? maskedSoftmax(z, mask, scale) : softmax(z * scale + mask);
+          auto output = bdot(weights, v);
+        }
+        g->forward();
+      }
+    };
+
+    run("scale, mask and softmax", Mode::composed);
+    run("maskedSoftmax", Mode::fused);
+    run("tiledAttention", Mode::tiled);
+  }
+
+  return 0;
+}
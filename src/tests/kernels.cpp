@@ -0,0 +1,221 @@
+#include "marian.h"
+#include "common/perf_counters.h"
+#include "common/timer.h"
+#include "tensors/cpu/expression_graph_packable.h"
+#include "tensors/tensor_operators.h"
+
+#include <functional>
+#include <iostream>
+
+// Microbenchmarks of the tensor kernels on the shapes of transformer-base and transformer-big, for the encoder (32
+// sentences of 32 tokens) and a decoder step (8 sentences with beam size 4). Each kernel is called on tensors of a
+// forwarded graph until half a second has passed, and its mean time per call is printed with the effective memory
+// bandwidth or GEMM throughput. The GEMM types of the CPU go through affine() of a graph to use its packed weights.
+// Where the hardware counters are available, CPU kernels also get their instructions per cycle and the memory
+// bandwidth estimated from their last-level cache misses, which tell compute-bound from memory-bound kernels.
+//   ./test_kernels [filter]     runs only kernels whose name contains filter, e.g. "cpu/Affine"
+
+using namespace marian;
+
+namespace {
+
+struct ModelShape {
+  std::string name;
+  int dimModel;
+  int dimFfn;
+  int heads;
+};
+
+struct Workload {
+  std::string name;
+  int dimBatch; // sentences, or the hypotheses of a decoder step
+  int length;   // keys of the attention
+  int queries;  // queries of the attention, a single token in a decoder step
+};
+
+const int dimVocab = 32000;
+const std::vector<ModelShape> modelShapes = {{"base", 512, 2048, 8}, {"big", 1024, 4096, 16}};
+const std::vector<Workload> workloads = {{"encoder", 32, 32, 32}, {"decoder", 32, 32, 1}};
+
+std::string filter;
+
+// Calls fn until at least half a second has passed after a warm-up call and prints the mean time per call. bytes are
+// the bytes read and written by a call, flops its floating-point operations, either may be zero.
+void bench(Ptr<ExpressionGraph> graph, const std::string& name, double bytes, double flops, const std::function<void()>& fn) {
+  if(name.find(filter) == std::string::npos)
+    return;
+
+  fn();
+  graph->getBackend()->synchronize();
+
+  static PerfCounters counters; // of this thread, which runs the CPU kernels
+  bool withCounters = counters.available() && graph->getDeviceId().type == DeviceType::cpu;
+  auto countsBefore = counters.read();
+  size_t iterations = 0;
+  timer::Timer timer;
+  do {
+    for(int i = 0; i < 10; ++i)
+      fn();
+    iterations += 10;
+    graph->getBackend()->synchronize();
+  } while(timer.elapsed() < 0.5);
+  double seconds = timer.elapsed() / iterations;
+  auto counts = counters.read() - countsBefore;
+
+  std::cout << fmt::format("{:<56} {:>8} {:>12.2f} us", name, iterations, seconds * 1e6);
+  if(bytes > 0)
+    std::cout << fmt::format(" {:>10.2f} GB/s", bytes / seconds * 1e-9);
+  if(flops > 0)
+    std::cout << fmt::format(" {:>10.2f} GFLOP/s", flops / seconds * 1e-9);
+  if(withCounters)
+    std::cout << fmt::format(" {:>6.2f} IPC {:>10.2f} GB/s from LLC misses", counts.ipc(),
+                             counts.bytesFromMemory() / iterations / seconds * 1e-9);
+  std::cout << std::endl;
+}
+
+void benchmarkOperators(DeviceId deviceId) {
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice(deviceId);
+  graph->reserveWorkspaceMB(2048);
+  std::string device = deviceId.type == DeviceType::gpu ? "gpu" : "cpu";
+
+  for(const auto& m : modelShapes) {
+    for(const auto& w : workloads) {
+      graph->clear();
+      int rows = w.dimBatch * w.queries;
+      int dimHead = m.dimModel / m.heads;
+      int k = 8;
+      auto prefix = [&](const std::string& op) { return device + "/" + op + "/" + m.name + "/" + w.name; };
+
+      auto attention = graph->constant({w.dimBatch, m.heads, w.queries, w.length}, inits::normal());
+      auto attentionOut = graph->constant(attention->shape(), inits::zeros());
+      auto logits = graph->constant({rows, dimVocab}, inits::normal());
+      auto logitsOut = graph->constant(logits->shape(), inits::zeros());
+      auto hidden = graph->constant({rows, m.dimModel}, inits::normal());
+      auto hiddenOut = graph->constant(hidden->shape(), inits::zeros());
+      auto gamma = graph->constant({1, m.dimModel}, inits::ones());
+      auto beta = graph->constant({1, m.dimModel}, inits::zeros());
+      auto embeddings = graph->constant({dimVocab, m.dimModel}, inits::normal());
+      std::vector<IndexType> words(rows);
+      for(int i = 0; i < rows; ++i)
+        words[i] = (IndexType)((i * 7919 + 3) % dimVocab);
+      auto indices = graph->indices(words);
+      auto heads = graph->constant({w.dimBatch, w.queries, m.heads, dimHead}, inits::normal());
+      auto headsOut = graph->constant({w.dimBatch, m.heads, w.queries, dimHead}, inits::zeros());
+      auto topKValues = graph->constant({rows, k}, inits::zeros());
+      auto topKIndices = graph->constant(topKValues->shape(), inits::zeros(), Type::uint32);
+      auto weights = graph->constant({m.dimModel, m.dimFfn}, inits::normal(0.f, 0.05f));
+      auto bias = graph->constant({1, m.dimFfn}, inits::zeros());
+      auto ffn = graph->constant({rows, m.dimFfn}, inits::zeros());
+      auto queries = graph->constant({w.dimBatch * m.heads, w.queries, dimHead}, inits::normal());
+      auto keys = graph->constant({w.dimBatch * m.heads, w.length, dimHead}, inits::normal());
+      auto scores = graph->constant({w.dimBatch * m.heads, w.queries, w.length}, inits::zeros());
+      graph->forward();
+
+      auto allocator = graph->allocator();
+      double attentionBytes = 2. * attention->shape().elements() * sizeof(float);
+      double logitsBytes = 2. * logits->shape().elements() * sizeof(float);
+      double hiddenBytes = 2. * hidden->shape().elements() * sizeof(float);
+      double gemmFlops = 2. * rows * m.dimModel * m.dimFfn;
+      double gemmBytes = ((double)rows * m.dimModel + (double)m.dimModel * m.dimFfn + (double)rows * m.dimFfn) * sizeof(float);
+
+      bench(graph, prefix("Softmax") + "/attention", attentionBytes, 0,
+            [&]() { Softmax(attentionOut->val(), attention->val()); });
+      bench(graph, prefix("Softmax") + "/logits", logitsBytes, 0,
+            [&]() { Softmax(logitsOut->val(), logits->val()); });
+      bench(graph, prefix("LogSoftmax") + "/logits", logitsBytes, 0,
+            [&]() { LogSoftmax(logitsOut->val(), logits->val()); });
+      bench(graph, prefix("LayerNormalization"), hiddenBytes, 0,
+            [&]() { LayerNormalization(hiddenOut->val(), hidden->val(), gamma->val(), beta->val(), 1e-6f); });
+      bench(graph, prefix("CopyRows") + "/embeddings", hiddenBytes, 0,
+            [&]() { CopyRows(hiddenOut->val(), embeddings->val(), indices->val()); });
+      bench(graph, prefix("TransposeND") + "/0213", 2. * heads->shape().elements() * sizeof(float), 0,
+            [&]() { TransposeND(headsOut->val(), heads->val(), {0, 2, 1, 3}); });
+      bench(graph, prefix("TopK") + "/logits", logitsBytes / 2, 0, [&]() {
+        TopK(topKValues->val(), topKIndices->val(), allocator, logits->val(), k, -1, /*descending=*/true);
+      });
+      bench(graph, prefix("Prod") + "/ffn", gemmBytes, gemmFlops,
+            [&]() { Prod(ffn->val(), hidden->val(), weights->val(), false, false, 0.f, 1.f); });
+      bench(graph, prefix("Affine") + "/ffn", gemmBytes, gemmFlops, [&]() {
+        Affine(ffn->val(), allocator, hidden->val(), weights->val(), bias->val(), false, false, 0.f, 1.f, false);
+      });
+      bench(graph,
+            prefix("ProdBatched") + "/attention",
+            (queries->shape().elements() + keys->shape().elements() + scores->shape().elements()) * sizeof(float),
+            2. * w.dimBatch * m.heads * w.queries * w.length * dimHead,
+            [&]() {
+              ProdBatched(scores->val(), allocator, queries->val(), keys->val(), false, true, 0.f, 1.f);
+            });
+    }
+  }
+}
+
+// affine() of a graph with the weights of the feed-forward layer in the GEMM type of gemmType: float32, the on-line
+// packed fbgemm types packed16/packed8 with --optimize, or the intgemm types packed offline like marian-conv does.
+// The expression is built again for every call as in decoding, the packed weights are memoized by the graph. The time
+// includes building the expression and copying the input, which the float32 baseline pays as well.
+void benchmarkGemmType(const std::string& gemmType) {
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(1024);
+  bool intgemm = gemmType.find("intgemm") == 0;
+  if(gemmType.find("packed") == 0) {
+    graph->getBackend()->setOptimized(true);
+    graph->getBackend()->setGemmType(gemmType);
+  }
+
+  for(const auto& m : modelShapes) {
+    for(const auto& w : workloads) {
+      int rows = w.dimBatch * w.queries;
+      auto name = "cpu/Affine/" + gemmType + "/" + m.name + "/" + w.name + "/ffn";
+      if(name.find(filter) == std::string::npos)
+        continue;
+
+      graph->clear();
+      auto weightsName = "bench_" + m.name + "_W";
+      if(intgemm && !graph->get(weightsName)) {
+        auto packable = New<ExpressionGraphPackable>();
+        packable->setDevice({0, DeviceType::cpu});
+        packable->reserveWorkspaceMB(512);
+        packable->param(weightsName, {m.dimModel, m.dimFfn}, inits::normal(0.f, 0.05f));
+        packable->forward();
+        auto packed = New<io::ModelWeights>();
+        packed->items() = packable->pack(typeFromString(gemmType));
+        graph->load(packed, /*markReloaded=*/false);
+      }
+      auto weights = graph->param(weightsName, {m.dimModel, m.dimFfn}, inits::normal(0.f, 0.05f));
+      auto bias = graph->param("bench_" + m.name + "_b", {1, m.dimFfn}, inits::zeros());
+      std::vector<float> hidden(rows * m.dimModel);
+      for(size_t i = 0; i < hidden.size(); ++i)
+        hidden[i] = (float)((i * 7919) % 201) / 100.f - 1.f;
+
+      bench(graph, name, 0, 2. * rows * m.dimModel * m.dimFfn, [&]() {
+        graph->clear();
+        affine(graph->constant({rows, m.dimModel}, inits::fromVector(hidden)), weights, bias);
+        graph->forward();
+      });
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if(argc > 1)
+    filter = argv[1];
+
+  benchmarkOperators({0, DeviceType::cpu});
+
+  std::vector<std::string> gemmTypes = {"float32", "intgemm8", "intgemm16"};
+#if USE_FBGEMM
+  gemmTypes.insert(gemmTypes.end(), {"packed16", "packed8"});
+#endif
+  for(const auto& gemmType : gemmTypes)
+    benchmarkGemmType(gemmType);
+
+#ifdef CUDA_FOUND
+  benchmarkOperators({0, DeviceType::gpu});
+#endif
+
+  return 0;
+}
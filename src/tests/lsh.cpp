@@ -0,0 +1,57 @@
+#include "marian.h"
+#include "common/timer.h"
+#include "layers/lsh.h"
+
+// Compares the full output layer (dot product plus softmax over the whole vocabulary) to the
+// LSH shortlist (hamming search plus the dot product over the k selected rows) for different
+// vocabulary sizes. Not a real test, just used for benchmarking by hand, like prod.cpp.
+int main(int /*argc*/, char** /*argv*/) {
+  using namespace marian;
+
+#ifdef CUDA_FOUND
+  DeviceId device = {0, DeviceType::gpu};
+#else
+  DeviceId device = {0, DeviceType::cpu};
+#endif
+
+  const int dimModel = 512;
+  const int dimBatch = 64;
+  const int k = 100;
+  const int nBits = 1024;
+  const int iterations = 100;
+
+  for(int dimVocab : {8000, 32000, 128000}) {
+    auto g = New<ExpressionGraph>(true);
+    g->setDevice(device);
+    g->reserveWorkspaceMB(2048);
+
+    auto W = g->param("Wemb", {dimVocab, dimModel}, inits::glorotUniform());
+
+    LOG(info, "Vocabulary size {}, {} queries", dimVocab, dimBatch);
+    {
+      LOG(info, "Full softmax");
+      timer::AutoTimer timer;
+      for(int i = 0; i < iterations; ++i) {
+        g->clear();
+        auto x = g->constant({1, dimBatch, dimModel}, inits::glorotUniform());
+        auto y = logsoftmax(dot(x, W, false, true));
+        g->forward();
+      }
+    }
+
+    {
+      LOG(info, "LSH shortlist with {} bits, k = {}", nBits, k);
+      timer::AutoTimer timer;
+      for(int i = 0; i < iterations; ++i) {
+        g->clear();
+        auto x = g->constant({1, dimBatch, dimModel}, inits::glorotUniform());
+        auto idx = lsh::search(x, W, k, nBits); // [1, dimBatch, k], the codes of W are memoized
+        auto Wt = reshape(index_select(W, 0, flatten(idx)), {1, dimBatch, k, dimModel});
+        auto y = logsoftmax(bdot(reshape(x, {1, dimBatch, 1, dimModel}), Wt, false, true));
+        g->forward();
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,42 @@
+#include "marian.h"
+#include "common/timer.h"
+
+// Times layer and RMS normalization on the CPU for transformer sizes, each with the skip connection
+// as a separate addition and fused into the normalization, see addLayerNorm(). Not a real test,
+// just used for benchmarking by hand, like prod.cpp.
+int main(int /*argc*/, char** /*argv*/) {
+  using namespace marian;
+
+  const int iterations = 1000;
+
+  for(int dimModel : {512, 1024}) {
+    for(int rows : {1, 64, 1024}) {
+      auto g = New<ExpressionGraph>(true);
+      g->setDevice({0, DeviceType::cpu});
+      g->reserveWorkspaceMB(512);
+
+      auto gamma = g->param("gamma", {1, dimModel}, inits::ones());
+      auto beta = g->param("beta", {1, dimModel}, inits::zeros());
+
+      LOG(info, "{} rows of dimension {}", rows, dimModel);
+      auto run = [&](const std::string& name, std::function<Expr(Expr, Expr)> norm) {
+        LOG(info, name);
+        timer::AutoTimer timer;
+        for(int i = 0; i < iterations; ++i) {
+          g->clear();
+          auto x = g->constant({rows, dimModel}, inits::normal());
+          auto r = g->constant({rows, dimModel}, inits::normal());
+          norm(x, r);
+          g->forward();
+        }
+      };
+
+      run("layerNorm(x + r)", [&](Expr x, Expr r) { return layerNorm(x + r, gamma, beta, 1e-6f); });
+      run("addLayerNorm(x, r)", [&](Expr x, Expr r) { return addLayerNorm(x, r, gamma, beta, 1e-6f); });
+      run("rmsNorm(x + r)", [&](Expr x, Expr r) { return rmsNorm(x + r, gamma, nullptr, 1e-6f); });
+      run("addRmsNorm(x, r)", [&](Expr x, Expr r) { return addRmsNorm(x, r, gamma, nullptr, 1e-6f); });
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,120 @@
+#include "marian.h"
+#include "common/timer.h"
+#include "translator/nth_element.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+using namespace marian;
+
+#ifdef CUDA_FOUND
+// Compares the warp-level top-k of NthElementGPU, which also adds the path scores, against the block reduction
+// over the expanded path scores for batch sizes, beam sizes and vocabulary sizes of 32k to 256k.
+static void benchmarkGPU() {
+  const int iterations = 20;
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::gpu});
+  graph->reserveWorkspaceMB(2048);
+
+  for(int dimVocab : {32000, 128000, 256000}) {
+    for(int dimBatch : {1, 16, 64}) {
+      for(size_t beamSize : {1, 4, 8, 12, 16}) {
+        graph->clear();
+        auto stepScores = graph->constant({(int)beamSize, 1, dimBatch, dimVocab}, inits::normal(0.f, 5.f));
+        auto prevPathScores = graph->constant({(int)beamSize, 1, dimBatch, 1}, inits::normal(-10.f, 2.f));
+        auto expandedPathScores = swapAxes(prevPathScores + stepScores, 0, 2);
+        graph->forward();
+
+        auto run = [&](bool blockReduction, std::vector<unsigned>& keys) {
+          auto getNBestList = createGetNBestListFn(beamSize, dimBatch, graph->getDeviceId(), blockReduction);
+          std::vector<float> costs; std::vector<unsigned> words;
+          timer::Timer timer;
+          for(int i = 0; i < iterations; ++i) {
+            costs.clear(); keys.clear();
+            if(blockReduction)
+              getNBestList(expandedPathScores->val(), beamSize, costs, keys, /*isFirst=*/false, nullptr, words, nullptr);
+            else
+              getNBestList(stepScores->val(), beamSize, costs, keys, /*isFirst=*/false, nullptr, words, prevPathScores->val());
+          }
+          return timer.elapsed();
+        };
+
+        std::vector<unsigned> warpKeys, blockKeys;
+        double timeWarp = run(false, warpKeys);
+        double timeBlock = run(true, blockKeys);
+        std::cout << "gpu vocab " << dimVocab << " batch " << dimBatch << " beam " << beamSize
+                  << ": warp top-k " << timeWarp << "s, block reduction " << timeBlock << "s"
+                  << (warpKeys == blockKeys ? "" : " [MISMATCH]") << std::endl;
+      }
+    }
+  }
+}
+#endif
+
+// Compares the threshold-filter top-k of NthElementCPU against the previous std::partial_sort
+// implementation for beam sizes 1 to 12 and vocabulary sizes without shortlist, and the GPU top-k
+// implementations against each other if compiled with CUDA.
+int main(int /*argc*/, char** /*argv*/) {
+
+  const int dimBatch = 16;
+  const int iterations = 20;
+
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(1024);
+
+  std::mt19937 gen(1234);
+  std::normal_distribution<float> dist(0.f, 5.f);
+
+  for(int dimVocab : {32000, 64000}) {
+    for(size_t beamSize : {1, 2, 4, 6, 8, 12}) {
+      graph->clear();
+
+      std::vector<float> values(dimBatch * beamSize * dimVocab);
+      for(auto& v : values)
+        v = dist(gen);
+      auto scores = graph->constant({dimBatch, 1, (int)beamSize, dimVocab}, inits::fromVector(values));
+      graph->forward();
+
+      auto getNBestList = createGetNBestListFn(beamSize, dimBatch, graph->getDeviceId());
+      std::vector<float> outCosts; std::vector<unsigned> outKeys, outWords;
+      timer::Timer timerNew;
+      for(int i = 0; i < iterations; ++i) {
+        outCosts.clear(); outKeys.clear();
+        getNBestList(scores->val(), beamSize, outCosts, outKeys, /*isFirst=*/false, nullptr, outWords, nullptr);
+      }
+      double timeNew = timerNew.elapsed();
+
+      // previous implementation
+      std::vector<unsigned> refKeys;
+      size_t batchOffset = beamSize * dimVocab;
+      std::vector<int> idxs(batchOffset);
+      timer::Timer timerOld;
+      for(int i = 0; i < iterations; ++i) {
+        refKeys.clear();
+        const float* data = values.data();
+        for(size_t batchIdx = 0; batchIdx < dimBatch; ++batchIdx) {
+          std::iota(idxs.begin(), idxs.end(), 0);
+          std::partial_sort(idxs.begin(), idxs.begin() + beamSize, idxs.end(),
+                            [&](int a, int b) { return data[a] > data[b] || (data[a] == data[b] && a < b); });
+          for(size_t k = 0; k < beamSize; ++k)
+            refKeys.push_back((unsigned)(idxs[k] + batchIdx * batchOffset));
+          data += batchOffset;
+        }
+      }
+      double timeOld = timerOld.elapsed();
+
+      std::cout << "vocab " << dimVocab << " beam " << beamSize
+                << ": threshold-filter " << timeNew << "s, partial_sort " << timeOld << "s"
+                << (outKeys == refKeys ? "" : " [MISMATCH]") << std::endl;
+    }
+  }
+
+#ifdef CUDA_FOUND
+  benchmarkGPU();
+#endif
+
+  return 0;
+}
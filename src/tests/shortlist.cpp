@@ -0,0 +1,109 @@
+#include "marian.h"
+#include "common/timer.h"
+#include "data/batch_generator.h"
+#include "data/corpus.h"
+#include "data/shortlist.h"
+#include "layers/lsh.h"
+#include "translator/beam_search.h"
+#include "translator/scorers.h"
+
+// Decodes a dev set with the full output layer and with the shortlist given by the usual decoder options,
+// e.g. --shortlist lex.s2t 100 100 0 for lexical, binary or quicksand shortlists or --output-approx-knn for
+// LSH, and reports per setting:
+//  - the 1-best tokens of the full-softmax translation that are missing from the batch shortlist, as these
+//    can never be produced with the shortlist. LSH candidates depend on the decoder state of every step,
+//    hence for LSH the tokens that differ between both translations are counted instead;
+//  - the decoding time with and without the shortlist, of which the difference is spent in the output layer.
+// Not a real test, just used for tuning by hand, like prod.cpp; run it once per setting, e.g.
+//   ./test_shortlist -m model.npz -v vocab.spm vocab.spm -i dev.src --shortlist lex.s2t 50 50 0.01 -b 4
+int main(int argc, char** argv) {
+  using namespace marian;
+
+  auto options = parseOptions(argc, argv, cli::mode::translation, /*validate=*/true);
+  options->set("inference", true, "shuffle", "none");
+
+  auto corpus = New<data::Corpus>(options, /*translate=*/true);
+  auto vocabs = options->get<std::vector<std::string>>("vocabs");
+  auto trgVocab = New<Vocab>(options, vocabs.size() - 1);
+  trgVocab->load(vocabs.back());
+
+  std::vector<Ptr<io::ModelWeights>> modelWeights;
+  for(auto modelPath : options->get<std::vector<std::string>>("models"))
+    modelWeights.push_back(io::ModelWeights::shared(modelPath, io::MmapMode::OpportunisticMmap));
+
+  auto lshOpts = lsh::resolveOptions(options->get<std::vector<int>>("output-approx-knn", {}), modelWeights.front());
+  ABORT_IF(lshOpts.empty() && !options->hasAndNotEmpty("shortlist"), "Specify a --shortlist or --output-approx-knn to benchmark");
+  auto shortlistGenerator = data::createShortlistGenerator(options, corpus->getVocabs()[0], trgVocab, lshOpts,
+                                                           0, 1, vocabs.front() == vocabs.back());
+
+  auto graph = New<ExpressionGraph>(true);
+  auto prec = options->get<std::vector<std::string>>("precision", {"float32"});
+  graph->setDefaultElementType(typeFromString(prec[0]));
+  graph->setDevice(Config::getDevices(options).front());
+  if(graph->getDeviceId().type == DeviceType::cpu) {
+    graph->getBackend()->setOptimized(options->get<bool>("optimize"));
+    graph->getBackend()->setGemmType(options->get<std::string>("gemm-type"));
+    graph->getBackend()->setQuantizeRange(options->get<float>("quantize-range"));
+  }
+  graph->reserveWorkspaceMB(options->get<int>("workspace"));
+
+  auto scorers = createScorers(options, modelWeights);
+  for(auto scorer : scorers)
+    scorer->init(graph);
+  graph->forward();
+
+  auto decode = [&](Ptr<data::CorpusBatch> batch, Ptr<const data::ShortlistGenerator> generator, double& seconds) {
+    for(auto scorer : scorers)
+      scorer->setShortlistGenerator(generator);
+    timer::Timer timer;
+    auto histories = New<BeamSearch>(options, scorers, trgVocab)->search(graph, batch);
+    seconds += timer.elapsed();
+    return histories;
+  };
+
+  size_t numTokens = 0, numMissed = 0, numSentences = 0, numChanged = 0;
+  double fullSeconds = 0, shortlistSeconds = 0;
+  size_t shortlistSize = 0, numShortlists = 0;
+
+  data::BatchGenerator<data::Corpus> bg(corpus, options);
+  bg.prepare();
+  for(auto batch : bg) {
+    auto full = decode(batch, nullptr, fullSeconds);
+    auto shortlisted = decode(batch, shortlistGenerator, shortlistSeconds);
+
+    // the same selection as during decoding
+    auto shortlist = lshOpts.empty() ? shortlistGenerator->generate(batch) : nullptr;
+    if(shortlist) {
+      shortlistSize += shortlist->indices().size();
+      numShortlists++;
+    }
+
+    for(size_t i = 0; i < full.size(); ++i) {
+      const auto& fullWords = std::get<0>(full[i]->top());
+      const auto& shortlistedWords = std::get<0>(shortlisted[i]->top());
+      numSentences++;
+      numChanged += fullWords != shortlistedWords;
+      for(size_t j = 0; j < fullWords.size(); ++j) {
+        numTokens++;
+        if(shortlist)
+          numMissed += shortlist->tryForwardMap(fullWords[j].toWordIndex()) == data::Shortlist::npos;
+        else
+          numMissed += j >= shortlistedWords.size() || shortlistedWords[j] != fullWords[j];
+      }
+    }
+  }
+
+  LOG(info, "{} sentences, {} tokens of the full-softmax 1-best translations", numSentences, numTokens);
+  if(numShortlists > 0)
+    LOG(info, "Average shortlist size {:.1f}, full-softmax tokens outside of the shortlist: {} ({:.3f}%)",
+        (double)shortlistSize / numShortlists, numMissed, 100.0 * numMissed / std::max<size_t>(numTokens, 1));
+  else
+    LOG(info, "LSH k = {}, {} bits, full-softmax tokens that differ with the shortlist: {} ({:.3f}%)",
+        lshOpts[0], lshOpts[1], numMissed, 100.0 * numMissed / std::max<size_t>(numTokens, 1));
+  LOG(info, "Translations that differ with the shortlist: {} ({:.2f}%)",
+      numChanged, 100.0 * numChanged / std::max<size_t>(numSentences, 1));
+  LOG(info, "Decoding time: {:.2f}s full softmax, {:.2f}s with shortlist ({:.2f}x)",
+      fullSeconds, shortlistSeconds, fullSeconds / std::max(shortlistSeconds, 1e-9));
+
+  return 0;
+}
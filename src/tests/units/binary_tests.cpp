@@ -1,9 +1,13 @@
 #include "catch.hpp"
 #include "common/binary.h"
 #include "common/file_stream.h"
+#include "common/io.h"
+#include "training/sharded_checkpoint.h"
 
 #include "3rd_party/mio/mio.hpp"
 
+#include <cstdio>
+
 using namespace marian;
 
 TEST_CASE("a few operations on binary files", "[binary]") {
@@ -58,4 +62,124 @@ TEST_CASE("a few operations on binary files", "[binary]") {
       CHECK( std::equal(item2.data(), item2.data() + item2.size(), items[1].data()) );
     }
   }
+
+  SECTION("Save items in version 2 with a directory and (de)compress them") {
+    io::TemporaryFile temp("/tmp/", /*earlyUnlink=*/false);
+
+    std::vector<io::Item> items(3);
+    for(size_t k = 0; k < items.size(); ++k) {
+      int n = k == 1 ? 100000 : 5; // large enough to be compressed
+      items[k].name  = "item" + std::to_string(k);
+      items[k].shape = { n, 1 };
+      items[k].type  = Type::float32;
+      items[k].bytes.resize(n * sizeof(float));
+      for(int i = 0; i < n; ++i)
+        ((float*)items[k].bytes.data())[i] = (float)(i % 7);
+    }
+
+#ifdef USE_ZSTD
+    io::binary::setSaveFormat(BINARY_FILE_VERSION_DIRECTORY, /*compressionLevel=*/3);
+#else
+    io::binary::setSaveFormat(BINARY_FILE_VERSION_DIRECTORY);
+#endif
+    io::binary::saveItems(temp.getFileName(), items);
+    io::binary::setSaveFormat(BINARY_FILE_VERSION);
+
+    std::vector<io::Item> loaded;
+    io::binary::loadItems(temp.getFileName(), loaded);
+    REQUIRE( loaded.size() == items.size() );
+    for(size_t k = 0; k < items.size(); ++k) {
+      CHECK( items[k].name == loaded[k].name );
+      CHECK( items[k].shape == loaded[k].shape );
+      CHECK( std::equal(items[k].data(), items[k].data() + items[k].size(), loaded[k].data()) );
+    }
+
+    mio::mmap_source mmap(temp.getFileName());
+    std::vector<io::Item> mapped;
+    io::binary::loadItems(mmap.data(), mapped, /*mapped=*/true);
+    REQUIRE( mapped.size() == items.size() );
+    CHECK( mapped[0].mapped );
+    CHECK( std::equal(items[1].data(), items[1].data() + items[1].size(), mapped[1].data()) );
+#ifdef USE_ZSTD
+    CHECK( !mapped[1].mapped ); // compressed
+    CHECK( mmap.size() < items[1].bytes.size() );
+#endif
+
+    auto item = io::binary::getItem(mmap.data(), "item2");
+    CHECK( item.name == "item2" );
+    CHECK( std::equal(items[2].data(), items[2].data() + items[2].size(), item.data()) );
+    CHECK( io::binary::getItem(temp.getFileName(), "item3").name.empty() );
+  }
+
+  SECTION("Save items in the background and load them after waiting") {
+    io::TemporaryFile temp("/tmp/", /*earlyUnlink=*/false);
+    std::string fileName = temp.getFileName() + ".bin";
+
+    std::vector<float> v = { 3.14, 2.71, 1.0, 0.0, 1.41 };
+    io::Item item;
+    item.name  = "item";
+    item.shape = { 5, 1 };
+    item.type  = Type::float32;
+    item.bytes.resize(v.size() * sizeof(float));
+    std::copy((char*)v.data(), (char*)v.data() + v.size() * sizeof(float), item.bytes.data());
+
+    io::AsyncSaver saver;
+    {
+      io::AsyncSaver::Scope scope(saver);
+      std::vector<io::Item> items = {item};
+      io::saveItems(fileName, items);
+      items[0].bytes.assign(items[0].bytes.size(), 0); // the writer has its own copy
+    }
+    saver.wait();
+
+    std::vector<io::Item> items;
+    io::binary::loadItems(fileName, items);
+    REQUIRE( items.size() == 1 );
+    CHECK( item.name == items[0].name );
+    CHECK( std::equal(item.data(), item.data() + item.size(), items[0].data()) );
+    std::remove(fileName.c_str());
+  }
+
+  SECTION("Consolidate the parts of a sharded checkpoint") {
+    io::TemporaryFile temp("/tmp/", /*earlyUnlink=*/false);
+    std::string modelFileName = temp.getFileName() + ".npz";
+
+    auto makeItem = [](const std::string& name, const std::vector<float>& v) {
+      io::Item item;
+      item.name  = name;
+      item.shape = { 1, (int)v.size() };
+      item.type  = Type::float32;
+      item.bytes.resize(v.size() * sizeof(float));
+      std::copy((char*)v.data(), (char*)v.data() + v.size() * sizeof(float), item.bytes.data());
+      return item;
+    };
+
+    std::vector<float> step = { 7 };
+    io::saveItems(ShardedCheckpoint::partFileName(modelFileName, 0), {makeItem("sliced", {1, 2, 3}), makeItem("copy", step)});
+    io::saveItems(ShardedCheckpoint::partFileName(modelFileName, 1), {makeItem("sliced", {4, 5}), makeItem("copy", step)});
+
+    ShardedCheckpoint manifest;
+    manifest.parts = 2;
+    manifest.items = {{"sliced", Type::float32, 5 * sizeof(float), true},
+                      {"copy", Type::float32, sizeof(float), false}};
+    manifest.save(modelFileName);
+
+    ShardedCheckpoint loaded;
+    REQUIRE( loaded.load(modelFileName) );
+    CHECK( loaded.parts == 2 );
+    REQUIRE( loaded.items.size() == 2 );
+    CHECK( loaded.items[0].sliced );
+    CHECK( !loaded.items[1].sliced );
+
+    auto items = loaded.consolidate(modelFileName);
+    REQUIRE( items.size() == 2 );
+    std::vector<float> sliced = { 1, 2, 3, 4, 5 };
+    CHECK( items[0].shape.elements() == 5 );
+    CHECK( std::equal(sliced.begin(), sliced.end(), (const float*)items[0].data()) );
+    CHECK( *(const float*)items[1].data() == 7 );
+
+    std::remove(ShardedCheckpoint::manifestFileName(modelFileName).c_str());
+    std::remove(ShardedCheckpoint::partFileName(modelFileName, 0).c_str());
+    std::remove(ShardedCheckpoint::partFileName(modelFileName, 1).c_str());
+  }
 }
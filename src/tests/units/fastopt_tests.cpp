@@ -1,5 +1,6 @@
 #include "catch.hpp"
 #include "common/fastopt.h"
+#include "common/options.h"
 #include "3rd_party/yaml-cpp/yaml.h"
 
 using namespace marian;
@@ -78,3 +79,22 @@ TEST_CASE("Options can be accessed", "[fastopt]") {
     CHECK( o["seq"].as<std::vector<double>>() == std::vector<double>({1, 2, 3}) );
   } 
 }
+
+TEST_CASE("Options clones share their values until they change", "[fastopt]") {
+  auto options = New<Options>("foo", 1, "bar", std::string("baz"));
+  auto clone = options->clone();
+  CHECK( clone->get<int>("foo") == 1 );
+
+  clone->set("foo", 2);
+  CHECK( clone->get<int>("foo") == 2 );
+  CHECK( options->get<int>("foo") == 1 );
+
+  options->set("bar", std::string("qux"));
+  CHECK( options->get<std::string>("bar") == "qux" );
+  CHECK( clone->get<std::string>("bar") == "baz" );
+
+  auto with = options->with("new", true);
+  CHECK( with->get<bool>("new") );
+  CHECK_FALSE( options->has("new") );
+  CHECK( with->get<std::string>("bar") == "qux" );
+}
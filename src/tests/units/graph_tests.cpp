@@ -1,6 +1,15 @@
 #include "catch.hpp"
+#include "graph/auto_tuner.h"
 #include "graph/expression_graph.h"
 #include "graph/expression_operators.h"
+#include "optimizers/gradient_compressor.h"
+#include "optimizers/optimizers.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
 
 #ifdef CUDA_FOUND
 #include "tensors/gpu/backend.h"
@@ -121,3 +130,750 @@ TEST_CASE("Expression graph can be initialized with constant values (cpu)",
     REQUIRE(values == v);
   }
 }
+
+TEST_CASE("Forward passes replay memory plans (cpu)", "[graph]") {
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->setMemoryPlans(4);
+  graph->reserveWorkspaceMB(4);
+
+  std::vector<float> input({1, -2, 3, -4, 5, -6});
+  auto run = [&]() {
+    graph->clear();
+    auto x = graph->constant({2, 3}, inits::fromVector(input));
+    auto y = relu(x * 2.f) + exp(x) - tanh(x);
+    auto z = sum(y * y, /*axis=*/-1) + sigmoid(x);
+    graph->forward();
+
+    std::vector<float> values;
+    z->val()->get(values);
+    return values;
+  };
+
+  auto first = run();
+  REQUIRE(graph->getMemoryPlanner()->size() == 1);
+
+  auto second = run();
+  auto third = run();
+  CHECK(second == first);
+  CHECK(third == first);
+  CHECK(graph->getMemoryPlanner()->size() == 1);
+}
+
+TEST_CASE("Frozen graphs replay with new inputs (cpu)", "[graph]") {
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+
+  auto weights = graph->param("W", {3, 2}, inits::fromVector(std::vector<float>({1, 2, 3, 4, 5, 6})));
+  auto build = [&](const std::vector<float>& input) {
+    auto x = graph->constant({2, 3}, inits::fromVector(input));
+    x->set_name("x");
+    auto y = relu(dot(reshape(x, {2, 3}), weights) - 10.f);
+    return std::vector<Expr>({sum(y * y, /*axis=*/-1), y});
+  };
+
+  std::vector<float> first({1, 2, 3, 4, 5, 6}), second({-1, 0, 1, 2, 3, 4});
+  std::vector<float> expected, values;
+
+  graph->clear();
+  auto outputs = build(second);
+  graph->forward();
+  outputs[0]->val()->get(expected);
+  outputs.clear();
+
+  graph->clear();
+  auto frozen = graph->freeze({"x"}, build(first));
+  graph->forward();
+
+  graph->clear();
+  auto replayed = graph->replay(frozen, {{"x", inits::fromVector(second)}});
+  REQUIRE(replayed.size() == 2);
+  graph->forward();
+  replayed[0]->val()->get(values);
+  CHECK(values == expected);
+
+  // the second output is still there after the pass, the other values were freed
+  CHECK(replayed[1]->val());
+  CHECK(frozen->size() > 2);
+  graph->clear();
+}
+
+TEST_CASE("Elementwise chains are fused in inference (cpu)", "[graph]") {
+  std::vector<float> x({-2, -1, 0, 1, 2, 3}), mask({1, 0, 1}), bias({0.5f, -0.5f});
+
+  auto run = [&](bool fusion, std::string& dot) {
+    auto graph = New<ExpressionGraph>(/*inference=*/true);
+    graph->setDevice({0, DeviceType::cpu});
+    graph->setElementwiseFusion(fusion);
+    graph->reserveWorkspaceMB(4);
+
+    auto xs = graph->constant({2, 3}, inits::fromVector(x));
+    auto ms = graph->constant({1, 3}, inits::fromVector(mask));
+    auto bs = graph->constant({2, 1}, inits::fromVector(bias));
+    auto y = tanh(relu(xs * ms + bs) * 2.f - exp(xs) / (abs(bs) + 1.f));
+
+    dot = graph->graphviz();
+    graph->forward();
+
+    std::vector<float> values;
+    y->val()->get(values);
+    return values;
+  };
+
+  std::string unfusedDot, fusedDot;
+  auto expected = run(false, unfusedDot);
+  auto values = run(true, fusedDot);
+
+  CHECK(unfusedDot.find("fused") == std::string::npos);
+  CHECK(fusedDot.find("fused") != std::string::npos);
+  REQUIRE(values.size() == expected.size());
+  for(size_t i = 0; i < values.size(); ++i)
+    CHECK(values[i] == Approx(expected[i]).epsilon(1e-5));
+}
+
+TEST_CASE("Transposes of axes of size 1 are simplified in inference (cpu)", "[graph]") {
+  std::vector<float> x({1, 2, 3, 4, 5, 6});
+
+  auto run = [&](bool simplification, std::string& dot) {
+    auto graph = New<ExpressionGraph>(/*inference=*/true);
+    graph->setDevice({0, DeviceType::cpu});
+    graph->setGraphSimplification(simplification);
+    graph->reserveWorkspaceMB(4);
+
+    auto xs = graph->constant({2, 1, 3}, inits::fromVector(x));
+    auto y1 = 2.f * transpose(xs, {1, 0, 2});
+    auto y2 = 2.f * transpose(xs, {2, 1, 0});
+
+    dot = graph->graphviz();
+    graph->forward();
+
+    std::vector<float> values1, values2;
+    y1->val()->get(values1);
+    y2->val()->get(values2);
+    values1.insert(values1.end(), values2.begin(), values2.end());
+    return values1;
+  };
+
+  std::string dot, simplifiedDot;
+  auto expected = run(false, dot);
+  auto values = run(true, simplifiedDot);
+
+  CHECK(dot.find("reshape") == std::string::npos);
+  CHECK(simplifiedDot.find("reshape") != std::string::npos);
+  CHECK(simplifiedDot.find("transpose") != std::string::npos); // the second one moves axes of size 2 and 3
+  CHECK(values == expected);
+}
+
+TEST_CASE("Allocator reuses blocks of size classes (cpu)", "[graph]") {
+  auto allocator = New<Allocator>(DeviceId(0, DeviceType::cpu), /*bytes=*/1 << 20, /*step=*/1 << 20, /*alignment=*/256);
+  allocator->setSizeClasses(true);
+
+  auto a = allocator->alloc(5000);
+  CHECK(a->size() == 5120);
+  uint8_t* ptr = a->data();
+  allocator->free(a);
+  CHECK(allocator->statistics().cached == 5120); // 5120 is the class of 4096 + 1024
+
+  // an allocation of the same class takes the freed block
+  auto b = allocator->alloc(4900);
+  CHECK(b->data() == ptr);
+  CHECK(allocator->statistics().reused == 1);
+  CHECK(allocator->statistics().cached == 0);
+
+  // cached blocks return to the gaps before the allocator grows, the class of d takes all of its memory
+  auto c = allocator->alloc(300 * 1024);
+  allocator->free(c);
+  allocator->free(b);
+  auto d = allocator->alloc((1 << 20) - 1024);
+  CHECK(allocator->size() == (size_t)(1 << 20));
+  CHECK(allocator->statistics().peak == (size_t)(1 << 20));
+  allocator->free(d);
+
+  auto stats = allocator->statistics();
+  CHECK(stats.used == 0);
+  CHECK(stats.held == 0);
+  CHECK(stats.reserved == (size_t)(1 << 20));
+  CHECK(stats.gaps == 0);
+}
+
+TEST_CASE("Activation offloading keeps the gradients (cpu)", "[graph]") {
+  std::vector<float> x({1, -2, 0.5f, 3, -1, 2}), w1({0.1f, -0.2f, 0.3f, 0.4f, -0.5f, 0.6f}), w2({0.7f, -0.8f, 0.9f});
+
+  auto run = [&](bool offloading, bool& offloaded) {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->setActivationOffloading(offloading);
+    graph->reserveWorkspaceMB(4);
+
+    auto xs = graph->constant({3, 2}, inits::fromVector(x));
+    auto W1 = graph->param("W1", {2, 3}, inits::fromVector(w1));
+    auto W2 = graph->param("W2", {3, 1}, inits::fromVector(w2));
+    auto h = checkpoint(tanh(dot(xs, W1)));
+    auto y = sum(sum(dot(h, W2) * dot(h, W2), -1), -2);
+
+    graph->forward();
+    offloaded = !h->val();
+    graph->backward();
+
+    std::vector<float> grads, grads2;
+    W1->grad()->get(grads);
+    W2->grad()->get(grads2);
+    grads.insert(grads.end(), grads2.begin(), grads2.end());
+    return grads;
+  };
+
+  bool offloaded = false;
+  auto expected = run(false, offloaded);
+  CHECK(!offloaded);
+  auto grads = run(true, offloaded);
+  CHECK(offloaded);
+  REQUIRE(grads.size() == expected.size());
+  for(size_t i = 0; i < grads.size(); ++i)
+    CHECK(grads[i] == Approx(expected[i]).epsilon(1e-5));
+}
+
+TEST_CASE("Gradient checkpointing policies keep the gradients (cpu)", "[graph]") {
+  std::vector<float> x({1, -2, 0.5f, 3, -1, 2}), w({0.1f, -0.2f, 0.3f, 0.4f});
+
+  auto run = [&](bool checkpointing, const std::string& policy, size_t every, CheckpointingStatistics& stats) {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->setCheckpointing(checkpointing);
+    graph->setCheckpointPolicy(policy, every);
+    graph->reserveWorkspaceMB(4);
+
+    auto h = graph->constant({3, 2}, inits::fromVector(x));
+    auto W = graph->param("W", {2, 2}, inits::fromVector(w));
+    for(int layer = 0; layer < 4; ++layer)
+      h = checkpoint(tanh(dot(h, W) * 2.f + 1.f));
+    auto y = sum(sum(h * h, -1), -2);
+
+    graph->forward();
+    graph->backward();
+    stats = graph->getCheckpointingStatistics();
+
+    std::vector<float> grads;
+    W->grad()->get(grads);
+    return grads;
+  };
+
+  CheckpointingStatistics none, manual, products, everyOther;
+  auto expected = run(false, "manual", 1, none);
+  for(auto& config : {std::make_tuple("manual", 1, &manual),
+                      std::make_tuple("products", 1, &products),
+                      std::make_tuple("manual", 2, &everyOther)}) {
+    auto grads = run(true, std::get<0>(config), std::get<1>(config), *std::get<2>(config));
+    REQUIRE(grads.size() == expected.size());
+    for(size_t i = 0; i < grads.size(); ++i)
+      CHECK(grads[i] == Approx(expected[i]).epsilon(1e-5));
+  }
+
+  CHECK(none.activationBytes == 0);
+  CHECK(manual.recomputedBytes > 0);
+  CHECK(manual.activationBytes == products.activationBytes);
+  CHECK(products.recomputedBytes < manual.recomputedBytes);
+  CHECK(everyOther.recomputedBytes > manual.recomputedBytes);
+  CHECK(everyOther.recomputedFlops > manual.recomputedFlops);
+}
+
+TEST_CASE("Gradient buckets are reported last to first during backward (cpu)", "[graph]") {
+  auto graph = New<ExpressionGraph>();
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+
+  auto x = graph->constant({2, 4}, inits::ones());
+  auto W1 = graph->param("W1", {4, 64}, inits::ones());
+  auto W2 = graph->param("W2", {64, 64}, inits::ones());
+  auto W3 = graph->param("W3", {64, 1}, inits::ones());
+  auto unused = graph->param("unused", {1, 8}, inits::ones());
+  auto y = sum(sum(dot(tanh(dot(tanh(dot(x, W1)), W2)), W3), -1), -2);
+  graph->forward();
+
+  std::vector<std::pair<size_t, size_t>> reported;
+  graph->setGradientBuckets(/*bucketBytes=*/1024, [&](size_t begin, size_t end) { reported.push_back({begin, end}); });
+  graph->backward();
+  graph->setGradientBuckets(1024, nullptr);
+
+  auto buckets = graph->gradientBuckets();
+  CHECK(buckets.size() >= 3);
+  CHECK(buckets.front().first == 0);
+  CHECK(buckets.back().second == graph->params()->grads()->size());
+  for(size_t i = 1; i < buckets.size(); ++i)
+    CHECK(buckets[i].first == buckets[i - 1].second);
+
+  REQUIRE(reported.size() == buckets.size());
+  for(size_t i = 0; i < reported.size(); ++i)
+    CHECK(reported[i] == buckets[buckets.size() - 1 - i]);
+}
+
+// rank 0 of two, the parameters of rank 1 are all ones
+class OnesOfOtherRank : public ParameterShards {
+public:
+  std::map<std::string, size_t> gathered;
+  std::map<std::string, std::vector<float>> reduced;
+
+  OnesOfOtherRank() : ParameterShards(0, 2) {}
+
+  void gather(const Expr& param, Tensor value) override {
+    gathered[param->name()]++;
+    if(!owns(param))
+      value->set(1.f);
+  }
+
+  void reduce(const Expr& param, Tensor grad) override { grad->get(reduced[param->name()]); }
+};
+
+TEST_CASE("Sharded parameters are gathered for forward and backward (cpu)", "[graph]") {
+  auto shards = New<OnesOfOtherRank>();
+  std::map<std::string, std::vector<float>> expected;
+  for(bool sharded : {false, true}) {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->reserveWorkspaceMB(4);
+    if(sharded)
+      graph->setParameterShards(shards);
+
+    auto x = graph->constant({2, 4}, inits::fromVector(std::vector<float>({0.1f, -0.2f, 0.3f, 0.f, 0.2f, 0.1f, -0.1f, 0.4f})));
+    auto W1 = graph->param("W1", {4, 8}, inits::ones());
+    auto b1 = graph->param("b1", {1, 8}, inits::ones());
+    auto W2 = graph->param("W2", {2, 32}, inits::ones()); // read through a view
+    auto W3 = graph->param("W3", {8, 1}, inits::ones());
+    auto h = tanh(dot(tanh(dot(x, W1) + b1), reshape(W2, {8, 8})));
+    auto y = sum(sum(dot(h, W3), -1), -2);
+    graph->forward();
+    graph->backward();
+
+    for(auto p : *graph->params()) {
+      if(!sharded) {
+        p->grad()->get(expected[p->name()]);
+        continue;
+      }
+      CHECK(shards->gathered[p->name()] == 2);
+      CHECK(!p->val() == !shards->owns(p));
+      CHECK(!p->grad() == !shards->owns(p));
+      auto& grads = shards->reduced[p->name()];
+      REQUIRE(grads.size() == expected[p->name()].size());
+      for(size_t i = 0; i < grads.size(); ++i)
+        CHECK(grads[i] == Approx(expected[p->name()][i]).epsilon(1e-5));
+    }
+    if(sharded)
+      CHECK(!shards->owns(W2));
+  }
+}
+
+// rank 1 of two, the parts of rank 0 are all zeros
+class SecondOfTwoRanks : public TensorParallel {
+public:
+  SecondOfTwoRanks() : TensorParallel(1, 2) {}
+
+  void allReduce(Tensor /*tensor*/) override {}
+
+  void allGather(Tensor part, Tensor gathered) override {
+    std::vector<float> values(part->size(), 0.f), own;
+    part->get(own);
+    values.insert(values.end(), own.begin(), own.end());
+    gathered->set(values);
+  }
+};
+
+TEST_CASE("Tensor-parallel graphs load and save their parts of split parameters (cpu)", "[graph]") {
+  auto tensorParallel = New<SecondOfTwoRanks>();
+  auto graph = New<ExpressionGraph>();
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+  graph->setTensorParallel(tensorParallel);
+
+  std::vector<float> values = {0, 1, 2, 3, 4, 5, 6, 7};
+  io::Item whole;
+  whole.name = "W";
+  whole.shape = {2, 4};
+  whole.bytes.assign((const char*)values.data(), (const char*)(values.data() + values.size()));
+
+  auto W = graph->param("W", {2, 2}, tensorParallel->loadPart(whole, {2, 2}));
+  tensorParallel->split(W->name(), -1);
+  auto y = sum(sum(W, -1), -2);
+  graph->forward();
+
+  std::vector<float> part;
+  W->val()->get(part);
+  CHECK(part == std::vector<float>({2, 3, 6, 7}));
+
+  std::vector<io::Item> items;
+  graph->getItems(items);
+  REQUIRE(items.size() == 1);
+  CHECK(items[0].shape == Shape({2, 4}));
+  const float* saved = (const float*)items[0].data();
+  CHECK(std::vector<float>(saved, saved + 8) == std::vector<float>({0, 0, 2, 3, 0, 0, 6, 7}));
+}
+
+TEST_CASE("Cross-entropy of logits split by vocabulary between tensor-parallel ranks (cpu)", "[graph]") {
+  auto graph = New<ExpressionGraph>();
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+  graph->setTensorParallel(New<SecondOfTwoRanks>());
+
+  // the classes 2 and 3 of this rank, the log-sum-exp of rank 0 is 0
+  std::vector<float> values = {0.5f, -1.f, 2.f, 0.25f};
+  auto z = graph->param("z", {2, 2}, inits::fromVector(values));
+  auto labels = graph->indices(std::vector<IndexType>({3, 0}));
+  auto ce = cross_entropy(vocab_parallel_logits(z), labels);
+  auto loss = sum(sum(ce, -1), -2);
+  graph->forward();
+  graph->backward();
+
+  CHECK(ce->shape() == Shape({2, 1}));
+  std::vector<float> losses, grads;
+  ce->val()->get(losses);
+  float lse0 = std::log(1.f + std::exp(0.5f) + std::exp(-1.f));
+  float lse1 = std::log(1.f + std::exp(2.f) + std::exp(0.25f));
+  CHECK(losses[0] == Approx(lse0 + 1.f));
+  CHECK(losses[1] == Approx(lse1)); // the label of rank 0 picks no logit here
+
+  z->grad()->get(grads);
+  CHECK(grads[0] == Approx(std::exp(0.5f - lse0)));
+  CHECK(grads[1] == Approx(std::exp(-1.f - lse0) - 1.f));
+  CHECK(grads[2] == Approx(std::exp(2.f - lse1)));
+  CHECK(grads[3] == Approx(std::exp(0.25f - lse1)));
+}
+
+TEST_CASE("PowerSGD sums gradients of low rank over devices exactly (cpu)", "[graph]") {
+  std::vector<Ptr<ExpressionGraph>> graphs;
+  std::vector<float> expected;
+  for(int d = 0; d < 2; ++d) {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->reserveWorkspaceMB(4);
+
+    std::vector<float> xs(16);
+    for(size_t i = 0; i < xs.size(); ++i)
+      xs[i] = 0.1f * ((i + d) % 5) - 0.2f;
+    auto x = graph->constant({1, 16}, inits::fromVector(xs));
+    auto W = graph->param("W", {16, 8}, inits::ones());
+    auto b = graph->param("b", {1, 8}, inits::zeros());
+    auto y = sum(sum(tanh(dot(x, W) + b), -1), -2); // the gradient of W has rank 1
+    graph->forward();
+    graph->backward();
+
+    std::vector<float> grads;
+    graph->params()->grads()->get(grads);
+    expected.resize(grads.size());
+    for(size_t i = 0; i < grads.size(); ++i)
+      expected[i] += grads[i];
+    graphs.push_back(graph);
+  }
+
+  std::vector<Ptr<GradientCompressor>> compressors = {New<GradientCompressor>("powersgd", 2, 2),
+                                                      New<GradientCompressor>("powersgd", 2, 2)};
+  for(size_t step = 0;; ++step) {
+    auto first = compressors[0]->reduce(step, graphs[0]);
+    auto second = compressors[1]->reduce(step, graphs[1]);
+    REQUIRE(first.size() == second.size());
+    if(first.empty())
+      break;
+    for(size_t i = 0; i < first.size(); ++i) { // all-reduce
+      std::vector<float> a, b;
+      first[i]->get(a);
+      second[i]->get(b);
+      for(size_t j = 0; j < a.size(); ++j)
+        a[j] += b[j];
+      first[i]->set(a);
+      second[i]->set(a);
+    }
+  }
+
+  for(auto graph : graphs) {
+    std::vector<float> grads;
+    graph->params()->grads()->get(grads);
+    REQUIRE(grads.size() == expected.size());
+    for(size_t i = 0; i < grads.size(); ++i)
+      CHECK(grads[i] == Approx(expected[i]).margin(1e-4));
+  }
+}
+
+TEST_CASE("Fused Adam update matches the unfused one (cpu)", "[graph]") {
+  std::vector<std::vector<float>> values, smoothed;
+  for(bool fused : {false, true}) {
+    auto options = New<Options>();
+    options->set("optimizer", "adam");
+    options->set("learn-rate", 0.01f);
+    options->set("exponential-smoothing", 0.1f);
+    options->set("fused-optimizer", fused);
+    options->set("optimizer-params", std::vector<float>({0.9f, 0.98f, 1e-9f, 0.01f}));
+    auto opt = Optimizer(options);
+
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->reserveWorkspaceMB(4);
+    std::vector<float> ws(24);
+    for(size_t i = 0; i < ws.size(); ++i)
+      ws[i] = 0.1f * (i % 7) - 0.3f;
+    for(int step = 0; step < 3; ++step) {
+      graph->clear();
+      auto W = graph->param("W", {4, 6}, inits::fromVector(ws));
+      auto y = sum(sum(W * W * W, -1), -2);
+      graph->forward();
+      graph->backward();
+      opt->update(graph, /*mbSize=*/1, /*costScaleFactor=*/4.f);
+    }
+
+    std::vector<float> v, s;
+    graph->params()->vals()->get(v);
+    opt->swapWithSmoothed(graph->params()->vals());
+    graph->params()->vals()->get(s);
+    values.push_back(v);
+    smoothed.push_back(s);
+  }
+
+  REQUIRE(values[0].size() == values[1].size());
+  for(size_t i = 0; i < values[0].size(); ++i) {
+    CHECK(values[1][i] == Approx(values[0][i]).margin(1e-6));
+    CHECK(smoothed[1][i] == Approx(smoothed[0][i]).margin(1e-6));
+  }
+}
+
+TEST_CASE("Exponential smoothing on a background thread matches the synchronous one (cpu)", "[graph]") {
+  std::vector<std::vector<float>> smoothed;
+  for(bool async : {false, true}) {
+    auto options = New<Options>();
+    options->set("optimizer", "adam");
+    options->set("learn-rate", 0.01f);
+    options->set("exponential-smoothing", 0.1f);
+    options->set("exponential-smoothing-async", async);
+    options->set("optimizer-params", std::vector<float>({0.9f, 0.98f, 1e-9f, 0.01f}));
+    auto opt = Optimizer(options);
+
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->reserveWorkspaceMB(4);
+    std::vector<float> ws(24);
+    for(size_t i = 0; i < ws.size(); ++i)
+      ws[i] = 0.1f * (i % 7) - 0.3f;
+    for(int step = 0; step < 3; ++step) {
+      graph->clear();
+      auto W = graph->param("W", {4, 6}, inits::fromVector(ws));
+      auto y = sum(sum(W * W * W, -1), -2);
+      graph->forward();
+      graph->backward();
+      opt->update(graph, /*mbSize=*/1);
+    }
+
+    std::vector<float> s;
+    opt->swapWithSmoothed(graph->params()->vals());
+    graph->params()->vals()->get(s);
+    smoothed.push_back(s);
+  }
+
+  REQUIRE(smoothed[0].size() == smoothed[1].size());
+  for(size_t i = 0; i < smoothed[0].size(); ++i)
+    CHECK(smoothed[1][i] == Approx(smoothed[0][i]).margin(1e-6));
+}
+
+TEST_CASE("8-bit Adam follows Adam (cpu)", "[graph]") {
+  std::vector<std::vector<float>> values;
+  for(std::string optimizer : {"adam", "adam8bit"}) {
+    auto options = New<Options>();
+    options->set("optimizer", optimizer);
+    options->set("learn-rate", 0.01f);
+    auto opt = Optimizer(options);
+
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->reserveWorkspaceMB(4);
+    std::vector<float> ws(300); // more than one block of Adam8bitCodec
+    for(size_t i = 0; i < ws.size(); ++i)
+      ws[i] = 0.01f * (i % 61) - 0.3f;
+    for(int step = 0; step < 5; ++step) {
+      graph->clear();
+      auto W = graph->param("W", {10, 30}, inits::fromVector(ws));
+      auto y = sum(sum(W * W * W, -1), -2);
+      graph->forward();
+      graph->backward();
+      opt->update(graph, /*mbSize=*/1);
+    }
+
+    std::vector<float> v;
+    graph->params()->vals()->get(v);
+    values.push_back(v);
+  }
+
+  for(size_t i = 0; i < values[0].size(); ++i)
+    CHECK(values[1][i] == Approx(values[0][i]).margin(1e-3));
+}
+
+TEST_CASE("Adafactor continues the same from a checkpoint (cpu)", "[graph]") {
+  auto options = New<Options>();
+  options->set("optimizer", "adafactor");
+  options->set("learn-rate", 0.01f);
+
+  auto graph = New<ExpressionGraph>();
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(4);
+  std::vector<float> ws(24);
+  for(size_t i = 0; i < ws.size(); ++i)
+    ws[i] = 0.1f * (i % 7) - 0.3f;
+  auto step = [&](Ptr<OptimizerBase> opt) {
+    graph->clear();
+    auto W = graph->param("W", {4, 6}, inits::fromVector(ws));
+    auto b = graph->param("b", {1, 6}, inits::zeros());
+    auto y = sum(sum(W * W * W, -1), -2) + sum(sum(tanh(b + 1.f), -1), -2);
+    graph->forward();
+    graph->backward();
+    opt->setParameterLayout(graph->params(), 0);
+    opt->update(graph, /*mbSize=*/1);
+  };
+
+  auto first = Optimizer(options);
+  step(first);
+  step(first);
+
+  std::vector<io::Item> items;
+  first->save(items, {first}, [](const OptimizerBase::GatherStateGetFunc& getFn) { return getFn(0); }, true);
+  auto vt = std::find_if(items.begin(), items.end(), [](const io::Item& item) { return item.name == "adafactor_vt"; });
+  REQUIRE(vt != items.end());
+  CHECK(vt->shape.elements() == graph->params()->vals()->size());
+
+  std::vector<float> saved, continued, reloaded;
+  graph->params()->vals()->get(saved);
+  step(first);
+  graph->params()->vals()->get(continued);
+
+  graph->params()->vals()->set(saved);
+  auto second = Optimizer(options);
+  second->load(items, {second}, {graph->getBackend()},
+               [](const io::Item& data, const OptimizerBase::ScatterStateSetFunc& setFn) {
+                 setFn(0, data.bytes.data(), data.bytes.data() + data.bytes.size());
+               }, true);
+  step(second);
+  graph->params()->vals()->get(reloaded);
+
+  CHECK(continued != saved);
+  for(size_t i = 0; i < continued.size(); ++i)
+    CHECK(reloaded[i] == Approx(continued[i]).margin(1e-6));
+}
+
+TEST_CASE("Memory profile traces node allocations (cpu)", "[graph]") {
+  std::string path = "memory_profile_test.json";
+  {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->reserveWorkspaceMB(4);
+    graph->setMemoryProfile(path, /*passes=*/1);
+
+    auto x = graph->constant({4, 3}, inits::ones());
+    auto W = graph->param("W", {3, 5}, inits::ones());
+    auto y = sum(sum(tanh(dot(x, W)), -1), -2);
+    graph->forward();
+    graph->backward();
+  } // the trace is written when the graph is destroyed
+
+  std::string tracePath = "memory_profile_test.cpu0.json";
+  std::ifstream in(tracePath);
+  REQUIRE(in.good());
+  std::stringstream trace;
+  trace << in.rdbuf();
+  in.close();
+  std::remove(tracePath.c_str());
+
+  auto json = trace.str();
+  CHECK(json.find("\"traceEvents\"") != std::string::npos);
+  CHECK(json.find("\"name\": \"forward\"") != std::string::npos);
+  CHECK(json.find("\"name\": \"backward\"") != std::string::npos);
+  CHECK(json.find("\"cat\": \"gradient\"") != std::string::npos);
+  CHECK(json.find("\"name\": \"dot ") != std::string::npos);
+  CHECK(json.find("\"name\": \"peak\"") != std::string::npos);
+}
+
+TEST_CASE("Node profile traces forward and backward calls (cpu)", "[graph]") {
+  {
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::cpu});
+    graph->reserveWorkspaceMB(4);
+    graph->setNodeProfile(/*passes=*/1, /*top=*/5, "node_profile_test.json");
+
+    auto x = graph->constant({4, 3}, inits::ones());
+    auto W = graph->param("W", {3, 5}, inits::ones());
+    auto y = sum(sum(tanh(dot(x, W)), -1), -2);
+    graph->forward();
+    graph->backward();
+  } // the report is written when the graph is destroyed
+
+  std::string tracePath = "node_profile_test.cpu0.json";
+  std::ifstream in(tracePath);
+  REQUIRE(in.good());
+  std::stringstream trace;
+  trace << in.rdbuf();
+  in.close();
+  std::remove(tracePath.c_str());
+
+  auto json = trace.str();
+  CHECK(json.find("\"name\": \"dot\", \"cat\": \"node\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0") != std::string::npos);
+  CHECK(json.find("\"name\": \"tanh\", \"cat\": \"node\", \"ph\": \"X\", \"pid\": 0, \"tid\": 1") != std::string::npos);
+}
+
+TEST_CASE("Shared values are used by all CPU inference graphs (cpu)", "[graph]") {
+  std::string path = "shared_values_test.npz";
+  auto item = io::fromVector(std::vector<float>({1, 2, 3, 4, 5, 6}), "W");
+  item.shape = Shape({2, 3});
+  io::saveItems(path, {item});
+  auto weights = New<io::ModelWeights>(path);
+
+  auto createGraph = [&]() {
+    auto graph = New<ExpressionGraph>(/*inference=*/true);
+    graph->setDevice({0, DeviceType::cpu});
+    graph->reserveWorkspaceMB(4);
+    graph->setSharedValues(true);
+    graph->load(weights, /*markReloaded=*/false);
+    return graph;
+  };
+
+  auto graph1 = createGraph();
+  auto graph2 = createGraph();
+  std::vector<Expr> params, scaled, biases;
+  for(auto graph : {graph1, graph2}) {
+    auto W = graph->get("W");
+    auto b = graph->param("b", {1, 3}, inits::zeros());
+    params.push_back(W);
+    scaled.push_back(2.f * W); // memoized, as its only child is a parameter
+    biases.push_back(b);
+    graph->forward();
+  }
+  std::remove(path.c_str());
+
+  CHECK(params[0]->val()->data() == params[1]->val()->data());
+  CHECK(scaled[0]->val()->data() == scaled[1]->val()->data());
+  CHECK(biases[0]->val()->data() != biases[1]->val()->data()); // not loaded, so not shared
+
+  graph1.reset(); // the shared values outlive the graph that filled them
+  std::vector<float> values;
+  scaled[1]->val()->get(values);
+  CHECK(values == std::vector<float>({2, 4, 6, 8, 10, 12}));
+  CHECK(graph2->getSharedValues()->size() == 3);
+}
+
+TEST_CASE("GEMM variant tuner keeps the fastest variant across runs", "[graph]") {
+  std::string path = "autotune_cache_test.tsv";
+  std::remove(path.c_str());
+
+  VariantTuner tuner("test", {"a", "b", "c"}, New<AutoTunerCache>(path, "model.npz:1"), /*runsPerVariant=*/2);
+  for(size_t run = 0; run < 6; ++run) {
+    auto choice = tuner.choose("64x64x64");
+    CHECK(choice.explore);
+    CHECK(choice.variant == run % 3);
+    tuner.record("64x64x64", choice.variant, choice.variant == 1 ? 0.1 : 0.2 + run);
+  }
+  auto decided = tuner.choose("64x64x64");
+  CHECK(decided.variant == 1);
+  CHECK(!decided.explore);
+  CHECK(tuner.choose("128x64x64").explore); // other shapes are tuned on their own
+
+  // a new process finds the decision for this model, but not for others
+  VariantTuner reloaded("test", {"a", "b", "c"}, New<AutoTunerCache>(path, "model.npz:1"));
+  auto cached = reloaded.choose("64x64x64");
+  CHECK(cached.variant == 1);
+  CHECK(!cached.explore);
+  VariantTuner otherModel("test", {"a", "b", "c"}, New<AutoTunerCache>(path, "other.npz:1"));
+  CHECK(otherModel.choose("64x64x64").explore);
+
+  std::remove(path.c_str());
+}
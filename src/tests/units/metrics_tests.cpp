@@ -0,0 +1,36 @@
+#include "catch.hpp"
+#include "common/metrics.h"
+
+using namespace marian;
+
+TEST_CASE("Metrics", "[common]") {
+  metrics::Registry registry;
+
+  SECTION("counters and gauges are rendered with their labels") {
+    auto counter = registry.counter("requests_total", "Number of requests", "endpoint=\"bulk\"");
+    counter->inc();
+    counter->inc(2);
+    registry.gauge("queue_depth", "Pending requests", []() { return 5.0; });
+
+    auto text = registry.render();
+    CHECK( text.find("# TYPE requests_total counter\n") != std::string::npos );
+    CHECK( text.find("requests_total{endpoint=\"bulk\"} 3\n") != std::string::npos );
+    CHECK( text.find("# HELP queue_depth Pending requests\n") != std::string::npos );
+    CHECK( text.find("queue_depth 5\n") != std::string::npos );
+  }
+
+  SECTION("histogram buckets are cumulative") {
+    auto histogram = registry.histogram("latency_seconds", "Latency", {0.1, 1});
+    histogram->observe(0.05);
+    histogram->observe(0.1); // upper bounds are inclusive
+    histogram->observe(0.5);
+    histogram->observe(5);
+
+    auto text = registry.render();
+    CHECK( text.find("latency_seconds_bucket{le=\"0.1\"} 2\n") != std::string::npos );
+    CHECK( text.find("latency_seconds_bucket{le=\"1\"} 3\n") != std::string::npos );
+    CHECK( text.find("latency_seconds_bucket{le=\"+Inf\"} 4\n") != std::string::npos );
+    CHECK( text.find("latency_seconds_sum 5.65\n") != std::string::npos );
+    CHECK( text.find("latency_seconds_count 4\n") != std::string::npos );
+  }
+}
@@ -5,12 +5,16 @@
 #include "catch.hpp"
 #include "graph/expression_graph.h"
 #include "graph/expression_operators.h"
+#include "tensors/cpu/bfloat16.h"
+#include "tensors/gpu/int8.h"
 
 #ifdef CUDA_FOUND
 #include "tensors/gpu/backend.h"
 #endif
 
+#include <algorithm>
 #include <cmath>
+#include <numeric>
 
 using namespace marian;
 
@@ -658,6 +662,60 @@ void tests(DeviceType device, Type floatType = Type::float32) {
     CHECK(values2 == values);
   }
 
+  SECTION("affine transformation with relu and dropout for training") {
+    graph->clear();
+    graph->setInference(false);
+    values.clear();
+
+    std::vector<T> vA({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12});
+    std::vector<T> vB({1, -2, 3, 4, -5, 6});
+
+    auto A1 = graph->param("A1", {4, 3}, inits::fromVector(vA));
+    auto B1 = graph->param("B1", {3, 2}, inits::fromVector(vB));
+    auto bias1 = graph->param("bias1", {1, 2}, inits::fromValue(2));
+
+    auto A2 = graph->param("A2", {4, 3}, inits::fromVector(vA));
+    auto B2 = graph->param("B2", {3, 2}, inits::fromVector(vB));
+    auto bias2 = graph->param("bias2", {1, 2}, inits::fromValue(2));
+
+    auto affRelu1 = affineWithReluDropout(A1, B1, bias1);
+    auto affRelu2 = relu(affine(A2, B2, bias2));
+
+    auto A3 = graph->param("A3", {4, 3}, inits::fromVector(vA));
+    auto B3 = graph->param("B3", {3, 2}, inits::fromVector(vB));
+    auto bias3 = graph->param("bias3", {1, 2}, inits::fromValue(2));
+    auto affDropout = affineWithReluDropout(A3, B3, bias3, 0.5f);
+
+    auto top = sum(flatten(affRelu1 * affRelu1)) + sum(flatten(affRelu2 * affRelu2)) + sum(flatten(affDropout));
+
+    graph->forward();
+    graph->backward();
+
+    affRelu1->val()->get(values);
+    affRelu2->val()->get(values2);
+    CHECK(std::equal(values.begin(), values.end(), values2.begin(), floatApprox));
+
+    // dropout either drops an element or scales it by 1 / (1 - 0.5)
+    std::vector<T> values3;
+    affDropout->val()->get(values3);
+    for(size_t i = 0; i < values3.size(); ++i)
+      CHECK((values3[i] == 0 || floatApprox(values3[i], 2 * values2[i])));
+
+    A1->grad()->get(values);
+    A2->grad()->get(values2);
+    CHECK(std::equal(values.begin(), values.end(), values2.begin(), floatApprox));
+
+    B1->grad()->get(values);
+    B2->grad()->get(values2);
+    CHECK(std::equal(values.begin(), values.end(), values2.begin(), floatApprox));
+
+    bias1->grad()->get(values);
+    bias2->grad()->get(values2);
+    CHECK(std::equal(values.begin(), values.end(), values2.begin(), floatApprox));
+
+    graph->setInference(true);
+  }
+
   SECTION("bdot") {
     graph->clear();
     values.clear();
@@ -718,6 +776,57 @@ void tests(DeviceType device, Type floatType = Type::float32) {
     CHECK(vCt == values);
   }
 
+  if(floatType == Type::float32) { // fused kernel is implemented for float32 only
+    SECTION("logsoftmax_shortlist") {
+      graph->clear();
+      values.clear();
+      std::vector<T> values2;
+
+      std::vector<T> vX({ 1, 2,    // beam 0, batch 0
+                          0, 1,    // beam 0, batch 1
+                         -1, 3,    // beam 1, batch 0
+                          2, 2});  // beam 1, batch 1
+      std::vector<T> vW({ 1, 0,
+                          0, 1,
+                          1, 1,
+                         -1, 2,
+                          3, -1});
+      std::vector<T> vb({0.5f, -1, 0, 2, 1});
+      std::vector<IndexType> vIdx({0, 2, 4,   // per beam and batch entry
+                                   1, 3, 4,
+                                   0, 1, 3,
+                                   2, 3, 4});
+      std::vector<IndexType> vIdxShared({0, 2, 4,   // per batch entry, shared over the beam
+                                         1, 3, 4});
+
+      auto x    = graph->param("x", {2, 2, 1, 2}, inits::fromVector(vX));
+      auto W    = graph->param("W", {5, 2}, inits::fromVector(vW));
+      auto b    = graph->param("b", {1, 5}, inits::fromVector(vb));
+      auto idx  = graph->constant({2, 2, 3}, inits::fromVector(vIdx), Type::uint32);
+      auto idxS = graph->constant({1, 2, 3}, inits::fromVector(vIdxShared), Type::uint32);
+
+      auto fused  = logsoftmax_shortlist(x, W, idx, b);
+      auto fusedS = logsoftmax_shortlist(x, W, idxS);
+      auto ref    = logsoftmax(bdot(x, reshape(rows(W, flatten(idx)), {2, 2, 3, 2}), false, true)
+                                + reshape(cols(b, flatten(idx)), {2, 2, 1, 3}));
+      auto refS   = logsoftmax(bdot(x, reshape(rows(W, flatten(idxS)), {1, 2, 3, 2}), false, true));
+
+      graph->forward();
+
+      CHECK(fused->shape() == Shape({2, 2, 1, 3}));
+      CHECK(fusedS->shape() == Shape({2, 2, 1, 3}));
+      CHECK(logsoftmax(fused) == fused); // already normalized
+
+      fused->val()->get(values);
+      ref->val()->get(values2);
+      CHECK(std::equal(values.begin(), values.end(), values2.begin(), floatApprox));
+
+      fusedS->val()->get(values);
+      refS->val()->get(values2);
+      CHECK(std::equal(values.begin(), values.end(), values2.begin(), floatApprox));
+    }
+  }
+
   SECTION("repeat") {
     graph->clear();
     values.clear();
@@ -745,6 +854,24 @@ void tests(DeviceType device, Type floatType = Type::float32) {
     CHECK(values == vC);
   }
 
+  SECTION("cumulative average") {
+    graph->clear();
+    values.clear();
+
+    std::vector<T> vAvg({1, 2, 3, 4, 5, 6});
+    std::vector<T> vX({4, 4, 4, 0, 0, 0});
+    std::vector<T> vC({1.75, 2.5, 3.25, 3, 3.75, 4.5});
+
+    auto avg = graph->param("avg", {2, 3}, inits::fromVector(vAvg));
+    auto x = graph->param("x", {2, 3}, inits::fromVector(vX));
+    auto C = cumulative_average(avg, x, /*count=*/3);
+    graph->forward();
+
+    CHECK(C->shape() == Shape({2, 3}));
+    C->val()->get(values);
+    CHECK(values == vC);
+  }
+
   SECTION("flatten") {
     graph->clear();
     values.clear();
@@ -1253,6 +1380,196 @@ TEST_CASE("Expression graph supports basic math operations (gpu fp16)", "[operat
   tests<float16>(DeviceType::gpu, Type::float16);
 }
 #endif
+
+#if CUDA_VERSION >= 11040
+TEST_CASE("CUDA graphs replay forward passes (gpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  std::vector<float> qs(2 * 3 * 5 * 8), ks(3 * 7 * 8);
+  for(size_t i = 0; i < qs.size(); ++i)
+    qs[i] = std::sin(0.1f * i);
+  for(size_t i = 0; i < ks.size(); ++i)
+    ks[i] = std::cos(0.3f * i);
+
+  // inputs change in every pass, so replays have to read them instead of reproducing the captured pass
+  auto run = [&](Ptr<ExpressionGraph> graph, int pass) {
+    std::vector<float> q(qs);
+    for(auto& x : q)
+      x *= pass + 1;
+    graph->clear();
+    auto qe = graph->constant({2, 3, 5, 8}, inits::fromVector(q));
+    auto ke = graph->constant({1, 3, 7, 8}, inits::fromVector(ks));
+    auto scores = softmax(bdot(qe, ke, false, true, 0.5f));            // broadcasts keys over the beam
+    auto y = concatenate({relu(bdot(scores, ke) + 1.f) * sigmoid(qe), qe}, -1);
+    graph->forward();
+    std::vector<float> values;
+    y->val()->get(values);
+    return values;
+  };
+
+  auto eager = New<ExpressionGraph>(/*inference=*/true);
+  eager->setDevice({0, DeviceType::gpu});
+  eager->reserveWorkspaceMB(16);
+
+  auto captured = New<ExpressionGraph>(/*inference=*/true);
+  captured->setDevice({0, DeviceType::gpu});
+  captured->reserveWorkspaceMB(16);
+  captured->getBackend()->setCudaGraphs(4);
+
+  for(int pass = 0; pass < 4; ++pass) { // runs, captures and then replays
+    auto expected = run(eager, pass);
+    auto values = run(captured, pass);
+    CHECK(std::equal(values.begin(), values.end(), expected.begin(), floatApprox));
+  }
+}
+#endif
+
+TEST_CASE("FP8 affine layers approximate float32 (gpu)", "[operator]") {
+  // norm of the difference relative to the norm of the float32 result, FP8 has 3 mantissa bits for activations
+  auto relativeError = [](const std::vector<float>& x, const std::vector<float>& y) {
+    double diff = 0, norm = 0;
+    for(size_t i = 0; i < x.size(); ++i) {
+      diff += (x[i] - y[i]) * (x[i] - y[i]);
+      norm += y[i] * y[i];
+    }
+    return std::sqrt(diff / norm);
+  };
+
+  // output and weight gradient of the last of a few training steps, the first one only collects the amax
+  auto run = [](size_t fp8) {
+    Config::seed = 1234;
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::gpu});
+    graph->getBackend()->setFp8(fp8); // does nothing on GPUs without FP8 tensor cores
+    graph->reserveWorkspaceMB(16);
+
+    std::vector<float> values, grads;
+    for(int step = 0; step < 3; ++step) {
+      graph->clear();
+      auto x = graph->constant({32, 64}, inits::normal());
+      auto W = graph->param("W", {64, 48}, inits::normal());
+      auto b = graph->param("b", {1, 48}, inits::zeros());
+      auto y = affine(x, W, b);
+      auto cost = sum(flatten(y * y));
+      graph->forward();
+      graph->backward();
+      y->val()->get(values);
+      W->grad()->get(grads);
+    }
+    return std::make_pair(values, grads);
+  };
+
+  auto expected = run(0);
+  auto actual = run(16);
+  CHECK(relativeError(actual.first, expected.first) < 0.1);
+  CHECK(relativeError(actual.second, expected.second) < 0.1);
+}
+
+TEST_CASE("Int8 weights in dot and affine (gpu)", "[operator]") {
+  // norm of the difference relative to the norm of the float32 result, activations and weights have 8 bits
+  auto relativeError = [](const std::vector<float>& x, const std::vector<float>& y) {
+    double diff = 0, norm = 0;
+    for(size_t i = 0; i < x.size(); ++i) {
+      diff += (x[i] - y[i]) * (x[i] - y[i]);
+      norm += y[i] * y[i];
+    }
+    return std::sqrt(diff / norm);
+  };
+
+  std::vector<float> wValues(64 * 32);
+  for(size_t i = 0; i < wValues.size(); ++i)
+    wValues[i] = std::sin(0.1f * i) * (1.f + (i % 32)); // columns of different ranges
+
+  // converted on the CPU as in marian-conv
+  io::Item item;
+  {
+    auto cpuGraph = New<ExpressionGraph>(/*inference=*/true);
+    cpuGraph->setDevice({0, DeviceType::cpu});
+    auto allocator = New<TensorAllocator>(cpuGraph->getBackend());
+    Tensor wFloat, wInt8;
+    allocator->allocate(wFloat, {64, 32}, Type::float32);
+    allocator->allocate(wInt8, {64, 32}, Type::int8gpu);
+    wFloat->set(wValues);
+    gpu::int8gemm::QuantizeB(wInt8, wFloat, /*quantizeRange=*/0.f);
+    wInt8->get(item, "W_int8");
+  }
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::gpu});
+  graph->reserveWorkspaceMB(16);
+
+  auto x = graph->constant({2, 8, 64}, inits::uniform(-1.f, 1.f));
+  auto bias = graph->constant({1, 32}, inits::uniform(-1.f, 1.f));
+  auto W = graph->constant({64, 32}, inits::fromVector(wValues));
+  auto WInt8 = graph->param("W_int8", {64, 32}, inits::fromItem(item), Type::int8gpu);
+
+  auto expectedAffine = affine(x, W, bias);
+  auto actualAffine = affine(x, WInt8, bias);
+  auto expectedRelu = relu(affine(x, W, bias));
+  auto actualRelu = affineWithReluDropout(x, WInt8, bias, /*dropProb=*/0.f);
+  auto expectedDot = dot(x, W);
+  auto actualDot = dot(x, WInt8);
+  graph->forward();
+
+  std::vector<std::pair<Expr, Expr>> results = {{actualAffine, expectedAffine}, {actualRelu, expectedRelu}, {actualDot, expectedDot}};
+  for(auto& result : results) {
+    CHECK(result.first->shape() == result.second->shape());
+    std::vector<float> actual, expected;
+    result.first->val()->get(actual);
+    result.second->val()->get(expected);
+    CHECK(relativeError(actual, expected) < 0.03);
+  }
+}
+#endif
+
+#ifdef CUDA_FOUND
+TEST_CASE("Fused dropout, skip connection and normalization (gpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  // output and gradients of all inputs of layerNorm(dropout(x) + r) or rmsNorm(dropout(x) + r), fused or composed
+  auto run = [](bool fused, bool rms) {
+    Config::seed = 1234;
+    auto graph = New<ExpressionGraph>();
+    graph->setDevice({0, DeviceType::gpu});
+    graph->reserveWorkspaceMB(16);
+
+    int cols = 37;
+    auto x = graph->param("x", {2, 5, cols}, inits::normal(1.f, 2.f));
+    auto r = graph->param("r", {2, 5, cols}, inits::normal(-1.f, 1.f));
+    auto gamma = graph->param("gamma", {1, cols}, inits::normal());
+    auto beta = rms ? nullptr : graph->param("beta", {1, cols}, inits::normal());
+    auto mask = graph->dropoutMask(0.5f, {5, cols});
+    auto weights = graph->constant({2, 5, cols}, inits::normal());
+
+    Expr y;
+    if(fused)
+      y = rms ? addRmsNorm(x, r, gamma, beta, 1e-6f, mask) : addLayerNorm(x, r, gamma, beta, 1e-6f, mask);
+    else
+      y = rms ? rmsNorm(dropout(x, mask) + r, gamma, beta, 1e-6f) : layerNorm(dropout(x, mask) + r, gamma, beta, 1e-6f);
+    CHECK((y->type() == "add_layer_normalization" || y->type() == "add_rms_normalization") == fused);
+
+    auto cost = sum(flatten(y * weights));
+    graph->forward();
+    graph->backward();
+
+    std::vector<std::vector<float>> results(5);
+    y->val()->get(results[0]);
+    x->grad()->get(results[1]);
+    r->grad()->get(results[2]);
+    gamma->grad()->get(results[3]);
+    if(beta)
+      beta->grad()->get(results[4]);
+    return results;
+  };
+
+  for(bool rms : {false, true}) {
+    auto expected = run(false, rms);
+    auto actual = run(true, rms);
+    for(size_t i = 0; i < expected.size(); ++i)
+      CHECK(std::equal(actual[i].begin(), actual[i].end(), expected[i].begin(), floatApprox));
+  }
+}
 #endif
 
 #ifdef BLAS_FOUND
@@ -1261,6 +1578,572 @@ TEST_CASE("Expression graph supports basic math operations (cpu)", "[operator]")
 }
 #endif
 
+#ifdef BLAS_FOUND
+TEST_CASE("Intra-op threads do not change results (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  // large enough to be split over the threads, see cpu::Backend::parallelFor()
+  auto run = [](size_t threads) {
+    Config::seed = 1234;
+    auto graph = New<ExpressionGraph>(/*inference=*/true);
+    graph->setDevice({0, DeviceType::cpu});
+    graph->getBackend()->setIntraOpThreads(threads);
+    graph->reserveWorkspaceMB(64);
+
+    auto x = graph->constant({4, 64, 256}, inits::normal());
+    auto W = graph->constant({256, 512}, inits::normal());
+    auto g = graph->constant({256}, inits::ones());
+    auto h = dot(x, W);
+    std::vector<Expr> outputs = {h, softmax(h), logsoftmax(h), layerNorm(x, g),
+                                 transpose(x, {1, 0, 2}), transpose(x, {2, 0, 1})};
+    graph->forward();
+
+    std::vector<std::vector<float>> values(outputs.size());
+    for(size_t i = 0; i < outputs.size(); ++i)
+      outputs[i]->val()->get(values[i]);
+    return values;
+  };
+
+  auto expected = run(1);
+  auto actual = run(4);
+  for(size_t i = 0; i < expected.size(); ++i)
+    CHECK(std::equal(actual[i].begin(), actual[i].end(), expected[i].begin(), floatApprox));
+}
+
+TEST_CASE("Tuned GEMM splits do not change results (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->getBackend()->setIntraOpThreads(4);
+  graph->reserveWorkspaceMB(64);
+
+  auto x = graph->constant({4, 64, 256}, inits::normal());
+  auto W = graph->constant({256, 512}, inits::normal());
+  auto Wt = graph->constant({512, 256}, inits::normal());
+  auto h = dot(x, W);
+  auto ht = dot(x, Wt, false, /*transB=*/true);
+  graph->forward();
+  std::vector<float> expected, expectedT;
+  h->val()->get(expected);
+  ht->val()->get(expectedT);
+
+  // the tuner of --gemm-type auto tries every split in turn on the first passes
+  graph->getBackend()->setGemmType("auto");
+  for(int pass = 0; pass < 6; ++pass) {
+    graph->forward();
+    std::vector<float> actual, actualT;
+    h->val()->get(actual);
+    ht->val()->get(actualT);
+    CHECK(std::equal(actual.begin(), actual.end(), expected.begin(), floatApprox));
+    CHECK(std::equal(actualT.begin(), actualT.end(), expectedT.begin(), floatApprox));
+  }
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Fused skip connection and normalization (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  // an odd number of columns covers the scalar tails of the SIMD kernels
+  for(int cols : {37, 512}) {
+    graph->clear();
+    auto x = graph->constant({2, 5, cols}, inits::normal(1.f, 2.f));
+    auto r = graph->constant({2, 5, cols}, inits::normal(-1.f, 1.f));
+    auto gamma = graph->constant({1, cols}, inits::normal());
+    auto beta = graph->constant({1, cols}, inits::normal());
+
+    std::vector<Expr> expected = {layerNorm(x + r, gamma, beta, 1e-6f), rmsNorm(x + r, gamma, nullptr, 1e-6f)};
+    std::vector<Expr> actual = {addLayerNorm(x, r, gamma, beta, 1e-6f), addRmsNorm(x, r, gamma, nullptr, 1e-6f)};
+    graph->forward();
+
+    for(size_t i = 0; i < expected.size(); ++i) {
+      std::vector<float> values, fused;
+      expected[i]->val()->get(values);
+      actual[i]->val()->get(fused);
+      CHECK(actual[i]->type() == (i == 0 ? "add_layer_normalization" : "add_rms_normalization"));
+      CHECK(std::equal(fused.begin(), fused.end(), values.begin(), floatApprox));
+    }
+  }
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Fused masked softmax (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.00001f); };
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  // 16, 12 and 13 columns go through the float32x8, float32x4 and float kernels
+  for(int cols : {16, 12, 13}) {
+    graph->clear();
+    auto z = graph->constant({2, 3, 4, cols}, inits::normal());
+    // attention masks broadcast over heads and queries, the second one is one value per row
+    auto mask = graph->constant({2, 1, 1, cols}, inits::uniform(-10.f, 0.f));
+    auto rowMask = graph->constant({3, 4, 1}, inits::uniform(-10.f, 0.f));
+
+    std::vector<Expr> expected = {softmax(z * 0.5f + mask), softmax(z + rowMask)};
+    std::vector<Expr> actual = {maskedSoftmax(z, mask, 0.5f), maskedSoftmax(z, rowMask)};
+    graph->forward();
+
+    for(size_t i = 0; i < expected.size(); ++i) {
+      std::vector<float> values, fused;
+      expected[i]->val()->get(values);
+      actual[i]->val()->get(fused);
+      CHECK(actual[i]->type() == "lambda");
+      CHECK(std::equal(fused.begin(), fused.end(), values.begin(), floatApprox));
+    }
+  }
+}
+#endif
+
+TEST_CASE("Fused masked pooling and cosine (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  auto x = graph->constant({5, 3, 16}, inits::normal());
+  auto y = graph->constant({1, 3, 16}, inits::normal());
+  // the second sentence has three steps, the last one all five
+  std::vector<float> maskValues = {1, 1, 1,
+                                   0, 1, 1,
+                                   0, 1, 1,
+                                   0, 0, 1,
+                                   0, 0, 1};
+  auto mask = graph->constant({5, 3, 1}, inits::fromVector(maskValues));
+
+  auto maxPool = max(x * mask + (1.f - mask) * -9999.f, /*axis=*/-3);
+  std::vector<Expr> expected = {maxPool,
+                                sum(x * mask, /*axis=*/-3) / sum(mask, /*axis=*/-3),
+                                scalar_product(maxPool, y, -1) / (sqrt(scalar_product(maxPool, maxPool, -1)) * sqrt(scalar_product(y, y, -1)))};
+  auto fusedMax = maskedPool(x, mask);
+  std::vector<Expr> actual = {fusedMax, maskedPool(x, mask, /*mean=*/true), cosine(fusedMax, y)};
+  graph->forward();
+
+  for(size_t i = 0; i < expected.size(); ++i) {
+    std::vector<float> values, fused;
+    expected[i]->val()->get(values);
+    actual[i]->val()->get(fused);
+    CHECK(actual[i]->type() == "lambda");
+    CHECK(actual[i]->shape() == expected[i]->shape());
+    CHECK(std::equal(fused.begin(), fused.end(), values.begin(), floatApprox));
+  }
+}
+
+TEST_CASE("Max pooling with masking (cpu)", "[operator]") {
+  auto graph = New<ExpressionGraph>();
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  // two kernels over five steps, windows of two steps with a shorter last one, the second step is masked
+  std::vector<float> xValues = {1, 3, 2, 5, 4,
+                               -1, 0, 7, 1, 2};
+  auto x = graph->param("x", {1, 2, 5}, inits::fromVector(xValues));
+  auto mask = graph->constant({1, 1, 5}, inits::fromVector(std::vector<float>({1, 0, 1, 1, 1})));
+  auto pooled = pooling_with_masking(x, mask, /*width=*/2);
+  auto loss = sum(flatten(pooled));
+  graph->forward();
+  graph->backward();
+
+  CHECK(pooled->shape() == Shape({1, 2, 3}));
+  std::vector<float> values, grads;
+  pooled->val()->get(values);
+  // the elements are [windows, dimBatch * numKernels]
+  CHECK(values == std::vector<float>({1, 0, 5, 7, 4, 2}));
+  x->grad()->get(grads);
+  CHECK(grads == std::vector<float>({1, 0, 0, 1, 1,
+                                     0, 1, 1, 0, 1}));
+}
+
+TEST_CASE("Fused embeddings with positions (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  const int vocab = 20, dimEmb = 8;
+  auto E = graph->constant({vocab, dimEmb}, inits::normal());
+  float scale = std::sqrt((float)dimEmb);
+
+  // encoder input [dimWords=5, dimBatch=3, dimEmb] from position 0, decoder input [dimBeam=2, dimSteps=4, dimBatch=3,
+  // dimEmb] from position 7
+  std::vector<IndexType> encIdx(5 * 3), decIdx(2 * 4 * 3);
+  for(size_t i = 0; i < encIdx.size(); ++i)
+    encIdx[i] = (IndexType)((7 * i + 3) % vocab);
+  for(size_t i = 0; i < decIdx.size(); ++i)
+    decIdx[i] = (IndexType)((5 * i + 1) % vocab);
+
+  // factored rows as Embedding::multiRows() passes them: row r sums the embeddings of r % vocab and r / 4
+  std::vector<float> csrWeights;
+  std::vector<IndexType> csrIndices, csrOffsets = {0};
+  for(int r = 0; r < 5 * 3; ++r) {
+    csrIndices.insert(csrIndices.end(), {(IndexType)(r % vocab), (IndexType)(r / 4)});
+    csrWeights.insert(csrWeights.end(), {1.f, 0.5f});
+    csrOffsets.push_back((IndexType)csrIndices.size());
+  }
+  auto weights = graph->constant({(int)csrWeights.size()}, inits::fromVector(csrWeights));
+  auto indices = graph->constant({(int)csrIndices.size()}, inits::fromVector(csrIndices), Type::uint32);
+  auto offsets = graph->constant({(int)csrOffsets.size()}, inits::fromVector(csrOffsets), Type::uint32);
+
+  auto positions = [&](int dimWords, int start) {
+    return graph->constant({dimWords, 1, dimEmb}, inits::sinusoidalPositionEmbeddings(start));
+  };
+
+  std::vector<Expr> expected = {
+    scale * reshape(rows(E, encIdx), {5, 3, dimEmb}) + positions(5, 0),
+    scale * reshape(rows(E, decIdx), {2, 4, 3, dimEmb}) + positions(4, 7),
+    scale * reshape(csr_dot({5 * 3, vocab}, weights, indices, offsets, E), {5, 3, dimEmb}) + positions(5, 0)};
+  std::vector<Expr> actual = {
+    embedWithPositions(E, graph->indices(encIdx), nullptr, nullptr, {5, 3, dimEmb}, scale, 0),
+    embedWithPositions(E, graph->indices(decIdx), nullptr, nullptr, {2, 4, 3, dimEmb}, scale, 7),
+    embedWithPositions(E, indices, weights, offsets, {5, 3, dimEmb}, scale, 0)};
+  graph->forward();
+
+  for(size_t i = 0; i < expected.size(); ++i) {
+    std::vector<float> values, fused;
+    expected[i]->val()->get(values);
+    actual[i]->val()->get(fused);
+    CHECK(actual[i]->type() == "lambda");
+    CHECK(fused.size() == values.size());
+    CHECK(std::equal(fused.begin(), fused.end(), values.begin(), floatApprox));
+  }
+}
+
+TEST_CASE("Fused Gumbel sampling with truncation (cpu)", "[operator]") {
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  // log-probabilities of rank r are proportional to -0.02 * r, ranks are shuffled over the row
+  const int rows = 3, cols = 300;
+  std::vector<float> probs(cols), logProbs(rows * cols);
+  for(int r = 0; r < cols; ++r)
+    probs[r] = std::exp(-0.02f * r);
+  float sum = std::accumulate(probs.begin(), probs.end(), 0.f);
+  for(auto& prob : probs)
+    prob /= sum;
+  for(int j = 0; j < rows; ++j)
+    for(int r = 0; r < cols; ++r)
+      logProbs[j * cols + (7 * r + j) % cols] = std::log(probs[r]);
+
+  // unnormalized logits only keep the same entries with normalize
+  std::vector<float> shifted(logProbs);
+  for(auto& logit : shifted)
+    logit += 3.f;
+  auto logits = graph->constant({rows, cols}, inits::fromVector(logProbs));
+  auto shiftedLogits = graph->constant({rows, cols}, inits::fromVector(shifted));
+
+  size_t nucleus = 0; // ranks of which the mass of the better ones is at most 0.9
+  for(float mass = 0.f; nucleus < probs.size() && mass <= 0.9f; mass += probs[nucleus++]) {}
+  size_t epsilon = std::count_if(probs.begin(), probs.end(), [](float prob) { return prob >= 0.005f; });
+
+  struct Case { Expr sample; size_t kept; };
+  std::vector<Case> cases = {
+    {gumbel_sampling(logits, SamplingMethod::Full, 0.f, 0.5f), (size_t)cols},
+    {gumbel_sampling(logits, SamplingMethod::TopK, 10.f), 10},
+    {gumbel_sampling(logits, SamplingMethod::Nucleus, 0.9f), nucleus},
+    {gumbel_sampling(shiftedLogits, SamplingMethod::Nucleus, 0.9f, 1.f, /*normalize=*/true), nucleus},
+    {gumbel_sampling(logits, SamplingMethod::Epsilon, 0.005f, 2.f), epsilon},
+    {gumbel_sampling(shiftedLogits, SamplingMethod::Epsilon, 0.005f, 1.f, /*normalize=*/true), epsilon}};
+  graph->forward();
+
+  CHECK(nucleus > 64); // the nucleus needs more than the first candidates
+  for(auto& c : cases) {
+    std::vector<float> values;
+    c.sample->val()->get(values);
+    for(int j = 0; j < rows; ++j) {
+      size_t kept = 0, keptBest = 0;
+      float mass = 0.f;
+      for(int i = 0; i < cols; ++i) {
+        float value = values[j * cols + i];
+        if(std::isinf(value))
+          continue;
+        ++kept;
+        mass += std::exp(value);
+        if(logProbs[j * cols + i] >= std::log(probs[c.kept - 1]))
+          ++keptBest;
+      }
+      CHECK(kept == c.kept);
+      CHECK(keptBest == c.kept); // the kept entries are the best ones
+      CHECK(mass == Approx(1.f).margin(0.001f));
+    }
+  }
+}
+
+#ifdef BLAS_FOUND
+TEST_CASE("Affine transformation with shortlisted rows (cpu)", "[operator]") {
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  const int vocab = 50, dim = 32;
+  std::vector<IndexType> shortlist = {0, 3, 4, 17, 18, 31, 42, 49};
+
+  auto W = graph->param("W", {vocab, dim}, inits::normal()); // memoized in inference
+  auto b = graph->param("b", {1, vocab}, inits::normal());
+  std::vector<float> input(2 * 3 * dim);
+  for(size_t i = 0; i < input.size(); ++i)
+    input[i] = std::sin((float)i);
+  auto x = graph->constant({2, 3, 1, dim}, inits::fromVector(input));
+  auto indices = graph->indices(shortlist);
+
+  auto expected = affine(x, index_select(W, 0, indices), index_select(b, -1, indices), false, true);
+  auto rows = affineRows(x, W, indices, b);
+  auto rowsNoBias = affineRows(x, W, indices);
+  graph->forward();
+
+  CHECK(rows->shape() == Shape({2, 3, 1, (int)shortlist.size()}));
+
+  std::vector<float> values, actual, actualNoBias, biases;
+  expected->val()->get(values);
+  rows->val()->get(actual);
+  rowsNoBias->val()->get(actualNoBias);
+  b->val()->get(biases);
+  for(size_t i = 0; i < values.size(); ++i) {
+    CHECK(actual[i] == Approx(values[i]).margin(0.0001f));
+    CHECK(actualNoBias[i] + biases[shortlist[i % shortlist.size()]] == Approx(values[i]).margin(0.0001f));
+  }
+
+#if USE_FBGEMM
+  // int8 GEMM over the packed rows, twice with the same shortlist to hit the cache of packed rows
+  graph->getBackend()->setGemmType("packed8");
+  for(int run = 0; run < 2; ++run) {
+    graph->clear();
+    x = graph->constant({2, 3, 1, dim}, inits::fromVector(input));
+    auto packedRows = affineRows(x, W, graph->indices(shortlist), b);
+    graph->forward();
+    CHECK(packedRows->type() == "gemmPacked8");
+
+    packedRows->val()->get(actual);
+    for(size_t i = 0; i < values.size(); ++i)
+      CHECK(actual[i] == Approx(values[i]).margin(0.5f)); // int8 quantization error
+  }
+#endif
+}
+
+TEST_CASE("Attention GEMMs on joined heads (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  // keys and values are shared across the beam of 2, as in decoder cross-attention
+  const int dimBeam = 2, dimBatch = 3, numHeads = 4, dimHead = 8, dimQuery = 5, dimKeys = 7;
+  const int dimModel = numHeads * dimHead;
+  auto q = graph->constant({dimBeam, dimBatch, dimQuery, dimModel}, inits::normal());
+  auto k = graph->constant({1, dimBatch, dimKeys, dimModel}, inits::normal());
+  auto v = graph->constant({1, dimBatch, dimKeys, dimModel}, inits::normal());
+  auto w = graph->constant({dimBeam * dimBatch, numHeads, dimQuery, dimKeys}, inits::uniform());
+
+  auto split = [&](Expr x) {
+    int batch = x->shape()[-4] * x->shape()[-3];
+    return transpose(reshape(x, {batch, x->shape()[-2], numHeads, dimHead}), {0, 2, 1, 3});
+  };
+  auto expectedScores = bdot_legacy(split(q), split(k), false, true, 0.5f);
+  auto expectedContext = reshape(transpose(bdot_legacy(w, split(v)), {0, 2, 1, 3}), {dimBeam * dimBatch, dimQuery, dimModel});
+
+  auto scores = bdotSplitHeads(q, k, numHeads, 0.5f);
+  auto context = bdotJoinHeads(w, v, numHeads);
+  graph->forward();
+
+  CHECK(scores->shape() == expectedScores->shape());
+  CHECK(context->shape() == expectedContext->shape());
+
+  std::vector<Expr> expected = {expectedScores, expectedContext};
+  std::vector<Expr> actual = {scores, context};
+  for(size_t i = 0; i < expected.size(); ++i) {
+    std::vector<float> values, joined;
+    expected[i]->val()->get(values);
+    actual[i]->val()->get(joined);
+    CHECK(actual[i]->type() == "lambda");
+    CHECK(std::equal(joined.begin(), joined.end(), values.begin(), floatApprox));
+  }
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("Tiled attention (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(64);
+
+  // 300 queries and keys span several tiles of both, keys and values are shared across the beam of 2
+  const int dimBeam = 2, dimBatch = 3, numHeads = 2, dimLength = 300, dimHead = 16, dimValue = 8;
+  const int dimBatchHeads = dimBatch * numHeads;
+  const float scale = 0.25f;
+
+  std::vector<float> vMask(dimBatch * dimLength, 1.f); // batch entries padded after 300, 200 and 100 positions
+  for(int b = 0; b < dimBatch; ++b)
+    for(int k = dimLength - 100 * b; k < dimLength; ++k)
+      vMask[b * dimLength + k] = 0.f;
+  std::vector<float> vSlopes = {-0.5f, -0.25f}, vBiases = {1.f, -2.f};
+
+  // the ALiBi bias of alibiLogMask() with a causal mask, computed here as reference
+  std::vector<float> vLogMask((size_t)dimBatchHeads * dimLength * dimLength);
+  std::vector<float> vAlibi(vLogMask.size());
+  for(int bh = 0; bh < dimBatchHeads; ++bh) {
+    int b = bh / numHeads, h = bh % numHeads;
+    for(int q = 0; q < dimLength; ++q) {
+      for(int k = 0; k < dimLength; ++k) {
+        bool masked = vMask[b * dimLength + k] == 0.f;
+        size_t i = ((size_t)bh * dimLength + q) * dimLength + k;
+        vLogMask[i] = masked ? -std::numeric_limits<float>::infinity() : 0.f;
+        vAlibi[i] = masked || k > q ? -std::numeric_limits<float>::infinity()
+                                    : vSlopes[h] * std::abs((float)(k - q) + vBiases[h]);
+      }
+    }
+  }
+
+  auto q = graph->constant({dimBeam, dimBatchHeads, dimLength, dimHead}, inits::normal());
+  auto k = graph->constant({1, dimBatchHeads, dimLength, dimHead}, inits::normal());
+  auto v = graph->constant({1, dimBatchHeads, dimLength, dimValue}, inits::normal());
+  auto mask = graph->constant({1, dimBatch, dimLength, 1}, inits::fromVector(vMask));
+  auto slopes = graph->constant({numHeads, 1, 1}, inits::fromVector(vSlopes));
+  auto biases = graph->constant({numHeads, 1, 1}, inits::fromVector(vBiases));
+  auto logMask = graph->constant({1, dimBatchHeads, dimLength, dimLength}, inits::fromVector(vLogMask));
+  auto alibiMask = graph->constant({1, dimBatchHeads, dimLength, dimLength}, inits::fromVector(vAlibi));
+
+  auto composed = [&](Expr logMask) {
+    return bdot_legacy(softmax(bdot_legacy(q, k, false, true, scale) + logMask), v);
+  };
+
+  // the ALiBi bias goes directly into the kernel, as in DeferredAlibiLogMaskNode
+  auto alibiFwd = [=](Expr out, const std::vector<Expr>& children) {
+    AttentionBias bias;
+    bias.alibiMask = children[3]->val();
+    bias.alibiSlopes = children[4]->val();
+    bias.alibiBiases = children[5]->val();
+    bias.numHeads = numHeads;
+    bias.causal = true;
+    TiledAttention(out->val(), children[0]->val(), children[1]->val(), children[2]->val(), bias, scale);
+  };
+
+  std::vector<Expr> expected = {composed(logMask), composed(alibiMask)};
+  std::vector<Expr> actual = {tiledAttention(q, k, v, logMask, scale),
+                              lambda({q, k, v, mask, slopes, biases}, {dimBeam, dimBatchHeads, dimLength, dimValue},
+                                     Type::float32, alibiFwd)};
+  graph->forward();
+
+  for(size_t i = 0; i < expected.size(); ++i) {
+    std::vector<float> values, tiled;
+    expected[i]->val()->get(values);
+    actual[i]->val()->get(tiled);
+    CHECK(actual[i]->type() == "lambda");
+    CHECK(std::equal(tiled.begin(), tiled.end(), values.begin(), floatApprox));
+  }
+}
+#endif
+
+#ifdef BLAS_FOUND
+TEST_CASE("BFloat16 weights in dot and affine (cpu)", "[operator]") {
+  // activations are rounded to bfloat16 as well when MKL provides the GEMM, hence the margin
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.1f); };
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(16);
+
+  std::vector<float> wValues(64 * 32);
+  for(size_t i = 0; i < wValues.size(); ++i)
+    wValues[i] = std::sin(0.1f * i);
+  // the float32 reference uses the rounded weights
+  std::vector<bfloat16> wBF16(wValues.size());
+  for(size_t i = 0; i < wValues.size(); ++i) {
+    wBF16[i].x = cpu::bf16::fromFloat(wValues[i]);
+    wValues[i] = cpu::bf16::toFloat(wBF16[i].x);
+  }
+
+  auto x = graph->constant({2, 8, 64}, inits::uniform(-1.f, 1.f));
+  auto bias = graph->constant({1, 32}, inits::uniform(-1.f, 1.f));
+  auto W = graph->constant({64, 32}, inits::fromVector(wValues));
+  auto WBF16 = graph->param("W_bf16", {64, 32}, inits::fromLambda([wBF16](Tensor t) { t->set(wBF16); }), Type::bfloat16);
+
+  auto expectedAffine = affine(x, W, bias);
+  auto actualAffine = affine(x, WBF16, bias);
+  // transB, e.g. a tied output layer
+  auto y = graph->constant({16, 32}, inits::uniform(-1.f, 1.f));
+  auto expectedDot = dot(y, W, false, true);
+  auto actualDot = dot(y, WBF16, false, true);
+  graph->forward();
+
+  CHECK(actualAffine->shape() == expectedAffine->shape());
+  CHECK(actualDot->shape() == expectedDot->shape());
+
+  std::vector<float> expected, actual;
+  expectedAffine->val()->get(expected);
+  actualAffine->val()->get(actual);
+  CHECK(std::equal(actual.begin(), actual.end(), expected.begin(), floatApprox));
+
+  expectedDot->val()->get(expected);
+  actualDot->val()->get(actual);
+  CHECK(std::equal(actual.begin(), actual.end(), expected.begin(), floatApprox));
+}
+
+TEST_CASE("Sparse weights in dot and affine (cpu)", "[operator]") {
+  auto floatApprox = [](float x, float y) -> bool { return x == Approx(y).margin(0.0001f); };
+
+  for(std::string pattern : {"2:4", "2:4x16", "1:8x8"}) {
+    DYNAMIC_SECTION("pattern " << pattern) {
+      Config::seed = 1234;
+      auto graph = New<ExpressionGraph>(/*inference=*/true);
+      graph->setDevice({0, DeviceType::cpu});
+      graph->getBackend()->setSparseGemm(pattern);
+      graph->reserveWorkspaceMB(16);
+
+      std::vector<float> wValues(64 * 32);
+      for(size_t i = 0; i < wValues.size(); ++i)
+        wValues[i] = std::sin(0.1f * i);
+      SparsityPattern(pattern).prune(wValues.data(), 64, 32);
+      CHECK(SparsityPattern(pattern).matches(wValues.data(), 64, 32));
+
+      auto x = graph->constant({2, 8, 64}, inits::uniform(-1.f, 1.f));
+      auto bias = graph->constant({1, 32}, inits::uniform(-1.f, 1.f));
+      auto W = graph->constant({64, 32}, inits::fromVector(wValues));
+      auto WSparse = graph->param("W_sparse", {64, 32}, inits::fromVector(wValues));
+
+      auto expectedAffine = affine(x, W, bias);
+      auto actualAffine = affine(x, WSparse, bias);
+      auto expectedDot = dot(x, W);
+      auto actualDot = dot(x, WSparse);
+      graph->forward();
+
+      CHECK(actualAffine->shape() == expectedAffine->shape());
+
+      std::vector<float> expected, actual;
+      expectedAffine->val()->get(expected);
+      actualAffine->val()->get(actual);
+      CHECK(std::equal(actual.begin(), actual.end(), expected.begin(), floatApprox));
+
+      expectedDot->val()->get(expected);
+      actualDot->val()->get(actual);
+      CHECK(std::equal(actual.begin(), actual.end(), expected.begin(), floatApprox));
+    }
+  }
+}
+#endif
+
 #ifdef BLAS_FOUND
 #ifdef CUDA_FOUND
 
@@ -0,0 +1,191 @@
+#include "catch.hpp"
+#include "common/config.h"
+#include "common/file_stream.h"
+#include "common/filesystem.h"
+#include "common/timer.h"
+#include "data/corpus_base.h"
+#include "graph/expression_graph.h"
+#include "models/model_factory.h"
+#include "tensors/allocator.h"
+#include "tensors/tensor_operators.h"
+#include "translator/beam_search.h"
+#include "translator/translator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+
+// Performance tests, compiled only with -DCOMPILE_PERF_TESTS=on. Each test runs a fixed workload a few times on a
+// single CPU thread and compares the median throughput with the value of the same name in the YAML baseline file
+// $MARIAN_PERF_BASELINE (default perf_baseline.yml). A test fails if it is more than $MARIAN_PERF_TOLERANCE (default
+// 0.2, i.e. 20%) slower than its baseline. Baselines depend on the host and are not bundled: run the tests once with
+// MARIAN_PERF_UPDATE=1 on the reference commit to write them, without a baseline a test only warns.
+
+using namespace marian;
+
+namespace {
+
+const size_t runs = 5;
+
+std::string env(const char* name, const std::string& defaultValue) {
+  const char* value = std::getenv(name);
+  return value && *value ? value : defaultValue;
+}
+
+// median throughput of runs calls of fn, which returns the units of work it did
+double measure(const std::function<double()>& fn) {
+  fn(); // warm-up
+  std::vector<double> throughputs;
+  for(size_t i = 0; i < runs; ++i) {
+    timer::Timer timer;
+    double units = fn();
+    throughputs.push_back(units / timer.elapsed());
+  }
+  std::sort(throughputs.begin(), throughputs.end());
+  return throughputs[runs / 2];
+}
+
+void checkBaseline(const std::string& name, double value) {
+  auto path = env("MARIAN_PERF_BASELINE", "perf_baseline.yml");
+  YAML::Node baseline = filesystem::exists(path) ? YAML::LoadFile(path) : YAML::Node(YAML::NodeType::Map);
+
+  if(env("MARIAN_PERF_UPDATE", "0") != "0") {
+    baseline[name] = value;
+    io::OutputFileStream out(path);
+    out << baseline << std::endl;
+    WARN(name << ": wrote baseline " << value);
+    return;
+  }
+  if(!baseline[name]) {
+    WARN(name << ": " << value << ", no baseline in " << path << ", set MARIAN_PERF_UPDATE=1 to write it");
+    return;
+  }
+
+  double expected = baseline[name].as<double>();
+  double tolerance = std::stod(env("MARIAN_PERF_TOLERANCE", "0.2"));
+  INFO(name << ": " << value << ", baseline " << expected << " in " << path);
+  CHECK( value >= expected * (1 - tolerance) );
+}
+
+// A transformer with 2 encoder and decoder layers of 64 dimensions and a vocabulary of 256 words, with the fixed
+// random parameters of training initialization
+const int dimVocab = 256;
+const std::string modelPath = "perf_tests_model.npz";
+const std::string vocabPath = "perf_tests_vocab.yml";
+
+void createTinyModel() {
+  {
+    io::OutputFileStream out(vocabPath);
+    out << "</s>: 0\n<unk>: 1\n";
+    for(int i = 2; i < dimVocab; ++i)
+      out << "w" << i << ": " << i << "\n";
+  }
+
+  auto options = parseOptions("--type transformer --dim-emb 64 --transformer-dim-ffn 256 --transformer-heads 4 "
+                              "--enc-depth 2 --dec-depth 2 --tied-embeddings-all --dim-vocabs 256 256 --vocabs "
+                                  + vocabPath + " " + vocabPath,
+                              cli::mode::training,
+                              /*validate=*/false);
+  std::vector<Ptr<Vocab>> vocabs;
+  for(size_t i = 0; i < 2; ++i) {
+    vocabs.push_back(New<Vocab>(options, i));
+    vocabs.back()->load(vocabPath);
+  }
+
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>();
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(64);
+  auto model = models::createCriterionFunctionFromOptions(options, models::usage::training);
+  model->build(graph, data::CorpusBatch::fakeBatch({8, 8}, vocabs, 2, options));
+  graph->forward(); // initializes the parameters
+  model->save(graph, modelPath, /*saveTranslatorConfig=*/false);
+}
+
+// 16 sentences of 20 arbitrary words each
+std::vector<std::vector<Words>> sentences() {
+  std::vector<Words> sentences(16);
+  size_t k = 0;
+  for(auto& words : sentences)
+    for(size_t i = 0; i < 20; ++i)
+      words.push_back(Word::fromWordIndex(2 + (k++ * 7919) % (dimVocab - 2)));
+  return {sentences};
+}
+
+}  // namespace
+
+TEST_CASE("Decoding throughput of a tiny transformer (cpu)", "[perf]") {
+  createTinyModel();
+  auto service = New<TranslateService<BeamSearch>>(
+      "-m " + modelPath + " -v " + vocabPath + " " + vocabPath + " --cpu-threads 1 --beam-size 4 --mini-batch 16 "
+      "--maxi-batch 1 --max-length-factor 2 --quiet");
+  auto inputs = sentences();
+
+  for(size_t beamSize : {4, 1}) { // beam search and greedy search
+    auto overrides = "beam-size: " + std::to_string(beamSize);
+    double tokensPerSecond = measure([&]() {
+      size_t tokens = 0;
+      for(const auto& output : service->translateIds(inputs, overrides))
+        tokens += output.words.size() + 1; // with the end of sentence
+      return (double)tokens;
+    });
+    checkBaseline("decode_beam" + std::to_string(beamSize) + "_tokens_per_second", tokensPerSecond);
+  }
+
+  service.reset();
+  std::remove(modelPath.c_str());
+  std::remove(vocabPath.c_str());
+}
+
+TEST_CASE("Allocator throughput (cpu)", "[perf]") {
+  auto allocator = New<Allocator>(DeviceId(0, DeviceType::cpu), /*bytes=*/64 << 20, /*step=*/16 << 20);
+  double allocationsPerSecond = measure([&]() {
+    // tensors of the sizes of a forward pass, freed in a different order than allocated
+    const size_t allocations = 100000;
+    std::vector<MemoryPiece::PtrType> live;
+    size_t k = 1;
+    for(size_t i = 0; i < allocations; ++i) {
+      k = k * 6364136223846793005ull + 1442695040888963407ull;
+      live.push_back(allocator->alloc(256 * (1 + (k >> 52) % 64)));
+      if(live.size() > 64) {
+        size_t victim = (k >> 32) % live.size();
+        allocator->free(live[victim]);
+        live[victim] = live.back();
+        live.pop_back();
+      }
+    }
+    for(auto& piece : live)
+      allocator->free(piece);
+    return (double)allocations;
+  });
+  checkBaseline("allocator_allocations_per_second", allocationsPerSecond);
+}
+
+TEST_CASE("CPU kernel throughput (cpu)", "[perf]") {
+  Config::seed = 1234;
+  auto graph = New<ExpressionGraph>(/*inference=*/true);
+  graph->setDevice({0, DeviceType::cpu});
+  graph->reserveWorkspaceMB(256);
+
+  const int rows = 256, dimModel = 512, dimFfn = 2048;
+  auto a = graph->constant({rows, dimModel}, inits::normal());
+  auto b = graph->constant({dimModel, dimFfn}, inits::normal());
+  auto c = graph->constant({rows, dimFfn}, inits::zeros());
+  auto logits = graph->constant({rows, 8192}, inits::normal());
+  auto probs = graph->constant(logits->shape(), inits::zeros());
+  graph->forward();
+
+  double gflops = measure([&]() {
+    for(int i = 0; i < 10; ++i)
+      Prod(c->val(), a->val(), b->val(), false, false, 0.f, 1.f);
+    return 10 * 2e-9 * rows * dimModel * dimFfn;
+  });
+  checkBaseline("prod_gflops", gflops);
+
+  double gbytes = measure([&]() {
+    for(int i = 0; i < 10; ++i)
+      Softmax(probs->val(), logits->val());
+    return 10 * 2e-9 * logits->shape().elements() * sizeof(float);
+  });
+  checkBaseline("softmax_gbytes_per_second", gbytes);
+}
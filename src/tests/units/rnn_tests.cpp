@@ -325,6 +325,55 @@ void tests(DeviceType type, Type floatType = Type::float32) {
     //CHECK( std::equal(values.begin(), values.end(),
     //                  vContextSum3.begin(), floatApprox) );
   }
+
+  SECTION("Bidirectional RNNs transduced jointly") {
+    Config::seed = 1234;
+
+    auto graph = New<ExpressionGraph>();
+    graph->setDefaultElementType(floatType);
+    graph->setDevice({0, type});
+    graph->reserveWorkspaceMB(16);
+
+    int dimEmb = 16;
+    int dimBatch = 4;
+    int dimTime = 8;
+    int dimRnn = 32;
+
+    auto emb = graph->param("Embeddings", {128, dimEmb}, inits::glorotUniform());
+    auto input = reshape(rows(emb, vWords), {dimTime, dimBatch, dimEmb});
+    auto mask = graph->constant({dimTime, dimBatch, 1}, inits::fromVector(vMask));
+
+    auto buildRnn = [&](std::string prefix, rnn::dir direction, std::string cellType) {
+      auto stack = rnn::rnn()("type", cellType)("direction", (int)direction)("dimInput", dimEmb)("dimState", dimRnn);
+      for(int i = 1; i <= 2; ++i) // the second layer reads the output of the first one of the same direction
+        stack.push_back(rnn::stacked_cell().push_back(rnn::cell()("prefix", prefix + "_l" + std::to_string(i))));
+      return stack.construct(graph);
+    };
+
+    std::vector<Expr> expected, joint;
+    for(std::string cellType : {"gru", "gru-nematus"}) {
+      expected.push_back(buildRnn(cellType + "_fw", rnn::dir::forward, cellType)->transduce(input, mask));
+      expected.push_back(buildRnn(cellType + "_bw", rnn::dir::backward, cellType)->transduce(input, mask));
+
+      auto outputs = rnn::RNN::transduceJointly(buildRnn(cellType + "_fw", rnn::dir::forward, cellType),
+                                                buildRnn(cellType + "_bw", rnn::dir::backward, cellType),
+                                                input, mask);
+      joint.push_back(outputs.first);
+      joint.push_back(outputs.second);
+    }
+
+    graph->forward();
+
+    for(size_t i = 0; i < expected.size(); ++i) {
+      CHECK(joint[i]->shape() == expected[i]->shape());
+
+      std::vector<T> expectedValues, jointValues;
+      expected[i]->val()->get(expectedValues);
+      joint[i]->val()->get(jointValues);
+      CHECK( std::equal(jointValues.begin(), jointValues.end(),
+                        expectedValues.begin(), floatApprox) );
+    }
+  }
 }
 
 #ifdef CUDA_FOUND
@@ -0,0 +1,65 @@
+#include "catch.hpp"
+#include "common/tracing.h"
+
+#include <cstdio>
+#include <fstream>
+
+using namespace marian;
+
+TEST_CASE("Tracing", "[common]") {
+  const std::string path = "tracing_tests.jsonl";
+
+  SECTION("requests are not traced with a sample rate of 0") {
+    auto tracer = New<tracing::Tracer>(0., path);
+    auto trace = tracer->startTrace("request");
+    CHECK( trace == nullptr );
+
+    tracing::Scope scope(trace);
+    CHECK_FALSE( tracing::active() );
+    tracing::Span span("unused"); // no-op without a trace
+    span.set("words", 3);
+  }
+
+  SECTION("spans are nested and written as OTLP/JSON") {
+    {
+      auto tracer = New<tracing::Tracer>(1., path);
+      auto trace = tracer->startTrace("request");
+      REQUIRE( trace != nullptr );
+      tracing::Scope scope(trace);
+      CHECK( tracing::active() );
+      {
+        tracing::Span outer("outer");
+        outer.set("sentences", 2);
+        tracing::RepeatedSpan steps("step");
+        for(int i = 0; i < 3; ++i)
+          auto interval = steps.time();
+        tracing::Span inner("inner");
+        CHECK( tracing::current().parent != trace->root() );
+      }
+      CHECK( tracing::current().parent == trace->root() );
+      trace = nullptr;
+    }
+    CHECK_FALSE( tracing::active() );
+
+    std::ifstream in(path);
+    std::string line, next;
+    REQUIRE( std::getline(in, line) );
+    CHECK_FALSE( std::getline(in, next) ); // one line per trace
+    CHECK( line.find("{\"resourceSpans\":[{\"resource\":") == 0 );
+    CHECK( line.find("\"name\":\"request\"") != std::string::npos );
+    CHECK( line.find("\"name\":\"outer\"") != std::string::npos );
+    CHECK( line.find("\"name\":\"inner\"") != std::string::npos );
+    CHECK( line.find("{\"key\":\"sentences\",\"value\":{\"intValue\":\"2\"}}") != std::string::npos );
+    CHECK( line.find("{\"key\":\"count\",\"value\":{\"intValue\":\"3\"}}") != std::string::npos );
+    // the root span has no parent, the others do
+    size_t spans = 0, parents = 0;
+    for(size_t pos = line.find("\"spanId\""); pos != std::string::npos; pos = line.find("\"spanId\"", pos + 1))
+      spans++;
+    for(size_t pos = line.find("\"parentSpanId\""); pos != std::string::npos; pos = line.find("\"parentSpanId\"", pos + 1))
+      parents++;
+    CHECK( spans == 4 );
+    CHECK( parents == 3 );
+  }
+
+  std::remove(path.c_str());
+}
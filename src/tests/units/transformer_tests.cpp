@@ -126,6 +126,87 @@ void tests(DeviceType device, Type floatType = Type::float32) {
     CHECK(values.size() == expected.size());
     // CHECK(std::equal(values.begin(), values.end(), expected.begin(), floatApprox));
   }
+
+  SECTION("Mixture of experts with a single expert") {
+    graph->clear();
+    values.clear();
+
+    using namespace marian::nn;
+
+    std::vector<T> vecInput(6 * 4);
+    for(size_t i = 0; i < vecInput.size(); ++i)
+      vecInput[i] = (T)std::sin(0.5f * i);
+    auto input = graph->constant({2, 3, 4}, inits::fromVector(vecInput));
+
+    // every word fits, the gate probability is 1 and the layer equals the dense FFN of its expert
+    auto moe = New<MixtureOfExperts>(graph, /*numExperts=*/1, /*topK=*/1, /*dimFfn=*/8, "relu",
+                                     /*dropoutProbability=*/0.f, /*capacityFactor=*/1.f, /*balanceWeight=*/0.f);
+    auto output = moe->apply(input);
+    auto dense = affine(relu(affine(input, reshape(moe->weight1, {4, 8}), reshape(moe->bias1, {1, 8}))),
+                        reshape(moe->weight2, {8, 4}), reshape(moe->bias2, {1, 4}));
+
+    // with half the capacity, the second half of the words skips the expert
+    auto half = New<MixtureOfExperts>(graph, 1, 1, 8, "relu", 0.f, /*capacityFactor=*/0.5f, 0.f);
+    half->gate    = moe->gate;
+    half->weight1 = moe->weight1;
+    half->bias1   = moe->bias1;
+    half->weight2 = moe->weight2;
+    half->bias2   = moe->bias2;
+    auto halfOutput = half->apply(input);
+
+    graph->forward();
+
+    std::vector<T> expected;
+    output->val()->get(values);
+    dense->val()->get(expected);
+    CHECK(values.size() == expected.size());
+    CHECK(std::equal(values.begin(), values.end(), expected.begin(), floatApprox));
+
+    halfOutput->val()->get(values);
+    for(size_t i = 0; i < values.size(); ++i)
+      CHECK(floatApprox(values[i], i < values.size() / 2 ? expected[i] : (T)0.f));
+  }
+
+  SECTION("Low-rank adapters selected per batch entry") {
+    graph->clear();
+    values.clear();
+
+    using namespace marian::nn;
+
+    std::vector<T> vecInput(2 * 3 * 4);
+    for(size_t i = 0; i < vecInput.size(); ++i)
+      vecInput[i] = (T)std::sin(0.5f * i);
+    auto input = graph->constant({2, 3, 4}, inits::fromVector(vecInput)); // [batch, words, dim]
+
+    const int rank = 2, adapters = 3;
+    std::vector<T> vecUp(adapters * rank * 4);
+    for(size_t i = 0; i < vecUp.size(); ++i)
+      vecUp[i] = (T)std::cos(0.3f * i);
+
+    auto linear = New<Linear>(graph, 4);
+    linear->setName("lora");
+    addAdapters(linear, rank, /*alpha=*/4.f, adapters);
+    linear->loraB = graph->param("lora->loraB", {adapters * rank, 4}, inits::fromVector(vecUp));
+    selectAdapters(linear, {2, -1}); // the first entry with the last adapter, the second one without
+    auto output = linear->apply(input);
+
+    auto plain = New<Linear>(graph, 4);
+    plain->weight = linear->weight;
+    plain->bias = linear->bias;
+    auto base = plain->apply(input);
+    auto adapted = base + 2.f * dot(dot(input, slice(linear->loraA, -1, Slice(2 * rank, 3 * rank))),
+                                    slice(linear->loraB, 0, Slice(2 * rank, 3 * rank)));
+
+    graph->forward();
+
+    std::vector<T> expected, unadapted;
+    output->val()->get(values);
+    adapted->val()->get(expected);
+    base->val()->get(unadapted);
+    CHECK(values.size() == expected.size());
+    for(size_t i = 0; i < values.size(); ++i)
+      CHECK(floatApprox(values[i], i < values.size() / 2 ? expected[i] : unadapted[i]));
+  }
 }
 
 #ifdef CUDA_FOUND
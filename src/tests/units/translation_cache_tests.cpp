@@ -0,0 +1,84 @@
+#include "catch.hpp"
+#include "translator/request_capture.h"
+#include "translator/translation_cache.h"
+
+#include <cstdio>
+
+using namespace marian;
+
+TEST_CASE("TranslationCache", "[translator]") {
+  TranslationCache::Value value;
+
+  SECTION("stored translations are returned") {
+    TranslationCache cache(1024 * 1024);
+    CHECK( !cache.get("foo", value) );
+
+    cache.put("foo", {"bar", "0 ||| bar"});
+    CHECK( cache.get("foo", value) );
+    CHECK( value.first == "bar" );
+    CHECK( value.second == "0 ||| bar" );
+  }
+
+  SECTION("the least recently used entries are evicted first") {
+    TranslationCache cache(/*maxBytes=*/400, /*numShards=*/1); // room for three small entries
+    cache.put("a", {"A", ""});
+    cache.put("b", {"B", ""});
+    cache.put("c", {"C", ""});
+    CHECK( cache.get("a", value) ); // a is now more recent than b
+
+    cache.put("d", {"D", ""});
+    CHECK( !cache.get("b", value) );
+    CHECK( cache.get("a", value) );
+    CHECK( cache.get("c", value) );
+    CHECK( cache.get("d", value) );
+  }
+
+  SECTION("entries larger than the memory bound are not stored") {
+    TranslationCache cache(/*maxBytes=*/200, /*numShards=*/1);
+    cache.put("foo", {std::string(1000, 'x'), ""});
+    CHECK( !cache.get("foo", value) );
+  }
+}
+
+TEST_CASE("Captured requests are read back from the replay file", "[translator]") {
+  std::string path = "capture_test.yml";
+  std::remove(path.c_str());
+
+  RequestCapture capture(/*thresholdSeconds=*/0.5, path);
+  CHECK( !capture.isSlow(0.1) );
+  CHECK( capture.isSlow(0.5) );
+
+  CapturedRequest lines;
+  lines.seconds = 1.25;
+  lines.overrides = "beam-size: 2\n";
+  lines.shortlist = {"lex.s2t", "50", "50"};
+  lines.input = "first line\n\tsecond line\n";
+  lines.batches.push_back({{1}, 3, 1.0});
+  lines.batches.push_back({{0, 2}, 4, 0.25});
+  capture.write(lines);
+
+  CapturedRequest ids;
+  ids.seconds = 0.75;
+  ids.ids = {{{Word::fromWordIndex(7), Word::fromWordIndex(8)}, {}}};
+  ids.batches.push_back({{0, 1}, 4, 0.5});
+  capture.write(ids);
+
+  auto requests = RequestCapture::read(path);
+  std::remove(path.c_str());
+
+  REQUIRE( requests.size() == 2 );
+  CHECK( requests[0].seconds == 1.25 );
+  CHECK( requests[0].overrides == lines.overrides );
+  CHECK( requests[0].shortlist == lines.shortlist );
+  CHECK( requests[0].input == lines.input );
+  REQUIRE( requests[0].batches.size() == 2 );
+  CHECK( requests[0].batches[1].sentences == std::vector<size_t>({0, 2}) );
+  CHECK( requests[0].batches[1].words == 4 );
+  CHECK( requests[0].batches[1].seconds == 0.25 );
+
+  CHECK( requests[1].input.empty() );
+  REQUIRE( requests[1].ids.size() == 1 );
+  REQUIRE( requests[1].ids[0].size() == 2 );
+  CHECK( requests[1].ids[0][0] == ids.ids[0][0] );
+  CHECK( requests[1].ids[0][1].empty() );
+}
@@ -1,6 +1,10 @@
 #include "catch.hpp"
+#include "common/numa.h"
+#include "common/perf_counters.h"
 #include "common/utils.h"
 
+#include <thread>
+
 using namespace marian;
 
 TEST_CASE("utils::splitTsv", "[utils]") {
@@ -34,3 +38,43 @@ TEST_CASE("utils::splitTsv", "[utils]") {
 
   //SECTION("excessive tab-separated fields abort the execution") {}
 }
+
+TEST_CASE("PerfCounters", "[utils]") {
+  PerfCounters counters;
+  auto before = counters.read();
+  volatile double x = 0;
+  for(int i = 0; i < 1000000; ++i)
+    x = x + 1;
+  auto counts = counters.read() - before;
+
+  if(counters.available()) { // not in many VMs and containers
+    CHECK( counts.instructions >= 1000000 );
+    CHECK( counts.cycles > 0 );
+    CHECK( counts.ipc() > 0 );
+  } else {
+    CHECK( counts.instructions == 0 );
+  }
+}
+
+TEST_CASE("NumaNodes", "[utils]") {
+  NumaNodes numa;
+  REQUIRE( numa.size() >= 1 );
+
+  // the workers fill the nodes one after the other
+  for(size_t workers : {1, 3, 8}) {
+    size_t previous = 0;
+    for(size_t i = 0; i < workers; ++i) {
+      size_t node = numa.nodeOf(i, workers);
+      CHECK( node < numa.size() );
+      CHECK( node >= previous );
+      previous = node;
+    }
+  }
+
+  // a thread of its own, the binding would stay with the thread of the tests
+  if(!numa.cpus(0).empty()) {
+    bool bound = false;
+    std::thread([&]() { bound = numa.bind(0); }).join();
+    CHECK( bound );
+  }
+}
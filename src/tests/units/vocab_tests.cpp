@@ -0,0 +1,44 @@
+#include "catch.hpp"
+#include "common/file_stream.h"
+#include "data/vocab_base.h"
+
+#include <cstdio>
+
+using namespace marian;
+
+TEST_CASE("Compiled vocabularies", "[vocab]") {
+  io::TemporaryFile text("/tmp/", /*earlyUnlink=*/false);
+  {
+    io::OutputFileStream out(text.getFileName() + ".txt");
+    out << "</s>\n<unk>\nthe\nhouse\n<0x0A>\nHaus\n";
+  }
+
+  auto vocab = createDefaultVocab();
+  vocab->load(text.getFileName() + ".txt", 0);
+  compileDefaultVocab(text.getFileName() + ".txt", text.getFileName() + ".bvoc");
+
+  SECTION("maps the same words to the same ids") {
+    auto compiled = createDefaultVocab();
+    CHECK(compiled->load(text.getFileName() + ".bvoc", 0) == vocab->size());
+    CHECK(compiled->getEosId() == vocab->getEosId());
+    CHECK(compiled->getUnkId() == vocab->getUnkId());
+    for(std::string word : {"</s>", "<unk>", "the", "house", "<0x0A>", "Haus", "tree", ""}) {
+      CHECK((*compiled)[word] == (*vocab)[word]);
+      CHECK((*compiled)[(*compiled)[word]] == (*vocab)[(*vocab)[word]]);
+    }
+
+    std::vector<Word> special;
+    compiled->addSpecialWords(special);
+    CHECK(special == std::vector<Word>({(*vocab)["<0x0A>"]}));
+  }
+
+  SECTION("maps words beyond the maximum size to <unk>") {
+    auto compiled = createDefaultVocab();
+    CHECK(compiled->load(text.getFileName() + ".bvoc", 4) == 4);
+    CHECK((*compiled)["house"] == Word::fromWordIndex(3));
+    CHECK((*compiled)["Haus"] == compiled->getUnkId());
+  }
+
+  std::remove((text.getFileName() + ".txt").c_str());
+  std::remove((text.getFileName() + ".bvoc").c_str());
+}
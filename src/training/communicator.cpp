@@ -23,7 +23,7 @@ ShardingMode getShardingMode(Ptr<Options> options, Ptr<IMPIWrapper> mpi) {
 
 Ptr<ICommunicator> createCommunicator(
   const std::vector<Ptr<ExpressionGraph>>& graphs,
-  bool noNccl, ShardingMode shardingMode, Ptr<IMPIWrapper> mpi) {
+  bool noNccl, ShardingMode shardingMode, Ptr<IMPIWrapper> mpi, bool hierarchical) {
   mpi;
 #if defined(CUDA_FOUND) && defined(USE_NCCL)
   if(noNccl) {
@@ -48,9 +48,9 @@ Ptr<ICommunicator> createCommunicator(
   }
 
   // the actual implementation is inside communicator.cu
-  return New<NCCLCommunicator>(graphs, shardingMode, mpi);
+  return New<NCCLCommunicator>(graphs, shardingMode, mpi, hierarchical);
 #else // no CUDA or no NCCL
-  noNccl; shardingMode; // (unused)
+  noNccl; shardingMode; hierarchical; // (unused)
   return New<DefaultCommunicator>(graphs, mpi);
 #endif
 }
@@ -69,6 +69,12 @@ class MPIWrapper : public IMPIWrapper
   int my_rank_;         // MPI rank of this node
   int comm_world_size_; // Number of nodes in MPI world (cluster)
 
+  MPI_Comm hostComm_{MPI_COMM_NULL};    // the processes on this host, which can share memory
+  MPI_Comm leadersComm_{MPI_COMM_NULL}; // the process with the lowest rank of each host, null on the others
+  int hostRank_{0};
+  int hostSize_{1};
+  mutable std::vector<MPI_Win> sharedWindows_; // of bCastNodeShared() with map, which items point into
+
   void handleError(int mpiRetval, const char* exprString) const { // call this with the return value of all MPI calls to report errors
     if (mpiRetval != MPI_SUCCESS) {
       char errStr[MPI_MAX_ERROR_STRING + 1] = { 0 };
@@ -95,6 +101,12 @@ public:
     ABORT_IF(comm_world_size_ > 1 && providedThreadingMode < requiredThreadingMode,
       "Your version of MPI does not support multi-threaded communication.");
 
+    // ordered by world rank, so rank 0 is the first process of its host and of the leaders
+    HANDLE_MPI_ERROR(MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank_, MPI_INFO_NULL, &hostComm_));
+    MPI_Comm_rank(hostComm_, &hostRank_);
+    MPI_Comm_size(hostComm_, &hostSize_);
+    HANDLE_MPI_ERROR(MPI_Comm_split(MPI_COMM_WORLD, hostRank_ == 0 ? 0 : MPI_UNDEFINED, my_rank_, &leadersComm_));
+
     // patch logging pattern to include the MPI rank, so that we can associate error messages with nodes
     if (numMPIProcesses() > 1) {
       std::string rankStr = std::to_string(MPIWrapper::myMPIRank());
@@ -192,6 +204,12 @@ public:
   }
 
   virtual void finalize() override {
+    for(auto& window : sharedWindows_)
+      HANDLE_MPI_ERROR(MPI_Win_free(&window));
+    sharedWindows_.clear();
+    if(leadersComm_ != MPI_COMM_NULL)
+      HANDLE_MPI_ERROR(MPI_Comm_free(&leadersComm_));
+    HANDLE_MPI_ERROR(MPI_Comm_free(&hostComm_));
     HANDLE_MPI_ERROR(MPI_Finalize());
   }
 
@@ -218,9 +236,7 @@ public:
   }
 
   virtual void bCast(std::vector<io::Item>& items, size_t rootRank = 0, MPI_Comm comm = MPI_COMM_WORLD) const override {
-    size_t numItems = 0;
-    if(isMainProcess())
-      numItems = items.size();
+    size_t numItems = items.size(); // only that of the root counts
 
     bCast(&numItems, 1, getDataType(&numItems), rootRank, comm);
     items.resize(numItems);
@@ -229,14 +245,74 @@ public:
   }
 
   virtual void bCast(std::string& str, size_t rootRank = 0, MPI_Comm comm = MPI_COMM_WORLD) const override {
-    size_t length = 0;
-    if(isMainProcess())
-      length = str.size();
+    size_t length = str.size(); // only that of the root counts
 
     bCast(&length, 1, getDataType(&length), rootRank, comm);
     str.resize(length);
     bCast(str.data(), length, getDataType(str.data()), rootRank, comm);
   }
+
+  virtual void bCastNodeShared(std::vector<io::Item>& items, bool map) const override {
+    if(leadersComm_ != MPI_COMM_NULL)
+      bCast(items, 0, leadersComm_);
+    if(hostSize_ == 1)
+      return;
+
+    // everything but the bytes, from the first process of the host to the others
+    size_t numItems = items.size();
+    bCast(&numItems, 1, getDataType(&numItems), 0, hostComm_);
+    items.resize(numItems);
+    std::vector<size_t> offsets, lengths;
+    size_t total = 0;
+    for(auto& item : items) {
+      bCast(item.name, 0, hostComm_);
+      unsigned long long shapeLen = item.shape.size();
+      bCast(&shapeLen, 1, getDataType(&shapeLen), 0, hostComm_);
+      item.shape.resize(shapeLen);
+      bCast(item.shape.data(), shapeLen, getDataType(item.shape.data()), 0, hostComm_);
+      size_t type = (size_t)item.type;
+      bCast(&type, 1, getDataType(&type), 0, hostComm_);
+      item.type = (Type)type;
+      unsigned long long bytesLen = item.bytes.size();
+      bCast(&bytesLen, 1, getDataType(&bytesLen), 0, hostComm_);
+
+      offsets.push_back(total);
+      lengths.push_back(bytesLen);
+      total += (bytesLen + 255) / 256 * 256; // items keep the 256-byte alignment of their parameters
+    }
+    if(total == 0)
+      return;
+
+    char* base = nullptr;
+    MPI_Win window;
+    HANDLE_MPI_ERROR(MPI_Win_allocate_shared(hostRank_ == 0 ? (MPI_Aint)total : 0, 1, MPI_INFO_NULL, hostComm_, &base, &window));
+    if(hostRank_ != 0) {
+      MPI_Aint size; int dispUnit;
+      HANDLE_MPI_ERROR(MPI_Win_shared_query(window, 0, &size, &dispUnit, &base));
+    }
+
+    HANDLE_MPI_ERROR(MPI_Win_fence(0, window));
+    if(hostRank_ == 0)
+      for(size_t i = 0; i < numItems; ++i)
+        std::copy(items[i].bytes.begin(), items[i].bytes.end(), base + offsets[i]);
+    HANDLE_MPI_ERROR(MPI_Win_fence(0, window));
+
+    for(size_t i = 0; i < numItems; ++i) {
+      const char* begin = base + offsets[i];
+      if(map) {
+        items[i].bytes = std::vector<char>();
+        items[i].ptr = begin;
+        items[i].mapped = true;
+      } else if(hostRank_ != 0) {
+        items[i].bytes.assign(begin, begin + lengths[i]);
+      }
+    }
+
+    if(map)
+      sharedWindows_.push_back(window);
+    else
+      HANDLE_MPI_ERROR(MPI_Win_free(&window));
+  }
 };
 #endif
 
@@ -53,12 +53,42 @@ public:
   // @TODO: We probably can still share foreach() between the two implementations. Just need to move some helper functions from the .cu file.
 
   virtual void scatterReduceAndResetGrads() const = 0; // reduce param gradients and scatter into gradient shards
+  // Overlapping the reduction with the backward pass: reduceGradsAsync() is called on the thread of local device
+  // localDeviceIndex with the ranges of ExpressionGraph::setGradientBuckets() once they are final and starts their
+  // reduction, scatterReduceAndResetGrads() then reduces what was not started and waits for all of it.
+  virtual bool canReduceGradsAsync() const { return false; }
+  virtual void reduceGradsAsync(size_t /*localDeviceIndex*/, size_t /*begin*/, size_t /*end*/) const {
+    ABORT("This communicator cannot reduce gradients during the backward pass");
+  }
+  // The parameter shards of the graph of the given local device, see ExpressionGraph::setParameterShards()
+  virtual Ptr<ParameterShards> createParameterShards(size_t /*localDeviceIndex*/) const {
+    ABORT("Sharded parameters require NCCL communication");
+  }
+  // The tensor parallelism of the graph of the given local device, see ExpressionGraph::setTensorParallel()
+  virtual Ptr<TensorParallel> createTensorParallel(size_t /*localDeviceIndex*/) const {
+    ABORT("Tensor parallelism requires NCCL communication");
+  }
+  // Compresses the gradients that scatterReduceAndResetGrads() sums over devices, see GradientCompressor
+  virtual void setGradientCompression(const std::string& mode, size_t /*rank*/) {
+    LOG(warn, "[comm] Gradient compression {} is only used by NCCL communication, ignoring it", mode);
+  }
   virtual void allGatherParams() const = 0;     // redistribute value shards into param values
   virtual void broadcastParams(bool average = false) const = 0;  // average corresponding parameters across all workers
   virtual void broadcastShards(const std::vector<Ptr<OptimizerBase>>& opts, bool average = false) const = 0;
 
   virtual void scatterState(const io::Item& data, const OptimizerBase::ScatterStateSetFunc& setFn) const = 0;
   virtual io::Item gatherState(const OptimizerBase::GatherStateGetFunc& getFn) const = 0;
+
+  // For sharded checkpoints: the optimizer state that the devices of this process hold is part myStatePart() of
+  // numStateParts(). gatherLocalState() concatenates it without communication, scatterLocalState() distributes such a
+  // part of an item of totalSize bytes like scatterState() distributes the whole item.
+  virtual size_t numStateParts() const { return 1; }
+  virtual size_t myStatePart() const { return 0; }
+  virtual io::Item gatherLocalState(const OptimizerBase::GatherStateGetFunc& getFn) const { return gatherState(getFn); }
+  virtual void scatterLocalState(const io::Item& data, size_t totalSize, const OptimizerBase::ScatterStateSetFunc& setFn) const {
+    ABORT_IF(data.size() != totalSize, "Part of {} bytes of an item of {} bytes for a single part", data.size(), totalSize);
+    scatterState(data, setFn);
+  }
 };
 
 // Abstracts MPI operations, allowing alternative implementations (specifically fake (for debugging) and NCCL.
@@ -97,7 +127,13 @@ struct/*interface*/ IMPIWrapper {
   virtual void bCast(io::Item& item, size_t rootRank = 0, MPI_Comm comm = MPI_COMM_WORLD) const = 0;
   virtual void bCast(std::vector<io::Item>& items, size_t rootRank = 0, MPI_Comm comm = MPI_COMM_WORLD) const = 0;
   virtual void bCast(std::string& str, size_t rootRank = 0, MPI_Comm comm = MPI_COMM_WORLD) const = 0;
-  
+
+  // Broadcasts the items of the main process so that they go over the network once per host, to its process with the
+  // lowest rank, and from there to the other processes on the host through a node-local shared memory window. With
+  // map, the items of all processes on a host then point into that window, which stays allocated until MPI is
+  // finalized, otherwise every process copies them.
+  virtual void bCastNodeShared(std::vector<io::Item>& items, bool map) const { map; bCast(items); }
+
   std::string idStr() const;
 };
 
@@ -299,8 +335,9 @@ public:
   }
 };
 
+// hierarchical selects the two-level all-reduce of NCCLCommunicator
 Ptr<ICommunicator> createCommunicator(
     const std::vector<Ptr<ExpressionGraph>>& graphs,
-    bool noNccl, ShardingMode shardingMode, Ptr<IMPIWrapper> mpi);
+    bool noNccl, ShardingMode shardingMode, Ptr<IMPIWrapper> mpi, bool hierarchical = false);
 
 }  // namespace marian
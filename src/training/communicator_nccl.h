@@ -1,7 +1,9 @@
 // Note: This must only be included if defined(CUDA_FOUND) && defined(USE_NCCL)
 #include "training/communicator.h"
 #include "3rd_party/threadpool.h"
+#include "optimizers/gradient_compressor.h"
 #include "tensors/tensor_operators.h"
+#include "tensors/gpu/backend.h"
 #include "tensors/gpu/cuda_helpers.h"
 
 #include "common/timer.h"
@@ -16,6 +18,9 @@
 #include "nccl.h"
 #include <cuda_runtime.h>
 
+#include <algorithm>
+#include <limits>
+
 #if (NCCL_MAJOR<3 || NCCL_MINOR<2)
 #define ncclGetVersion(pv) (*(pv) = (NCCL_MAJOR * 1000 + NCCL_MINOR * 100 + NCCL_PATCH))
 #endif
@@ -27,14 +32,67 @@ pid_t gettid(void){ return syscall(SYS_gettid); }
 
 namespace marian {
 
+// The parameter shards of the graph of one device, gathered by broadcasts from and reduced by reduces to the owner
+// over all devices, on the stream of the graph so that its nodes are ordered after them
+class NCCLParameterShards : public ParameterShards {
+  ncclComm_t comm_;
+  Ptr<gpu::Backend> backend_;
+
+  static ncclDataType_t ncclFloatType(Tensor tensor) {
+    return tensor->type() == Type::float16 ? ncclFloat16 : ncclFloat32;
+  }
+
+public:
+  NCCLParameterShards(size_t rank, size_t ranks, ncclComm_t comm, Ptr<gpu::Backend> backend)
+      : ParameterShards(rank, ranks), comm_(comm), backend_(backend) {}
+
+  void gather(const Expr& param, Tensor value) override {
+    NCCL_CHECK(ncclBroadcast(value->data(), value->data(), value->size(), ncclFloatType(value), (int)owner(param), comm_, backend_->getCudaStream()));
+  }
+
+  void reduce(const Expr& param, Tensor grad) override {
+    NCCL_CHECK(ncclReduce(grad->data(), grad->data(), grad->size(), ncclFloatType(grad), ncclSum, (int)owner(param), comm_, backend_->getCudaStream()));
+  }
+};
+
+// The tensor parallelism of the graphs of the devices of one process, with all-reduces and all-gathers on the stream
+// of the graph so that its nodes are ordered after them
+class NCCLTensorParallel : public TensorParallel {
+  ncclComm_t comm_;
+  Ptr<gpu::Backend> backend_;
+
+  static ncclDataType_t ncclFloatType(Tensor tensor) {
+    return tensor->type() == Type::float16 ? ncclFloat16 : ncclFloat32;
+  }
+
+public:
+  NCCLTensorParallel(size_t rank, size_t ranks, ncclComm_t comm, Ptr<gpu::Backend> backend)
+      : TensorParallel(rank, ranks), comm_(comm), backend_(backend) {}
+
+  void allReduce(Tensor tensor) override {
+    NCCL_CHECK(ncclAllReduce(tensor->data(), tensor->data(), tensor->size(), ncclFloatType(tensor), ncclSum, comm_, backend_->getCudaStream()));
+  }
+
+  void allGather(Tensor part, Tensor gathered) override {
+    NCCL_CHECK(ncclAllGather(part->data(), gathered->data(), part->size(), ncclFloatType(part), comm_, backend_->getCudaStream()));
+  }
+};
+
 class NCCLCommunicator : public ICommunicator {
 private:
   ShardingMode shardingMode_{ShardingMode::global};
 
+  bool hierarchical_{false}; // reduce gradients within processes, across them and gather back, see scatterReduceAndResetGrads()
+
   std::vector<ncclComm_t> globalComms_;     // [device index]
   std::vector<ncclComm_t> localComms_;     // [device index]
+  std::vector<ncclComm_t> crossComms_;     // [device index] same device index across processes, if hierarchical
 
   std::vector<cudaStream_t> streams_; // [device index]
+  std::vector<cudaEvent_t> computed_; // [device index] the gradients of a bucket were computed, see reduceGradsAsync()
+  mutable std::vector<size_t> reducedFrom_; // [device index] gradients from here on are being reduced already
+  static constexpr size_t NOT_STARTED = std::numeric_limits<size_t>::max(); // for reducedFrom_
+  std::vector<Ptr<GradientCompressor>> compressors_; // [device index] if gradients are compressed
   std::vector<int> devices_;          // [device index]
   Ptr<IMPIWrapper> mpi_; // (may be null)
   mutable ThreadPool threadPool_;
@@ -128,17 +186,52 @@ private:
       mpi_->barrier();
   }
 
+  // Creates crossComms, which bind the devices with the same index in all processes, and localComms, which bind all
+  // devices within a process.
+  void initTwoLevelComms(std::vector<ncclComm_t>& crossComms, std::vector<ncclComm_t>& localComms) {
+    std::vector<ncclUniqueId> crossUniqueIds(numLocalRanks(), {0}); // one per local device, binds numProcesses shards at the same location in the processes together
+    std::vector<ncclUniqueId> localUniqueIds(mpi_->numMPIProcesses(), {0}); // one per process, binds all shards within one process, stays local to process
+
+    if(mpi_->myMPIRank() == 0) {
+      for(auto& id : crossUniqueIds)
+        NCCL_CHECK(ncclGetUniqueId(&id));
+      for(auto& id : localUniqueIds)
+        NCCL_CHECK(ncclGetUniqueId(&id));
+    }
+
+    for(auto& id : crossUniqueIds)
+      mpi_->bCast(&id, sizeof(id), MPI_BYTE, 0);
+    for(auto& id : localUniqueIds)
+      mpi_->bCast(&id, sizeof(id), MPI_BYTE, 0);
+
+    groupStart();
+    for(int localDeviceIndex = 0; localDeviceIndex < numLocalRanks(); localDeviceIndex++) {
+      CUDA_CHECK(cudaSetDevice(devices_[localDeviceIndex]));
+      NCCL_CHECK(ncclCommInitRank(&crossComms[localDeviceIndex], mpi_->numMPIProcesses(), crossUniqueIds[localDeviceIndex], mpi_->myMPIRank()));
+      NCCL_CHECK(ncclCommInitRank( &localComms[localDeviceIndex],         numLocalRanks(), localUniqueIds[mpi_->myMPIRank()],  localDeviceIndex));
+    }
+    groupEnd();
+  }
+
 public:
   // a NCCLCommunicator is bound to a set of graphs, one per GPU device
   // If MPI is used, then each MPI process has an instance of this class for its specific
   // set of GPU devices, which are communicating with each other. The total number of GPUs
   // involved in the NCCL communication setup is (#MPI processes) x (#GPUs per process).
-  NCCLCommunicator(const std::vector<Ptr<ExpressionGraph>>& graphs, ShardingMode shardingMode, Ptr<IMPIWrapper> mpi)
+  // With hierarchical and global sharding, gradients are reduced in three steps instead of one all-reduce over all
+  // devices: reduce-scatter within each process, e.g. over NVLink, all-reduce of the resulting chunks across processes,
+  // one chunk per device, and all-gather within each process.
+  NCCLCommunicator(const std::vector<Ptr<ExpressionGraph>>& graphs, ShardingMode shardingMode, Ptr<IMPIWrapper> mpi,
+                   bool hierarchical = false)
       : ICommunicator(graphs),
         shardingMode_(shardingMode),
+        hierarchical_(hierarchical),
         globalComms_(graphs.size()),
         localComms_(graphs.size()),
+        crossComms_(graphs.size()),
         streams_(graphs.size()),
+        computed_(graphs.size()),
+        reducedFrom_(graphs.size(), NOT_STARTED),
         devices_(graphs.size()),
         mpi_(mpi),
         threadPool_(graphs.size(), graphs.size()) {
@@ -158,6 +251,7 @@ public:
       devices_[i] = device.no;
       CUDA_CHECK(cudaSetDevice(devices_[i]));
       CUDA_CHECK(cudaStreamCreate(&streams_[i]));
+      CUDA_CHECK(cudaEventCreateWithFlags(&computed_[i], cudaEventDisableTiming));
     }
 
     // set up NCCL
@@ -168,8 +262,15 @@ public:
     if(!mpi_) // without MPI local and global is the same, so only handle global
       shardingMode_ = ShardingMode::global;
 
+    if(hierarchical_ && (shardingMode_ != ShardingMode::global || !mpi_ || mpi_->numMPIProcesses() == 1 || numLocalRanks() == 1)) {
+      LOG(warn, "[comm] Hierarchical all-reduce needs global sharding and several processes with several devices each, using flat all-reduce");
+      hierarchical_ = false;
+    }
+
     mpiBarrier();
     LOG(info, "[comm] Using {} sharding", shardingMode_ == ShardingMode::global ? "global" : "local");
+    if(hierarchical_)
+      LOG(info, "[comm] Using hierarchical all-reduce over {} processes with {} devices each", mpi_->numMPIProcesses(), numLocalRanks());
     mpiBarrier();
 
     // Creating unique ids for NCCL as well as communicators, if global, we only need one unique id and broadcast it to all processes
@@ -188,31 +289,13 @@ public:
         NCCL_CHECK(ncclCommInitRank(&globalComms_[localDeviceIndex], numNcclRanks(), uniqueId, myNcclRank(localDeviceIndex)));
       }
       groupEnd();
+
+      if(hierarchical_)
+        initTwoLevelComms(crossComms_, localComms_);
     } else {
       ABORT_IF(shardingMode_ == ShardingMode::local && !mpi_, "Local/global sharding only implemented for MPI, global is same as local with no MPI");
-      
-      std::vector<ncclUniqueId> globalUniqueIds(numLocalRanks(), {0}); // one per local device, binds numProcesses shards at the same location in the processes together
-      std::vector<ncclUniqueId> localUniqueIds(mpi_->numMPIProcesses(), {0}); // one per process, binds all shards within one process, stays local to process
-      
-      if(mpi->myMPIRank() == 0) {
-        for(auto& id : globalUniqueIds)
-          NCCL_CHECK(ncclGetUniqueId(&id));
-        for(auto& id : localUniqueIds)
-          NCCL_CHECK(ncclGetUniqueId(&id));
-      }
-
-      for(auto& id : globalUniqueIds)
-        mpi_->bCast(&id, sizeof(id), MPI_BYTE, 0);
-      for(auto& id : localUniqueIds)
-        mpi_->bCast(&id, sizeof(id), MPI_BYTE, 0);
-    
-      groupStart();
-      for(int localDeviceIndex = 0; localDeviceIndex < numLocalRanks(); localDeviceIndex++) {
-        CUDA_CHECK(cudaSetDevice(devices_[localDeviceIndex]));
-        NCCL_CHECK(ncclCommInitRank(&globalComms_[localDeviceIndex], mpi_->numMPIProcesses(), globalUniqueIds[localDeviceIndex], mpi_->myMPIRank()));
-        NCCL_CHECK(ncclCommInitRank( &localComms_[localDeviceIndex],         numLocalRanks(), localUniqueIds[mpi_->myMPIRank()],  localDeviceIndex));
-      }
-      groupEnd();
+      // here, global communicators bind the same device index across processes
+      initTwoLevelComms(globalComms_, localComms_);
     }
 
     mpiBarrier(); // (synchronize the log messages)
@@ -224,9 +307,12 @@ public:
     for(int i = 0; i < devices_.size(); ++i) {
       cudaSetDevice(devices_[i]);
       cudaStreamDestroy(streams_[i]);
+      cudaEventDestroy(computed_[i]);
       ncclCommDestroy(globalComms_[i]);
-      if(shardingMode_ == ShardingMode::local)
+      if(shardingMode_ == ShardingMode::local || hierarchical_)
         ncclCommDestroy(localComms_[i]);
+      if(hierarchical_)
+        ncclCommDestroy(crossComms_[i]);
     }
   }
 
@@ -260,9 +346,107 @@ public:
     return foreachAcc(func, allTrue, true, parallel);
   }
 
+  ncclDataType_t ncclFloatType(Tensor tensor) const {
+    return tensor->type() == Type::float16 ? ncclFloat16 : ncclFloat32;
+  }
+
+  // Buckets are all-reduced like all gradients in global sharding, which the ranges of local sharding do not allow
+  bool canReduceGradsAsync() const override {
+    return shardingMode_ == ShardingMode::global && !hierarchical_ && compressors_.empty();
+  }
+
+  void reduceGradsAsync(size_t i, size_t begin, size_t end) const override {
+    ABORT_IF(!canReduceGradsAsync(), "Gradients are only reduced during the backward pass in global sharding");
+    if(reducedFrom_[i] == NOT_STARTED)
+      reducedFrom_[i] = dataSize();
+    ABORT_IF(end != reducedFrom_[i], "Gradient buckets must be reduced from the last one to the first one");
+
+    // the NCCL stream waits for the backward pass to compute the bucket, which continues meanwhile
+    auto backend = std::static_pointer_cast<gpu::Backend>(graphs_[i]->getBackend());
+    CUDA_CHECK(cudaEventRecord(computed_[i], backend->getCudaStream()));
+    CUDA_CHECK(cudaStreamWaitEvent(streams_[i], computed_[i], 0));
+
+    auto grads = graphs_[i]->params()->grads()->subtensor(begin, end - begin);
+    NCCL_CHECK(ncclAllReduce(grads->data(), grads->data(), grads->size(), ncclFloatType(grads), ncclSum, globalComms_[i], streams_[i]));
+    reducedFrom_[i] = begin;
+  }
+
+  // Over all devices of all processes
+  Ptr<ParameterShards> createParameterShards(size_t localDeviceIndex) const override {
+    ABORT_IF(shardingMode_ != ShardingMode::global, "Sharded parameters require global sharding");
+    auto backend = std::static_pointer_cast<gpu::Backend>(graphs_[localDeviceIndex]->getBackend());
+    return New<NCCLParameterShards>(myNcclRank(localDeviceIndex), numNcclRanks(), globalComms_[localDeviceIndex], backend);
+  }
+
+  // Over the devices of this process
+  Ptr<TensorParallel> createTensorParallel(size_t localDeviceIndex) const override {
+    auto backend = std::static_pointer_cast<gpu::Backend>(graphs_[localDeviceIndex]->getBackend());
+    if(shardingMode_ == ShardingMode::local || hierarchical_)
+      return New<NCCLTensorParallel>(localDeviceIndex, numLocalRanks(), localComms_[localDeviceIndex], backend);
+    ABORT_IF(numNcclRanks() != numLocalRanks(), "Tensor parallelism over several processes requires local sharding");
+    return New<NCCLTensorParallel>(myNcclRank(localDeviceIndex), numNcclRanks(), globalComms_[localDeviceIndex], backend);
+  }
+
+  // Compressed gradients replace the flat all-reduce of global sharding
+  void setGradientCompression(const std::string& mode, size_t rank) override {
+    if(shardingMode_ != ShardingMode::global || hierarchical_) {
+      LOG(warn, "[comm] Gradient compression requires global sharding and flat --all-reduce, ignoring it");
+      return;
+    }
+    for(size_t i = 0; i < graphs_.size(); ++i)
+      compressors_.push_back(New<GradientCompressor>(mode, rank, numNcclRanks()));
+  }
+
+  // Each step of the compressors sums their tensors over all devices once all of them were prepared
+  void reduceCompressedGrads() const {
+    for(size_t step = 0;; ++step) {
+      std::vector<std::vector<Tensor>> summed(graphs_.size());
+      for(int i = 0; i < graphs_.size(); ++i) {
+        graphs_[i]->getBackend()->setDevice();
+        summed[i] = compressors_[i]->reduce(step, graphs_[i]);
+      }
+      if(summed.front().empty())
+        break;
+
+      synchronizeAllOnNullStream();
+      groupStart();
+      for(int i = 0; i < graphs_.size(); ++i)
+        for(const auto& t : summed[i])
+          NCCL_CHECK(ncclAllReduce(t->data(), t->data(), t->size(), ncclFloatType(t), ncclSum, globalComms_[i], streams_[i]));
+      groupEnd();
+      synchronizeAll();
+    }
+  }
+
   void scatterReduceAndResetGrads() const override {
     synchronizeAllOnNullStream();
 
+    if(std::any_of(reducedFrom_.begin(), reducedFrom_.end(), [](size_t from) { return from != NOT_STARTED; })) {
+      // reduce the buckets that were not started, e.g. on devices without a sub-batch, in the same order
+      groupStart();
+      for(int i = 0; i < graphs_.size(); ++i) {
+        size_t reducedFrom = reducedFrom_[i] != NOT_STARTED ? reducedFrom_[i] : dataSize();
+        auto buckets = graphs_[i]->gradientBuckets();
+        for(auto it = buckets.rbegin(); it != buckets.rend(); ++it) {
+          if(it->first >= reducedFrom)
+            continue;
+          auto grads = graphs_[i]->params()->grads()->subtensor(it->first, it->second - it->first);
+          NCCL_CHECK(ncclAllReduce(grads->data(), grads->data(), grads->size(), ncclFloatType(grads), ncclSum, globalComms_[i], streams_[i]));
+        }
+        reducedFrom_[i] = NOT_STARTED;
+      }
+      groupEnd();
+      synchronizeAll();
+      resetGradsOutsideShards();
+      return;
+    }
+
+    if(!compressors_.empty()) {
+      reduceCompressedGrads();
+      resetGradsOutsideShards();
+      return;
+    }
+
     groupStart();
     for(int i = 0; i < graphs_.size(); ++i) {
       size_t begin, end; std::tie
@@ -278,7 +462,15 @@ public:
       if(grads->type() == Type::float16)
         ncclFloatType = ncclFloat16;
 
-      if(shardingMode_ == ShardingMode::global) {
+      if(hierarchical_) {
+        // each device reduces its chunk within the process, all-reduces it with the same chunk of the other
+        // processes and gathers the chunks of the other devices back
+        size_t chunkSize = grads->size() / numLocalRanks();
+        auto chunk = grads->subtensor(i * chunkSize, chunkSize);
+        NCCL_CHECK(ncclReduceScatter(sendbuf, chunk->data(), chunkSize, ncclFloatType, ncclSum, localComms_[i], streams_[i]));
+        NCCL_CHECK(    ncclAllReduce(chunk->data(), chunk->data(), chunkSize, ncclFloatType, ncclSum, crossComms_[i], streams_[i]));
+        NCCL_CHECK(    ncclAllGather(chunk->data(), grads->data(), chunkSize, ncclFloatType, localComms_[i], streams_[i]));
+      } else if(shardingMode_ == ShardingMode::global) {
         NCCL_CHECK(ncclAllReduce(grads->data(), grads->data(), grads->size(), ncclFloatType, ncclSum, globalComms_[i], streams_[i])); // apparently this is somehow faster??
         // NCCL_CHECK(ncclReduceScatter(sendbuf, recvbuf, bufsize, ncclFloatType, ncclSum, globalComms_[i], streams_[i]));
       } else {
@@ -289,6 +481,10 @@ public:
     groupEnd();
     synchronizeAll();
 
+    resetGradsOutsideShards();
+  }
+
+  void resetGradsOutsideShards() const {
     // reset gradients outside the shards we reduce in
     // In the future, we can keep quantization residuals here straight in the grads themselves.
     // @TODO: all the different places where gradients get reset are confusing
@@ -370,6 +566,10 @@ public:
       ncclDataType_t ncclFloatType = ncclFloat32;
       if(tensor->type() == Type::float16)
         ncclFloatType = ncclFloat16;
+      else if(tensor->type() == Type::int8) // quantized optimizer state, e.g. of Adam8bit
+        ncclFloatType = ncclInt8;
+      else if(tensor->type() == Type::uint8)
+        ncclFloatType = ncclUint8;
       return ncclFloatType;
     };
 
@@ -380,6 +580,7 @@ public:
       for(auto shard : opts[i]->getShards()) {
         if(shard) {
           if(average) {
+            ABORT_IF(!isFloat(shard->type()), "Optimizer shards of type {} cannot be averaged", shard->type());
             NCCL_CHECK(ncclAllReduce(shard->data(), 
                                      shard->data(), 
                                      shard->size(), 
@@ -421,6 +622,39 @@ public:
     }
   }
 
+  // With global sharding each MPI process holds its own part of the optimizer state, otherwise all hold all of it
+  size_t numStateParts() const override {
+    return mpi_ && shardingMode_ == ShardingMode::global ? mpi_->numMPIProcesses() : 1;
+  }
+
+  size_t myStatePart() const override {
+    return mpi_ && shardingMode_ == ShardingMode::global ? mpi_->myMPIRank() : 0;
+  }
+
+  io::Item gatherLocalState(const OptimizerBase::GatherStateGetFunc& getFn) const override {
+    io::Item localData = getFn(0);
+    for(size_t localDeviceIndex = 1; localDeviceIndex < graphs_.size(); localDeviceIndex++)
+      localData.append(getFn(localDeviceIndex));
+    return localData;
+  }
+
+  // Same slicing as scatterState(), of the part of the data that starts at the shard of the first local device
+  void scatterLocalState(const io::Item& data, size_t totalSize, const OptimizerBase::ScatterStateSetFunc& setFn) const override {
+    size_t numShards = shardingMode_ == ShardingMode::global ? numNcclRanks() : numLocalRanks();
+    size_t shardSize = (totalSize + numShards - 1) / numShards;
+    auto ncclRank = [&](size_t localDeviceIndex) {
+      return shardingMode_ == ShardingMode::global ? myNcclRank(localDeviceIndex) : myLocalRank(localDeviceIndex);
+    };
+    size_t first = ncclRank(0) * shardSize;
+    for(size_t localDeviceIndex = 0; localDeviceIndex < graphs_.size(); localDeviceIndex++) {
+      size_t begin = ncclRank(localDeviceIndex) * shardSize;
+      size_t end   = std::min(begin + shardSize, totalSize);
+      ABORT_IF(end - first > data.size(), "Part of {} bytes does not contain the shard of local device {}",
+               data.size(), localDeviceIndex);
+      setFn(localDeviceIndex, data.bytes.data() + begin - first, data.bytes.data() + end - first);
+    }
+  }
+
   // Collect shards across multiple devices and MPI processes in the NCCL configuration into a single CPU-side io::Item.
   // This is used when persisting optimizer state which is sharded.
   io::Item gatherState(const OptimizerBase::GatherStateGetFunc& getFn) const override {
@@ -1,4 +1,7 @@
 #include "training/graph_group.h"
+#include "training/sharded_checkpoint.h"
+
+#include <set>
 
 namespace marian {
 
@@ -58,10 +61,16 @@ GraphGroup::GraphGroup(Ptr<Options> options, Ptr<IMPIWrapper> mpi)
   // This part of the code will not special-case any of this here.
   // Rather, it is assumed that the communicator knows to reduce unnecessary transfers to no-ops.
   // @TODO: createCommunicator(options, ...)
+  auto allReduce = options_->get<std::string>("all-reduce", "flat");
+  ABORT_IF(allReduce != "flat" && allReduce != "hierarchical", "Unknown all-reduce topology {}", allReduce);
   comm_ = createCommunicator(graphs_,
                              /*noNccl=*/options_->get<bool>("no-nccl", false),
                              shardingMode_,
-                             /*mpi=*/mpi_);
+                             /*mpi=*/mpi_,
+                             /*hierarchical=*/allReduce == "hierarchical");
+  auto compression = options_->get<std::string>("gradient-compression", "none");
+  if(compression != "none")
+    comm_->setGradientCompression(compression, options_->get<size_t>("gradient-compression-rank", 4));
 
   auto formattedDeviceType = utils::utf8ToUpper(devices_.front().typeAsString()) + "s";
   if (mpi_->numMPIProcesses() > 1)
@@ -80,13 +89,29 @@ void GraphGroup::initGraphsAndOpts() {
 
     graph->setDefaultElementType(parameterType);
     graph->setCheckpointing(options_->get<bool>("gradient-checkpointing"));
+    graph->setCheckpointPolicy(options_->get<std::string>("gradient-checkpointing-policy", "manual"),
+                               options_->get<size_t>("gradient-checkpointing-every", 1));
+    graph->setActivationOffloading(options_->get<bool>("activation-offloading", false));
+    if(options_->get<int>("lora-rank", 0) > 0)
+      graph->setTrainableOnly("->lora");
 
     if(options_->get<bool>("check-nan")) // @TODO: add to other places
       graph->setThrowNaN(true);
 
     graph->setDevice(device);
+    if(device.type == DeviceType::gpu) {
+      graph->getBackend()->setFp8(options_->get<size_t>("fp8", 0));
+      graph->getBackend()->setPinnedUploads(options_->get<size_t>("pinned-uploads", 0) * 1024 * 1024);
+      graph->setStagedLoading(options_->get<size_t>("staged-loading", 0) * 1024 * 1024);
+    }
 
+    graph->setAllocatorSizeClasses(options_->get<bool>("allocator-size-classes", false));
     graph->reserveWorkspaceMB(options_->get<int>("workspace"));
+    graph->setMemoryProfile(options_->get<std::string>("memory-profile", ""),
+                            options_->get<size_t>("memory-profile-passes", 2));
+    graph->setNodeProfile(options_->get<size_t>("profile-nodes", 0), options_->get<size_t>("profile-nodes-top", 20),
+                          options_->get<std::string>("profile-nodes-trace", ""),
+                          options_->get<bool>("profile-nodes-counters", false));
 
     graphs_.push_back(graph);
 
@@ -95,6 +120,12 @@ void GraphGroup::initGraphsAndOpts() {
   }
 }
 
+void GraphGroup::registerModelObservers() {
+  for(auto model : models_)
+    if(auto observer = model->getTrainingObserver())
+      scheduler_->registerTrainingObserver(observer);
+}
+
 void GraphGroup::syncParametersAndShards() {
   // In local model we have seen that parameters can diverge occasionally due to non-determinism in NCCL.
   // Here, we try to catch this and if caught, re-sync everything (also optimizer state) across nodes.
@@ -182,6 +213,14 @@ void GraphGroup::decreaseCostScaleFactor() {
 float GraphGroup::checkNanOrNorm(size_t i, size_t begin, size_t end) {
   auto curGrad = graphs_[i]->params()->grads()->subtensor(begin, end-begin);
 
+  // A finite norm means that there are no NaN or Inf values, so the usual case needs a single reduction and a
+  // single wait for its result instead of sanitizing the gradient first.
+  if(dynamicGradientScaling_) {
+    auto gNorm = L2Norm(curGrad, graphs_[i]->allocator());
+    if(isFinite(gNorm) && gNorm > 0.0)
+      return gNorm;
+  }
+
   // If costScaling_ then check for NaN values if the costScalingFactor_ is larger than
   // the minimum. If a NaN value is seen we exit here and will reduce the factor next and
   // this skips an update.
@@ -366,7 +405,8 @@ void GraphGroup::load(const OptimizerBase::ScatterStateFunc& scatterFn) {
       // continue with checkpoint loading
       if(mpi_) {
         // broadcast model information to other processes
-        modelWeights_->loadAndSync(mpi_);
+        // the parameters are copied into the graphs, so the processes of a host can share the items
+        modelWeights_->loadAndSync(mpi_, /*mapShared=*/true);
         mpi_->bCast(&markReloaded, 1, mpi_->getDataType(&markReloaded));
       }
 
@@ -403,6 +443,9 @@ bool GraphGroup::loadOptimizerState(const std::string& modelFileName,
     - abort if checkpoint model and graph size do not match, probably due to different model or precision
   */
 
+  if(options_->get<bool>("sharded-checkpoints", false))
+    return loadShardedOptimizerState(modelFileName);
+
   std::string checkpointName = modelFileName + ".optimizer.npz"; // @TODO: change to .checkpoint.npz, would break backwards compat
 
   // if a checkpoint exists, the main process will find it and propagate this information to other MPI nodes
@@ -422,8 +465,13 @@ bool GraphGroup::loadOptimizerState(const std::string& modelFileName,
   if(mpi_) // only the main process loads the checkpoint and the rest receives a copy
     checkpoint->loadAndSync(mpi_);
 
-  auto& items = checkpoint->items();
+  return restoreOptimizerState(modelFileName, checkpointName, checkpoint->items(), scatterFn);
+}
 
+bool GraphGroup::restoreOptimizerState(const std::string& modelFileName,
+                                       const std::string& checkpointName,
+                                       std::vector<io::Item>& items,
+                                       const OptimizerBase::ScatterStateFunc& scatterFn) {
   // @TODO: probably we want to have the list of DeviceIds as an attribute
   std::vector<Ptr<Backend>> backends;
   for(auto graph : graphs_)
@@ -462,6 +510,9 @@ bool GraphGroup::loadOptimizerState(const std::string& modelFileName,
 
 void GraphGroup::saveOptimizerState(const std::string& modelFileName,
                                     const OptimizerBase::GatherStateFunc& gatherFn) {
+  if(options_->get<bool>("sharded-checkpoints", false))
+    return saveShardedOptimizerState(modelFileName);
+
   // @TODO: change to .checkpoint.npz, would break backwards compat
   std::string checkpointName = modelFileName + ".optimizer.npz";
 
@@ -490,6 +541,139 @@ void GraphGroup::saveOptimizerState(const std::string& modelFileName,
   }
 }
 
+std::vector<std::pair<size_t, size_t>> GraphGroup::localShardRanges() {
+  std::vector<std::pair<size_t, size_t>> ranges(graphs_.size());
+  comm_->foreach([&](size_t i, size_t begin, size_t end) {
+    ranges[i] = {begin, end};
+    return true;
+  });
+  return ranges;
+}
+
+bool GraphGroup::writesCheckpoint() const {
+  return isMainProcess() || (options_->get<bool>("sharded-checkpoints", false) && comm_->numStateParts() > 1);
+}
+
+bool GraphGroup::loadShardedOptimizerState(const std::string& modelFileName) {
+  // every process reads the manifest and its own part, there is nothing to broadcast
+  ShardedCheckpoint checkpoint;
+  if(!checkpoint.load(modelFileName)) {
+    LOG(warn, "No sharded checkpoint found, parameters reloaded from last inference model");
+    return false; // failed to restore
+  }
+  if(checkpoint.parts != comm_->numStateParts()) {
+    // the processes changed, e.g. with --elastic-restart: all of them read all parts and shard the state anew
+    LOG(info, "[training] Re-sharding the {} parts of the checkpoint of {} over {} processes",
+        checkpoint.parts, modelFileName, comm_->numStateParts());
+    auto items = checkpoint.consolidate(modelFileName);
+    auto scatterFn = [&](const io::Item& data, const OptimizerBase::ScatterStateSetFunc& setShardFn) {
+      comm_->scatterState(data, setShardFn);
+    };
+    return restoreOptimizerState(modelFileName, ShardedCheckpoint::manifestFileName(modelFileName), items, scatterFn);
+  }
+
+  std::string partName = ShardedCheckpoint::partFileName(modelFileName, comm_->myStatePart());
+  auto part = New<io::ModelWeights>(partName, io::MmapMode::DontMmap);
+  auto& items = part->items();
+
+  auto scatterFn = [&](const io::Item& data, const OptimizerBase::ScatterStateSetFunc& setShardFn) {
+    auto item = checkpoint.find(data.name);
+    ABORT_IF(!item || !item->sliced, "Item {} of {} is not a slice of the optimizer state", data.name, partName);
+    comm_->scatterLocalState(data, item->bytes, setShardFn);
+  };
+
+  std::vector<Ptr<Backend>> backends;
+  for(auto graph : graphs_)
+    backends.push_back(graph->getBackend());
+  optimizerShards_[0]->load(items, optimizerShards_, backends, scatterFn, isMainProcess());
+
+  // restore the parameters of the local shards from the slice of the master copy, the others are gathered below
+  auto found = std::find_if(items.begin(), items.end(),
+    [](const io::Item& item) { return item.name == "master_parameters"; });
+  if(found == items.end()) {
+    LOG(warn, "No master parameters found in checkpoint, parameters reloaded from last inference model");
+    return false; // failed to restore
+  }
+  auto& masterParameters = *found;
+
+  for(auto graph : graphs_)
+    graph->forward(); // allocate graph parameter memory in order, see loadOptimizerState()
+
+  auto vals = graphs_[0]->params()->vals();
+  auto item = checkpoint.find("master_parameters");
+  ABORT_IF(item->bytes / sizeOf(item->type) != vals->size(),
+           "Graph parameter sizes and master copy parameter sizes in checkpoint do not match ({} != {})",
+           vals->size(), item->bytes / sizeOf(item->type));
+  if(masterParameters.type != vals->type())
+    masterParameters.convert(vals->type());
+
+  auto ranges = localShardRanges();
+  size_t first = ranges[0].first;
+  ABORT_IF(ranges.back().second - first != masterParameters.shape.elements(),
+           "The master parameters in {} do not match the shards of the local devices", partName);
+  size_t typeSize = sizeOf(masterParameters.type);
+  for(size_t i = 0; i < graphs_.size(); ++i) {
+    auto shard = graphs_[i]->params()->vals()->subtensor(ranges[i].first, ranges[i].second - ranges[i].first);
+    const char* begin = masterParameters.bytes.data() + (ranges[i].first - first) * typeSize;
+    shard->set(begin, begin + (ranges[i].second - ranges[i].first) * typeSize, masterParameters.type);
+  }
+  comm_->allGatherParams();
+  if(shardingMode_ == ShardingMode::local)
+    comm_->broadcastParams();
+
+  for(auto graph : graphs_)
+    graph->clear();
+
+  LOG(info, "[training] Master parameters and optimizers restored from training checkpoint {} and {}", modelFileName, partName);
+  return true; // succeeded to restore
+}
+
+void GraphGroup::saveShardedOptimizerState(const std::string& modelFileName) {
+  // the items of the optimizer state that are gathered over the devices are sliced, the others are copies
+  std::set<std::string> sliced;
+  auto gatherFn = [&](const OptimizerBase::GatherStateGetFunc& getShardFn) {
+    auto data = comm_->gatherLocalState(getShardFn);
+    sliced.insert(data.name);
+    return data;
+  };
+
+  std::vector<io::Item> items;
+  optimizerShards_[0]->save(items, optimizerShards_, gatherFn, isMainProcess());
+
+  auto found = std::find_if(items.begin(), items.end(),
+    [](const io::Item& item) { return item.name == "master_parameters"; });
+  if(found == items.end()) {
+    // as in saveOptimizerState(), only the shards of the local devices
+    auto ranges = localShardRanges();
+    items.push_back(gatherFn([&](size_t i) {
+      io::Item masterParameters;
+      auto shard = graphs_[i]->params()->vals()->subtensor(ranges[i].first, ranges[i].second - ranges[i].first);
+      shard->get(masterParameters, "master_parameters");
+      return masterParameters;
+    }));
+  }
+
+  if(writesCheckpoint()) {
+    std::string partName = ShardedCheckpoint::partFileName(modelFileName, comm_->myStatePart());
+    LOG(info, "[training] Saving training checkpoint to {} and {}", modelFileName, partName);
+    io::saveItems(partName, items);
+  }
+
+  if(isMainProcess()) {
+    ShardedCheckpoint checkpoint;
+    checkpoint.parts = comm_->numStateParts();
+    size_t numParams = graphs_[0]->params()->vals()->size();
+    for(const auto& item : items) {
+      bool isSliced = sliced.count(item.name) > 0;
+      checkpoint.items.push_back({item.name,
+                                  item.type,
+                                  isSliced ? numParams * sizeOf(item.type) : item.shape.elements() * sizeOf(item.type),
+                                  isSliced});
+    }
+    checkpoint.save(modelFileName);
+  }
+}
+
 void GraphGroup::saveCheckPoint(const std::string& modelFileName,
                                 bool isFinal,
                                 bool doSaveOptimizerState,
@@ -502,7 +686,20 @@ void GraphGroup::saveCheckPoint(const std::string& modelFileName,
 
   if(isMainProcess()) {
     // save main model file
-    models_[0]->save(graphs_[0], modelFileName, /*saveTranslatorConfig=*/true);
+    if(graphs_[0]->getTensorParallel()) {
+      // the graphs of all local devices gather the parts of the split parameters for the one that saves them
+      comm_->foreach([&](size_t i, size_t /*begin*/, size_t /*end*/) {
+        if(i == 0) {
+          models_[0]->save(graphs_[0], modelFileName, /*saveTranslatorConfig=*/true);
+        } else {
+          std::vector<io::Item> items;
+          graphs_[i]->getItems(items);
+        }
+        return true;
+      });
+    } else {
+      models_[0]->save(graphs_[0], modelFileName, /*saveTranslatorConfig=*/true);
+    }
     // save scheduler-related state
     if(doSaveOptimizerState && scheduler_)
       scheduler_->save(modelFileName);
@@ -526,6 +723,17 @@ void GraphGroup::save(bool isFinal,
     barrier(); // (for better grouping of log messages)
   }
 
+  // With --async-checkpoints the processes that write files copy the items to host memory and continue training while
+  // they are written. The files of the previous save have to be complete before they are written again.
+  std::unique_ptr<io::AsyncSaver::Scope> asyncSave;
+  if(writesCheckpoint() && options_->get<bool>("async-checkpoints", false)) {
+    if(!checkpointSaver_)
+      checkpointSaver_ = New<io::AsyncSaver>();
+    checkpointSaver_->wait();
+    if(!isFinal)
+      asyncSave.reset(new io::AsyncSaver::Scope(*checkpointSaver_));
+  }
+
   std::string modelFileName = options_->get<std::string>("model");
   bool overwrite = options_->get<bool>("overwrite", false);
 
@@ -581,6 +789,22 @@ void GraphGroup::finalize() {
   finalized_ = true;
 }
 
+// The statistics of --mini-batch-fit depend on the model and training options, on the device and its memory and on
+// the multiplier. Only options that differ between runs without changing the memory of a batch are left out.
+static std::string batchStatsKey(Ptr<Options> options, Ptr<ExpressionGraph> graph, double multiplier) {
+  YAML::Node config = options->cloneToYamlNode();
+  for(const char* key : {"after", "after-epochs", "after-batches", "disp-freq", "disp-first", "save-freq",
+                         "valid-freq", "log", "valid-log", "seed", "no-reload", "no-optimizer-reload", "quiet"})
+    config.remove(key);
+
+  auto backend = graph->getBackend();
+  config["device-type"] = backend->getDeviceId().typeAsString();
+  if(backend->getDeviceId().type == DeviceType::gpu)
+    config["device-memory"] = backend->getGlobalMemorySize();
+  config["multiplier"] = multiplier;
+  return std::to_string(std::hash<std::string>()(YAML::Dump(config)));
+}
+
 /**
  * Determine maximal batch size that can fit into the given workspace
  * so that reallocation does not happen. Rather adjust the batch size
@@ -595,6 +819,17 @@ Ptr<data::BatchStats> GraphGroup::collectStats(Ptr<ExpressionGraph> graph,
                                                Ptr<models::ICriterionFunction> model,
                                                const std::vector<Ptr<Vocab>>& vocabs,
                                                double multiplier) {
+  // reuse the statistics of an earlier run for the same model, options and device, see --mini-batch-fit-cache
+  std::string cacheFile, cacheKey;
+  if(options_->get<bool>("mini-batch-fit-cache", false) && !options_->get<std::string>("model", "").empty()) {
+    cacheFile = options_->get<std::string>("model") + ".batch-stats.yml";
+    cacheKey = batchStatsKey(options_, graph, multiplier);
+    if(auto cached = data::BatchStats::load(cacheFile, cacheKey)) {
+      LOG(info, "[batching] Reusing the statistics for batch fitting from {}", cacheFile);
+      return cached;
+    }
+  }
+
   // this runs with fake values, we do not care for overflow/underflow
   bool throwNan = graph->getThrowNaN();
 
@@ -687,6 +922,8 @@ Ptr<data::BatchStats> GraphGroup::collectStats(Ptr<ExpressionGraph> graph,
   // set back to original value for aborting on NaN or Inf
   graph->setThrowNaN(throwNan);
 
+  if(!cacheFile.empty() && mpi_->isMainProcess())
+    stats->save(cacheFile, cacheKey);
   return stats;
 }
 
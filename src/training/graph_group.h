@@ -48,6 +48,7 @@ protected:
 
   Ptr<io::ModelWeights> modelWeights_; // handle for model weights, we keep this around to make sure weights are not deallocated while we are still using them
   Ptr<Scheduler> scheduler_; // scheduler that keeps track of how much has been processed
+  Ptr<io::AsyncSaver> checkpointSaver_; // writes the files of save() in the background with --async-checkpoints
 
   bool finalized_{false};    // 'true' if training has completed (further updates are no longer allowed)
   float typicalTrgBatchWords_{0}; // for dynamic batch sizing: typical batch size in words
@@ -83,6 +84,7 @@ public:
 
   void initGraphsAndOpts();
   void syncParametersAndShards();
+  void registerModelObservers(); // of the criterion functions that follow the training progress
 
   virtual ~GraphGroup() {}
 
@@ -105,6 +107,12 @@ private:
   bool loadOptimizerState(const std::string& modelFileName,
                           const OptimizerBase::ScatterStateFunc& scatterFn);
 
+  // restores the optimizers and the graph parameters from the items of a whole checkpoint
+  bool restoreOptimizerState(const std::string& modelFileName,
+                             const std::string& checkpointName,
+                             std::vector<io::Item>& items,
+                             const OptimizerBase::ScatterStateFunc& scatterFn);
+
   void save(bool isFinal,
             const OptimizerBase::GatherStateFunc& gatherOptimizerStateFn);
 
@@ -116,6 +124,14 @@ private:
   void saveOptimizerState(const std::string& modelFileName,
                           const OptimizerBase::GatherStateFunc& gatherFn);
 
+  // --sharded-checkpoints: each MPI process writes and reads the optimizer state of its devices, see ShardedCheckpoint
+  bool loadShardedOptimizerState(const std::string& modelFileName);
+  void saveShardedOptimizerState(const std::string& modelFileName);
+  // whether this process writes files in save(), all that hold a part of a sharded checkpoint or the main one
+  bool writesCheckpoint() const;
+  // the element range of the parameters of each local device that comm_->foreach() processes
+  std::vector<std::pair<size_t, size_t>> localShardRanges();
+
 public:
   // This function swaps out the current optimizer parameters with the smoothed version (provided smoothing is enabled).
   // Usually we will call this twice, to swap in and to swap out.
@@ -3,63 +3,121 @@
 #include "functional/functional.h"
 #include "tensors/tensor_operators.h"
 
+#include <limits>
+
 namespace marian {
 
 AsyncGraphGroup::AsyncGraphGroup(Ptr<Options> options, Ptr<IMPIWrapper> mpi)
     : GraphGroup(options, mpi),
-      shardSync_(devices_.size()),
+      fetches_(devices_.size()),
+      staleness_(options_->get<size_t>("async-staleness", 0)),
+      clocks_(devices_.size(), 0),
+      busy_(devices_.size(), 0),
       optimizerDelay_((size_t)options_->get<double>("optimizer-delay")) {
   ABORT_IF(mpi->numMPIProcesses() != 1, "AsyncGraphGroup presently does not support multiple MPI processes");
   ABORT_IF((double)optimizerDelay_ != options_->get<double>("optimizer-delay"), "AsyncGraphGroup presently does not implement fractional values for --optimizer-delay");
+  ABORT_IF(!options_->get<std::string>("prune-pattern", "").empty(), "AsyncGraphGroup presently does not support --prune-pattern");
   pool_.reset(new ThreadPool(devices_.size(), devices_.size()));
+  for(size_t i = 0; i < devices_.size(); ++i)
+    shardWorkers_.emplace_back(new ThreadPool(1));
 }
 
 void AsyncGraphGroup::setScheduler(Ptr<Scheduler> scheduler) {
   scheduler_ = scheduler;
   // optimizer has to be registered last to see changes of learning rate
   scheduler_->registerTrainingObserver(scheduler_);
+  registerModelObservers();
   for(auto opt : optimizerShards_)
     scheduler_->registerTrainingObserver(opt);
 }
 
-void AsyncGraphGroup::fetchParams(Tensor oldParams,
-                                  const std::vector<Tensor>& params,
-                                  int /*device_id*/) {
-  // @TODO read guard on parameters
-  int pos = 0;
-  auto fetch = [&](int idx, int pos) {
-    // individual mutex per-shard
-    std::lock_guard<std::mutex> guard(shardSync_[idx]);
-    oldParams->subtensor((int)pos, (int)params[idx]->size())->copyFrom(params[idx]);
-  };
+void AsyncGraphGroup::prefetchParams(int device_id) {
+  waitForStragglers(device_id);
 
-  std::vector<std::thread> threads;
-  for(int idx = 0; idx < devices_.size(); idx++) {
-    threads.emplace_back(std::thread(fetch, idx, pos));
+  auto fetched = fetched_[device_id];
+  int pos = 0;
+  for(size_t idx = 0; idx < shardWorkers_.size(); idx++) {
+    auto param = params_[idx];
+    fetches_[device_id].push_back(shardWorkers_[idx]->enqueue([fetched, param, pos]() {
+      fetched->subtensor(pos, (int)param->size())->copyFrom(param);
+    }));
     pos += shardSize_;
   }
-  for(auto&& t : threads)
-    t.join();
+}
+
+void AsyncGraphGroup::fetchParams(Tensor oldParams,
+                                  const std::vector<Tensor>& /*params*/,
+                                  int device_id) {
+  // the parameters were usually prefetched during the last backward pass, except for the first update
+  if(fetches_[device_id].empty())
+    prefetchParams(device_id);
+  for(auto& fetch : fetches_[device_id])
+    fetch.wait();
+  fetches_[device_id].clear();
+  oldParams->copyFrom(fetched_[device_id]);
 }
 
 void AsyncGraphGroup::pushGradients(Tensor newGrads,
-                                    int /*device_id*/,
+                                    int device_id,
                                     size_t mbSize) {
-  std::vector<std::thread> threads;
+  // the device continues once the shard workers copied its gradients, they update the shards after that
+  std::vector<std::future<void>> copied;
   int pos = 0;
-  for(int idx = 0; idx < devices_.size(); idx++) {
-    auto push = [&](int idx, int pos) {
-      // individual mutex per-shard
-      std::lock_guard<std::mutex> guard(shardSync_[idx]);
+  for(size_t idx = 0; idx < shardWorkers_.size(); idx++) {
+    auto promise = New<std::promise<void>>();
+    copied.push_back(promise->get_future());
+    shardWorkers_[idx]->enqueue([this, newGrads, promise, idx, pos, mbSize]() {
       grads_[idx]->copyFrom(newGrads->subtensor(pos, (int)grads_[idx]->size()));
+      promise->set_value();
       optimizerShards_[idx]->update(params_[idx], grads_[idx], mbSize);
-    };
-
-    threads.emplace_back(std::thread(push, idx, pos));
+    });
     pos += shardSize_;
   }
-  for(auto&& t : threads)
-    t.join();
+  for(auto& c : copied)
+    c.wait();
+
+  {
+    std::lock_guard<std::mutex> lock(clockMutex_);
+    clocks_[device_id]++;
+  }
+  clockCondition_.notify_all();
+}
+
+void AsyncGraphGroup::waitForStragglers(int device_id) {
+  if(staleness_ == 0)
+    return;
+  std::unique_lock<std::mutex> lock(clockMutex_);
+  clockCondition_.wait(lock, [&]() {
+    for(size_t i = 0; i < clocks_.size(); ++i)
+      if(busy_[i] && clocks_[i] + staleness_ < clocks_[device_id])
+        return false;
+    return true;
+  });
+}
+
+void AsyncGraphGroup::setBusy(int device_id, bool busy) {
+  {
+    std::lock_guard<std::mutex> lock(clockMutex_);
+    if(busy && !busy_[device_id]) {
+      // a device that was idle fetches fresh parameters, it does not need to catch up with the slowest busy one
+      size_t slowest = std::numeric_limits<size_t>::max();
+      for(size_t i = 0; i < clocks_.size(); ++i)
+        if(busy_[i])
+          slowest = std::min(slowest, clocks_[i]);
+      if(slowest != std::numeric_limits<size_t>::max())
+        clocks_[device_id] = std::max(clocks_[device_id], slowest);
+    }
+    busy_[device_id] = busy;
+  }
+  clockCondition_.notify_all();
+}
+
+void AsyncGraphGroup::drainShardWorkers() {
+  std::vector<std::future<void>> drained;
+  for(auto& worker : shardWorkers_)
+    drained.push_back(worker->enqueue([]() {}));
+  for(auto& d : drained)
+    d.wait();
 }
 
 void AsyncGraphGroup::init(Ptr<data::Batch> batch) {
@@ -98,6 +156,16 @@ void AsyncGraphGroup::init(Ptr<data::Batch> batch) {
       pos += __size__;
     }
   }
+  if(fetched_.empty()) {
+    for(auto graph : graphs_) {
+      Tensor fetched;
+      Ptr<TensorAllocator> allocator = New<TensorAllocator>(graph->getBackend());
+      allocator->reserveExact(graph->params()->vals()->memory()->size());
+      allocator->allocate(fetched, graph->params()->vals()->shape(), graph->getDefaultElementType());
+      fetchedAlloc_.push_back(allocator);
+      fetched_.push_back(fetched);
+    }
+  }
   if(grads_.empty()) {
     int totalSize = (int)graphs_[0]->params()->vals()->size();
 
@@ -118,8 +186,10 @@ void AsyncGraphGroup::init(Ptr<data::Batch> batch) {
   }
 
   // Initialize optimizers with empty gradient
-  for(int i = 0; i < params_.size(); ++i)
+  for(int i = 0; i < params_.size(); ++i) {
+    optimizerShards_[i]->setParameterLayout(graphs_[0]->params(), (size_t)i * shardSize_);
     optimizerShards_[i]->update(params_[i], grads_[i], batch->wordsTrg());
+  }
 }
 
 void AsyncGraphGroup::execute(Ptr<data::Batch> batch) {
@@ -144,6 +214,7 @@ void AsyncGraphGroup::execute(Ptr<data::Batch> batch) {
     thread_local Ptr<TensorAllocator> accAlloc;
 
     ABORT_IF(costScaling_ ,"Cost-scaling not implemented for AsyncSGD");
+    setBusy(tid, true);
 
     auto graph = graphs_[tid];
     Ptr<RationalLoss> dynamicLoss = models_[tid]->build(graph, batch);
@@ -158,6 +229,8 @@ void AsyncGraphGroup::execute(Ptr<data::Batch> batch) {
 
     graph->forward();
     loss += *dynamicLoss; // does not add scaledLoss but original loss
+    if((t + 1) % optimizerDelay_ == 0)
+      prefetchParams(tid); // for the next update, overlaps the backward pass and does not see its gradients
     graph->backward();
 
     Tensor gradients;
@@ -216,7 +289,9 @@ void AsyncGraphGroup::execute(Ptr<data::Batch> batch) {
         // update.
         // We want to reuse the graphs for validation, so they need to be in
         // a safe state.
+        setBusy(tid, false); // the others must not wait for this device to reach the validation
         pool_->wait_for_others(lock);
+        drainShardWorkers();
 
         LOG(info, "TODO: implement exponential smoothing!");
 
@@ -230,6 +305,7 @@ void AsyncGraphGroup::execute(Ptr<data::Batch> batch) {
         pool_->notify_others();
       }
     }
+    setBusy(tid, false);
   };
 
   pool_->enqueue(task, batch);
@@ -238,6 +314,8 @@ void AsyncGraphGroup::execute(Ptr<data::Batch> batch) {
 void AsyncGraphGroup::finalize() {
   pool_->join_all();  // call before destructing thread pool
   pool_.reset(nullptr);
+  drainShardWorkers(); // the last updates and prefetches
+  shardWorkers_.clear();
   finalized_ = true;
 }
 
@@ -3,6 +3,7 @@
 #include "3rd_party/threadpool.h"
 #include "training/graph_group.h"
 
+#include <condition_variable>
 #include <future>
 #include <thread>
 
@@ -15,11 +16,24 @@ public:
 protected:
   bool first_{true};
 
-  std::mutex sync_;
-  std::vector<std::mutex> shardSync_;
-
   std::mutex schedulerMutex_;
 
+  // One thread per shard owns its parameters, gradients and optimizer, the updates and fetches of the devices are
+  // queued to it and run in order without further locking
+  std::vector<std::unique_ptr<ThreadPool>> shardWorkers_;
+
+  // The parameters for the next update of each device, fetched by the shard workers during its backward pass
+  std::vector<Tensor> fetched_;
+  std::vector<Ptr<TensorAllocator>> fetchedAlloc_;
+  std::vector<std::vector<std::future<void>>> fetches_;
+
+  // Bounded staleness, see --async-staleness: the number of updates each device pushed and whether it is busy
+  size_t staleness_{0};
+  std::mutex clockMutex_;
+  std::condition_variable clockCondition_;
+  std::vector<size_t> clocks_;
+  std::vector<char> busy_;
+
   std::vector<Tensor> params_;
   std::vector<Ptr<TensorAllocator>> paramsAlloc_;
 
@@ -36,6 +50,9 @@ protected:
                            const std::vector<Tensor>& params,
                            int device_id);
 
+  // Starts fetching the parameters of all shards into fetched_[device_id], waited for by fetchParams()
+  void prefetchParams(int device_id);
+
   virtual void pushGradients(Tensor newGrads,
                              int device_id,
                              size_t mbSize);
@@ -43,6 +60,12 @@ protected:
   virtual void init(Ptr<data::Batch> batch);
   void execute(Ptr<data::Batch> batch);
 
+  // Blocks while device_id is more than staleness_ updates ahead of the slowest busy device
+  void waitForStragglers(int device_id);
+  void setBusy(int device_id, bool busy);
+  // Waits until the shard workers applied all queued updates
+  void drainShardWorkers();
+
 public:
   AsyncGraphGroup(Ptr<Options> config, Ptr<IMPIWrapper> mpi);
 
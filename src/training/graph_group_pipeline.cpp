@@ -0,0 +1,298 @@
+#include "training/graph_group_pipeline.h"
+
+#include "common/filesystem.h"
+#include "common/hash.h"
+#include "models/costs.h"
+#include "tensors/tensor_operators.h"
+
+#include <cmath>
+#include <thread>
+
+namespace marian {
+
+struct PipelineGraphGroup::Transfer {
+  std::vector<Ptr<io::Item>> contexts; // [encoder]
+  std::vector<Ptr<io::Item>> masks;    // [encoder]
+  std::vector<Ptr<io::Item>> grads;    // [encoder] of the contexts
+  bool statesReady{false};
+  bool gradsReady{false};
+};
+
+// the initializer holds on to the item, unlike inits::fromItem()
+static Ptr<inits::NodeInitializer> fromTransferred(Ptr<io::Item> item) {
+  return inits::fromLambda([item](Tensor tensor) { tensor->set(*item); }, item->type);
+}
+
+static Ptr<io::Item> transfer(Tensor tensor, const std::string& name) {
+  auto item = New<io::Item>();
+  tensor->get(*item, name);
+  return item;
+}
+
+PipelineGraphGroup::PipelineGraphGroup(Ptr<Options> options, Ptr<IMPIWrapper> mpi)
+    : GraphGroup(options, mpi), numMicroBatches_(options->get<size_t>("pipeline-micro-batches")) {
+  ABORT_IF(mpi->numMPIProcesses() != 1, "--pipeline-parallel does not support multiple MPI processes");
+  ABORT_IF(devices_.size() != 2,
+           "--pipeline-parallel runs the encoders and the decoder on two devices, but {} are given",
+           devices_.size());
+  for(auto model : models_) {
+    auto trainer = std::dynamic_pointer_cast<models::Trainer>(model);
+    auto encdec = trainer ? std::dynamic_pointer_cast<EncoderDecoder>(trainer->getModel()) : nullptr;
+    ABORT_IF(!encdec, "--pipeline-parallel requires an encoder-decoder model");
+    stages_.push_back(encdec);
+  }
+  LOG(info, "[training] Pipelining the encoders on device {} and the decoder on device {} over {} micro-batches",
+      devices_[0].no, devices_[1].no, numMicroBatches_);
+}
+
+void PipelineGraphGroup::setScheduler(Ptr<Scheduler> scheduler) {
+  validate();
+  scheduler_ = scheduler;
+  scheduler_->registerTrainingObserver(scheduler_);
+  registerModelObservers();
+
+  // optimizer has to be registered last to see changes of learning rate
+  for(auto opt : optimizerShards_)
+    scheduler_->registerTrainingObserver(opt);
+}
+
+void PipelineGraphGroup::encoderStage(const std::vector<Ptr<data::Batch>>& microBatches,
+                                      std::vector<Transfer>& transfers) {
+  auto graph = graphs_[0];
+  auto encdec = stages_[0];
+  graph->getBackend()->setDevice();
+
+  auto encode = [&](size_t i) {
+    // the recomputation of a micro-batch draws the same dropout masks as its first forward pass
+    graph->getBackend()->setRandomSeed(util::hashArgs(Config::seed, updates_, i));
+    encdec->clear(graph);
+    return encdec->encode(graph, std::static_pointer_cast<data::CorpusBatch>(microBatches[i]));
+  };
+
+  // the parameters are initialized before the seeded passes, which then draw only dropout masks
+  if(first_) {
+    encdec->clear(graph);
+    encdec->encode(graph, std::static_pointer_cast<data::CorpusBatch>(microBatches.front()));
+    graph->forward();
+  }
+
+  size_t sent = 0;
+  for(size_t i = 0; i < microBatches.size(); ++i) {
+    // forward passes until the stage is one micro-batch ahead of the backward pass of the decoder stage
+    for(; sent < std::min(i + 2, microBatches.size()); ++sent) {
+      auto states = encode(sent);
+      graph->forward();
+      Transfer transferred;
+      for(auto state : states) {
+        transferred.contexts.push_back(transfer(state->getContext()->val(), "context"));
+        transferred.masks.push_back(transfer(state->getMask()->val(), "mask"));
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      transfers[sent].contexts = transferred.contexts;
+      transfers[sent].masks = transferred.masks;
+      transfers[sent].statesReady = true;
+      transferred_.notify_all();
+    }
+
+    std::vector<Ptr<io::Item>> grads;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      transferred_.wait(lock, [&]() { return transfers[i].gradsReady; });
+      grads = transfers[i].grads;
+    }
+
+    // the gradient of sum(context * grad) with respect to the context is the gradient of the decoder stage
+    auto states = encode(i);
+    Expr cost;
+    for(size_t k = 0; k < states.size(); ++k) {
+      auto context = states[k]->getContext();
+      auto grad = graph->constant(grads[k]->shape, fromTransferred(grads[k]), grads[k]->type);
+      auto term = sum(flatten(context * grad), /*axis=*/0);
+      cost = cost ? cost + term : term;
+    }
+    graph->forward();
+    graph->backward(/*reset=*/i == 0);
+  }
+}
+
+StaticLoss PipelineGraphGroup::decoderStage(const std::vector<Ptr<data::Batch>>& microBatches,
+                                            std::vector<Transfer>& transfers) {
+  auto graph = graphs_[1];
+  auto encdec = stages_[1];
+  graph->getBackend()->setDevice();
+
+  StaticLoss loss;
+  for(size_t i = 0; i < microBatches.size(); ++i) {
+    Transfer transferred;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      transferred_.wait(lock, [&]() { return transfers[i].statesReady; });
+      transferred = transfers[i];
+    }
+
+    auto batch = std::static_pointer_cast<data::CorpusBatch>(microBatches[i]);
+    encdec->clear(graph);
+    std::vector<Expr> contexts;
+    std::vector<Ptr<EncoderState>> states;
+    for(size_t k = 0; k < transferred.contexts.size(); ++k) {
+      auto context = Expression<InputNode>(graph, transferred.contexts[k]->shape,
+                                           fromTransferred(transferred.contexts[k]), transferred.contexts[k]->type);
+      auto mask = graph->constant(transferred.masks[k]->shape,
+                                  fromTransferred(transferred.masks[k]), transferred.masks[k]->type);
+      contexts.push_back(context);
+      states.push_back(New<EncoderState>(context, mask, batch));
+    }
+    encdec->setEncoderStates(states);
+
+    { // let loss go out of scope, frees memory
+      auto rationalLoss = models_[1]->build(graph, batch, /*clearGraph=*/false);
+      if(costScalingFactor_ != 1.f)
+        rationalLoss->loss() * costScalingFactor_;
+      graph->forward();
+      loss += *rationalLoss;
+    }
+    graph->backward(/*reset=*/i == 0);
+
+    std::vector<Ptr<io::Item>> grads;
+    for(auto context : contexts)
+      grads.push_back(transfer(context->grad(), "grad"));
+    std::lock_guard<std::mutex> lock(mutex_);
+    transfers[i].grads = grads;
+    transfers[i].gradsReady = true;
+    transferred_.notify_all();
+  }
+  return loss;
+}
+
+void PipelineGraphGroup::update(Ptr<data::Batch> batch) {
+  validate();
+
+  auto microBatches = batch->split(numMicroBatches_);
+  std::vector<Transfer> transfers(microBatches.size());
+
+  std::thread encoder([&]() { encoderStage(microBatches, transfers); });
+  StaticLoss loss = decoderStage(microBatches, transfers);
+  encoder.join();
+
+  if(first_) {
+    for(size_t i = 0; i < graphs_.size(); ++i)
+      optimizerShards_[i]->setParameterLayout(graphs_[i]->params(), 0);
+    first_ = false;
+  }
+  updates_++;
+
+  // the gradients of both stages are checked and normalized together, like the shards of one model
+  float gradNorm = 0.f;
+  if(costScaling_ || dynamicGradientScaling_ || checkGradientNan_) {
+    for(size_t i = 0; i < graphs_.size(); ++i) {
+      float stageNorm = checkNanOrNorm(i, 0, graphs_[i]->params()->grads()->size());
+      gradNorm += stageNorm * stageNorm;
+    }
+    gradNorm = std::sqrt(gradNorm);
+  }
+
+  size_t updateTargetWords = batch->wordsTrg();
+  bool saneGradient = isFinite(gradNorm);
+  if(saneGradient) {
+    float gradientNormalizer = GraphGroup::computeNormalizationFactor(gradNorm, updateTargetWords);
+    bool reportNorm = dynamicGradientScaling_ || !scheduler_ || scheduler_->displaysNextUpdate(updateTargetWords);
+
+    gradNorm = 0.f;
+    for(size_t i = 0; i < graphs_.size(); ++i) {
+      graphs_[i]->getBackend()->setDevice();
+      optimizerShards_[i]->setReportNorm(reportNorm);
+      float stageNorm = optimizerShards_[i]->update(graphs_[i]->params()->vals(),
+                                                    graphs_[i]->params()->grads(),
+                                                    updateTargetWords,
+                                                    gradientNormalizer);
+      gradNorm += stageNorm * stageNorm;
+    }
+    gradNorm = std::sqrt(gradNorm);
+    if(!options_->get<bool>("normalize-gradient"))
+      gradNorm /= updateTargetWords; // normalize for logging
+  } else {
+    LOG(debug, "Seen NaN in gradient, skipping update, resetting gradient");
+    gradNorm = 0.f;
+    GraphGroup::decreaseCostScaleFactor();
+  }
+
+  if(scheduler_) {
+    scheduler_->update(loss, /*numReadBatches=*/1, batch->size(), updateTargetWords, gradNorm);
+
+    if(scheduler_->saving())
+      save();
+
+    if(scheduler_->replacingWithSmoothed())
+      for(size_t i = 0; i < graphs_.size(); ++i)
+        optimizerShards_[i]->replaceWithSmoothed(graphs_[i]->params()->vals());
+  }
+
+  if(saneGradient)
+    GraphGroup::increaseCostScaleFactor();
+}
+
+void PipelineGraphGroup::load() {
+  validate();
+  if(options_->get<bool>("no-reload"))
+    return;
+
+  std::string modelFileName = options_->get<std::string>("model");
+  bool markReloaded = true;
+  if(filesystem::exists(modelFileName)) {
+    LOG(info, "Loading model from {}", modelFileName);
+    modelWeights_ = New<io::ModelWeights>(modelFileName, io::MmapMode::DontMmap);
+    if(scheduler_)
+      scheduler_->load(modelFileName);
+  } else if(options_->hasAndNotEmpty("pretrained-model")) {
+    std::string pretrainedModelFileName = options_->get<std::string>("pretrained-model");
+    LOG(info, "[training] Initializing model weights with pre-trained model {}", pretrainedModelFileName);
+    modelWeights_ = New<io::ModelWeights>(pretrainedModelFileName, io::MmapMode::DontMmap);
+    markReloaded = false;
+  } else {
+    return;
+  }
+
+  // each stage holds the parameters of its layers, those of the encoders are named after them
+  for(auto& item : modelWeights_->items()) {
+    if(item.name.substr(0, 8) == "special:")
+      continue;
+    auto graph = graphs_[item.name.substr(0, 7) == "encoder" ? 0 : 1];
+    auto type = graph->getDefaultElementType();
+    graph->param(item.name, item.shape, inits::fromItem(item), isSameTypeClass(item.type, type) ? type : item.type,
+                 /*fixed=*/false);
+  }
+  if(markReloaded && !options_->get<bool>("ignore-model-config", false))
+    for(auto graph : graphs_)
+      graph->setReloaded(true);
+
+  LOG(warn, "[training] --pipeline-parallel does not restore the optimizer state, it starts anew");
+}
+
+void PipelineGraphGroup::swapStagesWithSmoothed() {
+  for(size_t i = 0; i < graphs_.size(); ++i) {
+    graphs_[i]->getBackend()->setDevice();
+    optimizerShards_[i]->swapWithSmoothed(graphs_[i]->params()->vals());
+  }
+}
+
+void PipelineGraphGroup::save(bool isFinal) {
+  // both stages are written into one model file, which can be trained or decoded without --pipeline-parallel
+  auto saveModel = [&](const std::string& name, bool saveProgress) {
+    swapStagesWithSmoothed();
+    stages_[1]->save(graphs_, name, /*saveTranslatorConfig=*/true);
+    swapStagesWithSmoothed();
+    if(saveProgress && scheduler_)
+      scheduler_->save(name);
+  };
+
+  std::string modelFileName = options_->get<std::string>("model");
+  if(!options_->get<bool>("overwrite", false) && !isFinal) { // save a model with iteration number
+    std::string numberOfBatches = scheduler_ ? std::to_string(scheduler_->numberOfBatches()) : "unknown";
+    std::string nameOverwrite = modelFileName;
+    nameOverwrite.replace(modelFileName.size() - 4, 4, ".iter" + numberOfBatches + ".npz");
+    saveModel(nameOverwrite, /*saveProgress=*/false);
+  }
+  saveModel(modelFileName, /*saveProgress=*/true);
+}
+
+}  // namespace marian
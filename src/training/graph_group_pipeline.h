@@ -0,0 +1,53 @@
+#pragma once
+
+#include "training/graph_group.h"
+#include "models/encoder_decoder.h"
+
+#include <condition_variable>
+#include <mutex>
+
+namespace marian {
+
+/**
+ * Pipeline-parallel training of an encoder-decoder model on two devices, see --pipeline-parallel. The first device
+ * runs the encoders and the second one the decoder, and each holds and updates only the parameters of its stage.
+ * A batch is split into --pipeline-micro-batches micro-batches, whose encoder states are copied to the decoder
+ * device and whose gradients are copied back. The encoder device keeps one micro-batch ahead of the decoder and
+ * then alternates between the forward pass of the next micro-batch and the backward pass of the one the decoder
+ * has finished (1F1B). Since a graph holds the tape of one forward pass only, the backward pass of a micro-batch
+ * recomputes its encoder forward pass with the same random seed, thus the same dropout masks.
+ */
+class PipelineGraphGroup : public GraphGroup {
+private:
+  std::vector<Ptr<EncoderDecoder>> stages_; // [stage] the models of the criteria in models_
+  size_t numMicroBatches_;
+  size_t updates_{0}; // seeds the dropout masks of the encoder stage
+  bool first_{true};
+
+  // the encoder states of a micro-batch on their way to the decoder stage and their gradients on the way back
+  struct Transfer;
+  std::mutex mutex_;
+  std::condition_variable transferred_;
+
+  // the encoder stage runs on its own thread, the decoder stage on the calling one
+  void encoderStage(const std::vector<Ptr<data::Batch>>& microBatches, std::vector<Transfer>& transfers);
+  StaticLoss decoderStage(const std::vector<Ptr<data::Batch>>& microBatches, std::vector<Transfer>& transfers);
+
+  void swapStagesWithSmoothed();
+
+public:
+  PipelineGraphGroup(Ptr<Options> options, Ptr<IMPIWrapper> mpi);
+
+  void setScheduler(Ptr<Scheduler> scheduler) override;
+
+  void update(Ptr<data::Batch> batch) override;
+
+  void load() override;
+  void save(bool isFinal = false) override;
+
+  Ptr<data::BatchStats> collectStats(const std::vector<Ptr<Vocab>>& /*vocabs*/) override {
+    ABORT("--pipeline-parallel does not support --mini-batch-fit");
+  }
+};
+
+}  // namespace marian
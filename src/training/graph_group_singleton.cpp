@@ -6,6 +6,7 @@ void SingletonGraph::setScheduler(Ptr<Scheduler> scheduler) {
   scheduler_ = scheduler;
   // optimizer has to be registered last to see changes of learning rate
   scheduler_->registerTrainingObserver(scheduler_);
+  registerModelObservers();
   for(auto opt : optimizerShards_)
     scheduler_->registerTrainingObserver(opt);
 }
@@ -35,6 +36,7 @@ void SingletonGraph::execute(Ptr<data::Batch> batch) {
       GraphGroup::decreaseCostScaleFactor();
   }
 
+  opt->setParameterLayout(graph->params(), 0);
   if(noNanOrInf) // skip update if NaN was seen @TODO: repeat instead with smaller factor?
     opt->update(graph->params()->vals(),
                 graph->params()->grads(),
@@ -1,17 +1,24 @@
 #include "training/graph_group_sync.h"
 
+#include <algorithm>
 #include <math.h>
 
 namespace marian {
 
 SyncGraphGroup::SyncGraphGroup(Ptr<Options> options, Ptr<IMPIWrapper> mpi)
     : GraphGroup(options, mpi),
-      delay_{options_->get<double>("optimizer-delay")} {} // @TODO: rename delay_ to something else; delay means delayed updated, not accumulation
+      delay_{options_->get<double>("optimizer-delay")}, // @TODO: rename delay_ to something else; delay means delayed updated, not accumulation
+      delayWords_{options_->get<size_t>("optimizer-delay-words", 0)},
+      benchmark_{options_->get<bool>("benchmark", false)},
+      benchmarkWarmup_{std::max<size_t>(1, options_->get<size_t>("benchmark-warmup", 1))} {} // the first update also initializes
 
 void SyncGraphGroup::setScheduler(Ptr<Scheduler> scheduler) /*override*/ {
   validate();
   scheduler_ = scheduler;
+  ABORT_IF(delayWords_ > 0 && scheduler_->isDynamicMBSizeScaling(),
+           "--optimizer-delay-words does not support --mini-batch-warmup or --mini-batch-track-lr");
   scheduler_->registerTrainingObserver(scheduler_);
+  registerModelObservers();
 
   // optimizer has to be registered last to see changes of learning rate
   for(auto opt : optimizerShards_)
@@ -21,11 +28,12 @@ void SyncGraphGroup::setScheduler(Ptr<Scheduler> scheduler) /*override*/ {
 void SyncGraphGroup::initialize(const Ptr<data::Batch>& exampleBatch) {
   // Initialize graphs with random weights in one forward step
   // Also allocate and clear the gradients
-  comm_->foreach([&](size_t i, size_t /*begin*/, size_t /*end*/) {
+  comm_->foreach([&](size_t i, size_t begin, size_t /*end*/) {
     models_[i]->build(graphs_[i], exampleBatch);
     graphs_[i]->forward();
     graphs_[i]->params()->allocateBackward();
     graphs_[i]->params()->set_zero_adjoint();
+    optimizerShards_[i]->setParameterLayout(graphs_[i]->params(), begin);
     return true; // dummy success
   });
 
@@ -43,6 +51,10 @@ void SyncGraphGroup::initialize(const Ptr<data::Batch>& exampleBatch) {
     });
   }
 
+  if(!options_->get<std::string>("prune-pattern", "").empty())
+    for(size_t idx = 0; idx < graphs_.size(); idx++)
+      pruners_.push_back(New<ModelPruner>(options_));
+
   // We compute the readerMultiplier in collectStats(...) and the updateMultiplier_ here
   // as collectStats maybe called for a different instance of this object and fields would not
   // survive destruction.
@@ -112,6 +124,26 @@ bool SyncGraphGroup::tryGetSubBatches(Ptr<data::Batch> newBatch,
 
   size_t warpSize = devices_.size() /** mpi_->numMPIProcesses()*/; // warp := set of batches processed concurrently across GPUs and workers
 
+  // --optimizer-delay-words: collect the batches of the reader, split over the GPUs as they may be too large for one,
+  // until they reach this process's share of the target labels. The update then holds between the budget and the
+  // budget plus one reader batch, and there are as many warps as it takes.
+  if(delayWords_ > 0) {
+    for(auto& subBatch : newBatch->split(warpSize))
+      pendingBatches_.push_back(subBatch);
+    pendingWords_ += newBatch->wordsTrg();
+    pendingReadBatches_++;
+
+    if(pendingWords_ < delayWords_ / mpi_->numMPIProcesses())
+      return false;
+
+    subBatches = std::move(pendingBatches_);
+    pendingBatches_.clear();
+    numReadBatches = pendingReadBatches_;
+    pendingWords_ = 0;
+    pendingReadBatches_ = 0;
+    return true;
+  }
+
   // if not dynamic then return the big batch, but first split it over GPUs as it may be too large
   if (!scheduler_->isDynamicMBSizeScaling()) {
     // If mini-batch-fit, then the read batch is (devices_.size() * mpi_->numMPIProcesses() * delay_)
@@ -188,29 +220,54 @@ bool SyncGraphGroup::tryGetSubBatches(Ptr<data::Batch> newBatch,
 
 void SyncGraphGroup::update(Ptr<data::Batch> newBatch) /*override*/ {
   validate();
+  if(!first_)
+    dataWait_ += sinceUpdate_.elapsed();
 
   std::vector<Ptr<data::Batch>> subBatches;
   size_t numReadBatches; // actual #batches delivered by reader, for restoring from checkpoint   --@TODO: reader should checkpoint itself; should not go via the scheduler
   bool gotSubBatches = tryGetSubBatches(newBatch, subBatches, numReadBatches);
   
   // not enough data yet: return right away
-  if (!gotSubBatches)
+  if (!gotSubBatches) {
+    sinceUpdate_.start();
     return;
+  }
 
   // when decoupled, put barrier here?
   barrier();
   update(subBatches, numReadBatches);
+  sinceUpdate_.start();
 }
 
 void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t numReadBatches) {
   size_t updateBatchSize = 0;
   size_t updateTargetWords = 0;
+  size_t updateSourceWords = 0;
   for (const auto& batch : subBatches) {
     updateBatchSize   += batch->size();
     updateTargetWords += batch->wordsTrg();
+    updateSourceWords += batch->words();
   }
   mpi_->allReduce(&updateTargetWords, &updateTargetWords, 1, IMPIWrapper::getDataType(&updateTargetWords), MPI_SUM);
   mpi_->allReduce(&updateBatchSize, &updateBatchSize, 1, IMPIWrapper::getDataType(&updateBatchSize), MPI_SUM);
+  if(benchmark_)
+    mpi_->allReduce(&updateSourceWords, &updateSourceWords, 1, IMPIWrapper::getDataType(&updateSourceWords), MPI_SUM);
+
+  // with --disp-timing and in the updates of --benchmark after the warm-up, the devices are synchronized after each
+  // phase of the update to time it
+  bool benchmarkTimed = benchmark_ && benchmarkSeen_ >= benchmarkWarmup_;
+  bool dispTimed = scheduler_ && scheduler_->timingSteps();
+  bool timed = benchmarkTimed || dispTimed;
+  auto synchronize = [&]() {
+    for(auto graph : graphs_)
+      graph->getBackend()->synchronize();
+  };
+  StepTimes times;
+  times.dataWait = dataWait_;
+  dataWait_ = 0;
+  std::vector<double> buildSeconds(devices_.size(), 0.);
+  std::vector<double> forwardSeconds(devices_.size(), 0.);
+  std::vector<double> backwardSeconds(devices_.size(), 0.);
 
   std::sort(subBatches.begin(), subBatches.end(),
             [](Ptr<data::Batch> a, Ptr<data::Batch> b) { return a->wordsTrg() > b->wordsTrg(); });
@@ -238,6 +295,8 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
   // Compute gradients
   // This happens in multiple steps in case of delay > 1.
   std::vector<StaticLoss> localDeviceLosses(devices_.size()); // [local device index] aggregate cost for each local device
+  size_t bucketBytes = options_->get<size_t>("gradient-bucket-mb", 0) * 1024 * 1024;
+  bool overlapReduction = bucketBytes > 0 && comm_->canReduceGradsAsync();
   comm_->foreach([&](size_t localDeviceIndex, size_t /*begin*/, size_t /*end*/) { // parallel across devices. Aggregate for warp > 1.
     auto graph = graphs_[localDeviceIndex];
     // reset gradient  --presently done outside
@@ -250,16 +309,38 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
       if (!subBatch)
         break;
 
+      timer::Timer phase;
       { // let loss go out of scope, frees memory
         auto rationalLoss = models_[localDeviceIndex]->build(graph, subBatch);
         if(costScalingFactor_ != 1.f)
           rationalLoss->loss() * costScalingFactor_;
+        if(timed) {
+          buildSeconds[localDeviceIndex] += phase.elapsed();
+          phase.start();
+        }
         graph->forward();
 
         localDeviceLosses[localDeviceIndex] += *rationalLoss;
       }
+      if(timed) {
+        graph->getBackend()->synchronize();
+        forwardSeconds[localDeviceIndex] += phase.elapsed();
+        phase.start();
+      }
 
+      // the gradients of the last sub-batch are final as the backward pass goes, so their reduction can start
+      bool overlap = overlapReduction && !getSubBatch(warp + 1, localDeviceIndex, mpi_->myMPIRank());
+      if(overlap)
+        graph->setGradientBuckets(bucketBytes, [&, localDeviceIndex](size_t begin, size_t end) {
+          comm_->reduceGradsAsync(localDeviceIndex, begin, end);
+        });
       graph->backward(/*zero=*/false); // (gradients are reset before we get here)
+      if(overlap)
+        graph->setGradientBuckets(bucketBytes, nullptr);
+      if(timed) {
+        graph->getBackend()->synchronize();
+        backwardSeconds[localDeviceIndex] += phase.elapsed();
+      }
     }
 
 #if 0 // @TODO: this can probably be removed now, keep around until confirmed.
@@ -281,8 +362,14 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
 
   // At this point, each device on each MPI process has a gradient aggregated over a subset of the sub-batches.
   // check for Nan or Inf in all summed up shards
+  timer::Timer phase;
   comm_->scatterReduceAndResetGrads(); // reduce gradients across all devices (globally) into shards
-  
+  if(timed) {
+    synchronize();
+    times.communication += phase.elapsed();
+    phase.start();
+  }
+
   float gradNorm = 0.f; 
   if(costScaling_ || dynamicGradientScaling_ || checkGradientNan_) {
     // Wrapping member function
@@ -297,11 +384,14 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
     // actual model update
 
     float gradientNormalizer = GraphGroup::computeNormalizationFactor(gradNorm, updateTargetWords);
+    // the norm of the update is only needed for display, unless its statistics scale the gradient
+    bool reportNorm = dynamicGradientScaling_ || !scheduler_ || scheduler_->displaysNextUpdate(updateTargetWords);
 
     // Update parameter shard with gradient shard
     auto update = [&](size_t i, size_t begin, size_t end) -> float {
       auto curGrad = graphs_[i]->params()->grads()->subtensor(begin, end-begin);
       auto curParam = graphs_[i]->params()->vals()->subtensor(begin, end-begin);
+      optimizerShards_[i]->setReportNorm(reportNorm);
       float l2norm = optimizerShards_[i]->update(curParam, curGrad, updateTargetWords, gradientNormalizer);
 
       // resets remaining gradient to zero
@@ -314,7 +404,16 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
     if(!options_->get<bool>("normalize-gradient"))
       gradNorm /= updateTargetWords; // normalize for logging
 
+    if(timed) {
+      synchronize();
+      times.optimizer += phase.elapsed();
+      phase.start();
+    }
     comm_->allGatherParams(); // distribute param value shards back
+    if(timed) {
+      synchronize();
+      times.communication += phase.elapsed();
+    }
 
     // Re-add the error residual from previous quantization,
     // then re-quantize the model back and update the error residual
@@ -323,6 +422,14 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
         quantizers_[idx]->quantize(graphs_[idx]); return true; 
       });
 
+    // zero the pruned weights again, all graphs compute the same masks from the same parameters
+    if(!pruners_.empty()) {
+      size_t updates = scheduler_ ? scheduler_->numberOfUpdates() + 1 : 0;
+      comm_->foreach([&](size_t idx, size_t /*begin*/, size_t /*end*/) {
+        pruners_[idx]->prune(graphs_[idx], updates); return true;
+      });
+    }
+
   } else {
     LOG(debug, "Seen NaN in gradient, skipping update, resetting gradient");
 
@@ -341,6 +448,14 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
   // cost across all local devices (scheduler will aggregate cross-process)
   StaticLoss localLoss = std::accumulate(localDeviceLosses.begin(), localDeviceLosses.end(), StaticLoss());
 
+  if(timed) {
+    times.build = *std::max_element(buildSeconds.begin(), buildSeconds.end());
+    times.forward = *std::max_element(forwardSeconds.begin(), forwardSeconds.end());
+    times.backward = *std::max_element(backwardSeconds.begin(), backwardSeconds.end());
+    if(dispTimed)
+      scheduler_->addStepTimes(times); // before update() displays them
+  }
+
   if(scheduler_) {
     // track and log localLoss
     scheduler_->update(localLoss, numReadBatches, updateBatchSize, updateTargetWords, gradNorm);
@@ -357,9 +472,17 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
     // process valid data set
     // This may save a model as well.
     if(scheduler_->validating()) {
+      phase.start();
       swapWithSmoothed();
       scheduler_->validate(graphs_);
       swapWithSmoothed();
+      if(timed) {
+        StepTimes validation;
+        validation.validation = phase.elapsed();
+        times += validation;
+        if(dispTimed)
+          scheduler_->addStepTimes(validation);
+      }
     }
 
     if(scheduler_->replacingWithSmoothed()) {
@@ -369,10 +492,53 @@ void SyncGraphGroup::update(std::vector<Ptr<data::Batch>> subBatches, size_t num
 
   if(saneGradient)
     GraphGroup::increaseCostScaleFactor();
+
+  if(benchmarkTimed) {
+    benchmarkTimes_.updates++;
+    benchmarkTimes_.srcWords += updateSourceWords;
+    benchmarkTimes_.trgWords += updateTargetWords;
+    benchmarkTimes_.phases += times;
+  } else if(benchmark_ && ++benchmarkSeen_ == benchmarkWarmup_) {
+    synchronize();
+    benchmarkTimes_.total.start();
+  }
+}
+
+void SyncGraphGroup::logBenchmark() {
+  const auto& times = benchmarkTimes_;
+  if(times.updates == 0) {
+    LOG(warn, "[benchmark] Training ended within the {} warm-up updates, nothing was measured", benchmarkWarmup_);
+    return;
+  }
+
+  double seconds = times.total.elapsed();
+  LOG(info, "[benchmark] {} updates after {} warm-up updates in {:.2f}s: {:.2f} updates/s, {} source words/s, {} target words/s",
+      times.updates, benchmarkWarmup_, seconds, times.updates / seconds,
+      utils::withCommas((size_t)(times.srcWords / seconds)), utils::withCommas((size_t)(times.trgWords / seconds)));
+
+  const auto& phases = times.phases;
+  double ms = 1000. / times.updates;
+  LOG(info, "[benchmark] Per update: data {:.2f}ms, build {:.2f}ms, forward {:.2f}ms, backward {:.2f}ms, "
+      "communication {:.2f}ms, optimizer {:.2f}ms, other {:.2f}ms", phases.dataWait * ms, phases.build * ms,
+      phases.forward * ms, phases.backward * ms, phases.communication * ms, phases.optimizer * ms,
+      std::max(0., seconds - phases.total()) * ms);
+  LOG(info, "[benchmark] Time spent in {}", phases.toPercentages(seconds));
+
+  const float MB = 1024.f * 1024.f;
+  for(auto graph : graphs_) {
+    auto params = graph->params();
+    size_t paramBytes = params->vals()->size() * sizeOf(params->vals()->type());
+    size_t gradBytes = params->grads()->size() * sizeOf(params->grads()->type());
+    auto workspace = graph->allocator()->statistics();
+    LOG(info, "[benchmark] Memory of {}: workspace peak {:.1f} MB of {:.1f} MB reserved, parameters {:.1f} MB, gradients {:.1f} MB",
+        (std::string)graph->getDeviceId(), workspace.peak / MB, workspace.reserved / MB, paramBytes / MB, gradBytes / MB);
+  }
 }
 
 void SyncGraphGroup::finalize() /*override*/ {
   validate();
+  if(benchmark_)
+    logBenchmark();
   Base::finalize();
 }
 
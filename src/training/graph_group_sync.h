@@ -1,5 +1,6 @@
 #pragma once
 
+#include "optimizers/pruner.h"
 #include "optimizers/quantizer.h"
 #include "training/graph_group.h"
 
@@ -8,17 +9,42 @@ namespace marian {
 class SyncGraphGroup : public GraphGroup {
   using Base = GraphGroup;
   const double delay_{1.}; // optimizer-delay parameter. Fractional means to use a fraction of whatever the MB size is
+  const size_t delayWords_{0}; // optimizer-delay-words parameter, the target labels of an update of all processes
 
   // @TODO: instead, create an array of ExponentialSmoothing objects, and don't use ExponentialSmoothing as a base class
   std::vector<Ptr<TensorAllocator>> paramsAllocs_; // [deviceIndex] we must hold a reference to the memory until this class dies
 
   // model quantizer
   std::vector<Ptr<ModelQuantizer>> quantizers_;
+
+  // model pruner, see --prune-pattern
+  std::vector<Ptr<ModelPruner>> pruners_;
   
   // state for update()
   bool first_{ true };                           // gets interpreted and cleared by update()
   std::vector<Ptr<data::Batch>> pendingBatches_; // in case of dynamic MB-size scaling, we temporarly buffer up batches across update() calls until enough
   double updateMultiplier_{1};                  // multiplier not applied in collectStats() (no multiplier if not mini-batch-fit)
+  size_t pendingWords_{0};                       // with --optimizer-delay-words, the target labels of pendingBatches_
+  size_t pendingReadBatches_{0};                 // ... and the number of batches of the reader they came from
+
+  // the time between the end of an update and the next call of update(), for StepTimes::dataWait
+  timer::Timer sinceUpdate_;
+  double dataWait_{0};
+
+  // --benchmark: the updates after --benchmark-warmup, with the seconds of their phases. Reported by logBenchmark()
+  // in finalize().
+  struct BenchmarkTimes {
+    size_t updates{0};
+    size_t srcWords{0};
+    size_t trgWords{0};
+    StepTimes phases;
+    timer::Timer total; // started at the end of the warm-up
+  };
+  bool benchmark_{false};
+  size_t benchmarkWarmup_{0};
+  size_t benchmarkSeen_{0};
+  BenchmarkTimes benchmarkTimes_;
+  void logBenchmark();
 
   void initialize(const Ptr<data::Batch>& exampleBatch);
 
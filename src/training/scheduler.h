@@ -7,6 +7,9 @@
 #include "training/communicator.h"
 #include "layers/loss.h"
 
+#include <chrono>
+#include <future>
+
 namespace marian {
 
 /**
@@ -21,6 +24,42 @@ public:
     {}
 };
 
+/**
+ * Seconds spent in the phases of training updates, see --disp-timing and --benchmark. The devices run the build,
+ * forward and backward phases in parallel, an update adds the time of the slowest one.
+ */
+struct StepTimes {
+  double dataWait{0};      // waiting for the next batch from the batch generator
+  double build{0};         // building the expression graphs
+  double forward{0};
+  double backward{0};
+  double communication{0}; // reducing the gradients and gathering the parameters
+  double optimizer{0};
+  double validation{0};
+
+  double total() const { return dataWait + build + forward + backward + communication + optimizer + validation; }
+
+  StepTimes& operator+=(const StepTimes& other) {
+    dataWait      += other.dataWait;
+    build         += other.build;
+    forward       += other.forward;
+    backward      += other.backward;
+    communication += other.communication;
+    optimizer     += other.optimizer;
+    validation    += other.validation;
+    return *this;
+  }
+
+  // the phases in percent of seconds, the rest of which is reported as other
+  std::string toPercentages(double seconds) const {
+    auto percent = [=](double t) { return seconds > 0 ? 100. * t / seconds : 0.; };
+    return fmt::format("data {:.1f}% : build {:.1f}% : forward {:.1f}% : backward {:.1f}% : communication {:.1f}% : "
+                       "optimizer {:.1f}% : validation {:.1f}% : other {:.1f}%",
+                       percent(dataWait), percent(build), percent(forward), percent(backward), percent(communication),
+                       percent(optimizer), percent(validation), std::max(0., percent(seconds - total())));
+  }
+};
+
 class Scheduler : public TrainingObserver {
 private:
   Ptr<Options> options_;
@@ -28,6 +67,14 @@ private:
   std::vector<Ptr<ValidatorBase>> validators_;
   Ptr<IMPIWrapper> mpi_;
 
+  // --valid-async: the validators run on a copy of the parameters in validGraph_ on a thread of their own
+  Ptr<ExpressionGraph> validGraph_;
+  UPtr<ThreadPool> validThread_;
+  std::future<std::vector<float>> asyncValidation_;
+  std::string asyncEpoch_;  // logical epoch and update of the parameters of asyncValidation_
+  size_t asyncBatches_{0};
+  size_t asyncStalled_{0};  // stalled() before asyncValidation_
+
   bool first_{true};                  // true if this is the first update after renewing the training
 
   bool throwOnDivergence_{false};   // throw an exception if training divergence is detected
@@ -43,6 +90,9 @@ private:
   timer::Timer timer_;
   timer::Timer heartBeatTimer_;
 
+  bool dispTiming_{false};  // --disp-timing
+  StepTimes stepTimes_;     // since the last display
+
   // The variable helps to keep track of the end of the current epoch
   // (regardless if it's the 1st or nth epoch and if it's a new or continued training),
   // which indicates the end of the training data stream from STDIN
@@ -153,7 +203,8 @@ private:
 public:
   Scheduler(Ptr<Options> options, Ptr<TrainingState> state, Ptr<IMPIWrapper> mpi = nullptr)
       : options_(options), state_(state), mpi_(mpi),
-        gradientNormAvgWindow_(options_->get<size_t>("gradient-norm-average-window", 100)) {
+        gradientNormAvgWindow_(options_->get<size_t>("gradient-norm-average-window", 100)),
+        dispTiming_(options_->get<bool>("disp-timing", false)) {
 
     auto throwParameters = options_->get<std::vector<std::string>>("throw-on-divergence");
     if(!throwParameters.empty()) {
@@ -196,6 +247,14 @@ public:
 
     ABORT_IF(state_->factor != 1, "state.factor unexpectedly not 1 at this point??");
     updateLearningRate(*state);
+
+    ABORT_IF(options_->get<bool>("valid-async", false) && mpi_ && mpi_->numMPIProcesses() > 1,
+             "--valid-async is not supported with several MPI processes");
+  }
+
+  ~Scheduler() {
+    if(asyncValidation_.valid())
+      asyncValidation_.wait();
   }
 
   // test if any parameters specify dynamic MB scaling
@@ -246,6 +305,9 @@ public:
     return std::make_tuple(gradientNormAvgWindow_, state_->logGradientNormAvg, state_->logGradientNormVar);
   }
 
+  // number of updates before the current one
+  size_t numberOfUpdates() const { return state_->batches; }
+
   bool keepGoing() {
     if(saveAndExitRequested()) // via SIGTERM
       return false;
@@ -303,6 +365,11 @@ public:
       LOG(info, "Training finished");
   }
 
+  // Whether the graph group should time the phases of the updates and add them with addStepTimes(), see --disp-timing
+  bool timingSteps() const { return dispTiming_; }
+
+  void addStepTimes(const StepTimes& times) { stepTimes_ += times; }
+
   void addValidator(Ptr<ValidatorBase> validator) {
     validators_.push_back(validator);
 
@@ -321,6 +388,15 @@ public:
             && keepGoing());
   }
 
+  // whether update() displays the next update of batchLabels target labels, before it is called
+  bool displaysNextUpdate(size_t batchLabels) const {
+    auto dispFreq = SchedulingParameter::parse(options_->get<std::string>("disp-freq"));
+    size_t progress = state_->getProgressIn(dispFreq.unit);
+    size_t next = progress + (dispFreq.unit == SchedulingUnit::trgLabels ? batchLabels : 1);
+    return state_->batches + 1 <= options_->get<size_t>("disp-first")
+           || (dispFreq && next / dispFreq.n != progress / dispFreq.n);
+  }
+
   bool saving() {
     return state_->enteredNewPeriodOf(options_->get<std::string>("save-freq"));
   }
@@ -346,6 +422,15 @@ public:
        || (!state_->enteredNewPeriodOf(options_->get<std::string>("valid-freq")) && !isFinal)) // not now
       return;
 
+    // The final validation waits for a background one and then runs on the training graphs like all others
+    // without --valid-async.
+    if(options_->get<bool>("valid-async", false) && !isFinal) {
+      validateAsync(graphs[0]);
+      state_->validated = true;
+      return;
+    }
+    finishAsyncValidation(/*wait=*/true);
+
     size_t stalledPrev = stalled();
     for(auto validator : validators_) {
       if(!validator)
@@ -357,22 +442,7 @@ public:
         // Validators might modify random state etc., maybe we should run validators
         // everywhere, but not report and not save on the other processes.
         value = validator->validate(graphs, state_);
-        if(validator->stalled() > 0) {
-          LOG_VALID(info,
-                    "Ep. {} : Up. {} : {} : {} : stalled {} times (last best: {})",
-                    formatLogicalEpoch(),
-                    state_->batches,
-                    validator->type(),
-                    value,
-                    validator->stalled(), validator->lastBest());
-        } else {
-          LOG_VALID(info,
-                    "Ep. {} : Up. {} : {} : {} : new best",
-                    formatLogicalEpoch(),
-                    state_->batches,
-                    validator->type(),
-                    value);
-        }
+        logValidation(validator, value, formatLogicalEpoch(), state_->batches);
       }
 
       if(mpi_) {
@@ -396,6 +466,87 @@ public:
     state_->validated = true;
   }
 
+  void logValidation(Ptr<ValidatorBase> validator, float value, const std::string& epoch, size_t batches) {
+    if(validator->stalled() > 0) {
+      LOG_VALID(info,
+                "Ep. {} : Up. {} : {} : {} : stalled {} times (last best: {})",
+                epoch,
+                batches,
+                validator->type(),
+                value,
+                validator->stalled(), validator->lastBest());
+    } else {
+      LOG_VALID(info,
+                "Ep. {} : Up. {} : {} : {} : new best",
+                epoch,
+                batches,
+                validator->type(),
+                value);
+    }
+  }
+
+  /* Copies the current parameters of graph, which are the smoothed ones during validation, into the background
+   * graph of --valid-async and runs the validators on it on a thread of their own while training continues. The
+   * background graph is created on the first call on --valid-async-device. A background validation that is still
+   * running is waited for first, so none is skipped.
+   */
+  void validateAsync(Ptr<ExpressionGraph> graph) {
+    finishAsyncValidation(/*wait=*/true);
+
+    if(!validGraph_) {
+      auto deviceStr = options_->get<std::string>("valid-async-device", "");
+      DeviceId device = graph->getDeviceId();
+      if(deviceStr == "cpu")
+        device = DeviceId(0, DeviceType::cpu);
+      else if(!deviceStr.empty())
+        device = DeviceId(std::stoul(deviceStr), DeviceType::gpu);
+
+      validGraph_ = New<ExpressionGraph>();
+      validGraph_->setDefaultElementType(graph->getDefaultElementType());
+      validGraph_->setDevice(device);
+      validGraph_->reserveWorkspaceMB(options_->get<size_t>("valid-async-workspace", 512));
+      validGraph_->copyParams(graph);
+      validThread_.reset(new ThreadPool(1));
+      LOG(info, "[valid] Validating in the background on {}", device);
+    } else {
+      for(auto p : *graph->params())
+        validGraph_->get(p->name())->val()->copyFrom(p->val());
+    }
+
+    asyncEpoch_ = formatLogicalEpoch();
+    asyncBatches_ = state_->batches;
+    asyncStalled_ = stalled();
+    auto state = New<TrainingState>(*state_); // for the file name templates of the validators
+    asyncValidation_ = validThread_->enqueue([this, state]() {
+      std::vector<float> values;
+      for(auto validator : validators_)
+        values.push_back(validator ? validator->validate({validGraph_}, state) : 0.f);
+      return values;
+    });
+  }
+
+  // Reports the results of the background validation once it has finished, or after waiting for it
+  void finishAsyncValidation(bool wait) {
+    if(!asyncValidation_.valid())
+      return;
+    if(!wait && asyncValidation_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      return;
+
+    auto values = asyncValidation_.get();
+    for(size_t i = 0; i < validators_.size(); ++i) {
+      auto validator = validators_[i];
+      if(!validator)
+        continue;
+      logValidation(validator, values[i], asyncEpoch_, asyncBatches_);
+      state_->validators[validator->type()]["last-best"] = validator->lastBest();
+      state_->validators[validator->type()]["stalled"]   = validator->stalled();
+    }
+
+    size_t stalledNew = stalled();
+    if(stalledNew > asyncStalled_)
+      state_->newStalled(stalledNew);
+  }
+
   // Returns the proper number of stalled validation w.r.t. early-stopping-on
   size_t stalled() {
     std::string stopOn = options_->get<std::string>("early-stopping-on");
@@ -447,6 +598,7 @@ public:
     state_->rememberPreviousProgress();  // note: epoch increases happen at the wrong place, hence
                                          // -freq parameters do not support epoch units
     state_->validated = false;
+    finishAsyncValidation(/*wait=*/false);
 
     // collect costs from all nodes if training with MPI
     if(mpi_) {
@@ -576,8 +728,11 @@ public:
               state_->wordsDisp / timer_.elapsed(),
               state_->gradientNormAvg);
         }
+        if(dispTiming_)
+          LOG(info, "Time spent in {}", stepTimes_.toPercentages(timer_.elapsed()));
       }
       timer_.start();
+      stepTimes_ = StepTimes();
       state_->costSum      = 0;
       state_->costCount    = 0;
 
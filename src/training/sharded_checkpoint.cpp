@@ -0,0 +1,93 @@
+#include "training/sharded_checkpoint.h"
+#include "common/file_stream.h"
+#include "common/filesystem.h"
+
+#include "3rd_party/yaml-cpp/yaml.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace marian {
+
+std::string ShardedCheckpoint::manifestFileName(const std::string& modelFileName) {
+  return modelFileName + ".optimizer.manifest.yml";
+}
+
+std::string ShardedCheckpoint::partFileName(const std::string& modelFileName, size_t part) {
+  return modelFileName + ".optimizer.part" + std::to_string(part) + ".npz";
+}
+
+const ShardedCheckpoint::Item* ShardedCheckpoint::find(const std::string& name) const {
+  for(const auto& item : items)
+    if(item.name == name)
+      return &item;
+  return nullptr;
+}
+
+void ShardedCheckpoint::save(const std::string& modelFileName) const {
+  YAML::Node config;
+  config["parts"] = parts;
+  for(const auto& item : items) {
+    std::stringstream type;
+    type << item.type;
+
+    YAML::Node node;
+    node["name"] = item.name;
+    node["type"] = type.str();
+    node["bytes"] = item.bytes;
+    node["sliced"] = item.sliced;
+    config["items"].push_back(node);
+  }
+
+  std::ofstream fout(manifestFileName(modelFileName));
+  fout << config;
+}
+
+bool ShardedCheckpoint::load(const std::string& modelFileName) {
+  auto fileName = manifestFileName(modelFileName);
+  if(!filesystem::exists(fileName))
+    return false;
+
+  YAML::Node config = YAML::Load(io::InputFileStream(fileName).readToString());
+  parts = config["parts"].as<size_t>();
+  items.clear();
+  for(const auto& node : config["items"])
+    items.push_back({node["name"].as<std::string>(),
+                     typeFromString(node["type"].as<std::string>()),
+                     node["bytes"].as<size_t>(),
+                     node["sliced"].as<bool>()});
+  return true;
+}
+
+std::vector<io::Item> ShardedCheckpoint::consolidate(const std::string& modelFileName) const {
+  std::vector<io::Item> whole(items.size());
+  for(size_t part = 0; part < parts; ++part) {
+    auto partFile = partFileName(modelFileName, part);
+    ABORT_IF(!filesystem::exists(partFile), "Part {} of {} of the sharded checkpoint is missing: {}", part, parts, partFile);
+    io::ModelWeights weights(partFile, io::MmapMode::DontMmap);
+    const auto& partItems = weights.items();
+
+    for(size_t i = 0; i < items.size(); ++i) {
+      const auto& item = items[i];
+      auto found = std::find_if(partItems.begin(), partItems.end(),
+        [&](const io::Item& partItem) { return partItem.name == item.name; });
+      ABORT_IF(found == partItems.end(), "Item {} is missing from {}", item.name, partFile);
+      ABORT_IF(found->type != item.type, "Item {} in {} has type {}, not {}", item.name, partFile, found->type, item.type);
+
+      if(part == 0)
+        whole[i] = *found;
+      else if(item.sliced)
+        whole[i].append(*found);
+    }
+  }
+
+  for(size_t i = 0; i < items.size(); ++i) {
+    size_t bytes = whole[i].shape.elements() * sizeOf(whole[i].type);
+    ABORT_IF(bytes != items[i].bytes, "The parts of item {} have {} bytes, the manifest lists {}",
+             items[i].name, bytes, items[i].bytes);
+  }
+  return whole;
+}
+
+}  // namespace marian
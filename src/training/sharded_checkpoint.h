@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/io.h"
+
+#include <string>
+#include <vector>
+
+namespace marian {
+
+/**
+ * The manifest of a training checkpoint written with --sharded-checkpoints. Instead of the single file
+ * <model>.optimizer.npz that the main process gathers over the network, each MPI process writes the optimizer
+ * state of its own devices to <model>.optimizer.part<k>.npz and reads it back from there. The main process writes
+ * this manifest to <model>.optimizer.manifest.yml, with the number of parts and, for each item, whether the parts
+ * hold consecutive slices of it or full copies of it.
+ *
+ * consolidate() reassembles the items of a regular <model>.optimizer.npz from the parts, e.g. to continue training
+ * with a different number of processes, see marian-conv --consolidate-checkpoint.
+ */
+struct ShardedCheckpoint {
+  struct Item {
+    std::string name;
+    Type type;
+    size_t bytes;  // of the whole item, over all parts if sliced
+    bool sliced;   // each part holds a slice, in the order of the parts, otherwise each holds all of it
+  };
+
+  size_t parts{1};
+  std::vector<Item> items;
+
+  static std::string manifestFileName(const std::string& modelFileName);
+  static std::string partFileName(const std::string& modelFileName, size_t part);
+
+  const Item* find(const std::string& name) const;
+
+  void save(const std::string& modelFileName) const;
+  // returns false if there is no manifest for this model
+  bool load(const std::string& modelFileName);
+
+  // reads all parts of a loaded manifest and returns the items of the whole checkpoint
+  std::vector<io::Item> consolidate(const std::string& modelFileName) const;
+};
+
+}  // namespace marian
@@ -3,9 +3,13 @@
 #include "common/config.h"
 #include "common/utils.h"
 #include "data/batch_generator.h"
+#include "data/corpus_binary.h"
+#include "data/corpus_mixture.h"
 #ifndef _MSC_VER // @TODO: include SqLite in Visual Studio project
 #include "data/corpus_sqlite.h"
 #endif
+#include "data/corpus_feed.h"
+#include "data/corpus_synthetic.h"
 #include "models/model_task.h"
 #include "training/scheduler.h"
 #include "training/validator.h"
@@ -16,11 +20,16 @@ template <class ModelWrapper>
 class Train : public ModelTask {
 private:
   Ptr<Options> options_;
+  Ptr<data::SentenceFeed> feed_; // the training data of --train-feed
   void installCustomSignalHandlers();
+  void keepEffectiveBatch(Ptr<IMPIWrapper> mpi, size_t numDevices);
 
 public:
   Train(Ptr<Options> options) : options_(options) {}
 
+  // Sets the source of the training sentences of --train-feed, call before run()
+  void setFeed(Ptr<data::SentenceFeed> feed) { feed_ = feed; }
+
   void run() override {
     using namespace data;
 
@@ -32,16 +41,52 @@ public:
       LOG(info, "Synced seed {}", Config::seed);
     }
 
-    Ptr<CorpusBase> dataset;
     auto corpusSeed = Config::seed + (mpi ? mpi->myMPIRank() : 0); // @BUGBUG: no correct resume right now
-    if(!options_->get<std::string>("sqlite").empty())
+    // --benchmark trains on synthetic data for one epoch of it by default, without loading, validating or saving models
+    bool benchmark = options_->get<bool>("benchmark", false);
+    if(benchmark) {
+      if(options_->get<std::string>("after") == "0e")
+        options_->set("after", std::string("1e"));
+      options_->set("no-reload", true, "save-freq", std::string("0u"));
+    }
+
+    auto createDataset = [&]() -> Ptr<CorpusBase> {
+      if(benchmark)
+        return New<CorpusSynthetic>(options_, corpusSeed);
+      else if(options_->get<bool>("train-feed", false)) {
+        ABORT_IF(!feed_, "--train-feed needs the training data, e.g. Trainer.train(data) of pymarian");
+        return New<CorpusFeed>(feed_, options_, corpusSeed);
+      } else if(!options_->get<std::string>("sqlite").empty())
 #ifndef _MSC_VER // @TODO: include SqLite in Visual Studio project
-      dataset = New<CorpusSQLite>(options_, /*translate=*/false, corpusSeed);
+        return New<CorpusSQLite>(options_, /*translate=*/false, corpusSeed);
 #else
-      ABORT("SqLite presently not supported on Windows");
+        ABORT("SqLite presently not supported on Windows");
 #endif
-    else
-      dataset = New<Corpus>(options_, /*translate=*/false, corpusSeed);
+      else if(!options_->get<std::string>("binary-corpus", "").empty())
+        return New<CorpusBinary>(options_, /*translate=*/false, corpusSeed);
+      else if(!options_->get<std::vector<std::string>>("train-mixture", {}).empty())
+        return New<CorpusMixture>(options_, /*translate=*/false, corpusSeed);
+      else
+        return New<Corpus>(options_, /*translate=*/false, corpusSeed);
+    };
+
+    // With several processes, the main process creates missing vocabularies and a persistent corpus first, so that
+    // the others read them instead of writing the same files at the same time
+    Ptr<CorpusBase> dataset;
+    bool multiProcess = mpi && mpi->numMPIProcesses() > 1;
+    if(!multiProcess || mpi->isMainProcess())
+      dataset = createDataset();
+    if(multiProcess) {
+      mpi->barrier();
+      if(!mpi->isMainProcess())
+        dataset = createDataset();
+    }
+
+    bool shardData = multiProcess && options_->get<bool>("shard-data", false);
+    if(shardData) {
+      LOG(info, "[data] Reading shard {} of {} of the training data", mpi->myMPIRank(), mpi->numMPIProcesses());
+      dataset->setShard(mpi->myMPIRank(), mpi->numMPIProcesses());
+    }
 
     dataset->prepare();
 
@@ -63,6 +108,10 @@ public:
         // for example, when fp16 training diverges and it is restarted with fp32
         restartTraining = false;
 
+        size_t numDevices = Config::getDevices(options_, mpi->myMPIRank(), mpi->numMPIProcesses()).size() * mpi->numMPIProcesses();
+        if(options_->get<bool>("elastic-restart", false))
+          keepEffectiveBatch(mpi, numDevices);
+
         Ptr<BatchStats> stats;
         if(options_->get<bool>("mini-batch-fit")) {
           LOG(info,
@@ -78,14 +127,26 @@ public:
           auto tempScheduler = New<Scheduler>(options_, tempTrainState, mpi);
 
           model->setScheduler(tempScheduler); // collectStats() needs to know about dynamic MB scaling
-          stats = model->collectStats(dataset->getVocabs());
+          if(!shardData) {
+            stats = model->collectStats(dataset->getVocabs());
+          } else {
+            // the processes read batches of the same sizes from their shards, the main process measures them for all
+            std::vector<size_t> flattened;
+            if(mpi->isMainProcess())
+              flattened = model->collectStats(dataset->getVocabs())->flatten();
+            size_t size = flattened.size();
+            mpi->bCast(&size, 1, IMPIWrapper::getDataType(&size));
+            flattened.resize(size);
+            mpi->bCast(flattened.data(), size, IMPIWrapper::getDataType(flattened.data()));
+            stats = New<BatchStats>(flattened);
+          }
           LOG(info, "[batching] Done. Typical MB size is {} target words", utils::withCommas(stats->estimateTypicalTrgWords()));
         }
 
         auto trainState = New<TrainingState>(options_->get<float>("learn-rate"));
         auto scheduler = New<Scheduler>(options_, trainState, mpi);
 
-        if((options_->hasAndNotEmpty("valid-sets") || options_->hasAndNotEmpty("valid-script-path"))
+        if(!benchmark && (options_->hasAndNotEmpty("valid-sets") || options_->hasAndNotEmpty("valid-script-path"))
           && SchedulingParameter::parse(options_->get<std::string>("valid-freq"))) {
           for(auto validator : Validators(dataset->getVocabs(), options_))
             scheduler->addValidator(validator);
@@ -99,6 +160,9 @@ public:
         model->setScheduler(scheduler);
         model->setTypicalTrgBatchWords(batchGenerator->estimateTypicalTrgBatchWords()); // needed for dynamic MB scaling
         model->load();
+        // recorded in the checkpoints, after load() replaced the training state
+        trainState->devices = numDevices;
+        trainState->optimizerDelay = options_->get<double>("optimizer-delay");
 
         bool restored = !options_->get<bool>("no-restore-corpus")
                         && batchGenerator->restore(trainState);
@@ -128,7 +192,7 @@ public:
         model->finalize(); // allow async to sync before final save   --@TODO: rename, or move into save()
 
         // Avoid saving the model twice if it has been loaded and training did not progress
-        if(!trainState->loaded)
+        if(!trainState->loaded && !benchmark)
           model->save(true);
 
         // Signal success to a potential MPI runner
@@ -167,6 +231,35 @@ public:
   }
 };
 
+// With --elastic-restart, training that continues from a checkpoint on a different number of devices keeps the
+// effective batch size of the checkpoint, i.e. the number of devices times --optimizer-delay. The budget of
+// --optimizer-delay-words does not depend on the number of devices.
+template <class ModelWrapper>
+void Train<ModelWrapper>::keepEffectiveBatch(Ptr<IMPIWrapper> mpi, size_t numDevices) {
+  if(options_->get<bool>("no-reload") || options_->get<size_t>("optimizer-delay-words", 0) > 0)
+    return;
+
+  std::string nameYaml = options_->get<std::string>("model") + ".progress.yml";
+  std::string yamlStr;
+  if(mpi->isMainProcess() && filesystem::exists(nameYaml))
+    yamlStr = io::InputFileStream(nameYaml).readToString();
+  mpi->bCast(yamlStr);
+  if(yamlStr.empty())
+    return;
+
+  TrainingState saved(options_->get<float>("learn-rate"));
+  saved.loadFromString(yamlStr);
+  if(saved.devices == 0 || saved.devices == numDevices)
+    return;
+
+  double delay = saved.optimizerDelay * saved.devices / numDevices;
+  if(!options_->get<bool>("sync-sgd")) // asynchronous SGD only accumulates whole batches
+    delay = std::max(1., std::round(delay));
+  LOG(info, "[training] Checkpoint was written with {} devices and --optimizer-delay {}, continuing with {} devices "
+      "and --optimizer-delay {}", saved.devices, saved.optimizerDelay, numDevices, delay);
+  options_->set("optimizer-delay", delay);
+}
+
 template <class ModelWrapper>
 void Train<ModelWrapper>::installCustomSignalHandlers(){
   const std::string sigTermAction = options_->get<std::string>("sigterm");
@@ -49,6 +49,9 @@ public:
   YAML::Node validators;
   // Reset optimizer parameters
   bool reset{false};
+  // The total number of devices and the --optimizer-delay of the training run, see --elastic-restart
+  size_t devices{0};
+  double optimizerDelay{1.};
 
   // Current learning rate, representing all adjustment processes and factors
   float eta;
@@ -93,6 +96,8 @@ public:
   std::string seedBatch;
   // The state of the random number generator from a corpus
   std::string seedCorpus;
+  // The number of sentences drawn and the read position of each corpus, see --train-mixture
+  std::vector<size_t> corpusPositions;
 
   // Set flag if training was resumed
   bool loaded{false};
@@ -232,6 +237,8 @@ public:
     validator = config["validator"].as<std::string>();
     validators = config["validators"];
     reset = config["reset"].as<bool>();
+    devices        = config["devices"]         ? config["devices"].as<size_t>()         : 0;
+    optimizerDelay = config["optimizer-delay"] ? config["optimizer-delay"].as<double>() : 1.;
 
     eta = config["eta"].as<float>();
     factor = config["eta-factor"].as<float>();
@@ -257,6 +264,8 @@ public:
 
     seedBatch = config["seed-batch"].as<std::string>();
     seedCorpus = config["seed-corpus"].as<std::string>();
+    corpusPositions = config["corpus-positions"] ? config["corpus-positions"].as<std::vector<size_t>>()
+                                                 : std::vector<size_t>();
   }
 
   void load(const std::string& name) {
@@ -284,6 +293,8 @@ public:
     config["validator"] = validator;
     config["validators"] = validators;
     config["reset"] = reset;
+    config["devices"] = devices;
+    config["optimizer-delay"] = optimizerDelay;
 
     config["eta"] = eta;
     config["eta-factor"] = factor;
@@ -308,6 +319,8 @@ public:
 
     config["seed-batch"] = seedBatch;
     config["seed-corpus"] = seedCorpus;
+    if(!corpusPositions.empty())
+      config["corpus-positions"] = corpusPositions;
 
     fout << config;
   }
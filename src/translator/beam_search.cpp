@@ -1,26 +1,40 @@
+#include "common/tracing.h"
 #include "common/utils.h"
 #include "data/factored_vocab.h"
 #include "data/shortlist.h"
 #include "translator/beam_search.h"
+#include "translator/greedy_search.h"
 #include "translator/helpers.h"
 #include "translator/sampling.h"
 
+#include <unordered_set>
+
 namespace marian {
 
 // combine new expandedPathScores and previous beams into new set of beams
 Beams BeamSearch::toHyps(const std::vector<unsigned int>& nBestKeys, // [currentDimBatch, beamSize] flattened -> ((batchIdx, beamHypIdx) flattened, word idx) flattened
                          const std::vector<float>& nBestPathScores,  // [currentDimBatch, beamSize] flattened
+                         const std::vector<unsigned int>& nBestWords,   // [currentDimBatch, beamSize] flattened -> word index, mapped via the shortlist; empty if not mapped
                          const size_t nBestBeamSize, // for interpretation of nBestKeys
                          const size_t vocabSize,     // ditto.
                          const Beams& beams,
                          const std::vector<Ptr<ScorerState /*const*/>>& states,
                          Ptr<data::CorpusBatch /*const*/> batch, // for alignments only
+                         Expr2 topAlignment,
                          Ptr<FactoredVocab/*const*/> factoredVocab, size_t factorGroup,
                          const std::vector<bool>& dropBatchEntries, // [origDimBatch] - empty source batch entries are marked with true, should be cleared after first use.
                          const std::vector<IndexType>& batchIdxMap) const { // [origBatchIdx -> currentBatchIdx]
   std::vector<float> align; // collects alignment information from the last executed time step
-  if(options_->hasAndNotEmpty("alignment") && factorGroup == 0)
-    align = scorers_[0]->getAlignment(); // [beam depth * max src length * current batch size] -> P(s|t); use alignments from the first scorer, even if ensemble,
+  std::vector<float> topAlignValues;
+  std::vector<IndexType> topAlignSrcPos;
+  if(opts_.alignment && factorGroup == 0) {
+    if(get<0>(topAlignment)) { // only the top-k probabilities of every row leave the device
+      get<0>(topAlignment)->val()->get(topAlignValues); // [beam depth * k * current batch size]
+      get<1>(topAlignment)->val()->get(topAlignSrcPos);
+    } else {
+      align = scorers_[0]->getAlignment(); // [beam depth * max src length * current batch size] -> P(s|t); use alignments from the first scorer, even if ensemble,
+    }
+  }
 
   const auto origDimBatch = beams.size(); // see function search for definition of origDimBatch and currentDimBatch etc.
   Beams newBeams(origDimBatch);           // return value of this function goes here. There are always origDimBatch beams.
@@ -64,6 +78,7 @@ Beams BeamSearch::toHyps(const std::vector<unsigned int>& nBestKeys, // [current
     } else { // we are not dropping anything, just assign the normal index
       wordIdx = (WordIndex)(key % vocabSize);
     }
+    bool wordMapped = !nBestWords.empty() && !dropHyp; // the shortlist has been applied by getNBestList() already
 
     // @TODO: We currently assign a log probability of 0 to all beam entries of the dropped batch entry, instead it might be a good idea to use
     // the per Hyp pathScore without the current expansion (a bit hard to obtain).
@@ -92,7 +107,7 @@ Beams BeamSearch::toHyps(const std::vector<unsigned int>& nBestKeys, // [current
       // For factored decoding, the word is built over multiple decoding steps,
       // starting with the lemma, then adding factors one by one.
       if (factorGroup == 0) {
-        word = factoredVocab->lemma2Word(shortlist ? shortlist->reverseMap((int) prevBeamHypIdx, (int) currentBatchIdx, wordIdx) : wordIdx);
+        word = factoredVocab->lemma2Word(wordMapped ? nBestWords[i] : shortlist ? shortlist->reverseMap((int) prevBeamHypIdx, (int) currentBatchIdx, wordIdx) : wordIdx);
         std::vector<size_t> factorIndices; factoredVocab->word2factors(word, factorIndices);
         //LOG(info, "{} + {} ({}) -> {} -> {}",
         //    factoredVocab->decode(prevHyp->tracebackWords()),
@@ -112,15 +127,17 @@ Beams BeamSearch::toHyps(const std::vector<unsigned int>& nBestKeys, // [current
         prevHyp = prevHyp->getPrevHyp(); // short-circuit the backpointer, so that the traceback does not contain partially factored words
       }
     }
+    else if (wordMapped)
+      word = Word::fromWordIndex(nBestWords[i]);
     else if (shortlist)
       word = Word::fromWordIndex(shortlist->reverseMap((int) prevBeamHypIdx, (int) currentBatchIdx, wordIdx));
     else
       word = Word::fromWordIndex(wordIdx);
 
-    auto hyp = Hypothesis::New(prevHyp, word, prevBeamHypIdx, pathScore);
+    auto hyp = hypothesisPool_->New(prevHyp, word, prevBeamHypIdx, pathScore);
 
     // Set score breakdown for n-best lists
-    if(options_->get<bool>("n-best")) {
+    if(opts_.nBest) {
       auto breakDown = beam[beamHypIdx]->getScoreBreakdown();
       ABORT_IF(factoredVocab && factorGroup > 0 && !factoredVocab->canExpandFactoredWord(word, factorGroup),
                "A word without this factor snuck through to here??");
@@ -143,6 +160,8 @@ Beams BeamSearch::toHyps(const std::vector<unsigned int>& nBestKeys, // [current
     // Set alignments
     if(!align.empty())
       hyp->setAlignment(getAlignmentsForHypothesis(align, batch, (int)beamHypIdx, (int)currentBatchIdx, (int)origBatchIdx, (int)currentDimBatch));
+    else if(!topAlignValues.empty())
+      hyp->setAlignment(getTopAlignmentsForHypothesis(topAlignValues, topAlignSrcPos, get<0>(topAlignment)->shape()[-3], batch, (int)beamHypIdx, (int)currentBatchIdx, (int)origBatchIdx, (int)currentDimBatch));
     else // not first factor: just copy
       hyp->setAlignment(beam[beamHypIdx]->getAlignment());
 
@@ -221,16 +240,221 @@ std::vector<float> BeamSearch::getAlignmentsForHypothesis( // -> P(s|t) for curr
   return align;
 }
 
-// remove all beam entries that have reached EOS
-Beams BeamSearch::purgeBeams(const Beams& beams, /*in/out=*/std::vector<IndexType>& batchIdxMap) {
+std::vector<float> BeamSearch::getTopAlignmentsForHypothesis(
+    const std::vector<float>& topValues,
+    const std::vector<IndexType>& topSrcPos,
+    int k,
+    Ptr<data::CorpusBatch> batch,
+    int beamHypIdx,
+    int currentBatchIdx,
+    int origBatchIdx,
+    int currentDimBatch) const {
+  size_t origDimBatch = batch->size();
+  size_t batchWidth   = batch->width();
+
+  std::vector<float> align(batchWidth, 0.f);
+  for(int i = 0; i < k; ++i) {
+    size_t topIdx = (k * beamHypIdx + i) * currentDimBatch + currentBatchIdx; // = flatten [beam index, i, batch index, 0]
+    align[topSrcPos[topIdx]] = topValues[topIdx];
+  }
+
+  // keep the unmasked source positions as getAlignmentsForHypothesis() does
+  size_t numUnmasked = 0;
+  for(size_t srcPos = 0; srcPos < batchWidth; ++srcPos)
+    if(batch->front()->mask()[srcPos * origDimBatch + origBatchIdx] != 0)
+      align[numUnmasked++] = align[srcPos];
+  align.resize(numUnmasked);
+  return align;
+}
+
+static ConstraintState constraintStateOf(const BeamSearch::ConstraintStates& states, const Hypothesis::PtrType& hyp) {
+  auto it = states.find(hyp.get());
+  return it == states.end() ? ConstraintState() : it->second; // start hypotheses have produced nothing
+}
+
+Expr BeamSearch::gatherConstraintScores(Expr stepScores,
+                                        const Beams& beams,
+                                        const std::vector<IndexType>& batchIdxMap,
+                                        const std::vector<SentenceConstraints>& constraints,
+                                        const ConstraintStates& states,
+                                        std::vector<WordIndex>& words) const {
+  int dimBeam  = stepScores->shape()[-4]; // 1 for the first step
+  int dimBatch = stepScores->shape()[-2];
+
+  std::vector<std::vector<WordIndex>> rowWords(dimBeam * dimBatch); // [beamHypIdx * currentDimBatch + currentBatchIdx]
+  size_t numCandidates = 1;
+  for(size_t origBatchIdx = 0; origBatchIdx < beams.size(); ++origBatchIdx) {
+    const auto& beam = beams[origBatchIdx];
+    if(constraints[origBatchIdx].empty() || beam.empty())
+      continue;
+    for(size_t beamHypIdx = 0; beamHypIdx < std::min((size_t)dimBeam, beam.size()); ++beamHypIdx) {
+      auto& row = rowWords[beamHypIdx * dimBatch + batchIdxMap[origBatchIdx]];
+      constraints[origBatchIdx].nextWords(constraintStateOf(states, beam[beamHypIdx]), row);
+      numCandidates = std::max(numCandidates, row.size());
+    }
+  }
+
+  words.assign(rowWords.size() * numCandidates, (WordIndex)data::Shortlist::npos);
+  std::vector<IndexType> indices(words.size(), 0);
+  for(size_t row = 0; row < rowWords.size(); ++row) {
+    for(size_t i = 0; i < rowWords[row].size(); ++i) {
+      words[row * numCandidates + i] = rowWords[row][i];
+      indices[row * numCandidates + i] = rowWords[row][i];
+    }
+  }
+
+  auto graph = stepScores->graph();
+  Expr candidates = graph->constant({dimBeam, 1, dimBatch, (int)numCandidates}, inits::fromVector(indices), Type::uint32);
+  return gather(stepScores, /*axis=*/-1, candidates);
+}
+
+void BeamSearch::constrainNBest(std::vector<unsigned int>& nBestKeys,
+                                std::vector<float>& nBestPathScores,
+                                Expr constraintScores,
+                                const std::vector<WordIndex>& constraintWords,
+                                size_t nBestBeamSize,
+                                size_t vocabSize,
+                                const Beams& beams,
+                                const std::vector<IndexType>& batchIdxMap,
+                                const std::vector<SentenceConstraints>& constraints,
+                                const ConstraintStates& states,
+                                bool lastStep) const {
+  std::vector<float> stepScores;
+  constraintScores->val()->get(stepScores);
+  int dimBeam = constraintScores->shape()[-4];
+  int dimBatch = constraintScores->shape()[-2];
+  int numCandidates = constraintScores->shape()[-1];
+  const auto trgEosId = trgVocab_->getEosId();
+
+  std::vector<int> reverseBatchIdxMap(dimBatch, -1); // [currentBatchIdx] -> origBatchIdx
+  for(size_t origBatchIdx = 0; origBatchIdx < beams.size(); ++origBatchIdx)
+    if(!beams[origBatchIdx].empty())
+      reverseBatchIdxMap[batchIdxMap[origBatchIdx]] = (int)origBatchIdx;
+
+  struct Candidate {
+    unsigned int key;
+    float pathScore;
+    size_t bank;  // constraint words produced
+    bool blocked; // ends before its constraints are met
+  };
+  std::vector<std::vector<Candidate>> candidates(dimBatch); // [currentBatchIdx]
+  auto addCandidate = [&](size_t currentBatchIdx, size_t beamHypIdx, WordIndex wordIdx, float pathScore) {
+    size_t origBatchIdx = reverseBatchIdxMap[currentBatchIdx];
+    const auto& sentence = constraints[origBatchIdx];
+    if(pathScore == INVALID_PATH_SCORE || beamHypIdx >= beams[origBatchIdx].size())
+      return;
+    Word word = Word::fromWordIndex(wordIdx);
+    auto next = sentence.advance(constraintStateOf(states, beams[origBatchIdx][beamHypIdx]), word);
+    unsigned int key = (unsigned int)((currentBatchIdx * nBestBeamSize + beamHypIdx) * vocabSize + wordIdx);
+    candidates[currentBatchIdx].push_back({key, pathScore, sentence.progress(next),
+                                           !lastStep && word == trgEosId && !sentence.allMet(next)});
+  };
+
+  // keep the n-best lists of sentences without constraints as they are
+  std::vector<unsigned int> keys;
+  std::vector<float> pathScores;
+  for(size_t i = 0; i < nBestKeys.size(); ++i) {
+    size_t currentBatchIdx = (nBestKeys[i] / vocabSize) / nBestBeamSize;
+    if(constraints[reverseBatchIdxMap[currentBatchIdx]].empty()) {
+      keys.push_back(nBestKeys[i]);
+      pathScores.push_back(nBestPathScores[i]);
+    } else {
+      addCandidate(currentBatchIdx, (nBestKeys[i] / vocabSize) % nBestBeamSize, nBestKeys[i] % vocabSize, nBestPathScores[i]);
+    }
+  }
+  for(int beamHypIdx = 0; beamHypIdx < dimBeam; ++beamHypIdx) {
+    for(int currentBatchIdx = 0; currentBatchIdx < dimBatch; ++currentBatchIdx) {
+      int origBatchIdx = reverseBatchIdxMap[currentBatchIdx];
+      if(origBatchIdx < 0 || beamHypIdx >= (int)beams[origBatchIdx].size())
+        continue;
+      float prevPathScore = beams[origBatchIdx][beamHypIdx]->getPathScore();
+      for(int i = 0; i < numCandidates; ++i) {
+        size_t idx = (beamHypIdx * dimBatch + currentBatchIdx) * numCandidates + i;
+        if(constraintWords[idx] != (WordIndex)data::Shortlist::npos)
+          addCandidate(currentBatchIdx, beamHypIdx, constraintWords[idx], prevPathScore + stepScores[idx]);
+      }
+    }
+  }
+
+  for(size_t currentBatchIdx = 0; currentBatchIdx < candidates.size(); ++currentBatchIdx) {
+    auto& sentenceCandidates = candidates[currentBatchIdx];
+    if(sentenceCandidates.empty())
+      continue;
+    std::stable_sort(sentenceCandidates.begin(), sentenceCandidates.end(),
+                     [](const Candidate& a, const Candidate& b) { return a.pathScore > b.pathScore; });
+    // the n-best list may contain a constraint candidate as well
+    std::unordered_set<unsigned int> seen;
+    sentenceCandidates.erase(std::remove_if(sentenceCandidates.begin(), sentenceCandidates.end(),
+                                            [&](const Candidate& c) { return !seen.insert(c.key).second; }),
+                             sentenceCandidates.end());
+
+    size_t beamSize = beams[reverseBatchIdxMap[currentBatchIdx]].size();
+    size_t numBanks = constraints[reverseBatchIdxMap[currentBatchIdx]].numWords() + 1;
+    size_t bankSize = std::max(beamSize / numBanks, (size_t)1);
+    std::vector<bool> taken(sentenceCandidates.size(), false);
+    std::vector<size_t> selected;
+    auto take = [&](size_t i) {
+      taken[i] = true;
+      selected.push_back(i);
+    };
+
+    // the best of every bank, starting with the banks of hypotheses with more constraint words
+    for(size_t bank = numBanks; bank-- > 0 && selected.size() < beamSize;) {
+      size_t inBank = 0;
+      for(size_t i = 0; i < sentenceCandidates.size() && inBank < bankSize && selected.size() < beamSize; ++i) {
+        const auto& c = sentenceCandidates[i];
+        if(!c.blocked && c.bank == bank) {
+          take(i);
+          inBank++;
+        }
+      }
+    }
+    // the rest of the beam by score, blocked candidates only if nothing else is left
+    for(bool blocked : {false, true})
+      for(size_t i = 0; i < sentenceCandidates.size() && selected.size() < beamSize; ++i)
+        if(!taken[i] && sentenceCandidates[i].blocked == blocked)
+          take(i);
+
+    std::sort(selected.begin(), selected.end()); // candidates are sorted by score
+    for(auto i : selected) {
+      keys.push_back(sentenceCandidates[i].key);
+      pathScores.push_back(sentenceCandidates[i].pathScore);
+    }
+  }
+
+  nBestKeys = keys;
+  nBestPathScores = pathScores;
+}
+
+// remove all beam entries that have reached EOS, and the pruned ones
+Beams BeamSearch::purgeBeams(const Beams& beams,
+                             /*in/out=*/std::vector<IndexType>& batchIdxMap,
+                             /*in/out=*/std::vector<float>& bestFinishedScores) {
   const auto trgEosId = trgVocab_->getEosId();
   Beams newBeams;
   size_t beamIdx = 0; // beam index
   for(auto beam : beams) {
+    // hyps below the threshold are pruned, the best one of the beam is above it
+    float threshold = std::numeric_limits<float>::lowest();
+    if(opts_.prunes() && !beam.empty()) {
+      float best = std::numeric_limits<float>::lowest();
+      for(auto hyp : beam) {
+        best = std::max(best, hyp->getPathScore());
+        if(hyp->getWord() == trgEosId)
+          bestFinishedScores[beamIdx] = std::max(bestFinishedScores[beamIdx], hyp->getPathScore());
+      }
+      if(opts_.pruneRelative > 0.f)
+        threshold = std::max(best + std::log(opts_.pruneRelative), threshold);
+      if(opts_.pruneAbsolute > 0.f)
+        threshold = std::max(best - opts_.pruneAbsolute, threshold);
+      if(opts_.pruneFinished)
+        threshold = std::max(bestFinishedScores[beamIdx], threshold);
+    }
+
     Beam newBeam; // a beam of surviving hyps
     for(auto hyp : beam)
-      if(hyp->getWord() != trgEosId) // if this hyp is not finished,
-        newBeam.push_back(hyp);      // move over to beam of surviving hyps
+      if(hyp->getWord() != trgEosId && hyp->getPathScore() >= threshold) // if this hyp is not finished or pruned,
+        newBeam.push_back(hyp);                                          // move over to beam of surviving hyps
 
     if(PURGE_BATCH)
       if(newBeam.empty() && !beam.empty()) {      // previous beam had hyps, but all were finished in this step, newBeam will now stay empty
@@ -247,6 +471,13 @@ Beams BeamSearch::purgeBeams(const Beams& beams, /*in/out=*/std::vector<IndexTyp
 //**********************************************************************
 // main decoding function
 Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch) {
+  // plain greedy decoding does not need beams, n-best selection or per-step hypotheses
+  if(GreedySearch::canDecode(options_, trgVocab_)) {
+    GreedySearch greedySearch(options_, scorers_, trgVocab_);
+    greedySearch.setFinishedCallback(finishedCallback_);
+    return greedySearch.search(graph, batch);
+  }
+
   auto factoredVocab = trgVocab_->tryAs<FactoredVocab>();
   size_t numFactorGroups = factoredVocab ? factoredVocab->getNumGroups() : 1;
   if (numFactorGroups == 1) // if no factors then we didn't need this object in the first place
@@ -259,26 +490,49 @@ Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch>
 
   auto getNBestList = createGetNBestListFn(beamSize_, origDimBatch, graph->getDeviceId());
 
+  bool parallelEnsemble = std::any_of(scorers_.begin(), scorers_.end(), [](Ptr<Scorer> s) { return s->hasOwnGraph(); });
+  ABORT_IF(parallelEnsemble && factoredVocab, "--parallel-ensemble does not support factored vocabularies");
+
   for(auto scorer : scorers_) {
-    scorer->clear(graph);
+    scorer->clear(scorer->graph(graph));
   }
 
+  hypothesisPool_ = New<HypothesisPool>();
+
+  // Sentences stop early when their live hypotheses cannot reach the scores of the finished ones, which assumes that
+  // path scores only decrease. Sampling noise and negative scorer weights break that, constraints may prefer worse
+  // scoring hypotheses.
+  bool earlyStop = !options_->hasAndNotEmpty("output-sampling") && !terminology_
+                   && std::all_of(scorers_.begin(), scorers_.end(), [](Ptr<Scorer> s) { return s->getWeight() >= 0.f; });
+  size_t nBestSize = opts_.nBest ? beamSize_ : 1;
+  size_t maxLength = (size_t)std::ceil(opts_.maxLengthFactor * batch->front()->batchWidth());
+
+  // the path score of the best finished hypothesis of every sentence, for --beam-prune-finished
+  std::vector<float> bestFinishedScores(origDimBatch, std::numeric_limits<float>::lowest());
+
   Histories histories(origDimBatch);
   for(int i = 0; i < origDimBatch; ++i) {
     size_t sentId = batch->getSentenceIds()[i];
     histories[i] = New<History>(sentId,
-                                options_->get<float>("normalize"),
-                                options_->get<float>("word-penalty"));
+                                opts_.normalize,
+                                opts_.wordPenalty);
+    histories[i]->setHypothesisPool(hypothesisPool_);
   }
 
   // start states
   std::vector<Ptr<ScorerState>> states;
-  for(auto scorer : scorers_) {
-    states.push_back(scorer->startState(graph, batch));
+  {
+    // the encoder runs with the first step, except for sampled requests that time it on its own
+    tracing::Span span("encoder");
+    for(auto scorer : scorers_) {
+      states.push_back(scorer->startState(scorer->graph(graph), batch));
+    }
+    if(tracing::active())
+      graph->forward();
   }
 
   // create one beam per batch entry with sentence-start hypothesis
-  Beams beams(origDimBatch, Beam(beamSize_, Hypothesis::New())); // array [origDimBatch] of array [maxBeamSize] of Hypothesis, keeps full size through search.
+  Beams beams(origDimBatch, Beam(beamSize_, hypothesisPool_->New())); // array [origDimBatch] of array [maxBeamSize] of Hypothesis, keeps full size through search.
                                                                  // batch purging is determined from an empty sub-beam.
   std::vector<IndexType> batchIdxMap(origDimBatch); // Record at which batch entry a beam is looking.
                                                     // By default that corresponds to position in array,
@@ -296,8 +550,8 @@ Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch>
   }
 
   Expr suppressedWordIndices;
-  bool suppressUnk     = !options_->get<bool>("allow-unk", false);
-  bool suppressSpecial = !options_->get<bool>("allow-special", false);
+  bool suppressUnk     = !opts_.allowUnk;
+  bool suppressSpecial = !opts_.allowSpecial;
 
   auto shortlist = scorers_[0]->getShortlist(); // first shortlist is generally ok, @TODO: make sure they are the same across scorers?
   if (suppressUnk || suppressSpecial) { // do we need to suppress unk or special?
@@ -316,6 +570,20 @@ Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch>
 
   auto distMod = New<DistModifier>(graph, options_, batch, INVALID_PATH_SCORE, shortlist);
 
+  // sentences with terms are decoded with a beam divided into banks, see constrainNBest()
+  std::vector<SentenceConstraints> constraints; // [origBatchIdx], empty if no sentence has constraints
+  ConstraintStates constraintStates;
+  if(terminology_) {
+    ABORT_IF(shortlist || factoredVocab, "--terminology does not support shortlists or factored vocabularies");
+    bool anyConstraints = false;
+    for(int origBatchIdx = 0; origBatchIdx < origDimBatch; ++origBatchIdx) {
+      constraints.emplace_back(terminology_->constraints(batch, origBatchIdx));
+      anyConstraints |= !constraints.back().empty();
+    }
+    if(!anyConstraints)
+      constraints.clear();
+  }
+
   // the decoding process updates the following state information in each output time step:
   //  - beams: array [origDimBatch] of array [maxBeamSize] of Hypothesis
   //     - current output time step's set of active hypotheses, aka active search space
@@ -329,7 +597,9 @@ Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch>
   IndexType currentDimBatch = origDimBatch;
   auto prevBatchIdxMap = batchIdxMap; // [origBatchIdx -> currentBatchIdx] but shifted by one time step
   // main loop over output time steps
+  tracing::RepeatedSpan decoderSteps("decoder_step");
   for (size_t t = 0; ; t++) {
+    auto stepInterval = decoderSteps.time();
     //std::cerr << "\nstep=" << t << std::endl;
     ABORT_IF(origDimBatch != beams.size(), "Lost a batch entry??");
     // determine beam size for next output time step, as max over still-active sentences
@@ -411,12 +681,39 @@ Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch>
       if (!anyCanExpand) // all words cannot expand this factor: skip
         continue;
 
+      // members of a parallel ensemble build and forward their step on their own threads while this thread builds the
+      // step of the other scorers, their scores are copied into this graph when its forward pass reaches them
+      std::vector<std::shared_future<Tensor>> memberLogProbs(scorers_.size());
+      if(parallelEnsemble) {
+        for(size_t i = 0; i < scorers_.size(); ++i) {
+          if(!scorers_[i]->hasOwnGraph())
+            continue;
+          memberLogProbs[i] = scorers_[i]->runOnOwnThread([&, i]() {
+            auto memberGraph = scorers_[i]->graph(graph);
+            states[i] = scorers_[i]->step(memberGraph, states[i], hypIndices, prevWords, batchIndices, (int)maxBeamSize);
+            auto logProbs = states[i]->getLogProbs().getLogits(); // [maxBeamSize, 1, currentDimBatch, dimVocab]
+            if(t == 0)
+              memberGraph->forward();
+            else
+              memberGraph->forwardNext();
+            return logProbs->val();
+          }).share();
+        }
+      }
+
       //**********************************************************************
       // compute expanded path scores with word prediction probs from all scorers
       Expr stepScores;
       for(size_t i = 0; i < scorers_.size(); ++i) {
         Expr logProbs;
-        if (factorGroup == 0) {
+        if(scorers_[i]->hasOwnGraph()) {
+          // the first scorer shares this graph, all scores of an ensemble have its shape
+          auto memberScores = memberLogProbs[i];
+          logProbs = graph->constant(stepScores->shape(),
+                                     inits::fromLambda([memberScores](Tensor t) { t->copyFrom(memberScores.get()); }),
+                                     stepScores->value_type());
+        }
+        else if (factorGroup == 0) {
           // compute output probabilities for current output time step
           //  - uses hypIndices[index in beam, 1, batch index, 1] to reorder scorer state to reflect the top-N in beams[][]
           //  - adds prevWords [index in beam, 1, batch index, 1] to the scorer's target history
@@ -460,22 +757,45 @@ Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch>
       // @TODO:: consider doing this before ensembling
       stepScores = cast(stepScores, Type::float32);
 
+      // thresholded and hard alignments only need the largest attention probabilities, which are selected on the device
+      Expr2 topAlignment;
+      if(opts_.alignmentTopK > 0 && factorGroup == 0)
+        topAlignment = scorers_[0]->getTopAlignment(opts_.alignmentTopK);
+
       if(factorGroup == 0) {
         stepScores = distMod->force(stepScores, (int)t, (int)maxBeamSize, batchIndices);
         stepScores = distMod->sample(stepScores, /*normalize=*/true);
       }
 
-      // make beams continuous
-      auto expandedPathScores = prevPathScores + stepScores; // will become [maxBeamSize, 1, currDimBatch, dimVocab]
+      // the scores of the words that advance constraints are gathered on the device with the step
+      Expr constraintScores;
+      std::vector<WordIndex> constraintWords;
+      if(!constraints.empty())
+        constraintScores = gatherConstraintScores(stepScores, beams, batchIdxMap, constraints, constraintStates, constraintWords);
+
+      // make beams continuous. The GPU top-k for small beams adds the path scores while it reads the step scores,
+      // so that neither the sum nor its transposition are written out. Suppression modifies the scores in place,
+      // which must not reach the step scores of the decoder states.
+      bool nBestAddsPathScores = nBestListAddsPathScores(maxBeamSize, graph->getDeviceId())
+                                 && !(suppressedWordIndices && factorGroup == 0);
+      Expr expandedPathScores;
+      if(nBestAddsPathScores) {
+        expandedPathScores = stepScores; // [maxBeamSize, 1, currentDimBatch, dimVocab]
+      } else {
+        expandedPathScores = prevPathScores + stepScores; // will become [maxBeamSize, 1, currDimBatch, dimVocab]
 
-      // this transpose is required for the combined top-k search below
-      expandedPathScores = swapAxes(expandedPathScores, 0, 2); // -> [currentDimBatch, 1, maxBeamSize, dimVocab]
+        // this transpose is required for the combined top-k search below
+        expandedPathScores = swapAxes(expandedPathScores, 0, 2); // -> [currentDimBatch, 1, maxBeamSize, dimVocab]
+      }
 
       // perform NN computation
       if(t == 0 && factorGroup == 0)
         graph->forward();
       else
         graph->forwardNext();
+      for(auto& logProbs : memberLogProbs) // the states of the members are read below
+        if(logProbs.valid())
+          logProbs.wait();
 
       //**********************************************************************
       // suppress specific symbols if not at right positions
@@ -489,22 +809,34 @@ Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch>
       // find N best amongst the (maxBeamSize * dimVocab) hypotheses
       std::vector<unsigned int> nBestKeys; // [currentDimBatch, maxBeamSize] flattened -> (batchIdx, beamHypIdx, word idx) flattened
       std::vector<float> nBestPathScores;  // [currentDimBatch, maxBeamSize] flattened
-      getNBestList(/*in*/   expandedPathScores->val(),   // [currentDimBatch, 1, maxBeamSize, dimVocab or dimShortlist]
+      std::vector<unsigned int> nBestWords; // [currentDimBatch, maxBeamSize] flattened -> word index, if short-listed
+      // the shortlist only applies to the lemmas, its indices are mapped on the device of the scores
+      Tensor shortlistIndices = shortlist && factorGroup == 0 ? shortlist->getIndicesTensor() : nullptr;
+      getNBestList(/*in*/   expandedPathScores->val(),   // [currentDimBatch, 1, maxBeamSize, dimVocab or dimShortlist], or untransposed step scores
                   /*N=*/    maxBeamSize,                 // desired beam size
                   /*out*/   nBestPathScores,
                    /*out*/  nBestKeys,
-                  /*first=*/t == 0 && factorGroup == 0); // @TODO: this is only used for checking presently, and should be removed altogether
+                  /*first=*/t == 0 && factorGroup == 0, // @TODO: this is only used for checking presently, and should be removed altogether
+                  /*in*/    shortlistIndices,            // [beam or 1, currentDimBatch or 1, dimShortlist] or nullptr
+                  /*out*/   nBestWords,
+                  /*in*/    nBestAddsPathScores ? prevPathScores->val() : nullptr);
 
       // Now, nBestPathScores contain N-best expandedPathScores for each batch and beam,
       // and nBestKeys for each their original location (batchIdx, beamHypIdx, word).
+      if(constraintScores)
+        constrainNBest(nBestKeys, nBestPathScores, constraintScores, constraintWords,
+                       expandedPathScores->shape()[nBestAddsPathScores ? -4 : -2], expandedPathScores->shape()[-1],
+                       beams, batchIdxMap, constraints, constraintStates,
+                       /*lastStep=*/t + 1 >= opts_.maxLengthFactor * batch->front()->batchWidth());
 
       // combine N-best sets with existing search space (beams) to updated search space
-      beams = toHyps(nBestKeys, nBestPathScores,
-                     /*nBestBeamSize*/expandedPathScores->shape()[-2], // used for interpretation of keys
+      beams = toHyps(nBestKeys, nBestPathScores, nBestWords,
+                     /*nBestBeamSize*/expandedPathScores->shape()[nBestAddsPathScores ? -4 : -2], // used for interpretation of keys
                      /*vocabSize=*/expandedPathScores->shape()[-1],    // used for interpretation of keys
                      beams,
                      states,            // used for keeping track of per-ensemble-member path score
                      batch,             // only used for propagating alignment info
+                     topAlignment,      // ditto
                      factoredVocab, factorGroup,
                      emptyBatchEntries, // [origDimBatch] - empty source batch entries are marked with true
                      batchIdxMap);      // used to create a reverse batch index map to recover original batch indices for this step
@@ -512,19 +844,39 @@ Histories BeamSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch>
 
     prevBatchIdxMap = batchIdxMap; // save current batchIdx map to be used in next step; we are then going to look one step back
 
+    if(!constraints.empty()) {
+      ConstraintStates nextStates;
+      for(int origBatchIdx = 0; origBatchIdx < origDimBatch; ++origBatchIdx)
+        if(!constraints[origBatchIdx].empty())
+          for(const auto& hyp : beams[origBatchIdx])
+            nextStates[hyp.get()] = constraints[origBatchIdx].advance(constraintStateOf(constraintStates, hyp->getPrevHyp()), hyp->getWord());
+      constraintStates.swap(nextStates);
+    }
+
     // remove all hyps that end in EOS
     // The position of a hyp in the beam may change.
     // in/out = shifts the batch index map if a beam gets fully purged
-    const auto purgedNewBeams = purgeBeams(beams, /*in/out=*/batchIdxMap);
+    auto purgedNewBeams = purgeBeams(beams, /*in/out=*/batchIdxMap, /*in/out=*/bestFinishedScores);
 
     // add updated search space (beams) to our return value
     bool maxLengthReached = false;
     for(int batchIdx = 0; batchIdx < origDimBatch; ++batchIdx) {
       // if this batch entry has surviving hyps then add them to the traceback grid
       if(!beams[batchIdx].empty()) { // if the beam is not empty expand the history object associated with the beam
-        if (histories[batchIdx]->size() >= options_->get<float>("max-length-factor") * batch->front()->batchWidth())
+        if (histories[batchIdx]->size() >= opts_.maxLengthFactor * batch->front()->batchWidth())
           maxLengthReached = true;
-        histories[batchIdx]->add(beams[batchIdx], trgEosId, purgedNewBeams[batchIdx].empty() || maxLengthReached);
+        bool finished = purgedNewBeams[batchIdx].empty() || maxLengthReached;
+        histories[batchIdx]->add(beams[batchIdx], trgEosId, finished);
+        // a sentence retires once none of its live hypotheses can enter its n-best list any more, which frees its
+        // batch row like sentences whose hypotheses all finished
+        if(!finished && earlyStop && !histories[batchIdx]->canImprove(purgedNewBeams[batchIdx], nBestSize, maxLength)) {
+          finished = true;
+          purgedNewBeams[batchIdx].clear();
+          for(size_t i = batchIdx + 1; i < beams.size(); ++i)
+            batchIdxMap[i] = batchIdxMap[i] - 1;
+        }
+        if(finished && finishedCallback_)
+          finishedCallback_(histories[batchIdx]);
       }
     }
     if (maxLengthReached) // early exit if max length limit was reached
@@ -4,6 +4,9 @@
 #include "translator/history.h"
 #include "translator/scorers.h"
 #include "translator/nth_element.h"
+#include "translator/terminology.h"
+
+#include <unordered_map>
 
 namespace marian {
 
@@ -14,6 +17,59 @@ private:
   size_t beamSize_;
   Ptr<const Vocab> trgVocab_;
 
+  // options that the search reads for every step or hypothesis, converted once from the Options
+  struct SearchOptions {
+    bool nBest;
+    bool alignment;
+    int alignmentTopK; // attention probabilities per target word that can decide a hard alignment, 0 for soft ones
+    float normalize;
+    float wordPenalty;
+    float maxLengthFactor;
+    bool allowUnk;
+    bool allowSpecial;
+    float pruneRelative; // 0 if disabled
+    float pruneAbsolute; // ditto
+    bool pruneFinished;
+
+    SearchOptions(Ptr<Options> options)
+        : nBest(options->get<bool>("n-best")),
+          alignment(options->hasAndNotEmpty("alignment")),
+          alignmentTopK(chooseAlignmentTopK(options->get<std::string>("alignment", ""))),
+          normalize(options->get<float>("normalize")),
+          wordPenalty(options->get<float>("word-penalty")),
+          maxLengthFactor(options->get<float>("max-length-factor")),
+          allowUnk(options->get<bool>("allow-unk", false)),
+          allowSpecial(options->get<bool>("allow-special", false)),
+          pruneRelative(options->get<float>("beam-prune-relative", 0.f)),
+          pruneAbsolute(options->get<float>("beam-prune-absolute", 0.f)),
+          pruneFinished(options->get<bool>("beam-prune-finished", false)) {}
+
+    bool prunes() const {
+      return pruneRelative > 0.f || pruneAbsolute > 0.f || pruneFinished;
+    }
+
+    // Hard alignments take the argmax. Less than 1/threshold probabilities of a distribution can exceed a threshold,
+    // so the top ceil(1/threshold) are a superset of the alignment points.
+    static int chooseAlignmentTopK(const std::string& alignment) {
+      if(alignment == "hard")
+        return 1;
+      float threshold = 0.f;
+      try {
+        threshold = std::stof(alignment);
+      } catch(...) {
+        return 0; // soft or none
+      }
+      if(threshold >= 1.f)
+        return 1;
+      return threshold > 0.f ? (int)std::ceil(1.f / threshold) : 0;
+    }
+  };
+  const SearchOptions opts_;
+
+  FinishedHistoryCallback finishedCallback_;
+  Ptr<const Terminology> terminology_;
+  Ptr<HypothesisPool> hypothesisPool_; // arena for the hypotheses of the current search, shared with its Histories
+
   const float INVALID_PATH_SCORE;
   const bool PURGE_BATCH = true; // @TODO: diagnostic, to-be-removed once confirmed there are no issues.
 
@@ -26,17 +82,19 @@ private:
 public:
   BeamSearch(Ptr<Options> options, const std::vector<Ptr<Scorer>>& scorers, const Ptr<const Vocab> trgVocab)
       : options_(options), scorers_(scorers), beamSize_(options_->get<size_t>("beam-size")), trgVocab_(trgVocab),
-        INVALID_PATH_SCORE{chooseInvalidPathScore(options)}
+        opts_(options), INVALID_PATH_SCORE{chooseInvalidPathScore(options)}
   {}
 
   // combine new expandedPathScores and previous beams into new set of beams
   Beams toHyps(const std::vector<unsigned int>& nBestKeys, // [currentDimBatch, beamSize] flattened -> ((batchIdx, beamHypIdx) flattened, word idx) flattened
                const std::vector<float>& nBestPathScores,  // [currentDimBatch, beamSize] flattened
+               const std::vector<unsigned int>& nBestWords,   // [currentDimBatch, beamSize] flattened -> word index, mapped via the shortlist; empty if not mapped
                const size_t nBestBeamSize, // for interpretation of nBestKeys
                const size_t vocabSize,     // ditto.
                const Beams& beams,
                const std::vector<Ptr<ScorerState /*const*/>>& states,
                Ptr<data::CorpusBatch /*const*/> batch, // for alignments only
+               Expr2 topAlignment, // [beam depth, k, current batch size, 1] see Scorer::getTopAlignment(), for opts_.alignmentTopK only
                Ptr<class FactoredVocab/*const*/> factoredVocab, size_t factorGroup,
                const std::vector<bool>& dropBatchEntries, // [origDimBatch] - empty source batch entries are marked with true, should be cleared after first use.
                const std::vector<IndexType>& batchIdxMap) const;
@@ -49,8 +107,54 @@ public:
       int origBatchIdx,
       int currentDimBatch) const;
 
-  // remove all beam entries that have reached EOS
-  Beams purgeBeams(const Beams& beams, /*in/out=*/std::vector<IndexType>& batchIdxMap);
+  // The same from the top-k attention probabilities, the others are 0
+  std::vector<float> getTopAlignmentsForHypothesis(
+      const std::vector<float>& topValues,       // [beam depth, k, batch size, 1] flattened
+      const std::vector<IndexType>& topSrcPos,   // ditto, source positions
+      int k,
+      Ptr<data::CorpusBatch> batch,
+      int beamHypIdx,
+      int currentBatchIdx,
+      int origBatchIdx,
+      int currentDimBatch) const;
+
+  typedef std::unordered_map<const Hypothesis*, ConstraintState> ConstraintStates; // of the hypotheses in the beams
+
+  // Step scores of the words that advance the constraints of the hypotheses in beams, [beam depth, 1, current batch
+  // size, num candidates]. words holds the candidates of every row in the same layout, padded with Shortlist::npos.
+  Expr gatherConstraintScores(Expr stepScores,
+                              const Beams& beams,
+                              const std::vector<IndexType>& batchIdxMap,
+                              const std::vector<SentenceConstraints>& constraints,
+                              const ConstraintStates& states,
+                              std::vector<WordIndex>& words) const;
+
+  // Replaces the n-best selection of every sentence with constraints: the n-best list and the constraint candidates
+  // are divided into banks by the number of constraint words they produced, and the beam is shared among the banks,
+  // favoring the ones with more. Hypotheses that end before all constraints are met are only used if nothing is left.
+  void constrainNBest(std::vector<unsigned int>& nBestKeys,
+                      std::vector<float>& nBestPathScores,
+                      Expr constraintScores,
+                      const std::vector<WordIndex>& constraintWords,
+                      size_t nBestBeamSize,
+                      size_t vocabSize,
+                      const Beams& beams,
+                      const std::vector<IndexType>& batchIdxMap,
+                      const std::vector<SentenceConstraints>& constraints,
+                      const ConstraintStates& states,
+                      bool lastStep) const;
+
+  // remove all beam entries that have reached EOS and, with beam pruning, the ones that scored too far below the best
+  // hypothesis of their beam or below the best finished one of their sentence, kept in bestFinishedScores
+  Beams purgeBeams(const Beams& beams,
+                   /*in/out=*/std::vector<IndexType>& batchIdxMap,
+                   /*in/out=*/std::vector<float>& bestFinishedScores);
+
+  // stream out every sentence once it has finished instead of waiting for the whole batch
+  void setFinishedCallback(FinishedHistoryCallback callback) { finishedCallback_ = callback; }
+
+  // constrain the translations of sentences with terms, see --terminology
+  void setTerminology(Ptr<const Terminology> terminology) { terminology_ = terminology; }
 
   // main decoding function
   Histories search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch);
@@ -0,0 +1,209 @@
+#include "translator/greedy_search.h"
+
+#include "data/factored_vocab.h"
+#include "data/shortlist.h"
+#include "common/tracing.h"
+#include "translator/helpers.h"
+#include "translator/sampling.h"
+
+#include <cmath>
+
+namespace marian {
+
+bool GreedySearch::canDecode(Ptr<const Options> options, Ptr<const Vocab> trgVocab) {
+  if(options->get<size_t>("beam-size") != 1)
+    return false;
+  // several samples per sentence are decoded here by design, their n-best list needs no score breakdown
+  bool samples = options->get<size_t>("num-samples", 1) > 1 && options->hasAndNotEmpty("output-sampling");
+  // n-best lists carry per-scorer score breakdowns, sampling and force-decoding need the DistModifier, the members of
+  // a parallel ensemble run on their own graphs
+  if((!samples && (options->get<bool>("n-best", false) || options->hasAndNotEmpty("output-sampling")))
+     || options->get<bool>("force-decode", false) || options->hasAndNotEmpty("alignment")
+     || options->hasAndNotEmpty("terminology") || options->get<bool>("parallel-ensemble", false))
+    return false;
+  auto factoredVocab = trgVocab->tryAs<FactoredVocab>();
+  return !factoredVocab || factoredVocab->getNumGroups() == 1;
+}
+
+Histories GreedySearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch) {
+  const int origDimBatch = (int)batch->size();
+  const auto trgEosId = trgVocab_->getEosId();
+  const float maxLength = options_->get<float>("max-length-factor") * batch->front()->batchWidth();
+  // with --num-samples, row r of the decoder batch is sample r % numSamples of sentence r / numSamples
+  const int numSamples = (int)options_->get<size_t>("num-samples", 1);
+  const int dimRows = origDimBatch * numSamples;
+
+  for(auto scorer : scorers_)
+    scorer->clear(graph);
+
+  auto hypothesisPool = New<HypothesisPool>();
+
+  Histories histories(origDimBatch);
+  for(int i = 0; i < origDimBatch; ++i) {
+    size_t sentId = batch->getSentenceIds()[i];
+    histories[i] = New<History>(sentId,
+                                options_->get<float>("normalize"),
+                                options_->get<float>("word-penalty"));
+    histories[i]->setHypothesisPool(hypothesisPool);
+  }
+
+  std::vector<Ptr<ScorerState>> states;
+  {
+    // the encoder runs with the first step, except for sampled requests that time it on its own
+    tracing::Span span("encoder");
+    for(auto scorer : scorers_)
+      states.push_back(scorer->startState(graph, batch));
+    if(tracing::active())
+      graph->forward();
+  }
+
+  // Mark batch entries that consist only of source <EOS> i.e. these are empty lines. They will be forced to EOS.
+  std::vector<bool> emptyBatchEntries(origDimBatch);
+  const auto& srcEosId = batch->front()->vocab()->getEosId();
+  for(int origBatchIdx = 0; origBatchIdx < origDimBatch; ++origBatchIdx)
+    emptyBatchEntries[origBatchIdx] = batch->front()->data()[origBatchIdx] == srcEosId;
+
+  // chosen words and path scores, [row * maxSteps + t]
+  const size_t maxSteps = (size_t)std::ceil(std::max(maxLength, 1.f));
+  std::vector<Word>  words(dimRows * maxSteps);
+  std::vector<float> pathScores(dimRows * maxSteps);
+  std::vector<size_t> lengths(dimRows, 0);
+  std::vector<int> unfinishedSamples(origDimBatch, numSamples);
+
+  // build the traceback grid of a finished sentence in one go
+  auto finish = [&](IndexType origBatchIdx) {
+    auto& history = histories[origBatchIdx];
+    auto hyp = hypothesisPool->New();
+    history->add(Beam(1, hyp), trgEosId);
+    size_t length = lengths[origBatchIdx];
+    for(size_t t = 0; t < length; ++t) {
+      size_t pos = origBatchIdx * maxSteps + t;
+      hyp = hypothesisPool->New(hyp, words[pos], /*prevBeamHypIdx=*/0, pathScores[pos]);
+      history->add(Beam(1, hyp), trgEosId, /*last=*/t + 1 == length);
+    }
+    if(finishedCallback_)
+      finishedCallback_(history);
+  };
+
+  // the samples of a sentence share one grid, beam entry k is sample k. Samples that ended earlier repeat their last
+  // hypothesis, which is not final again
+  auto finishSamples = [&](IndexType origBatchIdx) {
+    auto& history = histories[origBatchIdx];
+    size_t firstRow = (size_t)origBatchIdx * numSamples;
+    size_t maxLen = *std::max_element(lengths.begin() + firstRow, lengths.begin() + firstRow + numSamples);
+    Beam beam(numSamples, hypothesisPool->New());
+    history->add(beam, trgEosId);
+    for(size_t t = 0; t < maxLen; ++t) {
+      Beam next(beam);
+      std::vector<bool> final(numSamples, false);
+      for(int k = 0; k < numSamples; ++k) {
+        size_t length = lengths[firstRow + k];
+        if(t >= length)
+          continue;
+        size_t pos = (firstRow + k) * maxSteps + t;
+        next[k] = hypothesisPool->New(beam[k], words[pos], /*prevBeamHypIdx=*/(IndexType)k, pathScores[pos]);
+        final[k] = t + 1 == length;
+      }
+      history->add(next, final);
+      beam = next;
+    }
+    if(finishedCallback_)
+      finishedCallback_(history);
+  };
+
+  std::vector<IndexType> batchIdxMap(dimRows); // [currentBatchIdx] -> row, the same as origBatchIdx without samples
+  std::iota(batchIdxMap.begin(), batchIdxMap.end(), 0);
+
+  std::vector<IndexType> batchIndices(origDimBatch); // entries of the previous step that are still active
+  std::iota(batchIndices.begin(), batchIndices.end(), 0);
+  std::vector<IndexType> hypIndices;                 // same as batchIndices with beam size 1, empty at t == 0
+  if(numSamples > 1) {
+    // expands the encoder and start states of every sentence to its samples with the first step
+    batchIndices.clear();
+    for(int row = 0; row < dimRows; ++row)
+      batchIndices.push_back((IndexType)(row / numSamples));
+    hypIndices = batchIndices;
+  }
+  auto distMod = numSamples > 1 ? New<DistModifier>(graph, options_, batch, NumericLimits<float>(Type::float32).lowest / 2.f) : nullptr;
+  Words prevWords;                                   // [currentDimBatch]
+  Expr suppressedWords;
+  bool suppressedWordsChecked = false;
+
+  tracing::RepeatedSpan decoderSteps("decoder_step");
+  for(size_t t = 0; !batchIdxMap.empty(); ++t) {
+    auto stepInterval = decoderSteps.time();
+    Expr stepScores;
+    for(size_t i = 0; i < scorers_.size(); ++i) {
+      states[i] = scorers_[i]->step(graph, states[i], hypIndices, prevWords, batchIndices, /*beamSize=*/1);
+      auto logProbs = scorers_[i]->getWeight() * states[i]->getLogProbs().getLogits(); // [1, 1, currentDimBatch, dimVocab]
+      stepScores = stepScores ? stepScores + logProbs : logProbs;
+    }
+    stepScores = cast(stepScores, Type::float32);
+
+    auto shortlist = scorers_[0]->getShortlist();
+    if(!suppressedWordsChecked) { // the vocabulary dimension does not change during search
+      suppressedWords = suppressionMask(graph, options_, trgVocab_, shortlist, stepScores->shape()[-1]);
+      suppressedWordsChecked = true;
+    }
+    if(suppressedWords)
+      stepScores = stepScores + suppressedWords;
+
+    // samples pick the argmax of the noisy scores, but keep the model scores of the picked words
+    auto best = argmax(distMod ? distMod->sample(stepScores, /*normalize=*/true) : stepScores, /*axis=*/-1); // [1, 1, currentDimBatch, 1]
+    auto scores = distMod ? gather(stepScores, /*axis=*/-1, get<1>(best)) : get<0>(best);
+
+    if(t == 0)
+      graph->forward();
+    else
+      graph->forwardNext();
+
+    std::vector<IndexType> bestIndices;
+    std::vector<float> bestScores;
+    get<1>(best)->val()->get(bestIndices);
+    scores->val()->get(bestScores);
+
+    // the history would hold t + 1 entries (incl. the start hypothesis) before adding this step, see BeamSearch
+    bool maxLengthReached = t + 1 >= maxLength;
+
+    std::vector<IndexType> nextBatchIdxMap, survivors;
+    Words nextWords;
+    for(IndexType currentBatchIdx = 0; currentBatchIdx < (IndexType)batchIdxMap.size(); ++currentBatchIdx) {
+      auto row = batchIdxMap[currentBatchIdx];
+      auto origBatchIdx = row / numSamples;
+      size_t pos = row * maxSteps + lengths[row];
+      float prevPathScore = lengths[row] > 0 ? pathScores[pos - 1] : 0.f;
+
+      Word word;
+      if(t == 0 && emptyBatchEntries[origBatchIdx]) {
+        word = trgEosId;
+        pathScores[pos] = 0.f;
+      } else {
+        WordIndex wordIdx = bestIndices[currentBatchIdx];
+        word = Word::fromWordIndex(shortlist ? shortlist->reverseMap(/*beamIdx=*/0, (int)currentBatchIdx, wordIdx) : wordIdx);
+        pathScores[pos] = prevPathScore + bestScores[currentBatchIdx];
+      }
+      words[pos] = word;
+      lengths[row]++;
+
+      if(word == trgEosId || maxLengthReached) {
+        if(numSamples == 1)
+          finish(origBatchIdx);
+        else if(--unfinishedSamples[origBatchIdx] == 0)
+          finishSamples(origBatchIdx);
+      } else {
+        nextBatchIdxMap.push_back(row);
+        survivors.push_back(currentBatchIdx);
+        nextWords.push_back(word);
+      }
+    }
+
+    batchIdxMap = nextBatchIdxMap;
+    batchIndices = survivors;
+    hypIndices = survivors;
+    prevWords = nextWords;
+  }
+
+  return histories; // [origDimBatch][t][numSamples hyps]
+}
+
+}  // namespace marian
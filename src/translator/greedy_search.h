@@ -0,0 +1,37 @@
+#pragma once
+
+#include "marian.h"
+#include "translator/history.h"
+#include "translator/scorers.h"
+
+namespace marian {
+
+/**
+ * Greedy decoding for --beam-size 1. Words are picked with an argmax inside the graph, and only the
+ * chosen word ids and their scores are copied back per step into flat per-sentence buffers. No
+ * Beams, n-best selection or Hypothesis objects are involved during the search. The traceback grid
+ * of a History is only built once a sentence has finished. Results are identical to BeamSearch with
+ * beam size 1, which dispatches here whenever canDecode() holds.
+ */
+class GreedySearch {
+private:
+  Ptr<Options> options_;
+  std::vector<Ptr<Scorer>> scorers_;
+  Ptr<const Vocab> trgVocab_;
+  FinishedHistoryCallback finishedCallback_;
+
+public:
+  GreedySearch(Ptr<Options> options, const std::vector<Ptr<Scorer>>& scorers, const Ptr<const Vocab> trgVocab)
+      : options_(options), scorers_(scorers), trgVocab_(trgVocab) {}
+
+  // true if the decoding options do not require the full beam search machinery
+  static bool canDecode(Ptr<const Options> options, Ptr<const Vocab> trgVocab);
+
+  // stream out every sentence once it has finished instead of waiting for the whole batch
+  void setFinishedCallback(FinishedHistoryCallback callback) { finishedCallback_ = callback; }
+
+  // main decoding function
+  Histories search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch);
+};
+
+}  // namespace marian
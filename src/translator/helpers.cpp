@@ -5,7 +5,10 @@
 
 #include <limits>
 
+#include "common/options.h"
+#include "data/shortlist.h"
 #include "data/types.h"
+#include "data/vocab.h"
 #include "tensors/tensor.h"
 #include "translator/helpers.h"
 
@@ -40,4 +43,27 @@ void suppressWords(Expr logProbs, Expr wordIndices) {
   }
 #endif
 }
+
+Expr suppressionMask(Ptr<ExpressionGraph> graph,
+                     Ptr<const Options> options,
+                     Ptr<const Vocab> vocab,
+                     Ptr<data::Shortlist> shortlist,
+                     int dimVocab) {
+  bool suppressUnk     = !options->get<bool>("allow-unk", false);
+  bool suppressSpecial = !options->get<bool>("allow-special", false);
+  if(!suppressUnk && !suppressSpecial)
+    return nullptr;
+
+  std::vector<float> mask(dimVocab, 0.f);
+  bool any = false;
+  for(auto wordIdx : vocab->suppressedIndices(suppressUnk, suppressSpecial)) {
+    if(shortlist)
+      wordIdx = shortlist->tryForwardMap(wordIdx);
+    if(wordIdx == data::Shortlist::npos || wordIdx >= (WordIndex)dimVocab)
+      continue;
+    mask[wordIdx] = NumericLimits<float>(Type::float32).lowest / 2.f;
+    any = true;
+  }
+  return any ? graph->constant({dimVocab}, inits::fromVector(mask), Type::float32) : nullptr;
+}
 }  // namespace marian
@@ -4,6 +4,12 @@
 
 namespace marian {
 
+class Options;
+class Vocab;
+namespace data {
+class Shortlist;
+}
+
 namespace cpu {
 
 void suppressWords(Expr logProbs, Expr wordIndices);
@@ -15,4 +21,13 @@ void suppressWords(Expr logProbs, Expr wordIndices);
 }
 
 void suppressWords(Expr logProbs, Expr wordIndices);
+
+// Additive [dimVocab] mask that lowers the scores of <unk> and special symbols unless allowed with
+// --allow-unk and --allow-special, or nullptr if nothing needs to be suppressed. For searches that
+// pick words inside the graph (e.g. with argmax) rather than with suppressWords() after forward().
+Expr suppressionMask(Ptr<ExpressionGraph> graph,
+                     Ptr<const Options> options,
+                     Ptr<const Vocab> vocab,
+                     Ptr<data::Shortlist> shortlist,
+                     int dimVocab);
 }  // namespace marian
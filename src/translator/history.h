@@ -3,6 +3,8 @@
 #include "data/types.h"
 #include "hypothesis.h"
 
+#include <algorithm>
+#include <functional>
 #include <queue>
 
 namespace marian {
@@ -21,6 +23,20 @@ private:
 
   float lengthPenalty(size_t length) { return std::pow((float)length, alpha_); }
   float wordPenalty(size_t length) { return wp_ * (float)length; }
+
+  // Upper bound of the normalized score (s - wp * x) / x^alpha of a hypothesis whose path score s can only decrease
+  // and that finishes at a length x in [minLength, maxLength]. The score is largest at the ends of the interval or
+  // where its derivative wp * x * (alpha - 1) - alpha * s is 0.
+  float bestNormalizedScore(float pathScore, float minLength, float maxLength) const {
+    auto normalized = [&](float length) { return (pathScore - wp_ * length) / std::pow(length, alpha_); };
+    float best = std::max(normalized(minLength), normalized(maxLength));
+    if(wp_ != 0.f && alpha_ != 1.f) {
+      float stationary = alpha_ * pathScore / (wp_ * (alpha_ - 1.f));
+      if(stationary > minLength && stationary < maxLength)
+        best = std::max(best, normalized(stationary));
+    }
+    return best;
+  }
 public:
   History(size_t lineNo, float alpha = 1.f, float wp_ = 0.f);
 
@@ -35,6 +51,18 @@ public:
     history_.push_back(beam);
   }
 
+  // Adds a beam of which only the hypotheses marked in final are sentence hypotheses, e.g. independent samples of
+  // different lengths that share the search grid, see --num-samples
+  void add(const Beam& beam, const std::vector<bool>& final) {
+    for(size_t beamIdx = 0; beamIdx < beam.size(); ++beamIdx) {
+      if(final[beamIdx]) {
+        float pathScore = (beam[beamIdx]->getPathScore() - wordPenalty(history_.size())) / lengthPenalty(history_.size());
+        topHyps_.push({history_.size(), beamIdx, pathScore});
+      }
+    }
+    history_.push_back(beam);
+  }
+
   size_t size() const { return history_.size(); } // number of time steps
 
   /* return n best hypotheses
@@ -64,6 +92,51 @@ public:
     return nbest;
   }
 
+  // The same entries as nBest(n) with every path walked once for its words and word scores, which go into flat buffers
+  // shared by all entries instead of vectors per entry
+  NBestTraceback nBestTraceback(size_t n) const {
+    NBestTraceback nbest;
+    nbest.words.reserve(n * history_.size());
+    nbest.wordScores.reserve(n * history_.size());
+    for (auto topHypsCopy = topHyps_; nbest.size() < n && !topHypsCopy.empty(); topHypsCopy.pop()) {
+      const auto& bestHypCoord = topHypsCopy.top();
+      Hypothesis::PtrType bestHyp = history_[bestHypCoord.timeStepIdx][bestHypCoord.beamIdx];
+
+      size_t begin = nbest.words.size();
+      for(auto hyp = bestHyp.get(); hyp->getPrevHyp(); hyp = hyp->getPrevHyp().get()) {
+        nbest.words.push_back(hyp->getWord());
+        nbest.wordScores.push_back(hyp->getPathScore() - hyp->getPrevHyp()->getPathScore());
+      }
+      std::reverse(nbest.words.begin() + begin, nbest.words.end());
+      std::reverse(nbest.wordScores.begin() + begin, nbest.wordScores.end());
+
+      nbest.offsets.push_back(nbest.words.size());
+      nbest.hyps.push_back(bestHyp);
+      nbest.scores.push_back(bestHypCoord.normalizedPathScore);
+    }
+    return nbest;
+  }
+
+  // Whether a live hypothesis of beam may still enter the n best sentence hypotheses once it finishes, at most at
+  // length maxLength. Without noise and with non-negative scorer weights path scores only decrease with every word,
+  // which bounds the normalized scores the hypotheses can reach.
+  bool canImprove(const Beam& beam, size_t n, size_t maxLength) const {
+    if(topHyps_.size() < n)
+      return true;
+    auto topHypsCopy = topHyps_;
+    for(size_t i = 1; i < n; ++i)
+      topHypsCopy.pop();
+    float nthBestScore = topHypsCopy.top().normalizedPathScore;
+
+    // a live hypothesis of the last step finishes with at least one more word, at length history_.size() at the earliest
+    size_t minLength = history_.size();
+    maxLength = std::max(maxLength, minLength);
+    for(const auto& hyp : beam)
+      if(bestNormalizedScore(hyp->getPathScore(), (float)minLength, (float)maxLength) >= nthBestScore)
+        return true;
+    return false;
+  }
+
   Result top() const {
     const NBestList& nbest = nBest(1);
     ABORT_IF(nbest.empty(), "No hypotheses in n-best list??");
@@ -72,7 +145,11 @@ public:
 
   size_t getLineNum() const { return lineNo_; }
 
+  // keep the arena of the hypotheses in this search grid alive for as long as the History exists
+  void setHypothesisPool(Ptr<HypothesisPool> pool) { hypothesisPool_ = pool; }
+
 private:
+  Ptr<HypothesisPool> hypothesisPool_; // declared first, hence destroyed after the hypotheses below
   std::vector<Beam> history_; // [time step][index into beam] search grid @TODO: simplify as this is currently an expensive length count
   std::priority_queue<SentenceHypothesisCoord> topHyps_; // all sentence hypotheses (those that reached eos), sorted by score
   size_t lineNo_;
@@ -81,4 +158,8 @@ private:
 };
 
 typedef std::vector<Ptr<History>> Histories; // [batchDim]
+
+// Called by a search as soon as a sentence of the batch is finished. Other sentences of the
+// same batch may still be decoded, hence the History must not be modified by the receiver.
+typedef std::function<void(Ptr<const History>)> FinishedHistoryCallback;
 }  // namespace marian
@@ -1,11 +1,14 @@
 #pragma once
 #include <memory>
+#include <type_traits>
 
 #include "common/definitions.h"
 #include "data/alignment.h"
 
 namespace marian {
 
+class HypothesisPool;
+
 // one single (partial or full) hypothesis in beam search
 // key elements:
 //  - the word that this hyp ends with
@@ -16,7 +19,9 @@ public:
   typedef IPtr<Hypothesis> PtrType;
 
 private:
-  // Constructors are private, use Hypothesis::New(...)
+  friend class HypothesisPool;
+
+  // Constructors are private, use Hypothesis::New(...) or HypothesisPool::New(...)
 
   Hypothesis() : prevHyp_(nullptr), prevBeamHypIdx_(0), word_(Word::ZERO), pathScore_(0.0) {}
 
@@ -91,11 +96,97 @@ private:
   std::vector<float> scoreBreakdown_; // [num scorers]
   std::vector<float> alignment_;
 
-  ENABLE_INTRUSIVE_PTR(Hypothesis)
+  // Same as ENABLE_INTRUSIVE_PTR(Hypothesis), but hypotheses created by a HypothesisPool are
+  // handed back to their pool instead of being deleted.
+  size_t references_{0};
+  HypothesisPool* pool_{nullptr};
+
+  inline friend void intrusivePtrAddRef(Hypothesis* x) {
+    if(x != 0)
+      ++x->references_;
+  }
+
+  inline friend void intrusivePtrRelease(Hypothesis* x);
+
+  inline friend size_t references(Hypothesis* x) {
+    return x->references_;
+  }
+};
+
+// Arena for the hypotheses of one search. Every step of a search creates beamSize x batchSize
+// hypotheses, most of which are discarded immediately; allocating them one by one from the
+// global heap serializes many CPU worker threads on the allocator. The pool hands out slots
+// from large chunks and recycles released slots, and all chunks are freed in bulk together with
+// the pool. Each History of the search holds a reference to the pool, so the memory goes away
+// once the last History of a batch has been consumed.
+// Like IntrusivePtr this is not thread-safe, a pool must only be used by one thread at a time.
+class HypothesisPool {
+private:
+  typedef std::aligned_storage<sizeof(Hypothesis), alignof(Hypothesis)>::type Slot;
+
+  const size_t chunkSize_;
+  std::vector<std::unique_ptr<Slot[]>> chunks_;
+  size_t usedInLastChunk_{0};
+  std::vector<void*> released_; // slots of destroyed hypotheses that can be reused
+
+  void* allocate() {
+    if(!released_.empty()) {
+      void* slot = released_.back();
+      released_.pop_back();
+      return slot;
+    }
+    if(chunks_.empty() || usedInLastChunk_ == chunkSize_) {
+      chunks_.emplace_back(new Slot[chunkSize_]);
+      usedInLastChunk_ = 0;
+    }
+    return &chunks_.back()[usedInLastChunk_++];
+  }
+
+public:
+  HypothesisPool(size_t chunkSize = 4096) : chunkSize_(chunkSize) {}
+
+  HypothesisPool(const HypothesisPool&) = delete;
+  HypothesisPool& operator=(const HypothesisPool&) = delete;
+
+  // Same as Hypothesis::New(...), the hypothesis must not outlive the pool
+  template <class ...Args>
+  Hypothesis::PtrType New(Args&& ...args) {
+    auto hyp = new(allocate()) Hypothesis(std::forward<Args>(args)...);
+    hyp->pool_ = this;
+    return Hypothesis::PtrType(hyp);
+  }
+
+  void release(Hypothesis* hyp) {
+    hyp->~Hypothesis(); // may recursively release the predecessors of hyp into this pool
+    released_.push_back(hyp);
+  }
 };
 
+inline void intrusivePtrRelease(Hypothesis* x) {
+  if(x != 0 && --x->references_ == 0) {
+    if(x->pool_)
+      x->pool_->release(x);
+    else
+      delete x;
+  }
+}
+
 typedef std::vector<IPtr<Hypothesis>> Beam;                // Beam = vector [beamSize] of hypotheses
 typedef std::vector<Beam> Beams;                          // Beams = vector [batchDim] of vector [beamSize] of hypotheses
 typedef std::tuple<Words, IPtr<Hypothesis>, float> Result; // (word ids for hyp, hyp, normalized sentence score for hyp)
 typedef std::vector<Result> NBestList;                    // sorted vector of (word ids, hyp, sent score) tuples
+
+// An n-best list traced back into flat buffers, see History::nBestTraceback(). The words and word scores of entry i
+// are [offsets[i], offsets[i + 1]).
+struct NBestTraceback {
+  Words words;
+  std::vector<float> wordScores;  // de-aggregated path scores, see Hypothesis::tracebackWordScores()
+  std::vector<size_t> offsets{0}; // [size() + 1]
+  std::vector<IPtr<Hypothesis>> hyps;
+  std::vector<float> scores;      // normalized sentence scores
+
+  size_t size() const { return hyps.size(); }
+  size_t length(size_t i) const { return offsets[i + 1] - offsets[i]; }
+  Words getWords(size_t i) const { return Words(words.begin() + offsets[i], words.begin() + offsets[i + 1]); }
+};
 }  // namespace marian
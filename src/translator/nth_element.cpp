@@ -11,13 +11,82 @@
 #include <limits>
 #include <numeric>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace marian {
 
+namespace {
+
+// index of the lowest set bit, mask must not be 0
+inline int lowestBit(unsigned int mask) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return (int)idx;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+} // namespace
+
 class NthElementCPU {
   std::vector<int> h_res_idx;
   std::vector<float> h_res;
+  std::vector<std::pair<float, int>> heap_; // re-used for each batch entry
   //size_t lastN_;
 
+  // higher score first, lower index first for ties
+  static bool better(const std::pair<float, int>& a, const std::pair<float, int>& b) {
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+  }
+
+  // Threshold-filter top-N over one row of scores. A heap keeps the N best candidates seen so far
+  // with the worst of them on top; its score is the threshold a new element has to beat. Since
+  // that threshold quickly rises, almost all of the row is rejected by a vectorized comparison
+  // and only the few surviving lanes are offered to the heap. Results end up in heap_, best first.
+  void topN(const float* scores, int size, size_t N) {
+    heap_.clear();
+    for(int j = 0; j < (int)N; ++j)
+      heap_.emplace_back(scores[j], j);
+    std::make_heap(heap_.begin(), heap_.end(), better);
+    float threshold = heap_.front().first;
+
+    auto offer = [&](int j) {
+      if(scores[j] > threshold) { // ties lose against the earlier element that is already in the heap
+        std::pop_heap(heap_.begin(), heap_.end(), better);
+        heap_.back() = {scores[j], j};
+        std::push_heap(heap_.begin(), heap_.end(), better);
+        threshold = heap_.front().first;
+      }
+    };
+
+    int j = (int)N;
+#if defined(__AVX512F__)
+    for(; j + 16 <= size; j += 16) {
+      __mmask16 mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(scores + j), _mm512_set1_ps(threshold), _CMP_GT_OQ);
+      for(unsigned int m = mask; m; m &= m - 1)
+        offer(j + lowestBit(m));
+    }
+#elif defined(__AVX2__)
+    for(; j + 8 <= size; j += 8) {
+      __m256 gt = _mm256_cmp_ps(_mm256_loadu_ps(scores + j), _mm256_set1_ps(threshold), _CMP_GT_OQ);
+      for(unsigned int m = (unsigned int)_mm256_movemask_ps(gt); m; m &= m - 1)
+        offer(j + lowestBit(m));
+    }
+#endif
+    for(; j < size; ++j)
+      offer(j);
+
+    std::sort_heap(heap_.begin(), heap_.end(), better);
+  }
+
 public:
   NthElementCPU() {}
   NthElementCPU(const NthElementCPU& copy) = delete;
@@ -28,7 +97,9 @@ public:
                     size_t N,
                     std::vector<float>& outPathScores,
                     std::vector<unsigned>& outKeys,
-                    const bool isFirst) {
+                    const bool isFirst,
+                    Tensor shortlistIndices,
+                    std::vector<unsigned>& outWords) {
     const auto vocabSize = scores->shape()[-1];
     const auto inputN    = scores->shape()[-2];
     const auto dimBatch  = scores->shape()[-4];
@@ -41,25 +112,16 @@ public:
     size_t pos = 0; // iterates through h_res and h_res_idx
 
     size_t batchOffset = inputN * vocabSize;
-    std::vector<int> idxs(batchOffset); // re-used for each batch
-    std::iota(idxs.begin(), idxs.end(), 0);
+    ABORT_IF(N > batchOffset, "Cannot select {} best out of {} scores", N, batchOffset);
 
     for(size_t batchIdx = 0; batchIdx < dimBatch; ++batchIdx) {
-
-      std::partial_sort( 
-        // sorts the top N (beam size) idxs by score to the front
-        idxs.begin(),
-        idxs.begin() + N,
-        idxs.end(),
-        [&](int a, int b) { return scoresData[a] > scoresData[b]; }
-      );
+      topN(scoresData, (int)batchOffset, N);
 
       // copy top N idxs and scores to return vectors
-      for(size_t i = 0; i < N; ++i) {
-        int idx = idxs[i];
-        // since idxs is re-used for each batch, add batch offset to each idx to get absolute position
-        h_res_idx[pos] = (int) (idx + batchIdx * batchOffset);
-        h_res[pos] = scoresData[idx];
+      for(const auto& best : heap_) {
+        // indices are relative to the current batch entry, add batch offset to get absolute position
+        h_res_idx[pos] = (int) (best.second + batchIdx * batchOffset);
+        h_res[pos] = best.first;
         ++pos;
       }
 
@@ -67,9 +129,25 @@ public:
       scoresData += batchOffset;
     }
     getPairs(/*cumulativeBeamSizes.back(),*/ outKeys, outPathScores);
+    if(shortlistIndices)
+      mapShortlist(shortlistIndices, vocabSize, inputN, outWords);
   }
 
 private:
+  // same as Shortlist::reverseMap() for every key, the beam and batch dimensions of the indices may be 1
+  void mapShortlist(Tensor shortlistIndices, int vocabSize, int inputN, std::vector<unsigned>& outWords) {
+    const IndexType* indices = shortlistIndices->data<IndexType>();
+    int numRows = shortlistIndices->shape().elements() / vocabSize;
+    int indicesBatch = numRows == 1 ? 1 : shortlistIndices->shape()[-2];
+    int indicesBeams = numRows / indicesBatch;
+    for(auto key : h_res_idx) {
+      int beamHypIdx = (key / vocabSize) % inputN;
+      int batchIdx   = (key / vocabSize) / inputN;
+      int row = (indicesBeams == 1 ? 0 : beamHypIdx) * indicesBatch + (indicesBatch == 1 ? 0 : batchIdx);
+      outWords.push_back(indices[row * vocabSize + key % vocabSize]);
+    }
+  }
+
   void getPairs(/*size_t number,*/
                 std::vector<unsigned>& outKeys,
                 std::vector<float>& outValues) {
@@ -86,22 +164,35 @@ private:
 };
 
 #ifdef CUDA_FOUND
-GetNBestListFn createGetNBestListGPUFn(size_t beamSize, size_t dimBatch, DeviceId deviceId); // in .cu file
+GetNBestListFn createGetNBestListGPUFn(size_t beamSize, size_t dimBatch, DeviceId deviceId, bool blockReduction); // in .cu file
+bool warpTopKSupports(size_t beamSize); // in .cu file
 #endif
 
 // factory function
 // Returns a lambda with the same signature as the getNBestList() function.
-GetNBestListFn createGetNBestListFn(size_t beamSize, size_t dimBatch, DeviceId deviceId) {
+GetNBestListFn createGetNBestListFn(size_t beamSize, size_t dimBatch, DeviceId deviceId, bool blockReduction) {
 #ifdef CUDA_FOUND
   if(deviceId.type == DeviceType::gpu)
-    return createGetNBestListGPUFn(beamSize, dimBatch, deviceId);
+    return createGetNBestListGPUFn(beamSize, dimBatch, deviceId, blockReduction);
 #else
   deviceId; beamSize; dimBatch; // (unused)
 #endif
+  blockReduction; // GPU only
   auto nth = New<NthElementCPU>();
-  return [nth](Tensor logProbs, size_t N, std::vector<float>& outCosts, std::vector<unsigned>& outKeys, const bool isFirst) {
-    return nth->getNBestList(logProbs, N, outCosts, outKeys, isFirst);
+  return [nth](Tensor logProbs, size_t N, std::vector<float>& outCosts, std::vector<unsigned>& outKeys, const bool isFirst,
+               Tensor shortlistIndices, std::vector<unsigned>& outWords, Tensor prevPathScores) {
+    ABORT_IF(prevPathScores, "The CPU n-best list does not add path scores");
+    return nth->getNBestList(logProbs, N, outCosts, outKeys, isFirst, shortlistIndices, outWords);
   };
 }
 
+bool nBestListAddsPathScores(size_t beamSize, DeviceId deviceId) {
+#ifdef CUDA_FOUND
+  return deviceId.type == DeviceType::gpu && warpTopKSupports(beamSize);
+#else
+  beamSize; deviceId; // (unused)
+  return false;
+#endif
+}
+
 }  // namespace marian
@@ -8,6 +8,7 @@
 #include "translator/nth_element.h"
 
 #include <cuda.h>
+#include <climits>
 #include "tensors/gpu/cuda_helpers.h"
 
 namespace marian {
@@ -275,6 +276,202 @@ __global__ void gGetValueByKey(float* d_in, float* d_out, int* indeces, int n) {
   }
 }
 
+// same as Shortlist::reverseMap() for every key, the beam and batch dimensions of the indices may be 1
+__global__ void gMapShortlist(const int* keys,
+                              const IndexType* indices, // [indicesBeams, indicesBatch, vocabSize]
+                              int* words,
+                              int n,
+                              int vocabSize,
+                              int inputN,
+                              int indicesBeams,
+                              int indicesBatch) {
+  int tid = threadIdx.x + blockDim.x * blockIdx.x;
+  if(tid < n) {
+    int key = keys[tid];
+    int beamHypIdx = (key / vocabSize) % inputN;
+    int batchIdx   = (key / vocabSize) / inputN;
+    int row = (indicesBeams == 1 ? 0 : beamHypIdx) * indicesBatch + (indicesBatch == 1 ? 0 : batchIdx);
+    words[tid] = (int)indices[(size_t)row * vocabSize + key % vocabSize];
+  }
+}
+
+// Warp-level top-k for beam sizes up to WARP_TOPK_MAX_K, instead of the N block-wide arg-max rounds above.
+// Every thread keeps the K best of the scores it reads in registers, sorted, and a block merges these lists with K
+// rounds of warp-shuffle arg-max. Blocks first reduce chunks of WARP_TOPK_CHUNK words of one hypothesis to K
+// candidates each, then one block per batch entry reduces the candidates to the n-best list. The scores are read
+// only once, and the previous path scores can be added while reading them.
+static const int WARP_TOPK_MAX_K   = 16;
+static const int WARP_TOPK_CHUNK   = 4096;
+static const int WARP_TOPK_THREADS = 256;
+
+// higher score first, lower key first for ties, as in NthElementCPU
+__device__ inline bool gBetter(float a, unsigned keyA, float b, unsigned keyB) {
+  return a > b || (a == b && keyA < keyB);
+}
+
+template <int K>
+__device__ inline void gInsert(float (&values)[K], unsigned (&keys)[K], float value, unsigned key) {
+  if(!gBetter(value, key, values[K - 1], keys[K - 1]))
+    return;
+  values[K - 1] = value;
+  keys[K - 1] = key;
+#pragma unroll
+  for(int i = K - 1; i > 0; --i) {
+    if(gBetter(values[i], keys[i], values[i - 1], keys[i - 1])) {
+      float v = values[i]; values[i] = values[i - 1]; values[i - 1] = v;
+      unsigned k = keys[i]; keys[i] = keys[i - 1]; keys[i - 1] = k;
+    }
+  }
+}
+
+__device__ inline void gWarpArgMax(float& value, unsigned& key) {
+#pragma unroll
+  for(int offset = 16; offset > 0; offset >>= 1) {
+    float otherValue = __shfl_xor_sync(0xffffffff, value, offset);
+    unsigned otherKey = __shfl_xor_sync(0xffffffff, key, offset);
+    if(gBetter(otherValue, otherKey, value, key)) {
+      value = otherValue;
+      key = otherKey;
+    }
+  }
+}
+
+// Writes the n <= K best entries of the lists of all threads of the block to outValues and outKeys. Keys are unique
+// across the block except for the padding of short lists.
+template <int K>
+__device__ void gBlockTopK(float (&values)[K], unsigned (&keys)[K], int n, float* outValues, unsigned* outKeys) {
+  __shared__ float sValues[33];
+  __shared__ unsigned sKeys[33];
+  int warp = threadIdx.x / 32, lane = threadIdx.x % 32;
+  for(int r = 0; r < n; ++r) {
+    float value = values[0];
+    unsigned key = keys[0];
+    gWarpArgMax(value, key);
+    if(lane == 0) {
+      sValues[warp] = value;
+      sKeys[warp] = key;
+    }
+    __syncthreads();
+    if(warp == 0) {
+      bool valid = lane < blockDim.x / 32;
+      value = valid ? sValues[lane] : -INFINITY;
+      key = valid ? sKeys[lane] : UINT_MAX;
+      gWarpArgMax(value, key);
+      if(lane == 0) {
+        sValues[32] = value;
+        sKeys[32] = key;
+        outValues[r] = value;
+        outKeys[r] = key;
+      }
+    }
+    __syncthreads();
+    if(keys[0] == sKeys[32]) { // pop the winner
+#pragma unroll
+      for(int i = 0; i < K - 1; ++i) {
+        values[i] = values[i + 1];
+        keys[i] = keys[i + 1];
+      }
+      values[K - 1] = -INFINITY;
+      keys[K - 1] = UINT_MAX;
+    }
+    __syncthreads(); // sValues and sKeys are overwritten by the next round
+  }
+}
+
+// grid [chunks per hypothesis * inputN, dimBatch]. Keys are positions in the batch-major [dimBatch, inputN, vocab]
+// layout. Scores are batch-major too, or beam-major [inputN, dimBatch, vocab] with prevScores to add.
+template <int K>
+__global__ void gTopKChunks(float* candValues,        // [dimBatch, gridDim.x, K]
+                            unsigned* candKeys,       // [dimBatch, gridDim.x, K]
+                            const float* scores,
+                            const float* prevScores,  // [inputN, dimBatch] or a single value, may be null
+                            int prevElements,
+                            int dimBatch,
+                            int inputN,
+                            int vocab,
+                            int chunksPerHyp) {
+  int batchIdx = blockIdx.y;
+  int hyp      = blockIdx.x / chunksPerHyp;
+  int begin    = (blockIdx.x % chunksPerHyp) * WARP_TOPK_CHUNK;
+  int end      = min(begin + WARP_TOPK_CHUNK, vocab);
+
+  bool beamMajor = prevScores != nullptr;
+  size_t row = beamMajor ? (size_t)hyp * dimBatch + batchIdx : (size_t)batchIdx * inputN + hyp;
+  float prev = beamMajor ? prevScores[prevElements == 1 ? 0 : row] : 0.f;
+  const float* rowScores = scores + row * vocab;
+  unsigned keyOffset = (unsigned)(((size_t)batchIdx * inputN + hyp) * vocab);
+
+  float values[K];
+  unsigned keys[K];
+#pragma unroll
+  for(int i = 0; i < K; ++i) {
+    values[i] = -INFINITY;
+    keys[i] = UINT_MAX;
+  }
+
+  for(int w = begin + threadIdx.x; w < end; w += blockDim.x)
+    gInsert(values, keys, rowScores[w] + prev, keyOffset + w);
+
+  size_t out = ((size_t)batchIdx * gridDim.x + blockIdx.x) * K;
+  gBlockTopK(values, keys, K, candValues + out, candKeys + out);
+}
+
+// one block per batch entry, reduces its candidates to the N best
+template <int K>
+__global__ void gTopKMerge(float* outValues,          // [dimBatch, N]
+                           int* outKeys,              // [dimBatch, N]
+                           const float* candValues,
+                           const unsigned* candKeys,
+                           int candidates,            // per batch entry
+                           int N) {
+  int batchIdx = blockIdx.x;
+
+  float values[K];
+  unsigned keys[K];
+#pragma unroll
+  for(int i = 0; i < K; ++i) {
+    values[i] = -INFINITY;
+    keys[i] = UINT_MAX;
+  }
+
+  for(int i = threadIdx.x; i < candidates; i += blockDim.x)
+    gInsert(values, keys, candValues[(size_t)batchIdx * candidates + i], candKeys[(size_t)batchIdx * candidates + i]);
+
+  gBlockTopK(values, keys, N, outValues + batchIdx * N, (unsigned*)outKeys + batchIdx * N);
+}
+
+// smallest supported K for N
+static int warpTopKSize(size_t N) {
+  int K = 1;
+  while(K < (int)N)
+    K *= 2;
+  return K;
+}
+
+bool warpTopKSupports(size_t beamSize) {
+  return beamSize <= WARP_TOPK_MAX_K;
+}
+
+template <int K>
+void launchWarpTopK(float* outValues,
+                    int* outKeys,
+                    float* candValues,
+                    unsigned* candKeys,
+                    const float* scores,
+                    const float* prevScores,
+                    int prevElements,
+                    int dimBatch,
+                    int inputN,
+                    int vocab,
+                    int N) {
+  int chunksPerHyp = (vocab + WARP_TOPK_CHUNK - 1) / WARP_TOPK_CHUNK;
+  dim3 grid(chunksPerHyp * inputN, dimBatch);
+  gTopKChunks<K><<<grid, WARP_TOPK_THREADS, 0, /* stream_ */ 0>>>(
+      candValues, candKeys, scores, prevScores, prevElements, dimBatch, inputN, vocab, chunksPerHyp);
+  gTopKMerge<K><<<dimBatch, WARP_TOPK_THREADS, 0, /* stream_ */ 0>>>(
+      outValues, outKeys, candValues, candKeys, grid.x * K, N);
+}
+
 class NthElementGPU {
 public:
   NthElementGPU() = delete;
@@ -282,13 +479,15 @@ public:
 
   NthElementGPU(size_t maxBeamSize,
                 size_t maxBatchSize,
-                DeviceId deviceId)
+                DeviceId deviceId,
+                bool blockReduction)
       : deviceId_(deviceId),
         maxBeamSize_(maxBeamSize), maxBatchSize_(maxBatchSize),
         NUM_BLOCKS(std::min(
             500,
             int(maxBeamSize* MAX_VOCAB_SIZE / (2 * BLOCK_SIZE))
-                + int(maxBeamSize* MAX_VOCAB_SIZE % (2 * BLOCK_SIZE) != 0))) {
+                + int(maxBeamSize* MAX_VOCAB_SIZE % (2 * BLOCK_SIZE) != 0))),
+        warpTopK_(!blockReduction && warpTopKSupports(maxBeamSize)) {
     // std::cerr << "NthElement::NthElement" << std::endl;
 
     cudaSetDevice(deviceId_.no);
@@ -296,11 +495,16 @@ public:
     CUDA_CHECK(cudaMalloc((void**)&d_ind, maxBatchSize * NUM_BLOCKS * sizeof(int)));
     CUDA_CHECK(cudaMalloc((void**)&d_out, maxBatchSize * NUM_BLOCKS * sizeof(float)));
 
-    CUDA_CHECK(cudaMalloc((void**)&d_res_idx, maxBatchSize * maxBeamSize * sizeof(int)));
-    CUDA_CHECK(cudaMalloc((void**)&d_res,     maxBatchSize * maxBeamSize * sizeof(float)));
+    // scores, keys and shortlisted words share one allocation, so that the n-best list is copied back with a single transfer
+    static_assert(sizeof(int) == sizeof(float), "n-best scores and keys are expected to have the same size");
+    const size_t maxN = maxBatchSize * maxBeamSize;
+    CUDA_CHECK(cudaMalloc((void**)&d_res, 3 * maxN * sizeof(float)));
+    d_res_idx = (int*)(d_res + maxN);
+    d_res_words = (int*)(d_res + 2 * maxN);
 
-    CUDA_CHECK(cudaHostAlloc((void**)&h_res,     maxBeamSize * maxBatchSize * sizeof(float), cudaHostAllocDefault));
-    CUDA_CHECK(cudaHostAlloc((void**)&h_res_idx, maxBeamSize * maxBatchSize * sizeof(int), cudaHostAllocDefault));
+    CUDA_CHECK(cudaHostAlloc((void**)&h_res, 3 * maxN * sizeof(float), cudaHostAllocDefault));
+    h_res_idx = (int*)(h_res + maxN);
+    h_res_words = (int*)(h_res + 2 * maxN);
 
     CUDA_CHECK(cudaMalloc((void**)&d_breakdown, maxBeamSize * sizeof(float)));
     CUDA_CHECK(cudaMalloc((void**)&d_batchPosition, (maxBatchSize + 1) * sizeof(int)));
@@ -310,13 +514,13 @@ public:
   ~NthElementGPU() {
     // No CUDA error checking as this is a destructor and we cannot do anything about errors anyway.
     cudaSetDevice(deviceId_.no);
+    cudaFree(d_candKeys);
+    cudaFree(d_candValues);
     cudaFree(d_cumBeamSizes);
     cudaFree(d_batchPosition);
     cudaFree(d_breakdown);
-    cudaFreeHost(h_res_idx);
-    cudaFreeHost(h_res);
-    cudaFree(d_res);
-    cudaFree(d_res_idx);
+    cudaFreeHost(h_res); // includes h_res_idx and h_res_words
+    cudaFree(d_res);     // includes d_res_idx and d_res_words
     cudaFree(d_out);
     cudaFree(d_ind);
   }
@@ -329,16 +533,24 @@ private:
                    float disabledPathScore) {
 
     cudaSetDevice(deviceId_.no);
-    CUDA_CHECK(cudaMemcpyAsync(d_batchPosition,
-                               batchFirstElementIdxs.data(),
-                               batchFirstElementIdxs.size() * sizeof(int),
-                               cudaMemcpyHostToDevice,
-                               /* stream_ */ 0));
-    CUDA_CHECK(cudaMemcpyAsync(d_cumBeamSizes,
-                               cumulativeBeamSizes.data(),
-                               cumulativeBeamSizes.size() * sizeof(int),
-                               cudaMemcpyHostToDevice,
-                               /* stream_ */ 0));
+    // The offsets only change when batch, beam or vocab size change (batch purging, first step),
+    // so most steps do not need to upload anything.
+    if(batchFirstElementIdxs != uploadedBatchPositions_) {
+      CUDA_CHECK(cudaMemcpyAsync(d_batchPosition,
+                                 batchFirstElementIdxs.data(),
+                                 batchFirstElementIdxs.size() * sizeof(int),
+                                 cudaMemcpyHostToDevice,
+                                 /* stream_ */ 0));
+      uploadedBatchPositions_ = batchFirstElementIdxs;
+    }
+    if(cumulativeBeamSizes != uploadedCumBeamSizes_) {
+      CUDA_CHECK(cudaMemcpyAsync(d_cumBeamSizes,
+                                 cumulativeBeamSizes.data(),
+                                 cumulativeBeamSizes.size() * sizeof(int),
+                                 cudaMemcpyHostToDevice,
+                                 /* stream_ */ 0));
+      uploadedCumBeamSizes_ = cumulativeBeamSizes;
+    }
 
     const int numBatches = batchFirstElementIdxs.size() - 1;
 
@@ -362,17 +574,48 @@ private:
                                            disabledPathScore);
   }
 
+  // see the kernels above, the results go to d_res and d_res_idx as with selectNBest()
+  void selectNBestWarp(const float* scores, Tensor prevPathScores, int dimBatch, int inputN, int vocab, size_t N) {
+    int chunks = (vocab + WARP_TOPK_CHUNK - 1) / WARP_TOPK_CHUNK * inputN;
+    size_t candidates = (size_t)dimBatch * chunks * WARP_TOPK_MAX_K;
+    if(candidates > candidateCapacity_) { // grows with the vocabulary, e.g. when the shortlist changes
+      cudaFree(d_candKeys);
+      cudaFree(d_candValues);
+      CUDA_CHECK(cudaMalloc((void**)&d_candValues, candidates * sizeof(float)));
+      CUDA_CHECK(cudaMalloc((void**)&d_candKeys, candidates * sizeof(unsigned)));
+      candidateCapacity_ = candidates;
+    }
+
+    const float* prevScores = prevPathScores ? prevPathScores->data<float>() : nullptr;
+    int prevElements = prevPathScores ? (int)prevPathScores->shape().elements() : 0;
+    auto launch = launchWarpTopK<WARP_TOPK_MAX_K>;
+    switch(warpTopKSize(N)) {
+      case 1:  launch = launchWarpTopK<1>; break;
+      case 2:  launch = launchWarpTopK<2>; break;
+      case 4:  launch = launchWarpTopK<4>; break;
+      case 8:  launch = launchWarpTopK<8>; break;
+      default: break;
+    }
+    launch(d_res, d_res_idx, d_candValues, d_candKeys, scores, prevScores, prevElements, dimBatch, inputN, vocab, (int)N);
+  }
+
 public:
   void getNBestList(Tensor scores,
                     size_t N,
                     std::vector<float>& outCosts,
                     std::vector<unsigned>& outKeys,
-                    const bool isFirst) {
+                    const bool isFirst,
+                    Tensor shortlistIndices,
+                    std::vector<unsigned>& outWords,
+                    Tensor prevPathScores) {
     cudaSetDevice(deviceId_.no);
 
+    // beam-major step scores [inputN, 1, dimBatch, vocab] with prevPathScores, otherwise [dimBatch, 1, inputN, vocab]
     const auto vocabSize = scores->shape()[-1];
-    const auto inputN    = scores->shape()[-2];
-    const auto dimBatch  = scores->shape()[-4];
+    const auto inputN    = prevPathScores ? scores->shape()[-4] : scores->shape()[-2];
+    const auto dimBatch  = prevPathScores ? scores->shape()[-2] : scores->shape()[-4];
+    ABORT_IF(prevPathScores && !(warpTopK_ && scores->type() == Type::float32 && prevPathScores->type() == Type::float32),
+             "Path scores can only be added by the warp-level top-k of float32 scores");
     ABORT_IF(inputN != (isFirst ? 1 : N), "Input tensor has wrong beam dim??"); // @TODO: Remove isFirst argument altogether
     ABORT_IF(vocabSize > MAX_VOCAB_SIZE, "GetNBestList(): actual vocab size {} exceeds MAX_VOCAB_SIZE of {}", vocabSize, MAX_VOCAB_SIZE);
     ABORT_IF(dimBatch > maxBatchSize_, "GetNBestList(): actual batch size {} exceeds initialization parameter {}", dimBatch, maxBatchSize_);
@@ -397,7 +640,9 @@ public:
 #endif
     }
 
-    if(scores->type() == Type::float32) {
+    if(warpTopK_ && scores->type() == Type::float32) {
+      selectNBestWarp(scores->data<float>(), prevPathScores, dimBatch, inputN, vocabSize, N);
+    } else if(scores->type() == Type::float32) {
       float disabledPathScore = NumericLimits<float>(scores->type()).lowest;
       selectNBest(scores->data<float>(), batchFirstElementIdxs, cumulativeBeamSizes, disabledPathScore);
 #if COMPILE_FP16
@@ -408,31 +653,39 @@ public:
     } else {
       ABORT("getNBestList not implemented for type {}", scores->type());
     }
-    getPairs(dimBatch * N, outKeys, outCosts);
+
+    size_t number = dimBatch * N;
+    if(shortlistIndices) {
+      int numRows = shortlistIndices->shape().elements() / vocabSize;
+      int indicesBatch = numRows == 1 ? 1 : shortlistIndices->shape()[-2];
+      int threads = std::min((int)number, 512);
+      gMapShortlist<<<(int)(number + threads - 1) / threads, threads, 0, /* stream_ */ 0>>>(
+          d_res_idx, shortlistIndices->data<IndexType>(), d_res_words,
+          (int)number, vocabSize, inputN, numRows / indicesBatch, indicesBatch);
+    }
+    getPairs(number, outKeys, outCosts, shortlistIndices ? &outWords : nullptr);
     ABORT_IF(cumulativeBeamSizes.back() != dimBatch * N, "cumulativeBeamSizes.back() wrong??");
   }
 
 private:
   void getPairs(size_t number,
                 std::vector<unsigned>& outKeys,
-                std::vector<float>& outValues) {
+                std::vector<float>& outValues,
+                std::vector<unsigned>* outWords) {
     cudaSetDevice(deviceId_.no);
+    // one transfer covering scores [0, number), keys [maxN, maxN + number) and words [2 * maxN, 2 * maxN + number)
+    const size_t maxN = maxBatchSize_ * maxBeamSize_;
     CUDA_CHECK(cudaMemcpyAsync(h_res,
                                d_res,
-                               number * sizeof(float),
-                               cudaMemcpyDeviceToHost,
-                               /* stream_ */ 0));
-    CUDA_CHECK(cudaMemcpyAsync(h_res_idx,
-                               d_res_idx,
-                               number * sizeof(int),
+                               ((outWords ? 2 * maxN : maxN) + number) * sizeof(float),
                                cudaMemcpyDeviceToHost,
                                /* stream_ */ 0));
     cudaStreamSynchronize(/* stream_ */ 0);
 
-    for(size_t i = 0; i < number; ++i) {
-      outKeys.push_back(h_res_idx[i]);
-      outValues.push_back(h_res[i]);
-    }
+    outKeys.insert(outKeys.end(), h_res_idx, h_res_idx + number);
+    outValues.insert(outValues.end(), h_res, h_res + number);
+    if(outWords)
+      outWords->insert(outWords->end(), h_res_words, h_res_words + number);
 
     //lastN = number;
   }
@@ -449,24 +702,35 @@ private:
   int* d_ind;           // [maxBatchSize * NUM_BLOCKS]
   float* d_out;         // [maxBatchSize * NUM_BLOCKS]
 
-  int* d_res_idx;       // [maxBatchSize * maxBeamSize]
+  int* d_res_idx;       // [maxBatchSize * maxBeamSize], points into the allocation of d_res
   float* d_res;         // [maxBatchSize * maxBeamSize]
 
-  int* h_res_idx;       // [maxBeamSize * maxBatchSize]
+  int* h_res_idx;       // [maxBeamSize * maxBatchSize], points into the allocation of h_res
+  int* d_res_words;     // [maxBatchSize * maxBeamSize], points into the allocation of d_res
+  int* h_res_words;     // [maxBatchSize * maxBeamSize], points into the allocation of h_res
   float* h_res;         // [maxBeamSize * maxBatchSize]
 
   float* d_breakdown;   // [maxBeamSize]
   int* d_batchPosition; // [maxBatchSize + 1]
   int* d_cumBeamSizes;  // [maxBatchSize + 1]
+
+  std::vector<int> uploadedBatchPositions_; // host copies of what is currently in d_batchPosition
+  std::vector<int> uploadedCumBeamSizes_;   // and d_cumBeamSizes
+
+  bool warpTopK_;                   // selectNBestWarp() instead of selectNBest() for float32 scores
+  float* d_candValues{nullptr};     // [candidateCapacity_], candidates of selectNBestWarp()
+  unsigned* d_candKeys{nullptr};    // [candidateCapacity_]
+  size_t candidateCapacity_{0};
   //size_t lastN;
 };
 
 // factory function
 // Returns a lambda with the same signature as the getNBestList() function.
-GetNBestListFn createGetNBestListGPUFn(size_t beamSize, size_t dimBatch, DeviceId deviceId) {
-  auto nth = New<NthElementGPU>(beamSize, dimBatch, deviceId);
-  return [nth](Tensor logProbs, size_t N, std::vector<float>& outCosts, std::vector<unsigned>& outKeys, const bool isFirst) {
-    return nth->getNBestList(logProbs, N, outCosts, outKeys, isFirst);
+GetNBestListFn createGetNBestListGPUFn(size_t beamSize, size_t dimBatch, DeviceId deviceId, bool blockReduction) {
+  auto nth = New<NthElementGPU>(beamSize, dimBatch, deviceId, blockReduction);
+  return [nth](Tensor logProbs, size_t N, std::vector<float>& outCosts, std::vector<unsigned>& outKeys, const bool isFirst,
+               Tensor shortlistIndices, std::vector<unsigned>& outWords, Tensor prevPathScores) {
+    return nth->getNBestList(logProbs, N, outCosts, outKeys, isFirst, shortlistIndices, outWords, prevPathScores);
   };
 }
 
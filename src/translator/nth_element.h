@@ -10,11 +10,27 @@
 
 namespace marian {
 
+// If shortlistIndices ([beam or 1, batch or 1, dimShortlist], see Shortlist::getIndicesTensor()) is given,
+// outWords receives the vocabulary index of every key, which is looked up on the device of logProbs.
+//
+// logProbs are usually the expanded path scores [batch, 1, beam, dimVocab]. If prevPathScores ([beam, 1, batch, 1],
+// or [1, 1, 1, 1] on the first step) is given instead, logProbs are the scores of the current step in their
+// [beam, 1, batch, dimVocab] layout and the path scores are added while searching, which saves the sum and its
+// transposition. The keys refer to the [batch, 1, beam, dimVocab] layout either way. Only where
+// nBestListAddsPathScores() says so.
 typedef std::function<void(Tensor logProbs,
                            size_t N,
                            std::vector<float>& outCosts,
                            std::vector<unsigned>& outKeys,
-                           const bool isFirst)> GetNBestListFn;
+                           const bool isFirst,
+                           Tensor shortlistIndices,
+                           std::vector<unsigned>& outWords,
+                           Tensor prevPathScores)> GetNBestListFn;
 
-GetNBestListFn createGetNBestListFn(size_t beamSize, size_t dimBatch, DeviceId deviceId);
+// blockReduction selects the original GPU kernels for all beam sizes, for comparisons
+GetNBestListFn createGetNBestListFn(size_t beamSize, size_t dimBatch, DeviceId deviceId, bool blockReduction = false);
+
+// Whether the n-best list for beams of beamSize with float32 scores on deviceId can add the path scores itself,
+// i.e. with the warp-level top-k of the GPU
+bool nBestListAddsPathScores(size_t beamSize, DeviceId deviceId);
 }  // namespace marian
@@ -23,7 +23,16 @@ void OutputCollector::Write(long sourceId,
                             const std::string& bestn,
                             bool nbest) {
   std::lock_guard<std::mutex> lock(mutex_);
-  if(sourceId == nextId_) {
+  if(unordered_) {
+    if(printing_->shouldBePrinted(sourceId))
+      LOG(info, "Best translation {} : {}", sourceId, best1);
+    if(outStrm_) {
+      if(nbest)
+        *outStrm_ << bestn << std::endl;
+      else
+        *outStrm_ << sourceId << "\t" << best1 << std::endl;
+    }
+  } else if(sourceId == nextId_) {
     if(printing_->shouldBePrinted(sourceId))
       LOG(info, "Best translation {} : {}", sourceId, best1);
 
@@ -73,12 +82,18 @@ void OutputCollector::Write(long sourceId,
     if(outStrm_ && !nbest)
       *outStrm_ << std::flush;
 
+    drained_.notify_all();
   } else {
     // save for later
     outputs_[sourceId] = std::make_pair(best1, bestn);
   }
 }
 
+void OutputCollector::waitForPending(size_t maxPending) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  drained_.wait(lock, [&]() { return outputs_.size() < maxPending; });
+}
+
 StringCollector::StringCollector(bool quiet /*=false*/) : maxId_(-1), quiet_(quiet) {}
 
 void StringCollector::add(long sourceId,
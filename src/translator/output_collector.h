@@ -3,6 +3,7 @@
 #include "common/definitions.h"
 #include "common/file_stream.h"
 
+#include <condition_variable>
 #include <mutex>
 #include <iostream>
 #include <map>
@@ -63,13 +64,23 @@ public:
     printing_ = strategy;
   }
 
+  // Print every output as soon as it arrives, 1-best translations prefixed with "<id>\t", n-best lists already
+  // contain the id. Nothing is buffered then.
+  void setUnordered(bool unordered) { unordered_ = unordered; }
+
+  // Blocks until fewer than maxPending outputs wait for an earlier one, for backpressure on the producer of
+  // the batches, which calls this before translating the next batch. Never call it from a translating thread.
+  void waitForPending(size_t maxPending);
+
 protected:
   typedef std::map<long, std::pair<std::string, std::string>> Outputs;
   Outputs outputs_;
   long nextId_;
   UPtr<std::ostream> outStrm_;
   Ptr<PrintingStrategy> printing_;
+  bool unordered_{false};
   std::mutex mutex_;
+  std::condition_variable drained_;
 };
 
 class StringCollector {
@@ -1,5 +1,8 @@
 #include "output_printer.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
 #include <sstream>
 
 namespace marian {
@@ -27,12 +30,130 @@ std::string OutputPrinter::getAlignment(const Hypothesis::PtrType& hyp) {
   }
 }
 
-std::string OutputPrinter::getWordScores(const Hypothesis::PtrType& hyp) {
-  std::ostringstream scores;
-  scores.precision(5);
-  for(const auto& score : hyp->tracebackWordScores())
-    scores << " " << std::fixed << score;
-  return scores.str();
+namespace {
+// printf-style formatting of a number without a temporary string, "%g" matches the default of std::ostream
+void appendNumber(std::string& out, const char* format, double value) {
+  char buffer[64];
+  int length = std::snprintf(buffer, sizeof(buffer), format, value);
+  out.append(buffer, std::min((size_t)length, sizeof(buffer) - 1));
+}
+}  // namespace
+
+void OutputPrinter::appendWordScores(const NBestTraceback& nbest, size_t i, std::string& out) const {
+  for(size_t pos = nbest.offsets[i]; pos < nbest.offsets[i + 1]; ++pos) {
+    out += ' ';
+    appendNumber(out, "%.5f", nbest.wordScores[pos]);
+  }
+}
+
+void OutputPrinter::appendTranslation(const NBestTraceback& nbest, size_t i, std::string& out) const {
+  const Word* begin = nbest.words.data() + nbest.offsets[i];
+  const Word* end   = nbest.words.data() + nbest.offsets[i + 1];
+  if(reverse_) {
+    thread_local Words reversed;
+    reversed.assign(std::reverse_iterator<const Word*>(end), std::reverse_iterator<const Word*>(begin));
+    vocab_->decodeAppend(reversed.data(), reversed.data() + reversed.size(), out);
+  } else {
+    vocab_->decodeAppend(begin, end, out);
+  }
+}
+
+void OutputPrinter::print(Ptr<const History> history, std::string& best1, std::string& bestn) {
+  // one traceback serves the n-best list, the best translation and the binary n-best list
+  const auto nbl = history->nBestTraceback(std::max(nbest_, (size_t)1));
+  ABORT_IF(nbl.size() == 0, "No hypotheses in n-best list??");
+
+  // prepare n-best list output
+  size_t numEntries = nbest_ > 0 ? nbl.size() : 0;
+  for(size_t i = 0; i < numEntries; ++i) {
+    const auto& hypo = nbl.hyps[i];
+
+    bestn += std::to_string(history->getLineNum());
+    bestn += " ||| ";
+    appendTranslation(nbl, i, bestn);
+
+    if(!alignment_.empty()) {
+      bestn += " ||| ";
+      bestn += getAlignment(hypo);
+    }
+
+    if(wordScores_) {
+      bestn += " ||| WordScores=";
+      appendWordScores(nbl, i, bestn);
+    }
+
+    bestn += " |||";
+    if(hypo->getScoreBreakdown().empty()) {
+      bestn += " F0=";
+      appendNumber(bestn, "%g", hypo->getPathScore());
+    } else {
+      for(size_t j = 0; j < hypo->getScoreBreakdown().size(); ++j) {
+        bestn += " F";
+        bestn += std::to_string(j);
+        bestn += "= ";
+        appendNumber(bestn, "%g", hypo->getScoreBreakdown()[j]);
+      }
+    }
+
+    bestn += " ||| ";
+    appendNumber(bestn, "%g", nbl.scores[i]);
+
+    if(i < numEntries - 1)
+      bestn += '\n';
+  }
+
+  if(binary_)
+    binary_->write(history->getLineNum(), nbl);
+
+  appendTranslation(nbl, 0, best1);
+  if(!alignment_.empty()) {
+    best1 += " ||| ";
+    best1 += getAlignment(nbl.hyps[0]);
+  }
+
+  if(wordScores_) {
+    best1 += " ||| WordScores=";
+    appendWordScores(nbl, 0, best1);
+  }
+}
+
+namespace {
+template <typename T>
+void append(std::string& buffer, T value) {
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+}  // namespace
+
+BinaryNBestWriter::BinaryNBestWriter(const std::string& path) : file_(path, std::ios::binary) {
+  ABORT_IF(!file_, "Cannot open {} for the binary n-best lists", path);
+  file_.write("MNBEST", 6);
+  uint16_t version = 1;
+  file_.write(reinterpret_cast<const char*>(&version), sizeof(version));
+}
+
+void BinaryNBestWriter::write(size_t lineNum, const NBestTraceback& nbest) {
+  std::string record;
+  append<uint64_t>(record, lineNum);
+  append<uint32_t>(record, (uint32_t)nbest.size());
+  for(size_t i = 0; i < nbest.size(); ++i) {
+    append<float>(record, nbest.scores[i]);
+    const auto& breakdown = nbest.hyps[i]->getScoreBreakdown();
+    if(breakdown.empty()) { // F0 of the text format
+      append<uint32_t>(record, 1);
+      append<float>(record, nbest.hyps[i]->getPathScore());
+    } else {
+      append<uint32_t>(record, (uint32_t)breakdown.size());
+      record.append(reinterpret_cast<const char*>(breakdown.data()), breakdown.size() * sizeof(float));
+    }
+    append<uint32_t>(record, (uint32_t)nbest.length(i));
+    for(size_t pos = nbest.offsets[i]; pos < nbest.offsets[i + 1]; ++pos)
+      append<uint32_t>(record, (uint32_t)nbest.words[pos].toWordIndex());
+    record.append(reinterpret_cast<const char*>(nbest.wordScores.data() + nbest.offsets[i]), nbest.length(i) * sizeof(float));
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_.write(record.data(), record.size());
+  file_.flush();
 }
 
 }  // namespace marian
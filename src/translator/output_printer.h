@@ -1,5 +1,7 @@
 #pragma once
 
+#include <fstream>
+#include <mutex>
 #include <vector>
 
 #include "common/options.h"
@@ -11,80 +13,52 @@
 
 namespace marian {
 
+/**
+ * Writes n-best lists in a binary format for rerankers, which do not need to parse the text format. The file starts
+ * with the magic bytes "MNBEST" and a uint16 version, followed by one record per sentence in the order the sentences
+ * finish. All numbers are little-endian:
+ *   uint64 line number, uint32 number of entries, and per entry:
+ *     float32 normalized score, uint32 number of features, float32 features (the F0, F1, ... of the text format),
+ *     uint32 length, uint32 word ids [length], float32 word scores [length] (including </s>).
+ */
+class BinaryNBestWriter {
+public:
+  BinaryNBestWriter(const std::string& path);
+
+  void write(size_t lineNum, const NBestTraceback& nbest);
+
+private:
+  std::mutex mutex_;
+  std::ofstream file_;
+};
+
 class OutputPrinter {
 public:
   OutputPrinter(Ptr<const Options> options, Ptr<const Vocab> vocab)
       : vocab_(vocab),
         reverse_(options->get<bool>("right-left")),
         nbest_(options->get<bool>("n-best", false)
-                   ? options->get<size_t>("beam-size")
+                   ? std::max(options->get<size_t>("beam-size"), options->get<size_t>("num-samples", 1))
                    : 0),
         alignment_(options->get<std::string>("alignment", "")),
         alignmentThreshold_(getAlignmentThreshold(alignment_)),
         wordScores_(options->get<bool>("word-scores")) {}
 
+  // Appends the translation to best1 and the n-best list, if any, to bestn. The fields are formatted into the strings
+  // directly, so that buffers reused for many sentences keep their capacity
+  void print(Ptr<const History> history, std::string& best1, std::string& bestn);
+
   template <class OStream>
   void print(Ptr<const History> history, OStream& best1, OStream& bestn) {
-    const auto& nbl = history->nBest(nbest_);
-
-    // prepare n-best list output
-    for(size_t i = 0; i < nbl.size(); ++i) {
-      const auto& result = nbl[i];
-      const auto& hypo = std::get<1>(result);
-      auto words = std::get<0>(result);
-
-      if(reverse_)
-        std::reverse(words.begin(), words.end());
-
-      std::string translation = vocab_->decode(words);
-      bestn << history->getLineNum() << " ||| " << translation;
-
-      if(!alignment_.empty())
-        bestn << " ||| " << getAlignment(hypo);
-
-      if(wordScores_)
-        bestn << " ||| WordScores=" << getWordScores(hypo);
-
-      bestn << " |||";
-      if(hypo->getScoreBreakdown().empty()) {
-        bestn << " F0=" << hypo->getPathScore();
-      } else {
-        for(size_t j = 0; j < hypo->getScoreBreakdown().size(); ++j) {
-          bestn << " F" << j << "= " << hypo->getScoreBreakdown()[j];
-        }
-      }
-
-      float realScore = std::get<2>(result);
-      bestn << " ||| " << realScore;
-
-      if(i < nbl.size() - 1)
-        bestn << std::endl;
-      else
-        bestn << std::flush;
-    }
-
-    auto result = history->top();
-    auto words = std::get<0>(result);
-
-    if(reverse_)
-      std::reverse(words.begin(), words.end());
-
-    std::string translation = vocab_->decode(words);
-
-    best1 << translation;
-    if(!alignment_.empty()) {
-      const auto& hypo = std::get<1>(result);
-      best1 << " ||| " << getAlignment(hypo);
-    }
-
-    if(wordScores_) {
-      const auto& hypo = std::get<1>(result);
-      best1 << " ||| WordScores=" << getWordScores(hypo);
-    }
-
-    best1 << std::flush;
+    std::string best1Str, bestnStr;
+    print(history, best1Str, bestnStr);
+    best1 << best1Str << std::flush;
+    bestn << bestnStr << std::flush;
   }
 
+  // also write every printed n-best list to a binary file, see --n-best-binary
+  void setBinaryWriter(Ptr<BinaryNBestWriter> binary) { binary_ = binary; }
+
 private:
   Ptr<Vocab const> vocab_;
   bool reverse_{false};            // If it is a right-to-left model that needs reversed word order
@@ -92,11 +66,14 @@ private:
   std::string alignment_;          // A non-empty string indicates the type of word alignment
   float alignmentThreshold_{0.f};  // Threshold for converting attention into hard word alignment
   bool wordScores_{false};         // Whether to print word-level scores or not
+  Ptr<BinaryNBestWriter> binary_;  // Writer of --n-best-binary, if any
 
   // Get word alignment pairs or soft alignment
   std::string getAlignment(const Hypothesis::PtrType& hyp);
-  // Get word-level scores
-  std::string getWordScores(const Hypothesis::PtrType& hyp);
+  // Append word-level scores
+  void appendWordScores(const NBestTraceback& nbest, size_t i, std::string& out) const;
+  // Append the decoded words of entry i
+  void appendTranslation(const NBestTraceback& nbest, size_t i, std::string& out) const;
 
   float getAlignmentThreshold(const std::string& str) {
     try {
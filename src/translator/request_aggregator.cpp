@@ -0,0 +1,147 @@
+#include "translator/request_aggregator.h"
+
+#include "common/logging.h"
+#include "common/utils.h"
+
+#include <algorithm>
+
+namespace marian {
+
+RequestAggregator::RequestAggregator(TranslateFn translate, size_t maxWaitMs, size_t maxWords)
+    : translate_(translate), maxWait_(maxWaitMs), maxWords_(maxWords), worker_([this]() { loop(); }) {}
+
+RequestAggregator::~RequestAggregator() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  pendingChanged_.notify_all();
+  worker_.join();
+}
+
+void RequestAggregator::submit(const std::string& input,
+                               DoneCallback done,
+                               LineCallback onLine,
+                               int priority,
+                               Clock::time_point deadline,
+                               ExpiredCallback onExpired) {
+  Request request;
+  // a single trailing newline does not start another sentence
+  auto text = !input.empty() && input.back() == '\n' ? input.substr(0, input.size() - 1) : input;
+  request.lines = utils::split(text, "\n", /*keepEmpty=*/true);
+  if(request.lines.empty())
+    request.lines.push_back("");
+  request.words = 0;
+  for(const auto& line : request.lines)
+    request.words += utils::split(line, " ").size() + 1; // + 1 for </s>
+  request.done = done;
+  request.onLine = onLine;
+  request.priority = priority;
+  request.deadline = deadline;
+  request.onExpired = onExpired;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(pending_.empty())
+      oldestArrival_ = Clock::now();
+    pendingWords_ += request.words;
+    pending_.push_back(std::move(request));
+  }
+  pendingChanged_.notify_one();
+}
+
+size_t RequestAggregator::pendingRequests() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_.size();
+}
+
+size_t RequestAggregator::pendingWords() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pendingWords_;
+}
+
+void RequestAggregator::loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for(;;) {
+    pendingChanged_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+    if(pending_.empty()) // stopped and nothing left to do
+      return;
+
+    pendingChanged_.wait_until(lock, oldestArrival_ + maxWait_, [this]() {
+      return stop_ || (maxWords_ > 0 && pendingWords_ >= maxWords_);
+    });
+
+    // highest priority first, otherwise in order of arrival
+    std::stable_sort(pending_.begin(), pending_.end(), [](const Request& a, const Request& b) {
+      return a.priority > b.priority;
+    });
+
+    // take requests up to the word limit, but at least one, skipping those that are too late already
+    std::vector<Request> requests, expired;
+    size_t words = 0;
+    auto now = Clock::now();
+    while(!pending_.empty() && (requests.empty() || maxWords_ == 0 || words + pending_.front().words <= maxWords_)) {
+      pendingWords_ -= pending_.front().words;
+      if(pending_.front().deadline < now) {
+        expired.push_back(std::move(pending_.front()));
+      } else {
+        words += pending_.front().words;
+        requests.push_back(std::move(pending_.front()));
+      }
+      pending_.pop_front();
+    }
+    // the remaining requests have been waiting already, do not delay them any further
+    if(!pending_.empty())
+      oldestArrival_ = now - maxWait_;
+
+    lock.unlock();
+    for(auto& request : expired)
+      expire(request);
+    if(!requests.empty())
+      process(requests);
+    lock.lock();
+  }
+}
+
+void RequestAggregator::process(std::vector<Request>& requests) {
+  std::vector<std::string> lines;
+  std::vector<size_t> offsets; // [request] -> line number of its first line in the joint input
+  for(const auto& request : requests) {
+    offsets.push_back(lines.size());
+    lines.insert(lines.end(), request.lines.begin(), request.lines.end());
+  }
+  LOG(info, "Translating {} sentences from {} requests as one batch", lines.size(), requests.size());
+
+  // only skip work once nobody is waiting for it anymore
+  auto deadline = Clock::time_point::min();
+  for(const auto& request : requests)
+    deadline = std::max(deadline, request.deadline);
+
+  auto onLine = [&](size_t lineNo, const std::string& translation) {
+    size_t r = std::upper_bound(offsets.begin(), offsets.end(), lineNo) - offsets.begin() - 1;
+    if(requests[r].onLine)
+      requests[r].onLine(lineNo - offsets[r], translation);
+  };
+
+  auto outputs = translate_(utils::join(lines, "\n"), onLine, deadline);
+  outputs.resize(lines.size()); // trailing empty lines may not have produced an output
+
+  auto now = Clock::now();
+  for(size_t r = 0; r < requests.size(); ++r) {
+    if(requests[r].deadline < now) { // parts of the output may be missing
+      expire(requests[r]);
+      continue;
+    }
+    auto begin = outputs.begin() + offsets[r];
+    std::vector<std::string> output(begin, begin + requests[r].lines.size());
+    requests[r].done(utils::join(output, "\n"));
+  }
+}
+
+void RequestAggregator::expire(Request& request) {
+  LOG(warn, "Dropping request with {} sentences, its deadline has passed", request.lines.size());
+  if(request.onExpired)
+    request.onExpired();
+}
+
+}  // namespace marian
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace marian {
+
+/**
+ * Collects translation requests from many concurrent clients, e.g. the connections of
+ * marian_server, and translates them together as one input. A batch is sent off when the oldest
+ * pending request has waited for maxWaitMs milliseconds or when the pending requests contain at
+ * least maxWords source words, whichever comes first. The outputs are split up again per request
+ * and handed to the completion callback of each request from a single worker thread.
+ *
+ * Requests with a higher priority go into the next batch first, requests with the same priority
+ * in order of arrival. Requests whose deadline has passed are dropped before they are translated.
+ */
+class RequestAggregator {
+public:
+  typedef std::chrono::steady_clock Clock;
+  // Called with the line number relative to the request and its translation
+  typedef std::function<void(size_t /*lineNo*/, const std::string& /*translation*/)> LineCallback;
+  // Called with the complete output of a request
+  typedef std::function<void(const std::string& /*output*/)> DoneCallback;
+  // Called instead of DoneCallback if the deadline of a request has passed
+  typedef std::function<void()> ExpiredCallback;
+  // Translates a multi-line input and returns one output per line, may stream out finished lines.
+  // Work that is still pending when the deadline has passed may be skipped.
+  typedef std::function<std::vector<std::string>(const std::string& /*input*/, LineCallback, Clock::time_point /*deadline*/)> TranslateFn;
+
+  RequestAggregator(TranslateFn translate, size_t maxWaitMs, size_t maxWords = 0);
+  RequestAggregator(const RequestAggregator&) = delete;
+  ~RequestAggregator(); // translates all pending requests before returning
+
+  // Queue up a request, returns immediately. onLine and onExpired are optional.
+  void submit(const std::string& input,
+              DoneCallback done,
+              LineCallback onLine = nullptr,
+              int priority = 0,
+              Clock::time_point deadline = Clock::time_point::max(),
+              ExpiredCallback onExpired = nullptr);
+
+  // number of requests and source words waiting for the next batch
+  size_t pendingRequests();
+  size_t pendingWords();
+
+private:
+  struct Request {
+    std::vector<std::string> lines;
+    size_t words;
+    DoneCallback done;
+    LineCallback onLine;
+    int priority;
+    Clock::time_point deadline;
+    ExpiredCallback onExpired;
+  };
+
+  TranslateFn translate_;
+  const std::chrono::milliseconds maxWait_;
+  const size_t maxWords_; // 0 means no limit
+
+  std::mutex mutex_;
+  std::condition_variable pendingChanged_;
+  std::deque<Request> pending_;
+  size_t pendingWords_{0};
+  Clock::time_point oldestArrival_;
+  bool stop_{false};
+
+  std::thread worker_; // started last, after all members above have been initialized
+
+  void loop();
+  void process(std::vector<Request>& requests);
+  static void expire(Request& request);
+};
+
+}  // namespace marian
@@ -0,0 +1,97 @@
+#include "translator/request_capture.h"
+
+#include "3rd_party/yaml-cpp/yaml.h"
+#include "common/logging.h"
+
+#include <fstream>
+
+namespace marian {
+
+RequestCapture::RequestCapture(double thresholdSeconds, const std::string& path)
+    : thresholdSeconds_(thresholdSeconds), path_(path) {
+  ABORT_IF(path_.empty(), "--capture-slow-ms needs a file in --capture-output");
+  LOG(info, "[capture] Requests slower than {:.0f} ms are appended to {}", thresholdSeconds_ * 1000, path_);
+}
+
+void RequestCapture::write(const CapturedRequest& request) {
+  YAML::Emitter out;
+  out << YAML::BeginMap;
+  out << YAML::Key << "seconds" << YAML::Value << request.seconds;
+  out << YAML::Key << "overrides" << YAML::Value << YAML::Literal << request.overrides;
+  out << YAML::Key << "shortlist" << YAML::Value << YAML::Flow << request.shortlist;
+  if(!request.input.empty()) {
+    out << YAML::Key << "input" << YAML::Value << YAML::Literal << request.input;
+  } else {
+    out << YAML::Key << "ids" << YAML::Value << YAML::BeginSeq;
+    for(const auto& stream : request.ids) {
+      out << YAML::BeginSeq;
+      for(const auto& words : stream) {
+        out << YAML::Flow << YAML::BeginSeq;
+        for(auto word : words)
+          out << word.toWordIndex();
+        out << YAML::EndSeq;
+      }
+      out << YAML::EndSeq;
+    }
+    out << YAML::EndSeq;
+  }
+  out << YAML::Key << "batches" << YAML::Value << YAML::BeginSeq;
+  for(const auto& batch : request.batches) {
+    out << YAML::Flow << YAML::BeginMap;
+    out << YAML::Key << "sentences" << YAML::Value << YAML::Flow << batch.sentences;
+    out << YAML::Key << "words" << YAML::Value << batch.words;
+    out << YAML::Key << "seconds" << YAML::Value << batch.seconds;
+    out << YAML::EndMap;
+  }
+  out << YAML::EndSeq;
+  out << YAML::EndMap;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ofstream file(path_, std::ios::app);
+  if(!file)
+    LOG_ONCE(warn, "[capture] Cannot append to {}, slow requests are not captured", path_);
+  else
+    file << "---\n" << out.c_str() << "\n";
+  LOG(info, "[capture] Captured a request of {} batches that took {:.0f} ms", request.batches.size(), request.seconds * 1000);
+}
+
+std::vector<CapturedRequest> RequestCapture::read(const std::string& path) {
+  std::vector<CapturedRequest> requests;
+  for(const auto& node : YAML::LoadAllFromFile(path)) {
+    CapturedRequest request;
+    request.seconds = node["seconds"].as<double>();
+    request.overrides = node["overrides"].as<std::string>("");
+    if(node["shortlist"])
+      request.shortlist = node["shortlist"].as<std::vector<std::string>>();
+    if(node["input"])
+      request.input = node["input"].as<std::string>();
+    for(const auto& stream : node["ids"]) {
+      request.ids.emplace_back();
+      for(const auto& sentence : stream) {
+        Words words;
+        for(const auto& id : sentence)
+          words.push_back(Word::fromWordIndex(id.as<size_t>()));
+        request.ids.back().push_back(words);
+      }
+    }
+    for(const auto& batchNode : node["batches"]) {
+      CapturedRequest::Batch batch;
+      batch.sentences = batchNode["sentences"].as<std::vector<size_t>>();
+      batch.words = batchNode["words"].as<size_t>();
+      batch.seconds = batchNode["seconds"].as<double>();
+      request.batches.push_back(batch);
+    }
+    ABORT_IF(request.input.empty() && request.ids.empty(), "Captured request {} in {} has no input", requests.size(), path);
+    requests.push_back(request);
+  }
+  return requests;
+}
+
+Ptr<RequestCapture> createRequestCapture(Ptr<const Options> options) {
+  size_t thresholdMs = options->get<size_t>("capture-slow-ms", 0);
+  if(thresholdMs == 0)
+    return nullptr;
+  return New<RequestCapture>(thresholdMs / 1000., options->get<std::string>("capture-output"));
+}
+
+}  // namespace marian
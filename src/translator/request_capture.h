@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/options.h"
+#include "data/types.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace marian {
+
+// A request to a translation service that took longer than --capture-slow-ms, see RequestCapture
+struct CapturedRequest {
+  struct Batch {
+    std::vector<size_t> sentences; // line numbers of the input in the batch
+    size_t words{0};               // source words incl. </s>
+    double seconds{0};             // time of the search, 0 if the batch was dropped at the deadline
+  };
+
+  double seconds{0};                   // from the call until it returned
+  std::string overrides;               // YAML options of the call
+  std::vector<std::string> shortlist;  // --shortlist of the service
+  std::string input;                   // of translateLines(), with tab-separated fields for --tsv
+  std::vector<std::vector<Words>> ids; // [stream][sentence] of translateIds(), if input is empty
+  std::vector<Batch> batches;          // in the order of the batch generator
+};
+
+/**
+ * Writes requests that took longer than a threshold to a replay file, which marian-bench --bench-replay decodes again,
+ * e.g. under --profile-nodes. A request is captured with everything that decides how it is decoded: its input, the
+ * options it overrides, the sentences of every batch it was split into and the shortlist of the service, which is
+ * generated from the same source words again. The file is a stream of YAML documents, one per request, that is
+ * appended to.
+ */
+class RequestCapture {
+public:
+  RequestCapture(double thresholdSeconds, const std::string& path);
+
+  bool isSlow(double seconds) const { return seconds >= thresholdSeconds_; }
+  void write(const CapturedRequest& request);
+
+  static std::vector<CapturedRequest> read(const std::string& path);
+
+private:
+  double thresholdSeconds_;
+  std::string path_;
+  std::mutex mutex_;
+};
+
+// Creates the capture requested with --capture-slow-ms, or returns nullptr if there should be none
+Ptr<RequestCapture> createRequestCapture(Ptr<const Options> options);
+
+}  // namespace marian
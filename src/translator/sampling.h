@@ -9,7 +9,7 @@ namespace sampling {
 // However this doesn't matter much for sampling since the gumbel max trick works for unnormalized distributions.
 
 // Prune logits via top-k pruning
-Expr topkPruning(Expr scores, int k, bool normalize = false) {
+inline Expr topkPruning(Expr scores, int k, bool normalize = false) {
   Expr val, idx;
 
   // note, for around k>200 topk is slower on the GPU than sorting and then selecting the top-k values
@@ -23,7 +23,7 @@ Expr topkPruning(Expr scores, int k, bool normalize = false) {
 }
 
 // Prune logits via nucleus pruning
-Expr nucleusPruning(Expr scores, float threshold, bool normalize = false) {
+inline Expr nucleusPruning(Expr scores, float threshold, bool normalize = false) {
   // normalization would make sense here since we compare against a meaningful threshold and
   // we don't know what other manipulations have been done to the logits before, but
   // leaving it to the user for now. We do set it to true in beam_search.cpp
@@ -50,7 +50,7 @@ Expr nucleusPruning(Expr scores, float threshold, bool normalize = false) {
 }
 
 // Prune logits via epsilon pruning
-Expr epsilonPruning(Expr scores, float epsilon, bool normalize = false) {
+inline Expr epsilonPruning(Expr scores, float epsilon, bool normalize = false) {
   // normalization would make sense here since we compare against a meaningful threshold and
   // we don't know what other manipulations have been done to the logits before
   if(normalize)
@@ -70,13 +70,27 @@ Expr epsilonPruning(Expr scores, float epsilon, bool normalize = false) {
   return logEpsScores;
 }
 
-Expr gumbelMaxTrick(Expr scores, float temperature) {
+inline Expr gumbelMaxTrick(Expr scores, float temperature) {
   // scale scores by temperature
   if(temperature != 1.f)
     scores = scores / temperature;
   // add Gumbel noise to all values and renormalize via logsoftmax
   return logsoftmax(scores + constant_like(scores, inits::gumbel()));
 }
+
+// The same as gumbelMaxTrick() after pruning with method, in a single kernel per row for float32 scores. Other types
+// compose the functions above.
+inline Expr truncatedGumbelMaxTrick(Expr scores, SamplingMethod method, float param, float temperature, bool normalize) {
+  if(scores->value_type() == Type::float32)
+    return gumbel_sampling(scores, method, param, temperature, normalize);
+
+  switch(method) {
+    case SamplingMethod::TopK:    return gumbelMaxTrick(topkPruning(scores, (int)param, normalize), temperature);
+    case SamplingMethod::Nucleus: return gumbelMaxTrick(nucleusPruning(scores, param, normalize), temperature);
+    case SamplingMethod::Epsilon: return gumbelMaxTrick(epsilonPruning(scores, param, normalize), temperature);
+    default:                      return gumbelMaxTrick(normalize ? logsoftmax(scores) : scores, temperature);
+  }
+}
 } // namespace sampling
 
 class DistModifier {
@@ -150,7 +164,7 @@ public:
 
         samplingFn_ = [temperature](Expr logits, bool normalize = false) {
           // full softmax sampling is just gumbel trick with temperature 1 and optional prior renormalization
-          return sampling::gumbelMaxTrick(normalize ? logsoftmax(logits) : logits, temperature);
+          return sampling::truncatedGumbelMaxTrick(logits, SamplingMethod::Full, 0.f, temperature, normalize);
         };
       } else if(samplingMethod == "topk") {
         int topk = 10; // number of top-k values to sample from
@@ -164,7 +178,7 @@ public:
 
         samplingFn_ = [topk, temperature](Expr logits, bool normalize = false) {
           // top-k sampling is just gumbel trick with temperature 1 and top-k pruning
-          return sampling::gumbelMaxTrick(sampling::topkPruning(logits, topk, normalize), temperature);
+          return sampling::truncatedGumbelMaxTrick(logits, SamplingMethod::TopK, (float)topk, temperature, normalize);
         };
       } else if(samplingMethod == "nucleus") {
         float threshold = 0.9f; // probability mass threshold of nucleus
@@ -178,7 +192,7 @@ public:
 
         samplingFn_ = [threshold, temperature](Expr logits, bool normalize = false) {
           // nucleus sampling is just gumbel trick with temperature 1 and nucleus pruning
-          return sampling::gumbelMaxTrick(sampling::nucleusPruning(logits, threshold, normalize), temperature);
+          return sampling::truncatedGumbelMaxTrick(logits, SamplingMethod::Nucleus, threshold, temperature, normalize);
         };
       } else if(samplingMethod == "epsilon") {
         float eps = 0.02f; // mimimal probability of sampled token
@@ -192,7 +206,7 @@ public:
 
         samplingFn_ = [eps, temperature](Expr logits, bool normalize = false) {
           // epsilon sampling is just gumbel trick with temperature 1 and epsilon pruning
-          return sampling::gumbelMaxTrick(sampling::epsilonPruning(logits, eps, normalize), temperature);
+          return sampling::truncatedGumbelMaxTrick(logits, SamplingMethod::Epsilon, eps, temperature, normalize);
         };
       } else {
         ABORT("Unknown sampling method: {}", samplingMethod);
@@ -1,8 +1,90 @@
 #include "translator/scorers.h"
 #include "common/io.h"
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+
 namespace marian {
 
+// Replaces the low-rank adapters of the model, if it has any, with those of the adapter files side by side, see
+// --lora-adapters. The loraA [dimIn, rank] of a layer in every file become the columns of one [dimIn, files * rank]
+// parameter, its loraB [rank, dimOut] the rows of one [files * rank, dimOut] parameter, in the order of the files.
+// The rank and scale come from the config of the first file.
+static void loadAdapters(Ptr<Options> modelOptions,
+                         Ptr<io::ModelWeights> modelFile,
+                         const std::vector<std::string>& adapterFiles) {
+  struct Parts {
+    io::Item item;                        // name, type and shape of the part of one file
+    std::vector<std::vector<char>> bytes; // [file] the part without padding
+  };
+  std::map<std::string, Parts> adapters;
+
+  int rank = 0;
+  for(size_t k = 0; k < adapterFiles.size(); ++k) {
+    io::ModelWeights adapterFile(adapterFiles[k]);
+    YAML::Node config = adapterFile.getYamlFromModel("special:model.yml");
+    int fileRank = !config.IsNull() && config["lora-rank"] ? config["lora-rank"].as<int>() : 0;
+    ABORT_IF(fileRank <= 0, "{} has no low-rank adapters, see --lora-rank", adapterFiles[k]);
+    if(k == 0) {
+      rank = fileRank;
+      modelOptions->set("lora-rank", rank);
+      modelOptions->set("lora-alpha", config["lora-alpha"] ? config["lora-alpha"].as<float>() : 16.f);
+    }
+    ABORT_IF(fileRank != rank, "{} has adapters of rank {}, the first --lora-adapters of rank {}",
+             adapterFiles[k], fileRank, rank);
+
+    for(const auto& item : adapterFile.items()) {
+      if(item.name.find("->lora") == std::string::npos)
+        continue;
+      auto& parts = adapters[item.name];
+      if(parts.bytes.empty()) {
+        parts.item.name = item.name;
+        parts.item.shape = item.shape;
+        parts.item.type = item.type;
+      }
+      ABORT_IF(!isFloat(item.type), "Adapter {} of {} is not of a float type", item.name, adapterFiles[k]);
+      ABORT_IF(parts.bytes.size() != k || item.shape != parts.item.shape || item.type != parts.item.type,
+               "Adapter {} of {} does not match that of the other --lora-adapters", item.name, adapterFiles[k]);
+      size_t bytes = item.shape.elements() * sizeOf(item.type);
+      parts.bytes.emplace_back(item.data(), item.data() + bytes);
+    }
+  }
+
+  std::vector<io::Item> stacked;
+  for(auto& named : adapters) {
+    auto& parts = named.second;
+    ABORT_IF(parts.bytes.size() != adapterFiles.size(),
+             "Adapter {} is missing in some of the --lora-adapters", named.first);
+    io::Item item = parts.item;
+    size_t files = parts.bytes.size();
+    size_t partBytes = parts.bytes[0].size();
+    bool isA = named.first.size() >= 5 && named.first.compare(named.first.size() - 5, 5, "loraA") == 0;
+    item.shape.set(isA ? -1 : 0, item.shape[isA ? -1 : 0] * (int)files);
+    item.bytes.resize(std::max(item.size(), files * partBytes));
+    if(isA) { // side by side in the columns
+      size_t rows = parts.item.shape.elements() / parts.item.shape[-1];
+      size_t rowBytes = partBytes / rows;
+      for(size_t r = 0; r < rows; ++r)
+        for(size_t k = 0; k < files; ++k)
+          std::memcpy(item.bytes.data() + (r * files + k) * rowBytes, parts.bytes[k].data() + r * rowBytes, rowBytes);
+    } else { // one after the other in the rows
+      for(size_t k = 0; k < files; ++k)
+        std::memcpy(item.bytes.data() + k * partBytes, parts.bytes[k].data(), partBytes);
+    }
+    stacked.push_back(std::move(item));
+  }
+  ABORT_IF(stacked.empty(), "The --lora-adapters hold no adapter parameters");
+
+  auto& items = modelFile->items();
+  items.erase(std::remove_if(items.begin(), items.end(),
+                             [](const io::Item& item) { return item.name.find("->lora") != std::string::npos; }),
+              items.end());
+  for(auto& item : stacked)
+    items.push_back(std::move(item));
+  LOG(info, "Loaded {} low-rank adapters of rank {} onto the model", adapterFiles.size(), rank);
+}
+
 Ptr<Scorer> scorerByType(const std::string& fname,
                          float weight,
                          Ptr<io::ModelWeights> modelFile,
@@ -62,6 +144,9 @@ std::vector<Ptr<Scorer>> createScorers(Ptr<Options> options, const std::vector<P
       }
     }
 
+    if(options->hasAndNotEmpty("lora-adapters"))
+      loadAdapters(modelOptions, modelFile, options->get<std::vector<std::string>>("lora-adapters"));
+
     scorers.push_back(scorerByType(fname, weights[i], modelFile, modelOptions));
     i++;
   }
@@ -80,4 +165,15 @@ std::vector<Ptr<Scorer>> createScorers(Ptr<Options> options) {
   return createScorers(options, modelFiles);
 }
 
+bool hasParallelEnsemble(Ptr<const Options> options, DeviceId device) {
+  if(!options->get<bool>("parallel-ensemble", false) || options->get<std::vector<std::string>>("models").size() < 2)
+    return false;
+  if(device.type != DeviceType::cpu) {
+    // the members would share the stream of the device, hence not overlap
+    LOG_ONCE(warn, "[ensemble] --parallel-ensemble only applies to CPU devices, the ensemble shares one graph");
+    return false;
+  }
+  return true;
+}
+
 }  // namespace marian
@@ -5,6 +5,8 @@
 #include "data/shortlist.h"
 #include "models/model_factory.h"
 
+#include "3rd_party/threadpool.h"
+
 namespace marian {
 
 class ScorerState {
@@ -14,6 +16,11 @@ public:
   virtual Logits getLogProbs() const = 0;
 
   virtual void blacklist(Expr /*totalCosts*/, Ptr<data::CorpusBatch> /*batch*/){};
+
+  // keep only the first `length` target positions, see SpeculativeSearch
+  virtual Ptr<ScorerState> truncate(size_t /*length*/) const {
+    ABORT("This scorer state cannot be truncated");
+  }
 };
 
 class Scorer {
@@ -21,6 +28,9 @@ protected:
   std::string name_;
   float weight_;
 
+  Ptr<ExpressionGraph> graph_; // of a member of a parallel ensemble, nullptr if it shares the graph of the search
+  UPtr<ThreadPool> thread_;    // runs the steps on graph_
+
 public:
   Scorer(const std::string& name, float weight)
       : name_(name), weight_(weight) {}
@@ -42,12 +52,40 @@ public:
                                 int beamSize)
       = 0;
 
+  // advance by several target positions at once with beam size 1, see SpeculativeSearch
+  virtual Ptr<ScorerState> stepTokens(Ptr<ExpressionGraph>,
+                                      Ptr<ScorerState>,
+                                      const Words& /*words*/, // [step * dimBatch + batchIndex]
+                                      int /*dimBatch*/,
+                                      int /*dimSteps*/) {
+    ABORT("Scorer {} does not support multi-token steps", name_);
+  }
+
   virtual void init(Ptr<ExpressionGraph>) {}
 
+  // Members of a parallel ensemble run on a graph and a thread of their own, see --parallel-ensemble. Their steps are
+  // built and forwarded on that thread while the search forwards the graph of the other scorers.
+  void setOwnGraph(Ptr<ExpressionGraph> graph) {
+    graph_ = graph;
+    thread_.reset(new ThreadPool(1));
+  }
+  bool hasOwnGraph() const { return graph_ != nullptr; }
+  // the graph to pass to the other functions, given the graph of the search
+  Ptr<ExpressionGraph> graph(Ptr<ExpressionGraph> searchGraph) const { return graph_ ? graph_ : searchGraph; }
+
+  template <class F>
+  std::future<typename std::result_of<F()>::type> runOnOwnThread(F&& f) {
+    return thread_->enqueue(std::forward<F>(f));
+  }
+
   virtual void setShortlistGenerator(Ptr<const data::ShortlistGenerator> /*shortlistGenerator*/){};
   virtual Ptr<data::Shortlist> getShortlist() { return nullptr; };
 
   virtual std::vector<float> getAlignment() { return {}; };
+
+  // The k largest attention probabilities of the last step and their source positions, [beam depth, k, batch size, 1]
+  // each. Must be called before the step is forwarded, nullptr if there are no alignments.
+  virtual Expr2 getTopAlignment(int /*k*/) { return Expr2(); }
 };
 
 class ScorerWrapperState : public ScorerState {
@@ -65,6 +103,10 @@ public:
   virtual void blacklist(Expr totalCosts, Ptr<data::CorpusBatch> batch) override {
     state_->blacklist(totalCosts, batch);
   }
+
+  virtual Ptr<ScorerState> truncate(size_t length) const override {
+    return New<ScorerWrapperState>(state_->truncate(length));
+  }
 };
 
 // class to wrap IEncoderDecoder in a Scorer interface
@@ -114,6 +156,17 @@ public:
     return New<ScorerWrapperState>(newState);
   }
 
+  virtual Ptr<ScorerState> stepTokens(Ptr<ExpressionGraph> graph,
+                                      Ptr<ScorerState> state,
+                                      const Words& words,
+                                      int dimBatch,
+                                      int dimSteps) override {
+    graph->switchParams(getName());
+    auto wrapperState = std::dynamic_pointer_cast<ScorerWrapperState>(state);
+    auto newState = encdec_->stepTokens(graph, wrapperState->getState(), words, dimBatch, dimSteps);
+    return New<ScorerWrapperState>(newState);
+  }
+
   virtual void setShortlistGenerator(
       Ptr<const data::ShortlistGenerator> shortlistGenerator) override {
     encdec_->setShortlistGenerator(shortlistGenerator);
@@ -128,9 +181,20 @@ public:
     // This makes as copy. @TODO: It should be OK to return this as a const&.
     return encdec_->getAlignment().front(); // [beam depth * max src length * batch size]
   }
+
+  virtual Expr2 getTopAlignment(int k) override {
+    auto alignments = encdec_->getAlignmentNodes();
+    if(alignments.empty())
+      return Expr2();
+    auto alignment = alignments.front(); // [beam depth, max src length, batch size, 1]
+    return topk(alignment, std::min(k, alignment->shape()[-3]), /*axis=*/-3);
+  }
 };
 
 std::vector<Ptr<Scorer>> createScorers(Ptr<Options> options);
 std::vector<Ptr<Scorer>> createScorers(Ptr<Options> options, const std::vector<Ptr<io::ModelWeights>>& models);
 
+// Whether the ensemble members after the first run on graphs and threads of their own on device, see --parallel-ensemble
+bool hasParallelEnsemble(Ptr<const Options> options, DeviceId device);
+
 }  // namespace marian
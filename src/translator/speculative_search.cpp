@@ -0,0 +1,195 @@
+#include "translator/speculative_search.h"
+
+#include "data/factored_vocab.h"
+#include "data/shortlist.h"
+#include "translator/helpers.h"
+
+namespace marian {
+
+SpeculativeSearch::SpeculativeSearch(Ptr<Options> options,
+                                     const std::vector<Ptr<Scorer>>& scorers,
+                                     const Ptr<const Vocab> trgVocab)
+    : options_(options), scorers_(scorers),
+      draftSteps_(options_->get<size_t>("speculative-decoding")), trgVocab_(trgVocab) {
+  ABORT_IF(draftSteps_ == 0, "Speculative decoding requires --speculative-decoding > 0");
+  ABORT_IF(scorers_.size() < 2,
+           "Speculative decoding requires at least two models, the last one given with --models is the draft model");
+  ABORT_IF(options_->get<bool>("n-best") || options_->hasAndNotEmpty("alignment"),
+           "Speculative decoding does not produce n-best lists or alignments");
+  ABORT_IF(options_->hasAndNotEmpty("output-sampling"),
+           "Speculative decoding is greedy and cannot be combined with --output-sampling");
+
+  auto factoredVocab = trgVocab_->tryAs<FactoredVocab>();
+  ABORT_IF(factoredVocab && factoredVocab->getNumGroups() > 1,
+           "Speculative decoding does not support factored vocabularies");
+
+  if(options_->get<size_t>("beam-size") > 1)
+    LOG_ONCE(info, "[speculative] Decoding greedily, --beam-size is ignored");
+}
+
+Expr SpeculativeSearch::verifierScores(const std::vector<Ptr<ScorerState>>& states) const {
+  Expr scores;
+  for(size_t i = 0; i + 1 < scorers_.size(); ++i) {
+    auto logProbs = scorers_[i]->getWeight() * states[i]->getLogProbs().getLogits();
+    scores = scores ? scores + logProbs : logProbs;
+  }
+  return cast(scores, Type::float32);
+}
+
+Words SpeculativeSearch::toWords(const std::vector<IndexType>& indices,
+                                 Ptr<data::Shortlist> shortlist,
+                                 int dimBatch) const {
+  Words words;
+  words.reserve(indices.size());
+  for(size_t i = 0; i < indices.size(); ++i) {
+    WordIndex wordIdx = indices[i];
+    if(shortlist)
+      wordIdx = shortlist->reverseMap(/*beamIdx=*/0, /*batchIdx=*/(int)(i % dimBatch), wordIdx);
+    words.push_back(Word::fromWordIndex(wordIdx));
+  }
+  return words;
+}
+
+Histories SpeculativeSearch::search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch) {
+  const int dimBatch = (int)batch->size();
+  const int dimSteps = (int)draftSteps_;
+  const auto trgEosId = trgVocab_->getEosId();
+  const size_t maxLength = (size_t)(options_->get<float>("max-length-factor") * batch->front()->batchWidth());
+
+  auto draft = scorers_.back();
+  const size_t numVerifiers = scorers_.size() - 1;
+
+  for(auto scorer : scorers_)
+    scorer->clear(graph);
+
+  auto hypothesisPool = New<HypothesisPool>();
+
+  Histories histories(dimBatch);
+  for(int i = 0; i < dimBatch; ++i) {
+    size_t sentId = batch->getSentenceIds()[i];
+    histories[i] = New<History>(sentId,
+                                options_->get<float>("normalize"),
+                                options_->get<float>("word-penalty"));
+    histories[i]->setHypothesisPool(hypothesisPool);
+  }
+
+  std::vector<Ptr<ScorerState>> states;
+  for(auto scorer : scorers_)
+    states.push_back(scorer->startState(graph, batch));
+
+  Beams beams(dimBatch, Beam(1, hypothesisPool->New()));
+  std::vector<bool> finished(dimBatch, false);
+  std::vector<bool> emptyBatchEntries(dimBatch, false); // source consists of <EOS> only
+  const auto& srcEosId = batch->front()->vocab()->getEosId();
+  for(int b = 0; b < dimBatch; ++b) {
+    histories[b]->add(beams[b], trgEosId);
+    emptyBatchEntries[b] = batch->front()->data()[b] == srcEosId;
+  }
+
+  std::vector<IndexType> batchIndices(dimBatch);
+  std::iota(batchIndices.begin(), batchIndices.end(), 0);
+
+  // append the verifier's choices for numSteps positions to the histories of unfinished sentences,
+  // returns the last committed word per sentence (<EOS> for sentences that were already finished)
+  auto commit = [&](const std::vector<IndexType>& indices, const std::vector<float>& scores, size_t numSteps) {
+    auto words = toWords(indices, scorers_[0]->getShortlist(), dimBatch);
+    Words lastWords(dimBatch, trgEosId);
+    for(int b = 0; b < dimBatch; ++b) {
+      for(size_t j = 0; j < numSteps && !finished[b]; ++j) {
+        size_t i = j * dimBatch + b;
+        auto word = emptyBatchEntries[b] ? trgEosId : words[i];
+        const auto& prevHyp = beams[b][0];
+        float pathScore = emptyBatchEntries[b] ? 0.f : prevHyp->getPathScore() + scores[i];
+        beams[b] = Beam(1, hypothesisPool->New(prevHyp, word, /*prevBeamHypIdx=*/0, pathScore));
+        finished[b] = word == trgEosId || histories[b]->size() >= maxLength;
+        histories[b]->add(beams[b], trgEosId, /*last=*/finished[b]);
+        if(finished[b] && finishedCallback_)
+          finishedCallback_(histories[b]);
+        lastWords[b] = word;
+      }
+    }
+    return lastWords;
+  };
+
+  // first step, all models start from the empty history
+  for(size_t i = 0; i < scorers_.size(); ++i)
+    states[i] = scorers_[i]->step(graph, states[i], /*hypIndices=*/{}, /*words=*/{}, batchIndices, /*beamSize=*/1);
+
+  auto firstScores = verifierScores(states);
+  if(auto mask = suppressionMask(graph, options_, trgVocab_, scorers_[0]->getShortlist(), firstScores->shape()[-1]))
+    firstScores = firstScores + mask;
+  auto first = argmax(firstScores, -1);
+  graph->forward();
+
+  std::vector<IndexType> indices; std::vector<float> values;
+  get<1>(first)->val()->get(indices);
+  get<0>(first)->val()->get(values);
+  Words pending = commit(indices, values, 1); // verifier's last choice, not yet consumed by any model
+  size_t position = 1;
+
+  Expr draftMask, verifierMask;
+  while(std::find(finished.begin(), finished.end(), false) != finished.end()) {
+    // draft model proposes dimSteps tokens greedily, starting from the pending token
+    Words block;      // [dimSteps, dimBatch] verifier input: pending token followed by the first proposals
+    Words proposals;  // [dimSteps, dimBatch]
+    Words draftWords = pending;
+    for(int j = 0; j < dimSteps; ++j) {
+      block.insert(block.end(), draftWords.begin(), draftWords.end());
+
+      states.back() = draft->step(graph, states.back(), /*hypIndices=*/{}, draftWords, batchIndices, /*beamSize=*/1);
+      auto draftScores = cast(states.back()->getLogProbs().getLogits(), Type::float32);
+      if(!draftMask)
+        draftMask = suppressionMask(graph, options_, trgVocab_, draft->getShortlist(), draftScores->shape()[-1]);
+      if(draftMask)
+        draftScores = draftScores + draftMask;
+      auto draftBest = get<1>(argmax(draftScores, -1));
+      graph->forwardNext();
+
+      std::vector<IndexType> draftIndices;
+      draftBest->val()->get(draftIndices);
+      draftWords = toWords(draftIndices, draft->getShortlist(), dimBatch);
+      for(int b = 0; b < dimBatch; ++b)
+        if(finished[b])
+          draftWords[b] = trgEosId;
+      proposals.insert(proposals.end(), draftWords.begin(), draftWords.end());
+    }
+
+    // verifier scores all proposals at once
+    for(size_t i = 0; i < numVerifiers; ++i)
+      states[i] = scorers_[i]->stepTokens(graph, states[i], block, dimBatch, dimSteps);
+    auto scores = verifierScores(states);
+    if(!verifierMask)
+      verifierMask = suppressionMask(graph, options_, trgVocab_, scorers_[0]->getShortlist(), scores->shape()[-1]);
+    if(verifierMask)
+      scores = scores + verifierMask;
+    auto best = argmax(scores, -1); // [1, dimSteps, dimBatch, 1]
+    graph->forwardNext();
+
+    get<1>(best)->val()->get(indices);
+    get<0>(best)->val()->get(values);
+    auto choices = toWords(indices, scorers_[0]->getShortlist(), dimBatch);
+
+    // accept the matching prefix plus the verifier's next choice, same for all unfinished sentences
+    size_t numAccepted = dimSteps;
+    for(int b = 0; b < dimBatch; ++b) {
+      if(finished[b])
+        continue;
+      size_t matched = 0;
+      while(matched < numAccepted && proposals[matched * dimBatch + b] == choices[matched * dimBatch + b])
+        ++matched;
+      numAccepted = std::min(numAccepted, matched + 1);
+    }
+
+    pending = commit(indices, values, numAccepted);
+    position += numAccepted;
+
+    // roll back positions that were computed for rejected proposals
+    if(numAccepted < dimSteps)
+      for(auto& state : states)
+        state = state->truncate(position);
+  }
+
+  return histories; // [dimBatch][t][1 hyp]
+}
+
+}  // namespace marian
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "marian.h"
+#include "translator/history.h"
+#include "translator/scorers.h"
+#include "translator/terminology.h"
+
+namespace marian {
+
+/**
+ * Greedy speculative decoding. The last model given with --models is a small draft model that
+ * proposes --speculative-decoding k tokens one at a time. All remaining models form the
+ * (possibly ensembled) verifier that scores the k proposals in a single multi-token step.
+ * The longest prefix of proposals that matches the verifier's own greedy choices is accepted
+ * together with the verifier's next token; rejected positions are rolled back in both decoder
+ * states. The output is identical to greedy decoding (--beam-size 1) with the verifier models.
+ *
+ * All sentences of a batch advance by the same number of tokens per round, hence the number of
+ * accepted tokens is the minimum over the still unfinished sentences.
+ */
+class SpeculativeSearch {
+private:
+  Ptr<Options> options_;
+  std::vector<Ptr<Scorer>> scorers_; // [verifier..., draft]
+  size_t draftSteps_;
+  Ptr<const Vocab> trgVocab_;
+  FinishedHistoryCallback finishedCallback_;
+
+  // weighted sum of the verifier log-probabilities, [1, dimSteps, dimBatch, dimVocab]
+  Expr verifierScores(const std::vector<Ptr<ScorerState>>& states) const;
+
+  // map (shortlisted) argmax indices [step * dimBatch + batchIdx] back to words
+  Words toWords(const std::vector<IndexType>& indices, Ptr<data::Shortlist> shortlist, int dimBatch) const;
+
+public:
+  SpeculativeSearch(Ptr<Options> options, const std::vector<Ptr<Scorer>>& scorers, const Ptr<const Vocab> trgVocab);
+
+  // stream out every sentence once it has finished instead of waiting for the whole batch
+  void setFinishedCallback(FinishedHistoryCallback callback) { finishedCallback_ = callback; }
+
+  // the draft model proposes words without constraints, hence there are none
+  void setTerminology(Ptr<const Terminology> terminology) {
+    ABORT_IF(terminology, "Speculative decoding does not support --terminology");
+  }
+
+  // main decoding function
+  Histories search(Ptr<ExpressionGraph> graph, Ptr<data::CorpusBatch> batch);
+};
+
+}  // namespace marian
@@ -0,0 +1,120 @@
+#include "translator/terminology.h"
+
+#include "common/file_stream.h"
+#include "common/logging.h"
+#include "common/utils.h"
+
+namespace marian {
+
+Terminology::Terminology(const std::string& path, Ptr<const Vocab> srcVocab, Ptr<const Vocab> trgVocab) {
+  io::InputFileStream in(path);
+  std::string line;
+  std::vector<std::string> fields;
+  for(size_t lineNo = 1; io::getline(in, line); ++lineNo) {
+    if(line.empty())
+      continue;
+    utils::splitTsv(line, fields, 2);
+    Term term{srcVocab->encode(fields[0], /*addEOS=*/false, /*inference=*/true),
+              trgVocab->encode(fields[1], /*addEOS=*/false, /*inference=*/true)};
+    ABORT_IF(term.source.empty() || term.target.empty(), "Empty phrase in line {} of terminology {}", lineNo, path);
+    termsByFirstWord_[term.source.front().toWordIndex()].push_back(terms_.size());
+    terms_.push_back(term);
+  }
+  LOG(info, "[terminology] Loaded {} terms from {}", terms_.size(), path);
+}
+
+std::vector<Words> Terminology::constraints(Ptr<data::CorpusBatch> batch, size_t batchIdx) const {
+  const auto& subBatch = batch->front();
+  size_t dimBatch = subBatch->batchSize();
+  size_t width = subBatch->batchWidth();
+
+  // the source sentence without padding, the data is [width, dimBatch]
+  Words source;
+  for(size_t pos = 0; pos < width; ++pos)
+    if(subBatch->mask()[pos * dimBatch + batchIdx] != 0)
+      source.push_back(subBatch->data()[pos * dimBatch + batchIdx]);
+
+  std::vector<Words> constraints;
+  std::vector<bool> found(terms_.size(), false);
+  for(size_t pos = 0; pos < source.size(); ++pos) {
+    auto candidates = termsByFirstWord_.find(source[pos].toWordIndex());
+    if(candidates == termsByFirstWord_.end())
+      continue;
+    for(auto termIdx : candidates->second) {
+      const auto& term = terms_[termIdx];
+      if(found[termIdx] || pos + term.source.size() > source.size()
+         || !std::equal(term.source.begin(), term.source.end(), source.begin() + pos))
+        continue;
+      found[termIdx] = true;
+      if(constraints.size() == MAX_CONSTRAINTS) {
+        LOG_ONCE(warn, "[terminology] Using only the first {} terms of a sentence", MAX_CONSTRAINTS);
+        return constraints;
+      }
+      constraints.push_back(term.target);
+    }
+  }
+  return constraints;
+}
+
+SentenceConstraints::SentenceConstraints(const std::vector<Words>& phrases) : phrases_(phrases) {
+  for(size_t i = 0; i < phrases_.size(); ++i) {
+    numWords_ += phrases_[i].size();
+    allMet_ |= uint64_t(1) << i;
+  }
+}
+
+ConstraintState SentenceConstraints::advance(const ConstraintState& state, Word word) const {
+  ConstraintState next = state;
+  if(next.active >= 0) {
+    const auto& phrase = phrases_[next.active];
+    if(phrase[next.position] == word) {
+      if(++next.position == phrase.size()) {
+        next.met |= uint64_t(1) << next.active;
+        next.active = -1;
+        next.position = 0;
+      }
+      return next;
+    }
+    // the phrase was abandoned, the word may start another one
+    next.active = -1;
+    next.position = 0;
+  }
+  for(size_t i = 0; i < phrases_.size(); ++i) {
+    if((next.met >> i & 1) || phrases_[i].front() != word)
+      continue;
+    if(phrases_[i].size() == 1) {
+      next.met |= uint64_t(1) << i;
+    } else {
+      next.active = (int)i;
+      next.position = 1;
+    }
+    break;
+  }
+  return next;
+}
+
+void SentenceConstraints::nextWords(const ConstraintState& state, std::vector<WordIndex>& words) const {
+  if(state.active >= 0) {
+    words.push_back(phrases_[state.active][state.position].toWordIndex());
+    return;
+  }
+  for(size_t i = 0; i < phrases_.size(); ++i)
+    if(!(state.met >> i & 1))
+      words.push_back(phrases_[i].front().toWordIndex());
+}
+
+size_t SentenceConstraints::progress(const ConstraintState& state) const {
+  size_t produced = state.position;
+  for(size_t i = 0; i < phrases_.size(); ++i)
+    if(state.met >> i & 1)
+      produced += phrases_[i].size();
+  return produced;
+}
+
+Ptr<const Terminology> createTerminology(Ptr<const Options> options, Ptr<const Vocab> srcVocab, Ptr<const Vocab> trgVocab) {
+  if(!options->hasAndNotEmpty("terminology"))
+    return nullptr;
+  return New<Terminology>(options->get<std::string>("terminology"), srcVocab, trgVocab);
+}
+
+}  // namespace marian
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/options.h"
+#include "data/corpus_base.h"
+#include "data/vocab.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace marian {
+
+/**
+ * Target phrases that translations must contain, see --terminology. Every line of the file is a source and a target
+ * phrase separated by a tab, both are encoded with the vocabularies of the model. Whenever the ids of a source phrase
+ * occur in a source sentence, the target phrase becomes a constraint of its translation, which BeamSearch decodes
+ * with a beam divided into banks by the number of constraint words produced.
+ */
+class Terminology {
+public:
+  static const size_t MAX_CONSTRAINTS = 64; // per sentence, the met constraints of a hypothesis are a bit mask
+
+  Terminology(const std::string& path, Ptr<const Vocab> srcVocab, Ptr<const Vocab> trgVocab);
+
+  // target phrases of the terms in the source of batch entry batchIdx, in the order of their first occurrence
+  std::vector<Words> constraints(Ptr<data::CorpusBatch> batch, size_t batchIdx) const;
+
+  size_t size() const { return terms_.size(); }
+
+private:
+  struct Term {
+    Words source;
+    Words target;
+  };
+  std::vector<Term> terms_;
+  std::unordered_map<WordIndex, std::vector<size_t>> termsByFirstWord_; // first source word -> index into terms_
+};
+
+// Progress of a hypothesis on the constraints of its sentence
+struct ConstraintState {
+  uint64_t met{0};     // bit i is set once constraint i has been produced
+  int active{-1};      // constraint whose target phrase is being produced, -1 if none
+  size_t position{0};  // words of the active constraint produced so far
+};
+
+// The constraints of one sentence and the transitions of their states
+class SentenceConstraints {
+public:
+  SentenceConstraints() {}
+  SentenceConstraints(const std::vector<Words>& phrases);
+
+  bool empty() const { return phrases_.empty(); }
+  size_t numWords() const { return numWords_; } // of all constraints, hence the number of banks minus 1
+
+  // the state after a hypothesis in state produced word
+  ConstraintState advance(const ConstraintState& state, Word word) const;
+
+  // words that continue the active constraint or start an unmet one, appended to words
+  void nextWords(const ConstraintState& state, std::vector<WordIndex>& words) const;
+
+  // number of constraint words produced, the bank of a hypothesis
+  size_t progress(const ConstraintState& state) const;
+
+  bool allMet(const ConstraintState& state) const { return state.met == allMet_; }
+
+private:
+  std::vector<Words> phrases_;
+  size_t numWords_{0};
+  uint64_t allMet_{0};
+};
+
+// Loads --terminology, or returns nullptr if there is none
+Ptr<const Terminology> createTerminology(Ptr<const Options> options, Ptr<const Vocab> srcVocab, Ptr<const Vocab> trgVocab);
+
+}  // namespace marian
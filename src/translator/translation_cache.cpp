@@ -0,0 +1,121 @@
+#include "translator/translation_cache.h"
+
+namespace marian {
+
+namespace {
+void appendWords(std::string& key, const Words& words) {
+  for(auto word : words) {
+    auto id = (uint32_t)word.toWordIndex();
+    key.append((const char*)&id, sizeof(id));
+  }
+  key.push_back('\n'); // stream separator
+}
+}  // namespace
+
+TranslationCache::TranslationCache(size_t maxBytes, size_t numShards)
+    : maxBytesPerShard_(maxBytes / std::max<size_t>(numShards, 1)) {
+  for(size_t i = 0; i < std::max<size_t>(numShards, 1); ++i)
+    shards_.emplace_back(new Shard());
+}
+
+std::string TranslationCache::key(const data::SentenceTuple& tuple, const std::string& prefix) {
+  std::string key = prefix;
+  for(size_t i = 0; i < tuple.size(); ++i)
+    appendWords(key, tuple[i]);
+  return key;
+}
+
+std::string TranslationCache::key(Ptr<data::CorpusBatch> batch, size_t batchIdx, const std::string& prefix) {
+  std::string key = prefix;
+  for(size_t i = 0; i < batch->sets(); ++i) {
+    auto subBatch = (*batch)[i];
+    Words words;
+    for(size_t j = 0; j < subBatch->batchWidth(); ++j) {
+      size_t k = subBatch->locate(batchIdx, /*wordPos=*/j);
+      if(subBatch->mask()[k] != 0)
+        words.push_back(subBatch->data()[k]);
+    }
+    appendWords(key, words);
+  }
+  return key;
+}
+
+size_t TranslationCache::bytes(const std::string& key, const Value& value) {
+  // two copies of the key (list and index) plus rough per-entry overhead of the containers
+  return 2 * key.size() + value.first.size() + value.second.size() + 128;
+}
+
+bool TranslationCache::get(const std::string& key, Value& value) {
+  auto& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(key);
+  if(it == s.index.end()) {
+    misses_++;
+    return false;
+  }
+  s.entries.splice(s.entries.begin(), s.entries, it->second); // mark as most recently used
+  value = it->second->second;
+  hits_++;
+  return true;
+}
+
+void TranslationCache::put(const std::string& key, const Value& value) {
+  size_t entryBytes = bytes(key, value);
+  if(entryBytes > maxBytesPerShard_)
+    return;
+
+  auto& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if(s.index.find(key) != s.index.end()) // another worker translated the same sentence
+    return;
+
+  s.entries.emplace_front(key, value);
+  s.index[key] = s.entries.begin();
+  s.bytes += entryBytes;
+
+  while(s.bytes > maxBytesPerShard_) { // evict least recently used entries
+    auto& last = s.entries.back();
+    s.bytes -= bytes(last.first, last.second);
+    s.index.erase(last.first);
+    s.entries.pop_back();
+  }
+}
+
+size_t TranslationCache::sizeInBytes() const {
+  size_t bytes = 0;
+  for(auto& s : shards_) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    bytes += s->bytes;
+  }
+  return bytes;
+}
+
+void TranslationCache::logStats() const {
+  size_t hits = hits_, misses = misses_;
+  size_t bytes = 0, entries = 0;
+  for(auto& s : shards_) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    bytes += s->bytes;
+    entries += s->entries.size();
+  }
+  LOG(info, "[cache] {} hits, {} misses, hit rate {:.2f}%, {} entries using {:.2f} MB",
+      hits, misses, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0,
+      entries, bytes / (1024.0 * 1024.0));
+}
+
+Ptr<TranslationCache> createTranslationCache(Ptr<const Options> options) {
+  size_t cacheMB = options->get<size_t>("translation-cache", 0);
+  if(cacheMB == 0)
+    return nullptr;
+  if(options->hasAndNotEmpty("output-sampling")) { // repeated sentences are not meant to get the same output
+    LOG(warn, "[cache] Translation cache is disabled with --output-sampling");
+    return nullptr;
+  }
+  if(options->hasAndNotEmpty("n-best-binary")) { // cached sentences would be missing from the binary n-best lists
+    LOG(warn, "[cache] Translation cache is disabled with --n-best-binary");
+    return nullptr;
+  }
+  return New<TranslationCache>(cacheMB * 1024 * 1024);
+}
+
+}  // namespace marian
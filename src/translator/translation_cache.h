@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common/definitions.h"
+#include "common/options.h"
+#include "data/corpus_base.h"
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace marian {
+
+/**
+ * Memory-bounded LRU cache of finished translations, see --translation-cache. The key space is
+ * split over independently locked shards, so that worker threads rarely contend for a lock.
+ * Sentences are identified by the word ids of all their streams, which implicitly normalizes
+ * white space and everything else the vocabularies do not distinguish. Decoding options that
+ * change the output have to be added to the key by the caller via a prefix.
+ */
+class TranslationCache {
+public:
+  typedef std::pair<std::string, std::string> Value; // (best translation, n-best list)
+
+  TranslationCache(size_t maxBytes, size_t numShards = 16);
+
+  // cache key of a sentence as read from the corpus
+  static std::string key(const data::SentenceTuple& tuple, const std::string& prefix = "");
+  // cache key of the sentence at batchIdx, equal to key(tuple) of the tuple it was created from
+  static std::string key(Ptr<data::CorpusBatch> batch, size_t batchIdx, const std::string& prefix = "");
+
+  bool get(const std::string& key, Value& value);
+  void put(const std::string& key, const Value& value);
+
+  void logStats() const;
+
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+  size_t sizeInBytes() const; // memory currently taken by all entries
+
+private:
+  struct Shard {
+    typedef std::list<std::pair<std::string, Value>> Entries; // most recently used first
+    std::mutex mutex;
+    Entries entries;
+    std::unordered_map<std::string, Entries::iterator> index;
+    size_t bytes{0};
+  };
+
+  const size_t maxBytesPerShard_;
+  std::vector<UPtr<Shard>> shards_;
+
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+
+  Shard& shard(const std::string& key) { return *shards_[std::hash<std::string>()(key) % shards_.size()]; }
+  static size_t bytes(const std::string& key, const Value& value);
+};
+
+// Creates the cache requested with --translation-cache, or returns nullptr if there should be none
+Ptr<TranslationCache> createTranslationCache(Ptr<const Options> options);
+
+}  // namespace marian
@@ -1,26 +1,73 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <string>
 
 #include "data/batch_generator.h"
 #include "data/corpus.h"
 #include "data/shortlist.h"
+#include "data/target_length_predictor.h"
 #include "data/text_input.h"
 
+#include "graph/auto_tuner.h"
+
+#include "common/metrics.h"
+#include "common/numa.h"
 #include "common/scheduling_parameter.h"
 #include "common/timer.h"
+#include "common/tracing.h"
 
 #include "3rd_party/threadpool.h"
 
 #include "translator/history.h"
 #include "translator/output_collector.h"
 #include "translator/output_printer.h"
+#include "translator/request_capture.h"
+#include "translator/terminology.h"
+#include "translator/translation_cache.h"
 
+#include "layers/lsh.h"
 #include "models/model_task.h"
 #include "translator/scorers.h"
 
 namespace marian {
 
+// A graph of a translation worker on device, configured by the options of the translator
+inline Ptr<ExpressionGraph> createTranslationGraph(Ptr<Options> options, DeviceId device,
+                                                  Ptr<AutoTunerCache> autoTunerCache) {
+  auto graph = New<ExpressionGraph>(true);
+
+  auto precision = options->get<std::vector<std::string>>("precision", {"float32"});
+  graph->setDefaultElementType(typeFromString(precision[0])); // only use first type, used for parameter type in graph
+  graph->setDevice(device);
+  if (device.type == DeviceType::cpu) {
+    graph->getBackend()->setOptimized(options->get<bool>("optimize"));
+    graph->getBackend()->setGemmType(options->get<std::string>("gemm-type"));
+    graph->getBackend()->setQuantizeRange(options->get<float>("quantize-range"));
+    graph->getBackend()->setSparseGemm(options->get<std::string>("sparse-gemm", ""));
+    graph->getBackend()->setIntraOpThreads(options->get<size_t>("cpu-intra-op-threads", 1));
+    graph->getBackend()->setAutoTunerCache(autoTunerCache);
+    graph->setSharedValues(options->get<bool>("shared-cpu-parameters", false));
+  } else {
+    graph->getBackend()->setCudaGraphs(options->get<size_t>("cuda-graphs", 0));
+    graph->getBackend()->setFp8(options->get<size_t>("fp8", 0));
+    graph->setStagedLoading(options->get<size_t>("staged-loading", 0) * 1024 * 1024);
+  }
+  graph->setAllocatorSizeClasses(options->get<bool>("allocator-size-classes", false));
+  graph->setMemoryPlans(options->get<size_t>("memory-plans", 0));
+  graph->setGraphSimplification(options->get<bool>("simplify-graph", false));
+  graph->setElementwiseFusion(options->get<bool>("fuse-elementwise", false));
+  graph->reserveWorkspaceMB(options->get<int>("workspace"));
+  graph->setMemoryProfile(options->get<std::string>("memory-profile", ""),
+                          options->get<size_t>("memory-profile-passes", 2));
+  graph->setNodeProfile(options->get<size_t>("profile-nodes", 0),
+                        options->get<size_t>("profile-nodes-top", 20),
+                        options->get<std::string>("profile-nodes-trace", ""),
+                        options->get<bool>("profile-nodes-counters", false));
+  return graph;
+}
+
 template <class Search>
 class Translate : public ModelTask {
 private:
@@ -31,10 +78,16 @@ private:
   Ptr<data::Corpus> corpus_;
   Ptr<Vocab> trgVocab_;
   Ptr<const data::ShortlistGenerator> shortlistGenerator_;
+  Ptr<const Terminology> terminology_; // nullptr unless --terminology
 
   size_t numDevices_;
+  size_t numGraphs_; // numDevices_ * --in-flight-batches
   std::vector<Ptr<io::ModelWeights>> modelWeights_;
 
+  // with --cpu-numa the NUMA nodes, and the node of each graph whose threads are bound to its CPUs
+  Ptr<NumaNodes> numa_;
+  std::vector<size_t> graphNodes_;
+
 public:
   Translate(Ptr<Options> options)
     : options_(options->clone()) {
@@ -44,26 +97,24 @@ public:
     options_->set("inference", true,
                   "shuffle", "none");
 
-    corpus_ = New<data::Corpus>(options_, /*translate=*/true);
+    // The phases of the startup that do not depend on each other run concurrently: the source vocabularies, the
+    // target vocabulary and the model files are read at the same time, and the shortlist is created while the graphs
+    // are built. Each phase is timed for the breakdown that is logged at the end.
+    timer::Timer startupTimer;
+    ThreadPool startupPool(3);
 
     auto vocabs = options_->get<std::vector<std::string>>("vocabs");
-    trgVocab_ = New<Vocab>(options_, vocabs.size() - 1);
-    trgVocab_->load(vocabs.back());
-    auto srcVocab = corpus_->getVocabs()[0];
-
-    std::vector<int> lshOpts = options_->get<std::vector<int>>("output-approx-knn", {});
-    ABORT_IF(lshOpts.size() != 0 && lshOpts.size() != 2, "--output-approx-knn takes 2 parameters");
-
-    if (lshOpts.size() == 2 || options_->hasAndNotEmpty("shortlist")) {
-      shortlistGenerator_ = data::createShortlistGenerator(options_, srcVocab, trgVocab_, lshOpts, 0, 1, vocabs.front() == vocabs.back());
-    }
-
-    auto devices = Config::getDevices(options_);
-    numDevices_ = devices.size();
-
-    ThreadPool threadPool(numDevices_, numDevices_);
-    scorers_.resize(numDevices_);
-    graphs_.resize(numDevices_);
+    auto corpusLoaded = startupPool.enqueue([&]() {
+      timer::Timer timer;
+      corpus_ = New<data::Corpus>(options_, /*translate=*/true);
+      return timer.elapsed();
+    });
+    auto trgVocabLoaded = startupPool.enqueue([&]() {
+      timer::Timer timer;
+      trgVocab_ = New<Vocab>(options_, vocabs.size() - 1);
+      trgVocab_->load(vocabs.back());
+      return timer.elapsed();
+    });
 
     auto modelPaths = options->get<std::vector<std::string>>("models");
 
@@ -74,40 +125,124 @@ public:
     bool mmap     = options_->get<bool>("model-mmap", false);
     auto mmapMode = mmap ? io::MmapMode::RequiredMmap : io::MmapMode::OpportunisticMmap;
 
+    timer::Timer modelTimer;
     for(auto modelPath : modelPaths) {
       LOG(info, "Loading model from {}", modelPath);
-      modelWeights_.push_back(New<io::ModelWeights>(modelPath, mmapMode));
+      modelWeights_.push_back(io::ModelWeights::shared(modelPath, mmapMode));
+      if(options_->get<bool>("model-mmap-lazy", false))
+        modelWeights_.back()->adviseRandomAccess();
     }
+    double modelTime = modelTimer.elapsed();
+    double vocabTime = std::max(corpusLoaded.get(), trgVocabLoaded.get());
+    auto srcVocab = corpus_->getVocabs()[0];
 
-    size_t id = 0;
-    for(auto device : devices) {
-      auto task = [&](DeviceId device, size_t id) {
-        auto graph = New<ExpressionGraph>(true);
-        auto prec = options_->get<std::vector<std::string>>("precision", {"float32"});
-        graph->setDefaultElementType(typeFromString(prec[0]));
-        graph->setDevice(device);
-        if (device.type == DeviceType::cpu) {
-          graph->getBackend()->setOptimized(options_->get<bool>("optimize"));
-          graph->getBackend()->setGemmType(options_->get<std::string>("gemm-type"));
-          graph->getBackend()->setQuantizeRange(options_->get<float>("quantize-range"));
-        }
-        graph->reserveWorkspaceMB(options_->get<int>("workspace"));
-        graphs_[id] = graph;
+    // the shortlist belongs to the first model, which may carry a precomputed LSH index
+    std::vector<int> lshOpts = lsh::resolveOptions(options_->get<std::vector<int>>("output-approx-knn", {}), modelWeights_.front());
 
-        std::vector<Ptr<Scorer>> scorers = createScorers(options_, modelWeights_);
+    auto shortlistCreated = startupPool.enqueue([&, srcVocab]() {
+      timer::Timer timer;
+      if (lshOpts.size() == 2 || options_->hasAndNotEmpty("shortlist")) {
+        shortlistGenerator_ = data::createShortlistGenerator(options_, srcVocab, trgVocab_, lshOpts, 0, 1, vocabs.front() == vocabs.back());
+      }
+      return timer.elapsed();
+    });
+    terminology_ = createTerminology(options_, srcVocab, trgVocab_);
 
-        for(auto scorer : scorers) {
-          scorer->init(graph);
-          if(shortlistGenerator_)
-            scorer->setShortlistGenerator(shortlistGenerator_);
+    auto devices = Config::getDevices(options_);
+    numDevices_ = devices.size();
+
+    // With --in-flight-batches N we keep N independent graphs per device, so that a new batch can
+    // start decoding on a device while another batch is still draining its longest sentences.
+    size_t inFlightBatches = std::max<size_t>(1, options_->get<size_t>("in-flight-batches", 1));
+    numGraphs_ = numDevices_ * inFlightBatches;
+
+    // the GEMM decisions of --gemm-type auto, shared by all graphs
+    auto autoTunerCache = options_->get<std::string>("gemm-type") == "auto"
+        ? New<AutoTunerCache>(options_->get<std::string>("autotune-cache", ""),
+                              AutoTunerCache::modelKey(options_->get<std::vector<std::string>>("models")))
+        : nullptr;
+
+    // The CPU graphs are spread over the NUMA nodes, and the threads that build, load and run a graph are bound to
+    // the CPUs of its node, so that its workspace and parameters are in the memory of the node. The graphs of a node
+    // read their own replica of the model weights with --cpu-numa-replicate.
+    std::vector<std::vector<Ptr<io::ModelWeights>>> nodeWeights;
+    if(options_->get<bool>("cpu-numa", false) && devices.front().type == DeviceType::cpu) {
+      numa_ = New<NumaNodes>();
+      graphNodes_.resize(numGraphs_);
+      for(size_t id = 0; id < numGraphs_; ++id)
+        graphNodes_[id] = numa_->nodeOf(devices[id % numDevices_].no, numDevices_);
+      LOG(info, "[numa] Binding {} graphs to the CPUs of {} NUMA nodes", numGraphs_, numa_->size());
+
+      nodeWeights.resize(numa_->size(), modelWeights_);
+      if(options_->get<bool>("cpu-numa-replicate", false) && numa_->size() > 1) {
+        timer::Timer timer;
+        ThreadPool replicatePool(numa_->size(), numa_->size());
+        for(size_t node = 0; node < numa_->size(); ++node) {
+          replicatePool.enqueue([&](size_t node) {
+            numa_->bind(node);
+            for(auto& weights : nodeWeights[node])
+              weights = io::ModelWeights::replicate(weights);
+          }, node);
         }
+        replicatePool.join_all();
+        LOG(info, "[numa] Replicated the model weights on {} NUMA nodes in {:.2f}s", numa_->size(), timer.elapsed());
+      }
+    }
 
-        scorers_[id] = scorers;
-        graph->forward();
-      };
+    ThreadPool threadPool(numGraphs_, numGraphs_);
+    scorers_.resize(numGraphs_);
+    graphs_.resize(numGraphs_);
+    std::vector<double> initTimes(numGraphs_), warmTimes(numGraphs_);
+
+    timer::Timer graphTimer;
+    size_t id = 0;
+    for(size_t slot = 0; slot < inFlightBatches; ++slot) {
+      for(auto device : devices) {
+        auto task = [&](DeviceId device, size_t id) {
+          if(numa_)
+            numa_->bind(graphNodes_[id]);
+          auto graph = createTranslationGraph(options_, device, autoTunerCache);
+          graphs_[id] = graph;
+
+          // loading the parameters into the graph includes their conversion and packing for the device
+          timer::Timer timer;
+          bool parallelEnsemble = hasParallelEnsemble(options_, device);
+          std::vector<Ptr<Scorer>> scorers
+              = createScorers(options_, numa_ ? nodeWeights[graphNodes_[id]] : modelWeights_);
+          for(size_t i = 0; i < scorers.size(); ++i) {
+            if(parallelEnsemble && i > 0)
+              scorers[i]->setOwnGraph(createTranslationGraph(options_, device, autoTunerCache));
+            scorers[i]->init(scorers[i]->graph(graph));
+          }
+          initTimes[id] = timer.elapsed();
+
+          timer.start();
+          scorers_[id] = scorers;
+          graph->forward();
+          for(auto scorer : scorers)
+            if(scorer->hasOwnGraph())
+              scorer->graph(graph)->forward();
+          warmTimes[id] = timer.elapsed();
+        };
 
-      threadPool.enqueue(task, device, id++);
+        threadPool.enqueue(task, device, id++);
+      }
     }
+    threadPool.join_all();
+    double graphTime = graphTimer.elapsed();
+
+    double shortlistTime = shortlistCreated.get();
+    if(shortlistGenerator_)
+      for(auto& scorers : scorers_)
+        for(auto scorer : scorers)
+          scorer->setShortlistGenerator(shortlistGenerator_);
+
+    LOG(info,
+        "[startup] Ready after {:.2f}s: vocabularies {:.2f}s, model files {:.2f}s, shortlist {:.2f}s, "
+        "{} graphs {:.2f}s (loading and packing up to {:.2f}s, warm-up up to {:.2f}s)",
+        startupTimer.elapsed(), vocabTime, modelTime, shortlistTime, numGraphs_,
+        graphTime, *std::max_element(initTimes.begin(), initTimes.end()),
+        *std::max_element(warmTimes.begin(), warmTimes.end()));
 
     if(options_->hasAndNotEmpty("output-sampling")) {
       if(options_->get<size_t>("beam-size") > 1)
@@ -117,16 +252,49 @@ public:
     }
   }
 
+  // feed the lengths of the best translations back into the predictor, see --maxi-batch-sort trg-predicted
+  static void updateLengthPredictor(Ptr<data::TargetLengthPredictor> lengthPredictor,
+                                    Ptr<data::CorpusBatch> batch,
+                                    const Histories& histories) {
+    auto subBatch = batch->front();
+    for(size_t i = 0; i < histories.size(); ++i) {
+      Words source;
+      for(size_t j = 0; j < subBatch->batchWidth(); ++j) {
+        size_t k = subBatch->locate(/*batchIdx=*/i, /*wordPos=*/j);
+        if(subBatch->mask()[k] != 0)
+          source.push_back(subBatch->data()[k]);
+      }
+      lengthPredictor->update(source, std::get<0>(histories[i]->top()).size());
+    }
+  }
+
   void run() override {
     data::BatchGenerator<data::Corpus> bg(corpus_, options_);
 
-    ThreadPool threadPool(numDevices_, numDevices_);
+    // with --maxi-batch-sort trg-predicted batches are grouped by their expected output length,
+    // which is learned from the translations that have been finished so far
+    Ptr<data::TargetLengthPredictor> lengthPredictor;
+    if(options_->get<std::string>("maxi-batch-sort", "none") == "trg-predicted") {
+      lengthPredictor = New<data::TargetLengthPredictor>();
+      bg.setSortKey([lengthPredictor](const data::SentenceTuple& sample) {
+        return lengthPredictor->predict(sample[0]);
+      });
+    }
+
+    ThreadPool threadPool(numGraphs_, numGraphs_);
+
+    // each worker thread binds itself to one graph on first use
+    std::atomic<size_t> nextGraphId{0};
 
     size_t batchId = 0;
     auto collector = New<OutputCollector>(options_->get<std::string>("output"));
     auto printer = New<OutputPrinter>(options_, trgVocab_);
+    if(options_->hasAndNotEmpty("n-best-binary"))
+      printer->setBinaryWriter(New<BinaryNBestWriter>(options_->get<std::string>("n-best-binary")));
     if(options_->get<bool>("quiet-translation"))
       collector->setPrintingStrategy(New<QuietPrinting>());
+    collector->setUnordered(options_->get<bool>("output-unordered", false));
+    size_t reorderWindow = options_->get<size_t>("output-reorder-window", 0);
 
     // mutex for syncing counter and timer updates
     std::mutex syncCounts;
@@ -150,31 +318,63 @@ public:
 
     bool doNbest = options_->get<bool>("n-best");
 
+    // repeated sentences are served from the cache and never go into a batch
+    auto cache = createTranslationCache(options_);
+    if(cache) {
+      bg.setSkipFilter([cache, collector, doNbest](const data::SentenceTuple& sample) {
+        TranslationCache::Value cached;
+        if(!cache->get(TranslationCache::key(sample), cached))
+          return false;
+        collector->Write((long)sample.getId(), cached.first, cached.second, doNbest);
+        return true;
+      });
+    }
+
     bg.prepare();
     for(auto batch : bg) {
-      auto task = [=, &syncCounts,
+      // do not translate ahead while too many translations wait for a slow earlier one
+      if(reorderWindow > 0)
+        collector->waitForPending(reorderWindow);
+
+      auto task = [=, &syncCounts, &nextGraphId,
                       &totBatches, &totLines, &totSourceTokens, &totTimer,
-                      &curBatches, &curLines, &curSourceTokens, &curTimer](size_t id) {
+                      &curBatches, &curLines, &curSourceTokens, &curTimer](size_t /*id*/) {
         thread_local Ptr<ExpressionGraph> graph;
         thread_local std::vector<Ptr<Scorer>> scorers;
 
         if(!graph) {
-          graph = graphs_[id % numDevices_];
-          scorers = scorers_[id % numDevices_];
+          // There are exactly numGraphs_ worker threads, hence every thread gets its own graph.
+          size_t graphId = nextGraphId++ % numGraphs_;
+          graph = graphs_[graphId];
+          scorers = scorers_[graphId];
+          if(numa_)
+            numa_->bind(graphNodes_[graphId]);
         }
 
         auto search = New<Search>(options_, scorers, trgVocab_);
-        auto histories = search->search(graph, batch);
-
-        for(auto history : histories) {
-          std::stringstream best1;
-          std::stringstream bestn;
+        search->setTerminology(terminology_);
+        // hand every sentence to the collector as soon as it is finished, so that short sentences
+        // are not held back by long ones in the same batch; the collector keeps the output in order
+        search->setFinishedCallback([&](Ptr<const History> history) {
+          // the output buffers of a worker thread keep their capacity from sentence to sentence
+          thread_local std::string best1, bestn;
+          best1.clear();
+          bestn.clear();
           printer->print(history, best1, bestn);
           collector->Write((long)history->getLineNum(),
-                           best1.str(),
-                           bestn.str(),
+                           best1,
+                           bestn,
                            doNbest);
-        }
+          if(cache) {
+            const auto& ids = batch->getSentenceIds();
+            size_t batchIdx = std::find(ids.begin(), ids.end(), history->getLineNum()) - ids.begin();
+            cache->put(TranslationCache::key(batch, batchIdx), {best1, bestn});
+          }
+        });
+        auto histories = search->search(graph, batch);
+
+        if(lengthPredictor)
+          updateLengthPredictor(lengthPredictor, batch, histories);
 
         // if we asked for speed information display this
         if(statFreq.n > 0) {
@@ -215,6 +415,9 @@ public:
           "Processed {} batches, {} lines, {} source tokens in {:.2f}s - Speed (total): {:.2f} batches/s - {:.2f} lines/s - {:.2f} tokens/s",
           totBatches, totLines, totSourceTokens, totTime, totBatches / totTime, totLines / totTime, totSourceTokens / totTime);
     }
+
+    if(cache)
+      cache->logStats();
   }
 };
 
@@ -222,20 +425,103 @@ template <class Search>
 class TranslateService : public ModelServiceTask {
 private:
   Ptr<Options> options_;
-  std::vector<Ptr<ExpressionGraph>> graphs_;
-  std::vector<std::vector<Ptr<Scorer>>> scorers_;
+
+  // the loaded models with their graphs and scorers, one per graph id. reload() replaces the set under modelsMutex_,
+  // every call of decode() holds the one it started with, and the last of them frees it.
+  struct Models {
+    size_t generation{0}; // counts the reloads, part of the keys of the translation cache
+    std::vector<Ptr<io::ModelWeights>> weights;
+    std::vector<Ptr<ExpressionGraph>> graphs;
+    std::vector<std::vector<Ptr<Scorer>>> scorers;
+  };
+  Ptr<const Models> models_;
+  mutable std::mutex modelsMutex_;
+  std::mutex reloadMutex_; // one reload() at a time
 
   std::vector<Ptr<Vocab>> srcVocabs_;
   Ptr<Vocab> trgVocab_;
   std::vector<Ptr<Vocab>> allVocabs_;
   Ptr<const data::ShortlistGenerator> shortlistGenerator_;
+  Ptr<const Terminology> terminology_; // nullptr unless --terminology
 
-  std::vector<Ptr<io::ModelWeights>> modelWeights_;
-
+  std::vector<DeviceId> devices_;
+  Ptr<AutoTunerCache> autoTunerCache_; // the GEMM decisions of --gemm-type auto, shared by all graphs
   size_t numDevices_;
+  size_t numGraphs_; // numDevices_ * --in-flight-batches
+
+  Ptr<TranslationCache> cache_; // shared by all calls, see --translation-cache
+  Ptr<tracing::Tracer> tracer_; // nullptr unless --trace-sample-rate
+  Ptr<RequestCapture> capture_; // nullptr unless --capture-slow-ms
+
+  // optional, see registerMetrics()
+  Ptr<metrics::Counter> batchesMetric_, sentencesMetric_, srcWordsMetric_, trgWordsMetric_, decodeSecondsMetric_;
+  Ptr<metrics::Histogram> batchFillMetric_;
+  std::atomic<size_t> workspaceHighWater_{0}; // largest workspace of any graph in bytes
+  mutable std::mutex workspaceMutex_;
+  std::vector<AllocatorStatistics> workspaceStatistics_; // per graph, updated by its worker after every batch
+
+  Ptr<const Models> currentModels() const {
+    std::lock_guard<std::mutex> lock(modelsMutex_);
+    return models_;
+  }
+
+  // Creates the graphs and scorers of the given model weights, --in-flight-batches per device, and runs their first
+  // forward pass to allocate the parameters
+  Ptr<Models> createModels(const std::vector<Ptr<io::ModelWeights>>& modelWeights) {
+    auto models = New<Models>();
+    models->weights = modelWeights;
+    models->graphs.resize(numGraphs_);
+    models->scorers.resize(numGraphs_);
+
+    ThreadPool threadPool(numGraphs_, numGraphs_);
+    size_t id = 0;
+    for(size_t slot = 0; slot < numGraphs_ / numDevices_; ++slot) {
+      for(auto device : devices_) {
+        auto task = [&](DeviceId device, size_t id) {
+          auto graph = createTranslationGraph(options_, device, autoTunerCache_);
+          models->graphs[id] = graph;
+
+          bool parallelEnsemble = hasParallelEnsemble(options_, device);
+          auto scorers = createScorers(options_, modelWeights);
+          for(size_t i = 0; i < scorers.size(); ++i) {
+            if(parallelEnsemble && i > 0)
+              scorers[i]->setOwnGraph(createTranslationGraph(options_, device, autoTunerCache_));
+            scorers[i]->init(scorers[i]->graph(graph));
+            if(shortlistGenerator_)
+              scorers[i]->setShortlistGenerator(shortlistGenerator_);
+          }
+
+          models->scorers[id] = scorers;
+          graph->forward();
+          for(auto scorer : scorers)
+            if(scorer->hasOwnGraph())
+              scorer->graph(graph)->forward();
+          updateWorkspaceStatistics(id, graph);
+        };
+
+        threadPool.enqueue(task, device, id++);
+      }
+    }
+    return models; // the pool waits for all graphs when it goes out of scope
+  }
+
+  void updateWorkspaceStatistics(size_t graphId, Ptr<ExpressionGraph> graph) {
+    auto statistics = graph->getWorkspaceStatistics();
+    std::lock_guard<std::mutex> lock(workspaceMutex_);
+    workspaceStatistics_[graphId] = statistics;
+  }
+
+  // One persistent worker per graph, kept alive across calls to run(). Each worker picks a graph
+  // on its first task and keeps using it, hence concurrent calls never share a graph.
+  // Declared last so that the workers are joined before the graphs are destroyed.
+  std::atomic<size_t> nextGraphId_{0};
+  std::unique_ptr<ThreadPool> threadPool_;
 
 public:
-  virtual ~TranslateService() {}
+  virtual ~TranslateService() {
+    if(cache_)
+      cache_->logStats();
+  }
 
   TranslateService(const std::string& cliString)
     : TranslateService(parseOptions(cliString, cli::mode::translation, /*validate=*/true)) {}
@@ -261,60 +547,108 @@ public:
     allVocabs_.insert(allVocabs_.end(), srcVocabs_.begin(), srcVocabs_.end());
     allVocabs_.emplace_back(trgVocab_);
 
-    std::vector<int> lshOpts = options_->get<std::vector<int>>("output-approx-knn", {});
-    ABORT_IF(lshOpts.size() != 0 && lshOpts.size() != 2, "--output-approx-knn takes 2 parameters");
+    bool mmap     = options_->get<bool>("model-mmap", false);
+    auto mmapMode = mmap ? io::MmapMode::RequiredMmap : io::MmapMode::OpportunisticMmap;
+
+    // preload models
+    std::vector<Ptr<io::ModelWeights>> modelWeights;
+    auto modelPaths = options->get<std::vector<std::string>>("models");
+    for(auto modelPath : modelPaths) {
+      modelWeights.push_back(io::ModelWeights::shared(modelPath, mmapMode));
+      if(options_->get<bool>("model-mmap-lazy", false))
+        modelWeights.back()->adviseRandomAccess();
+    }
 
-    // load lexical shortlist
+    // load lexical shortlist, LSH parameters may come from the first model
+    std::vector<int> lshOpts = lsh::resolveOptions(options_->get<std::vector<int>>("output-approx-knn", {}), modelWeights.front());
     if (lshOpts.size() == 2 || options_->hasAndNotEmpty("shortlist")) {
         shortlistGenerator_ = data::createShortlistGenerator(options_, srcVocab, trgVocab_, lshOpts, 0, 1, vocabPaths.front() == vocabPaths.back());
     }
 
+    terminology_ = createTerminology(options_, srcVocab, trgVocab_);
+
     // get device IDs
-    auto devices = Config::getDevices(options_);
-    numDevices_ = devices.size();
+    devices_ = Config::getDevices(options_);
+    numDevices_ = devices_.size();
 
-    ThreadPool threadPool(numDevices_, numDevices_);
-    scorers_.resize(numDevices_);
-    graphs_.resize(numDevices_);
+    // keep --in-flight-batches independent graphs per device, see Translate
+    size_t inFlightBatches = std::max<size_t>(1, options_->get<size_t>("in-flight-batches", 1));
+    numGraphs_ = numDevices_ * inFlightBatches;
 
-    bool mmap     = options_->get<bool>("model-mmap", false);
-    auto mmapMode = mmap ? io::MmapMode::RequiredMmap : io::MmapMode::OpportunisticMmap;
+    autoTunerCache_ = options_->get<std::string>("gemm-type") == "auto"
+        ? New<AutoTunerCache>(options_->get<std::string>("autotune-cache", ""),
+                              AutoTunerCache::modelKey(options_->get<std::vector<std::string>>("models")))
+        : nullptr;
 
-    // preload models
-    auto modelPaths = options->get<std::vector<std::string>>("models");
-    for(auto modelPath : modelPaths)
-      modelWeights_.push_back(New<io::ModelWeights>(modelPath, mmapMode));
+    workspaceStatistics_.resize(numGraphs_);
+    models_ = createModels(modelWeights);
 
-    // initialize scorers
-    size_t id = 0;
-    for(auto device : devices) {
-      auto task = [&](DeviceId device, size_t id) {
-        auto graph = New<ExpressionGraph>(true);
-
-        auto precison = options_->get<std::vector<std::string>>("precision", {"float32"});
-        graph->setDefaultElementType(typeFromString(precison[0])); // only use first type, used for parameter type in graph
-        graph->setDevice(device);
-        if (device.type == DeviceType::cpu) {
-          graph->getBackend()->setOptimized(options_->get<bool>("optimize"));
-          graph->getBackend()->setGemmType(options_->get<std::string>("gemm-type"));
-          graph->getBackend()->setQuantizeRange(options_->get<float>("quantize-range"));
-        }
-        graph->reserveWorkspaceMB(options_->get<int>("workspace"));
-        graphs_[id] = graph;
-
-        auto scorers = createScorers(options_, modelWeights_);
-        for(auto scorer : scorers) {
-          scorer->init(graph);
-          if(shortlistGenerator_)
-            scorer->setShortlistGenerator(shortlistGenerator_);
-        }
+    cache_ = createTranslationCache(options_);
+    if(options_->get<float>("trace-sample-rate", 0.f) > 0.f)
+      tracer_ = New<tracing::Tracer>(options_->get<float>("trace-sample-rate"), options_->get<std::string>("trace-output"));
+    threadPool_.reset(new ThreadPool(numGraphs_, numGraphs_));
 
-        scorers_[id] = scorers;
-        graph->forward();
-      };
+    warmup(options_->get<std::vector<size_t>>("warmup-batch-sizes", {}),
+           options_->get<std::vector<size_t>>("warmup-lengths", {16}));
+    capture_ = createRequestCapture(options_); // after the warmup, which is slow by design
+  }
+
+  // Largest workspace of any graph so far in bytes
+  size_t workspaceHighWater() const { return workspaceHighWater_; }
+
+  // Memory use of the workspace of every graph after its last batch, see ExpressionGraph::getWorkspaceStatistics()
+  std::vector<AllocatorStatistics> workspaceStatistics() const {
+    std::lock_guard<std::mutex> lock(workspaceMutex_);
+    return workspaceStatistics_;
+  }
+
+  DeviceId graphDevice(size_t graphId) const { return devices_[graphId % numDevices_]; }
+
+  // Loads the models again, from the given files or else from --models, into a second set of graphs, warms them up
+  // and switches new requests over to them, e.g. for marian-server on SIGHUP. Requests that have already started
+  // finish on the previous graphs, which are freed with the last of them, so the devices need memory for both sets
+  // until then. The files of the service are read anew, replace them by renaming rather than overwriting them when
+  // they are memory-mapped. The vocabularies and the shortlist stay, cached translations of the previous models are
+  // not used anymore.
+  void reload(std::vector<std::string> modelPaths = {}) {
+    std::lock_guard<std::mutex> lock(reloadMutex_);
+    if(modelPaths.empty())
+      modelPaths = options_->get<std::vector<std::string>>("models");
+    auto previous = currentModels();
+    ABORT_IF(modelPaths.size() != previous->weights.size(),
+             "Reloading {} models, but the service was started with {}", modelPaths.size(), previous->weights.size());
+
+    LOG(info, "Reloading models {}", utils::join(modelPaths, ", "));
+    timer::Timer timer;
+    bool mmap = options_->get<bool>("model-mmap", false);
+    std::vector<Ptr<io::ModelWeights>> modelWeights;
+    for(const auto& modelPath : modelPaths) {
+      modelWeights.push_back(New<io::ModelWeights>(modelPath, mmap ? io::MmapMode::RequiredMmap
+                                                                   : io::MmapMode::OpportunisticMmap));
+      if(options_->get<bool>("model-mmap-lazy", false))
+        modelWeights.back()->adviseRandomAccess();
+    }
+    auto models = createModels(modelWeights);
+    models->generation = previous->generation + 1;
+    warmup(options_->get<std::vector<size_t>>("warmup-batch-sizes", {}),
+           options_->get<std::vector<size_t>>("warmup-lengths", {16}),
+           models);
 
-      threadPool.enqueue(task, device, id++);
+    {
+      std::lock_guard<std::mutex> lock(modelsMutex_);
+      models_ = models;
     }
+    LOG(info, "Reloaded models in {:.2f}s, the previous ones are freed after their last request", timer.elapsed());
+  }
+
+  // Samples the requests to trace, nullptr unless --trace-sample-rate. Callers that start the trace of a request
+  // themselves, e.g. marian-server, get the spans of the calls below within it.
+  Ptr<tracing::Tracer> getTracer() const { return tracer_; }
+
+  // Decodes synthetic batches of all combinations of batch sizes and source lengths on every graph,
+  // see --warmup-batch-sizes
+  void warmup(const std::vector<size_t>& batchSizes, const std::vector<size_t>& lengths) {
+    warmup(batchSizes, lengths, currentModels());
   }
 
   std::vector<std::string> run(const std::vector<std::string>& inputs, const std::string& yamlOverridesStr="") override {
@@ -324,13 +658,30 @@ public:
   }
 
   std::string run(const std::string& input, const std::string& yamlOverridesStr="") override {
-    YAML::Node configOverrides = YAML::Load(yamlOverridesStr);
+    return run(input, yamlOverridesStr, /*callback=*/nullptr);
+  }
 
-    auto currentOptions = New<Options>(options_->clone());
-    if (!configOverrides.IsNull()) {
-      LOG(info,  "Overriding options:\n {}", configOverrides);
-      currentOptions->merge(configOverrides, /*overwrite=*/true);
-    }
+  // Called with the line number and the translation of every input line as soon as it is finished,
+  // which may be out of order. Calls are serialized, so the callback does not need to be thread-safe.
+  typedef std::function<void(size_t /*lineNo*/, const std::string& /*translation*/)> TranslationCallback;
+
+  // Same as run() above, but additionally streams out every translated line via callback
+  std::string run(const std::string& input, const std::string& yamlOverridesStr, TranslationCallback callback) {
+    return utils::join(translateLines(input, yamlOverridesStr, callback), "\n");
+  }
+
+  // Translates a multi-line input and returns one translation (or n-best list) per input line.
+  // Batches that have not been started when the deadline passes are dropped, their lines stay empty.
+  std::vector<std::string> translateLines(const std::string& input,
+                                          const std::string& yamlOverridesStr,
+                                          TranslationCallback callback = nullptr,
+                                          std::chrono::steady_clock::time_point deadline
+                                            = std::chrono::steady_clock::time_point::max()) {
+    timer::Timer requestTimer;
+    tracing::Scope scope(startTrace());
+    tracing::Span span("translate");
+    Ptr<Options> currentOptions = overrideOptions(yamlOverridesStr);
+    auto models = currentModels(); // the whole request is translated by the same models
 
     // split tab-separated input into fields if necessary
     auto inputs = currentOptions->get<bool>("tsv", false)
@@ -341,48 +692,301 @@ public:
     auto forceDecoding = currentOptions->get<bool>("force-decode", false);
 
     auto corpus_ = New<data::TextInput>(inputs, forceDecoding ? allVocabs_ : srcVocabs_, currentOptions);
-    data::BatchGenerator<data::TextInput> batchGenerator(corpus_, currentOptions, nullptr, /*runAsync=*/false);
 
     auto collector = New<StringCollector>(currentOptions->get<bool>("quiet-translation", false));
     auto printer = New<OutputPrinter>(currentOptions, trgVocab_);
-    size_t batchId = 0;
+    std::mutex callbackMutex;
+    tracing::RepeatedSpan detokenization("detokenization");
+
+    // overridden options may change the output, hence they are part of the cache key
+    auto cache = currentOptions->hasAndNotEmpty("output-sampling") ? nullptr : cache_;
+    const std::string cachePrefix = std::to_string(models->generation) + '\0' + yamlOverridesStr + '\0';
+    std::function<bool(const data::SentenceTuple&)> skip;
+    if(cache) {
+      skip = [&](const data::SentenceTuple& sample) {
+        TranslationCache::Value cached;
+        if(!cache->get(TranslationCache::key(sample, cachePrefix), cached))
+          return false;
+        collector->add((long)sample.getId(), cached.first, cached.second);
+        if(callback) {
+          std::lock_guard<std::mutex> lock(callbackMutex);
+          callback(sample.getId(), cached.first);
+        }
+        return true;
+      };
+    }
 
-    batchGenerator.prepare();
+    std::deque<CapturedRequest::Batch> batches;
+    auto onFinished = [&](Ptr<data::CorpusBatch> batch, Ptr<const History> history) {
+      thread_local std::string best1, bestn;
+      best1.clear();
+      bestn.clear();
+      {
+        auto interval = detokenization.time();
+        printer->print(history, best1, bestn);
+      }
+      collector->add((long)history->getLineNum(), best1, bestn);
+      if(cache) {
+        const auto& ids = batch->getSentenceIds();
+        size_t batchIdx = std::find(ids.begin(), ids.end(), history->getLineNum()) - ids.begin();
+        cache->put(TranslationCache::key(batch, batchIdx, cachePrefix), {best1, bestn});
+      }
+      if(callback) {
+        std::lock_guard<std::mutex> lock(callbackMutex);
+        callback((size_t)history->getLineNum(), best1);
+      }
+    };
+    decode(models, corpus_, currentOptions, deadline, skip, onFinished, capture_ ? &batches : nullptr);
 
+    std::vector<std::string> translations;
     {
-      ThreadPool threadPool_(numDevices_, numDevices_);
+      tracing::Span output("output");
+      translations = collector->collect(currentOptions->get<bool>("n-best"));
+    }
+    if(capture_ && capture_->isSlow(requestTimer.elapsed()))
+      captureRequest(requestTimer.elapsed(), yamlOverridesStr, input, {}, batches);
+    return translations;
+  }
+
+  const std::vector<Ptr<Vocab>>& getSrcVocabs() const { return srcVocabs_; }
+
+  // Adds decoding statistics of all subsequent calls to the registry. Needs to be called before the
+  // first translation, the registry must not outlive the service.
+  void registerMetrics(metrics::Registry& registry) {
+    batchesMetric_ = registry.counter("marian_batches_total", "Number of decoded batches");
+    sentencesMetric_ = registry.counter("marian_sentences_total", "Number of decoded sentences");
+    srcWordsMetric_ = registry.counter("marian_source_words_total", "Number of decoded source words incl. </s>");
+    trgWordsMetric_ = registry.counter("marian_target_words_total", "Number of generated target words incl. </s>");
+    decodeSecondsMetric_ = registry.counter("marian_decode_seconds_total", "Time spent in beam search, summed over all graphs");
+    batchFillMetric_ = registry.histogram("marian_batch_fill_ratio",
+                                          "Source words per batch relative to --mini-batch-words, or sentences relative to --mini-batch",
+                                          {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.0});
+    registry.gauge("marian_workspace_bytes_max", "Largest workspace reserved by any graph so far",
+                   [this]() { return (double)workspaceHighWater_; });
+    for(size_t i = 0; i < numGraphs_; ++i) {
+      auto labels = "graph=\"" + std::to_string(i) + "\",device=\"" + (std::string)graphDevice(i) + "\"";
+      auto statistic = [this, i](size_t AllocatorStatistics::*field) {
+        return [this, i, field]() { return (double)(workspaceStatistics()[i].*field); };
+      };
+      registry.gauge("marian_workspace_reserved_bytes", "Device memory reserved by the workspace of a graph",
+                     statistic(&AllocatorStatistics::reserved), labels);
+      registry.gauge("marian_workspace_used_bytes", "Bytes of the workspace allocated after the last batch of a graph",
+                     statistic(&AllocatorStatistics::used), labels);
+      registry.gauge("marian_workspace_peak_bytes", "Most bytes of the workspace allocated at once, see --workspace",
+                     statistic(&AllocatorStatistics::peak), labels);
+      registry.counterFn("marian_workspace_allocations_total", "Number of allocations from the workspace of a graph",
+                         statistic(&AllocatorStatistics::allocations), labels);
+      registry.gauge("marian_workspace_fragmentation_ratio", "Share of the free workspace outside of its largest gap",
+                     [this, i]() { return (double)workspaceStatistics()[i].fragmentation(); }, labels);
+    }
+    if(cache_) {
+      auto cache = cache_;
+      registry.counterFn("marian_cache_hits_total", "Translation cache hits", [cache]() { return (double)cache->hits(); });
+      registry.counterFn("marian_cache_misses_total", "Translation cache misses", [cache]() { return (double)cache->misses(); });
+      registry.gauge("marian_cache_bytes", "Memory used by the translation cache", [cache]() { return (double)cache->sizeInBytes(); });
+    }
+  }
 
-      for(auto batch : batchGenerator) {
-        auto task = [=](size_t id) {
-          thread_local Ptr<ExpressionGraph> graph;
-          thread_local std::vector<Ptr<Scorer>> scorers;
+  // best translation of a pre-tokenized sentence, see translateIds()
+  struct IdTranslation {
+    Words words;                     // without </s>
+    float score;                     // normalized sentence score
+    data::SoftAlignment alignment;   // [trg pos][src pos] incl. </s> on both sides, only filled with --alignment
+  };
+
+  // Translates pre-tokenized input given as vocabulary ids [stream][sentence] and returns the ids of
+  // the best translation per sentence. There is no text parsing, vocabulary encoding or decoding on
+  // either side. The translation cache is not used here.
+  std::vector<IdTranslation> translateIds(const std::vector<std::vector<Words>>& inputs,
+                                          const std::string& yamlOverridesStr="") {
+    return translateIds(currentModels(), inputs, yamlOverridesStr);
+  }
 
-          if(!graph) {
-            graph = graphs_[id % numDevices_];
-            scorers = scorers_[id % numDevices_];
+private:
+  // Decodes the synthetic batches of warmup() on the graphs of models
+  void warmup(const std::vector<size_t>& batchSizes,
+              const std::vector<size_t>& lengths,
+              Ptr<const Models> models) {
+    if(batchSizes.empty() || lengths.empty())
+      return;
+    LOG(info, "Warming up with batch sizes {} and source lengths {}", utils::join(batchSizes, ", "), utils::join(lengths, ", "));
+    timer::Timer timer;
+
+    for(auto batchSize : batchSizes) {
+      for(auto length : lengths) {
+        // one batch per graph, the workers bind to graphs on their first batch
+        std::vector<std::vector<Words>> inputs;
+        for(auto vocab : srcVocabs_) {
+          std::vector<Words> sentences(batchSize * numGraphs_);
+          size_t k = 0;
+          for(auto& words : sentences) {
+            for(size_t i = 0; i + 1 < length; ++i) {
+              auto word = Word::fromWordIndex((k++ * 7919 + 3) % vocab->size()); // arbitrary words from the vocabulary
+              if(word != vocab->getEosId() && word != vocab->getUnkId())
+                words.push_back(word);
+            }
           }
+          inputs.push_back(sentences);
+        }
+        std::string batching = "mini-batch: " + std::to_string(batchSize) + "\n"
+                               "mini-batch-words: 0\n"
+                               "maxi-batch: " + std::to_string(numGraphs_) + "\n"
+                               "maxi-batch-sort: none\n";
+        translateIds(models, inputs, batching);
+      }
+    }
+    LOG(info, "Warmup took {:.2f}s", timer.elapsed());
+  }
 
-          auto search = New<Search>(currentOptions, scorers, trgVocab_);
-          auto histories = search->search(graph, batch);
 
-          for(auto history : histories) {
-            std::stringstream best1;
-            std::stringstream bestn;
-            printer->print(history, best1, bestn);
-            collector->add((long)history->getLineNum(), best1.str(), bestn.str());
-          }
-        };
+  // translateIds() on the graphs of models
+  std::vector<IdTranslation> translateIds(Ptr<const Models> models,
+                                          const std::vector<std::vector<Words>>& inputs,
+                                          const std::string& yamlOverridesStr) {
+    timer::Timer requestTimer;
+    tracing::Scope scope(startTrace());
+    tracing::Span span("translate");
+    Ptr<Options> currentOptions = overrideOptions(yamlOverridesStr);
+    auto forceDecoding = currentOptions->get<bool>("force-decode", false);
+    auto corpus_ = New<data::TextInput>(inputs, forceDecoding ? allVocabs_ : srcVocabs_, currentOptions);
 
-        threadPool_.enqueue(task, batchId);
-        batchId++;
-      }
+    std::vector<IdTranslation> outputs(inputs.empty() ? 0 : inputs.front().size());
+    auto trgEosId = trgVocab_->getEosId();
+    bool withAlignment = currentOptions->hasAndNotEmpty("alignment");
+    auto onFinished = [&](Ptr<data::CorpusBatch> /*batch*/, Ptr<const History> history) {
+      auto result = history->top();
+      auto& output = outputs[history->getLineNum()]; // distinct sentences, no locking needed
+      output.words = std::get<0>(result);
+      if(!output.words.empty() && output.words.back() == trgEosId)
+        output.words.pop_back();
+      output.score = std::get<2>(result);
+      if(withAlignment)
+        output.alignment = std::get<1>(result)->tracebackAlignment();
+    };
+    std::deque<CapturedRequest::Batch> batches;
+    decode(models, corpus_, currentOptions, std::chrono::steady_clock::time_point::max(), /*skip=*/nullptr, onFinished,
+           capture_ ? &batches : nullptr);
+    if(capture_ && capture_->isSlow(requestTimer.elapsed()))
+      captureRequest(requestTimer.elapsed(), yamlOverridesStr, /*input=*/"", inputs, batches);
+    return outputs;
+  }
+
+  // A new trace if the request is sampled and not already traced by the caller
+  Ptr<tracing::Trace> startTrace() const {
+    return tracer_ && !tracing::active() ? tracer_->startTrace("request") : nullptr;
+  }
+
+  void captureRequest(double seconds,
+                      const std::string& yamlOverridesStr,
+                      const std::string& input,
+                      const std::vector<std::vector<Words>>& ids,
+                      const std::deque<CapturedRequest::Batch>& batches) {
+    CapturedRequest request;
+    request.seconds = seconds;
+    request.overrides = yamlOverridesStr;
+    request.shortlist = options_->get<std::vector<std::string>>("shortlist", {});
+    request.input = input;
+    request.ids = ids;
+    request.batches.assign(batches.begin(), batches.end());
+    capture_->write(request);
+  }
+
+  Ptr<Options> overrideOptions(const std::string& yamlOverridesStr) const {
+    YAML::Node configOverrides = YAML::Load(yamlOverridesStr);
+
+    auto currentOptions = New<Options>(options_->clone());
+    if (!configOverrides.IsNull()) {
+      LOG(info,  "Overriding options:\n {}", configOverrides);
+      currentOptions->merge(configOverrides, /*overwrite=*/true);
+    }
+    return currentOptions;
+  }
+
+  // Decodes all sentences of corpus on the persistent workers, returns once all are finished.
+  // Samples for which skip returns true are not decoded, neither are batches that would start after
+  // the deadline. onFinished is called concurrently from the workers as soon as a sentence is finished.
+  // With captured, the sentences and search time of every batch are added to it. The batches run on the graphs of
+  // models, which the workers hold until they are finished.
+  void decode(Ptr<const Models> models,
+              Ptr<data::TextInput> corpus,
+              Ptr<Options> currentOptions,
+              std::chrono::steady_clock::time_point deadline,
+              std::function<bool(const data::SentenceTuple&)> skip,
+              std::function<void(Ptr<data::CorpusBatch>, Ptr<const History>)> onFinished,
+              std::deque<CapturedRequest::Batch>* captured = nullptr) {
+    data::BatchGenerator<data::TextInput> batchGenerator(corpus, currentOptions, nullptr, /*runAsync=*/false);
+    if(skip)
+      batchGenerator.setSkipFilter(skip);
+    {
+      tracing::Span span("batch_formation");
+      batchGenerator.prepare();
     }
+    auto context = tracing::current(); // the workers add the spans of their batches to the trace of this call
+
+    TaskBarrier taskBarrier; // waits for all batches of this call, the workers stay alive
+    auto miniBatchWords = currentOptions->get<size_t>("mini-batch-words", 0);
+    auto miniBatch = currentOptions->get<size_t>("mini-batch", 1);
+    size_t batchId = 0;
+    for(auto batch : batchGenerator) {
+      auto enqueued = tracing::Clock::now();
+      CapturedRequest::Batch* capturedBatch = nullptr; // a deque keeps its elements in place while it grows
+      if(captured) {
+        captured->push_back({batch->getSentenceIds(), batch->words(), 0.});
+        capturedBatch = &captured->back();
+      }
+      auto task = [=, &onFinished](size_t /*id*/) {
+        thread_local bool bound = false;
+        thread_local size_t graphId;
+
+        if(!bound) {
+          graphId = nextGraphId_++ % numGraphs_;
+          bound = true;
+        }
+        auto graph = models->graphs[graphId];
+        const auto& scorers = models->scorers[graphId];
+
+        if(std::chrono::steady_clock::now() > deadline) {
+          LOG(warn, "Dropping batch of {} sentences, the deadline of its request has passed", batch->size());
+          return;
+        }
+
+        tracing::Scope scope(context);
+        tracing::record("queue_wait", enqueued, tracing::Clock::now());
+        tracing::Span span("search");
+        span.set("sentences", batch->size());
+        span.set("words", batch->words());
+
+        timer::Timer timer;
+        auto search = New<Search>(currentOptions, scorers, trgVocab_);
+        search->setTerminology(terminology_);
+        search->setFinishedCallback([&](Ptr<const History> history) { onFinished(batch, history); });
+        auto histories = search->search(graph, batch);
+        updateWorkspaceStatistics(graphId, graph);
+        if(capturedBatch)
+          capturedBatch->seconds = timer.elapsed();
+
+        if(batchesMetric_) {
+          decodeSecondsMetric_->inc(timer.elapsed());
+          batchesMetric_->inc();
+          sentencesMetric_->inc((double)batch->size());
+          srcWordsMetric_->inc((double)batch->words());
+          size_t trgWords = 0;
+          for(const auto& history : histories)
+            trgWords += std::get<0>(history->top()).size();
+          trgWordsMetric_->inc((double)trgWords);
+          batchFillMetric_->observe(miniBatchWords > 0 ? (double)batch->words() / miniBatchWords
+                                                       : (double)batch->size() / miniBatch);
+          // the workspace of a graph only grows, its size is the high-water mark
+          size_t workspace = graph->allocator()->size(), highWater = workspaceHighWater_;
+          while(workspace > highWater && !workspaceHighWater_.compare_exchange_weak(highWater, workspace)) {}
+        }
+      };
 
-    auto translations = collector->collect(currentOptions->get<bool>("n-best"));
-    return utils::join(translations, "\n");
+      taskBarrier.push_back(threadPool_->enqueue(task, batchId));
+      batchId++;
+    }
   }
 
-private:
   // Converts a multi-line input with tab-separated source(s) and target sentences into separate lists
   // of sentences from source(s) and target sides, e.g.
   // "src1 \t trg1 \n src2 \t trg2" -> ["src1 \n src2", "trg1 \n trg2"]